@@ -41,6 +41,7 @@
 #include "irq.h"
 #include "lpc.h"
 #include "monitor.h"
+#include "pioreg.h"
 
 static pthread_mutex_t pm_lock = PTHREAD_MUTEX_INITIALIZER;
 static struct mevent *power_button;
@@ -133,6 +134,21 @@ static uint16_t pm1_enable, pm1_status;
  */
 static uint16_t pm1_control;
 
+/*
+ * The reads of the PM1 registers are served by the hypervisor from
+ * these, which are updated along with the registers. The writes have side
+ * effects and still come here.
+ */
+static struct acrn_pio_reg *pm1_status_reg, *pm1_enable_reg, *pm1_control_reg;
+
+/*
+ * General Purpose Event 0 Registers
+ *
+ * The GPEs are raised by the device model, only the CPU hotplug one so far.
+ * ACPICA accesses the registers a byte at a time.
+ */
+static uint16_t gpe0_status, gpe0_enable;
+
 static void
 sci_update(struct vmctx *ctx)
 {
@@ -157,6 +173,8 @@ sci_update(struct vmctx *ctx)
 		need_sci = 1;
 	if ((pm1_enable & PM1_RTC_EN) && (pm1_status & PM1_RTC_STS))
 		need_sci = 1;
+	if (gpe0_enable & gpe0_status)
+		need_sci = 1;
 	if (need_sci)
 		sci_assert(ctx);
 	else
@@ -180,6 +198,7 @@ pm1_status_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 		 */
 		pm1_status &= ~(*eax & (PM1_WAK_STS | PM1_RTC_STS |
 		    PM1_SLPBTN_STS | PM1_PWRBTN_STS | PM1_BM_STS));
+		pioreg_set(pm1_status_reg, pm1_status);
 		sci_update(ctx);
 	}
 	pthread_mutex_unlock(&pm_lock);
@@ -194,6 +213,7 @@ pm_backto_wakeup(struct vmctx *ctx)
 	 * set when system trasition to the working state
 	 */
 	pm1_status |= PM1_WAK_STS;
+	pioreg_set(pm1_status_reg, pm1_status);
 }
 
 static int
@@ -213,6 +233,7 @@ pm1_enable_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 		 * can't set GBL_EN.
 		 */
 		pm1_enable = *eax & (PM1_RTC_EN | PM1_PWRBTN_EN | PM1_GBL_EN);
+		pioreg_set(pm1_enable_reg, pm1_enable);
 		sci_update(ctx);
 	}
 	pthread_mutex_unlock(&pm_lock);
@@ -229,6 +250,7 @@ inject_power_button_event(struct vmctx *ctx)
 	pthread_mutex_lock(&pm_lock);
 	if (!(pm1_status & PM1_PWRBTN_STS)) {
 		pm1_status |= PM1_PWRBTN_STS;
+		pioreg_set(pm1_status_reg, pm1_status);
 		sci_update(ctx);
 	}
 	pthread_mutex_unlock(&pm_lock);
@@ -257,6 +279,7 @@ pm1_control_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 		 */
 		pm1_control = (pm1_control & VIRTUAL_PM1A_SCI_EN) |
 		    (*eax & ~(VIRTUAL_PM1A_SLP_EN | VIRTUAL_PM1A_ALWAYS_ZERO));
+		pioreg_set(pm1_control_reg, pm1_control);
 
 		/*
 		 * If SLP_EN is set, check for S5.  ACRN-DM's _S5_ method
@@ -293,6 +316,7 @@ smi_cmd_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 	switch (*eax & 0xFF) {
 	case ACPI_ENABLE:
 		pm1_control |= VIRTUAL_PM1A_SCI_EN;
+		pioreg_set(pm1_control_reg, pm1_control);
 		/*
 		 * FIXME: ACPI_ENABLE/ACPI_DISABLE only impacts SCI_EN via SMI
 		 * command register, not impact power button emulation. so need
@@ -313,6 +337,7 @@ smi_cmd_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 		break;
 	case ACPI_DISABLE:
 		pm1_control &= ~VIRTUAL_PM1A_SCI_EN;
+		pioreg_set(pm1_control_reg, pm1_control);
 		if (power_button != NULL) {
 			mevent_delete(power_button);
 			power_button = NULL;
@@ -326,6 +351,53 @@ smi_cmd_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 INOUT_PORT(smi_cmd, SMI_CMD, IOPORT_F_OUT, smi_cmd_handler);
 SYSRES_IO(SMI_CMD, 1);
 
+static int
+gpe0_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
+	     uint32_t *eax, void *arg)
+{
+	uint16_t *reg, mask;
+	int shift;
+
+	if ((bytes != 1 && bytes != 2) ||
+	    ((port - GPE0_BLK_ADDR) % 2) + bytes > 2)
+		return -1;
+
+	reg = (port - GPE0_BLK_ADDR < GPE0_BLK_LEN / 2) ? &gpe0_status :
+	    &gpe0_enable;
+	shift = ((port - GPE0_BLK_ADDR) % 2) * 8;
+	mask = ((bytes == 1) ? 0xff : 0xffff) << shift;
+
+	pthread_mutex_lock(&pm_lock);
+	if (in)
+		*eax = (*reg & mask) >> shift;
+	else {
+		/* the status bits are cleared by writing 1 to them */
+		if (reg == &gpe0_status)
+			gpe0_status &= ~((*eax << shift) & mask);
+		else
+			gpe0_enable = (gpe0_enable & ~mask) |
+			    ((*eax << shift) & mask);
+		sci_update(ctx);
+	}
+	pthread_mutex_unlock(&pm_lock);
+
+	return 0;
+}
+INOUT_PORT(gpe0_sts_lo, GPE0_BLK_ADDR, IOPORT_F_INOUT, gpe0_handler);
+INOUT_PORT(gpe0_sts_hi, GPE0_BLK_ADDR + 1, IOPORT_F_INOUT, gpe0_handler);
+INOUT_PORT(gpe0_en_lo, GPE0_BLK_ADDR + 2, IOPORT_F_INOUT, gpe0_handler);
+INOUT_PORT(gpe0_en_hi, GPE0_BLK_ADDR + 3, IOPORT_F_INOUT, gpe0_handler);
+SYSRES_IO(GPE0_BLK_ADDR, GPE0_BLK_LEN);
+
+void
+gpe_raise(struct vmctx *ctx, int gpe)
+{
+	pthread_mutex_lock(&pm_lock);
+	gpe0_status |= 1 << gpe;
+	sci_update(ctx);
+	pthread_mutex_unlock(&pm_lock);
+}
+
 void
 sci_init(struct vmctx *ctx)
 {
@@ -334,4 +406,11 @@ sci_init(struct vmctx *ctx)
 	 * in the PIRQ router.
 	 */
 	pci_irq_use(SCI_INT);
+
+	pm1_status_reg = pioreg_add(PM1A_EVT_ADDR, 2,
+			ACRN_PIO_REG_FLAG_READ, pm1_status, 0);
+	pm1_enable_reg = pioreg_add(PM1A_EVT_ADDR + 2, 2,
+			ACRN_PIO_REG_FLAG_READ, pm1_enable, 0);
+	pm1_control_reg = pioreg_add(VIRTUAL_PM1A_CNT_ADDR, 2,
+			ACRN_PIO_REG_FLAG_READ, pm1_control, 0);
 }
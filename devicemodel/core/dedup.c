@@ -0,0 +1,363 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dm.h"
+#include "vmmapi.h"
+#include "log.h"
+#include "snapshot.h"
+#include "dedup.h"
+
+#define DEDUP_MAX_REGIONS	8
+#define DEDUP_PAGE_SHIFT	12
+#define DEDUP_PAGE_SIZE		(1UL << DEDUP_PAGE_SHIFT)
+#define DEDUP_CHUNK_PAGES	512UL		/* 2M */
+
+#define DEDUP_MIN_INTERVAL	10
+
+struct dedup_hashes {
+	uint64_t *pages;
+	uint64_t *chunks;
+	size_t npages;
+	size_t nchunks;
+};
+
+static int dedup_interval;
+static pthread_t dedup_tid;
+static bool dedup_running;
+static bool dedup_stop;
+static pthread_mutex_t dedup_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dedup_cond = PTHREAD_COND_INITIALIZER;
+static char dedup_path[PATH_MAX];
+static uint64_t zero_page_hash;
+static uint64_t zero_chunk_hash;
+
+int
+dedup_parse_interval(const char *arg)
+{
+	char *end;
+	long val;
+
+	val = strtol(arg, &end, 10);
+	if (*end != '\0' || val < DEDUP_MIN_INTERVAL || val > INT_MAX)
+		return -1;
+
+	dedup_interval = val;
+	return 0;
+}
+
+static int
+dedup_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x < y) ? -1 : (x > y);
+}
+
+static uint64_t
+dedup_chunk_hash(const uint64_t *page_hashes)
+{
+	uint64_t h = 0xcbf29ce484222325UL;
+	size_t i;
+
+	for (i = 0; i < DEDUP_CHUNK_PAGES; i++)
+		h = (h ^ page_hashes[i]) * 0x100000001b3UL;
+
+	return h;
+}
+
+/*
+ * Zero page and chunk hashes left out, the others sorted. The pages given
+ * back by the balloon are not resident, they are skipped rather than
+ * faulted in again.
+ */
+static int
+dedup_hash_memory(struct dedup_hashes *own, size_t *zero_pages,
+	size_t *zero_chunks)
+{
+	struct hugetlb_region regions[DEDUP_MAX_REGIONS];
+	uint64_t *hashes;
+	unsigned char *resident;
+	size_t total = 0, page, npages, i;
+	bool whole;
+	int n, r;
+
+	n = hugetlb_get_regions(regions, DEDUP_MAX_REGIONS);
+	if (n <= 0)
+		return -1;
+	for (r = 0; r < n; r++)
+		total += regions[r].len >> DEDUP_PAGE_SHIFT;
+
+	hashes = malloc(total * sizeof(uint64_t));
+	resident = malloc(total);
+	own->pages = malloc(total * sizeof(uint64_t));
+	own->chunks = malloc((total / DEDUP_CHUNK_PAGES + 1) * sizeof(uint64_t));
+	if (hashes == NULL || resident == NULL || own->pages == NULL ||
+	    own->chunks == NULL) {
+		free(hashes);
+		free(resident);
+		return -1;
+	}
+
+	own->npages = own->nchunks = 0;
+	*zero_pages = *zero_chunks = 0;
+	for (r = 0; r < n; r++) {
+		npages = regions[r].len >> DEDUP_PAGE_SHIFT;
+		if (mincore(regions[r].hva, regions[r].len, resident) < 0)
+			memset(resident, 1, npages);
+		for (page = 0; page < npages; page++) {
+			if ((resident[page] & 1) != 0)
+				hashes[page] = snapshot_page_hash((const char *)
+					regions[r].hva + (page << DEDUP_PAGE_SHIFT));
+		}
+
+		for (page = 0; page + DEDUP_CHUNK_PAGES <= npages;
+				page += DEDUP_CHUNK_PAGES) {
+			whole = true;
+			for (i = page; i < page + DEDUP_CHUNK_PAGES; i++)
+				whole = whole && ((resident[i] & 1) != 0);
+			if (!whole)
+				continue;
+			own->chunks[own->nchunks] = dedup_chunk_hash(&hashes[page]);
+			if (own->chunks[own->nchunks] == zero_chunk_hash)
+				(*zero_chunks)++;
+			else
+				own->nchunks++;
+		}
+
+		for (i = 0; i < npages; i++) {
+			if ((resident[i] & 1) == 0)
+				continue;
+			if (hashes[i] == zero_page_hash)
+				(*zero_pages)++;
+			else
+				own->pages[own->npages++] = hashes[i];
+		}
+	}
+	free(hashes);
+	free(resident);
+
+	qsort(own->pages, own->npages, sizeof(uint64_t), dedup_cmp);
+	qsort(own->chunks, own->nchunks, sizeof(uint64_t), dedup_cmp);
+	return 0;
+}
+
+/* duplicates of sorted hashes, removed in place */
+static size_t
+dedup_uniq(uint64_t *hashes, size_t *n)
+{
+	size_t i, j = 0;
+
+	for (i = 0; i < *n; i++) {
+		if (j == 0 || hashes[j - 1] != hashes[i])
+			hashes[j++] = hashes[i];
+	}
+
+	i = *n - j;
+	*n = j;
+	return i;
+}
+
+/* hashes found in both sorted arrays */
+static size_t
+dedup_common(const uint64_t *a, size_t na, const uint64_t *b, size_t nb)
+{
+	size_t i = 0, j = 0, n = 0;
+
+	while (i < na && j < nb) {
+		if (a[i] < b[j]) {
+			i++;
+		} else if (a[i] > b[j]) {
+			j++;
+		} else {
+			n++;
+			i++;
+			j++;
+		}
+	}
+
+	return n;
+}
+
+static void
+dedup_publish(const struct dedup_hashes *own)
+{
+	struct dedup_header hdr;
+	char tmp[PATH_MAX + 4];
+	FILE *fp;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", dedup_path);
+	fp = fopen(tmp, "w");
+	if (fp == NULL)
+		return;
+
+	hdr.magic = DEDUP_MAGIC;
+	hdr.npages = own->npages;
+	hdr.nchunks = own->nchunks;
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    fwrite(own->pages, sizeof(uint64_t), own->npages, fp) != own->npages ||
+	    fwrite(own->chunks, sizeof(uint64_t), own->nchunks, fp) != own->nchunks) {
+		fclose(fp);
+		unlink(tmp);
+		return;
+	}
+	fclose(fp);
+
+	/* readers see the old or the new hashes, never a partial file */
+	if (rename(tmp, dedup_path) < 0)
+		unlink(tmp);
+}
+
+/* compare with the hashes the other VMs published */
+static void
+dedup_compare(const struct dedup_hashes *own)
+{
+	struct dedup_header hdr;
+	uint64_t *other;
+	glob_t files;
+	size_t i, n;
+	FILE *fp;
+
+	if (glob(DEDUP_PATH_GLOB, 0, NULL, &files) != 0)
+		return;
+
+	for (i = 0; i < files.gl_pathc; i++) {
+		n = strlen(files.gl_pathv[i]);
+		if (strcmp(files.gl_pathv[i], dedup_path) == 0 ||
+		    (n > 4 && strcmp(files.gl_pathv[i] + n - 4, ".tmp") == 0))
+			continue;
+		fp = fopen(files.gl_pathv[i], "r");
+		if (fp == NULL)
+			continue;
+
+		other = NULL;
+		if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+		    hdr.magic != DEDUP_MAGIC ||
+		    hdr.npages > SIZE_MAX / sizeof(uint64_t) - hdr.nchunks)
+			goto next;
+		n = hdr.npages + hdr.nchunks;
+		other = malloc(n * sizeof(uint64_t));
+		if (other == NULL ||
+		    fread(other, sizeof(uint64_t), n, fp) != n)
+			goto next;
+
+		pr_notice("dedup: %zu pages, %zu 2M chunks identical with %s\n",
+			dedup_common(own->pages, own->npages, other, hdr.npages),
+			dedup_common(own->chunks, own->nchunks,
+				other + hdr.npages, hdr.nchunks),
+			files.gl_pathv[i] + strlen(DEDUP_PATH_GLOB) - 1);
+next:
+		free(other);
+		fclose(fp);
+	}
+
+	globfree(&files);
+}
+
+static void
+dedup_scan(void)
+{
+	struct dedup_hashes own = { NULL, NULL, 0, 0 };
+	size_t npages, zero_pages, zero_chunks, dup_pages, dup_chunks;
+
+	if (dedup_hash_memory(&own, &zero_pages, &zero_chunks) < 0) {
+		pr_err("dedup: cannot hash the guest memory\n");
+		goto end;
+	}
+
+	npages = own.npages + zero_pages;
+	dup_pages = dedup_uniq(own.pages, &own.npages);
+	dup_chunks = dedup_uniq(own.chunks, &own.nchunks);
+	pr_notice("dedup: %zu pages, %zu zero, %zu duplicate; %zu 2M chunks zero, "
+		"%zu duplicate\n", npages, zero_pages, dup_pages, zero_chunks,
+		dup_chunks);
+
+	dedup_publish(&own);
+	dedup_compare(&own);
+end:
+	free(own.pages);
+	free(own.chunks);
+}
+
+static void *
+dedup_scan_thread(void *arg)
+{
+	struct timespec ts;
+
+	pthread_mutex_lock(&dedup_mtx);
+	while (!dedup_stop) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += dedup_interval;
+		pthread_cond_timedwait(&dedup_cond, &dedup_mtx, &ts);
+		if (dedup_stop)
+			break;
+
+		pthread_mutex_unlock(&dedup_mtx);
+		dedup_scan();
+		pthread_mutex_lock(&dedup_mtx);
+	}
+	pthread_mutex_unlock(&dedup_mtx);
+
+	return NULL;
+}
+
+void
+dedup_scan_init(struct vmctx *ctx)
+{
+	uint64_t hashes[DEDUP_CHUNK_PAGES];
+	void *zero;
+	size_t i;
+
+	if (dedup_interval == 0 || dedup_running)
+		return;
+
+	zero = calloc(1, DEDUP_PAGE_SIZE);
+	if (zero == NULL)
+		return;
+	zero_page_hash = snapshot_page_hash(zero);
+	free(zero);
+	for (i = 0; i < DEDUP_CHUNK_PAGES; i++)
+		hashes[i] = zero_page_hash;
+	zero_chunk_hash = dedup_chunk_hash(hashes);
+
+	snprintf(dedup_path, sizeof(dedup_path), DEDUP_PATH, vmname);
+	dedup_stop = false;
+	if (pthread_create(&dedup_tid, NULL, dedup_scan_thread, NULL) != 0) {
+		pr_err("dedup: cannot create the scanner thread\n");
+		return;
+	}
+	pthread_setname_np(dedup_tid, "dedup_scan");
+	dedup_running = true;
+}
+
+void
+dedup_scan_deinit(void)
+{
+	if (!dedup_running)
+		return;
+
+	pthread_mutex_lock(&dedup_mtx);
+	dedup_stop = true;
+	pthread_cond_signal(&dedup_cond);
+	pthread_mutex_unlock(&dedup_mtx);
+	pthread_join(dedup_tid, NULL);
+
+	unlink(dedup_path);
+	dedup_running = false;
+}
@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include <sys/mman.h>
+#include <sys/queue.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dm.h"
+#include "mevent.h"
+#include "timer.h"
+#include "log.h"
+#include "dm_stats.h"
+
+struct dm_stats_entry {
+	enum dm_stats_type	type;
+	char			name[DM_STATS_NAME_LEN];
+	void			*owner;
+	dm_stats_collect_t	collect;
+	void			*arg;
+	TAILQ_ENTRY(dm_stats_entry) link;
+};
+
+static TAILQ_HEAD(, dm_stats_entry) dm_stats_entries =
+	TAILQ_HEAD_INITIALIZER(dm_stats_entries);
+static pthread_mutex_t dm_stats_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+static struct dm_stats_region *dm_stats;
+/* the counters are collected here, the region is only written under seq */
+static struct dm_stats_region dm_stats_snap;
+static struct acrn_timer dm_stats_timer;
+static char dm_stats_path[PATH_MAX];
+
+int
+dm_stats_register(enum dm_stats_type type, const char *name, void *owner,
+		dm_stats_collect_t collect, void *arg)
+{
+	struct dm_stats_entry *e;
+
+	e = calloc(1, sizeof(*e));
+	if (e == NULL)
+		return -1;
+
+	e->type = type;
+	snprintf(e->name, sizeof(e->name), "%s", name);
+	e->owner = owner;
+	e->collect = collect;
+	e->arg = arg;
+
+	pthread_mutex_lock(&dm_stats_mtx);
+	TAILQ_INSERT_TAIL(&dm_stats_entries, e, link);
+	pthread_mutex_unlock(&dm_stats_mtx);
+	return 0;
+}
+
+void
+dm_stats_unregister(void *owner)
+{
+	struct dm_stats_entry *e, *tmp;
+
+	pthread_mutex_lock(&dm_stats_mtx);
+	for (e = TAILQ_FIRST(&dm_stats_entries); e != NULL; e = tmp) {
+		tmp = TAILQ_NEXT(e, link);
+		if (e->owner == owner) {
+			TAILQ_REMOVE(&dm_stats_entries, e, link);
+			free(e);
+		}
+	}
+	pthread_mutex_unlock(&dm_stats_mtx);
+}
+
+static void
+dm_stats_collect(struct dm_stats_region *snap)
+{
+	struct dm_stats_entry *e;
+	struct dm_stats_vq *vq;
+	struct dm_stats_blk *blk;
+
+	ioreq_get_stats(snap->ioreq.reqs, &snap->ioreq.rounds);
+	mevent_get_stats(&snap->mevent.wakeups, &snap->mevent.events);
+
+	snap->nvq = 0;
+	snap->nblk = 0;
+	pthread_mutex_lock(&dm_stats_mtx);
+	TAILQ_FOREACH(e, &dm_stats_entries, link) {
+		if (e->type == DM_STATS_TYPE_VQ && snap->nvq < DM_STATS_MAX_VQ) {
+			vq = &snap->vq[snap->nvq++];
+			memset(vq, 0, sizeof(*vq));
+			memcpy(vq->name, e->name, sizeof(vq->name));
+			(*e->collect)(e->arg, vq);
+		} else if (e->type == DM_STATS_TYPE_BLK &&
+				snap->nblk < DM_STATS_MAX_BLK) {
+			blk = &snap->blk[snap->nblk++];
+			memset(blk, 0, sizeof(*blk));
+			memcpy(blk->name, e->name, sizeof(blk->name));
+			(*e->collect)(e->arg, blk);
+		}
+	}
+	pthread_mutex_unlock(&dm_stats_mtx);
+}
+
+static void
+dm_stats_update(void *arg, uint64_t nexp)
+{
+	struct dm_stats_region *r = dm_stats;
+	struct dm_stats_region *snap = &dm_stats_snap;
+	struct timespec now;
+	uint32_t seq;
+
+	if (r == NULL)
+		return;
+
+	dm_stats_collect(snap);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	/* the readers retry while seq is odd or has moved */
+	seq = r->seq;
+	__atomic_store_n(&r->seq, seq + 1U, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	r->update_ns = now.tv_sec * NS_PER_SEC + now.tv_nsec;
+	r->updates++;
+	r->ioreq = snap->ioreq;
+	r->mevent = snap->mevent;
+	r->nvq = snap->nvq;
+	r->nblk = snap->nblk;
+	memcpy(r->vq, snap->vq, snap->nvq * sizeof(r->vq[0]));
+	memcpy(r->blk, snap->blk, snap->nblk * sizeof(r->blk[0]));
+
+	__atomic_store_n(&r->seq, seq + 2U, __ATOMIC_RELEASE);
+}
+
+void
+dm_stats_init(void)
+{
+	struct dm_stats_region *r;
+	struct itimerspec ts;
+	int fd;
+
+	snprintf(dm_stats_path, sizeof(dm_stats_path), DM_STATS_PATH, vmname);
+	fd = open(dm_stats_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		pr_info("dm stats: cannot create %s, errno %d\n",
+				dm_stats_path, errno);
+		return;
+	}
+	if (ftruncate(fd, sizeof(*r)) < 0) {
+		pr_info("dm stats: cannot size %s, errno %d\n",
+				dm_stats_path, errno);
+		goto fail;
+	}
+	r = mmap(NULL, sizeof(*r), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (r == MAP_FAILED) {
+		pr_info("dm stats: cannot map %s, errno %d\n",
+				dm_stats_path, errno);
+		goto fail;
+	}
+	close(fd);
+
+	r->version = DM_STATS_VERSION;
+	r->size = sizeof(*r);
+	r->pid = getpid();
+	r->interval_ms = DM_STATS_INTERVAL_MS;
+	/* the magic goes last, the readers take the region once it is set */
+	__atomic_store_n(&r->magic, DM_STATS_MAGIC, __ATOMIC_RELEASE);
+
+	dm_stats_timer.clockid = CLOCK_MONOTONIC;
+	if (acrn_timer_init(&dm_stats_timer, dm_stats_update, NULL) != 0) {
+		pr_info("dm stats: cannot create the update timer\n");
+		munmap(r, sizeof(*r));
+		unlink(dm_stats_path);
+		return;
+	}
+	ts.it_value.tv_sec = DM_STATS_INTERVAL_MS / 1000U;
+	ts.it_value.tv_nsec = (DM_STATS_INTERVAL_MS % 1000U) * 1000000U;
+	ts.it_interval = ts.it_value;
+	dm_stats = r;
+	acrn_timer_settime(&dm_stats_timer, &ts);
+	return;
+
+fail:
+	close(fd);
+	unlink(dm_stats_path);
+}
+
+void
+dm_stats_deinit(void)
+{
+	if (dm_stats == NULL)
+		return;
+
+	acrn_timer_deinit(&dm_stats_timer);
+	munmap(dm_stats, sizeof(*dm_stats));
+	unlink(dm_stats_path);
+	dm_stats = NULL;
+}
@@ -34,10 +34,17 @@
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/syscall.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <linux/falloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 
 #include "vmmapi.h"
+#include "dm_string.h"
+#include "monitor.h"
 
 extern char *vmname;
 
@@ -49,6 +56,10 @@ extern char *vmname;
 
 #define HUGETLBFS_MAGIC       0x958458f6
 
+/* the hugepage pool of acrnd, see ACRN_HUGETLB_POOL_LV1/2 of acrn_mngr.h */
+#define PATH_HUGETLB_POOL_LV1	"/run/hugepage/acrn/pool_lv1/"
+#define PATH_HUGETLB_POOL_LV2	"/run/hugepage/acrn/pool_lv2/"
+
 /* HugePage Level 1 for 2M page, Level 2 for 1G page*/
 #define PATH_HUGETLB_LV1 "/run/hugepage/acrn/huge_lv1/"
 #define OPT_HUGETLB_LV1 "pagesize=2M"
@@ -65,6 +76,7 @@ extern char *vmname;
  * - mount_path: hugetlbfs mount path
  * - mount_opt: hugetlb mount option
  * - node_path: record for hugetlbfs node path
+ * - pool_path: mount path of the acrnd hugepage pool of this page size
  * - pg_size: this hugetlbfs's page size
  * - lowmem: lowmem of this hugetlbfs need allocate
  * - highmem: highmem of this hugetlbfs need allocate
@@ -79,6 +91,7 @@ struct hugetlb_info {
 	char *mount_opt;
 
 	char node_path[MAX_PATH_LEN];
+	char *pool_path;
 	int fd;
 	int pg_size;
 	size_t lowmem;
@@ -95,6 +108,7 @@ static struct hugetlb_info hugetlb_priv[HUGETLB_LV_MAX] = {
 		.mounted = false,
 		.mount_path = PATH_HUGETLB_LV1,
 		.mount_opt = OPT_HUGETLB_LV1,
+		.pool_path = PATH_HUGETLB_POOL_LV1,
 		.fd = -1,
 		.pg_size = 0,
 		.lowmem = 0,
@@ -109,6 +123,7 @@ static struct hugetlb_info hugetlb_priv[HUGETLB_LV_MAX] = {
 		.mounted = false,
 		.mount_path = PATH_HUGETLB_LV2,
 		.mount_opt = OPT_HUGETLB_LV2,
+		.pool_path = PATH_HUGETLB_POOL_LV2,
 		.fd = -1,
 		.pg_size = 0,
 		.lowmem = 0,
@@ -125,6 +140,47 @@ static void *ptr;
 static size_t total_size;
 static int hugetlb_lv_max;
 
+/* lowmem, highmem and biosmem may each be split over all the levels */
+#define MAX_REGIONS	(3 * HUGETLB_LV_MAX)
+
+static struct hugetlb_region regions[MAX_REGIONS];
+static size_t region_pgsz[MAX_REGIONS];
+static int nregions;
+
+/* prefault threads, and the NUMA node of the guest memory if any */
+#define PREFAULT_MAX_THREADS	64
+#define PATH_NODE_CPULIST	"/sys/devices/system/node/node%d/cpulist"
+
+#ifndef MPOL_BIND
+#define MPOL_BIND		2
+#endif
+
+static int numa_node = -1;
+static size_t prefault_next;	/* next page to touch, over all the regions */
+static size_t prefault_pages;
+
+/*
+ * The memfd backend: the guest memory of a sealed memfd, backed by the
+ * transparent hugepages of shmem, which needs no hugepage reserved.
+ */
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC		0x0001U
+#define MFD_ALLOW_SEALING	0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS		(1024 + 9)
+#define F_SEAL_SEAL		0x0001
+#define F_SEAL_SHRINK		0x0002
+#define F_SEAL_GROW		0x0004
+#endif
+
+#define MEMFD_PG_SIZE		(2 * MB)
+#define SYS_SHMEM_THP		"/sys/kernel/mm/transparent_hugepage/shmem_enabled"
+
+static bool memfd_backend;
+static bool memfd_mlock;
+static int memfd_fd = -1;
+
 static int open_hugetlbfs(struct vmctx *ctx, int level)
 {
 	char uuid_str[48];
@@ -203,6 +259,69 @@ static void close_hugetlbfs(int level)
 	}
 }
 
+/*
+ * Take the memory from the hugepage pool of acrnd if there is one: the
+ * pool files of the UOS replace the ones opened by open_hugetlbfs(), and
+ * are unlinked by close_hugetlbfs() the same, which gives the pages back
+ * to the pool. Nothing is changed on failure, the caller then reserves
+ * the pages the usual way.
+ */
+static bool hugetlb_from_pool(void)
+{
+	unsigned int pages[HUGETLB_LV_MAX] = { 0 };
+	char path[HUGETLB_LV_MAX][MAX_PATH_LEN];
+	int fd[HUGETLB_LV_MAX];
+	struct hugetlb_info *htlb;
+	struct statfs fs;
+	int level;
+
+	for (level = HUGETLB_LV1; level < hugetlb_lv_max; level++) {
+		htlb = &hugetlb_priv[level];
+		pages[level] = (htlb->lowmem + htlb->biosmem + htlb->highmem) /
+			htlb->pg_size;
+		snprintf(path[level], MAX_PATH_LEN, "%s%s", htlb->pool_path,
+			vmname);
+		fd[level] = -1;
+	}
+
+	if (acrnd_get_hugepages(pages, hugetlb_lv_max) != 0)
+		return false;
+
+	for (level = HUGETLB_LV1; level < hugetlb_lv_max; level++) {
+		if (pages[level] == 0)
+			continue;
+
+		fd[level] = open(path[level], O_RDWR);
+		if (fd[level] < 0 || fstatfs(fd[level], &fs) != 0 ||
+			fs.f_type != HUGETLBFS_MAGIC ||
+			fs.f_bsize != hugetlb_priv[level].pg_size)
+			goto err;
+	}
+
+	for (level = HUGETLB_LV1; level < hugetlb_lv_max; level++) {
+		if (fd[level] < 0)
+			continue;
+		htlb = &hugetlb_priv[level];
+		close(htlb->fd);
+		unlink(htlb->node_path);
+		htlb->fd = fd[level];
+		strncpy(htlb->node_path, path[level], MAX_PATH_LEN);
+	}
+
+	printf("hugepages from the acrnd pool\n");
+	return true;
+
+err:
+	for (level = HUGETLB_LV1; level < hugetlb_lv_max; level++) {
+		if (pages[level] == 0)
+			continue;
+		if (fd[level] >= 0)
+			close(fd[level]);
+		unlink(path[level]);
+	}
+	return false;
+}
+
 static bool should_enable_hugetlb_level(int level)
 {
 	if (level >= HUGETLB_LV_MAX) {
@@ -225,8 +344,7 @@ static int mmap_hugetlbfs_from_level(struct vmctx *ctx, int level, size_t len,
 		size_t offset, size_t skip)
 {
 	char *addr;
-	size_t pagesz = 0;
-	int fd, i;
+	int fd;
 
 	if (level >= HUGETLB_LV_MAX) {
 		perror("exceed max hugetlb level");
@@ -241,16 +359,151 @@ static int mmap_hugetlbfs_from_level(struct vmctx *ctx, int level, size_t len,
 
 	printf("mmap 0x%lx@%p\n", len, addr);
 
-	/* pre-allocate hugepages by touch them */
-	pagesz = hugetlb_priv[level].pg_size;
+	/* recorded to share the guest memory, e.g. with a vhost-user backend */
+	if (nregions < MAX_REGIONS) {
+		regions[nregions].gpa = offset;
+		regions[nregions].len = len;
+		regions[nregions].hva = addr;
+		regions[nregions].fd = fd;
+		regions[nregions].offset = skip;
+		region_pgsz[nregions] = hugetlb_priv[level].pg_size;
+		nregions++;
+	}
+
+	return 0;
+}
+
+/* cpus of the NUMA node from a "0-3,8" sysfs list, -1 on error */
+static int
+numa_node_cpus(int node, cpu_set_t *cpus)
+{
+	char path[MAX_PATH_LEN], buf[1024];
+	char *str, *cp, *end;
+	int lo, hi, ncpu = 0;
+	FILE *fp;
+
+	snprintf(path, MAX_PATH_LEN, PATH_NODE_CPULIST, node);
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return -1;
+	str = fgets(buf, sizeof(buf), fp);
+	fclose(fp);
+	if (str == NULL)
+		return -1;
+
+	CPU_ZERO(cpus);
+	while ((cp = strsep(&str, ",\n")) != NULL) {
+		if (*cp == '\0')
+			continue;
+		lo = hi = strtol(cp, &end, 10);
+		if (*end == '-')
+			hi = strtol(end + 1, NULL, 10);
+		for (; lo <= hi && lo < CPU_SETSIZE; lo++) {
+			CPU_SET(lo, cpus);
+			ncpu++;
+		}
+	}
+
+	return (ncpu > 0) ? ncpu : -1;
+}
+
+/* Place the pages of the regions on the NUMA node, before any is touched */
+static int
+numa_bind_regions(int node)
+{
+	unsigned long nodemask[4] = { 0 };
+	int i;
+
+	if (node >= (int)(sizeof(nodemask) * 8))
+		return -1;
+	nodemask[node / (sizeof(unsigned long) * 8)] =
+		1UL << (node % (sizeof(unsigned long) * 8));
 
-	printf("touch %ld pages with pagesz 0x%lx\n", len/pagesz, pagesz);
+	for (i = 0; i < nregions; i++) {
+		if (syscall(SYS_mbind, regions[i].hva, regions[i].len, MPOL_BIND,
+				nodemask, sizeof(nodemask) * 8, 0) < 0) {
+			printf("mbind to node %d failed: %s\n", node, strerror(errno));
+			return -1;
+		}
+	}
+
+	return 0;
+}
 
-	for (i = 0; i < len/pagesz; i++) {
-		*(volatile char *)addr = *addr;
-		addr += pagesz;
+/* Touch the pages handed out one by one, so the 1G ones spread too */
+static void *
+prefault_worker(void *arg)
+{
+	size_t page, n;
+	int i;
+
+	while ((page = __atomic_fetch_add(&prefault_next, 1, __ATOMIC_RELAXED))
+			< prefault_pages) {
+		for (i = 0; i < nregions; i++) {
+			n = regions[i].len / region_pgsz[i];
+			if (page < n) {
+				*(volatile char *)((char *)regions[i].hva +
+					page * region_pgsz[i]) = 0;
+				break;
+			}
+			page -= n;
+		}
 	}
 
+	return NULL;
+}
+
+/*
+ * Pre-allocate the hugepages of the guest memory by touching them. The
+ * kernel zeroes each page at its first fault, which dominates the launch
+ * time of a large UOS, so the pages are touched from one thread per SOS
+ * cpu, or per cpu of the NUMA node the memory is bound to.
+ */
+static int
+hugetlb_prefault(void)
+{
+	pthread_t tids[PREFAULT_MAX_THREADS];
+	pthread_attr_t attr;
+	cpu_set_t cpus;
+	int i, nthreads, created = 0;
+
+	prefault_pages = 0;
+	for (i = 0; i < nregions; i++)
+		prefault_pages += regions[i].len / region_pgsz[i];
+	prefault_next = 0;
+
+	pthread_attr_init(&attr);
+	if (numa_node >= 0) {
+		nthreads = numa_node_cpus(numa_node, &cpus);
+		if (nthreads < 0 || numa_bind_regions(numa_node) < 0) {
+			printf("can't bind the guest memory to node %d\n", numa_node);
+			pthread_attr_destroy(&attr);
+			return -1;
+		}
+		pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	} else {
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+
+	if (nthreads > PREFAULT_MAX_THREADS)
+		nthreads = PREFAULT_MAX_THREADS;
+	if ((size_t)nthreads > prefault_pages)
+		nthreads = prefault_pages;
+
+	printf("touch %ld pages with %d threads\n", prefault_pages, nthreads);
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&tids[created], &attr, prefault_worker,
+				NULL) == 0)
+			created++;
+	}
+	pthread_attr_destroy(&attr);
+
+	/* whatever is left, e.g. no thread could be created */
+	prefault_worker(NULL);
+	for (i = 0; i < created; i++)
+		pthread_join(tids[i], NULL);
+
 	return 0;
 }
 
@@ -604,10 +857,183 @@ static bool hugetlb_reserve_pages(void)
 }
 
 
+/*
+ * "hugetlb", the default, or "memfd[,mlock]": the memfd backend, with its
+ * pages locked in memory on mlock.
+ */
+int hugetlb_parse_mem_backend(const char *arg)
+{
+	if (strcmp(arg, "hugetlb") == 0) {
+		memfd_backend = false;
+	} else if (strcmp(arg, "memfd") == 0) {
+		memfd_backend = true;
+	} else if (strcmp(arg, "memfd,mlock") == 0) {
+		memfd_backend = true;
+		memfd_mlock = true;
+	} else
+		return -1;
+
+	return 0;
+}
+
+/* shmem gives MADV_HUGEPAGE mappings 2M pages on "always" or "advise" */
+static void memfd_check_thp(void)
+{
+	char buf[128];
+	FILE *fp;
+
+	fp = fopen(SYS_SHMEM_THP, "r");
+	if (fp == NULL)
+		return;
+	if (fgets(buf, sizeof(buf), fp) != NULL &&
+		strstr(buf, "[always]") == NULL &&
+		strstr(buf, "[advise]") == NULL &&
+		strstr(buf, "[force]") == NULL)
+		printf("WARNING: %s is '%s', the guest memory gets 4K pages\n",
+			SYS_SHMEM_THP, strtok(buf, "\n"));
+	fclose(fp);
+}
+
+static int memfd_map_region(struct vmctx *ctx, size_t gpa, size_t len,
+		size_t offset)
+{
+	char *addr;
+
+	if (len == 0)
+		return 0;
+
+	addr = mmap(ctx->baseaddr + gpa, len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_FIXED, memfd_fd, offset);
+	if (addr == MAP_FAILED)
+		return -ENOMEM;
+
+	printf("mmap 0x%lx@%p\n", len, addr);
+
+	if (madvise(addr, len, MADV_HUGEPAGE) < 0)
+		perror("madvise hugepage");
+
+	if (nregions < MAX_REGIONS) {
+		regions[nregions].gpa = gpa;
+		regions[nregions].len = len;
+		regions[nregions].hva = addr;
+		regions[nregions].fd = memfd_fd;
+		regions[nregions].offset = offset;
+		region_pgsz[nregions] = MEMFD_PG_SIZE;
+		nregions++;
+	}
+
+	return 0;
+}
+
+/*
+ * The lowmem, biosmem and highmem one after another in the memfd. Its size
+ * is sealed, the vhost-user backends map it as the hugetlbfs files. The
+ * pages are allocated by hugetlb_prefault() or mlock(), the VHM then maps
+ * the VMAs into the EPT the same way, it pins their pages.
+ */
+static int memfd_setup_memory(struct vmctx *ctx)
+{
+	size_t size;
+	int i;
+
+	if (ctx->lowmem == 0) {
+		perror("vm requests 0 memory");
+		return -ENOMEM;
+	}
+
+	ctx->lowmem = ALIGN_DOWN(ctx->lowmem, MEMFD_PG_SIZE);
+	ctx->biosmem = ALIGN_DOWN(ctx->biosmem, MEMFD_PG_SIZE);
+	ctx->highmem = ALIGN_DOWN(ctx->highmem, MEMFD_PG_SIZE);
+	size = ctx->lowmem + ctx->biosmem + ctx->highmem;
+
+	memfd_check_thp();
+
+	memfd_fd = syscall(SYS_memfd_create, vmname,
+			MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (memfd_fd < 0) {
+		perror("memfd_create");
+		return -ENOMEM;
+	}
+	if (ftruncate(memfd_fd, size) < 0 ||
+		fcntl(memfd_fd, F_ADD_SEALS,
+			F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+		perror("memfd size");
+		goto err;
+	}
+
+	/* the base is 2M aligned for the THPs of the mappings */
+	total_size = ctx->highmem_gpa_base + ctx->highmem + MEMFD_PG_SIZE;
+	ptr = mmap(NULL, total_size, PROT_NONE,
+			MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if (ptr == MAP_FAILED) {
+		perror("anony mmap fail");
+		ptr = NULL;
+		goto err;
+	}
+	ctx->baseaddr = (void *)ALIGN_UP((size_t)ptr, MEMFD_PG_SIZE);
+	printf("mmap ptr 0x%p -> baseaddr 0x%p\n", ptr, ctx->baseaddr);
+
+	if (memfd_map_region(ctx, 0, ctx->lowmem, 0) < 0 ||
+		memfd_map_region(ctx, 4 * GB - ctx->biosmem, ctx->biosmem,
+			ctx->lowmem) < 0 ||
+		memfd_map_region(ctx, ctx->highmem_gpa_base, ctx->highmem,
+			ctx->lowmem + ctx->biosmem) < 0) {
+		perror("memfd mmap failed");
+		goto err;
+	}
+
+	if (memfd_mlock) {
+		if (numa_node >= 0 && numa_bind_regions(numa_node) < 0)
+			goto err;
+		for (i = 0; i < nregions; i++) {
+			if (mlock(regions[i].hva, regions[i].len) < 0) {
+				perror("mlock guest memory");
+				goto err;
+			}
+		}
+	} else if (hugetlb_prefault() < 0)
+		goto err;
+
+	if (vm_map_memseg_vma(ctx, ctx->lowmem, 0,
+		(uint64_t)ctx->baseaddr, PROT_ALL) < 0)
+		goto err;
+
+	if (ctx->biosmem > 0) {
+		if (vm_map_memseg_vma(ctx, ctx->biosmem, 4 * GB - ctx->biosmem,
+			(uint64_t)(ctx->baseaddr + 4 * GB - ctx->biosmem),
+			PROT_ALL) < 0)
+			goto err;
+	}
+
+	if (ctx->highmem > 0) {
+		if (vm_map_memseg_vma(ctx, ctx->highmem, ctx->highmem_gpa_base,
+			(uint64_t)(ctx->baseaddr + ctx->highmem_gpa_base),
+			PROT_ALL) < 0)
+			goto err;
+	}
+
+	return 0;
+
+err:
+	nregions = 0;
+	if (ptr) {
+		munmap(ptr, total_size);
+		ptr = NULL;
+	}
+	total_size = 0;
+	close(memfd_fd);
+	memfd_fd = -1;
+	return -ENOMEM;
+}
+
 bool init_hugetlb(void)
 {
 	int level;
 
+	/* no hugetlbfs to mount */
+	if (memfd_backend)
+		return true;
+
 	for (level = HUGETLB_LV1; level < HUGETLB_LV_MAX; level++) {
 		if (create_hugetlb_dirs(level) < 0)
 			return false;
@@ -645,6 +1071,9 @@ int hugetlb_setup_memory(struct vmctx *ctx)
 	size_t lowmem, biosmem, highmem;
 	bool has_gap;
 
+	if (memfd_backend)
+		return memfd_setup_memory(ctx);
+
 	if (ctx->lowmem == 0) {
 		perror("vm requests 0 memory");
 		goto err;
@@ -692,11 +1121,13 @@ int hugetlb_setup_memory(struct vmctx *ctx)
 		}
 	}
 
-	/* it will check each level memory need */
-	has_gap = hugetlb_check_memgap();
-	if (has_gap) {
-		if (!hugetlb_reserve_pages())
-			goto err;
+	/* it will check each level memory need, unless acrnd provides it */
+	if (!hugetlb_from_pool()) {
+		has_gap = hugetlb_check_memgap();
+		if (has_gap) {
+			if (!hugetlb_reserve_pages())
+				goto err;
+		}
 	}
 
 	/* align up total size with huge page size for vma alignment */
@@ -766,6 +1197,9 @@ int hugetlb_setup_memory(struct vmctx *ctx)
 			hugetlb_priv[level].highmem);
 	}
 
+	if (hugetlb_prefault() < 0)
+		goto err;
+
 	/* map ept for lowmem */
 	if (vm_map_memseg_vma(ctx, ctx->lowmem, 0,
 		(uint64_t)ctx->baseaddr, PROT_ALL) < 0)
@@ -795,6 +1229,7 @@ int hugetlb_setup_memory(struct vmctx *ctx)
 	return 0;
 
 err:
+	nregions = 0;
 	if (ptr) {
 		munmap(ptr, total_size);
 		ptr = NULL;
@@ -805,10 +1240,22 @@ err:
 	return -ENOMEM;
 }
 
+int hugetlb_parse_numa_node(const char *arg)
+{
+	int node;
+
+	if (dm_strtoi(arg, NULL, 10, &node) || node < 0)
+		return -1;
+
+	numa_node = node;
+	return 0;
+}
+
 void hugetlb_unsetup_memory(struct vmctx *ctx)
 {
 	int level;
 
+	nregions = 0;
 	if (total_size > 0) {
 		munmap(ptr, total_size);
 		total_size = 0;
@@ -818,4 +1265,108 @@ void hugetlb_unsetup_memory(struct vmctx *ctx)
 	for (level = HUGETLB_LV1; level < hugetlb_lv_max; level++) {
 		close_hugetlbfs(level);
 	}
+
+	if (memfd_fd >= 0) {
+		close(memfd_fd);
+		memfd_fd = -1;
+	}
+}
+
+/*
+ * Copy out the hugetlbfs mappings of the guest memory, the fds stay owned
+ * by hugetlb.c. Returns the number of regions, or -1 if there are more
+ * than max.
+ */
+int hugetlb_get_regions(struct hugetlb_region *regs, int max)
+{
+	if (nregions > max)
+		return -1;
+
+	memcpy(regs, regions, nregions * sizeof(struct hugetlb_region));
+	return nregions;
+}
+
+/*
+ * The region holding [gpa, gpa + len), which must be made of whole pages
+ * of the region, or -1.
+ */
+static int
+hugetlb_find_range(vm_paddr_t gpa, size_t len)
+{
+	int i;
+
+	for (i = 0; i < nregions; i++) {
+		if (gpa < regions[i].gpa ||
+		    gpa + len > regions[i].gpa + regions[i].len)
+			continue;
+		if ((gpa - regions[i].gpa) % region_pgsz[i] != 0 ||
+		    len % region_pgsz[i] != 0)
+			return -1;
+		return i;
+	}
+
+	return -1;
+}
+
+/*
+ * Unmap [gpa, gpa + len) from the EPT and give its hugepages back to the
+ * pool, e.g. for the balloon. Fails if the range is not made of whole
+ * hugepages, a 2M range backed by a 1G page can't be released.
+ */
+int
+hugetlb_release_range(struct vmctx *ctx, vm_paddr_t gpa, size_t len)
+{
+	int i;
+
+	i = hugetlb_find_range(gpa, len);
+	if (i < 0)
+		return -1;
+
+	if (vm_unmap_memseg(ctx, gpa, len) < 0) {
+		perror("unmap memseg");
+		return -1;
+	}
+
+	/* the mapping of the DM stays, it faults the pages in again */
+	if (fallocate(regions[i].fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			regions[i].offset + gpa - regions[i].gpa, len) < 0) {
+		perror("hugetlbfs punch hole");
+		/* the pages are still there, map them back */
+		if (vm_map_memseg_vma(ctx, len, gpa,
+			(uint64_t)regions[i].hva + gpa - regions[i].gpa,
+			PROT_ALL) < 0)
+			return -2;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Allocate the hugepages of a range released by hugetlb_release_range()
+ * again, and map them into the EPT. The allocation fails, instead of a
+ * SIGBUS on the first touch, if the pool is exhausted.
+ */
+int
+hugetlb_restore_range(struct vmctx *ctx, vm_paddr_t gpa, size_t len)
+{
+	volatile char *addr;
+	size_t off;
+	int i;
+
+	i = hugetlb_find_range(gpa, len);
+	if (i < 0)
+		return -1;
+
+	if (fallocate(regions[i].fd, 0,
+			regions[i].offset + gpa - regions[i].gpa, len) < 0) {
+		perror("hugetlbfs allocate");
+		return -1;
+	}
+
+	addr = (volatile char *)regions[i].hva + (gpa - regions[i].gpa);
+	for (off = 0; off < len; off += region_pgsz[i])
+		(void)addr[off];
+
+	return vm_map_memseg_vma(ctx, len, gpa, (uint64_t)addr, PROT_ALL);
 }
@@ -28,8 +28,10 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "inout.h"
+#include "mem.h"
 SET_DECLARE(inout_port_set, struct inout_port);
 
 #define	MAX_IOPORTS	(1 << 16)
@@ -44,6 +46,9 @@ static struct {
 	void		*arg;
 } inout_handlers[MAX_IOPORTS];
 
+/* protects inout_handlers against the runtime (un)registrations */
+static pthread_rwlock_t inout_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+
 static int
 default_inout(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 	      uint32_t *eax, void *arg)
@@ -101,9 +106,11 @@ emulate_inout(struct vmctx *ctx, int *pvcpu, struct pio_request *pio_request)
 		((bytes != 1) && (bytes != 2) && (bytes != 4)))
 		return -1;
 
+	pthread_rwlock_rdlock(&inout_rwlock);
 	handler = inout_handlers[port].handler;
 	flags = inout_handlers[port].flags;
 	arg = inout_handlers[port].arg;
+	pthread_rwlock_unlock(&inout_rwlock);
 
 	if (pio_request->direction == REQUEST_READ) {
 		if (!(flags & IOPORT_F_IN))
@@ -112,8 +119,13 @@ emulate_inout(struct vmctx *ctx, int *pvcpu, struct pio_request *pio_request)
 		if (!(flags & IOPORT_F_OUT))
 			return -1;
 	}
+
+	if (!(flags & IOPORT_F_CONCURRENT))
+		emul_lock();
 	retval = handler(ctx, *pvcpu, in, port, bytes,
 		(uint32_t *)&(pio_request->value), arg);
+	if (!(flags & IOPORT_F_CONCURRENT))
+		emul_unlock();
 	return retval;
 }
 
@@ -155,14 +167,18 @@ register_inout(struct inout_port *iop)
 		return -1;
 	}
 
+	pthread_rwlock_wrlock(&inout_rwlock);
+
 	/*
 	 * Verify that the new registration is not overwriting an already
 	 * allocated i/o range.
 	 */
 	if ((iop->flags & IOPORT_F_DEFAULT) == 0) {
 		for (i = iop->port; i < iop->port + iop->size; i++) {
-			if ((inout_handlers[i].flags & IOPORT_F_DEFAULT) == 0)
+			if ((inout_handlers[i].flags & IOPORT_F_DEFAULT) == 0) {
+				pthread_rwlock_unlock(&inout_rwlock);
 				return -1;
+			}
 		}
 	}
 
@@ -173,6 +189,7 @@ register_inout(struct inout_port *iop)
 		inout_handlers[i].arg = iop->arg;
 	}
 
+	pthread_rwlock_unlock(&inout_rwlock);
 	return 0;
 }
 
@@ -0,0 +1,318 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dm.h"
+#include "vmmapi.h"
+#include "log.h"
+#include "ioreq_trace.h"
+
+/* kinds of requests of the report, by type and direction */
+#define IOREQ_TRACE_KINDS	8
+
+static const char *ioreq_trace_kind_names[IOREQ_TRACE_KINDS] = {
+	"pio read", "pio write", "mmio read", "mmio write",
+	"pci read", "pci write", "wp read", "wp write",
+};
+
+struct ioreq_trace_stats {
+	uint64_t count;
+	uint64_t ns;
+	uint64_t max_ns;
+	uint64_t mismatches;	/* reads returning another value than recorded */
+};
+
+bool ioreq_trace_recording;
+
+static const char *ioreq_trace_path;
+static bool ioreq_trace_replay_mode;
+static FILE *ioreq_trace_fp;
+static struct ioreq_trace_header ioreq_trace_hdr;
+static pthread_mutex_t ioreq_trace_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+int
+ioreq_trace_parse_record(const char *path)
+{
+	if (ioreq_trace_replay_mode)
+		return -1;
+
+	ioreq_trace_path = path;
+	return 0;
+}
+
+int
+ioreq_trace_parse_replay(const char *path)
+{
+	if (ioreq_trace_path != NULL)
+		return -1;
+
+	ioreq_trace_fp = fopen(path, "r");
+	if (ioreq_trace_fp == NULL) {
+		pr_err("ioreq trace: cannot open %s, errno %d\n", path, errno);
+		return -1;
+	}
+	if (fread(&ioreq_trace_hdr, sizeof(ioreq_trace_hdr), 1,
+			ioreq_trace_fp) != 1 ||
+	    ioreq_trace_hdr.magic != IOREQ_TRACE_MAGIC ||
+	    ioreq_trace_hdr.version != IOREQ_TRACE_VERSION ||
+	    ioreq_trace_hdr.ncpus < 1 || ioreq_trace_hdr.ncpus > VM_MAXCPU) {
+		pr_err("ioreq trace: %s is not a trace\n", path);
+		fclose(ioreq_trace_fp);
+		ioreq_trace_fp = NULL;
+		return -1;
+	}
+
+	ioreq_trace_path = path;
+	ioreq_trace_replay_mode = true;
+	return 0;
+}
+
+bool
+ioreq_trace_replaying(void)
+{
+	return ioreq_trace_replay_mode;
+}
+
+int
+ioreq_trace_ncpus(void)
+{
+	return (int)ioreq_trace_hdr.ncpus;
+}
+
+int
+ioreq_trace_init(struct vmctx *ctx, int ncpus)
+{
+	if (ioreq_trace_path == NULL)
+		return 0;
+
+	if (ioreq_trace_replay_mode) {
+		if (ioreq_trace_hdr.lowmem != ctx->lowmem ||
+		    ioreq_trace_hdr.highmem != ctx->highmem) {
+			pr_err("ioreq trace: recorded with %lu bytes of memory\n",
+				ioreq_trace_hdr.lowmem + ioreq_trace_hdr.highmem);
+			return -1;
+		}
+		return 0;
+	}
+
+	/* the recording goes on across the full resets of the VM */
+	if (ioreq_trace_fp != NULL)
+		return 0;
+
+	ioreq_trace_fp = fopen(ioreq_trace_path, "w");
+	if (ioreq_trace_fp == NULL) {
+		pr_err("ioreq trace: cannot create %s, errno %d\n",
+			ioreq_trace_path, errno);
+		return -1;
+	}
+
+	ioreq_trace_hdr.magic = IOREQ_TRACE_MAGIC;
+	ioreq_trace_hdr.version = IOREQ_TRACE_VERSION;
+	ioreq_trace_hdr.ncpus = (uint32_t)ncpus;
+	ioreq_trace_hdr.lowmem = ctx->lowmem;
+	ioreq_trace_hdr.highmem = ctx->highmem;
+	if (fwrite(&ioreq_trace_hdr, sizeof(ioreq_trace_hdr), 1,
+			ioreq_trace_fp) != 1) {
+		pr_err("ioreq trace: cannot write %s\n", ioreq_trace_path);
+		fclose(ioreq_trace_fp);
+		ioreq_trace_fp = NULL;
+		return -1;
+	}
+
+	pr_notice("ioreq trace: recording to %s\n", ioreq_trace_path);
+	ioreq_trace_recording = true;
+	return 0;
+}
+
+void
+ioreq_trace_deinit(void)
+{
+	pthread_mutex_lock(&ioreq_trace_mtx);
+	ioreq_trace_recording = false;
+	if (ioreq_trace_fp != NULL) {
+		fclose(ioreq_trace_fp);
+		ioreq_trace_fp = NULL;
+	}
+	pthread_mutex_unlock(&ioreq_trace_mtx);
+}
+
+/* the record and its data in one go, the workers and the device threads share the file */
+static void
+ioreq_trace_write(const struct ioreq_trace_record *rec, const void *data)
+{
+	pthread_mutex_lock(&ioreq_trace_mtx);
+	if (ioreq_trace_fp != NULL &&
+	    (fwrite(rec, sizeof(*rec), 1, ioreq_trace_fp) != 1 ||
+	     fwrite(data, rec->len, 1, ioreq_trace_fp) != 1)) {
+		pr_err("ioreq trace: write failed, recording stopped\n");
+		ioreq_trace_recording = false;
+		fclose(ioreq_trace_fp);
+		ioreq_trace_fp = NULL;
+	}
+	pthread_mutex_unlock(&ioreq_trace_mtx);
+}
+
+static uint64_t
+ioreq_value(const struct vhm_request *req)
+{
+	switch (req->type) {
+	case REQ_PORTIO:
+		return req->reqs.pio.value;
+	case REQ_PCICFG:
+		return (uint32_t)req->reqs.pci.value;
+	default:
+		return req->reqs.mmio.value;
+	}
+}
+
+/* pio_request, mmio_request and pci_request start with the same direction */
+static int
+ioreq_kind(const struct vhm_request *req)
+{
+	if (req->type > REQ_WP)
+		return -1;
+
+	return (int)(req->type * 2U) +
+		((req->reqs.pio.direction == REQUEST_READ) ? 0 : 1);
+}
+
+void
+ioreq_trace_request(const struct vhm_request *issued,
+		const struct vhm_request *done, int vcpu)
+{
+	struct ioreq_trace_record rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.kind = IOREQ_TRACE_REQ;
+	rec.vcpu = (uint32_t)vcpu;
+	rec.len = sizeof(*issued);
+	rec.value = ioreq_value(done);
+	ioreq_trace_write(&rec, issued);
+}
+
+void
+ioreq_trace_mem(uint64_t gpa, const void *hva, size_t len)
+{
+	struct ioreq_trace_record rec;
+
+	if (len == 0 || len > IOREQ_TRACE_MEM_MAX)
+		return;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.kind = IOREQ_TRACE_MEM;
+	rec.len = (uint32_t)len;
+	rec.gpa = gpa;
+	ioreq_trace_write(&rec, hva);
+}
+
+static inline uint64_t
+ioreq_trace_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000UL + (uint64_t)ts.tv_nsec;
+}
+
+static void
+ioreq_trace_report(const struct ioreq_trace_stats *stats, uint64_t total_ns)
+{
+	int i;
+
+	printf("ioreq replay of %s: %.3f ms in the device models\n",
+		ioreq_trace_path, (double)total_ns / 1000000.0);
+	printf("%-12s %10s %12s %10s %10s %10s\n", "request", "count",
+		"total_us", "avg_ns", "max_ns", "mismatch");
+	for (i = 0; i < IOREQ_TRACE_KINDS; i++) {
+		if (stats[i].count == 0)
+			continue;
+		printf("%-12s %10lu %12lu %10lu %10lu %10lu\n",
+			ioreq_trace_kind_names[i], stats[i].count,
+			stats[i].ns / 1000UL, stats[i].ns / stats[i].count,
+			stats[i].max_ns, stats[i].mismatches);
+	}
+}
+
+int
+ioreq_trace_replay(struct vmctx *ctx, struct vhm_request *req_buf,
+		ioreq_trace_handler_t handle)
+{
+	struct ioreq_trace_stats stats[IOREQ_TRACE_KINDS];
+	struct ioreq_trace_record rec;
+	struct vhm_request *req;
+	uint64_t start, ns, total_ns = 0;
+	void *buf, *hva;
+	int kind, ret = 0;
+
+	buf = malloc(IOREQ_TRACE_MEM_MAX);
+	if (buf == NULL)
+		return -1;
+
+	memset(stats, 0, sizeof(stats));
+	while (fread(&rec, sizeof(rec), 1, ioreq_trace_fp) == 1) {
+		if ((rec.kind == IOREQ_TRACE_REQ && (rec.len != sizeof(*req) ||
+		     rec.vcpu >= ioreq_trace_hdr.ncpus)) ||
+		    (rec.kind == IOREQ_TRACE_MEM && rec.len > IOREQ_TRACE_MEM_MAX) ||
+		    (rec.kind != IOREQ_TRACE_REQ && rec.kind != IOREQ_TRACE_MEM)) {
+			pr_err("ioreq trace: bad record of kind %u\n", rec.kind);
+			ret = -1;
+			break;
+		}
+
+		if (rec.kind == IOREQ_TRACE_MEM) {
+			if (fread(buf, rec.len, 1, ioreq_trace_fp) != 1) {
+				ret = -1;
+				break;
+			}
+			hva = vm_map_gpa_fast(ctx, rec.gpa, rec.len);
+			if (hva != NULL)
+				memcpy(hva, buf, rec.len);
+			continue;
+		}
+
+		req = &req_buf[rec.vcpu];
+		if (fread(req, sizeof(*req), 1, ioreq_trace_fp) != 1) {
+			ret = -1;
+			break;
+		}
+		kind = ioreq_kind(req);
+		if (kind < 0) {
+			pr_err("ioreq trace: bad request type %u\n", req->type);
+			ret = -1;
+			break;
+		}
+		req->client = ctx->ioreq_client;
+		req->processed = REQ_STATE_PROCESSING;
+
+		start = ioreq_trace_now_ns();
+		(void)handle(ctx, req, (int)rec.vcpu);
+		ns = ioreq_trace_now_ns() - start;
+
+		stats[kind].count++;
+		stats[kind].ns += ns;
+		if (ns > stats[kind].max_ns)
+			stats[kind].max_ns = ns;
+		if ((kind & 1) == 0 && ioreq_value(req) != rec.value)
+			stats[kind].mismatches++;
+		total_ns += ns;
+
+		if (vm_get_suspend_mode() != VM_SUSPEND_NONE)
+			break;
+	}
+
+	if (ret != 0)
+		pr_err("ioreq trace: %s is cut short\n", ioreq_trace_path);
+	ioreq_trace_report(stats, total_ns);
+	free(buf);
+	return ret;
+}
@@ -37,6 +37,7 @@
 #include <sysexits.h>
 #include <stdbool.h>
 #include <getopt.h>
+#include <time.h>
 
 #include "vmmapi.h"
 #include "sw_load.h"
@@ -55,9 +56,17 @@
 #include "rtc.h"
 #include "pit.h"
 #include "hpet.h"
+#include "vcounter.h"
+#include "pioreg.h"
+#include "vcpu_stats.h"
+#include "dm_stats.h"
+#include "dedup.h"
+#include "ioreq_trace.h"
+#include "template.h"
 #include "version.h"
 #include "sw_load.h"
 #include "monitor.h"
+#include "acrn_mngr.h"
 #include "ioc.h"
 #include "pm.h"
 #include "atomic.h"
@@ -92,6 +101,9 @@ bool skip_pci_mem64bar_workaround = false;
 static int guest_ncpus;
 static int virtio_msix = 1;
 static bool debugexit_enabled;
+static bool warm_reset;
+static bool template_mode;
+static int max_cpus;
 static char mac_seed_str[50];
 static int pm_notify_channel;
 
@@ -103,6 +115,7 @@ static const int BSP;
 static cpuset_t cpumask;
 
 static void vm_loop(struct vmctx *ctx);
+static int handle_vmexit(struct vmctx *ctx, struct vhm_request *vhm_req, int vcpu);
 
 static char vhm_request_page[4096] __aligned(4096);
 
@@ -140,7 +153,10 @@ usage(int code)
 		"       %*s [--vtpm2 sock_path] [--virtio_poll interval] [--mac_seed seed_string]\n"
 		"       %*s [--vmcfg sub_options] [--dump vm_idx] [--ptdev_no_reset] [--debugexit] \n"
 		"       %*s [--logger-setting param_setting] [--pm_notify_channel]\n"
-		"       %*s [--pm_by_vuart vuart_node] <vm>\n"
+		"       %*s [--pm_by_vuart vuart_node] [--ioreq_threads cpu_list]\n"
+		"       %*s [--ioreq_poll max_us] [--mem_node node] [--mem_backend type]\n"
+		"       %*s [--dedup_scan interval] [--template] [--max_cpus count]\n"
+		"       %*s [--warm_reset] [--ioreq_record file] [--ioreq_replay file] <vm>\n"
 		"       -A: create ACPI tables\n"
 		"       -B: bootargs for kernel\n"
 		"       -E: elf image path\n"
@@ -175,11 +191,33 @@ usage(int code)
 		"       --rtvm: indicate that the guest is rtvm\n"
 		"       --logger_setting: params like console,level=4;kmsg,level=3\n"
 		"       --pm_notify_channel: define the channel used to notify guest about power event\n"
-		"       --pm_by_vuart:pty,/run/acrn/vuart_vmname or tty,/dev/ttySn\n",
+		"       --pm_by_vuart:pty,/run/acrn/vuart_vmname or tty,/dev/ttySn\n"
+		"       --ioreq_threads: emulate the ioreqs in one thread per listed SOS cpu,\n"
+		"            vCPU n is served by the thread of the (n %% count)th cpu, e.g. 2,3\n"
+		"       --ioreq_poll: poll the ioreqs for up to max_us before blocking,\n"
+		"            needs --lapic_pt or --rtvm\n"
+		"       --mem_node: allocate the guest memory on this NUMA node,\n"
+		"            from prefault threads bound to its cpus\n"
+		"       --mem_backend: hugetlb (default), or memfd[,mlock] for the\n"
+		"            transparent hugepages of a memfd, none reserved\n"
+		"       --warm_reset: reset the devices in place on guest reboot,\n"
+		"            keeping their backends open\n"
+		"       --dedup_scan: every interval seconds, at least 10, report\n"
+		"            the guest pages identical within the VM or with other VMs\n"
+		"       --template: create no VM, fork one on each clone request of\n"
+		"            acrnctl, sharing the boot images\n"
+		"       --ioreq_record: record the ioreqs and the guest memory the\n"
+		"            devices read into file\n"
+		"       --ioreq_replay: run no VM, replay the ioreqs of file with the\n"
+		"            same devices and report the time spent per request\n"
+		"       --max_cpus: vCPUs the guest may have, the ones above the VM\n"
+		"            configuration are hot-added by acrnctl cpu, needs -A\n",
 		progname, (int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
 		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
 		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
-		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "");
+		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
+		(int)strnlen(progname, PATH_MAX), "", (int)strnlen(progname, PATH_MAX), "",
+		(int)strnlen(progname, PATH_MAX), "");
 
 	exit(code);
 }
@@ -239,6 +277,12 @@ start_thread(void *param)
 	snprintf(tname, sizeof(tname), "vcpu %d", vcpu);
 	pthread_setname_np(mtp->mt_thr, tname);
 
+	if (ioreq_trace_replaying()) {
+		ioreq_trace_replay(mtp->mt_ctx, vhm_req_buf, handle_vmexit);
+		vm_suspend(mtp->mt_ctx, VM_SUSPEND_POWEROFF);
+		return NULL;
+	}
+
 	vm_loop(mtp->mt_ctx);
 
 	/* reset or halt */
@@ -263,6 +307,7 @@ add_cpu(struct vmctx *ctx, int vcpu_num)
 		mt_vmm_info[i].mt_vcpu = i;
 	}
 
+	vcpu_stats_init(ctx, vcpu_num);
 	vm_set_vcpu_regs(ctx, &ctx->bsp_regs);
 
 	error = pthread_create(&mt_vmm_info[0].mt_thr, NULL,
@@ -271,6 +316,18 @@ add_cpu(struct vmctx *ctx, int vcpu_num)
 	return error;
 }
 
+/* A vCPU added by cpu_hotplug_add(), its ioreqs are served from now on */
+void
+add_hotplug_cpu(struct vmctx *ctx, int vcpu)
+{
+	CPU_SET_ATOMIC(vcpu, &cpumask);
+	mt_vmm_info[vcpu].mt_ctx = ctx;
+	mt_vmm_info[vcpu].mt_vcpu = vcpu;
+
+	if (vcpu >= guest_ncpus)
+		guest_ncpus = vcpu + 1;
+}
+
 static int
 delete_cpu(struct vmctx *ctx, int vcpu)
 {
@@ -383,7 +440,30 @@ static vmexit_handler_t handler[VM_EXITCODE_MAX] = {
 	[VM_EXITCODE_PCI_CFG] = vmexit_pci_emul,
 };
 
-static void
+static_assert(VM_EXITCODE_MAX == DM_STATS_IOREQ_TYPES, "dm_stats ioreq types");
+
+/*
+ * The ioreqs emulated, counted per vCPU: the request of a vCPU is handled
+ * by one thread at a time, so plain increments do.
+ */
+static uint64_t ioreq_counts[VM_MAXCPU][VM_EXITCODE_MAX];
+static uint64_t ioreq_rounds;
+
+void
+ioreq_get_stats(uint64_t *reqs, uint64_t *rounds)
+{
+	int vcpu, i;
+
+	for (i = 0; i < VM_EXITCODE_MAX; i++) {
+		reqs[i] = 0UL;
+		for (vcpu = 0; vcpu < VM_MAXCPU; vcpu++)
+			reqs[i] += ioreq_counts[vcpu][i];
+	}
+	*rounds = atomic_load(&ioreq_rounds);
+}
+
+/* Emulate the request of vcpu, return the vcpu whose request is completed */
+static int
 handle_vmexit(struct vmctx *ctx, struct vhm_request *vhm_req, int vcpu)
 {
 	enum vm_exitcode exitcode;
@@ -395,20 +475,20 @@ handle_vmexit(struct vmctx *ctx, struct vhm_request *vhm_req, int vcpu)
 		exit(1);
 	}
 
-	(*handler[exitcode])(ctx, vhm_req, &vcpu);
+	ioreq_counts[vcpu][exitcode]++;
 
-	/* We cannot notify the VHM/hypervisor on the request completion at this
-	 * point if the UOS is in suspend or system reset mode, as the VM is
-	 * still not paused and a notification can kick off the vcpu to run
-	 * again. Postpone the notification till vm_system_reset() or
-	 * vm_suspend_resume() for resetting the ioreq states in the VHM and
-	 * hypervisor.
-	 */
-	if ((VM_SUSPEND_SYSTEM_RESET == vm_get_suspend_mode()) ||
-		(VM_SUSPEND_SUSPEND == vm_get_suspend_mode()))
-		return;
+	/* the posted writes go first, see coalesced_mmio_drain() */
+	coalesced_mmio_drain(ctx);
+	if (ioreq_trace_recording) {
+		struct vhm_request issued = *vhm_req;
+		int req_vcpu = vcpu;
 
-	vm_notify_request_done(ctx, vcpu);
+		(*handler[exitcode])(ctx, vhm_req, &vcpu);
+		ioreq_trace_request(&issued, vhm_req, req_vcpu);
+	} else
+		(*handler[exitcode])(ctx, vhm_req, &vcpu);
+
+	return vcpu;
 }
 
 static void
@@ -475,15 +555,19 @@ vm_init_vdevs(struct vmctx *ctx)
 	if (ret < 0)
 		goto monitor_fail;
 
+	dm_stats_init();
+
 	ret = init_pci(ctx);
 	if (ret < 0)
 		goto pci_fail;
 
 	init_vtpm2(ctx);
+	dedup_scan_init(ctx);
 
 	return 0;
 
 pci_fail:
+	dm_stats_deinit();
 	monitor_close();
 monitor_fail:
 	if (debugexit_enabled)
@@ -511,7 +595,9 @@ vm_deinit_vdevs(struct vmctx *ctx)
 	 */
 	acrn_writeback_ovmf_nvstorage(ctx);
 
+	dedup_scan_deinit();
 	deinit_pci(ctx);
+	dm_stats_deinit();
 	monitor_close();
 
 	if (debugexit_enabled)
@@ -536,6 +622,24 @@ vm_reset_vdevs(struct vmctx *ctx)
 	 */
 	acrn_writeback_ovmf_nvstorage(ctx);
 
+	/*
+	 * With --warm_reset, the PCI devices which all can be reset in
+	 * place keep their backends (taps, vhost, disk images), and their
+	 * interrupts, so the ACPI tables stay valid.
+	 */
+	if (warm_reset && reset_pci(ctx) == 0) {
+		atkbdc_deinit(ctx);
+		vhpet_deinit(ctx);
+		vpit_deinit(ctx);
+		vrtc_deinit(ctx);
+
+		atkbdc_init(ctx);
+		vrtc_init(ctx);
+		vpit_init(ctx);
+		vhpet_init(ctx);
+		return;
+	}
+
 	/*
 	 * The current virtual devices doesn't define virtual
 	 * device reset function. So we call vdev deinit/init
@@ -637,6 +741,7 @@ vm_suspend_resume(struct vmctx *ctx)
 
 	vm_clear_ioreq(ctx);
 	vm_stop_watchdog(ctx);
+	monitor_notify_state(VM_SUSPENDED);
 	wait_for_resume(ctx);
 
 	pm_backto_wakeup(ctx);
@@ -646,6 +751,366 @@ vm_suspend_resume(struct vmctx *ctx)
 	/* set the BSP init state */
 	vm_set_vcpu_regs(ctx, &ctx->bsp_regs);
 	vm_run(ctx);
+	monitor_notify_state(VM_STARTED);
+}
+
+/*
+ * Optional ioreq worker threads, see --ioreq_threads.
+ *
+ * vm_loop() stays the only thread attached to the ioreq client, it hands
+ * the request of vCPU i over to worker (i % ioreq_worker_num) so that the
+ * requests of different vCPUs are emulated concurrently. A vCPU's bit in
+ * ioreq_dispatched is set while its request is owned by a worker, the
+ * owner clears it once the completion has been notified.
+ */
+struct ioreq_worker {
+	pthread_t	tid;
+	int		sos_cpu;
+	pthread_mutex_t	mtx;
+	pthread_cond_t	cond;
+	uint64_t	pending;	/* vCPUs handed over by vm_loop */
+	struct vmctx	*ctx;
+};
+
+static struct ioreq_worker ioreq_workers[VM_MAXCPU];
+static int ioreq_worker_num;
+static uint64_t ioreq_dispatched;
+
+static int
+acrn_parse_ioreq_threads(char *arg)
+{
+	char *cp, *str, *tofree;
+	int cpu, ret = 0;
+
+	tofree = str = strdup(arg);
+	if (str == NULL)
+		return -1;
+
+	ioreq_worker_num = 0;
+	while ((cp = strsep(&str, ",")) != NULL) {
+		if ((ioreq_worker_num >= VM_MAXCPU) ||
+			dm_strtoi(cp, NULL, 10, &cpu) || (cpu < 0) || (cpu >= CPU_SETSIZE)) {
+			pr_err("invalid ioreq thread cpu list %s\n", arg);
+			ioreq_worker_num = 0;
+			ret = -1;
+			break;
+		}
+		ioreq_workers[ioreq_worker_num++].sos_cpu = cpu;
+	}
+
+	free(tofree);
+	return ret;
+}
+
+/* Take the ownership of the pending request of vcpu, false if already owned */
+static inline bool
+ioreq_claim(struct vmctx *ctx, int vcpu)
+{
+	struct vhm_request *vhm_req = &vhm_req_buf[vcpu];
+
+	if ((atomic_load(&vhm_req->processed) != REQ_STATE_PROCESSING) ||
+		(vhm_req->client != ctx->ioreq_client))
+		return false;
+
+	return (atomic_fetch_or(&ioreq_dispatched, 1UL << vcpu) & (1UL << vcpu)) == 0UL;
+}
+
+static inline bool
+ioreq_notify_allowed(void)
+{
+	/* see the notification postponing in ioreq_handle() */
+	return (VM_SUSPEND_SYSTEM_RESET != vm_get_suspend_mode()) &&
+		(VM_SUSPEND_SUSPEND != vm_get_suspend_mode());
+}
+
+static void *
+ioreq_worker_thread(void *arg)
+{
+	struct ioreq_worker *worker = arg;
+	struct vmctx *ctx;
+	uint64_t mask, done_mask;
+	int vcpu;
+
+	while (1) {
+		pthread_mutex_lock(&worker->mtx);
+		while (worker->pending == 0UL)
+			pthread_cond_wait(&worker->cond, &worker->mtx);
+		mask = worker->pending;
+		worker->pending = 0UL;
+		ctx = worker->ctx;
+		pthread_mutex_unlock(&worker->mtx);
+
+		while (mask != 0UL) {
+			done_mask = mask;
+			for (vcpu = 0; vcpu < guest_ncpus; vcpu++) {
+				if ((mask & (1UL << vcpu)) != 0UL)
+					handle_vmexit(ctx, &vhm_req_buf[vcpu], vcpu);
+			}
+
+			if (!ioreq_notify_allowed()) {
+				atomic_fetch_and(&ioreq_dispatched, ~done_mask);
+				break;
+			}
+			vm_notify_request_done_batch(ctx, done_mask);
+			atomic_fetch_add(&ioreq_rounds, 1UL);
+			atomic_fetch_and(&ioreq_dispatched, ~done_mask);
+
+			/*
+			 * vm_loop() skips the vCPUs still owned by this worker,
+			 * pick up the requests they issued in the meantime.
+			 */
+			mask = 0UL;
+			for (vcpu = 0; (vcpu < guest_ncpus) &&
+				(vm_get_suspend_mode() == VM_SUSPEND_NONE); vcpu++) {
+				if (((done_mask & (1UL << vcpu)) != 0UL) && ioreq_claim(ctx, vcpu))
+					mask |= 1UL << vcpu;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static int
+ioreq_workers_init(struct vmctx *ctx)
+{
+	struct ioreq_worker *worker;
+	cpu_set_t cpus;
+	char tname[MAXCOMLEN + 1];
+	int i, error;
+
+	for (i = 0; i < ioreq_worker_num; i++) {
+		worker = &ioreq_workers[i];
+
+		/* the workers are kept across the full reset of the VM */
+		if (worker->ctx != NULL) {
+			pthread_mutex_lock(&worker->mtx);
+			worker->ctx = ctx;
+			pthread_mutex_unlock(&worker->mtx);
+			continue;
+		}
+
+		worker->ctx = ctx;
+		worker->pending = 0UL;
+		pthread_mutex_init(&worker->mtx, NULL);
+		pthread_cond_init(&worker->cond, NULL);
+
+		error = pthread_create(&worker->tid, NULL, ioreq_worker_thread, worker);
+		if (error != 0) {
+			pr_err("%s, failed to create ioreq worker %d\n", __func__, i);
+			return error;
+		}
+
+		CPU_ZERO(&cpus);
+		CPU_SET(worker->sos_cpu, &cpus);
+		if (pthread_setaffinity_np(worker->tid, sizeof(cpus), &cpus) != 0)
+			pr_warn("%s, failed to pin ioreq worker %d to cpu %d\n",
+				__func__, i, worker->sos_cpu);
+
+		snprintf(tname, sizeof(tname), "ioreq-%d", i);
+		pthread_setname_np(worker->tid, tname);
+	}
+
+	return 0;
+}
+
+static void
+ioreq_worker_kick(struct ioreq_worker *worker, uint64_t mask)
+{
+	pthread_mutex_lock(&worker->mtx);
+	worker->pending |= mask;
+	pthread_cond_signal(&worker->cond);
+	pthread_mutex_unlock(&worker->mtx);
+}
+
+/* Wait for the workers to finish the requests they own */
+static void
+ioreq_workers_drain(void)
+{
+	while (atomic_load(&ioreq_dispatched) != 0UL)
+		usleep(100);
+}
+
+/* Hand the pending requests over to their workers */
+static void
+ioreq_dispatch(struct vmctx *ctx)
+{
+	uint64_t worker_mask[VM_MAXCPU];
+	int vcpu, i;
+
+	memset(worker_mask, 0, sizeof(worker_mask));
+	for (vcpu = 0; vcpu < guest_ncpus; vcpu++) {
+		if (ioreq_claim(ctx, vcpu))
+			worker_mask[vcpu % ioreq_worker_num] |= 1UL << vcpu;
+	}
+
+	for (i = 0; i < ioreq_worker_num; i++) {
+		if (worker_mask[i] != 0UL)
+			ioreq_worker_kick(&ioreq_workers[i], worker_mask[i]);
+	}
+}
+
+/* Handle the pending requests in the vm_loop() thread */
+static void
+ioreq_handle(struct vmctx *ctx)
+{
+	int vcpu_id, done_vcpu;
+	uint64_t done_mask = 0UL;
+	struct vhm_request *vhm_req;
+
+	for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
+		vhm_req = &vhm_req_buf[vcpu_id];
+		if ((atomic_load(&vhm_req->processed) == REQ_STATE_PROCESSING)
+			&& (vhm_req->client == ctx->ioreq_client)) {
+			done_vcpu = handle_vmexit(ctx, vhm_req, vcpu_id);
+			done_mask |= 1UL << done_vcpu;
+		}
+	}
+
+	/* We cannot notify the VHM/hypervisor on the request completion at this
+	 * point if the UOS is in suspend or system reset mode, as the VM is
+	 * still not paused and a notification can kick off the vcpu to run
+	 * again. Postpone the notification till vm_system_reset() or
+	 * vm_suspend_resume() for resetting the ioreq states in the VHM and
+	 * hypervisor.
+	 *
+	 * Otherwise notify all the requests handled in this round at once.
+	 */
+	if (ioreq_notify_allowed()) {
+		vm_notify_request_done_batch(ctx, done_mask);
+		atomic_fetch_add(&ioreq_rounds, 1UL);
+	}
+}
+
+/*
+ * Optional polling of the ioreqs, see --ioreq_poll.
+ *
+ * Only for the VMs in IO completion polling mode, whose vCPUs spin in the
+ * hypervisor until their request is completed. Between two blocking
+ * vm_attach_ioreq_client() calls, vm_loop() spins on the request slots
+ * with dm_polling set, so that the hypervisor skips the upcall. The
+ * PENDING requests are claimed by moving them to PROCESSING here, as the
+ * VHM never sees them, and completed by setting them COMPLETE.
+ *
+ * The spin window adapts between IOREQ_POLL_MIN_US and ioreq_poll_us: it
+ * is halved when it expires without any request and doubled when a
+ * request shows up shortly after we went back to blocking.
+ */
+#define IOREQ_POLL_MIN_US	8UL
+
+static uint64_t ioreq_poll_us;
+static uint64_t ioreq_poll_window_us;
+static uint64_t ioreq_poll_block_start;
+
+static int
+acrn_parse_ioreq_poll(char *arg)
+{
+	int us;
+
+	if (dm_strtoi(arg, NULL, 10, &us) || (us <= 0))
+		return -1;
+
+	ioreq_poll_us = (uint64_t)us;
+	ioreq_poll_window_us = ioreq_poll_us;
+	return 0;
+}
+
+static inline uint64_t
+ioreq_poll_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000UL + (uint64_t)ts.tv_nsec / 1000UL;
+}
+
+static void
+ioreq_poll_set_active(uint32_t active)
+{
+	int vcpu;
+
+	for (vcpu = 0; vcpu < guest_ncpus; vcpu++)
+		atomic_store(&vhm_req_buf[vcpu].dm_polling, active);
+}
+
+/* Claim and emulate the PENDING requests, return the number handled */
+static int
+ioreq_poll_pending(struct vmctx *ctx)
+{
+	int vcpu_id, done_vcpu, handled = 0;
+	uint32_t state;
+	struct vhm_request *vhm_req;
+
+	for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
+		vhm_req = &vhm_req_buf[vcpu_id];
+		state = REQ_STATE_PENDING;
+		if ((vhm_req->completion_polling == 0U) ||
+			!atomic_cmpxchg(&vhm_req->processed, &state,
+				REQ_STATE_PROCESSING))
+			continue;
+
+		done_vcpu = handle_vmexit(ctx, vhm_req, vcpu_id);
+		handled++;
+
+		/*
+		 * Same postponing as in ioreq_handle(). A vCPU which stopped
+		 * spinning is paused, atomic_store() orders the completion
+		 * before reading hv_waiting, pairs with the hypervisor.
+		 */
+		if (ioreq_notify_allowed()) {
+			atomic_store(&vhm_req_buf[done_vcpu].processed,
+				REQ_STATE_COMPLETE);
+			if (atomic_load(&vhm_req_buf[done_vcpu].hv_waiting) != 0U)
+				vm_notify_request_done(ctx, done_vcpu);
+		}
+	}
+
+	return handled;
+}
+
+static void
+ioreq_poll(struct vmctx *ctx)
+{
+	uint64_t now, last;
+	bool hit = false;
+
+	now = ioreq_poll_now_us();
+	if ((ioreq_poll_block_start != 0UL) &&
+		(now - ioreq_poll_block_start < ioreq_poll_us))
+		ioreq_poll_window_us = (ioreq_poll_window_us * 2UL < ioreq_poll_us) ?
+			ioreq_poll_window_us * 2UL : ioreq_poll_us;
+
+	ioreq_poll_set_active(1U);
+	last = now;
+	while ((VM_SUSPEND_NONE == vm_get_suspend_mode()) &&
+		(now - last < ioreq_poll_window_us)) {
+		/*
+		 * The VHM may still deliver a request raised before dm_polling
+		 * was seen, handle it before the PENDING ones so that a request
+		 * claimed here but postponed is never emulated twice.
+		 */
+		ioreq_handle(ctx);
+		if (ioreq_poll_pending(ctx) > 0) {
+			hit = true;
+			last = ioreq_poll_now_us();
+		} else {
+			__builtin_ia32_pause();
+		}
+		now = ioreq_poll_now_us();
+	}
+
+	/*
+	 * atomic_store() orders the clearing of dm_polling before the scan
+	 * below, a request which is not seen there gets an upcall.
+	 */
+	ioreq_poll_set_active(0U);
+	if (VM_SUSPEND_NONE == vm_get_suspend_mode())
+		(void)ioreq_poll_pending(ctx);
+
+	if (!hit)
+		ioreq_poll_window_us = (ioreq_poll_window_us / 2UL > IOREQ_POLL_MIN_US) ?
+			ioreq_poll_window_us / 2UL : IOREQ_POLL_MIN_US;
+	ioreq_poll_block_start = ioreq_poll_now_us();
 }
 
 static void
@@ -659,36 +1124,42 @@ vm_loop(struct vmctx *ctx)
 		return;
 	}
 
+	if (ioreq_workers_init(ctx) != 0)
+		return;
+
 	if (vm_run(ctx) != 0) {
 		pr_err("%s, failed to run VM.\n", __func__);
 		return;
 	}
 
 	while (1) {
-		int vcpu_id;
-		struct vhm_request *vhm_req;
+		if (ioreq_poll_us > 0UL)
+			ioreq_poll(ctx);
 
-		error = vm_attach_ioreq_client(ctx);
-		if (error)
-			break;
+		if (VM_SUSPEND_NONE == vm_get_suspend_mode()) {
+			error = vm_attach_ioreq_client(ctx);
+			if (error)
+				break;
 
-		for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
-			vhm_req = &vhm_req_buf[vcpu_id];
-			if ((atomic_load(&vhm_req->processed) == REQ_STATE_PROCESSING)
-				&& (vhm_req->client == ctx->ioreq_client))
-				handle_vmexit(ctx, vhm_req, vcpu_id);
+			if (ioreq_worker_num > 0)
+				ioreq_dispatch(ctx);
+			else
+				ioreq_handle(ctx);
 		}
 
 		if (VM_SUSPEND_FULL_RESET == vm_get_suspend_mode() ||
 		    VM_SUSPEND_POWEROFF == vm_get_suspend_mode()) {
+			ioreq_workers_drain();
 			break;
 		}
 
 		if (VM_SUSPEND_SYSTEM_RESET == vm_get_suspend_mode()) {
+			ioreq_workers_drain();
 			vm_system_reset(ctx);
 		}
 
 		if (VM_SUSPEND_SUSPEND == vm_get_suspend_mode()) {
+			ioreq_workers_drain();
 			vm_suspend_resume(ctx);
 		}
 	}
@@ -730,6 +1201,16 @@ enum {
 	CMD_OPT_LOGGER_SETTING,
 	CMD_OPT_PM_NOTIFY_CHANNEL,
 	CMD_OPT_PM_BY_VUART,
+	CMD_OPT_IOREQ_THREADS,
+	CMD_OPT_IOREQ_POLL,
+	CMD_OPT_MEM_NODE,
+	CMD_OPT_MEM_BACKEND,
+	CMD_OPT_WARM_RESET,
+	CMD_OPT_DEDUP_SCAN,
+	CMD_OPT_TEMPLATE,
+	CMD_OPT_IOREQ_RECORD,
+	CMD_OPT_IOREQ_REPLAY,
+	CMD_OPT_MAX_CPUS,
 };
 
 static struct option long_options[] = {
@@ -769,6 +1250,16 @@ static struct option long_options[] = {
 	{"logger_setting",	required_argument,	0, CMD_OPT_LOGGER_SETTING},
 	{"pm_notify_channel",	required_argument,	0, CMD_OPT_PM_NOTIFY_CHANNEL},
 	{"pm_by_vuart",	required_argument,	0, CMD_OPT_PM_BY_VUART},
+	{"ioreq_threads",	required_argument,	0, CMD_OPT_IOREQ_THREADS},
+	{"ioreq_poll",		required_argument,	0, CMD_OPT_IOREQ_POLL},
+	{"mem_node",		required_argument,	0, CMD_OPT_MEM_NODE},
+	{"mem_backend",		required_argument,	0, CMD_OPT_MEM_BACKEND},
+	{"warm_reset",		no_argument,		0, CMD_OPT_WARM_RESET},
+	{"dedup_scan",		required_argument,	0, CMD_OPT_DEDUP_SCAN},
+	{"template",		no_argument,		0, CMD_OPT_TEMPLATE},
+	{"ioreq_record",	required_argument,	0, CMD_OPT_IOREQ_RECORD},
+	{"ioreq_replay",	required_argument,	0, CMD_OPT_IOREQ_REPLAY},
+	{"max_cpus",		required_argument,	0, CMD_OPT_MAX_CPUS},
 	{0,			0,			0,  0  },
 };
 
@@ -900,6 +1391,9 @@ main(int argc, char *argv[])
 		case CMD_OPT_DEBUGEXIT:
 			debugexit_enabled = true;
 			break;
+		case CMD_OPT_WARM_RESET:
+			warm_reset = true;
+			break;
 		case CMD_OPT_LAPIC_PT:
 			lapic_pt = true;
 		case CMD_OPT_RTVM:
@@ -930,6 +1424,42 @@ main(int argc, char *argv[])
 			if (parse_pm_by_vuart(optarg) != 0)
 				errx(EX_USAGE, "invalid pm-by-vuart params %s", optarg);
 			break;
+		case CMD_OPT_IOREQ_THREADS:
+			if (acrn_parse_ioreq_threads(optarg) != 0)
+				errx(EX_USAGE, "invalid ioreq threads params %s", optarg);
+			break;
+		case CMD_OPT_IOREQ_POLL:
+			if (acrn_parse_ioreq_poll(optarg) != 0)
+				errx(EX_USAGE, "invalid ioreq poll params %s", optarg);
+			break;
+		case CMD_OPT_MEM_NODE:
+			if (hugetlb_parse_numa_node(optarg) != 0)
+				errx(EX_USAGE, "invalid mem node %s", optarg);
+			break;
+		case CMD_OPT_MEM_BACKEND:
+			if (hugetlb_parse_mem_backend(optarg) != 0)
+				errx(EX_USAGE, "invalid mem backend %s", optarg);
+			break;
+		case CMD_OPT_DEDUP_SCAN:
+			if (dedup_parse_interval(optarg) != 0)
+				errx(EX_USAGE, "invalid dedup scan interval %s", optarg);
+			break;
+		case CMD_OPT_TEMPLATE:
+			template_mode = true;
+			break;
+		case CMD_OPT_IOREQ_RECORD:
+			if (ioreq_trace_parse_record(optarg) != 0)
+				errx(EX_USAGE, "--ioreq_record and --ioreq_replay are exclusive");
+			break;
+		case CMD_OPT_IOREQ_REPLAY:
+			if (ioreq_trace_parse_replay(optarg) != 0)
+				errx(EX_USAGE, "invalid ioreq trace %s", optarg);
+			break;
+		case CMD_OPT_MAX_CPUS:
+			if (dm_strtoi(optarg, NULL, 10, &max_cpus) ||
+			    max_cpus < 1 || max_cpus > VM_MAXCPU)
+				errx(EX_USAGE, "invalid max cpus %s", optarg);
+			break;
 		case 'h':
 			usage(0);
 		default:
@@ -939,6 +1469,18 @@ main(int argc, char *argv[])
 	argc -= optind;
 	argv += optind;
 
+	if (ioreq_poll_us > 0UL) {
+		if (ioreq_worker_num > 0)
+			errx(EX_USAGE, "--ioreq_poll and --ioreq_threads are exclusive");
+		if (!lapic_pt && !is_rtvm) {
+			pr_warn("--ioreq_poll needs IO completion polling, ignored\n");
+			ioreq_poll_us = 0UL;
+		}
+	}
+
+	if (max_cpus > 0 && (!acpi || lapic_pt))
+		errx(EX_USAGE, "--max_cpus needs -A, without --lapic_pt");
+
 	if (argc != 1)
 		usage(1);
 
@@ -948,11 +1490,16 @@ main(int argc, char *argv[])
 		exit(1);
 	}
 
-	if (!init_hugetlb()) {
+	/* the replay of an ioreq trace runs on plain memory */
+	if (!ioreq_trace_replaying() && !init_hugetlb()) {
 		pr_err("init_hugetlb failed\n");
 		exit(1);
 	}
 
+	/* returns in the clones only */
+	if (template_mode && template_run() != 0)
+		exit(1);
+
 	for (;;) {
 		pr_notice("vm_create: %s\n", vmname);
 		ctx = vm_create(vmname, (unsigned long)vhm_req_buf, &guest_ncpus);
@@ -973,6 +1520,14 @@ main(int argc, char *argv[])
 			goto fail;
 		}
 
+		/* the resets of the passthrough devices, along what follows */
+		pci_emul_prepare(ctx);
+
+		cpu_hotplug_init(guest_ncpus, max_cpus);
+		coalesced_mmio_init(ctx);
+		vcounter_init(ctx);
+		pioreg_init(ctx);
+
 		pr_notice("vm_setup_memory: size=0x%lx\n", memsize);
 		error = vm_setup_memory(ctx, memsize);
 		if (error) {
@@ -980,6 +1535,9 @@ main(int argc, char *argv[])
 			goto fail;
 		}
 
+		if (ioreq_trace_init(ctx, guest_ncpus) != 0)
+			goto mevent_fail;
+
 		error = mevent_init();
 		if (error) {
 			pr_err("Unable to initialize mevent (%d)\n", errno);
@@ -1052,6 +1610,7 @@ main(int argc, char *argv[])
 		mevent_deinit();
 		vm_unsetup_memory(ctx);
 		vm_destroy(ctx);
+		vcpu_stats_deinit();
 		_ctx = 0;
 
 		vm_set_suspend_mode(VM_SUSPEND_NONE);
@@ -1065,8 +1624,11 @@ mevent_fail:
 	vm_unsetup_memory(ctx);
 fail:
 	vm_destroy(ctx);
+	vcpu_stats_deinit();
 create_fail:
-	uninit_hugetlb();
+	ioreq_trace_deinit();
+	if (!ioreq_trace_replaying())
+		uninit_hugetlb();
 	deinit_loggers();
 	exit(ret);
 }
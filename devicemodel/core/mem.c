@@ -27,9 +27,17 @@
  */
 
 /*
- * Memory ranges are represented with an RB tree. On insertion, the range
- * is checked for overlaps. On lookup, the key has the same base and limit
- * so it can be searched within the range.
+ * Memory ranges are kept in two arrays sorted by address, one for the
+ * regular ranges and one for the fallback ones. On insertion, the range
+ * is checked for overlaps. On lookup, the arrays are binary searched.
+ *
+ * A published array is never modified: register_mem()/unregister_mem()
+ * build a new copy under mmio_mtx and swap it in, so that emulate_mem()
+ * looks the ranges up without taking any lock. The lookup is bracketed by
+ * the epoch the thread entered in, and a replaced copy is only freed once
+ * no thread is still in the lookup under an older epoch. The handler is
+ * called on a copy of the range, out of the lookup, so it may register or
+ * unregister ranges itself (e.g. when the guest moves a BAR).
  */
 
 #include <errno.h>
@@ -37,96 +45,170 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <sys/queue.h>
 
 #include "vmm.h"
+#include "vmmapi.h"
 #include "mem.h"
-#include "tree.h"
+#include "atomic.h"
+#include "log.h"
 
 #define MEMNAMESZ (80)
 
-struct mmio_rb_range {
-	RB_ENTRY(mmio_rb_range)	mr_link;	/* RB tree links */
+struct mmio_range {
+	uint64_t		mr_base;
+	uint64_t		mr_end;
 	struct mem_range	mr_param;
-	uint64_t                mr_base;
-	uint64_t                mr_end;
 };
 
-static RB_HEAD(mmio_rb_tree, mmio_rb_range) mmio_rb_root, mmio_rb_fallback;
-RB_PROTOTYPE_STATIC(mmio_rb_tree, mmio_rb_range, mr_link, mmio_rb_range_compare);
+struct mmio_table {
+	uint64_t		gen;	/* tells the copies apart */
+	int			n;
+	struct mmio_range	r[];
+};
 
-/*
- * Per-VM cache. Since most accesses from a vCPU will be to
- * consecutive addresses in a range, it makes sense to cache the
- * result of a lookup.
- */
-static struct mmio_rb_range	*mmio_hint __aligned(sizeof(struct mmio_rb_range *));
+/* A thread looking up the ranges, on its own cache line */
+struct mmio_reader {
+	uint64_t		epoch;	/* 0 out of the lookup */
+
+	/*
+	 * Since most accesses from a vCPU will be to consecutive
+	 * addresses in a range, cache the result of its last lookup.
+	 */
+	uint64_t		hint_gen;
+	int			hint;
+	LIST_ENTRY(mmio_reader)	link;
+};
 
-static pthread_rwlock_t mmio_rwlock;
+static struct mmio_table *mmio_root, *mmio_fallback;
+static uint64_t mmio_gen;
+static uint64_t mmio_epoch = 1;
+static LIST_HEAD(, mmio_reader) mmio_readers =
+	LIST_HEAD_INITIALIZER(mmio_readers);
+static pthread_mutex_t mmio_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t mmio_reader_key;
+static pthread_once_t mmio_once = PTHREAD_ONCE_INIT;
 
-static int
-mmio_rb_range_compare(struct mmio_rb_range *a, struct mmio_rb_range *b)
+static pthread_mutex_t emul_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+void
+emul_lock(void)
 {
-	if (a->mr_end < b->mr_base)
-		return -1;
-	else if (a->mr_base > b->mr_end)
-		return 1;
-	return 0;
+	pthread_mutex_lock(&emul_mtx);
 }
 
-static int
-mmio_rb_lookup(struct mmio_rb_tree *rbt, uint64_t addr,
-		struct mmio_rb_range **entry)
+void
+emul_unlock(void)
 {
-	struct mmio_rb_range find, *res;
+	pthread_mutex_unlock(&emul_mtx);
+}
 
-	find.mr_base = find.mr_end = addr;
+static void
+mmio_reader_free(void *arg)
+{
+	struct mmio_reader *rd = arg;
 
-	res = RB_FIND(mmio_rb_tree, rbt, &find);
+	pthread_mutex_lock(&mmio_mtx);
+	LIST_REMOVE(rd, link);
+	pthread_mutex_unlock(&mmio_mtx);
+	free(rd);
+}
 
-	if (res != NULL) {
-		*entry = res;
-		return 0;
+static void
+mmio_reader_key_init(void)
+{
+	pthread_key_create(&mmio_reader_key, mmio_reader_free);
+}
+
+static struct mmio_reader *
+mmio_reader_get(void)
+{
+	struct mmio_reader *rd;
+	void *p;
+
+	rd = pthread_getspecific(mmio_reader_key);
+	if (rd != NULL)
+		return rd;
+
+	if (posix_memalign(&p, 64, sizeof(struct mmio_reader)) != 0)
+		return NULL;
+	rd = p;
+	bzero(rd, sizeof(struct mmio_reader));
+	if (pthread_setspecific(mmio_reader_key, rd) != 0) {
+		free(rd);
+		return NULL;
 	}
 
-	return -1;
+	pthread_mutex_lock(&mmio_mtx);
+	LIST_INSERT_HEAD(&mmio_readers, rd, link);
+	pthread_mutex_unlock(&mmio_mtx);
+	return rd;
 }
 
-static int
-mmio_rb_add(struct mmio_rb_tree *rbt, struct mmio_rb_range *new)
+static struct mmio_range *
+mmio_table_lookup(struct mmio_table *t, uint64_t addr, int *idx)
 {
-	struct mmio_rb_range *overlap;
-
-	overlap = RB_INSERT(mmio_rb_tree, rbt, new);
+	int lo, hi, mid;
+
+	if (t == NULL)
+		return NULL;
+
+	lo = 0;
+	hi = t->n - 1;
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (addr < t->r[mid].mr_base)
+			hi = mid - 1;
+		else if (addr > t->r[mid].mr_end)
+			lo = mid + 1;
+		else {
+			*idx = mid;
+			return &t->r[mid];
+		}
+	}
 
-	if (overlap != NULL) {
-#ifdef RB_DEBUG
-		printf("overlap detected: new %lx:%lx, tree %lx:%lx\n",
-		       new->mr_base, new->mr_end,
-		       overlap->mr_base, overlap->mr_end);
-#endif
+	return NULL;
+}
 
-		return -1;
-	}
+static struct mmio_table *
+mmio_table_alloc(int n)
+{
+	struct mmio_table *t;
 
-	return 0;
+	t = malloc(sizeof(struct mmio_table) + n * sizeof(struct mmio_range));
+	if (t != NULL)
+		t->n = n;
+	return t;
 }
 
-#if RB_DEBUG
+/*
+ * Swap in the new copy and free the old one once no reader may use it.
+ * Called with mmio_mtx held.
+ */
 static void
-mmio_rb_dump(struct mmio_rb_tree *rbt)
+mmio_table_publish(struct mmio_table **tp, struct mmio_table *t)
 {
-	struct mmio_rb_range *np;
+	struct mmio_reader *rd;
+	struct mmio_table *old;
+	uint64_t epoch, e;
+
+	t->gen = ++mmio_gen;
+	old = atomic_xchg(tp, t);
 
-	pthread_rwlock_rdlock(&mmio_rwlock);
-	RB_FOREACH(np, mmio_rb_tree, rbt) {
-		printf(" %lx:%lx, %s\n", np->mr_base, np->mr_end,
-		       np->mr_param.name);
+	/*
+	 * The readers entering from now on see the new copy, wait for
+	 * those which entered before.
+	 */
+	epoch = atomic_add_fetch(&mmio_epoch, 1);
+	LIST_FOREACH(rd, &mmio_readers, link) {
+		while ((e = atomic_load(&rd->epoch)) != 0 && e < epoch)
+			sched_yield();
 	}
-	pthread_rwlock_unlock(&mmio_rwlock);
-}
-#endif
 
-RB_GENERATE_STATIC(mmio_rb_tree, mmio_rb_range, mr_link, mmio_rb_range_compare);
+	free(old);
+}
 
 static int
 mem_read(void *ctx, int vcpu, uint64_t gpa, uint64_t *rval, int size, void *arg)
@@ -155,125 +237,270 @@ emulate_mem(struct vmctx *ctx, struct mmio_request *mmio_req)
 {
 	uint64_t paddr = mmio_req->address;
 	int size = mmio_req->size;
-	struct mmio_rb_range *hint, *entry = NULL;
-	int err;
+	struct mmio_reader *rd;
+	struct mmio_table *t;
+	struct mmio_range *entry = NULL;
+	struct mem_range mr;
+	int serialize;
+	int err, idx;
+
+	rd = mmio_reader_get();
+	if (rd != NULL)
+		atomic_store(&rd->epoch, atomic_load(&mmio_epoch));
+	else
+		pthread_mutex_lock(&mmio_mtx);
 
-	pthread_rwlock_rdlock(&mmio_rwlock);
+	t = atomic_load(&mmio_root);
 
 	/*
-	 * First check the per-VM cache
+	 * First check the per-thread cache
 	 */
-	hint = mmio_hint;
-
-	if (hint && paddr >= hint->mr_base && paddr <= hint->mr_end)
-		entry = hint;
-	else if (mmio_rb_lookup(&mmio_rb_root, paddr, &entry) == 0)
-		/* Update the per-VM cache */
-		mmio_hint = entry;
-	else if (mmio_rb_lookup(&mmio_rb_fallback, paddr, &entry)) {
-		pthread_rwlock_unlock(&mmio_rwlock);
-		return -ESRCH;
+	if (rd != NULL && t != NULL && rd->hint_gen == t->gen) {
+		entry = &t->r[rd->hint];
+		if (paddr < entry->mr_base || paddr > entry->mr_end)
+			entry = NULL;
+	}
+
+	if (entry == NULL) {
+		entry = mmio_table_lookup(t, paddr, &idx);
+		if (entry != NULL && rd != NULL) {
+			/* Update the per-thread cache */
+			rd->hint_gen = t->gen;
+			rd->hint = idx;
+		}
 	}
 
-	pthread_rwlock_unlock(&mmio_rwlock);
+	if (entry == NULL)
+		entry = mmio_table_lookup(atomic_load(&mmio_fallback), paddr,
+				&idx);
+
+	if (entry != NULL)
+		mr = entry->mr_param;
+
+	if (rd != NULL)
+		atomic_store(&rd->epoch, 0);
+	else
+		pthread_mutex_unlock(&mmio_mtx);
 
 	if (entry == NULL)
-		return -EINVAL;
+		return -ESRCH;
+
+	serialize = (mr.flags & MEM_F_CONCURRENT) == 0;
+	if (serialize)
+		emul_lock();
 
 	if (mmio_req->direction == REQUEST_READ)
 		err = mem_read(ctx, 0, paddr, (uint64_t *)&mmio_req->value,
-				size, &entry->mr_param);
+				size, &mr);
 	else
 		err = mem_write(ctx, 0, paddr, mmio_req->value,
-				size, &entry->mr_param);
+				size, &mr);
+
+	if (serialize)
+		emul_unlock();
 
 	return err;
 }
 
+static struct acrn_coalesced_mmio_ring coalesced_ring;
+static bool coalesced_enabled;
+static pthread_mutex_t coalesced_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+void
+coalesced_mmio_init(struct vmctx *ctx)
+{
+	coalesced_enabled = false;
+	bzero(&coalesced_ring, sizeof(coalesced_ring));
+	if (vm_set_coalesced_mmio_ring(ctx, &coalesced_ring) == 0)
+		coalesced_enabled = true;
+	else
+		pr_info("coalesced mmio unsupported, errno %d\n", errno);
+}
+
+void
+coalesced_mmio_drain(struct vmctx *ctx)
+{
+	struct acrn_coalesced_mmio_entry *entry;
+	struct mmio_request mmio_req;
+	uint32_t first;
+
+	if (!coalesced_enabled ||
+	    atomic_load(&coalesced_ring.first) == atomic_load(&coalesced_ring.last))
+		return;
+
+	pthread_mutex_lock(&coalesced_mtx);
+	first = coalesced_ring.first;
+	while (first != atomic_load(&coalesced_ring.last)) {
+		entry = &coalesced_ring.entries[first];
+		bzero(&mmio_req, sizeof(mmio_req));
+		mmio_req.direction = REQUEST_WRITE;
+		mmio_req.address = entry->address;
+		mmio_req.size = entry->size;
+		mmio_req.value = entry->value;
+		if (emulate_mem(ctx, &mmio_req) != 0)
+			pr_warn("coalesced mmio write at 0x%lx dropped\n",
+				entry->address);
+
+		/* gives the entry back to the hypervisor */
+		first = (first + 1) % ACRN_COALESCED_MMIO_MAX;
+		atomic_store(&coalesced_ring.first, first);
+	}
+	pthread_mutex_unlock(&coalesced_mtx);
+}
+
 static int
-register_mem_int(struct mmio_rb_tree *rbt, struct mem_range *memp)
+coalesced_mmio_zone(struct vmctx *ctx, uint64_t base, uint64_t size,
+		uint32_t flags)
 {
-	struct mmio_rb_range *entry, *mrp;
-	int err;
+	struct acrn_coalesced_mmio_zone zone;
+
+	if (!coalesced_enabled)
+		return -1;
+
+	bzero(&zone, sizeof(zone));
+	zone.addr = base;
+	zone.size = size;
+	zone.flags = flags;
+	return vm_coalesced_mmio_zone(ctx, &zone);
+}
+
+int
+register_coalesced_mmio(struct vmctx *ctx, uint64_t base, uint64_t size)
+{
+	return coalesced_mmio_zone(ctx, base, size, 0);
+}
+
+int
+unregister_coalesced_mmio(struct vmctx *ctx, uint64_t base, uint64_t size)
+{
+	int error;
+
+	error = coalesced_mmio_zone(ctx, base, size,
+			ACRN_COALESCED_MMIO_FLAG_DEASSIGN);
+
+	/* the recorded writes belong to the old range */
+	coalesced_mmio_drain(ctx);
+	return error;
+}
+
+static int
+register_mem_int(struct mmio_table **tp, struct mem_range *memp)
+{
+	struct mmio_table *old, *t;
+	uint64_t base, end;
+	int err, i, n;
 
 	err = -1;
+	base = memp->base;
+	end = memp->base + memp->size - 1;
+
+	pthread_mutex_lock(&mmio_mtx);
+	old = *tp;
+	n = (old != NULL) ? old->n : 0;
 
-	mrp = malloc(sizeof(struct mmio_rb_range));
-
-	if (mrp != NULL) {
-		mrp->mr_param = *memp;
-		mrp->mr_base = memp->base;
-		mrp->mr_end = memp->base + memp->size - 1;
-		pthread_rwlock_wrlock(&mmio_rwlock);
-		if (mmio_rb_lookup(rbt, memp->base, &entry) != 0)
-			err = mmio_rb_add(rbt, mrp);
-		pthread_rwlock_unlock(&mmio_rwlock);
-		if (err)
-			free(mrp);
+	/* the first range not below the new one must be above it */
+	for (i = 0; i < n && old->r[i].mr_end < base; i++)
+		;
+	if (i < n && old->r[i].mr_base <= end) {
+#ifdef RB_DEBUG
+		printf("overlap detected: new %lx:%lx, table %lx:%lx\n",
+		       base, end, old->r[i].mr_base, old->r[i].mr_end);
+#endif
+		goto out;
 	}
 
+	t = mmio_table_alloc(n + 1);
+	if (t == NULL)
+		goto out;
+
+	if (i > 0)
+		memcpy(t->r, old->r, i * sizeof(struct mmio_range));
+	t->r[i].mr_base = base;
+	t->r[i].mr_end = end;
+	t->r[i].mr_param = *memp;
+	if (i < n)
+		memcpy(&t->r[i + 1], &old->r[i],
+			(n - i) * sizeof(struct mmio_range));
+
+	mmio_table_publish(tp, t);
+	err = 0;
+out:
+	pthread_mutex_unlock(&mmio_mtx);
 	return err;
 }
 
 int
 register_mem(struct mem_range *memp)
 {
-	return register_mem_int(&mmio_rb_root, memp);
+	return register_mem_int(&mmio_root, memp);
 }
 
 int
 register_mem_fallback(struct mem_range *memp)
 {
-	return register_mem_int(&mmio_rb_fallback, memp);
+	return register_mem_int(&mmio_fallback, memp);
 }
 
 static int
-unregister_mem_int(struct mmio_rb_tree *rbt, struct mem_range *memp)
+unregister_mem_int(struct mmio_table **tp, struct mem_range *memp)
 {
 	struct mem_range *mr;
-	struct mmio_rb_range *entry = NULL;
-	int err;
-
-	pthread_rwlock_wrlock(&mmio_rwlock);
-	err = mmio_rb_lookup(rbt, memp->base, &entry);
-	if (err == 0) {
-		mr = &entry->mr_param;
-		if (strncmp(mr->name, memp->name, MEMNAMESZ)
-			|| (mr->base != memp->base) || (mr->size != memp->size)
-			|| ((mr->flags & MEM_F_IMMUTABLE) != 0)) {
-			err = -1;
-		} else {
-			RB_REMOVE(mmio_rb_tree, rbt, entry);
-
-			/* flush Per-VM cache */
-			if (mmio_hint == entry)
-				mmio_hint = NULL;
-		}
-	}
-	pthread_rwlock_unlock(&mmio_rwlock);
+	struct mmio_table *old, *t;
+	struct mmio_range *entry;
+	int err, i;
 
-	if (entry)
-		free(entry);
+	err = -1;
 
+	pthread_mutex_lock(&mmio_mtx);
+	old = *tp;
+	entry = mmio_table_lookup(old, memp->base, &i);
+	if (entry == NULL)
+		goto out;
+
+	mr = &entry->mr_param;
+	if (strncmp(mr->name, memp->name, MEMNAMESZ)
+		|| (mr->base != memp->base) || (mr->size != memp->size)
+		|| ((mr->flags & MEM_F_IMMUTABLE) != 0))
+		goto out;
+
+	t = mmio_table_alloc(old->n - 1);
+	if (t == NULL)
+		goto out;
+
+	memcpy(t->r, old->r, i * sizeof(struct mmio_range));
+	memcpy(&t->r[i], &old->r[i + 1],
+		(old->n - i - 1) * sizeof(struct mmio_range));
+
+	/* the per-thread caches are dropped with the generation */
+	mmio_table_publish(tp, t);
+	err = 0;
+out:
+	pthread_mutex_unlock(&mmio_mtx);
 	return err;
 }
 
 int
 unregister_mem(struct mem_range *memp)
 {
-	return unregister_mem_int(&mmio_rb_root, memp);
+	return unregister_mem_int(&mmio_root, memp);
 }
 
 int
 unregister_mem_fallback(struct mem_range *memp)
 {
-	return unregister_mem_int(&mmio_rb_fallback, memp);
+	return unregister_mem_int(&mmio_fallback, memp);
 }
 
 void
 init_mem(void)
 {
-	RB_INIT(&mmio_rb_root);
-	RB_INIT(&mmio_rb_fallback);
-	pthread_rwlock_init(&mmio_rwlock, NULL);
+	pthread_once(&mmio_once, mmio_reader_key_init);
+
+	/* no vCPU runs, drop what is left from a previous boot */
+	pthread_mutex_lock(&mmio_mtx);
+	free(mmio_root);
+	free(mmio_fallback);
+	mmio_root = NULL;
+	mmio_fallback = NULL;
+	pthread_mutex_unlock(&mmio_mtx);
 }
@@ -29,32 +29,37 @@
 /*
  * Micro event library for FreeBSD, designed for a single i/o thread
  * using EPOLL, and having events be persistent by default.
+ *
+ * The events are dispatched by the main loop, run on the main thread from
+ * mevent_dispatch(), unless they are added to a loop created with
+ * mevent_loop_create(), which has a thread of its own. The devices whose
+ * events must not wait for the handlers of the others have their own loop.
  */
 #include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include <fcntl.h>
+#include <sched.h>
 #include <unistd.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/queue.h>
 #include <pthread.h>
 
 #include "mevent.h"
 #include "vmmapi.h"
+#include "atomic.h"
+#include "log.h"
 
-#define	MEVENT_MAX	64
+#define	MEVENT_MAX	256	/* events handled per epoll_wait() */
 
 #define	MEV_ADD		1
 #define	MEV_ENABLE	2
 #define	MEV_DISABLE	3
 #define	MEV_DEL_PENDING	4
 
-static int epoll_fd;
-static pthread_t mevent_tid;
-static int mevent_pipefd[2];
-static pthread_mutex_t mevent_lmutex = PTHREAD_MUTEX_INITIALIZER;
-
 struct mevent {
 	void			(*run)(int, enum ev_type, void *);
 	void			*run_param;
@@ -67,62 +72,100 @@ struct mevent {
 	int			me_state;
 
 	int			closefd;
+	struct mevent_loop	*me_loop;
 	LIST_ENTRY(mevent)	me_list;
 };
 
-static LIST_HEAD(listhead, mevent) global_head;
-/* List holds the mevent node which is requested to deleted */
-static LIST_HEAD(del_listhead, mevent) del_head;
+struct mevent_loop {
+	int			epoll_fd;
+	pthread_t		tid;
+	bool			started;
+	volatile bool		quit;	/* stop the loop thread */
+	int			notify_fd;	/* eventfd, -1 until set up */
+	int			notified;	/* notify_fd written, not read */
+	pthread_mutex_t		lmutex;
+
+	LIST_HEAD(listhead, mevent) global_head;
+	/* List holds the mevent node which is requested to deleted */
+	LIST_HEAD(del_listhead, mevent) del_head;
+};
+
+/* totals of all the loops, see mevent_get_stats() */
+static uint64_t mevent_wakeups;
+static uint64_t mevent_events;
+
+static struct mevent_loop mevent_main_loop = {
+	.notify_fd = -1,
+	.lmutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static inline struct mevent_loop *
+mevent_loop_get(struct mevent_loop *loop)
+{
+	return (loop != NULL) ? loop : &mevent_main_loop;
+}
 
 static void
-mevent_qlock(void)
+mevent_qlock(struct mevent_loop *loop)
 {
-	pthread_mutex_lock(&mevent_lmutex);
+	pthread_mutex_lock(&loop->lmutex);
 }
 
 static void
-mevent_qunlock(void)
+mevent_qunlock(struct mevent_loop *loop)
 {
-	pthread_mutex_unlock(&mevent_lmutex);
+	pthread_mutex_unlock(&loop->lmutex);
 }
 
 static bool
-is_dispatch_thread(void)
+is_dispatch_thread(struct mevent_loop *loop)
 {
-	return (pthread_self() == mevent_tid);
+	return (loop->started && pthread_self() == loop->tid);
 }
 
 static void
-mevent_pipe_read(int fd, enum ev_type type, void *param)
+mevent_notify_read(int fd, enum ev_type type, void *param)
 {
-	char buf[MEVENT_MAX];
-	ssize_t status;
+	struct mevent_loop *loop = param;
+	uint64_t cnt;
 
 	/*
-	 * Drain the pipe read side. The fd is non-blocking so this is
-	 * safe to do.
+	 * Clear the flag first, a notify racing with the read then either
+	 * is consumed here, before the loop goes on, or wakes it again.
+	 * The fd is non-blocking and edge triggered, one read drains it.
 	 */
-	do {
-		status = read(fd, buf, sizeof(buf));
-	} while (status == MEVENT_MAX);
+	atomic_store(&loop->notified, 0);
+	if (read(fd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+		pr_warn("%s, read of the notify eventfd failed (%d)\n",
+			__func__, errno);
 }
 
-/* On error, -1 is returned, else return zero */
-int
-mevent_notify(void)
+static int
+mevent_loop_notify(struct mevent_loop *loop)
 {
-	char c;
+	uint64_t cnt = 1;
 
 	/*
-	 * If calling from outside the i/o thread, write a byte on the
-	 * pipe to force the i/o thread to exit the blocking epoll call.
+	 * If calling from outside the i/o thread, signal the eventfd to
+	 * force the i/o thread to exit the blocking epoll call. Once it is
+	 * signaled, the others have nothing to add until the loop reads it.
 	 */
-	if (mevent_pipefd[1] != 0 && !is_dispatch_thread())
-		if (write(mevent_pipefd[1], &c, 1) <= 0)
+	if (loop->notify_fd >= 0 && !is_dispatch_thread(loop) &&
+	    atomic_xchg(&loop->notified, 1) == 0)
+		if (write(loop->notify_fd, &cnt, sizeof(cnt)) <= 0) {
+			atomic_store(&loop->notified, 0);
 			return -1;
+		}
 	return 0;
 }
 
+/* On error, -1 is returned, else return zero */
+int
+mevent_notify(void)
+{
+	return mevent_loop_notify(&mevent_main_loop);
+}
+
 static int
 mevent_kq_filter(struct mevent *mevp)
 {
@@ -146,14 +189,14 @@ mevent_kq_filter(struct mevent *mevp)
 }
 
 static void
-mevent_destroy(void)
+mevent_destroy(struct mevent_loop *loop)
 {
 	struct mevent *mevp, *tmpp;
 
-	mevent_qlock();
-	list_foreach_safe(mevp, &global_head, me_list, tmpp) {
+	mevent_qlock(loop);
+	list_foreach_safe(mevp, &loop->global_head, me_list, tmpp) {
 		LIST_REMOVE(mevp, me_list);
-		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, mevp->me_fd, NULL);
+		epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, mevp->me_fd, NULL);
 
                if ((mevp->me_type == EVF_READ ||
                     mevp->me_type == EVF_READ_ET ||
@@ -169,24 +212,20 @@ mevent_destroy(void)
 	}
 
 	/* the mevp in del_head was removed from epoll when add it
-	 * to del_head already.
+	 * to del_head already, its fd is closed as its owner asked.
 	 */
-	list_foreach_safe(mevp, &del_head, me_list, tmpp) {
+	list_foreach_safe(mevp, &loop->del_head, me_list, tmpp) {
 		LIST_REMOVE(mevp, me_list);
 
-               if ((mevp->me_type == EVF_READ ||
-                    mevp->me_type == EVF_READ_ET ||
-                    mevp->me_type == EVF_WRITE ||
-                    mevp->me_type == EVF_WRITE_ET) &&
-                    mevp->me_fd != STDIN_FILENO)
-                       close(mevp->me_fd);
+		if (mevp->closefd)
+			close(mevp->me_fd);
 
 		if (mevp->teardown)
 			mevp->teardown(mevp->teardown_param);
 
 		free(mevp);
 	}
-	mevent_qunlock();
+	mevent_qunlock(loop);
 }
 
 static void
@@ -204,7 +243,7 @@ mevent_handle(struct epoll_event *kev, int numev)
 }
 
 struct mevent *
-mevent_add(int tfd, enum ev_type type,
+mevent_add_loop(struct mevent_loop *loop, int tfd, enum ev_type type,
 	   void (*run)(int, enum ev_type, void *), void *run_param,
 	   void (*teardown)(void *), void *teardown_param)
 {
@@ -218,15 +257,17 @@ mevent_add(int tfd, enum ev_type type,
 	if (type == EVF_TIMER)
 		return NULL;
 
-	mevent_qlock();
+	loop = mevent_loop_get(loop);
+
+	mevent_qlock(loop);
 	/* Verify that the fd/type tuple is not present in the list */
-	LIST_FOREACH(lp, &global_head, me_list) {
+	LIST_FOREACH(lp, &loop->global_head, me_list) {
 		if (lp->me_fd == tfd && lp->me_type == type) {
-			mevent_qunlock();
+			mevent_qunlock(loop);
 			return lp;
 		}
 	}
-	mevent_qunlock();
+	mevent_qunlock(loop);
 
 	/*
 	 * Allocate an entry, populate it, and add it to the list.
@@ -238,6 +279,7 @@ mevent_add(int tfd, enum ev_type type,
 	mevp->me_fd = tfd;
 	mevp->me_type = type;
 	mevp->me_state = 1;
+	mevp->me_loop = loop;
 
 	mevp->run = run;
 	mevp->run_param = run_param;
@@ -246,12 +288,12 @@ mevent_add(int tfd, enum ev_type type,
 
 	ee.events = mevent_kq_filter(mevp);
 	ee.data.ptr = mevp;
-	ret = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, mevp->me_fd, &ee);
+	ret = epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, mevp->me_fd, &ee);
 
 	if (ret == 0) {
-		mevent_qlock();
-		LIST_INSERT_HEAD(&global_head, mevp, me_list);
-		mevent_qunlock();
+		mevent_qlock(loop);
+		LIST_INSERT_HEAD(&loop->global_head, mevp, me_list);
+		mevent_qunlock(loop);
 
 		return mevp;
 	} else {
@@ -260,29 +302,39 @@ mevent_add(int tfd, enum ev_type type,
 	}
 }
 
+struct mevent *
+mevent_add(int tfd, enum ev_type type,
+	   void (*run)(int, enum ev_type, void *), void *run_param,
+	   void (*teardown)(void *), void *teardown_param)
+{
+	return mevent_add_loop(NULL, tfd, type, run, run_param,
+			teardown, teardown_param);
+}
+
 int
 mevent_enable(struct mevent *evp)
 {
 	int ret;
 	struct epoll_event ee;
+	struct mevent_loop *loop = evp->me_loop;
 	struct mevent *lp, *mevp = NULL;
 
-	mevent_qlock();
+	mevent_qlock(loop);
 	/* Verify that the fd/type tuple is not present in the list */
-	LIST_FOREACH(lp, &global_head, me_list) {
+	LIST_FOREACH(lp, &loop->global_head, me_list) {
 		if (lp == evp) {
 			mevp = lp;
 			break;
 		}
 	}
-	mevent_qunlock();
+	mevent_qunlock(loop);
 
 	if (!mevp)
 		return -1;
 
 	ee.events = mevent_kq_filter(mevp);
 	ee.data.ptr = mevp;
-	ret = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, mevp->me_fd, &ee);
+	ret = epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, mevp->me_fd, &ee);
 	if (ret < 0 && errno == EEXIST)
 		ret = 0;
 
@@ -294,7 +346,7 @@ mevent_disable(struct mevent *evp)
 {
 	int ret;
 
-	ret = epoll_ctl(epoll_fd, EPOLL_CTL_DEL, evp->me_fd, NULL);
+	ret = epoll_ctl(evp->me_loop->epoll_fd, EPOLL_CTL_DEL, evp->me_fd, NULL);
 	if (ret < 0 && errno == ENOENT)
 		ret = 0;
 
@@ -304,20 +356,22 @@ mevent_disable(struct mevent *evp)
 static void
 mevent_add_to_del_list(struct mevent *evp, int closefd)
 {
-	mevent_qlock();
-	LIST_INSERT_HEAD(&del_head, evp, me_list);
-	mevent_qunlock();
+	struct mevent_loop *loop = evp->me_loop;
+
+	mevent_qlock(loop);
+	LIST_INSERT_HEAD(&loop->del_head, evp, me_list);
+	mevent_qunlock(loop);
 
-	mevent_notify();
+	mevent_loop_notify(loop);
 }
 
 static void
-mevent_drain_del_list(void)
+mevent_drain_del_list(struct mevent_loop *loop)
 {
 	struct mevent *evp, *tmpp;
 
-	mevent_qlock();
-	list_foreach_safe(evp, &del_head, me_list, tmpp) {
+	mevent_qlock(loop);
+	list_foreach_safe(evp, &loop->del_head, me_list, tmpp) {
 		LIST_REMOVE(evp, me_list);
 		if (evp->closefd) {
 			close(evp->me_fd);
@@ -327,20 +381,22 @@ mevent_drain_del_list(void)
 			evp->teardown(evp->teardown_param);
 		free(evp);
 	}
-	mevent_qunlock();
+	mevent_qunlock(loop);
 }
 
 static int
 mevent_delete_event(struct mevent *evp, int closefd)
 {
-	mevent_qlock();
+	struct mevent_loop *loop = evp->me_loop;
+
+	mevent_qlock(loop);
 	LIST_REMOVE(evp, me_list);
-	mevent_qunlock();
+	mevent_qunlock(loop);
 	evp->me_state = 0;
 	evp->closefd = closefd;
 
-	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, evp->me_fd, NULL);
-	if (!is_dispatch_thread() && evp->teardown != NULL) {
+	epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, evp->me_fd, NULL);
+	if (!is_dispatch_thread(loop) && evp->teardown != NULL) {
 		mevent_add_to_del_list(evp, closefd);
 	} else {
 		if (evp->closefd) {
@@ -366,18 +422,144 @@ mevent_delete_close(struct mevent *evp)
 	return mevent_delete_event(evp, 1);
 }
 
+/*
+ * Open the eventfd that will be used for other threads to force the
+ * blocking epoll call of the loop to exit by signaling it.
+ */
+static int
+mevent_loop_notify_init(struct mevent_loop *loop)
+{
+	int fd;
+
+	fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	/*
+	 * Add internal event handler for the eventfd
+	 */
+	if (mevent_add_loop(loop, fd, EVF_READ_ET, mevent_notify_read, loop,
+			NULL, NULL) == NULL) {
+		close(fd);
+		return -1;
+	}
+
+	loop->notified = 0;
+	loop->notify_fd = fd;
+	return 0;
+}
+
 static void
-mevent_set_name(void)
+mevent_loop_run(struct mevent_loop *loop, struct epoll_event *eventlist)
+{
+	int ret;
+
+	/*
+	 * Block awaiting events
+	 */
+	ret = epoll_wait(loop->epoll_fd, eventlist, MEVENT_MAX, -1);
+
+	if (ret == -1 && errno != EINTR)
+		perror("Error return from epoll_wait");
+
+	atomic_fetch_add(&mevent_wakeups, 1UL);
+	if (ret > 0)
+		atomic_fetch_add(&mevent_events, (uint64_t)ret);
+
+	/*
+	 * Handle reported events
+	 */
+	mevent_handle(eventlist, ret);
+	mevent_drain_del_list(loop);
+}
+
+static void *
+mevent_loop_thread(void *param)
 {
-	pthread_setname_np(mevent_tid, "mevent");
+	struct epoll_event eventlist[MEVENT_MAX];
+	struct mevent_loop *loop = param;
+
+	while (!loop->quit)
+		mevent_loop_run(loop, eventlist);
+
+	return NULL;
+}
+
+struct mevent_loop *
+mevent_loop_create(const char *name, int cpu)
+{
+	struct mevent_loop *loop;
+	cpu_set_t cpus;
+
+	loop = calloc(1, sizeof(struct mevent_loop));
+	if (loop == NULL)
+		return NULL;
+
+	loop->notify_fd = -1;
+	pthread_mutex_init(&loop->lmutex, NULL);
+	loop->epoll_fd = epoll_create1(0);
+	if (loop->epoll_fd < 0)
+		goto fail;
+
+	if (mevent_loop_notify_init(loop) < 0)
+		goto fail;
+
+	if (pthread_create(&loop->tid, NULL, mevent_loop_thread, loop) != 0)
+		goto fail;
+	loop->started = true;
+	pthread_setname_np(loop->tid, name);
+
+	if (cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		if (pthread_setaffinity_np(loop->tid, sizeof(cpus), &cpus) != 0)
+			pr_warn("%s, failed to pin %s to cpu %d\n",
+				__func__, name, cpu);
+	}
+
+	return loop;
+
+fail:
+	pr_err("%s, failed to create %s\n", __func__, name);
+	/* closes the eventfd */
+	mevent_destroy(loop);
+	if (loop->epoll_fd >= 0)
+		close(loop->epoll_fd);
+	pthread_mutex_destroy(&loop->lmutex);
+	free(loop);
+	return NULL;
+}
+
+void
+mevent_loop_destroy(struct mevent_loop *loop)
+{
+	if (loop == NULL || loop == &mevent_main_loop)
+		return;
+
+	loop->quit = true;
+	mevent_loop_notify(loop);
+	pthread_join(loop->tid, NULL);
+	loop->started = false;
+
+	mevent_destroy(loop);
+	close(loop->epoll_fd);
+	pthread_mutex_destroy(&loop->lmutex);
+	free(loop);
+}
+
+void
+mevent_get_stats(uint64_t *wakeups, uint64_t *events)
+{
+	*wakeups = atomic_load(&mevent_wakeups);
+	*events = atomic_load(&mevent_events);
 }
 
 int
 mevent_init(void)
 {
-	epoll_fd = epoll_create1(0);
+	mevent_main_loop.epoll_fd = epoll_create1(0);
 
-	if (epoll_fd >= 0)
+	if (mevent_main_loop.epoll_fd >= 0)
 		return 0;
 	else
 		return -1;
@@ -386,59 +568,31 @@ mevent_init(void)
 void
 mevent_deinit(void)
 {
-	mevent_destroy();
-	close(epoll_fd);
-	if (mevent_pipefd[1] != 0)
-		close(mevent_pipefd[1]);
+	/* closes the eventfd too */
+	mevent_main_loop.notify_fd = -1;
+	mevent_destroy(&mevent_main_loop);
+	close(mevent_main_loop.epoll_fd);
 }
 
 void
 mevent_dispatch(void)
 {
 	struct epoll_event eventlist[MEVENT_MAX];
+	struct mevent_loop *loop = &mevent_main_loop;
 
-	struct mevent *pipev;
-	int ret;
-
-	mevent_tid = pthread_self();
-	mevent_set_name();
+	loop->tid = pthread_self();
+	loop->started = true;
+	pthread_setname_np(loop->tid, "mevent");
 
-	/*
-	 * Open the pipe that will be used for other threads to force
-	 * the blocking kqueue call to exit by writing to it. Set the
-	 * descriptor to non-blocking.
-	 */
-	ret = pipe2(mevent_pipefd, O_NONBLOCK);
-	if (ret < 0) {
-		perror("pipe");
-		exit(0);
-	}
-
-	/*
-	 * Add internal event handler for the pipe write fd
-	 */
-	pipev = mevent_add(mevent_pipefd[0], EVF_READ, mevent_pipe_read, NULL, NULL, NULL);
-	if (!pipev) {
-		fprintf(stderr, "pipefd mevent_add failed\n");
+	if (mevent_loop_notify_init(loop) < 0) {
+		perror("eventfd");
 		exit(0);
 	}
 
 	for (;;) {
 		int suspend_mode;
 
-		/*
-		 * Block awaiting events
-		 */
-		ret = epoll_wait(epoll_fd, eventlist, MEVENT_MAX, -1);
-
-		if (ret == -1 && errno != EINTR)
-			perror("Error return from epoll_wait");
-
-		/*
-		 * Handle reported events
-		 */
-		mevent_handle(eventlist, ret);
-		mevent_drain_del_list();
+		mevent_loop_run(loop, eventlist);
 
 		suspend_mode = vm_get_suspend_mode();
 		if ((suspend_mode != VM_SUSPEND_NONE) &&
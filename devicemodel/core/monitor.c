@@ -11,6 +11,7 @@
  */
 
 #include <stdio.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -23,7 +24,10 @@
 #include "acrn_mngr.h"
 #include "pm.h"
 #include "vmmapi.h"
+#include "block_if.h"
 #include "log.h"
+#include "snapshot.h"
+#include "acpi.h"
 
 #define INTR_STORM_MONITOR_PERIOD	10 /* 10 seconds */
 #define INTR_STORM_THRESHOLD	100000 /* 10K times per second */
@@ -271,6 +275,74 @@ int set_wakeup_timer(time_t t)
 	return ack.data.err;
 }
 
+/*
+ * Ask acrnd for the memory of the UOS from its hugepage pool, pages[0]
+ * of 2M and pages[1] of 1G. On success the pages are in the files named
+ * after the UOS in the pool mounts.
+ */
+int acrnd_get_hugepages(const unsigned int *pages, int nlvl)
+{
+	int acrnd_fd;
+	struct mngr_msg req;
+	struct mngr_msg ack;
+	int i, ret;
+
+	if (nlvl > ACRN_HUGETLB_POOL_LVS)
+		return -1;
+
+	acrnd_fd = mngr_open_un("acrnd", MNGR_CLIENT);
+	if (acrnd_fd < 0) {
+		return -1;
+	}
+
+	memset(&req, 0, sizeof(struct mngr_msg));
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = ACRND_HUGETLB;
+	req.timestamp = time(NULL);
+
+	strncpy(req.data.acrnd_hugetlb.vmname, vmname,
+			sizeof(req.data.acrnd_hugetlb.vmname) - 1);
+	for (i = 0; i < nlvl; i++)
+		req.data.acrnd_hugetlb.pages[i] = pages[i];
+
+	memset(&ack, 0, sizeof(struct mngr_msg));
+	ret = mngr_send_msg(acrnd_fd, &req, &ack, 2);
+	mngr_close(acrnd_fd);
+	if (ret != sizeof(ack)) {
+		return -1;
+	}
+
+	return ack.data.err;
+}
+
+/*
+ * Tell acrnd the VM changed to state, an enum vm_state of acrn_mngr.h.
+ * acrnd keeps the VM states from these rather than querying the DMs.
+ */
+void monitor_notify_state(int state)
+{
+	int acrnd_fd;
+	struct mngr_msg req;
+
+	acrnd_fd = mngr_open_un("acrnd", MNGR_CLIENT);
+	if (acrnd_fd < 0) {
+		return;
+	}
+
+	memset(&req, 0, sizeof(struct mngr_msg));
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_NOTIFY;
+	req.timestamp = time(NULL);
+
+	strncpy(req.data.dm_notify.vmname, vmname,
+			sizeof(req.data.dm_notify.vmname) - 1);
+	req.data.dm_notify.state = state;
+	req.data.dm_notify.pid = getpid();
+
+	mngr_send_msg(acrnd_fd, &req, NULL, 0);
+	mngr_close(acrnd_fd);
+}
+
 static LIST_HEAD(vm_ops_list, vm_ops) vm_ops_head;
 static pthread_mutex_t vm_ops_mtx = PTHREAD_MUTEX_INITIALIZER;
 
@@ -308,7 +380,8 @@ static int monitor_fd = -1;
 /* handlers */
 #define ACK_TIMEOUT	1
 
-#define DEFINE_HANDLER(name, func)				\
+/* state notified to acrnd on success, VM_STATE_UNKNOWN for none */
+#define DEFINE_HANDLER(name, func, state)			\
 static void name(struct mngr_msg *msg, int client_fd, void *param)	\
 {									\
 	struct mngr_msg ack;					\
@@ -335,11 +408,14 @@ static void name(struct mngr_msg *msg, int client_fd, void *param)	\
 		ack.data.err = ret;							\
 										\
 	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);		\
+	if (count && !ret && state != VM_STATE_UNKNOWN)		\
+		monitor_notify_state(state);			\
 }
 
-DEFINE_HANDLER(handle_suspend, suspend);
-DEFINE_HANDLER(handle_pause, pause);
-DEFINE_HANDLER(handle_continue, unpause);
+/* the guest suspends later on, notified by vm_suspend_resume() */
+DEFINE_HANDLER(handle_suspend, suspend, VM_STATE_UNKNOWN);
+DEFINE_HANDLER(handle_pause, pause, VM_PAUSED);
+DEFINE_HANDLER(handle_continue, unpause, VM_STARTED);
 
 static void handle_stop(struct mngr_msg *msg, int client_fd, void *param)
 {
@@ -451,6 +527,338 @@ static void handle_blkrescan(struct mngr_msg *msg, int client_fd, void *param)
 	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
 }
 
+static void handle_blkqos(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+	struct vm_ops *ops;
+	int ret = 0;
+	int count = 0;
+
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	LIST_FOREACH(ops, &vm_ops_head, list) {
+		if (ops->ops->blkqos) {
+			ret += ops->ops->blkqos(ops->arg, msg->data.devargs);
+			count++;
+		}
+	}
+
+	if (!count) {
+		ack.data.err = -1;
+		fprintf(stderr, "No handler for id:%u\r\n", msg->msgid);
+	} else
+		ack.data.err = ret;
+
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+}
+
+static void handle_netpoll(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+	struct vm_ops *ops;
+	int ret = 0;
+	int count = 0;
+
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	LIST_FOREACH(ops, &vm_ops_head, list) {
+		if (ops->ops->netpoll) {
+			ret += ops->ops->netpoll(ops->arg, msg->data.devargs);
+			count++;
+		}
+	}
+
+	if (!count) {
+		ack.data.err = -1;
+		fprintf(stderr, "No handler for id:%u\r\n", msg->msgid);
+	} else
+		ack.data.err = ret;
+
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+}
+
+static void handle_blkstats(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+	struct vm_ops *ops;
+	struct blockif_stats stats;
+	struct blockif_op_stats *src;
+	int ret = 0;
+	int count = 0;
+	int i, j;
+
+	memset(&ack, 0, sizeof(ack));
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	memset(&stats, 0, sizeof(stats));
+	LIST_FOREACH(ops, &vm_ops_head, list) {
+		if (ops->ops->blkstats) {
+			ret += ops->ops->blkstats(ops->arg, msg->data.devargs,
+					&stats);
+			count++;
+		}
+	}
+
+	if (!count) {
+		ack.data.blkstats.err = -1;
+		fprintf(stderr, "No handler for id:%u\r\n", msg->msgid);
+	} else
+		ack.data.blkstats.err = ret;
+
+	if (!ack.data.blkstats.err) {
+		for (i = 0; i < BLK_STATS_OPS && i < BLOCKIF_STAT_OPS; i++) {
+			src = &stats.op[i];
+			ack.data.blkstats.op[i].ops = src->ops;
+			ack.data.blkstats.op[i].bytes = src->bytes;
+			ack.data.blkstats.op[i].merged = src->merged;
+			ack.data.blkstats.op[i].errors = src->errors;
+			ack.data.blkstats.op[i].lat_us = src->lat_us;
+			for (j = 0; j < BLK_STATS_LAT_BUCKETS &&
+					j < BLOCKIF_LAT_BUCKETS; j++)
+				ack.data.blkstats.op[i].lat_hist[j] =
+					src->lat_hist[j];
+		}
+		ack.data.blkstats.inflight = stats.inflight;
+		for (j = 0; j < BLK_STATS_QD_BUCKETS &&
+				j < BLOCKIF_QD_BUCKETS; j++)
+			ack.data.blkstats.qd_hist[j] = stats.qd_hist[j];
+	}
+
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+}
+
+static void handle_rdt(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+	struct vm_ops *ops;
+	int ret = 0;
+	int count = 0;
+
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	LIST_FOREACH(ops, &vm_ops_head, list) {
+		if (ops->ops->rdt) {
+			ret += ops->ops->rdt(ops->arg, msg->data.devargs);
+			count++;
+		}
+	}
+
+	if (!count) {
+		ack.data.err = -1;
+		fprintf(stderr, "No handler for id:%u\r\n", msg->msgid);
+	} else
+		ack.data.err = ret;
+
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+}
+
+static void handle_balloon(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+	struct vm_ops *ops;
+	int ret = 0;
+	int count = 0;
+
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	LIST_FOREACH(ops, &vm_ops_head, list) {
+		if (ops->ops->balloon) {
+			ret += ops->ops->balloon(ops->arg, msg->data.devargs);
+			count++;
+		}
+	}
+
+	if (!count) {
+		ack.data.err = -1;
+		fprintf(stderr, "No handler for id:%u\r\n", msg->msgid);
+	} else
+		ack.data.err = ret;
+
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+}
+
+static void handle_snapshot(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+	struct vm_ops *ops;
+	int ret = 0;
+	int count = 0;
+
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	LIST_FOREACH(ops, &vm_ops_head, list) {
+		if (ops->ops->snapshot) {
+			ret += ops->ops->snapshot(ops->arg, msg->data.devargs);
+			count++;
+		}
+	}
+
+	if (!count) {
+		ack.data.err = -1;
+		fprintf(stderr, "No handler for id:%u\r\n", msg->msgid);
+	} else
+		ack.data.err = ret;
+
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+	/* left paused */
+	if (count && !ret)
+		monitor_notify_state(VM_PAUSED);
+}
+
+static void handle_migrate(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+	struct vm_ops *ops;
+	int ret = 0;
+	int count = 0;
+
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	LIST_FOREACH(ops, &vm_ops_head, list) {
+		if (ops->ops->migrate) {
+			ret += ops->ops->migrate(ops->arg, msg->data.devargs);
+			count++;
+		}
+	}
+
+	if (!count) {
+		ack.data.err = -1;
+		fprintf(stderr, "No handler for id:%u\r\n", msg->msgid);
+	} else
+		ack.data.err = ret;
+
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+	/* left paused */
+	if (count && !ret)
+		monitor_notify_state(VM_PAUSED);
+}
+
+static void handle_cpu(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+	struct vm_ops *ops;
+	int ret = 0;
+	int count = 0;
+
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	LIST_FOREACH(ops, &vm_ops_head, list) {
+		if (ops->ops->cpu) {
+			ret += ops->ops->cpu(ops->arg, msg->data.devargs);
+			count++;
+		}
+	}
+
+	if (!count) {
+		ack.data.err = -1;
+		fprintf(stderr, "No handler for id:%u\r\n", msg->msgid);
+	} else
+		ack.data.err = ret;
+
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+}
+
+/*
+ * devargs of DM_RDT:
+ *   clos=<clos>[,vcpu=<vcpu id>]	CLOS of the vCPUs of this VM, all by default
+ *   cbm=<clos>:<bitmask>		cache capacity bitmask of a CLOS
+ *   mba=<clos>:<delay>		MBA throttling delay of a CLOS
+ */
+static int
+vm_monitor_rdt(void *arg, char *devargs)
+{
+	struct vmctx *ctx = (struct vmctx *)arg;
+	unsigned long clos, vcpu, value;
+	uint16_t type;
+	char *end;
+	int ret;
+
+	if (!strncmp(devargs, "clos=", 5)) {
+		clos = strtoul(devargs + 5, &end, 0);
+		vcpu = ACRN_CLOS_ALL_VCPUS;
+		if (*end == ',') {
+			if (strncmp(end + 1, "vcpu=", 5))
+				return -EINVAL;
+			vcpu = strtoul(end + 6, &end, 0);
+		}
+		if (*end != '\0' || clos > UINT16_MAX || vcpu > UINT16_MAX)
+			return -EINVAL;
+
+		ret = vm_set_clos(ctx, (uint16_t)vcpu, (uint16_t)clos);
+	} else {
+		if (!strncmp(devargs, "cbm=", 4))
+			type = ACRN_CLOS_CACHE;
+		else if (!strncmp(devargs, "mba=", 4))
+			type = ACRN_CLOS_MBA;
+		else
+			return -EINVAL;
+
+		clos = strtoul(devargs + 4, &end, 0);
+		if (*end != ':' || clos > UINT16_MAX)
+			return -EINVAL;
+		value = strtoul(end + 1, &end, 0);
+		if (*end != '\0')
+			return -EINVAL;
+
+		ret = vm_set_clos_mask(ctx, (uint16_t)clos, type, value);
+	}
+
+	if (ret < 0)
+		pr_err("%s: failed to apply %s, %d\n", __func__, devargs, errno);
+
+	return ret;
+}
+
+/*
+ * devargs of DM_CPU:
+ *   add=<pcpu>		add a vCPU on a pCPU the SOS has offlined
+ *   remove=<vcpu>	ask the guest to eject a vCPU, handing its pCPU back
+ */
+static int
+vm_monitor_cpu(void *arg, char *devargs)
+{
+	struct vmctx *ctx = (struct vmctx *)arg;
+	unsigned long id;
+	char *end;
+	int ret;
+
+	if (!strncmp(devargs, "add=", 4)) {
+		id = strtoul(devargs + 4, &end, 0);
+		if (*end != '\0' || id > UINT16_MAX)
+			return -EINVAL;
+		ret = cpu_hotplug_add(ctx, (int)id);
+	} else if (!strncmp(devargs, "remove=", 7)) {
+		id = strtoul(devargs + 7, &end, 0);
+		if (*end != '\0' || id > UINT16_MAX)
+			return -EINVAL;
+		ret = cpu_hotplug_remove(ctx, (int)id);
+	} else
+		return -EINVAL;
+
+	if (ret < 0) {
+		pr_err("%s: failed to apply %s, %d\n", __func__, devargs, ret);
+		return ret;
+	}
+
+	return 0;
+}
+
 static struct monitor_vm_ops pmc_ops = {
 	.stop       = NULL,
 	.resume     = vm_monitor_resume,
@@ -458,6 +866,10 @@ static struct monitor_vm_ops pmc_ops = {
 	.pause      = NULL,
 	.unpause    = NULL,
 	.query      = vm_monitor_query,
+	.rdt        = vm_monitor_rdt,
+	.snapshot   = vm_monitor_snapshot,
+	.migrate    = vm_monitor_migrate,
+	.cpu        = vm_monitor_cpu,
 };
 
 int monitor_init(struct vmctx *ctx)
@@ -493,6 +905,14 @@ int monitor_init(struct vmctx *ctx)
 	ret += mngr_add_handler(monitor_fd, DM_CONTINUE, handle_continue, NULL);
 	ret += mngr_add_handler(monitor_fd, DM_QUERY, handle_query, NULL);
 	ret += mngr_add_handler(monitor_fd, DM_BLKRESCAN, handle_blkrescan, NULL);
+	ret += mngr_add_handler(monitor_fd, DM_BLKQOS, handle_blkqos, NULL);
+	ret += mngr_add_handler(monitor_fd, DM_BLKSTATS, handle_blkstats, NULL);
+	ret += mngr_add_handler(monitor_fd, DM_NETPOLL, handle_netpoll, NULL);
+	ret += mngr_add_handler(monitor_fd, DM_RDT, handle_rdt, NULL);
+	ret += mngr_add_handler(monitor_fd, DM_BALLOON, handle_balloon, NULL);
+	ret += mngr_add_handler(monitor_fd, DM_SNAPSHOT, handle_snapshot, NULL);
+	ret += mngr_add_handler(monitor_fd, DM_MIGRATE, handle_migrate, NULL);
+	ret += mngr_add_handler(monitor_fd, DM_CPU, handle_cpu, NULL);
 
 	if (ret) {
 		pr_err("%s %d\r\n", __func__, __LINE__);
@@ -502,6 +922,7 @@ int monitor_init(struct vmctx *ctx)
 	monitor_register_vm_ops(&pmc_ops, ctx, "PMC_VM_OPs");
 
 	start_intr_storm_monitor(ctx);
+	monitor_notify_state(VM_STARTED);
 
 	return 0;
 
@@ -515,8 +936,11 @@ int monitor_init(struct vmctx *ctx)
 
 void monitor_close(void)
 {
-	if (monitor_fd >= 0)
+	if (monitor_fd >= 0) {
 		mngr_close(monitor_fd);
+		monitor_fd = -1;
+		monitor_notify_state(VM_CREATED);
+	}
 
 	stop_intr_storm_monitor();
 }
@@ -0,0 +1,422 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "dm.h"
+#include "vmmapi.h"
+#include "log.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_MAX_REGIONS	8
+#define SNAPSHOT_PAGE_SHIFT	12
+#define SNAPSHOT_PAGE_SIZE	(1UL << SNAPSHOT_PAGE_SHIFT)
+
+/* harvested per IC_GET_DIRTY_LOG, a 32K bitmap */
+#define SNAPSHOT_CHUNK		(1UL << 30)
+/* pages sent by one record at most */
+#define SNAPSHOT_RUN_PAGES	256UL
+
+/* the rounds stop once that few pages are dirty, or if they don't converge */
+#define SNAPSHOT_MAX_ROUNDS	16
+#define SNAPSHOT_STOP_PAGES	2048UL
+#define SNAPSHOT_MAX_STALLS	3
+
+struct snapshot_region_state {
+	struct hugetlb_region r;
+	uint64_t *hashes;	/* of each page as sent */
+};
+
+struct snapshot_state {
+	struct vmctx *ctx;
+	int fd;
+	int nregions;
+	struct snapshot_region_state regions[SNAPSHOT_MAX_REGIONS];
+	uint64_t bitmap[SNAPSHOT_CHUNK >> SNAPSHOT_PAGE_SHIFT >> 6];
+};
+
+static int
+snapshot_write(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* four independent lanes, the hash is as fast as the memory reads */
+uint64_t
+snapshot_page_hash(const void *page)
+{
+	const uint64_t *p = page;
+	uint64_t h[4] = { 0xcbf29ce484222325UL, 0x84222325cbf29ce4UL,
+		0x9e3779b97f4a7c15UL, 0xc2b2ae3d27d4eb4fUL };
+	size_t i;
+
+	for (i = 0; i < SNAPSHOT_PAGE_SIZE / 8; i += 4) {
+		h[0] = (h[0] ^ p[i]) * 0x100000001b3UL;
+		h[1] = (h[1] ^ p[i + 1]) * 0x100000001b3UL;
+		h[2] = (h[2] ^ p[i + 2]) * 0x100000001b3UL;
+		h[3] = (h[3] ^ p[i + 3]) * 0x100000001b3UL;
+	}
+
+	return h[0] ^ (h[1] << 1) ^ (h[2] << 2) ^ (h[3] << 3);
+}
+
+/* send npages from page of the region */
+static int
+snapshot_send(struct snapshot_state *st, struct snapshot_region_state *rs,
+	size_t page, size_t npages)
+{
+	struct snapshot_record rec;
+	const char *hva;
+	size_t i;
+
+	rec.gpa = rs->r.gpa + (page << SNAPSHOT_PAGE_SHIFT);
+	rec.len = npages << SNAPSHOT_PAGE_SHIFT;
+	hva = (const char *)rs->r.hva + (page << SNAPSHOT_PAGE_SHIFT);
+
+	for (i = 0; i < npages; i++)
+		rs->hashes[page + i] = snapshot_page_hash(hva +
+			(i << SNAPSHOT_PAGE_SHIFT));
+
+	if (snapshot_write(st->fd, &rec, sizeof(rec)) < 0 ||
+	    snapshot_write(st->fd, hva, rec.len) < 0) {
+		pr_err("snapshot: write failed, errno %d\n", errno);
+		return -1;
+	}
+
+	return 0;
+}
+
+static ssize_t
+snapshot_send_all(struct snapshot_state *st)
+{
+	struct snapshot_region_state *rs;
+	size_t page, npages, sent = 0;
+	int i;
+
+	for (i = 0; i < st->nregions; i++) {
+		rs = &st->regions[i];
+		npages = rs->r.len >> SNAPSHOT_PAGE_SHIFT;
+		for (page = 0; page < npages; page += SNAPSHOT_RUN_PAGES) {
+			if (snapshot_send(st, rs, page,
+					MIN(SNAPSHOT_RUN_PAGES, npages - page)) < 0)
+				return -1;
+		}
+		sent += npages;
+	}
+
+	return sent;
+}
+
+/* send the runs of the set bits of bitmap, page 0 of it at first */
+static ssize_t
+snapshot_send_bitmap(struct snapshot_state *st,
+	struct snapshot_region_state *rs, size_t first, size_t npages)
+{
+	size_t i, run = 0, sent = 0;
+
+	for (i = 0; i <= npages; i++) {
+		if (i < npages && (st->bitmap[i >> 6] & (1UL << (i & 63))) != 0 &&
+		    run < SNAPSHOT_RUN_PAGES) {
+			run++;
+			continue;
+		}
+		if (run > 0) {
+			if (snapshot_send(st, rs, first + i - run, run) < 0)
+				return -1;
+			sent += run;
+			/* the page ending a full run starts the next one */
+			run = (i < npages &&
+			       (st->bitmap[i >> 6] & (1UL << (i & 63))) != 0) ?
+				1 : 0;
+		}
+	}
+
+	return sent;
+}
+
+/* send the pages dirtied since the previous round */
+static ssize_t
+snapshot_send_dirty(struct snapshot_state *st)
+{
+	struct snapshot_region_state *rs;
+	size_t off, len, sent = 0;
+	ssize_t n;
+	int i;
+
+	for (i = 0; i < st->nregions; i++) {
+		rs = &st->regions[i];
+		for (off = 0; off < rs->r.len; off += SNAPSHOT_CHUNK) {
+			len = MIN(SNAPSHOT_CHUNK, rs->r.len - off);
+			if (vm_get_dirty_log(st->ctx, rs->r.gpa + off, len,
+					st->bitmap) < 0) {
+				pr_err("snapshot: dirty log of 0x%lx failed\n",
+					rs->r.gpa + off);
+				return -1;
+			}
+			n = snapshot_send_bitmap(st, rs,
+				off >> SNAPSHOT_PAGE_SHIFT,
+				len >> SNAPSHOT_PAGE_SHIFT);
+			if (n < 0)
+				return -1;
+			sent += n;
+		}
+	}
+
+	return sent;
+}
+
+/* send the pages changed behind the dirty log, with the VM paused */
+static ssize_t
+snapshot_send_changed(struct snapshot_state *st)
+{
+	struct snapshot_region_state *rs;
+	size_t page, npages, i, sent = 0;
+	const char *hva;
+	ssize_t n;
+	int r;
+
+	for (r = 0; r < st->nregions; r++) {
+		rs = &st->regions[r];
+		hva = rs->r.hva;
+		npages = rs->r.len >> SNAPSHOT_PAGE_SHIFT;
+		for (page = 0; page < npages; page += SNAPSHOT_CHUNK >>
+				SNAPSHOT_PAGE_SHIFT) {
+			size_t n_chunk = MIN(SNAPSHOT_CHUNK >> SNAPSHOT_PAGE_SHIFT,
+				npages - page);
+
+			memset(st->bitmap, 0, sizeof(st->bitmap));
+			for (i = 0; i < n_chunk; i++) {
+				if (snapshot_page_hash(hva + ((page + i) <<
+						SNAPSHOT_PAGE_SHIFT)) !=
+				    rs->hashes[page + i])
+					st->bitmap[i >> 6] |= 1UL << (i & 63);
+			}
+			n = snapshot_send_bitmap(st, rs, page, n_chunk);
+			if (n < 0)
+				return -1;
+			sent += n;
+		}
+	}
+
+	return sent;
+}
+
+static int
+snapshot_send_header(struct snapshot_state *st)
+{
+	struct snapshot_header hdr;
+	struct snapshot_region reg;
+	int i;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+	hdr.version = SNAPSHOT_VERSION;
+	hdr.nregions = st->nregions;
+	if (snapshot_write(st->fd, &hdr, sizeof(hdr)) < 0)
+		return -1;
+
+	for (i = 0; i < st->nregions; i++) {
+		reg.gpa = st->regions[i].r.gpa;
+		reg.len = st->regions[i].r.len;
+		if (snapshot_write(st->fd, &reg, sizeof(reg)) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+snapshot_rounds(struct snapshot_state *st)
+{
+	ssize_t n = 0, prev;
+	int round, stalls = 0;
+
+	if (vm_set_dirty_log(st->ctx, true) < 0) {
+		/* no EPT A/D flags, the memory is sent once at pause */
+		pr_info("snapshot: no dirty log, errno %d\n", errno);
+		vm_pause(st->ctx);
+		return (snapshot_send_all(st) < 0) ? -1 : 0;
+	}
+
+	prev = snapshot_send_all(st);
+	for (round = 1; prev >= 0 && round < SNAPSHOT_MAX_ROUNDS; round++) {
+		n = snapshot_send_dirty(st);
+		if (n < 0)
+			break;
+		pr_info("snapshot: round %d, %ld dirty pages\n", round, n);
+		stalls = (n >= prev) ? stalls + 1 : 0;
+		prev = n;
+		if (n <= SNAPSHOT_STOP_PAGES || stalls >= SNAPSHOT_MAX_STALLS)
+			break;
+	}
+
+	vm_pause(st->ctx);
+	if (prev >= 0 && n >= 0) {
+		n = snapshot_send_dirty(st);
+		if (n >= 0) {
+			prev = n;
+			n = snapshot_send_changed(st);
+			pr_info("snapshot: %ld dirty pages at pause, %ld written "
+				"by devices\n", prev, n);
+		}
+	}
+	vm_set_dirty_log(st->ctx, false);
+
+	return (prev < 0 || n < 0) ? -1 : 0;
+}
+
+int
+vm_save_memory(struct vmctx *ctx, int fd)
+{
+	struct snapshot_state *st;
+	struct snapshot_record rec;
+	struct hugetlb_region regions[SNAPSHOT_MAX_REGIONS];
+	int i, ret = -1;
+
+	st = calloc(1, sizeof(*st));
+	if (st == NULL)
+		return -1;
+
+	st->ctx = ctx;
+	st->fd = fd;
+	st->nregions = hugetlb_get_regions(regions, SNAPSHOT_MAX_REGIONS);
+	if (st->nregions <= 0) {
+		pr_err("snapshot: no guest memory region\n");
+		goto end;
+	}
+
+	for (i = 0; i < st->nregions; i++) {
+		st->regions[i].r = regions[i];
+		st->regions[i].hashes = calloc(regions[i].len >>
+			SNAPSHOT_PAGE_SHIFT, sizeof(uint64_t));
+		if (st->regions[i].hashes == NULL)
+			goto end;
+	}
+
+	if (snapshot_send_header(st) < 0 || snapshot_rounds(st) < 0)
+		goto end;
+
+	rec.gpa = SNAPSHOT_END;
+	rec.len = 0;
+	ret = snapshot_write(fd, &rec, sizeof(rec));
+end:
+	for (i = 0; i < st->nregions; i++)
+		free(st->regions[i].hashes);
+	free(st);
+	return ret;
+}
+
+/*
+ * devargs of DM_SNAPSHOT: path of the file, the VM stays paused once its
+ * memory is saved.
+ */
+int
+vm_monitor_snapshot(void *arg, char *devargs)
+{
+	struct vmctx *ctx = (struct vmctx *)arg;
+	int fd, ret;
+
+	fd = open(devargs, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		pr_err("snapshot: cannot create %s, errno %d\n", devargs, errno);
+		return -1;
+	}
+
+	ret = vm_save_memory(ctx, fd);
+	if (ret == 0)
+		ret = fsync(fd);
+	close(fd);
+
+	return ret;
+}
+
+/*
+ * devargs of DM_MIGRATE: <host>:<port> of the receiver, the memory is
+ * streamed over TCP and the VM stays paused once it is sent.
+ */
+int
+vm_monitor_migrate(void *arg, char *devargs)
+{
+	struct vmctx *ctx = (struct vmctx *)arg;
+	struct addrinfo hints, *res, *ai;
+	char *host, *port;
+	int fd = -1, ret, opt;
+
+	host = strdup(devargs);
+	if (host == NULL)
+		return -1;
+	port = strrchr(host, ':');
+	if (port == NULL || port == host || port[1] == '\0') {
+		free(host);
+		return -EINVAL;
+	}
+	*port++ = '\0';
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	ret = getaddrinfo(host, port, &hints, &res);
+	if (ret != 0) {
+		pr_err("migrate: cannot resolve %s, %s\n", devargs,
+			gai_strerror(ret));
+		free(host);
+		return -1;
+	}
+
+	for (ai = res; ai != NULL; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	free(host);
+
+	if (fd < 0) {
+		pr_err("migrate: cannot connect to %s, errno %d\n", devargs,
+			errno);
+		return -1;
+	}
+
+	/* the records are large, only the last one must not linger */
+	opt = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+	ret = vm_save_memory(ctx, fd);
+	if (ret == 0)
+		ret = shutdown(fd, SHUT_WR);
+	close(fd);
+
+	return ret;
+}
@@ -29,6 +29,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "vmmapi.h"
 #include "sw_load.h"
@@ -169,6 +174,196 @@ check_image(char *path, size_t size_limit, size_t *size)
 	return 0;
 }
 
+/*
+ * The images are mapped instead of read, so they are copied straight
+ * from the page cache into the guest memory, and the large ones by
+ * several threads: the guest memory is already populated, so the copy
+ * is only bound by the memory bandwidth once the image is cached, as on
+ * a UOS reboot.
+ */
+#define IMAGE_COPY_CHUNK	(8 * MB)	/* per copy thread at least */
+#define IMAGE_COPY_THREADS	8
+
+struct image_copy {
+	void *dst;
+	const void *src;
+	size_t len;
+};
+
+static void *
+image_copy_thread(void *arg)
+{
+	struct image_copy *c = arg;
+
+	memcpy(c->dst, c->src, c->len);
+	return NULL;
+}
+
+void
+copy_image(void *dst, const void *src, size_t len)
+{
+	struct image_copy c[IMAGE_COPY_THREADS];
+	pthread_t tids[IMAGE_COPY_THREADS];
+	bool created[IMAGE_COPY_THREADS];
+	size_t chunk, off;
+	long ncpu;
+	int i, n;
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	n = len / IMAGE_COPY_CHUNK;
+	if (n > ncpu)
+		n = ncpu;
+	if (n > IMAGE_COPY_THREADS)
+		n = IMAGE_COPY_THREADS;
+	if (n <= 1) {
+		memcpy(dst, src, len);
+		return;
+	}
+
+	/* page aligned slices, the last one takes the rest */
+	chunk = (len / n) & ~(4 * KB - 1);
+	for (i = 0, off = 0; i < n; i++, off += chunk) {
+		c[i].dst = (char *)dst + off;
+		c[i].src = (const char *)src + off;
+		c[i].len = (i == n - 1) ? len - off : chunk;
+	}
+
+	/* the first slice, and any a thread could not be created for */
+	for (i = 1; i < n; i++)
+		created[i] = (pthread_create(&tids[i], NULL,
+				image_copy_thread, &c[i]) == 0);
+	image_copy_thread(&c[0]);
+	for (i = 1; i < n; i++) {
+		if (created[i])
+			pthread_join(tids[i], NULL);
+		else
+			image_copy_thread(&c[i]);
+	}
+}
+
+/*
+ * Images kept mapped by a template DM, see template.h: the clones forked
+ * from it share the pages of the mappings instead of opening the files
+ * and faulting them in again.
+ */
+#define IMAGE_CACHE_MAX		4
+
+struct image_cache {
+	const char *path;
+	void *img;
+	size_t size;
+};
+
+static struct image_cache image_cache[IMAGE_CACHE_MAX];
+static int image_cache_num;
+
+static void *
+map_image_file(const char *path, size_t *size)
+{
+	struct stat st;
+	void *img;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+
+	img = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (img == MAP_FAILED)
+		return NULL;
+
+	madvise(img, st.st_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+	*size = st.st_size;
+	return img;
+}
+
+void *
+map_image(const char *path, size_t *size)
+{
+	int i;
+
+	for (i = 0; i < image_cache_num; i++) {
+		if (strcmp(image_cache[i].path, path) == 0) {
+			*size = image_cache[i].size;
+			return image_cache[i].img;
+		}
+	}
+
+	return map_image_file(path, size);
+}
+
+void
+unmap_image(void *img, size_t size)
+{
+	int i;
+
+	for (i = 0; i < image_cache_num; i++) {
+		if (image_cache[i].img == img)
+			return;
+	}
+
+	munmap(img, size);
+}
+
+static int
+preload_image(const char *path)
+{
+	volatile const char *p;
+	size_t size, off;
+	void *img;
+
+	if (image_cache_num >= IMAGE_CACHE_MAX)
+		return -1;
+
+	img = map_image_file(path, &size);
+	if (img == NULL) {
+		fprintf(stderr, "SW_LOAD ERR: could not map image file: %s\n",
+			path);
+		return -1;
+	}
+
+	/* fault the whole image in now, not in each clone */
+	for (p = img, off = 0; off < size; off += 4 * KB)
+		(void)p[off];
+
+	image_cache[image_cache_num].path = path;
+	image_cache[image_cache_num].img = img;
+	image_cache[image_cache_num].size = size;
+	image_cache_num++;
+	return 0;
+}
+
+int
+load_image(const char *path, size_t size, void *dst)
+{
+	size_t len;
+	void *img;
+
+	img = map_image(path, &len);
+	if (img == NULL) {
+		fprintf(stderr,
+			"SW_LOAD ERR: could not map image file: %s\n", path);
+		return -1;
+	}
+
+	if (len != size) {
+		fprintf(stderr,
+			"SW_LOAD ERR: image file %s changed\n", path);
+		unmap_image(img, len);
+		return -1;
+	}
+
+	copy_image(dst, img, len);
+	unmap_image(img, len);
+	return 0;
+}
+
 /* Assumption:
  * the range [start, start + size] belongs to one entry of e820 table
  */
@@ -266,6 +461,21 @@ acrn_create_e820_table(struct vmctx *ctx, struct e820_entry *e820)
 	return (NUM_E820_ENTRIES - removed);
 }
 
+int
+acrn_sw_preload(void)
+{
+	if (vsbl_file_name)
+		return preload_image(vsbl_file_name);
+	else if (ovmf_file_name)
+		return preload_image(ovmf_file_name);
+	else if (kernel_file_name)
+		return acrn_sw_preload_bzimage(preload_image);
+	else if (elf_file_name)
+		return preload_image(elf_file_name);
+	else
+		return -1;
+}
+
 int
 acrn_sw_load(struct vmctx *ctx)
 {
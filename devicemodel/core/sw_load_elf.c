@@ -109,25 +109,20 @@ acrn_parse_elf(char *arg)
 	return err;
 }
 
-static int load_elf32(struct vmctx *ctx, FILE *fp, void *buf)
+static int load_elf32(struct vmctx *ctx, const char *img, size_t size)
 {
 	int i;
-	size_t phd_size, read_len;
-	Elf32_Ehdr *elf32_header = (Elf32_Ehdr *)buf;
-	Elf32_Phdr *elf32_phdr, *elf32_phdr_bk;
+	size_t phd_size;
+	const Elf32_Ehdr *elf32_header = (const Elf32_Ehdr *)img;
+	const Elf32_Phdr *elf32_phdr;
 
 	phd_size = elf32_header->e_phentsize * elf32_header->e_phnum;
-	elf32_phdr_bk = elf32_phdr = (Elf32_Phdr *)calloc(1, phd_size);
-	if (elf32_phdr == NULL) {
-		fprintf(stderr, "Can't allocate memory for elf program header\n");
-		return -1;
-	}
-
-	fseek(fp, elf32_header->e_phoff, SEEK_SET);
-	read_len = fread((void *)elf32_phdr, 1, phd_size, fp);
-	if (read_len != phd_size) {
+	if (elf32_header->e_phentsize != sizeof(Elf32_Phdr) ||
+		elf32_header->e_phoff + phd_size > size) {
 		fprintf(stderr, "can't get %ld data from elf file\n", phd_size);
+		return -1;
 	}
+	elf32_phdr = (const Elf32_Phdr *)(img + elf32_header->e_phoff);
 
 	for (i = 0; i < elf32_header->e_phnum; i++) {
 		if (elf32_phdr->p_type == PT_LOAD) {
@@ -135,28 +130,31 @@ static int load_elf32(struct vmctx *ctx, FILE *fp, void *buf)
 					ctx->lowmem) {
 				fprintf(stderr,
 					"No enough memory to load elf file\n");
-				free(elf32_phdr_bk);
+				return -1;
+			}
+
+			if (elf32_phdr->p_filesz > elf32_phdr->p_memsz ||
+				(size_t)elf32_phdr->p_offset +
+					elf32_phdr->p_filesz > size) {
+				fprintf(stderr, "Can't get %d data\n",
+						elf32_phdr->p_filesz);
 				return -1;
 			}
 
 			void *seg_ptr = ctx->baseaddr + elf32_phdr->p_vaddr;
 
-			/* Clear the segment memory in memory.
+			/* Clear the rest of the segment memory in memory.
 			 * This is required for BSS section
 			 */
-			memset(seg_ptr, 0, elf32_phdr->p_memsz);
-			fseek(fp, elf32_phdr->p_offset, SEEK_SET);
-			read_len = fread(seg_ptr, 1, elf32_phdr->p_filesz, fp);
-			if (read_len != elf32_phdr->p_filesz) {
-				fprintf(stderr, "Can't get %d data\n",
-						elf32_phdr->p_filesz);
-			}
+			copy_image(seg_ptr, img + elf32_phdr->p_offset,
+					elf32_phdr->p_filesz);
+			memset(seg_ptr + elf32_phdr->p_filesz, 0,
+					elf32_phdr->p_memsz - elf32_phdr->p_filesz);
 		}
 
 		elf32_phdr++;
 	}
 
-	free(elf32_phdr_bk);
 	return 0;
 }
 
@@ -165,37 +163,29 @@ acrn_load_elf(struct vmctx *ctx, char *elf_file_name, unsigned long *entry,
 		uint32_t *multiboot_flags)
 {
 	int i, ret = 0;
-	FILE *fp;
-	size_t read_len = 0;
-	unsigned int *ptr32;
-	char *elf_buf;
-	Elf32_Ehdr *elf_ehdr;
+	size_t size, scan_len;
+	const unsigned int *ptr32;
+	char *img;
+	const Elf32_Ehdr *elf_ehdr;
 
-
-	elf_buf = calloc(1, ELF_BUF_LEN);
-	if (elf_buf == NULL) {
-		fprintf(stderr, "Can't allocate elf buf\r\n");
-		return -1;
-	}
-
-	fp = fopen(elf_file_name, "r");
-	if (fp == NULL) {
+	img = map_image(elf_file_name, &size);
+	if (img == NULL) {
 		fprintf(stderr, "Can't open elf file: %s\r\n", elf_file_name);
-		free(elf_buf);
 		return -1;
 	}
 
-	read_len = fread(elf_buf, 1, ELF_BUF_LEN, fp);
-	if (read_len != ELF_BUF_LEN) {
-		fprintf(stderr, "Can't get %ld data from elf file\n",
-				ELF_BUF_LEN);
+	if (size < sizeof(Elf32_Ehdr)) {
+		fprintf(stderr, "This is not elf file\n");
+		unmap_image(img, size);
+		return -1;
 	}
 
 	/* Scan the first 8k to detect whether the elf needs multboot
 	 * info prepared.
 	 */
-	ptr32 = (unsigned int *) elf_buf;
-	for (i = 0; i <= ((ELF_BUF_LEN/4) - 3); i++) {
+	scan_len = (size < ELF_BUF_LEN) ? size : ELF_BUF_LEN;
+	ptr32 = (const unsigned int *) img;
+	for (i = 0; i + 3 <= (scan_len / 4); i++) {
 		if (ptr32[i] == MULTIBOOT_HEAD_MAGIC) {
 			int j = 0;
 			unsigned int sum = 0;
@@ -220,30 +210,28 @@ acrn_load_elf(struct vmctx *ctx, char *elf_file_name, unsigned long *entry,
 		}
 	}
 
-	elf_ehdr = (Elf32_Ehdr *) elf_buf;
+	elf_ehdr = (const Elf32_Ehdr *) img;
 
 	if ((elf_ehdr->e_ident[EI_MAG0] != ELFMAG0) ||
 		(elf_ehdr->e_ident[EI_MAG1] != ELFMAG1) ||
 		(elf_ehdr->e_ident[EI_MAG2] != ELFMAG2) ||
 		(elf_ehdr->e_ident[EI_MAG3] != ELFMAG3)) {
 		fprintf(stderr, "This is not elf file\n");
-		fclose(fp);
-		free(elf_buf);
+		unmap_image(img, size);
 
 		return -1;
 	}
 
 	if (elf_ehdr->e_ident[EI_CLASS] == ELFCLASS32) {
-		ret = load_elf32(ctx, fp, elf_buf);
+		ret = load_elf32(ctx, img, size);
 	} else {
 		fprintf(stderr, "No available 64bit elf loader ready yet\n");
-		fclose(fp);
-		free(elf_buf);
+		unmap_image(img, size);
 		return -1;
 	}
 
 	*entry = elf_ehdr->e_entry;
-	free(elf_buf);
+	unmap_image(img, size);
 
 	return ret;
 }
@@ -206,36 +206,10 @@ acrn_parse_vsbl(char *arg)
 static int
 acrn_prepare_vsbl(struct vmctx *ctx)
 {
-	FILE *fp;
-	size_t read;
-
-	fp = fopen(vsbl_path, "r");
-	if (fp == NULL) {
-		fprintf(stderr,
-			"SW_LOAD ERR: could not open vsbl file: %s\n",
-			vsbl_path);
-		return -1;
-	}
-
-	fseek(fp, 0, SEEK_END);
-
-	if (ftell(fp) != vsbl_size) {
-		fprintf(stderr,
-			"SW_LOAD ERR: vsbl file changed\n");
-		fclose(fp);
+	if (load_image(vsbl_path, vsbl_size,
+			ctx->baseaddr + VSBL_TOP(ctx) - vsbl_size) < 0)
 		return -1;
-	}
 
-	fseek(fp, 0, SEEK_SET);
-	read = fread(ctx->baseaddr + VSBL_TOP(ctx) - vsbl_size,
-		sizeof(char), vsbl_size, fp);
-	if (read < vsbl_size) {
-		fprintf(stderr,
-			"SW_LOAD ERR: could not read whole partition blob\n");
-		fclose(fp);
-		return -1;
-	}
-	fclose(fp);
 	printf("SW_LOAD: partition blob %s size %lu copy to guest 0x%lx\n",
 		vsbl_path, vsbl_size, VSBL_TOP(ctx) - vsbl_size);
 
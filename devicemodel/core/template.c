@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dm.h"
+#include "vmmapi.h"
+#include "pci_core.h"
+#include "sw_load.h"
+#include "acrn_mngr.h"
+#include "log.h"
+#include "template.h"
+
+#define CLONE_ACK_TIMEOUT	1
+
+/* a DM_CLONE handed from the mngr poll thread over to the main thread */
+static pthread_mutex_t clone_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t clone_cond = PTHREAD_COND_INITIALIZER;
+static char clone_args[PARAM_LEN];
+static bool clone_pending;
+static int clone_err;
+
+static int template_fd = -1;
+
+/*
+ * Parameters of a clone, only checked in the template, applied in the
+ * clone. args is modified.
+ */
+static int
+clone_parse(char *args, bool apply)
+{
+	char *tok, *val, *save = NULL;
+
+	tok = strtok_r(args, " ", &save);
+	if (tok == NULL || strnlen(tok, MAX_VMNAME_LEN) >= MAX_VMNAME_LEN) {
+		pr_err("template: no valid vm name in the clone request\n");
+		return -1;
+	}
+	if (apply)
+		vmname = strdup(tok);
+
+	while ((tok = strtok_r(NULL, " ", &save)) != NULL) {
+		val = strtok_r(NULL, " ", &save);
+		if (val == NULL) {
+			pr_err("template: no value of %s\n", tok);
+			return -1;
+		}
+
+		if (strcmp(tok, "-U") == 0) {
+			if (apply)
+				guest_uuid_str = strdup(val);
+		} else if (strcmp(tok, "--mac_seed") == 0) {
+			if (apply)
+				mac_seed = strdup(val);
+		} else if (strcmp(tok, "-s") == 0) {
+			if (apply && pci_reparse_slot(val) != 0)
+				return -1;
+		} else {
+			pr_err("template: unknown clone parameter %s\n", tok);
+			return -1;
+		}
+	}
+
+	return (apply && vmname == NULL) ? -1 : 0;
+}
+
+static void
+handle_clone(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+
+	/* forked by the main thread, the only thread a clone keeps */
+	pthread_mutex_lock(&clone_mtx);
+	while (clone_pending)
+		pthread_cond_wait(&clone_cond, &clone_mtx);
+	strncpy(clone_args, msg->data.devargs, sizeof(clone_args) - 1);
+	clone_args[sizeof(clone_args) - 1] = '\0';
+	clone_pending = true;
+	pthread_cond_broadcast(&clone_cond);
+	while (clone_pending)
+		pthread_cond_wait(&clone_cond, &clone_mtx);
+	ack.data.err = clone_err;
+	pthread_mutex_unlock(&clone_mtx);
+
+	mngr_send_msg(client_fd, &ack, NULL, CLONE_ACK_TIMEOUT);
+}
+
+int
+template_run(void)
+{
+	char path[128], args[PARAM_LEN];
+	struct timespec ts;
+	pid_t pid;
+
+	if (acrn_sw_preload() != 0) {
+		pr_err("template: cannot preload the boot images\n");
+		return -1;
+	}
+
+	if (check_dir(ACRN_DM_BASE_PATH, CHK_CREAT) ||
+	    check_dir(ACRN_DM_SOCK_PATH, CHK_CREAT))
+		return -1;
+
+	snprintf(path, sizeof(path), "%s%s", vmname, TEMPLATE_SUFFIX);
+	template_fd = mngr_open_un(path, MNGR_SERVER);
+	if (template_fd < 0) {
+		pr_err("template: cannot open %s\n", path);
+		return -1;
+	}
+	if (mngr_add_handler(template_fd, DM_CLONE, handle_clone, NULL)) {
+		mngr_close(template_fd);
+		return -1;
+	}
+	pr_notice("template %s ready\n", vmname);
+
+	pthread_mutex_lock(&clone_mtx);
+	while (vm_get_suspend_mode() != VM_SUSPEND_POWEROFF) {
+		while (waitpid(-1, NULL, WNOHANG) > 0)
+			;
+
+		if (!clone_pending) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += 1;
+			pthread_cond_timedwait(&clone_cond, &clone_mtx, &ts);
+			continue;
+		}
+
+		memcpy(args, clone_args, sizeof(args));
+		clone_err = -1;
+		if (clone_parse(args, false) == 0) {
+			pid = fork();
+			if (pid == 0) {
+				/* the socket stays the template's */
+				pthread_mutex_unlock(&clone_mtx);
+				close(template_fd);
+				memcpy(args, clone_args, sizeof(args));
+				if (clone_parse(args, true) != 0)
+					exit(1);
+				pr_notice("template: cloned %s\n", vmname);
+				return 0;
+			}
+			clone_err = (pid < 0) ? -1 : 0;
+		}
+		clone_pending = false;
+		pthread_cond_broadcast(&clone_cond);
+	}
+	pthread_mutex_unlock(&clone_mtx);
+
+	mngr_close(template_fd);
+	exit(0);
+}
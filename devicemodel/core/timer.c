@@ -5,8 +5,11 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sys/queue.h>
 #include <sys/timerfd.h>
 
 #include "vmmapi.h"
@@ -18,129 +21,328 @@
  * Compare with sigevent mechanism, timerfd has a advantage that it could
  * avoid race condition on resource accessing in the async sigev thread.
  *
+ * The timers of a clock share a single timerfd: they are kept sorted by
+ * expiration time and the timerfd is armed for the first one. Re-arming a
+ * timer that is not the next to expire costs no syscall, and the timers
+ * expiring together are handled with one wakeup.
+ *
  * Please note timerfd and epoll are all Linux specific. If the code need to be
  * ported to other OS, we can modify the api with POSIX timers and sigevent
  * mechanism.
  */
 
+struct timer_base {
+	clockid_t		clockid;
+	int			fd;
+	struct mevent		*mevp;
+	pthread_mutex_t		mtx;
+	pthread_cond_t		cond;
+	TAILQ_HEAD(, acrn_timer) timers;	/* armed, by expiration */
+
+	bool			dispatching;	/* the timerfd is re-armed */
+	struct acrn_timer	*running;	/* whose callback is called */
+	pthread_t		runner;
+};
+
+static struct timer_base timer_bases[] = {
+	{ .clockid = CLOCK_REALTIME, .fd = -1,
+	  .mtx = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER },
+	{ .clockid = CLOCK_MONOTONIC, .fd = -1,
+	  .mtx = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER },
+};
+
+static inline uint64_t
+ts_to_ns(const struct timespec *ts)
+{
+	return ts->tv_sec * NS_PER_SEC + ts->tv_nsec;
+}
+
+static inline void
+ns_to_ts(uint64_t ns, struct timespec *ts)
+{
+	ts->tv_sec = ns / NS_PER_SEC;
+	ts->tv_nsec = ns % NS_PER_SEC;
+}
+
+static uint64_t
+timer_base_now(struct timer_base *base)
+{
+	struct timespec now;
+
+	clock_gettime(base->clockid, &now);
+	return ts_to_ns(&now);
+}
+
+/* Arm the timerfd for the first timer, called with the lock held */
+static void
+timer_base_arm(struct timer_base *base)
+{
+	struct acrn_timer *first;
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	first = TAILQ_FIRST(&base->timers);
+	if (first != NULL)
+		ns_to_ts(first->expire, &its.it_value);
+
+	if (timerfd_settime(base->fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+		perror("acrn_timer timerfd_settime error");
+}
+
+/* Called with the lock held */
+static void
+timer_insert(struct timer_base *base, struct acrn_timer *timer)
+{
+	struct acrn_timer *t;
+
+	TAILQ_FOREACH(t, &base->timers, link) {
+		if (t->expire > timer->expire)
+			break;
+	}
+	if (t != NULL)
+		TAILQ_INSERT_BEFORE(t, timer, link);
+	else
+		TAILQ_INSERT_TAIL(&base->timers, timer, link);
+}
+
+/* Called with the lock held */
+static void
+timer_remove(struct timer_base *base, struct acrn_timer *timer)
+{
+	if (timer->expire != 0) {
+		TAILQ_REMOVE(&base->timers, timer, link);
+		timer->expire = 0;
+	}
+}
+
 static void
 timer_handler(int fd __attribute__((unused)),
 		  enum ev_type t __attribute__((unused)),
 		  void *arg)
 {
-	struct acrn_timer *timer = arg;
-	uint64_t nexp;
+	struct timer_base *base = arg;
+	struct acrn_timer *timer;
+	uint64_t nexp, now;
 	ssize_t size;
-	void (*cb)(void *, uint64_t);
-
-	if (timer == NULL) {
-		return;
-	}
 
 	/* Consume I/O event for default EPOLLLT type.
 	 * Here is a temporary solution, the processing could be moved to
 	 * mevent.c once EVF_TIMER is supported.
 	 */
-	size = read(timer->fd, &nexp, sizeof(nexp));
+	size = read(base->fd, &nexp, sizeof(nexp));
 
-	if (size < 0) {
-		if (errno != EAGAIN) {
-			perror("acrn_timer read timerfd error");
-		}
+	if (size < 0 && errno != EAGAIN) {
+		perror("acrn_timer read timerfd error");
 		return;
 	}
 
-	/* check the validity of timer expiration. */
-	if ((size == 0) || (nexp == 0))
-		return;
+	pthread_mutex_lock(&base->mtx);
+	base->dispatching = true;
+	now = timer_base_now(base);
+	while ((timer = TAILQ_FIRST(&base->timers)) != NULL &&
+	       timer->expire <= now) {
+		TAILQ_REMOVE(&base->timers, timer, link);
+
+		/* the periods missed are reported as for a timerfd */
+		nexp = 1;
+		if (timer->interval != 0) {
+			nexp += (now - timer->expire) / timer->interval;
+			timer->expire += nexp * timer->interval;
+			timer_insert(base, timer);
+		} else
+			timer->expire = 0;
+
+		/* the callback may re-arm the timer */
+		base->running = timer;
+		base->runner = pthread_self();
+		pthread_mutex_unlock(&base->mtx);
+
+		(*timer->callback)(timer->callback_param, nexp);
+
+		pthread_mutex_lock(&base->mtx);
+		base->running = NULL;
+		pthread_cond_broadcast(&base->cond);
+		now = timer_base_now(base);
+	}
+	base->dispatching = false;
+	timer_base_arm(base);
+	pthread_mutex_unlock(&base->mtx);
+}
+
+/*
+ * Called by mevent_deinit(), with no timer left running. The timerfd is
+ * closed by mevent, the base is set up again by the next acrn_timer_init().
+ */
+static void
+timer_base_teardown(void *arg)
+{
+	struct timer_base *base = arg;
+	struct acrn_timer *timer;
+
+	while ((timer = TAILQ_FIRST(&base->timers)) != NULL)
+		timer_remove(base, timer);
+	base->mevp = NULL;
+	base->fd = -1;
+}
+
+/* Called with the lock held */
+static int
+timer_base_init(struct timer_base *base)
+{
+	if (base->mevp != NULL)
+		return 0;
+
+	base->fd = timerfd_create(base->clockid, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (base->fd < 0) {
+		perror("acrn_timer create failed.\n");
+		return -1;
+	}
 
-	if ((cb = timer->callback) != NULL) {
-		(*cb)(timer->callback_param, nexp);
+	TAILQ_INIT(&base->timers);
+	base->mevp = mevent_add(base->fd, EVF_READ, timer_handler, base,
+				timer_base_teardown, base);
+	if (base->mevp == NULL) {
+		close(base->fd);
+		base->fd = -1;
+		perror("acrn_timer mevent add failed.\n");
+		return -1;
 	}
+
+	return 0;
 }
 
 int32_t
 acrn_timer_init(struct acrn_timer *timer, void (*cb)(void *, uint64_t),
 		void *param)
 {
+	struct timer_base *base;
+	int32_t ret;
+
 	if ((timer == NULL) || (cb == NULL)) {
 		return -1;
 	}
 
-	timer->fd = -1;
-	if ((timer->clockid == CLOCK_REALTIME) ||
-			(timer->clockid == CLOCK_MONOTONIC)) {
-		timer->fd = timerfd_create(timer->clockid,
-					TFD_NONBLOCK | TFD_CLOEXEC);
+	timer->base = NULL;
+	if (timer->clockid == CLOCK_REALTIME) {
+		base = &timer_bases[0];
+	} else if (timer->clockid == CLOCK_MONOTONIC) {
+		base = &timer_bases[1];
 	} else {
 		perror("acrn_timer clockid is not supported.\n");
-	}
-
-	if (timer->fd <= 0) {
-		perror("acrn_timer create failed.\n");
 		return -1;
 	}
 
-	timer->mevp = mevent_add(timer->fd, EVF_READ, timer_handler, timer, NULL, NULL);
-	if (timer->mevp == NULL) {
-		close(timer->fd);
-		perror("acrn_timer mevent add failed.\n");
-		return -1;
+	pthread_mutex_lock(&base->mtx);
+	ret = timer_base_init(base);
+	if (ret == 0) {
+		timer->base = base;
+		timer->expire = 0;
+		timer->interval = 0;
+		timer->callback = cb;
+		timer->callback_param = param;
 	}
+	pthread_mutex_unlock(&base->mtx);
 
-	timer->callback = cb;
-	timer->callback_param = param;
-
-	return 0;
+	return ret;
 }
 
 void
 acrn_timer_deinit(struct acrn_timer *timer)
 {
-	if (timer == NULL) {
+	struct timer_base *base;
+
+	if ((timer == NULL) || (timer->base == NULL)) {
 		return;
 	}
 
-	if (timer->mevp != NULL) {
-		mevent_delete_close(timer->mevp);
-		timer->mevp = NULL;
-	}
+	base = timer->base;
+	pthread_mutex_lock(&base->mtx);
+	timer_remove(base, timer);
 
-	timer->fd = -1;
+	/* a callback running elsewhere still refers to the timer */
+	while ((base->running == timer) &&
+	       !pthread_equal(base->runner, pthread_self()))
+		pthread_cond_wait(&base->cond, &base->mtx);
+	pthread_mutex_unlock(&base->mtx);
+
+	timer->base = NULL;
 	timer->callback = NULL;
 	timer->callback_param = NULL;
 }
 
-int32_t
-acrn_timer_settime(struct acrn_timer *timer, const struct itimerspec *new_value)
+static int32_t
+acrn_timer_set(struct acrn_timer *timer, const struct itimerspec *new_value,
+		bool abs)
 {
-	if (timer == NULL) {
+	struct timer_base *base;
+
+	if ((timer == NULL) || (timer->base == NULL) || (new_value == NULL) ||
+	    (new_value->it_value.tv_nsec < 0) ||
+	    (new_value->it_value.tv_nsec >= (long)NS_PER_SEC) ||
+	    (new_value->it_interval.tv_nsec < 0) ||
+	    (new_value->it_interval.tv_nsec >= (long)NS_PER_SEC)) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	return timerfd_settime(timer->fd, 0, new_value, NULL);
+	base = timer->base;
+	pthread_mutex_lock(&base->mtx);
+	timer_remove(base, timer);
+
+	timer->interval = ts_to_ns(&new_value->it_interval);
+	if ((new_value->it_value.tv_sec != 0) ||
+	    (new_value->it_value.tv_nsec != 0)) {
+		timer->expire = ts_to_ns(&new_value->it_value);
+		if (!abs)
+			timer->expire += timer_base_now(base);
+		if (timer->expire == 0)
+			timer->expire = 1;
+		timer_insert(base, timer);
+
+		/* the handler re-arms the timerfd once it is done */
+		if ((TAILQ_FIRST(&base->timers) == timer) && !base->dispatching)
+			timer_base_arm(base);
+	}
+	pthread_mutex_unlock(&base->mtx);
+
+	return 0;
+}
+
+int32_t
+acrn_timer_settime(struct acrn_timer *timer, const struct itimerspec *new_value)
+{
+	return acrn_timer_set(timer, new_value, false);
 }
 
 int32_t
 acrn_timer_settime_abs(struct acrn_timer *timer,
 		const struct itimerspec *new_value)
 {
-	if (timer == NULL) {
-		errno = EINVAL;
-		return -1;
-	}
-
-	return timerfd_settime(timer->fd, TFD_TIMER_ABSTIME, new_value, NULL);
+	return acrn_timer_set(timer, new_value, true);
 }
 
 int32_t
 acrn_timer_gettime(struct acrn_timer *timer, struct itimerspec *cur_value)
 {
-	if (timer == NULL) {
+	struct timer_base *base;
+	uint64_t now;
+
+	if ((timer == NULL) || (timer->base == NULL) || (cur_value == NULL)) {
 		errno = EINVAL;
 		return -1;
 	}
 
-	return timerfd_gettime(timer->fd, cur_value);
+	base = timer->base;
+	memset(cur_value, 0, sizeof(*cur_value));
+	pthread_mutex_lock(&base->mtx);
+	if (timer->expire != 0) {
+		now = timer_base_now(base);
+		/* due, but not handled yet */
+		ns_to_ts((timer->expire > now) ? (timer->expire - now) : 1,
+			 &cur_value->it_value);
+	}
+	ns_to_ts(timer->interval, &cur_value->it_interval);
+	pthread_mutex_unlock(&base->mtx);
+
+	return 0;
 }
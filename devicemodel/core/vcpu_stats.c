@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include <sys/mman.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "dm.h"
+#include "vmmapi.h"
+#include "log.h"
+#include "vcpu_stats.h"
+
+static struct acrn_vcpu_stats *vcpu_stats;
+static size_t vcpu_stats_len;
+static char vcpu_stats_path[PATH_MAX];
+
+void
+vcpu_stats_init(struct vmctx *ctx, int ncpus)
+{
+	struct acrn_vcpu_stats *stats;
+	size_t len;
+	int fd, i;
+
+	len = ncpus * sizeof(struct acrn_vcpu_stats);
+	snprintf(vcpu_stats_path, sizeof(vcpu_stats_path), VCPU_STATS_PATH,
+			vmname);
+	fd = open(vcpu_stats_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		pr_info("vcpu stats: cannot create %s, errno %d\n",
+				vcpu_stats_path, errno);
+		return;
+	}
+	if (ftruncate(fd, len) < 0) {
+		pr_info("vcpu stats: cannot size %s, errno %d\n",
+				vcpu_stats_path, errno);
+		goto fail;
+	}
+	stats = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (stats == MAP_FAILED) {
+		pr_info("vcpu stats: cannot map %s, errno %d\n",
+				vcpu_stats_path, errno);
+		goto fail;
+	}
+	/* the hypervisor keeps writing to the pages, they must not move */
+	if (mlock(stats, len) < 0) {
+		pr_info("vcpu stats: cannot lock the pages, errno %d\n", errno);
+		munmap(stats, len);
+		goto fail;
+	}
+	close(fd);
+
+	for (i = 0; i < ncpus; i++) {
+		stats[i].vcpu_id = i;
+		if (vm_set_vcpu_stats(ctx, &stats[i]) != 0) {
+			pr_info("vcpu stats in hv unsupported, errno %d\n",
+					errno);
+			break;
+		}
+	}
+	vcpu_stats = stats;
+	vcpu_stats_len = len;
+	/* the pages set up already stay mapped until the VM is destroyed */
+	if (i == 0)
+		vcpu_stats_deinit();
+	return;
+
+fail:
+	close(fd);
+	unlink(vcpu_stats_path);
+}
+
+void
+vcpu_stats_deinit(void)
+{
+	if (vcpu_stats == NULL)
+		return;
+
+	munmap(vcpu_stats, vcpu_stats_len);
+	unlink(vcpu_stats_path);
+	vcpu_stats = NULL;
+	vcpu_stats_len = 0;
+}
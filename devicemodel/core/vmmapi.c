@@ -36,6 +36,8 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
+#include <stdarg.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -46,6 +48,7 @@
 #include "dm.h"
 #include "pci_core.h"
 #include "log.h"
+#include "ioreq_trace.h"
 
 #define MAP_NOCORE 0
 #define MAP_ALIGNED_SUPER 0
@@ -86,6 +89,26 @@ check_api(int fd)
 
 static int devfd = -1;
 
+/*
+ * The VHM requests of the device model, no-ops when replaying an ioreq
+ * trace without the hypervisor.
+ */
+static inline int
+vm_ioctl(int fd, unsigned long request, ...)
+{
+	va_list ap;
+	void *arg;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	if (ioreq_trace_replaying())
+		return 0;
+
+	return ioctl(fd, request, arg);
+}
+
 struct vmctx *
 vm_create(const char *name, uint64_t req_buf, int *vcpu_num)
 {
@@ -100,7 +123,9 @@ vm_create(const char *name, uint64_t req_buf, int *vcpu_num)
 	if ((ctx == NULL) || (devfd != -1))
 		goto err;
 
-	if (stat("/dev/acrn_vhm", &tmp_st) == 0) {
+	if (ioreq_trace_replaying()) {
+		devfd = open("/dev/null", O_RDWR|O_CLOEXEC);
+	} else if (stat("/dev/acrn_vhm", &tmp_st) == 0) {
 		devfd = open("/dev/acrn_vhm", O_RDWR|O_CLOEXEC);
 	} else if (stat("/dev/acrn_hsm", &tmp_st) == 0) {
 		devfd = open("/dev/acrn_hsm", O_RDWR|O_CLOEXEC);
@@ -112,7 +137,7 @@ vm_create(const char *name, uint64_t req_buf, int *vcpu_num)
 		goto err;
 	}
 
-	if (check_api(devfd) < 0)
+	if (!ioreq_trace_replaying() && check_api(devfd) < 0)
 		goto err;
 
 	if (guest_uuid_str == NULL)
@@ -156,7 +181,7 @@ vm_create(const char *name, uint64_t req_buf, int *vcpu_num)
 
 	create_vm.req_buf = req_buf;
 	while (retry > 0) {
-		error = ioctl(ctx->fd, IC_CREATE_VM, &create_vm);
+		error = vm_ioctl(ctx->fd, IC_CREATE_VM, &create_vm);
 		if (error == 0)
 			break;
 		usleep(500000);
@@ -168,6 +193,9 @@ vm_create(const char *name, uint64_t req_buf, int *vcpu_num)
 		goto err;
 	}
 
+	if (ioreq_trace_replaying())
+		create_vm.vcpu_num = ioreq_trace_ncpus();
+
 	*vcpu_num = create_vm.vcpu_num;
 	ctx->vmid = create_vm.vmid;
 
@@ -183,13 +211,13 @@ err:
 int
 vm_create_ioreq_client(struct vmctx *ctx)
 {
-	return ioctl(ctx->fd, IC_CREATE_IOREQ_CLIENT, 0);
+	return vm_ioctl(ctx->fd, IC_CREATE_IOREQ_CLIENT, 0);
 }
 
 int
 vm_destroy_ioreq_client(struct vmctx *ctx)
 {
-	return ioctl(ctx->fd, IC_DESTROY_IOREQ_CLIENT, ctx->ioreq_client);
+	return vm_ioctl(ctx->fd, IC_DESTROY_IOREQ_CLIENT, ctx->ioreq_client);
 }
 
 int
@@ -197,7 +225,7 @@ vm_attach_ioreq_client(struct vmctx *ctx)
 {
 	int error;
 
-	error = ioctl(ctx->fd, IC_ATTACH_IOREQ_CLIENT, ctx->ioreq_client);
+	error = vm_ioctl(ctx->fd, IC_ATTACH_IOREQ_CLIENT, ctx->ioreq_client);
 
 	if (error) {
 		pr_err("attach ioreq client return %d "
@@ -219,7 +247,7 @@ vm_notify_request_done(struct vmctx *ctx, int vcpu)
 	notify.client_id = ctx->ioreq_client;
 	notify.vcpu = vcpu;
 
-	error = ioctl(ctx->fd, IC_NOTIFY_REQUEST_FINISH, &notify);
+	error = vm_ioctl(ctx->fd, IC_NOTIFY_REQUEST_FINISH, &notify);
 
 	if (error) {
 		pr_err("failed: notify request finish\n");
@@ -229,13 +257,52 @@ vm_notify_request_done(struct vmctx *ctx, int vcpu)
 	return 0;
 }
 
+/*
+ * Notify the completion of the requests of all the vCPUs in vcpu_mask with
+ * one ioctl. Falls back to one notification per vCPU if VHM doesn't support
+ * the batched notification.
+ */
+int
+vm_notify_request_done_batch(struct vmctx *ctx, uint64_t vcpu_mask)
+{
+	static bool batch_unsupported = false;
+	struct ioreq_notify_batch notify;
+	int error = 0, vcpu;
+
+	if (vcpu_mask == 0UL)
+		return 0;
+
+	if (!batch_unsupported) {
+		bzero(&notify, sizeof(notify));
+		notify.client_id = ctx->ioreq_client;
+		notify.vcpu_mask = vcpu_mask;
+
+		if (vm_ioctl(ctx->fd, IC_NOTIFY_REQUEST_FINISH_BATCH, &notify) == 0)
+			return 0;
+
+		if (errno != ENOTTY && errno != EINVAL) {
+			pr_err("failed: notify request finish batch\n");
+			return -1;
+		}
+		pr_info("batched request finish notification unsupported\n");
+		batch_unsupported = true;
+	}
+
+	for (vcpu = 0; vcpu < 64; vcpu++) {
+		if ((vcpu_mask & (1UL << vcpu)) != 0UL)
+			error |= vm_notify_request_done(ctx, vcpu);
+	}
+
+	return error;
+}
+
 void
 vm_destroy(struct vmctx *ctx)
 {
 	if (!ctx)
 		return;
 
-	ioctl(ctx->fd, IC_DESTROY_VM, NULL);
+	vm_ioctl(ctx->fd, IC_DESTROY_VM, NULL);
 	close(ctx->fd);
 	free(ctx);
 	devfd = -1;
@@ -295,7 +362,65 @@ vm_map_memseg_vma(struct vmctx *ctx, size_t len, vm_paddr_t gpa,
 	memmap.len = len;
 	memmap.gpa = gpa;
 	memmap.prot = prot;
-	return ioctl(ctx->fd, IC_SET_MEMSEG, &memmap);
+	return vm_ioctl(ctx->fd, IC_SET_MEMSEG, &memmap);
+}
+
+/* remove [gpa, gpa + len) of the guest memory from the EPT */
+int
+vm_unmap_memseg(struct vmctx *ctx, vm_paddr_t gpa, size_t len)
+{
+	struct vm_memmap memmap;
+
+	bzero(&memmap, sizeof(struct vm_memmap));
+	memmap.type = VM_MEMMAP_SYSMEM;
+	memmap.len = len;
+	memmap.gpa = gpa;
+	return vm_ioctl(ctx->fd, IC_UNSET_MEMSEG, &memmap);
+}
+
+/* start or stop the EPT dirty page tracking, all the pages are clean at start */
+int
+vm_set_dirty_log(struct vmctx *ctx, bool enable)
+{
+	return vm_ioctl(ctx->fd, IC_SET_DIRTY_LOG, enable ? 1UL : 0UL);
+}
+
+/* harvest and clear the dirty bits of [gpa, gpa + len) into bitmap */
+int
+vm_get_dirty_log(struct vmctx *ctx, vm_paddr_t gpa, size_t len,
+	uint64_t *bitmap)
+{
+	struct vm_dirty_log log;
+
+	bzero(&log, sizeof(struct vm_dirty_log));
+	log.gpa = gpa;
+	log.size = len;
+	log.bitmap = (uint64_t)bitmap;
+	return vm_ioctl(ctx->fd, IC_GET_DIRTY_LOG, &log);
+}
+
+/* the replay of an ioreq trace has no EPT, plain anonymous memory is enough */
+static size_t
+vm_replay_memory_size(struct vmctx *ctx)
+{
+	return (ctx->highmem > 0) ? ctx->highmem_gpa_base + ctx->highmem :
+		4 * GB;
+}
+
+static int
+vm_setup_replay_memory(struct vmctx *ctx)
+{
+	void *ptr;
+
+	ptr = mmap(NULL, vm_replay_memory_size(ctx), PROT_READ | PROT_WRITE,
+		MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+	if (ptr == MAP_FAILED) {
+		pr_err("failed to allocate the replay memory\n");
+		return -ENOMEM;
+	}
+
+	ctx->baseaddr = ptr;
+	return 0;
 }
 
 int
@@ -315,6 +440,9 @@ vm_setup_memory(struct vmctx *ctx, size_t memsize)
 
 	ctx->biosmem = high_bios_size();
 
+	if (ioreq_trace_replaying())
+		return vm_setup_replay_memory(ctx);
+
 	return hugetlb_setup_memory(ctx);
 }
 
@@ -330,6 +458,11 @@ vm_unsetup_memory(struct vmctx *ctx)
 	 * may be leaked to the new UOS if the memory is not cleared.
 	 *
 	 */
+	if (ioreq_trace_replaying()) {
+		munmap(ctx->baseaddr, vm_replay_memory_size(ctx));
+		return;
+	}
+
 	bzero((void *)ctx->baseaddr, ctx->lowmem);
 	if (ctx->highmem > 0) {
 		bzero((void *)(ctx->baseaddr + ctx->highmem_gpa_base),
@@ -349,23 +482,7 @@ vm_unsetup_memory(struct vmctx *ctx)
 void *
 vm_map_gpa(struct vmctx *ctx, vm_paddr_t gaddr, size_t len)
 {
-
-	if (ctx->lowmem > 0) {
-		if (gaddr < ctx->lowmem && len <= ctx->lowmem &&
-		    gaddr + len <= ctx->lowmem)
-			return (ctx->baseaddr + gaddr);
-	}
-
-	if (ctx->highmem > 0) {
-		if (gaddr >= ctx->highmem_gpa_base) {
-			if (gaddr < ctx->highmem_gpa_base + ctx->highmem &&
-			    len <= ctx->highmem &&
-			    gaddr + len <= ctx->highmem_gpa_base + ctx->highmem)
-				return (ctx->baseaddr + gaddr);
-		}
-	}
-
-	return NULL;
+	return vm_map_gpa_fast(ctx, gaddr, len);
 }
 
 size_t
@@ -385,7 +502,7 @@ vm_run(struct vmctx *ctx)
 {
 	int error;
 
-	error = ioctl(ctx->fd, IC_START_VM, &ctx->vmid);
+	error = vm_ioctl(ctx->fd, IC_START_VM, &ctx->vmid);
 
 	return error;
 }
@@ -393,19 +510,19 @@ vm_run(struct vmctx *ctx)
 void
 vm_pause(struct vmctx *ctx)
 {
-	ioctl(ctx->fd, IC_PAUSE_VM, &ctx->vmid);
+	vm_ioctl(ctx->fd, IC_PAUSE_VM, &ctx->vmid);
 }
 
 void
 vm_reset(struct vmctx *ctx)
 {
-	ioctl(ctx->fd, IC_RESET_VM, &ctx->vmid);
+	vm_ioctl(ctx->fd, IC_RESET_VM, &ctx->vmid);
 }
 
 void
 vm_clear_ioreq(struct vmctx *ctx)
 {
-	ioctl(ctx->fd, IC_CLEAR_VM_IOREQ, NULL);
+	vm_ioctl(ctx->fd, IC_CLEAR_VM_IOREQ, NULL);
 }
 
 static int suspend_mode = VM_SUSPEND_NONE;
@@ -441,7 +558,7 @@ vm_lapic_msi(struct vmctx *ctx, uint64_t addr, uint64_t msg)
 	msi.msi_addr = addr;
 	msi.msi_data = msg;
 
-	return ioctl(ctx->fd, IC_INJECT_MSI, &msi);
+	return vm_ioctl(ctx->fd, IC_INJECT_MSI, &msi);
 }
 
 int
@@ -453,7 +570,7 @@ vm_set_gsi_irq(struct vmctx *ctx, int gsi, uint32_t operation)
 	op.op = operation;
 	op.gsi = (uint32_t)gsi;
 
-	return ioctl(ctx->fd, IC_SET_IRQLINE, *req);
+	return vm_ioctl(ctx->fd, IC_SET_IRQLINE, *req);
 }
 
 int
@@ -464,7 +581,7 @@ vm_assign_ptdev(struct vmctx *ctx, int bus, int slot, int func)
 	bdf = ((bus & 0xff) << 8) | ((slot & 0x1f) << 3) |
 			(func & 0x7);
 
-	return ioctl(ctx->fd, IC_ASSIGN_PTDEV, &bdf);
+	return vm_ioctl(ctx->fd, IC_ASSIGN_PTDEV, &bdf);
 }
 
 int
@@ -475,7 +592,7 @@ vm_unassign_ptdev(struct vmctx *ctx, int bus, int slot, int func)
 	bdf = ((bus & 0xff) << 8) | ((slot & 0x1f) << 3) |
 			(func & 0x7);
 
-	return ioctl(ctx->fd, IC_DEASSIGN_PTDEV, &bdf);
+	return vm_ioctl(ctx->fd, IC_DEASSIGN_PTDEV, &bdf);
 }
 
 int
@@ -491,7 +608,7 @@ vm_map_ptdev_mmio(struct vmctx *ctx, int bus, int slot, int func,
 	memmap.hpa = hpa;
 	memmap.prot = PROT_ALL;
 
-	return ioctl(ctx->fd, IC_SET_MEMSEG, &memmap);
+	return vm_ioctl(ctx->fd, IC_SET_MEMSEG, &memmap);
 }
 
 int
@@ -507,7 +624,41 @@ vm_unmap_ptdev_mmio(struct vmctx *ctx, int bus, int slot, int func,
 	memmap.hpa = hpa;
 	memmap.prot = PROT_ALL;
 
-	return ioctl(ctx->fd, IC_UNSET_MEMSEG, &memmap);
+	return vm_ioctl(ctx->fd, IC_UNSET_MEMSEG, &memmap);
+}
+
+/*
+ * A BAR the guest moved, unmapped and mapped again in one hypercall, or
+ * in two on a VHM without IC_REMAP_MEMSEG.
+ */
+int
+vm_remap_ptdev_mmio(struct vmctx *ctx, int bus, int slot, int func,
+		   vm_paddr_t old_gpa, vm_paddr_t gpa, size_t len, vm_paddr_t hpa)
+{
+	static bool remap_unsupported;
+	struct vm_memmap_remap remap;
+	int error;
+
+	if (!remap_unsupported) {
+		bzero(&remap, sizeof(struct vm_memmap_remap));
+		remap.old_gpa = old_gpa;
+		remap.memmap.type = VM_MMIO;
+		remap.memmap.len = len;
+		remap.memmap.gpa = gpa;
+		remap.memmap.hpa = hpa;
+		remap.memmap.prot = PROT_ALL;
+
+		error = vm_ioctl(ctx->fd, IC_REMAP_MEMSEG, &remap);
+		if (error == 0 || errno != ENOTTY)
+			return error;
+		remap_unsupported = true;
+	}
+
+	error = vm_unmap_ptdev_mmio(ctx, bus, slot, func, old_gpa, len, hpa);
+	if (error == 0)
+		error = vm_map_ptdev_mmio(ctx, bus, slot, func, gpa, len, hpa);
+
+	return error;
 }
 
 int
@@ -516,7 +667,7 @@ vm_set_ptdev_msix_info(struct vmctx *ctx, struct ic_ptdev_irq *ptirq)
 	if (!ptirq)
 		return -1;
 
-	return ioctl(ctx->fd, IC_SET_PTDEV_INTR_INFO, ptirq);
+	return vm_ioctl(ctx->fd, IC_SET_PTDEV_INTR_INFO, ptirq);
 }
 
 int
@@ -531,7 +682,7 @@ vm_reset_ptdev_msix_info(struct vmctx *ctx, uint16_t virt_bdf, uint16_t phys_bdf
 	ptirq.phys_bdf = phys_bdf;
 	ptirq.msix.vector_cnt = vector_count;
 
-	return ioctl(ctx->fd, IC_RESET_PTDEV_INTR_INFO, &ptirq);
+	return vm_ioctl(ctx->fd, IC_RESET_PTDEV_INTR_INFO, &ptirq);
 }
 
 int
@@ -548,7 +699,7 @@ vm_set_ptdev_intx_info(struct vmctx *ctx, uint16_t virt_bdf, uint16_t phys_bdf,
 	ptirq.intx.phys_pin = phys_pin;
 	ptirq.intx.is_pic_pin = pic_pin;
 
-	return ioctl(ctx->fd, IC_SET_PTDEV_INTR_INFO, &ptirq);
+	return vm_ioctl(ctx->fd, IC_SET_PTDEV_INTR_INFO, &ptirq);
 }
 
 int
@@ -564,7 +715,7 @@ vm_reset_ptdev_intx_info(struct vmctx *ctx, uint16_t virt_bdf, uint16_t phys_bdf
 	ptirq.virt_bdf = virt_bdf;
 	ptirq.phys_bdf = phys_bdf;
 
-	return ioctl(ctx->fd, IC_RESET_PTDEV_INTR_INFO, &ptirq);
+	return vm_ioctl(ctx->fd, IC_RESET_PTDEV_INTR_INFO, &ptirq);
 }
 
 int
@@ -575,37 +726,139 @@ vm_create_vcpu(struct vmctx *ctx, uint16_t vcpu_id)
 
 	bzero(&cv, sizeof(struct acrn_create_vcpu));
 	cv.vcpu_id = vcpu_id;
-	error = ioctl(ctx->fd, IC_CREATE_VCPU, &cv);
+	error = vm_ioctl(ctx->fd, IC_CREATE_VCPU, &cv);
 
 	return error;
 }
 
+/* Add a vCPU to the running VM, on a pCPU the SOS has offlined */
+int
+vm_add_vcpu(struct vmctx *ctx, uint16_t vcpu_id, uint16_t pcpu_id)
+{
+	struct acrn_create_vcpu cv;
+
+	bzero(&cv, sizeof(struct acrn_create_vcpu));
+	cv.vcpu_id = vcpu_id;
+	cv.pcpu_id = pcpu_id;
+
+	return vm_ioctl(ctx->fd, IC_CREATE_VCPU, &cv);
+}
+
+/* Remove a vCPU the guest has ejected, its pCPU goes back to the SOS */
+int
+vm_remove_vcpu(struct vmctx *ctx, uint16_t vcpu_id)
+{
+	return vm_ioctl(ctx->fd, IC_REMOVE_VCPU, (unsigned long)vcpu_id);
+}
+
 int
 vm_set_vcpu_regs(struct vmctx *ctx, struct acrn_set_vcpu_regs *vcpu_regs)
 {
-	return ioctl(ctx->fd, IC_SET_VCPU_REGS, vcpu_regs);
+	return vm_ioctl(ctx->fd, IC_SET_VCPU_REGS, vcpu_regs);
 }
 
 int
 vm_get_cpu_state(struct vmctx *ctx, void *state_buf)
 {
-	return ioctl(ctx->fd, IC_PM_GET_CPU_STATE, state_buf);
+	return vm_ioctl(ctx->fd, IC_PM_GET_CPU_STATE, state_buf);
 }
 
 int
 vm_intr_monitor(struct vmctx *ctx, void *intr_buf)
 {
-	return ioctl(ctx->fd, IC_VM_INTR_MONITOR, intr_buf);
+	return vm_ioctl(ctx->fd, IC_VM_INTR_MONITOR, intr_buf);
 }
 
 int
 vm_ioeventfd(struct vmctx *ctx, struct acrn_ioeventfd *args)
 {
-	return ioctl(ctx->fd, IC_EVENT_IOEVENTFD, args);
+	return vm_ioctl(ctx->fd, IC_EVENT_IOEVENTFD, args);
 }
 
 int
 vm_irqfd(struct vmctx *ctx, struct acrn_irqfd *args)
 {
-	return ioctl(ctx->fd, IC_EVENT_IRQFD, args);
+	return vm_ioctl(ctx->fd, IC_EVENT_IRQFD, args);
+}
+
+int
+vm_set_coalesced_mmio_ring(struct vmctx *ctx,
+		struct acrn_coalesced_mmio_ring *ring)
+{
+	return vm_ioctl(ctx->fd, IC_SET_COALESCED_MMIO_RING, ring);
+}
+
+int
+vm_coalesced_mmio_zone(struct vmctx *ctx,
+		struct acrn_coalesced_mmio_zone *zone)
+{
+	return vm_ioctl(ctx->fd, IC_SET_COALESCED_MMIO_ZONE, zone);
+}
+
+int
+vm_set_timer_counters(struct vmctx *ctx, struct acrn_timer_counters *counters)
+{
+	return vm_ioctl(ctx->fd, IC_SET_TIMER_COUNTERS, counters);
+}
+
+int
+vm_set_vcpu_stats(struct vmctx *ctx, struct acrn_vcpu_stats *stats)
+{
+	return vm_ioctl(ctx->fd, IC_SET_VCPU_STATS, stats);
+}
+
+int
+vm_set_clos(struct vmctx *ctx, uint16_t vcpu_id, uint16_t clos)
+{
+	struct acrn_vm_clos vm_clos;
+
+	bzero(&vm_clos, sizeof(vm_clos));
+	vm_clos.vcpu_id = vcpu_id;
+	vm_clos.clos = clos;
+
+	return vm_ioctl(ctx->fd, IC_SET_VM_CLOS, &vm_clos);
+}
+
+int
+vm_set_clos_mask(struct vmctx *ctx, uint16_t clos, uint16_t type,
+		uint64_t value)
+{
+	struct acrn_clos_mask clos_mask;
+
+	bzero(&clos_mask, sizeof(clos_mask));
+	clos_mask.clos = clos;
+	clos_mask.type = type;
+	clos_mask.value = value;
+
+	return vm_ioctl(ctx->fd, IC_SET_CLOS_MASK, &clos_mask);
+}
+
+int
+vm_set_pci_cfg_shadow(struct vmctx *ctx, struct acrn_pci_cfg_shadow *shadow)
+{
+	return vm_ioctl(ctx->fd, IC_SET_PCI_CFG_SHADOW, shadow);
+}
+
+int
+vm_set_emul_msix(struct vmctx *ctx, struct acrn_emul_msix *msix)
+{
+	return vm_ioctl(ctx->fd, IC_SET_EMUL_MSIX, msix);
+}
+
+int
+vm_ivshmem(struct vmctx *ctx, struct acrn_ivshmem *ivshmem)
+{
+	return vm_ioctl(ctx->fd, IC_VM_IVSHMEM, ivshmem);
+}
+
+int
+vm_set_pio_regs(struct vmctx *ctx, struct acrn_pio_regs *regs)
+{
+	return vm_ioctl(ctx->fd, IC_SET_PIO_REGS, regs);
+}
+
+int
+vm_set_vrtc(struct vmctx *ctx, struct acrn_vrtc *vrtc)
+{
+	return vm_ioctl(ctx->fd, IC_SET_VRTC, vrtc);
 }
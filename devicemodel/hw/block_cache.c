@@ -0,0 +1,389 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * Read cache for blockif.
+ *
+ * All the images share one pool of CACHE_BLKSZ blocks, hashed by image
+ * and block number and evicted in LRU order once the pool reaches the
+ * largest size asked for by the images. An image is identified by the
+ * device and inode of its file, so the contexts opening the same image
+ * share its blocks, and the blocks survive a close/open of the image, as
+ * on a UOS reboot.
+ *
+ * Every invalidation bumps the generation of the image. A miss is read
+ * without the lock and only inserted if the generation did not move in
+ * between, so a block read before a write never gets cached after it.
+ */
+
+#include <sys/queue.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "block_cache.h"
+
+#define CACHE_BLKSZ		(64 * 1024UL)
+#define CACHE_HASH_SIZE		4096		/* power of 2 */
+#define CACHE_RA_TRIGGER	2	/* sequential reads to start readahead */
+#define CACHE_RA_SIZE		(16 * CACHE_BLKSZ)	/* readahead window */
+
+struct blockif_cache {
+	LIST_ENTRY(blockif_cache) link;
+	dev_t			dev;
+	ino_t			ino;
+	off_t			base;
+	struct timespec		mtime;	/* of the file at the last put */
+	off_t			fsize;
+	int			refs;
+	uint64_t		gen;
+
+	/* sequential read detection */
+	off_t			next;	/* end of the last read */
+	int			seq;	/* reads in a row starting at next */
+	off_t			ra_off;	/* pending readahead */
+	off_t			ra_len;
+	off_t			ra_end;	/* end of the last window */
+};
+
+struct cache_blk {
+	LIST_ENTRY(cache_blk)	hlink;
+	TAILQ_ENTRY(cache_blk)	lru;
+	struct blockif_cache	*img;
+	uint64_t		blkno;
+	size_t			len;	/* short at the end of the image */
+	uint8_t			data[CACHE_BLKSZ];
+};
+
+static pthread_mutex_t cache_mtx = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(, blockif_cache) cache_images =
+	LIST_HEAD_INITIALIZER(cache_images);
+static LIST_HEAD(cache_bucket, cache_blk) cache_hash[CACHE_HASH_SIZE];
+static TAILQ_HEAD(cache_lru, cache_blk) cache_lru =
+	TAILQ_HEAD_INITIALIZER(cache_lru);
+static size_t cache_nblks;
+static size_t cache_maxblks;
+
+static inline struct cache_bucket *
+cache_bucket(struct blockif_cache *img, uint64_t blkno)
+{
+	uintptr_t h = ((uintptr_t)img >> 6) + blkno;
+
+	return &cache_hash[h & (CACHE_HASH_SIZE - 1)];
+}
+
+static void
+cache_free_blk(struct cache_blk *b)
+{
+	LIST_REMOVE(b, hlink);
+	TAILQ_REMOVE(&cache_lru, b, lru);
+	cache_nblks--;
+	free(b);
+}
+
+/* Called with the lock held */
+static struct cache_blk *
+cache_lookup(struct blockif_cache *img, uint64_t blkno)
+{
+	struct cache_blk *b;
+
+	LIST_FOREACH(b, cache_bucket(img, blkno), hlink) {
+		if (b->img == img && b->blkno == blkno) {
+			TAILQ_REMOVE(&cache_lru, b, lru);
+			TAILQ_INSERT_HEAD(&cache_lru, b, lru);
+			return b;
+		}
+	}
+	return NULL;
+}
+
+static void
+cache_insert(struct blockif_cache *img, uint64_t blkno, const uint8_t *buf,
+		size_t len, uint64_t gen)
+{
+	struct cache_blk *b;
+
+	pthread_mutex_lock(&cache_mtx);
+	if (img->gen != gen || cache_lookup(img, blkno) != NULL)
+		goto out;
+
+	while (cache_nblks >= cache_maxblks && !TAILQ_EMPTY(&cache_lru))
+		cache_free_blk(TAILQ_LAST(&cache_lru, cache_lru));
+	if (cache_maxblks == 0)
+		goto out;
+
+	b = malloc(sizeof(struct cache_blk));
+	if (b == NULL)
+		goto out;
+	b->img = img;
+	b->blkno = blkno;
+	b->len = len;
+	memcpy(b->data, buf, len);
+	LIST_INSERT_HEAD(cache_bucket(img, blkno), b, hlink);
+	TAILQ_INSERT_HEAD(&cache_lru, b, lru);
+	cache_nblks++;
+out:
+	pthread_mutex_unlock(&cache_mtx);
+}
+
+/* Drop all the blocks of img, called with the lock held */
+static void
+cache_drop_image(struct blockif_cache *img)
+{
+	struct cache_blk *b, *tmp;
+
+	img->gen++;
+	for (b = TAILQ_FIRST(&cache_lru); b != NULL; b = tmp) {
+		tmp = TAILQ_NEXT(b, lru);
+		if (b->img == img)
+			cache_free_blk(b);
+	}
+}
+
+struct blockif_cache *
+blockif_cache_get(int fd, off_t base, size_t size_mb)
+{
+	struct blockif_cache *img;
+	struct stat sbuf;
+	size_t maxblks;
+
+	if (fstat(fd, &sbuf) < 0)
+		return NULL;
+
+	pthread_mutex_lock(&cache_mtx);
+	LIST_FOREACH(img, &cache_images, link) {
+		if (img->dev == sbuf.st_dev && img->ino == sbuf.st_ino &&
+			img->base == base)
+			break;
+	}
+
+	if (img == NULL) {
+		img = calloc(1, sizeof(struct blockif_cache));
+		if (img == NULL)
+			goto out;
+		img->dev = sbuf.st_dev;
+		img->ino = sbuf.st_ino;
+		img->base = base;
+		LIST_INSERT_HEAD(&cache_images, img, link);
+	} else if (img->refs == 0 &&
+		(img->fsize != sbuf.st_size ||
+		 img->mtime.tv_sec != sbuf.st_mtim.tv_sec ||
+		 img->mtime.tv_nsec != sbuf.st_mtim.tv_nsec)) {
+		/* changed since it was closed, or another file on the inode */
+		cache_drop_image(img);
+	}
+	img->refs++;
+
+	maxblks = size_mb * 1024 * 1024 / CACHE_BLKSZ;
+	if (maxblks > cache_maxblks)
+		cache_maxblks = maxblks;
+out:
+	pthread_mutex_unlock(&cache_mtx);
+	return img;
+}
+
+void
+blockif_cache_put(struct blockif_cache *img, int fd)
+{
+	struct stat sbuf;
+	int err;
+
+	err = fstat(fd, &sbuf);
+
+	pthread_mutex_lock(&cache_mtx);
+	if (err < 0) {
+		cache_drop_image(img);
+	} else {
+		img->mtime = sbuf.st_mtim;
+		img->fsize = sbuf.st_size;
+	}
+	img->refs--;
+	pthread_mutex_unlock(&cache_mtx);
+}
+
+/* Copy out the cached part of a block, -1 on a miss */
+static ssize_t
+cache_copy(struct blockif_cache *img, uint64_t blkno, size_t in,
+		uint8_t *buf, size_t n, uint64_t *gen)
+{
+	struct cache_blk *b;
+	ssize_t len;
+
+	pthread_mutex_lock(&cache_mtx);
+	b = cache_lookup(img, blkno);
+	if (b != NULL) {
+		len = (in < b->len) ? b->len - in : 0;
+		if (len > n)
+			len = n;
+		memcpy(buf, b->data + in, len);
+	} else {
+		len = -1;
+		*gen = img->gen;
+	}
+	pthread_mutex_unlock(&cache_mtx);
+	return len;
+}
+
+ssize_t
+blockif_cache_preadv(struct blockif_cache *img, blockif_cache_read_t rd,
+		void *arg, const struct iovec *iov, int iovcnt, off_t offset)
+{
+	uint8_t *buf, *fill;
+	uint64_t blkno, gen;
+	off_t off;
+	size_t left, n, in;
+	ssize_t done, len;
+	int i;
+
+	fill = NULL;
+	done = 0;
+	off = offset;
+	for (i = 0; i < iovcnt; i++) {
+		buf = iov[i].iov_base;
+		left = iov[i].iov_len;
+		while (left > 0) {
+			blkno = off / CACHE_BLKSZ;
+			in = off % CACHE_BLKSZ;
+			n = CACHE_BLKSZ - in;
+			if (n > left)
+				n = left;
+
+			len = cache_copy(img, blkno, in, buf, n, &gen);
+			if (len < 0) {
+				/* miss, read the whole block */
+				if (fill == NULL)
+					fill = malloc(CACHE_BLKSZ);
+				if (fill == NULL) {
+					errno = ENOMEM;
+					done = -1;
+					goto out;
+				}
+				len = rd(arg, fill, CACHE_BLKSZ,
+						blkno * CACHE_BLKSZ);
+				if (len < 0) {
+					done = -1;
+					goto out;
+				}
+				if (len > 0)
+					cache_insert(img, blkno, fill, len, gen);
+				len = ((size_t)len > in) ? len - in : 0;
+				if ((size_t)len > n)
+					len = n;
+				memcpy(buf, fill + in, len);
+			}
+
+			done += len;
+			if ((size_t)len < n)
+				goto out;	/* end of the image */
+			buf += n;
+			left -= n;
+			off += n;
+		}
+	}
+
+out:
+	free(fill);
+	if (done <= 0)
+		return done;
+
+	pthread_mutex_lock(&cache_mtx);
+	if (offset == img->next)
+		img->seq++;
+	else
+		img->seq = 0;
+	img->next = offset + done;
+	if (img->seq >= CACHE_RA_TRIGGER) {
+		off = img->next;
+		if (off < img->ra_end)
+			off = img->ra_end;
+		if (off < img->next + (off_t)CACHE_RA_SIZE) {
+			img->ra_off = off;
+			img->ra_len = img->next + CACHE_RA_SIZE - off;
+			img->ra_end = img->next + CACHE_RA_SIZE;
+		}
+	}
+	pthread_mutex_unlock(&cache_mtx);
+
+	return done;
+}
+
+void
+blockif_cache_readahead(struct blockif_cache *img, blockif_cache_read_t rd,
+		void *arg)
+{
+	uint8_t *fill;
+	uint64_t blkno, last, gen;
+	ssize_t len;
+	int cached;
+
+	pthread_mutex_lock(&cache_mtx);
+	blkno = img->ra_off / CACHE_BLKSZ;
+	last = (img->ra_off + img->ra_len - 1) / CACHE_BLKSZ;
+	len = img->ra_len;
+	img->ra_len = 0;
+	pthread_mutex_unlock(&cache_mtx);
+
+	if (len == 0)
+		return;
+
+	fill = malloc(CACHE_BLKSZ);
+	if (fill == NULL)
+		return;
+
+	for (; blkno <= last; blkno++) {
+		pthread_mutex_lock(&cache_mtx);
+		cached = (cache_lookup(img, blkno) != NULL);
+		gen = img->gen;
+		pthread_mutex_unlock(&cache_mtx);
+		if (cached)
+			continue;
+
+		len = rd(arg, fill, CACHE_BLKSZ, blkno * CACHE_BLKSZ);
+		if (len <= 0)
+			break;
+		cache_insert(img, blkno, fill, len, gen);
+		if (len < CACHE_BLKSZ)
+			break;
+	}
+	free(fill);
+}
+
+void
+blockif_cache_invalidate(struct blockif_cache *img, off_t offset, off_t len)
+{
+	struct cache_blk *b, *tmp;
+	uint64_t blkno, last;
+
+	if (len <= 0)
+		return;
+
+	blkno = offset / CACHE_BLKSZ;
+	last = (offset + len - 1) / CACHE_BLKSZ;
+
+	pthread_mutex_lock(&cache_mtx);
+	img->gen++;
+	if (last - blkno >= cache_nblks) {
+		/* cheaper to walk the cache than the range */
+		for (b = TAILQ_FIRST(&cache_lru); b != NULL; b = tmp) {
+			tmp = TAILQ_NEXT(b, lru);
+			if (b->img == img && b->blkno >= blkno &&
+				b->blkno <= last)
+				cache_free_blk(b);
+		}
+	} else {
+		for (; blkno <= last; blkno++) {
+			b = cache_lookup(img, blkno);
+			if (b != NULL)
+				cache_free_blk(b);
+		}
+	}
+	pthread_mutex_unlock(&cache_mtx);
+}
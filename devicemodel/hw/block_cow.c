@@ -0,0 +1,529 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * Copy-on-write overlay images for blockif.
+ *
+ * The virtual disk is split in clusters. A cluster written by the guest
+ * is copied from the backing image into the overlay first, the clusters
+ * never written are read from the backing image, which is never written
+ * to. Instantiating a UOS only needs an empty overlay file.
+ *
+ * On-disk layout of the overlay, in host (little endian) byte order:
+ *  cluster 0:	struct cow_header
+ *  cluster 1:	the L1 table, the offsets of the L2 tables
+ *  then the L2 tables and the data clusters in allocation order.
+ * An L2 table is one cluster with the offsets of the data clusters, a zero
+ * L1 or L2 entry means the range is not in the overlay. New clusters are
+ * appended to the file, and the entries pointing to them are only written
+ * once the cluster is synced, so an interrupted allocation only leaks the
+ * cluster.
+ *
+ * The L1 table is kept in memory, the L2 tables go through a small LRU
+ * cache. The tables are written through, so eviction is free.
+ */
+
+#include <sys/param.h>
+#include <sys/queue.h>
+#include <sys/stat.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "block_cow.h"
+
+#define WPRINTF(params) (printf params)
+
+#define COW_MAGIC		0x574f4341	/* "ACOW" */
+#define COW_VERSION		1
+#define COW_CLUSTER_BITS	16		/* 64KiB clusters */
+#define COW_MIN_CLUSTER_BITS	12
+#define COW_MAX_CLUSTER_BITS	21
+#define COW_L2_CACHE_SIZE	32		/* L2 tables kept in memory */
+
+struct cow_header {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	cluster_bits;
+	uint32_t	l1_entries;
+	uint64_t	size;		/* virtual disk size in bytes */
+	uint64_t	l1_offset;
+} __attribute__((packed));
+
+struct cow_l2 {
+	TAILQ_ENTRY(cow_l2)	link;
+	uint64_t		offset;	/* of the table, 0 if the slot is free */
+	uint64_t		*table;
+};
+
+struct blockif_cow {
+	int			fd;
+	int			bfd;
+	off_t			bsize;		/* of the backing image */
+	uint64_t		size;
+	uint32_t		cluster_bits;
+	uint64_t		cluster_size;
+	uint32_t		l1_entries;
+	uint64_t		l1_offset;
+	uint64_t		*l1;
+	uint64_t		end;		/* where the next cluster goes */
+	uint8_t			*cbuf;		/* for the copy of a cluster */
+
+	/* Protects the tables and the allocation */
+	pthread_mutex_t		mtx;
+	TAILQ_HEAD(cow_l2_list, cow_l2) l2_lru;	/* most recent first */
+	struct cow_l2		l2_cache[COW_L2_CACHE_SIZE];
+};
+
+/* Read len bytes, what is past the end of the file reads as zeroes */
+static int
+cow_pread_full(int fd, void *buf, size_t len, off_t off)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = pread(fd, buf, len, off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0) {
+			memset(buf, 0, len);
+			break;
+		}
+		buf = (uint8_t *)buf + n;
+		len -= n;
+		off += n;
+	}
+	return 0;
+}
+
+static int
+cow_pwrite_full(int fd, const void *buf, size_t len, off_t off)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = pwrite(fd, buf, len, off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf = (const uint8_t *)buf + n;
+		len -= n;
+		off += n;
+	}
+	return 0;
+}
+
+static inline uint32_t
+cow_l2_bits(struct blockif_cow *cow)
+{
+	/* an L2 table holds cluster_size / sizeof(uint64_t) entries */
+	return cow->cluster_bits - 3;
+}
+
+static inline uint32_t
+cow_l1_index(struct blockif_cow *cow, uint64_t off)
+{
+	return off >> (cow->cluster_bits + cow_l2_bits(cow));
+}
+
+static inline uint32_t
+cow_l2_index(struct blockif_cow *cow, uint64_t off)
+{
+	return (off >> cow->cluster_bits) & ((1UL << cow_l2_bits(cow)) - 1);
+}
+
+/* Append a cluster to the overlay, it reads as zeroes until written */
+static uint64_t
+cow_alloc_cluster(struct blockif_cow *cow)
+{
+	uint64_t off = cow->end;
+
+	if (ftruncate(cow->fd, off + cow->cluster_size) < 0)
+		return 0;
+	cow->end += cow->cluster_size;
+	return off;
+}
+
+/*
+ * Get the L2 table covering the L1 entry l1_idx, allocating it if alloc is
+ * set. *table is NULL if the table is not allocated.
+ */
+static int
+cow_l2_table(struct blockif_cow *cow, uint32_t l1_idx, int alloc,
+		uint64_t **table)
+{
+	struct cow_l2 *l2;
+	uint64_t l2_off;
+
+	*table = NULL;
+	l2_off = cow->l1[l1_idx];
+	if (l2_off == 0) {
+		if (!alloc)
+			return 0;
+		l2_off = cow_alloc_cluster(cow);
+		if (l2_off == 0)
+			return -1;
+		/* the zeroed table is on disk before the L1 entry */
+		if (fdatasync(cow->fd) < 0)
+			return -1;
+		if (cow_pwrite_full(cow->fd, &l2_off, sizeof(l2_off),
+				cow->l1_offset + l1_idx * sizeof(uint64_t)) < 0)
+			return -1;
+		cow->l1[l1_idx] = l2_off;
+	}
+
+	TAILQ_FOREACH(l2, &cow->l2_lru, link) {
+		if (l2->offset == l2_off)
+			break;
+	}
+
+	if (l2 == NULL) {
+		/* reuse the least recently used slot */
+		l2 = TAILQ_LAST(&cow->l2_lru, cow_l2_list);
+		l2->offset = 0;
+		if (cow_pread_full(cow->fd, l2->table, cow->cluster_size,
+				l2_off) < 0)
+			return -1;
+		l2->offset = l2_off;
+	}
+
+	if (l2 != TAILQ_FIRST(&cow->l2_lru)) {
+		TAILQ_REMOVE(&cow->l2_lru, l2, link);
+		TAILQ_INSERT_HEAD(&cow->l2_lru, l2, link);
+	}
+	*table = l2->table;
+	return 0;
+}
+
+/* Offset in the overlay of the cluster holding off, 0 if not allocated */
+static int
+cow_lookup(struct blockif_cow *cow, uint64_t off, uint64_t *host)
+{
+	uint64_t *table;
+
+	if (cow_l2_table(cow, cow_l1_index(cow, off), 0, &table) < 0)
+		return -1;
+	*host = (table != NULL) ? table[cow_l2_index(cow, off)] : 0;
+	return 0;
+}
+
+static int
+cow_read_backing(struct blockif_cow *cow, uint8_t *buf, size_t len,
+		uint64_t off)
+{
+	size_t n;
+
+	n = 0;
+	if (off < cow->bsize) {
+		n = (len < cow->bsize - off) ? len : cow->bsize - off;
+		if (cow_pread_full(cow->bfd, buf, n, off) < 0)
+			return -1;
+	}
+	memset(buf + n, 0, len - n);
+	return 0;
+}
+
+/*
+ * Allocate the cluster holding off and fill it with the backing data and
+ * the len bytes of buf at off. Called with the lock held.
+ */
+static int
+cow_copy_cluster(struct blockif_cow *cow, const uint8_t *buf, size_t len,
+		uint64_t off)
+{
+	uint64_t base, host, *table;
+	uint32_t l2_idx;
+
+	base = off & ~(cow->cluster_size - 1);
+	if (len != cow->cluster_size &&
+		cow_read_backing(cow, cow->cbuf, cow->cluster_size, base) < 0)
+		return -1;
+	memcpy(cow->cbuf + (off - base), buf, len);
+
+	if (cow_l2_table(cow, cow_l1_index(cow, off), 1, &table) < 0)
+		return -1;
+	host = cow_alloc_cluster(cow);
+	if (host == 0)
+		return -1;
+	if (cow_pwrite_full(cow->fd, cow->cbuf, cow->cluster_size, host) < 0)
+		return -1;
+	/* the data is on disk before the L2 entry */
+	if (fdatasync(cow->fd) < 0)
+		return -1;
+
+	l2_idx = cow_l2_index(cow, off);
+	if (cow_pwrite_full(cow->fd, &host, sizeof(host),
+			cow->l1[cow_l1_index(cow, off)] +
+			l2_idx * sizeof(uint64_t)) < 0)
+		return -1;
+	table[l2_idx] = host;
+	return 0;
+}
+
+static int
+cow_read_piece(struct blockif_cow *cow, uint8_t *buf, size_t len,
+		uint64_t off)
+{
+	uint64_t host;
+	int err;
+
+	pthread_mutex_lock(&cow->mtx);
+	err = cow_lookup(cow, off, &host);
+	pthread_mutex_unlock(&cow->mtx);
+	if (err < 0)
+		return -1;
+
+	if (host != 0)
+		return cow_pread_full(cow->fd, buf, len,
+				host + (off & (cow->cluster_size - 1)));
+	return cow_read_backing(cow, buf, len, off);
+}
+
+static int
+cow_write_piece(struct blockif_cow *cow, const uint8_t *buf, size_t len,
+		uint64_t off)
+{
+	uint64_t host;
+	int err;
+
+	pthread_mutex_lock(&cow->mtx);
+	err = cow_lookup(cow, off, &host);
+	if (err == 0 && host == 0) {
+		/* the first write to the cluster */
+		err = cow_copy_cluster(cow, buf, len, off);
+		pthread_mutex_unlock(&cow->mtx);
+		return err;
+	}
+	pthread_mutex_unlock(&cow->mtx);
+	if (err < 0)
+		return -1;
+
+	return cow_pwrite_full(cow->fd, buf, len,
+			host + (off & (cow->cluster_size - 1)));
+}
+
+/* Split the request at the cluster boundaries, like preadv/pwritev */
+static ssize_t
+cow_rw(struct blockif_cow *cow, const struct iovec *iov, int iovcnt,
+		off_t offset, int write)
+{
+	uint8_t *buf;
+	uint64_t off;
+	size_t left, n;
+	ssize_t done;
+	int i, err;
+
+	if (offset < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	done = 0;
+	off = offset;
+	for (i = 0; i < iovcnt; i++) {
+		buf = iov[i].iov_base;
+		left = iov[i].iov_len;
+		while (left > 0) {
+			if (off >= cow->size)
+				return done;
+			n = cow->cluster_size - (off & (cow->cluster_size - 1));
+			if (n > left)
+				n = left;
+			if (n > cow->size - off)
+				n = cow->size - off;
+
+			if (write)
+				err = cow_write_piece(cow, buf, n, off);
+			else
+				err = cow_read_piece(cow, buf, n, off);
+			if (err < 0)
+				return -1;
+
+			buf += n;
+			left -= n;
+			off += n;
+			done += n;
+		}
+	}
+	return done;
+}
+
+ssize_t
+blockif_cow_preadv(struct blockif_cow *cow, const struct iovec *iov,
+		int iovcnt, off_t offset)
+{
+	return cow_rw(cow, iov, iovcnt, offset, 0);
+}
+
+ssize_t
+blockif_cow_pwritev(struct blockif_cow *cow, const struct iovec *iov,
+		int iovcnt, off_t offset)
+{
+	return cow_rw(cow, iov, iovcnt, offset, 1);
+}
+
+/* Write the header and an empty L1 table to an empty overlay */
+static int
+cow_format(int fd, off_t bsize, struct cow_header *hdr)
+{
+	uint64_t cluster_size, l2_span;
+
+	cluster_size = 1UL << COW_CLUSTER_BITS;
+	l2_span = cluster_size * (cluster_size / sizeof(uint64_t));
+
+	hdr->magic = COW_MAGIC;
+	hdr->version = COW_VERSION;
+	hdr->cluster_bits = COW_CLUSTER_BITS;
+	hdr->size = bsize;
+	hdr->l1_entries = (bsize + l2_span - 1) / l2_span;
+	hdr->l1_offset = cluster_size;
+
+	/* the L1 table is zeroed by the truncate */
+	if (ftruncate(fd, hdr->l1_offset + roundup(hdr->l1_entries *
+			sizeof(uint64_t), cluster_size)) < 0)
+		return -1;
+	if (cow_pwrite_full(fd, hdr, sizeof(*hdr), 0) < 0)
+		return -1;
+	return fsync(fd);
+}
+
+static int
+cow_check_header(struct cow_header *hdr, off_t fsize)
+{
+	uint64_t l2_span;
+
+	if (hdr->magic != COW_MAGIC || hdr->version != COW_VERSION) {
+		WPRINTF(("cow: not an overlay image\n"));
+		return -1;
+	}
+	if (hdr->cluster_bits < COW_MIN_CLUSTER_BITS ||
+		hdr->cluster_bits > COW_MAX_CLUSTER_BITS) {
+		WPRINTF(("cow: invalid cluster size 2^%u\n", hdr->cluster_bits));
+		return -1;
+	}
+	l2_span = 1UL << (2 * hdr->cluster_bits - 3);
+	if (hdr->l1_entries < (hdr->size + l2_span - 1) / l2_span ||
+		hdr->l1_offset == 0 ||
+		(hdr->l1_offset & ((1UL << hdr->cluster_bits) - 1))) {
+		WPRINTF(("cow: invalid L1 table\n"));
+		return -1;
+	}
+	/* the L1 table is read in memory, it has to be in the file */
+	if (hdr->l1_offset > fsize ||
+		hdr->l1_entries * sizeof(uint64_t) > fsize - hdr->l1_offset) {
+		WPRINTF(("cow: L1 table past the end of the overlay\n"));
+		return -1;
+	}
+	return 0;
+}
+
+struct blockif_cow *
+blockif_cow_open(int fd, const char *backing, int ro, off_t *size)
+{
+	struct blockif_cow *cow;
+	struct cow_header hdr;
+	struct stat sbuf;
+	size_t l1_len;
+	int i;
+
+	cow = calloc(1, sizeof(struct blockif_cow));
+	if (cow == NULL) {
+		perror("calloc");
+		return NULL;
+	}
+	cow->fd = fd;
+	pthread_mutex_init(&cow->mtx, NULL);
+	TAILQ_INIT(&cow->l2_lru);
+
+	cow->bfd = open(backing, O_RDONLY);
+	if (cow->bfd < 0) {
+		warn("Could not open backing image: %s", backing);
+		goto err;
+	}
+	cow->bsize = lseek(cow->bfd, 0, SEEK_END);
+	if (cow->bsize < 0) {
+		warn("Could not get the size of %s", backing);
+		goto err;
+	}
+
+	if (fstat(fd, &sbuf) < 0)
+		goto err;
+	if (sbuf.st_size == 0) {
+		if (ro) {
+			WPRINTF(("cow: cannot format a read only overlay\n"));
+			goto err;
+		}
+		if (cow_format(fd, cow->bsize, &hdr) < 0) {
+			warn("Could not format the overlay");
+			goto err;
+		}
+		if (fstat(fd, &sbuf) < 0)
+			goto err;
+	} else if (cow_pread_full(fd, &hdr, sizeof(hdr), 0) < 0 ||
+			cow_check_header(&hdr, sbuf.st_size) < 0) {
+		goto err;
+	}
+
+	if (hdr.size != cow->bsize)
+		WPRINTF(("cow: overlay size 0x%lx, backing image size 0x%lx\n",
+			hdr.size, cow->bsize));
+
+	cow->size = hdr.size;
+	cow->cluster_bits = hdr.cluster_bits;
+	cow->cluster_size = 1UL << hdr.cluster_bits;
+	cow->l1_entries = hdr.l1_entries;
+	cow->l1_offset = hdr.l1_offset;
+	cow->end = roundup(sbuf.st_size, cow->cluster_size);
+
+	l1_len = cow->l1_entries * sizeof(uint64_t);
+	cow->l1 = malloc(l1_len);
+	cow->cbuf = malloc(cow->cluster_size);
+	if (cow->l1 == NULL || cow->cbuf == NULL)
+		goto err;
+	if (cow_pread_full(fd, cow->l1, l1_len, cow->l1_offset) < 0)
+		goto err;
+
+	for (i = 0; i < COW_L2_CACHE_SIZE; i++) {
+		cow->l2_cache[i].table = malloc(cow->cluster_size);
+		if (cow->l2_cache[i].table == NULL)
+			goto err;
+		TAILQ_INSERT_TAIL(&cow->l2_lru, &cow->l2_cache[i], link);
+	}
+
+	*size = cow->size;
+	return cow;
+
+err:
+	blockif_cow_close(cow);
+	return NULL;
+}
+
+void
+blockif_cow_close(struct blockif_cow *cow)
+{
+	int i;
+
+	if (cow->bfd >= 0)
+		close(cow->bfd);
+	for (i = 0; i < COW_L2_CACHE_SIZE; i++)
+		free(cow->l2_cache[i].table);
+	free(cow->cbuf);
+	free(cow->l1);
+	pthread_mutex_destroy(&cow->mtx);
+	free(cow);
+}
@@ -30,11 +30,18 @@
 #include <sys/queue.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
 #include <linux/falloc.h>
 #include <linux/fs.h>
+#include <linux/io_uring.h>
+#include <linux/aio_abi.h>
 #include <errno.h>
 #include <err.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -44,8 +51,13 @@
 
 #include "dm.h"
 #include "block_if.h"
+#include "block_cow.h"
+#include "block_cache.h"
 #include "ahci.h"
 #include "dm_string.h"
+#include "mevent.h"
+#include "timer.h"
+#include "dm_stats.h"
 
 /*
  * Notes:
@@ -59,12 +71,32 @@
 #define F_OFD_SETLK	37
 #endif
 
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup	425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter	426
+#endif
+#ifndef __NR_io_uring_register
+#define __NR_io_uring_register	427
+#endif
+
 #define BLOCKIF_SIG	0xb109b109
 
 #define BLOCKIF_NUMTHR	8
 #define BLOCKIF_MAXREQ	(64 + BLOCKIF_NUMTHR)
 #define MAX_DISCARD_SEGMENT	256
 
+/*
+ * Write zeroes falls back to writing the zeroes when the image can't zero
+ * a range by itself, BLOCKIF_ZERO_BUF_SZ at once from a read-only zero
+ * mapping. Any image may fall back, the overlays always do, so the limit
+ * advertised is never above BLOCKIF_ZERO_MAX_SECTORS, to keep one request
+ * short.
+ */
+#define BLOCKIF_ZERO_BUF_SZ	(1024 * 1024)
+#define BLOCKIF_ZERO_MAX_SECTORS	(256 * 1024 * 1024 / DEV_BSIZE)
+
 /*
  * Debug printf
  */
@@ -76,7 +108,8 @@ enum blockop {
 	BOP_READ,
 	BOP_WRITE,
 	BOP_FLUSH,
-	BOP_DISCARD
+	BOP_DISCARD,
+	BOP_WRITE_ZEROES
 };
 
 enum blockstat {
@@ -84,9 +117,16 @@ enum blockstat {
 	BST_BLOCK,
 	BST_PEND,
 	BST_BUSY,
-	BST_DONE
+	BST_DONE,
+	BST_MERGED
 };
 
+/*
+ * Contiguous read/write requests with the same op which are queued while
+ * the first one is not started yet are merged into it: they stay on the
+ * queues with BST_MERGED, chained from mnext, and the first one (mhead)
+ * carries the iovecs of the whole chain in miov.
+ */
 struct blockif_elem {
 	TAILQ_ENTRY(blockif_elem) link;
 	struct blockif_req  *req;
@@ -94,6 +134,94 @@ struct blockif_elem {
 	enum blockstat	     status;
 	pthread_t            tid;
 	off_t		     block;
+	uint64_t	     start;	/* enqueue time, in ns */
+	uint64_t	     lat;	/* to the completion callback */
+	ssize_t		     done;	/* bytes transferred */
+	int		     err;
+	struct blockif_elem *mhead;
+	struct blockif_elem *mnext;
+	struct blockif_elem *mtail;
+	int		     miovcnt;
+	struct iovec	     miov[BLOCKIF_IOV_MAX];
+
+	/*
+	 * Ranges of a discard or write zeroes, merged by blockif_ranges()
+	 * when queued: their number, -1 if invalid, and the first one.
+	 */
+	int		     nranges;
+	off_t		     roff;
+	off_t		     rlen;
+	int		     runmap;
+};
+
+struct blockif_ctxt;
+
+/*
+ * An async engine takes over the requests it can submit from the block
+ * i/o threads, one thread is kept for the others (e.g. discard).
+ * submit() queues a request and kick() hands the queued ones to the kernel,
+ * both are called with the ctxt mutex held. The engine reports completions
+ * through blockif_aio_done().
+ */
+struct blockif_engine {
+	const char	*name;
+	int		(*init)(struct blockif_ctxt *bc);
+	void		(*deinit)(struct blockif_ctxt *bc);
+	int		(*can_submit)(struct blockif_ctxt *bc, struct blockif_elem *be);
+	void		(*submit)(struct blockif_ctxt *bc, struct blockif_elem *be);
+	void		(*kick)(struct blockif_ctxt *bc);
+};
+
+struct blockif_uring {
+	int			fd;
+	int			efd;
+	struct mevent		*mevp;
+	void			*sq_ring;
+	size_t			sq_ring_sz;
+	void			*cq_ring;
+	size_t			cq_ring_sz;
+	struct io_uring_sqe	*sqes;
+	size_t			sqes_sz;
+	unsigned int		*sq_tail;
+	unsigned int		*sq_mask;
+	unsigned int		*cq_head;
+	unsigned int		*cq_tail;
+	unsigned int		*cq_mask;
+	struct io_uring_cqe	*cqes;
+	unsigned int		to_submit;
+	int			fallocate;	/* IORING_OP_FALLOCATE supported */
+};
+
+struct blockif_laio {
+	aio_context_t		ctx;
+	int			dfd;
+	int			efd;
+	struct mevent		*mevp;
+	struct iocb		iocbs[BLOCKIF_MAXREQ];
+	void			*bounce[BLOCKIF_MAXREQ];
+	struct iocb		*queued[BLOCKIF_MAXREQ];
+	int			nqueued;
+	struct blockif_elem	*failed[BLOCKIF_MAXREQ];
+	int			failed_err[BLOCKIF_MAXREQ];
+	int			nfailed;
+};
+
+/*
+ * Token bucket, it runs into debt for the request that empties it so
+ * that a request larger than the burst still gets through.
+ */
+struct blockif_bucket {
+	uint64_t		rate;	/* tokens per second, 0 for no limit */
+	uint64_t		burst;
+	int64_t			tokens;
+	uint64_t		last;	/* time of the last refill, in ns */
+};
+
+/* I/O throttling, shared by the contexts cloned from one another */
+struct blockif_qos {
+	pthread_mutex_t		mtx;
+	struct blockif_bucket	ops;
+	struct blockif_bucket	bytes;
 };
 
 struct blockif_ctxt {
@@ -103,6 +231,7 @@ struct blockif_ctxt {
 	int			rdonly;
 	off_t			size;
 	int			sub_file_assign;
+	int			shared_fd;
 	off_t			sub_file_start_lba;
 	struct flock		fl;
 	int			sectsz;
@@ -111,11 +240,44 @@ struct blockif_ctxt {
 	int			max_discard_sectors;
 	int			max_discard_seg;
 	int			discard_sector_alignment;
+	int			canzero;
+	int			max_zero_sectors;
+	int			max_zero_seg;
+	int			nozerorange;	/* no FALLOC_FL_ZERO_RANGE */
 	int			closing;
+	int			nthr;
 	pthread_t		btid[BLOCKIF_NUMTHR];
+	struct blockif_cow	*cow;	/* overlay image, if any */
+	struct blockif_cache	*rcache;	/* read cache, if any */
+	struct blockif_engine	*engine;
+	struct blockif_uring	uring;
+	struct blockif_laio	laio;
+	int			plugged;
 	pthread_mutex_t		mtx;
 	pthread_cond_t		cond;
 
+	/* end of a batch of completions, see blockif_set_batch_cb() */
+	void			(*batch_cb)(void *);
+	void			*batch_arg;
+
+	/* fsync() coalescing, see blockif_fsync() */
+	pthread_mutex_t		flush_mtx;
+	pthread_cond_t		flush_cond;
+	uint64_t		flush_started;
+	uint64_t		flush_done;
+	int			flush_running;
+	int			flush_err;
+	int			nodsync;	/* no RWF_DSYNC in the kernel */
+
+	/* throttling, see blockif_throttled() */
+	struct blockif_qos	*qos;
+	uint64_t		qos_wait;	/* ns until the next request may go */
+	struct acrn_timer	qos_timer;	/* re-dispatch for the engines */
+	int			qos_armed;
+
+	/* counters of the completed requests, see blockif_account() */
+	struct blockif_stats	stats;
+
 	/* Request elements and free/pending/busy queues */
 	TAILQ_HEAD(, blockif_elem) freeq;
 	TAILQ_HEAD(, blockif_elem) pendq;
@@ -139,27 +301,431 @@ struct discard_range {
 	uint64_t sector;
 	uint32_t num_sectors;
 	uint32_t flags;
+#define DISCARD_RANGE_F_UNMAP	0x1	/* write zeroes may deallocate */
 };
 
+/* source of the zeroes written by write zeroes, see blockif_write_zero_buf() */
+static void *blockif_zero_buf;
+
 static struct blockif_sig_elem *blockif_bse_head;
 
+/*
+ * fsync() the image, sharing the fsync() of the other threads when
+ * possible: the caller needs an fsync() started after it got here, so it
+ * waits for the one in flight, if any, and then either starts the next
+ * one or finds that another waiter has started it already.
+ */
+static int
+blockif_fsync(struct blockif_ctxt *bc)
+{
+	uint64_t target, n;
+	int err;
+
+	pthread_mutex_lock(&bc->flush_mtx);
+	target = bc->flush_started + 1;
+	while (bc->flush_done < target) {
+		if (bc->flush_running) {
+			pthread_cond_wait(&bc->flush_cond, &bc->flush_mtx);
+			continue;
+		}
+
+		bc->flush_running = 1;
+		n = ++bc->flush_started;
+		pthread_mutex_unlock(&bc->flush_mtx);
+
+		err = fsync(bc->fd) ? errno : 0;
+
+		pthread_mutex_lock(&bc->flush_mtx);
+		bc->flush_running = 0;
+		bc->flush_done = n;
+		bc->flush_err = err;
+		pthread_cond_broadcast(&bc->flush_cond);
+	}
+	err = bc->flush_err;
+	pthread_mutex_unlock(&bc->flush_mtx);
+
+	return err;
+}
+
 static int
 blockif_flush_cache(struct blockif_ctxt *bc)
 {
 	int err;
 
 	err = 0;
-	if (!bc->wce) {
-		if (fsync(bc->fd))
-			err = errno;
-	}
+	if (!bc->wce)
+		err = blockif_fsync(bc);
 	return err;
 }
 
+/*
+ * Write to the image, in writethru mode with RWF_DSYNC rather than a
+ * separate fsync() when the kernel has it.
+ */
+static ssize_t
+blockif_pwritev(struct blockif_ctxt *bc, struct iovec *iov, int iovcnt,
+		off_t offset, int *err)
+{
+	ssize_t len;
+
+	*err = 0;
+	if (!bc->wce && !bc->nodsync) {
+		len = pwritev2(bc->fd, iov, iovcnt, offset, RWF_DSYNC);
+		if (len >= 0 || (errno != EOPNOTSUPP && errno != ENOSYS &&
+			errno != EINVAL)) {
+			if (len < 0)
+				*err = errno;
+			return len;
+		}
+		bc->nodsync = 1;
+	}
+
+	len = pwritev(bc->fd, iov, iovcnt, offset);
+	if (len < 0)
+		*err = errno;
+	else
+		*err = blockif_flush_cache(bc);
+	return len;
+}
+
+/*
+ * Merge be into the chain of tbe if tbe ends the chain, the chain is not
+ * started yet and the iovecs of both fit in one vectored i/o.
+ */
+static int
+blockif_merge(struct blockif_elem *tbe, struct blockif_elem *be)
+{
+	struct blockif_elem *head = tbe->mhead;
+	struct blockif_req *br = be->req;
+
+	if ((be->op != BOP_READ && be->op != BOP_WRITE) || head->op != be->op ||
+			head->mtail != tbe ||
+			(head->status != BST_PEND && head->status != BST_BLOCK))
+		return 0;
+
+	if (head->mnext == NULL) {
+		if (head->req->iovcnt + br->iovcnt > BLOCKIF_IOV_MAX)
+			return 0;
+		memcpy(head->miov, head->req->iov,
+			head->req->iovcnt * sizeof(struct iovec));
+		head->miovcnt = head->req->iovcnt;
+	} else if (head->miovcnt + br->iovcnt > BLOCKIF_IOV_MAX)
+		return 0;
+
+	memcpy(&head->miov[head->miovcnt], br->iov,
+		br->iovcnt * sizeof(struct iovec));
+	head->miovcnt += br->iovcnt;
+	tbe->mnext = be;
+	head->mtail = be;
+	be->mhead = head;
+	return 1;
+}
+
+/* the iovecs and the length in bytes of a read/write and its merged chain */
+static void
+blockif_elem_iov(struct blockif_elem *be, struct iovec **iov, int *iovcnt)
+{
+	if (be->mnext != NULL) {
+		*iov = be->miov;
+		*iovcnt = be->miovcnt;
+	} else {
+		*iov = be->req->iov;
+		*iovcnt = be->req->iovcnt;
+	}
+}
+
+static off_t
+blockif_elem_len(struct blockif_elem *be)
+{
+	return be->mtail->block - be->req->offset;
+}
+
+static uint64_t
+blockif_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static void
+blockif_bucket_set(struct blockif_bucket *b, uint64_t rate, uint64_t burst,
+		uint64_t now)
+{
+	b->rate = rate;
+	/* one second of tokens by default */
+	b->burst = (burst != 0) ? burst : rate;
+	b->tokens = b->burst;
+	b->last = now;
+}
+
+static void
+blockif_bucket_refill(struct blockif_bucket *b, uint64_t now)
+{
+	uint64_t add;
+
+	add = (unsigned __int128)(now - b->last) * b->rate / NS_PER_SEC;
+	if (add == 0)
+		return;
+
+	if (b->tokens + add >= b->burst) {
+		b->tokens = b->burst;
+		b->last = now;
+	} else {
+		b->tokens += add;
+		/* keep the fraction of a token for the next refill */
+		b->last += (unsigned __int128)add * NS_PER_SEC / b->rate;
+	}
+}
+
+/* ns until the bucket has a token again */
+static uint64_t
+blockif_bucket_wait(struct blockif_bucket *b, uint64_t now)
+{
+	uint64_t need, since;
+
+	if (b->rate == 0 || b->tokens > 0)
+		return 0;
+	need = ((unsigned __int128)(1 - b->tokens) * NS_PER_SEC +
+			b->rate - 1) / b->rate;
+	since = now - b->last;
+	return (need > since) ? need - since : 1;
+}
+
+/*
+ * Whether be has to wait for the rate limits, in which case bc->qos_wait
+ * is how long. Otherwise its tokens are taken. The requests merged into
+ * be take one op. Called with the mutex held.
+ */
+static int
+blockif_throttled(struct blockif_ctxt *bc, struct blockif_elem *be)
+{
+	struct blockif_qos *qos = bc->qos;
+	uint64_t now, wait, bwait;
+
+	if ((qos->ops.rate == 0 && qos->bytes.rate == 0) ||
+		(be->op != BOP_READ && be->op != BOP_WRITE))
+		return 0;
+
+	now = blockif_now();
+	pthread_mutex_lock(&qos->mtx);
+	if (qos->ops.rate != 0)
+		blockif_bucket_refill(&qos->ops, now);
+	if (qos->bytes.rate != 0)
+		blockif_bucket_refill(&qos->bytes, now);
+
+	wait = blockif_bucket_wait(&qos->ops, now);
+	bwait = blockif_bucket_wait(&qos->bytes, now);
+	if (bwait > wait)
+		wait = bwait;
+	if (wait == 0) {
+		if (qos->ops.rate != 0)
+			qos->ops.tokens--;
+		if (qos->bytes.rate != 0)
+			qos->bytes.tokens -= blockif_elem_len(be);
+	}
+	pthread_mutex_unlock(&qos->mtx);
+
+	bc->qos_wait = wait;
+	return (wait != 0);
+}
+
+/* <rate>[/<burst>] */
+static int
+blockif_parse_rate(char *cp, uint64_t *rate, uint64_t *burst)
+{
+	unsigned long val;
+
+	if (cp == NULL || dm_strtoul(cp, &cp, 10, &val))
+		return -1;
+	*rate = val;
+	*burst = 0;
+	if (*cp == '/') {
+		if (dm_strtoul(cp + 1, &cp, 10, &val))
+			return -1;
+		*burst = val;
+	}
+	return (*cp == '\0') ? 0 : -1;
+}
+
+/*
+ * Parse an iops= or bps= option into limits: the ops rate and burst, then
+ * the bytes rate and burst.
+ */
+static int
+blockif_parse_qos(char *cp, uint64_t limits[4])
+{
+	if (!strncmp(cp, "iops=", strlen("iops=")))
+		return blockif_parse_rate(cp + strlen("iops="), &limits[0],
+				&limits[1]);
+	if (!strncmp(cp, "bps=", strlen("bps=")))
+		return blockif_parse_rate(cp + strlen("bps="), &limits[2],
+				&limits[3]);
+	return -1;
+}
+
+static void
+blockif_qos_set(struct blockif_qos *qos, uint64_t limits[4])
+{
+	uint64_t now = blockif_now();
+
+	pthread_mutex_lock(&qos->mtx);
+	blockif_bucket_set(&qos->ops, limits[0], limits[1], now);
+	blockif_bucket_set(&qos->bytes, limits[2], limits[3], now);
+	pthread_mutex_unlock(&qos->mtx);
+}
+
+/* log2 histogram bucket of v */
+static int
+blockif_stat_bucket(uint64_t v, int nbuckets)
+{
+	int i;
+
+	i = (v != 0) ? flsl(v) - 1 : 0;
+	return MIN(i, nbuckets - 1);
+}
+
+/* Count a new request in the queue depth. Called with the mutex held. */
+static void
+blockif_account_depth(struct blockif_ctxt *bc)
+{
+	bc->stats.inflight++;
+	bc->stats.qd_hist[blockif_stat_bucket(bc->stats.inflight,
+			BLOCKIF_QD_BUCKETS)]++;
+}
+
+/*
+ * Count the request leaving the queues, the completed ones in the
+ * counters of their op. Called with the mutex held.
+ */
+static void
+blockif_account(struct blockif_ctxt *bc, struct blockif_elem *be)
+{
+	struct blockif_op_stats *st;
+	uint64_t us;
+
+	bc->stats.inflight--;
+	if (be->status != BST_DONE)
+		return;		/* cancelled */
+
+	/* write zeroes is counted with discard */
+	st = &bc->stats.op[(be->op == BOP_WRITE_ZEROES) ? BOP_DISCARD : be->op];
+	us = be->lat / 1000;
+	st->ops++;
+	st->bytes += be->done;
+	if (be->err != 0)
+		st->errors++;
+	st->lat_us += us;
+	st->lat_hist[blockif_stat_bucket(us, BLOCKIF_LAT_BUCKETS)]++;
+}
+
+static int
+range_validate(struct blockif_ctxt *bc, enum blockop op, off_t start,
+		off_t size)
+{
+	off_t start_sector = start / DEV_BSIZE;
+	off_t size_sector = size / DEV_BSIZE;
+
+	if (!size || (start + size) > (bc->size + bc->sub_file_start_lba))
+		return -1;
+
+	if (op == BOP_WRITE_ZEROES)
+		return (size_sector > bc->max_zero_sectors) ? -1 : 0;
+	if ((size_sector > bc->max_discard_sectors) ||
+			(bc->discard_sector_alignment &&
+			start_sector % bc->discard_sector_alignment))
+		return -1;
+	return 0;
+}
+
+/*
+ * Parse the ranges of a discard or write zeroes into arg, as the offsets
+ * in the image and the lengths in bytes, merging the ranges which follow
+ * one another. unmap is set if all the ranges may be deallocated.
+ *
+ * Return the number of ranges, -1 if one is invalid.
+ */
+static int
+blockif_ranges(struct blockif_ctxt *bc, struct blockif_req *br,
+		enum blockop op, off_t arg[][2], int *unmap)
+{
+	struct discard_range *range;
+	int n_range, max_seg, i, n;
+	off_t off, len;
+
+	*unmap = 1;
+	if (br->iovcnt != 1) {
+		/* ahci parse discard range to br->offset and br->reside */
+		arg[0][0] = br->offset + bc->sub_file_start_lba;
+		arg[0][1] = br->resid;
+		return 1;
+	}
+
+	/* virtio-blk use iov to transfer discard range */
+	n_range = br->iov[0].iov_len / sizeof(*range);
+	range = br->iov[0].iov_base;
+	max_seg = (op == BOP_DISCARD) ? bc->max_discard_seg : bc->max_zero_seg;
+	if (n_range > max_seg) {
+		WPRINTF(("segment > max_discard_seg\n"));
+		return -1;
+	}
+
+	for (i = 0, n = 0; i < n_range; i++) {
+		off = range[i].sector * DEV_BSIZE + bc->sub_file_start_lba;
+		len = (off_t)range[i].num_sectors * DEV_BSIZE;
+		if (range_validate(bc, op, off, len)) {
+			WPRINTF(("range [%ld: %ld] is invalid\n", off, len));
+			return -1;
+		}
+		if (op == BOP_WRITE_ZEROES &&
+				!(range[i].flags & DISCARD_RANGE_F_UNMAP))
+			*unmap = 0;
+
+		if (n > 0 && arg[n - 1][0] + arg[n - 1][1] == off) {
+			arg[n - 1][1] += len;
+		} else {
+			arg[n][0] = off;
+			arg[n][1] = len;
+			n++;
+		}
+	}
+	return n;
+}
+
+/*
+ * How a range of a discard or write zeroes is done: with fallocate() in
+ * the returned mode, with the BLKDISCARD or BLKZEROOUT ioctl of the block
+ * device for 0, or by writing the zeroes for -1.
+ *
+ * FALLOC_FL_PUNCH_HOLE:
+ *	Deallocates space in the byte range starting at offset and
+ *	continuing for length bytes.  After a successful call,
+ *	subsequent reads from this range will return zeroes.
+ * FALLOC_FL_ZERO_RANGE:
+ *	Zeroes the range, keeping it allocated.
+ * FALLOC_FL_KEEP_SIZE:
+ *	Do not modify the apparent length of the file.
+ */
+static int
+blockif_range_mode(struct blockif_ctxt *bc, enum blockop op, int unmap)
+{
+	if (op == BOP_WRITE_ZEROES &&
+			(bc->cow != NULL || (!unmap && bc->nozerorange)))
+		return -1;
+	if (bc->isblk)
+		return (op == BOP_WRITE_ZEROES && !unmap) ?
+			(FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE) : 0;
+	if (unmap)
+		return FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
+	return FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE;
+}
+
 static int
 blockif_enqueue(struct blockif_ctxt *bc, struct blockif_req *breq,
 		enum blockop op)
 {
+	off_t arg[MAX_DISCARD_SEGMENT][2];
 	struct blockif_elem *be, *tbe;
 	off_t off;
 	int i;
@@ -172,10 +738,24 @@ blockif_enqueue(struct blockif_ctxt *bc, struct blockif_req *breq,
 	TAILQ_REMOVE(&bc->freeq, be, link);
 	be->req = breq;
 	be->op = op;
+	be->mhead = be;
+	be->mnext = NULL;
+	be->mtail = be;
+	be->miovcnt = 0;
+	be->start = blockif_now();
+	blockif_account_depth(bc);
+	if (op == BOP_DISCARD || op == BOP_WRITE_ZEROES) {
+		be->nranges = blockif_ranges(bc, breq, op, arg, &be->runmap);
+		if (be->nranges > 0) {
+			be->roff = arg[0][0];
+			be->rlen = arg[0][1];
+		}
+	}
 	switch (op) {
 	case BOP_READ:
 	case BOP_WRITE:
 	case BOP_DISCARD:
+	case BOP_WRITE_ZEROES:
 		off = breq->offset;
 		for (i = 0; i < breq->iovcnt; i++)
 			off += breq->iov[i].iov_len;
@@ -189,6 +769,12 @@ blockif_enqueue(struct blockif_ctxt *bc, struct blockif_req *breq,
 		if (tbe->block == breq->offset)
 			break;
 	}
+	if (tbe != NULL && blockif_merge(tbe, be)) {
+		bc->stats.op[op].merged++;
+		be->status = BST_MERGED;
+		TAILQ_INSERT_TAIL(&bc->pendq, be, link);
+		return 0;
+	}
 	if (tbe == NULL) {
 		TAILQ_FOREACH(tbe, &bc->busyq, link) {
 			if (tbe->block == breq->offset)
@@ -203,145 +789,852 @@ blockif_enqueue(struct blockif_ctxt *bc, struct blockif_req *breq,
 	return (be->status == BST_PEND);
 }
 
+/* move be and the requests merged into it to the busy queue */
+static void
+blockif_mark_busy(struct blockif_ctxt *bc, struct blockif_elem *be, pthread_t t)
+{
+	for (; be != NULL; be = be->mnext) {
+		TAILQ_REMOVE(&bc->pendq, be, link);
+		be->status = BST_BUSY;
+		be->tid = t;
+		TAILQ_INSERT_TAIL(&bc->busyq, be, link);
+	}
+}
+
 static int
 blockif_dequeue(struct blockif_ctxt *bc, pthread_t t, struct blockif_elem **bep)
 {
 	struct blockif_elem *be;
 
 	TAILQ_FOREACH(be, &bc->pendq, link) {
-		if (be->status == BST_PEND)
+		if (be->status == BST_PEND && (bc->engine == NULL ||
+				!bc->engine->can_submit(bc, be)))
 			break;
 	}
-	if (be == NULL)
+	if (be == NULL || blockif_throttled(bc, be))
 		return 0;
-	TAILQ_REMOVE(&bc->pendq, be, link);
-	be->status = BST_BUSY;
-	be->tid = t;
-	TAILQ_INSERT_TAIL(&bc->busyq, be, link);
+	blockif_mark_busy(bc, be, t);
 	*bep = be;
 	return 1;
 }
 
 static void
-blockif_complete(struct blockif_ctxt *bc, struct blockif_elem *be)
+blockif_complete(struct blockif_ctxt *bc, struct blockif_elem *be)
+{
+	struct blockif_elem *tbe, *next;
+
+	for (; be != NULL; be = next) {
+		next = be->mnext;
+		if (be->status == BST_DONE || be->status == BST_BUSY)
+			TAILQ_REMOVE(&bc->busyq, be, link);
+		else
+			TAILQ_REMOVE(&bc->pendq, be, link);
+		TAILQ_FOREACH(tbe, &bc->pendq, link) {
+			if (tbe->req->offset == be->block &&
+					tbe->status == BST_BLOCK)
+				tbe->status = BST_PEND;
+		}
+		blockif_account(bc, be);
+		be->tid = 0;
+		be->status = BST_FREE;
+		be->req = NULL;
+		be->mnext = NULL;
+		TAILQ_INSERT_TAIL(&bc->freeq, be, link);
+	}
+}
+
+/*
+ * Run the callbacks of be and of the requests merged into it, len bytes
+ * were transferred for the whole chain.
+ */
+static void
+blockif_callback(struct blockif_elem *be, ssize_t len, int err)
+{
+	struct blockif_elem *next;
+	struct blockif_req *br;
+	uint64_t now;
+	ssize_t n;
+
+	now = blockif_now();
+	for (; be != NULL; be = next) {
+		next = be->mnext;
+		br = be->req;
+		n = 0;
+		if (len > 0 && (be->op == BOP_READ || be->op == BOP_WRITE)) {
+			n = MIN(len, be->block - br->offset);
+			br->resid -= n;
+			len -= n;
+		} else if (err == 0 && (be->op == BOP_DISCARD ||
+				be->op == BOP_WRITE_ZEROES)) {
+			br->resid = 0;
+		}
+		/* br may be reused by the callback, keep the stats in be */
+		be->lat = now - be->start;
+		be->done = n;
+		be->err = err;
+		be->status = BST_DONE;
+		(*br->callback)(br, err);
+	}
+}
+
+static void
+blockif_batch_end(struct blockif_ctxt *bc)
+{
+	if (bc->batch_cb != NULL)
+		(*bc->batch_cb)(bc->batch_arg);
+}
+
+static void blockif_dispatch(struct blockif_ctxt *bc);
+
+static void
+blockif_qos_timer(void *arg, uint64_t nexp)
+{
+	struct blockif_ctxt *bc = arg;
+
+	pthread_mutex_lock(&bc->mtx);
+	bc->qos_armed = 0;
+	blockif_dispatch(bc);
+	pthread_mutex_unlock(&bc->mtx);
+}
+
+/* Dispatch again once the throttled request may go */
+static void
+blockif_qos_arm(struct blockif_ctxt *bc)
+{
+	struct itimerspec ts;
+
+	if (bc->qos_armed)
+		return;
+
+	memset(&ts, 0, sizeof(ts));
+	ts.it_value.tv_sec = bc->qos_wait / NS_PER_SEC;
+	ts.it_value.tv_nsec = bc->qos_wait % NS_PER_SEC;
+	if (acrn_timer_settime(&bc->qos_timer, &ts) == 0)
+		bc->qos_armed = 1;
+}
+
+/*
+ * Hand the pending requests the async engine can submit to it and wake
+ * the block i/o thread up for the others. Called with the mutex held.
+ */
+static void
+blockif_dispatch(struct blockif_ctxt *bc)
+{
+	struct blockif_elem *be;
+	int wake, submitted;
+
+	wake = 0;
+	do {
+		/* restart the walk, the merged requests left the pendq too */
+		submitted = 0;
+		TAILQ_FOREACH(be, &bc->pendq, link) {
+			if (be->status != BST_PEND)
+				continue;
+			if (!bc->engine->can_submit(bc, be)) {
+				wake = 1;
+				continue;
+			}
+			if (blockif_throttled(bc, be)) {
+				blockif_qos_arm(bc);
+				break;
+			}
+			blockif_mark_busy(bc, be, 0);
+			bc->engine->submit(bc, be);
+			submitted = 1;
+			break;
+		}
+	} while (submitted);
+
+	if (bc->plugged == 0)
+		bc->engine->kick(bc);
+	if (wake)
+		pthread_cond_signal(&bc->cond);
+}
+
+/*
+ * Complete a request submitted by the async engine, res is the number of
+ * bytes transferred or a negative errno.
+ */
+static void
+blockif_aio_done(struct blockif_ctxt *bc, struct blockif_elem *be, ssize_t res)
+{
+	if (res < 0)
+		blockif_callback(be, 0, -res);
+	else
+		blockif_callback(be, res, 0);
+
+	pthread_mutex_lock(&bc->mtx);
+	blockif_complete(bc, be);
+	blockif_dispatch(bc);
+	pthread_mutex_unlock(&bc->mtx);
+}
+
+/*
+ * io_uring engine: read, write and flush are submitted to an io_uring
+ * from the caller of blockif_read()/blockif_write()/blockif_flush(), the
+ * completions are reaped in the mevent thread on the eventfd registered
+ * to the ring. Writes in writethru mode carry RWF_DSYNC, like the ones of
+ * the block i/o threads.
+ *
+ * A discard or write zeroes of one range, once merged, done by fallocate()
+ * is submitted as IORING_OP_FALLOCATE, linked to the fdatasync() of
+ * writethru mode on a file. The BLKDISCARD and BLKZEROOUT ioctls and the
+ * requests of several ranges are left to the block i/o thread.
+ */
+#define BLOCKIF_URING_LINKED	1UL	/* user_data of the first sqe of a pair */
+
+static int
+blockif_uring_can_submit(struct blockif_ctxt *bc, struct blockif_elem *be)
+{
+	switch (be->op) {
+	case BOP_READ:
+	case BOP_FLUSH:
+		return 1;
+	case BOP_WRITE:
+		return !bc->rdonly;
+	case BOP_DISCARD:
+	case BOP_WRITE_ZEROES:
+		return (bc->uring.fallocate && be->nranges == 1 && !bc->rdonly &&
+			((be->op == BOP_DISCARD) ? bc->candiscard : bc->canzero) &&
+			blockif_range_mode(bc, be->op, be->runmap) > 0);
+	default:
+		return 0;
+	}
+}
+
+static void
+blockif_uring_submit(struct blockif_ctxt *bc, struct blockif_elem *be)
+{
+	struct blockif_uring *ur = &bc->uring;
+	struct blockif_req *br = be->req;
+	struct io_uring_sqe *sqe;
+	struct iovec *iov;
+	unsigned int tail;
+	int iovcnt;
+
+	/*
+	 * at most BLOCKIF_MAXREQ requests in flight, of two sqes at most,
+	 * the ring can't be full
+	 */
+	tail = *ur->sq_tail;
+	sqe = &ur->sqes[tail & *ur->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->fd = bc->fd;
+	sqe->user_data = (uintptr_t)be;
+	switch (be->op) {
+	case BOP_READ:
+		blockif_elem_iov(be, &iov, &iovcnt);
+		sqe->opcode = IORING_OP_READV;
+		sqe->addr = (uintptr_t)iov;
+		sqe->len = iovcnt;
+		sqe->off = br->offset + bc->sub_file_start_lba;
+		break;
+	case BOP_WRITE:
+		blockif_elem_iov(be, &iov, &iovcnt);
+		sqe->opcode = IORING_OP_WRITEV;
+		sqe->addr = (uintptr_t)iov;
+		sqe->len = iovcnt;
+		sqe->off = br->offset + bc->sub_file_start_lba;
+		sqe->rw_flags = bc->wce ? 0 : RWF_DSYNC;
+		break;
+	case BOP_DISCARD:
+	case BOP_WRITE_ZEROES:
+		sqe->opcode = IORING_OP_FALLOCATE;
+		sqe->off = be->roff;
+		sqe->addr = be->rlen;
+		sqe->len = blockif_range_mode(bc, be->op, be->runmap);
+		be->err = 0;
+		if (bc->isblk || bc->wce)
+			break;
+
+		sqe->flags = IOSQE_IO_LINK;
+		sqe->user_data |= BLOCKIF_URING_LINKED;
+		tail++;
+		ur->to_submit++;
+		sqe = &ur->sqes[tail & *ur->sq_mask];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->fd = bc->fd;
+		sqe->user_data = (uintptr_t)be;
+		sqe->opcode = IORING_OP_FSYNC;
+		sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+		break;
+	default:
+		sqe->opcode = IORING_OP_FSYNC;
+		break;
+	}
+
+	__atomic_store_n(ur->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ur->to_submit++;
+}
+
+/*
+ * Give be back to the block i/o thread, from the mevent thread, once the
+ * engine found it can't do it.
+ */
+static void
+blockif_uring_requeue(struct blockif_ctxt *bc, struct blockif_elem *be)
+{
+	pthread_mutex_lock(&bc->mtx);
+	TAILQ_REMOVE(&bc->busyq, be, link);
+	be->status = BST_PEND;
+	TAILQ_INSERT_HEAD(&bc->pendq, be, link);
+	blockif_dispatch(bc);
+	pthread_mutex_unlock(&bc->mtx);
+}
+
+static void
+blockif_uring_kick(struct blockif_ctxt *bc)
+{
+	struct blockif_uring *ur = &bc->uring;
+	int ret;
+
+	if (ur->to_submit == 0)
+		return;
+
+	ret = syscall(__NR_io_uring_enter, ur->fd, ur->to_submit, 0, 0,
+			NULL, 0);
+	if (ret < 0) {
+		/* the sqes are left on the ring, retried on the next kick */
+		if (errno != EINTR && errno != EAGAIN)
+			WPRINTF(("%s: io_uring_enter failed %d\n", __func__, errno));
+	} else
+		ur->to_submit -= ret;
+}
+
+static void
+blockif_uring_reap(int fd, enum ev_type t, void *arg)
+{
+	struct blockif_ctxt *bc = arg;
+	struct blockif_uring *ur = &bc->uring;
+	struct io_uring_cqe *cqe;
+	struct blockif_elem *be;
+	unsigned int head;
+	eventfd_t val;
+	ssize_t res;
+	int linked;
+
+	eventfd_read(fd, &val);
+
+	head = *ur->cq_head;
+	while (head != __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE)) {
+		cqe = &ur->cqes[head & *ur->cq_mask];
+		be = (struct blockif_elem *)(uintptr_t)
+			(cqe->user_data & ~BLOCKIF_URING_LINKED);
+		linked = !!(cqe->user_data & BLOCKIF_URING_LINKED);
+		res = cqe->res;
+		head++;
+		__atomic_store_n(ur->cq_head, head, __ATOMIC_RELEASE);
+
+		if (linked) {
+			/* the fallocate() of a pair, its fsync() completes be */
+			be->err = (res < 0) ? res : 0;
+			continue;
+		}
+		if (be->op == BOP_DISCARD || be->op == BOP_WRITE_ZEROES) {
+			if (be->err < 0)
+				res = be->err;
+			if (res == -EOPNOTSUPP && be->op == BOP_WRITE_ZEROES &&
+					!be->runmap) {
+				/* no FALLOC_FL_ZERO_RANGE, the thread writes the zeroes */
+				bc->nozerorange = 1;
+				blockif_uring_requeue(bc, be);
+				continue;
+			}
+		}
+		blockif_aio_done(bc, be, res);
+	}
+	blockif_batch_end(bc);
+}
+
+static void
+blockif_uring_deinit(struct blockif_ctxt *bc)
+{
+	struct blockif_uring *ur = &bc->uring;
+
+	if (ur->mevp != NULL)
+		mevent_delete(ur->mevp);
+	if (ur->efd >= 0)
+		close(ur->efd);
+	if (ur->sqes != NULL)
+		munmap(ur->sqes, ur->sqes_sz);
+	if (ur->cq_ring != NULL)
+		munmap(ur->cq_ring, ur->cq_ring_sz);
+	if (ur->sq_ring != NULL)
+		munmap(ur->sq_ring, ur->sq_ring_sz);
+	close(ur->fd);
+}
+
+static int
+blockif_uring_init(struct blockif_ctxt *bc)
+{
+	struct blockif_uring *ur = &bc->uring;
+	struct io_uring_params p;
+	struct io_uring_probe *probe;
+	unsigned int *sq_array;
+	unsigned int i;
+	void *ptr;
+
+	memset(ur, 0, sizeof(*ur));
+	ur->efd = -1;
+	memset(&p, 0, sizeof(p));
+	ur->fd = syscall(__NR_io_uring_setup, 2 * BLOCKIF_MAXREQ, &p);
+	if (ur->fd < 0) {
+		WPRINTF(("%s: io_uring_setup failed %d\n", __func__, errno));
+		return -1;
+	}
+
+	ur->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ptr = mmap(NULL, ur->sq_ring_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQ_RING);
+	if (ptr == MAP_FAILED)
+		goto err;
+	ur->sq_ring = ptr;
+	ur->sq_tail = ptr + p.sq_off.tail;
+	ur->sq_mask = ptr + p.sq_off.ring_mask;
+	sq_array = ptr + p.sq_off.array;
+
+	ur->cq_ring_sz = p.cq_off.cqes +
+			p.cq_entries * sizeof(struct io_uring_cqe);
+	ptr = mmap(NULL, ur->cq_ring_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_CQ_RING);
+	if (ptr == MAP_FAILED)
+		goto err;
+	ur->cq_ring = ptr;
+	ur->cq_head = ptr + p.cq_off.head;
+	ur->cq_tail = ptr + p.cq_off.tail;
+	ur->cq_mask = ptr + p.cq_off.ring_mask;
+	ur->cqes = ptr + p.cq_off.cqes;
+
+	ur->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	ptr = mmap(NULL, ur->sqes_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQES);
+	if (ptr == MAP_FAILED)
+		goto err;
+	ur->sqes = ptr;
+
+	/* sqe i always sits in slot i of the submission ring */
+	for (i = 0; i < p.sq_entries; i++)
+		sq_array[i] = i;
+
+	ur->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ur->efd < 0)
+		goto err;
+	if (syscall(__NR_io_uring_register, ur->fd, IORING_REGISTER_EVENTFD,
+			&ur->efd, 1) < 0)
+		goto err;
+
+	/* the discards and write zeroes need IORING_OP_FALLOCATE, Linux 5.6 */
+	probe = calloc(1, sizeof(*probe) +
+			IORING_OP_LAST * sizeof(struct io_uring_probe_op));
+	if (probe != NULL) {
+		if (syscall(__NR_io_uring_register, ur->fd,
+				IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0 &&
+				probe->last_op >= IORING_OP_FALLOCATE &&
+				(probe->ops[IORING_OP_FALLOCATE].flags &
+				 IO_URING_OP_SUPPORTED))
+			ur->fallocate = 1;
+		free(probe);
+	}
+
+	ur->mevp = mevent_add(ur->efd, EVF_READ, blockif_uring_reap, bc,
+			NULL, NULL);
+	if (ur->mevp == NULL)
+		goto err;
+
+	return 0;
+
+err:
+	WPRINTF(("%s: failed to set up the io_uring %d\n", __func__, errno));
+	blockif_uring_deinit(bc);
+	return -1;
+}
+
+static struct blockif_engine blockif_uring_engine = {
+	.name		= "io_uring",
+	.init		= blockif_uring_init,
+	.deinit		= blockif_uring_deinit,
+	.can_submit	= blockif_uring_can_submit,
+	.submit		= blockif_uring_submit,
+	.kick		= blockif_uring_kick,
+};
+
+/*
+ * Linux AIO engine: reads and writes are submitted with io_submit() on a
+ * second O_DIRECT descriptor of the backing file, bypassing the SOS page
+ * cache. O_DIRECT needs the file offset, the length and the buffers to be
+ * aligned to the physical sector size: the requests with an unaligned
+ * offset or length are left to the block i/o thread, the ones with only
+ * unaligned buffers go through a bounce buffer. Flush and discard are also
+ * left to the thread, IOCB_CMD_FSYNC is not supported by most filesystems.
+ */
+static int
+blockif_laio_can_submit(struct blockif_ctxt *bc, struct blockif_elem *be)
+{
+	off_t mask = bc->psectsz - 1;
+	off_t off = be->req->offset + bc->sub_file_start_lba;
+
+	if (be->op != BOP_READ && (be->op != BOP_WRITE || bc->rdonly))
+		return 0;
+
+	return ((off & mask) == 0 && (blockif_elem_len(be) & mask) == 0);
+}
+
+static int
+blockif_iov_aligned(struct iovec *iov, int iovcnt, int align)
+{
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		if (((uintptr_t)iov[i].iov_base & (align - 1)) != 0 ||
+				(iov[i].iov_len & (align - 1)) != 0)
+			return 0;
+	}
+	return 1;
+}
+
+static void
+blockif_laio_fail(struct blockif_ctxt *bc, struct blockif_elem *be, int err)
+{
+	struct blockif_laio *la = &bc->laio;
+
+	/* completed from the mevent thread, the mutex is held here */
+	la->failed[la->nfailed] = be;
+	la->failed_err[la->nfailed] = err;
+	la->nfailed++;
+	eventfd_write(la->efd, 1);
+}
+
+static void
+blockif_laio_submit(struct blockif_ctxt *bc, struct blockif_elem *be)
+{
+	struct blockif_laio *la = &bc->laio;
+	struct blockif_req *br = be->req;
+	int i = be - bc->reqs;
+	struct iocb *cb = &la->iocbs[i];
+	struct iovec *iov;
+	size_t len, done;
+	int iovcnt, j;
+	void *buf;
+
+	memset(cb, 0, sizeof(*cb));
+	cb->aio_data = (uintptr_t)be;
+	cb->aio_fildes = la->dfd;
+	cb->aio_offset = br->offset + bc->sub_file_start_lba;
+	cb->aio_flags = IOCB_FLAG_RESFD;
+	cb->aio_resfd = la->efd;
+	if (be->op == BOP_WRITE && !bc->wce)
+		cb->aio_rw_flags = RWF_DSYNC;
+
+	blockif_elem_iov(be, &iov, &iovcnt);
+	if (blockif_iov_aligned(iov, iovcnt, bc->psectsz)) {
+		cb->aio_lio_opcode = (be->op == BOP_READ) ?
+				IOCB_CMD_PREADV : IOCB_CMD_PWRITEV;
+		cb->aio_buf = (uintptr_t)iov;
+		cb->aio_nbytes = iovcnt;
+	} else {
+		len = blockif_elem_len(be);
+		if (posix_memalign(&buf, bc->psectsz, len) != 0) {
+			blockif_laio_fail(bc, be, ENOMEM);
+			return;
+		}
+		if (be->op == BOP_WRITE) {
+			for (j = 0, done = 0; j < iovcnt; j++) {
+				memcpy(buf + done, iov[j].iov_base,
+					iov[j].iov_len);
+				done += iov[j].iov_len;
+			}
+		}
+		la->bounce[i] = buf;
+		cb->aio_lio_opcode = (be->op == BOP_READ) ?
+				IOCB_CMD_PREAD : IOCB_CMD_PWRITE;
+		cb->aio_buf = (uintptr_t)buf;
+		cb->aio_nbytes = len;
+	}
+
+	la->queued[la->nqueued++] = cb;
+}
+
+static void
+blockif_laio_kick(struct blockif_ctxt *bc)
+{
+	struct blockif_laio *la = &bc->laio;
+	struct blockif_elem *be;
+	int ret, done;
+
+	done = 0;
+	while (done < la->nqueued) {
+		ret = syscall(__NR_io_submit, la->ctx, la->nqueued - done,
+				&la->queued[done]);
+		if (ret > 0) {
+			done += ret;
+			continue;
+		}
+		/* the iocbs are left queued, retried on the next kick */
+		if (ret < 0 && errno == EAGAIN)
+			break;
+
+		/* the first iocb was rejected */
+		be = (struct blockif_elem *)(uintptr_t)la->queued[done]->aio_data;
+		blockif_laio_fail(bc, be, (ret < 0) ? errno : EIO);
+		done++;
+	}
+
+	la->nqueued -= done;
+	memmove(la->queued, &la->queued[done],
+		la->nqueued * sizeof(la->queued[0]));
+}
+
+static void
+blockif_laio_finish(struct blockif_ctxt *bc, struct blockif_elem *be,
+		ssize_t res)
+{
+	struct blockif_laio *la = &bc->laio;
+	int i = be - bc->reqs;
+	struct iovec *iov;
+	size_t done, n;
+	int iovcnt, j;
+
+	if (la->bounce[i] != NULL) {
+		if (be->op == BOP_READ && res > 0) {
+			blockif_elem_iov(be, &iov, &iovcnt);
+			for (j = 0, done = 0; j < iovcnt && done < res; j++) {
+				n = MIN(iov[j].iov_len, res - done);
+				memcpy(iov[j].iov_base, la->bounce[i] + done, n);
+				done += n;
+			}
+		}
+		free(la->bounce[i]);
+		la->bounce[i] = NULL;
+	}
+
+	blockif_aio_done(bc, be, res);
+}
+
+static void
+blockif_laio_reap(int fd, enum ev_type t, void *arg)
+{
+	struct blockif_ctxt *bc = arg;
+	struct blockif_laio *la = &bc->laio;
+	struct blockif_elem *failed[BLOCKIF_MAXREQ];
+	int failed_err[BLOCKIF_MAXREQ];
+	struct io_event events[BLOCKIF_MAXREQ];
+	struct timespec ts = { 0, 0 };
+	eventfd_t val;
+	int i, n;
+
+	eventfd_read(fd, &val);
+
+	pthread_mutex_lock(&bc->mtx);
+	n = la->nfailed;
+	memcpy(failed, la->failed, n * sizeof(failed[0]));
+	memcpy(failed_err, la->failed_err, n * sizeof(failed_err[0]));
+	la->nfailed = 0;
+	pthread_mutex_unlock(&bc->mtx);
+
+	for (i = 0; i < n; i++)
+		blockif_laio_finish(bc, failed[i], -failed_err[i]);
+
+	do {
+		n = syscall(__NR_io_getevents, la->ctx, 0, BLOCKIF_MAXREQ,
+				events, &ts);
+		for (i = 0; i < n; i++)
+			blockif_laio_finish(bc,
+				(struct blockif_elem *)(uintptr_t)events[i].data,
+				events[i].res);
+	} while (n == BLOCKIF_MAXREQ);
+	blockif_batch_end(bc);
+}
+
+static void
+blockif_laio_deinit(struct blockif_ctxt *bc)
 {
-	struct blockif_elem *tbe;
+	struct blockif_laio *la = &bc->laio;
+
+	if (la->mevp != NULL)
+		mevent_delete(la->mevp);
+	if (la->efd >= 0)
+		close(la->efd);
+	if (la->ctx != 0)
+		syscall(__NR_io_destroy, la->ctx);
+	close(la->dfd);
+}
 
-	if (be->status == BST_DONE || be->status == BST_BUSY)
-		TAILQ_REMOVE(&bc->busyq, be, link);
-	else
-		TAILQ_REMOVE(&bc->pendq, be, link);
-	TAILQ_FOREACH(tbe, &bc->pendq, link) {
-		if (tbe->req->offset == be->block)
-			tbe->status = BST_PEND;
+static int
+blockif_laio_init(struct blockif_ctxt *bc)
+{
+	struct blockif_laio *la = &bc->laio;
+	char path[32];
+
+	memset(la, 0, sizeof(*la));
+	la->efd = -1;
+	if (bc->psectsz == 0 || !powerof2(bc->psectsz)) {
+		WPRINTF(("%s: invalid physical sector size %d\n", __func__,
+			bc->psectsz));
+		return -1;
 	}
-	be->tid = 0;
-	be->status = BST_FREE;
-	be->req = NULL;
-	TAILQ_INSERT_TAIL(&bc->freeq, be, link);
+
+	/* a second open file description, so only this one is O_DIRECT */
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", bc->fd);
+	la->dfd = open(path, (bc->rdonly ? O_RDONLY : O_RDWR) | O_DIRECT);
+	if (la->dfd < 0) {
+		WPRINTF(("%s: O_DIRECT open failed %d\n", __func__, errno));
+		return -1;
+	}
+
+	if (syscall(__NR_io_setup, BLOCKIF_MAXREQ, &la->ctx) < 0)
+		goto err;
+
+	la->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (la->efd < 0)
+		goto err;
+
+	la->mevp = mevent_add(la->efd, EVF_READ, blockif_laio_reap, bc,
+			NULL, NULL);
+	if (la->mevp == NULL)
+		goto err;
+
+	return 0;
+
+err:
+	WPRINTF(("%s: failed to set up the aio context %d\n", __func__, errno));
+	blockif_laio_deinit(bc);
+	return -1;
 }
 
+static struct blockif_engine blockif_laio_engine = {
+	.name		= "native",
+	.init		= blockif_laio_init,
+	.deinit		= blockif_laio_deinit,
+	.can_submit	= blockif_laio_can_submit,
+	.submit		= blockif_laio_submit,
+	.kick		= blockif_laio_kick,
+};
+
+/* Write len bytes of zeroes at off of the image, from the zero mapping */
 static int
-discard_range_validate(struct blockif_ctxt *bc, off_t start, off_t size)
+blockif_write_zero_buf(struct blockif_ctxt *bc, off_t off, off_t len)
 {
-	off_t start_sector = start / DEV_BSIZE;
-	off_t size_sector = size / DEV_BSIZE;
+	struct iovec iov;
+	ssize_t n;
 
-	if (!size || (start + size) > (bc->size + bc->sub_file_start_lba))
-		return -1;
+	if (blockif_zero_buf == NULL)
+		return ENOMEM;
 
-	if ((size_sector > bc->max_discard_sectors) ||
-			(bc->discard_sector_alignment &&
-			start_sector % bc->discard_sector_alignment))
-		return -1;
+	while (len > 0) {
+		iov.iov_base = blockif_zero_buf;
+		iov.iov_len = MIN(len, BLOCKIF_ZERO_BUF_SZ);
+		if (bc->cow != NULL)
+			n = blockif_cow_pwritev(bc->cow, &iov, 1, off);
+		else
+			n = pwritev(bc->fd, &iov, 1, off);
+		if (n <= 0)
+			return (n < 0) ? errno : EIO;
+		off += n;
+		len -= n;
+	}
 	return 0;
 }
 
 static int
-blockif_process_discard(struct blockif_ctxt *bc, struct blockif_req *br)
+blockif_process_ranges(struct blockif_ctxt *bc, struct blockif_elem *be)
 {
-	int err;
-	struct discard_range *range;
-	int n_range, i, segment;
 	off_t arg[MAX_DISCARD_SEGMENT][2];
+	int n, i, mode, unmap, err, sync;
 
-	err = 0;
-	n_range = 0;
-	segment = 0;
-	if (!bc->candiscard)
+	if ((be->op == BOP_DISCARD) ? !bc->candiscard : !bc->canzero)
 		return EOPNOTSUPP;
 
 	if (bc->rdonly)
 		return EROFS;
 
-	if (br->iovcnt == 1) {
-		/* virtio-blk use iov to transfer discard range */
-		n_range = br->iov[0].iov_len/sizeof(*range);
-		range = br->iov[0].iov_base;
-		for (i = 0; i < n_range; i++) {
-			arg[i][0] = range[i].sector * DEV_BSIZE +
-					bc->sub_file_start_lba;
-			arg[i][1] = range[i].num_sectors * DEV_BSIZE;
-			segment++;
-			if (segment > bc->max_discard_seg) {
-				WPRINTF(("segment > max_discard_seg\n"));
-				return EINVAL;
-			}
-			if (discard_range_validate(bc, arg[i][0], arg[i][1])) {
-				WPRINTF(("range [%ld: %ld] is invalid\n", arg[i][0], arg[i][1]));
-				return EINVAL;
+	n = blockif_ranges(bc, be->req, be->op, arg, &unmap);
+	if (n < 0)
+		return EINVAL;
+
+	err = 0;
+	sync = 0;
+	for (i = 0; i < n && err == 0; i++) {
+		mode = blockif_range_mode(bc, be->op, unmap);
+		if (mode > 0) {
+			if (fallocate(bc->fd, mode, arg[i][0], arg[i][1]) < 0)
+				err = errno;
+			if (err == EOPNOTSUPP && (mode & FALLOC_FL_ZERO_RANGE)) {
+				/* the zeroes are written from now on */
+				bc->nozerorange = 1;
+				mode = -1;
+				err = 0;
+			} else if (!bc->isblk) {
+				sync = 1;
 			}
+		} else if (mode == 0) {
+			if (ioctl(bc->fd, (be->op == BOP_DISCARD) ?
+					BLKDISCARD : BLKZEROOUT, arg[i]) < 0)
+				err = errno;
 		}
-	} else {
-		/* ahci parse discard range to br->offset and br->reside */
-		arg[0][0] = br->offset + bc->sub_file_start_lba;
-		arg[0][1] = br->resid;
-		segment = 1;
-	}
-	for (i = 0; i < segment; i++) {
-		if (bc->isblk) {
-			err = ioctl(bc->fd, BLKDISCARD, arg[i]);
-		} else {
-			/* FALLOC_FL_PUNCH_HOLE:
-			 *	Deallocates space in the byte range starting at offset and
-			 *	continuing for length bytes.  After a successful call,
-			 *	subsequent reads from this range will return zeroes.
-			 * FALLOC_FL_KEEP_SIZE:
-			 *	Do not modify the apparent length of the file.
-			 */
-			err = fallocate(bc->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
-				arg[i][0], arg[i][1]);
-			if (!err)
-				err = fdatasync(bc->fd);
+		if (mode < 0) {
+			err = blockif_write_zero_buf(bc, arg[i][0], arg[i][1]);
+			sync = 1;
 		}
+
+		if (bc->rcache != NULL)
+			blockif_cache_invalidate(bc->rcache,
+				arg[i][0] - bc->sub_file_start_lba, arg[i][1]);
 		if (err) {
-			WPRINTF(("Failed to discard offset=%ld nbytes=%ld err code: %d\n",
+			WPRINTF(("Failed to %s offset=%ld nbytes=%ld err code: %d\n",
+				 (be->op == BOP_DISCARD) ? "discard" : "zero",
 				 arg[i][0], arg[i][1], err));
-			return err;
 		}
 	}
-	br->resid = 0;
 
-	return 0;
+	/* one fsync() in writethru mode for all the ranges */
+	if (err == 0 && sync)
+		err = blockif_flush_cache(bc);
+	return err;
+}
+
+/* Fill the read cache from the image */
+static ssize_t
+blockif_cache_fill(void *arg, void *buf, size_t len, off_t off)
+{
+	struct blockif_ctxt *bc = arg;
+	struct iovec iov;
+
+	if (bc->cow != NULL) {
+		iov.iov_base = buf;
+		iov.iov_len = len;
+		return blockif_cow_preadv(bc->cow, &iov, 1, off);
+	}
+	return pread(bc->fd, buf, len, off + bc->sub_file_start_lba);
 }
 
 static void
 blockif_proc(struct blockif_ctxt *bc, struct blockif_elem *be)
 {
 	struct blockif_req *br;
+	struct iovec *iov;
 	ssize_t len;
-	int err;
+	int err, iovcnt;
+	enum blockop op;
 
 	br = be->req;
+	op = be->op;
 	err = 0;
-	switch (be->op) {
+	len = 0;
+	switch (op) {
 	case BOP_READ:
-		len = preadv(bc->fd, br->iov, br->iovcnt,
+		blockif_elem_iov(be, &iov, &iovcnt);
+		if (bc->rcache != NULL)
+			len = blockif_cache_preadv(bc->rcache,
+					blockif_cache_fill, bc,
+					iov, iovcnt, br->offset);
+		else if (bc->cow != NULL)
+			len = blockif_cow_preadv(bc->cow, iov, iovcnt,
+					br->offset);
+		else
+			len = preadv(bc->fd, iov, iovcnt,
 				 br->offset + bc->sub_file_start_lba);
 		if (len < 0)
 			err = errno;
-		else
-			br->resid -= len;
 		break;
 	case BOP_WRITE:
 		if (bc->rdonly) {
@@ -349,30 +1642,41 @@ blockif_proc(struct blockif_ctxt *bc, struct blockif_elem *be)
 			break;
 		}
 
-		len = pwritev(bc->fd, br->iov, br->iovcnt,
-				  br->offset + bc->sub_file_start_lba);
-		if (len < 0)
-			err = errno;
-		else {
-			br->resid -= len;
-			err = blockif_flush_cache(bc);
+		blockif_elem_iov(be, &iov, &iovcnt);
+		if (bc->cow != NULL) {
+			/* the overlay metadata needs the fsync() anyway */
+			len = blockif_cow_pwritev(bc->cow, iov, iovcnt,
+					br->offset);
+			if (len < 0)
+				err = errno;
+			else
+				err = blockif_flush_cache(bc);
+		} else {
+			len = blockif_pwritev(bc, iov, iovcnt,
+				  br->offset + bc->sub_file_start_lba, &err);
 		}
+		if (bc->rcache != NULL)
+			blockif_cache_invalidate(bc->rcache, br->offset,
+					blockif_elem_len(be));
 		break;
 	case BOP_FLUSH:
-		if (fsync(bc->fd))
-			err = errno;
+		err = blockif_fsync(bc);
 		break;
 	case BOP_DISCARD:
-		err = blockif_process_discard(bc, br);
+	case BOP_WRITE_ZEROES:
+		err = blockif_process_ranges(bc, be);
 		break;
 	default:
 		err = EINVAL;
 		break;
 	}
 
-	be->status = BST_DONE;
+	blockif_callback(be, len, err);
+	blockif_batch_end(bc);
 
-	(*br->callback)(br, err);
+	/* the guest has its data, now read ahead of a sequential stream */
+	if (op == BOP_READ && bc->rcache != NULL)
+		blockif_cache_readahead(bc->rcache, blockif_cache_fill, bc);
 }
 
 static void *
@@ -380,6 +1684,8 @@ blockif_thr(void *arg)
 {
 	struct blockif_ctxt *bc;
 	struct blockif_elem *be;
+	struct timespec ts;
+	uint64_t deadline;
 	pthread_t t;
 
 	bc = arg;
@@ -393,11 +1699,22 @@ blockif_thr(void *arg)
 			blockif_proc(bc, be);
 			pthread_mutex_lock(&bc->mtx);
 			blockif_complete(bc, be);
+			if (bc->engine != NULL)
+				blockif_dispatch(bc);
 		}
 		/* Check ctxt status here to see if exit requested */
 		if (bc->closing)
 			break;
-		pthread_cond_wait(&bc->cond, &bc->mtx);
+		if (bc->qos_wait != 0) {
+			/* throttled, wait for the tokens or a new request */
+			deadline = blockif_now() + bc->qos_wait;
+			bc->qos_wait = 0;
+			ts.tv_sec = deadline / NS_PER_SEC;
+			ts.tv_nsec = deadline % NS_PER_SEC;
+			pthread_cond_timedwait(&bc->cond, &bc->mtx, &ts);
+		} else {
+			pthread_cond_wait(&bc->cond, &bc->mtx);
+		}
 	}
 
 	pthread_mutex_unlock(&bc->mtx);
@@ -436,7 +1753,15 @@ blockif_sigcont_handler(int signal)
 static void
 blockif_init(void)
 {
+	void *p;
+
 	signal(SIGCONT, blockif_sigcont_handler);
+
+	/* never written, all of it reads from the zero page */
+	p = mmap(NULL, BLOCKIF_ZERO_BUF_SZ, PROT_READ,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p != MAP_FAILED)
+		blockif_zero_buf = p;
 }
 
 /*
@@ -486,17 +1811,119 @@ sub_file_unlock(struct blockif_ctxt *bc)
 }
 
 
+static void
+blockif_dm_stats(void *arg, void *rec)
+{
+	struct blockif_stats st;
+	struct dm_stats_blk *blk = rec;
+	int i;
+
+	memset(&st, 0, sizeof(st));
+	blockif_get_stats(arg, &st);
+	for (i = 0; i < BLOCKIF_STAT_OPS && i < DM_STATS_BLK_OPS; i++) {
+		blk->ops[i] = st.op[i].ops;
+		blk->bytes[i] = st.op[i].bytes;
+		blk->errors[i] = st.op[i].errors;
+		blk->lat_us[i] = st.op[i].lat_us;
+	}
+	blk->inflight = st.inflight;
+}
+
+/* set up the queues, the async engine and the block i/o threads of bc */
+static void
+blockif_start(struct blockif_ctxt *bc, struct blockif_engine *engine,
+		const char *ident)
+{
+	char tname[MAXCOMLEN + 1];
+	pthread_condattr_t attr;
+	int i;
+
+	pthread_mutex_init(&bc->mtx, NULL);
+	/* the throttled threads wait with a deadline on the monotonic clock */
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&bc->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_mutex_init(&bc->flush_mtx, NULL);
+	pthread_cond_init(&bc->flush_cond, NULL);
+	TAILQ_INIT(&bc->freeq);
+	TAILQ_INIT(&bc->pendq);
+	TAILQ_INIT(&bc->busyq);
+	for (i = 0; i < BLOCKIF_MAXREQ; i++) {
+		bc->reqs[i].status = BST_FREE;
+		TAILQ_INSERT_HEAD(&bc->freeq, &bc->reqs[i], link);
+	}
+
+	bc->nthr = BLOCKIF_NUMTHR;
+	if (engine != NULL) {
+		if (engine->init(bc) == 0) {
+			bc->engine = engine;
+			bc->nthr = 1;
+			bc->qos_timer.clockid = CLOCK_MONOTONIC;
+			acrn_timer_init(&bc->qos_timer, blockif_qos_timer, bc);
+		} else
+			WPRINTF(("blockif: %s engine unavailable, use threads\n",
+				engine->name));
+	}
+
+	for (i = 0; i < bc->nthr; i++) {
+		if (snprintf(tname, sizeof(tname), "blk-%s-%d",
+					ident, i) >= sizeof(tname)) {
+			perror("blk thread name too long");
+		}
+		pthread_create(&bc->btid[i], NULL, blockif_thr, bc);
+		pthread_setname_np(bc->btid[i], tname);
+	}
+
+	dm_stats_register(DM_STATS_TYPE_BLK, ident, bc, blockif_dm_stats, bc);
+}
+
+/*
+ * Read a limit of the request queue of the block device, from its sysfs
+ * queue directory, or the one of its disk for a partition.
+ *
+ * Return the limit, -1 if not found.
+ */
+static long long
+blockif_queue_limit(const struct stat *sbuf, const char *name)
+{
+	char path[PATH_MAX];
+	long long val;
+	FILE *fp;
+	int i, ret;
+
+	for (i = 0; i < 2; i++) {
+		snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/%squeue/%s",
+			major(sbuf->st_rdev), minor(sbuf->st_rdev),
+			(i == 0) ? "" : "../", name);
+		fp = fopen(path, "r");
+		if (fp == NULL)
+			continue;
+		ret = fscanf(fp, "%lld", &val);
+		fclose(fp);
+		if (ret == 1)
+			return val;
+	}
+	return -1;
+}
+
+/* A number of sectors of a limit in bytes, as the int of the config space */
+static int
+blockif_limit_sectors(long long bytes)
+{
+	return (int)MIN(bytes / DEV_BSIZE, (long long)INT_MAX);
+}
+
 struct blockif_ctxt *
 blockif_open(const char *optstr, const char *ident)
 {
-	char tname[MAXCOMLEN + 1];
 	/* char name[MAXPATHLEN]; */
 	char *nopt, *xopts, *cp;
 	struct blockif_ctxt *bc;
 	struct stat sbuf;
 	/* struct diocgattr_arg arg; */
 	off_t size, psectsz, psectoff;
-	int fd, i, sectsz;
+	int fd, sectsz;
 	int writeback, ro, candiscard, ssopt, pssopt;
 	long sz;
 	long long b;
@@ -504,7 +1931,14 @@ blockif_open(const char *optstr, const char *ident)
 	off_t sub_file_start_lba, sub_file_size;
 	int sub_file_assign;
 	int max_discard_sectors, max_discard_seg, discard_sector_alignment;
+	long long discard_max, discard_segs, discard_gran, zeroes_max;
 	off_t probe_arg[] = {0, 0};
+	struct blockif_engine *engine;
+	struct blockif_cow *cow;
+	char *backing;
+	int cache_mb;
+	uint64_t limits[4];
+	struct blockif_qos *qos;
 
 	pthread_once(&blockif_once, blockif_init);
 
@@ -520,11 +1954,30 @@ blockif_open(const char *optstr, const char *ident)
 	max_discard_seg = -1;
 	discard_sector_alignment = -1;
 
+	/* the queue limits of a block device, the defaults for the others */
+	discard_max = -1;
+	discard_segs = MAX_DISCARD_SEGMENT;
+	discard_gran = 0;
+	zeroes_max = -1;
+
 	/* writethru is on by default */
 	writeback = 0;
 
 	candiscard = 0;
 
+	/* synchronous i/o in the block i/o threads by default */
+	engine = NULL;
+
+	cow = NULL;
+	backing = NULL;
+
+	/* no read cache by default */
+	cache_mb = 0;
+
+	/* no throttling by default */
+	memset(limits, 0, sizeof(limits));
+	qos = NULL;
+
 	/*
 	 * The first element in the optstring is always a pathname.
 	 * Optional elements follow
@@ -578,6 +2031,33 @@ blockif_open(const char *optstr, const char *ident)
 				sub_file_assign = 1;
 			else
 				goto err;
+		} else if (!strncmp(cp, "aio", strlen("aio"))) {
+			/* aio=threads|io_uring|native */
+			strsep(&cp, "=");
+			if (cp != NULL && !strcmp(cp, "threads"))
+				engine = NULL;
+			else if (cp != NULL && !strcmp(cp, "io_uring"))
+				engine = &blockif_uring_engine;
+			else if (cp != NULL && !strcmp(cp, "native"))
+				engine = &blockif_laio_engine;
+			else
+				goto err;
+		} else if (!strncmp(cp, "backing", strlen("backing"))) {
+			/* backing=<read-only base image of the overlay> */
+			strsep(&cp, "=");
+			if (cp == NULL || *cp == '\0')
+				goto err;
+			backing = cp;
+		} else if (!strncmp(cp, "iops=", strlen("iops=")) ||
+				!strncmp(cp, "bps=", strlen("bps="))) {
+			/* iops=<ops/s>[/<burst>], bps=<bytes/s>[/<burst>] */
+			if (blockif_parse_qos(cp, limits))
+				goto err;
+		} else if (!strncmp(cp, "cache", strlen("cache"))) {
+			/* cache=<read cache size in MiB> */
+			if (strsep(&cp, "=") == NULL ||
+				dm_strtoi(cp, &cp, 10, &cache_mb) || cache_mb < 0)
+				goto err;
 		} else {
 			fprintf(stderr, "Invalid device option \"%s\"\n", cp);
 			goto err;
@@ -587,8 +2067,8 @@ blockif_open(const char *optstr, const char *ident)
 	/*
 	 * To support "writeback" and "writethru" mode switch during runtime,
 	 * O_SYNC is not used directly, as O_SYNC flag cannot dynamic change
-	 * after file is opened. Instead, we call fsync() after each write
-	 * operation to emulate it.
+	 * after file is opened. Instead, each write carries RWF_DSYNC, or is
+	 * followed by an fsync() on the kernels without it.
 	 */
 
 	fd = open(nopt, ro ? O_RDONLY : O_RDWR);
@@ -615,7 +2095,24 @@ blockif_open(const char *optstr, const char *ident)
 	sectsz = DEV_BSIZE;
 	psectsz = psectoff = 0;
 
-	if (S_ISBLK(sbuf.st_mode)) {
+	if (backing != NULL) {
+		/*
+		 * The file is a copy-on-write overlay of the backing image.
+		 * Only the block i/o threads know how to walk its tables.
+		 */
+		if (!S_ISREG(sbuf.st_mode) || sub_file_assign) {
+			fprintf(stderr, "backing needs a regular file without range\n");
+			goto err;
+		}
+		cow = blockif_cow_open(fd, backing, ro, &size);
+		if (cow == NULL)
+			goto err;
+		if (candiscard || engine != NULL)
+			WPRINTF(("%s: overlay, discard and aio are off\n", nopt));
+		candiscard = 0;
+		engine = NULL;
+		psectsz = sbuf.st_blksize;
+	} else if (S_ISBLK(sbuf.st_mode)) {
 		/* get size */
 		err_code = ioctl(fd, BLKGETSIZE, &sz);
 		if (err_code) {
@@ -650,12 +2147,22 @@ blockif_open(const char *optstr, const char *ident)
 
 		if (candiscard) {
 			err_code = ioctl(fd, BLKDISCARD, probe_arg);
-			if (err_code) {
+			discard_max = blockif_queue_limit(&sbuf,
+					"discard_max_bytes");
+			if (err_code || discard_max == 0) {
 				WPRINTF(("not support DISCARD\n"));
 				candiscard = 0;
 			}
+			discard_segs = blockif_queue_limit(&sbuf,
+					"max_discard_segments");
+			discard_gran = blockif_queue_limit(&sbuf,
+					"discard_granularity");
 		}
 
+		/* 0 if the kernel writes the zeroes of BLKZEROOUT itself */
+		zeroes_max = blockif_queue_limit(&sbuf,
+				"write_zeroes_max_bytes");
+
 	} else {
 		if (size < DEV_BSIZE || (size & (DEV_BSIZE - 1))) {
 			WPRINTF(("%s size not corret, should be multiple of %d\n",
@@ -694,11 +2201,20 @@ blockif_open(const char *optstr, const char *ident)
 		psectoff = 0;
 	}
 
+	qos = calloc(1, sizeof(struct blockif_qos));
+	if (qos == NULL) {
+		perror("calloc");
+		goto err;
+	}
+	pthread_mutex_init(&qos->mtx, NULL);
+	blockif_qos_set(qos, limits);
+
 	bc = calloc(1, sizeof(struct blockif_ctxt));
 	if (bc == NULL) {
 		perror("calloc");
 		goto err;
 	}
+	bc->qos = qos;
 
 	if (sub_file_assign) {
 		DPRINTF(("sector size is %d\n", sectsz));
@@ -720,16 +2236,36 @@ blockif_open(const char *optstr, const char *ident)
 	}
 
 	bc->fd = fd;
+	bc->cow = cow;
 	bc->isblk = S_ISBLK(sbuf.st_mode);
 	bc->candiscard = candiscard;
 	if (candiscard) {
+		if (discard_max <= 0)
+			discard_max = size;
+		if (discard_segs <= 0 || discard_segs > MAX_DISCARD_SEGMENT)
+			discard_segs = MAX_DISCARD_SEGMENT;
 		bc->max_discard_sectors =
 			(max_discard_sectors != -1) ?
-				max_discard_sectors : (size / DEV_BSIZE);
+				max_discard_sectors : blockif_limit_sectors(discard_max);
 		bc->max_discard_seg =
-			(max_discard_seg != -1) ? max_discard_seg : 1;
+			(max_discard_seg != -1) ?
+				MIN(max_discard_seg, MAX_DISCARD_SEGMENT) : discard_segs;
 		bc->discard_sector_alignment =
-			(discard_sector_alignment != -1) ? discard_sector_alignment : 0;
+			(discard_sector_alignment != -1) ? discard_sector_alignment :
+				blockif_limit_sectors(discard_gran);
+	}
+
+	/*
+	 * Write zeroes falls back to writing the zeroes, e.g. in the overlay,
+	 * so it is always there on a writable image.
+	 */
+	bc->canzero = !ro;
+	if (bc->canzero) {
+		if (zeroes_max <= 0 ||
+		    zeroes_max > (long long)BLOCKIF_ZERO_MAX_SECTORS * DEV_BSIZE)
+			zeroes_max = (long long)BLOCKIF_ZERO_MAX_SECTORS * DEV_BSIZE;
+		bc->max_zero_sectors = blockif_limit_sectors(zeroes_max);
+		bc->max_zero_seg = MAX_DISCARD_SEGMENT;
 	}
 	bc->rdonly = ro;
 	bc->size = size;
@@ -737,24 +2273,19 @@ blockif_open(const char *optstr, const char *ident)
 	bc->psectsz = psectsz;
 	bc->psectoff = psectoff;
 	bc->wce = writeback;
-	pthread_mutex_init(&bc->mtx, NULL);
-	pthread_cond_init(&bc->cond, NULL);
-	TAILQ_INIT(&bc->freeq);
-	TAILQ_INIT(&bc->pendq);
-	TAILQ_INIT(&bc->busyq);
-	for (i = 0; i < BLOCKIF_MAXREQ; i++) {
-		bc->reqs[i].status = BST_FREE;
-		TAILQ_INSERT_HEAD(&bc->freeq, &bc->reqs[i], link);
-	}
-
-	for (i = 0; i < BLOCKIF_NUMTHR; i++) {
-		if (snprintf(tname, sizeof(tname), "blk-%s-%d",
-					ident, i) >= sizeof(tname)) {
-			perror("blk thread name too long");
-		}
-		pthread_create(&bc->btid[i], NULL, blockif_thr, bc);
-		pthread_setname_np(bc->btid[i], tname);
+	if (cache_mb > 0) {
+		/*
+		 * The cache sits in the block i/o threads, the reads and
+		 * writes submitted by an aio engine would go around it.
+		 */
+		if (engine != NULL)
+			WPRINTF(("%s: cache is only used with aio=threads\n",
+				nopt));
+		else
+			bc->rcache = blockif_cache_get(fd, (cow != NULL) ? -1 :
+					bc->sub_file_start_lba, cache_mb);
 	}
+	blockif_start(bc, engine, ident);
 
 	/* free strdup memory */
 	if (nopt) {
@@ -768,11 +2299,62 @@ err:
 	if (nopt)
 		free(nopt);
 
+	if (qos != NULL) {
+		pthread_mutex_destroy(&qos->mtx);
+		free(qos);
+	}
+	if (cow != NULL)
+		blockif_cow_close(cow);
 	if (fd >= 0)
 		close(fd);
 	return NULL;
 }
 
+/*
+ * Open another submission context on the backing file of bc, with its own
+ * queues, async engine and block i/o threads, e.g. one per virtqueue. It
+ * shares the file descriptor and the settings of bc and must be closed
+ * before bc.
+ */
+struct blockif_ctxt *
+blockif_clone(struct blockif_ctxt *bc, const char *ident)
+{
+	struct blockif_ctxt *nbc;
+
+	nbc = calloc(1, sizeof(struct blockif_ctxt));
+	if (nbc == NULL) {
+		perror("calloc");
+		return NULL;
+	}
+
+	nbc->fd = bc->fd;
+	nbc->shared_fd = 1;
+	nbc->cow = bc->cow;
+	nbc->rcache = bc->rcache;
+	nbc->qos = bc->qos;
+	nbc->isblk = bc->isblk;
+	nbc->candiscard = bc->candiscard;
+	nbc->rdonly = bc->rdonly;
+	nbc->size = bc->size;
+	/* the sub file lock is held by bc */
+	nbc->sub_file_assign = 0;
+	nbc->sub_file_start_lba = bc->sub_file_start_lba;
+	nbc->sectsz = bc->sectsz;
+	nbc->psectsz = bc->psectsz;
+	nbc->psectoff = bc->psectoff;
+	nbc->max_discard_sectors = bc->max_discard_sectors;
+	nbc->max_discard_seg = bc->max_discard_seg;
+	nbc->discard_sector_alignment = bc->discard_sector_alignment;
+	nbc->canzero = bc->canzero;
+	nbc->max_zero_sectors = bc->max_zero_sectors;
+	nbc->max_zero_seg = bc->max_zero_seg;
+	nbc->nozerorange = bc->nozerorange;
+	nbc->wce = bc->wce;
+	blockif_start(nbc, bc->engine, ident);
+
+	return nbc;
+}
+
 static int
 blockif_request(struct blockif_ctxt *bc, struct blockif_req *breq,
 		enum blockop op)
@@ -787,8 +2369,16 @@ blockif_request(struct blockif_ctxt *bc, struct blockif_req *breq,
 		 * Enqueue and inform the block i/o thread
 		 * that there is work available
 		 */
-		if (blockif_enqueue(bc, breq, op))
-			pthread_cond_signal(&bc->cond);
+		if (blockif_enqueue(bc, breq, op)) {
+			/*
+			 * While plugged, the dispatch is left to
+			 * blockif_unplug() so that the batch can merge.
+			 */
+			if (bc->engine == NULL)
+				pthread_cond_signal(&bc->cond);
+			else if (bc->plugged == 0)
+				blockif_dispatch(bc);
+		}
 	} else {
 		/*
 		 * Callers are not allowed to enqueue more than
@@ -803,6 +2393,29 @@ blockif_request(struct blockif_ctxt *bc, struct blockif_req *breq,
 	return err;
 }
 
+/*
+ * Between blockif_plug() and blockif_unplug() the requests are only queued,
+ * so that a batch of them is merged and submitted to the async engine at
+ * once.
+ */
+void
+blockif_plug(struct blockif_ctxt *bc)
+{
+	pthread_mutex_lock(&bc->mtx);
+	bc->plugged++;
+	pthread_mutex_unlock(&bc->mtx);
+}
+
+void
+blockif_unplug(struct blockif_ctxt *bc)
+{
+	pthread_mutex_lock(&bc->mtx);
+	bc->plugged--;
+	if (bc->plugged == 0 && bc->engine != NULL)
+		blockif_dispatch(bc);
+	pthread_mutex_unlock(&bc->mtx);
+}
+
 int
 blockif_read(struct blockif_ctxt *bc, struct blockif_req *breq)
 {
@@ -827,6 +2440,12 @@ blockif_discard(struct blockif_ctxt *bc, struct blockif_req *breq)
 	return blockif_request(bc, breq, BOP_DISCARD);
 }
 
+int
+blockif_write_zeroes(struct blockif_ctxt *bc, struct blockif_req *breq)
+{
+	return blockif_request(bc, breq, BOP_WRITE_ZEROES);
+}
+
 int
 blockif_cancel(struct blockif_ctxt *bc, struct blockif_req *breq)
 {
@@ -840,6 +2459,14 @@ blockif_cancel(struct blockif_ctxt *bc, struct blockif_req *breq)
 		if (be->req == breq)
 			break;
 	}
+	if (be != NULL && (be->mhead != be || be->mnext != NULL)) {
+		/*
+		 * Merged with other requests, it completes along with them
+		 * through the normal callback path.
+		 */
+		pthread_mutex_unlock(&bc->mtx);
+		return -EBUSY;
+	}
 	if (be != NULL) {
 		/*
 		 * Found it.
@@ -865,6 +2492,15 @@ blockif_cancel(struct blockif_ctxt *bc, struct blockif_req *breq)
 		return -1;
 	}
 
+	/*
+	 * Submitted by the async engine, it completes through the normal
+	 * callback path.
+	 */
+	if (be->tid == 0) {
+		pthread_mutex_unlock(&bc->mtx);
+		return -EBUSY;
+	}
+
 	/*
 	 * Interrupt the processing thread to force it return
 	 * prematurely via it's normal callback path.
@@ -908,6 +2544,7 @@ blockif_close(struct blockif_ctxt *bc)
 	void *jval;
 	int i;
 
+	dm_stats_unregister(bc);
 	sub_file_unlock(bc);
 
 	/*
@@ -918,15 +2555,27 @@ blockif_close(struct blockif_ctxt *bc)
 	pthread_cond_broadcast(&bc->cond);
 	pthread_mutex_unlock(&bc->mtx);
 
-	for (i = 0; i < BLOCKIF_NUMTHR; i++)
+	for (i = 0; i < bc->nthr; i++)
 		pthread_join(bc->btid[i], &jval);
 
 	/* XXX Cancel queued i/o's ??? */
+	if (bc->engine != NULL) {
+		acrn_timer_deinit(&bc->qos_timer);
+		bc->engine->deinit(bc);
+	}
 
 	/*
 	 * Release resources
 	 */
-	close(bc->fd);
+	if (!bc->shared_fd) {
+		pthread_mutex_destroy(&bc->qos->mtx);
+		free(bc->qos);
+		if (bc->rcache != NULL)
+			blockif_cache_put(bc->rcache, bc->fd);
+		if (bc->cow != NULL)
+			blockif_cow_close(bc->cow);
+		close(bc->fd);
+	}
 	free(bc);
 
 	return 0;
@@ -1037,6 +2686,24 @@ blockif_discard_sector_alignment(struct blockif_ctxt *bc)
 	return bc->discard_sector_alignment;
 }
 
+int
+blockif_canzero(struct blockif_ctxt *bc)
+{
+	return bc->canzero;
+}
+
+int
+blockif_max_zero_sectors(struct blockif_ctxt *bc)
+{
+	return bc->max_zero_sectors;
+}
+
+int
+blockif_max_zero_seg(struct blockif_ctxt *bc)
+{
+	return bc->max_zero_seg;
+}
+
 uint8_t
 blockif_get_wce(struct blockif_ctxt *bc)
 {
@@ -1059,3 +2726,83 @@ blockif_flush_all(struct blockif_ctxt *bc)
 		err = errno;
 	return err;
 }
+
+/*
+ * Add the counters of bc to st, e.g. to sum up the contexts cloned from
+ * one another.
+ */
+void
+blockif_get_stats(struct blockif_ctxt *bc, struct blockif_stats *st)
+{
+	struct blockif_op_stats *src, *dst;
+	int i, j;
+
+	pthread_mutex_lock(&bc->mtx);
+	for (i = 0; i < BLOCKIF_STAT_OPS; i++) {
+		src = &bc->stats.op[i];
+		dst = &st->op[i];
+		dst->ops += src->ops;
+		dst->bytes += src->bytes;
+		dst->merged += src->merged;
+		dst->errors += src->errors;
+		dst->lat_us += src->lat_us;
+		for (j = 0; j < BLOCKIF_LAT_BUCKETS; j++)
+			dst->lat_hist[j] += src->lat_hist[j];
+	}
+	st->inflight += bc->stats.inflight;
+	for (i = 0; i < BLOCKIF_QD_BUCKETS; i++)
+		st->qd_hist[i] += bc->stats.qd_hist[i];
+	pthread_mutex_unlock(&bc->mtx);
+}
+
+void
+blockif_set_batch_cb(struct blockif_ctxt *bc, void (*cb)(void *), void *arg)
+{
+	pthread_mutex_lock(&bc->mtx);
+	bc->batch_cb = cb;
+	bc->batch_arg = arg;
+	pthread_mutex_unlock(&bc->mtx);
+}
+
+/*
+ * Change the throttling of bc at runtime, opts is a comma separated list
+ * of iops=<ops/s>[/<burst>] and bps=<bytes/s>[/<burst>], a limit not in
+ * the list is removed. The contexts cloned from bc share its limits.
+ */
+int
+blockif_set_qos(struct blockif_ctxt *bc, const char *opts)
+{
+	uint64_t limits[4];
+	char *str, *sp, *cp;
+	int err;
+
+	str = strdup(opts);
+	if (str == NULL)
+		return -1;
+
+	err = 0;
+	memset(limits, 0, sizeof(limits));
+	sp = str;
+	while ((cp = strsep(&sp, ",")) != NULL) {
+		if (blockif_parse_qos(cp, limits)) {
+			fprintf(stderr, "Invalid qos option \"%s\"\n", cp);
+			err = -1;
+			break;
+		}
+	}
+	free(str);
+	if (err)
+		return err;
+
+	blockif_qos_set(bc->qos, limits);
+
+	/* let the requests held back go with the new limits */
+	pthread_mutex_lock(&bc->mtx);
+	bc->qos_wait = 0;
+	pthread_cond_broadcast(&bc->cond);
+	if (bc->engine != NULL)
+		blockif_dispatch(bc);
+	pthread_mutex_unlock(&bc->mtx);
+
+	return 0;
+}
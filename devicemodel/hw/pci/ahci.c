@@ -132,6 +132,7 @@ struct ahci_port {
 	uint8_t asc;
 	u_int ccs;
 	uint32_t pending;
+	uint32_t sdb_done;	/* NCQ slots completed, not in a SDB FIS yet */
 
 	uint32_t clb;
 	uint32_t clbu;
@@ -351,12 +352,41 @@ ahci_write_fis_piosetup(struct ahci_port *p)
 	ahci_write_fis(p, FIS_TYPE_PIOSETUP, fis);
 }
 
+/*
+ * One SDB FIS, and so at most one interrupt, for the NCQ commands
+ * completed successfully since the last one.
+ */
+static void
+ahci_write_fis_sdb_done(struct ahci_port *p)
+{
+	uint8_t fis[8];
+	uint32_t tfd;
+
+	if (p->sdb_done == 0)
+		return;
+
+	tfd = (ATA_S_READY | ATA_S_DSC) & 0x77;
+	memset(fis, 0, sizeof(fis));
+	fis[0] = FIS_TYPE_SETDEVBITS;
+	fis[1] = (1 << 6);
+	fis[2] = tfd;
+	*(uint32_t *)(fis + 4) = p->sdb_done;
+	p->sact &= ~p->sdb_done;
+	p->sdb_done = 0;
+	p->tfd &= ~0x77;
+	p->tfd |= tfd;
+	ahci_write_fis(p, FIS_TYPE_SETDEVBITS, fis);
+}
+
 static void
 ahci_write_fis_sdb(struct ahci_port *p, int slot, uint8_t *cfis, uint32_t tfd)
 {
 	uint8_t fis[8];
 	uint8_t error;
 
+	/* the guest sees the completions in order */
+	ahci_write_fis_sdb_done(p);
+
 	error = (tfd >> 8) & 0xff;
 	tfd &= 0x77;
 	memset(fis, 0, sizeof(fis));
@@ -457,6 +487,7 @@ ahci_check_stopped(struct ahci_port *p)
 			p->cmd &= ~(AHCI_P_CMD_CR | AHCI_P_CMD_CCS_MASK);
 			p->ci = 0;
 			p->sact = 0;
+			p->sdb_done = 0;
 			p->waitforclear = 0;
 		}
 	}
@@ -513,6 +544,7 @@ ahci_port_reset(struct ahci_port *pr)
 {
 	pr->serr = 0;
 	pr->sact = 0;
+	pr->sdb_done = 0;
 	pr->xfermode = ATA_UDMA6;
 	pr->mult_sectors = 128;
 
@@ -1856,6 +1888,10 @@ ahci_handle_port(struct ahci_port *p)
 	if (!(p->cmd & AHCI_P_CMD_ST))
 		return;
 
+	/* the commands issued together go to blockif as one batch */
+	if (p->bctx)
+		blockif_plug(p->bctx);
+
 	/*
 	 * Search for any new commands to issue ignoring those that
 	 * are already in-flight.  Stop if device is busy or in error.
@@ -1871,6 +1907,9 @@ ahci_handle_port(struct ahci_port *p)
 			ahci_handle_slot(p, p->ccs);
 		}
 	}
+
+	if (p->bctx)
+		blockif_unplug(p->bctx);
 }
 
 /*
@@ -1934,7 +1973,9 @@ ata_ioreq_cb(struct blockif_req *br, int err)
 		tfd = ATA_S_READY | ATA_S_DSC;
 	else
 		tfd = (ATA_E_ABORT << 8) | ATA_S_READY | ATA_S_ERROR;
-	if (ncq)
+	if (ncq && !err)
+		p->sdb_done |= (1 << slot);	/* see ahci_blockif_batch_cb() */
+	else if (ncq)
 		ahci_write_fis_sdb(p, slot, cfis, tfd);
 	else
 		ahci_write_fis_d2h(p, slot, cfis, tfd);
@@ -1951,6 +1992,20 @@ out:
 	DPRINTF("%s exit\n", __func__);
 }
 
+/*
+ * End of a batch of blockif completions: the NCQ commands completed in the
+ * batch share a SDB FIS.
+ */
+static void
+ahci_blockif_batch_cb(void *arg)
+{
+	struct ahci_port *p = arg;
+
+	pthread_mutex_lock(&p->ahci_dev->mtx);
+	ahci_write_fis_sdb_done(p);
+	pthread_mutex_unlock(&p->ahci_dev->mtx);
+}
+
 static void
 atapi_ioreq_cb(struct blockif_req *br, int err)
 {
@@ -2407,6 +2462,8 @@ pci_ahci_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts, int atapi)
 		ahci_dev->port[p].ahci_dev = ahci_dev;
 		ahci_dev->port[p].port = p;
 		ahci_dev->port[p].atapi = atapi;
+		blockif_set_batch_cb(bctxt, ahci_blockif_batch_cb,
+				&ahci_dev->port[p]);
 
 		/*
 		 * Create an identifier for the backing file.
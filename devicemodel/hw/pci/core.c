@@ -34,6 +34,7 @@
 #include <strings.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <time.h>
 
 #include "dm.h"
 #include "vmmapi.h"
@@ -46,6 +47,7 @@
 #include "lpc.h"
 #include "sw_load.h"
 #include "log.h"
+#include "dm_stats.h"
 
 #define CONF1_ADDR_PORT    0x0cf8
 #define CONF1_DATA_PORT    0x0cfc
@@ -61,6 +63,17 @@ struct funcinfo {
 	char	*fi_param;
 	char	*fi_param_saved; /* save for reboot */
 	struct pci_vdev *fi_devi;
+	uint64_t fi_init_us;	/* time spent in vdev_init */
+};
+
+struct pci_prepare_job {
+	pthread_t	tid;
+	struct vmctx	*ctx;
+	struct pci_vdev_ops *ops;
+	struct funcinfo	*fi;
+	char		*opts;
+	int		error;
+	bool		started;
 };
 
 struct intxinfo {
@@ -83,6 +96,10 @@ struct businfo {
 
 static struct businfo *pci_businfo[MAXBUSES];
 
+/* The config space dispatch goes straight from (bus, devfn) to the device */
+#define	PCI_DEVFN(slot, func)	(((slot) << 3) | (func))
+static struct pci_vdev *pci_vdevs[MAXBUSES][MAXSLOTS * MAXFUNCS];
+
 SET_DECLARE(pci_vdev_ops_set, struct pci_vdev_ops);
 
 static uint64_t pci_emul_iobase;
@@ -105,6 +122,8 @@ static void pci_lintr_update(struct pci_vdev *dev);
 static void pci_cfgrw(struct vmctx *ctx, int vcpu, int in, int bus, int slot,
 		      int func, int coff, int bytes, uint32_t *val);
 static void pci_emul_free_msixcap(struct pci_vdev *pdi);
+static void pci_emul_cmdsts_write(struct pci_vdev *dev, int coff,
+				  uint32_t new, int bytes);
 
 static inline void
 CFGWRITE(struct pci_vdev *dev, int coff, uint32_t val, int bytes)
@@ -270,6 +289,42 @@ done:
 	return error;
 }
 
+/*
+ * As pci_parse_slot(), the slot may be occupied already: the clones of a
+ * template DM replace some of the slots of the template.
+ */
+int
+pci_reparse_slot(char *opt)
+{
+	struct funcinfo *fi;
+	char *str, *cp;
+	int bnum, snum, fnum;
+
+	str = strdup(opt);
+	if (!str)
+		return -1;
+
+	cp = strchr(str, ',');
+	if (cp)
+		*cp = '\0';
+	if (parse_bdf(str, &bnum, &snum, &fnum, 10) != 0 ||
+	    bnum < 0 || bnum >= MAXBUSES || snum < 0 || snum >= MAXSLOTS ||
+	    fnum < 0 || fnum >= MAXFUNCS) {
+		free(str);
+		pci_parse_slot_usage(opt);
+		return -1;
+	}
+	free(str);
+
+	if (pci_businfo[bnum] != NULL) {
+		fi = &pci_businfo[bnum]->slotinfo[snum].si_funcs[fnum];
+		fi->fi_name = NULL;
+		fi->fi_param_saved = NULL;
+	}
+
+	return pci_parse_slot(opt);
+}
+
 static int
 pci_valid_pba_offset(struct pci_vdev *dev, uint64_t offset)
 {
@@ -397,8 +452,9 @@ pci_emul_io_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 	struct pci_vdev *pdi = arg;
 	struct pci_vdev_ops *ops = pdi->dev_ops;
 	uint64_t offset;
-	int i;
+	int i, ret = -1;
 
+	pthread_mutex_lock(&pdi->emul_lock);
 	for (i = 0; i <= PCI_BARMAX; i++) {
 		if (pdi->bar[i].type == PCIBAR_IO &&
 		    port >= pdi->bar[i].addr &&
@@ -411,10 +467,12 @@ pci_emul_io_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 			} else
 				(*ops->vdev_barwrite)(ctx, vcpu, pdi, i, offset,
 				                      bytes, bar_value(bytes, *eax));
-			return 0;
+			ret = 0;
+			break;
 		}
 	}
-	return -1;
+	pthread_mutex_unlock(&pdi->emul_lock);
+	return ret;
 }
 
 static int
@@ -433,6 +491,7 @@ pci_emul_mem_handler(struct vmctx *ctx, int vcpu, int dir, uint64_t addr,
 
 	offset = addr - pdi->bar[bidx].addr;
 
+	pthread_mutex_lock(&pdi->emul_lock);
 	if (dir == MEM_F_WRITE) {
 		if (size == 8) {
 			(*ops->vdev_barwrite)(ctx, vcpu, pdi, bidx, offset,
@@ -461,6 +520,7 @@ pci_emul_mem_handler(struct vmctx *ctx, int vcpu, int dir, uint64_t addr,
 			*val = bar_value(size, *val);
 		}
 	}
+	pthread_mutex_unlock(&pdi->emul_lock);
 
 	return 0;
 }
@@ -494,6 +554,35 @@ pci_emul_alloc_bar(struct pci_vdev *pdi, int idx, enum pcibar_type type,
 	return pci_emul_alloc_pbar(pdi, idx, 0, type, size);
 }
 
+/*
+ * Let the hypervisor serve the MSI-X table and PBA accesses of the BAR at
+ * base, or no more if !assign. The table is only shared when it fits in
+ * its page, the device model keeps serving the others.
+ */
+static void
+pci_emul_share_msix(struct pci_vdev *dev, int idx, uint64_t base, bool assign)
+{
+	struct acrn_emul_msix msix;
+
+	if (dev->msix.table == NULL || idx != dev->msix.table_bar ||
+	    dev->msix.table_count > ACRN_EMUL_MSIX_ENTRIES)
+		return;
+
+	bzero(&msix, sizeof(msix));
+	msix.addr = base;
+	msix.size = dev->bar[idx].size;
+	msix.table_buf = (uint64_t)dev->msix.table;
+	msix.table_count = dev->msix.table_count;
+	msix.pba_offset = dev->msix.pba_offset;
+	msix.pba_size = dev->msix.pba_size;
+	if (!assign)
+		msix.flags = ACRN_EMUL_MSIX_FLAG_DEASSIGN;
+
+	if (vm_set_emul_msix(dev->vmctx, &msix) != 0 && assign)
+		pr_dbg("%s: msix table in hv unsupported, errno %d\n",
+			dev->name, errno);
+}
+
 /*
  * Register (or unregister) the MMIO or I/O region associated with the BAR
  * register 'idx' of an emulated pci device.
@@ -526,7 +615,7 @@ modify_bar_registration(struct pci_vdev *dev, int idx, int registration)
 		iop.port = dev->bar[idx].addr;
 		iop.size = dev->bar[idx].size;
 		if (registration) {
-			iop.flags = IOPORT_F_INOUT;
+			iop.flags = IOPORT_F_INOUT | IOPORT_F_CONCURRENT;
 			iop.handler = pci_emul_io_handler;
 			iop.arg = dev;
 			error = register_inout(&iop);
@@ -540,13 +629,25 @@ modify_bar_registration(struct pci_vdev *dev, int idx, int registration)
 		mr.base = dev->bar[idx].addr;
 		mr.size = dev->bar[idx].size;
 		if (registration) {
-			mr.flags = MEM_F_RW;
+			mr.flags = MEM_F_RW | MEM_F_CONCURRENT;
 			mr.handler = pci_emul_mem_handler;
 			mr.arg1 = dev;
 			mr.arg2 = idx;
 			error = register_mem(&mr);
-		} else
+			if (!error && dev->bar[idx].coalesced_size)
+				(void)register_coalesced_mmio(dev->vmctx,
+					mr.base + dev->bar[idx].coalesced_off,
+					dev->bar[idx].coalesced_size);
+			if (!error)
+				pci_emul_share_msix(dev, idx, mr.base, true);
+		} else {
+			pci_emul_share_msix(dev, idx, mr.base, false);
+			if (dev->bar[idx].coalesced_size)
+				(void)unregister_coalesced_mmio(dev->vmctx,
+					mr.base + dev->bar[idx].coalesced_off,
+					dev->bar[idx].coalesced_size);
 			error = unregister_mem(&mr);
+		}
 		break;
 	default:
 		error = EINVAL;
@@ -854,11 +955,157 @@ pci_emul_finddev(char *name)
 	return NULL;
 }
 
+static uint64_t
+pci_emul_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+static void *
+pci_emul_prepare_thread(void *arg)
+{
+	struct pci_prepare_job *job = arg;
+
+	job->error = (*job->ops->vdev_prepare)(job->ctx, job->opts);
+	return NULL;
+}
+
+/* the vdev_prepare jobs pci_emul_prepare() left running */
+static struct pci_prepare_job *prepare_jobs;
+static int prepare_njobs;
+static uint64_t prepare_start_us;
+
+/*
+ * The vdev_prepare of all the devices at once, a thread each. The DM starts
+ * them right after vm_create, they run along the memory setup and the other
+ * vdevs, init_pci() waits for them and only then runs the vdev_init one
+ * after another in slot order: the BARs, IRQs and other emulated resources
+ * are allocated the same way at each boot. A device whose preparation
+ * failed does the work in vdev_init itself.
+ */
+void
+pci_emul_prepare(struct vmctx *ctx)
+{
+	struct pci_prepare_job *jobs;
+	struct pci_vdev_ops *ops;
+	struct businfo *bi;
+	struct funcinfo *fi;
+	int bus, slot, func, i, njobs = 0;
+
+	if (prepare_jobs != NULL)
+		return;
+
+	for (bus = 0; bus < MAXBUSES; bus++) {
+		if ((bi = pci_businfo[bus]) == NULL)
+			continue;
+		for (slot = 0; slot < MAXSLOTS; slot++) {
+			for (func = 0; func < MAXFUNCS; func++) {
+				fi = &bi->slotinfo[slot].si_funcs[func];
+				ops = fi->fi_name ?
+					pci_emul_finddev(fi->fi_name) : NULL;
+				if (ops && ops->vdev_prepare)
+					njobs++;
+			}
+		}
+	}
+	if (njobs == 0)
+		return;
+
+	jobs = calloc(njobs, sizeof(*jobs));
+	if (jobs == NULL)
+		return;
+
+	prepare_start_us = pci_emul_now_us();
+	i = 0;
+	for (bus = 0; bus < MAXBUSES; bus++) {
+		if ((bi = pci_businfo[bus]) == NULL)
+			continue;
+		for (slot = 0; slot < MAXSLOTS; slot++) {
+			for (func = 0; func < MAXFUNCS; func++) {
+				fi = &bi->slotinfo[slot].si_funcs[func];
+				ops = fi->fi_name ?
+					pci_emul_finddev(fi->fi_name) : NULL;
+				if (!ops || !ops->vdev_prepare)
+					continue;
+
+				jobs[i].ctx = ctx;
+				jobs[i].ops = ops;
+				jobs[i].fi = fi;
+				if (fi->fi_param_saved)
+					jobs[i].opts = strdup(fi->fi_param_saved);
+				jobs[i].started = (pthread_create(&jobs[i].tid,
+					NULL, pci_emul_prepare_thread,
+					&jobs[i]) == 0);
+				if (!jobs[i].started)
+					pci_emul_prepare_thread(&jobs[i]);
+				i++;
+			}
+		}
+	}
+
+	prepare_jobs = jobs;
+	prepare_njobs = njobs;
+}
+
+static void
+pci_emul_prepare_wait(void)
+{
+	struct pci_prepare_job *jobs = prepare_jobs;
+	int i;
+
+	if (jobs == NULL)
+		return;
+
+	for (i = 0; i < prepare_njobs; i++) {
+		if (jobs[i].started)
+			pthread_join(jobs[i].tid, NULL);
+		if (jobs[i].error)
+			pr_warn("pci prepare %s failed, error %d\n",
+				jobs[i].fi->fi_name, jobs[i].error);
+		free(jobs[i].opts);
+	}
+
+	pr_notice("pci prepare of %d devices: %lu ms\n", prepare_njobs,
+		(pci_emul_now_us() - prepare_start_us) / 1000);
+
+	free(jobs);
+	prepare_jobs = NULL;
+	prepare_njobs = 0;
+}
+
+static void
+pci_emul_report_init(void)
+{
+	struct businfo *bi;
+	struct funcinfo *fi;
+	int bus, slot, func;
+
+	for (bus = 0; bus < MAXBUSES; bus++) {
+		if ((bi = pci_businfo[bus]) == NULL)
+			continue;
+		for (slot = 0; slot < MAXSLOTS; slot++) {
+			for (func = 0; func < MAXFUNCS; func++) {
+				fi = &bi->slotinfo[slot].si_funcs[func];
+				if (fi->fi_devi == NULL)
+					continue;
+				pr_notice("pci init %d:%d:%d %s: %lu.%03lu ms\n",
+					bus, slot, func, fi->fi_name,
+					fi->fi_init_us / 1000,
+					fi->fi_init_us % 1000);
+			}
+		}
+	}
+}
+
 static int
 pci_emul_init(struct vmctx *ctx, struct pci_vdev_ops *ops, int bus, int slot,
 	      int func, struct funcinfo *fi)
 {
 	struct pci_vdev *pdi;
+	uint64_t start;
 	int err;
 
 	pdi = calloc(1, sizeof(struct pci_vdev));
@@ -872,6 +1119,7 @@ pci_emul_init(struct vmctx *ctx, struct pci_vdev_ops *ops, int bus, int slot,
 	pdi->slot = slot;
 	pdi->func = func;
 	pthread_mutex_init(&pdi->lintr.lock, NULL);
+	pthread_mutex_init(&pdi->emul_lock, NULL);
 	pdi->lintr.pin = 0;
 	pdi->lintr.state = IDLE;
 	pdi->lintr.pirq_pin = 0;
@@ -890,11 +1138,16 @@ pci_emul_init(struct vmctx *ctx, struct pci_vdev_ops *ops, int bus, int slot,
 		fi->fi_param = strdup(fi->fi_param_saved);
 	else
 		fi->fi_param = NULL;
+	start = pci_emul_now_us();
 	err = (*ops->vdev_init)(ctx, pdi, fi->fi_param);
-	if (err == 0)
+	fi->fi_init_us = pci_emul_now_us() - start;
+	if (err == 0) {
 		fi->fi_devi = pdi;
-	else
+		pci_vdevs[bus][PCI_DEVFN(slot, func)] = pdi;
+	} else {
+		dm_stats_unregister(pdi);
 		free(pdi);
+	}
 
 	return err;
 }
@@ -903,12 +1156,15 @@ static void
 pci_emul_deinit(struct vmctx *ctx, struct pci_vdev_ops *ops, int bus, int slot,
 		int func, struct funcinfo *fi)
 {
+	if (fi->fi_devi)
+		dm_stats_unregister(fi->fi_devi);
 	if (ops->vdev_deinit && fi->fi_devi)
 		(*ops->vdev_deinit)(ctx, fi->fi_devi, fi->fi_param);
 	if (fi->fi_param)
 		free(fi->fi_param);
 
 	if (fi->fi_devi) {
+		pci_vdevs[bus][PCI_DEVFN(slot, func)] = NULL;
 		pci_lintr_release(fi->fi_devi);
 		pci_emul_free_bars(fi->fi_devi);
 		pci_emul_free_msixcap(fi->fi_devi);
@@ -974,12 +1230,14 @@ pci_msix_table_init(struct pci_vdev *dev, int table_entries)
 {
 	int i, table_size;
 
-	table_size = table_entries * MSIX_TABLE_ENTRY_SIZE;
-	dev->msix.table = calloc(1, table_size);
-	if (!dev->msix.table) {
+	/* page aligned, to be shared with the hypervisor */
+	table_size = roundup2(table_entries * MSIX_TABLE_ENTRY_SIZE, 4096);
+	if (posix_memalign((void **)&dev->msix.table, 4096, table_size) != 0) {
+		dev->msix.table = NULL;
 		pr_err("%s: Cannot alloc memory!\n", __func__);
 		return -1;
 	}
+	bzero(dev->msix.table, table_size);
 
 	/* set mask bit of vector control register */
 	for (i = 0; i < table_entries; i++)
@@ -1229,6 +1487,66 @@ pci_emul_ecfg_handler(struct vmctx *ctx, int vcpu, int dir, uint64_t addr,
 	return 0;
 }
 
+/*
+ * The read-only bytes of the header, which the hypervisor serves from its
+ * shadow: IDs, revision, class, header type, subsystem IDs, capability
+ * pointer and interrupt pin.
+ */
+#define	PCI_CFG_SHADOW_RO_MASK	(0xfUL | 0xf00UL | (1UL << PCIR_HDRTYPE) | \
+				 (0xfUL << PCIR_SUBVEND_0) | \
+				 (1UL << PCIR_CAP_PTR) | (1UL << PCIR_INTPIN))
+
+static struct acrn_pci_cfg_shadow pci_cfg_shadow;
+
+/*
+ * Push the read-only config space of the devices to the hypervisor, or
+ * drop it if !enable. The BDFs without a device are then answered by the
+ * hypervisor as well.
+ */
+static void
+pci_push_cfg_shadow(struct vmctx *ctx, bool enable)
+{
+	struct acrn_pci_cfg_shadow_dev *sd;
+	struct pci_vdev *dev;
+	uint32_t val;
+	int bus, devfn, off;
+
+	bzero(&pci_cfg_shadow, sizeof(pci_cfg_shadow));
+	if (enable) {
+		pci_cfg_shadow.flags = ACRN_PCI_CFG_SHADOW_COMPLETE;
+		pci_cfg_shadow.ecfg_base = PCI_EMUL_ECFG_BASE;
+		pci_cfg_shadow.ecfg_size = PCI_EMUL_ECFG_SIZE;
+	}
+
+	for (bus = 0; enable && bus < MAXBUSES; bus++) {
+		for (devfn = 0; devfn < MAXSLOTS * MAXFUNCS; devfn++) {
+			dev = pci_vdevs[bus][devfn];
+			if (dev == NULL)
+				continue;
+			if (pci_cfg_shadow.num_devs == ACRN_PCI_CFG_SHADOW_DEVS) {
+				/* the others are still asked to the device model */
+				pci_cfg_shadow.flags &= ~ACRN_PCI_CFG_SHADOW_COMPLETE;
+				break;
+			}
+
+			sd = &pci_cfg_shadow.devs[pci_cfg_shadow.num_devs++];
+			sd->bdf = PCI_BDF(bus, dev->slot, dev->func);
+			sd->ro_mask = PCI_CFG_SHADOW_RO_MASK;
+			for (off = 0; off < ACRN_PCI_CFG_SHADOW_SIZE; off += 4) {
+				if (((sd->ro_mask >> off) & 0xf) == 0)
+					continue;
+				pci_cfgrw(ctx, 0, 1, bus, dev->slot, dev->func, off,
+						4, &val);
+				memcpy(&sd->cfg[off], &val, 4);
+			}
+		}
+	}
+
+	if (vm_set_pci_cfg_shadow(ctx, &pci_cfg_shadow) != 0 && enable)
+		pr_info("pci config shadow in hv unsupported, errno %d\n",
+				errno);
+}
+
 #define	BUSIO_ROUNDUP		32
 #define	BUSMEM_ROUNDUP		(1024 * 1024)
 
@@ -1250,6 +1568,9 @@ init_pci(struct vmctx *ctx)
 	pci_emul_membase64 = PCI_EMUL_MEMBASE64;
 
 	create_gsi_sharing_groups();
+	/* started already, but on the reset of the vdevs */
+	pci_emul_prepare(ctx);
+	pci_emul_prepare_wait();
 
 	for (bus = 0; bus < MAXBUSES; bus++) {
 		bi = pci_businfo[bus];
@@ -1375,7 +1696,7 @@ init_pci(struct vmctx *ctx)
 	/* PCI extended config space */
 	bzero(&mr, sizeof(struct mem_range));
 	mr.name = "PCI ECFG";
-	mr.flags = MEM_F_RW;
+	mr.flags = MEM_F_RW | MEM_F_CONCURRENT;
 	mr.base = PCI_EMUL_ECFG_BASE;
 	mr.size = PCI_EMUL_ECFG_SIZE;
 	mr.handler = pci_emul_ecfg_handler;
@@ -1383,6 +1704,9 @@ init_pci(struct vmctx *ctx)
 	if (error != 0)
 		goto pci_emul_init_fail;
 
+	pci_push_cfg_shadow(ctx, true);
+	pci_emul_report_init();
+
 	return 0;
 
 pci_emul_init_fail:
@@ -1423,6 +1747,8 @@ deinit_pci(struct vmctx *ctx)
 	size_t lowmem;
 	struct mem_range mr;
 
+	pci_push_cfg_shadow(ctx, false);
+
 	/* Release PCI extended config space */
 	bzero(&mr, sizeof(struct mem_range));
 	mr.name = "PCI ECFG";
@@ -1469,6 +1795,85 @@ deinit_pci(struct vmctx *ctx)
 	}
 }
 
+/*
+ * Bring the config space of dev back to its state after vdev_init: no
+ * decoding, no MSI/MSI-X, INTx deasserted. The BAR addresses, the INTx
+ * routing and the backend are kept.
+ */
+static void
+pci_emul_reset_cfg(struct pci_vdev *dev)
+{
+	uint16_t msgctrl;
+	int capoff, i;
+
+	pthread_mutex_lock(&dev->emul_lock);
+
+	pci_emul_cmdsts_write(dev, PCIR_COMMAND, 0, 2);
+
+	if (pci_emul_find_capability(dev, PCIY_MSI, &capoff) == 0) {
+		msgctrl = pci_get_cfgdata16(dev, capoff + 2);
+		msgctrl &= ~(PCIM_MSICTRL_MME_MASK | PCIM_MSICTRL_MSI_ENABLE);
+		pci_set_cfgdata16(dev, capoff + 2, msgctrl);
+		dev->msi.enabled = 0;
+		dev->msi.maxmsgnum = 0;
+	}
+
+	if (pci_emul_find_capability(dev, PCIY_MSIX, &capoff) == 0) {
+		msgctrl = pci_get_cfgdata16(dev, capoff + 2);
+		msgctrl &= ~(PCIM_MSIXCTRL_MSIX_ENABLE |
+			PCIM_MSIXCTRL_FUNCTION_MASK);
+		pci_set_cfgdata16(dev, capoff + 2, msgctrl);
+		dev->msix.enabled = 0;
+		dev->msix.function_mask = 0;
+		for (i = 0; dev->msix.table && i < dev->msix.table_count; i++) {
+			dev->msix.table[i].addr = 0;
+			dev->msix.table[i].msg_data = 0;
+			dev->msix.table[i].vector_control = PCIM_MSIX_VCTRL_MASK;
+		}
+	}
+
+	pthread_mutex_unlock(&dev->emul_lock);
+
+	if (dev->lintr.pin > 0)
+		pci_lintr_deassert(dev);
+}
+
+/*
+ * Reset all the devices in place for a warm reset of the VM, or return -1
+ * without touching any of them if one has no vdev_reset, the caller then
+ * goes through deinit_pci()/init_pci().
+ */
+int
+reset_pci(struct vmctx *ctx)
+{
+	struct pci_vdev *dev;
+	int bus, devfn;
+
+	for (bus = 0; bus < MAXBUSES; bus++) {
+		for (devfn = 0; devfn < MAXSLOTS * MAXFUNCS; devfn++) {
+			dev = pci_vdevs[bus][devfn];
+			if (dev != NULL && dev->dev_ops->vdev_reset == NULL) {
+				pr_info("pci %s has no warm reset\n",
+					dev->dev_ops->class_name);
+				return -1;
+			}
+		}
+	}
+
+	for (bus = 0; bus < MAXBUSES; bus++) {
+		for (devfn = 0; devfn < MAXSLOTS * MAXFUNCS; devfn++) {
+			dev = pci_vdevs[bus][devfn];
+			if (dev == NULL)
+				continue;
+			pr_notice("pci reset %s\n", dev->dev_ops->class_name);
+			pci_emul_reset_cfg(dev);
+			dev->dev_ops->vdev_reset(ctx, dev);
+		}
+	}
+
+	return 0;
+}
+
 static void
 pci_apic_prt_entry(int bus, int slot, int pin, int pirq_pin, int ioapic_irq,
 		   void *arg)
@@ -2073,24 +2478,14 @@ pci_emul_cmdsts_write(struct pci_vdev *dev, int coff, uint32_t new, int bytes)
 }
 
 static void
-pci_cfgrw(struct vmctx *ctx, int vcpu, int in, int bus, int slot, int func,
-	  int coff, int bytes, uint32_t *eax)
+pci_cfgrw_nolock(struct vmctx *ctx, int vcpu, int in, struct pci_vdev *dev,
+	  int bus, int slot, int func, int coff, int bytes, uint32_t *eax)
 {
-	struct businfo *bi;
-	struct slotinfo *si;
-	struct pci_vdev *dev;
 	struct pci_vdev_ops *ops;
 	int idx, needcfg;
 	uint64_t addr, bar, mask;
 	bool decode, ignore_reg_unreg = false;
 
-	bi = pci_businfo[bus];
-	if (bi != NULL) {
-		si = &bi->slotinfo[slot];
-		dev = si->si_funcs[func].fi_devi;
-	} else
-		dev = NULL;
-
 	/*
 	 * Just return if there is no device at this slot:func or if the
 	 * the guest is doing an un-aligned access.
@@ -2253,6 +2648,21 @@ pci_cfgrw(struct vmctx *ctx, int vcpu, int in, int bus, int slot, int func,
 	}
 }
 
+static void
+pci_cfgrw(struct vmctx *ctx, int vcpu, int in, int bus, int slot, int func,
+	  int coff, int bytes, uint32_t *eax)
+{
+	struct pci_vdev *dev;
+
+	dev = pci_vdevs[bus][PCI_DEVFN(slot, func)];
+
+	if (dev != NULL)
+		pthread_mutex_lock(&dev->emul_lock);
+	pci_cfgrw_nolock(ctx, vcpu, in, dev, bus, slot, func, coff, bytes, eax);
+	if (dev != NULL)
+		pthread_mutex_unlock(&dev->emul_lock);
+}
+
 static int cfgenable, cfgbus, cfgslot, cfgfunc, cfgoff;
 
 static int
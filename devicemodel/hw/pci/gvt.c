@@ -42,6 +42,14 @@ struct pci_gvt {
 	int instance_created;
 };
 
+/*
+ * The low GM of the vGPUs is the part of the aperture they map, slices of
+ * it kept on the 2MB boundaries let the EPT map them with 2MB pages: the
+ * aperture BAR is aligned on its size as the host one is, and the guest
+ * sees its slice at the same offset.
+ */
+#define GVT_GM_ALIGN_MB	2
+
 /* These are the default values */
 int gvt_low_gm_sz = 64; /* in MB */
 int gvt_high_gm_sz = 448; /* in MB */
@@ -56,6 +64,12 @@ acrn_parse_gvtargs(char *arg)
 		dm_strtoi(arg, &arg, 10, &gvt_fence_sz) != 0)
 		return -1;
 
+	if (gvt_low_gm_sz % GVT_GM_ALIGN_MB != 0) {
+		gvt_low_gm_sz = roundup2(gvt_low_gm_sz, GVT_GM_ALIGN_MB);
+		printf("gvt-g low_gm rounded up to %dMB for the 2MB pages\n",
+			gvt_low_gm_sz);
+	}
+
 	printf("passed gvt-g optargs low_gm %d, high_gm %d, fence %d\n",
 		gvt_low_gm_sz, gvt_high_gm_sz, gvt_fence_sz);
 
@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * Inter-VM shared memory device, the ivshmem device of QEMU without the
+ * legacy interrupt:
+ *	-s <slot>,ivshmem,<region>
+ *
+ * BAR2 maps a region of the inter-VM shared memory of the hypervisor, the
+ * one of the ivshmem devices of the other VMs attached to the region. The
+ * hypervisor serves the doorbell writes and raises the MSI-X vectors of the
+ * peers from the table it shares with the device model, only the config
+ * space and the other registers are emulated here.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include "vmmapi.h"
+#include "pci_core.h"
+#include "log.h"
+
+#define IVSHMEM_VENDOR		0x1af4
+#define IVSHMEM_DEVICE		0x1110
+#define IVSHMEM_REVID		0x01
+
+#define IVSHMEM_REGS_BAR	0
+#define IVSHMEM_MSIX_BAR	1
+#define IVSHMEM_SHM_BAR		2
+
+struct pci_ivshmem_vdev {
+	struct pci_vdev *dev;
+	struct acrn_ivshmem info;
+};
+
+/* attached again each time the guest moves a BAR */
+static int
+pci_ivshmem_attach(struct pci_ivshmem_vdev *ivshmem)
+{
+	struct pci_vdev *dev = ivshmem->dev;
+
+	ivshmem->info.op = ACRN_IVSHMEM_ATTACH;
+	ivshmem->info.shm_gpa = dev->bar[IVSHMEM_SHM_BAR].addr;
+	ivshmem->info.regs_gpa = dev->bar[IVSHMEM_REGS_BAR].addr;
+	ivshmem->info.msix_gpa = dev->bar[IVSHMEM_MSIX_BAR].addr;
+	if (vm_ivshmem(dev->vmctx, &ivshmem->info) != 0) {
+		pr_err("ivshmem: cannot attach to region %u, errno %d\n",
+			ivshmem->info.region_id, errno);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+pci_ivshmem_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct pci_ivshmem_vdev *ivshmem;
+	unsigned long region;
+	char *end;
+
+	if (opts == NULL) {
+		pr_err("ivshmem: no region given\n");
+		return -1;
+	}
+	region = strtoul(opts, &end, 0);
+	if (end == opts || *end != '\0' || region > UINT16_MAX) {
+		pr_err("ivshmem: invalid region %s\n", opts);
+		return -1;
+	}
+
+	ivshmem = calloc(1, sizeof(*ivshmem));
+	if (ivshmem == NULL) {
+		pr_err("ivshmem: cannot allocate the device\n");
+		return -1;
+	}
+	ivshmem->dev = dev;
+	ivshmem->info.op = ACRN_IVSHMEM_QUERY;
+	ivshmem->info.region_id = region;
+	if (vm_ivshmem(ctx, &ivshmem->info) != 0) {
+		pr_err("ivshmem: no region %lu in the hypervisor\n", region);
+		goto fail;
+	}
+
+	pci_set_cfgdata16(dev, PCIR_VENDOR, IVSHMEM_VENDOR);
+	pci_set_cfgdata16(dev, PCIR_DEVICE, IVSHMEM_DEVICE);
+	pci_set_cfgdata8(dev, PCIR_REVID, IVSHMEM_REVID);
+	pci_set_cfgdata8(dev, PCIR_CLASS, PCIC_MEMORY);
+	pci_set_cfgdata8(dev, PCIR_SUBCLASS, PCIS_MEMORY_RAM);
+	pci_set_cfgdata16(dev, PCIR_SUBVEND_0, IVSHMEM_VENDOR);
+	pci_set_cfgdata16(dev, PCIR_SUBDEV_0, IVSHMEM_DEVICE);
+
+	if (pci_emul_alloc_bar(dev, IVSHMEM_REGS_BAR, PCIBAR_MEM32,
+			ACRN_IVSHMEM_REGS_SIZE) != 0 ||
+	    pci_emul_add_msixcap(dev, ACRN_IVSHMEM_VECTORS,
+			IVSHMEM_MSIX_BAR) != 0 ||
+	    pci_emul_alloc_bar(dev, IVSHMEM_SHM_BAR, PCIBAR_MEM64,
+			ivshmem->info.size) != 0) {
+		pr_err("ivshmem: cannot allocate the BARs\n");
+		goto fail;
+	}
+
+	dev->arg = ivshmem;
+	if (pci_ivshmem_attach(ivshmem) != 0) {
+		dev->arg = NULL;
+		goto fail;
+	}
+	pr_notice("ivshmem: region %lu, %lu bytes, IVPosition %u\n", region,
+		ivshmem->info.size, ivshmem->info.ivpos);
+
+	return 0;
+
+fail:
+	free(ivshmem);
+	return -1;
+}
+
+static void
+pci_ivshmem_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct pci_ivshmem_vdev *ivshmem = dev->arg;
+
+	if (ivshmem == NULL)
+		return;
+
+	ivshmem->info.op = ACRN_IVSHMEM_DETACH;
+	if (vm_ivshmem(ctx, &ivshmem->info) != 0)
+		pr_err("ivshmem: cannot detach from region %u\n",
+			ivshmem->info.region_id);
+	free(ivshmem);
+	dev->arg = NULL;
+}
+
+static void
+pci_ivshmem_update_bar_map(struct vmctx *ctx, struct pci_vdev *dev, int idx,
+		uint64_t orig_addr)
+{
+	struct pci_ivshmem_vdev *ivshmem = dev->arg;
+
+	if (ivshmem != NULL)
+		pci_ivshmem_attach(ivshmem);
+}
+
+static void
+pci_ivshmem_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
+		int baridx, uint64_t offset, int size, uint64_t value)
+{
+	/* the doorbell is served by the hypervisor, the rest is read-only */
+	if (baridx == IVSHMEM_MSIX_BAR)
+		pci_emul_msix_twrite(dev, offset, size, value);
+}
+
+static uint64_t
+pci_ivshmem_read(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
+		int baridx, uint64_t offset, int size)
+{
+	struct pci_ivshmem_vdev *ivshmem = dev->arg;
+
+	if (baridx == IVSHMEM_MSIX_BAR)
+		return pci_emul_msix_tread(dev, offset, size);
+
+	if (baridx == IVSHMEM_REGS_BAR && offset == ACRN_IVSHMEM_IVPOSITION &&
+	    size == 4)
+		return ivshmem->info.ivpos;
+
+	/* legacy interrupt mask and status, and the unmapped shared memory */
+	return 0;
+}
+
+struct pci_vdev_ops pci_ops_ivshmem = {
+	.class_name		= "ivshmem",
+	.vdev_init		= pci_ivshmem_init,
+	.vdev_deinit		= pci_ivshmem_deinit,
+	.vdev_update_bar_map	= pci_ivshmem_update_bar_map,
+	.vdev_barwrite		= pci_ivshmem_write,
+	.vdev_barread		= pci_ivshmem_read,
+};
+DEFINE_PCI_DEVTYPE(pci_ops_ivshmem);
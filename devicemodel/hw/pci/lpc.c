@@ -436,6 +436,18 @@ pci_lpc_deinit(struct vmctx *ctx, struct pci_vdev *pi, char *opts)
 	lpc_deinit(ctx);
 }
 
+static void
+pci_lpc_reset(struct vmctx *ctx, struct pci_vdev *pi)
+{
+	int unit;
+
+	/* the PIRQ routing is kept, it matches the ACPI tables */
+	for (unit = 0; unit < LPC_UART_NUM; unit++) {
+		if (lpc_uart_vdev[unit].enabled)
+			uart_warm_reset(lpc_uart_vdev[unit].uart);
+	}
+}
+
 char *
 lpc_pirq_name(int pin)
 {
@@ -471,6 +483,7 @@ struct pci_vdev_ops pci_ops_lpc = {
 	.class_name		= "lpc",
 	.vdev_init		= pci_lpc_init,
 	.vdev_deinit		= pci_lpc_deinit,
+	.vdev_reset		= pci_lpc_reset,
 	.vdev_write_dsdt	= pci_lpc_write_dsdt,
 	.vdev_cfgwrite		= pci_lpc_cfgwrite,
 	.vdev_barwrite		= pci_lpc_write,
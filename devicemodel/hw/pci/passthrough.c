@@ -45,6 +45,7 @@
 #include "pciio.h"
 #include "pci_core.h"
 #include "acpi.h"
+#include "acrn_mngr.h"
 
 #ifndef PCI_COMMAND_INTX_DISABLE
 #define PCI_COMMAND_INTX_DISABLE ((uint16_t)0x400)
@@ -80,6 +81,13 @@ static pthread_mutex_t ref_cnt_mtx = PTHREAD_MUTEX_INITIALIZER;
  */
 static bool no_reset = false;
 
+/* the devices passthru_prepare() reset already, by physical BDF */
+static uint64_t pt_reset_done[(PCI_BUSMAX + 1) * 256 / 64];
+static pthread_mutex_t pt_reset_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/* a file per device a UOS was given since the SOS booted, /run is a tmpfs */
+#define PT_USED_PATH	ACRN_DM_BASE_PATH "/ptdev"
+
 struct mmio_map {
 	uint64_t gpa;
 	uint64_t hpa;
@@ -99,7 +107,9 @@ struct passthru_dev {
 		int		table_size;		/* page aligned size */
 		void		*table_pages;
 		int		table_offset;		/* page aligned */
+		uint64_t	table_gpa;		/* of table_offset */
 		bool		ptirq_allocated;
+		bool		shared;			/* served by the hv */
 	} msix;
 	bool pcie_cap;
 	struct pcisel sel;
@@ -122,6 +132,75 @@ void ptdev_no_reset(bool enable)
 	no_reset = enable;
 }
 
+static void
+pt_reset_set_done(uint16_t bdf)
+{
+	pthread_mutex_lock(&pt_reset_mtx);
+	pt_reset_done[bdf / 64] |= 1UL << (bdf % 64);
+	pthread_mutex_unlock(&pt_reset_mtx);
+}
+
+/* true once per reset passthru_prepare() did */
+static bool
+pt_reset_take_done(uint16_t bdf)
+{
+	bool done;
+
+	pthread_mutex_lock(&pt_reset_mtx);
+	done = (pt_reset_done[bdf / 64] & (1UL << (bdf % 64))) != 0;
+	pt_reset_done[bdf / 64] &= ~(1UL << (bdf % 64));
+	pthread_mutex_unlock(&pt_reset_mtx);
+
+	return done;
+}
+
+static int
+pt_reset_path(char *path, size_t len, int bus, int slot, int func)
+{
+	return snprintf(path, len,
+		"/sys/bus/pci/devices/0000:%02x:%02x.%x/reset",
+		bus, slot, func);
+}
+
+static int
+pt_used_path(char *path, size_t len, int bus, int slot, int func)
+{
+	return snprintf(path, len, PT_USED_PATH "/0000:%02x:%02x.%x",
+		bus, slot, func);
+}
+
+/* The device is as the SOS boot left it, no UOS was given it since */
+static bool
+pt_is_clean(int bus, int slot, int func)
+{
+	char used_path[60];
+
+	pt_used_path(used_path, sizeof(used_path), bus, slot, func);
+	return access(used_path, F_OK) != 0 && errno == ENOENT;
+}
+
+static void
+pt_set_used(int bus, int slot, int func)
+{
+	char used_path[60];
+	int fd;
+
+	if (check_dir(ACRN_DM_BASE_PATH, CHK_CREAT) ||
+	    check_dir(PT_USED_PATH, CHK_CREAT)) {
+		warnx("%s: no %s, ptdevs are reset at each start",
+			__func__, PT_USED_PATH);
+		return;
+	}
+
+	pt_used_path(used_path, sizeof(used_path), bus, slot, func);
+	fd = open(used_path, O_WRONLY | O_CREAT, 0600);
+	if (fd < 0)
+		warnx("%s: failed to create %s, errno %d", __func__,
+			used_path, errno);
+	else
+		close(fd);
+}
+
 static int
 msi_caplen(int msgctrl)
 {
@@ -389,6 +468,37 @@ static inline int ptdev_msix_pba_bar(struct passthru_dev *ptdev)
 	return ptdev->dev->msix.pba_bar;
 }
 
+/*
+ * Let the hypervisor serve the guest accesses to the pages holding the MSI-X
+ * table, or no more if !assign. It emulates the table and passes the rest
+ * of the pages, such as a PBA or doorbell registers sharing them, to the
+ * device, so none of these accesses exit to the device model. Otherwise
+ * they go to passthru_read()/passthru_write().
+ */
+static void
+passthru_share_msix(struct vmctx *ctx, struct passthru_dev *ptdev, bool assign)
+{
+	struct pci_vdev *dev = ptdev->dev;
+	struct acrn_emul_msix msix;
+
+	if (assign == ptdev->msix.shared)
+		return;
+
+	bzero(&msix, sizeof(msix));
+	msix.addr = ptdev->msix.table_gpa;
+	msix.size = ptdev->msix.table_size;
+	msix.virt_bdf = PCI_BDF(dev->bus, dev->slot, dev->func);
+	msix.flags = ACRN_EMUL_MSIX_FLAG_PTDEV;
+	if (!assign)
+		msix.flags |= ACRN_EMUL_MSIX_FLAG_DEASSIGN;
+
+	if (vm_set_emul_msix(ctx, &msix) == 0)
+		ptdev->msix.shared = assign;
+	else if (assign)
+		warnx("MSI-X table pages of %x/%x/%x trap to the device model",
+			ptdev->sel.bus, ptdev->sel.dev, ptdev->sel.func);
+}
+
 static int
 init_msix_table(struct vmctx *ctx, struct passthru_dev *ptdev, uint64_t base)
 {
@@ -450,6 +560,7 @@ init_msix_table(struct vmctx *ctx, struct passthru_dev *ptdev, uint64_t base)
 	}
 	ptdev->msix.table_offset = table_offset;
 	ptdev->msix.table_size = table_size;
+	ptdev->msix.table_gpa = start;
 
 	/* Handle MSI-X vectors:
 	 * request to alloc vector entries of MSI-X.
@@ -467,7 +578,7 @@ init_msix_table(struct vmctx *ctx, struct passthru_dev *ptdev, uint64_t base)
 		return error;
 	}
 	ptdev->msix.ptirq_allocated = true;
-
+	passthru_share_msix(ctx, ptdev, true);
 
 	/* Skip the MSI-X table */
 	base += table_size;
@@ -500,6 +611,8 @@ deinit_msix_table(struct vmctx *ctx, struct passthru_dev *ptdev)
 	uint16_t virt_bdf = PCI_BDF(dev->bus, dev->slot, dev->func);
 	int vector_cnt = dev->msix.table_count;
 
+	passthru_share_msix(ctx, ptdev, false);
+
 	if (ptdev->msix.ptirq_allocated) {
 		printf("ptdev reset msix: 0x%x-%x, vector_cnt=%d.\n",
 				virt_bdf, ptdev->phys_bdf, vector_cnt);
@@ -671,13 +784,12 @@ cfginit(struct vmctx *ctx, struct passthru_dev *ptdev, int bus,
 	 *   UOS reboot
 	 * - refuse to passthrough PCIe dev without any reset capability
 	 */
-	snprintf(reset_path, 40,
-		"/sys/bus/pci/devices/0000:%02x:%02x.%x/reset",
-		bus, slot, func);
+	pt_reset_path(reset_path, sizeof(reset_path), bus, slot, func);
 
 	fd = open(reset_path, O_WRONLY);
 	if (fd >= 0) {
-		if (ptdev->need_reset && write(fd, "1", 1) < 0)
+		if (ptdev->need_reset && !pt_reset_take_done(ptdev->phys_bdf) &&
+		    write(fd, "1", 1) < 0)
 			warnx("reset dev %x/%x/%x failed!\n",
 			      bus, slot, func);
 		close(fd);
@@ -747,6 +859,44 @@ pciaccess_init(void)
 	return 0;	/* success */
 }
 
+/*
+ * The function level or secondary bus reset of the "reset" devices takes
+ * up to seconds, they all go at once ahead of passthru_init(). A device no
+ * UOS was given since the SOS booted needs none.
+ */
+static int
+passthru_prepare(struct vmctx *ctx, char *opts)
+{
+	char reset_path[60];
+	int bus, slot, func, fd, error = 0;
+	char *opt;
+
+	if (opts == NULL)
+		return 0;
+
+	opt = strsep(&opts, ",");
+	if (parse_bdf(opt, &bus, &slot, &func, 16) != 0)
+		return 0;
+
+	while ((opt = strsep(&opts, ",")) != NULL) {
+		if (strncmp(opt, "reset", 5) != 0)
+			continue;
+
+		pt_reset_path(reset_path, sizeof(reset_path), bus, slot, func);
+		fd = open(reset_path, O_WRONLY);
+		if (fd < 0)
+			return 0;
+		if (pt_is_clean(bus, slot, func) || write(fd, "1", 1) == 1)
+			pt_reset_set_done(PCI_BDF(bus, slot, func));
+		else
+			error = -errno;
+		close(fd);
+		break;
+	}
+
+	return error;
+}
+
 /*
  * Passthrough device initialization function:
  * - initialize virtual config space
@@ -797,6 +947,8 @@ passthru_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 			bus, slot, func);
 		goto done;
 	}
+	if (need_reset)
+		pt_set_used(bus, slot, func);
 
 	ptdev = calloc(1, sizeof(struct passthru_dev));
 	if (ptdev == NULL) {
@@ -968,15 +1120,13 @@ passthru_update_bar_map(struct vmctx *ctx, struct pci_vdev *dev,
 		orig_addr + dev->bar[idx].size > PCI_EMUL_MEMLIMIT64)
 		return;
 
-	vm_unmap_ptdev_mmio(ctx, ptdev->sel.bus,
-			ptdev->sel.dev, ptdev->sel.func,
-			orig_addr, ptdev->bar[idx].size,
-			ptdev->bar[idx].addr);
-
-	vm_map_ptdev_mmio(ctx, ptdev->sel.bus,
+	if (vm_remap_ptdev_mmio(ctx, ptdev->sel.bus,
 			ptdev->sel.dev, ptdev->sel.func,
-			dev->bar[idx].addr, ptdev->bar[idx].size,
-			ptdev->bar[idx].addr);
+			orig_addr, dev->bar[idx].addr, ptdev->bar[idx].size,
+			ptdev->bar[idx].addr) != 0)
+		warnx("Failed to move BAR %d of %x/%x/%x to 0x%lx", idx,
+			ptdev->sel.bus, ptdev->sel.dev, ptdev->sel.func,
+			dev->bar[idx].addr);
 }
 
 /* bind pin info for pass-through device */
@@ -1786,6 +1936,7 @@ passthru_write_dsdt(struct pci_vdev *dev)
 
 struct pci_vdev_ops passthru = {
 	.class_name		= "passthru",
+	.vdev_prepare		= passthru_prepare,
 	.vdev_init		= passthru_init,
 	.vdev_deinit		= passthru_deinit,
 	.vdev_cfgwrite		= passthru_cfgwrite,
@@ -10,11 +10,15 @@
 #include <sys/uio.h>
 #include <sys/ioctl.h>
 #include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <errno.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <string.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <linux/vhost.h>
@@ -23,6 +27,7 @@
 #include "pci_core.h"
 #include "irq.h"
 #include "vmmapi.h"
+#include "mevent.h"
 #include "vhost.h"
 
 static int vhost_debug;
@@ -31,6 +36,113 @@ static int vhost_debug;
 	do { if (vhost_debug) printf(LOG_TAG fmt, ##args); } while (0)
 #define WPRINTF(fmt, args...) printf(LOG_TAG fmt, ##args)
 
+/*
+ * vhost-user protocol, see docs/interop/vhost-user.rst of QEMU.
+ */
+#define VHOST_USER_GET_FEATURES		1
+#define VHOST_USER_SET_FEATURES		2
+#define VHOST_USER_SET_OWNER		3
+#define VHOST_USER_RESET_OWNER		4
+#define VHOST_USER_SET_MEM_TABLE	5
+#define VHOST_USER_SET_VRING_NUM	8
+#define VHOST_USER_SET_VRING_ADDR	9
+#define VHOST_USER_SET_VRING_BASE	10
+#define VHOST_USER_GET_VRING_BASE	11
+#define VHOST_USER_SET_VRING_KICK	12
+#define VHOST_USER_SET_VRING_CALL	13
+#define VHOST_USER_GET_PROTOCOL_FEATURES	15
+#define VHOST_USER_SET_PROTOCOL_FEATURES	16
+#define VHOST_USER_SET_VRING_ENABLE	18
+#define VHOST_USER_SET_SLAVE_REQ_FD	21
+#define VHOST_USER_GET_CONFIG		24
+
+#define VHOST_USER_VERSION		0x1
+#define VHOST_USER_REPLY_MASK		(0x1 << 2)
+#define VHOST_USER_NEED_REPLY_MASK	(0x1 << 3)
+
+#define VHOST_USER_F_PROTOCOL_FEATURES	30
+#define VHOST_USER_PROTOCOL_F_REPLY_ACK	3
+#define VHOST_USER_PROTOCOL_F_SLAVE_REQ	5
+#define VHOST_USER_PROTOCOL_F_CONFIG	9
+#define VHOST_USER_PROTOCOL_FEATURES	\
+	((1UL << VHOST_USER_PROTOCOL_F_REPLY_ACK) | \
+	(1UL << VHOST_USER_PROTOCOL_F_SLAVE_REQ) | \
+	(1UL << VHOST_USER_PROTOCOL_F_CONFIG))
+
+#define VHOST_USER_VRING_NOFD_MASK	(0x1 << 8)
+#define VHOST_USER_MEMORY_MAX_NREGIONS	8
+#define VHOST_USER_MAX_CONFIG_SIZE	256
+
+struct vhost_user_memory_region {
+	uint64_t guest_phys_addr;
+	uint64_t memory_size;
+	uint64_t userspace_addr;
+	uint64_t mmap_offset;
+};
+
+struct vhost_user_memory {
+	uint32_t nregions;
+	uint32_t padding;
+	struct vhost_user_memory_region regions[VHOST_USER_MEMORY_MAX_NREGIONS];
+};
+
+struct vhost_user_config {
+	uint32_t offset;
+	uint32_t size;
+	uint32_t flags;
+	uint8_t region[VHOST_USER_MAX_CONFIG_SIZE];
+};
+
+struct vhost_user_msg {
+	uint32_t request;
+	uint32_t flags;
+	uint32_t size;		/* of the payload */
+	union {
+		uint64_t u64;
+		struct vhost_vring_state state;
+		struct vhost_vring_addr addr;
+		struct vhost_user_memory memory;
+		struct vhost_user_config config;
+	} payload;
+} __attribute__((packed));
+
+#define VHOST_USER_HDR_SIZE	offsetof(struct vhost_user_msg, payload)
+
+/*
+ * Transport of the vhost messages: ioctls on a vhost chardev, or
+ * vhost-user messages on a UNIX socket. The vring indexes are the ones in
+ * the vhost_dev.
+ */
+struct vhost_dev_ops {
+	void (*deinit)(struct vhost_dev *vdev);
+	int (*set_mem_table)(struct vhost_dev *vdev);
+	int (*set_vring_addr)(struct vhost_dev *vdev,
+			      struct vhost_vring_addr *addr);
+	int (*set_vring_num)(struct vhost_dev *vdev,
+			     struct vhost_vring_state *ring);
+	int (*set_vring_base)(struct vhost_dev *vdev,
+			      struct vhost_vring_state *ring);
+	int (*get_vring_base)(struct vhost_dev *vdev,
+			      struct vhost_vring_state *ring);
+	int (*set_vring_kick)(struct vhost_dev *vdev,
+			      struct vhost_vring_file *file);
+	int (*set_vring_call)(struct vhost_dev *vdev,
+			      struct vhost_vring_file *file);
+	/* optional */
+	int (*set_vring_enable)(struct vhost_dev *vdev, int idx, bool enable);
+	int (*set_vring_busyloop_timeout)(struct vhost_dev *vdev,
+					  struct vhost_vring_state *s);
+	int (*set_features)(struct vhost_dev *vdev, uint64_t features);
+	int (*get_features)(struct vhost_dev *vdev, uint64_t *features);
+	int (*set_owner)(struct vhost_dev *vdev);
+	int (*reset_device)(struct vhost_dev *vdev);
+	/* optional */
+	int (*net_set_backend)(struct vhost_dev *vdev,
+			       struct vhost_vring_file *file);
+	int (*vsock_set_guest_cid)(struct vhost_dev *vdev, uint64_t cid);
+	int (*vsock_set_running)(struct vhost_dev *vdev, int start);
+};
+
 static inline
 int vhost_kernel_ioctl(struct vhost_dev *vdev,
 		       unsigned long int request,
@@ -46,16 +158,6 @@ int vhost_kernel_ioctl(struct vhost_dev *vdev,
 	return rc;
 }
 
-static void
-vhost_kernel_init(struct vhost_dev *vdev, struct virtio_base *base,
-		  int fd, int vq_idx, uint32_t busyloop_timeout)
-{
-	vdev->base = base;
-	vdev->fd = fd;
-	vdev->vq_idx = vq_idx;
-	vdev->busyloop_timeout = busyloop_timeout;
-}
-
 static void
 vhost_kernel_deinit(struct vhost_dev *vdev)
 {
@@ -69,10 +171,58 @@ vhost_kernel_deinit(struct vhost_dev *vdev)
 }
 
 static int
-vhost_kernel_set_mem_table(struct vhost_dev *vdev,
-			   struct vhost_memory *mem)
+vhost_kernel_set_mem_table(struct vhost_dev *vdev)
 {
-	return vhost_kernel_ioctl(vdev, VHOST_SET_MEM_TABLE, mem);
+	struct vmctx *ctx;
+	struct vhost_memory *mem;
+	uint32_t nregions = 0;
+	int rc;
+
+	ctx = vdev->base->dev->vmctx;
+	if (ctx->lowmem > 0)
+		nregions++;
+	if (ctx->highmem > 0)
+		nregions++;
+
+	mem = calloc(1, sizeof(struct vhost_memory) +
+		sizeof(struct vhost_memory_region) * nregions);
+	if (!mem) {
+		WPRINTF("out of memory\n");
+		return -1;
+	}
+
+	nregions = 0;
+	if (ctx->lowmem > 0) {
+		mem->regions[nregions].guest_phys_addr = (uintptr_t)0;
+		mem->regions[nregions].memory_size = ctx->lowmem;
+		mem->regions[nregions].userspace_addr =
+			(uintptr_t)ctx->baseaddr;
+		DPRINTF("[%d][0x%llx -> 0x%llx, 0x%llx]\n",
+			nregions,
+			mem->regions[nregions].guest_phys_addr,
+			mem->regions[nregions].userspace_addr,
+			mem->regions[nregions].memory_size);
+		nregions++;
+	}
+
+	if (ctx->highmem > 0) {
+		mem->regions[nregions].guest_phys_addr = ctx->highmem_gpa_base;
+		mem->regions[nregions].memory_size = ctx->highmem;
+		mem->regions[nregions].userspace_addr =
+			(uintptr_t)(ctx->baseaddr + ctx->highmem_gpa_base);
+		DPRINTF("[%d][0x%llx -> 0x%llx, 0x%llx]\n",
+			nregions,
+			mem->regions[nregions].guest_phys_addr,
+			mem->regions[nregions].userspace_addr,
+			mem->regions[nregions].memory_size);
+		nregions++;
+	}
+
+	mem->nregions = nregions;
+	mem->padding = 0;
+	rc = vhost_kernel_ioctl(vdev, VHOST_SET_MEM_TABLE, mem);
+	free(mem);
+	return rc;
 }
 
 static int
@@ -161,6 +311,353 @@ vhost_kernel_net_set_backend(struct vhost_dev *vdev,
 	return vhost_kernel_ioctl(vdev, VHOST_NET_SET_BACKEND, file);
 }
 
+static int
+vhost_kernel_vsock_set_guest_cid(struct vhost_dev *vdev, uint64_t cid)
+{
+	return vhost_kernel_ioctl(vdev, VHOST_VSOCK_SET_GUEST_CID, &cid);
+}
+
+static int
+vhost_kernel_vsock_set_running(struct vhost_dev *vdev, int start)
+{
+	return vhost_kernel_ioctl(vdev, VHOST_VSOCK_SET_RUNNING, &start);
+}
+
+static const struct vhost_dev_ops vhost_kernel_ops = {
+	.deinit			= vhost_kernel_deinit,
+	.set_mem_table		= vhost_kernel_set_mem_table,
+	.set_vring_addr		= vhost_kernel_set_vring_addr,
+	.set_vring_num		= vhost_kernel_set_vring_num,
+	.set_vring_base		= vhost_kernel_set_vring_base,
+	.get_vring_base		= vhost_kernel_get_vring_base,
+	.set_vring_kick		= vhost_kernel_set_vring_kick,
+	.set_vring_call		= vhost_kernel_set_vring_call,
+	.set_vring_busyloop_timeout = vhost_kernel_set_vring_busyloop_timeout,
+	.set_features		= vhost_kernel_set_features,
+	.get_features		= vhost_kernel_get_features,
+	.set_owner		= vhost_kernel_set_owner,
+	.reset_device		= vhost_kernel_reset_device,
+	.net_set_backend	= vhost_kernel_net_set_backend,
+	.vsock_set_guest_cid	= vhost_kernel_vsock_set_guest_cid,
+	.vsock_set_running	= vhost_kernel_vsock_set_running,
+};
+
+/*
+ * Send msg with its payload of msg->size bytes and the nfds fds, then
+ * read the reply into msg if the request has one.
+ */
+static int
+vhost_user_xfer(struct vhost_dev *vdev, struct vhost_user_msg *msg,
+		int *fds, int nfds, bool reply)
+{
+	char control[CMSG_SPACE(VHOST_USER_MEMORY_MAX_NREGIONS * sizeof(int))];
+	struct msghdr mh;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	uint32_t request = msg->request;
+	ssize_t rc, len;
+
+	msg->flags = VHOST_USER_VERSION;
+	iov.iov_base = msg;
+	iov.iov_len = VHOST_USER_HDR_SIZE + msg->size;
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	if (nfds > 0) {
+		memset(control, 0, sizeof(control));
+		mh.msg_control = control;
+		mh.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+		cmsg = CMSG_FIRSTHDR(&mh);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+	}
+
+	do {
+		rc = sendmsg(vdev->fd, &mh, MSG_NOSIGNAL);
+	} while (rc < 0 && errno == EINTR);
+	if (rc != (ssize_t)iov.iov_len) {
+		WPRINTF("vhost-user request %u failed, errno = %d\n",
+			request, errno);
+		return -1;
+	}
+
+	if (!reply)
+		return 0;
+
+	len = recv(vdev->fd, msg, VHOST_USER_HDR_SIZE, MSG_WAITALL);
+	if (len != (ssize_t)VHOST_USER_HDR_SIZE || msg->request != request ||
+	    (msg->flags & VHOST_USER_REPLY_MASK) == 0 ||
+	    msg->size > sizeof(msg->payload)) {
+		WPRINTF("vhost-user request %u: bad reply\n", request);
+		return -1;
+	}
+	if (msg->size > 0) {
+		len = recv(vdev->fd, &msg->payload, msg->size, MSG_WAITALL);
+		if (len != (ssize_t)msg->size) {
+			WPRINTF("vhost-user request %u: short reply\n",
+				request);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int
+vhost_user_set_u64(struct vhost_dev *vdev, uint32_t request, uint64_t u64)
+{
+	struct vhost_user_msg msg = {0};
+
+	msg.request = request;
+	msg.size = sizeof(msg.payload.u64);
+	msg.payload.u64 = u64;
+	return vhost_user_xfer(vdev, &msg, NULL, 0, false);
+}
+
+static int
+vhost_user_get_u64(struct vhost_dev *vdev, uint32_t request, uint64_t *u64)
+{
+	struct vhost_user_msg msg = {0};
+
+	msg.request = request;
+	if (vhost_user_xfer(vdev, &msg, NULL, 0, true) < 0 ||
+	    msg.size != sizeof(msg.payload.u64))
+		return -1;
+	*u64 = msg.payload.u64;
+	return 0;
+}
+
+/* The rings are numbered over the whole device on the socket */
+static int
+vhost_user_vring_state(struct vhost_dev *vdev, uint32_t request,
+		       struct vhost_vring_state *ring, bool reply)
+{
+	struct vhost_user_msg msg = {0};
+
+	msg.request = request;
+	msg.size = sizeof(msg.payload.state);
+	msg.payload.state = *ring;
+	msg.payload.state.index += vdev->vq_idx;
+	if (vhost_user_xfer(vdev, &msg, NULL, 0, reply) < 0)
+		return -1;
+	if (reply) {
+		if (msg.size != sizeof(msg.payload.state))
+			return -1;
+		ring->num = msg.payload.state.num;
+	}
+	return 0;
+}
+
+static int
+vhost_user_vring_file(struct vhost_dev *vdev, uint32_t request,
+		      struct vhost_vring_file *file)
+{
+	struct vhost_user_msg msg = {0};
+	int fd = file->fd;
+
+	msg.request = request;
+	msg.size = sizeof(msg.payload.u64);
+	msg.payload.u64 = file->index + vdev->vq_idx;
+	if (fd < 0)
+		msg.payload.u64 |= VHOST_USER_VRING_NOFD_MASK;
+	return vhost_user_xfer(vdev, &msg, &fd, fd < 0 ? 0 : 1, false);
+}
+
+static void
+vhost_user_deinit(struct vhost_dev *vdev)
+{
+	if (vdev->slave_mevp) {
+		mevent_delete_close(vdev->slave_mevp);
+		vdev->slave_mevp = NULL;
+	}
+	vhost_kernel_deinit(vdev);
+	vdev->protocol_features = 0;
+}
+
+/*
+ * The backend maps the hugetlbfs files of the guest memory, the DM
+ * addresses in the table are only used to translate the ring addresses.
+ */
+static int
+vhost_user_set_mem_table(struct vhost_dev *vdev)
+{
+	struct hugetlb_region regions[VHOST_USER_MEMORY_MAX_NREGIONS];
+	struct vhost_user_memory_region *r;
+	struct vhost_user_msg msg = {0};
+	int fds[VHOST_USER_MEMORY_MAX_NREGIONS];
+	int i, n;
+
+	n = hugetlb_get_regions(regions, VHOST_USER_MEMORY_MAX_NREGIONS);
+	if (n <= 0) {
+		WPRINTF("no shareable guest memory\n");
+		return -1;
+	}
+
+	msg.request = VHOST_USER_SET_MEM_TABLE;
+	msg.payload.memory.nregions = n;
+	for (i = 0; i < n; i++) {
+		r = &msg.payload.memory.regions[i];
+		r->guest_phys_addr = regions[i].gpa;
+		r->memory_size = regions[i].len;
+		r->userspace_addr = (uintptr_t)regions[i].hva;
+		r->mmap_offset = regions[i].offset;
+		fds[i] = regions[i].fd;
+		DPRINTF("[%d][0x%lx -> 0x%lx, 0x%lx]\n", i,
+			r->guest_phys_addr, r->userspace_addr,
+			r->memory_size);
+	}
+	msg.size = offsetof(struct vhost_user_memory, regions) +
+		n * sizeof(struct vhost_user_memory_region);
+	return vhost_user_xfer(vdev, &msg, fds, n, false);
+}
+
+static int
+vhost_user_set_vring_addr(struct vhost_dev *vdev,
+			  struct vhost_vring_addr *addr)
+{
+	struct vhost_user_msg msg = {0};
+
+	msg.request = VHOST_USER_SET_VRING_ADDR;
+	msg.size = sizeof(msg.payload.addr);
+	msg.payload.addr = *addr;
+	msg.payload.addr.index += vdev->vq_idx;
+	return vhost_user_xfer(vdev, &msg, NULL, 0, false);
+}
+
+static int
+vhost_user_set_vring_num(struct vhost_dev *vdev,
+			 struct vhost_vring_state *ring)
+{
+	return vhost_user_vring_state(vdev, VHOST_USER_SET_VRING_NUM,
+				      ring, false);
+}
+
+static int
+vhost_user_set_vring_base(struct vhost_dev *vdev,
+			  struct vhost_vring_state *ring)
+{
+	return vhost_user_vring_state(vdev, VHOST_USER_SET_VRING_BASE,
+				      ring, false);
+}
+
+/* This also stops the ring in the backend */
+static int
+vhost_user_get_vring_base(struct vhost_dev *vdev,
+			  struct vhost_vring_state *ring)
+{
+	return vhost_user_vring_state(vdev, VHOST_USER_GET_VRING_BASE,
+				      ring, true);
+}
+
+static int
+vhost_user_set_vring_kick(struct vhost_dev *vdev,
+			  struct vhost_vring_file *file)
+{
+	return vhost_user_vring_file(vdev, VHOST_USER_SET_VRING_KICK, file);
+}
+
+static int
+vhost_user_set_vring_call(struct vhost_dev *vdev,
+			  struct vhost_vring_file *file)
+{
+	return vhost_user_vring_file(vdev, VHOST_USER_SET_VRING_CALL, file);
+}
+
+/*
+ * With VHOST_USER_F_PROTOCOL_FEATURES the rings start disabled, without
+ * it they are enabled by the kick fd.
+ */
+static int
+vhost_user_set_vring_enable(struct vhost_dev *vdev, int idx, bool enable)
+{
+	struct vhost_vring_state ring;
+
+	if ((vdev->vhost_ext_features &
+	     (1UL << VHOST_USER_F_PROTOCOL_FEATURES)) == 0)
+		return 0;
+
+	ring.index = idx;
+	ring.num = enable;
+	return vhost_user_vring_state(vdev, VHOST_USER_SET_VRING_ENABLE,
+				      &ring, false);
+}
+
+static int
+vhost_user_set_features(struct vhost_dev *vdev, uint64_t features)
+{
+	return vhost_user_set_u64(vdev, VHOST_USER_SET_FEATURES, features);
+}
+
+static int
+vhost_user_get_features(struct vhost_dev *vdev, uint64_t *features)
+{
+	return vhost_user_get_u64(vdev, VHOST_USER_GET_FEATURES, features);
+}
+
+static int
+vhost_user_set_owner(struct vhost_dev *vdev)
+{
+	struct vhost_user_msg msg = {0};
+
+	msg.request = VHOST_USER_SET_OWNER;
+	return vhost_user_xfer(vdev, &msg, NULL, 0, false);
+}
+
+static int
+vhost_user_reset_device(struct vhost_dev *vdev)
+{
+	struct vhost_user_msg msg = {0};
+
+	msg.request = VHOST_USER_RESET_OWNER;
+	return vhost_user_xfer(vdev, &msg, NULL, 0, false);
+}
+
+static const struct vhost_dev_ops vhost_user_ops = {
+	.deinit			= vhost_user_deinit,
+	.set_mem_table		= vhost_user_set_mem_table,
+	.set_vring_addr		= vhost_user_set_vring_addr,
+	.set_vring_num		= vhost_user_set_vring_num,
+	.set_vring_base		= vhost_user_set_vring_base,
+	.get_vring_base		= vhost_user_get_vring_base,
+	.set_vring_kick		= vhost_user_set_vring_kick,
+	.set_vring_call		= vhost_user_set_vring_call,
+	.set_vring_enable	= vhost_user_set_vring_enable,
+	.set_features		= vhost_user_set_features,
+	.get_features		= vhost_user_get_features,
+	.set_owner		= vhost_user_set_owner,
+	.reset_device		= vhost_user_reset_device,
+};
+
+static int
+vhost_user_connect(const char *path)
+{
+	struct sockaddr_un un;
+	int fd;
+
+	if (strnlen(path, sizeof(un.sun_path)) >= sizeof(un.sun_path)) {
+		WPRINTF("vhost-user socket path too long: %s\n", path);
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		WPRINTF("vhost-user socket failed, errno = %d\n", errno);
+		return -1;
+	}
+
+	memset(&un, 0, sizeof(un));
+	un.sun_family = AF_UNIX;
+	strncpy(un.sun_path, path, sizeof(un.sun_path) - 1);
+	if (connect(fd, (struct sockaddr *)&un, sizeof(un)) < 0) {
+		WPRINTF("connect to vhost-user %s failed, errno = %d\n",
+			path, errno);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
 static int
 vhost_eventfd_test_and_clear(int fd)
 {
@@ -240,11 +737,23 @@ vhost_vq_register_eventfd(struct vhost_dev *vdev,
 			ACRN_IOEVENTFD_FLAG_PIO);
 	}
 
+	/*
+	 * Ask the VHM to back the kick with a hypervisor doorbell, so that the
+	 * vcpu doesn't wait for the ioreq completion. Fall back to the plain
+	 * ioeventfd if it cannot.
+	 */
+	if (is_register)
+		ioeventfd.flags |= ACRN_IOEVENTFD_FLAG_DOORBELL;
+
 	ioeventfd.fd = vq->kick_fd;
 	DPRINTF("[ioeventfd: %d][0x%lx@%d][flags: 0x%x][data: 0x%lx]\n",
 		ioeventfd.fd, ioeventfd.addr, ioeventfd.len,
 		ioeventfd.flags, ioeventfd.data);
 	rc = vm_ioeventfd(vdev->base->dev->vmctx, &ioeventfd);
+	if (rc < 0 && is_register && (errno == EINVAL || errno == ENOSPC)) {
+		ioeventfd.flags &= ~ACRN_IOEVENTFD_FLAG_DOORBELL;
+		rc = vm_ioeventfd(vdev->base->dev->vmctx, &ioeventfd);
+	}
 	if (rc < 0) {
 		WPRINTF("vm_ioeventfd failed rc = %d, errno = %d\n",
 			rc, errno);
@@ -299,6 +808,7 @@ vhost_vq_init(struct vhost_dev *vdev, int idx)
 
 	vq->idx = idx;
 	vq->dev = vdev;
+	vq->busyloop_timeout = vdev->busyloop_timeout;
 	return 0;
 
 fail_call:
@@ -364,6 +874,10 @@ vhost_vq_start(struct vhost_dev *vdev, int idx)
 	vqi = &vdev->base->queues[q_idx];
 	vq = &vdev->vqs[idx];
 
+	/* a queue not set up by the guest, e.g. fewer queues than offered */
+	if (!vq_ring_ready(vqi))
+		return 0;
+
 	/* clear kick_fd and call_fd */
 	vhost_eventfd_test_and_clear(vq->kick_fd);
 	vhost_eventfd_test_and_clear(vq->call_fd);
@@ -378,7 +892,7 @@ vhost_vq_start(struct vhost_dev *vdev, int idx)
 	/* VHOST_SET_VRING_NUM */
 	ring.index = idx;
 	ring.num = vqi->qsize;
-	rc = vhost_kernel_set_vring_num(vdev, &ring);
+	rc = vdev->ops->set_vring_num(vdev, &ring);
 	if (rc < 0) {
 		WPRINTF("set_vring_num failed: idx = %d\n", idx);
 		goto fail_vring;
@@ -386,7 +900,7 @@ vhost_vq_start(struct vhost_dev *vdev, int idx)
 
 	/* VHOST_SET_VRING_BASE */
 	ring.num = vqi->last_avail;
-	rc = vhost_kernel_set_vring_base(vdev, &ring);
+	rc = vdev->ops->set_vring_base(vdev, &ring);
 	if (rc < 0) {
 		WPRINTF("set_vring_base failed: idx = %d, last_avail = %d\n",
 			idx, vqi->last_avail);
@@ -400,7 +914,7 @@ vhost_vq_start(struct vhost_dev *vdev, int idx)
 	addr.used_user_addr = (uintptr_t)vqi->used;
 	addr.log_guest_addr = (uintptr_t)NULL;
 	addr.flags = 0;
-	rc = vhost_kernel_set_vring_addr(vdev, &addr);
+	rc = vdev->ops->set_vring_addr(vdev, &addr);
 	if (rc < 0) {
 		WPRINTF("set_vring_addr failed: idx = %d\n", idx);
 		goto fail_vring;
@@ -409,7 +923,7 @@ vhost_vq_start(struct vhost_dev *vdev, int idx)
 	/* VHOST_SET_VRING_CALL */
 	file.index = idx;
 	file.fd = vq->call_fd;
-	rc = vhost_kernel_set_vring_call(vdev, &file);
+	rc = vdev->ops->set_vring_call(vdev, &file);
 	if (rc < 0) {
 		WPRINTF("set_vring_call failed\n");
 		goto fail_vring;
@@ -418,18 +932,30 @@ vhost_vq_start(struct vhost_dev *vdev, int idx)
 	/* VHOST_SET_VRING_KICK */
 	file.index = idx;
 	file.fd = vq->kick_fd;
-	rc = vhost_kernel_set_vring_kick(vdev, &file);
+	rc = vdev->ops->set_vring_kick(vdev, &file);
 	if (rc < 0) {
 		WPRINTF("set_vring_kick failed: idx = %d", idx);
 		goto fail_vring_kick;
 	}
 
+	if (vdev->ops->set_vring_enable) {
+		rc = vdev->ops->set_vring_enable(vdev, idx, true);
+		if (rc < 0) {
+			WPRINTF("set_vring_enable failed: idx = %d\n", idx);
+			goto fail_vring_enable;
+		}
+	}
+
 	return 0;
 
+fail_vring_enable:
+	file.index = idx;
+	file.fd = -1;
+	vdev->ops->set_vring_kick(vdev, &file);
 fail_vring_kick:
 	file.index = idx;
 	file.fd = -1;
-	vhost_kernel_set_vring_call(vdev, &file);
+	vdev->ops->set_vring_call(vdev, &file);
 fail_vring:
 	vhost_vq_register_eventfd(vdev, idx, false);
 fail:
@@ -458,19 +984,24 @@ vhost_vq_stop(struct vhost_dev *vdev, int idx)
 		return -1;
 	}
 	vqi = &vdev->base->queues[q_idx];
+	if (!vq_ring_ready(vqi))
+		return 0;
+
+	if (vdev->ops->set_vring_enable)
+		vdev->ops->set_vring_enable(vdev, idx, false);
 
 	file.index = idx;
 	file.fd = -1;
 
 	/* VHOST_SET_VRING_KICK */
-	vhost_kernel_set_vring_kick(vdev, &file);
+	vdev->ops->set_vring_kick(vdev, &file);
 
 	/* VHOST_SET_VRING_CALL */
-	vhost_kernel_set_vring_call(vdev, &file);
+	vdev->ops->set_vring_call(vdev, &file);
 
 	/* VHOST_GET_VRING_BASE */
 	ring.index = idx;
-	rc = vhost_kernel_get_vring_base(vdev, &ring);
+	rc = vdev->ops->get_vring_base(vdev, &ring);
 	if (rc < 0)
 		WPRINTF("get_vring_base failed: idx = %d", idx);
 	else
@@ -488,63 +1019,76 @@ vhost_vq_stop(struct vhost_dev *vdev, int idx)
 }
 
 static int
-vhost_set_mem_table(struct vhost_dev *vdev)
+vhost_dev_check(struct vhost_dev *vdev, struct virtio_base *base, int vq_idx)
 {
-	struct vmctx *ctx;
-	struct vhost_memory *mem;
-	uint32_t nregions = 0;
-	int rc;
-
-	ctx = vdev->base->dev->vmctx;
-	if (ctx->lowmem > 0)
-		nregions++;
-	if (ctx->highmem > 0)
-		nregions++;
-
-	mem = calloc(1, sizeof(struct vhost_memory) +
-		sizeof(struct vhost_memory_region) * nregions);
-	if (!mem) {
-		WPRINTF("out of memory\n");
+	if (!base || !base->queues || !base->vops) {
+		WPRINTF("virtio_base is not initialized\n");
 		return -1;
 	}
 
-	nregions = 0;
-	if (ctx->lowmem > 0) {
-		mem->regions[nregions].guest_phys_addr = (uintptr_t)0;
-		mem->regions[nregions].memory_size = ctx->lowmem;
-		mem->regions[nregions].userspace_addr =
-			(uintptr_t)ctx->baseaddr;
-		DPRINTF("[%d][0x%llx -> 0x%llx, 0x%llx]\n",
-			nregions,
-			mem->regions[nregions].guest_phys_addr,
-			mem->regions[nregions].userspace_addr,
-			mem->regions[nregions].memory_size);
-		nregions++;
+	if (!vdev->vqs || vdev->nvqs == 0) {
+		WPRINTF("virtqueue is not initialized\n");
+		return -1;
 	}
 
-	if (ctx->highmem > 0) {
-		mem->regions[nregions].guest_phys_addr = ctx->highmem_gpa_base;
-		mem->regions[nregions].memory_size = ctx->highmem;
-		mem->regions[nregions].userspace_addr =
-			(uintptr_t)(ctx->baseaddr + ctx->highmem_gpa_base);
-		DPRINTF("[%d][0x%llx -> 0x%llx, 0x%llx]\n",
-			nregions,
-			mem->regions[nregions].guest_phys_addr,
-			mem->regions[nregions].userspace_addr,
-			mem->regions[nregions].memory_size);
-		nregions++;
+	if (vq_idx + vdev->nvqs > base->vops->nvq) {
+		WPRINTF("invalid vq_idx: %d\n", vq_idx);
+		return -1;
 	}
+	return 0;
+}
 
-	mem->nregions = nregions;
-	mem->padding = 0;
-	rc = vhost_kernel_set_mem_table(vdev, mem);
-	free(mem);
+static int
+vhost_dev_setup(struct vhost_dev *vdev,
+		const struct vhost_dev_ops *ops,
+		struct virtio_base *base,
+		int fd,
+		int vq_idx,
+		uint64_t vhost_features,
+		uint64_t vhost_ext_features,
+		uint32_t busyloop_timeout)
+{
+	uint64_t features;
+	int i, rc;
+
+	vdev->ops = ops;
+	vdev->base = base;
+	vdev->fd = fd;
+	vdev->vq_idx = vq_idx;
+	vdev->busyloop_timeout = busyloop_timeout;
+
+	rc = vdev->ops->get_features(vdev, &features);
 	if (rc < 0) {
-		WPRINTF("set_mem_table failed\n");
-		return -1;
+		WPRINTF("vhost_get_features failed\n");
+		goto fail;
+	}
+
+	for (i = 0; i < vdev->nvqs; i++) {
+		rc = vhost_vq_init(vdev, i);
+		if (rc < 0)
+			goto fail;
 	}
 
+	/* specific backend features to vhost */
+	vdev->vhost_ext_features = vhost_ext_features & features;
+
+	/* features supported by vhost */
+	vdev->vhost_features = vhost_features & features;
+
+	/*
+	 * If the features bits are not supported by either vhost kernel
+	 * mediator or configuration of device model(specified by
+	 * vhost_features), they should be disabled in device_caps,
+	 * which expose as virtio host_features for virtio FE driver.
+	 */
+	vdev->base->device_caps &= ~(vhost_features ^ features);
+	vdev->started = false;
+
 	return 0;
+
+fail:
+	vhost_dev_deinit(vdev);
+	return -1;
 }
 
 /**
@@ -571,60 +1115,229 @@ vhost_dev_init(struct vhost_dev *vdev,
 	       uint64_t vhost_features,
 	       uint64_t vhost_ext_features,
 	       uint32_t busyloop_timeout)
+{
+	if (vhost_dev_check(vdev, base, vq_idx) < 0)
+		return -1;
+
+	return vhost_dev_setup(vdev, &vhost_kernel_ops, base, fd, vq_idx,
+			       vhost_features, vhost_ext_features,
+			       busyloop_timeout);
+}
+
+/**
+ * @brief vhost_dev initialization with a vhost-user backend.
+ *
+ * Same as vhost_dev_init(), the vhost messages go to the vhost-user
+ * backend listening on the UNIX socket at path, e.g. a DPDK or SPDK
+ * process. The backend maps the guest memory from its hugetlbfs files,
+ * and is kicked and calls the guest through the eventfds of the rings.
+ *
+ * @param vdev Pointer to struct vhost_dev.
+ * @param base Pointer to struct virtio_base.
+ * @param path Path of the socket of the backend.
+ * @param vq_idx The first virtqueue which would be used by this vhost dev.
+ * @param vhost_features Subset of vhost features which would be enabled.
+ * @param vhost_ext_features Specific vhost internal features to be enabled.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int
+vhost_user_dev_init(struct vhost_dev *vdev,
+		    struct virtio_base *base,
+		    const char *path,
+		    int vq_idx,
+		    uint64_t vhost_features,
+		    uint64_t vhost_ext_features)
 {
 	uint64_t features;
-	int i, rc;
+	int fd;
 
-	/* sanity check */
-	if (!base || !base->queues || !base->vops) {
-		WPRINTF("virtio_base is not initialized\n");
-		goto fail;
-	}
+	if (vhost_dev_check(vdev, base, vq_idx) < 0)
+		return -1;
 
-	if (!vdev->vqs || vdev->nvqs == 0) {
-		WPRINTF("virtqueue is not initialized\n");
-		goto fail;
+	fd = vhost_user_connect(path);
+	if (fd < 0)
+		return -1;
+
+	vhost_ext_features |= 1UL << VHOST_USER_F_PROTOCOL_FEATURES;
+	if (vhost_dev_setup(vdev, &vhost_user_ops, base, fd, vq_idx,
+			    vhost_features, vhost_ext_features, 0) < 0)
+		return -1;
+
+	vdev->protocol_features = 0;
+	vdev->slave_mevp = NULL;
+	if (vdev->vhost_ext_features &
+	    (1UL << VHOST_USER_F_PROTOCOL_FEATURES)) {
+		if (vhost_user_get_u64(vdev, VHOST_USER_GET_PROTOCOL_FEATURES,
+				       &features) < 0)
+			goto fail;
+		features &= VHOST_USER_PROTOCOL_FEATURES;
+		if (vhost_user_set_u64(vdev, VHOST_USER_SET_PROTOCOL_FEATURES,
+				       features) < 0)
+			goto fail;
+		vdev->protocol_features = features;
 	}
+	DPRINTF("vhost-user %s: features 0x%lx, protocol features 0x%lx\n",
+		path, vdev->vhost_features, vdev->protocol_features);
 
-	if (vq_idx + vdev->nvqs > base->vops->nvq) {
-		WPRINTF("invalid vq_idx: %d\n", vq_idx);
-		goto fail;
+	return 0;
+
+fail:
+	WPRINTF("vhost-user %s: protocol features failed\n", path);
+	vhost_dev_deinit(vdev);
+	return -1;
+}
+
+/**
+ * @brief read the device config space from the vhost-user backend.
+ *
+ * @param vdev Pointer to struct vhost_dev, set up by vhost_user_dev_init().
+ * @param config Buffer for the config space.
+ * @param size Size of the config space, at most 256 bytes.
+ *
+ * @return 0 on success and -1 on failure, e.g. when the backend does not
+ *	   support VHOST_USER_PROTOCOL_F_CONFIG.
+ */
+int
+vhost_user_get_config(struct vhost_dev *vdev, void *config, uint32_t size)
+{
+	struct vhost_user_msg msg = {0};
+
+	if (vdev->ops != &vhost_user_ops ||
+	    (vdev->protocol_features &
+	     (1UL << VHOST_USER_PROTOCOL_F_CONFIG)) == 0 ||
+	    size > VHOST_USER_MAX_CONFIG_SIZE)
+		return -1;
+
+	msg.request = VHOST_USER_GET_CONFIG;
+	msg.size = offsetof(struct vhost_user_config, region) + size;
+	msg.payload.config.offset = 0;
+	msg.payload.config.size = size;
+	if (vhost_user_xfer(vdev, &msg, NULL, 0, true) < 0 ||
+	    msg.size != offsetof(struct vhost_user_config, region) + size ||
+	    msg.payload.config.size != size) {
+		WPRINTF("get_config failed\n");
+		return -1;
 	}
 
-	vhost_kernel_init(vdev, base, fd, vq_idx, busyloop_timeout);
+	memcpy(config, msg.payload.config.region, size);
+	return 0;
+}
 
-	rc = vhost_kernel_get_features(vdev, &features);
-	if (rc < 0) {
-		WPRINTF("vhost_get_features failed\n");
-		goto fail;
+/*
+ * A request of the backend on the slave channel, its fds are closed once
+ * the handler returns. The backend asks for the result of the handler
+ * with VHOST_USER_NEED_REPLY_MASK.
+ */
+static void
+vhost_user_slave_read(int fd, enum ev_type t, void *arg)
+{
+	char control[CMSG_SPACE(VHOST_USER_MEMORY_MAX_NREGIONS * sizeof(int))];
+	struct vhost_dev *vdev = arg;
+	struct vhost_user_msg msg;
+	int fds[VHOST_USER_MEMORY_MAX_NREGIONS];
+	struct msghdr mh;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	uint64_t result;
+	ssize_t len;
+	int i, nfds = 0;
+
+	iov.iov_base = &msg;
+	iov.iov_len = VHOST_USER_HDR_SIZE;
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = control;
+	mh.msg_controllen = sizeof(control);
+	do {
+		len = recvmsg(fd, &mh, MSG_CMSG_CLOEXEC);
+	} while (len < 0 && errno == EINTR);
+
+	for (cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_RIGHTS) {
+			nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+		}
 	}
 
-	for (i = 0; i < vdev->nvqs; i++) {
-		rc = vhost_vq_init(vdev, i);
-		if (rc < 0)
-			goto fail;
+	if (len != (ssize_t)VHOST_USER_HDR_SIZE ||
+	    msg.size > sizeof(msg.payload) ||
+	    (msg.size > 0 &&
+	     recv(fd, &msg.payload, msg.size, MSG_WAITALL) !=
+	     (ssize_t)msg.size)) {
+		WPRINTF("vhost-user slave channel closed\n");
+		mevent_delete_close(vdev->slave_mevp);
+		vdev->slave_mevp = NULL;
+		goto out;
 	}
 
-	/* specific backend features to vhost */
-	vdev->vhost_ext_features = vhost_ext_features & features;
+	result = vdev->slave_fn(vdev->slave_arg, msg.request, &msg.payload,
+				msg.size, fds, nfds);
+	if (msg.flags & VHOST_USER_NEED_REPLY_MASK) {
+		msg.flags = VHOST_USER_VERSION | VHOST_USER_REPLY_MASK;
+		msg.size = sizeof(msg.payload.u64);
+		msg.payload.u64 = result;
+		if (send(fd, &msg, VHOST_USER_HDR_SIZE + msg.size,
+			 MSG_NOSIGNAL) < 0)
+			WPRINTF("vhost-user slave request %u: no reply, "
+				"errno = %d\n", msg.request, errno);
+	}
 
-	/* features supported by vhost */
-	vdev->vhost_features = vhost_features & features;
+out:
+	for (i = 0; i < nfds; i++)
+		close(fds[i]);
+}
 
-	/*
-	 * If the features bits are not supported by either vhost kernel
-	 * mediator or configuration of device model(specified by
-	 * vhost_features), they should be disabled in device_caps,
-	 * which expose as virtio host_features for virtio FE driver.
-	 */
-	vdev->base->device_caps &= ~(vhost_features ^ features);
-	vdev->started = false;
+/**
+ * @brief serve the requests of the vhost-user backend.
+ *
+ * Give the backend the slave channel of VHOST_USER_PROTOCOL_F_SLAVE_REQ,
+ * its requests are passed to fn in the mevent thread.
+ *
+ * @param vdev Pointer to struct vhost_dev, set up by vhost_user_dev_init().
+ * @param fn Handler of the requests, returns 0 on success.
+ * @param arg Argument of fn.
+ *
+ * @return 0 on success and -1 on failure, e.g. when the backend does not
+ *	   support VHOST_USER_PROTOCOL_F_SLAVE_REQ.
+ */
+int
+vhost_user_set_slave_handler(struct vhost_dev *vdev, vhost_user_slave_fn fn,
+			     void *arg)
+{
+	struct vhost_user_msg msg = {0};
+	int sv[2];
 
-	return 0;
+	if (vdev->ops != &vhost_user_ops || vdev->slave_mevp ||
+	    (vdev->protocol_features &
+	     (1UL << VHOST_USER_PROTOCOL_F_SLAVE_REQ)) == 0)
+		return -1;
 
-fail:
-	vhost_dev_deinit(vdev);
-	return -1;
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+		return -1;
+
+	vdev->slave_fn = fn;
+	vdev->slave_arg = arg;
+	vdev->slave_mevp = mevent_add(sv[0], EVF_READ, vhost_user_slave_read,
+				      vdev, NULL, NULL);
+	if (!vdev->slave_mevp) {
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	}
+
+	msg.request = VHOST_USER_SET_SLAVE_REQ_FD;
+	if (vhost_user_xfer(vdev, &msg, &sv[1], 1, false) < 0) {
+		mevent_delete_close(vdev->slave_mevp);
+		vdev->slave_mevp = NULL;
+		close(sv[1]);
+		return -1;
+	}
+
+	close(sv[1]);
+	return 0;
 }
 
 /**
@@ -647,7 +1360,7 @@ vhost_dev_deinit(struct vhost_dev *vdev)
 	for (i = 0; i < vdev->nvqs; i++)
 		vhost_vq_deinit(&vdev->vqs[i]);
 
-	vhost_kernel_deinit(vdev);
+	vdev->ops->deinit(vdev);
 
 	return 0;
 }
@@ -688,7 +1401,7 @@ vhost_dev_start(struct vhost_dev *vdev)
 		goto fail;
 	}
 
-	rc = vhost_kernel_set_owner(vdev);
+	rc = vdev->ops->set_owner(vdev);
 	if (rc < 0) {
 		WPRINTF("vhost_set_owner failed\n");
 		goto fail;
@@ -697,7 +1410,7 @@ vhost_dev_start(struct vhost_dev *vdev)
 	/* set vhost internal features */
 	features = (vdev->base->negotiated_caps & vdev->vhost_features) |
 		vdev->vhost_ext_features;
-	rc = vhost_kernel_set_features(vdev, features);
+	rc = vdev->ops->set_features(vdev, features);
 	if (rc < 0) {
 		WPRINTF("set_features failed\n");
 		goto fail;
@@ -705,23 +1418,23 @@ vhost_dev_start(struct vhost_dev *vdev)
 	DPRINTF("set_features: 0x%lx\n", features);
 
 	/* set memory table */
-	rc = vhost_set_mem_table(vdev);
+	rc = vdev->ops->set_mem_table(vdev);
 	if (rc < 0) {
 		WPRINTF("set_mem_table failed\n");
 		goto fail;
 	}
 
 	/* config busyloop timeout */
-	if (vdev->busyloop_timeout) {
-		state.num = vdev->busyloop_timeout;
-		for (i = 0; i < vdev->nvqs; i++) {
-			state.index = i;
-			rc = vhost_kernel_set_vring_busyloop_timeout(vdev,
-				&state);
-			if (rc < 0) {
-				WPRINTF("set_busyloop_timeout failed\n");
-				goto fail;
-			}
+	for (i = 0; i < vdev->nvqs; i++) {
+		if (vdev->vqs[i].busyloop_timeout == 0 ||
+		    !vdev->ops->set_vring_busyloop_timeout)
+			continue;
+		state.index = i;
+		state.num = vdev->vqs[i].busyloop_timeout;
+		rc = vdev->ops->set_vring_busyloop_timeout(vdev, &state);
+		if (rc < 0) {
+			WPRINTF("set_busyloop_timeout failed\n");
+			goto fail;
 		}
 	}
 
@@ -763,7 +1476,7 @@ vhost_dev_stop(struct vhost_dev *vdev)
 	 * 1) resources of the vhost dev are freed
 	 * 2) vhost virtqueues are reset
 	 */
-	rc = vhost_kernel_reset_device(vdev);
+	rc = vdev->ops->reset_device(vdev);
 	if (rc < 0) {
 		WPRINTF("vhost_reset_device failed\n");
 		rc = -1;
@@ -790,10 +1503,13 @@ vhost_net_set_backend(struct vhost_dev *vdev, int backend_fd)
 	struct vhost_vring_file file;
 	int rc, i;
 
+	if (!vdev->ops->net_set_backend)
+		return -1;
+
 	file.fd = backend_fd;
 	for (i = 0; i < vdev->nvqs; i++) {
 		file.index = i;
-		rc = vhost_kernel_net_set_backend(vdev, &file);
+		rc = vdev->ops->net_set_backend(vdev, &file);
 		if (rc < 0)
 			goto fail;
 	}
@@ -803,8 +1519,76 @@ fail:
 	file.fd = -1;
 	while (--i >= 0) {
 		file.index = i;
-		vhost_kernel_net_set_backend(vdev, &file);
+		vdev->ops->net_set_backend(vdev, &file);
 	}
 
 	return -1;
 }
+
+/**
+ * @brief set the context id of the guest to vhost vsock.
+ *
+ * @param vdev Pointer to struct vhost_dev.
+ * @param cid Context id of the guest, 3 or above.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int
+vhost_vsock_set_guest_cid(struct vhost_dev *vdev, uint64_t cid)
+{
+	if (!vdev->ops->vsock_set_guest_cid)
+		return -1;
+
+	return vdev->ops->vsock_set_guest_cid(vdev, cid);
+}
+
+/**
+ * @brief start or stop the data plane of vhost vsock.
+ *
+ * @param vdev Pointer to struct vhost_dev.
+ * @param start 1 to start, 0 to stop.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int
+vhost_vsock_set_running(struct vhost_dev *vdev, int start)
+{
+	if (!vdev->ops->vsock_set_running)
+		return -1;
+
+	return vdev->ops->vsock_set_running(vdev, start);
+}
+
+/**
+ * @brief set the busy loop timeout of a vhost virtqueue.
+ *
+ * @param vdev Pointer to struct vhost_dev.
+ * @param idx Index of the virtqueue in the vhost_dev.
+ * @param timeout Busy loop timeout in us, 0 to disable busy polling.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int
+vhost_vq_set_busyloop_timeout(struct vhost_dev *vdev, int idx,
+			      uint32_t timeout)
+{
+	struct vhost_vring_state state;
+	int rc;
+
+	if (idx < 0 || idx >= vdev->nvqs ||
+	    !vdev->ops->set_vring_busyloop_timeout)
+		return -1;
+
+	if (vdev->started) {
+		state.index = idx;
+		state.num = timeout;
+		rc = vdev->ops->set_vring_busyloop_timeout(vdev, &state);
+		if (rc < 0) {
+			WPRINTF("set_busyloop_timeout failed\n");
+			return -1;
+		}
+	}
+
+	vdev->vqs[idx].busyloop_timeout = timeout;
+	return 0;
+}
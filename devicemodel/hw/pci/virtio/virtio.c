@@ -34,7 +34,10 @@
 #include "dm.h"
 #include "pci_core.h"
 #include "virtio.h"
+#include "vmmapi.h"
 #include "timer.h"
+#include "dm_string.h"
+#include "dm_stats.h"
 #include <atomic.h>
 
 /*
@@ -91,8 +94,10 @@ virtio_poll_timer(void *arg, uint64_t nexp)
 		vq = &base->queues[i];
 		if(!vq_ring_ready(vq))
 			continue;
-		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
-		/* TODO: call notify when necessary */
+		vq_set_used_ring_flags(base, vq);
+		/* only call into the device when the driver has added chains */
+		if (!vq_has_descs(vq))
+			continue;
 		if (vq->notify)
 			(*vq->notify)(DEV_STRUCT(base), vq);
 		else if (vops->qnotify)
@@ -109,6 +114,17 @@ virtio_poll_timer(void *arg, uint64_t nexp)
 	virtio_start_timer(&base->polling_timer, 0, virtio_poll_interval);
 }
 
+static void
+virtio_vq_stats(void *arg, void *rec)
+{
+	struct virtio_vq_info *vq = arg;
+	struct dm_stats_vq *st = rec;
+
+	st->notifies = vq->stat_notifies;
+	st->used = vq->stat_used;
+	st->interrupts = vq->stat_interrupts;
+}
+
 /**
  * @brief Link a virtio_base to its constants, the virtio device,
  * and the PCI emulation.
@@ -127,6 +143,7 @@ virtio_linkup(struct virtio_base *base, struct virtio_ops *vops,
 	      struct virtio_vq_info *queues,
 	      int backend_type)
 {
+	char stats_name[PI_NAMESZ + 16];
 	int i;
 
 	/* base and pci_virtio_dev addresses must match */
@@ -141,9 +158,13 @@ virtio_linkup(struct virtio_base *base, struct virtio_ops *vops,
 	base->backend_type = backend_type;
 
 	base->queues = queues;
+	dm_stats_unregister(dev);
 	for (i = 0; i < vops->nvq; i++) {
 		queues[i].base = base;
 		queues[i].num = i;
+		snprintf(stats_name, sizeof(stats_name), "%s/%d", dev->name, i);
+		dm_stats_register(DM_STATS_TYPE_VQ, stats_name, dev,
+				virtio_vq_stats, &queues[i]);
 	}
 }
 
@@ -187,6 +208,10 @@ virtio_reset_dev(struct virtio_base *base)
 		vq->gpa_used[0] = 0;
 		vq->gpa_used[1] = 0;
 		vq->enabled = 0;
+		free(vq->ndesc);
+		vq->ndesc = NULL;
+		/* a pending coalescing timer finds nothing to signal */
+		atomic_store(&vq->coal_pending, 0);
 	}
 	base->negotiated_caps = 0;
 	base->curq = 0;
@@ -298,6 +323,11 @@ virtio_vq_init(struct virtio_base *base, uint32_t pfn)
 	phys = (uint64_t)pfn << VRING_PAGE_BITS;
 	size = vring_size(vq->qsize, VIRTIO_PCI_VRING_ALIGN);
 	vb = paddr_guest2host(base->dev->vmctx, phys, size);
+	if (vb == NULL) {
+		fprintf(stderr, "%s: queue %d: vring out of guest memory\r\n",
+			base->vops->name, base->curq);
+		return;
+	}
 
 	/* First page(s) are descriptors... */
 	vq->desc = (struct vring_desc *)vb;
@@ -322,6 +352,57 @@ virtio_vq_init(struct virtio_base *base, uint32_t pfn)
 	vq->flags = VQ_ALLOC;
 }
 
+/*
+ * Packed ring flavour of virtio_vq_enable(): the desc, avail and used
+ * addresses are the ones of the descriptor ring, and of the driver and
+ * device event suppression structures.
+ */
+static void
+virtio_vq_enable_packed(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	uint16_t qsz = vq->qsize;
+	uint64_t phys;
+
+	free(vq->ndesc);
+	vq->ndesc = calloc(qsz, sizeof(uint16_t));
+	if (vq->ndesc == NULL) {
+		fprintf(stderr, "%s: queue %d: out of memory\r\n",
+			base->vops->name, vq->num);
+		return;
+	}
+
+	phys = (((uint64_t)vq->gpa_desc[1]) << 32) | vq->gpa_desc[0];
+	vq->pdesc = paddr_guest2host(base->dev->vmctx, phys,
+			qsz * sizeof(struct vring_packed_desc));
+
+	phys = (((uint64_t)vq->gpa_avail[1]) << 32) | vq->gpa_avail[0];
+	vq->driver_event = paddr_guest2host(base->dev->vmctx, phys,
+			sizeof(struct vring_packed_desc_event));
+
+	phys = (((uint64_t)vq->gpa_used[1]) << 32) | vq->gpa_used[0];
+	vq->device_event = paddr_guest2host(base->dev->vmctx, phys,
+			sizeof(struct vring_packed_desc_event));
+
+	if (vq->pdesc == NULL || vq->driver_event == NULL ||
+	    vq->device_event == NULL) {
+		fprintf(stderr, "%s: queue %d: ring out of guest memory\r\n",
+			base->vops->name, vq->num);
+		return;
+	}
+
+	/* Both wrap counters start at 1. */
+	vq->last_avail = 0;
+	vq->avail_wrap = true;
+	vq->used_idx = 0;
+	vq->used_wrap = true;
+	vq->save_used = 0;
+
+	vq->enabled = true;
+
+	mb();
+	vq->flags = VQ_ALLOC | VQ_PACKED;
+}
+
 /*
  * Initialize the currently-selected virtio queue (base->curq).
  * The guest just gave us the gpa of desc array, avail ring and
@@ -340,6 +421,11 @@ virtio_vq_enable(struct virtio_base *base)
 	vq = &base->queues[base->curq];
 	qsz = vq->qsize;
 
+	if (base->negotiated_caps & (1UL << VIRTIO_F_RING_PACKED)) {
+		virtio_vq_enable_packed(base, vq);
+		return;
+	}
+
 	/* descriptors */
 	phys = (((uint64_t)vq->gpa_desc[1]) << 32) | vq->gpa_desc[0];
 	size = qsz * sizeof(struct vring_desc);
@@ -358,6 +444,16 @@ virtio_vq_enable(struct virtio_base *base)
 	vb = paddr_guest2host(base->dev->vmctx, phys, size);
 	vq->used = (struct vring_used *)vb;
 
+	/*
+	 * The rings are checked once here, the per-request paths use them
+	 * without going through paddr_guest2host() again.
+	 */
+	if (vq->desc == NULL || vq->avail == NULL || vq->used == NULL) {
+		fprintf(stderr, "%s: queue %d: ring out of guest memory\r\n",
+			base->vops->name, base->curq);
+		return;
+	}
+
 	/* Start at 0 when we use it. */
 	vq->last_avail = 0;
 	vq->save_used = 0;
@@ -372,100 +468,174 @@ virtio_vq_enable(struct virtio_base *base)
 
 /*
  * Helper inline for vq_getchain(): record the i'th "real"
- * descriptor.
+ * descriptor. The guest buffers are translated with the inline bounds
+ * check of vm_map_gpa_fast(), and each field is read once so that the
+ * guest cannot change the length after the check.
+ *
+ * Returns -1 if the buffer is not in guest memory.
  */
-static inline void
+static inline int
 _vq_record(int i, volatile struct vring_desc *vd, struct vmctx *ctx,
 	   struct iovec *iov, int n_iov, uint16_t *flags) {
+	uint64_t addr;
+	uint32_t len;
 
 	if (i >= n_iov)
-		return;
-	iov[i].iov_base = paddr_guest2host(ctx, vd->addr, vd->len);
-	iov[i].iov_len = vd->len;
+		return 0;
+	addr = vd->addr;
+	len = vd->len;
+	iov[i].iov_base = vm_map_gpa_fast(ctx, addr, len);
+	if (iov[i].iov_base == NULL)
+		return -1;
+	iov[i].iov_len = len;
 	if (flags != NULL)
 		flags[i] = vd->flags;
+	return 0;
 }
 #define	VQ_MAX_DESCRIPTORS	512	/* see below */
 
+/* Same as _vq_record(), for a packed descriptor. */
+static inline int
+_vq_record_packed(int i, const struct vring_packed_desc *vd,
+		  struct vmctx *ctx, struct iovec *iov, int n_iov,
+		  uint16_t *flags) {
+
+	if (i >= n_iov)
+		return 0;
+	iov[i].iov_base = vm_map_gpa_fast(ctx, vd->addr, vd->len);
+	if (iov[i].iov_base == NULL)
+		return -1;
+	iov[i].iov_len = vd->len;
+	if (flags != NULL)
+		flags[i] = vd->flags;
+	return 0;
+}
+
 /*
- * Examine the chain of descriptors starting at the "next one" to
- * make sure that they describe a sensible request.  If so, return
- * the number of "real" descriptors that would be needed/used in
- * acting on this request.  This may be smaller than the number of
- * available descriptors, e.g., if there are two available but
- * they are two separate requests, this just returns 1.  Or, it
- * may be larger: if there are indirect descriptors involved,
- * there may only be one descriptor available but it may be an
- * indirect pointing to eight more.  We return 8 in this case,
- * i.e., we do not count the indirect descriptors, only the "real"
- * ones.
- *
- * Basically, this vets the flags and vd_next field of each
- * descriptor and tells you how many are involved.  Since some may
- * be indirect, this also needs the vmctx (in the pci_vdev
- * at base->dev) so that it can find indirect descriptors.
- *
- * As we process each descriptor, we copy and adjust it (guest to
- * host address wise, also using the vmtctx) into the given iov[]
- * array (of the given size).  If the array overflows, we stop
- * placing values into the array but keep processing descriptors,
- * up to VQ_MAX_DESCRIPTORS, before giving up and returning -1.
- * So you, the caller, must not assume that iov[] is as big as the
- * return value (you can process the same thing twice to allocate
- * a larger iov array if needed, or supply a zero length to find
- * out how much space is needed).
- *
- * If you want to verify the WRITE flag on each descriptor, pass a
- * non-NULL "flags" pointer to an array of "uint16_t" of the same size
- * as n_iov and we'll copy each flags field after unwinding any
- * indirects.
- *
- * If some descriptor(s) are invalid, this prints a diagnostic message
- * and returns -1.  If no descriptors are ready now it simply returns 0.
- *
- * You are assumed to have done a vq_ring_ready() if needed (note
- * that vq_has_descs() does one).
+ * vq_getchain() for the packed ring. Each descriptor is read once into
+ * a local copy, the ring has no separate avail ring and next fields:
+ * a buffer is a run of descriptors flagged NEXT but the last, which
+ * carries the buffer id, or a single INDIRECT one.
  */
-int
-vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
-	    struct iovec *iov, int n_iov, uint16_t *flags)
+static int
+vq_getchain_packed(struct virtio_vq_info *vq, uint16_t *pidx,
+		   struct iovec *iov, int n_iov, uint16_t *flags)
 {
-	int i;
-	u_int ndesc, n_indir;
-	u_int idx, next;
-
-	volatile struct vring_desc *vdir, *vindir, *vp;
-	struct vmctx *ctx;
+	struct vring_packed_desc vd;
+	const struct vring_packed_desc *vindir;
 	struct virtio_base *base;
+	struct vmctx *ctx;
 	const char *name;
+	u_int i, j, n, n_indir;
+	uint16_t idx;
+	bool wrap;
 
 	base = vq->base;
 	name = base->vops->name;
 
-	/*
-	 * Note: it's the responsibility of the guest not to
-	 * update vq->avail->idx until all of the descriptors
-	 * the guest has written are valid (including all their
-	 * next fields and vd_flags).
-	 *
-	 * Compute (last_avail - idx) in integers mod 2**16.  This is
-	 * the number of descriptors the device has made available
-	 * since the last time we updated vq->last_avail.
-	 *
-	 * We just need to do the subtraction as an unsigned int,
-	 * then trim off excess bits.
-	 */
-	idx = vq->last_avail;
-	ndesc = (uint16_t)((u_int)vq->avail->idx - idx);
-	if (ndesc == 0)
+	if (!vq_has_descs(vq))
 		return 0;
-	if (ndesc > vq->qsize) {
-		/* XXX need better way to diagnose issues */
+	/* read the descriptors only after their flags said available */
+	atomic_thread_fence();
+
+	ctx = base->dev->vmctx;
+	idx = vq->last_avail;
+	wrap = vq->avail_wrap;
+	for (i = 0, n = 0; ; ) {
+		vd = vq->pdesc[idx];
+		if (++idx == vq->qsize) {
+			idx = 0;
+			wrap = !wrap;
+		}
+		if (++n > vq->qsize) {
+			fprintf(stderr,
+			    "%s: descriptor chain longer than the ring, "
+			    "driver confused?\r\n",
+			    name);
+			return -1;
+		}
+
+		if ((vd.flags & VRING_DESC_F_INDIRECT) == 0) {
+			if (_vq_record_packed(i, &vd, ctx, iov, n_iov, flags))
+				goto badaddr;
+			if (++i > VQ_MAX_DESCRIPTORS)
+				goto loopy;
+		} else if ((base->device_caps &
+		    (1 << VIRTIO_RING_F_INDIRECT_DESC)) == 0) {
+			fprintf(stderr,
+			    "%s: descriptor has forbidden INDIRECT flag, "
+			    "driver confused?\r\n",
+			    name);
+			return -1;
+		} else {
+			n_indir = vd.len / sizeof(struct vring_packed_desc);
+			if ((vd.len & 0xf) || n_indir == 0) {
+				fprintf(stderr,
+				    "%s: invalid indir len 0x%x, "
+				    "driver confused?\r\n",
+				    name, (u_int)vd.len);
+				return -1;
+			}
+			/* the indirect table is laid out in order */
+			vindir = vm_map_gpa_fast(ctx, vd.addr, vd.len);
+			if (vindir == NULL)
+				goto badaddr;
+			for (j = 0; j < n_indir; j++) {
+				if (_vq_record_packed(i, &vindir[j], ctx, iov,
+						n_iov, flags))
+					goto badaddr;
+				if (++i > VQ_MAX_DESCRIPTORS)
+					goto loopy;
+			}
+			/* an indirect descriptor is the whole buffer */
+			vd.flags &= ~VRING_DESC_F_NEXT;
+		}
+		if ((vd.flags & VRING_DESC_F_NEXT) == 0)
+			break;
+	}
+
+	if (vd.id >= vq->qsize) {
 		fprintf(stderr,
-		    "%s: ndesc (%u) out of range, driver confused?\r\n",
-		    name, (u_int)ndesc);
+		    "%s: buffer id %u out of range, driver confused?\r\n",
+		    name, (u_int)vd.id);
 		return -1;
 	}
+	*pidx = vd.id;
+	vq->ndesc[vd.id] = n;
+	vq->last_avail = idx;
+	vq->avail_wrap = wrap;
+	return i;
+
+badaddr:
+	fprintf(stderr,
+	    "%s: descriptor out of guest memory, driver confused?\r\n",
+	    name);
+	return -1;
+loopy:
+	fprintf(stderr,
+	    "%s: descriptor loop? count > %d - driver confused?\r\n",
+	    name, i);
+	return -1;
+}
+
+/*
+ * Walk the split ring chain starting at descriptor next, for
+ * vq_getchain() and vq_getchains().
+ */
+static int
+vq_walkchain(struct virtio_vq_info *vq, u_int next,
+	     struct iovec *iov, int n_iov, uint16_t *flags)
+{
+	int i;
+	u_int n_indir;
+
+	volatile struct vring_desc *vdir, *vindir, *vp;
+	struct vmctx *ctx;
+	struct virtio_base *base;
+	const char *name;
+
+	base = vq->base;
+	name = base->vops->name;
 
 	/*
 	 * Now count/parse "involved" descriptors starting from
@@ -476,8 +646,6 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 	 * index, but we just abort if the count gets excessive.
 	 */
 	ctx = base->dev->vmctx;
-	*pidx = next = vq->avail->ring[idx & (vq->qsize - 1)];
-	vq->last_avail++;
 	for (i = 0; i < VQ_MAX_DESCRIPTORS; next = vdir->next) {
 		if (next >= vq->qsize) {
 			fprintf(stderr,
@@ -488,7 +656,8 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 		}
 		vdir = &vq->desc[next];
 		if ((vdir->flags & VRING_DESC_F_INDIRECT) == 0) {
-			_vq_record(i, vdir, ctx, iov, n_iov, flags);
+			if (_vq_record(i, vdir, ctx, iov, n_iov, flags))
+				goto badaddr;
 			i++;
 		} else if ((base->device_caps &
 		    (1 << VIRTIO_RING_F_INDIRECT_DESC)) == 0) {
@@ -506,8 +675,10 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 				    name, (u_int)vdir->len);
 				return -1;
 			}
-			vindir = paddr_guest2host(ctx,
-			    vdir->addr, vdir->len);
+			vindir = vm_map_gpa_fast(ctx,
+			    vdir->addr, n_indir * sizeof(struct vring_desc));
+			if (vindir == NULL)
+				goto badaddr;
 			/*
 			 * Indirects start at the 0th, then follow
 			 * their own embedded "next"s until those run
@@ -525,7 +696,8 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 					    name);
 					return -1;
 				}
-				_vq_record(i, vp, ctx, iov, n_iov, flags);
+				if (_vq_record(i, vp, ctx, iov, n_iov, flags))
+					goto badaddr;
 				if (++i > VQ_MAX_DESCRIPTORS)
 					goto loopy;
 				if ((vp->flags & VRING_DESC_F_NEXT) == 0)
@@ -543,6 +715,11 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 		if ((vdir->flags & VRING_DESC_F_NEXT) == 0)
 			return i;
 	}
+badaddr:
+	fprintf(stderr,
+	    "%s: descriptor out of guest memory, driver confused?\r\n",
+	    name);
+	return -1;
 loopy:
 	fprintf(stderr,
 	    "%s: descriptor loop? count > %d - driver confused?\r\n",
@@ -550,6 +727,90 @@ loopy:
 	return -1;
 }
 
+/*
+ * Examine the chain of descriptors starting at the "next one" to
+ * make sure that they describe a sensible request.  If so, return
+ * the number of "real" descriptors that would be needed/used in
+ * acting on this request.  This may be smaller than the number of
+ * available descriptors, e.g., if there are two available but
+ * they are two separate requests, this just returns 1.  Or, it
+ * may be larger: if there are indirect descriptors involved,
+ * there may only be one descriptor available but it may be an
+ * indirect pointing to eight more.  We return 8 in this case,
+ * i.e., we do not count the indirect descriptors, only the "real"
+ * ones.
+ *
+ * Basically, this vets the flags and vd_next field of each
+ * descriptor and tells you how many are involved.  Since some may
+ * be indirect, this also needs the vmctx (in the pci_vdev
+ * at base->dev) so that it can find indirect descriptors.
+ *
+ * As we process each descriptor, we copy and adjust it (guest to
+ * host address wise, also using the vmtctx) into the given iov[]
+ * array (of the given size).  If the array overflows, we stop
+ * placing values into the array but keep processing descriptors,
+ * up to VQ_MAX_DESCRIPTORS, before giving up and returning -1.
+ * So you, the caller, must not assume that iov[] is as big as the
+ * return value (you can process the same thing twice to allocate
+ * a larger iov array if needed, or supply a zero length to find
+ * out how much space is needed).
+ *
+ * If you want to verify the WRITE flag on each descriptor, pass a
+ * non-NULL "flags" pointer to an array of "uint16_t" of the same size
+ * as n_iov and we'll copy each flags field after unwinding any
+ * indirects.
+ *
+ * If some descriptor(s) are invalid, this prints a diagnostic message
+ * and returns -1.  If no descriptors are ready now it simply returns 0.
+ *
+ * You are assumed to have done a vq_ring_ready() if needed (note
+ * that vq_has_descs() does one).
+ */
+int
+vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
+	    struct iovec *iov, int n_iov, uint16_t *flags)
+{
+	u_int ndesc;
+	u_int idx;
+	struct virtio_base *base;
+	const char *name;
+
+	if (vq->flags & VQ_PACKED)
+		return vq_getchain_packed(vq, pidx, iov, n_iov, flags);
+
+	base = vq->base;
+	name = base->vops->name;
+
+	/*
+	 * Note: it's the responsibility of the guest not to
+	 * update vq->avail->idx until all of the descriptors
+	 * the guest has written are valid (including all their
+	 * next fields and vd_flags).
+	 *
+	 * Compute (last_avail - idx) in integers mod 2**16.  This is
+	 * the number of descriptors the device has made available
+	 * since the last time we updated vq->last_avail.
+	 *
+	 * We just need to do the subtraction as an unsigned int,
+	 * then trim off excess bits.
+	 */
+	idx = vq->last_avail;
+	ndesc = (uint16_t)((u_int)vq->avail->idx - idx);
+	if (ndesc == 0)
+		return 0;
+	if (ndesc > vq->qsize) {
+		/* XXX need better way to diagnose issues */
+		fprintf(stderr,
+		    "%s: ndesc (%u) out of range, driver confused?\r\n",
+		    name, (u_int)ndesc);
+		return -1;
+	}
+
+	*pidx = vq->avail->ring[idx & (vq->qsize - 1)];
+	vq->last_avail++;
+	return vq_walkchain(vq, *pidx, iov, n_iov, flags);
+}
+
 /*
  * Return the currently-first request chain back to the available queue.
  *
@@ -559,7 +820,29 @@ loopy:
 void
 vq_retchain(struct virtio_vq_info *vq)
 {
-	vq->last_avail--;
+	uint16_t n, prev;
+
+	if ((vq->flags & VQ_PACKED) == 0) {
+		vq->last_avail--;
+		return;
+	}
+
+	/*
+	 * Step back over the tail of the chain, then over the descriptors
+	 * flagged NEXT before it. The chain before ends with one which is
+	 * not, and so does a used descriptor.
+	 */
+	n = 0;
+	do {
+		if (vq->last_avail == 0) {
+			vq->last_avail = vq->qsize;
+			vq->avail_wrap = !vq->avail_wrap;
+		}
+		vq->last_avail--;
+		prev = (vq->last_avail == 0) ? vq->qsize - 1 :
+			vq->last_avail - 1;
+	} while (++n < vq->qsize &&
+	    (vq->pdesc[prev].flags & VRING_DESC_F_NEXT) != 0);
 }
 
 /*
@@ -575,6 +858,30 @@ vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
 	uint16_t uidx, mask;
 	volatile struct vring_used *vuh;
 	volatile struct vring_used_elem *vue;
+	volatile struct vring_packed_desc *vd;
+
+	vq->stat_used++;
+	if (vq->flags & VQ_PACKED) {
+		/*
+		 * Used descriptors are written in completion order, each
+		 * one then skips the slots of the descriptors of its
+		 * buffer. The flags go last as they hand it to the guest.
+		 */
+		vd = &vq->pdesc[vq->used_idx];
+		vd->id = idx;
+		vd->len = iolen;
+		atomic_thread_fence();
+		vd->flags = vq->used_wrap ?
+			((1 << VRING_PACKED_DESC_F_AVAIL) |
+			 (1 << VRING_PACKED_DESC_F_USED)) : 0;
+
+		vq->used_idx += (idx < vq->qsize) ? vq->ndesc[idx] : 1;
+		if (vq->used_idx >= vq->qsize) {
+			vq->used_idx -= vq->qsize;
+			vq->used_wrap = !vq->used_wrap;
+		}
+		return;
+	}
 
 	/*
 	 * Notes:
@@ -596,6 +903,189 @@ vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
 	vuh->idx = uidx;
 }
 
+/*
+ * Get up to nchains request chains at once. On the split ring the avail
+ * index is read once for the whole batch. See vq_getchains() in virtio.h.
+ */
+int
+vq_getchains(struct virtio_vq_info *vq, struct vq_chain *chains,
+	     int nchains, int n_iov)
+{
+	struct vq_chain *c;
+	u_int ndesc;
+	int i;
+
+	if (vq->flags & VQ_PACKED) {
+		for (i = 0; i < nchains; i++) {
+			c = &chains[i];
+			c->idx = vq->qsize;
+			c->n = vq_getchain_packed(vq, &c->idx, c->iov, n_iov,
+					c->flags);
+			if (c->n == 0)
+				break;
+			if (c->n < 0)
+				return i + 1;
+		}
+		return i;
+	}
+
+	ndesc = (uint16_t)((u_int)vq->avail->idx - vq->last_avail);
+	if (ndesc > vq->qsize) {
+		fprintf(stderr,
+		    "%s: ndesc (%u) out of range, driver confused?\r\n",
+		    vq->base->vops->name, ndesc);
+		return -1;
+	}
+	if (ndesc > nchains)
+		ndesc = nchains;
+	/* the ring entries and descriptors are read after the index */
+	atomic_thread_fence();
+
+	for (i = 0; i < ndesc; i++) {
+		c = &chains[i];
+		c->idx = vq->avail->ring[vq->last_avail & (vq->qsize - 1)];
+		vq->last_avail++;
+		c->n = vq_walkchain(vq, c->idx, c->iov, n_iov, c->flags);
+		if (c->n < 0)
+			return i + 1;
+	}
+	return ndesc;
+}
+
+/*
+ * Return nchains chains to the guest, each with its iolen. The used
+ * index, or the flags of the first used descriptor of the packed ring,
+ * is written once for the batch.
+ */
+void
+vq_relchains(struct virtio_vq_info *vq, struct vq_chain *chains,
+	     int nchains)
+{
+	volatile struct vring_used *vuh;
+	volatile struct vring_used_elem *vue;
+	volatile struct vring_packed_desc *vd, *first;
+	uint16_t uidx, mask, vflags, first_flags;
+	int i;
+
+	if (nchains <= 0)
+		return;
+
+	vq->stat_used += nchains;
+	if ((vq->flags & VQ_PACKED) == 0) {
+		mask = vq->qsize - 1;
+		vuh = vq->used;
+		uidx = vuh->idx;
+		for (i = 0; i < nchains; i++) {
+			vue = &vuh->ring[uidx++ & mask];
+			vue->id = chains[i].idx;
+			vue->len = chains[i].iolen;
+		}
+		atomic_thread_fence();
+		vuh->idx = uidx;
+		return;
+	}
+
+	/*
+	 * The guest takes the used descriptors in ring order, so the
+	 * others stay hidden until the first one gets its flags.
+	 */
+	first = NULL;
+	first_flags = 0;
+	for (i = 0; i < nchains; i++) {
+		vd = &vq->pdesc[vq->used_idx];
+		vd->id = chains[i].idx;
+		vd->len = chains[i].iolen;
+		vflags = vq->used_wrap ?
+			((1 << VRING_PACKED_DESC_F_AVAIL) |
+			 (1 << VRING_PACKED_DESC_F_USED)) : 0;
+		if (first == NULL) {
+			first = vd;
+			first_flags = vflags;
+		} else {
+			vd->flags = vflags;
+		}
+
+		vq->used_idx += (chains[i].idx < vq->qsize) ?
+			vq->ndesc[chains[i].idx] : 1;
+		if (vq->used_idx >= vq->qsize) {
+			vq->used_idx -= vq->qsize;
+			vq->used_wrap = !vq->used_wrap;
+		}
+	}
+	atomic_thread_fence();
+	first->flags = first_flags;
+}
+
+/*
+ * vq_endchains() for the packed ring, the driver event suppression
+ * structure stands for the avail flags and the used event index. The
+ * event offset is a slot with the wrap counter in bit 15, moved into
+ * the index space of old and new like in the split ring.
+ */
+/*
+ * Deliver the interrupt asked for by vq_endchains(), or hold it back for
+ * the coalescing of the queue: nused buffers were just used. Lock-free
+ * against vq_coalesce_timer(), whichever takes coal_pending to 0 signals.
+ */
+static void
+vq_coalesce_intr(struct virtio_vq_info *vq, int intr, uint16_t nused)
+{
+	uint32_t pending, usecs;
+
+	usecs = atomic_load(&vq->coal_usecs);
+	if (usecs == 0) {
+		if (intr)
+			vq_interrupt(vq->base, vq);
+		return;
+	}
+
+	/* once owed, the interrupt is kept until it is delivered */
+	if (!intr && atomic_load(&vq->coal_pending) == 0)
+		return;
+	if (nused == 0)
+		nused = 1;	/* notify on empty */
+
+	pending = atomic_add_fetch(&vq->coal_pending, nused);
+	if (vq->coal_frames != 0 && pending >= vq->coal_frames) {
+		if (atomic_xchg(&vq->coal_pending, 0) != 0)
+			vq_interrupt(vq->base, vq);
+	} else if (pending == nused) {
+		/* the first buffer held back */
+		virtio_start_timer(&vq->coal_timer, usecs / 1000000,
+				   (usecs % 1000000) * 1000);
+	}
+}
+
+static void
+vq_endchains_packed(struct virtio_vq_info *vq, int used_all_avail)
+{
+	struct virtio_base *base = vq->base;
+	uint16_t event_idx, off_wrap, new_idx, old_idx;
+	int intr;
+
+	old_idx = vq->save_used;
+	vq->save_used = new_idx = vq->used_idx;
+	if (used_all_avail &&
+	    (base->negotiated_caps & (1 << VIRTIO_F_NOTIFY_ON_EMPTY)))
+		intr = 1;
+	else if (new_idx == old_idx ||
+	    vq->driver_event->flags == VRING_PACKED_EVENT_FLAG_DISABLE)
+		intr = 0;
+	else if (vq->driver_event->flags == VRING_PACKED_EVENT_FLAG_DESC &&
+	    (base->negotiated_caps & (1 << VIRTIO_RING_F_EVENT_IDX))) {
+		off_wrap = vq->driver_event->off_wrap;
+		event_idx = off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+		if ((off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR) !=
+		    vq->used_wrap)
+			event_idx -= vq->qsize;
+		intr = (uint16_t)(new_idx - event_idx - 1) <
+			(uint16_t)(new_idx - old_idx);
+	} else {
+		intr = 1;
+	}
+	vq_coalesce_intr(vq, intr, new_idx - old_idx);
+}
+
 /*
  * Driver has finished processing "available" chains and calling
  * vq_relchain on each one.  If driver used all the available
@@ -631,6 +1121,10 @@ vq_endchains(struct virtio_vq_info *vq, int used_all_avail)
 	atomic_thread_fence();
 
 	base = vq->base;
+	if (vq->flags & VQ_PACKED) {
+		vq_endchains_packed(vq, used_all_avail);
+		return;
+	}
 	old_idx = vq->save_used;
 	vq->save_used = new_idx = vq->used->idx;
 	if (used_all_avail &&
@@ -648,8 +1142,105 @@ vq_endchains(struct virtio_vq_info *vq, int used_all_avail)
 		intr = new_idx != old_idx &&
 		    !(vq->avail->flags & VRING_AVAIL_F_NO_INTERRUPT);
 	}
-	if (intr)
-		vq_interrupt(base, vq);
+	vq_coalesce_intr(vq, intr, new_idx - old_idx);
+}
+
+static void
+vq_coalesce_timer(void *arg, uint64_t nexp)
+{
+	struct virtio_vq_info *vq = arg;
+
+	if (atomic_xchg(&vq->coal_pending, 0) != 0)
+		vq_interrupt(vq->base, vq);
+}
+
+/**
+ * @brief Set the interrupt coalescing of a virtqueue.
+ *
+ * vq_endchains() then holds its interrupts back until max_frames buffers
+ * are used, or at most max_usecs after the first buffer held back.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param max_frames Used buffers per interrupt, 0 for no limit.
+ * @param max_usecs Max delay of an interrupt in us, 0 turns coalescing off.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int
+vq_set_coalesce(struct virtio_vq_info *vq, uint32_t max_frames,
+		uint32_t max_usecs)
+{
+	/* kept until vq_coalesce_deinit(), a pending flush may still fire */
+	if (max_usecs > 0 && !vq->coal_timer_on) {
+		vq->coal_timer.clockid = CLOCK_MONOTONIC;
+		if (acrn_timer_init(&vq->coal_timer, vq_coalesce_timer, vq))
+			return -1;
+		vq->coal_timer_on = true;
+	}
+
+	vq->coal_frames = max_frames;
+	atomic_store(&vq->coal_usecs, max_usecs);
+
+	/* nothing is held back anymore */
+	if (max_usecs == 0 && atomic_xchg(&vq->coal_pending, 0) != 0)
+		vq_interrupt(vq->base, vq);
+	return 0;
+}
+
+/**
+ * @brief Release the coalescing timer of a virtqueue, on device deinit.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ *
+ * @return None
+ */
+void
+vq_coalesce_deinit(struct virtio_vq_info *vq)
+{
+	vq->coal_usecs = 0;
+	vq->coal_pending = 0;
+	if (vq->coal_timer_on) {
+		acrn_timer_deinit(&vq->coal_timer);
+		vq->coal_timer_on = false;
+	}
+}
+
+/**
+ * @brief Parse a coalescing option "<max frames>/<max usecs>".
+ *
+ * @param str The option value.
+ * @param max_frames Returns the max frames.
+ * @param max_usecs Returns the max usecs.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int
+virtio_parse_coalesce(const char *str, uint32_t *max_frames,
+		      uint32_t *max_usecs)
+{
+	char *end;
+
+	if (dm_strtoui(str, &end, 10, max_frames) || *end != '/' ||
+	    dm_strtoui(end + 1, &end, 10, max_usecs) ||
+	    (*end != '\0' && *end != ','))
+		return -1;
+	return 0;
+}
+
+/**
+ * @brief Helper function for setting used ring flags.
+ *
+ * @param base Pointer to struct virtio_base.
+ * @param vq Pointer to struct virtio_vq_info.
+ *
+ * @return None
+ */
+void vq_set_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	if (vq->flags & VQ_PACKED)
+		vq->device_event->flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+	else
+		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
 }
 
 /**
@@ -659,6 +1250,11 @@ vq_endchains(struct virtio_vq_info *vq, int used_all_avail)
  * For virtio poll mode, in order to avoid trap, we should never really
  * clear used ring flags.
  *
+ * With VIRTIO_RING_F_EVENT_IDX the driver ignores the flags and kicks
+ * once it passes the avail event index, so that is moved to the next
+ * chain as well. In poll mode it is left behind, which keeps the kicks
+ * off the same way.
+ *
  * @param base Pointer to struct virtio_base.
  * @param vq Pointer to struct virtio_vq_info.
  *
@@ -673,7 +1269,19 @@ void vq_clear_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *v
 	if (virtio_poll_enabled && backend_type == BACKEND_VBSU && polling_in_progress == 1)
 		return;
 
+	if (vq->flags & VQ_PACKED) {
+		vq->device_event->flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+		/* publish the flags before the caller rechecks the ring */
+		atomic_thread_fence();
+		return;
+	}
+
 	vq->used->flags &= ~VRING_USED_F_NO_NOTIFY;
+	if (base->negotiated_caps & (1 << VIRTIO_RING_F_EVENT_IDX)) {
+		VQ_AVAIL_EVENT_IDX(vq) = vq->last_avail;
+		/* publish the event index before the caller rechecks avail */
+		atomic_thread_fence();
+	}
 }
 
 struct config_reg {
@@ -964,6 +1572,7 @@ bad:
 			goto done;
 		}
 		vq = &base->queues[value];
+		vq->stat_notifies++;
 		if (vq->notify)
 			(*vq->notify)(DEV_STRUCT(base), vq);
 		else if (vops->qnotify)
@@ -1369,6 +1978,7 @@ virtio_common_cfg_write(struct pci_vdev *dev, uint64_t offset, int size,
 	struct virtio_ops *vops;
 	const struct config_reg *cr;
 	const char *name;
+	uint64_t mask;
 
 	vops = base->vops;
 	name = vops->name;
@@ -1405,10 +2015,12 @@ virtio_common_cfg_write(struct pci_vdev *dev, uint64_t offset, int size,
 		if (base->status & VIRTIO_CONFIG_S_DRIVER_OK)
 			break;
 		if (base->driver_feature_select < 2) {
+			/* keep the other half, written with the other select */
+			mask = 0xffffffffUL << (base->driver_feature_select * 32);
 			value &= 0xffffffff;
-			base->negotiated_caps =
-				(value << (base->driver_feature_select * 32))
-				& base->device_caps;
+			base->negotiated_caps = (base->negotiated_caps & ~mask) |
+				((value << (base->driver_feature_select * 32))
+				& base->device_caps);
 			if (vops->apply_features)
 				(*vops->apply_features)(DEV_STRUCT(base),
 					base->negotiated_caps);
@@ -1597,6 +2209,7 @@ virtio_notify_cfg_write(struct pci_vdev *dev, uint64_t offset, int size,
 	}
 
 	vq = &base->queues[idx];
+	vq->stat_notifies++;
 	if (vq->notify)
 		(*vq->notify)(DEV_STRUCT(base), vq);
 	else if (vops->qnotify)
@@ -1760,6 +2373,7 @@ virtio_pci_modern_pio_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 		pthread_mutex_lock(base->mtx);
 
 	vq = &base->queues[idx];
+	vq->stat_notifies++;
 	if (vq->notify)
 		(*vq->notify)(DEV_STRUCT(base), vq);
 	else if (vops->qnotify)
@@ -1870,6 +2484,32 @@ virtio_pci_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 		base->vops->name, baridx);
 }
 
+/**
+ * @brief Reset the device as if the guest wrote 0 to its status.
+ *
+ * @param ctx Pointer to struct vmctx representing VM context.
+ * @param dev Pointer to struct pci_vdev which emulates a PCI device.
+ *
+ * @return None
+ */
+void
+virtio_pci_reset(struct vmctx *ctx, struct pci_vdev *dev)
+{
+	struct virtio_base *base = dev->arg;
+	struct virtio_ops *vops = base->vops;
+
+	if (base->mtx)
+		pthread_mutex_lock(base->mtx);
+
+	base->status = 0;
+	if (vops->set_status)
+		(*vops->set_status)(DEV_STRUCT(base), 0);
+	(*vops->reset)(DEV_STRUCT(base));
+
+	if (base->mtx)
+		pthread_mutex_unlock(base->mtx);
+}
+
 /**
  * @brief Get the virtio poll parameters
  *
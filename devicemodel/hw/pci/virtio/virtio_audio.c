@@ -41,6 +41,14 @@
  */
 #define VIRTIO_AUDIO_VQ_NUM  4 /*4 currently we use 4 vq, may change later*/
 
+/*
+ * With "batch", the guest driver only kicks, and the back end only
+ * interrupts, at the ring index the other side asks for. Several periods
+ * then go with a single notification instead of one each. The VBS-K back
+ * end has to honour VIRTIO_RING_F_EVENT_IDX, hence not offered by default.
+ */
+#define VIRTIO_AUDIO_S_BATCHCAPS	(1 << VIRTIO_RING_F_EVENT_IDX)
+
 const char *vbs_k_audio_dev_path = "/dev/vbs_k_audio";
 
 static int virtio_audio_debug = 1;
@@ -291,6 +299,11 @@ virtio_audio_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	virt_audio->vbs_k.kstatus = VIRTIO_DEV_INITIAL;
 	virt_audio->vbs_k.audio_fd = -1;
 
+	if (opts != NULL && strcmp(opts, "batch") == 0)
+		virt_audio->base.device_caps = VIRTIO_AUDIO_S_BATCHCAPS;
+	else if (opts != NULL)
+		WPRINTF(("virtio_audio: unknown option %s\n", opts));
+
 	/* init mutex attribute properly */
 	rc = pthread_mutexattr_init(&attr);
 	if (rc)
@@ -0,0 +1,555 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * virtio balloon device emulation.
+ *
+ * The pages given by the guest are tracked at 4K, the guest memory itself is
+ * only released to the hugepage pool when all the pages of a 2M block are in
+ * the balloon: the block is unmapped from the EPT and its hugepage is freed,
+ * see hugetlb_release_range(). The block is allocated and mapped again once
+ * one of its pages is deflated.
+ *
+ * The target size is changed with the monitor:
+ *	acrnctl balloon <vm> slot,target=<MB>
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+#include "dm.h"
+#include "pci_core.h"
+#include "virtio.h"
+#include "vmmapi.h"
+#include "dm_string.h"
+#include "monitor.h"
+
+#define VIRTIO_BALLOON_RINGSZ	64
+#define VIRTIO_BALLOON_MAXSEGS	64
+
+#define VIRTIO_BALLOON_INFLATEQ	0
+#define VIRTIO_BALLOON_DEFLATEQ	1
+#define VIRTIO_BALLOON_STATSQ	2
+#define VIRTIO_BALLOON_MAXQ	3
+
+#define VIRTIO_BALLOON_F_MUST_TELL_HOST	(1 << 0)
+#define VIRTIO_BALLOON_F_STATS_VQ	(1 << 1)
+#define VIRTIO_BALLOON_F_DEFLATE_ON_OOM	(1 << 2)
+
+#define VIRTIO_BALLOON_S_HOSTCAPS	\
+	(VIRTIO_BALLOON_F_MUST_TELL_HOST | VIRTIO_BALLOON_F_STATS_VQ | \
+	 VIRTIO_BALLOON_F_DEFLATE_ON_OOM)
+
+/* the pfns of the queues are always in 4K pages */
+#define VIRTIO_BALLOON_PFN_SHIFT	12
+#define BALLOON_BLOCK_SHIFT		21	/* released in 2M blocks */
+#define BALLOON_BLOCK_SIZE		(1UL << BALLOON_BLOCK_SHIFT)
+#define BALLOON_BLOCK_PAGES		\
+	(1U << (BALLOON_BLOCK_SHIFT - VIRTIO_BALLOON_PFN_SHIFT))
+
+/* memory statistics of the guest */
+#define VIRTIO_BALLOON_S_SWAP_IN	0
+#define VIRTIO_BALLOON_S_SWAP_OUT	1
+#define VIRTIO_BALLOON_S_MAJFLT		2
+#define VIRTIO_BALLOON_S_MINFLT		3
+#define VIRTIO_BALLOON_S_MEMFREE	4
+#define VIRTIO_BALLOON_S_MEMTOT		5
+#define VIRTIO_BALLOON_S_AVAIL		6
+#define VIRTIO_BALLOON_S_CACHES		7
+#define VIRTIO_BALLOON_S_HTLB_PGALLOC	8
+#define VIRTIO_BALLOON_S_HTLB_PGFAIL	9
+#define VIRTIO_BALLOON_S_NR		10
+
+static const char *const virtio_balloon_stat_names[VIRTIO_BALLOON_S_NR] = {
+	"swap_in", "swap_out", "major_faults", "minor_faults", "free_memory",
+	"total_memory", "available_memory", "disk_caches",
+	"hugetlb_allocations", "hugetlb_failures"
+};
+
+struct virtio_balloon_config {
+	uint32_t num_pages;	/* pages the device wants in the balloon */
+	uint32_t actual;	/* pages in the balloon, set by the guest */
+} __attribute__((packed));
+
+struct virtio_balloon_stat {
+	uint16_t tag;
+	uint64_t val;
+} __attribute__((packed));
+
+struct virtio_balloon {
+	struct virtio_base base;
+	struct virtio_vq_info queues[VIRTIO_BALLOON_MAXQ];
+	pthread_mutex_t mtx;
+	struct vmctx *ctx;
+	struct virtio_balloon_config cfg;
+
+	/* guest pages in the balloon, over lowmem and highmem */
+	uint64_t *bitmap;
+	uint16_t *block_pages;	/* pages in the balloon of each 2M block */
+	uint64_t *released;	/* blocks given back to the hugepage pool */
+	size_t npages;
+	size_t released_blocks;
+
+	/* the stats buffer is held until the next request */
+	bool stats_held;
+	uint16_t stats_idx;
+	uint64_t stats[VIRTIO_BALLOON_S_NR];
+	bool stats_valid[VIRTIO_BALLOON_S_NR];
+};
+
+static int virtio_balloon_debug;
+#define DPRINTF(params) do { if (virtio_balloon_debug) printf params; } while (0)
+#define WPRINTF(params) (printf params)
+
+static void virtio_balloon_reset(void *);
+static int virtio_balloon_cfgread(void *, int, int, uint32_t *);
+static int virtio_balloon_cfgwrite(void *, int, int, uint32_t);
+
+static struct virtio_ops virtio_balloon_ops = {
+	"vtballoon",			/* our name */
+	VIRTIO_BALLOON_MAXQ,		/* we support 3 virtqueues */
+	sizeof(struct virtio_balloon_config), /* config reg size */
+	virtio_balloon_reset,		/* reset */
+	NULL,				/* device-wide qnotify */
+	virtio_balloon_cfgread,		/* read virtio config */
+	virtio_balloon_cfgwrite,	/* write virtio config */
+	NULL,				/* apply negotiated features */
+	NULL,				/* called on guest set status */
+};
+
+static bool register_vm_monitor_balloon = false;
+
+static int vm_monitor_balloon(void *arg, char *devargs);
+
+static struct monitor_vm_ops virtio_balloon_monitor_ops = {
+	.balloon = vm_monitor_balloon,
+};
+
+/*
+ * Index of a guest page in the bitmap, the highmem follows the lowmem.
+ * Returns -1 for the pages out of the guest memory.
+ */
+static ssize_t
+virtio_balloon_page_index(struct virtio_balloon *bl, uint64_t gpa)
+{
+	struct vmctx *ctx = bl->ctx;
+
+	if (gpa < ctx->lowmem)
+		return gpa >> VIRTIO_BALLOON_PFN_SHIFT;
+	if (gpa >= ctx->highmem_gpa_base &&
+	    gpa < ctx->highmem_gpa_base + ctx->highmem)
+		return (ctx->lowmem + gpa - ctx->highmem_gpa_base) >>
+			VIRTIO_BALLOON_PFN_SHIFT;
+	return -1;
+}
+
+static uint64_t
+virtio_balloon_block_gpa(struct virtio_balloon *bl, size_t block)
+{
+	uint64_t off = (uint64_t)block << BALLOON_BLOCK_SHIFT;
+
+	if (off < bl->ctx->lowmem)
+		return off;
+	return bl->ctx->highmem_gpa_base + off - bl->ctx->lowmem;
+}
+
+static inline bool
+bitmap_test(const uint64_t *map, size_t i)
+{
+	return (map[i / 64] & (1UL << (i % 64))) != 0;
+}
+
+static inline void
+bitmap_assign(uint64_t *map, size_t i, bool set)
+{
+	if (set)
+		map[i / 64] |= (1UL << (i % 64));
+	else
+		map[i / 64] &= ~(1UL << (i % 64));
+}
+
+static void
+virtio_balloon_restore_block(struct virtio_balloon *bl, size_t block)
+{
+	if (!bitmap_test(bl->released, block))
+		return;
+
+	if (hugetlb_restore_range(bl->ctx, virtio_balloon_block_gpa(bl, block),
+			BALLOON_BLOCK_SIZE) < 0) {
+		WPRINTF(("vtballoon: can't restore the block at 0x%lx\n",
+			virtio_balloon_block_gpa(bl, block)));
+		return;
+	}
+	bitmap_assign(bl->released, block, false);
+	bl->released_blocks--;
+}
+
+static void
+virtio_balloon_inflate_page(struct virtio_balloon *bl, uint64_t gpa)
+{
+	ssize_t page = virtio_balloon_page_index(bl, gpa);
+	size_t block;
+
+	if (page < 0 || bitmap_test(bl->bitmap, page)) {
+		DPRINTF(("vtballoon: ignore inflated page 0x%lx\n", gpa));
+		return;
+	}
+
+	bitmap_assign(bl->bitmap, page, true);
+	block = page / BALLOON_BLOCK_PAGES;
+	if (++bl->block_pages[block] < BALLOON_BLOCK_PAGES)
+		return;
+
+	/* the 2M blocks backed by a 1G hugepage stay mapped */
+	if (hugetlb_release_range(bl->ctx, virtio_balloon_block_gpa(bl, block),
+			BALLOON_BLOCK_SIZE) == 0) {
+		bitmap_assign(bl->released, block, true);
+		bl->released_blocks++;
+	}
+}
+
+static void
+virtio_balloon_deflate_page(struct virtio_balloon *bl, uint64_t gpa)
+{
+	ssize_t page = virtio_balloon_page_index(bl, gpa);
+	size_t block;
+
+	if (page < 0 || !bitmap_test(bl->bitmap, page)) {
+		DPRINTF(("vtballoon: ignore deflated page 0x%lx\n", gpa));
+		return;
+	}
+
+	/* with MUST_TELL_HOST, the guest doesn't touch it before this */
+	block = page / BALLOON_BLOCK_PAGES;
+	virtio_balloon_restore_block(bl, block);
+
+	bitmap_assign(bl->bitmap, page, false);
+	bl->block_pages[block]--;
+}
+
+/* give all the guest memory back, e.g. before the guest reboots */
+static void
+virtio_balloon_deflate_all(struct virtio_balloon *bl)
+{
+	size_t block, nblocks;
+
+	nblocks = bl->npages / BALLOON_BLOCK_PAGES;
+	for (block = 0; block < nblocks && bl->released_blocks > 0; block++)
+		virtio_balloon_restore_block(bl, block);
+
+	memset(bl->bitmap, 0, (bl->npages + 63) / 64 * sizeof(uint64_t));
+	memset(bl->block_pages, 0, nblocks * sizeof(uint16_t));
+}
+
+static void
+virtio_balloon_notify_pfns(void *vdev, struct virtio_vq_info *vq)
+{
+	struct virtio_balloon *bl = vdev;
+	struct iovec iov[VIRTIO_BALLOON_MAXSEGS];
+	uint32_t *pfns;
+	uint16_t idx;
+	size_t i, num;
+	int n, seg;
+
+	pthread_mutex_lock(&bl->mtx);
+	while (vq_has_descs(vq)) {
+		n = vq_getchain(vq, &idx, iov, VIRTIO_BALLOON_MAXSEGS, NULL);
+		if (n <= 0) {
+			WPRINTF(("vtballoon: invalid descriptors\n"));
+			break;
+		}
+
+		for (seg = 0; seg < n; seg++) {
+			pfns = iov[seg].iov_base;
+			num = iov[seg].iov_len / sizeof(uint32_t);
+			for (i = 0; i < num; i++) {
+				uint64_t gpa = (uint64_t)pfns[i] <<
+					VIRTIO_BALLOON_PFN_SHIFT;
+
+				if (vq == &bl->queues[VIRTIO_BALLOON_INFLATEQ])
+					virtio_balloon_inflate_page(bl, gpa);
+				else
+					virtio_balloon_deflate_page(bl, gpa);
+			}
+		}
+		vq_relchain(vq, idx, 0);
+	}
+	vq_endchains(vq, 1);
+	pthread_mutex_unlock(&bl->mtx);
+}
+
+static void
+virtio_balloon_notify_stats(void *vdev, struct virtio_vq_info *vq)
+{
+	struct virtio_balloon *bl = vdev;
+	struct virtio_balloon_stat *stat;
+	struct iovec iov;
+	uint16_t idx;
+	size_t i, num;
+	int n;
+
+	pthread_mutex_lock(&bl->mtx);
+	if (bl->stats_held || !vq_has_descs(vq))
+		goto end;
+
+	n = vq_getchain(vq, &idx, &iov, 1, NULL);
+	if (n != 1) {
+		WPRINTF(("vtballoon: invalid stats descriptors\n"));
+		if (n > 0) {
+			vq_relchain(vq, idx, 0);
+			vq_endchains(vq, 1);
+		}
+		goto end;
+	}
+
+	stat = iov.iov_base;
+	num = iov.iov_len / sizeof(*stat);
+	for (i = 0; i < num; i++) {
+		if (stat[i].tag < VIRTIO_BALLOON_S_NR) {
+			bl->stats[stat[i].tag] = stat[i].val;
+			bl->stats_valid[stat[i].tag] = true;
+		}
+	}
+
+	/* returned when the stats are asked again */
+	bl->stats_held = true;
+	bl->stats_idx = idx;
+end:
+	pthread_mutex_unlock(&bl->mtx);
+}
+
+/* print the last stats of the guest, and ask for fresh ones */
+static void
+virtio_balloon_dump_stats(struct virtio_balloon *bl)
+{
+	struct virtio_vq_info *vq = &bl->queues[VIRTIO_BALLOON_STATSQ];
+	int i;
+
+	printf("vtballoon: %u pages in the balloon, target %u, "
+		"%lu MB released\n", bl->cfg.actual, bl->cfg.num_pages,
+		bl->released_blocks * (BALLOON_BLOCK_SIZE >> 20));
+	for (i = 0; i < VIRTIO_BALLOON_S_NR; i++) {
+		if (bl->stats_valid[i])
+			printf("\t%-20s%lu\n", virtio_balloon_stat_names[i],
+				bl->stats[i]);
+	}
+
+	if (bl->stats_held) {
+		bl->stats_held = false;
+		vq_relchain(vq, bl->stats_idx, 0);
+		vq_endchains(vq, 0);
+	}
+}
+
+static void
+virtio_balloon_reset(void *vdev)
+{
+	struct virtio_balloon *bl = vdev;
+
+	DPRINTF(("vtballoon: device reset requested !\n"));
+	pthread_mutex_lock(&bl->mtx);
+	virtio_balloon_deflate_all(bl);
+	bl->cfg.actual = 0;
+	bl->stats_held = false;
+	memset(bl->stats_valid, 0, sizeof(bl->stats_valid));
+	virtio_reset_dev(&bl->base);
+	pthread_mutex_unlock(&bl->mtx);
+}
+
+static int
+virtio_balloon_cfgread(void *vdev, int offset, int size, uint32_t *retval)
+{
+	struct virtio_balloon *bl = vdev;
+
+	memcpy(retval, (uint8_t *)&bl->cfg + offset, size);
+	return 0;
+}
+
+static int
+virtio_balloon_cfgwrite(void *vdev, int offset, int size, uint32_t val)
+{
+	struct virtio_balloon *bl = vdev;
+
+	if (offset == offsetof(struct virtio_balloon_config, actual) &&
+	    size == sizeof(uint32_t))
+		bl->cfg.actual = val;
+	else
+		DPRINTF(("vtballoon: write to readonly reg %d\n", offset));
+
+	return 0;
+}
+
+/*
+ * Set the target size of the balloon in the slot of devargs, or print its
+ * statistics: "slot,target=<MB>" or "slot,stats".
+ */
+static int
+vm_monitor_balloon(void *arg, char *devargs)
+{
+	struct pci_vdev *dev;
+	struct virtio_balloon *bl;
+	char *str, *cp, *str_slot;
+	unsigned long target;
+	int slot, error = 0;
+
+	str = cp = strdup(devargs);
+	if (str == NULL)
+		return -1;
+
+	str_slot = strsep(&cp, ",");
+	if (dm_strtoi(str_slot, &str_slot, 10, &slot)) {
+		fprintf(stderr, "Incorrect slot!\n");
+		error = -1;
+		goto end;
+	}
+
+	dev = pci_get_vdev_info(slot);
+	if (dev == NULL || strstr(dev->name, "virtio-balloon") == NULL ||
+	    dev->arg == NULL) {
+		fprintf(stderr, "No virtio-balloon device at slot %d\n", slot);
+		error = -1;
+		goto end;
+	}
+	bl = dev->arg;
+
+	if (cp != NULL && strcmp(cp, "stats") == 0) {
+		pthread_mutex_lock(&bl->mtx);
+		virtio_balloon_dump_stats(bl);
+		pthread_mutex_unlock(&bl->mtx);
+	} else if (cp != NULL && strncmp(cp, "target=", 7) == 0 &&
+		   dm_strtoul(cp + 7, NULL, 10, &target) == 0 &&
+		   (target << (20 - VIRTIO_BALLOON_PFN_SHIFT)) <= bl->npages) {
+		pthread_mutex_lock(&bl->mtx);
+		bl->cfg.num_pages = target << (20 - VIRTIO_BALLOON_PFN_SHIFT);
+		pthread_mutex_unlock(&bl->mtx);
+		virtio_config_changed(&bl->base);
+	} else {
+		fprintf(stderr, "Incorrect balloon request!\n");
+		error = -1;
+	}
+end:
+	free(str);
+	return error;
+}
+
+static int
+virtio_balloon_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct virtio_balloon *bl;
+	pthread_mutexattr_t attr;
+	size_t nblocks;
+	int rc;
+
+	bl = calloc(1, sizeof(struct virtio_balloon));
+	if (!bl) {
+		WPRINTF(("vtballoon: calloc returns NULL\n"));
+		return -1;
+	}
+
+	bl->ctx = ctx;
+	bl->npages = (ctx->lowmem + ctx->highmem) >> VIRTIO_BALLOON_PFN_SHIFT;
+	nblocks = bl->npages / BALLOON_BLOCK_PAGES;
+	bl->bitmap = calloc((bl->npages + 63) / 64, sizeof(uint64_t));
+	bl->block_pages = calloc(nblocks, sizeof(uint16_t));
+	bl->released = calloc((nblocks + 63) / 64, sizeof(uint64_t));
+	if (!bl->bitmap || !bl->block_pages || !bl->released) {
+		WPRINTF(("vtballoon: can't allocate the page bitmaps\n"));
+		goto fail;
+	}
+
+	/* the core holds it around the callbacks, they take it again */
+	rc = pthread_mutexattr_init(&attr);
+	if (rc)
+		DPRINTF(("mutexattr init failed with erro %d!\n", rc));
+	rc = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	if (rc)
+		DPRINTF(("vtballoon: mutexattr_settype failed with "
+			"error %d!\n", rc));
+	rc = pthread_mutex_init(&bl->mtx, &attr);
+	if (rc)
+		DPRINTF(("vtballoon: pthread_mutex_init failed with "
+			"error %d!\n", rc));
+
+	virtio_linkup(&bl->base, &virtio_balloon_ops, bl, dev, bl->queues,
+		      BACKEND_VBSU);
+	bl->base.mtx = &bl->mtx;
+	bl->base.device_caps = VIRTIO_BALLOON_S_HOSTCAPS;
+
+	bl->queues[VIRTIO_BALLOON_INFLATEQ].qsize = VIRTIO_BALLOON_RINGSZ;
+	bl->queues[VIRTIO_BALLOON_INFLATEQ].notify = virtio_balloon_notify_pfns;
+	bl->queues[VIRTIO_BALLOON_DEFLATEQ].qsize = VIRTIO_BALLOON_RINGSZ;
+	bl->queues[VIRTIO_BALLOON_DEFLATEQ].notify = virtio_balloon_notify_pfns;
+	bl->queues[VIRTIO_BALLOON_STATSQ].qsize = VIRTIO_BALLOON_RINGSZ;
+	bl->queues[VIRTIO_BALLOON_STATSQ].notify = virtio_balloon_notify_stats;
+
+	/* initialize config space */
+	pci_set_cfgdata16(dev, PCIR_DEVICE, VIRTIO_DEV_BALLOON);
+	pci_set_cfgdata16(dev, PCIR_VENDOR, VIRTIO_VENDOR);
+	pci_set_cfgdata8(dev, PCIR_CLASS, PCIC_OTHER);
+	pci_set_cfgdata16(dev, PCIR_SUBDEV_0, VIRTIO_TYPE_BALLOON);
+	pci_set_cfgdata16(dev, PCIR_SUBVEND_0, VIRTIO_VENDOR);
+
+	if (virtio_interrupt_init(&bl->base, virtio_uses_msix())) {
+		DPRINTF(("%s, interrupt_init failed!\n", __func__));
+		goto fail;
+	}
+	virtio_set_io_bar(&bl->base, 0);
+
+	if (register_vm_monitor_balloon == false) {
+		register_vm_monitor_balloon = true;
+		if (monitor_register_vm_ops(&virtio_balloon_monitor_ops, ctx,
+					    "virtio_balloon") < 0)
+			fprintf(stderr, "balloon registration to VM monitor failed\n");
+	}
+
+	return 0;
+
+fail:
+	free(bl->released);
+	free(bl->block_pages);
+	free(bl->bitmap);
+	free(bl);
+	dev->arg = NULL;
+	return -1;
+}
+
+static void
+virtio_balloon_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct virtio_balloon *bl;
+
+	bl = dev->arg;
+	if (bl == NULL) {
+		DPRINTF(("%s: balloon is NULL\n", __func__));
+		return;
+	}
+
+	pthread_mutex_lock(&bl->mtx);
+	virtio_balloon_deflate_all(bl);
+	pthread_mutex_unlock(&bl->mtx);
+
+	dev->arg = NULL;
+	free(bl->released);
+	free(bl->block_pages);
+	free(bl->bitmap);
+	free(bl);
+}
+
+struct pci_vdev_ops pci_ops_virtio_balloon = {
+	.class_name	= "virtio-balloon",
+	.vdev_init	= virtio_balloon_init,
+	.vdev_deinit	= virtio_balloon_deinit,
+	.vdev_reset	= virtio_pci_reset,
+	.vdev_barwrite	= virtio_pci_write,
+	.vdev_barread	= virtio_pci_read
+};
+DEFINE_PCI_DEVTYPE(pci_ops_virtio_balloon);
@@ -37,10 +37,14 @@
 #include "dm.h"
 #include "pci_core.h"
 #include "virtio.h"
+#include "vhost.h"
 #include "block_if.h"
 #include "monitor.h"
+#include "dm_string.h"
 
 #define VIRTIO_BLK_RINGSZ	64
+#define VIRTIO_BLK_BATCH	8	/* chains got from the ring at once */
+#define VIRTIO_BLK_MAX_QUEUES	16
 #define VIRTIO_BLK_MAX_OPTS_LEN	256
 
 #define VIRTIO_BLK_S_OK	0
@@ -59,7 +63,10 @@
 /* Device can toggle its cache between writeback and writethrough modes */
 #define	VIRTIO_BLK_F_CONFIG_WCE	(1 << 11)
 
+#define	VIRTIO_BLK_F_MQ		(1 << 12)	/* Support more than one vq */
+
 #define	VIRTIO_BLK_F_DISCARD	(1 << 13)
+#define	VIRTIO_BLK_F_WRITE_ZEROES	(1 << 14)
 
 /*
  * Basic device capabilities
@@ -68,8 +75,20 @@
 	(VIRTIO_BLK_F_SEG_MAX |						    \
 	VIRTIO_BLK_F_BLK_SIZE |						    \
 	VIRTIO_BLK_F_TOPOLOGY |						    \
+	(1 << VIRTIO_RING_F_EVENT_IDX) |	/* event index suppression */   \
 	(1 << VIRTIO_RING_F_INDIRECT_DESC))	/* indirect descriptors */
 
+/*
+ * Capabilities taken from a vhost-user backend, the write cache can't be
+ * toggled through the DM
+ */
+#define VIRTIO_BLK_S_VHOSTCAPS	\
+	(VIRTIO_BLK_S_HOSTCAPS |	\
+	VIRTIO_BLK_F_RO |		\
+	VIRTIO_BLK_F_FLUSH |		\
+	VIRTIO_BLK_F_DISCARD |		\
+	VIRTIO_BLK_F_WRITE_ZEROES)
+
 /*
  * Writeback cache bits
  */
@@ -98,14 +117,21 @@ struct virtio_blk_config {
 	} topology;
 	uint8_t	writeback;
 	uint8_t unused;
-	/* Reserve for num_queues when VIRTIO_BLK_F_MQ is support*/
-	uint16_t reserve;
+	/* The number of virtqueues with VIRTIO_BLK_F_MQ */
+	uint16_t num_queues;
 	/* The maximum discard sectors (in 512-byte sectors) for one segment */
 	uint32_t max_discard_sectors;
 	/* The maximum number of discard segments */
 	uint32_t max_discard_seg;
 	/* Discard commands must be aligned to this number of sectors. */
 	uint32_t discard_sector_alignment;
+	/* The maximum write zeroes sectors for one segment */
+	uint32_t max_write_zeroes_sectors;
+	/* The maximum number of write zeroes segments */
+	uint32_t max_write_zeroes_seg;
+	/* Set if a write zeroes with the unmap flag may deallocate */
+	uint8_t write_zeroes_may_unmap;
+	uint8_t unused1[3];
 } __attribute__((packed));
 
 /*
@@ -118,6 +144,7 @@ struct virtio_blk_hdr {
 #define	VBH_OP_FLUSH_OUT	5
 #define	VBH_OP_IDENT		8
 #define	VBH_OP_DISCARD		11
+#define	VBH_OP_WRITE_ZEROES	13
 #define	VBH_FLAG_BARRIER	0x80000000	/* OR'ed into type */
 	uint32_t type;
 	uint32_t ioprio;
@@ -138,38 +165,68 @@ static bool register_vm_monitor_blkrescan = false;
 
 static struct monitor_vm_ops virtio_blk_rescan_ops = {
 	.rescan	= vm_monitor_blkrescan,
+	.blkqos	= vm_monitor_blkqos,
+	.blkstats = vm_monitor_blkstats,
 };
 
+struct virtio_blk_queue;
+
 struct virtio_blk_ioreq {
 	struct blockif_req req;
-	struct virtio_blk *blk;
+	struct virtio_blk_queue *q;
 	uint8_t *status;
 	uint16_t idx;
 };
 
+/*
+ * Per-virtqueue state. Each queue has its own blockif submission context
+ * (the one of queue 0 or a clone of it) and its own lock for the rings,
+ * so the completions of a queue don't contend with the other queues.
+ * Lock order: device mutex, then queue mutex.
+ */
+struct virtio_blk_queue {
+	struct virtio_vq_info *vq;
+	pthread_mutex_t mtx;
+	struct blockif_ctxt *bc;
+	struct virtio_blk_ioreq ios[VIRTIO_BLK_RINGSZ];
+
+	/* batch of chains got by vq_getchains(), under mtx */
+	struct vq_chain chains[VIRTIO_BLK_BATCH];
+	struct iovec iov[VIRTIO_BLK_BATCH][BLOCKIF_IOV_MAX + 2];
+	uint16_t flags[VIRTIO_BLK_BATCH][BLOCKIF_IOV_MAX + 2];
+};
+
 /*
  * Per-device struct
  */
 struct virtio_blk {
 	struct virtio_base base;
+	struct virtio_ops ops;	/* virtio_blk_ops with the negotiated nvq */
 	pthread_mutex_t mtx;
-	struct virtio_vq_info vq;
+	int nq;
+	struct virtio_vq_info *vqs;
+	struct virtio_blk_queue *qs;
 	struct virtio_blk_config cfg;
 	bool dummy_bctxt; /* Used in blockrescan. Indicate if the bctxt can be used */
-	struct blockif_ctxt *bc;
+	struct blockif_ctxt *bc;	/* blockif context of queue 0 */
 	char ident[VIRTIO_BLK_BLK_ID_BYTES + 1];
-	struct virtio_blk_ioreq ios[VIRTIO_BLK_RINGSZ];
 	uint8_t original_wce;
+
+	/* vhost-user backend, it serves the rings instead of blockif */
+	bool vhost_user;
+	struct vhost_dev vdev;
+	struct vhost_vq vhost_vqs[VIRTIO_BLK_MAX_QUEUES];
 };
 
 static void virtio_blk_reset(void *);
 static void virtio_blk_notify(void *, struct virtio_vq_info *);
 static int virtio_blk_cfgread(void *, int, int, uint32_t *);
 static int virtio_blk_cfgwrite(void *, int, int, uint32_t);
+static void virtio_blk_set_status(void *, uint64_t);
 
 static struct virtio_ops virtio_blk_ops = {
 	"virtio_blk",		/* our name */
-	1,			/* we support 1 virtqueue */
+	1,			/* 1 virtqueue, more with mq=<n> */
 	sizeof(struct virtio_blk_config), /* config reg size */
 	virtio_blk_reset,	/* reset */
 	virtio_blk_notify,	/* device-wide qnotify */
@@ -183,19 +240,26 @@ static void
 virtio_blk_reset(void *vdev)
 {
 	struct virtio_blk *blk = vdev;
+	int i;
 
 	DPRINTF(("virtio_blk: device reset requested !\n"));
+	for (i = 0; i < blk->nq; i++)
+		pthread_mutex_lock(&blk->qs[i].mtx);
 	virtio_reset_dev(&blk->base);
+	for (i = blk->nq - 1; i >= 0; i--)
+		pthread_mutex_unlock(&blk->qs[i].mtx);
 	/* Reset virtio-blk device only on valid bctxt*/
-	if (!blk->dummy_bctxt)
-		blockif_set_wce(blk->bc, blk->original_wce);
+	if (!blk->dummy_bctxt) {
+		for (i = 0; i < blk->nq; i++)
+			blockif_set_wce(blk->qs[i].bc, blk->original_wce);
+	}
 }
 
 static void
 virtio_blk_done(struct blockif_req *br, int err)
 {
 	struct virtio_blk_ioreq *io = br->param;
-	struct virtio_blk *blk = io->blk;
+	struct virtio_blk_queue *q = io->q;
 
 	if (err)
 		DPRINTF(("virtio_blk: done with error = %d\n\r", err));
@@ -212,10 +276,10 @@ virtio_blk_done(struct blockif_req *br, int err)
 	 * Return the descriptor back to the host.
 	 * We wrote 1 byte (our status) to host.
 	 */
-	pthread_mutex_lock(&blk->mtx);
-	vq_relchain(&blk->vq, io->idx, 1);
-	vq_endchains(&blk->vq, !vq_has_descs(&blk->vq));
-	pthread_mutex_unlock(&blk->mtx);
+	pthread_mutex_lock(&q->mtx);
+	vq_relchain(q->vq, io->idx, 1);
+	vq_endchains(q->vq, !vq_has_descs(q->vq));
+	pthread_mutex_unlock(&q->mtx);
 }
 
 static void
@@ -228,19 +292,20 @@ virtio_blk_abort(struct virtio_vq_info *vq, uint16_t idx)
 }
 
 static void
-virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
+virtio_blk_proc(struct virtio_blk *blk, struct virtio_blk_queue *q,
+		struct vq_chain *c)
 {
+	struct virtio_vq_info *vq = q->vq;
 	struct virtio_blk_hdr *vbh;
 	struct virtio_blk_ioreq *io;
 	int i, n;
 	int err;
 	ssize_t iolen;
 	int writeop, type;
-	struct iovec iov[BLOCKIF_IOV_MAX + 2];
-	uint16_t idx, flags[BLOCKIF_IOV_MAX + 2];
+	struct iovec *iov = c->iov;
+	uint16_t idx = c->idx, *flags = c->flags;
 
-	idx = vq->qsize;
-	n = vq_getchain(vq, &idx, iov, BLOCKIF_IOV_MAX + 2, flags);
+	n = c->n;
 
 	/*
 	 * The first descriptor will be the read-only fixed header,
@@ -256,7 +321,7 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 		return;
 	}
 
-	io = &blk->ios[idx];
+	io = &q->ios[idx];
 	if ((flags[0] & VRING_DESC_F_WRITE) != 0) {
 		WPRINTF(("%s: the type for hdr should not be VRING_DESC_F_WRITE\n", __func__));
 		virtio_blk_abort(vq, idx);
@@ -288,7 +353,8 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 	 */
 	type = vbh->type & ~VBH_FLAG_BARRIER;
 	writeop = ((type == VBH_OP_WRITE) ||
-			(type == VBH_OP_DISCARD));
+			(type == VBH_OP_DISCARD) ||
+			(type == VBH_OP_WRITE_ZEROES));
 
 	if (blk->dummy_bctxt) {
 		WPRINTF(("Block context invalid: Operation cannot be permitted!\n"));
@@ -296,7 +362,7 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 		return;
 	}
 
-	if (writeop && blockif_is_ro(blk->bc)) {
+	if (writeop && blockif_is_ro(q->bc)) {
 		WPRINTF(("Cannot write to a read-only storage!\n"));
 		virtio_blk_done(&io->req, EROFS);
 		return;
@@ -347,14 +413,17 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 		}
 
 		err = ((type == VBH_OP_READ) ? blockif_read : blockif_write)
-				(blk->bc, &io->req);
+				(q->bc, &io->req);
 		break;
 	case VBH_OP_DISCARD:
-		err = blockif_discard(blk->bc, &io->req);
+		err = blockif_discard(q->bc, &io->req);
+		break;
+	case VBH_OP_WRITE_ZEROES:
+		err = blockif_write_zeroes(q->bc, &io->req);
 		break;
 	case VBH_OP_FLUSH:
 	case VBH_OP_FLUSH_OUT:
-		err = blockif_flush(blk->bc, &io->req);
+		err = blockif_flush(q->bc, &io->req);
 		break;
 	case VBH_OP_IDENT:
 		/* Assume a single buffer */
@@ -372,13 +441,53 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 		WPRINTF(("%s: request process failed\n", __func__));
 }
 
+/* Process the chains of the ring, a batch at a time */
+static void
+virtio_blk_drain(struct virtio_blk *blk, struct virtio_blk_queue *q)
+{
+	int i, n;
+
+	while (vq_has_descs(q->vq)) {
+		n = vq_getchains(q->vq, q->chains, VIRTIO_BLK_BATCH,
+				BLOCKIF_IOV_MAX + 2);
+		if (n <= 0) {
+			WPRINTF(("%s: vq_getchains failed\n", __func__));
+			break;
+		}
+		for (i = 0; i < n; i++)
+			virtio_blk_proc(blk, q, &q->chains[i]);
+	}
+}
+
 static void
 virtio_blk_notify(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_blk *blk = vdev;
+	struct virtio_blk_queue *q = &blk->qs[vq->num];
+
+	/* the rings belong to the vhost-user backend */
+	if (blk->vhost_user)
+		return;
 
-	while (vq_has_descs(vq))
-		virtio_blk_proc(blk, vq);
+	pthread_mutex_lock(&q->mtx);
+	/*
+	 * No kicks while the ring is drained. The re-enable in
+	 * vq_clear_used_ring_flags() is skipped in poll mode, where the
+	 * poll timer calls in here instead.
+	 */
+	do {
+		vq_set_used_ring_flags(&blk->base, vq);
+		if (blk->dummy_bctxt) {
+			virtio_blk_drain(blk, q);
+		} else {
+			/* submit the requests of the kick as one batch */
+			blockif_plug(q->bc);
+			virtio_blk_drain(blk, q);
+			blockif_unplug(q->bc);
+		}
+		vq_clear_used_ring_flags(&blk->base, vq);
+	} while (vq_has_descs(vq));
+	pthread_mutex_unlock(&q->mtx);
 }
 
 static uint64_t
@@ -393,9 +502,15 @@ virtio_blk_get_caps(struct virtio_blk *blk, bool wb)
 	if (blockif_candiscard(blk->bc))
 		caps |= VIRTIO_BLK_F_DISCARD;
 
+	if (blockif_canzero(blk->bc))
+		caps |= VIRTIO_BLK_F_WRITE_ZEROES;
+
 	if (blockif_is_ro(blk->bc))
 		caps |= VIRTIO_BLK_F_RO;
 
+	if (blk->nq > 1)
+		caps |= VIRTIO_BLK_F_MQ;
+
 	return caps;
 }
 
@@ -423,29 +538,200 @@ virtio_blk_update_config_space(struct virtio_blk *blk)
 	    (sto != 0) ? ((sts - sto) / sectsz) : 0;
 	blk->cfg.topology.min_io_size = 0;
 	blk->cfg.writeback = blockif_get_wce(blk->bc);
+	blk->cfg.num_queues = blk->nq;
 	blk->original_wce = blk->cfg.writeback; /* save for reset */
 	if (blockif_candiscard(blk->bc)) {
 		blk->cfg.max_discard_sectors = blockif_max_discard_sectors(blk->bc);
 		blk->cfg.max_discard_seg = blockif_max_discard_seg(blk->bc);
 		blk->cfg.discard_sector_alignment = blockif_discard_sector_alignment(blk->bc);
 	}
+	if (blockif_canzero(blk->bc)) {
+		blk->cfg.max_write_zeroes_sectors = blockif_max_zero_sectors(blk->bc);
+		blk->cfg.max_write_zeroes_seg = blockif_max_zero_seg(blk->bc);
+		blk->cfg.write_zeroes_may_unmap = 1;
+	}
 	blk->base.device_caps =
 		virtio_blk_get_caps(blk, !!blk->cfg.writeback);
 }
+/*
+ * Take the "mq=<n>" option out of opts, the rest of the options are for
+ * blockif_open().
+ */
+static int
+virtio_blk_parse_mq(char *opts, int *nq)
+{
+	char *cp, *end;
+
+	*nq = 1;
+	cp = strstr(opts, ",mq=");
+	if (cp == NULL)
+		return 0;
+
+	if (dm_strtoi(cp + strlen(",mq="), &end, 10, nq) ||
+		(*end != ',' && *end != '\0') ||
+		*nq < 1 || *nq > VIRTIO_BLK_MAX_QUEUES) {
+		WPRINTF(("virtio_blk: mq should be in [1, %d]\n",
+					VIRTIO_BLK_MAX_QUEUES));
+		return -1;
+	}
+	memmove(cp, end, strlen(end) + 1);
+	return 0;
+}
+
+/*
+ * Take the "coalesce=<max frames>/<max usecs>" option out of opts, for the
+ * interrupts of all the queues.
+ */
+static int
+virtio_blk_parse_coalesce(char *opts, uint32_t *frames, uint32_t *usecs)
+{
+	char *cp, *end;
+
+	*frames = *usecs = 0;
+	cp = strstr(opts, ",coalesce=");
+	if (cp == NULL)
+		return 0;
+
+	if (virtio_parse_coalesce(cp + strlen(",coalesce="), frames, usecs)) {
+		WPRINTF(("virtio_blk: coalesce should be "
+			"<max frames>/<max usecs>\n"));
+		return -1;
+	}
+	end = strchr(cp + 1, ',');
+	if (end == NULL)
+		*cp = '\0';
+	else
+		memmove(cp, end, strlen(end) + 1);
+	return 0;
+}
+
+/*
+ * Queue 0 submits to bctxt, the other queues each get a clone of it so
+ * that they have their own blockif queues and threads.
+ */
+static int
+virtio_blk_open_queues(struct virtio_blk *blk, struct blockif_ctxt *bctxt,
+		const char *bident)
+{
+	char qident[24];
+	int i;
+
+	blk->bc = bctxt;
+	blk->qs[0].bc = bctxt;
+	for (i = 1; i < blk->nq; i++) {
+		snprintf(qident, sizeof(qident), "%s.%d", bident, i);
+		blk->qs[i].bc = blockif_clone(bctxt, qident);
+		if (blk->qs[i].bc == NULL) {
+			while (--i > 0) {
+				blockif_close(blk->qs[i].bc);
+				blk->qs[i].bc = NULL;
+			}
+			blk->qs[0].bc = NULL;
+			blk->bc = NULL;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* The clones have to be closed before the context they share the fd of */
+static void
+virtio_blk_close_queues(struct virtio_blk *blk)
+{
+	int i;
+
+	for (i = blk->nq - 1; i > 0; i--)
+		blockif_close(blk->qs[i].bc);
+	blockif_close(blk->qs[0].bc);
+}
+
+/*
+ * Connect to a vhost-user backend (e.g. SPDK) at path, the config space
+ * comes from the backend
+ */
+static int
+virtio_blk_vhost_user_setup(struct virtio_blk *blk, const char *path)
+{
+	uint64_t caps = VIRTIO_BLK_S_VHOSTCAPS;
+
+	if (blk->nq > 1)
+		caps |= VIRTIO_BLK_F_MQ;
+
+	blk->vdev.nvqs = blk->nq;
+	blk->vdev.vqs = blk->vhost_vqs;
+	blk->base.device_caps = caps;
+	if (vhost_user_dev_init(&blk->vdev, &blk->base, path, 0, caps, 0)) {
+		WPRINTF(("virtio_blk: vhost-user %s failed\n", path));
+		return -1;
+	}
+
+	if (blk->nq > 1 && (blk->base.device_caps & VIRTIO_BLK_F_MQ) == 0) {
+		WPRINTF(("virtio_blk: vhost-user %s has one queue\n", path));
+		goto fail;
+	}
+
+	if (vhost_user_get_config(&blk->vdev, &blk->cfg, sizeof(blk->cfg))) {
+		WPRINTF(("virtio_blk: no config from vhost-user %s\n", path));
+		goto fail;
+	}
+	blk->cfg.num_queues = blk->nq;
+
+	blk->vhost_user = true;
+	blk->ops.set_status = virtio_blk_set_status;
+	return 0;
+
+fail:
+	vhost_dev_deinit(&blk->vdev);
+	return -1;
+}
+
+static void
+virtio_blk_set_status(void *vdev, uint64_t status)
+{
+	struct virtio_blk *blk = vdev;
+
+	if (!blk->vdev.started && (status & VIRTIO_CONFIG_S_DRIVER_OK)) {
+		if (vhost_dev_start(&blk->vdev) < 0)
+			WPRINTF(("virtio_blk: vhost_dev_start failed\n"));
+	} else if (blk->vdev.started &&
+		   (status & VIRTIO_CONFIG_S_DRIVER_OK) == 0) {
+		if (vhost_dev_stop(&blk->vdev) < 0)
+			WPRINTF(("virtio_blk: vhost_dev_stop failed\n"));
+	}
+}
+
+static void
+virtio_blk_free(struct virtio_blk *blk)
+{
+	int i;
+
+	for (i = 0; i < blk->nq; i++) {
+		vq_coalesce_deinit(&blk->vqs[i]);
+		pthread_mutex_destroy(&blk->qs[i].mtx);
+	}
+	free(blk->qs);
+	free(blk->vqs);
+	free(blk);
+}
+
 static int
 virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
 	bool dummy_bctxt;
 	char bident[16];
+	char *bopts, *vhost_path;
 	struct blockif_ctxt *bctxt;
 	MD5_CTX mdctx;
 	u_char digest[16];
 	struct virtio_blk *blk;
-	int i;
+	struct virtio_blk_queue *q;
+	int i, j, nq;
+	uint32_t coal_frames, coal_usecs;
 	pthread_mutexattr_t attr;
 	int rc;
 
 	bctxt = NULL;
+	vhost_path = NULL;
 	/* Assume the bctxt is valid, until identified otherwise */
 	dummy_bctxt = false;
 
@@ -454,6 +740,17 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		return -1;
 	}
 
+	bopts = strdup(opts);
+	if (bopts == NULL) {
+		WPRINTF(("virtio_blk: strdup returns NULL\n"));
+		return -1;
+	}
+	if (virtio_blk_parse_mq(bopts, &nq) ||
+	    virtio_blk_parse_coalesce(bopts, &coal_frames, &coal_usecs)) {
+		free(bopts);
+		return -1;
+	}
+
 	/*
 	 * The supplied backing file has to exist
 	 */
@@ -466,34 +763,49 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	 * If "nodisk" keyword is found in opts, this is not a valid backend
 	 * file. Skip blockif_open and set dummy bctxt in virtio_blk struct
 	 */
-	if (strstr(opts, "nodisk") != NULL) {
+	if (strstr(bopts, "nodisk") != NULL) {
+		dummy_bctxt = true;
+	} else if (strncmp(bopts, "vhost-user=", 11) == 0) {
+		/* no blockif, the requests go to the vhost-user backend */
+		vhost_path = bopts + 11;
 		dummy_bctxt = true;
 	} else {
-		bctxt = blockif_open(opts, bident);
+		bctxt = blockif_open(bopts, bident);
 		if (bctxt == NULL) {
 			perror("Could not open backing file");
+			free(bopts);
 			return -1;
 		}
 	}
 
 
 	blk = calloc(1, sizeof(struct virtio_blk));
-	if (!blk) {
+	if (blk)
+		blk->vqs = calloc(nq, sizeof(struct virtio_vq_info));
+	if (blk && blk->vqs)
+		blk->qs = calloc(nq, sizeof(struct virtio_blk_queue));
+	if (!blk || !blk->qs) {
 		WPRINTF(("virtio_blk: calloc returns NULL\n"));
+		if (blk)
+			free(blk->vqs);
+		free(blk);
+		if (bctxt)
+			blockif_close(bctxt);
+		free(bopts);
 		return -1;
 	}
 
-	blk->bc = bctxt;
+	blk->nq = nq;
 	/* Update virtio-blk device struct of dummy ctxt*/
 	blk->dummy_bctxt = dummy_bctxt;
-
-	for (i = 0; i < VIRTIO_BLK_RINGSZ; i++) {
-		struct virtio_blk_ioreq *io = &blk->ios[i];
-
-		io->req.callback = virtio_blk_done;
-		io->req.param = io;
-		io->blk = blk;
-		io->idx = i;
+	if (!dummy_bctxt && virtio_blk_open_queues(blk, bctxt, bident)) {
+		WPRINTF(("virtio_blk: failed to open %d queues\n", nq));
+		blockif_close(bctxt);
+		free(blk->qs);
+		free(blk->vqs);
+		free(blk);
+		free(bopts);
+		return -1;
 	}
 
 	/* init mutex attribute properly to avoid deadlock */
@@ -510,19 +822,54 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		DPRINTF(("virtio_blk: pthread_mutex_init failed with "
 					"error %d!\n", rc));
 
+	for (i = 0; i < nq; i++) {
+		q = &blk->qs[i];
+		q->vq = &blk->vqs[i];
+		rc = pthread_mutex_init(&q->mtx, &attr);
+		if (rc)
+			DPRINTF(("virtio_blk: pthread_mutex_init failed with "
+						"error %d!\n", rc));
+		for (j = 0; j < VIRTIO_BLK_RINGSZ; j++) {
+			struct virtio_blk_ioreq *io = &q->ios[j];
+
+			io->req.callback = virtio_blk_done;
+			io->req.param = io;
+			io->q = q;
+			io->idx = j;
+		}
+		for (j = 0; j < VIRTIO_BLK_BATCH; j++) {
+			q->chains[j].iov = q->iov[j];
+			q->chains[j].flags = q->flags[j];
+		}
+	}
+
 	/* init virtio struct and virtqueues */
-	virtio_linkup(&blk->base, &virtio_blk_ops, blk, dev, &blk->vq, BACKEND_VBSU);
+	blk->ops = virtio_blk_ops;
+	blk->ops.nvq = nq;
+	virtio_linkup(&blk->base, &blk->ops, blk, dev, blk->vqs,
+		      vhost_path ? BACKEND_VHOST : BACKEND_VBSU);
 	blk->base.mtx = &blk->mtx;
 
-	blk->vq.qsize = VIRTIO_BLK_RINGSZ;
-	/* blk->vq.vq_notify = we have no per-queue notify */
+	for (i = 0; i < nq; i++) {
+		blk->vqs[i].qsize = VIRTIO_BLK_RINGSZ;
+		if (coal_usecs && !vhost_path &&
+		    vq_set_coalesce(&blk->vqs[i], coal_frames, coal_usecs))
+			WPRINTF(("virtio_blk: no interrupt coalescing\n"));
+	}
+	/* vq_notify: we have no per-queue notify, qnotify finds the queue */
+
+	if (vhost_path && virtio_blk_vhost_user_setup(blk, vhost_path)) {
+		virtio_blk_free(blk);
+		free(bopts);
+		return -1;
+	}
 
 	/*
 	 * Create an identifier for the backing file. Use parts of the
 	 * md5 sum of the filename
 	 */
 	MD5_Init(&mdctx);
-	MD5_Update(&mdctx, opts, strnlen(opts, VIRTIO_BLK_MAX_OPTS_LEN));
+	MD5_Update(&mdctx, bopts, strnlen(bopts, VIRTIO_BLK_MAX_OPTS_LEN));
 	MD5_Final(digest, &mdctx);
 	if (snprintf(blk->ident, sizeof(blk->ident),
 		"ACRN--%02X%02X-%02X%02X-%02X%02X", digest[0],
@@ -530,6 +877,7 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		digest[5]) >= sizeof(blk->ident)) {
 		WPRINTF(("virtio_blk: block ident too long\n"));
 	}
+	free(bopts);
 
 	/* Setup virtio block config space only for valid backend file*/
 	if (!blk->dummy_bctxt)
@@ -549,8 +897,10 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	if (virtio_interrupt_init(&blk->base, virtio_uses_msix())) {
 		/* call close only for valid bctxt */
 		if (!blk->dummy_bctxt)
-			blockif_close(blk->bc);
-		free(blk);
+			virtio_blk_close_queues(blk);
+		if (blk->vhost_user)
+			vhost_dev_deinit(&blk->vdev);
+		virtio_blk_free(blk);
 		return -1;
 	}
 	virtio_set_io_bar(&blk->base, 0);
@@ -572,20 +922,23 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 static void
 virtio_blk_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
-	struct blockif_ctxt *bctxt;
 	struct virtio_blk *blk;
 
 	if (dev->arg) {
 		DPRINTF(("virtio_blk: deinit\n"));
 		blk = (struct virtio_blk *) dev->arg;
+		if (blk->vhost_user) {
+			if (blk->vdev.started)
+				vhost_dev_stop(&blk->vdev);
+			vhost_dev_deinit(&blk->vdev);
+		}
 		/* De-init virtio-blk device only on valid bctxt*/
 		if (!blk->dummy_bctxt) {
-			bctxt = blk->bc;
-			if (blockif_flush_all(bctxt))
+			if (blockif_flush_all(blk->bc))
 				WPRINTF(("vrito_blk: Failed to flush before close\n"));
-			blockif_close(bctxt);
+			virtio_blk_close_queues(blk);
 		}
-		free(blk);
+		virtio_blk_free(blk);
 	}
 }
 
@@ -595,6 +948,7 @@ virtio_blk_cfgwrite(void *vdev, int offset, int size, uint32_t value)
 	struct virtio_blk *blk = vdev;
 	struct virtio_blk_config *blkcfg = &(blk->cfg);
 	void *ptr;
+	int i;
 
 	ptr = (uint8_t *)blkcfg + offset;
 
@@ -602,8 +956,10 @@ virtio_blk_cfgwrite(void *vdev, int offset, int size, uint32_t value)
 		&& (size == 1)) {
 		memcpy(ptr, &value, size);
 		/* Update write cache enable only on valid bctxt*/
-		if (!blk->dummy_bctxt)
-			blockif_set_wce(blk->bc, blkcfg->writeback);
+		if (!blk->dummy_bctxt) {
+			for (i = 0; i < blk->nq; i++)
+				blockif_set_wce(blk->qs[i].bc, blkcfg->writeback);
+		}
 		if (blkcfg->writeback)
 			blk->base.device_caps |= VIRTIO_BLK_F_FLUSH;
 		else
@@ -677,7 +1033,7 @@ virtio_blk_rescan(struct vmctx *ctx, struct pci_vdev *dev, char *newpath)
 	 * user has passed empty file during VM launch and wants to update it.
 	 * If this is the case, blk->bc would be null.
 	 */
-	if (blk->bc) {
+	if (blk->bc || blk->vhost_user) {
 		fprintf(stderr, "Replacing valid backend file not supported!\n");
 		goto end;
 	}
@@ -690,7 +1046,11 @@ virtio_blk_rescan(struct vmctx *ctx, struct pci_vdev *dev, char *newpath)
 		goto end;
 	}
 
-	blk->bc = bctxt;
+	if (virtio_blk_open_queues(blk, bctxt, bident)) {
+		fprintf(stderr, "Error opening the queues of the backing file\n");
+		blockif_close(bctxt);
+		goto end;
+	}
 	blk->dummy_bctxt = false;
 
 	/* Update virtio-blk device configuration on valid file*/
@@ -755,10 +1115,88 @@ end:
 	return error;
 }
 
+/* Set the I/O limits of the virtio-blk device in the slot of devargs */
+int
+vm_monitor_blkqos(void *arg, char *devargs)
+{
+	char *str, *cp;
+	char *str_slot, *str_opts;
+	int slot, i;
+	int error = 0;
+	struct pci_vdev *dev;
+	struct virtio_blk *blk;
+
+	/* slot,iops=<ops/s>[/<burst>],bps=<bytes/s>[/<burst>] */
+	str = cp = strdup(devargs);
+	if (str == NULL)
+		return -1;
+
+	str_slot = strsep(&cp, ",");
+	str_opts = (cp != NULL) ? cp : "";
+
+	if (dm_strtoi(str_slot, &str_slot, 10, &slot)) {
+		fprintf(stderr, "Incorrect slot!\n");
+		error = -1;
+		goto end;
+	}
+
+	dev = pci_get_vdev_info(slot);
+	if (dev == NULL || strstr(dev->name, "virtio-blk") == NULL) {
+		fprintf(stderr, "No virtio-blk device at slot %d\n", slot);
+		error = -1;
+		goto end;
+	}
+
+	blk = (struct virtio_blk *) dev->arg;
+	if (blk == NULL || blk->dummy_bctxt) {
+		fprintf(stderr, "No backing file for the device at slot %d\n", slot);
+		error = -1;
+		goto end;
+	}
+
+	/* the queues share the limits, but each has to be woken up */
+	for (i = 0; i < blk->nq && !error; i++)
+		error = blockif_set_qos(blk->qs[i].bc, str_opts);
+end:
+	free(str);
+	return error;
+}
+
+/* Add up the I/O statistics of the queues of the device in the slot */
+int
+vm_monitor_blkstats(void *arg, char *devargs, struct blockif_stats *stats)
+{
+	struct pci_vdev *dev;
+	struct virtio_blk *blk;
+	char *str_slot;
+	int slot, i;
+
+	str_slot = devargs;
+	if (dm_strtoi(str_slot, &str_slot, 10, &slot)) {
+		fprintf(stderr, "Incorrect slot!\n");
+		return -1;
+	}
+
+	dev = pci_get_vdev_info(slot);
+	if (dev == NULL || strstr(dev->name, "virtio-blk") == NULL) {
+		fprintf(stderr, "No virtio-blk device at slot %d\n", slot);
+		return -1;
+	}
+
+	blk = (struct virtio_blk *) dev->arg;
+	if (blk == NULL || blk->dummy_bctxt)
+		return 0;	/* no backing file, nothing done yet */
+
+	for (i = 0; i < blk->nq; i++)
+		blockif_get_stats(blk->qs[i].bc, stats);
+	return 0;
+}
+
 struct pci_vdev_ops pci_ops_virtio_blk = {
 	.class_name	= "virtio-blk",
 	.vdev_init	= virtio_blk_init,
 	.vdev_deinit	= virtio_blk_deinit,
+	.vdev_reset	= virtio_pci_reset,
 	.vdev_barwrite	= virtio_pci_write,
 	.vdev_barread	= virtio_pci_read
 };
@@ -46,11 +46,20 @@
 #include "dm.h"
 #include "pci_core.h"
 #include "virtio.h"
+#include "virtio_kernel.h"
 #include "mevent.h"
+#include "timer.h"
+#include "atomic.h"
 
 #define	VIRTIO_CONSOLE_RINGSZ	64
 #define	VIRTIO_CONSOLE_MAXPORTS	16
 #define	VIRTIO_CONSOLE_MAXQ	(VIRTIO_CONSOLE_MAXPORTS * 2 + 2)
+#define	VIRTIO_CONSOLE_MAXSEGS	8
+#define	VIRTIO_CONSOLE_TX_BATCH	16	/* tx chains written at once */
+
+/* output buffering of the file backends */
+#define	VIRTIO_CONSOLE_OUTBUF_SIZE	(64 * 1024)
+#define	VIRTIO_CONSOLE_OUTBUF_FLUSH_MS	200
 
 #define	VIRTIO_CONSOLE_DEVICE_READY	0
 #define	VIRTIO_CONSOLE_DEVICE_ADD	1
@@ -104,6 +113,7 @@ struct virtio_console_port {
 	int			txq;
 	void			*arg;
 	virtio_console_cb_t	*cb;
+	struct mevent		*rx_evp;	/* backend read paused */
 };
 
 struct virtio_console_backend {
@@ -117,6 +127,13 @@ struct virtio_console_backend {
 	int				pts_fd;	/* only valid for PTY */
 	const char 			*portpath;
 	const char 			*socket_type;
+
+	/* file backend with output buffering, NULL outbuf otherwise */
+	char				*outbuf;
+	size_t				outlen;
+	pthread_mutex_t			outbuf_mtx;
+	struct acrn_timer		flush_timer;
+	bool				flush_armed;
 };
 
 struct virtio_console {
@@ -131,6 +148,7 @@ struct virtio_console {
 	struct virtio_console_port	ports[VIRTIO_CONSOLE_MAXPORTS];
 	struct virtio_console_config	*config;
 	int				ref_count;
+	struct vbs_k_dev		vbs_k;
 };
 
 struct virtio_console_config {
@@ -174,6 +192,20 @@ static struct virtio_ops virtio_console_ops = {
 	NULL,				/* called on guest set status */
 };
 
+/* VBS-K virtio_ops, the same but for the start of the kernel module */
+static void virtio_console_k_set_status(void *, uint64_t);
+static struct virtio_ops virtio_console_ops_k = {
+	"vtcon",			/* our name */
+	VIRTIO_CONSOLE_MAXQ,		/* we support VTCON_MAXQ virtqueues */
+	sizeof(struct virtio_console_config), /* config reg size */
+	virtio_console_reset,		/* reset */
+	NULL,				/* device-wide qnotify */
+	virtio_console_cfgread,		/* read virtio config */
+	NULL,				/* write virtio config */
+	virtio_console_neg_features,	/* apply negotiated features */
+	virtio_console_k_set_status,	/* called on guest set status */
+};
+
 static const char *virtio_console_be_table[VIRTIO_CONSOLE_BE_MAX] = {
 	[VIRTIO_CONSOLE_BE_STDIO]	= "stdio",
 	[VIRTIO_CONSOLE_BE_TTY]		= "tty",
@@ -194,6 +226,22 @@ virtio_console_reset(void *vdev)
 
 	DPRINTF(("vtcon: device reset requested!\n"));
 	virtio_reset_dev(&console->base);
+	vbs_kernel_dev_reset(&console->vbs_k);
+}
+
+static void
+virtio_console_k_set_status(void *vdev, uint64_t status)
+{
+	struct virtio_console *console = vdev;
+
+	vbs_kernel_set_status(&console->vbs_k, &console->base, status);
+}
+
+/* the virtqueues are served by the kernel module, not touched here */
+static inline bool
+virtio_console_in_kernel(struct virtio_console *console)
+{
+	return console->base.backend_type == BACKEND_VBSK;
 }
 
 static void
@@ -358,7 +406,7 @@ virtio_console_control_send(struct virtio_console *console,
 
 	vq = virtio_console_port_to_vq(&console->control_port, true);
 
-	if (!vq_has_descs(vq))
+	if (virtio_console_in_kernel(console) || !vq_has_descs(vq))
 		return;
 
 	n = vq_getchain(vq, &idx, &iov, 1, NULL);
@@ -376,27 +424,63 @@ virtio_console_control_send(struct virtio_console *console,
 	vq_endchains(vq, 1);
 }
 
+/*
+ * The data of a batch of chains goes to the backend in one call, so in
+ * one writev(). The control messages are still handled one by one.
+ */
 static void
 virtio_console_notify_tx(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_console *console;
 	struct virtio_console_port *port;
-	struct iovec iov[1];
-	uint16_t idx;
-	uint16_t flags[8];
+	struct iovec iov[VIRTIO_CONSOLE_TX_BATCH][VIRTIO_CONSOLE_MAXSEGS];
+	struct iovec data[VIRTIO_CONSOLE_TX_BATCH * VIRTIO_CONSOLE_MAXSEGS];
+	struct vq_chain chains[VIRTIO_CONSOLE_TX_BATCH];
+	int i, j, n, nchains, ndone, ndata;
 
 	console = vdev;
 	port = virtio_console_vq_to_port(console, vq);
+	if (virtio_console_in_kernel(console))
+		return;
+
+	for (j = 0; j < VIRTIO_CONSOLE_TX_BATCH; j++) {
+		chains[j].iov = iov[j];
+		chains[j].flags = NULL;
+		chains[j].iolen = 0;
+	}
 
 	while (vq_has_descs(vq)) {
-		vq_getchain(vq, &idx, iov, 1, flags);
-		if (port != NULL)
-			port->cb(port, port->arg, iov, 1);
+		nchains = vq_getchains(vq, chains, VIRTIO_CONSOLE_TX_BATCH,
+				VIRTIO_CONSOLE_MAXSEGS);
+		if (nchains <= 0)
+			break;
 
-		/*
-		 * Release this chain and handle more
-		 */
-		vq_relchain(vq, idx, 0);
+		ndone = 0;
+		ndata = 0;
+		for (j = 0; j < nchains; j++) {
+			n = chains[j].n;
+			if (n < 1) {
+				WPRINTF(("vtcon: notify_tx vq_getchain error %d\n",
+					n));
+				break;
+			}
+			if (n > VIRTIO_CONSOLE_MAXSEGS)
+				n = VIRTIO_CONSOLE_MAXSEGS;
+			ndone++;
+
+			if (port == &console->control_port)
+				port->cb(port, port->arg, chains[j].iov, n);
+			else
+				for (i = 0; i < n; i++)
+					data[ndata++] = chains[j].iov[i];
+		}
+		if (ndata > 0 && port != NULL)
+			port->cb(port, port->arg, data, ndata);
+
+		/* release the chains of the batch at once */
+		vq_relchains(vq, chains, ndone);
+		if (ndone < nchains)
+			break;
 	}
 	vq_endchains(vq, 1);	/* Generate interrupt if appropriate. */
 }
@@ -409,11 +493,51 @@ virtio_console_notify_rx(void *vdev, struct virtio_vq_info *vq)
 
 	console = vdev;
 	port = virtio_console_vq_to_port(console, vq);
+	if (virtio_console_in_kernel(console))
+		return;
 
+	pthread_mutex_lock(&console->mtx);
 	if (!port->rx_ready) {
 		port->rx_ready = 1;
 		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
 	}
+
+	/* new guest buffers, read the backend again */
+	if (port->rx_evp != NULL && vq_has_descs(vq)) {
+		vq_set_used_ring_flags(&console->base, vq);
+		mevent_enable(port->rx_evp);
+		port->rx_evp = NULL;
+	}
+	pthread_mutex_unlock(&console->mtx);
+}
+
+/*
+ * No guest buffer left: the backend is not read until the guest posts
+ * some, its data waits in the pty, tty or socket rather than being
+ * dropped. Called with the console mutex held.
+ */
+static void
+virtio_console_rx_pause(struct virtio_console_backend *be,
+			struct virtio_vq_info *vq)
+{
+	struct virtio_console_port *port = be->port;
+	struct mevent *evp;
+
+	evp = (be->conn_evp != NULL) ? be->conn_evp : be->evp;
+	if (evp == NULL || port->rx_evp != NULL)
+		return;
+
+	mevent_disable(evp);
+	port->rx_evp = evp;
+	vq_clear_used_ring_flags(&port->console->base, vq);
+
+	/* buffers posted before the kicks were on */
+	atomic_thread_fence();
+	if (vq_has_descs(vq)) {
+		vq_set_used_ring_flags(&port->console->base, vq);
+		mevent_enable(evp);
+		port->rx_evp = NULL;
+	}
 }
 
 static void
@@ -424,6 +548,8 @@ virtio_console_reset_backend(struct virtio_console_backend *be)
 
 	if (be->evp)
 		mevent_disable(be->evp);
+	if (be->port)
+		be->port->rx_evp = NULL;
 	if (be->fd != STDIN_FILENO)
 		close(be->fd);
 	be->fd = -1;
@@ -434,6 +560,8 @@ static void
 virtio_console_socket_clear(struct virtio_console_backend *be)
 {
 	if (be->conn_evp) {
+		if (be->port && be->port->rx_evp == be->conn_evp)
+			be->port->rx_evp = NULL;
 		mevent_delete(be->conn_evp);
 		be->conn_evp = NULL;
 	}
@@ -451,7 +579,7 @@ virtio_console_backend_read(int fd __attribute__((unused)),
 	struct virtio_console_port *port;
 	struct virtio_console_backend *be = arg;
 	struct virtio_vq_info *vq;
-	struct iovec iov;
+	struct iovec iov[VIRTIO_CONSOLE_MAXSEGS];
 	static char dummybuf[2048];
 	int len, n;
 	uint16_t idx;
@@ -459,27 +587,31 @@ virtio_console_backend_read(int fd __attribute__((unused)),
 	port = be->port;
 	vq = virtio_console_port_to_vq(port, true);
 
-	if (!be->open || !port->rx_ready) {
+	if (!be->open || !port->rx_ready ||
+	    virtio_console_in_kernel(port->console)) {
 		len = read(be->fd, dummybuf, sizeof(dummybuf));
 		if (len == 0)
 			goto close;
 		return;
 	}
 
+	pthread_mutex_lock(&port->console->mtx);
 	if (!vq_has_descs(vq)) {
-		len = read(be->fd, dummybuf, sizeof(dummybuf));
-		vq_endchains(vq, 1);
-		if (len == 0)
-			goto close;
+		virtio_console_rx_pause(be, vq);
+		pthread_mutex_unlock(&port->console->mtx);
 		return;
 	}
 
+	/* each chain is filled with one readv() over all its buffers */
 	do {
-		n = vq_getchain(vq, &idx, &iov, 1, NULL);
-		len = readv(be->fd, &iov, n);
+		n = vq_getchain(vq, &idx, iov, VIRTIO_CONSOLE_MAXSEGS, NULL);
+		if (n > VIRTIO_CONSOLE_MAXSEGS)
+			n = VIRTIO_CONSOLE_MAXSEGS;
+		len = readv(be->fd, iov, n);
 		if (len <= 0) {
 			vq_retchain(vq);
 			vq_endchains(vq, 0);
+			pthread_mutex_unlock(&port->console->mtx);
 
 			/* no data available */
 			if (len == -1 && errno == EAGAIN)
@@ -498,6 +630,7 @@ virtio_console_backend_read(int fd __attribute__((unused)),
 	} while (vq_has_descs(vq));
 
 	vq_endchains(vq, 1);
+	pthread_mutex_unlock(&port->console->mtx);
 	return;
 
 close:
@@ -516,20 +649,32 @@ clear:
 	}
 }
 
+/* writev() again on short writes, iov is modified */
 static void
-virtio_console_backend_write(struct virtio_console_port *port, void *arg,
-			     struct iovec *iov, int niov)
+virtio_console_writev(struct virtio_console_backend *be, struct iovec *iov,
+		      int niov)
 {
-	struct virtio_console_backend *be;
-	int ret;
-
-	be = arg;
+	ssize_t ret = 0;
 
 	if (be->fd == -1)
 		return;
 
-	ret = writev(be->fd, iov, niov);
-	if (ret <= 0) {
+	while (niov > 0) {
+		ret = writev(be->fd, iov, niov > IOV_MAX ? IOV_MAX : niov);
+		if (ret <= 0)
+			break;
+
+		while (niov > 0 && (size_t)ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			niov--;
+		}
+		if (niov > 0) {
+			iov->iov_base = (char *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+	if (niov > 0) {
 		/* Case 1:backend cannot receive more data. For example when pts is
 		 * not connected to any client, its tty buffer will become full.
 		 * In this case we just drop data from guest hvc console.
@@ -560,6 +705,91 @@ virtio_console_backend_write(struct virtio_console_port *port, void *arg,
 	}
 }
 
+/* Called with outbuf_mtx held */
+static void
+virtio_console_flush_outbuf(struct virtio_console_backend *be)
+{
+	struct iovec iov;
+
+	if (be->outlen == 0)
+		return;
+
+	iov.iov_base = be->outbuf;
+	iov.iov_len = be->outlen;
+	virtio_console_writev(be, &iov, 1);
+	be->outlen = 0;
+}
+
+static void
+virtio_console_flush_timer(void *arg, uint64_t nexp __attribute__((unused)))
+{
+	struct virtio_console_backend *be = arg;
+
+	pthread_mutex_lock(&be->outbuf_mtx);
+	be->flush_armed = false;
+	virtio_console_flush_outbuf(be);
+	pthread_mutex_unlock(&be->outbuf_mtx);
+}
+
+/*
+ * The output of a file backend goes to the file once the buffer is full
+ * or VIRTIO_CONSOLE_OUTBUF_FLUSH_MS after it was written, whichever is
+ * first.
+ */
+static void
+virtio_console_buffer_write(struct virtio_console_backend *be,
+			    struct iovec *iov, int niov)
+{
+	struct itimerspec ts;
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < niov; i++)
+		len += iov[i].iov_len;
+
+	pthread_mutex_lock(&be->outbuf_mtx);
+	if (be->outlen + len > VIRTIO_CONSOLE_OUTBUF_SIZE)
+		virtio_console_flush_outbuf(be);
+
+	if (len >= VIRTIO_CONSOLE_OUTBUF_SIZE) {
+		virtio_console_writev(be, iov, niov);
+	} else {
+		for (i = 0; i < niov; i++) {
+			memcpy(be->outbuf + be->outlen, iov[i].iov_base,
+				iov[i].iov_len);
+			be->outlen += iov[i].iov_len;
+		}
+
+		if (!be->flush_armed) {
+			memset(&ts, 0, sizeof(ts));
+			ts.it_value.tv_nsec =
+				VIRTIO_CONSOLE_OUTBUF_FLUSH_MS * 1000000L;
+			if (acrn_timer_settime(&be->flush_timer, &ts) == 0)
+				be->flush_armed = true;
+			else
+				virtio_console_flush_outbuf(be);
+		}
+	}
+	pthread_mutex_unlock(&be->outbuf_mtx);
+}
+
+static void
+virtio_console_backend_write(struct virtio_console_port *port, void *arg,
+			     struct iovec *iov, int niov)
+{
+	struct virtio_console_backend *be;
+
+	be = arg;
+
+	if (be->fd == -1)
+		return;
+
+	if (be->outbuf != NULL)
+		virtio_console_buffer_write(be, iov, niov);
+	else
+		virtio_console_writev(be, iov, niov);
+}
+
 static void
 virtio_console_restore_stdio(void)
 {
@@ -816,6 +1046,8 @@ virtio_console_add_backend(struct virtio_console *console, char *opt)
 	char *portname = NULL;
 	char *portpath = NULL;
 	char *socket_type = NULL;
+	char *suffix;
+	bool buffered = false;
 	enum virtio_console_be_type be_type = VIRTIO_CONSOLE_BE_INVALID;
 
 	backend = strsep(&opt, ":");
@@ -848,6 +1080,13 @@ virtio_console_add_backend(struct virtio_console *console, char *opt)
 			portname = strsep(&opt, "=");
 			portpath = opt;
 		}
+		if (be_type == VIRTIO_CONSOLE_BE_FILE && portpath != NULL) {
+			suffix = strrchr(portpath, ':');
+			if (suffix != NULL && !strcmp(suffix, ":buffered")) {
+				*suffix = '\0';
+				buffered = true;
+			}
+		}
 		if (portname == NULL) {
 			WPRINTF(("vtcon: portname missing \n"));
 			error = -1;
@@ -886,6 +1125,24 @@ virtio_console_add_backend(struct virtio_console *console, char *opt)
 	be->portpath = portpath;
 	be->socket_type = socket_type;
 
+	if (buffered) {
+		be->outbuf = malloc(VIRTIO_CONSOLE_OUTBUF_SIZE);
+		if (be->outbuf == NULL) {
+			error = -1;
+			goto out;
+		}
+		pthread_mutex_init(&be->outbuf_mtx, NULL);
+		be->flush_timer.clockid = CLOCK_MONOTONIC;
+		if (acrn_timer_init(&be->flush_timer, virtio_console_flush_timer,
+				be) != 0) {
+			WPRINTF(("vtcon: cannot init the flush timer\n"));
+			free(be->outbuf);
+			be->outbuf = NULL;
+			error = -1;
+			goto out;
+		}
+	}
+
 	if (virtio_console_config_backend(be) < 0) {
 		WPRINTF(("vtcon: virtio_console_config_backend failed\n"));
 		error = -1;
@@ -940,6 +1197,10 @@ out:
 			if (be->be_type == VIRTIO_CONSOLE_BE_PTY &&
 				be->pts_fd > 0)
 				close(be->pts_fd);
+			if (be->outbuf != NULL) {
+				acrn_timer_deinit(&be->flush_timer);
+				free(be->outbuf);
+			}
 			free(be);
 		}
 		if (fd != -1 && fd != STDIN_FILENO)
@@ -957,8 +1218,13 @@ virtio_console_add_backends(struct virtio_console *console, char *opts)
 
 	/* virtio-console,[@]stdio|tty|pty|file:portname[=portpath]
 	 * [,[@]stdio|tty|pty|file:portname[=portpath][:socket_type]]
+	 * with file:portname=portpath:buffered for a buffered file
+	 * [,kernel=on] for the virtqueues served by the kernel module
 	 */
 	while ((opt = strsep(&opts, ",")) != NULL) {
+		/* parsed before */
+		if (vbs_kernel_opt(opt))
+			continue;
 		if (virtio_console_add_backend(console, opt))
 			return -1;
 	}
@@ -990,6 +1256,16 @@ virtio_console_close_backend(struct virtio_console_backend *be)
 			}
 		}
 		break;
+	case VIRTIO_CONSOLE_BE_FILE:
+		if (be->outbuf != NULL) {
+			acrn_timer_deinit(&be->flush_timer);
+			pthread_mutex_lock(&be->outbuf_mtx);
+			virtio_console_flush_outbuf(be);
+			pthread_mutex_unlock(&be->outbuf_mtx);
+			free(be->outbuf);
+			be->outbuf = NULL;
+		}
+		break;
 	default:
 		break;
 	}
@@ -1076,6 +1352,20 @@ virtio_console_close_all(struct virtio_console *console)
 	return rc;
 }
 
+static bool
+virtio_console_has_kernel_opt(const char *opts)
+{
+	char *b, *o, *opt;
+	bool kernel = false;
+
+	b = o = strdup(opts);
+	while (o != NULL && (opt = strsep(&o, ",")) != NULL)
+		kernel = kernel || vbs_kernel_opt(opt);
+	free(b);
+
+	return kernel;
+}
+
 static int
 virtio_console_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
@@ -1120,8 +1410,15 @@ virtio_console_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		DPRINTF(("virtio_console: pthread_mutex_init failed with "
 					"error %d!\n", rc));
 
-	virtio_linkup(&console->base, &virtio_console_ops, console, dev,
-		console->queues, BACKEND_VBSU);
+	/* the DM backends are kept for the fallback to VBS-U */
+	if (virtio_console_has_kernel_opt(opts) &&
+	    vbs_kernel_init(&console->vbs_k, "/dev/vbs_console",
+			&virtio_console_ops) == 0)
+		virtio_linkup(&console->base, &virtio_console_ops_k, console,
+			dev, console->queues, BACKEND_VBSK);
+	else
+		virtio_linkup(&console->base, &virtio_console_ops, console,
+			dev, console->queues, BACKEND_VBSU);
 	console->base.mtx = &console->mtx;
 	console->base.device_caps = VIRTIO_CONSOLE_S_HOSTCAPS;
 
@@ -1141,6 +1438,7 @@ virtio_console_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	pci_set_cfgdata16(dev, PCIR_SUBVEND_0, VIRTIO_VENDOR);
 
 	if (virtio_interrupt_init(&console->base, virtio_uses_msix())) {
+		vbs_kernel_deinit(&console->vbs_k);
 		if (console) {
 			if (console->config)
 				free(console->config);
@@ -1171,6 +1469,7 @@ virtio_console_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 	console = (struct virtio_console *)dev->arg;
 	if (console) {
+		vbs_kernel_deinit(&console->vbs_k);
 		rc = virtio_console_close_all(console);
 		/*
 		 * if all the ports are without mevent attached,
@@ -1186,6 +1485,7 @@ struct pci_vdev_ops pci_ops_virtio_console = {
 	.class_name	= "virtio-console",
 	.vdev_init	= virtio_console_init,
 	.vdev_deinit	= virtio_console_deinit,
+	.vdev_reset	= virtio_pci_reset,
 	.vdev_barwrite	= virtio_pci_write,
 	.vdev_barread	= virtio_pci_read
 };
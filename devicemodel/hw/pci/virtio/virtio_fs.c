@@ -0,0 +1,529 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * virtio-fs device, a directory of the SOS shared with the UOS, served by
+ * a FUSE daemon over vhost-user, e.g. virtiofsd:
+ *
+ *   -s <slot>,virtio-fs,sock=<path>,tag=<tag>[,queues=<n>][,dax=<MB>]
+ *
+ * The daemon serves all the virtqueues, the hiprio one and the <n> request
+ * ones, the DM only emulates the PCI device.
+ *
+ * With dax=<MB>, BAR2 is a DAX window of that size, the shared memory
+ * region 0 of the device. The daemon maps the pages of the host files in
+ * the window of the DM on a FUSE_SETUPMAPPING request of the UOS, and the
+ * DM maps them to the UOS through the EPT: the UOS then reads and writes
+ * the page cache of the SOS in place, with neither a FUSE request nor a
+ * copy. The pages of the window mapped to no file are not in the EPT, the
+ * accesses to them are emulated and read zeroes.
+ */
+
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "dm.h"
+#include "pci_core.h"
+#include "virtio.h"
+#include "vhost.h"
+#include "vmmapi.h"
+#include "dm_string.h"
+
+#define VIRTIO_FS_RINGSZ	128
+#define VIRTIO_FS_MAXREQQ	8
+#define VIRTIO_FS_MAXQ		(1 + VIRTIO_FS_MAXREQQ)	/* and hiprio */
+#define VIRTIO_FS_TAG_LEN	36
+
+#define VIRTIO_FS_DAX_BAR	2
+#define VIRTIO_FS_SHMCAP_ID_CACHE	0
+#define VIRTIO_FS_DAX_PAGE	4096UL
+
+#define VIRTIO_FS_S_VHOSTCAPS	\
+	((1UL << VIRTIO_F_VERSION_1) | (1 << VIRTIO_RING_F_INDIRECT_DESC) | \
+	(1 << VIRTIO_RING_F_EVENT_IDX))
+
+/*
+ * DAX requests of the daemon on the vhost-user slave channel, as the ones
+ * of virtiofsd: up to VHOST_USER_FS_SLAVE_ENTRIES ranges of the window, a
+ * len of ~0 unmaps the whole window.
+ */
+#define VHOST_USER_SLAVE_FS_MAP		6
+#define VHOST_USER_SLAVE_FS_UNMAP	7
+#define VHOST_USER_SLAVE_FS_SYNC	8
+
+#define VHOST_USER_FS_SLAVE_ENTRIES	8
+#define VHOST_USER_FS_FLAG_MAP_R	(1UL << 0)
+#define VHOST_USER_FS_FLAG_MAP_W	(1UL << 1)
+
+struct vhost_user_fs_slave_msg {
+	uint64_t	fd_offset[VHOST_USER_FS_SLAVE_ENTRIES];
+	uint64_t	c_offset[VHOST_USER_FS_SLAVE_ENTRIES];
+	uint64_t	len[VHOST_USER_FS_SLAVE_ENTRIES];
+	uint64_t	flags[VHOST_USER_FS_SLAVE_ENTRIES];
+};
+
+struct virtio_fs_config {
+	char		tag[VIRTIO_FS_TAG_LEN];
+	uint32_t	num_request_queues;
+} __attribute__((packed));
+
+struct virtio_fs {
+	struct virtio_base base;
+	struct virtio_vq_info queues[VIRTIO_FS_MAXQ];
+	struct virtio_ops ops;	/* virtio_fs_ops with the nvq of the queues */
+	pthread_mutex_t mtx;
+	struct virtio_fs_config config;
+	struct vhost_dev vdev;
+	struct vhost_vq	vhost_vqs[VIRTIO_FS_MAXQ];
+
+	/* DAX window, the prot of its pages mapped to a file, or 0 */
+	uint8_t		*dax_base;
+	size_t		dax_size;
+	uint8_t		*dax_prot;
+};
+
+static int virtio_fs_debug;
+#define DPRINTF(params) do { if (virtio_fs_debug) printf params; } while (0)
+#define WPRINTF(params) (printf params)
+
+static void virtio_fs_reset(void *);
+static void virtio_fs_notify(void *, struct virtio_vq_info *);
+static int virtio_fs_cfgread(void *, int, int, uint32_t *);
+static void virtio_fs_set_status(void *, uint64_t);
+
+static struct virtio_ops virtio_fs_ops = {
+	"vtfs",				/* our name */
+	1 + 1,				/* hiprio and 1 request queue */
+	sizeof(struct virtio_fs_config),	/* config reg size */
+	virtio_fs_reset,		/* reset */
+	virtio_fs_notify,		/* device-wide qnotify */
+	virtio_fs_cfgread,		/* read virtio config */
+	NULL,				/* write virtio config */
+	NULL,				/* apply negotiated features */
+	virtio_fs_set_status,		/* called on guest set status */
+};
+
+/*
+ * Map (or unmap) the pages of [off, off + len) of the window mapped to a
+ * file at the window in gpa, a run of pages of the same prot at a time.
+ */
+static void
+virtio_fs_dax_ept(struct virtio_fs *fs, uint64_t gpa, size_t off,
+		  size_t len, bool map)
+{
+	struct vmctx *ctx = fs->base.dev->vmctx;
+	size_t pg, end, run, start, size;
+	uint8_t prot;
+
+	pg = off / VIRTIO_FS_DAX_PAGE;
+	end = (off + len) / VIRTIO_FS_DAX_PAGE;
+	while (pg < end) {
+		prot = fs->dax_prot[pg];
+		for (run = pg + 1; run < end && fs->dax_prot[run] == prot; run++)
+			;
+		start = pg * VIRTIO_FS_DAX_PAGE;
+		size = (run - pg) * VIRTIO_FS_DAX_PAGE;
+		pg = run;
+		if (prot == 0)
+			continue;
+
+		if (map && vm_map_memseg_vma(ctx, size, gpa + start,
+				(uint64_t)(fs->dax_base + start), prot) < 0)
+			WPRINTF(("vtfs: cannot map 0x%lx of the DAX window, "
+				"errno %d\n", start, errno));
+		else if (!map && vm_unmap_memseg(ctx, gpa + start, size) < 0)
+			WPRINTF(("vtfs: cannot unmap 0x%lx of the DAX window, "
+				"errno %d\n", start, errno));
+	}
+}
+
+static bool
+virtio_fs_dax_range(struct virtio_fs *fs, uint64_t off, uint64_t len)
+{
+	return len > 0 && off < fs->dax_size && len <= fs->dax_size - off &&
+		(off % VIRTIO_FS_DAX_PAGE) == 0 &&
+		(len % VIRTIO_FS_DAX_PAGE) == 0;
+}
+
+/* back to the pages of no file, out of the EPT */
+static int
+virtio_fs_dax_unmap(struct virtio_fs *fs, size_t off, size_t len)
+{
+	uint64_t gpa = fs->base.dev->bar[VIRTIO_FS_DAX_BAR].addr;
+
+	virtio_fs_dax_ept(fs, gpa, off, len, false);
+	memset(fs->dax_prot + off / VIRTIO_FS_DAX_PAGE, 0,
+		len / VIRTIO_FS_DAX_PAGE);
+	if (mmap(fs->dax_base + off, len, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+			-1, 0) == MAP_FAILED)
+		return -1;
+
+	return 0;
+}
+
+static int
+virtio_fs_dax_map(struct virtio_fs *fs, int fd, uint64_t fd_offset,
+		  size_t off, size_t len, uint64_t flags)
+{
+	uint64_t gpa = fs->base.dev->bar[VIRTIO_FS_DAX_BAR].addr;
+	int prot = 0;
+
+	if (flags & VHOST_USER_FS_FLAG_MAP_R)
+		prot |= PROT_READ;
+	if (flags & VHOST_USER_FS_FLAG_MAP_W)
+		prot |= PROT_WRITE;
+	if (prot == 0)
+		return -1;
+
+	/* a mapping over another one replaces it */
+	virtio_fs_dax_ept(fs, gpa, off, len, false);
+	memset(fs->dax_prot + off / VIRTIO_FS_DAX_PAGE, 0,
+		len / VIRTIO_FS_DAX_PAGE);
+	if (mmap(fs->dax_base + off, len, prot, MAP_SHARED | MAP_FIXED, fd,
+			fd_offset) == MAP_FAILED) {
+		WPRINTF(("vtfs: cannot map 0x%lx bytes at 0x%lx of the DAX "
+			"window, errno %d\n", len, off, errno));
+		virtio_fs_dax_unmap(fs, off, len);
+		return -1;
+	}
+
+	memset(fs->dax_prot + off / VIRTIO_FS_DAX_PAGE, prot,
+		len / VIRTIO_FS_DAX_PAGE);
+	virtio_fs_dax_ept(fs, gpa, off, len, true);
+	return 0;
+}
+
+static uint64_t
+virtio_fs_slave_request(void *arg, uint32_t request, void *payload,
+			uint32_t size, int *fds, int nfds)
+{
+	struct virtio_fs *fs = arg;
+	struct vhost_user_fs_slave_msg *msg = payload;
+	uint64_t off, len;
+	int i, ret = 0;
+
+	if (fs->dax_base == NULL || size != sizeof(*msg) ||
+	    (request == VHOST_USER_SLAVE_FS_MAP && nfds != 1)) {
+		WPRINTF(("vtfs: bad slave request %u\n", request));
+		return -1;
+	}
+
+	pthread_mutex_lock(&fs->mtx);
+	for (i = 0; i < VHOST_USER_FS_SLAVE_ENTRIES && ret == 0; i++) {
+		off = msg->c_offset[i];
+		len = msg->len[i];
+		if (len == 0)
+			continue;
+		if (request == VHOST_USER_SLAVE_FS_UNMAP && len == ~0UL) {
+			off = 0;
+			len = fs->dax_size;
+		}
+		if (!virtio_fs_dax_range(fs, off, len)) {
+			WPRINTF(("vtfs: bad DAX range 0x%lx+0x%lx\n",
+				off, len));
+			ret = -1;
+			break;
+		}
+
+		DPRINTF(("vtfs: slave request %u 0x%lx+0x%lx\n", request,
+			off, len));
+		switch (request) {
+		case VHOST_USER_SLAVE_FS_MAP:
+			ret = virtio_fs_dax_map(fs, fds[0],
+				msg->fd_offset[i], off, len, msg->flags[i]);
+			break;
+		case VHOST_USER_SLAVE_FS_UNMAP:
+			ret = virtio_fs_dax_unmap(fs, off, len);
+			break;
+		case VHOST_USER_SLAVE_FS_SYNC:
+			ret = msync(fs->dax_base + off, len, MS_SYNC);
+			break;
+		default:
+			WPRINTF(("vtfs: unknown slave request %u\n", request));
+			ret = -1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&fs->mtx);
+
+	return ret == 0 ? 0 : -1;
+}
+
+/* the EPT follows the window when the UOS moves the BAR */
+static void
+virtio_fs_update_bar_map(struct vmctx *ctx, struct pci_vdev *dev, int idx,
+			 uint64_t orig_addr)
+{
+	struct virtio_fs *fs = dev->arg;
+
+	if (fs == NULL || fs->dax_base == NULL || idx != VIRTIO_FS_DAX_BAR)
+		return;
+
+	pthread_mutex_lock(&fs->mtx);
+	virtio_fs_dax_ept(fs, orig_addr, 0, fs->dax_size, false);
+	virtio_fs_dax_ept(fs, dev->bar[idx].addr, 0, fs->dax_size, true);
+	pthread_mutex_unlock(&fs->mtx);
+}
+
+static void
+virtio_fs_notify(void *vdev, struct virtio_vq_info *vq)
+{
+	/* all the queues are served by the daemon */
+}
+
+static int
+virtio_fs_cfgread(void *vdev, int offset, int size, uint32_t *retval)
+{
+	struct virtio_fs *fs = vdev;
+
+	if (offset + size > sizeof(fs->config))
+		return -1;
+
+	*retval = 0;
+	memcpy(retval, (uint8_t *)&fs->config + offset, size);
+	return 0;
+}
+
+static void
+virtio_fs_set_status(void *vdev, uint64_t status)
+{
+	struct virtio_fs *fs = vdev;
+
+	if (!fs->vdev.started && (status & VIRTIO_CONFIG_S_DRIVER_OK)) {
+		if (vhost_dev_start(&fs->vdev) < 0)
+			WPRINTF(("vtfs: vhost_dev_start failed\n"));
+	} else if (fs->vdev.started &&
+		   (status & VIRTIO_CONFIG_S_DRIVER_OK) == 0) {
+		if (vhost_dev_stop(&fs->vdev) < 0)
+			WPRINTF(("vtfs: vhost_dev_stop failed\n"));
+	}
+}
+
+static void
+virtio_fs_reset(void *vdev)
+{
+	struct virtio_fs *fs = vdev;
+
+	DPRINTF(("vtfs: device reset requested!\n"));
+	if (fs->vdev.started && vhost_dev_stop(&fs->vdev) < 0)
+		WPRINTF(("vtfs: vhost_dev_stop failed\n"));
+
+	/* the mappings of the window go with the FUSE session */
+	if (fs->dax_base)
+		virtio_fs_dax_unmap(fs, 0, fs->dax_size);
+	virtio_reset_dev(&fs->base);
+}
+
+/* the window is reserved in the DM, the daemon maps the files in it */
+static int
+virtio_fs_dax_init(struct virtio_fs *fs, struct pci_vdev *dev)
+{
+	struct virtio_pci_cap64 shm = {
+		.cap.cap_vndr = PCIY_VENDOR,
+		.cap.cap_next = 0,
+		.cap.cap_len = sizeof(shm),
+		.cap.cfg_type = VIRTIO_PCI_CAP_SHARED_MEMORY_CFG,
+		.cap.bar = VIRTIO_FS_DAX_BAR,
+		.cap.id = VIRTIO_FS_SHMCAP_ID_CACHE,
+		.cap.offset = 0,
+		.cap.length = (uint32_t)fs->dax_size,
+		.offset_hi = 0,
+		.length_hi = (uint32_t)(fs->dax_size >> 32),
+	};
+
+	fs->dax_base = mmap(NULL, fs->dax_size, PROT_NONE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (fs->dax_base == MAP_FAILED) {
+		fs->dax_base = NULL;
+		return -1;
+	}
+	fs->dax_prot = calloc(fs->dax_size / VIRTIO_FS_DAX_PAGE, 1);
+	if (fs->dax_prot == NULL)
+		goto fail;
+
+	if (pci_emul_add_capability(dev, (u_char *)&shm, sizeof(shm)) != 0 ||
+	    pci_emul_alloc_bar(dev, VIRTIO_FS_DAX_BAR, PCIBAR_MEM64,
+			fs->dax_size) != 0) {
+		WPRINTF(("vtfs: cannot allocate the DAX window\n"));
+		goto fail;
+	}
+
+	if (vhost_user_set_slave_handler(&fs->vdev, virtio_fs_slave_request,
+			fs) < 0) {
+		WPRINTF(("vtfs: the daemon has no DAX support\n"));
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	free(fs->dax_prot);
+	fs->dax_prot = NULL;
+	munmap(fs->dax_base, fs->dax_size);
+	fs->dax_base = NULL;
+	return -1;
+}
+
+static int
+virtio_fs_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct virtio_fs *fs;
+	pthread_mutexattr_t attr;
+	char *opt, *path = NULL, *tag = NULL;
+	long nq = 1, dax = 0;
+	int i;
+
+	while ((opt = strsep(&opts, ",")) != NULL) {
+		if (!strncmp(opt, "sock=", 5))
+			path = opt + 5;
+		else if (!strncmp(opt, "tag=", 4))
+			tag = opt + 4;
+		else if (!strncmp(opt, "queues=", 7)) {
+			if (dm_strtol(opt + 7, NULL, 10, &nq) != 0)
+				nq = 0;
+		} else if (!strncmp(opt, "dax=", 4)) {
+			if (dm_strtol(opt + 4, NULL, 10, &dax) != 0)
+				dax = -1;
+		} else
+			WPRINTF(("vtfs: invalid option %s\n", opt));
+	}
+
+	if (path == NULL || tag == NULL || *tag == '\0' ||
+	    strlen(tag) > VIRTIO_FS_TAG_LEN) {
+		WPRINTF(("vtfs: needs sock=<path>,tag=<at most %d chars>\n",
+			VIRTIO_FS_TAG_LEN));
+		return -1;
+	}
+	if (nq < 1 || nq > VIRTIO_FS_MAXREQQ) {
+		WPRINTF(("vtfs: 1 to %d request queues\n", VIRTIO_FS_MAXREQQ));
+		return -1;
+	}
+	/* a power of 2 for the BAR to be all of the window */
+	if (dax < 0 || (dax & (dax - 1)) != 0) {
+		WPRINTF(("vtfs: the DAX window is a power of 2 MB\n"));
+		return -1;
+	}
+
+	fs = calloc(1, sizeof(struct virtio_fs));
+	if (!fs) {
+		WPRINTF(("vtfs: calloc returns NULL\n"));
+		return -1;
+	}
+	/* not NUL terminated when the tag is the whole field */
+	strncpy(fs->config.tag, tag, VIRTIO_FS_TAG_LEN);
+	fs->config.num_request_queues = nq;
+	fs->dax_size = (size_t)dax * MB;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&fs->mtx, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	fs->ops = virtio_fs_ops;
+	fs->ops.nvq = 1 + nq;
+	virtio_linkup(&fs->base, &fs->ops, fs, dev, fs->queues,
+		BACKEND_VHOST);
+	fs->base.mtx = &fs->mtx;
+	fs->base.device_caps = VIRTIO_FS_S_VHOSTCAPS;
+	for (i = 0; i < fs->ops.nvq; i++)
+		fs->queues[i].qsize = VIRTIO_FS_RINGSZ;
+
+	pci_set_cfgdata16(dev, PCIR_DEVICE, 0x1040 + VIRTIO_TYPE_FS);
+	pci_set_cfgdata16(dev, PCIR_VENDOR, VIRTIO_VENDOR);
+	pci_set_cfgdata8(dev, PCIR_CLASS, PCIC_STORAGE);
+	pci_set_cfgdata8(dev, PCIR_SUBCLASS, PCIS_STORAGE_OTHER);
+	pci_set_cfgdata16(dev, PCIR_SUBDEV_0, 0x1100);
+	pci_set_cfgdata16(dev, PCIR_SUBVEND_0, VIRTIO_VENDOR);
+	pci_set_cfgdata16(dev, PCIR_REVID, 1);
+
+	fs->vdev.nvqs = fs->ops.nvq;
+	fs->vdev.vqs = fs->vhost_vqs;
+	if (vhost_user_dev_init(&fs->vdev, &fs->base, path, 0,
+			VIRTIO_FS_S_VHOSTCAPS, 0) < 0) {
+		WPRINTF(("vtfs: vhost-user %s failed\n", path));
+		goto fail;
+	}
+
+	if (virtio_interrupt_init(&fs->base, virtio_uses_msix()))
+		goto fail_vhost;
+	if (virtio_set_modern_bar(&fs->base, false))
+		goto fail_vhost;
+	if (fs->dax_size > 0 && virtio_fs_dax_init(fs, dev) < 0)
+		goto fail_vhost;
+
+	DPRINTF(("vtfs: tag %s on %s, %ld request queues, %ld MB DAX\n",
+		tag, path, nq, dax));
+	return 0;
+
+fail_vhost:
+	vhost_dev_deinit(&fs->vdev);
+fail:
+	pthread_mutex_destroy(&fs->mtx);
+	dev->arg = NULL;
+	free(fs);
+	return -1;
+}
+
+static void
+virtio_fs_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct virtio_fs *fs = dev->arg;
+
+	if (fs == NULL)
+		return;
+
+	if (fs->vdev.started)
+		vhost_dev_stop(&fs->vdev);
+	vhost_dev_deinit(&fs->vdev);
+	if (fs->dax_base) {
+		virtio_fs_dax_unmap(fs, 0, fs->dax_size);
+		munmap(fs->dax_base, fs->dax_size);
+		free(fs->dax_prot);
+	}
+
+	pthread_mutex_destroy(&fs->mtx);
+	free(fs);
+	dev->arg = NULL;
+}
+
+static void
+virtio_fs_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
+		int baridx, uint64_t offset, int size, uint64_t value)
+{
+	/* the pages of the window mapped to no file */
+	if (baridx == VIRTIO_FS_DAX_BAR)
+		return;
+
+	virtio_pci_write(ctx, vcpu, dev, baridx, offset, size, value);
+}
+
+static uint64_t
+virtio_fs_read(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
+	       int baridx, uint64_t offset, int size)
+{
+	if (baridx == VIRTIO_FS_DAX_BAR)
+		return 0;
+
+	return virtio_pci_read(ctx, vcpu, dev, baridx, offset, size);
+}
+
+struct pci_vdev_ops pci_ops_virtio_fs = {
+	.class_name		= "virtio-fs",
+	.vdev_init		= virtio_fs_init,
+	.vdev_deinit		= virtio_fs_deinit,
+	.vdev_reset		= virtio_pci_reset,
+	.vdev_update_bar_map	= virtio_fs_update_bar_map,
+	.vdev_barwrite		= virtio_fs_write,
+	.vdev_barread		= virtio_fs_read
+};
+DEFINE_PCI_DEVTYPE(pci_ops_virtio_fs);
@@ -24,6 +24,8 @@
 #include "mevent.h"
 #include "virtio.h"
 #include "gpio_dm.h"
+#include "timer.h"
+#include "atomic.h"
 
 /*
  *  GPIO virtualization architecture
@@ -117,7 +119,7 @@ static FILE *dbg_file;
 	}								\
 } while (0)
 
-#define BIT(x) (1 << (x))
+#define BIT(x) (1UL << (x))
 
 /* Virtio GPIO supports maximum number of virtual gpio */
 #define VIRTIO_GPIO_MAX_VLINES	64
@@ -128,6 +130,12 @@ static FILE *dbg_file;
 /* Virtio GPIO virtqueue numbers*/
 #define VIRTIO_GPIO_MAXQ	3
 
+/* max irq coalescing window, in us */
+#define VIRTIO_GPIO_MAX_IRQ_WINDOW	100000
+
+/* line events read at once */
+#define VIRTIO_GPIO_IRQ_EVENTS	16
+
 /* Virtio GPIO capabilities */
 #define VIRTIO_GPIO_F_CHIP	1
 #define VIRTIO_GPIO_S_HOSTCAPS	VIRTIO_GPIO_F_CHIP
@@ -263,12 +271,21 @@ struct gpio_irq_desc {
 	uint64_t		intr_stat;	/* interrupts count */
 };
 
+/*
+ * The edges set intr_pending with atomics, so the line events do not
+ * take intr_mtx. It is taken to move the pending interrupts in service,
+ * all of them in one bitmap event.
+ */
 struct gpio_irq_chip {
 	pthread_mutex_t		intr_mtx;
 	struct gpio_irq_desc	descs[VIRTIO_GPIO_MAX_VLINES];
 	uint64_t		intr_pending;	/* pending interrupts */
 	uint64_t		intr_service;	/* service interrupts */
 	uint64_t		intr_stat;	/* all interrupts count */
+	struct mevent_loop	*evloop;	/* line events, NULL for main */
+	uint32_t		window_us;	/* coalescing window, 0 if none */
+	struct acrn_timer	window_timer;
+	bool			window_armed;
 };
 
 struct virtio_gpio {
@@ -844,7 +861,8 @@ static int
 native_gpio_init(struct virtio_gpio *gpio, char *opts)
 {
 	struct gpio_line *line;
-	char *cstr, *lstr, *tmp, *b, *o;
+	char *cstr, *lstr, *tmp, *b, *o, *r, *end;
+	unsigned long window;
 	int rc;
 	int cn = 0;
 	int ln = 0;
@@ -855,11 +873,33 @@ native_gpio_init(struct virtio_gpio *gpio, char *opts)
 	 * <@chip_name0{offset|name[=vname]:offset|name[=vname]:...}
 	 * [@chip_name1{offset|name[=vname]:offset|name[=vname]:...}]
 	 * [@chip_name2{offset|name[=vname]:offset|name[=vname]:...}]
-	 * ...>
+	 * ...>[,irq_window=<us>]
+	 *
+	 * irq_window coalesces the edges of all the lines coming within
+	 * the given time after one into a single interrupt.
 	 */
 
 	b = o = strdup(opts);
-	while ((tmp = strsep(&o, "@")) != NULL) {
+	if (!b)
+		return -1;
+	r = strsep(&o, ",");
+	while ((tmp = strsep(&o, ",")) != NULL) {
+		if (!strncmp(tmp, "irq_window=", strlen("irq_window="))) {
+			tmp += strlen("irq_window=");
+			window = strtoul(tmp, &end, 10);
+			if (end == tmp || *end != '\0' ||
+					window > VIRTIO_GPIO_MAX_IRQ_WINDOW) {
+				DPRINTF("virtio gpio, invalid irq_window %s\n",
+						tmp);
+				free(b);
+				return -1;
+			}
+			gpio->irq_chip.window_us = window;
+		} else
+			DPRINTF("virtio gpio, unknown option %s\n", tmp);
+	}
+
+	while ((tmp = strsep(&r, "@")) != NULL) {
 
 		/* discard subsequent chips */
 		if (cn >= VIRTIO_GPIO_MAX_CHIPS ||
@@ -921,7 +961,7 @@ native_gpio_init(struct virtio_gpio *gpio, char *opts)
 	return ln == 0 ? -1 : 0;
 }
 
-static void
+static bool
 gpio_irq_deliver_intr(struct virtio_gpio *gpio, uint64_t mask)
 {
 	struct virtio_vq_info *vq;
@@ -938,7 +978,7 @@ gpio_irq_deliver_intr(struct virtio_gpio *gpio, uint64_t mask)
 			DPRINTF("virtio gpio, invalid gpio data size %lu\n",
 					iov[0].iov_len);
 			virtio_gpio_abort(vq, idx);
-			return;
+			return false;
 		}
 
 		*data = mask;
@@ -953,87 +993,143 @@ gpio_irq_deliver_intr(struct virtio_gpio *gpio, uint64_t mask)
 
 		/* interrupt statistics */
 		record_intr_statistics(&gpio->irq_chip, mask);
+		return true;
+	}
 
-	} else
-		DPRINTF("virtio gpio failed to send an IRQ, mask %lu", mask);
+	DPRINTF("virtio gpio failed to send an IRQ, mask %lu", mask);
+	return false;
 }
 
+/*
+ * If all interrupts in service are acknowledged, the pending ones go to
+ * the guest in one event.
+ */
 static void
-gpio_irq_generate_intr(struct virtio_gpio *gpio, int pin)
+gpio_irq_flush_intr(struct virtio_gpio *gpio)
 {
 	struct gpio_irq_chip *chip;
-	struct gpio_irq_desc *desc;
 
 	chip = &gpio->irq_chip;
-	desc = &chip->descs[pin];
+	pthread_mutex_lock(&chip->intr_mtx);
+	if (!chip->intr_service) {
+		chip->intr_service = atomic_xchg(&chip->intr_pending, 0);
 
-	/* Ignore interrupt until it is unmasked */
-	if (desc->mask)
-		return;
+		/* deliver interrupt, kept pending if there is no buffer */
+		if (chip->intr_service &&
+				!gpio_irq_deliver_intr(gpio, chip->intr_service)) {
+			atomic_fetch_or(&chip->intr_pending, chip->intr_service);
+			chip->intr_service = 0;
+		}
+	}
+	pthread_mutex_unlock(&chip->intr_mtx);
+}
 
-	pthread_mutex_lock(&chip->intr_mtx);
+static void
+gpio_irq_window_timer(void *arg, uint64_t nexp __attribute__((unused)))
+{
+	struct virtio_gpio *gpio = arg;
 
-	/* set it to pending mask */
-	chip->intr_pending |= BIT(pin);
+	atomic_store(&gpio->irq_chip.window_armed, false);
+	gpio_irq_flush_intr(gpio);
+}
 
-	/*
-	 * if all interrupts in service are acknowledged, then send pending
-	 * interrupts.
-	 */
-	if (!chip->intr_service) {
-		chip->intr_service = chip->intr_pending;
-		chip->intr_pending = 0;
+/* the pending interrupts go now or at the end of the window */
+static void
+gpio_irq_kick_intr(struct virtio_gpio *gpio)
+{
+	struct gpio_irq_chip *chip;
+	struct itimerspec ts;
 
-		/* deliver interrupt */
-		gpio_irq_deliver_intr(gpio, chip->intr_service);
+	chip = &gpio->irq_chip;
+	if (!chip->window_us) {
+		gpio_irq_flush_intr(gpio);
+		return;
 	}
-	pthread_mutex_unlock(&chip->intr_mtx);
+
+	if (atomic_xchg(&chip->window_armed, true))
+		return;
+
+	memset(&ts, 0, sizeof(ts));
+	ts.it_value.tv_sec = chip->window_us / 1000000;
+	ts.it_value.tv_nsec = (chip->window_us % 1000000) * 1000;
+	if (acrn_timer_settime(&chip->window_timer, &ts) != 0) {
+		atomic_store(&chip->window_armed, false);
+		gpio_irq_flush_intr(gpio);
+	}
+}
+
+static bool
+gpio_irq_set_pending(struct gpio_irq_chip *chip, int pin)
+{
+	/* Ignore interrupt until it is unmasked */
+	if (atomic_load(&chip->descs[pin].mask))
+		return false;
+
+	/* set it to pending mask */
+	atomic_fetch_or(&chip->intr_pending, BIT(pin));
+	return true;
+}
+
+static void
+gpio_irq_generate_intr(struct virtio_gpio *gpio, int pin)
+{
+	if (gpio_irq_set_pending(&gpio->irq_chip, pin))
+		gpio_irq_kick_intr(gpio);
 }
 
+/* runs on the irq event loop, the mevent main loop without one */
 static void
 gpio_irq_set_pin_state(int fd __attribute__((unused)),
 		enum ev_type t __attribute__((unused)),
 		void *arg)
 {
-	struct gpioevent_data data;
+	struct gpioevent_data data[VIRTIO_GPIO_IRQ_EVENTS];
 	struct virtio_gpio *gpio;
 	struct gpio_irq_desc *desc;
-	int err;
+	bool pending = false;
+	int i, n, len;
 
 	desc = (struct gpio_irq_desc *) arg;
 	gpio = (struct virtio_gpio *) desc->data;
 
-	/* get pin state */
-	memset(&data, 0, sizeof(data));
-	err = read(desc->fd, &data, sizeof(data));
-	if (err != sizeof(data)) {
+	/* get pin state, all the edges since the last read */
+	len = read(desc->fd, data, sizeof(data));
+	if (len < (int)sizeof(data[0])) {
 		DPRINTF("virtio gpio, gpio mevent read error %s, len %d\n",
-				strerror(errno), err);
+				strerror(errno), len);
 		return;
 	}
 
-	if (data.id == GPIOEVENT_EVENT_RISING_EDGE) {
-
-		/* pin level is high */
-		desc->level = 1;
-
-		/* jitter protection */
-		if ((desc->mode & IRQ_TYPE_EDGE_RISING)
-				|| (desc->mode & IRQ_TYPE_LEVEL_HIGH)) {
-			gpio_irq_generate_intr(gpio, desc->pin);
-		}
-	} else if (data.id == GPIOEVENT_EVENT_FALLING_EDGE) {
-
-		/* pin level is low */
-		desc->level = 0;
+	n = len / sizeof(data[0]);
+	for (i = 0; i < n; i++) {
+		if (data[i].id == GPIOEVENT_EVENT_RISING_EDGE) {
+
+			/* pin level is high */
+			atomic_store(&desc->level, 1);
+
+			/* jitter protection */
+			if ((desc->mode & IRQ_TYPE_EDGE_RISING)
+					|| (desc->mode & IRQ_TYPE_LEVEL_HIGH))
+				pending |= gpio_irq_set_pending(&gpio->irq_chip,
+						desc->pin);
+		} else if (data[i].id == GPIOEVENT_EVENT_FALLING_EDGE) {
+
+			/* pin level is low */
+			atomic_store(&desc->level, 0);
+
+			/* jitter protection */
+			if ((desc->mode & IRQ_TYPE_EDGE_FALLING)
+					|| (desc->mode & IRQ_TYPE_LEVEL_LOW))
+				pending |= gpio_irq_set_pending(&gpio->irq_chip,
+						desc->pin);
+		} else
+			DPRINTF("virtio gpio, undefined GPIO event id %d\n",
+					data[i].id);
+	}
 
-		/* jitter protection */
-		if ((desc->mode & IRQ_TYPE_EDGE_FALLING)
-				|| (desc->mode & IRQ_TYPE_LEVEL_LOW)) {
-			gpio_irq_generate_intr(gpio, desc->pin);
-		}
-	} else
-		DPRINTF("virtio gpio, undefined GPIO event id %d\n", data.id);
+	/* one interrupt for the edges of the read */
+	if (pending)
+		gpio_irq_kick_intr(gpio);
 }
 
 static void
@@ -1133,7 +1229,7 @@ gpio_irq_enable(struct virtio_gpio *gpio, unsigned int pin,
 	}
 
 	desc->fd = req.fd;
-	desc->mevt = mevent_add(desc->fd, EVF_READ,
+	desc->mevt = mevent_add_loop(chip->evloop, desc->fd, EVF_READ,
 			gpio_irq_set_pin_state, desc,
 			gpio_irq_teardown, desc);
 	if (!desc->mevt) {
@@ -1159,8 +1255,8 @@ gpio_irq_has_pending_intr(struct gpio_irq_desc *desc)
 	if (desc->mode & IRQ_TYPE_LEVEL_MASK) {
 		level_high = desc->mode & IRQ_TYPE_LEVEL_HIGH;
 		level_low = desc->mode & IRQ_TYPE_LEVEL_LOW;
-		if ((level_high && desc->level == 1) ||
-				(level_low && desc->level == 0))
+		if ((level_high && atomic_load(&desc->level) == 1) ||
+				(level_low && atomic_load(&desc->level) == 0))
 			return true;
 	}
 	return false;
@@ -1222,13 +1318,16 @@ virtio_gpio_irq_proc(struct virtio_gpio *gpio, struct iovec *iov, uint16_t flag)
 		 */
 		gpio_irq_clear_intr(chip, req->pin);
 		if (gpio_irq_has_pending_intr(desc))
-			gpio_irq_generate_intr(gpio, req->pin);
+			gpio_irq_set_pending(chip, req->pin);
+
+		/* the edges coming while in service */
+		gpio_irq_flush_intr(gpio);
 		break;
 	case IRQ_ACTION_MASK:
-		desc->mask = true;
+		atomic_store(&desc->mask, true);
 		break;
 	case IRQ_ACTION_UNMASK:
-		desc->mask = false;
+		atomic_store(&desc->mask, false);
 		if (gpio_irq_has_pending_intr(desc))
 			gpio_irq_generate_intr(gpio, req->pin);
 		break;
@@ -1281,7 +1380,6 @@ gpio_irq_deinit(struct virtio_gpio *gpio)
 	int i;
 
 	chip = &gpio->irq_chip;
-	pthread_mutex_destroy(&chip->intr_mtx);
 	for (i = 0; i < gpio->nvline; i++) {
 		desc = &chip->descs[i];
 		if (desc->mevt) {
@@ -1292,6 +1390,13 @@ gpio_irq_deinit(struct virtio_gpio *gpio)
 		/* desc fd will be closed by mevent teardown */
 		}
 	}
+
+	/* runs the teardown of the line events just deleted */
+	mevent_loop_destroy(chip->evloop);
+	chip->evloop = NULL;
+	if (chip->window_us)
+		acrn_timer_deinit(&chip->window_timer);
+	pthread_mutex_destroy(&chip->intr_mtx);
 }
 
 static int
@@ -1318,6 +1423,20 @@ gpio_irq_init(struct virtio_gpio *gpio)
 		desc->gpio = line;
 		line->irq = desc;
 	}
+
+	/* the line events do not wait behind the other devices */
+	chip->evloop = mevent_loop_create("vtgpio irq", -1);
+	if (chip->evloop == NULL)
+		DPRINTF("%s", "virtio gpio: irq events left to the main loop\n");
+
+	if (chip->window_us) {
+		chip->window_timer.clockid = CLOCK_MONOTONIC;
+		if (acrn_timer_init(&chip->window_timer, gpio_irq_window_timer,
+				gpio) != 0) {
+			DPRINTF("%s", "virtio gpio: no irq window timer\n");
+			chip->window_us = 0;
+		}
+	}
 	return 0;
 }
 
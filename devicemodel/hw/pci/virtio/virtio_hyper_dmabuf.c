@@ -34,6 +34,12 @@
 /* Hyper dmabuf uses two queues one for Rx and one for Tx */
 #define HYPER_DMABUF_VQ_NUM 2
 
+/*
+ * The page list of a shared buffer goes in one indirect descriptor table,
+ * a single ring slot per export whatever the number of pages.
+ */
+#define HYPER_DMABUF_S_HOSTCAPS (1 << VIRTIO_RING_F_INDIRECT_DESC)
+
 const char *hyper_dmabuf_vbs_dev_path = "/dev/vbs_hyper_dmabuf";
 
 static int virtio_hyper_dmabuf_debug;
@@ -312,6 +318,7 @@ virtio_hyper_dmabuf_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	}
 
 	hyper_dmabuf->base.mtx = &hyper_dmabuf->mtx;
+	hyper_dmabuf->base.device_caps = HYPER_DMABUF_S_HOSTCAPS;
 
 	hyper_dmabuf->vq[0].qsize = HYPER_DMABUF_RINGSZ;
 	hyper_dmabuf->vq[1].qsize = HYPER_DMABUF_RINGSZ;
@@ -96,10 +96,31 @@ struct virtio_i2c_hdr {
 	uint16_t len;       /*msg length*/
 }__attribute__((packed));
 
+/*
+ * The msgs of consecutive chains to the same adapter, done in one I2C_RDWR
+ * ioctl by the worker thread of the adapter. The frontend queues the msgs
+ * of one i2c transfer at a time, the batch keeps them in one combined
+ * transaction, with a repeated START between them, as on the native bus.
+ */
+struct i2c_batch {
+	STAILQ_ENTRY(i2c_batch) link;
+	int		nmsgs;
+	struct i2c_msg	msgs[I2C_RDRW_IOCTL_MAX_MSGS];
+	uint8_t		*status[I2C_RDRW_IOCTL_MAX_MSGS];
+	uint16_t	idx[I2C_RDRW_IOCTL_MAX_MSGS];
+};
+
 struct native_i2c_adapter {
 	int 		fd;
 	int 		bus;
 	bool 		i2cdev_enable[MAX_I2C_VDEV];
+	struct virtio_i2c *vi2c;
+	pthread_t	tid;
+	pthread_mutex_t	mtx;
+	pthread_cond_t	cond;
+	STAILQ_HEAD(, i2c_batch) batches;
+	bool		running;
+	bool		closing;
 };
 
 /*
@@ -114,11 +135,6 @@ struct virtio_i2c {
 	char acpi_nodes[MAX_I2C_VDEV][MAX_NODE_NAME_LEN];
 	struct virtio_vq_info vq;
 	char ident[256];
-	pthread_t req_tid;
-	pthread_mutex_t req_mtx;
-	pthread_cond_t req_cond;
-	int in_process;
-	int closing;
 };
 
 static void virtio_i2c_reset(void *);
@@ -390,40 +406,127 @@ native_adapter_find(struct virtio_i2c *vi2c, uint16_t addr)
 	return NULL;
 }
 
-static uint8_t
-native_adapter_proc(struct virtio_i2c *vi2c, struct i2c_msg *msg)
+static void
+native_adapter_proc(struct native_i2c_adapter *adapter, struct i2c_batch *batch)
 {
-	int ret;
-	uint16_t addr;
+	struct virtio_i2c *vi2c = adapter->vi2c;
 	struct i2c_rdwr_ioctl_data work_queue;
+	struct i2c_msg *msg;
+	int i, ret;
+
+	work_queue.nmsgs = batch->nmsgs;
+	work_queue.msgs = batch->msgs;
+
+	/*
+	 * I2C_RDWR returns the number of msgs transferred, the ones after
+	 * it, or all of them on an error, fail.
+	 */
+	ret = ioctl(adapter->fd, I2C_RDWR, &work_queue);
+	for (i = 0; i < batch->nmsgs; i++) {
+		msg = &batch->msgs[i];
+		*batch->status[i] = (i < ret) ? I2C_MSG_OK : I2C_MSG_ERR;
+		if (msg->len)
+			DPRINTF("i2c_core: i2c msg: flags=0x%x, addr=0x%x, len=0x%x buf=%x\n",
+					msg->flags,
+					msg->addr,
+					msg->len,
+					msg->buf[0]);
+		else
+			DPRINTF("i2c_core: i2c msg: flags=0x%x, addr=0x%x, len=0x%x\n",
+					msg->flags,
+					msg->addr,
+					msg->len);
+	}
+
+	pthread_mutex_lock(&vi2c->mtx);
+	for (i = 0; i < batch->nmsgs; i++)
+		vq_relchain(&vi2c->vq, batch->idx[i], 1);
+	vq_endchains(&vi2c->vq, 0);
+	pthread_mutex_unlock(&vi2c->mtx);
+}
+
+static void *
+native_adapter_thread(void *arg)
+{
+	struct native_i2c_adapter *adapter = arg;
+	struct i2c_batch *batch;
+
+	for (;;) {
+		pthread_mutex_lock(&adapter->mtx);
+		while (STAILQ_EMPTY(&adapter->batches) && !adapter->closing)
+			pthread_cond_wait(&adapter->cond, &adapter->mtx);
+
+		if (adapter->closing) {
+			pthread_mutex_unlock(&adapter->mtx);
+			return NULL;
+		}
+		batch = STAILQ_FIRST(&adapter->batches);
+		STAILQ_REMOVE_HEAD(&adapter->batches, link);
+		pthread_mutex_unlock(&adapter->mtx);
+
+		native_adapter_proc(adapter, batch);
+		free(batch);
+	}
+}
+
+static void
+native_adapter_submit(struct native_i2c_adapter *adapter, struct i2c_batch *batch)
+{
+	pthread_mutex_lock(&adapter->mtx);
+	STAILQ_INSERT_TAIL(&adapter->batches, batch, link);
+	pthread_cond_signal(&adapter->cond);
+	pthread_mutex_unlock(&adapter->mtx);
+}
+
+static int
+native_adapter_start(struct virtio_i2c *vi2c)
+{
+	int i;
+	char tname[16];
 	struct native_i2c_adapter *adapter;
-	uint8_t status;
 
-	addr = msg->addr;
-	adapter = native_adapter_find(vi2c, addr);
-	if (!adapter)
-		return I2C_NO_DEV;
+	for (i = 0; i < vi2c->native_adapter_num; i++) {
+		adapter = vi2c->native_adapter[i];
+		adapter->vi2c = vi2c;
+		adapter->closing = false;
+		STAILQ_INIT(&adapter->batches);
+		pthread_mutex_init(&adapter->mtx, NULL);
+		pthread_cond_init(&adapter->cond, NULL);
+		if (pthread_create(&adapter->tid, NULL, native_adapter_thread, adapter)) {
+			WPRINTF("failed to create the thread of i2c-%d\n", adapter->bus);
+			pthread_cond_destroy(&adapter->cond);
+			pthread_mutex_destroy(&adapter->mtx);
+			return -1;
+		}
+		snprintf(tname, sizeof(tname), "virtio-i2c-%d", adapter->bus);
+		pthread_setname_np(adapter->tid, tname);
+		adapter->running = true;
+	}
+	return 0;
+}
 
-	work_queue.nmsgs = 1;
-	work_queue.msgs = msg;
+static void
+native_adapter_stop(struct native_i2c_adapter *adapter)
+{
+	struct i2c_batch *batch;
+	void *jval;
 
-	ret = ioctl(adapter->fd, I2C_RDWR, &work_queue);
-	if (ret < 0)
-		status = I2C_MSG_ERR;
-	else
-		status = I2C_MSG_OK;
-	if (msg->len)
-		DPRINTF("i2c_core: i2c msg: flags=0x%x, addr=0x%x, len=0x%x buf=%x\n",
-				msg->flags,
-				msg->addr,
-				msg->len,
-				msg->buf[0]);
-	else
-		DPRINTF("i2c_core: i2c msg: flags=0x%x, addr=0x%x, len=0x%x\n",
-				msg->flags,
-				msg->addr,
-				msg->len);
-	return status;
+	if (!adapter->running)
+		return;
+
+	pthread_mutex_lock(&adapter->mtx);
+	adapter->closing = true;
+	pthread_cond_broadcast(&adapter->cond);
+	pthread_mutex_unlock(&adapter->mtx);
+	pthread_join(adapter->tid, &jval);
+
+	while ((batch = STAILQ_FIRST(&adapter->batches)) != NULL) {
+		STAILQ_REMOVE_HEAD(&adapter->batches, link);
+		free(batch);
+	}
+	pthread_cond_destroy(&adapter->cond);
+	pthread_mutex_destroy(&adapter->mtx);
+	adapter->running = false;
 }
 
 static struct native_i2c_adapter *
@@ -483,6 +586,7 @@ native_adapter_remove(struct virtio_i2c *vi2c)
 	for (i = 0; i < MAX_NATIVE_I2C_ADAPTER; i++) {
 		native_adapter = vi2c->native_adapter[i];
 		if (native_adapter) {
+			native_adapter_stop(native_adapter);
 			if (native_adapter->fd > 0)
 				close(native_adapter->fd);
 			free(native_adapter);
@@ -491,68 +595,6 @@ native_adapter_remove(struct virtio_i2c *vi2c)
 	}
 }
 
-static void
-virtio_i2c_req_stop(struct virtio_i2c *vi2c)
-{
-	void *jval;
-
-	pthread_mutex_lock(&vi2c->req_mtx);
-	vi2c->closing = 1;
-	pthread_cond_broadcast(&vi2c->req_cond);
-	pthread_mutex_unlock(&vi2c->req_mtx);
-	pthread_join(vi2c->req_tid, &jval);
-}
-
-static void *
-virtio_i2c_proc_thread(void *arg)
-{
-	struct virtio_i2c *vi2c = arg;
-	struct virtio_vq_info *vq = &vi2c->vq;
-	struct iovec iov[3];
-	uint16_t idx, flags[3];
-	struct virtio_i2c_hdr *hdr;
-	struct i2c_msg msg;
-	uint8_t *status;
-	int n;
-
-	for (;;) {
-		pthread_mutex_lock(&vi2c->req_mtx);
-
-		vi2c->in_process = 0;
-		while (!vq_has_descs(vq) && !vi2c->closing)
-			pthread_cond_wait(&vi2c->req_cond, &vi2c->req_mtx);
-
-		if (vi2c->closing) {
-			pthread_mutex_unlock(&vi2c->req_mtx);
-			return NULL;
-		}
-		vi2c->in_process = 1;
-		pthread_mutex_unlock(&vi2c->req_mtx);
-		do {
-			n = vq_getchain(vq, &idx, iov, 3, flags);
-			if (n < 2 || n > 3) {
-				WPRINTF("virtio_i2c_proc: failed to get iov from virtqueue\n");
-				continue;
-			}
-			hdr = iov[0].iov_base;
-			msg.addr = hdr->addr;
-			msg.flags = hdr->flags;
-			if (hdr->len) {
-				msg.buf = iov[1].iov_base;
-				msg.len = iov[1].iov_len;
-				status = iov[2].iov_base;
-			} else {
-				msg.buf = NULL;
-				msg.len = 0;
-				status = iov[1].iov_base;
-			}
-			*status = native_adapter_proc(vi2c, &msg);
-			vq_relchain(vq, idx, 1);
-		} while (vq_has_descs(vq));
-		vq_endchains(vq, 0);
-	}
-}
-
 static int
 virtio_i2c_map(struct virtio_i2c *vi2c)
 {
@@ -708,18 +750,78 @@ virtio_i2c_reset(void *vdev)
 	virtio_reset_dev(&vi2c->base);
 }
 
+/*
+ * Batch the chains queued to the msgs of the adapters, consecutive msgs to
+ * the same adapter in one batch, and hand the batches to the worker threads
+ * of the adapters, the notify returns without waiting for the bus.
+ */
 static void
 virtio_i2c_notify(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_i2c *vi2c = vdev;
+	struct native_i2c_adapter *adapter, *cur = NULL;
+	struct i2c_batch *batch = NULL;
+	struct virtio_i2c_hdr *hdr;
+	struct iovec iov[3];
+	uint16_t idx, flags[3];
+	struct i2c_msg *msg;
+	uint8_t *status;
+	bool nodev = false;
+	int n;
 
-	if (!vq_has_descs(vq))
-		return;
+	while (vq_has_descs(vq)) {
+		n = vq_getchain(vq, &idx, iov, 3, flags);
+		if (n < 2 || n > 3) {
+			WPRINTF("virtio_i2c_proc: failed to get iov from virtqueue\n");
+			continue;
+		}
+		hdr = iov[0].iov_base;
+		status = hdr->len ? iov[2].iov_base : iov[1].iov_base;
+
+		adapter = native_adapter_find(vi2c, hdr->addr);
+		if (!adapter) {
+			*status = I2C_NO_DEV;
+			vq_relchain(vq, idx, 1);
+			nodev = true;
+			continue;
+		}
 
-	pthread_mutex_lock(&vi2c->req_mtx);
-	if (!vi2c->in_process)
-		pthread_cond_signal(&vi2c->req_cond);
-	pthread_mutex_unlock(&vi2c->req_mtx);
+		if (batch && (adapter != cur ||
+				batch->nmsgs == I2C_RDRW_IOCTL_MAX_MSGS)) {
+			native_adapter_submit(cur, batch);
+			batch = NULL;
+		}
+		if (!batch) {
+			batch = calloc(1, sizeof(*batch));
+			if (!batch) {
+				WPRINTF("failed to alloc the i2c batch\n");
+				*status = I2C_MSG_ERR;
+				vq_relchain(vq, idx, 1);
+				nodev = true;
+				continue;
+			}
+			cur = adapter;
+		}
+
+		msg = &batch->msgs[batch->nmsgs];
+		msg->addr = hdr->addr;
+		msg->flags = hdr->flags;
+		if (hdr->len) {
+			msg->buf = iov[1].iov_base;
+			msg->len = iov[1].iov_len;
+		} else {
+			msg->buf = NULL;
+			msg->len = 0;
+		}
+		batch->status[batch->nmsgs] = status;
+		batch->idx[batch->nmsgs] = idx;
+		batch->nmsgs++;
+	}
+
+	if (batch)
+		native_adapter_submit(cur, batch);
+	if (nodev)
+		vq_endchains(vq, 0);
 }
 
 static int
@@ -798,12 +900,10 @@ virtio_i2c_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		goto fail;
 	}
 	virtio_set_io_bar(&vi2c->base, 0);
-	vi2c->in_process = 0;
-	vi2c->closing = 0;
-	pthread_mutex_init(&vi2c->req_mtx, NULL);
-	pthread_cond_init(&vi2c->req_cond, NULL);
-	pthread_create(&vi2c->req_tid, NULL, virtio_i2c_proc_thread, vi2c);
-	pthread_setname_np(vi2c->req_tid, "virtio-i2c");
+	if (native_adapter_start(vi2c)) {
+		rc = -1;
+		goto fail;
+	}
 	return 0;
 
 fail:
@@ -822,9 +922,7 @@ virtio_i2c_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	if (dev->arg) {
 		DPRINTF("deinit\n");
 		vi2c = (struct virtio_i2c *) dev->arg;
-		virtio_i2c_req_stop(vi2c);
 		native_adapter_remove(vi2c);
-		pthread_mutex_destroy(&vi2c->req_mtx);
 		pthread_mutex_destroy(&vi2c->mtx);
 		free(vi2c);
 		dev->arg = NULL;
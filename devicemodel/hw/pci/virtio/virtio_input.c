@@ -19,6 +19,7 @@
 #include "dm.h"
 #include "pci_core.h"
 #include "virtio.h"
+#include "virtio_kernel.h"
 #include "mevent.h"
 #include <linux/input.h>
 
@@ -43,10 +44,16 @@ static int virtio_input_debug;
  */
 #define VIRTIO_INPUT_PACKET_SIZE	10
 
+/*
+ * Host events read at once
+ */
+#define VIRTIO_INPUT_READ_EVENTS	64
+
 /*
  * Host capabilities
  */
-#define VIRTIO_INPUT_S_HOSTCAPS		(1UL << VIRTIO_F_VERSION_1)
+#define VIRTIO_INPUT_S_HOSTCAPS		\
+	((1UL << VIRTIO_F_VERSION_1) | (1UL << VIRTIO_F_RING_PACKED))
 
 enum virtio_input_config_select {
 	VIRTIO_INPUT_CFG_UNSET		= 0x00,
@@ -98,12 +105,6 @@ struct virtio_input_config {
 	} u;
 };
 
-struct virtio_input_event_elem {
-	struct virtio_input_event		event;
-	struct iovec				iov;
-	uint16_t				idx;
-};
-
 /*
  * Per-device struct
  */
@@ -119,9 +120,14 @@ struct virtio_input {
 	int					fd;
 	bool					ready;
 
-	struct virtio_input_event_elem		*event_queue;
+	/* events read from evdev, up to event_qframe in whole frames */
+	struct virtio_input_event		*event_queue;
 	uint32_t				event_qsize;
 	uint32_t				event_qindex;
+	uint32_t				event_qframe;
+	bool					syn_dropped;
+
+	struct vbs_k_dev			vbs_k;
 };
 
 static void virtio_input_reset(void *);
@@ -144,6 +150,20 @@ static struct virtio_ops virtio_input_ops = {
 	virtio_input_set_status,	/* called on guest set status */
 };
 
+/* VBS-K virtio_ops, the same but for the start of the kernel module */
+static void virtio_input_k_set_status(void *, uint64_t);
+static struct virtio_ops virtio_input_ops_k = {
+	"virtio_input",			/* our name */
+	VIRTIO_INPUT_MAXQ,		/* we support VTCON_MAXQ virtqueues */
+	sizeof(struct virtio_input_config),	/* config reg size */
+	virtio_input_reset,		/* reset */
+	NULL,				/* device-wide qnotify */
+	virtio_input_cfgread,		/* read virtio config */
+	virtio_input_cfgwrite,		/* write virtio config */
+	virtio_input_neg_features,	/* apply negotiated features */
+	virtio_input_k_set_status,	/* called on guest set status */
+};
+
 static void
 virtio_input_reset(void *vdev)
 {
@@ -153,7 +173,11 @@ virtio_input_reset(void *vdev)
 
 	DPRINTF(("vtinput: device reset requested!\n"));
 	vi->ready = false;
+	vi->event_qindex = 0;
+	vi->event_qframe = 0;
+	vi->syn_dropped = false;
 	virtio_reset_dev(&vi->base);
+	vbs_kernel_dev_reset(&vi->vbs_k);
 }
 
 static void
@@ -175,6 +199,15 @@ virtio_input_set_status(void *vdev, uint64_t status)
 	}
 }
 
+/* the events are not sent while the kernel module has the queues */
+static void
+virtio_input_k_set_status(void *vdev, uint64_t status)
+{
+	struct virtio_input *vi = vdev;
+
+	vbs_kernel_set_status(&vi->vbs_k, &vi->base, status);
+}
+
 static int
 virtio_input_cfgread(void *vdev, int offset, int size, uint32_t *retval)
 {
@@ -247,6 +280,8 @@ virtio_input_notify_status_vq(void *vdev, struct virtio_vq_info *vq)
 	uint16_t idx;
 
 	vi = vdev;
+	if (vi->base.backend_type == BACKEND_VBSK)
+		return;
 
 	while (vq_has_descs(vq)) {
 		n = vq_getchain(vq, &idx, &iov, 1, NULL);
@@ -286,72 +321,126 @@ virtio_input_notify_status_vq(void *vdev, struct virtio_vq_info *vq)
 	vq_endchains(vq, 1);	/* Generate interrupt if appropriate. */
 }
 
+/*
+ * Events are queued up to the SYN_REPORT closing their frame. After a
+ * SYN_DROPPED of evdev, the events up to the next SYN_REPORT are
+ * dropped along with the partial frame, as evdev clients do.
+ */
 static void
-virtio_input_send_event(struct virtio_input *vi,
-			struct virtio_input_event *event)
+virtio_input_queue_event(struct virtio_input *vi,
+			 struct virtio_input_event *event)
 {
-	struct virtio_vq_info *vq;
-	struct iovec iov;
-	int n, i;
-	uint16_t idx;
+	struct virtio_input_event *queue;
 
 	if (!vi->ready)
 		return;
 
+	if (event->type == EV_SYN && event->code == SYN_DROPPED) {
+		vi->event_qindex = vi->event_qframe;
+		vi->syn_dropped = true;
+		return;
+	}
+	if (vi->syn_dropped) {
+		if (event->type == EV_SYN && event->code == SYN_REPORT)
+			vi->syn_dropped = false;
+		return;
+	}
+
 	if (vi->event_qindex == vi->event_qsize) {
-		vi->event_qsize++;
-		vi->event_queue = realloc(vi->event_queue,
-			vi->event_qsize *
-			sizeof(struct virtio_input_event_elem));
-		if (!vi->event_queue) {
+		queue = realloc(vi->event_queue, vi->event_qsize * 2 *
+			sizeof(struct virtio_input_event));
+		if (!queue) {
 			WPRINTF(("virtio_input: realloc memory for vi->event_queue failed!\n"));
 			return;
 		}
+		vi->event_queue = queue;
+		vi->event_qsize *= 2;
 	}
-	vi->event_queue[vi->event_qindex].event = *event;
-	vi->event_qindex++;
+	vi->event_queue[vi->event_qindex++] = *event;
 
-	if (event->type != EV_SYN || event->code != SYN_REPORT)
-		return;
+	if (event->type == EV_SYN && event->code == SYN_REPORT)
+		vi->event_qframe = vi->event_qindex;
+}
 
-	vq = &vi->queues[VIRTIO_INPUT_EVENT_QUEUE];
-	for (i = 0; i < vi->event_qindex; i++) {
-		if (!vq_has_descs(vq)) {
-			while (i-- > 0)
-				vq_retchain(vq);
-			WPRINTF(("%s: not enough avail descs, dropped:%d\n",
-				__func__, vi->event_qindex));
-			goto out;
-		}
-		n = vq_getchain(vq, &idx, &iov, 1, NULL);
-		if (n < 0) {
-			WPRINTF(("virtio-input: invalid descriptors\n"));
-			return;
-		}
-		if (n == 0) {
-			WPRINTF(("virtio-input: get no available desciptors\n"));
-			return;
-		}
-		if (n != 1) {
-			WPRINTF(("virtio_input: get wrong number of available descriptors\n"));
-			vq_relchain(vq, idx, sizeof(event)); /* Release the chain */
-			return;
-		}
-		vi->event_queue[i].iov = iov;
-		vi->event_queue[i].idx = idx;
+/* a frame goes to the guest whole or not at all */
+static int
+virtio_input_send_frame(struct virtio_vq_info *vq,
+			struct virtio_input_event *events, int nevents)
+{
+	struct iovec iov[VIRTIO_INPUT_RINGSZ];
+	struct vq_chain chains[VIRTIO_INPUT_RINGSZ];
+	int i, n;
+
+	if (nevents > VIRTIO_INPUT_RINGSZ)
+		return -1;
+
+	for (i = 0; i < nevents; i++) {
+		chains[i].iov = &iov[i];
+		chains[i].flags = NULL;
+		chains[i].iolen = 0;
 	}
 
-	for (i = 0; i < vi->event_qindex; i++) {
-		memcpy(vi->event_queue[i].iov.iov_base,
-			&vi->event_queue[i].event,
-			sizeof(struct virtio_input_event));
-		vq_relchain(vq, vi->event_queue[i].idx,
+	n = vq_getchains(vq, chains, nevents, 1);
+	if (n < 0) {
+		WPRINTF(("virtio-input: invalid avail ring\n"));
+		return -1;
+	}
+	if (n > 0 && chains[n - 1].n < 1) {
+		WPRINTF(("virtio-input: invalid descriptors\n"));
+		vq_relchains(vq, chains, n);
+		return -1;
+	}
+	if (n < nevents) {
+		while (n-- > 0)
+			vq_retchain(vq);
+		return -1;
+	}
+
+	for (i = 0; i < nevents; i++) {
+		if (iov[i].iov_len < sizeof(struct virtio_input_event))
+			continue;
+		memcpy(iov[i].iov_base, &events[i],
 			sizeof(struct virtio_input_event));
+		chains[i].iolen = sizeof(struct virtio_input_event);
 	}
+	vq_relchains(vq, chains, nevents);
 
-out:
-	vi->event_qindex = 0;
+	return 0;
+}
+
+/*
+ * The whole frames queued go to the guest with one interrupt, the
+ * partial one is kept for the next read.
+ */
+static void
+virtio_input_send_events(struct virtio_input *vi)
+{
+	struct virtio_vq_info *vq;
+	struct virtio_input_event *event;
+	uint32_t i, start = 0;
+
+	if (vi->event_qframe == 0)
+		return;
+
+	vq = &vi->queues[VIRTIO_INPUT_EVENT_QUEUE];
+	for (i = 0; i < vi->event_qframe; i++) {
+		event = &vi->event_queue[i];
+		if (event->type != EV_SYN || event->code != SYN_REPORT)
+			continue;
+
+		if (virtio_input_send_frame(vq, &vi->event_queue[start],
+				i + 1 - start) != 0)
+			WPRINTF(("%s: not enough avail descs, dropped:%d\n",
+				__func__, i + 1 - start));
+		start = i + 1;
+	}
 	vq_endchains(vq, 1);
+
+	memmove(vi->event_queue, &vi->event_queue[vi->event_qframe],
+		(vi->event_qindex - vi->event_qframe) *
+		sizeof(struct virtio_input_event));
+	vi->event_qindex -= vi->event_qframe;
+	vi->event_qframe = 0;
 }
 
 static void
@@ -361,24 +450,34 @@ virtio_input_read_event(int fd __attribute__((unused)),
 {
 	struct virtio_input *vi = arg;
 	struct virtio_input_event event;
-	struct input_event host_event;
-	int len;
+	struct input_event host_events[VIRTIO_INPUT_READ_EVENTS];
+	ssize_t len;
+	int i, n;
 
 	while (1) {
-		len = read(vi->fd, &host_event, sizeof(host_event));
-		if (len != sizeof(host_event)) {
+		len = read(vi->fd, host_events, sizeof(host_events));
+		if (len < (ssize_t)sizeof(struct input_event)) {
 			if (len == -1 && errno != EAGAIN)
 				WPRINTF(("vtinput: host read failed! "
-					"len = %d, errno = %d\n",
+					"len = %zd, errno = %d\n",
 					len, errno));
 			break;
 		}
 
-		event.type = host_event.type;
-		event.code = host_event.code;
-		event.value = host_event.value;
-		virtio_input_send_event(vi, &event);
+		n = len / sizeof(struct input_event);
+		for (i = 0; i < n; i++) {
+			event.type = host_events[i].type;
+			event.code = host_events[i].code;
+			event.value = host_events[i].value;
+			virtio_input_queue_event(vi, &event);
+		}
+
+		/* evdev had no more */
+		if (len < sizeof(host_events))
+			break;
 	}
+
+	virtio_input_send_events(vi);
 }
 
 static int
@@ -596,11 +695,12 @@ virtio_input_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	struct virtio_input *vi;
 	pthread_mutexattr_t attr;
 	char *opt;
+	bool kernel = false;
 	int flags, ver;
 	int rc;
 
 	/* get evdev path from opts
-	 * -s n,virtio-input,/dev/input/eventX[,serial]
+	 * -s n,virtio-input,/dev/input/eventX[,serial][,kernel=on]
 	 */
 	if (!opts) {
 		WPRINTF(("%s: evdev path is NULL\n", __func__));
@@ -625,8 +725,14 @@ virtio_input_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		goto opt_fail;
 	}
 
-	if (opts) {
-		vi->serial = strdup(opts);
+	while ((opt = strsep(&opts, ",")) != NULL) {
+		if (vbs_kernel_opt(opt)) {
+			kernel = true;
+			continue;
+		}
+		if (vi->serial)
+			continue;
+		vi->serial = strdup(opt);
 		if (!vi->serial) {
 			WPRINTF(("%s: strdup serial failed\n", __func__));
 			goto serial_fail;
@@ -668,8 +774,9 @@ virtio_input_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 	vi->event_qsize = VIRTIO_INPUT_PACKET_SIZE;
 	vi->event_qindex = 0;
+	vi->event_qframe = 0;
 	vi->event_queue = calloc(vi->event_qsize,
-		sizeof(struct virtio_input_event_elem));
+		sizeof(struct virtio_input_event));
 	if (!vi->event_queue) {
 		WPRINTF(("vtinput: could not alloc event queue buf\n"));
 		goto evqueue_fail;
@@ -682,7 +789,14 @@ virtio_input_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		goto mevent_fail;
 	}
 
-	virtio_linkup(&vi->base, &virtio_input_ops, vi, dev, vi->queues, BACKEND_VBSU);
+	/* the evdev is kept open for the fallback to VBS-U */
+	if (kernel && vbs_kernel_init(&vi->vbs_k, "/dev/vbs_input",
+			&virtio_input_ops) == 0)
+		virtio_linkup(&vi->base, &virtio_input_ops_k, vi, dev,
+			vi->queues, BACKEND_VBSK);
+	else
+		virtio_linkup(&vi->base, &virtio_input_ops, vi, dev,
+			vi->queues, BACKEND_VBSU);
 	vi->base.mtx = &vi->mtx;
 	vi->base.device_caps = VIRTIO_INPUT_S_HOSTCAPS;
 
@@ -712,6 +826,7 @@ virtio_input_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	return rc;
 
 fail:
+	vbs_kernel_deinit(&vi->vbs_k);
 	/* all resources will be freed in the teardown callback */
 	mevent_delete(vi->mevp);
 	return -1;
@@ -744,6 +859,8 @@ virtio_input_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	struct virtio_input *vi;
 
 	vi = (struct virtio_input *)dev->arg;
+	if (vi)
+		vbs_kernel_deinit(&vi->vbs_k);
 	if (vi && vi->mevp)
 		mevent_delete(vi->mevp);
 }
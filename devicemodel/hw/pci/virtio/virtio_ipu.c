@@ -38,6 +38,12 @@
  */
 #define VIRTIO_IPU_VQ_NUM 2
 
+/*
+ * A frame buffer is queued on VQ0 as one indirect descriptor table holding
+ * all its pages, not one ring slot per page.
+ */
+#define VIRTIO_IPU_S_HOSTCAPS (1 << VIRTIO_RING_F_INDIRECT_DESC)
+
 #define IPU_VBS_DEV_PATH "/dev/vbs_ipu"
 
 static int ipu_log_level;
@@ -333,6 +339,7 @@ virtio_ipu_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 	ipu->vbs_k.ipu_kstatus = VIRTIO_DEV_INIT_SUCCESS;
 	ipu->base.mtx = &ipu->mtx;
+	ipu->base.device_caps = VIRTIO_IPU_S_HOSTCAPS;
 
 	ipu->vq[0].qsize = VIRTIO_IPU_RINGSZ;
 	ipu->vq[1].qsize = VIRTIO_IPU_RINGSZ;
@@ -8,7 +8,16 @@
 /* Routines to notify the VBS-K in kernel */
 
 #include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
 #include <sys/ioctl.h>
+#include "vmmapi.h"
+#include "pci_core.h"
+#include "virtio.h"
 #include "virtio_kernel.h"
 
 static int virtio_kernel_debug;
@@ -93,3 +102,179 @@ vbs_kernel_stop(int fd)
 	DPRINTF(("%s\n", __func__));
 	return VIRTIO_SUCCESS;
 }
+
+/*
+ * Generic VBS-K shim, see struct vbs_k_dev. The module knows of legacy
+ * rings only, given by their PFN, and of a PIO kick register.
+ */
+bool
+vbs_kernel_opt(const char *opt)
+{
+	return opt != NULL && strcmp(opt, "kernel=on") == 0;
+}
+
+int
+vbs_kernel_init(struct vbs_k_dev *vbs_k, const char *path,
+		struct virtio_ops *vops_u)
+{
+	vbs_k->vops_u = vops_u;
+	memset(&vbs_k->dev, 0, sizeof(struct vbs_dev_info));
+	memset(&vbs_k->vqs, 0, sizeof(struct vbs_vqs_info));
+
+	vbs_k->fd = open(path, O_RDWR);
+	if (vbs_k->fd < 0) {
+		WPRINTF(("Failed to open %s, fallback to VBS-U\n", path));
+		vbs_k->status = VIRTIO_DEV_INIT_FAILED;
+		return -VIRTIO_ERROR_FD_OPEN_FAILED;
+	}
+
+	DPRINTF(("Open %s success!\n", path));
+	vbs_k->status = VIRTIO_DEV_INIT_SUCCESS;
+	return VIRTIO_SUCCESS;
+}
+
+/* PFN of a ring in the legacy layout, 0 if it is not */
+static uint32_t
+vbs_kernel_vq_pfn(struct virtio_vq_info *vq)
+{
+	uint64_t desc, avail, used;
+
+	if (vq->pfn != 0)
+		return vq->pfn;
+	if (vq->flags & VQ_PACKED)
+		return 0;
+
+	desc = (((uint64_t)vq->gpa_desc[1]) << 32) | vq->gpa_desc[0];
+	avail = (((uint64_t)vq->gpa_avail[1]) << 32) | vq->gpa_avail[0];
+	used = (((uint64_t)vq->gpa_used[1]) << 32) | vq->gpa_used[0];
+	if ((desc & (VIRTIO_PCI_VRING_ALIGN - 1)) != 0 ||
+	    avail != desc + vq->qsize * sizeof(struct vring_desc) ||
+	    used != ((avail + sizeof(uint16_t) * (3 + vq->qsize) +
+		VIRTIO_PCI_VRING_ALIGN - 1) & ~(VIRTIO_PCI_VRING_ALIGN - 1UL)))
+		return 0;
+
+	return desc >> VRING_PAGE_BITS;
+}
+
+static int
+vbs_kernel_setup(struct vbs_k_dev *vbs_k, struct virtio_base *base)
+{
+	struct pci_vdev *dev = base->dev;
+	struct virtio_vq_info *vq;
+	struct vbs_vq_info *kvq;
+	struct msix_table_entry *mte;
+	uint64_t pio_start, pio_len;
+	int i, nvq = 0;
+
+	/* the queues after the last one set up are left out */
+	for (i = 0; i < base->vops->nvq; i++) {
+		if (base->queues[i].flags & VQ_ALLOC)
+			nvq = i + 1;
+	}
+	if (nvq > VBS_MAX_VQ_CNT) {
+		WPRINTF(("%s: %d queues, VBS-K takes %d\n",
+			base->vops->name, nvq, VBS_MAX_VQ_CNT));
+		return -VIRTIO_ERROR_GENERAL;
+	}
+
+	if ((base->negotiated_caps & (1UL << VIRTIO_F_VERSION_1)) == 0) {
+		pio_start = dev->bar[base->legacy_pio_bar_idx].addr +
+			VIRTIO_PCI_QUEUE_NOTIFY;
+		pio_len = 2;
+	} else if (base->modern_pio_bar_idx == VIRTIO_MODERN_PIO_BAR_IDX &&
+		   dev->bar[VIRTIO_MODERN_PIO_BAR_IDX].type == PCIBAR_IO) {
+		pio_start = dev->bar[VIRTIO_MODERN_PIO_BAR_IDX].addr;
+		pio_len = 4;
+	} else {
+		WPRINTF(("%s: no PIO notify register for VBS-K\n",
+			base->vops->name));
+		return -VIRTIO_ERROR_GENERAL;
+	}
+
+	strncpy(vbs_k->dev.name, base->vops->name, VBS_NAME_LEN);
+	vbs_k->dev.name[VBS_NAME_LEN - 1] = '\0';
+	vbs_k->dev.vmid = dev->vmctx->vmid;
+	vbs_k->dev.nvq = nvq;
+	vbs_k->dev.negotiated_features = base->negotiated_caps;
+	vbs_k->dev.pio_range_start = pio_start;
+	vbs_k->dev.pio_range_len = pio_len;
+
+	vbs_k->vqs.nvq = nvq;
+	for (i = 0; i < nvq; i++) {
+		vq = &base->queues[i];
+		kvq = &vbs_k->vqs.vqs[i];
+		memset(kvq, 0, sizeof(*kvq));
+		if ((vq->flags & VQ_ALLOC) == 0)
+			continue;
+
+		kvq->qsize = vq->qsize;
+		kvq->pfn = vbs_kernel_vq_pfn(vq);
+		if (kvq->pfn == 0) {
+			WPRINTF(("%s: queue %d is not a legacy ring\n",
+				base->vops->name, i));
+			return -VIRTIO_ERROR_GENERAL;
+		}
+		kvq->msix_idx = vq->msix_idx;
+		if (vq->msix_idx != VIRTIO_MSI_NO_VECTOR &&
+		    vq->msix_idx < dev->msix.table_count) {
+			mte = &dev->msix.table[vq->msix_idx];
+			kvq->msix_addr = mte->addr;
+			kvq->msix_data = mte->msg_data;
+		}
+	}
+
+	return VIRTIO_SUCCESS;
+}
+
+void
+vbs_kernel_set_status(struct vbs_k_dev *vbs_k, struct virtio_base *base,
+		      uint64_t status)
+{
+	if (vbs_k->status != VIRTIO_DEV_INIT_SUCCESS ||
+	    (status & VIRTIO_CONFIG_S_DRIVER_OK) == 0)
+		return;
+
+	if (vbs_kernel_setup(vbs_k, base) == VIRTIO_SUCCESS &&
+	    vbs_kernel_start(vbs_k->fd, &vbs_k->dev, &vbs_k->vqs) >= 0) {
+		DPRINTF(("%s: vbs_k started!\n", base->vops->name));
+		vbs_k->status = VIRTIO_DEV_STARTED;
+		return;
+	}
+
+	WPRINTF(("%s: VBS-K start failed, fallback to VBS-U\n",
+		base->vops->name));
+	vbs_k->status = VIRTIO_DEV_START_FAILED;
+	memset(&vbs_k->dev, 0, sizeof(struct vbs_dev_info));
+	memset(&vbs_k->vqs, 0, sizeof(struct vbs_vqs_info));
+	vbs_kernel_reset(vbs_k->fd);
+
+	base->vops = vbs_k->vops_u;
+	base->backend_type = BACKEND_VBSU;
+	if (base->vops->set_status)
+		(*base->vops->set_status)(base, status);
+}
+
+void
+vbs_kernel_dev_reset(struct vbs_k_dev *vbs_k)
+{
+	if (vbs_k->status != VIRTIO_DEV_STARTED)
+		return;
+
+	vbs_kernel_stop(vbs_k->fd);
+	memset(&vbs_k->dev, 0, sizeof(struct vbs_dev_info));
+	memset(&vbs_k->vqs, 0, sizeof(struct vbs_vqs_info));
+	vbs_kernel_reset(vbs_k->fd);
+	vbs_k->status = VIRTIO_DEV_INIT_SUCCESS;
+}
+
+void
+vbs_kernel_deinit(struct vbs_k_dev *vbs_k)
+{
+	vbs_kernel_dev_reset(vbs_k);
+	if (vbs_k->status != VIRTIO_DEV_INITIAL &&
+	    vbs_k->status != VIRTIO_DEV_PRE_INIT && vbs_k->fd >= 0) {
+		close(vbs_k->fd);
+		vbs_k->fd = -1;
+	}
+	vbs_k->status = VIRTIO_DEV_INITIAL;
+}
@@ -306,6 +306,10 @@ struct vmei_host_client {
 	int                          client_fd;
 
 	struct mevent                *rx_mevp;
+	/* a dup of client_fd, epoll takes one event per fd */
+	int                          tx_fd;
+	struct mevent                *tx_mevp;
+	bool                         tx_blocked;
 	uint8_t                      *recv_buf;
 	size_t                       recv_buf_sz;
 	int                          recv_offset;
@@ -362,6 +366,9 @@ struct virtio_mei {
 	LIST_HEAD(clhead, vmei_me_client) active_clients;
 	struct vmei_me_client           *hbm_client;
 	int hbm_fd;
+
+	/* the events of the host client fds, off the main loop */
+	struct mevent_loop              *evloop;
 };
 
 static inline void
@@ -389,6 +396,12 @@ vmei_rx_teardown(void *param)
 	free(hclient);
 }
 
+static void
+vmei_tx_teardown(void *param)
+{
+	close((int)(intptr_t)param);
+}
+
 static void
 vmei_host_client_destroy(const struct refcnt *ref)
 {
@@ -403,6 +416,11 @@ vmei_host_client_destroy(const struct refcnt *ref)
 	LIST_REMOVE(hclient, list);
 	pthread_mutex_unlock(&mclient->list_mutex);
 
+	if (hclient->tx_mevp)
+		mevent_delete(hclient->tx_mevp);
+	else if (hclient->tx_fd > -1)
+		close(hclient->tx_fd);
+
 	if (hclient->rx_mevp)
 		mevent_delete(hclient->rx_mevp);
 	else
@@ -427,6 +445,8 @@ vmei_host_client_create(struct vmei_me_client *mclient, uint8_t host_addr)
 	hclient->mclient   = mclient;
 	hclient->client_fd = -1;
 	hclient->rx_mevp   = NULL;
+	hclient->tx_fd     = -1;
+	hclient->tx_mevp   = NULL;
 
 	/* HBM and fixed address doesn't provide flow control
 	 * make the receiving part always available.
@@ -984,6 +1004,7 @@ static void vmei_del_reset_event(struct virtio_mei *vmei)
 }
 
 static void vmei_rx_callback(int fd, enum ev_type type, void *param);
+static void vmei_tx_callback(int fd, enum ev_type type, void *param);
 
 static inline uint8_t
 errno_to_hbm_conn_status(int err)
@@ -1036,14 +1057,30 @@ vmei_host_client_native_connect(struct vmei_host_client *hclient)
 	}
 
 	/* add READ event into mevent */
-	hclient->rx_mevp = mevent_add(hclient->client_fd, EVF_READ,
-			vmei_rx_callback, hclient, vmei_rx_teardown, hclient);
+	hclient->rx_mevp = mevent_add_loop(vmei->evloop, hclient->client_fd,
+			EVF_READ, vmei_rx_callback, hclient,
+			vmei_rx_teardown, hclient);
 	if (!hclient->rx_mevp)
 		return MEI_HBM_REJECTED;
 
 	if (!hclient->recv_creds)
 		mevent_disable(hclient->rx_mevp);
 
+	/*
+	 * WRITE event, enabled while the native driver has no room for
+	 * the messages of the client, the tx thread retries them every
+	 * two seconds without it
+	 */
+	hclient->tx_fd = dup(hclient->client_fd);
+	if (hclient->tx_fd > -1) {
+		hclient->tx_mevp = mevent_add_loop(vmei->evloop,
+				hclient->tx_fd, EVF_WRITE, vmei_tx_callback,
+				hclient, vmei_tx_teardown,
+				(void *)(intptr_t)hclient->tx_fd);
+		if (hclient->tx_mevp)
+			mevent_disable(hclient->tx_mevp);
+	}
+
 	HCL_DBG(hclient, "connect succeeded!\n");
 
 	return MEI_HBM_SUCCESS;
@@ -1594,7 +1631,7 @@ vmei_notify_tx(void *data, struct virtio_vq_info *vq)
 
 	pthread_mutex_lock(&vmei->tx_mutex);
 	DPRINTF("TX: New OUT buffer available!\n");
-	vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+	vq_set_used_ring_flags(&vmei->base, vq);
 	pthread_mutex_unlock(&vmei->tx_mutex);
 
 	do {
@@ -1651,24 +1688,37 @@ static void *vmei_tx_thread(void *param)
 			pending_cnt = 0;
 		}
 
+		/*
+		 * A client the native driver has no room for is skipped
+		 * until vmei_tx_callback() finds its fd writable, the
+		 * others are not held up behind it.
+		 */
 		pthread_mutex_lock(&vmei->list_mutex);
 		LIST_FOREACH(me, &vmei->active_clients, list) {
 			pthread_mutex_lock(&me->list_mutex);
 			LIST_FOREACH(e, &me->connections, list) {
-				if (!vmei_host_ready_send_buffers(e))
+				if (!vmei_host_ready_send_buffers(e) ||
+				    e->tx_blocked)
 					continue;
 
 				len = vmei_host_client_native_write(e);
-				if (len < 0 && len != -EAGAIN) {
-					HCL_WARN(e, "TX:send failed %zd\n",
-						 len);
-					pthread_mutex_unlock(&me->list_mutex);
-					goto unlock;
-				}
 				if (vmei->status == VMEI_STS_RESET) {
 					pthread_mutex_unlock(&me->list_mutex);
 					goto unlock;
 				}
+				if (len == -EAGAIN) {
+					if (e->tx_mevp &&
+					    mevent_enable(e->tx_mevp) == 0)
+						e->tx_blocked = true;
+					else
+						pending_cnt++;
+					continue;
+				}
+				if (len < 0) {
+					HCL_WARN(e, "TX:send failed %zd\n",
+						 len);
+					continue;
+				}
 
 				send_ready = vmei_host_ready_send_buffers(e);
 				pending_cnt += send_ready;
@@ -1686,6 +1736,31 @@ out:
 	pthread_exit(NULL);
 }
 
+/*
+ * The native driver has room again for the messages of a client
+ * the tx thread left blocked.
+ */
+static void
+vmei_tx_callback(int fd, enum ev_type type, void *param)
+{
+	struct vmei_host_client *hclient = param;
+	struct virtio_mei *vmei = vmei_host_client_to_vmei(hclient);
+
+	if (!vmei)
+		return;
+
+	if (!vmei_host_client_get(hclient))
+		return;
+
+	pthread_mutex_lock(&vmei->tx_mutex);
+	mevent_disable(hclient->tx_mevp);
+	hclient->tx_blocked = false;
+	pthread_cond_signal(&vmei->tx_cond);
+	pthread_mutex_unlock(&vmei->tx_mutex);
+
+	vmei_host_client_put(hclient);
+}
+
 /*
  * A completed read guarantees that a client message is completed,
  * transmission of client message is started by a flow control message of HBM
@@ -1915,7 +1990,7 @@ static void *vmei_rx_thread(void *param)
 				goto out;
 		}
 
-		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+		vq_set_used_ring_flags(&vmei->base, vq);
 
 		do {
 			vmei->rx_need_sched = vmei_proc_rx(vmei, vq);
@@ -1943,7 +2018,7 @@ vmei_notify_rx(void *data, struct virtio_vq_info *vq)
 	/* Signal the rx thread for processing */
 	pthread_mutex_lock(&vmei->rx_mutex);
 	DPRINTF("RX: New IN buffer available!\n");
-	vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+	vq_set_used_ring_flags(&vmei->base, vq);
 	pthread_cond_signal(&vmei->rx_cond);
 	pthread_mutex_unlock(&vmei->rx_mutex);
 }
@@ -1983,8 +2058,9 @@ vmei_start(struct virtio_mei *vmei, bool do_rescan)
 		goto scan_failed;
 
 	hclient->client_fd = pipefd[0];
-	hclient->rx_mevp = mevent_add(hclient->client_fd, EVF_READ,
-		      vmei_rx_callback, hclient, vmei_rx_teardown, hclient);
+	hclient->rx_mevp = mevent_add_loop(vmei->evloop, hclient->client_fd,
+		      EVF_READ, vmei_rx_callback, hclient,
+		      vmei_rx_teardown, hclient);
 	vmei->hbm_fd = pipefd[1];
 
 	if (do_rescan) {
@@ -2031,6 +2107,9 @@ vmei_stop(struct virtio_mei *vmei)
 
 	vmei_free_me_clients(vmei);
 
+	mevent_loop_destroy(vmei->evloop);
+	vmei->evloop = NULL;
+
 	pthread_mutex_destroy(&vmei->rx_mutex);
 	pthread_mutex_destroy(&vmei->tx_mutex);
 	pthread_mutex_destroy(&vmei->list_mutex);
@@ -2337,6 +2416,12 @@ init:
 	snprintf(tname, sizeof(tname), "vmei-%d:%d rx", dev->slot, dev->func);
 	pthread_setname_np(vmei->rx_thread, tname);
 
+	/*
+	 * host client events, on the main loop if it cannot be created
+	 */
+	snprintf(tname, sizeof(tname), "vmei-%d:%d io", dev->slot, dev->func);
+	vmei->evloop = mevent_loop_create(tname, -1);
+
 	/*
 	 * start mei backend
 	 */
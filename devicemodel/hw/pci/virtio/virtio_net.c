@@ -35,20 +35,31 @@
 #include <unistd.h>
 #include <openssl/md5.h>
 #include <pthread.h>
+#include <sched.h>
 #include <sys/ioctl.h>
 #include <sys/errno.h>
 #include <net/if.h>
 #include <linux/if_tun.h>
+#define NETMAP_WITH_LIBS
+#include "netmap_user.h"
 
 #include "dm.h"
+#include "atomic.h"
 #include "pci_core.h"
 #include "mevent.h"
 #include "virtio.h"
 #include "vhost.h"
+#include "monitor.h"
 #include "dm_string.h"
 
 #define VIRTIO_NET_RINGSZ	1024
 #define VIRTIO_NET_MAXSEGS	256
+#define VIRTIO_NET_TX_BATCH	16	/* tx chains got and released at once */
+#define VIRTIO_NET_RX_BATCH	32	/* rx frames per wakeup */
+#define VIRTIO_NET_MAX_PAIRS	8	/* queue pairs with mq=<n> */
+#define VIRTIO_NET_CTL_SEGS	4
+#define VIRTIO_NET_RX_LEN	(ETHER_MAX_LEN + 4)	/* with a vlan tag */
+#define VIRTIO_NET_RX_GSO_LEN	(64 * 1024 + ETHER_HDR_LEN + 4)
 
 /*
  * Host capabilities.  Note that we only offer a few of these.
@@ -72,12 +83,25 @@
 #define	VIRTIO_NET_F_CTRL_VLAN	(1 << 19) /* control channel VLAN filtering */
 #define	VIRTIO_NET_F_GUEST_ANNOUNCE \
 				(1 << 21) /* guest can send gratuitous pkts */
+#define	VIRTIO_NET_F_MQ		(1 << 22) /* host supports multiple queues */
+#define	VIRTIO_NET_F_NOTF_COAL	(1UL << 53) /* interrupt coalescing */
 #define	VHOST_NET_F_VIRTIO_NET_HDR \
 				(1 << 27) /* vhost provides virtio_net_hdr */
 
 #define VIRTIO_NET_S_HOSTCAPS      \
 	(VIRTIO_NET_F_MAC | VIRTIO_NET_F_MRG_RXBUF | VIRTIO_NET_F_STATUS | \
-	(1 << VIRTIO_F_NOTIFY_ON_EMPTY) | (1 << VIRTIO_RING_F_INDIRECT_DESC))
+	(1 << VIRTIO_F_NOTIFY_ON_EMPTY) | (1 << VIRTIO_RING_F_INDIRECT_DESC) | \
+	(1 << VIRTIO_RING_F_EVENT_IDX))
+
+/*
+ * Offloads passed through to a tap device with IFF_VNET_HDR: the virtio
+ * net header goes as is between the guest and the tap.
+ */
+#define VIRTIO_NET_S_OFFLOADCAPS      \
+	(VIRTIO_NET_F_CSUM | VIRTIO_NET_F_HOST_TSO4 | VIRTIO_NET_F_HOST_TSO6 | \
+	VIRTIO_NET_F_HOST_ECN | VIRTIO_NET_F_GUEST_CSUM | \
+	VIRTIO_NET_F_GUEST_TSO4 | VIRTIO_NET_F_GUEST_TSO6 | \
+	VIRTIO_NET_F_GUEST_ECN)
 
 #define VIRTIO_NET_S_VHOSTCAPS      \
 	((1 << VIRTIO_F_NOTIFY_ON_EMPTY) | (1 << VIRTIO_RING_F_INDIRECT_DESC) | \
@@ -93,16 +117,43 @@
 struct virtio_net_config {
 	uint8_t  mac[6];
 	uint16_t status;
+	uint16_t max_virtqueue_pairs;
 } __attribute__((packed));
 
 /*
- * Queue definitions.
+ * Queue definitions. Queue pair n uses the queues 2n (rx) and 2n + 1 (tx).
+ * The control queue follows the last pair with VIRTIO_NET_F_MQ, and is
+ * queue 2 without it.
  */
 #define VIRTIO_NET_RXQ	0
 #define VIRTIO_NET_TXQ	1
-#define VIRTIO_NET_CTLQ	2	/* NB: not yet supported */
+#define VIRTIO_NET_CTLQ	2
+
+#define VIRTIO_NET_MAXQ	(2 * VIRTIO_NET_MAX_PAIRS + 1)
+
+/*
+ * Control queue commands: the number of queue pairs, and the interrupt
+ * coalescing of the rx or tx queues.
+ */
+struct virtio_net_ctrl_hdr {
+	uint8_t		class;
+	uint8_t		cmd;
+} __attribute__((packed));
+
+#define VIRTIO_NET_OK			0
+#define VIRTIO_NET_ERR			1
 
-#define VIRTIO_NET_MAXQ	3
+#define VIRTIO_NET_CTRL_MQ		4
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET	0
+
+#define VIRTIO_NET_CTRL_NOTF_COAL		6
+#define VIRTIO_NET_CTRL_NOTF_COAL_TX_SET	0
+#define VIRTIO_NET_CTRL_NOTF_COAL_RX_SET	1
+
+struct virtio_net_ctrl_coal {
+	uint32_t	max_packets;
+	uint32_t	max_usecs;
+} __attribute__((packed));
 
 /*
  * Fixed network header size
@@ -129,50 +180,89 @@ static int virtio_net_debug;
  */
 struct vhost_net {
 	struct vhost_dev vdev;
-	struct vhost_vq vqs[VIRTIO_NET_MAXQ - 1];
+	struct vhost_vq vqs[2];		/* rx and tx of one queue pair */
 	int tapfd;
 	bool vhost_started;
 };
 
+struct virtio_net;
+
 /*
- * Per-device struct
+ * Per-queue pair struct. Each pair has its own tap queue, rx event and tx
+ * thread, so the pairs are served in parallel.
  */
-struct virtio_net {
-	struct virtio_base base;
-	struct virtio_vq_info queues[VIRTIO_NET_MAXQ - 1];
-	pthread_mutex_t mtx;
+struct virtio_net_qp {
+	struct virtio_net *net;
+	int		idx;
 	struct mevent	*mevp;
 
 	int		tapfd;
+	bool		attached;	/* tap queue attached */
+	struct nm_desc	*nmd;		/* netmap port, instead of the tap */
 
 	int		rx_ready;
 
+	pthread_mutex_t	rx_mtx;
+	int		rx_in_progress;
+	pthread_t	tx_tid;
+	pthread_mutex_t	tx_mtx;
+	pthread_cond_t	tx_cond;
+	int		tx_in_progress;
+	/* the iovecs of a tx batch, only used by the tx thread */
+	struct iovec	tx_iov[VIRTIO_NET_TX_BATCH][VIRTIO_NET_MAXSEGS + 1];
+
+	struct vhost_net *vhost_net;
+};
+
+/*
+ * Per-device struct
+ */
+struct virtio_net {
+	struct virtio_base base;
+	struct virtio_ops ops;	/* virtio_net_ops with the nvq of npairs */
+	struct virtio_vq_info queues[VIRTIO_NET_MAXQ];
+	pthread_mutex_t mtx;
+
+	int		npairs;		/* queue pairs offered */
+	int		curr_pairs;	/* queue pairs in use by the guest */
+	struct virtio_net_qp qps[VIRTIO_NET_MAX_PAIRS];
+	int		refs;		/* device and rx events */
+
 	volatile int	resetting;	/* set and checked outside lock */
-	volatile int	closing;	/* stop the tx i/o thread */
+	volatile int	closing;	/* stop the tx i/o threads */
 
 	uint64_t	features;	/* negotiated features */
 
 	struct virtio_net_config config;
 
-	pthread_mutex_t	rx_mtx;
-	int		rx_in_progress;
 	int		rx_vhdrlen;
 	int		rx_merge;	/* merged rx bufs in use */
-	pthread_t	tx_tid;
-	pthread_mutex_t	tx_mtx;
-	pthread_cond_t	tx_cond;
-	int		tx_in_progress;
+	bool		vnet_hdr;	/* tap opened with IFF_VNET_HDR */
 
-	void (*virtio_net_rx)(struct virtio_net *net);
-	void (*virtio_net_tx)(struct virtio_net *net, struct iovec *iov,
+	/* read one frame, -1 with EWOULDBLOCK when there is none */
+	ssize_t (*virtio_net_rx)(struct virtio_net_qp *qp, struct iovec *iov,
+			     int iovcnt);
+	void (*virtio_net_tx)(struct virtio_net_qp *qp, struct iovec *iov,
 			     int iovcnt, int len);
+	/* after a batch of tx frames, may be NULL */
+	void (*virtio_net_tx_flush)(struct virtio_net_qp *qp);
 
-	struct vhost_net *vhost_net;
 	bool		use_vhost;
+	uint32_t	busyloop[2];	/* vhost rx/tx busy loop timeout, us */
+
+	/* interrupt coalescing of the rx/tx queues after a reset */
+	uint32_t	coal_frames;
+	uint32_t	coal_usecs;
+
+	/* loop of the rx events, NULL for the main one */
+	struct mevent_loop *evloop;
+	bool		iothread;
+	int		iothread_cpu;	/* -1 for any */
 };
 
 static void virtio_net_reset(void *vdev);
-static void virtio_net_tx_stop(struct virtio_net *net);
+static void virtio_net_notify(void *vdev, struct virtio_vq_info *vq);
+static void virtio_net_tx_stop(struct virtio_net_qp *qp);
 static int virtio_net_cfgread(void *vdev, int offset, int size,
 	uint32_t *retval);
 static int virtio_net_cfgwrite(void *vdev, int offset, int size,
@@ -182,16 +272,24 @@ static void virtio_net_set_status(void *vdev, uint64_t status);
 static void virtio_net_teardown(void *param);
 static struct vhost_net *vhost_net_init(struct virtio_base *base, int vhostfd,
 	int tapfd, int vq_idx);
+static struct vhost_net *vhost_net_user_init(struct virtio_base *base,
+	const char *path);
 static int vhost_net_deinit(struct vhost_net *vhost_net);
 static int vhost_net_start(struct vhost_net *vhost_net);
 static int vhost_net_stop(struct vhost_net *vhost_net);
 
+static bool register_vm_monitor_netpoll = false;
+
+static struct monitor_vm_ops virtio_net_monitor_ops = {
+	.netpoll = vm_monitor_netpoll,
+};
+
 static struct virtio_ops virtio_net_ops = {
 	"vtnet",			/* our name */
-	VIRTIO_NET_MAXQ - 1,		/* we currently support 2 virtqueues */
+	2,				/* 2 virtqueues, more with mq=<n> */
 	sizeof(struct virtio_net_config), /* config reg size */
 	virtio_net_reset,		/* reset */
-	NULL,				/* device-wide qnotify -- not used */
+	virtio_net_notify,		/* device-wide qnotify */
 	virtio_net_cfgread,		/* read PCI config */
 	virtio_net_cfgwrite,		/* write PCI config */
 	virtio_net_neg_features,	/* apply negotiated features */
@@ -233,36 +331,116 @@ ether_aton(const char *a, struct ether_addr *e)
  * If the transmit thread is active then stall until it is done.
  */
 static void
-virtio_net_txwait(struct virtio_net *net)
+virtio_net_txwait(struct virtio_net_qp *qp)
 {
-	pthread_mutex_lock(&net->tx_mtx);
-	while (net->tx_in_progress) {
-		pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
+	while (qp->tx_in_progress) {
+		pthread_mutex_unlock(&qp->tx_mtx);
 		usleep(10000);
-		pthread_mutex_lock(&net->tx_mtx);
+		pthread_mutex_lock(&qp->tx_mtx);
 	}
-	pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_unlock(&qp->tx_mtx);
 }
 
 /*
  * If the receive thread is active then stall until it is done.
  */
 static void
-virtio_net_rxwait(struct virtio_net *net)
+virtio_net_rxwait(struct virtio_net_qp *qp)
 {
-	pthread_mutex_lock(&net->rx_mtx);
-	while (net->rx_in_progress) {
-		pthread_mutex_unlock(&net->rx_mtx);
+	pthread_mutex_lock(&qp->rx_mtx);
+	while (qp->rx_in_progress) {
+		pthread_mutex_unlock(&qp->rx_mtx);
 		usleep(10000);
-		pthread_mutex_lock(&net->rx_mtx);
+		pthread_mutex_lock(&qp->rx_mtx);
+	}
+	pthread_mutex_unlock(&qp->rx_mtx);
+}
+
+/*
+ * Attach the tap queues of the first n pairs and detach the others, so
+ * that the host does not queue packets where the guest does not look.
+ */
+static void
+virtio_net_set_pairs(struct virtio_net *net, int n)
+{
+	struct virtio_net_qp *qp;
+	struct ifreq ifr;
+	bool attach;
+	int i;
+
+	for (i = 0; net->npairs > 1 && i < net->npairs; i++) {
+		qp = &net->qps[i];
+		attach = (i < n);
+		if (qp->tapfd < 0 || qp->attached == attach)
+			continue;
+
+		memset(&ifr, 0, sizeof(ifr));
+		ifr.ifr_flags = attach ? IFF_ATTACH_QUEUE : IFF_DETACH_QUEUE;
+		if (ioctl(qp->tapfd, TUNSETQUEUE, (void *)&ifr) < 0) {
+			WPRINTF(("vtnet: %s of tap queue %d failed: %d\n",
+				attach ? "attach" : "detach", i, errno));
+			continue;
+		}
+		qp->attached = attach;
+	}
+	net->curr_pairs = n;
+}
+
+/*
+ * Tell the tap the header size and the offloads of the guest, so that it
+ * only hands over packets the guest can take.
+ */
+static void
+virtio_net_tap_set_offload(struct virtio_net *net)
+{
+	unsigned int offload = 0;
+	int i, hdrlen = net->rx_vhdrlen;
+
+	if (!net->vnet_hdr)
+		return;
+
+	if (net->features & VIRTIO_NET_F_GUEST_CSUM) {
+		offload |= TUN_F_CSUM;
+		if (net->features & VIRTIO_NET_F_GUEST_TSO4)
+			offload |= TUN_F_TSO4;
+		if (net->features & VIRTIO_NET_F_GUEST_TSO6)
+			offload |= TUN_F_TSO6;
+		if (net->features & VIRTIO_NET_F_GUEST_ECN)
+			offload |= TUN_F_TSO_ECN;
+	}
+
+	for (i = 0; i < net->npairs; i++) {
+		if (net->qps[i].tapfd < 0)
+			continue;
+		if (ioctl(net->qps[i].tapfd, TUNSETVNETHDRSZ, &hdrlen) < 0 ||
+		    ioctl(net->qps[i].tapfd, TUNSETOFFLOAD, offload) < 0)
+			WPRINTF(("vtnet: tap offload 0x%x failed: %d\n",
+				offload, errno));
+	}
+}
+
+/*
+ * Set the interrupt coalescing of all the rx or tx queues. The tx thread
+ * of a pair may be in vq_endchains(), which vq_set_coalesce() copes with.
+ */
+static void
+virtio_net_set_coalesce(struct virtio_net *net, int q, uint32_t frames,
+			uint32_t usecs)
+{
+	int i;
+
+	for (i = 0; i < net->npairs; i++) {
+		if (vq_set_coalesce(&net->queues[2 * i + q], frames, usecs))
+			WPRINTF(("vtnet: no interrupt coalescing\n"));
 	}
-	pthread_mutex_unlock(&net->rx_mtx);
 }
 
 static void
 virtio_net_reset(void *vdev)
 {
 	struct virtio_net *net = vdev;
+	int i;
 
 	DPRINTF(("vtnet: device reset requested !\n"));
 
@@ -272,16 +450,31 @@ virtio_net_reset(void *vdev)
 	 * Wait for the transmit and receive threads to finish their
 	 * processing.
 	 */
-	virtio_net_txwait(net);
-	virtio_net_rxwait(net);
+	for (i = 0; i < net->npairs; i++) {
+		virtio_net_txwait(&net->qps[i]);
+		virtio_net_rxwait(&net->qps[i]);
+		net->qps[i].rx_ready = 0;
+	}
 
-	net->rx_ready = 0;
 	net->rx_merge = 1;
 	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
+	net->features = 0;
+	virtio_net_tap_set_offload(net);
+
+	/* the guest starts with a single queue pair */
+	virtio_net_set_pairs(net, 1);
 
 	/* now reset rings, MSI-X vectors, and negotiated capabilities */
 	virtio_reset_dev(&net->base);
 
+	/* the coalescing set by the guest is dropped */
+	if (!net->use_vhost) {
+		virtio_net_set_coalesce(net, VIRTIO_NET_RXQ, net->coal_frames,
+					net->coal_usecs);
+		virtio_net_set_coalesce(net, VIRTIO_NET_TXQ, net->coal_frames,
+					net->coal_usecs);
+	}
+
 	net->resetting = 0;
 	net->closing = 0;
 }
@@ -290,29 +483,29 @@ virtio_net_reset(void *vdev)
  * Send signal to tx I/O thread and wait till it exits
  */
 static void
-virtio_net_tx_stop(struct virtio_net *net)
+virtio_net_tx_stop(struct virtio_net_qp *qp)
 {
 	void *jval;
 
-	pthread_mutex_lock(&net->tx_mtx);
-	net->closing = 1;
-	pthread_cond_broadcast(&net->tx_cond);
-	pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
+	qp->net->closing = 1;
+	pthread_cond_broadcast(&qp->tx_cond);
+	pthread_mutex_unlock(&qp->tx_mtx);
 
-	pthread_join(net->tx_tid, &jval);
+	pthread_join(qp->tx_tid, &jval);
 }
 
 /*
  * Called to send a buffer chain out to the tap device
  */
 static void
-virtio_net_tap_tx(struct virtio_net *net, struct iovec *iov, int iovcnt,
+virtio_net_tap_tx(struct virtio_net_qp *qp, struct iovec *iov, int iovcnt,
 		  int len)
 {
 	static char pad[60]; /* all zero bytes */
 	ssize_t ret;
 
-	if (net->tapfd == -1)
+	if (qp->tapfd == -1)
 		return;
 
 	/*
@@ -325,7 +518,7 @@ virtio_net_tap_tx(struct virtio_net *net, struct iovec *iov, int iovcnt,
 		iov[iovcnt].iov_len = 60 - len;
 		iovcnt++;
 	}
-	ret = writev(net->tapfd, iov, iovcnt);
+	ret = writev(qp->tapfd, iov, iovcnt);
 	(void)ret; /*avoid compiler warning*/
 }
 
@@ -365,171 +558,377 @@ rx_iov_trim(struct iovec *iov, int *niov, int tlen)
 	return riov;
 }
 
+static ssize_t
+virtio_net_tap_rx(struct virtio_net_qp *qp, struct iovec *iov, int iovcnt)
+{
+	return readv(qp->tapfd, iov, iovcnt);
+}
+
+/*
+ * netmap backend: the frames are copied once between the guest buffers
+ * and the netmap buffers, which are mapped in the DM.
+ */
 static void
-virtio_net_tap_rx(struct virtio_net *net)
+virtio_net_netmap_tx(struct virtio_net_qp *qp, struct iovec *iov, int iovcnt,
+		     int len)
 {
-	struct iovec iov[VIRTIO_NET_MAXSEGS], *riov;
-	struct virtio_vq_info *vq;
-	void *vrx;
-	int len, n;
-	uint16_t idx;
-	ssize_t ret;
+	static char pad[60]; /* all zero bytes */
+	struct nm_desc *nmd = qp->nmd;
+	struct netmap_ring *ring;
+	uint32_t cur;
+	char *buf;
+	int i, r, off;
 
-	/*
-	 * Should never be called without a valid tap fd
-	 */
-	if (net->tapfd == -1) {
-		WPRINTF(("vtnet: tapfd == -1\n"));
+	if (nmd == NULL)
+		return;
+
+	if (len < 60) {
+		iov[iovcnt].iov_base = pad;
+		iov[iovcnt].iov_len = 60 - len;
+		iovcnt++;
+		len = 60;
+	}
+
+	/* a tx ring with room, reclaim the sent slots once if none */
+	for (r = nmd->cur_tx_ring; ; ) {
+		ring = NETMAP_TXRING(nmd->nifp, r);
+		if (!nm_ring_empty(ring))
+			break;
+		if (++r > nmd->last_tx_ring)
+			r = nmd->first_tx_ring;
+		if (r == nmd->cur_tx_ring) {
+			if (ioctl(nmd->fd, NIOCTXSYNC, NULL) < 0 ||
+			    nm_ring_empty(NETMAP_TXRING(nmd->nifp, r))) {
+				DPRINTF(("vtnet: netmap tx rings full\n\r"));
+				return;
+			}
+		}
+	}
+
+	if (len > ring->nr_buf_size) {
+		DPRINTF(("vtnet: netmap tx frame of %d bytes dropped\n\r",
+			len));
 		return;
 	}
 
+	cur = ring->cur;
+	buf = NETMAP_BUF(ring, ring->slot[cur].buf_idx);
+	for (i = 0, off = 0; i < iovcnt; i++) {
+		memcpy(buf + off, iov[i].iov_base, iov[i].iov_len);
+		off += iov[i].iov_len;
+	}
+	ring->slot[cur].len = off;
+	ring->head = ring->cur = nm_ring_next(ring, cur);
+	nmd->cur_tx_ring = r;
+}
+
+static void
+virtio_net_netmap_tx_flush(struct virtio_net_qp *qp)
+{
+	if (qp->nmd != NULL)
+		ioctl(qp->nmd->fd, NIOCTXSYNC, NULL);
+}
+
+static ssize_t
+virtio_net_netmap_rx(struct virtio_net_qp *qp, struct iovec *iov, int iovcnt)
+{
+	struct nm_desc *nmd = qp->nmd;
+	struct netmap_ring *ring;
+	uint32_t cur;
+	size_t left, n;
+	ssize_t len;
+	char *buf;
+	int i, r, synced;
+
+	/* an rx ring with a frame, release the read slots once if none */
+	synced = 0;
+	for (r = nmd->cur_rx_ring; ; ) {
+		ring = NETMAP_RXRING(nmd->nifp, r);
+		if (!nm_ring_empty(ring))
+			break;
+		if (++r > nmd->last_rx_ring)
+			r = nmd->first_rx_ring;
+		if (r == nmd->cur_rx_ring) {
+			if (synced || ioctl(nmd->fd, NIOCRXSYNC, NULL) < 0) {
+				errno = EWOULDBLOCK;
+				return -1;
+			}
+			synced = 1;
+		}
+	}
+
+	cur = ring->cur;
+	buf = NETMAP_BUF(ring, ring->slot[cur].buf_idx);
+	left = ring->slot[cur].len;
+	for (i = 0, len = 0; i < iovcnt && left > 0; i++) {
+		n = (iov[i].iov_len < left) ? iov[i].iov_len : left;
+		memcpy(iov[i].iov_base, buf + len, n);
+		len += n;
+		left -= n;
+	}
+	ring->head = ring->cur = nm_ring_next(ring, cur);
+	nmd->cur_rx_ring = r;
+
+	return len;
+}
+
+/*
+ * Drop a frame of the backend
+ */
+static void
+virtio_net_rx_drop(struct virtio_net_qp *qp)
+{
+	struct iovec iov;
+	ssize_t ret;
+
+	iov.iov_base = dummybuf;
+	iov.iov_len = sizeof(dummybuf);
+	ret = qp->net->virtio_net_rx(qp, &iov, 1);
+	(void)ret; /*avoid compiler warning*/
+}
+
+static void
+virtio_net_proc_rx(struct virtio_net_qp *qp)
+{
+	struct iovec iov[VIRTIO_NET_MAXSEGS], *riov;
+	struct virtio_net *net = qp->net;
+	struct virtio_vq_info *vq;
+	struct vq_chain rel[VIRTIO_NET_RX_BATCH + VIRTIO_NET_MAXSEGS];
+	uint16_t idx[VIRTIO_NET_MAXSEGS];
+	int clen[VIRTIO_NET_MAXSEGS];
+	void *vrx;
+	int i, len, n, need, niov, nchains, used, nrel, npkts;
+
 	/*
-	 * But, will be called when the rx ring hasn't yet
+	 * Will be called when the rx ring hasn't yet
 	 * been set up or the guest is resetting the device.
 	 */
-	if (!net->rx_ready || net->resetting) {
+	if (!qp->rx_ready || net->resetting) {
 		/*
 		 * Drop the packet and try later.
 		 */
-		ret = read(net->tapfd, dummybuf, sizeof(dummybuf));
-		(void)ret; /*avoid compiler warning*/
-
+		virtio_net_rx_drop(qp);
 		return;
 	}
 
 	/*
 	 * Check for available rx buffers
 	 */
-	vq = &net->queues[VIRTIO_NET_RXQ];
+	vq = &net->queues[2 * qp->idx + VIRTIO_NET_RXQ];
 	if (!vq_has_descs(vq)) {
 		/*
 		 * Drop the packet and try later.  Interrupt on
 		 * empty, if that's negotiated.
 		 */
-		ret = read(net->tapfd, dummybuf, sizeof(dummybuf));
-		(void)ret; /*avoid compiler warning*/
+		virtio_net_rx_drop(qp);
 
 		vq_endchains(vq, 1);
 		return;
 	}
 
+	/*
+	 * Read a burst of up to VIRTIO_NET_RX_BATCH frames, the used chains
+	 * are published and the guest interrupted once for all of them. The
+	 * frames left in the tap get the next wakeup.
+	 */
+	nrel = 0;
+	npkts = 0;
 	do {
 		/*
-		 * Get descriptor chain.
+		 * Get enough chains for the largest packet, with merged rx
+		 * bufs a packet may span several of them.
 		 */
-		n = vq_getchain(vq, &idx, iov, VIRTIO_NET_MAXSEGS, NULL);
-		if (n < 1 || n > VIRTIO_NET_MAXSEGS) {
-			WPRINTF(("vtnet: virtio_net_tap_rx: vq_getchain = %d\n", n));
-			return;
-		}
+		need = net->rx_vhdrlen + ((net->features &
+			(VIRTIO_NET_F_GUEST_TSO4 | VIRTIO_NET_F_GUEST_TSO6)) ?
+			VIRTIO_NET_RX_GSO_LEN : VIRTIO_NET_RX_LEN);
+		nchains = 0;
+		niov = 0;
+		do {
+			n = vq_getchain(vq, &idx[nchains], &iov[niov],
+					VIRTIO_NET_MAXSEGS - niov, NULL);
+			if (n < 1 || n > VIRTIO_NET_MAXSEGS - niov) {
+				if (n > 0)
+					vq_retchain(vq);
+				else
+					WPRINTF(("vtnet: virtio_net_proc_rx: "
+						"vq_getchain = %d\n", n));
+				break;
+			}
+			clen[nchains] = 0;
+			for (i = 0; i < n; i++)
+				clen[nchains] += iov[niov + i].iov_len;
+			need -= clen[nchains];
+			niov += n;
+			nchains++;
+		} while (net->rx_merge && need > 0 &&
+			 niov < VIRTIO_NET_MAXSEGS && vq_has_descs(vq));
+		if (nchains == 0)
+			break;
+
 		/*
-		 * Get a pointer to the rx header, and use the
-		 * data immediately following it for the packet buffer.
+		 * Get a pointer to the rx header, and use the data
+		 * immediately following it for the packet buffer, unless
+		 * the tap fills in the header itself.
 		 */
 		vrx = iov[0].iov_base;
-		riov = rx_iov_trim(iov, &n, net->rx_vhdrlen);
-		if (riov == NULL)
-			return;
+		n = niov;
+		if (iov[0].iov_len < net->rx_vhdrlen)
+			riov = NULL;
+		else if (net->vnet_hdr)
+			riov = iov;
+		else
+			riov = rx_iov_trim(iov, &n, net->rx_vhdrlen);
+		if (riov == NULL) {
+			WPRINTF(("vtnet: rx header does not fit in %lu bytes\n",
+				iov[0].iov_len));
+			for (i = 0; i < nchains; i++) {
+				rel[nrel].idx = idx[i];
+				rel[nrel++].iolen = 0;
+			}
+			break;
+		}
 
-		len = readv(net->tapfd, riov, n);
+		len = net->virtio_net_rx(qp, riov, n);
 
-		if (len < 0 && errno == EWOULDBLOCK) {
+		if (len < 0) {
 			/*
 			 * No more packets, but still some avail ring
 			 * entries.  Interrupt if needed/appropriate.
 			 */
-			vq_retchain(vq);
+			for (i = 0; i < nchains; i++)
+				vq_retchain(vq);
+			vq_relchains(vq, rel, nrel);
 			vq_endchains(vq, 0);
 			return;
 		}
 
 		/*
-		 * The only valid field in the rx packet header is the
-		 * number of buffers if merged rx bufs were negotiated.
+		 * Without vnet_hdr the only valid field in the rx packet
+		 * header is the number of buffers if merged rx bufs were
+		 * negotiated.
 		 */
-		memset(vrx, 0, net->rx_vhdrlen);
+		if (!net->vnet_hdr) {
+			memset(vrx, 0, net->rx_vhdrlen);
+			len += net->rx_vhdrlen;
+		}
+
+		/* the chains the packet went in */
+		n = len;
+		for (used = 1; used < nchains && n > clen[used - 1]; used++)
+			n -= clen[used - 1];
 
 		if (net->rx_merge) {
 			struct virtio_net_rxhdr *vrxh;
 
 			vrxh = vrx;
-			vrxh->vrh_bufs = 1;
+			vrxh->vrh_bufs = used;
 		}
 
 		/*
-		 * Release this chain and handle more chains.
+		 * Release the chains of the packet and hand back the
+		 * others.
 		 */
-		vq_relchain(vq, idx, len + net->rx_vhdrlen);
-	} while (vq_has_descs(vq));
+		for (i = 0; i < used; i++) {
+			n = (len < clen[i]) ? len : clen[i];
+			rel[nrel].idx = idx[i];
+			rel[nrel++].iolen = n;
+			len -= n;
+		}
+		for (i = nchains - 1; i >= used; i--)
+			vq_retchain(vq);
+	} while (++npkts < VIRTIO_NET_RX_BATCH && nrel < VIRTIO_NET_RX_BATCH &&
+		 vq_has_descs(vq));
+
+	vq_relchains(vq, rel, nrel);
 
 	/* Interrupt if needed, including for NOTIFY_ON_EMPTY. */
-	vq_endchains(vq, 1);
+	vq_endchains(vq, !vq_has_descs(vq));
 }
 
 static void
 virtio_net_rx_callback(int fd, enum ev_type type, void *param)
 {
-	struct virtio_net *net = param;
+	struct virtio_net_qp *qp = param;
 
-	pthread_mutex_lock(&net->rx_mtx);
-	net->rx_in_progress = 1;
-	net->virtio_net_rx(net);
-	net->rx_in_progress = 0;
-	pthread_mutex_unlock(&net->rx_mtx);
+	pthread_mutex_lock(&qp->rx_mtx);
+	qp->rx_in_progress = 1;
+	virtio_net_proc_rx(qp);
+	qp->rx_in_progress = 0;
+	pthread_mutex_unlock(&qp->rx_mtx);
 
 }
 
 static void
-virtio_net_ping_rxq(void *vdev, struct virtio_vq_info *vq)
+virtio_net_ping_rxq(struct virtio_net_qp *qp, struct virtio_vq_info *vq)
 {
-	struct virtio_net *net = vdev;
-
 	/*
 	 * A qnotify means that the rx process can now begin
 	 */
-	if (net->rx_ready == 0) {
-		net->rx_ready = 1;
-		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+	if (qp->rx_ready == 0) {
+		qp->rx_ready = 1;
+		vq_set_used_ring_flags(&qp->net->base, vq);
 	}
 }
 
+/*
+ * With vnet_hdr the header goes to the tap with the packet, len is still
+ * the length of the packet only.
+ */
 static void
-virtio_net_proctx(struct virtio_net *net, struct virtio_vq_info *vq)
+virtio_net_proctx(struct virtio_net_qp *qp, struct virtio_vq_info *vq)
 {
-	struct iovec iov[VIRTIO_NET_MAXSEGS + 1];
-	int i, n;
+	struct vq_chain chains[VIRTIO_NET_TX_BATCH], *c;
+	int i, j, n, nchains;
 	int plen, tlen;
-	uint16_t idx;
+
+	for (j = 0; j < VIRTIO_NET_TX_BATCH; j++) {
+		chains[j].iov = qp->tx_iov[j];
+		chains[j].flags = NULL;
+	}
 
 	/*
-	 * Obtain chain of descriptors.  The first one is
-	 * really the header descriptor, so we need to sum
+	 * Obtain a batch of chains of descriptors.  The first one
+	 * of each is really the header descriptor, so we need to sum
 	 * up two lengths: packet length and transfer length.
 	 */
-	n = vq_getchain(vq, &idx, iov, VIRTIO_NET_MAXSEGS, NULL);
-	if (n < 1 || n > VIRTIO_NET_MAXSEGS) {
-		WPRINTF(("vtnet: virtio_net_proctx: vq_getchain = %d\n", n));
-		return;
-	}
-	plen = 0;
-	tlen = iov[0].iov_len;
-	for (i = 1; i < n; i++) {
-		plen += iov[i].iov_len;
-		tlen += iov[i].iov_len;
+	nchains = vq_getchains(vq, chains, VIRTIO_NET_TX_BATCH,
+			VIRTIO_NET_MAXSEGS);
+	for (j = 0; j < nchains; j++) {
+		c = &chains[j];
+		n = c->n;
+		if (n < 1 || n > VIRTIO_NET_MAXSEGS) {
+			/* drop the packet, the chain still goes back */
+			WPRINTF(("vtnet: virtio_net_proctx: vq_getchain = %d\n", n));
+			c->iolen = 0;
+			continue;
+		}
+		plen = 0;
+		tlen = c->iov[0].iov_len;
+		for (i = 1; i < n; i++) {
+			plen += c->iov[i].iov_len;
+			tlen += c->iov[i].iov_len;
+		}
+
+		DPRINTF(("virtio: packet send, %d bytes, %d segs\n\r", plen, n));
+		if (qp->net->vnet_hdr)
+			qp->net->virtio_net_tx(qp, c->iov, n, plen);
+		else
+			qp->net->virtio_net_tx(qp, &c->iov[1], n - 1, plen);
+
+		/* chain is processed, set tlen */
+		c->iolen = tlen;
 	}
 
-	DPRINTF(("virtio: packet send, %d bytes, %d segs\n\r", plen, n));
-	net->virtio_net_tx(net, &iov[1], n - 1, plen);
+	if (qp->net->virtio_net_tx_flush)
+		qp->net->virtio_net_tx_flush(qp);
 
-	/* chain is processed, release it and set tlen */
-	vq_relchain(vq, idx, tlen);
+	/* release the chains at once */
+	vq_relchains(vq, chains, nchains);
 }
 
 static void
-virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
+virtio_net_ping_txq(struct virtio_net_qp *qp, struct virtio_vq_info *vq)
 {
-	struct virtio_net *net = vdev;
-
 	/*
 	 * Any ring entries to process?
 	 */
@@ -537,11 +936,11 @@ virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 		return;
 
 	/* Signal the tx thread for processing */
-	pthread_mutex_lock(&net->tx_mtx);
-	vq->used->flags |= VRING_USED_F_NO_NOTIFY;
-	if (net->tx_in_progress == 0)
-		pthread_cond_signal(&net->tx_cond);
-	pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
+	vq_set_used_ring_flags(&qp->net->base, vq);
+	if (qp->tx_in_progress == 0)
+		pthread_cond_signal(&qp->tx_cond);
+	pthread_mutex_unlock(&qp->tx_mtx);
 }
 
 /*
@@ -550,27 +949,28 @@ virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 static void *
 virtio_net_tx_thread(void *param)
 {
-	struct virtio_net *net = param;
-	struct virtio_vq_info *vq = &net->queues[VIRTIO_NET_TXQ];
+	struct virtio_net_qp *qp = param;
+	struct virtio_net *net = qp->net;
+	struct virtio_vq_info *vq = &net->queues[2 * qp->idx + VIRTIO_NET_TXQ];
 
 	/*
 	 * Let us wait till the tx queue pointers get initialised &
 	 * first tx signaled
 	 */
-	pthread_mutex_lock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
 
 	while (!net->closing && !vq_ring_ready(vq))
-		pthread_cond_wait(&net->tx_cond, &net->tx_mtx);
+		pthread_cond_wait(&qp->tx_cond, &qp->tx_mtx);
 
 	if (net->closing) {
 		WPRINTF(("vtnet tx thread closing...\n"));
-		pthread_mutex_unlock(&net->tx_mtx);
+		pthread_mutex_unlock(&qp->tx_mtx);
 		return NULL;
 	}
 
 	for (;;) {
 		/* note - tx mutex is locked here */
-		net->tx_in_progress = 0;
+		qp->tx_in_progress = 0;
 
 		/*
 		 * Checking the avail ring here serves two purposes:
@@ -584,18 +984,18 @@ virtio_net_tx_thread(void *param)
 			if (!net->resetting && vq_has_descs(vq))
 				break;
 
-			pthread_cond_wait(&net->tx_cond, &net->tx_mtx);
+			pthread_cond_wait(&qp->tx_cond, &qp->tx_mtx);
 
 			if (net->closing) {
 				WPRINTF(("vtnet tx thread closing...\n"));
-				pthread_mutex_unlock(&net->tx_mtx);
+				pthread_mutex_unlock(&qp->tx_mtx);
 				return NULL;
 			}
 		}
 
-		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
-		net->tx_in_progress = 1;
-		pthread_mutex_unlock(&net->tx_mtx);
+		vq_set_used_ring_flags(&net->base, vq);
+		qp->tx_in_progress = 1;
+		pthread_mutex_unlock(&qp->tx_mtx);
 
 		do {
 			/*
@@ -603,7 +1003,7 @@ virtio_net_tx_thread(void *param)
 			 * iovecs and sending when an end-of-packet
 			 * is found
 			 */
-			virtio_net_proctx(net, vq);
+			virtio_net_proctx(qp, vq);
 		} while (vq_has_descs(vq));
 
 		/*
@@ -611,17 +1011,137 @@ virtio_net_tx_thread(void *param)
 		 */
 		vq_endchains(vq, 1);
 
-		pthread_mutex_lock(&net->tx_mtx);
+		pthread_mutex_lock(&qp->tx_mtx);
+	}
+}
+
+static uint8_t
+virtio_net_ctl_mq(struct virtio_net *net, uint8_t cmd, uint8_t *data,
+		  size_t len)
+{
+	uint16_t pairs;
+
+	if (len < sizeof(pairs) || cmd != VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET)
+		return VIRTIO_NET_ERR;
+
+	memcpy(&pairs, data, sizeof(pairs));
+	if (pairs < 1 || pairs > net->npairs ||
+	    (net->features & VIRTIO_NET_F_MQ) == 0) {
+		WPRINTF(("vtnet: invalid number of queue pairs %d\n", pairs));
+		return VIRTIO_NET_ERR;
+	}
+
+	DPRINTF(("vtnet: %d queue pairs in use\n\r", pairs));
+	virtio_net_set_pairs(net, pairs);
+	return VIRTIO_NET_OK;
+}
+
+static uint8_t
+virtio_net_ctl_coal(struct virtio_net *net, uint8_t cmd, uint8_t *data,
+		    size_t len)
+{
+	struct virtio_net_ctrl_coal coal;
+
+	if (len < sizeof(coal) || (net->features & VIRTIO_NET_F_NOTF_COAL) == 0 ||
+	    (cmd != VIRTIO_NET_CTRL_NOTF_COAL_TX_SET &&
+	     cmd != VIRTIO_NET_CTRL_NOTF_COAL_RX_SET))
+		return VIRTIO_NET_ERR;
+
+	memcpy(&coal, data, sizeof(coal));
+	DPRINTF(("vtnet: %s coalescing %u frames/%u us\n\r",
+		cmd == VIRTIO_NET_CTRL_NOTF_COAL_TX_SET ? "tx" : "rx",
+		coal.max_packets, coal.max_usecs));
+	virtio_net_set_coalesce(net,
+		cmd == VIRTIO_NET_CTRL_NOTF_COAL_TX_SET ?
+		VIRTIO_NET_TXQ : VIRTIO_NET_RXQ,
+		coal.max_packets, coal.max_usecs);
+	return VIRTIO_NET_OK;
+}
+
+/*
+ * Handle one command of the control queue, returns the ack.
+ */
+static uint8_t
+virtio_net_ctl_cmd(struct virtio_net *net, uint8_t *cmd, size_t len)
+{
+	struct virtio_net_ctrl_hdr *hdr = (struct virtio_net_ctrl_hdr *)cmd;
+	uint8_t ack = VIRTIO_NET_ERR;
+
+	if (len >= sizeof(*hdr)) {
+		if (hdr->class == VIRTIO_NET_CTRL_MQ)
+			ack = virtio_net_ctl_mq(net, hdr->cmd,
+				cmd + sizeof(*hdr), len - sizeof(*hdr));
+		else if (hdr->class == VIRTIO_NET_CTRL_NOTF_COAL)
+			ack = virtio_net_ctl_coal(net, hdr->cmd,
+				cmd + sizeof(*hdr), len - sizeof(*hdr));
+	}
+
+	if (ack != VIRTIO_NET_OK)
+		DPRINTF(("vtnet: control command %d/%d failed\n\r",
+			len ? hdr->class : -1, len > 1 ? hdr->cmd : -1));
+	return ack;
+}
+
+static void
+virtio_net_ping_ctlq(struct virtio_net *net, struct virtio_vq_info *vq)
+{
+	struct iovec iov[VIRTIO_NET_CTL_SEGS];
+	uint16_t flags[VIRTIO_NET_CTL_SEGS];
+	uint8_t cmd[16], *ack;
+	size_t len, n_copy;
+	uint16_t idx;
+	int i, n;
+
+	while (vq_has_descs(vq)) {
+		n = vq_getchain(vq, &idx, iov, VIRTIO_NET_CTL_SEGS, flags);
+		if (n < 2 || n > VIRTIO_NET_CTL_SEGS) {
+			WPRINTF(("vtnet: virtio_net_ping_ctlq: vq_getchain = %d\n",
+				n));
+			return;
+		}
+
+		/* the command in the readable buffers, the ack in the last */
+		len = 0;
+		for (i = 0; i < n - 1 && (flags[i] & VRING_DESC_F_WRITE) == 0;
+				i++) {
+			n_copy = iov[i].iov_len;
+			if (n_copy > sizeof(cmd) - len)
+				n_copy = sizeof(cmd) - len;
+			memcpy(cmd + len, iov[i].iov_base, n_copy);
+			len += n_copy;
+		}
+
+		if ((flags[n - 1] & VRING_DESC_F_WRITE) == 0 ||
+		    iov[n - 1].iov_len < 1) {
+			WPRINTF(("vtnet: control queue without ack buffer\n"));
+			vq_relchain(vq, idx, 0);
+			continue;
+		}
+		ack = iov[n - 1].iov_base;
+		*ack = virtio_net_ctl_cmd(net, cmd, len);
+		vq_relchain(vq, idx, sizeof(*ack));
 	}
+
+	vq_endchains(vq, 1);
 }
 
-#ifdef notyet
 static void
-virtio_net_ping_ctlq(void *vdev, struct virtio_vq_info *vq)
+virtio_net_notify(void *vdev, struct virtio_vq_info *vq)
 {
-	DPRINTF(("vtnet: control qnotify!\n\r"));
+	struct virtio_net *net = vdev;
+	int ctlq;
+
+	ctlq = (net->features & VIRTIO_NET_F_MQ) ?
+		2 * net->npairs : VIRTIO_NET_CTLQ;
+	if ((net->features & VIRTIO_NET_F_CTRL_VQ) && vq->num == ctlq)
+		virtio_net_ping_ctlq(net, vq);
+	else if (vq->num >= 2 * net->npairs)
+		WPRINTF(("vtnet: notify of unused queue %d\n", vq->num));
+	else if ((vq->num & 1) == VIRTIO_NET_RXQ)
+		virtio_net_ping_rxq(&net->qps[vq->num / 2], vq);
+	else
+		virtio_net_ping_txq(&net->qps[vq->num / 2], vq);
 }
-#endif
 
 static int
 virtio_net_parsemac(char *mac_str, uint8_t *mac_addr)
@@ -648,10 +1168,17 @@ virtio_net_parsemac(char *mac_str, uint8_t *mac_addr)
 	return 0;
 }
 
+/*
+ * Open a queue of the tap device. flags holds the optional IFF_MULTI_QUEUE
+ * and IFF_VNET_HDR, the ones the tun driver does not support are dropped.
+ * All the queues of a multi-queue device are opened with the same name
+ * and flags.
+ */
 static int
-virtio_net_tap_open(char *devname)
+virtio_net_tap_open(char *devname, int *flags)
 {
 	int tunfd, rc;
+	unsigned int features;
 	struct ifreq ifr;
 
 #define PATH_NET_TUN "/dev/net/tun"
@@ -662,7 +1189,10 @@ virtio_net_tap_open(char *devname)
 	}
 
 	memset(&ifr, 0, sizeof(ifr));
-	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+	if (ioctl(tunfd, TUNGETFEATURES, &features) < 0)
+		features = 0;
+	*flags &= features;
+	ifr.ifr_flags = IFF_TAP | IFF_NO_PI | *flags;
 
 	if (*devname) {
 		strncpy(ifr.ifr_name, devname, IFNAMSIZ);
@@ -681,26 +1211,97 @@ virtio_net_tap_open(char *devname)
 	return tunfd;
 }
 
+/*
+ * Parse "<rx us>[/<tx us>]", tx takes the rx timeout if not given.
+ */
+static int
+virtio_net_parse_busyloop(const char *str, uint32_t *busyloop)
+{
+	char *end;
+
+	if (dm_strtoui(str, &end, 10, &busyloop[VIRTIO_NET_RXQ]))
+		return -1;
+	busyloop[VIRTIO_NET_TXQ] = busyloop[VIRTIO_NET_RXQ];
+	if (*end == '/' &&
+	    dm_strtoui(end + 1, &end, 10, &busyloop[VIRTIO_NET_TXQ]))
+		return -1;
+	return (*end == '\0') ? 0 : -1;
+}
+
 static void
-virtio_net_tap_setup(struct virtio_net *net, char *devname)
+virtio_net_set_busyloop(struct virtio_net_qp *qp)
 {
-	char tbuf[IFNAMSIZ];
-	int vhost_fd = -1;
-	int rc;
+	struct virtio_net *net = qp->net;
+	int i;
+
+	for (i = VIRTIO_NET_RXQ; i <= VIRTIO_NET_TXQ; i++) {
+		if (vhost_vq_set_busyloop_timeout(&qp->vhost_net->vdev, i,
+				net->busyloop[i]) < 0)
+			WPRINTF(("vtnet: busyloop of vhost queue %d failed\n",
+				2 * qp->idx + i));
+	}
+}
 
-	rc = snprintf(tbuf, IFNAMSIZ, "%s", devname);
-	if (rc < 0 || rc >= IFNAMSIZ) /* give warning if error or truncation happens */
-		WPRINTF(("Fail to set tap device name %s\n", tbuf));
+/*
+ * Set the vhost busy loop timeouts of the virtio-net device in the slot of
+ * devargs: "slot,busyloop=<rx us>[/<tx us>]".
+ */
+int
+vm_monitor_netpoll(void *arg, char *devargs)
+{
+	struct pci_vdev *dev;
+	struct virtio_net *net;
+	uint32_t busyloop[2];
+	char *str, *cp, *str_slot;
+	int slot, i, error = 0;
 
-	net->virtio_net_rx = virtio_net_tap_rx;
-	net->virtio_net_tx = virtio_net_tap_tx;
+	str = cp = strdup(devargs);
+	if (str == NULL)
+		return -1;
 
-	net->tapfd = virtio_net_tap_open(tbuf);
-	if (net->tapfd == -1) {
-		WPRINTF(("open of tap device %s failed\n", tbuf));
-		return;
+	str_slot = strsep(&cp, ",");
+	if (dm_strtoi(str_slot, &str_slot, 10, &slot)) {
+		fprintf(stderr, "Incorrect slot!\n");
+		error = -1;
+		goto end;
 	}
-	DPRINTF(("open of tap device %s success!\n", tbuf));
+
+	if (cp == NULL || strncmp(cp, "busyloop=", 9) != 0 ||
+	    virtio_net_parse_busyloop(cp + 9, busyloop)) {
+		fprintf(stderr, "Incorrect busyloop!\n");
+		error = -1;
+		goto end;
+	}
+
+	dev = pci_get_vdev_info(slot);
+	if (dev == NULL || strstr(dev->name, "virtio-net") == NULL) {
+		fprintf(stderr, "No virtio-net device at slot %d\n", slot);
+		error = -1;
+		goto end;
+	}
+
+	net = (struct virtio_net *)dev->arg;
+	if (net == NULL || net->qps[0].vhost_net == NULL) {
+		fprintf(stderr, "No vhost for the device at slot %d\n", slot);
+		error = -1;
+		goto end;
+	}
+
+	net->busyloop[VIRTIO_NET_RXQ] = busyloop[VIRTIO_NET_RXQ];
+	net->busyloop[VIRTIO_NET_TXQ] = busyloop[VIRTIO_NET_TXQ];
+	for (i = 0; i < net->npairs; i++) {
+		if (net->qps[i].vhost_net)
+			virtio_net_set_busyloop(&net->qps[i]);
+	}
+end:
+	free(str);
+	return error;
+}
+
+static void
+virtio_net_qp_setup(struct virtio_net *net, struct virtio_net_qp *qp)
+{
+	int vhost_fd = -1;
 
 	/*
 	 * Set non-blocking and register for read
@@ -708,10 +1309,10 @@ virtio_net_tap_setup(struct virtio_net *net, char *devname)
 	 */
 	int opt = 1;
 
-	if (ioctl(net->tapfd, FIONBIO, &opt) < 0) {
+	if (ioctl(qp->tapfd, FIONBIO, &opt) < 0) {
 		WPRINTF(("tap device O_NONBLOCK failed\n"));
-		close(net->tapfd);
-		net->tapfd = -1;
+		close(qp->tapfd);
+		qp->tapfd = -1;
 	}
 
 	if (net->use_vhost) {
@@ -719,27 +1320,167 @@ virtio_net_tap_setup(struct virtio_net *net, char *devname)
 		if (vhost_fd < 0)
 			WPRINTF(("open of vhost-net failed\n"));
 		else {
-			net->vhost_net = vhost_net_init(&net->base, vhost_fd,
-				net->tapfd, 0);
-			if (!net->vhost_net) {
+			qp->vhost_net = vhost_net_init(&net->base, vhost_fd,
+				qp->tapfd, 2 * qp->idx);
+			if (!qp->vhost_net) {
 				WPRINTF(("vhost_net_init failed, fallback "
 					"to userspace virtio\n"));
 				close(vhost_fd);
 				vhost_fd = -1;
-			}
+			} else
+				virtio_net_set_busyloop(qp);
 		}
 	}
 
 	if (vhost_fd < 0) {
-		net->mevp = mevent_add(net->tapfd, EVF_READ,
-				       virtio_net_rx_callback, net,
-				       virtio_net_teardown, net);
-		if (net->mevp == NULL) {
+		qp->mevp = mevent_add_loop(net->evloop, qp->tapfd, EVF_READ,
+				       virtio_net_rx_callback, qp,
+				       virtio_net_teardown, qp);
+		if (qp->mevp == NULL) {
 			WPRINTF(("Could not register event\n"));
-			close(net->tapfd);
-			net->tapfd = -1;
+			close(qp->tapfd);
+			qp->tapfd = -1;
+		} else
+			net->refs++;
+	}
+}
+
+static void
+virtio_net_tap_setup(struct virtio_net *net, char *devname)
+{
+	char tbuf[IFNAMSIZ];
+	struct virtio_net_qp *qp;
+	unsigned int offload;
+	int i, flags, rc;
+
+	rc = snprintf(tbuf, IFNAMSIZ, "%s", devname);
+	if (rc < 0 || rc >= IFNAMSIZ) /* give warning if error or truncation happens */
+		WPRINTF(("Fail to set tap device name %s\n", tbuf));
+
+	net->virtio_net_rx = virtio_net_tap_rx;
+	net->virtio_net_tx = virtio_net_tap_tx;
+
+	/* vhost adds the virtio net header itself */
+	flags = net->use_vhost ? 0 : IFF_VNET_HDR;
+	if (net->npairs > 1)
+		flags |= IFF_MULTI_QUEUE;
+
+	for (i = 0; i < net->npairs; i++) {
+		qp = &net->qps[i];
+		qp->tapfd = virtio_net_tap_open(tbuf, &flags);
+		if (i == 0 && net->npairs > 1 &&
+		    (qp->tapfd == -1 || (flags & IFF_MULTI_QUEUE) == 0)) {
+			WPRINTF(("multi-queue tap device %s failed, "
+				"fallback to one queue pair\n", tbuf));
+			net->npairs = 1;
+			flags &= ~IFF_MULTI_QUEUE;
+			if (qp->tapfd == -1)
+				qp->tapfd = virtio_net_tap_open(tbuf, &flags);
+		}
+		if (qp->tapfd == -1) {
+			WPRINTF(("open of tap device %s queue %d failed\n",
+				tbuf, i));
+			if (i > 0)
+				net->npairs = i;
+			break;
 		}
+		qp->attached = true;
+	}
+	if (net->qps[0].tapfd == -1)
+		return;
+	DPRINTF(("open of tap device %s success!\n", tbuf));
+
+	/*
+	 * With IFF_VNET_HDR the offloads are passed through, the guest
+	 * offloads only if the tap takes them.
+	 */
+	if (flags & IFF_VNET_HDR) {
+		net->vnet_hdr = true;
+		net->base.device_caps |= VIRTIO_NET_S_OFFLOADCAPS;
+		offload = TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6 | TUN_F_TSO_ECN;
+		if (ioctl(net->qps[0].tapfd, TUNSETOFFLOAD, offload) < 0)
+			net->base.device_caps &= ~(VIRTIO_NET_F_GUEST_CSUM |
+				VIRTIO_NET_F_GUEST_TSO4 |
+				VIRTIO_NET_F_GUEST_TSO6 |
+				VIRTIO_NET_F_GUEST_ECN);
+		virtio_net_tap_set_offload(net);
+	}
+
+	for (i = 0; i < net->npairs; i++)
+		virtio_net_qp_setup(net, &net->qps[i]);
+}
+
+static bool
+virtio_net_is_netmap(const char *devname)
+{
+	return (strncmp(devname, "vale", 4) == 0 ||
+		strncmp(devname, "netmap:", 7) == 0);
+}
+
+/*
+ * Open a netmap port, e.g. "vale0:vm1" for a port of a VALE switch or
+ * "netmap:eth0" for a NIC. The port has a single queue pair.
+ */
+static void
+virtio_net_netmap_setup(struct virtio_net *net, char *devname)
+{
+	struct virtio_net_qp *qp = &net->qps[0];
+
+	net->virtio_net_rx = virtio_net_netmap_rx;
+	net->virtio_net_tx = virtio_net_netmap_tx;
+	net->virtio_net_tx_flush = virtio_net_netmap_tx_flush;
+
+	if (net->npairs > 1) {
+		WPRINTF(("netmap port %s: only one queue pair\n", devname));
+		net->npairs = 1;
 	}
+
+	qp->nmd = nm_open(devname, NULL, 0, NULL);
+	if (qp->nmd == NULL) {
+		WPRINTF(("open of netmap port %s failed: %d\n",
+			devname, errno));
+		return;
+	}
+	DPRINTF(("open of netmap port %s success!\n", devname));
+
+	qp->mevp = mevent_add_loop(net->evloop, qp->nmd->fd, EVF_READ,
+			      virtio_net_rx_callback, qp,
+			      virtio_net_teardown, qp);
+	if (qp->mevp == NULL) {
+		WPRINTF(("Could not register event\n"));
+		nm_close(qp->nmd);
+		qp->nmd = NULL;
+	} else
+		net->refs++;
+}
+
+static bool
+virtio_net_is_vhost_user(const char *devname)
+{
+	return (strncmp(devname, "vhost-user:", 11) == 0);
+}
+
+/*
+ * Connect to a vhost-user backend, e.g. "vhost-user:/run/vm1-net.sock".
+ * The backend serves the rings itself, the DM sees no frames.
+ */
+static void
+virtio_net_vhost_user_setup(struct virtio_net *net, char *devname)
+{
+	struct virtio_net_qp *qp = &net->qps[0];
+
+	/* a kick before DRIVER_OK is dropped, qp->tapfd stays -1 */
+	net->virtio_net_rx = virtio_net_tap_rx;
+	net->virtio_net_tx = virtio_net_tap_tx;
+
+	net->base.device_caps |= VIRTIO_NET_S_OFFLOADCAPS;
+	qp->vhost_net = vhost_net_user_init(&net->base, devname + 11);
+	if (!qp->vhost_net) {
+		WPRINTF(("vhost-user port %s failed\n", devname + 11));
+		net->base.device_caps &= ~VIRTIO_NET_S_OFFLOADCAPS;
+		return;
+	}
+	DPRINTF(("vhost-user port %s connected!\n", devname + 11));
 }
 
 static int
@@ -755,7 +1496,8 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	char *opt;
 	int mac_provided;
 	pthread_mutexattr_t attr;
-	int rc;
+	struct virtio_net_qp *qp;
+	int i, rc;
 
 	net = calloc(1, sizeof(struct virtio_net));
 	if (!net) {
@@ -781,7 +1523,8 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	 * Read the MAC address if specified
 	 */
 	mac_provided = 0;
-	net->vhost_net = NULL;
+	net->npairs = 1;
+	net->iothread_cpu = -1;
 	if (opts != NULL) {
 		int err;
 
@@ -797,7 +1540,50 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		while ((opt = strsep(&vtopts, ",")) != NULL) {
 			if (strcmp("vhost", opt) == 0)
 				net->use_vhost = true;
-			else {
+			else if (strncmp("busyloop=", opt, 9) == 0) {
+				if (virtio_net_parse_busyloop(opt + 9,
+						net->busyloop)) {
+					WPRINTF(("virtio_net: busyloop should be "
+						"<rx us>[/<tx us>]\n"));
+					free(devname);
+					free(net);
+					return -1;
+				}
+			} else if (strncmp("coalesce=", opt, 9) == 0) {
+				if (virtio_parse_coalesce(opt + 9,
+						&net->coal_frames,
+						&net->coal_usecs)) {
+					WPRINTF(("virtio_net: coalesce should be "
+						"<max frames>/<max usecs>\n"));
+					free(devname);
+					free(net);
+					return -1;
+				}
+			} else if (strcmp("iothread", opt) == 0)
+				net->iothread = true;
+			else if (strncmp("iothread=", opt, 9) == 0) {
+				if (dm_strtoi(opt + 9, &opt, 10,
+						&net->iothread_cpu) ||
+				    *opt != '\0' || net->iothread_cpu < 0 ||
+				    net->iothread_cpu >= CPU_SETSIZE) {
+					WPRINTF(("virtio_net: iothread should "
+						"be a SOS cpu\n"));
+					free(devname);
+					free(net);
+					return -1;
+				}
+				net->iothread = true;
+			} else if (strncmp("mq=", opt, 3) == 0) {
+				if (dm_strtoi(opt + 3, &opt, 10, &net->npairs) ||
+				    *opt != '\0' || net->npairs < 1 ||
+				    net->npairs > VIRTIO_NET_MAX_PAIRS) {
+					WPRINTF(("virtio_net: mq should be in "
+						"[1, %d]\n", VIRTIO_NET_MAX_PAIRS));
+					free(devname);
+					free(net);
+					return -1;
+				}
+			} else {
 				err = virtio_net_parsemac(opt,
 					net->config.mac);
 				if (err != 0) {
@@ -810,37 +1596,95 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		}
 	}
 
-	virtio_linkup(&net->base, &virtio_net_ops, net, dev, net->queues,
+	if (devname && net->use_vhost && virtio_net_is_netmap(devname)) {
+		WPRINTF(("virtio_net: no vhost with netmap\n"));
+		net->use_vhost = false;
+	}
+
+	/* all the queues of a vhost-user port are on one socket */
+	if (devname && virtio_net_is_vhost_user(devname)) {
+		if (net->npairs > 1) {
+			WPRINTF(("virtio_net: vhost-user has one queue pair\n"));
+			net->npairs = 1;
+		}
+		net->use_vhost = true;
+	}
+
+	/*
+	 * The queue pairs and the control queue, if more than one pair is
+	 * offered. The rx/tx queues have no per-queue notify, qnotify finds
+	 * the pair.
+	 */
+	net->ops = virtio_net_ops;
+	net->ops.nvq = 2 * net->npairs + (net->npairs > 1);
+	virtio_linkup(&net->base, &net->ops, net, dev, net->queues,
 		      net->use_vhost ? BACKEND_VHOST : BACKEND_VBSU);
 	net->base.mtx = &net->mtx;
 	net->base.device_caps = VIRTIO_NET_S_HOSTCAPS;
-
-	net->queues[VIRTIO_NET_RXQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_RXQ].notify = virtio_net_ping_rxq;
-	net->queues[VIRTIO_NET_TXQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_TXQ].notify = virtio_net_ping_txq;
-#ifdef notyet
-	net->queues[VIRTIO_NET_CTLQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_CTLQ].notify = virtio_net_ping_ctlq;
-#endif
+	if (net->npairs > 1)
+		net->base.device_caps |= VIRTIO_NET_F_MQ | VIRTIO_NET_F_CTRL_VQ |
+			VIRTIO_NET_F_NOTF_COAL;
+
+	for (i = 0; i < net->ops.nvq; i++)
+		net->queues[i].qsize = VIRTIO_NET_RINGSZ;
+
+	net->refs = 1;
+	for (i = 0; i < net->npairs; i++) {
+		qp = &net->qps[i];
+		qp->net = net;
+		qp->idx = i;
+		qp->tapfd = -1;
+		pthread_mutex_init(&qp->rx_mtx, NULL);
+		pthread_mutex_init(&qp->tx_mtx, NULL);
+		pthread_cond_init(&qp->tx_cond, NULL);
+	}
 
 	/*
 	 * Attempt to open the tap device
 	 */
-	net->tapfd = -1;
-
 	if (!devname) {
 		WPRINTF(("virtio_net: devname NULL\n"));
 		free(net);
 		return -1;
 	}
 
+	/* the rx events get a thread of their own, vhost has none */
+	if (net->iothread && !net->use_vhost) {
+		snprintf(tname, sizeof(tname), "vtnet-%d:%d rx",
+			 dev->slot, dev->func);
+		net->evloop = mevent_loop_create(tname, net->iothread_cpu);
+		if (net->evloop == NULL)
+			WPRINTF(("virtio_net: rx events left to the main "
+				"loop\n"));
+	}
+
 	if (strncmp(devname, "tap", 3) == 0 ||
 	    strncmp(devname, "vmnet", 5) == 0)
 		virtio_net_tap_setup(net, devname);
+	else if (virtio_net_is_netmap(devname))
+		virtio_net_netmap_setup(net, devname);
+	else if (virtio_net_is_vhost_user(devname))
+		virtio_net_vhost_user_setup(net, devname);
 
 	free(devname);
 
+	/* fewer queues than asked for */
+	net->ops.nvq = 2 * net->npairs + (net->npairs > 1);
+	if (net->npairs == 1)
+		net->base.device_caps &=
+			~(VIRTIO_NET_F_MQ | VIRTIO_NET_F_CTRL_VQ |
+			  VIRTIO_NET_F_NOTF_COAL);
+	net->config.max_virtqueue_pairs = net->npairs;
+	virtio_net_set_pairs(net, 1);
+
+	/* the interrupts of vhost go around vq_endchains() */
+	if (net->coal_usecs && !net->use_vhost) {
+		virtio_net_set_coalesce(net, VIRTIO_NET_RXQ, net->coal_frames,
+					net->coal_usecs);
+		virtio_net_set_coalesce(net, VIRTIO_NET_TXQ, net->coal_frames,
+					net->coal_usecs);
+	}
+
 	/*
 	 * The default MAC address is the standard NetApp OUI of 00-a0-98,
 	 * followed by an MD5 of the PCI slot/func number and dev name
@@ -869,7 +1713,8 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	pci_set_cfgdata16(dev, PCIR_SUBVEND_0, VIRTIO_VENDOR);
 
 	/* Link is up if we managed to open tap device */
-	net->config.status = (opts == NULL || net->tapfd >= 0);
+	net->config.status = (opts == NULL || net->qps[0].tapfd >= 0 ||
+		net->qps[0].nmd != NULL || net->qps[0].vhost_net != NULL);
 
 	/* use BAR 1 to map MSI-X table and PBA, if we're using MSI-X */
 	if (virtio_interrupt_init(&net->base, virtio_uses_msix())) {
@@ -886,22 +1731,29 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 	net->rx_merge = 1;
 	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
-	net->rx_in_progress = 0;
-	pthread_mutex_init(&net->rx_mtx, NULL);
 
 	/*
-	 * Initialize tx semaphore & spawn TX processing thread.
-	 * As of now, only one thread for TX desc processing is
-	 * spawned.
+	 * Spawn one TX processing thread per queue pair.
 	 */
-	net->tx_in_progress = 0;
-	pthread_mutex_init(&net->tx_mtx, NULL);
-	pthread_cond_init(&net->tx_cond, NULL);
-	pthread_create(&net->tx_tid, NULL, virtio_net_tx_thread,
-		       (void *)net);
-	snprintf(tname, sizeof(tname), "vtnet-%d:%d tx", dev->slot,
-		 dev->func);
-	pthread_setname_np(net->tx_tid, tname);
+	for (i = 0; i < net->npairs; i++) {
+		qp = &net->qps[i];
+		pthread_create(&qp->tx_tid, NULL, virtio_net_tx_thread,
+			       (void *)qp);
+		if (net->npairs > 1)
+			snprintf(tname, sizeof(tname), "vtnet-%d:%d tx%d",
+				 dev->slot, dev->func, (uint8_t)i);
+		else
+			snprintf(tname, sizeof(tname), "vtnet-%d:%d tx",
+				 dev->slot, dev->func);
+		pthread_setname_np(qp->tx_tid, tname);
+	}
+
+	if (register_vm_monitor_netpoll == false) {
+		register_vm_monitor_netpoll = true;
+		if (monitor_register_vm_ops(&virtio_net_monitor_ops, ctx,
+					    "virtio_net_netpoll") < 0)
+			fprintf(stderr, "netpoll registration to VM monitor failed\n");
+	}
 
 	return 0;
 }
@@ -953,74 +1805,117 @@ virtio_net_neg_features(void *vdev, uint64_t negotiated_features)
 		/* non-merge rx header is 2 bytes shorter */
 		net->rx_vhdrlen -= 2;
 	}
+	virtio_net_tap_set_offload(net);
 }
 
+/*
+ * Start the vhost of the pairs the guest may use, without VIRTIO_NET_F_MQ
+ * the queues after the first pair may be the control queue.
+ */
 static void
 virtio_net_set_status(void *vdev, uint64_t status)
 {
 	struct virtio_net *net = vdev;
-	int rc;
-
-	if (!net->vhost_net)
-		return;
-
-	if (!net->vhost_net->vhost_started &&
-		(status & VIRTIO_CONFIG_S_DRIVER_OK)) {
-		if (net->mevp)
-			mevent_disable(net->mevp);
-
-		rc = vhost_net_start(net->vhost_net);
-		if (rc < 0) {
-			WPRINTF(("vhost_net_start failed\n"));
-			return;
+	struct virtio_net_qp *qp;
+	int i, npairs, rc;
+
+	npairs = (net->features & VIRTIO_NET_F_MQ) ? net->npairs : 1;
+	for (i = 0; i < net->npairs; i++) {
+		qp = &net->qps[i];
+		if (!qp->vhost_net)
+			continue;
+
+		if (!qp->vhost_net->vhost_started && i < npairs &&
+			(status & VIRTIO_CONFIG_S_DRIVER_OK)) {
+			if (qp->mevp)
+				mevent_disable(qp->mevp);
+
+			rc = vhost_net_start(qp->vhost_net);
+			if (rc < 0) {
+				WPRINTF(("vhost_net_start failed\n"));
+				return;
+			}
+		} else if (qp->vhost_net->vhost_started &&
+			((status & VIRTIO_CONFIG_S_DRIVER_OK) == 0)) {
+			rc = vhost_net_stop(qp->vhost_net);
+			if (rc < 0)
+				WPRINTF(("vhost_net_stop failed\n"));
 		}
-	} else if (net->vhost_net->vhost_started &&
-		((status & VIRTIO_CONFIG_S_DRIVER_OK) == 0)) {
-		rc = vhost_net_stop(net->vhost_net);
-		if (rc < 0)
-			WPRINTF(("vhost_net_stop failed\n"));
 	}
 }
 
+/*
+ * Drop a reference to the device, held by virtio_net_init() and by each
+ * rx event until its teardown.
+ */
+static void
+virtio_net_put(struct virtio_net *net)
+{
+	if (atomic_sub_fetch(&net->refs, 1) == 0)
+		free(net);
+}
+
 static void
 virtio_net_teardown(void *param)
 {
-	struct virtio_net *net;
+	struct virtio_net_qp *qp;
 
-	net = (struct virtio_net *)param;
-	if (!net)
+	qp = (struct virtio_net_qp *)param;
+	if (!qp)
 		return;
 
-	if (net->tapfd >= 0) {
-		close(net->tapfd);
-		net->tapfd = -1;
+	if (qp->nmd != NULL) {
+		nm_close(qp->nmd);
+		qp->nmd = NULL;
+	} else if (qp->tapfd >= 0) {
+		close(qp->tapfd);
+		qp->tapfd = -1;
 	} else
-		fprintf(stderr, "net->tapfd is -1!\n");
+		fprintf(stderr, "qp->tapfd is -1!\n");
 
-	free(net);
+	virtio_net_put(qp->net);
 }
 
 static void
 virtio_net_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
 	struct virtio_net *net;
+	struct virtio_net_qp *qp;
+	int i;
 
 	if (dev->arg) {
 		net = (struct virtio_net *) dev->arg;
 
-		virtio_net_tx_stop(net);
+		for (i = 0; i < net->npairs; i++)
+			virtio_net_tx_stop(&net->qps[i]);
+
+		for (i = 0; i < 2 * net->npairs; i++)
+			vq_coalesce_deinit(&net->queues[i]);
+
+		for (i = 0; i < net->npairs; i++) {
+			qp = &net->qps[i];
+			if (qp->vhost_net) {
+				vhost_net_stop(qp->vhost_net);
+				vhost_net_deinit(qp->vhost_net);
+				free(qp->vhost_net);
+				qp->vhost_net = NULL;
+			}
 
-		if (net->vhost_net) {
-			vhost_net_stop(net->vhost_net);
-			vhost_net_deinit(net->vhost_net);
-			free(net->vhost_net);
-			net->vhost_net = NULL;
+			if (qp->mevp != NULL)
+				mevent_delete(qp->mevp);
+			else if (qp->nmd != NULL) {
+				nm_close(qp->nmd);
+				qp->nmd = NULL;
+			} else if (qp->tapfd >= 0) {
+				close(qp->tapfd);
+				qp->tapfd = -1;
+			}
 		}
 
-		if (net->mevp != NULL)
-			mevent_delete(net->mevp);
-		else
-			virtio_net_teardown(net);
+		/* runs the teardown of the rx events just deleted */
+		mevent_loop_destroy(net->evloop);
+		net->evloop = NULL;
+		virtio_net_put(net);
 
 		DPRINTF(("%s: done\n", __func__));
 	} else
@@ -1061,6 +1956,35 @@ fail:
 	return NULL;
 }
 
+static struct vhost_net *
+vhost_net_user_init(struct virtio_base *base, const char *path)
+{
+	struct vhost_net *vhost_net;
+	uint64_t vhost_features = VIRTIO_NET_S_VHOSTCAPS |
+		VIRTIO_NET_S_OFFLOADCAPS;
+	int rc;
+
+	vhost_net = calloc(1, sizeof(struct vhost_net));
+	if (!vhost_net) {
+		WPRINTF(("vhost init out of memory\n"));
+		return NULL;
+	}
+
+	vhost_net->vdev.nvqs = ARRAY_SIZE(vhost_net->vqs);
+	vhost_net->vdev.vqs = vhost_net->vqs;
+	vhost_net->tapfd = -1;
+
+	rc = vhost_user_dev_init(&vhost_net->vdev, base, path, 0,
+		vhost_features, 0);
+	if (rc < 0) {
+		WPRINTF(("vhost_user_dev_init failed\n"));
+		free(vhost_net);
+		return NULL;
+	}
+
+	return vhost_net;
+}
+
 static int
 vhost_net_deinit(struct vhost_net *vhost_net)
 {
@@ -1128,6 +2052,7 @@ struct pci_vdev_ops pci_ops_virtio_net = {
 	.class_name	= "virtio-net",
 	.vdev_init	= virtio_net_init,
 	.vdev_deinit	= virtio_net_deinit,
+	.vdev_reset	= virtio_pci_reset,
 	.vdev_barwrite	= virtio_pci_write,
 	.vdev_barread	= virtio_pci_read
 };
@@ -27,8 +27,15 @@
 
 /*
  * virtio entropy device emulation.
+ *
+ * The chains are filled from a reserve of VIRTIO_RND_POOLSZ bytes, a batch
+ * of them per wakeup. The reserve is preloaded, and topped up with large
+ * non-blocking getrandom() calls while the guest asks for nothing. When
+ * the host has no entropy to give, the chains wait in the ring and the
+ * source is retried every VIRTIO_RND_RETRY_MS.
  */
 
+#include <sys/random.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -36,6 +43,7 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <errno.h>
+#include <time.h>
 
 #include "dm.h"
 #include "pci_core.h"
@@ -44,6 +52,10 @@
 #include "vmmapi.h"			/* for vmctx */
 
 #define VIRTIO_RND_RINGSZ	64
+#define VIRTIO_RND_POOLSZ	(64 * 1024)
+#define VIRTIO_RND_BATCH	16
+#define VIRTIO_RND_MAXSEGS	4
+#define VIRTIO_RND_RETRY_MS	10
 
 /*
  * Per-device struct
@@ -59,33 +71,17 @@ struct virtio_rnd {
 	pthread_t rx_tid;
 	pthread_mutex_t	rx_mtx;
 	pthread_cond_t rx_cond;
+	/* the reserve, pool_len bytes at the start of pool */
+	size_t pool_len;
+	uint8_t pool[VIRTIO_RND_POOLSZ];
 	/* VBS-K variables */
-	struct {
-		enum VBS_K_STATUS status;
-		int fd;
-		struct vbs_dev_info dev;
-		struct vbs_vqs_info vqs;
-	} vbs_k;
+	struct vbs_k_dev vbs_k;
 };
 
 static int virtio_rnd_debug;
 #define DPRINTF(params) do { if (virtio_rnd_debug) printf params; } while (0)
 #define WPRINTF(params) (printf params)
 
-/* VBS-K interface functions */
-static int virtio_rnd_kernel_init(struct virtio_rnd *);	/* open VBS-K chardev */
-static int virtio_rnd_kernel_start(struct virtio_rnd *);
-static int virtio_rnd_kernel_stop(struct virtio_rnd *);
-static int virtio_rnd_kernel_reset(struct virtio_rnd *);
-static int virtio_rnd_kernel_dev_set(struct vbs_dev_info *kdev,
-				     const char *name, int vmid, int nvq,
-				     uint32_t feature, uint64_t pio_start,
-				     uint64_t pio_len);
-static int virtio_rnd_kernel_vq_set(struct vbs_vqs_info *kvqs, unsigned int nvq,
-				    unsigned int idx, uint16_t qsize,
-				    uint32_t pfn, uint16_t msix_idx,
-				    uint64_t msix_addr, uint32_t msix_data);
-
 /* VBS-U virtio_ops */
 static void virtio_rnd_reset(void *);
 static void virtio_rnd_notify(void *, struct virtio_vq_info *);
@@ -130,171 +126,101 @@ virtio_rnd_k_no_notify(void *base, struct virtio_vq_info *vq)
 static void
 virtio_rnd_k_set_status(void *base, uint64_t status)
 {
-	struct virtio_rnd *rnd;
-	int nvq;
-	struct msix_table_entry *mte;
-	uint64_t msix_addr = 0;
-	uint32_t msix_data = 0;
-	int rc, i, j;
+	struct virtio_rnd *rnd = base;
 
-	rnd = base;
-	nvq = rnd->base.vops->nvq;
-
-	if (rnd->vbs_k.status == VIRTIO_DEV_INIT_SUCCESS &&
-	    (status & VIRTIO_CONFIG_S_DRIVER_OK)) {
-		/* time to kickoff VBS-K side */
-		/* init vdev first */
-		rc = virtio_rnd_kernel_dev_set(&rnd->vbs_k.dev,
-					       rnd->base.vops->name,
-					       rnd->base.dev->vmctx->vmid,
-					       nvq,
-					       rnd->base.negotiated_caps,
-					       /*
-						* currently we let VBS-K handle
-						* kick register
-						*/
-					       rnd->base.dev->bar[0].addr + 16,
-					       2);
-
-		for (i = 0; i < nvq; i++) {
-			if (rnd->vq.msix_idx != VIRTIO_MSI_NO_VECTOR) {
-				j = rnd->vq.msix_idx;
-				mte = &rnd->base.dev->msix.table[j];
-				msix_addr = mte->addr;
-				msix_data = mte->msg_data;
-			}
-			rc = virtio_rnd_kernel_vq_set(&rnd->vbs_k.vqs,
-						      nvq, i,
-						      rnd->vq.qsize,
-						      rnd->vq.pfn,
-						      rnd->vq.msix_idx,
-						      msix_addr,
-						      msix_data);
-			if (rc < 0) {
-				WPRINTF(("rnd_kernel_set_vq fail,i %d ret %d\n",
-					 i, rc));
-				return;
-			}
-		}
-		rc = virtio_rnd_kernel_start(rnd);
-		if (rc < 0) {
-			WPRINTF(("virtio_rnd_kernel_start() failed\n"));
-			rnd->vbs_k.status = VIRTIO_DEV_START_FAILED;
-		} else {
-			rnd->vbs_k.status = VIRTIO_DEV_STARTED;
-		}
-	}
+	vbs_kernel_set_status(&rnd->vbs_k, &rnd->base, status);
 }
 
-/*
- * Called in virtio_rnd_init(), where the initialization of the
- * PCIe device emulation is still on the way by device model.
- */
-static int
-virtio_rnd_kernel_init(struct virtio_rnd *rnd)
+static void
+virtio_rnd_reset(void *base)
 {
+	struct virtio_rnd *rnd;
 
-	rnd->vbs_k.fd = open("/dev/vbs_rng", O_RDWR);
-	if (rnd->vbs_k.fd < 0) {
-		WPRINTF(("Failed to open /dev/vbs_k_rng!\n"));
-		return -VIRTIO_ERROR_FD_OPEN_FAILED;
-	}
-	DPRINTF(("Open /dev/vbs_rng success!\n"));
-
-	memset(&rnd->vbs_k.dev, 0, sizeof(struct vbs_dev_info));
-	memset(&rnd->vbs_k.vqs, 0, sizeof(struct vbs_vqs_info));
-
-	return VIRTIO_SUCCESS;
-}
+	rnd = base;
 
-static int
-virtio_rnd_kernel_dev_set(struct vbs_dev_info *kdev, const char *name,
-			  int vmid, int nvq, uint32_t feature,
-			  uint64_t pio_start, uint64_t pio_len)
-{
-	/* FE driver has set VIRTIO_CONFIG_S_DRIVER_OK */
-
-	/* init kdev */
-	strncpy(kdev->name, name, VBS_NAME_LEN);
-	kdev->name[VBS_NAME_LEN - 1] = '\0';
-	kdev->vmid = vmid;
-	kdev->nvq = nvq;
-	kdev->negotiated_features = feature;
-	kdev->pio_range_start = pio_start;
-	kdev->pio_range_len = pio_len;
-
-	return VIRTIO_SUCCESS;
+	DPRINTF(("virtio_rnd: device reset requested !\n"));
+	virtio_reset_dev(&rnd->base);
+	DPRINTF(("virtio_rnd: kstatus %d\n", rnd->vbs_k.status));
+	vbs_kernel_dev_reset(&rnd->vbs_k);
 }
 
-static int
-virtio_rnd_kernel_vq_set(struct vbs_vqs_info *kvqs, unsigned int nvq,
-			 unsigned int idx, uint16_t qsize, uint32_t pfn,
-			 uint16_t msix_idx, uint64_t msix_addr,
-			 uint32_t msix_data)
+/* top up the reserve without blocking, /dev/random without getrandom() */
+static ssize_t
+virtio_rnd_refill(struct virtio_rnd *rnd)
 {
-	/* FE driver has set VIRTIO_CONFIG_S_DRIVER_OK */
-	if (nvq <= idx) {
-		WPRINTF(("%s: wrong idx!\n", __func__));
-		return -VIRTIO_ERROR_GENERAL;
-	}
-
-	/* init kvqs */
-	kvqs->nvq = nvq;
-	kvqs->vqs[idx].qsize = qsize;
-	kvqs->vqs[idx].pfn = pfn;
-	kvqs->vqs[idx].msix_idx = msix_idx;
-	kvqs->vqs[idx].msix_addr = msix_addr;
-	kvqs->vqs[idx].msix_data = msix_data;
-
-	return VIRTIO_SUCCESS;
-}
+	uint8_t *buf = rnd->pool + rnd->pool_len;
+	size_t room = VIRTIO_RND_POOLSZ - rnd->pool_len;
+	ssize_t len;
 
-static int
-virtio_rnd_kernel_start(struct virtio_rnd *rnd)
-{
-	if (vbs_kernel_start(rnd->vbs_k.fd,
-			     &rnd->vbs_k.dev,
-			     &rnd->vbs_k.vqs) < 0) {
-		WPRINTF(("Failed in vbs_k_start!\n"));
-		return -VIRTIO_ERROR_START;
-	}
+	do {
+		len = getrandom(buf, room, GRND_NONBLOCK);
+		if (len < 0 && errno == ENOSYS)
+			len = read(rnd->fd, buf, room);
+	} while (len < 0 && errno == EINTR);
 
-	DPRINTF(("vbs_k_started!\n"));
-	return VIRTIO_SUCCESS;
+	if (len > 0)
+		rnd->pool_len += len;
+	return len;
 }
 
-static int
-virtio_rnd_kernel_stop(struct virtio_rnd *rnd)
+/* returns the bytes copied, from the end of the reserve */
+static size_t
+virtio_rnd_take(struct virtio_rnd *rnd, void *buf, size_t len)
 {
-	/* device specific cleanups here */
-	return vbs_kernel_stop(rnd->vbs_k.fd);
+	if (len > rnd->pool_len)
+		len = rnd->pool_len;
+	rnd->pool_len -= len;
+	memcpy(buf, rnd->pool + rnd->pool_len, len);
+	return len;
 }
 
-static int
-virtio_rnd_kernel_reset(struct virtio_rnd *rnd)
+/* fill the chains of the ring, as long as there is entropy for them */
+static void
+virtio_rnd_fill_chains(struct virtio_rnd *rnd)
 {
-	memset(&rnd->vbs_k.dev, 0, sizeof(struct vbs_dev_info));
-	memset(&rnd->vbs_k.vqs, 0, sizeof(struct vbs_vqs_info));
+	struct virtio_vq_info *vq = &rnd->vq;
+	struct iovec iovs[VIRTIO_RND_BATCH][VIRTIO_RND_MAXSEGS];
+	struct vq_chain chains[VIRTIO_RND_BATCH];
+	int i, j, n, filled;
+	bool dry = false;
+
+	for (i = 0; i < VIRTIO_RND_BATCH; i++) {
+		chains[i].iov = iovs[i];
+		chains[i].flags = NULL;
+	}
 
-	return vbs_kernel_reset(rnd->vbs_k.fd);
-}
+	while (!dry && vq_has_descs(vq)) {
+		n = vq_getchains(vq, chains, VIRTIO_RND_BATCH,
+				 VIRTIO_RND_MAXSEGS);
+		if (n <= 0)
+			break;
 
-static void
-virtio_rnd_reset(void *base)
-{
-	struct virtio_rnd *rnd;
+		for (filled = 0; filled < n && chains[filled].n > 0; filled++) {
+			if (rnd->pool_len == 0 && virtio_rnd_refill(rnd) <= 0) {
+				dry = true;
+				break;
+			}
+			chains[filled].iolen = 0;
+			for (j = 0; j < chains[filled].n; j++)
+				chains[filled].iolen += virtio_rnd_take(rnd,
+					chains[filled].iov[j].iov_base,
+					chains[filled].iov[j].iov_len);
+		}
 
-	rnd = base;
+		/* the chains left wait for more entropy */
+		if (dry) {
+			for (i = n - 1; i >= filled; i--)
+				vq_retchain(vq);
+		}
+		vq_relchains(vq, chains, filled);
 
-	DPRINTF(("virtio_rnd: device reset requested !\n"));
-	virtio_reset_dev(&rnd->base);
-	DPRINTF(("virtio_rnd: kstatus %d\n", rnd->vbs_k.status));
-	if (rnd->vbs_k.status == VIRTIO_DEV_STARTED) {
-		DPRINTF(("virtio_rnd: VBS-K reset requested!\n"));
-		virtio_rnd_kernel_stop(rnd);
-		virtio_rnd_kernel_reset(rnd);
-		rnd->vbs_k.status = VIRTIO_DEV_INIT_SUCCESS;
+		/* a bad chain ends the batch, and is dropped */
+		if (filled < n && !dry)
+			break;
 	}
+
+	/* one interrupt for all the chains */
+	vq_endchains(vq, !dry);
 }
 
 static void *
@@ -302,11 +228,12 @@ virtio_rnd_get_entropy(void *param)
 {
 	struct virtio_rnd *rnd = param;
 	struct virtio_vq_info *vq = &rnd->vq;
-	struct iovec iov;
-	uint16_t idx;
-	ssize_t len;
+	struct timespec ts;
 
 	for (;;) {
+		if (rnd->pool_len < VIRTIO_RND_POOLSZ)
+			virtio_rnd_refill(rnd);
+
 		pthread_mutex_lock(&rnd->rx_mtx);
 		rnd->in_progress = 0;
 
@@ -314,33 +241,32 @@ virtio_rnd_get_entropy(void *param)
 		 * Checking the avail ring here serves two purposes:
 		 *  - avoid vring processing due to spurious wakeups
 		 *  - catch missing notifications before acquiring rx_mtx
+		 * Until the reserve is full, the source is retried in a while.
 		 */
-		while (!vq_has_descs(vq))
-			pthread_cond_wait(&rnd->rx_cond, &rnd->rx_mtx);
+		if (!vq_has_descs(vq) || rnd->pool_len == 0) {
+			if (rnd->pool_len == VIRTIO_RND_POOLSZ)
+				pthread_cond_wait(&rnd->rx_cond, &rnd->rx_mtx);
+			else {
+				clock_gettime(CLOCK_REALTIME, &ts);
+				ts.tv_nsec += VIRTIO_RND_RETRY_MS * 1000000L;
+				if (ts.tv_nsec >= 1000000000L) {
+					ts.tv_sec++;
+					ts.tv_nsec -= 1000000000L;
+				}
+				pthread_cond_timedwait(&rnd->rx_cond,
+					&rnd->rx_mtx, &ts);
+			}
+			pthread_mutex_unlock(&rnd->rx_mtx);
+			continue;
+		}
 
 		rnd->in_progress = 1;
 		pthread_mutex_unlock(&rnd->rx_mtx);
 
-		do {
-			vq_getchain(vq, &idx, &iov, 1, NULL);
-			len = read(rnd->fd, iov.iov_base, iov.iov_len);
-			if (len <= 0) {
-				vq_retchain(vq);
-				vq_endchains(vq, 0);
-
-				/* no data available */
-				if (len == -1 && errno == EAGAIN)
-					return NULL;
-				break;
-			}
-
-			/* release this chain and handle more */
-			vq_relchain(vq, idx, len);
-		} while (vq_has_descs(vq));
-
-		/* at least one avail ring element has been processed */
-		vq_endchains(vq, 1);
+		virtio_rnd_fill_chains(rnd);
 	}
+
+	return NULL;
 }
 
 static void
@@ -367,17 +293,12 @@ virtio_rnd_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	pthread_mutexattr_t attr;
 	int rc;
 	char *opt;
-	char *vbs_k_opt = NULL;
 	enum VBS_K_STATUS kstat = VIRTIO_DEV_INITIAL;
 	char tname[MAXCOMLEN + 1];
 
 	while ((opt = strsep(&opts, ",")) != NULL) {
-		/* vbs_k_opt should be kernel=on */
-		vbs_k_opt = strsep(&opt, "=");
-		DPRINTF(("vbs_k_opt is %s\n", vbs_k_opt));
-		if (opt != NULL) {
-			if (strncmp(opt, "on", 2) == 0)
-				kstat = VIRTIO_DEV_PRE_INIT;
+		if (vbs_kernel_opt(opt)) {
+			kstat = VIRTIO_DEV_PRE_INIT;
 			WPRINTF(("virtio_rnd: VBS-K initializing..."));
 		}
 	}
@@ -385,7 +306,7 @@ virtio_rnd_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	/*
 	 * Should always be able to open /dev/random.
 	 */
-	fd = open("/dev/random", O_RDONLY);
+	fd = open("/dev/random", O_RDONLY | O_NONBLOCK);
 	if (fd < 0) {
 		WPRINTF(("virtio_rnd: open failed: /dev/random \n"));
 		return -1;
@@ -422,14 +343,11 @@ virtio_rnd_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		DPRINTF(("%s: VBS-K option detected!\n", __func__));
 		virtio_linkup(&rnd->base, &virtio_rnd_ops_k,
 			      rnd, dev, &rnd->vq, BACKEND_VBSK);
-		rc = virtio_rnd_kernel_init(rnd);
-		if (rc < 0) {
+		rc = vbs_kernel_init(&rnd->vbs_k, "/dev/vbs_rng",
+				     &virtio_rnd_ops);
+		if (rc < 0)
 			WPRINTF(("virtio_rnd: VBS-K init failed,error %d!\n",
 				 rc));
-			rnd->vbs_k.status = VIRTIO_DEV_INIT_FAILED;
-		} else {
-			rnd->vbs_k.status = VIRTIO_DEV_INIT_SUCCESS;
-		}
 	}
 	if (rnd->vbs_k.status == VIRTIO_DEV_INITIAL ||
 	    rnd->vbs_k.status != VIRTIO_DEV_INIT_SUCCESS) {
@@ -443,6 +361,7 @@ virtio_rnd_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 	/* keep /dev/random opened while emulating */
 	rnd->fd = fd;
+	virtio_rnd_refill(rnd);
 
 	/* initialize config space */
 	pci_set_cfgdata16(dev, PCIR_DEVICE, VIRTIO_DEV_RANDOM);
@@ -471,10 +390,7 @@ virtio_rnd_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 fail:
 	close(fd);
 	if (rnd) {
-		if (rnd->vbs_k.status == VIRTIO_DEV_INIT_SUCCESS) {
-			/* VBS-K is in use */
-			close(rnd->vbs_k.fd);
-		}
+		vbs_kernel_deinit(&rnd->vbs_k);
 		free(rnd);
 	}
 	return -1;
@@ -495,16 +411,8 @@ virtio_rnd_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	pthread_cancel(rnd->rx_tid);
 	pthread_join(rnd->rx_tid, &jval);
 
-	if (rnd->vbs_k.status == VIRTIO_DEV_STARTED) {
-		DPRINTF(("%s: deinit virtio_rnd_k!\n", __func__));
-		virtio_rnd_kernel_stop(rnd);
-		virtio_rnd_kernel_reset(rnd);
-		rnd->vbs_k.status = VIRTIO_DEV_INITIAL;
-		if (rnd->vbs_k.fd >= 0) {
-			close(rnd->vbs_k.fd);
-			rnd->vbs_k.fd = -1;
-		}
-	}
+	DPRINTF(("%s: deinit virtio_rnd_k!\n", __func__));
+	vbs_kernel_deinit(&rnd->vbs_k);
 
 	if (rnd->fd >= 0) {
 		close(rnd->fd);
@@ -519,6 +427,7 @@ struct pci_vdev_ops pci_ops_virtio_rnd = {
 	.class_name	= "virtio-rnd",
 	.vdev_init	= virtio_rnd_init,
 	.vdev_deinit	= virtio_rnd_deinit,
+	.vdev_reset	= virtio_pci_reset,
 	.vdev_barwrite	= virtio_pci_write,
 	.vdev_barread	= virtio_pci_read
 };
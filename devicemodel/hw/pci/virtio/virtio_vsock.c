@@ -0,0 +1,1236 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * virtio vsock device emulation, AF_VSOCK stream sockets between the UOS
+ * and the SOS:
+ *
+ *   -s <slot>,virtio-vsock,cid=<cid>,vhost
+ *	vhost_vsock of the SOS is the device, the SOS end is an AF_VSOCK
+ *	socket to <cid>.
+ *
+ *   -s <slot>,virtio-vsock,cid=<cid>,uds=<path>
+ *	the DM is the device, the SOS ends are UNIX sockets:
+ *	- a UOS connect to port P of the host connects to <path>_P
+ *	- a SOS process connects to <path> and writes "CONNECT P\n", once
+ *	  the UOS listening on port P accepts, the DM answers "OK <port>\n"
+ *	  with the host port of the connection, and the stream follows
+ *
+ * The UOS sends no more than the credit the DM gives, VSOCK_BUF_ALLOC
+ * bytes not yet written to the UNIX socket, and the DM no more than the
+ * UOS has room for. The rings are served a batch at a time, with one
+ * interrupt per batch.
+ */
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include "dm.h"
+#include "pci_core.h"
+#include "virtio.h"
+#include "vhost.h"
+#include "vmmapi.h"
+#include "dm_string.h"
+
+#define VIRTIO_VSOCK_RINGSZ	256
+#define VIRTIO_VSOCK_RXQ	0
+#define VIRTIO_VSOCK_TXQ	1
+#define VIRTIO_VSOCK_EVQ	2
+#define VIRTIO_VSOCK_MAXQ	3
+
+#define VSOCK_HOST_CID		2
+#define VSOCK_BUF_ALLOC		(256 * 1024)
+#define VSOCK_MAX_CONNS		256
+#define VSOCK_MAX_IOV		16
+#define VSOCK_TX_BATCH		32
+#define VSOCK_RX_BATCH		8	/* packets of a connection at once */
+#define VSOCK_MAX_RSTS		32
+#define VSOCK_FIRST_HOST_PORT	(1U << 30)
+
+#define VIRTIO_VSOCK_S_HOSTCAPS	\
+	((1UL << VIRTIO_F_VERSION_1) | (1 << VIRTIO_RING_F_INDIRECT_DESC))
+
+#define VIRTIO_VSOCK_S_VHOSTCAPS	\
+	((1UL << VIRTIO_F_VERSION_1) | (1 << VIRTIO_RING_F_INDIRECT_DESC) | \
+	(1 << VIRTIO_RING_F_EVENT_IDX))
+
+struct virtio_vsock_hdr {
+	uint64_t	src_cid;
+	uint64_t	dst_cid;
+	uint32_t	src_port;
+	uint32_t	dst_port;
+	uint32_t	len;
+	uint16_t	type;
+	uint16_t	op;
+	uint32_t	flags;
+	uint32_t	buf_alloc;
+	uint32_t	fwd_cnt;
+} __attribute__((packed));
+
+#define VSOCK_TYPE_STREAM	1
+
+enum vsock_op {
+	VSOCK_OP_INVALID,
+	VSOCK_OP_REQUEST,
+	VSOCK_OP_RESPONSE,
+	VSOCK_OP_RST,
+	VSOCK_OP_SHUTDOWN,
+	VSOCK_OP_RW,
+	VSOCK_OP_CREDIT_UPDATE,
+	VSOCK_OP_CREDIT_REQUEST,
+};
+
+#define VSOCK_SHUTDOWN_RCV	1
+#define VSOCK_SHUTDOWN_SEND	2
+
+struct virtio_vsock_config {
+	uint64_t	guest_cid;
+} __attribute__((packed));
+
+enum vsock_conn_state {
+	VSOCK_HANDSHAKE,	/* SOS end connected, its CONNECT to come */
+	VSOCK_CONNECTING,	/* REQUEST to the UOS, its RESPONSE to come */
+	VSOCK_ESTABLISHED,
+	VSOCK_CLOSING,		/* closed once the RST is sent */
+};
+
+/* the control packets a connection has to send to the UOS */
+#define VSOCK_PEND_REQUEST	(1U << 0)
+#define VSOCK_PEND_RESPONSE	(1U << 1)
+#define VSOCK_PEND_CREDIT	(1U << 2)
+#define VSOCK_PEND_SHUTDOWN	(1U << 3)
+#define VSOCK_PEND_RST		(1U << 4)
+
+struct vsock_conn {
+	int		fd;
+	enum vsock_conn_state state;
+	uint32_t	host_port;
+	uint32_t	guest_port;
+	uint32_t	pending;
+
+	/* credit of the UOS end */
+	uint32_t	peer_buf_alloc;
+	uint32_t	peer_fwd_cnt;
+	uint32_t	rx_cnt;		/* bytes sent to the UOS */
+
+	/* the bytes of the UOS not written to fd yet, a ring */
+	uint8_t		*buf;
+	uint32_t	buf_head;
+	uint32_t	buf_len;
+	uint32_t	fwd_cnt;	/* bytes of the UOS written to fd */
+	uint32_t	fwd_cnt_sent;	/* the fwd_cnt the UOS knows of */
+
+	bool		guest_shut;	/* no more data from the UOS */
+	bool		host_eof;	/* no more data from fd */
+	char		line[32];	/* the CONNECT line */
+	int		line_len;
+};
+
+/* an RST to a packet of no connection */
+struct vsock_rst {
+	uint32_t	host_port;
+	uint32_t	guest_port;
+};
+
+struct virtio_vsock {
+	struct virtio_base base;
+	struct virtio_vq_info queues[VIRTIO_VSOCK_MAXQ];
+	pthread_mutex_t mtx;
+	struct virtio_vsock_config config;
+
+	/* vhost backend */
+	bool		use_vhost;
+	struct vhost_dev vdev;
+	struct vhost_vq	vhost_vqs[2];	/* rx and tx */
+	bool		vhost_started;
+
+	/* DM backend */
+	char		*path;
+	int		listen_fd;
+	int		kick_fd;
+	pthread_t	tid;
+	bool		closing;
+	struct vsock_conn *conns[VSOCK_MAX_CONNS];
+	struct vsock_rst rsts[VSOCK_MAX_RSTS];
+	int		nrsts;
+	uint32_t	next_host_port;
+};
+
+static int virtio_vsock_debug;
+#define DPRINTF(params) do { if (virtio_vsock_debug) printf params; } while (0)
+#define WPRINTF(params) (printf params)
+
+static void virtio_vsock_reset(void *);
+static void virtio_vsock_notify(void *, struct virtio_vq_info *);
+static int virtio_vsock_cfgread(void *, int, int, uint32_t *);
+static void virtio_vsock_set_status(void *, uint64_t);
+
+static struct virtio_ops virtio_vsock_ops = {
+	"vtvsock",				/* our name */
+	VIRTIO_VSOCK_MAXQ,			/* we support 3 virtqueues */
+	sizeof(struct virtio_vsock_config),	/* config reg size */
+	virtio_vsock_reset,			/* reset */
+	virtio_vsock_notify,			/* device-wide qnotify */
+	virtio_vsock_cfgread,			/* read virtio config */
+	NULL,					/* write virtio config */
+	NULL,					/* apply negotiated features */
+	virtio_vsock_set_status,		/* called on guest set status */
+};
+
+static size_t
+iov_copy_out(const struct iovec *iov, int n, size_t off, void *dst, size_t len)
+{
+	size_t done = 0, chunk;
+	int i;
+
+	for (i = 0; i < n && done < len; i++) {
+		if (off >= iov[i].iov_len) {
+			off -= iov[i].iov_len;
+			continue;
+		}
+		chunk = iov[i].iov_len - off;
+		if (chunk > len - done)
+			chunk = len - done;
+		memcpy((uint8_t *)dst + done, (uint8_t *)iov[i].iov_base + off,
+			chunk);
+		done += chunk;
+		off = 0;
+	}
+
+	return done;
+}
+
+static size_t
+iov_copy_in(const struct iovec *iov, int n, const void *src, size_t len)
+{
+	size_t done = 0, chunk;
+	int i;
+
+	for (i = 0; i < n && done < len; i++) {
+		chunk = iov[i].iov_len;
+		if (chunk > len - done)
+			chunk = len - done;
+		memcpy(iov[i].iov_base, (const uint8_t *)src + done, chunk);
+		done += chunk;
+	}
+
+	return done;
+}
+
+/* iov[] past its first off bytes and up to len, into out[], count of out */
+static int
+iov_slice(const struct iovec *iov, int n, size_t off, size_t len,
+	  struct iovec *out)
+{
+	int i, nout = 0;
+
+	for (i = 0; i < n && len > 0; i++) {
+		if (off >= iov[i].iov_len) {
+			off -= iov[i].iov_len;
+			continue;
+		}
+		out[nout].iov_base = (uint8_t *)iov[i].iov_base + off;
+		out[nout].iov_len = iov[i].iov_len - off;
+		if (out[nout].iov_len > len)
+			out[nout].iov_len = len;
+		len -= out[nout].iov_len;
+		nout++;
+		off = 0;
+	}
+
+	return nout;
+}
+
+static size_t
+iov_size(const struct iovec *iov, int n)
+{
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < n; i++)
+		len += iov[i].iov_len;
+
+	return len;
+}
+
+/* what the UOS end has room for */
+static uint32_t
+vsock_peer_credit(struct vsock_conn *c)
+{
+	uint32_t used = c->rx_cnt - c->peer_fwd_cnt;
+
+	return (used < c->peer_buf_alloc) ? c->peer_buf_alloc - used : 0;
+}
+
+static struct vsock_conn *
+vsock_find_conn(struct virtio_vsock *vsock, uint32_t host_port,
+		uint32_t guest_port)
+{
+	struct vsock_conn *c;
+	int i;
+
+	for (i = 0; i < VSOCK_MAX_CONNS; i++) {
+		c = vsock->conns[i];
+		if (c && c->host_port == host_port && c->guest_port == guest_port)
+			return c;
+	}
+
+	return NULL;
+}
+
+static struct vsock_conn *
+vsock_new_conn(struct virtio_vsock *vsock, int fd)
+{
+	struct vsock_conn *c;
+	int i;
+
+	for (i = 0; i < VSOCK_MAX_CONNS; i++)
+		if (vsock->conns[i] == NULL)
+			break;
+	if (i == VSOCK_MAX_CONNS) {
+		WPRINTF(("vtvsock: at most %d connections\n", VSOCK_MAX_CONNS));
+		return NULL;
+	}
+
+	c = calloc(1, sizeof(*c));
+	if (c == NULL)
+		return NULL;
+	c->buf = malloc(VSOCK_BUF_ALLOC);
+	if (c->buf == NULL) {
+		free(c);
+		return NULL;
+	}
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	c->fd = fd;
+	vsock->conns[i] = c;
+	return c;
+}
+
+static void
+vsock_free_conn(struct virtio_vsock *vsock, struct vsock_conn *c)
+{
+	int i;
+
+	for (i = 0; i < VSOCK_MAX_CONNS; i++)
+		if (vsock->conns[i] == c)
+			vsock->conns[i] = NULL;
+
+	DPRINTF(("vtvsock: close %u <-> %u\n", c->host_port, c->guest_port));
+	close(c->fd);
+	free(c->buf);
+	free(c);
+}
+
+static void
+vsock_queue_rst(struct virtio_vsock *vsock, uint32_t host_port,
+		uint32_t guest_port)
+{
+	if (vsock->nrsts == VSOCK_MAX_RSTS)
+		return;
+
+	vsock->rsts[vsock->nrsts].host_port = host_port;
+	vsock->rsts[vsock->nrsts].guest_port = guest_port;
+	vsock->nrsts++;
+}
+
+static void
+vsock_fill_hdr(struct virtio_vsock *vsock, struct virtio_vsock_hdr *hdr,
+	       uint32_t host_port, uint32_t guest_port, uint16_t op)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->src_cid = VSOCK_HOST_CID;
+	hdr->dst_cid = vsock->config.guest_cid;
+	hdr->src_port = host_port;
+	hdr->dst_port = guest_port;
+	hdr->type = VSOCK_TYPE_STREAM;
+	hdr->op = op;
+	hdr->buf_alloc = VSOCK_BUF_ALLOC;
+}
+
+/* A packet without data to the UOS, -1 if the rx ring is full */
+static int
+vsock_send_ctrl(struct virtio_vsock *vsock, struct vsock_conn *c,
+		uint32_t host_port, uint32_t guest_port, uint16_t op,
+		uint32_t flags)
+{
+	struct virtio_vq_info *vq = &vsock->queues[VIRTIO_VSOCK_RXQ];
+	struct virtio_vsock_hdr hdr;
+	struct iovec iov[VSOCK_MAX_IOV];
+	uint16_t idx;
+	int n;
+
+	if (!vq_has_descs(vq))
+		return -1;
+	n = vq_getchain(vq, &idx, iov, VSOCK_MAX_IOV, NULL);
+	if (n < 1)
+		return -1;
+	if (iov_size(iov, n) < sizeof(hdr)) {
+		vq_relchain(vq, idx, 0);
+		return 0;
+	}
+
+	vsock_fill_hdr(vsock, &hdr, host_port, guest_port, op);
+	hdr.flags = flags;
+	if (c) {
+		hdr.fwd_cnt = c->fwd_cnt;
+		c->fwd_cnt_sent = c->fwd_cnt;
+	}
+	iov_copy_in(iov, n, &hdr, sizeof(hdr));
+	vq_relchain(vq, idx, sizeof(hdr));
+	return 0;
+}
+
+/* The control packets to send, returns false if the rx ring is full */
+static bool
+vsock_send_pending(struct virtio_vsock *vsock)
+{
+	struct vsock_conn *c;
+	int i, sent = 0;
+	bool room = true;
+
+	while (vsock->nrsts > 0) {
+		if (vsock_send_ctrl(vsock, NULL, vsock->rsts[0].host_port,
+				vsock->rsts[0].guest_port, VSOCK_OP_RST, 0) < 0) {
+			room = false;
+			goto out;
+		}
+		vsock->nrsts--;
+		memmove(&vsock->rsts[0], &vsock->rsts[1],
+			vsock->nrsts * sizeof(vsock->rsts[0]));
+		sent++;
+	}
+
+	for (i = 0; i < VSOCK_MAX_CONNS; i++) {
+		c = vsock->conns[i];
+		if (c == NULL || c->pending == 0)
+			continue;
+
+		if (c->pending & VSOCK_PEND_RST) {
+			if (vsock_send_ctrl(vsock, c, c->host_port,
+					c->guest_port, VSOCK_OP_RST, 0) < 0) {
+				room = false;
+				break;
+			}
+			sent++;
+			vsock_free_conn(vsock, c);
+			continue;
+		}
+
+		if (c->pending & VSOCK_PEND_REQUEST) {
+			if (vsock_send_ctrl(vsock, c, c->host_port,
+					c->guest_port, VSOCK_OP_REQUEST, 0) < 0) {
+				room = false;
+				break;
+			}
+			c->pending &= ~VSOCK_PEND_REQUEST;
+			sent++;
+		}
+		if (c->pending & VSOCK_PEND_RESPONSE) {
+			if (vsock_send_ctrl(vsock, c, c->host_port,
+					c->guest_port, VSOCK_OP_RESPONSE, 0) < 0) {
+				room = false;
+				break;
+			}
+			c->pending &= ~VSOCK_PEND_RESPONSE;
+			sent++;
+		}
+		if (c->pending & VSOCK_PEND_CREDIT) {
+			if (vsock_send_ctrl(vsock, c, c->host_port,
+					c->guest_port, VSOCK_OP_CREDIT_UPDATE,
+					0) < 0) {
+				room = false;
+				break;
+			}
+			c->pending &= ~VSOCK_PEND_CREDIT;
+			sent++;
+		}
+		if (c->pending & VSOCK_PEND_SHUTDOWN) {
+			if (vsock_send_ctrl(vsock, c, c->host_port,
+					c->guest_port, VSOCK_OP_SHUTDOWN,
+					VSOCK_SHUTDOWN_RCV |
+					VSOCK_SHUTDOWN_SEND) < 0) {
+				room = false;
+				break;
+			}
+			c->pending &= ~VSOCK_PEND_SHUTDOWN;
+			sent++;
+		}
+	}
+
+out:
+	if (sent)
+		vq_endchains(&vsock->queues[VIRTIO_VSOCK_RXQ], 0);
+	return room;
+}
+
+/* Write what the UOS sent to the SOS end, as much as it takes */
+static void
+vsock_flush(struct vsock_conn *c)
+{
+	struct msghdr msg = { 0 };
+	struct iovec iov[2];
+	ssize_t len;
+	uint32_t tail;
+
+	while (c->buf_len > 0) {
+		iov[0].iov_base = c->buf + c->buf_head;
+		tail = VSOCK_BUF_ALLOC - c->buf_head;
+		if (c->buf_len > tail) {
+			iov[0].iov_len = tail;
+			iov[1].iov_base = c->buf;
+			iov[1].iov_len = c->buf_len - tail;
+			msg.msg_iovlen = 2;
+		} else {
+			iov[0].iov_len = c->buf_len;
+			msg.msg_iovlen = 1;
+		}
+		msg.msg_iov = iov;
+
+		/* no SIGPIPE once the SOS end is gone */
+		len = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+		if (len <= 0) {
+			if (len < 0 && errno != EAGAIN && errno != EINTR) {
+				/* nobody reads any more */
+				c->pending |= VSOCK_PEND_RST;
+				c->state = VSOCK_CLOSING;
+			}
+			break;
+		}
+
+		c->buf_head = (c->buf_head + len) % VSOCK_BUF_ALLOC;
+		c->buf_len -= len;
+		c->fwd_cnt += len;
+	}
+
+	/* the UOS is told of its credit once half of it is back */
+	if (c->fwd_cnt - c->fwd_cnt_sent >= VSOCK_BUF_ALLOC / 2)
+		c->pending |= VSOCK_PEND_CREDIT;
+
+	if (c->buf_len == 0 && c->guest_shut)
+		shutdown(c->fd, SHUT_WR);
+}
+
+static void
+vsock_buffer(struct vsock_conn *c, const struct iovec *iov, int n, size_t off,
+	     uint32_t len)
+{
+	uint32_t tail, chunk;
+
+	if (len > VSOCK_BUF_ALLOC - c->buf_len) {
+		WPRINTF(("vtvsock: %u <-> %u over its credit\n",
+			c->host_port, c->guest_port));
+		c->pending |= VSOCK_PEND_RST;
+		c->state = VSOCK_CLOSING;
+		return;
+	}
+
+	tail = (c->buf_head + c->buf_len) % VSOCK_BUF_ALLOC;
+	chunk = VSOCK_BUF_ALLOC - tail;
+	if (chunk > len)
+		chunk = len;
+	iov_copy_out(iov, n, off, c->buf + tail, chunk);
+	if (len > chunk)
+		iov_copy_out(iov, n, off + chunk, c->buf, len - chunk);
+	c->buf_len += len;
+
+	vsock_flush(c);
+}
+
+/* A UOS connect to port of the host, it goes to <path>_<port> */
+static void
+vsock_connect(struct virtio_vsock *vsock, struct virtio_vsock_hdr *hdr)
+{
+	struct sockaddr_un addr;
+	struct vsock_conn *c;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (snprintf(addr.sun_path, sizeof(addr.sun_path), "%s_%u",
+			vsock->path, hdr->dst_port) >= sizeof(addr.sun_path))
+		goto rst;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		goto rst;
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		DPRINTF(("vtvsock: connect to %s failed, errno %d\n",
+			addr.sun_path, errno));
+		close(fd);
+		goto rst;
+	}
+
+	c = vsock_new_conn(vsock, fd);
+	if (c == NULL) {
+		close(fd);
+		goto rst;
+	}
+	c->host_port = hdr->dst_port;
+	c->guest_port = hdr->src_port;
+	c->state = VSOCK_ESTABLISHED;
+	c->pending = VSOCK_PEND_RESPONSE;
+	DPRINTF(("vtvsock: %s <-> %u\n", addr.sun_path, c->guest_port));
+	return;
+
+rst:
+	vsock_queue_rst(vsock, hdr->dst_port, hdr->src_port);
+}
+
+static void
+vsock_handle_tx(struct virtio_vsock *vsock, const struct iovec *iov, int n)
+{
+	struct virtio_vsock_hdr hdr;
+	struct vsock_conn *c;
+	char ok[32];
+	int len;
+
+	if (iov_copy_out(iov, n, 0, &hdr, sizeof(hdr)) < sizeof(hdr))
+		return;
+	if (hdr.src_cid != vsock->config.guest_cid ||
+	    hdr.dst_cid != VSOCK_HOST_CID)
+		return;
+	if (hdr.len > iov_size(iov, n) - sizeof(hdr))
+		hdr.len = iov_size(iov, n) - sizeof(hdr);
+
+	c = vsock_find_conn(vsock, hdr.dst_port, hdr.src_port);
+	if (hdr.type != VSOCK_TYPE_STREAM) {
+		if (hdr.op != VSOCK_OP_RST)
+			vsock_queue_rst(vsock, hdr.dst_port, hdr.src_port);
+		return;
+	}
+	if (c == NULL) {
+		if (hdr.op == VSOCK_OP_REQUEST)
+			vsock_connect(vsock, &hdr);
+		else if (hdr.op != VSOCK_OP_RST)
+			vsock_queue_rst(vsock, hdr.dst_port, hdr.src_port);
+		if ((c = vsock_find_conn(vsock, hdr.dst_port,
+				hdr.src_port)) == NULL)
+			return;
+	}
+
+	c->peer_buf_alloc = hdr.buf_alloc;
+	c->peer_fwd_cnt = hdr.fwd_cnt;
+
+	switch (hdr.op) {
+	case VSOCK_OP_REQUEST:
+		break;
+	case VSOCK_OP_RESPONSE:
+		if (c->state != VSOCK_CONNECTING) {
+			c->pending |= VSOCK_PEND_RST;
+			c->state = VSOCK_CLOSING;
+			break;
+		}
+		len = snprintf(ok, sizeof(ok), "OK %u\n", c->host_port);
+		if (send(c->fd, ok, len, MSG_NOSIGNAL) != len) {
+			c->pending |= VSOCK_PEND_RST;
+			c->state = VSOCK_CLOSING;
+			break;
+		}
+		c->state = VSOCK_ESTABLISHED;
+		break;
+	case VSOCK_OP_RW:
+		if (c->state == VSOCK_ESTABLISHED && !c->guest_shut)
+			vsock_buffer(c, iov, n, sizeof(hdr), hdr.len);
+		break;
+	case VSOCK_OP_CREDIT_REQUEST:
+		c->pending |= VSOCK_PEND_CREDIT;
+		break;
+	case VSOCK_OP_SHUTDOWN:
+		if (hdr.flags & VSOCK_SHUTDOWN_SEND) {
+			c->guest_shut = true;
+			if (c->buf_len == 0)
+				shutdown(c->fd, SHUT_WR);
+		}
+		/* closed by the UOS, it waits for the RST */
+		if ((hdr.flags & (VSOCK_SHUTDOWN_RCV | VSOCK_SHUTDOWN_SEND)) ==
+				(VSOCK_SHUTDOWN_RCV | VSOCK_SHUTDOWN_SEND)) {
+			vsock_flush(c);
+			c->pending |= VSOCK_PEND_RST;
+			c->state = VSOCK_CLOSING;
+		}
+		break;
+	case VSOCK_OP_RST:
+		vsock_free_conn(vsock, c);
+		break;
+	default:
+		break;
+	}
+}
+
+/* The packets of the UOS, a batch of chains at a time */
+static void
+vsock_process_tx(struct virtio_vsock *vsock)
+{
+	struct virtio_vq_info *vq = &vsock->queues[VIRTIO_VSOCK_TXQ];
+	struct iovec iovs[VSOCK_TX_BATCH][VSOCK_MAX_IOV];
+	struct vq_chain chains[VSOCK_TX_BATCH];
+	int i, n, done = 0;
+
+	for (i = 0; i < VSOCK_TX_BATCH; i++) {
+		chains[i].iov = iovs[i];
+		chains[i].flags = NULL;
+	}
+
+	while (vq_has_descs(vq)) {
+		n = vq_getchains(vq, chains, VSOCK_TX_BATCH, VSOCK_MAX_IOV);
+		if (n <= 0)
+			break;
+
+		for (i = 0; i < n; i++) {
+			if (chains[i].n > 0)
+				vsock_handle_tx(vsock, chains[i].iov,
+					chains[i].n);
+			chains[i].iolen = 0;
+		}
+		vq_relchains(vq, chains, n);
+		done += n;
+		if (chains[n - 1].n < 0)
+			break;
+	}
+
+	if (done)
+		vq_endchains(vq, 1);
+}
+
+/* What the SOS end wrote, as much as the UOS has room for */
+static void
+vsock_host_read(struct virtio_vsock *vsock, struct vsock_conn *c)
+{
+	struct virtio_vq_info *vq = &vsock->queues[VIRTIO_VSOCK_RXQ];
+	struct iovec iov[VSOCK_MAX_IOV], data[VSOCK_MAX_IOV];
+	struct virtio_vsock_hdr hdr;
+	uint32_t credit;
+	size_t room;
+	ssize_t len;
+	uint16_t idx;
+	int i, n, sent = 0;
+
+	for (i = 0; i < VSOCK_RX_BATCH; i++) {
+		credit = vsock_peer_credit(c);
+		if (credit == 0 || c->host_eof || !vq_has_descs(vq))
+			break;
+
+		n = vq_getchain(vq, &idx, iov, VSOCK_MAX_IOV, NULL);
+		if (n < 1)
+			break;
+		room = iov_size(iov, n);
+		if (room <= sizeof(hdr)) {
+			vq_relchain(vq, idx, 0);
+			sent++;
+			continue;
+		}
+		room -= sizeof(hdr);
+		if (room > credit)
+			room = credit;
+
+		len = readv(c->fd, data, iov_slice(iov, n, sizeof(hdr), room,
+				data));
+		if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+			vq_retchain(vq);
+			break;
+		}
+		if (len <= 0) {
+			vq_retchain(vq);
+			c->host_eof = true;
+			c->pending |= VSOCK_PEND_SHUTDOWN;
+			break;
+		}
+
+		vsock_fill_hdr(vsock, &hdr, c->host_port, c->guest_port,
+			VSOCK_OP_RW);
+		hdr.len = len;
+		hdr.fwd_cnt = c->fwd_cnt;
+		c->fwd_cnt_sent = c->fwd_cnt;
+		c->rx_cnt += len;
+		iov_copy_in(iov, n, &hdr, sizeof(hdr));
+		vq_relchain(vq, idx, sizeof(hdr) + len);
+		sent++;
+	}
+
+	if (sent)
+		vq_endchains(vq, 0);
+}
+
+/* A host port of no connection, for one the SOS end opened */
+static uint32_t
+vsock_alloc_port(struct virtio_vsock *vsock)
+{
+	uint32_t port;
+	int i;
+
+	for (;;) {
+		port = vsock->next_host_port++;
+		if (vsock->next_host_port == ~0U)
+			vsock->next_host_port = VSOCK_FIRST_HOST_PORT;
+
+		for (i = 0; i < VSOCK_MAX_CONNS; i++)
+			if (vsock->conns[i] && vsock->conns[i]->host_port == port)
+				break;
+		if (i == VSOCK_MAX_CONNS)
+			return port;
+	}
+}
+
+/* The "CONNECT <port>\n" of a SOS process, to the UOS then */
+static void
+vsock_handshake(struct virtio_vsock *vsock, struct vsock_conn *c)
+{
+	ssize_t len;
+	char *end;
+	int port;
+
+	len = read(c->fd, c->line + c->line_len,
+		sizeof(c->line) - 1 - c->line_len);
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (len <= 0) {
+		vsock_free_conn(vsock, c);
+		return;
+	}
+	c->line_len += len;
+	c->line[c->line_len] = '\0';
+
+	end = strchr(c->line, '\n');
+	if (end == NULL) {
+		if (c->line_len == sizeof(c->line) - 1)
+			vsock_free_conn(vsock, c);
+		return;
+	}
+	*end = '\0';
+
+	if (strncmp(c->line, "CONNECT ", 8) != 0 ||
+	    dm_strtoi(c->line + 8, NULL, 10, &port) != 0 || port < 0) {
+		WPRINTF(("vtvsock: bad handshake %s\n", c->line));
+		vsock_free_conn(vsock, c);
+		return;
+	}
+
+	c->guest_port = port;
+	c->host_port = vsock_alloc_port(vsock);
+	c->state = VSOCK_CONNECTING;
+	c->pending |= VSOCK_PEND_REQUEST;
+	DPRINTF(("vtvsock: %u -> %u\n", c->host_port, c->guest_port));
+}
+
+static void
+vsock_accept(struct virtio_vsock *vsock)
+{
+	struct vsock_conn *c;
+	int fd;
+
+	fd = accept4(vsock->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	c = vsock_new_conn(vsock, fd);
+	if (c == NULL) {
+		close(fd);
+		return;
+	}
+	c->state = VSOCK_HANDSHAKE;
+	c->guest_port = ~0U;
+	c->host_port = ~0U;
+}
+
+static void
+vsock_close_all(struct virtio_vsock *vsock)
+{
+	int i;
+
+	for (i = 0; i < VSOCK_MAX_CONNS; i++)
+		if (vsock->conns[i])
+			vsock_free_conn(vsock, vsock->conns[i]);
+	vsock->nrsts = 0;
+}
+
+static void *
+virtio_vsock_thread(void *param)
+{
+	struct virtio_vsock *vsock = param;
+	struct pollfd pfds[VSOCK_MAX_CONNS + 2];
+	int slot[VSOCK_MAX_CONNS + 2];
+	struct vsock_conn *c;
+	eventfd_t val;
+	bool rx_room;
+	int i, n;
+
+	for (;;) {
+		pthread_mutex_lock(&vsock->mtx);
+		if (vsock->closing) {
+			pthread_mutex_unlock(&vsock->mtx);
+			break;
+		}
+
+		rx_room = vsock_send_pending(vsock) &&
+			vq_has_descs(&vsock->queues[VIRTIO_VSOCK_RXQ]);
+		n = 0;
+		pfds[n].fd = vsock->kick_fd;
+		pfds[n++].events = POLLIN;
+		pfds[n].fd = vsock->listen_fd;
+		pfds[n++].events = POLLIN;
+		for (i = 0; i < VSOCK_MAX_CONNS; i++) {
+			c = vsock->conns[i];
+			if (c == NULL)
+				continue;
+			pfds[n].events = 0;
+			if (c->state == VSOCK_HANDSHAKE ||
+			    (c->state == VSOCK_ESTABLISHED && rx_room &&
+			     !c->host_eof && vsock_peer_credit(c) > 0))
+				pfds[n].events |= POLLIN;
+			if (c->buf_len > 0 && c->state != VSOCK_CLOSING)
+				pfds[n].events |= POLLOUT;
+			if (pfds[n].events == 0)
+				continue;
+			pfds[n].fd = c->fd;
+			slot[n++] = i;
+		}
+		pthread_mutex_unlock(&vsock->mtx);
+
+		if (poll(pfds, n, -1) < 0 && errno != EINTR) {
+			WPRINTF(("vtvsock: poll failed, errno %d\n", errno));
+			break;
+		}
+
+		pthread_mutex_lock(&vsock->mtx);
+		if (pfds[0].revents & POLLIN)
+			eventfd_read(vsock->kick_fd, &val);
+		if (pfds[1].revents & POLLIN)
+			vsock_accept(vsock);
+
+		for (i = 2; i < n; i++) {
+			c = vsock->conns[slot[i]];
+			/* closed meanwhile, or the fd has been reused */
+			if (c == NULL || c->fd != pfds[i].fd ||
+			    pfds[i].revents == 0)
+				continue;
+			if (pfds[i].revents & POLLOUT)
+				vsock_flush(c);
+			if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+				if (c->state == VSOCK_HANDSHAKE)
+					vsock_handshake(vsock, c);
+				else if (c->state == VSOCK_ESTABLISHED)
+					vsock_host_read(vsock, c);
+			}
+		}
+
+		vsock_process_tx(vsock);
+		pthread_mutex_unlock(&vsock->mtx);
+	}
+
+	return NULL;
+}
+
+static void
+virtio_vsock_kick(struct virtio_vsock *vsock)
+{
+	if (vsock->kick_fd >= 0)
+		eventfd_write(vsock->kick_fd, 1);
+}
+
+static void
+virtio_vsock_notify(void *vdev, struct virtio_vq_info *vq)
+{
+	struct virtio_vsock *vsock = vdev;
+
+	/* vhost serves rx and tx, the event vq holds its buffers */
+	if (!vsock->use_vhost && vq->num != VIRTIO_VSOCK_EVQ)
+		virtio_vsock_kick(vsock);
+}
+
+static int
+virtio_vsock_cfgread(void *vdev, int offset, int size, uint32_t *retval)
+{
+	struct virtio_vsock *vsock = vdev;
+
+	if (offset + size > sizeof(vsock->config))
+		return -1;
+
+	*retval = 0;
+	memcpy(retval, (uint8_t *)&vsock->config + offset, size);
+	return 0;
+}
+
+static int
+vhost_vsock_start(struct virtio_vsock *vsock)
+{
+	if (vsock->vhost_started)
+		return 0;
+
+	if (vhost_dev_start(&vsock->vdev) < 0) {
+		WPRINTF(("vtvsock: vhost_dev_start failed\n"));
+		return -1;
+	}
+	if (vhost_vsock_set_running(&vsock->vdev, 1) < 0) {
+		WPRINTF(("vtvsock: vhost_vsock_set_running failed\n"));
+		vhost_dev_stop(&vsock->vdev);
+		return -1;
+	}
+
+	vsock->vhost_started = true;
+	return 0;
+}
+
+static void
+vhost_vsock_stop(struct virtio_vsock *vsock)
+{
+	if (!vsock->vhost_started)
+		return;
+
+	vhost_vsock_set_running(&vsock->vdev, 0);
+	if (vhost_dev_stop(&vsock->vdev) < 0)
+		WPRINTF(("vtvsock: vhost_dev_stop failed\n"));
+	vsock->vhost_started = false;
+}
+
+static void
+virtio_vsock_set_status(void *vdev, uint64_t status)
+{
+	struct virtio_vsock *vsock = vdev;
+
+	if (!vsock->use_vhost)
+		return;
+
+	if (status & VIRTIO_CONFIG_S_DRIVER_OK)
+		vhost_vsock_start(vsock);
+	else
+		vhost_vsock_stop(vsock);
+}
+
+static void
+virtio_vsock_reset(void *vdev)
+{
+	struct virtio_vsock *vsock = vdev;
+
+	DPRINTF(("vtvsock: device reset requested!\n"));
+	if (vsock->use_vhost)
+		vhost_vsock_stop(vsock);
+	else {
+		vsock_close_all(vsock);
+		virtio_vsock_kick(vsock);
+	}
+	virtio_reset_dev(&vsock->base);
+}
+
+static int
+vsock_listen(struct virtio_vsock *vsock)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (snprintf(addr.sun_path, sizeof(addr.sun_path), "%s",
+			vsock->path) >= sizeof(addr.sun_path)) {
+		WPRINTF(("vtvsock: path %s too long\n", vsock->path));
+		return -1;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0)
+		return -1;
+	unlink(addr.sun_path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(fd, 16) < 0) {
+		WPRINTF(("vtvsock: listen on %s failed, errno %d\n",
+			addr.sun_path, errno));
+		close(fd);
+		return -1;
+	}
+
+	vsock->listen_fd = fd;
+	return 0;
+}
+
+static int
+vhost_vsock_init(struct virtio_vsock *vsock)
+{
+	int fd;
+
+	fd = open("/dev/vhost-vsock", O_RDWR);
+	if (fd < 0) {
+		WPRINTF(("vtvsock: open of vhost-vsock failed\n"));
+		return -1;
+	}
+
+	vsock->vdev.nvqs = ARRAY_SIZE(vsock->vhost_vqs);
+	vsock->vdev.vqs = vsock->vhost_vqs;
+	/* vhost_dev_deinit() closes fd on failure */
+	if (vhost_dev_init(&vsock->vdev, &vsock->base, fd, VIRTIO_VSOCK_RXQ,
+			VIRTIO_VSOCK_S_VHOSTCAPS, 0, 0) < 0) {
+		WPRINTF(("vtvsock: vhost_dev_init failed\n"));
+		return -1;
+	}
+
+	if (vhost_vsock_set_guest_cid(&vsock->vdev,
+			vsock->config.guest_cid) < 0) {
+		WPRINTF(("vtvsock: cid %lu in use\n", vsock->config.guest_cid));
+		vhost_dev_deinit(&vsock->vdev);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+virtio_vsock_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct virtio_vsock *vsock;
+	pthread_mutexattr_t attr;
+	char tname[MAXCOMLEN + 1];
+	char *opt;
+	long cid = 0;
+	int i;
+
+	vsock = calloc(1, sizeof(struct virtio_vsock));
+	if (!vsock) {
+		WPRINTF(("vtvsock: calloc returns NULL\n"));
+		return -1;
+	}
+	vsock->listen_fd = -1;
+	vsock->kick_fd = -1;
+	vsock->next_host_port = VSOCK_FIRST_HOST_PORT;
+
+	while ((opt = strsep(&opts, ",")) != NULL) {
+		if (!strncmp(opt, "cid=", 4)) {
+			if (dm_strtol(opt + 4, NULL, 10, &cid) != 0)
+				cid = 0;
+		} else if (!strcmp(opt, "vhost")) {
+			vsock->use_vhost = true;
+		} else if (!strncmp(opt, "uds=", 4)) {
+			free(vsock->path);
+			vsock->path = strdup(opt + 4);
+		} else
+			WPRINTF(("vtvsock: invalid option %s\n", opt));
+	}
+
+	/* 0 to 2 are the hypervisor, the local and the host ones */
+	if (cid <= VSOCK_HOST_CID || cid > UINT32_MAX) {
+		WPRINTF(("vtvsock: needs cid=<3 or above>\n"));
+		goto fail;
+	}
+	vsock->config.guest_cid = cid;
+	if (vsock->use_vhost == (vsock->path != NULL)) {
+		WPRINTF(("vtvsock: needs either vhost or uds=<path>\n"));
+		goto fail;
+	}
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&vsock->mtx, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	virtio_linkup(&vsock->base, &virtio_vsock_ops, vsock, dev,
+		vsock->queues, vsock->use_vhost ? BACKEND_VHOST : BACKEND_VBSU);
+	vsock->base.mtx = &vsock->mtx;
+	vsock->base.device_caps = vsock->use_vhost ?
+		VIRTIO_VSOCK_S_VHOSTCAPS : VIRTIO_VSOCK_S_HOSTCAPS;
+	for (i = 0; i < VIRTIO_VSOCK_MAXQ; i++)
+		vsock->queues[i].qsize = VIRTIO_VSOCK_RINGSZ;
+
+	pci_set_cfgdata16(dev, PCIR_DEVICE, 0x1040 + VIRTIO_TYPE_VSOCK);
+	pci_set_cfgdata16(dev, PCIR_VENDOR, VIRTIO_VENDOR);
+	pci_set_cfgdata8(dev, PCIR_CLASS, PCIC_SIMPLECOMM);
+	pci_set_cfgdata8(dev, PCIR_SUBCLASS, PCIS_SIMPLECOMM_OTHER);
+	pci_set_cfgdata16(dev, PCIR_SUBDEV_0, 0x1100);
+	pci_set_cfgdata16(dev, PCIR_SUBVEND_0, VIRTIO_VENDOR);
+	pci_set_cfgdata16(dev, PCIR_REVID, 1);
+
+	if (vsock->use_vhost) {
+		if (vhost_vsock_init(vsock) < 0)
+			goto fail_mtx;
+	} else {
+		if (vsock_listen(vsock) < 0)
+			goto fail_mtx;
+		vsock->kick_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (vsock->kick_fd < 0)
+			goto fail_mtx;
+	}
+
+	if (virtio_interrupt_init(&vsock->base, virtio_uses_msix()))
+		goto fail_backend;
+	if (virtio_set_modern_bar(&vsock->base, false))
+		goto fail_backend;
+
+	if (!vsock->use_vhost) {
+		if (pthread_create(&vsock->tid, NULL, virtio_vsock_thread,
+				vsock) != 0)
+			goto fail_backend;
+		snprintf(tname, sizeof(tname), "vtvsock-%d:%d", dev->slot,
+			dev->func);
+		pthread_setname_np(vsock->tid, tname);
+	}
+
+	return 0;
+
+fail_backend:
+	if (vsock->use_vhost)
+		vhost_dev_deinit(&vsock->vdev);
+fail_mtx:
+	if (vsock->kick_fd >= 0)
+		close(vsock->kick_fd);
+	if (vsock->listen_fd >= 0) {
+		close(vsock->listen_fd);
+		unlink(vsock->path);
+	}
+	pthread_mutex_destroy(&vsock->mtx);
+fail:
+	dev->arg = NULL;
+	free(vsock->path);
+	free(vsock);
+	return -1;
+}
+
+static void
+virtio_vsock_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
+{
+	struct virtio_vsock *vsock = dev->arg;
+
+	if (vsock == NULL)
+		return;
+
+	if (vsock->use_vhost) {
+		vhost_vsock_stop(vsock);
+		vhost_dev_deinit(&vsock->vdev);
+	} else {
+		pthread_mutex_lock(&vsock->mtx);
+		vsock->closing = true;
+		virtio_vsock_kick(vsock);
+		pthread_mutex_unlock(&vsock->mtx);
+		pthread_join(vsock->tid, NULL);
+
+		vsock_close_all(vsock);
+		close(vsock->kick_fd);
+		close(vsock->listen_fd);
+		unlink(vsock->path);
+	}
+
+	pthread_mutex_destroy(&vsock->mtx);
+	free(vsock->path);
+	free(vsock);
+	dev->arg = NULL;
+}
+
+struct pci_vdev_ops pci_ops_virtio_vsock = {
+	.class_name	= "virtio-vsock",
+	.vdev_init	= virtio_vsock_init,
+	.vdev_deinit	= virtio_vsock_deinit,
+	.vdev_reset	= virtio_pci_reset,
+	.vdev_barwrite	= virtio_pci_write,
+	.vdev_barread	= virtio_pci_read
+};
+DEFINE_PCI_DEVTYPE(pci_ops_virtio_vsock);
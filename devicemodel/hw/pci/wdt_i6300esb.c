@@ -16,6 +16,7 @@
 #include <stdbool.h>
 
 #include "vmmapi.h"
+#include "mem.h"
 #include "mevent.h"
 #include "pci_core.h"
 #include "timer.h"
@@ -66,6 +67,14 @@
  */
 #define	DEFAULT_RESET_TIMER_VAL		(60 << 10)
 
+/* The kicks are coalesced MMIO writes: the hypervisor queues the writes to
+ * the reload register and resumes the guest at once, they only get here
+ * with the next request of the guest or when the timer drains them. The
+ * timer fires WDT_POLLS times per stage so that a stage runs out at most a
+ * WDT_POLLS-th of it late.
+ */
+#define WDT_POLLS			4
+
 /* for debug */
 /* #define WDT_DEBUG */
 #ifdef WDT_DEBUG
@@ -90,6 +99,8 @@ struct info_wdt {
 	uint32_t timer1_val;
 	uint32_t timer2_val;
 	int stage;          /* stage 1 or 2. */
+	int polls;          /* timer expiries left in the stage */
+	uint64_t kicks;
 
 	int unlock_state;   /* unlock states 0 -> 1 -> 2  */
 };
@@ -102,6 +113,7 @@ static int wdt_timeout = 0;
 static struct info_wdt	wdt_state;
 
 static void start_wdt_timer(void);
+static void stop_wdt_timer(void);
 
 /*
  * WDT timer, start when guest OS start watchdog service; and re-start for
@@ -112,6 +124,16 @@ static void
 wdt_expired_handler(void *arg, uint64_t nexp)
 {
 	struct pci_vdev *dev = (struct pci_vdev *)arg;
+	uint64_t kicks = wdt_state.kicks;
+
+	/* a kick among the queued writes restarts the stage */
+	coalesced_mmio_drain(dev->vmctx);
+	if (wdt_state.kicks != kicks)
+		return;
+
+	wdt_state.polls -= (nexp < WDT_POLLS) ? (int)nexp : WDT_POLLS;
+	if (wdt_state.polls > 0)
+		return;
 
 	DPRINTF("wdt timer out! stage=%d, reboot=%d\n",
 		wdt_state.stage, wdt_state.reboot_enabled);
@@ -131,6 +153,7 @@ wdt_expired_handler(void *arg, uint64_t nexp)
 		start_wdt_timer();
 	} else {
 		if (wdt_state.reboot_enabled) {
+			stop_wdt_timer();
 			wdt_state.stage = 1;
 			wdt_timeout = 1;
 
@@ -170,6 +193,7 @@ static void
 start_wdt_timer(void)
 {
 	int seconds;
+	uint64_t poll_ns;
 	struct itimerspec timer_val;
 
 	if (!wdt_state.wdt_enabled)
@@ -183,8 +207,12 @@ start_wdt_timer(void)
 	DPRINTF("%s: armed=%d, time=%d\n", __func__,
 			wdt_state.wdt_armed, seconds);
 
+	poll_ns = (uint64_t)seconds * 1000000000UL / WDT_POLLS;
 	memset(&timer_val, 0, sizeof(struct itimerspec));
-	timer_val.it_value.tv_sec = seconds;
+	timer_val.it_value.tv_sec = poll_ns / 1000000000UL;
+	timer_val.it_value.tv_nsec = poll_ns % 1000000000UL;
+	timer_val.it_interval = timer_val.it_value;
+	wdt_state.polls = WDT_POLLS;
 
 	if (acrn_timer_settime(&wdt_state.timer, &timer_val) == -1) {
 		perror("WDT timerfd_settime failed.\n");
@@ -276,6 +304,7 @@ pci_wdt_bar_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 			wdt_state.unlock_state = 2;
 		else if (wdt_state.unlock_state == 2) {
 			if (value & ESB_WDT_RELOAD) {
+				wdt_state.kicks++;
 				wdt_state.stage = 1;
 				start_wdt_timer();
 			}
@@ -353,6 +382,8 @@ pci_wdt_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	wdt_state.timer2_val = DEFAULT_MAX_TIMER_VAL;
 	wdt_state.unlock_state = 0;
 
+	dev->bar[0].coalesced_off = ESB_RELOAD_REG;
+	dev->bar[0].coalesced_size = sizeof(uint32_t);
 	pci_emul_alloc_bar(dev, 0, PCIBAR_MEM32, WDT_REG_BAR_SIZE);
 
 	/* initialize config space */
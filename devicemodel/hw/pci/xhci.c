@@ -80,6 +80,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -428,6 +429,23 @@ struct pci_xhci_vdev {
 	struct pci_xhci_native_port native_ports[XHCI_MAX_VIRT_PORTS];
 	struct timespec init_time;
 	uint32_t	quirks;
+
+	/*
+	 * Device doorbells only recorded by the vCPU, a bit per endpoint of
+	 * the slot, and run by db_thread under mtx: the doorbells rung
+	 * meanwhile are handled in one pass over the rings.
+	 */
+	pthread_t	db_thread;
+	pthread_cond_t	db_cond;
+	bool		db_polling;
+	int		db_count;	/* slots with doorbells pending */
+	uint32_t	db_pending[XHCI_MAX_SLOTS + 1];
+
+	/* interrupter moderation, the interval is IMODI of imod */
+	pthread_mutex_t	intr_mtx;
+	struct acrn_timer imod_timer;
+	uint64_t	imod_last;	/* ns on CLOCK_MONOTONIC */
+	bool		imod_armed;
 };
 
 /* portregs and devices arrays are set up to start from idx=1 */
@@ -1524,22 +1542,82 @@ pci_xhci_trb_next(struct pci_xhci_vdev *xdev,
 	return next;
 }
 
+static uint64_t
+pci_xhci_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static void
+pci_xhci_fire_interrupt(struct pci_xhci_vdev *xdev)
+{
+	if (pci_msi_enabled(xdev->dev))
+		pci_generate_msi(xdev->dev, 0);
+	else
+		pci_lintr_assert(xdev->dev);
+}
+
+/* end of the moderation interval, the events since get one interrupt */
+static void
+pci_xhci_imod_handler(void *arg, uint64_t nexp)
+{
+	struct pci_xhci_vdev *xdev = arg;
+
+	pthread_mutex_lock(&xdev->intr_mtx);
+	xdev->imod_armed = false;
+	if ((xdev->opregs.usbcmd & XHCI_CMD_INTE) &&
+	    (xdev->rtsregs.intrreg.iman & XHCI_IMAN_INTR_ENA) &&
+	    (xdev->rtsregs.intrreg.iman & XHCI_IMAN_INTR_PEND)) {
+		xdev->imod_last = pci_xhci_now();
+		pci_xhci_fire_interrupt(xdev);
+	}
+	pthread_mutex_unlock(&xdev->intr_mtx);
+}
+
 static void
 pci_xhci_assert_interrupt(struct pci_xhci_vdev *xdev)
 {
+	struct itimerspec delay;
+	uint64_t ival, now;
 
 	xdev->rtsregs.intrreg.erdp |= XHCI_ERDP_LO_BUSY;
 	xdev->rtsregs.intrreg.iman |= XHCI_IMAN_INTR_PEND;
 	xdev->opregs.usbsts |= XHCI_STS_EINT;
 
 	/* only trigger interrupt if permitted */
-	if ((xdev->opregs.usbcmd & XHCI_CMD_INTE) &&
-	    (xdev->rtsregs.intrreg.iman & XHCI_IMAN_INTR_ENA)) {
-		if (pci_msi_enabled(xdev->dev))
-			pci_generate_msi(xdev->dev, 0);
-		else
-			pci_lintr_assert(xdev->dev);
+	if (!(xdev->opregs.usbcmd & XHCI_CMD_INTE) ||
+	    !(xdev->rtsregs.intrreg.iman & XHCI_IMAN_INTR_ENA))
+		return;
+
+	/*
+	 * No more than one interrupt per interval the guest programmed in
+	 * IMOD, the others are left to the moderation timer.
+	 */
+	ival = XHCI_IMOD_IVAL_GET(xdev->rtsregs.intrreg.imod) * 250UL;
+	pthread_mutex_lock(&xdev->intr_mtx);
+	if (ival == 0) {
+		pci_xhci_fire_interrupt(xdev);
+	} else if (!xdev->imod_armed) {
+		now = pci_xhci_now();
+		if (now - xdev->imod_last >= ival) {
+			xdev->imod_last = now;
+			pci_xhci_fire_interrupt(xdev);
+		} else {
+			/* the interval is 16ms at most */
+			delay.it_value.tv_sec = 0;
+			delay.it_value.tv_nsec = xdev->imod_last + ival - now;
+			delay.it_interval.tv_sec = 0;
+			delay.it_interval.tv_nsec = 0;
+			if (acrn_timer_settime(&xdev->imod_timer, &delay) == 0)
+				xdev->imod_armed = true;
+			else
+				pci_xhci_fire_interrupt(xdev);
+		}
 	}
+	pthread_mutex_unlock(&xdev->intr_mtx);
 }
 
 static void
@@ -3243,11 +3321,70 @@ pci_xhci_device_doorbell(struct pci_xhci_vdev *xdev,
 				 ringaddr, ccs, streamid);
 }
 
+/* the pending device doorbells, called with mtx held */
+static void
+pci_xhci_run_doorbells(struct pci_xhci_vdev *xdev)
+{
+	uint32_t pending;
+	int slot, epid;
+
+	if (xdev->db_count == 0)
+		return;
+
+	for (slot = 1; slot <= XHCI_MAX_SLOTS && xdev->db_count > 0; slot++) {
+		pending = xdev->db_pending[slot];
+		if (pending == 0)
+			continue;
+
+		xdev->db_pending[slot] = 0;
+		xdev->db_count--;
+		if (XHCI_HALTED(xdev))
+			continue;
+
+		while (pending != 0) {
+			epid = ffs(pending) - 1;
+			pending &= ~(1U << epid);
+			pci_xhci_device_doorbell(xdev, slot, epid, 0);
+		}
+	}
+}
+
+static void *
+pci_xhci_db_thread(void *data)
+{
+	struct pci_xhci_vdev *xdev;
+
+	xdev = data;
+	pthread_mutex_lock(&xdev->mtx);
+	while (xdev->db_polling) {
+		if (xdev->db_count == 0)
+			pthread_cond_wait(&xdev->db_cond, &xdev->mtx);
+		else
+			pci_xhci_run_doorbells(xdev);
+	}
+	pthread_mutex_unlock(&xdev->mtx);
+
+	return NULL;
+}
+
+static void
+pci_xhci_db_stop(struct pci_xhci_vdev *xdev)
+{
+	pthread_mutex_lock(&xdev->mtx);
+	xdev->db_polling = false;
+	pthread_cond_signal(&xdev->db_cond);
+	pthread_mutex_unlock(&xdev->mtx);
+
+	pthread_join(xdev->db_thread, NULL);
+	pthread_cond_destroy(&xdev->db_cond);
+}
+
 static void
 pci_xhci_dbregs_write(struct pci_xhci_vdev *xdev,
 		      uint64_t offset,
 		      uint64_t value)
 {
+	uint32_t epid, sid;
 
 	offset = (offset - xdev->dboff) / sizeof(uint32_t);
 
@@ -3259,12 +3396,31 @@ pci_xhci_dbregs_write(struct pci_xhci_vdev *xdev,
 		return;
 	}
 
-	if (offset == 0)
+	if (offset == 0) {
 		pci_xhci_complete_commands(xdev);
-	else if (xdev->portregs != NULL)
-		pci_xhci_device_doorbell(xdev, offset,
-					 XHCI_DB_TARGET_GET(value),
-					 XHCI_DB_SID_GET(value));
+		return;
+	}
+
+	if (xdev->portregs == NULL)
+		return;
+
+	epid = XHCI_DB_TARGET_GET(value);
+	sid = XHCI_DB_SID_GET(value);
+	if (epid >= XHCI_MAX_ENDPOINTS) {
+		UPRINTF(LWRN, "invalid doorbell target %u\r\n", epid);
+		return;
+	}
+
+	/* a stream doorbell is not only an endpoint, run it at once */
+	if (sid != 0 || offset > XHCI_MAX_SLOTS) {
+		pci_xhci_device_doorbell(xdev, offset, epid, sid);
+		return;
+	}
+
+	if (xdev->db_pending[offset] == 0)
+		xdev->db_count++;
+	xdev->db_pending[offset] |= 1U << epid;
+	pthread_cond_signal(&xdev->db_cond);
 }
 
 static void
@@ -3485,6 +3641,14 @@ pci_xhci_write(struct vmctx *ctx,
 	xdev = dev->arg;
 
 	pthread_mutex_lock(&xdev->mtx);
+
+	/*
+	 * The doorbells rung before go first, as the guest expects them to
+	 * be seen before a command, a reset or a register change.
+	 */
+	if (offset < xdev->dboff + sizeof(uint32_t) || offset >= xdev->rtsoff)
+		pci_xhci_run_doorbells(xdev);
+
 	if (offset < XHCI_CAPLEN)	/* read only registers */
 		UPRINTF(LWRN, "write RO-CAPs offset %ld\r\n", offset);
 	else if (offset < xdev->dboff)
@@ -4338,6 +4502,13 @@ pci_xhci_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 	pci_emul_add_msicap(dev, 1);
 
+	/*
+	 * The guest only moves ERDP forward once it consumed the events, a
+	 * late update just makes the event ring look fuller: post its writes.
+	 */
+	dev->bar[0].coalesced_off = xdev->rtsoff + XHCI_RT_IR_BASE + 0x18;
+	dev->bar[0].coalesced_size = sizeof(xdev->rtsregs.intrreg.erdp);
+
 	/* regsend registers */
 	pci_emul_alloc_bar(dev, 0, PCIBAR_MEM32, xdev->regsend);
 	UPRINTF(LDBG, "pci_emu_alloc: %d\r\n", xdev->regsend);
@@ -4345,14 +4516,34 @@ pci_xhci_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	pci_lintr_request(dev);
 
 	pthread_mutex_init(&xdev->mtx, NULL);
+	pthread_mutex_init(&xdev->intr_mtx, NULL);
+
+	xdev->imod_timer.clockid = CLOCK_MONOTONIC;
+	error = acrn_timer_init(&xdev->imod_timer, pci_xhci_imod_handler,
+			xdev);
+	if (error)
+		goto done;
+
+	xdev->db_polling = true;
+	pthread_cond_init(&xdev->db_cond, NULL);
+	error = pthread_create(&xdev->db_thread, NULL, pci_xhci_db_thread,
+			xdev);
+	if (error) {
+		acrn_timer_deinit(&xdev->imod_timer);
+		goto done;
+	}
+	pthread_setname_np(xdev->db_thread, "xhci_db");
 
 	/* create vbdp_thread */
 	xdev->vbdp_polling = true;
 	sem_init(&xdev->vbdp_sem, 0, 0);
 	error = pthread_create(&xdev->vbdp_thread, NULL, xhci_vbdp_thread,
 			xdev);
-	if (error)
+	if (error) {
+		pci_xhci_db_stop(xdev);
+		acrn_timer_deinit(&xdev->imod_timer);
 		goto done;
+	}
 
 	xhci_in_use = 1;
 done:
@@ -4389,6 +4580,9 @@ pci_xhci_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 	UPRINTF(LINF, "de-initialization\r\n");
 
+	pci_xhci_db_stop(xdev);
+	acrn_timer_deinit(&xdev->imod_timer);
+
 	for (i = 1; i <= XHCI_MAX_DEVS; ++i) {
 		de = xdev->devices[i];
 		if (de) {
@@ -4409,13 +4603,21 @@ pci_xhci_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	pthread_join(xdev->vbdp_thread, NULL);
 	sem_close(&xdev->vbdp_sem);
 
+	pthread_mutex_destroy(&xdev->intr_mtx);
 	pthread_mutex_destroy(&xdev->mtx);
 	free(xdev);
 	xhci_in_use = 0;
 }
 
+static int
+pci_xhci_prepare(struct vmctx *ctx, char *opts)
+{
+	return usb_dev_sys_prepare();
+}
+
 struct pci_vdev_ops pci_ops_xhci = {
 	.class_name	= "xhci",
+	.vdev_prepare	= pci_xhci_prepare,
 	.vdev_init	= pci_xhci_init,
 	.vdev_deinit	= pci_xhci_deinit,
 	.vdev_barwrite	= pci_xhci_write,
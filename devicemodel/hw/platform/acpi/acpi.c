@@ -34,6 +34,10 @@
  * the tables and the compiling them to AML with the Intel iasl compiler.
  * The AML files are then read into guest memory.
  *
+ * iasl is run once for each table of each different VM configuration: the
+ * AML output is kept in ACPI_CACHE_DIR under the hash of the ASL input and
+ * of the compiler, and reused each time the same ASL is generated again.
+ *
  *  The tables are placed in the guest's ROM area just below 1MB physical,
  * above the MPTable.
  *
@@ -92,12 +96,16 @@
 #ifndef ASL_COMPILER
 #define ASL_COMPILER	"/usr/sbin/iasl"
 #endif
+#define ACPI_CACHE_BASE	"/var/cache/acrn"
+#define ACPI_CACHE_DIR	ACPI_CACHE_BASE "/acpi"
 
 uint64_t audio_nhlt_len = 0;
 uint32_t csme_sec_cap = 0;
 
 static int basl_keep_temps;
 static int basl_verbose_iasl;
+static int basl_no_cache;
+static const char *basl_cache_dir = ACPI_CACHE_DIR;
 static int basl_ncpu;
 static uint32_t basl_acpi_base = ACPI_BASE;
 
@@ -244,6 +252,7 @@ basl_fwrite_xsdt(FILE *fp, struct vmctx *ctx)
 static int
 basl_fwrite_madt(FILE *fp, struct vmctx *ctx)
 {
+	bool present;
 	int i;
 
 	EFPRINTF(fp, "/*\n");
@@ -267,16 +276,21 @@ basl_fwrite_madt(FILE *fp, struct vmctx *ctx)
 	EFPRINTF(fp, "\t\t\tPC-AT Compatibility : 1\n");
 	EFPRINTF(fp, "\n");
 
-	/* Add a Processor Local APIC entry for each CPU */
+	/*
+	 * Add a Processor Local APIC entry for each CPU, the ones not present
+	 * are hot-added at runtime, see cpu_hotplug.c
+	 */
 	for (i = 0; i < basl_ncpu; i++) {
+		present = cpu_hotplug_present(i);
 		EFPRINTF(fp, "[0001]\t\tSubtable Type : 00\n");
 		EFPRINTF(fp, "[0001]\t\tLength : 08\n");
 		/* iasl expects hex values for the proc and apic id's */
 		EFPRINTF(fp, "[0001]\t\tProcessor ID : %02x\n", i);
 		EFPRINTF(fp, "[0001]\t\tLocal Apic ID : %02x\n", i);
-		EFPRINTF(fp, "[0004]\t\tFlags (decoded below) : 00000001\n");
-		EFPRINTF(fp, "\t\t\tProcessor Enabled : 1\n");
-		EFPRINTF(fp, "\t\t\tRuntime Online Capable : 0\n");
+		EFPRINTF(fp, "[0004]\t\tFlags (decoded below) : %08x\n",
+		    present ? 1 : 2);
+		EFPRINTF(fp, "\t\t\tProcessor Enabled : %d\n", present);
+		EFPRINTF(fp, "\t\t\tRuntime Online Capable : %d\n", !present);
 		EFPRINTF(fp, "\n");
 	}
 
@@ -371,13 +385,15 @@ basl_fwrite_fadt(FILE *fp, struct vmctx *ctx)
 	EFPRINTF(fp, "[0004]\t\tPM2 Control Block Address : 00000000\n");
 	EFPRINTF(fp, "[0004]\t\tPM Timer Block Address : %08X\n",
 	    IO_PMTMR);
-	EFPRINTF(fp, "[0004]\t\tGPE0 Block Address : 00000000\n");
+	EFPRINTF(fp, "[0004]\t\tGPE0 Block Address : %08X\n",
+	    GPE0_BLK_ADDR);
 	EFPRINTF(fp, "[0004]\t\tGPE1 Block Address : 00000000\n");
 	EFPRINTF(fp, "[0001]\t\tPM1 Event Block Length : 04\n");
 	EFPRINTF(fp, "[0001]\t\tPM1 Control Block Length : 02\n");
 	EFPRINTF(fp, "[0001]\t\tPM2 Control Block Length : 00\n");
 	EFPRINTF(fp, "[0001]\t\tPM Timer Block Length : 00\n");
-	EFPRINTF(fp, "[0001]\t\tGPE0 Block Length : 00\n");
+	EFPRINTF(fp, "[0001]\t\tGPE0 Block Length : %02X\n",
+	    GPE0_BLK_LEN);
 	EFPRINTF(fp, "[0001]\t\tGPE1 Block Length : 00\n");
 	EFPRINTF(fp, "[0001]\t\tGPE1 Base Offset : 00\n");
 	EFPRINTF(fp, "[0001]\t\t_CST Support : 00\n");
@@ -505,10 +521,11 @@ basl_fwrite_fadt(FILE *fp, struct vmctx *ctx)
 
 	EFPRINTF(fp, "[0012]\t\tGPE0 Block : [Generic Address Structure]\n");
 	EFPRINTF(fp, "[0001]\t\tSpace ID : 01 [SystemIO]\n");
-	EFPRINTF(fp, "[0001]\t\tBit Width : 00\n");
+	EFPRINTF(fp, "[0001]\t\tBit Width : %02X\n", GPE0_BLK_LEN * 8);
 	EFPRINTF(fp, "[0001]\t\tBit Offset : 00\n");
 	EFPRINTF(fp, "[0001]\t\tEncoded Access Width : 01 [Byte Access:8]\n");
-	EFPRINTF(fp, "[0008]\t\tAddress : 0000000000000000\n");
+	EFPRINTF(fp, "[0008]\t\tAddress : 00000000%08X\n",
+	    GPE0_BLK_ADDR);
 	EFPRINTF(fp, "\n");
 
 	EFPRINTF(fp, "[0012]\t\tGPE1 Block : [Generic Address Structure]\n");
@@ -958,6 +975,7 @@ basl_fwrite_dsdt(FILE *fp, struct vmctx *ctx)
 	dsdt_line("  }");
 
 	pm_write_dsdt(ctx, basl_ncpu);
+	cpu_hotplug_write_dsdt();
 
 	if (ctx->tpm_dev)
 		tpm2_crb_fwrite_dsdt();
@@ -1049,6 +1067,66 @@ basl_load(struct vmctx *ctx, int fd, uint64_t off)
 	return 0;
 }
 
+/* FNV-1a of the ASL file and of the size and mtime of the compiler */
+static int
+basl_cache_path(int asl_fd, char *path, size_t len)
+{
+	char buf[4096];
+	struct stat sb;
+	uint64_t h = 0xcbf29ce484222325UL;
+	off_t off = 0;
+	ssize_t n, i;
+
+	if (stat(ASL_COMPILER, &sb) < 0)
+		return -1;
+	h = (h ^ (uint64_t)sb.st_size) * 0x100000001b3UL;
+	h = (h ^ (uint64_t)sb.st_mtime) * 0x100000001b3UL;
+
+	while ((n = pread(asl_fd, buf, sizeof(buf), off)) > 0) {
+		for (i = 0; i < n; i++)
+			h = (h ^ (uint8_t)buf[i]) * 0x100000001b3UL;
+		off += n;
+	}
+	if (n < 0)
+		return -1;
+
+	snprintf(path, len, "%s/%016lx%s", basl_cache_dir, h, ASL_SUFFIX);
+	return 0;
+}
+
+/* written aside and renamed, a concurrent DM sees the whole AML or none */
+static void
+basl_cache_store(int aml_fd, const char *path)
+{
+	char buf[4096], tmp[MAXPATHLEN + 8];
+	off_t off = 0;
+	ssize_t n;
+	int fd;
+
+	if (strcmp(basl_cache_dir, ACPI_CACHE_DIR) == 0 &&
+	    mkdir(ACPI_CACHE_BASE, 0755) < 0 && errno != EEXIST)
+		return;
+	if (mkdir(basl_cache_dir, 0755) < 0 && errno != EEXIST)
+		return;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return;
+
+	while ((n = pread(aml_fd, buf, sizeof(buf), off)) > 0) {
+		if (write(fd, buf, n) != n) {
+			n = -1;
+			break;
+		}
+		off += n;
+	}
+	close(fd);
+
+	if (n < 0 || rename(tmp, path) < 0)
+		unlink(tmp);
+}
+
 static int
 basl_compile(struct vmctx *ctx,
 		int (*fwrite_section)(FILE *, struct vmctx *),
@@ -1056,12 +1134,27 @@ basl_compile(struct vmctx *ctx,
 {
 	struct basl_fio io[2];
 	static char iaslbuf[3*MAXPATHLEN + 10];
-	int err;
+	char cache[MAXPATHLEN];
+	bool cached;
+	int err, fd;
 
 	err = basl_start(&io[0], &io[1]);
 	if (!err) {
 		err = (*fwrite_section)(io[0].fp, ctx);
 
+		cached = false;
+		if (!err && !basl_no_cache && fflush(io[0].fp) == 0 &&
+		    basl_cache_path(io[0].fd, cache, sizeof(cache)) == 0) {
+			cached = true;
+			fd = open(cache, O_RDONLY);
+			if (fd >= 0) {
+				err = basl_load(ctx, fd, offset);
+				close(fd);
+				basl_end(&io[0], &io[1]);
+				return err;
+			}
+		}
+
 		if (!err) {
 			/*
 			 * iasl sends the results of the compilation to
@@ -1089,6 +1182,8 @@ basl_compile(struct vmctx *ctx,
 				 * memory at the specified location
 				 */
 				err = basl_load(ctx, io[1].fd, offset);
+				if (!err && cached)
+					basl_cache_store(io[1].fd, cache);
 			} else
 				err = -1;
 		}
@@ -1200,7 +1295,7 @@ acpi_build(struct vmctx *ctx, int ncpu)
 	int err;
 	int i;
 
-	basl_ncpu = ncpu;
+	basl_ncpu = cpu_hotplug_enabled() ? cpu_hotplug_ncpus() : ncpu;
 
 	/*
 	 * For debug, allow the user to have iasl compiler output sent
@@ -1216,6 +1311,15 @@ acpi_build(struct vmctx *ctx, int ncpu)
 	if (getenv("ACPI_KEEPTMPS"))
 		basl_keep_temps = 1;
 
+	/*
+	 * Allow the user to compile the tables each time, or to keep the
+	 * AML cache somewhere else
+	 */
+	if (getenv("ACPI_NOCACHE"))
+		basl_no_cache = 1;
+	if (getenv("ACPI_CACHEDIR") && *getenv("ACPI_CACHEDIR") != '\0')
+		basl_cache_dir = getenv("ACPI_CACHEDIR");
+
 	i = 0;
 	err = basl_make_templates();
 
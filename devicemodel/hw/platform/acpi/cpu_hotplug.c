@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * vCPU hotplug, with --max_cpus above the vCPUs of the VM configuration.
+ *
+ * The MADT lists the possible vCPUs, the ones added at runtime as online
+ * capable, and their processor objects read the state of the vCPUs from:
+ *
+ *   CPU_HOTPLUG_ADDR + 0	bitmap of the present vCPUs
+ *   CPU_HOTPLUG_ADDR + 4	bitmap of the vCPUs the guest is asked to eject
+ *   CPU_HOTPLUG_ADDR + 8	_EJ0 writes the ID of an ejected vCPU here
+ *
+ * A vCPU is added on a pCPU the SOS has offlined, and CPU_HOTPLUG_GPE tells
+ * the guest to bring it up. A vCPU is removed once the guest ejected it, and
+ * its pCPU goes back to the SOS, which may online it again.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "vmmapi.h"
+#include "acpi.h"
+#include "inout.h"
+#include "lpc.h"
+#include "dm.h"
+#include "log.h"
+
+static pthread_mutex_t cpuhp_mtx = PTHREAD_MUTEX_INITIALIZER;
+static int boot_ncpus, possible_ncpus;
+static uint32_t cpu_present, cpu_eject_req;
+
+void
+cpu_hotplug_init(int ncpu, int max_cpus)
+{
+	pthread_mutex_lock(&cpuhp_mtx);
+	boot_ncpus = ncpu;
+	possible_ncpus = (max_cpus > ncpu) ? max_cpus : ncpu;
+	cpu_present = (1U << ncpu) - 1;
+	cpu_eject_req = 0;
+	pthread_mutex_unlock(&cpuhp_mtx);
+}
+
+/* the vCPUs of the ACPI tables */
+int
+cpu_hotplug_ncpus(void)
+{
+	return possible_ncpus;
+}
+
+bool
+cpu_hotplug_enabled(void)
+{
+	return possible_ncpus > boot_ncpus;
+}
+
+bool
+cpu_hotplug_present(int cpu)
+{
+	return (cpu_present & (1U << cpu)) != 0;
+}
+
+static int
+cpu_hotplug_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
+		    uint32_t *eax, void *arg)
+{
+	int offset = port - CPU_HOTPLUG_ADDR;
+	uint32_t cpu;
+
+	if (bytes != 4)
+		return -1;
+
+	pthread_mutex_lock(&cpuhp_mtx);
+	if (in) {
+		if (offset == 0)
+			*eax = cpu_present;
+		else if (offset == 4)
+			*eax = cpu_eject_req;
+		else
+			*eax = 0;
+	} else if (offset == 8) {
+		cpu = *eax;
+		if (cpu != 0 && cpu < (uint32_t)possible_ncpus &&
+		    cpu_hotplug_present(cpu)) {
+			if (vm_remove_vcpu(ctx, (uint16_t)cpu) == 0) {
+				cpu_present &= ~(1U << cpu);
+				cpu_eject_req &= ~(1U << cpu);
+				pr_notice("vCPU %u ejected\n", cpu);
+			} else
+				pr_err("%s: failed to remove vCPU %u, %d\n",
+					__func__, cpu, errno);
+		}
+	}
+	pthread_mutex_unlock(&cpuhp_mtx);
+
+	return 0;
+}
+INOUT_PORT(cpu_present, CPU_HOTPLUG_ADDR, IOPORT_F_IN, cpu_hotplug_handler);
+INOUT_PORT(cpu_eject_req, CPU_HOTPLUG_ADDR + 4, IOPORT_F_IN, cpu_hotplug_handler);
+INOUT_PORT(cpu_eject, CPU_HOTPLUG_ADDR + 8, IOPORT_F_OUT, cpu_hotplug_handler);
+SYSRES_IO(CPU_HOTPLUG_ADDR, CPU_HOTPLUG_LEN);
+
+/* Add a vCPU on pcpu, returns its ID */
+int
+cpu_hotplug_add(struct vmctx *ctx, int pcpu)
+{
+	int cpu, ret;
+
+	pthread_mutex_lock(&cpuhp_mtx);
+	for (cpu = 1; cpu < possible_ncpus; cpu++)
+		if (!cpu_hotplug_present(cpu))
+			break;
+
+	if (!cpu_hotplug_enabled() || cpu == possible_ncpus)
+		ret = -ENOSPC;
+	else if (vm_add_vcpu(ctx, (uint16_t)cpu, (uint16_t)pcpu) != 0)
+		ret = -errno;
+	else {
+		cpu_present |= 1U << cpu;
+		add_hotplug_cpu(ctx, cpu);
+		ret = cpu;
+	}
+	pthread_mutex_unlock(&cpuhp_mtx);
+
+	if (ret >= 0) {
+		pr_notice("vCPU %d added on pCPU %d\n", ret, pcpu);
+		gpe_raise(ctx, CPU_HOTPLUG_GPE);
+	}
+
+	return ret;
+}
+
+/* Ask the guest to eject a vCPU, it is removed on its _EJ0 */
+int
+cpu_hotplug_remove(struct vmctx *ctx, int cpu)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&cpuhp_mtx);
+	if (!cpu_hotplug_enabled() || cpu <= 0 || cpu >= possible_ncpus ||
+	    !cpu_hotplug_present(cpu))
+		ret = -EINVAL;
+	else
+		cpu_eject_req |= 1U << cpu;
+	pthread_mutex_unlock(&cpuhp_mtx);
+
+	if (ret == 0)
+		gpe_raise(ctx, CPU_HOTPLUG_GPE);
+
+	return ret;
+}
+
+void
+cpu_hotplug_write_dsdt(void)
+{
+	int i;
+
+	if (!cpu_hotplug_enabled())
+		return;
+
+	dsdt_line("");
+	dsdt_line("  Scope (_PR)");
+	dsdt_line("  {");
+	dsdt_line("    OperationRegion (CPHP, SystemIO, 0x%04X, 0x%02X)",
+		CPU_HOTPLUG_ADDR, CPU_HOTPLUG_LEN);
+	dsdt_line("    Field (CPHP, DWordAcc, NoLock, Preserve)");
+	dsdt_line("    {");
+	dsdt_line("      CPRS, 32,");
+	dsdt_line("      CPRQ, 32,");
+	dsdt_line("      CPEJ, 32");
+	dsdt_line("    }");
+	dsdt_line("");
+	/* the present vCPUs the guest was last told of */
+	dsdt_line("    Name (CPCS, 0x%08X)", cpu_present);
+	dsdt_line("");
+	dsdt_line("    Method (CSTA, 1, NotSerialized)");
+	dsdt_line("    {");
+	dsdt_line("      If (And (CPRS, ShiftLeft (One, Arg0)))");
+	dsdt_line("      {");
+	dsdt_line("        Return (0x0F)");
+	dsdt_line("      }");
+	dsdt_line("      Return (Zero)");
+	dsdt_line("    }");
+	dsdt_line("");
+	dsdt_line("    Method (CMAT, 1, Serialized)");
+	dsdt_line("    {");
+	dsdt_line("      Name (LAPI, Buffer (0x08)");
+	dsdt_line("      {");
+	dsdt_line("        0x00, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00");
+	dsdt_line("      })");
+	dsdt_line("      CreateByteField (LAPI, 0x02, CUID)");
+	dsdt_line("      CreateByteField (LAPI, 0x03, CLID)");
+	dsdt_line("      CreateDWordField (LAPI, 0x04, CFLG)");
+	dsdt_line("      Store (Arg0, CUID)");
+	dsdt_line("      Store (Arg0, CLID)");
+	dsdt_line("      If (And (CPRS, ShiftLeft (One, Arg0)))");
+	dsdt_line("      {");
+	dsdt_line("        Store (One, CFLG)");
+	dsdt_line("      }");
+	dsdt_line("      Return (LAPI)");
+	dsdt_line("    }");
+	dsdt_line("");
+	dsdt_line("    Method (CSCN, 0, Serialized)");
+	dsdt_line("    {");
+	dsdt_line("      Store (CPRS, Local0)");
+	dsdt_line("      Store (CPRQ, Local1)");
+	dsdt_line("      Store (And (Local0, Not (CPCS)), Local2)");
+	for (i = 1; i < possible_ncpus; i++) {
+		dsdt_line("      If (And (Local2, 0x%08X))", 1U << i);
+		dsdt_line("      {");
+		dsdt_line("        Notify (CPU%d, One)", i);
+		dsdt_line("      }");
+		dsdt_line("      If (And (Local1, 0x%08X))", 1U << i);
+		dsdt_line("      {");
+		dsdt_line("        Notify (CPU%d, 0x03)", i);
+		dsdt_line("      }");
+	}
+	dsdt_line("      Store (Local0, CPCS)");
+	dsdt_line("    }");
+	dsdt_line("  }");
+
+	for (i = 1; i < possible_ncpus; i++) {
+		dsdt_line("");
+		dsdt_line("  Scope (_PR.CPU%d)", i);
+		dsdt_line("  {");
+		dsdt_line("    Method (_STA, 0, NotSerialized)");
+		dsdt_line("    {");
+		dsdt_line("      Return (^^CSTA (0x%02X))", i);
+		dsdt_line("    }");
+		dsdt_line("");
+		dsdt_line("    Method (_MAT, 0, NotSerialized)");
+		dsdt_line("    {");
+		dsdt_line("      Return (^^CMAT (0x%02X))", i);
+		dsdt_line("    }");
+		dsdt_line("");
+		dsdt_line("    Method (_EJ0, 1, NotSerialized)");
+		dsdt_line("    {");
+		dsdt_line("      Store (0x%02X, ^^CPEJ)", i);
+		dsdt_line("    }");
+		dsdt_line("  }");
+	}
+
+	dsdt_line("");
+	dsdt_line("  Scope (_GPE)");
+	dsdt_line("  {");
+	dsdt_line("    Method (_E%02X, 0, NotSerialized)", CPU_HOTPLUG_GPE);
+	dsdt_line("    {");
+	dsdt_line("      \\_PR.CSCN ()");
+	dsdt_line("    }");
+	dsdt_line("  }");
+}
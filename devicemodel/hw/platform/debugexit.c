@@ -33,10 +33,13 @@
 #include "vmmapi.h"
 #include "inout.h"
 #include "mevent.h"
+#include "pioreg.h"
 
 #define DEBUG_IO_BASE	(0xf4)
 #define	DEBUG_IO_SIZE	(1)
 
+static struct acrn_pio_reg *debugexit_reg;
+
 static int
 debugexit_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 	      uint32_t *eax, void *arg)
@@ -63,6 +66,10 @@ init_debugexit(void)
 	iop.handler = debugexit_handler;
 
 	register_inout(&iop);
+
+	/* only the writes exit */
+	debugexit_reg = pioreg_add(DEBUG_IO_BASE, DEBUG_IO_SIZE,
+			ACRN_PIO_REG_FLAG_READ, 0xFF, 0);
 }
 
 void
@@ -76,4 +83,7 @@ deinit_debugexit(void)
 	iop.size = DEBUG_IO_SIZE;
 
 	unregister_inout(&iop);
+
+	pioreg_del(debugexit_reg);
+	debugexit_reg = NULL;
 }
@@ -44,6 +44,7 @@
 #include "timer.h"
 #include "hpet.h"
 #include "acpi_hpet.h"
+#include "vcounter.h"
 
 #define	HPET_FREQ	(16777216)		/* 16.7 (2^24) Mhz */
 #define	FS_PER_S	(1000000000000000UL)
@@ -116,6 +117,7 @@ struct vhpet {
 	uint64_t	isr;		/* Interrupt Status */
 	uint32_t	countbase;	/* HPET counter base value */
 	struct timespec	countbase_ts;	/* uptime corresponding to base value */
+	uint64_t	countbase_tsc;	/* TSC corresponding to base value */
 
 	struct {
 		uint64_t	cap_config;	/* Configuration */
@@ -196,6 +198,7 @@ static uint32_t
 vhpet_counter(struct vhpet *vhpet, struct timespec *nowptr)
 {
 	uint32_t val;
+	uint64_t tsc;
 	struct timespec now, delta;
 
 	val = vhpet->countbase;
@@ -204,15 +207,23 @@ vhpet_counter(struct vhpet *vhpet, struct timespec *nowptr)
 		if (clock_gettime(CLOCK_REALTIME, &now))
 			errx(EX_SOFTWARE, "clock_gettime returned: %s", strerror(errno));
 
-		/* delta = now - countbase_ts */
-		if (timespeccmp(&now, &vhpet->countbase_ts, <)) {
-			warnx("vhpet counter going backwards");
-			vhpet->countbase_ts = now;
-		}
+		if (vcounter_page() != NULL) {
+			/* count as the hypervisor does, see vhpet_publish() */
+			tsc = vcounter_rdtsc();
+			if (tsc > vhpet->countbase_tsc)
+				val += vcounter_ticks(tsc - vhpet->countbase_tsc,
+						HPET_FREQ);
+		} else {
+			/* delta = now - countbase_ts */
+			if (timespeccmp(&now, &vhpet->countbase_ts, <)) {
+				warnx("vhpet counter going backwards");
+				vhpet->countbase_ts = now;
+			}
 
-		delta = now;
-		timespecsub(&delta, &vhpet->countbase_ts);
-		val += vhpet_ts_to_ticks(&delta);
+			delta = now;
+			timespecsub(&delta, &vhpet->countbase_ts);
+			val += vhpet_ts_to_ticks(&delta);
+		}
 
 		if (nowptr != NULL)
 			*nowptr = now;
@@ -337,7 +348,6 @@ vhpet_timer_handler(void *a, uint64_t nexp)
 	struct vhpet_timer_arg *arg;
 	struct timespec now;
 	struct itimerspec tmrts;
-	uint64_t newexp;
 
 	arg = a;
 	vhpet = arg->vhpet;
@@ -386,11 +396,9 @@ vhpet_timer_handler(void *a, uint64_t nexp)
 	vhpet->timer[n].expts = tmrts.it_value;
 
 	/*
-	 * Catch any remaining expirations that happened after being
-	 * last consumed by the mevent_dispatch thread.
+	 * The expirations that happened after nexp was counted are
+	 * reported by the next call.
 	 */
-	if (read(vhpet_tmr(vhpet, n)->fd, &newexp, sizeof(newexp)) > 0)
-		nexp += newexp;
 
 	/*
 	 * Periodic timer updates 'compval' upon expiration.
@@ -550,6 +558,7 @@ vhpet_start_counting(struct vhpet *vhpet)
 
 	if (clock_gettime(CLOCK_REALTIME, &vhpet->countbase_ts))
 		errx(EX_SOFTWARE, "clock_gettime returned: %s", strerror(errno));
+	vhpet->countbase_tsc = vcounter_rdtsc();
 
 	/* Restart the timers based on the main counter base value */
 	for (i = 0; i < VHPET_NUM_TIMERS; i++) {
@@ -919,6 +928,31 @@ done:
 	return 0;
 }
 
+/*
+ * Let the hypervisor serve the main counter reads from the current state,
+ * called with the lock held.
+ */
+static void
+vhpet_publish(struct vhpet *vhpet)
+{
+	struct acrn_timer_counters *tc;
+	struct acrn_hpet_counter *hc;
+
+	tc = vcounter_page();
+	if (tc == NULL)
+		return;
+
+	hc = &tc->hpet;
+	vcounter_write_begin(&hc->seq);
+	hc->valid = vhpet->inited;
+	hc->base = VHPET_BASE;
+	hc->freq = HPET_FREQ;
+	hc->count = vhpet->countbase;
+	hc->tsc = vhpet->countbase_tsc;
+	hc->enabled = vhpet_counter_enabled(vhpet);
+	vcounter_write_end(&hc->seq);
+}
+
 static int
 vhpet_handler(struct vmctx *ctx, int vcpu, int dir, uint64_t addr,
 		int size, uint64_t *val, void *arg1, long arg2)
@@ -935,6 +969,8 @@ vhpet_handler(struct vmctx *ctx, int vcpu, int dir, uint64_t addr,
 
 	error = ((dir == MEM_F_READ) ? vhpet_mmio_read : vhpet_mmio_write)(
 				vhpet, vcpu, addr, val, size);
+	if (dir == MEM_F_WRITE)
+		vhpet_publish(vhpet);
 
 done:
 	VHPET_UNLOCK();
@@ -1023,6 +1059,7 @@ vhpet_init(struct vmctx *ctx)
 	}
 
 	vhpet->inited = true;
+	vhpet_publish(vhpet);
 
 done:
 	VHPET_UNLOCK();
@@ -1045,6 +1082,7 @@ vhpet_deinit(struct vmctx *ctx)
 	unregister_mem(&vhpet_mr);
 
 	vhpet->inited = false;
+	vhpet_publish(vhpet);
 
 done:
 	VHPET_UNLOCK();
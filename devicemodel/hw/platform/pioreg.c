@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "vmmapi.h"
+#include "log.h"
+#include "pioreg.h"
+
+static struct acrn_pio_regs pioregs;
+static bool pioregs_enabled;
+static pthread_mutex_t pioregs_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+void
+pioreg_init(struct vmctx *ctx)
+{
+	pioregs_enabled = false;
+	bzero(&pioregs, sizeof(pioregs));
+	if (vm_set_pio_regs(ctx, &pioregs) != 0)
+		pr_info("pio registers in hv unsupported, errno %d\n", errno);
+	else
+		pioregs_enabled = true;
+}
+
+struct acrn_pio_reg *
+pioreg_add(uint16_t port, uint16_t size, uint32_t flags, uint32_t value,
+		uint32_t wmask)
+{
+	struct acrn_pio_reg *reg, *free = NULL;
+	uint32_t i;
+
+	if (!pioregs_enabled || flags == 0)
+		return NULL;
+
+	pthread_mutex_lock(&pioregs_mtx);
+	for (i = 0; i < pioregs.num_regs; i++) {
+		reg = &pioregs.regs[i];
+		if (reg->flags == 0) {
+			if (free == NULL)
+				free = reg;
+		} else if (reg->port == port && reg->size == size) {
+			break;
+		}
+	}
+
+	if (i < pioregs.num_regs) {
+		/* stop serving it while it changes */
+		atomic_store(&reg->flags, 0);
+	} else if (free != NULL) {
+		reg = free;
+	} else if (pioregs.num_regs < ACRN_PIO_REGS_MAX) {
+		reg = &pioregs.regs[pioregs.num_regs];
+		reg->flags = 0;
+		/* the new entry is not in use until its flags are set */
+		atomic_store(&pioregs.num_regs, pioregs.num_regs + 1);
+	} else {
+		pr_warn("%s: no room for port 0x%x\n", __func__, port);
+		reg = NULL;
+	}
+
+	if (reg != NULL) {
+		reg->port = port;
+		reg->size = size;
+		reg->value = value;
+		reg->wmask = wmask;
+		atomic_store(&reg->flags, flags);
+	}
+	pthread_mutex_unlock(&pioregs_mtx);
+
+	return reg;
+}
+
+void
+pioreg_del(struct acrn_pio_reg *reg)
+{
+	if (reg != NULL)
+		atomic_store(&reg->flags, 0);
+}
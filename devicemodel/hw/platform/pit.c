@@ -39,6 +39,7 @@
 #include "timer.h"
 #include "inout.h"
 #include "pit.h"
+#include "vcounter.h"
 
 #define	TMR2_OUT_STS		0x20
 
@@ -81,6 +82,7 @@ struct channel {
 	int		mode;
 	uint32_t	initial;	/* initial counter value */
 	struct timespec start_ts;	/* uptime when counter was loaded */
+	uint64_t	start_tsc;	/* TSC when counter was loaded */
 	uint8_t		cr[2];
 	uint8_t		ol[2];
 	bool		nullcnt;
@@ -104,20 +106,59 @@ static pthread_mutex_t vpit_mtx = PTHREAD_MUTEX_INITIALIZER;
 
 
 static uint64_t
-ticks_elapsed_since(const struct timespec *since)
+ticks_elapsed_since(const struct channel *c)
 {
 	struct timespec ts;
+	uint64_t tsc;
+
+	if (vcounter_page() != NULL) {
+		/* count as the hypervisor does, see vpit_publish() */
+		tsc = vcounter_rdtsc();
+		if (tsc <= c->start_tsc)
+			return 0;
+
+		return vcounter_ticks(tsc - c->start_tsc, PIT_8254_FREQ);
+	}
 
 	if (clock_gettime(CLOCK_REALTIME, &ts))
 		errx(EX_SOFTWARE, "clock_gettime returned: %s", strerror(errno));
 
-	if (timespeccmp(&ts, since, <=))
+	if (timespeccmp(&ts, &c->start_ts, <=))
 		return 0;
 
-	timespecsub(&ts, since);
+	timespecsub(&ts, &c->start_ts);
 	return vpit_ts_to_ticks(&ts);
 }
 
+/*
+ * Let the hypervisor latch the count of the channel from its current
+ * state, or no more if vpit is NULL. Called with the lock held.
+ */
+static void
+vpit_publish(struct vpit *vpit, int channel)
+{
+	struct acrn_timer_counters *tc;
+	struct acrn_pit_counter *pc;
+	struct channel *c;
+
+	tc = vcounter_page();
+	if (tc == NULL)
+		return;
+
+	pc = &tc->pit[channel];
+	vcounter_write_begin(&pc->seq);
+	if (vpit != NULL) {
+		c = &vpit->channel[channel];
+		/* a pending latch or status is read from the device model first */
+		pc->valid = c->initial != 0 && c->olbyte == 0 && !c->slatched;
+		pc->mode = c->mode >> 1;
+		pc->initial = c->initial;
+		pc->tsc = c->start_tsc;
+	} else
+		pc->valid = 0;
+	vcounter_write_end(&pc->seq);
+}
+
 static bool
 pit_cntr0_timer_running(struct vpit *vpit)
 {
@@ -195,6 +236,7 @@ pit_load_ce(struct channel *c)
 
 		if (clock_gettime(CLOCK_REALTIME, &c->start_ts))
 			errx(EX_SOFTWARE, "clock_gettime returned: %s", strerror(errno));
+		c->start_tsc = vcounter_rdtsc();
 
 		if (c->initial == 0 || c->initial > 0x10000) {
 			warnx("vpit invalid initial count: 0x%x - use 0x10000",
@@ -239,6 +281,7 @@ vpit_timer_handler(union sigval s)
 
 	/* CR -> CE if necessary */
 	pit_load_ce(c);
+	vpit_publish(vpit, arg->channel_num);
 
 done:
 	VPIT_UNLOCK();
@@ -364,8 +407,9 @@ pit_update_counter(struct vpit *vpit, struct channel *c, bool latch,
 		delta_ticks = 0;
 		if (clock_gettime(CLOCK_REALTIME, &c->start_ts))
 			errx(EX_SOFTWARE, "clock_gettime returned: %s", strerror(errno));
+		c->start_tsc = vcounter_rdtsc();
 	} else
-		delta_ticks = ticks_elapsed_since(&c->start_ts);
+		delta_ticks = ticks_elapsed_since(c);
 
 	switch (c->mode) {
 	case TIMER_INTTC:
@@ -519,7 +563,7 @@ vpit_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 	struct vpit *vpit = ctx->vpit;
 	struct channel *c;
 	uint8_t val;
-	int error = 0;
+	int error = 0, i;
 
 	if (bytes != 1) {
 		warnx("vpit invalid operation size: %d bytes", bytes);
@@ -536,6 +580,8 @@ vpit_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 
 		VPIT_LOCK();
 		error = vpit_update_mode(vpit, val);
+		for (i = 0; i < nitems(vpit->channel); i++)
+			vpit_publish(vpit, i);
 		VPIT_UNLOCK();
 
 		return error;
@@ -620,6 +666,7 @@ vpit_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 	}
 
 done:
+	vpit_publish(vpit, port - TIMER_CNTR0);
 	VPIT_UNLOCK();
 
 	return error;
@@ -639,7 +686,7 @@ vpit_nmisc_handler(struct vmctx *ctx, int vcpu, int in, int port, int bytes,
 
 		VPIT_LOCK();
 
-		if (vpit_get_out(vpit, 2, ticks_elapsed_since(&c->start_ts))) {
+		if (vpit_get_out(vpit, 2, ticks_elapsed_since(c))) {
 			*eax = TMR2_OUT_STS;
 		} else {
 			*eax = 0;
@@ -680,6 +727,8 @@ vpit_init(struct vmctx *ctx)
 	}
 
 	ctx->vpit = vpit;
+	for (i = 0; i < nitems(vpit->channel); i++)
+		vpit_publish(vpit, i);
 
 	VPIT_UNLOCK();
 
@@ -695,6 +744,7 @@ void
 vpit_deinit(struct vmctx *ctx)
 {
 	struct vpit *vpit;
+	int i;
 
 	VPIT_LOCK();
 
@@ -705,6 +755,8 @@ vpit_deinit(struct vmctx *ctx)
 
 	ctx->vpit = NULL;
 	pit_timer_stop_cntr0(vpit, NULL);
+	for (i = 0; i < nitems(vpit->channel); i++)
+		vpit_publish(NULL, i);
 	memset(vpit_timer_arg, 0, sizeof(vpit_timer_arg));
 
 done:
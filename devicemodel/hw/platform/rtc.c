@@ -43,6 +43,7 @@
 #include "lpc.h"
 
 #include "log.h"
+#include "pioreg.h"
 
 /* #define DEBUG_RTC */
 #ifdef DEBUG_RTC
@@ -78,6 +79,8 @@ struct vrtc {
 	struct acrn_timer update_timer;     /* timer for update interrupt */
 	struct acrn_timer periodic_timer;   /* timer for periodic interrupt */
 	u_int		addr;               /* RTC register to read or write */
+	struct acrn_pio_reg *addr_reg;      /* addr latched by the hypervisor */
+	bool		hv_emulated;        /* served by the hypervisor instead */
 	time_t		base_uptime;
 	time_t		base_rtctime;
 	struct rtcdev	rtcdev;
@@ -188,6 +191,13 @@ u_char const bin2bcd_data[] = {
 
 static void vrtc_set_reg_c(struct vrtc *vrtc, uint8_t newval);
 
+/*
+ * The RTC page the hypervisor emulates the RTC from, the NVRAM it keeps
+ * there outlives the resets of the VM as it does on hardware.
+ */
+static struct acrn_vrtc hv_vrtc;
+static bool hv_vrtc_nvram;
+
 static int rtc_flag_broken_time = 1;
 
 static inline int
@@ -877,6 +887,7 @@ vrtc_addr_handler(struct vmctx *ctx, int vcpu, int in, int port,
 
 	pthread_mutex_lock(&vrtc->mtx);
 	vrtc->addr = *eax & 0x7f;
+	pioreg_set(vrtc->addr_reg, vrtc->addr);
 	pthread_mutex_unlock(&vrtc->mtx);
 
 	return 0;
@@ -898,6 +909,8 @@ vrtc_data_handler(struct vmctx *ctx, int vcpu, int in, int port,
 		return -1;
 
 	pthread_mutex_lock(&vrtc->mtx);
+	if (vrtc->addr_reg != NULL)
+		vrtc->addr = pioreg_get(vrtc->addr_reg);
 	offset = vrtc->addr;
 	if (offset >= sizeof(struct rtcdev)) {
 		pthread_mutex_unlock(&vrtc->mtx);
@@ -1018,6 +1031,15 @@ vrtc_init(struct vmctx *ctx)
 	 * 0x34/0x35 - 64KB chunks above 16MB, below 4GB
 	 * 0x5b/0x5c/0x5d - 64KB chunks above 4GB
 	 */
+	/* the NVRAM the guest wrote before a reset, the memory cells aside */
+	if (hv_vrtc_nvram) {
+		rtc = &vrtc->rtcdev;
+		memcpy(rtc->nvram, &hv_vrtc.cmos[offsetof(struct rtcdev, nvram)],
+			sizeof(rtc->nvram));
+		memcpy(rtc->nvram2, &hv_vrtc.cmos[offsetof(struct rtcdev, nvram2)],
+			sizeof(rtc->nvram2));
+	}
+
 	lomem = vm_get_lowmem_size(ctx);
 	if (lomem < 16 * MB) {
 		err = -EINVAL;
@@ -1087,6 +1109,10 @@ vrtc_init(struct vmctx *ctx)
 	/* Reset the index register to a safe value. */
 	vrtc->addr = RTC_STATUSD;
 
+	/* the index writes need no exit, the reads still return 0xff */
+	vrtc->addr_reg = pioreg_add(IO_RTC, 1, ACRN_PIO_REG_FLAG_LATCH,
+			vrtc->addr, 0x7f);
+
 	/*
 	 * Initialize RTC time to 00:00:00 Jan 1, 1970 if curtime = 0
 	 */
@@ -1106,7 +1132,23 @@ vrtc_init(struct vmctx *ctx)
 	/* init update interrupt timer(1s)*/
 	vrtc->update_timer.clockid = CLOCK_REALTIME;
 	acrn_timer_init(&vrtc->update_timer, vrtc_update_timer, vrtc);
-	vrtc_start_timer(&vrtc->update_timer, 1, 0);
+
+	/*
+	 * Hand the RTC over to the hypervisor, the guest accesses of the
+	 * ports and the interrupts stay there, only the NVRAM comes back.
+	 * The emulation here is kept for the hypervisors without it.
+	 */
+	hv_vrtc.rtc_time = curtime;
+	memcpy(hv_vrtc.cmos, &vrtc->rtcdev, sizeof(hv_vrtc.cmos));
+	if (vm_set_vrtc(ctx, &hv_vrtc) == 0) {
+		vrtc->hv_emulated = true;
+		hv_vrtc_nvram = true;
+		pioreg_del(vrtc->addr_reg);
+		vrtc->addr_reg = NULL;
+	} else {
+		pr_info("rtc in hv unsupported, errno %d\n", errno);
+		vrtc_start_timer(&vrtc->update_timer, 1, 0);
+	}
 
 	return 0;
 
@@ -1125,6 +1167,8 @@ vrtc_deinit(struct vmctx *ctx)
 	acrn_timer_deinit(&vrtc->periodic_timer);
 	acrn_timer_deinit(&vrtc->update_timer);
 
+	pioreg_del(vrtc->addr_reg);
+
 	memset(&iop, 0, sizeof(struct inout_port));
 	iop.name = "rtc";
 	iop.port = IO_RTC;
@@ -8,6 +8,7 @@
 
 #include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include "usb.h"
@@ -19,6 +20,8 @@
 
 static struct usb_dev_sys_ctx_info g_ctx;
 static uint16_t usb_dev_get_ep_maxp(struct usb_dev *udev, int pid, int epnum);
+static inline struct usb_dev_ep *usb_dev_get_ep(struct usb_dev *udev, int pid,
+		int ep);
 
 static bool
 usb_get_native_devinfo(struct libusb_device *ldev,
@@ -163,6 +166,61 @@ libusb_speed_to_usb_speed(int libusb_speed)
 	return speed;
 }
 
+static void
+usb_dev_free_req(struct usb_dev_req *req)
+{
+	if (req->trn)
+		libusb_free_transfer(req->trn);
+	free(req->pool_buf);
+	free(req);
+}
+
+/* back to the pool of its endpoint, freed if the pool is full */
+static void
+usb_dev_put_req(struct usb_dev_req *req)
+{
+	struct usb_dev *udev = req->udev;
+	struct usb_dev_ep *ep = req->ep;
+
+	pthread_mutex_lock(&udev->pool_mtx);
+	if (ep && ep->pool_cnt < USB_DEV_REQ_POOL) {
+		req->next = ep->pool;
+		ep->pool = req;
+		ep->pool_cnt++;
+		req = NULL;
+	}
+	pthread_mutex_unlock(&udev->pool_mtx);
+
+	if (req)
+		usb_dev_free_req(req);
+}
+
+static void
+usb_dev_drain_ep(struct usb_dev_ep *ep)
+{
+	struct usb_dev_req *req;
+
+	while ((req = ep->pool) != NULL) {
+		ep->pool = req->next;
+		usb_dev_free_req(req);
+	}
+	ep->pool_cnt = 0;
+}
+
+static void
+usb_dev_drain_reqs(struct usb_dev *udev)
+{
+	int i;
+
+	pthread_mutex_lock(&udev->pool_mtx);
+	usb_dev_drain_ep(&udev->epc);
+	for (i = 0; i < USB_NUM_ENDPOINT; i++) {
+		usb_dev_drain_ep(&udev->epi[i]);
+		usb_dev_drain_ep(&udev->epo[i]);
+	}
+	pthread_mutex_unlock(&udev->pool_mtx);
+}
+
 static void
 usb_dev_comp_cb(struct libusb_transfer *trn)
 {
@@ -275,7 +333,7 @@ usb_dev_comp_cb(struct libusb_transfer *trn)
 
 			if (block->type == USB_DATA_PART ||
 					block->type == USB_DATA_FULL) {
-				if (r->in == TOKEN_IN) {
+				if (r->in == TOKEN_IN && !r->direct) {
 					memcpy(block->buf, buf + buf_idx, d);
 					buf_idx += d;
 				}
@@ -314,58 +372,121 @@ out:
 		g_ctx.intr_cb(xfer->dev, NULL);
 
 cancel_out:
-	/* unlock and release memory */
+	/* unlock and give the request back to its endpoint */
 	g_ctx.unlock_ep_cb(xfer->dev, &xfer->epid);
 
-	if (r && r->buffer)
-		free(r->buffer);
-
 	xfer->reqs[r->blk_head] = NULL;
-	free(r);
+	usb_dev_put_req(r);
+	return;
+
 free_transfer:
 	libusb_free_transfer(trn);
 }
 
+/*
+ * A request of endpoint epnum, taken from its pool if it has one with
+ * enough iso packets. With direct, the transfer is done in place in the
+ * guest memory instead of through the bounce buffer.
+ */
 static struct usb_dev_req *
 usb_dev_alloc_req(struct usb_dev *udev, struct usb_xfer *xfer, int in,
-		size_t size, size_t count)
+		int epnum, size_t size, size_t count, uint8_t *direct)
 {
 	struct usb_dev_req *req;
+	struct usb_dev_ep *ep;
 	static int seq = 1;
 
-	if (!udev || !xfer || count < 0)
+	if (!udev || !xfer || count < 0 || !size)
 		return NULL;
 
-	req = calloc(1, sizeof(*req));
-	if (!req)
-		return NULL;
+	ep = usb_dev_get_ep(udev, in, epnum);
+	req = NULL;
+	pthread_mutex_lock(&udev->pool_mtx);
+	if (ep && ep->pool) {
+		req = ep->pool;
+		ep->pool = req->next;
+		ep->pool_cnt--;
+	}
+	pthread_mutex_unlock(&udev->pool_mtx);
+
+	if (req && req->niso < count) {
+		usb_dev_free_req(req);
+		req = NULL;
+	}
+
+	if (req) {
+		/* the fill functions leave these alone */
+		req->trn->flags = 0;
+		req->trn->num_iso_packets = 0;
+		memset(req->trn->iso_packet_desc, 0,
+			req->niso * sizeof(req->trn->iso_packet_desc[0]));
+	} else {
+		req = calloc(1, sizeof(*req));
+		if (!req)
+			return NULL;
+
+		req->trn = libusb_alloc_transfer(count);
+		if (!req->trn)
+			goto errout;
+		req->niso = count;
+	}
 
 	req->udev = udev;
 	req->in = in;
 	req->xfer = xfer;
+	req->ep = ep;
+	req->next = NULL;
 	req->seq = seq++;
-	req->trn = libusb_alloc_transfer(count);
-	if (!req->trn)
-		goto errout;
-
-	if (size)
-		req->buffer = malloc(size);
-
-	if (!req->buffer)
-		goto errout;
+	req->direct = (direct != NULL);
+	if (direct) {
+		req->buffer = direct;
+		return req;
+	}
 
+	if (size > req->buf_cap) {
+		free(req->pool_buf);
+		req->buf_cap = 0;
+		req->pool_buf = malloc(size);
+		if (!req->pool_buf)
+			goto errout;
+		req->buf_cap = size;
+	}
+	req->buffer = req->pool_buf;
 	return req;
 
 errout:
-	if (req && req->buffer)
-		free(req->buffer);
-	if (req && req->trn)
-		libusb_free_transfer(req->trn);
-	if (req)
-		free(req);
+	usb_dev_free_req(req);
 	return NULL;
 }
 
+/*
+ * The data blocks of a transfer contiguous in the guest memory mapping,
+ * as the TRBs of one large guest buffer usually are: returns where they
+ * start, for libusb to read or write them in place.
+ */
+static uint8_t *
+usb_dev_direct_buf(struct usb_xfer *xfer, int head, int tail, int size)
+{
+	struct usb_block *b;
+	uint8_t *start = NULL, *end = NULL;
+	int idx;
+
+	for (idx = head; index_valid(head, tail, xfer->max_blk_cnt, idx);
+			idx = index_inc(idx, xfer->max_blk_cnt)) {
+		b = &xfer->data[idx];
+		if (b->type != USB_DATA_PART && b->type != USB_DATA_FULL)
+			continue;
+
+		if (!start)
+			start = end = b->buf;
+		else if ((uint8_t *)b->buf != end)
+			return NULL;
+		end += b->blen;
+	}
+
+	return (start && end - start == size) ? start : NULL;
+}
+
 static int
 usb_dev_prepare_xfer(struct usb_xfer *xfer, int *head, int *tail)
 {
@@ -801,8 +922,10 @@ usb_dev_data(void *pdata, struct usb_xfer *xfer, int dir, int epctx)
 				framelen, framecnt);
 	}
 
-	r = usb_dev_alloc_req(udev, xfer, dir, size, type ==
-			USB_ENDPOINT_ISOC ? framecnt : 0);
+	r = usb_dev_alloc_req(udev, xfer, dir, epctx, size,
+			type == USB_ENDPOINT_ISOC ? framecnt : 0,
+			type == USB_ENDPOINT_BULK ?
+			usb_dev_direct_buf(xfer, head, tail, size) : NULL);
 	if (!r) {
 		xfer->status = USB_ERR_IOERROR;
 		goto done;
@@ -819,7 +942,7 @@ usb_dev_data(void *pdata, struct usb_xfer *xfer, int dir, int epctx)
 			r->blk_head, r->blk_tail, r->buf_size, dir_str[dir],
 			type_str[type]);
 
-	if (!dir) {
+	if (!dir && !r->direct) {
 		for (idx = head, buf_idx = 0;
 				index_valid(head, tail, xfer->max_blk_cnt, idx);
 				idx = index_inc(idx, xfer->max_blk_cnt)) {
@@ -871,18 +994,18 @@ usb_dev_data(void *pdata, struct usb_xfer *xfer, int dir, int epctx)
 
 	} else {
 		UPRINTF(LFTL, "%s: wrong endpoint type %d\r\n", __func__, type);
-		if (r->buffer)
-			free(r->buffer);
-		if (r->trn)
-			libusb_free_transfer(r->trn);
-		free(r);
+		xfer->reqs[head] = NULL;
+		usb_dev_put_req(r);
 		xfer->status = USB_ERR_INVAL;
+		goto done;
 	}
 
 	rc = libusb_submit_transfer(r->trn);
 	if (rc) {
 		xfer->status = USB_ERR_IOERROR;
 		UPRINTF(LDBG, "libusb_submit_transfer fail: %d\n", rc);
+		xfer->reqs[head] = NULL;
+		usb_dev_put_req(r);
 	}
 done:
 	return xfer->status;
@@ -1087,6 +1210,7 @@ usb_dev_init(void *pdata, char *opt)
 	udev->info    = *di;
 	udev->version = ver;
 	udev->handle  = NULL;
+	pthread_mutex_init(&udev->pool_mtx, NULL);
 
 	/* configure physical device through libusb library */
 	if (libusb_open(udev->info.priv_data, &udev->handle)) {
@@ -1123,6 +1247,8 @@ usb_dev_deinit(void *pdata)
 						rc);
 			libusb_close(udev->handle);
 		}
+		usb_dev_drain_reqs(udev);
+		pthread_mutex_destroy(&udev->pool_mtx);
 		free(udev);
 	}
 }
@@ -1239,6 +1365,25 @@ usb_dev_native_sys_disconn_cb(struct libusb_context *ctx, struct libusb_device
 	return 0;
 }
 
+/* libusb_init() walks all the native devices, the slow part of the init */
+int
+usb_dev_sys_prepare(void)
+{
+	int rc;
+
+	if (g_ctx.libusb_ctx)
+		return 0;
+
+	rc = libusb_init(&g_ctx.libusb_ctx);
+	if (rc < 0) {
+		g_ctx.libusb_ctx = NULL;
+		UPRINTF(LFTL, "libusb_init fails, rc:%d\r\n", rc);
+		return -1;
+	}
+
+	return 0;
+}
+
 int
 usb_dev_sys_init(usb_dev_sys_cb conn_cb, usb_dev_sys_cb disconn_cb,
 		usb_dev_sys_cb notify_cb, usb_dev_sys_cb intr_cb,
@@ -1255,16 +1400,13 @@ usb_dev_sys_init(usb_dev_sys_cb conn_cb, usb_dev_sys_cb disconn_cb,
 
 	usb_set_log_level(log_level);
 
-	if (g_ctx.libusb_ctx) {
+	if (g_ctx.hci_data) {
 		UPRINTF(LFTL, "port mapper is already initialized.\r\n");
 		return -1;
 	}
 
-	rc = libusb_init(&g_ctx.libusb_ctx);
-	if (rc < 0) {
-		UPRINTF(LFTL, "libusb_init fails, rc:%d\r\n", rc);
+	if (usb_dev_sys_prepare() < 0)
 		return -1;
-	}
 
 	g_ctx.hci_data     = hci_data;
 	g_ctx.conn_cb      = conn_cb;
@@ -1328,6 +1470,7 @@ errout:
 		libusb_exit(g_ctx.libusb_ctx);
 		g_ctx.libusb_ctx = NULL;
 	}
+	g_ctx.hci_data = NULL;
 	return -1;
 }
 
@@ -1337,6 +1480,13 @@ usb_dev_sys_deinit(void)
 	if (!g_ctx.libusb_ctx)
 		return;
 
+	/* only prepared */
+	if (!g_ctx.hci_data) {
+		libusb_exit(g_ctx.libusb_ctx);
+		g_ctx.libusb_ctx = NULL;
+		return;
+	}
+
 	UPRINTF(LINF, "port-mapper de-initialization\r\n");
 	libusb_hotplug_deregister_callback(g_ctx.libusb_ctx, g_ctx.conn_handle);
 	libusb_hotplug_deregister_callback(g_ctx.libusb_ctx,
@@ -1344,6 +1494,7 @@ usb_dev_sys_deinit(void)
 
 	g_ctx.thread_exit = 1;
 	pthread_join(g_ctx.thread, NULL);
+	g_ctx.hci_data = NULL;
 
 	if (g_ctx.devlist) {
 		libusb_free_device_list(g_ctx.devlist, 1);
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "vmmapi.h"
+#include "log.h"
+#include "vcounter.h"
+
+static struct acrn_timer_counters vcounter;
+static bool vcounter_enabled;
+
+void
+vcounter_init(struct vmctx *ctx)
+{
+	vcounter_enabled = false;
+	bzero(&vcounter, sizeof(vcounter));
+	if (vm_set_timer_counters(ctx, &vcounter) != 0)
+		pr_info("timer counters in hv unsupported, errno %d\n", errno);
+	else if (vcounter.tsc_khz == 0)
+		pr_info("timer counters in hv: unknown tsc frequency\n");
+	else
+		vcounter_enabled = true;
+}
+
+struct acrn_timer_counters *
+vcounter_page(void)
+{
+	return vcounter_enabled ? &vcounter : NULL;
+}
+
+uint64_t
+vcounter_ticks(uint64_t tsc_delta, uint64_t freq)
+{
+	uint64_t tsc_hz = (uint64_t)vcounter.tsc_khz * 1000;
+
+	return (tsc_delta / tsc_hz) * freq +
+		(tsc_delta % tsc_hz) * freq / tsc_hz;
+}
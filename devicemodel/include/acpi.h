@@ -29,6 +29,8 @@
 #ifndef _ACPI_H_
 #define _ACPI_H_
 
+#include <stdbool.h>
+
 #define	SCI_INT			9
 
 #define	SMI_CMD			0xb2
@@ -37,6 +39,15 @@
 
 #define	PM1A_EVT_ADDR		0x400
 
+/* GPE0 status and enable registers, two bytes each */
+#define	GPE0_BLK_ADDR		0x420
+#define	GPE0_BLK_LEN		4
+
+/* vCPU hotplug registers, see cpu_hotplug.c */
+#define	CPU_HOTPLUG_ADDR	0xcd8
+#define	CPU_HOTPLUG_LEN		12
+#define	CPU_HOTPLUG_GPE		2
+
 #define	IO_PMTMR		0x0	/* PM Timer is disabled in ACPI */
 
 /* All dynamic table entry no. */
@@ -62,5 +73,14 @@ void	pm_backto_wakeup(struct vmctx *ctx);
 void	inject_power_button_event(struct vmctx *ctx);
 void	power_button_init(struct vmctx *ctx);
 void	power_button_deinit(struct vmctx *ctx);
+void	gpe_raise(struct vmctx *ctx, int gpe);
+
+void	cpu_hotplug_init(int ncpu, int max_cpus);
+int	cpu_hotplug_ncpus(void);
+bool	cpu_hotplug_enabled(void);
+bool	cpu_hotplug_present(int cpu);
+void	cpu_hotplug_write_dsdt(void);
+int	cpu_hotplug_add(struct vmctx *ctx, int pcpu);
+int	cpu_hotplug_remove(struct vmctx *ctx, int vcpu);
 
 #endif /* _ACPI_H_ */
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * Read cache for blockif.
+ *
+ * One size-bounded cache of the blocks read by the guests, shared by all
+ * the blockif contexts of the device model that open the same image. The
+ * blocks stay in the cache when the image is closed, so the boot-time
+ * reads of a rebooting UOS are served from memory.
+ */
+
+#ifndef _BLOCK_CACHE_H_
+#define _BLOCK_CACHE_H_
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+struct blockif_cache;
+
+/* Read len bytes at off of the image, like pread() */
+typedef ssize_t (*blockif_cache_read_t)(void *arg, void *buf, size_t len,
+		off_t off);
+
+/**
+ * @brief Get the cache of the image on fd.
+ *
+ * @param fd File descriptor of the image.
+ * @param base Where the blockif offsets start in the file, -1 when they
+ *	  are not file offsets (an overlay).
+ * @param size_mb Upper bound of the memory of the whole cache, in MiB.
+ *
+ * @return Pointer to the cache of the image, NULL on failure.
+ */
+struct blockif_cache *blockif_cache_get(int fd, off_t base, size_t size_mb);
+
+/**
+ * @brief Drop a reference to the cache of the image on fd.
+ *
+ * The cached blocks are kept, they are dropped on the next get if the
+ * image is changed in between.
+ *
+ * @return None
+ */
+void blockif_cache_put(struct blockif_cache *cache, int fd);
+
+/**
+ * @brief Read through the cache, like preadv().
+ *
+ * The misses are read with rd(arg, ...) in whole cache blocks.
+ *
+ * @return The number of bytes read, or -1 with errno set.
+ */
+ssize_t blockif_cache_preadv(struct blockif_cache *cache,
+		blockif_cache_read_t rd, void *arg,
+		const struct iovec *iov, int iovcnt, off_t offset);
+
+/**
+ * @brief Read ahead after a sequential stream of reads, if any. Called
+ * after the completion of the request that was read.
+ *
+ * @return None
+ */
+void blockif_cache_readahead(struct blockif_cache *cache,
+		blockif_cache_read_t rd, void *arg);
+
+/**
+ * @brief Drop the cached blocks overlapping [offset, offset + len).
+ *
+ * @return None
+ */
+void blockif_cache_invalidate(struct blockif_cache *cache, off_t offset,
+		off_t len);
+
+#endif /* _BLOCK_CACHE_H_ */
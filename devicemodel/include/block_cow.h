@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * Copy-on-write overlay images for blockif.
+ *
+ * An overlay only holds the clusters written by the guest, the others are
+ * read from a read-only backing image that can be shared by many UOSes
+ * (and keeps a single copy in the SOS page cache).
+ */
+
+#ifndef _BLOCK_COW_H_
+#define _BLOCK_COW_H_
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+struct blockif_cow;
+
+/**
+ * @brief Open the overlay image on fd over the backing image.
+ *
+ * An empty overlay is formatted with the size of the backing image.
+ *
+ * @param fd File descriptor of the overlay image.
+ * @param backing Path of the backing image, opened read-only.
+ * @param ro Whether the overlay is opened for read only.
+ * @param size Returns the virtual size of the disk.
+ *
+ * @return Pointer to the overlay on success, NULL on failure.
+ */
+struct blockif_cow *blockif_cow_open(int fd, const char *backing, int ro,
+		off_t *size);
+
+/**
+ * @brief Release the overlay, fd is left to the caller.
+ *
+ * @param cow Pointer to the overlay.
+ *
+ * @return None
+ */
+void blockif_cow_close(struct blockif_cow *cow);
+
+/**
+ * @brief Read from the virtual disk, like preadv().
+ *
+ * @return The number of bytes read, or -1 with errno set.
+ */
+ssize_t blockif_cow_preadv(struct blockif_cow *cow, const struct iovec *iov,
+		int iovcnt, off_t offset);
+
+/**
+ * @brief Write to the virtual disk, like pwritev(). Clusters not in the
+ * overlay yet are copied from the backing image first.
+ *
+ * @return The number of bytes written, or -1 with errno set.
+ */
+ssize_t blockif_cow_pwritev(struct blockif_cow *cow, const struct iovec *iov,
+		int iovcnt, off_t offset);
+
+#endif /* _BLOCK_COW_H_ */
@@ -50,8 +50,35 @@ struct blockif_req {
 	void		*param;
 };
 
+#define BLOCKIF_STAT_OPS	4	/* read, write, flush, discard and write zeroes */
+#define BLOCKIF_LAT_BUCKETS	20	/* log2 of the latency in us */
+#define BLOCKIF_QD_BUCKETS	8	/* log2 of the queue depth */
+
+/*
+ * Counters of the completed requests of one op. lat_hist[i] counts the
+ * requests which took [2^i, 2^(i+1)) us from their submission to their
+ * completion, the first and the last buckets also count the ones below
+ * and above.
+ */
+struct blockif_op_stats {
+	uint64_t	ops;
+	uint64_t	bytes;
+	uint64_t	merged;		/* merged into the previous request */
+	uint64_t	errors;
+	uint64_t	lat_us;		/* sum of the latencies */
+	uint64_t	lat_hist[BLOCKIF_LAT_BUCKETS];
+};
+
+struct blockif_stats {
+	struct blockif_op_stats	op[BLOCKIF_STAT_OPS];
+	uint64_t	inflight;	/* requests queued or in progress */
+	/* queue depth seen by each new request, itself included */
+	uint64_t	qd_hist[BLOCKIF_QD_BUCKETS];
+};
+
 struct blockif_ctxt;
 struct blockif_ctxt *blockif_open(const char *optstr, const char *ident);
+struct blockif_ctxt *blockif_clone(struct blockif_ctxt *bc, const char *ident);
 off_t	blockif_size(struct blockif_ctxt *bc);
 void	blockif_chs(struct blockif_ctxt *bc, uint16_t *c, uint8_t *h,
 		    uint8_t *s);
@@ -60,17 +87,33 @@ void	blockif_psectsz(struct blockif_ctxt *bc, int *size, int *off);
 int	blockif_queuesz(struct blockif_ctxt *bc);
 int	blockif_is_ro(struct blockif_ctxt *bc);
 int	blockif_candiscard(struct blockif_ctxt *bc);
+int	blockif_canzero(struct blockif_ctxt *bc);
+void	blockif_plug(struct blockif_ctxt *bc);
+void	blockif_unplug(struct blockif_ctxt *bc);
 int	blockif_read(struct blockif_ctxt *bc, struct blockif_req *breq);
 int	blockif_write(struct blockif_ctxt *bc, struct blockif_req *breq);
 int	blockif_flush(struct blockif_ctxt *bc, struct blockif_req *breq);
 int	blockif_discard(struct blockif_ctxt *bc, struct blockif_req *breq);
+int	blockif_write_zeroes(struct blockif_ctxt *bc, struct blockif_req *breq);
 int	blockif_cancel(struct blockif_ctxt *bc, struct blockif_req *breq);
 int	blockif_close(struct blockif_ctxt *bc);
 uint8_t	blockif_get_wce(struct blockif_ctxt *bc);
 void	blockif_set_wce(struct blockif_ctxt *bc, uint8_t wce);
 int	blockif_flush_all(struct blockif_ctxt *bc);
+int	blockif_set_qos(struct blockif_ctxt *bc, const char *opts);
+/*
+ * cb is called once the callbacks of a batch of completions ran, in the
+ * same thread, e.g. to raise one interrupt for them all. The block i/o
+ * threads complete one request at a time, the async engines all the
+ * requests they reaped at once.
+ */
+void	blockif_set_batch_cb(struct blockif_ctxt *bc, void (*cb)(void *),
+			     void *arg);
+void	blockif_get_stats(struct blockif_ctxt *bc, struct blockif_stats *st);
 int	blockif_max_discard_sectors(struct blockif_ctxt *bc);
 int	blockif_max_discard_seg(struct blockif_ctxt *bc);
 int	blockif_discard_sector_alignment(struct blockif_ctxt *bc);
+int	blockif_max_zero_sectors(struct blockif_ctxt *bc);
+int	blockif_max_zero_seg(struct blockif_ctxt *bc);
 
 #endif /* _BLOCK_IF_H_ */
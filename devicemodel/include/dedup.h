@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * Scanner of the guest pages found identical within the VM, or with the
+ * other VMs scanned on the SOS.
+ *
+ * Every interval the guest memory is hashed per 4K page and per 2M chunk.
+ * The sorted hashes are published in a file of /dev/shm named after the VM,
+ * the files of the other VMs are compared with the own ones and a summary
+ * is logged. Pages are not merged: the guest memory is hugetlbfs memory,
+ * only whole huge pages go back to the pool, and a page shared by two VMs
+ * would need the device models of both to write-protect it.
+ */
+
+#ifndef _DEDUP_H_
+#define _DEDUP_H_
+
+#include "vmmapi.h"
+
+/* Path of the file of hashes published by the VM */
+#define DEDUP_PATH		"/dev/shm/acrn_dedup.%s"
+#define DEDUP_PATH_GLOB		"/dev/shm/acrn_dedup.*"
+
+#define DEDUP_MAGIC		0x50554445444e5241UL	/* "ARNDEDUP" */
+
+/* followed by npages then nchunks sorted uint64_t hashes */
+struct dedup_header {
+	uint64_t magic;
+	uint64_t npages;
+	uint64_t nchunks;
+};
+
+/**
+ * @brief Parse the --dedup_scan option, the scan interval in seconds.
+ *
+ * @param arg Option argument.
+ *
+ * @return 0 on success, -1 on invalid argument.
+ */
+int dedup_parse_interval(const char *arg);
+
+/**
+ * @brief Start the scanner thread if --dedup_scan is given.
+ *
+ * A failure is not fatal, the VM runs without the scanner.
+ *
+ * @param ctx Pointer to the VM context.
+ *
+ * @return None
+ */
+void dedup_scan_init(struct vmctx *ctx);
+
+/**
+ * @brief Stop the scanner and remove the published hashes.
+ *
+ * @return None
+ */
+void dedup_scan_deinit(void);
+
+#endif /* _DEDUP_H_ */
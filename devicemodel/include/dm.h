@@ -67,4 +67,7 @@ size_t high_bios_size(void);
 void ptdev_no_reset(bool enable);
 void init_debugexit(void);
 void deinit_debugexit(void);
+void add_hotplug_cpu(struct vmctx *ctx, int vcpu);
+/* reqs[] of DM_STATS_IOREQ_TYPES, see dm_stats.h */
+void ioreq_get_stats(uint64_t *reqs, uint64_t *rounds);
 #endif
@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * Statistics of the device model, for acrnd and the other monitors of the
+ * SOS.
+ *
+ * Once per DM_STATS_INTERVAL_MS, the mevent thread of the DM copies the
+ * counters of the ioreq dispatch, of the mevent loops, of the virtqueues
+ * and of the block backends into one struct dm_stats_region, in a file of
+ * /dev/shm named after the VM. A monitor maps the regions of all the VMs
+ * read-only and reads them with dm_stats_read(), without a request to, nor
+ * a wakeup of, any DM.
+ *
+ * The region is versioned by DM_STATS_VERSION and protected by a seqlock:
+ * seq is odd while the DM updates the region.
+ */
+
+#ifndef _DM_STATS_H_
+#define _DM_STATS_H_
+
+#include <stdint.h>
+#include <string.h>
+
+/* Path of the file holding the region of the VM */
+#define DM_STATS_DIR		"/dev/shm"
+#define DM_STATS_PREFIX		"acrn_dm_stats."
+#define DM_STATS_PATH		DM_STATS_DIR "/" DM_STATS_PREFIX "%s"
+
+#define DM_STATS_MAGIC		0x5354534dU	/* "MSTS" */
+#define DM_STATS_VERSION	1U
+#define DM_STATS_INTERVAL_MS	1000U
+
+#define DM_STATS_NAME_LEN	32
+#define DM_STATS_IOREQ_TYPES	3	/* pio, mmio, pci cfg, as enum vm_exitcode */
+#define DM_STATS_BLK_OPS	4	/* read, write, flush, discard and write zeroes */
+#define DM_STATS_MAX_BLK	32
+#define DM_STATS_MAX_VQ		128
+
+/* The counters are totals since the DM started, or since the last full reset */
+struct dm_stats_ioreq {
+	uint64_t	reqs[DM_STATS_IOREQ_TYPES];	/* emulated, by type */
+	uint64_t	rounds;		/* completions notified at once */
+};
+
+struct dm_stats_mevent {
+	uint64_t	wakeups;	/* epoll_wait() returns, all the loops */
+	uint64_t	events;		/* events dispatched */
+};
+
+struct dm_stats_vq {
+	char		name[DM_STATS_NAME_LEN];	/* <pci device>/<queue> */
+	uint64_t	notifies;	/* kicks of the guest */
+	uint64_t	used;		/* buffers returned to the guest */
+	uint64_t	interrupts;	/* raised to the guest */
+};
+
+struct dm_stats_blk {
+	char		name[DM_STATS_NAME_LEN];	/* ident of the backend */
+	uint64_t	ops[DM_STATS_BLK_OPS];
+	uint64_t	bytes[DM_STATS_BLK_OPS];
+	uint64_t	errors[DM_STATS_BLK_OPS];
+	uint64_t	lat_us[DM_STATS_BLK_OPS];	/* sum of the latencies */
+	uint64_t	inflight;
+};
+
+struct dm_stats_region {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	size;		/* of the region */
+	uint32_t	seq;		/* odd while updated */
+	int32_t		pid;		/* of the DM */
+	uint32_t	interval_ms;
+	uint64_t	update_ns;	/* CLOCK_MONOTONIC of the last update */
+	uint64_t	updates;
+
+	struct dm_stats_ioreq	ioreq;
+	struct dm_stats_mevent	mevent;
+
+	uint32_t	nvq;		/* entries in use */
+	uint32_t	nblk;
+	struct dm_stats_vq	vq[DM_STATS_MAX_VQ];
+	struct dm_stats_blk	blk[DM_STATS_MAX_BLK];
+};
+
+/**
+ * @brief Take a consistent copy of a region mapped from its file.
+ *
+ * @param r Pointer to the mapped region.
+ * @param out Pointer to the copy.
+ *
+ * @return 0 on success, -1 if the region is not one of this version or is
+ *	   being updated for too long.
+ */
+static inline int
+dm_stats_read(const struct dm_stats_region *r, struct dm_stats_region *out)
+{
+	uint32_t seq;
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		seq = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1U)
+			continue;
+		memcpy(out, r, sizeof(*out));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&r->seq, __ATOMIC_RELAXED) != seq)
+			continue;
+
+		if (out->magic != DM_STATS_MAGIC ||
+		    out->version != DM_STATS_VERSION ||
+		    out->size != sizeof(*out))
+			return -1;
+		return 0;
+	}
+	return -1;
+}
+
+/*
+ * Sources of the entries of the vq[] and blk[] arrays. collect fills the
+ * entry pointed to by rec, a struct dm_stats_vq or dm_stats_blk without its
+ * name, from arg, in the mevent thread.
+ */
+enum dm_stats_type {
+	DM_STATS_TYPE_VQ = 0,
+	DM_STATS_TYPE_BLK,
+};
+
+typedef void (*dm_stats_collect_t)(void *arg, void *rec);
+
+/**
+ * @brief Add an entry of the region, until dm_stats_unregister(owner).
+ *
+ * @return 0 on success, -1 if out of memory.
+ */
+int dm_stats_register(enum dm_stats_type type, const char *name, void *owner,
+		dm_stats_collect_t collect, void *arg);
+
+/**
+ * @brief Remove all the entries of owner, collect is not called for them
+ *	  once it returns.
+ */
+void dm_stats_unregister(void *owner);
+
+/**
+ * @brief Create the region of the VM and start updating it.
+ *
+ * A failure is not fatal, the VM runs without the region.
+ */
+void dm_stats_init(void);
+
+/**
+ * @brief Stop updating the region and remove its file.
+ */
+void dm_stats_deinit(void);
+
+#endif /* _DM_STATS_H_ */
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * Record and replay of the ioreqs handled by the device model.
+ *
+ * --ioreq_record <file> writes each request handled by handle_vmexit(),
+ * as issued by the guest and with the value it got back, and the guest
+ * memory the device models map with vm_map_gpa_fast(), with its content
+ * at the time of the mapping: the virtqueue rings, descriptors and buffers.
+ *
+ * --ioreq_replay <file> runs the device model with the same device options
+ * but without the hypervisor: the guest memory is anonymous memory, the
+ * VHM ioctls are no-ops, and the requests of the trace are handled one
+ * after the other as fast as possible, after the guest memory they found
+ * has been restored. The time spent in each kind of request and the reads
+ * returning another value than the recorded one are reported on exit.
+ */
+
+#ifndef _IOREQ_TRACE_H_
+#define _IOREQ_TRACE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define IOREQ_TRACE_MAGIC	0x51524f494e524341UL	/* "ACRNIORQ" */
+#define IOREQ_TRACE_VERSION	1U
+
+/* larger mappings, the guest memory loaded by the software loaders, are not recorded */
+#define IOREQ_TRACE_MEM_MAX	(64UL * 1024UL)
+
+struct ioreq_trace_header {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t ncpus;
+	uint64_t lowmem;
+	uint64_t highmem;
+};
+
+#define IOREQ_TRACE_REQ		1U	/* followed by the struct vhm_request as issued */
+#define IOREQ_TRACE_MEM		2U	/* followed by len bytes of guest memory at gpa */
+
+struct ioreq_trace_record {
+	uint32_t kind;
+	uint32_t vcpu;
+	uint32_t len;
+	uint32_t reserved;
+	uint64_t gpa;
+	uint64_t value;		/* the value a read got */
+};
+
+struct vmctx;
+struct vhm_request;
+
+typedef int (*ioreq_trace_handler_t)(struct vmctx *ctx,
+		struct vhm_request *vhm_req, int vcpu);
+
+/* set while recording, checked inline by vm_map_gpa_fast() */
+extern bool ioreq_trace_recording;
+
+/**
+ * @brief Parse the --ioreq_record option.
+ *
+ * @param path The trace file to write.
+ *
+ * @return 0 on success, -1 with --ioreq_replay.
+ */
+int ioreq_trace_parse_record(const char *path);
+
+/**
+ * @brief Parse the --ioreq_replay option, and read the header of the trace.
+ *
+ * @param path The trace file to replay.
+ *
+ * @return 0 on success, -1 if the file is not a trace or with --ioreq_record.
+ */
+int ioreq_trace_parse_replay(const char *path);
+
+/**
+ * @brief Whether the device model replays a trace rather than runs a VM.
+ */
+bool ioreq_trace_replaying(void);
+
+/**
+ * @brief The number of vCPUs of the recorded VM, to replay its trace.
+ */
+int ioreq_trace_ncpus(void);
+
+/**
+ * @brief Start the recording, or check the trace against the replay VM.
+ *
+ * Called once the guest memory is set up.
+ *
+ * @param ctx Pointer to the VM context.
+ * @param ncpus Number of vCPUs of the VM.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int ioreq_trace_init(struct vmctx *ctx, int ncpus);
+
+/**
+ * @brief Stop the recording and close the trace.
+ */
+void ioreq_trace_deinit(void);
+
+/**
+ * @brief Record a handled request.
+ *
+ * @param issued The request as issued by the guest.
+ * @param done The request once handled.
+ * @param vcpu The vCPU of the request.
+ */
+void ioreq_trace_request(const struct vhm_request *issued,
+		const struct vhm_request *done, int vcpu);
+
+/**
+ * @brief Record guest memory mapped by a device model.
+ *
+ * @param gpa Guest physical address of the mapping.
+ * @param hva Host virtual address of the mapping.
+ * @param len Length of the mapping.
+ */
+void ioreq_trace_mem(uint64_t gpa, const void *hva, size_t len);
+
+/**
+ * @brief Replay the trace and report the time spent per kind of request.
+ *
+ * @param ctx Pointer to the VM context.
+ * @param req_buf The request slots of the vCPUs.
+ * @param handle The ioreq handler of the device model.
+ *
+ * @return 0 if the whole trace has been replayed, -1 otherwise.
+ */
+int ioreq_trace_replay(struct vmctx *ctx, struct vhm_request *req_buf,
+		ioreq_trace_handler_t handle);
+
+#endif
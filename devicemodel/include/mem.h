@@ -47,6 +47,27 @@ struct mem_range {
 #define	MEM_F_WRITE		0x2
 #define	MEM_F_RW		(MEM_F_READ | MEM_F_WRITE)
 #define	MEM_F_IMMUTABLE		0x4	/* mem_range cannot be unregistered */
+#define	MEM_F_CONCURRENT	0x8	/* handler serializes its own accesses */
+
+/*
+ * Serializes the I/O and MMIO handlers which are not registered with
+ * IOPORT_F_CONCURRENT/MEM_F_CONCURRENT, as the ioreqs of different vCPUs
+ * may be emulated concurrently (see --ioreq_threads).
+ */
+void	emul_lock(void);
+void	emul_unlock(void);
+
+/*
+ * Coalesced MMIO: the hypervisor records the guest writes to the registered
+ * ranges in a ring and resumes the guest, coalesced_mmio_drain() emulates
+ * them and must run before any other request of the VM is emulated. Only
+ * for the registers whose writes have no side effect the guest may observe
+ * before its next access to the device.
+ */
+void	coalesced_mmio_init(struct vmctx *ctx);
+void	coalesced_mmio_drain(struct vmctx *ctx);
+int	register_coalesced_mmio(struct vmctx *ctx, uint64_t base, uint64_t size);
+int	unregister_coalesced_mmio(struct vmctx *ctx, uint64_t base, uint64_t size);
 
 int	emulate_mem(struct vmctx *ctx, struct mmio_request *mmio_req);
 int	register_mem(struct mem_range *memp);
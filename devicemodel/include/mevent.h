@@ -29,6 +29,12 @@
 #ifndef	_MEVENT_H_
 #define	_MEVENT_H_
 
+#include <stdint.h>
+
+/*
+ * The _ET events are edge triggered: run() is only called again once more
+ * is ready on the fd, so it must read (or write) it until EAGAIN.
+ */
 enum ev_type {
 	EVF_READ,
 	EVF_WRITE,
@@ -39,10 +45,16 @@ enum ev_type {
 };
 
 struct mevent;
+struct mevent_loop;
 
 struct mevent *mevent_add(int fd, enum ev_type type,
 			  void (*run)(int, enum ev_type, void *), void *param,
 			  void (*teardown)(void *), void *teardown_param);
+/* as mevent_add(), on the given loop, the main one when loop is NULL */
+struct mevent *mevent_add_loop(struct mevent_loop *loop, int fd,
+			  enum ev_type type,
+			  void (*run)(int, enum ev_type, void *), void *param,
+			  void (*teardown)(void *), void *teardown_param);
 int	mevent_enable(struct mevent *evp);
 int	mevent_disable(struct mevent *evp);
 int	mevent_delete(struct mevent *evp);
@@ -50,6 +62,18 @@ int	mevent_delete_close(struct mevent *evp);
 int	mevent_notify(void);
 
 void	mevent_dispatch(void);
+
+/*
+ * An event loop with a thread of its own, named name and pinned to cpu,
+ * if not negative. Destroying the loop stops the thread, then tears down
+ * its remaining events.
+ */
+struct mevent_loop *mevent_loop_create(const char *name, int cpu);
+void	mevent_loop_destroy(struct mevent_loop *loop);
+
+/* Totals of the epoll_wait() returns and of the events of all the loops */
+void	mevent_get_stats(uint64_t *wakeups, uint64_t *events);
+
 int	mevent_init(void);
 void	mevent_deinit(void);
 
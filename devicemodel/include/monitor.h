@@ -15,6 +15,8 @@
 #ifndef MONITOR_H
 #define MONITOR_H
 
+struct blockif_stats;
+
 int monitor_init(struct vmctx *ctx);
 void monitor_close(void);
 
@@ -26,6 +28,14 @@ struct monitor_vm_ops {
 	int (*unpause) (void *arg);
 	int (*query) (void *arg);
 	int (*rescan)(void *arg, char *devargs);
+	int (*blkqos)(void *arg, char *devargs);
+	int (*blkstats)(void *arg, char *devargs, struct blockif_stats *stats);
+	int (*netpoll)(void *arg, char *devargs);
+	int (*rdt)(void *arg, char *devargs);
+	int (*balloon)(void *arg, char *devargs);
+	int (*snapshot)(void *arg, char *devargs);
+	int (*migrate)(void *arg, char *devargs);
+	int (*cpu)(void *arg, char *devargs);
 };
 
 int monitor_register_vm_ops(struct monitor_vm_ops *ops, void *arg,
@@ -34,6 +44,11 @@ int monitor_register_vm_ops(struct monitor_vm_ops *ops, void *arg,
 /* helper functions for vm_ops callback developer */
 unsigned get_wakeup_reason(void);
 int set_wakeup_timer(time_t t);
+int acrnd_get_hugepages(const unsigned int *pages, int nlvl);
+void monitor_notify_state(int state);
 int acrn_parse_intr_monitor(const char *opt);
 int vm_monitor_blkrescan(void *arg, char *devargs);
+int vm_monitor_blkqos(void *arg, char *devargs);
+int vm_monitor_blkstats(void *arg, char *devargs, struct blockif_stats *stats);
+int vm_monitor_netpoll(void *arg, char *devargs);
 #endif
@@ -52,6 +52,13 @@ struct memory_region;
 struct pci_vdev_ops {
 	char	*class_name;		/* Name of device class */
 
+	/*
+	 * slow backend work ahead of vdev_init, optional: run in a thread
+	 * per device, concurrently with the other devices, so it must not
+	 * touch the emulated PCI state. opts is a copy of the vdev_init ones.
+	 */
+	int	(*vdev_prepare)(struct vmctx *, char *opts);
+
 	/* instance creation */
 	int	(*vdev_init)(struct vmctx *, struct pci_vdev *,
 			     char *opts);
@@ -60,6 +67,9 @@ struct pci_vdev_ops {
 	void	(*vdev_deinit)(struct vmctx *, struct pci_vdev *,
 			char *opts);
 
+	/* instance reset keeping the backend, optional (--warm_reset) */
+	void	(*vdev_reset)(struct vmctx *, struct pci_vdev *);
+
 	/* ACPI DSDT enumeration */
 	void	(*vdev_write_dsdt)(struct pci_vdev *);
 
@@ -107,6 +117,10 @@ struct pcibar {
 	uint64_t		size;
 	uint64_t		addr;
 	bool			sizing;
+
+	/* sub-range of a memory bar to coalesce, see register_coalesced_mmio() */
+	uint64_t		coalesced_off;
+	uint64_t		coalesced_size;
 };
 
 #define PI_NAMESZ	40
@@ -171,6 +185,9 @@ struct pci_vdev {
 
 	void	*arg;		/* devemu-private data */
 
+	/* serializes the BAR and config space emulation of the device */
+	pthread_mutex_t	emul_lock;
+
 	uint8_t	cfgdata[PCI_REGMAX + 1];
 	struct pcibar bar[PCI_BARMAX + 1];
 };
@@ -248,6 +265,7 @@ typedef void (*pci_lintr_cb)(int b, int s, int pin, int pirq_pin,
 
 int	init_pci(struct vmctx *ctx);
 void	deinit_pci(struct vmctx *ctx);
+int	reset_pci(struct vmctx *ctx);
 void	msicap_cfgwrite(struct pci_vdev *pi, int capoff, int offset,
 			int bytes, uint32_t val);
 void	msixcap_cfgwrite(struct pci_vdev *pi, int capoff, int offset,
@@ -312,6 +330,8 @@ int	pci_msix_table_bar(struct pci_vdev *pi);
 int	pci_msix_pba_bar(struct pci_vdev *pi);
 int	pci_msi_maxmsgnum(struct pci_vdev *pi);
 int	pci_parse_slot(char *opt);
+int	pci_reparse_slot(char *opt);
+void	pci_emul_prepare(struct vmctx *ctx);
 int	pci_populate_msicap(struct msicap *cap, int msgs, int nextptr);
 int	pci_emul_add_msixcap(struct pci_vdev *pi, int msgnum, int barnum);
 int	pci_emul_msix_twrite(struct pci_vdev *pi, uint64_t offset, int size,
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * Simple port I/O registers served by the hypervisor.
+ *
+ * A device publishes the registers whose reads return a plain value, or
+ * whose writes merely latch a value, in a page shared with the hypervisor,
+ * which then completes the guest accesses to them without an exit to the
+ * device model. The device keeps its inout handler for the accesses the
+ * hypervisor leaves, and for when the page is not set up.
+ */
+
+#ifndef _PIOREG_H_
+#define _PIOREG_H_
+
+#include <stdint.h>
+
+#include "atomic.h"
+#include "vmmapi.h"
+
+/**
+ * @brief Set up the port I/O registers page of the VM with the hypervisor.
+ *
+ * @param ctx Pointer to the VM context.
+ *
+ * @return None
+ */
+void pioreg_init(struct vmctx *ctx);
+
+/**
+ * @brief Publish a register, or update the one of the same port and size.
+ *
+ * @param port I/O port of the register.
+ * @param size Access size in bytes, 1, 2 or 4.
+ * @param flags ACRN_PIO_REG_FLAG_xxx.
+ * @param value Initial value of the register.
+ * @param wmask Bits of value a guest write latches.
+ *
+ * @return Pointer to the register, NULL if the hypervisor does not serve
+ *	   it.
+ */
+struct acrn_pio_reg *pioreg_add(uint16_t port, uint16_t size,
+		uint32_t flags, uint32_t value, uint32_t wmask);
+
+/**
+ * @brief Withdraw a register published by pioreg_add.
+ *
+ * @param reg Pointer to the register, may be NULL.
+ *
+ * @return None
+ */
+void pioreg_del(struct acrn_pio_reg *reg);
+
+static inline void
+pioreg_set(struct acrn_pio_reg *reg, uint32_t value)
+{
+	if (reg != NULL)
+		atomic_store(&reg->value, value);
+}
+
+static inline uint32_t
+pioreg_get(struct acrn_pio_reg *reg)
+{
+	return atomic_load(&reg->value);
+}
+
+#endif /* _PIOREG_H_ */
@@ -65,6 +65,7 @@
 #define IC_ID_GEN_BASE                  0x0UL
 #define IC_GET_API_VERSION             _IC_ID(IC_ID, IC_ID_GEN_BASE + 0x00)
 #define IC_GET_PLATFORM_INFO           _IC_ID(IC_ID, IC_ID_GEN_BASE + 0x03)
+#define IC_SET_CLOS_MASK               _IC_ID(IC_ID, IC_ID_GEN_BASE + 0x04)
 
 /* VM management */
 #define IC_ID_VM_BASE                  0x10UL
@@ -75,6 +76,10 @@
 #define IC_CREATE_VCPU                 _IC_ID(IC_ID, IC_ID_VM_BASE + 0x04)
 #define IC_RESET_VM                    _IC_ID(IC_ID, IC_ID_VM_BASE + 0x05)
 #define IC_SET_VCPU_REGS               _IC_ID(IC_ID, IC_ID_VM_BASE + 0x06)
+#define IC_SET_VCPU_STATS              _IC_ID(IC_ID, IC_ID_VM_BASE + 0x07)
+#define IC_SET_VM_CLOS                 _IC_ID(IC_ID, IC_ID_VM_BASE + 0x08)
+#define IC_VM_IVSHMEM                  _IC_ID(IC_ID, IC_ID_VM_BASE + 0x09)
+#define IC_REMOVE_VCPU                 _IC_ID(IC_ID, IC_ID_VM_BASE + 0x0a)
 
 /* IRQ and Interrupts */
 #define IC_ID_IRQ_BASE                 0x20UL
@@ -90,6 +95,14 @@
 #define IC_ATTACH_IOREQ_CLIENT          _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x03)
 #define IC_DESTROY_IOREQ_CLIENT         _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x04)
 #define IC_CLEAR_VM_IOREQ               _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x05)
+#define IC_NOTIFY_REQUEST_FINISH_BATCH  _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x06)
+#define IC_SET_COALESCED_MMIO_RING      _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x07)
+#define IC_SET_COALESCED_MMIO_ZONE      _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x08)
+#define IC_SET_TIMER_COUNTERS           _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x09)
+#define IC_SET_PCI_CFG_SHADOW           _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x0a)
+#define IC_SET_EMUL_MSIX                _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x0b)
+#define IC_SET_PIO_REGS                 _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x0c)
+#define IC_SET_VRTC                     _IC_ID(IC_ID, IC_ID_IOREQ_BASE + 0x0d)
 
 /* Guest memory management */
 #define IC_ID_MEM_BASE                  0x40UL
@@ -97,6 +110,9 @@
 #define IC_ALLOC_MEMSEG                 _IC_ID(IC_ID, IC_ID_MEM_BASE + 0x00)
 #define IC_SET_MEMSEG                   _IC_ID(IC_ID, IC_ID_MEM_BASE + 0x01)
 #define IC_UNSET_MEMSEG                 _IC_ID(IC_ID, IC_ID_MEM_BASE + 0x02)
+#define IC_SET_DIRTY_LOG                _IC_ID(IC_ID, IC_ID_MEM_BASE + 0x03)
+#define IC_GET_DIRTY_LOG                _IC_ID(IC_ID, IC_ID_MEM_BASE + 0x04)
+#define IC_REMAP_MEMSEG                 _IC_ID(IC_ID, IC_ID_MEM_BASE + 0x05)
 
 /* PCI assignment*/
 #define IC_ID_PCI_BASE                  0x50UL
@@ -147,6 +163,40 @@ struct vm_memmap {
 	uint32_t prot;	/* RWX */
 };
 
+/**
+ * @brief Dirty pages of a guest memory range, for IC_GET_DIRTY_LOG
+ */
+struct vm_dirty_log {
+	/** start guest physical address of the range, 4K aligned */
+	uint64_t gpa;
+	/** size of the range, 4K aligned */
+	uint64_t size;
+	/** service OS user virtual address of the bitmap, one bit per 4K
+	 *  page, set if the page has been written since the previous call
+	 */
+	uint64_t bitmap;
+	/** ACRN_DIRTY_LOG_* flags of the hypervisor */
+	uint32_t flags;
+	/** Reserved */
+	uint32_t reserved;
+};
+
+/**
+ * @brief EPT memory mapping moved to another guest address, for
+ * IC_REMAP_MEMSEG
+ *
+ * The VHM hands the hypervisor the unmapping of the old range and the
+ * mapping of the new one in a single HC_VM_SET_MEMORY_REGIONS, so the EPT
+ * of the guest is flushed once, and the large pages of the range are kept
+ * if the new address is as aligned as the old one.
+ */
+struct vm_memmap_remap {
+	/** user OS guest physical start address of the current mapping */
+	uint64_t old_gpa;
+	/** the new mapping, its len and hpa those of the current one */
+	struct vm_memmap memmap;
+};
+
 /**
  * @brief pass thru device irq data structure
  */
@@ -196,6 +246,18 @@ struct ioreq_notify {
 	uint32_t vcpu;
 };
 
+/**
+ * @brief data strcture to notify hypervisor a batch of ioreqs are handled
+ */
+struct ioreq_notify_batch {
+	/** client id to identify ioreq client */
+	int32_t client_id;
+	/** Reserved for future use */
+	uint32_t reserved;
+	/** bitmap of the ioreq submitters */
+	uint64_t vcpu_mask;
+};
+
 /**
  * @brief data structure to track VHM API version
  */
@@ -229,6 +291,8 @@ struct acrn_ioeventfd {
 #define ACRN_IOEVENTFD_FLAG_PIO		0x01
 #define ACRN_IOEVENTFD_FLAG_DATAMATCH	0x02
 #define ACRN_IOEVENTFD_FLAG_DEASSIGN	0x04
+/* completed by the hypervisor without an ioreq, see struct acrn_doorbell */
+#define ACRN_IOEVENTFD_FLAG_DOORBELL	0x08
        /** file descriptor of the eventfd of this ioeventfd */
        int32_t fd;
        /** flag for ioeventfd ioctl */
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * Stream of the guest memory, copied while the VM runs.
+ *
+ * The whole memory is sent first, then the pages dirtied in the meantime
+ * are sent again, as reported by the EPT dirty log, until few of them are
+ * left. The VM is paused for the last round. The pages written by the
+ * device model or by DMA don't show up in the dirty log, they are found at
+ * the end by comparing the pages with a hash of what has been sent.
+ *
+ * The stream is a struct snapshot_header, followed by its regions, then
+ * struct snapshot_record each followed by its data, applied in order. It
+ * ends with a record of gpa SNAPSHOT_END.
+ */
+
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include "vmmapi.h"
+
+#define SNAPSHOT_MAGIC		"ACRNSNAP"
+#define SNAPSHOT_VERSION	1U
+#define SNAPSHOT_END		(~0UL)
+
+struct snapshot_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t nregions;	/* struct snapshot_region following */
+};
+
+struct snapshot_region {
+	uint64_t gpa;
+	uint64_t len;
+};
+
+struct snapshot_record {
+	uint64_t gpa;
+	uint64_t len;		/* bytes of data following */
+};
+
+/**
+ * @brief Hash of a 4K page, fast rather than cryptographic.
+ *
+ * @param page Pointer to the page.
+ *
+ * @return Hash of the page.
+ */
+uint64_t snapshot_page_hash(const void *page);
+
+/**
+ * @brief Send the guest memory to fd, the VM is paused on return.
+ *
+ * @param ctx Pointer to the VM context.
+ * @param fd File or stream socket to write to.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int vm_save_memory(struct vmctx *ctx, int fd);
+
+/**
+ * @brief Monitor op saving the guest memory to the file of devargs.
+ *
+ * @param arg Pointer to the VM context.
+ * @param devargs Path of the file.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int vm_monitor_snapshot(void *arg, char *devargs);
+
+/**
+ * @brief Monitor op streaming the guest memory over TCP.
+ *
+ * @param arg Pointer to the VM context.
+ * @param devargs <host>:<port> of the receiver.
+ *
+ * @return 0 on success, -1 on error.
+ */
+int vm_monitor_migrate(void *arg, char *devargs);
+
+#endif /* _SNAPSHOT_H_ */
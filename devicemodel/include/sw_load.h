@@ -71,6 +71,30 @@ char *get_bootargs(void);
 void vsbl_set_bdf(int bnum, int snum, int fnum);
 
 int check_image(char *path, size_t size_limit, size_t *size);
+
+/**
+ * @brief Copy len bytes of an image into the guest memory, with several
+ * threads for the large ones.
+ */
+void copy_image(void *dst, const void *src, size_t len);
+
+/**
+ * @brief Map an image file read-only.
+ *
+ * @param path Path of the image.
+ * @param size Returns the size of the image.
+ *
+ * @return The mapping of the image, NULL on failure.
+ */
+void *map_image(const char *path, size_t *size);
+void unmap_image(void *img, size_t size);
+
+/**
+ * @brief Copy the whole image at path, still of size bytes, to dst.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int load_image(const char *path, size_t size, void *dst);
 uint32_t acrn_create_e820_table(struct vmctx *ctx, struct e820_entry *e820);
 int add_e820_entry(struct e820_entry *e820, int len, uint64_t start,
 	uint64_t size, uint32_t type);
@@ -81,5 +105,14 @@ int acrn_sw_load_vsbl(struct vmctx *ctx);
 int acrn_sw_load_ovmf(struct vmctx *ctx);
 int acrn_writeback_ovmf_nvstorage(struct vmctx *ctx);
 int acrn_sw_load(struct vmctx *ctx);
+
+/**
+ * @brief Map the boot images for good and fault them in, map_image() then
+ * returns these mappings. For the template DM, whose clones share them.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int acrn_sw_preload(void);
+int acrn_sw_preload_bzimage(int (*preload)(const char *path));
 #endif
 
@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * Template DM, see --template.
+ *
+ * The template parses the options and maps the boot images once, but
+ * creates no VM. It forks a clone on each DM_CLONE request to its socket
+ * [name].template: the clone takes the name, UUID, MAC seed and PCI slots
+ * of the request, then goes on with the usual start of a DM. The boot
+ * images are shared with the template copy-on-write rather than read
+ * again. The guest memory is not cloned: it is hugetlbfs memory the
+ * hypervisor maps by host physical address, each clone gets its own.
+ *
+ * devargs of DM_CLONE, separated by spaces:
+ *   <vm_name> [-U uuid] [--mac_seed seed] [-s slot_config]...
+ */
+
+#ifndef _TEMPLATE_H_
+#define _TEMPLATE_H_
+
+#define TEMPLATE_SUFFIX		".template"
+
+/**
+ * @brief Serve DM_CLONE until killed, in the template process.
+ *
+ * Returns in each clone, with the parameters of its request applied.
+ *
+ * @return 0 in a clone, -1 if the template cannot be set up.
+ */
+int template_run(void);
+
+#endif /* _TEMPLATE_H_ */
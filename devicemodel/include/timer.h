@@ -7,13 +7,24 @@
 #define _TIMER_H_
 
 #include <sys/param.h>
+#include <sys/queue.h>
 
+struct timer_base;
+
+/*
+ * Set clockid, CLOCK_REALTIME or CLOCK_MONOTONIC, before acrn_timer_init(),
+ * the other fields are private to timer.c. The callbacks are called from
+ * the main mevent loop.
+ */
 struct acrn_timer {
-	int32_t fd;
 	int32_t clockid;
-	struct mevent *mevp;
 	void (*callback)(void *, uint64_t);
 	void *callback_param;
+
+	struct timer_base *base;
+	TAILQ_ENTRY(acrn_timer) link;
+	uint64_t expire;	/* ns on clockid, 0 when disarmed */
+	uint64_t interval;	/* ns, 0 for a one-shot timer */
 };
 
 int32_t
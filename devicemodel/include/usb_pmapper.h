@@ -24,6 +24,9 @@
 #define USB_EP_MAXP_SZ(m) ((m) & 0x7ff)
 #define USB_EP_MAXP_MT(m) (((m) >> 11) & 0x3)
 
+/* completed requests kept per endpoint, with their transfer and buffer */
+#define USB_DEV_REQ_POOL 8
+
 enum {
 	USB_INFO_VERSION,
 	USB_INFO_SPEED,
@@ -33,10 +36,16 @@ enum {
 	USB_INFO_PID
 };
 
+struct usb_dev_req;
+
 struct usb_dev_ep {
 	uint8_t pid;
 	uint8_t type;
 	uint16_t maxp;
+
+	/* requests for reuse, under pool_mtx of the usb_dev */
+	struct usb_dev_req *pool;
+	int pool_cnt;
 };
 
 struct usb_dev {
@@ -57,6 +66,9 @@ struct usb_dev {
 
 	/* libusb data */
 	libusb_device_handle *handle;
+
+	/* the requests complete in the libusb thread */
+	pthread_mutex_t pool_mtx;
 };
 
 /*
@@ -77,9 +89,21 @@ struct usb_dev_req {
 	int     blk_head;
 	int     blk_tail;
 
+	/*
+	 * buffer is either pool_buf, the bounce buffer kept with the
+	 * request, or the guest memory itself for a direct transfer.
+	 */
+	uint8_t *pool_buf;
+	int     buf_cap;
+	bool    direct;
+
 	struct usb_xfer *xfer;
 	struct libusb_transfer *trn;
+	int     niso;		/* iso packets trn is allocated with */
 	struct usb_block *setup_blk;
+
+	struct usb_dev_ep *ep;
+	struct usb_dev_req *next;	/* in the pool of ep */
 };
 
 /* callback type used by code from HCD layer */
@@ -116,6 +140,8 @@ struct usb_dev_sys_ctx_info {
 	void *hci_data;
 };
 
+/* the native device enumeration of libusb, ahead of usb_dev_sys_init() */
+int usb_dev_sys_prepare(void);
 /* intialize the usb_dev subsystem and register callbacks for HCD layer */
 int usb_dev_sys_init(usb_dev_sys_cb conn_cb, usb_dev_sys_cb disconn_cb,
 		usb_dev_sys_cb notify_cb, usb_dev_sys_cb intr_cb,
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * Timer counters read in the hypervisor.
+ *
+ * The vHPET and the vPIT publish the state of their counters in a page
+ * shared with the hypervisor, which then serves the guest reads of the
+ * HPET main counter and the PIT latch commands from the TSC, without an
+ * exit to the device model. While the page is set up, the device model
+ * counts from the TSC as well, so both give the guest the same counts.
+ */
+
+#ifndef _VCOUNTER_H_
+#define _VCOUNTER_H_
+
+#include <stdint.h>
+
+#include "atomic.h"
+#include "vmmapi.h"
+
+static inline uint64_t
+vcounter_rdtsc(void)
+{
+	uint32_t lo, hi;
+
+	asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+/**
+ * @brief Set up the timer counters page of the VM with the hypervisor.
+ *
+ * @param ctx Pointer to the VM context.
+ *
+ * @return None
+ */
+void vcounter_init(struct vmctx *ctx);
+
+/**
+ * @brief Get the timer counters page.
+ *
+ * @return Pointer to the page, NULL if the hypervisor does not read the
+ *	   counters.
+ */
+struct acrn_timer_counters *vcounter_page(void);
+
+/**
+ * @brief Convert a TSC delta to ticks of a freq Hz counter.
+ *
+ * Same conversion as the hypervisor's, the page must be set up.
+ *
+ * @return The number of ticks.
+ */
+uint64_t vcounter_ticks(uint64_t tsc_delta, uint64_t freq);
+
+/* Make the fields guarded by seq inconsistent to the hypervisor readers */
+static inline void
+vcounter_write_begin(uint32_t *seq)
+{
+	atomic_add_fetch(seq, 1);
+}
+
+static inline void
+vcounter_write_end(uint32_t *seq)
+{
+	atomic_add_fetch(seq, 1);
+}
+
+#endif /* _VCOUNTER_H_ */
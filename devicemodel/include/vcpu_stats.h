@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * Always-on statistics of the vCPUs.
+ *
+ * The hypervisor updates one page per vCPU, see struct acrn_vcpu_stats,
+ * on each VM exit. The pages are the ones of a file in /dev/shm named
+ * after the VM, so acrnd and the other monitors of the SOS map them
+ * read-only without asking the device model.
+ */
+
+#ifndef _VCPU_STATS_H_
+#define _VCPU_STATS_H_
+
+#include "vmmapi.h"
+
+/* Path of the file holding the pages of the VM */
+#define VCPU_STATS_PATH		"/dev/shm/acrn_stats.%s"
+
+/**
+ * @brief Set up the statistics pages of the created vCPUs of the VM.
+ *
+ * A failure is not fatal, the VM runs without the pages.
+ *
+ * @param ctx Pointer to the VM context.
+ * @param ncpus Number of vCPUs of the VM.
+ *
+ * @return None
+ */
+void vcpu_stats_init(struct vmctx *ctx, int ncpus);
+
+/**
+ * @brief Remove the statistics pages, once the VM is destroyed.
+ *
+ * @return None
+ */
+void vcpu_stats_deinit(void);
+
+#endif /* _VCPU_STATS_H_ */
@@ -27,15 +27,33 @@ struct vhost_vq {
 	int kick_fd;		/**< fd of kick eventfd */
 	int call_fd;		/**< fd of call eventfd */
 	int idx;		/**< index of this vq in vhost dev */
+	uint32_t busyloop_timeout;	/**< busy loop timeout in us */
 	struct vhost_dev *dev;	/**< pointer to vhost_dev */
 };
 
+struct vhost_dev_ops;
+struct mevent;
+
+/*
+ * Handler of a request of the vhost-user backend on the slave channel,
+ * returns 0 on success.
+ */
+typedef uint64_t (*vhost_user_slave_fn)(void *arg, uint32_t request,
+					void *payload, uint32_t size,
+					int *fds, int nfds);
+
 struct vhost_dev {
 	/**
 	 * backpointer to virtio_base
 	 */
 	struct virtio_base *base;
 
+	/**
+	 * transport of the vhost messages, a vhost chardev or a vhost-user
+	 * socket
+	 */
+	const struct vhost_dev_ops *ops;
+
 	/**
 	 * pointer to vhost_vq array
 	 */
@@ -47,7 +65,7 @@ struct vhost_dev {
 	int nvqs;
 
 	/**
-	 * vhost chardev fd
+	 * vhost chardev fd, or vhost-user socket fd
 	 */
 	int fd;
 
@@ -67,6 +85,18 @@ struct vhost_dev {
 	 */
 	uint64_t vhost_ext_features;
 
+	/**
+	 * vhost-user protocol features negotiated with the backend
+	 */
+	uint64_t protocol_features;
+
+	/**
+	 * slave channel of the vhost-user backend, and its request handler
+	 */
+	struct mevent *slave_mevp;
+	vhost_user_slave_fn slave_fn;
+	void *slave_arg;
+
 	/**
 	 * vq busyloop timeout in us
 	 */
@@ -90,7 +120,7 @@ struct vhost_dev {
  * @param vq_idx The first virtqueue which would be used by this vhost dev.
  * @param vhost_features Subset of vhost features which would be enabled.
  * @param vhost_ext_features Specific vhost internal features to be enabled.
- * @param busyloop_timeout Busy loop timeout in us.
+ * @param busyloop_timeout Busy loop timeout in us of all the virtqueues.
  *
  * @return 0 on success and -1 on failure.
  */
@@ -98,6 +128,56 @@ int vhost_dev_init(struct vhost_dev *vdev, struct virtio_base *base, int fd,
 		   int vq_idx, uint64_t vhost_features,
 		   uint64_t vhost_ext_features, uint32_t busyloop_timeout);
 
+/**
+ * @brief vhost_dev initialization with a vhost-user backend.
+ *
+ * Same as vhost_dev_init(), the vhost messages go to the vhost-user
+ * backend listening on the UNIX socket at path, e.g. a DPDK or SPDK
+ * process. The backend maps the guest memory from its hugetlbfs files,
+ * and is kicked and calls the guest through the eventfds of the rings.
+ *
+ * @param vdev Pointer to struct vhost_dev.
+ * @param base Pointer to struct virtio_base.
+ * @param path Path of the socket of the backend.
+ * @param vq_idx The first virtqueue which would be used by this vhost dev.
+ * @param vhost_features Subset of vhost features which would be enabled.
+ * @param vhost_ext_features Specific vhost internal features to be enabled.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int vhost_user_dev_init(struct vhost_dev *vdev, struct virtio_base *base,
+			const char *path, int vq_idx, uint64_t vhost_features,
+			uint64_t vhost_ext_features);
+
+/**
+ * @brief read the device config space from the vhost-user backend.
+ *
+ * @param vdev Pointer to struct vhost_dev, set up by vhost_user_dev_init().
+ * @param config Buffer for the config space.
+ * @param size Size of the config space, at most 256 bytes.
+ *
+ * @return 0 on success and -1 on failure, e.g. when the backend does not
+ *	   support VHOST_USER_PROTOCOL_F_CONFIG.
+ */
+int vhost_user_get_config(struct vhost_dev *vdev, void *config,
+			  uint32_t size);
+
+/**
+ * @brief serve the requests of the vhost-user backend.
+ *
+ * Give the backend the slave channel of VHOST_USER_PROTOCOL_F_SLAVE_REQ,
+ * its requests are passed to fn in the mevent thread.
+ *
+ * @param vdev Pointer to struct vhost_dev, set up by vhost_user_dev_init().
+ * @param fn Handler of the requests, returns 0 on success.
+ * @param arg Argument of fn.
+ *
+ * @return 0 on success and -1 on failure, e.g. when the backend does not
+ *	   support VHOST_USER_PROTOCOL_F_SLAVE_REQ.
+ */
+int vhost_user_set_slave_handler(struct vhost_dev *vdev,
+				 vhost_user_slave_fn fn, void *arg);
+
 /**
  * @brief vhost_dev cleanup.
  *
@@ -144,6 +224,41 @@ int vhost_dev_stop(struct vhost_dev *vdev);
  */
 int vhost_net_set_backend(struct vhost_dev *vdev, int backend_fd);
 
+/**
+ * @brief set the context id of the guest to vhost vsock.
+ * This interface is called once, before vhost_vsock_set_running().
+ * @param vdev Pointer to struct vhost_dev.
+ * @param cid Context id of the guest, 3 or above.
+ * @return 0 on success and -1 on failure, e.g. the cid is in use.
+ */
+int vhost_vsock_set_guest_cid(struct vhost_dev *vdev, uint64_t cid);
+
+/**
+ * @brief start or stop the data plane of vhost vsock.
+ * It is started after vhost_dev_start(), and stopped before
+ * vhost_dev_stop().
+ * @param vdev Pointer to struct vhost_dev.
+ * @param start 1 to start, 0 to stop.
+ * @return 0 on success and -1 on failure.
+ */
+int vhost_vsock_set_running(struct vhost_dev *vdev, int start);
+
+/**
+ * @brief set the busy loop timeout of a vhost virtqueue.
+ *
+ * The vhost worker polls the virtqueue (and the backend) for up to timeout
+ * us before it goes back to waiting for a kick. It takes effect at once if
+ * the vhost_dev is started, else when it is.
+ *
+ * @param vdev Pointer to struct vhost_dev.
+ * @param idx Index of the virtqueue in the vhost_dev.
+ * @param timeout Busy loop timeout in us, 0 to disable busy polling.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int vhost_vq_set_busyloop_timeout(struct vhost_dev *vdev, int idx,
+				  uint32_t timeout);
+
 /**
  * @}
  */
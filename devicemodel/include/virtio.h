@@ -124,6 +124,17 @@
  * notify, when descriptors are added to the corresponding ring.
  * (These are provided only for interrupt optimization and need
  * not be implemented.)
+ *
+ * With VIRTIO_F_RING_PACKED negotiated (modern devices only), the
+ * three areas are replaced by a single ring of <N> 16-byte packed
+ * descriptors, <addr>, <len>, <id> and <flags>, and the two small
+ * driver and device event suppression structures. The driver makes
+ * a descriptor available by setting its AVAIL flag to its wrap
+ * counter and its USED flag to the opposite, and the device returns
+ * a buffer by writing one descriptor with the <id> of the buffer at
+ * the next used slot with both flags set to its own wrap counter.
+ * The used slot then moves on by the number of descriptors of the
+ * buffer. The wrap counters flip each time their index wraps around.
  */
 
 #include <linux/virtio_ring.h>
@@ -193,6 +204,8 @@ enum {
 #define	VIRTIO_TYPE_SCSI	8
 #define	VIRTIO_TYPE_9P		9
 #define	VIRTIO_TYPE_INPUT	18
+#define	VIRTIO_TYPE_VSOCK	19
+#define	VIRTIO_TYPE_FS		26
 
 /*
  * ACRN virtio device types
@@ -216,6 +229,7 @@ enum {
 #define	VIRTIO_VENDOR		0x1AF4
 #define	VIRTIO_DEV_NET		0x1000
 #define	VIRTIO_DEV_BLOCK	0x1001
+#define	VIRTIO_DEV_BALLOON	0x1002
 #define	VIRTIO_DEV_CONSOLE	0x1003
 #define	VIRTIO_DEV_RANDOM	0x1005
 
@@ -334,6 +348,8 @@ struct virtio_vq_info;
 #define VIRTIO_PCI_CAP_DEVICE_CFG	4
 /* PCI configuration access */
 #define VIRTIO_PCI_CAP_PCI_CFG		5
+/* Shared memory region */
+#define VIRTIO_PCI_CAP_SHARED_MEMORY_CFG	8
 
 /**
  * @brief Base component to any virtio device
@@ -397,6 +413,7 @@ struct virtio_ops {
 
 #define	VQ_ALLOC	0x01	/* set once we have a pfn */
 #define	VQ_BROKED	0x02	/* ??? */
+#define	VQ_PACKED	0x04	/* packed ring, see above */
 /**
  * @brief Virtqueue data structure
  *
@@ -443,6 +460,36 @@ struct virtio_vq_info {
 	uint32_t gpa_avail[2];	/**< gpa of avail_ring */
 	uint32_t gpa_used[2];	/**< gpa of used_ring */
 	bool enabled;		/**< whether the virtqueue is enabled */
+
+	/*
+	 * Packed ring only: last_avail and save_used are descriptor ring
+	 * slots, used_idx is the next used slot.
+	 */
+	volatile struct vring_packed_desc *pdesc;
+				/**< packed descriptor ring */
+	volatile struct vring_packed_desc_event *driver_event;
+				/**< driver event suppression */
+	volatile struct vring_packed_desc_event *device_event;
+				/**< device event suppression */
+	uint16_t used_idx;	/**< next used slot */
+	bool avail_wrap;	/**< wrap counter of last_avail */
+	bool used_wrap;		/**< wrap counter of used_idx */
+	uint16_t *ndesc;	/**< descriptors of each buffer id */
+
+	/*
+	 * Interrupt coalescing, see vq_set_coalesce(). An interrupt is owed
+	 * to the guest as long as coal_pending is not 0.
+	 */
+	uint32_t coal_frames;	/**< used buffers per interrupt, 0: no limit */
+	uint32_t coal_usecs;	/**< max delay of an interrupt, 0: off */
+	uint32_t coal_pending;	/**< used buffers not signaled yet */
+	bool coal_timer_on;	/**< whether coal_timer is initialized */
+	struct acrn_timer coal_timer;	/**< fires coal_usecs after the first */
+
+	/* Counters of the queue, exported by dm_stats.c */
+	uint64_t stat_notifies;	/**< kicks of the guest */
+	uint64_t stat_used;	/**< buffers returned to the guest */
+	uint64_t stat_interrupts;	/**< interrupts raised */
 };
 
 /* as noted above, these are sort of backwards, name-wise */
@@ -476,8 +523,16 @@ vq_ring_ready(struct virtio_vq_info *vq)
 static inline bool
 vq_has_descs(struct virtio_vq_info *vq)
 {
-	return (vq_ring_ready(vq) && vq->last_avail !=
-	    vq->avail->idx);
+	uint16_t flags;
+
+	if (!vq_ring_ready(vq))
+		return false;
+	if ((vq->flags & VQ_PACKED) == 0)
+		return (vq->last_avail != vq->avail->idx);
+
+	flags = vq->pdesc[vq->last_avail].flags;
+	return (!!(flags & (1 << VRING_PACKED_DESC_F_AVAIL)) == vq->avail_wrap &&
+	    !!(flags & (1 << VRING_PACKED_DESC_F_USED)) != vq->avail_wrap);
 }
 
 /**
@@ -493,6 +548,7 @@ vq_has_descs(struct virtio_vq_info *vq)
 static inline void
 vq_interrupt(struct virtio_base *vb, struct virtio_vq_info *vq)
 {
+	vq->stat_interrupts++;
 	if (pci_msix_enabled(vb->dev))
 		pci_generate_msix(vb->dev, vq->msix_idx);
 	else {
@@ -632,6 +688,35 @@ void virtio_set_io_bar(struct virtio_base *base, int barnum);
 int vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 		struct iovec *iov, int n_iov, uint16_t *flags);
 
+/**
+ * @brief A request chain of a batch, see vq_getchains().
+ */
+struct vq_chain {
+	uint16_t idx;		/**< head, as vq_getchain() puts in pidx */
+	int n;			/**< as vq_getchain() returns */
+	struct iovec *iov;	/**< n_iov entries, set up by the caller */
+	uint16_t *flags;	/**< n_iov entries or NULL, by the caller */
+	uint32_t iolen;		/**< set by the caller for vq_relchains() */
+};
+
+/**
+ * @brief Get a batch of request chains.
+ *
+ * Same as calling vq_getchain() up to nchains times, with the avail
+ * index read once. The batch stops after a chain with invalid
+ * descriptors, whose n is -1 and which has to be dealt with like a
+ * failed vq_getchain().
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param chains Array of nchains chains, with iov and flags set up.
+ * @param nchains Size of chains[] array.
+ * @param n_iov Size of the iov[] and flags[] array of each chain.
+ *
+ * @return number of chains filled in, or -1 if the avail ring is invalid.
+ */
+int vq_getchains(struct virtio_vq_info *vq, struct vq_chain *chains,
+		 int nchains, int n_iov);
+
 /**
  * @brief Return the currently-first request chain back to the
  * available ring.
@@ -654,6 +739,21 @@ void vq_retchain(struct virtio_vq_info *vq);
  */
 void vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen);
 
+/**
+ * @brief Return a batch of request chains to the guest.
+ *
+ * Same as calling vq_relchain() on each chain with its iolen, with the
+ * used index published once. vq_endchains() still has to be called.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param chains Array of chains got by vq_getchains(), iolen set.
+ * @param nchains Number of chains.
+ *
+ * @return None
+ */
+void vq_relchains(struct virtio_vq_info *vq, struct vq_chain *chains,
+		  int nchains);
+
 /**
  * @brief Driver has finished processing "available" chains and calling
  * vq_relchain on each one.
@@ -667,6 +767,57 @@ void vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen);
  */
 void vq_endchains(struct virtio_vq_info *vq, int used_all_avail);
 
+/**
+ * @brief Set the interrupt coalescing of a virtqueue.
+ *
+ * vq_endchains() then holds its interrupts back until max_frames buffers
+ * are used, or at most max_usecs after the first buffer held back. It has
+ * to be called with the lock serializing vq_endchains() on the queue
+ * held, or before the queue is used.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param max_frames Used buffers per interrupt, 0 for no limit.
+ * @param max_usecs Max delay of an interrupt in us, 0 turns coalescing off.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int vq_set_coalesce(struct virtio_vq_info *vq, uint32_t max_frames,
+		    uint32_t max_usecs);
+
+/**
+ * @brief Release the coalescing timer of a virtqueue, on device deinit.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ *
+ * @return None
+ */
+void vq_coalesce_deinit(struct virtio_vq_info *vq);
+
+/**
+ * @brief Parse a coalescing option "<max frames>/<max usecs>".
+ *
+ * @param str The option value.
+ * @param max_frames Returns the max frames.
+ * @param max_usecs Returns the max usecs.
+ *
+ * @return 0 on success and -1 on failure.
+ */
+int virtio_parse_coalesce(const char *str, uint32_t *max_frames,
+			  uint32_t *max_usecs);
+
+/**
+ * @brief Helper function for setting used ring flags.
+ *
+ * Asks the guest not to notify the queue while the device is draining
+ * it, with the used ring flags or the packed ring device event.
+ *
+ * @param base Pointer to struct virtio_base.
+ * @param vq Pointer to struct virtio_vq_info.
+ *
+ * @return None
+ */
+void vq_set_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *vq);
+
 /**
  * @brief Helper function for clearing used ring flags.
  *
@@ -718,6 +869,19 @@ uint64_t virtio_pci_read(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 void virtio_pci_write(struct vmctx *ctx, int vcpu, struct pci_vdev *dev,
 		      int baridx, uint64_t offset, int size, uint64_t value);
 
+/**
+ * @brief Warm reset of a virtio device, keeping its backend.
+ *
+ * Used as vdev_reset of the virtio devices which reset entirely in their
+ * virtio_ops reset callback.
+ *
+ * @param ctx Pointer to struct vmctx representing VM context.
+ * @param dev Pointer to struct pci_vdev which emulates a PCI device.
+ *
+ * @return None
+ */
+void virtio_pci_reset(struct vmctx *ctx, struct pci_vdev *dev);
+
 /**
  * @brief Set modern BAR (usually 4) to map PCI config registers.
  *
@@ -67,6 +67,85 @@ int vbs_kernel_start(int fd, struct vbs_dev_info *dev,
  */
 int vbs_kernel_stop(int fd);
 
+struct virtio_base;
+struct virtio_ops;
+
+/**
+ * @brief VBS-K state of a virtio device which can have its virtqueues
+ * served by a kernel module instead of the device model.
+ *
+ * The device opens the chardev of the module with vbs_kernel_init()
+ * and, on success, links up with BACKEND_VBSK and ops whose set_status
+ * calls vbs_kernel_set_status(). It keeps its VBS-U data path set up,
+ * for the fallback, but leaves the virtqueues alone while backend_type
+ * is BACKEND_VBSK.
+ */
+struct vbs_k_dev {
+	enum VBS_K_STATUS status;	/**< VBS-K state */
+	int fd;				/**< chardev of the kernel module */
+	struct virtio_ops *vops_u;	/**< VBS-U ops of the device */
+	struct vbs_dev_info dev;	/**< as given to the module */
+	struct vbs_vqs_info vqs;	/**< as given to the module */
+};
+
+/**
+ * @brief Is this the device option asking for the kernel backend?
+ *
+ * @param opt Device option, "kernel=on".
+ *
+ * @return true if it is.
+ */
+bool vbs_kernel_opt(const char *opt);
+
+/**
+ * @brief Open the chardev of the kernel backend of a device.
+ *
+ * @param vbs_k Pointer to struct vbs_k_dev of the device.
+ * @param path Chardev of the kernel module.
+ * @param vops_u VBS-U ops of the device, to fall back to.
+ *
+ * @return 0 on OK, the device is to link up with BACKEND_VBSK, and
+ * non-zero on error, it is to link up with BACKEND_VBSU.
+ */
+int vbs_kernel_init(struct vbs_k_dev *vbs_k, const char *path,
+		    struct virtio_ops *vops_u);
+
+/**
+ * @brief Hand the virtqueues to the kernel module once the guest driver
+ * is ready.
+ *
+ * To be called from the set_status op of the device. If the module
+ * cannot take the device, because of packed or non-legacy rings, too
+ * many queues or a MMIO notify region, it falls back to VBS-U: the ops
+ * and backend_type of base are switched.
+ *
+ * @param vbs_k Pointer to struct vbs_k_dev of the device.
+ * @param base Pointer to struct virtio_base of the device.
+ * @param status Device status written by the guest.
+ *
+ * @return None
+ */
+void vbs_kernel_set_status(struct vbs_k_dev *vbs_k, struct virtio_base *base,
+			   uint64_t status);
+
+/**
+ * @brief Stop and reset the kernel module on a device reset.
+ *
+ * @param vbs_k Pointer to struct vbs_k_dev of the device.
+ *
+ * @return None
+ */
+void vbs_kernel_dev_reset(struct vbs_k_dev *vbs_k);
+
+/**
+ * @brief Stop the kernel module and close its chardev.
+ *
+ * @param vbs_k Pointer to struct vbs_k_dev of the device.
+ *
+ * @return None
+ */
+void vbs_kernel_deinit(struct vbs_k_dev *vbs_k);
+
 /**
  * @}
  */
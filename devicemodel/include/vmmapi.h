@@ -34,6 +34,7 @@
 #include "types.h"
 #include "vmm.h"
 #include "macros.h"
+#include "ioreq_trace.h"
 
 /*
  * API version for out-of-tree consumers for making compile time decisions.
@@ -94,6 +95,7 @@ int	vm_create_ioreq_client(struct vmctx *ctx);
 int	vm_destroy_ioreq_client(struct vmctx *ctx);
 int	vm_attach_ioreq_client(struct vmctx *ctx);
 int	vm_notify_request_done(struct vmctx *ctx, int vcpu);
+int	vm_notify_request_done_batch(struct vmctx *ctx, uint64_t vcpu_mask);
 void	vm_clear_ioreq(struct vmctx *ctx);
 void	vm_set_suspend_mode(enum vm_suspend_how how);
 #ifdef DM_DEBUG
@@ -104,13 +106,56 @@ void	vm_destroy(struct vmctx *ctx);
 int	vm_parse_memsize(const char *optarg, size_t *memsize);
 int	vm_map_memseg_vma(struct vmctx *ctx, size_t len, vm_paddr_t gpa,
 	uint64_t vma, int prot);
+int	vm_unmap_memseg(struct vmctx *ctx, vm_paddr_t gpa, size_t len);
+int	vm_set_dirty_log(struct vmctx *ctx, bool enable);
+int	vm_get_dirty_log(struct vmctx *ctx, vm_paddr_t gpa, size_t len,
+	uint64_t *bitmap);
 int	vm_setup_memory(struct vmctx *ctx, size_t len);
 void	vm_unsetup_memory(struct vmctx *ctx);
 bool	init_hugetlb(void);
 void	uninit_hugetlb(void);
 int	hugetlb_setup_memory(struct vmctx *ctx);
+int	hugetlb_parse_numa_node(const char *arg);
+int	hugetlb_parse_mem_backend(const char *arg);
 void	hugetlb_unsetup_memory(struct vmctx *ctx);
+
+/* a piece of the guest memory mapped from a hugetlbfs file, or the memfd */
+struct hugetlb_region {
+	vm_paddr_t gpa;
+	size_t len;
+	void *hva;
+	int fd;			/* the hugetlbfs file or memfd */
+	size_t offset;		/* of the region in the file */
+};
+
+int	hugetlb_get_regions(struct hugetlb_region *regions, int max);
+int	hugetlb_release_range(struct vmctx *ctx, vm_paddr_t gpa, size_t len);
+int	hugetlb_restore_range(struct vmctx *ctx, vm_paddr_t gpa, size_t len);
 void	*vm_map_gpa(struct vmctx *ctx, vm_paddr_t gaddr, size_t len);
+
+/*
+ * Inline vm_map_gpa() for the per-request paths, e.g. each virtio
+ * descriptor. The lowmem and highmem are mapped at baseaddr + gpa, so a
+ * range inside either of them is just an offset.
+ */
+static inline void *
+vm_map_gpa_fast(struct vmctx *ctx, vm_paddr_t gaddr, size_t len)
+{
+	vm_paddr_t end = gaddr + len;
+
+	if (end < gaddr)
+		return NULL;
+	if ((gaddr < ctx->lowmem && end <= ctx->lowmem) ||
+	    (gaddr >= ctx->highmem_gpa_base &&
+	     gaddr < ctx->highmem_gpa_base + ctx->highmem &&
+	     end <= ctx->highmem_gpa_base + ctx->highmem)) {
+		if (ioreq_trace_recording)
+			ioreq_trace_mem(gaddr, ctx->baseaddr + gaddr, len);
+		return (ctx->baseaddr + gaddr);
+	}
+	return NULL;
+}
+
 uint32_t vm_get_lowmem_limit(struct vmctx *ctx);
 size_t	vm_get_lowmem_size(struct vmctx *ctx);
 size_t	vm_get_highmem_size(struct vmctx *ctx);
@@ -124,6 +169,9 @@ int	vm_map_ptdev_mmio(struct vmctx *ctx, int bus, int slot, int func,
 			  vm_paddr_t gpa, size_t len, vm_paddr_t hpa);
 int	vm_unmap_ptdev_mmio(struct vmctx *ctx, int bus, int slot, int func,
 			  vm_paddr_t gpa, size_t len, vm_paddr_t hpa);
+int	vm_remap_ptdev_mmio(struct vmctx *ctx, int bus, int slot, int func,
+				vm_paddr_t old_gpa, vm_paddr_t gpa, size_t len,
+				vm_paddr_t hpa);
 int	vm_set_ptdev_msix_info(struct vmctx *ctx, struct ic_ptdev_irq *ptirq);
 int	vm_reset_ptdev_msix_info(struct vmctx *ctx, uint16_t virt_bdf, uint16_t phys_bdf,
 	int vector_count);
@@ -133,6 +181,8 @@ int	vm_reset_ptdev_intx_info(struct vmctx *ctx, uint16_t virt_bdf,
 	uint16_t phys_bdf, int virt_pin, bool pic_pin);
 
 int	vm_create_vcpu(struct vmctx *ctx, uint16_t vcpu_id);
+int	vm_add_vcpu(struct vmctx *ctx, uint16_t vcpu_id, uint16_t pcpu_id);
+int	vm_remove_vcpu(struct vmctx *ctx, uint16_t vcpu_id);
 int	vm_set_vcpu_regs(struct vmctx *ctx, struct acrn_set_vcpu_regs *cpu_regs);
 
 int	vm_get_cpu_state(struct vmctx *ctx, void *state_buf);
@@ -142,4 +192,20 @@ void	vm_reset_watchdog(struct vmctx *ctx);
 
 int	vm_ioeventfd(struct vmctx *ctx, struct acrn_ioeventfd *args);
 int	vm_irqfd(struct vmctx *ctx, struct acrn_irqfd *args);
+int	vm_set_coalesced_mmio_ring(struct vmctx *ctx,
+		struct acrn_coalesced_mmio_ring *ring);
+int	vm_coalesced_mmio_zone(struct vmctx *ctx,
+		struct acrn_coalesced_mmio_zone *zone);
+int	vm_set_timer_counters(struct vmctx *ctx,
+		struct acrn_timer_counters *counters);
+int	vm_set_vcpu_stats(struct vmctx *ctx, struct acrn_vcpu_stats *stats);
+int	vm_set_clos(struct vmctx *ctx, uint16_t vcpu_id, uint16_t clos);
+int	vm_set_clos_mask(struct vmctx *ctx, uint16_t clos, uint16_t type,
+		uint64_t value);
+int	vm_set_pci_cfg_shadow(struct vmctx *ctx,
+		struct acrn_pci_cfg_shadow *shadow);
+int	vm_set_emul_msix(struct vmctx *ctx, struct acrn_emul_msix *msix);
+int	vm_ivshmem(struct vmctx *ctx, struct acrn_ivshmem *ivshmem);
+int	vm_set_pio_regs(struct vmctx *ctx, struct acrn_pio_regs *regs);
+int	vm_set_vrtc(struct vmctx *ctx, struct acrn_vrtc *vrtc);
 #endif	/* _VMMAPI_H_ */
@@ -13,15 +13,15 @@
 #include "acpi.h"
 
 
-struct find_iter_args {
+/* the DRHDs are parsed in one walk of the DMAR table */
+struct parse_iter_args {
+	struct dmar_info *info;
 	int32_t i;
-	struct acpi_dmar_hardware_unit *res;
+	bool include_all;
 };
 
 typedef int32_t (*dmar_iter_t)(struct acpi_dmar_header*, void*);
 
-static int32_t dmar_unit_cnt;
-
 static void *get_dmar_table(void)
 {
 	return get_acpi_tbl(ACPI_SIG_DMAR);
@@ -55,42 +55,6 @@ dmar_iterate_tbl(dmar_iter_t iter, void *arg)
 	}
 }
 
-static int32_t
-drhd_count_iter(struct acpi_dmar_header *dmar_header, __unused void *arg)
-{
-	if (dmar_header->type == ACPI_DMAR_TYPE_HARDWARE_UNIT)
-		dmar_unit_cnt++;
-	return 1;
-}
-
-static int32_t
-drhd_find_iter(struct acpi_dmar_header *dmar_header, void *arg)
-{
-	struct find_iter_args *args;
-
-	if (dmar_header->type != ACPI_DMAR_TYPE_HARDWARE_UNIT)
-		return 1;
-
-	args = arg;
-	if (args->i == 0) {
-		args->res = (struct acpi_dmar_hardware_unit *)dmar_header;
-		return 0;
-	}
-	args->i--;
-	return 1;
-}
-
-static struct acpi_dmar_hardware_unit *
-drhd_find_by_index(int32_t idx)
-{
-	struct find_iter_args args;
-
-	args.i = idx;
-	args.res = NULL;
-	dmar_iterate_tbl(drhd_find_iter, &args);
-	return args.res;
-}
-
 static uint8_t get_secondary_bus(uint8_t bus, uint8_t dev, uint8_t func)
 {
 	uint32_t data;
@@ -227,26 +191,38 @@ handle_one_drhd(struct acpi_dmar_hardware_unit *acpi_drhd,
 	return 0;
 }
 
-int32_t parse_dmar_table(struct dmar_info *plat_dmar_info)
+static int32_t
+drhd_parse_iter(struct acpi_dmar_header *dmar_header, void *arg)
 {
-	int32_t i;
+	struct parse_iter_args *args = arg;
 	struct acpi_dmar_hardware_unit *acpi_drhd;
 
-	/* find out how many dmar units */
-	dmar_iterate_tbl(drhd_count_iter, NULL);
-	ASSERT(dmar_unit_cnt <= MAX_DRHDS, "parsed dmar_unit_cnt > MAX_DRHDS");
+	if (dmar_header->type != ACPI_DMAR_TYPE_HARDWARE_UNIT)
+		return 1;
 
-	plat_dmar_info->drhd_count = dmar_unit_cnt;
+	ASSERT(args->i < MAX_DRHDS, "parsed dmar_unit_cnt > MAX_DRHDS");
+	if (args->i >= MAX_DRHDS)
+		return 0;
+	ASSERT(!args->include_all, "drhd with flags set should be the last one");
 
-	for (i = 0; i < dmar_unit_cnt; i++) {
-		acpi_drhd = drhd_find_by_index(i);
-		if (acpi_drhd == NULL)
-			continue;
-		if (acpi_drhd->flags & DRHD_FLAG_INCLUDE_PCI_ALL_MASK)
-			ASSERT((i+1) == dmar_unit_cnt,
-				"drhd with flags set should be the last one");
-		handle_one_drhd(acpi_drhd, &(plat_dmar_info->drhd_units[i]));
-	}
+	acpi_drhd = (struct acpi_dmar_hardware_unit *)dmar_header;
+	if (acpi_drhd->flags & DRHD_FLAG_INCLUDE_PCI_ALL_MASK)
+		args->include_all = true;
+	handle_one_drhd(acpi_drhd, &(args->info->drhd_units[args->i]));
+	args->i++;
+	return 1;
+}
+
+int32_t parse_dmar_table(struct dmar_info *plat_dmar_info)
+{
+	struct parse_iter_args args;
+
+	args.info = plat_dmar_info;
+	args.i = 0;
+	args.include_all = false;
+	dmar_iterate_tbl(drhd_parse_iter, &args);
+
+	plat_dmar_info->drhd_count = args.i;
 
 	return 0;
 }
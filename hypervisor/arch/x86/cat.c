@@ -15,15 +15,67 @@
 #include <board.h>
 #include <vm_config.h>
 #include <msr.h>
+#include <per_cpu.h>
+#include <acrn_common.h>
+#include <timer.h>
+
+#define QM_EVT_L3_OCCUPANCY	1U
+#define QM_EVT_MBM_TOTAL	2U
+#define QM_EVT_MBM_LOCAL	3U
+
+#define QM_CTR_ERROR		(1UL << 63U)
+#define QM_CTR_UNAVAILABLE	(1UL << 62U)
+#define QM_CTR_DATA_MASK	((1UL << 62U) - 1UL)
+
+/* the counter width of MBM is 24 + CPUID.(EAX=0xF,ECX=1):EAX[7:0] bits */
+#define MBM_CTR_BASE_WIDTH	24U
 
 struct cat_hw_info cat_cap_info;
+struct cmt_hw_info cmt_cap_info;
 const uint16_t hv_clos = 0U;
+/* the MBA throttling delays of the CLOSes, set by HC_SET_CLOS_MASK */
+static uint16_t mba_delays[MBA_MAX_CLOS_NUM];
+
+/* RMID 0 is of the hypervisor, VM n is monitored with RMID n + 1 */
+static struct rmid_stats rmid_stats_array[CONFIG_MAX_VM_NUM + 1U];
+static uint16_t rmid_num;
+static struct hv_timer rdt_mon_timer;
+
+static void init_cmt_cap_info(void)
+{
+	uint32_t eax = 0U, ebx = 0U, ecx = 0U, edx = 0U;
+	uint32_t width;
+
+	if (pcpu_has_cap(X86_FEATURE_PQM)) {
+		/* CPUID.(EAX=0xF,ECX=0):EDX[1] is set if L3 monitoring supported */
+		cpuid_subleaf(CPUID_RSD_MONITORING, 0U, &eax, &ebx, &ecx, &edx);
+		if ((edx & 2U) != 0U) {
+			/* CPUID.(EAX=0xF,ECX=1):EAX[7:0] the MBM counter width offset from 24
+			 * CPUID.(EAX=0xF,ECX=1):EBX the bytes of a counter unit
+			 * CPUID.(EAX=0xF,ECX=1):ECX the maximum RMID of L3
+			 * CPUID.(EAX=0xF,ECX=1):EDX[2:0] occupancy, total and local bandwidth events
+			 */
+			cpuid_subleaf(CPUID_RSD_MONITORING, 1U, &eax, &ebx, &ecx, &edx);
+			cmt_cap_info.support = ((edx & 1U) != 0U);
+			cmt_cap_info.mbm_total = ((edx & 2U) != 0U);
+			cmt_cap_info.mbm_local = ((edx & 4U) != 0U);
+			cmt_cap_info.upscale = ebx;
+			cmt_cap_info.rmid_max = (uint16_t)((ecx < 0xffffU) ? ecx : 0xffffU);
+			width = MBM_CTR_BASE_WIDTH + (eax & 0xffU);
+			cmt_cap_info.mbm_mask = (width < 62U) ? ((1UL << width) - 1UL) : QM_CTR_DATA_MASK;
+
+			rmid_num = (cmt_cap_info.rmid_max < CONFIG_MAX_VM_NUM) ? cmt_cap_info.rmid_max : CONFIG_MAX_VM_NUM;
+		}
+	}
+}
 
 int32_t init_cat_cap_info(void)
 {
 	uint32_t eax = 0U, ebx = 0U, ecx = 0U, edx = 0U;
 	int32_t ret = 0;
 
+	init_cmt_cap_info();
+
 	if (pcpu_has_cap(X86_FEATURE_CAT)) {
 		cpuid_subleaf(CPUID_RSD_ALLOCATION, 0, &eax, &ebx, &ecx, &edx);
 		/* If support L3 CAT, EBX[1] is set */
@@ -36,6 +88,11 @@ int32_t init_cat_cap_info(void)
 			cat_cap_info.res_id = CAT_RESID_L2;
 		}
 
+		/* If support MBA, EBX[3] is set */
+		if ((ebx & 8U) != 0U) {
+			cat_cap_info.mba_support = true;
+		}
+
 		cat_cap_info.support = true;
 
 		/* CPUID.(EAX=0x10,ECX=ResID):EAX[4:0] reports the length of CBM supported
@@ -48,6 +105,20 @@ int32_t init_cat_cap_info(void)
 		cat_cap_info.bitmask = ebx;
 		cat_cap_info.clos_max = (uint16_t)(edx & 0xffffU);
 
+		if (cat_cap_info.mba_support) {
+			/* CPUID.(EAX=0x10,ECX=3):EAX[11:0] reports the maximum throttling value minus one
+			 * CPUID.(EAX=0x10,ECX=3):ECX[2] is set if the delays are linear
+			 * CPUID.(EAX=0x10,ECX=3):EDX[15:0] reports the maximum CLOS of MBA
+			 */
+			cpuid_subleaf(CPUID_RSD_ALLOCATION, CAT_RESID_MBA, &eax, &ebx, &ecx, &edx);
+			cat_cap_info.mba_max_delay = (uint16_t)((eax & 0xfffU) + 1U);
+			cat_cap_info.mba_linear = ((ecx & 4U) != 0U);
+			cat_cap_info.mba_clos_max = (uint16_t)(edx & 0xffffU);
+			if (cat_cap_info.mba_clos_max >= MBA_MAX_CLOS_NUM) {
+				cat_cap_info.mba_clos_max = MBA_MAX_CLOS_NUM - 1U;
+			}
+		}
+
 		if ((platform_clos_num != 0U) && ((cat_cap_info.clos_max + 1U) != platform_clos_num)) {
 			pr_err("%s clos_max:%hu, platform_clos_num:%u\n", __func__, cat_cap_info.clos_max, platform_clos_num);
 			ret = -EINVAL;
@@ -72,6 +143,13 @@ void setup_clos(uint16_t pcpu_id)
 		}
 		/* set hypervisor CAT clos */
 		msr_write_pcpu(MSR_IA32_PQR_ASSOC, clos2prq_msr(hv_clos), pcpu_id);
+		per_cpu(pqr_assoc, pcpu_id) = (uint64_t)hv_clos << 32U;
+	}
+
+	if (cat_cap_info.mba_support) {
+		for (i = 0U; i <= cat_cap_info.mba_clos_max; i++) {
+			msr_write_pcpu(MSR_IA32_L2_QOS_EXT_BW_THRTL_0 + i, mba_delays[i], pcpu_id);
+		}
 	}
 }
 
@@ -84,3 +162,198 @@ uint64_t clos2prq_msr(uint16_t clos)
 
 	return prq_assoc;
 }
+
+bool is_clos_valid(uint16_t clos)
+{
+	bool valid = false;
+
+	if (cat_cap_info.support) {
+		valid = (clos <= cat_cap_info.clos_max) ||
+			(cat_cap_info.mba_support && (clos <= cat_cap_info.mba_clos_max));
+	}
+
+	return valid;
+}
+
+/**
+ * @brief Load the RMID and the CLOS of the vCPU switched in
+ *
+ * The pCPU stays in the RMID and the CLOS of the vCPU while it runs the
+ * hypervisor too, so the VM exits and entries don't switch MSR_IA32_PQR_ASSOC.
+ */
+void load_pqr_assoc(uint16_t rmid, uint16_t clos)
+{
+	uint64_t *cur = &get_cpu_var(pqr_assoc);
+	uint64_t val = ((uint64_t)clos << 32U) | rmid;
+
+	if ((cat_cap_info.support || cmt_cap_info.support) && (*cur != val)) {
+		msr_write(MSR_IA32_PQR_ASSOC, val);
+		*cur = val;
+	}
+}
+
+/**
+ * @brief The RMID of a VM, 0 if it is not monitored
+ */
+uint16_t vm_rmid(uint16_t vm_id)
+{
+	return (vm_id < rmid_num) ? (vm_id + 1U) : 0U;
+}
+
+/**
+ * @pre rmid <= CONFIG_MAX_VM_NUM
+ */
+const struct rmid_stats *get_rmid_stats(uint16_t rmid)
+{
+	return &rmid_stats_array[rmid];
+}
+
+static bool read_qm_ctr(uint16_t rmid, uint32_t evt_id, uint64_t *ctr)
+{
+	uint64_t val;
+
+	msr_write(MSR_IA32_QM_EVTSEL, ((uint64_t)rmid << 32U) | evt_id);
+	val = msr_read(MSR_IA32_QM_CTR);
+	*ctr = val & QM_CTR_DATA_MASK;
+
+	return ((val & (QM_CTR_ERROR | QM_CTR_UNAVAILABLE)) == 0UL);
+}
+
+/* the bytes since the last sample of a wrapping MBM counter */
+static uint64_t sample_mbm(uint16_t rmid, uint32_t evt_id, uint64_t *last, bool sampled)
+{
+	uint64_t ctr, bytes = 0UL;
+
+	if (read_qm_ctr(rmid, evt_id, &ctr)) {
+		if (sampled) {
+			bytes = ((ctr - *last) & cmt_cap_info.mbm_mask) * cmt_cap_info.upscale;
+		}
+		*last = ctr;
+	}
+
+	return bytes;
+}
+
+/*
+ * The counters of a RMID hold for the L3 of the package, they are sampled
+ * on the BSP only.
+ */
+static void rdt_mon_timer_callback(__unused void *data)
+{
+	struct rmid_stats *stats;
+	uint64_t ctr, bytes;
+	uint16_t rmid;
+
+	for (rmid = 1U; rmid <= rmid_num; rmid++) {
+		stats = &rmid_stats_array[rmid];
+
+		if (read_qm_ctr(rmid, QM_EVT_L3_OCCUPANCY, &ctr)) {
+			stats->llc_occupancy = ctr * cmt_cap_info.upscale;
+		}
+		if (cmt_cap_info.mbm_total) {
+			bytes = sample_mbm(rmid, QM_EVT_MBM_TOTAL, &stats->last_total, stats->sampled);
+			stats->mbm_total_bytes += bytes;
+			stats->total_bw = (bytes * 1000UL) / RDT_MON_PERIOD_MS;
+		}
+		if (cmt_cap_info.mbm_local) {
+			bytes = sample_mbm(rmid, QM_EVT_MBM_LOCAL, &stats->last_local, stats->sampled);
+			stats->mbm_local_bytes += bytes;
+			stats->local_bw = (bytes * 1000UL) / RDT_MON_PERIOD_MS;
+		}
+		stats->sampled = true;
+	}
+}
+
+void setup_rdt_monitor(uint16_t pcpu_id)
+{
+	uint64_t period_in_cycle;
+
+	if ((pcpu_id == BOOT_CPU_ID) && (rmid_num != 0U)) {
+		period_in_cycle = CYCLES_PER_MS * RDT_MON_PERIOD_MS;
+		initialize_timer(&rdt_mon_timer, rdt_mon_timer_callback, NULL,
+				rdtsc() + period_in_cycle, TICK_MODE_PERIODIC, period_in_cycle);
+		if (add_timer(&rdt_mon_timer) != 0) {
+			pr_err("Failed to add RDT monitoring timer");
+		}
+	}
+}
+
+/**
+ * @brief If the CLOS is reserved by a pre-launched VM, which the SOS doesn't manage
+ */
+bool is_clos_reserved(uint16_t clos)
+{
+	uint16_t vm_id;
+	const struct acrn_vm_config *vm_config;
+	bool ret = false;
+
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		vm_config = get_vm_config(vm_id);
+		if ((vm_config->load_order == PRE_LAUNCHED_VM) &&
+				((vm_config->guest_flags & GUEST_FLAG_CLOS_REQUIRED) != 0U) && (vm_config->clos == clos)) {
+			ret = true;
+			break;
+		}
+	}
+
+	return ret;
+}
+
+/* SDM Vol3 17.19.4.2, the capacity bitmask has at least one bit set, and contiguous ones */
+static bool is_cbm_valid(uint64_t cbm)
+{
+	uint64_t len_mask = (1UL << cat_cap_info.cbm_len) - 1UL;
+
+	return (cbm != 0UL) && ((cbm & ~len_mask) == 0UL) && (((cbm + (cbm & (~cbm + 1UL))) & cbm) == 0UL);
+}
+
+/**
+ * @brief Change the cache capacity bitmask or the MBA delay of a CLOS
+ *
+ * The MSRs are written on all the active pCPUs.
+ *
+ * @param clos the CLOS
+ * @param type ACRN_CLOS_CACHE or ACRN_CLOS_MBA
+ * @param value the capacity bitmask of the L2 or L3 CAT, or the MBA delay
+ *
+ * @return 0 on success, -EINVAL on a wrong CLOS, type or value, -EPERM for
+ *         the CLOS of a pre-launched VM.
+ */
+int32_t set_clos_mask(uint16_t clos, uint16_t type, uint64_t value)
+{
+	uint32_t msr_index = 0U;
+	uint16_t pcpu_id;
+	int32_t ret = -EINVAL;
+
+	if (is_clos_reserved(clos)) {
+		ret = -EPERM;
+	} else if (type == ACRN_CLOS_CACHE) {
+		if (cat_cap_info.support && (clos <= cat_cap_info.clos_max) && is_cbm_valid(value)) {
+			msr_index = ((cat_cap_info.res_id == CAT_RESID_L2) ? MSR_IA32_L2_MASK_0 : MSR_IA32_L3_MASK_0) + clos;
+			/* keep the mask for the pCPUs brought up later */
+			if (clos < platform_clos_num) {
+				platform_clos_array[clos].clos_mask = (uint32_t)value;
+			}
+			ret = 0;
+		}
+	} else if (type == ACRN_CLOS_MBA) {
+		if (cat_cap_info.mba_support && (clos <= cat_cap_info.mba_clos_max) &&
+				(value < cat_cap_info.mba_max_delay)) {
+			mba_delays[clos] = (uint16_t)value;
+			msr_index = MSR_IA32_L2_QOS_EXT_BW_THRTL_0 + clos;
+			ret = 0;
+		}
+	} else {
+		/* unknown type */
+	}
+
+	if (ret == 0) {
+		for (pcpu_id = 0U; pcpu_id < get_pcpu_nums(); pcpu_id++) {
+			if (is_pcpu_active(pcpu_id)) {
+				msr_write_pcpu(msr_index, value, pcpu_id);
+			}
+		}
+	}
+
+	return ret;
+}
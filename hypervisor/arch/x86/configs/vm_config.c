@@ -8,6 +8,7 @@
 #include <vm_config.h>
 #include <logmsg.h>
 #include <cat.h>
+#include <msr.h>
 #include <pgtable.h>
 
 /*
@@ -69,7 +70,7 @@ static bool check_vm_uuid_collision(uint16_t vm_id)
 bool sanitize_vm_config(void)
 {
 	bool ret = true;
-	uint16_t vm_id, vcpu_id, nr;
+	uint16_t vm_id, vcpu_id, nr, i;
 	uint64_t sos_pcpu_bitmap, pre_launch_pcpu_bitmap = 0U, vm_pcpu_bitmap;
 	struct acrn_vm_config *vm_config;
 
@@ -152,6 +153,14 @@ bool sanitize_vm_config(void)
 			ret = false;
 		}
 
+		for (i = 0U; i < vm_config->msr_policy_num; i++) {
+			if (!is_msr_policy_valid(vm_config->msr_policies[i].msr, vm_config->msr_policies[i].policy)) {
+				pr_err("%s: vm%u policy %u of MSR 0x%x not allowed", __func__, vm_id,
+					vm_config->msr_policies[i].policy, vm_config->msr_policies[i].msr);
+				ret = false;
+			}
+		}
+
 		if (ret) {
 			/* make sure no identical UUID in following VM configurations */
 			ret = check_vm_uuid_collision(vm_id);
@@ -28,19 +28,26 @@
 #include <vboot.h>
 #include <sgx.h>
 #include <uart16550.h>
+#include <host_pm.h>
 
 #define CPU_UP_TIMEOUT		100U /* millisecond */
 #define CPU_DOWN_TIMEOUT	100U /* millisecond */
 
+/* MWAIT ECX[0]: treat interrupts as break events even if masked */
+#define MWAIT_ECX_INTERRUPT_BREAK	1UL
+
 struct per_cpu_region per_cpu_data[CONFIG_MAX_PCPU_NUM] __aligned(PAGE_SIZE);
 static uint16_t phys_cpu_num = 0U;
 static uint64_t pcpu_sync = 0UL;
 static uint64_t startup_paddr = 0UL;
+static bool idle_mwait = false;
+static uint32_t idle_mwait_hint = 0U;
 
 /* physical cpu active bitmap, support up to 64 cpus */
 static volatile uint64_t pcpu_active_bitmap = 0UL;
 
 static void pcpu_xsave_init(void);
+static void init_idle_mwait(void);
 static void set_current_pcpu_id(uint16_t pcpu_id);
 static void print_hv_banner(void);
 static uint16_t get_pcpu_id_from_lapic_id(uint32_t lapic_id);
@@ -130,6 +137,7 @@ void init_pcpu_pre(bool is_bsp)
 		init_pcpu_model_name();
 
 		load_pcpu_state_data();
+		init_idle_mwait();
 
 		/* Initialize the hypervisor paging */
 		init_e820();
@@ -173,6 +181,8 @@ void init_pcpu_pre(bool is_bsp)
 		}
 	}
 
+	init_pcpu_topology(pcpu_id);
+
 	bitmap_set_lock(pcpu_id, &pcpu_active_bitmap);
 
 	/* Set state for this CPU to initializing */
@@ -259,6 +269,7 @@ void init_pcpu_post(uint16_t pcpu_id)
 	}
 
 	setup_clos(pcpu_id);
+	setup_rdt_monitor(pcpu_id);
 
 	enable_smep();
 
@@ -280,40 +291,12 @@ static uint16_t get_pcpu_id_from_lapic_id(uint32_t lapic_id)
 	return pcpu_id;
 }
 
-static void start_pcpu(uint16_t pcpu_id)
-{
-	uint32_t timeout;
-
-	/* Update the stack for pcpu */
-	stac();
-	write_trampoline_stack_sym(pcpu_id);
-	clac();
-
-	send_startup_ipi(INTR_CPU_STARTUP_USE_DEST, pcpu_id, startup_paddr);
-
-	/* Wait until the pcpu with pcpu_id is running and set the active bitmap or
-	 * configured time-out has expired
-	 */
-	timeout = CPU_UP_TIMEOUT * 1000U;
-	while (!is_pcpu_active(pcpu_id) && (timeout != 0U)) {
-		/* Delay 10us */
-		udelay(10U);
-
-		/* Decrement timeout value */
-		timeout -= 10U;
-	}
-
-	/* Check to see if expected CPU is actually up */
-	if (!is_pcpu_active(pcpu_id)) {
-		pr_fatal("Secondary CPU%hu failed to come up", pcpu_id);
-		pcpu_set_current_state(pcpu_id, PCPU_STATE_DEAD);
-	}
-}
-
-
 /**
  * @brief Start all cpus if the bit is set in mask except itself
  *
+ * The INIT-SIPI-SIPI sequences are sent to all of them before waiting, each
+ * cpu finds its stack in the trampoline by its LAPIC ID.
+ *
  * @param[in] mask bits mask of cpus which should be started
  *
  * @return true if all cpus set in mask are started
@@ -324,20 +307,41 @@ bool start_pcpus(uint64_t mask)
 	uint16_t i;
 	uint16_t pcpu_id = get_pcpu_id();
 	uint64_t expected_start_mask = mask;
+	uint32_t timeout;
+
+	bitmap_clear_nolock(pcpu_id, &expected_start_mask);
 
 	/* secondary cpu start up will wait for pcpu_sync -> 0UL */
 	pcpu_sync = 1UL;
 	cpu_write_memory_barrier();
 
+	stac();
+	write_trampoline_stacks(expected_start_mask);
+	clac();
+
 	i = ffs64(expected_start_mask);
 	while (i != INVALID_BIT_INDEX) {
 		bitmap_clear_nolock(i, &expected_start_mask);
+		send_startup_ipi(INTR_CPU_STARTUP_USE_DEST, i, startup_paddr);
+		i = ffs64(expected_start_mask);
+	}
 
-		if (pcpu_id == i) {
-			continue; /* Avoid start itself */
-		}
+	/* Wait until all of them are running or the configured time-out has expired */
+	timeout = CPU_UP_TIMEOUT * 1000U;
+	while (((pcpu_active_bitmap & mask) != mask) && (timeout != 0U)) {
+		/* Delay 10us */
+		udelay(10U);
+
+		/* Decrement timeout value */
+		timeout -= 10U;
+	}
 
-		start_pcpu(i);
+	expected_start_mask = mask & ~pcpu_active_bitmap;
+	i = ffs64(expected_start_mask);
+	while (i != INVALID_BIT_INDEX) {
+		bitmap_clear_nolock(i, &expected_start_mask);
+		pr_fatal("Secondary CPU%hu failed to come up", i);
+		pcpu_set_current_state(i, PCPU_STATE_DEAD);
 		i = ffs64(expected_start_mask);
 	}
 
@@ -393,11 +397,6 @@ void stop_pcpus(void)
 	wait_pcpus_offline(mask);
 }
 
-void cpu_do_idle(void)
-{
-	asm_pause();
-}
-
 /**
  * only run on current pcpu
  */
@@ -453,6 +452,39 @@ inline void asm_mwait(uint64_t eax, uint64_t ecx)
 	asm volatile("mwait\n" : : "a" (eax), "c" (ecx));
 }
 
+static void init_idle_mwait(void)
+{
+	uint32_t eax, ebx, ecx, edx;
+
+	if (has_monitor_cap()) {
+		cpuid(CPUID_MWAIT_LEAF, &eax, &ebx, &ecx, &edx);
+		/* MWAIT is entered with interrupts disabled in the idle loop */
+		if ((ecx & CPUID_ECX_MWAIT_INT_BREAK) != 0U) {
+			idle_mwait = true;
+			idle_mwait_hint = get_idle_mwait_hint();
+		}
+	}
+}
+
+/*
+ * Idle the pCPU until *addr no longer equals val or an interrupt is pending,
+ * using MONITOR/MWAIT with the C-state hint picked at boot if available.
+ * The caller shall service the pending interrupt by enabling interrupts.
+ *
+ * @pre interrupts are disabled on the current pCPU
+ */
+void cpu_do_idle(volatile const uint64_t *addr, uint64_t val)
+{
+	if (idle_mwait) {
+		asm_monitor(addr, 0UL, 0UL);
+		if ((*addr) == val) {
+			asm_mwait(idle_mwait_hint, MWAIT_ECX_INTERRUPT_BREAK);
+		}
+	} else {
+		asm_pause();
+	}
+}
+
 /* wait until *sync == wake_sync */
 void wait_sync_change(volatile const uint64_t *sync, uint64_t wake_sync)
 {
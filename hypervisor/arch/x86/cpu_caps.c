@@ -25,6 +25,7 @@
 #define VAPIC_FEATURE_TPR_SHADOW	(1U << 3U)
 #define VAPIC_FEATURE_POST_INTR		(1U << 4U)
 #define VAPIC_FEATURE_VX2APIC_MODE	(1U << 5U)
+#define VAPIC_FEATURE_IPI_VIRT		(1U << 6U)
 
 /* BASIC features: must supported by the physical platform and will enabled by default */
 #define APICV_BASIC_FEATURE	(VAPIC_FEATURE_TPR_SHADOW | VAPIC_FEATURE_VIRT_ACCESS | VAPIC_FEATURE_VX2APIC_MODE)
@@ -174,6 +175,18 @@ static void detect_apicv_cap(void)
 		features |= VAPIC_FEATURE_POST_INTR;
 	}
 
+	/*
+	 * IA32_VMX_PROCBASED_CTLS3 has no allowed 0-settings, a bit set
+	 * in it reports that the tertiary control may be 1.
+	 */
+	msr_val = msr_read(MSR_IA32_VMX_PROCBASED_CTLS);
+	if (is_ctrl_setting_allowed(msr_val, VMX_PROCBASED_CTLS_TERTIARY)) {
+		msr_val = msr_read(MSR_IA32_VMX_PROCBASED_CTLS3);
+		if ((msr_val & VMX_PROCBASED_CTLS3_IPIV) != 0UL) {
+			features |= VAPIC_FEATURE_IPI_VIRT;
+		}
+	}
+
 	cpu_caps.apicv_features = features;
 
 	vlapic_set_apicv_ops();
@@ -231,6 +244,12 @@ void init_pcpu_capabilities(void)
 		&boot_cpu_data.cpuid_leaves[FEAT_7_0_ECX],
 		&boot_cpu_data.cpuid_leaves[FEAT_7_0_EDX]);
 
+	if (boot_cpu_data.cpuid_level >= CPUID_XSAVE_FEATURES) {
+		cpuid_subleaf(CPUID_XSAVE_FEATURES, 1U,
+			&boot_cpu_data.cpuid_leaves[FEAT_D_1_EAX],
+			&unused, &unused, &unused);
+	}
+
 	cpuid(CPUID_MAX_EXTENDED_FUNCTION,
 		&boot_cpu_data.extended_cpuid_level,
 		&unused, &unused, &unused);
@@ -261,6 +280,9 @@ void init_pcpu_capabilities(void)
 	}
 
 	detect_pcpu_cap();
+
+	/* the string instructions memcpy_s() and memset() pick */
+	init_mem_ops();
 }
 
 static bool is_ept_supported(void)
@@ -278,6 +300,15 @@ bool is_apicv_advanced_feature_supported(void)
 	return ((cpu_caps.apicv_features & APICV_ADVANCED_FEATURE) == APICV_ADVANCED_FEATURE);
 }
 
+/*
+ * IPI virtualization relies on virtual-interrupt delivery and posted
+ * interrupts, it is only used along with the advanced features.
+ */
+bool is_apicv_ipiv_supported(void)
+{
+	return (is_apicv_advanced_feature_supported() && ((cpu_caps.apicv_features & VAPIC_FEATURE_IPI_VIRT) != 0U));
+}
+
 bool pcpu_has_vmx_ept_cap(uint32_t bit_mask)
 {
 	return ((cpu_caps.vmx_ept & bit_mask) != 0U);
@@ -309,6 +340,74 @@ void init_pcpu_model_name(void)
 	boot_cpu_data.model_name[48] = '\0';
 }
 
+/* Bits of an APIC ID needed to number nr_ids logical processors */
+static uint32_t apic_id_shift(uint32_t nr_ids)
+{
+	uint32_t shift = 0U;
+
+	while ((shift < 32U) && ((1UL << shift) < (uint64_t)nr_ids)) {
+		shift++;
+	}
+	return shift;
+}
+
+/*
+ * Run on each pCPU as the cache geometry may differ between the cores of
+ * hybrid parts. CPUID leaf 0xB gives the x2APIC ID and the width of the
+ * package-level bits, leaf 4 gives how many logical processors share each
+ * cache level.
+ */
+void init_pcpu_topology(uint16_t pcpu_id)
+{
+	struct pcpu_topology *topo = &per_cpu(topo, pcpu_id);
+	uint32_t eax, ebx, ecx, edx, subleaf, level;
+	uint32_t apic_id = per_cpu(lapic_id, pcpu_id);
+	uint32_t l2_shift = 0U, llc_shift = 0U, llc_level = 0U, pkg_shift = 0U;
+
+	if (boot_cpu_data.cpuid_level >= CPUID_EXTEND_TOPOLOGY) {
+		cpuid_subleaf(CPUID_EXTEND_TOPOLOGY, 0U, &eax, &ebx, &ecx, &edx);
+		if (ebx != 0U) {
+			apic_id = edx;
+			for (subleaf = 0U; subleaf < 8U; subleaf++) {
+				cpuid_subleaf(CPUID_EXTEND_TOPOLOGY, subleaf, &eax, &ebx, &ecx, &edx);
+				/* ECX[15:8]: level type, 0 ends the list */
+				if (((ecx >> 8U) & 0xffU) == 0U) {
+					break;
+				}
+				/* EAX[4:0]: shift to the ID of the next level */
+				pkg_shift = eax & 0x1fU;
+			}
+		}
+	}
+
+	if (boot_cpu_data.cpuid_level >= CPUID_CACHE_PARAMS) {
+		for (subleaf = 0U; subleaf < 8U; subleaf++) {
+			cpuid_subleaf(CPUID_CACHE_PARAMS, subleaf, &eax, &ebx, &ecx, &edx);
+			/* EAX[4:0]: cache type, 0 ends the list */
+			if ((eax & 0x1fU) == 0U) {
+				break;
+			}
+			/* EAX[7:5]: level, EAX[25:14]: logical processors sharing it - 1 */
+			level = (eax >> 5U) & 0x7U;
+			if (level == 2U) {
+				l2_shift = apic_id_shift(((eax >> 14U) & 0xfffU) + 1U);
+			}
+			if (level >= llc_level) {
+				llc_level = level;
+				llc_shift = apic_id_shift(((eax >> 14U) & 0xfffU) + 1U);
+			}
+		}
+	}
+
+	if (pkg_shift == 0U) {
+		pkg_shift = llc_shift;
+	}
+
+	topo->l2_id = (l2_shift < 32U) ? (apic_id >> l2_shift) : 0U;
+	topo->llc_id = (llc_shift < 32U) ? (apic_id >> llc_shift) : 0U;
+	topo->pkg_id = (pkg_shift < 32U) ? (apic_id >> pkg_shift) : 0U;
+}
+
 static inline bool is_vmx_disabled(void)
 {
 	uint64_t msr_val;
@@ -153,6 +153,33 @@ struct cpu_state_info *get_cpu_pm_state_info(void)
 	return &cpu_pm_state_info;
 }
 
+/*
+ * Return the MWAIT hint of the deepest Cx entry not deeper than
+ * CONFIG_IDLE_MAX_CSTATE, the Cx entries are listed from shallow to deep.
+ * C1 is used when no Cx data is available for the processor.
+ */
+uint32_t get_idle_mwait_hint(void)
+{
+	uint32_t hint = 0U;
+	uint8_t i;
+	const struct cpu_cx_data *cx;
+
+	for (i = 0U; i < cpu_pm_state_info.cx_cnt; i++) {
+		cx = &cpu_pm_state_info.cx_data[i];
+		if ((cx->type != 0U) && (cx->type <= CONFIG_IDLE_MAX_CSTATE)) {
+			if (cx->cx_reg.space_id == SPACE_FFixedHW) {
+				/* the address of a FFixedHW Cx register is the MWAIT hint */
+				hint = (uint32_t)cx->cx_reg.address;
+			} else {
+				/* MWAIT hint EAX[7:4] is the target C-state minus one */
+				hint = ((uint32_t)cx->type - 1U) << 4U;
+			}
+		}
+	}
+
+	return hint;
+}
+
 static void load_cpu_state_info(const struct cpu_state_info *state_info)
 {
 	if ((state_info->px_cnt != 0U) && (state_info->px_data != NULL)) {
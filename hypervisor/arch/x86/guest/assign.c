@@ -13,40 +13,6 @@
 #include <per_cpu.h>
 #include <ioapic.h>
 
-/*
- * lookup a ptdev entry by sid
- * Before adding a ptdev remapping, should lookup by physical sid to check
- * whether the resource has been token by others.
- * When updating a ptdev remapping, should lookup by virtual sid to check
- * whether this resource is valid.
- * @pre: vm must be NULL when lookup by physical sid, otherwise,
- * vm must not be NULL when lookup by virtual sid.
- */
-static inline struct ptirq_remapping_info *
-ptirq_lookup_entry_by_sid(uint32_t intr_type,
-		const union source_id *sid, const struct acrn_vm *vm)
-{
-	uint16_t idx;
-	struct ptirq_remapping_info *entry;
-	struct ptirq_remapping_info *entry_found = NULL;
-
-	for (idx = 0U; idx < CONFIG_MAX_PT_IRQ_ENTRIES; idx++) {
-		entry = &ptirq_entries[idx];
-		if (!is_entry_active(entry)) {
-			continue;
-		}
-		if ((intr_type == entry->intr_type) &&
-			((vm == NULL) ?
-			(sid->value == entry->phys_sid.value) :
-			((vm == entry->vm) &&
-			(sid->value == entry->virt_sid.value)))) {
-			entry_found = entry;
-			break;
-		}
-	}
-	return entry_found;
-}
-
 static inline struct ptirq_remapping_info *
 ptirq_lookup_entry_by_vpin(const struct acrn_vm *vm, uint32_t virt_pin, bool pic_pin)
 {
@@ -93,6 +59,28 @@ static void ptirq_free_irte(const struct ptirq_remapping_info *entry)
 	dmar_free_irte(intr_src, (uint16_t)entry->allocated_pirq);
 }
 
+/*
+ * A MSI can be posted by VT-d straight to the PIR descriptor of a vCPU with
+ * APICv posted interrupts, so it reaches the vCPU with no VM exit while it's
+ * running. Only one destination vCPU is possible, the first one is taken for
+ * lowest priority delivery.
+ *
+ * @return the vCPU to post to, NULL to remap the MSI to the destination pCPUs.
+ */
+static struct acrn_vcpu *ptirq_posted_msi_vcpu(struct acrn_vm *vm, uint64_t vdmask,
+		uint32_t delmode, uint32_t virt_vector)
+{
+	struct acrn_vcpu *vcpu = NULL;
+
+	if (is_apicv_advanced_feature_supported() && !is_lapic_pt_configured(vm) &&
+			(vdmask != 0UL) && (virt_vector >= 16U) &&
+			((delmode == MSI_DATA_DELMODE_LOPRI) || ((vdmask & (vdmask - 1UL)) == 0UL))) {
+		vcpu = vcpu_from_vid(vm, ffs64(vdmask));
+	}
+
+	return vcpu;
+}
+
 static void ptirq_build_physical_msi(struct acrn_vm *vm, struct ptirq_msi_info *info,
 		const struct ptirq_remapping_info *entry, uint32_t vector)
 {
@@ -101,8 +89,10 @@ static void ptirq_build_physical_msi(struct acrn_vm *vm, struct ptirq_msi_info *
 	bool phys;
 	union dmar_ir_entry irte;
 	union irte_index ir_index;
-	int32_t ret;
+	int32_t ret = -ENODEV;
 	struct intr_source intr_src;
+	struct acrn_vcpu *vcpu;
+	uint64_t pda;
 
 	/* get physical destination cpu mask */
 	dest = info->vmsi_addr.bits.dest_field;
@@ -119,18 +109,33 @@ static void ptirq_build_physical_msi(struct acrn_vm *vm, struct ptirq_msi_info *
 
 	dest_mask = calculate_logical_dest_mask(pdmask);
 
-	/* Using phys_irq as index in the corresponding IOMMU */
-	irte.entry.lo_64 = 0UL;
-	irte.entry.hi_64 = 0UL;
-	irte.bits.vector = vector;
-	irte.bits.delivery_mode = delmode;
-	irte.bits.dest_mode = MSI_ADDR_DESTMODE_LOGICAL;
-	irte.bits.rh = MSI_ADDR_RH;
-	irte.bits.dest = dest_mask;
-
 	intr_src.is_msi = true;
 	intr_src.src.msi.value = entry->phys_sid.msi_id.bdf;
-	ret = dmar_assign_irte(intr_src, irte, (uint16_t)entry->allocated_pirq);
+
+	/* Using phys_irq as index in the corresponding IOMMU */
+	vcpu = ptirq_posted_msi_vcpu(vm, vdmask, delmode, info->vmsi_data.bits.vector);
+	if (vcpu != NULL) {
+		pda = apicv_get_pir_desc_paddr(vcpu);
+		irte.entry.lo_64 = 0UL;
+		irte.entry.hi_64 = 0UL;
+		irte.pi_bits.pst = 1UL;
+		irte.pi_bits.vector = info->vmsi_data.bits.vector;
+		irte.pi_bits.pda_l = (pda >> 6U) & 0x3FFFFFFUL;
+		irte.pi_bits.pda_h = pda >> 32U;
+		ret = dmar_assign_irte(intr_src, irte, (uint16_t)entry->allocated_pirq);
+	}
+
+	/* remap to the physical vector, which raises ptirq_interrupt_handler() */
+	if (ret != 0) {
+		irte.entry.lo_64 = 0UL;
+		irte.entry.hi_64 = 0UL;
+		irte.bits.vector = vector;
+		irte.bits.delivery_mode = delmode;
+		irte.bits.dest_mode = MSI_ADDR_DESTMODE_LOGICAL;
+		irte.bits.rh = MSI_ADDR_RH;
+		irte.bits.dest = dest_mask;
+		ret = dmar_assign_irte(intr_src, irte, (uint16_t)entry->allocated_pirq);
+	}
 
 	if (ret == 0) {
 		/*
@@ -280,9 +285,9 @@ static struct ptirq_remapping_info *add_msix_remapping(struct acrn_vm *vm,
 	DEFINE_MSI_SID(phys_sid, phys_bdf, entry_nr);
 	DEFINE_MSI_SID(virt_sid, virt_bdf, entry_nr);
 
-	entry = ptirq_lookup_entry_by_sid(PTDEV_INTR_MSI, &phys_sid, NULL);
+	entry = ptirq_find_entry(PTDEV_INTR_MSI, &phys_sid, NULL);
 	if (entry == NULL) {
-		if (ptirq_lookup_entry_by_sid(PTDEV_INTR_MSI, &virt_sid, vm) != NULL) {
+		if (ptirq_find_entry(PTDEV_INTR_MSI, &virt_sid, vm) != NULL) {
 			pr_err("MSIX re-add vbdf%x", virt_bdf);
 		} else {
 			entry = ptirq_alloc_entry(vm, PTDEV_INTR_MSI);
@@ -300,8 +305,7 @@ static struct ptirq_remapping_info *add_msix_remapping(struct acrn_vm *vm,
 		}
 	} else if (entry->vm != vm) {
 		if (is_sos_vm(entry->vm)) {
-			entry->vm = vm;
-			entry->virt_sid.msi_id.bdf = virt_bdf;
+			ptirq_change_owner(entry, vm, &virt_sid);
 		} else {
 			pr_err("MSIX pbdf%x idx=%d already in vm%d with vbdf%x, not able to add into vm%d with vbdf%x",
 				entry->phys_sid.msi_id.bdf, entry->phys_sid.msi_id.entry_nr, entry->vm->vm_id,
@@ -329,7 +333,7 @@ remove_msix_remapping(const struct acrn_vm *vm, uint16_t virt_bdf, uint32_t entr
 	DEFINE_MSI_SID(virt_sid, virt_bdf, entry_nr);
 	struct intr_source intr_src;
 
-	entry = ptirq_lookup_entry_by_sid(PTDEV_INTR_MSI, &virt_sid, vm);
+	entry = ptirq_find_entry(PTDEV_INTR_MSI, &virt_sid, vm);
 	if (entry != NULL) {
 		if (is_entry_active(entry)) {
 			/*TODO: disable MSIX device when HV can in future */
@@ -370,7 +374,7 @@ static struct ptirq_remapping_info *add_intx_remapping(struct acrn_vm *vm, uint3
 	} else if (!ioapic_irq_is_gsi(phys_irq)) {
 		pr_err("%s, invalid phys_pin: %d <-> irq: 0x%x is not a GSI\n", __func__, phys_pin, phys_irq);
 	} else {
-		entry = ptirq_lookup_entry_by_sid(PTDEV_INTR_INTX, &phys_sid, NULL);
+		entry = ptirq_find_entry(PTDEV_INTR_INTX, &phys_sid, NULL);
 		if (entry == NULL) {
 			if (ptirq_lookup_entry_by_vpin(vm, virt_pin, pic_pin) == NULL) {
 				entry = ptirq_alloc_entry(vm, PTDEV_INTR_INTX);
@@ -390,8 +394,7 @@ static struct ptirq_remapping_info *add_intx_remapping(struct acrn_vm *vm, uint3
 			}
 		} else if (entry->vm != vm) {
 			if (is_sos_vm(entry->vm)) {
-				entry->vm = vm;
-				entry->virt_sid.value = virt_sid.value;
+				ptirq_change_owner(entry, vm, &virt_sid);
 				entry->polarity = 0U;
 			} else {
 				pr_err("INTX pin%d already in vm%d with vpin%d, not able to add into vm%d with vpin%d",
@@ -521,10 +524,20 @@ static void ptirq_handle_intx(struct acrn_vm *vm,
 
 void ptirq_softirq(uint16_t pcpu_id)
 {
+	uint32_t budget = PTIRQ_SOFTIRQ_BUDGET;
+
 	while (1) {
-		struct ptirq_remapping_info *entry = ptirq_dequeue_softirq(pcpu_id);
+		struct ptirq_remapping_info *entry;
 		struct ptirq_msi_info *msi;
 
+		if (budget == 0U) {
+			/* the rest stays in the draining bitmap of the pCPU */
+			fire_softirq(SOFTIRQ_PTDEV);
+			break;
+		}
+		budget--;
+
+		entry = ptirq_dequeue_softirq(pcpu_id);
 		if (entry == NULL) {
 			break;
 		}
@@ -617,7 +630,7 @@ int32_t ptirq_msix_remap(struct acrn_vm *vm, uint16_t virt_bdf, uint16_t phys_bd
 	 * entry already be held by others, return error.
 	 */
 	spinlock_obtain(&ptdev_lock);
-	entry = ptirq_lookup_entry_by_sid(PTDEV_INTR_MSI, &virt_sid, vm);
+	entry = ptirq_find_entry(PTDEV_INTR_MSI, &virt_sid, vm);
 	if (entry == NULL) {
 		/* SOS_VM we add mapping dynamically */
 		if (is_sos_vm(vm) || is_prelaunched_vm(vm)) {
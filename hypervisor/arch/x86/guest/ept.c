@@ -15,9 +15,67 @@
 #include <vtd.h>
 #include <logmsg.h>
 #include <trace.h>
+#include <atomic.h>
+#include <per_cpu.h>
 
 #define ACRN_DBG_EPT	6U
 
+/*
+ * Called after each change of the EPT of vm. A lookup which raced with the
+ * change may have been cached with the former generation, it is dropped too.
+ */
+static inline void ept_gen_bump(struct acrn_vm *vm)
+{
+	atomic_inc64(&vm->arch_vm.ept_gen);
+}
+
+/*
+ * The cache is only accessed by its own pCPU, interrupts are disabled around
+ * it since gpa2hva() may be used by the interrupt handlers.
+ */
+static bool ept_lookup_cached(struct acrn_vm *vm, const void *eptp, uint64_t gen,
+		uint64_t gpa, uint64_t *hpa, uint64_t *pg_size)
+{
+	uint64_t rflags;
+	uint32_t i;
+	bool hit = false;
+	const struct ept_lookup_entry *entry;
+	const struct ept_lookup_cache *cache = &vm->arch_vm.lookup_cache[get_pcpu_id()];
+
+	CPU_INT_ALL_DISABLE(&rflags);
+	for (i = 0U; i < EPT_LOOKUP_CACHE_ENTRIES; i++) {
+		entry = &cache->entries[i];
+		if ((entry->eptp == eptp) && (entry->gen == gen) &&
+				((gpa - entry->gpa) < entry->pg_size)) {
+			*hpa = entry->hpa | (gpa - entry->gpa);
+			*pg_size = entry->pg_size;
+			hit = true;
+			break;
+		}
+	}
+	CPU_INT_ALL_RESTORE(rflags);
+
+	return hit;
+}
+
+static void ept_lookup_cache_insert(struct acrn_vm *vm, const void *eptp, uint64_t gen,
+		uint64_t gpa, uint64_t hpa, uint64_t pg_size)
+{
+	uint64_t rflags;
+	struct ept_lookup_entry *entry;
+	struct ept_lookup_cache *cache = &vm->arch_vm.lookup_cache[get_pcpu_id()];
+
+	CPU_INT_ALL_DISABLE(&rflags);
+	entry = &cache->entries[cache->next];
+	entry->eptp = eptp;
+	entry->gen = gen;
+	entry->gpa = gpa & ~(pg_size - 1UL);
+	entry->hpa = hpa & ~(pg_size - 1UL);
+	entry->pg_size = pg_size;
+	cache->next = (cache->next + 1U) % EPT_LOOKUP_CACHE_ENTRIES;
+	CPU_INT_ALL_RESTORE(rflags);
+}
+
 void destroy_ept(struct acrn_vm *vm)
 {
 	/* Destroy secure world */
@@ -27,6 +85,9 @@ void destroy_ept(struct acrn_vm *vm)
 
 	if (vm->arch_vm.nworld_eptp != NULL) {
 		(void)memset(vm->arch_vm.nworld_eptp, 0U, PAGE_SIZE);
+		deinit_ept_mem_ops(vm);
+		ept_gen_bump(vm);
+		vm->arch_vm.nworld_eptp = NULL;
 	}
 }
 
@@ -39,13 +100,19 @@ uint64_t local_gpa2hpa(struct acrn_vm *vm, uint64_t gpa, uint32_t *size)
 	uint64_t hpa = INVALID_HPA;
 	const uint64_t *pgentry;
 	uint64_t pg_size = 0UL;
+	uint64_t gen;
 	void *eptp;
 
 	eptp = get_ept_entry(vm);
-	pgentry = lookup_address((uint64_t *)eptp, gpa, &pg_size, &vm->arch_vm.ept_mem_ops);
-	if (pgentry != NULL) {
-		hpa = (((*pgentry & (~EPT_PFN_HIGH_MASK)) & (~(pg_size - 1UL)))
-				| (gpa & (pg_size - 1UL)));
+	/* read the generation before the walk, see ept_gen_bump() */
+	gen = *(volatile const uint64_t *)&vm->arch_vm.ept_gen;
+	if (!ept_lookup_cached(vm, eptp, gen, gpa, &hpa, &pg_size)) {
+		pgentry = lookup_address((uint64_t *)eptp, gpa, &pg_size, &vm->arch_vm.ept_mem_ops);
+		if (pgentry != NULL) {
+			hpa = (((*pgentry & (~EPT_PFN_HIGH_MASK)) & (~(pg_size - 1UL)))
+					| (gpa & (pg_size - 1UL)));
+			ept_lookup_cache_insert(vm, eptp, gen, gpa, hpa, pg_size);
+		}
 	}
 
 	/**
@@ -94,11 +161,83 @@ int32_t ept_misconfig_vmexit_handler(__unused struct acrn_vcpu *vcpu)
 	return status;
 }
 
-void ept_add_mr(struct acrn_vm *vm, uint64_t *pml4_page,
-	uint64_t hpa, uint64_t gpa, uint64_t size, uint64_t prot_orig)
+void ept_update_begin(struct acrn_vm *vm, struct ept_update *update)
+{
+	update->vm = vm;
+	update->flush_tlb = false;
+	update->iotlb_num = 0U;
+}
+
+/* record [gpa, gpa + size) for the IOTLB invalidation, merged with the last range if contiguous */
+static void ept_update_add_iotlb_range(struct ept_update *update, uint64_t gpa, uint64_t size)
+{
+	uint32_t last = (update->iotlb_num != 0U) ? (update->iotlb_num - 1U) : 0U;
+
+	if ((update->iotlb_num != 0U) && (update->iotlb_num <= EPT_UPDATE_IOTLB_RANGES) &&
+			((update->iotlb_ranges[last].gpa + update->iotlb_ranges[last].size) == gpa)) {
+		update->iotlb_ranges[last].size += size;
+	} else if (update->iotlb_num < EPT_UPDATE_IOTLB_RANGES) {
+		update->iotlb_ranges[update->iotlb_num].gpa = gpa;
+		update->iotlb_ranges[update->iotlb_num].size = size;
+		update->iotlb_num++;
+	} else {
+		update->iotlb_num = EPT_UPDATE_IOTLB_RANGES + 1U;
+	}
+}
+
+/*
+ * One EPT_FLUSH request per vCPU makes each of them do a single INVEPT on its
+ * next VM entry, whatever the number of updates. The IOTLB, which caches the
+ * same page tables, only needs to be invalidated for the ranges where a
+ * present entry has been modified or deleted.
+ */
+void ept_update_commit(struct ept_update *update)
 {
-	uint16_t i;
 	struct acrn_vcpu *vcpu;
+	uint16_t i;
+	uint32_t r;
+
+	if (update->flush_tlb) {
+		foreach_vcpu(i, update->vm, vcpu) {
+			vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
+		}
+	}
+
+	if (update->iotlb_num > EPT_UPDATE_IOTLB_RANGES) {
+		iommu_flush_domain(update->vm->iommu);
+	} else {
+		for (r = 0U; r < update->iotlb_num; r++) {
+			iommu_flush_domain_range(update->vm->iommu, update->iotlb_ranges[r].gpa,
+					update->iotlb_ranges[r].size);
+		}
+	}
+
+	update->flush_tlb = false;
+	update->iotlb_num = 0U;
+}
+
+/*
+ * Each request follows an ept_gen_bump(), the generation is read before the
+ * INVEPT so that a change racing with it is flushed again.
+ */
+void flush_vm_ept(struct acrn_vm *vm)
+{
+	uint16_t pcpu_id = get_pcpu_id();
+	uint64_t gen = *(volatile const uint64_t *)&vm->arch_vm.ept_gen;
+
+	if (vm->arch_vm.ept_flushed_gen[pcpu_id] != gen) {
+		invept(vm->arch_vm.nworld_eptp);
+		if (vm->sworld_control.flag.active != 0UL) {
+			invept(vm->arch_vm.sworld_eptp);
+		}
+		vm->arch_vm.ept_flushed_gen[pcpu_id] = gen;
+	}
+}
+
+void ept_update_add_mr(struct ept_update *update, uint64_t *pml4_page,
+	uint64_t hpa, uint64_t gpa, uint64_t size, uint64_t prot_orig)
+{
+	struct acrn_vm *vm = update->vm;
 	uint64_t prot = prot_orig;
 
 	dev_dbg(ACRN_DBG_EPT, "%s, vm[%d] hpa: 0x%016llx gpa: 0x%016llx size: 0x%016llx prot: 0x%016x\n",
@@ -113,18 +252,16 @@ void ept_add_mr(struct acrn_vm *vm, uint64_t *pml4_page,
 	}
 
 	mmu_add(pml4_page, hpa, gpa, size, prot, &vm->arch_vm.ept_mem_ops);
+	ept_gen_bump(vm);
 
-	foreach_vcpu(i, vm, vcpu) {
-		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
-	}
+	update->flush_tlb = true;
 }
 
-void ept_modify_mr(struct acrn_vm *vm, uint64_t *pml4_page,
+void ept_update_modify_mr(struct ept_update *update, uint64_t *pml4_page,
 		uint64_t gpa, uint64_t size,
 		uint64_t prot_set, uint64_t prot_clr)
 {
-	struct acrn_vcpu *vcpu;
-	uint16_t i;
+	struct acrn_vm *vm = update->vm;
 	uint64_t local_prot = prot_set;
 
 	dev_dbg(ACRN_DBG_EPT, "%s,vm[%d] gpa 0x%llx size 0x%llx\n", __func__, vm->vm_id, gpa, size);
@@ -134,26 +271,59 @@ void ept_modify_mr(struct acrn_vm *vm, uint64_t *pml4_page,
 	}
 
 	mmu_modify_or_del(pml4_page, gpa, size, local_prot, prot_clr, &(vm->arch_vm.ept_mem_ops), MR_MODIFY);
+	ept_gen_bump(vm);
 
-	foreach_vcpu(i, vm, vcpu) {
-		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
-	}
+	update->flush_tlb = true;
+	ept_update_add_iotlb_range(update, gpa, size);
 }
+
 /**
  * @pre [gpa,gpa+size) has been mapped into host physical memory region
  */
-void ept_del_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa, uint64_t size)
+void ept_update_del_mr(struct ept_update *update, uint64_t *pml4_page, uint64_t gpa, uint64_t size)
 {
-	struct acrn_vcpu *vcpu;
-	uint16_t i;
+	struct acrn_vm *vm = update->vm;
 
 	dev_dbg(ACRN_DBG_EPT, "%s,vm[%d] gpa 0x%llx size 0x%llx\n", __func__, vm->vm_id, gpa, size);
 
 	mmu_modify_or_del(pml4_page, gpa, size, 0UL, 0UL, &vm->arch_vm.ept_mem_ops, MR_DEL);
+	ept_gen_bump(vm);
 
-	foreach_vcpu(i, vm, vcpu) {
-		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
-	}
+	update->flush_tlb = true;
+	ept_update_add_iotlb_range(update, gpa, size);
+}
+
+void ept_add_mr(struct acrn_vm *vm, uint64_t *pml4_page,
+	uint64_t hpa, uint64_t gpa, uint64_t size, uint64_t prot_orig)
+{
+	struct ept_update update;
+
+	ept_update_begin(vm, &update);
+	ept_update_add_mr(&update, pml4_page, hpa, gpa, size, prot_orig);
+	ept_update_commit(&update);
+}
+
+void ept_modify_mr(struct acrn_vm *vm, uint64_t *pml4_page,
+		uint64_t gpa, uint64_t size,
+		uint64_t prot_set, uint64_t prot_clr)
+{
+	struct ept_update update;
+
+	ept_update_begin(vm, &update);
+	ept_update_modify_mr(&update, pml4_page, gpa, size, prot_set, prot_clr);
+	ept_update_commit(&update);
+}
+
+/**
+ * @pre [gpa,gpa+size) has been mapped into host physical memory region
+ */
+void ept_del_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa, uint64_t size)
+{
+	struct ept_update update;
+
+	ept_update_begin(vm, &update);
+	ept_update_del_mr(&update, pml4_page, gpa, size);
+	ept_update_commit(&update);
 }
 
 /**
@@ -190,6 +360,175 @@ void *get_ept_entry(struct acrn_vm *vm)
 	return eptp;
 }
 
+uint64_t ept_pointer(const struct acrn_vm *vm, const void *eptp)
+{
+	uint64_t value = hva2hpa(eptp) | VMX_EPTP_PWL_4 | VMX_EPTP_MT_WB;
+
+	if (vm->arch_vm.ept_ad_enabled) {
+		value |= VMX_EPTP_AD_ENABLE_BIT;
+	}
+
+	return value;
+}
+
+static void ept_clear_ad_flags(uint64_t *pgentry, __unused uint64_t size)
+{
+	*pgentry &= ~(EPT_ACCESSED | EPT_DIRTY);
+}
+
+/*
+ * The processor does not touch the flags with A/D disabled, so the ones left
+ * by a former tracking session are reset before the EPT pointers enable it.
+ * The flush makes sure no translation cached as already accessed/dirty hides
+ * an access from the new session.
+ */
+void ept_set_ad_tracking(struct acrn_vm *vm, bool enable)
+{
+	struct acrn_vcpu *vcpu;
+	uint16_t i;
+
+	if (vm->arch_vm.ept_ad_enabled != enable) {
+		if (enable) {
+			walk_ept_table(vm, ept_clear_ad_flags);
+		}
+		vm->arch_vm.ept_ad_enabled = enable;
+		ept_gen_bump(vm);
+
+		foreach_vcpu(i, vm, vcpu) {
+			vcpu_make_request(vcpu, ACRN_REQUEST_EPTP_UPDATE);
+			vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
+		}
+	}
+}
+
+static void ept_flush_smp_call(void *data)
+{
+	invept(data);
+}
+
+/*
+ * A vCPU writing through a translation cached as dirty would not set the flag
+ * again, so the cleared flags only take effect once the TLBs of all the pCPUs
+ * the vm runs on are invalidated. It can't be deferred to the next VM entry
+ * as with ACRN_REQUEST_EPT_FLUSH, a harvest with the vm running would miss
+ * the writes done in between.
+ */
+static void ept_flush_vm_sync(struct acrn_vm *vm)
+{
+	struct acrn_vcpu *vcpu;
+	uint64_t mask = 0UL;
+	uint16_t i;
+
+	foreach_vcpu(i, vm, vcpu) {
+		bitmap_set_nolock(vcpu->pcpu_id, &mask);
+	}
+
+	if (bitmap_test(get_pcpu_id(), &mask)) {
+		bitmap_clear_nolock(get_pcpu_id(), &mask);
+		invept(vm->arch_vm.nworld_eptp);
+	}
+
+	if (mask != 0UL) {
+		smp_call_function(mask, ept_flush_smp_call, vm->arch_vm.nworld_eptp);
+	}
+}
+
+/*
+ * Return the leaf entry mapping gpa, or NULL if it's not mapped. pg_size is
+ * the size mapped by the entry, or the size of the hole at the level the walk
+ * stopped.
+ */
+static uint64_t *ept_leaf_entry(const struct acrn_vm *vm, uint64_t gpa, uint64_t *pg_size)
+{
+	const struct memory_ops *mem_ops = &vm->arch_vm.ept_mem_ops;
+	uint64_t *pml4e, *pdpte, *pde, *pte;
+	uint64_t *leaf = NULL;
+
+	pml4e = pml4e_offset((uint64_t *)vm->arch_vm.nworld_eptp, gpa);
+	*pg_size = PML4E_SIZE;
+	if (mem_ops->pgentry_present(*pml4e) != 0UL) {
+		pdpte = pdpte_offset(pml4e, gpa);
+		*pg_size = PDPTE_SIZE;
+		if (mem_ops->pgentry_present(*pdpte) != 0UL) {
+			if (pdpte_large(*pdpte) != 0UL) {
+				leaf = pdpte;
+			} else {
+				pde = pde_offset(pdpte, gpa);
+				*pg_size = PDE_SIZE;
+				if (mem_ops->pgentry_present(*pde) != 0UL) {
+					if (pde_large(*pde) != 0UL) {
+						leaf = pde;
+					} else {
+						pte = pte_offset(pde, gpa);
+						*pg_size = PTE_SIZE;
+						if (mem_ops->pgentry_present(*pte) != 0UL) {
+							leaf = pte;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	return leaf;
+}
+
+/*
+ * A leaf may span several chunks, its flag is tested and cleared once, in the
+ * first one, dirty_end carries the result to the next ones.
+ */
+int32_t ept_harvest_ad_bits(struct acrn_vm *vm, uint64_t gpa, uint64_t size, uint16_t ad_bit,
+		ept_ad_bitmap_cb cb, void *data)
+{
+	uint64_t bitmap[EPT_AD_CHUNK_PAGES / 64UL];
+	uint64_t end = gpa + size;
+	uint64_t cur = gpa, chunk_start, chunk_end, leaf_start, leaf_end, pg_size, idx, last;
+	uint64_t dirty_end = 0UL;
+	uint64_t *leaf;
+	bool cleared = false;
+	int32_t ret = 0;
+
+	while ((cur < end) && (ret == 0)) {
+		chunk_start = cur;
+		chunk_end = min(end, chunk_start + (EPT_AD_CHUNK_PAGES << PAGE_SHIFT));
+		(void)memset(bitmap, 0U, sizeof(bitmap));
+
+		while (cur < chunk_end) {
+			if (cur >= dirty_end) {
+				leaf = ept_leaf_entry(vm, cur, &pg_size);
+				leaf_start = cur & ~(pg_size - 1UL);
+				leaf_end = leaf_start + pg_size;
+				if ((leaf != NULL) && bitmap_test(ad_bit, leaf)) {
+					dirty_end = leaf_end;
+					if ((leaf_start >= gpa) && (leaf_end <= end)) {
+						(void)bitmap_test_and_clear_lock(ad_bit, leaf);
+						cleared = true;
+					}
+				}
+			} else {
+				leaf_end = dirty_end;
+			}
+
+			last = min(leaf_end, chunk_end);
+			if (cur < dirty_end) {
+				for (idx = (cur - chunk_start) >> PAGE_SHIFT;
+						idx < ((last - chunk_start) >> PAGE_SHIFT); idx++) {
+					bitmap_set_nolock((uint16_t)(idx & 0x3FUL), &bitmap[idx >> 6U]);
+				}
+			}
+			cur = last;
+		}
+
+		ret = cb(data, bitmap, (chunk_start - gpa) >> PAGE_SHIFT, (chunk_end - chunk_start) >> PAGE_SHIFT);
+	}
+
+	if (cleared) {
+		ept_flush_vm_sync(vm);
+	}
+
+	return ret;
+}
+
 /**
  * @pre vm != NULL && cb != NULL.
  */
@@ -232,3 +571,46 @@ void walk_ept_table(struct acrn_vm *vm, pge_handler cb)
 		}
 	}
 }
+
+void ept_page_stats(const struct acrn_vm *vm, struct ept_page_stats *stats)
+{
+	const struct memory_ops *mem_ops = &vm->arch_vm.ept_mem_ops;
+	uint64_t *pml4e, *pdpte, *pde, *pte;
+	uint64_t i, j, k, m;
+
+	(void)memset(stats, 0U, sizeof(*stats));
+
+	for (i = 0UL; i < PTRS_PER_PML4E; i++) {
+		pml4e = pml4e_offset((uint64_t *)vm->arch_vm.nworld_eptp, i << PML4E_SHIFT);
+		if (mem_ops->pgentry_present(*pml4e) == 0UL) {
+			continue;
+		}
+		for (j = 0UL; j < PTRS_PER_PDPTE; j++) {
+			pdpte = pdpte_offset(pml4e, j << PDPTE_SHIFT);
+			if (mem_ops->pgentry_present(*pdpte) == 0UL) {
+				continue;
+			}
+			if (pdpte_large(*pdpte) != 0UL) {
+				stats->pages_1g++;
+				continue;
+			}
+			stats->split_1g++;
+			for (k = 0UL; k < PTRS_PER_PDE; k++) {
+				pde = pde_offset(pdpte, k << PDE_SHIFT);
+				if (mem_ops->pgentry_present(*pde) == 0UL) {
+					continue;
+				}
+				if (pde_large(*pde) != 0UL) {
+					stats->pages_2m++;
+					continue;
+				}
+				for (m = 0UL; m < PTRS_PER_PTE; m++) {
+					pte = pte_offset(pde, m << PTE_SHIFT);
+					if (mem_ops->pgentry_present(*pte) != 0UL) {
+						stats->pages_4k++;
+					}
+				}
+			}
+		}
+	}
+}
@@ -230,6 +230,110 @@ static int32_t local_gva2gpa_pae(struct acrn_vcpu *vcpu, struct page_walk_info *
 	return ret;
 }
 
+/*
+ * The translations done during a VM exit are cached per vCPU, so that the
+ * instruction fetch, the operand accesses and the page by page copies of
+ * copy_from/to_gva() walk the guest page tables once per page.
+ *
+ * Neither INVLPG nor CR3 loads cause VM exits, so the guest may change its
+ * page tables behind any cached translation once it runs again: an entry is
+ * only valid during the VM exit which filled it, and the entries are dropped
+ * on the emulated CR0/CR4 writes changing the paging mode.
+ */
+static bool gva_tlb_lookup(const struct acrn_vcpu *vcpu, uint64_t cr3, uint64_t gva,
+	uint32_t access, uint64_t *gpa)
+{
+	const struct gva_tlb_entry *entry;
+	bool hit = false;
+	uint32_t i;
+
+	for (i = 0U; i < GVA_TLB_ENTRIES; i++) {
+		entry = &vcpu->arch.gva_tlb[i];
+		if (entry->valid && (entry->nrexit == vcpu->arch.nrexits) && (entry->cr3 == cr3) &&
+				(entry->gva_page == (gva & PAGE_MASK)) && (entry->access == access)) {
+			*gpa = entry->gpa_page | (gva & (PAGE_SIZE - 1UL));
+			hit = true;
+			break;
+		}
+	}
+
+	return hit;
+}
+
+static void gva_tlb_insert(struct acrn_vcpu *vcpu, uint64_t cr3, uint64_t gva,
+	uint32_t access, uint64_t gpa)
+{
+	struct gva_tlb_entry *entry = &vcpu->arch.gva_tlb[vcpu->arch.gva_tlb_next];
+
+	entry->gva_page = gva & PAGE_MASK;
+	entry->gpa_page = gpa & PAGE_MASK;
+	entry->cr3 = cr3;
+	entry->access = access;
+	entry->nrexit = vcpu->arch.nrexits;
+	entry->valid = true;
+	vcpu->arch.gva_tlb_next = (vcpu->arch.gva_tlb_next + 1U) % GVA_TLB_ENTRIES;
+}
+
+void flush_vcpu_gva_tlb(struct acrn_vcpu *vcpu)
+{
+	uint32_t i;
+
+	for (i = 0U; i < GVA_TLB_ENTRIES; i++) {
+		vcpu->arch.gva_tlb[i].valid = false;
+	}
+}
+
+static int32_t local_gva2gpa(struct acrn_vcpu *vcpu, enum vm_paging_mode pm, uint64_t cr3,
+	uint64_t gva, uint64_t *gpa, uint32_t *err_code)
+{
+	struct page_walk_info pw_info;
+	int32_t ret = 0;
+
+	pw_info.top_entry = cr3;
+	pw_info.level = (uint32_t)pm;
+	pw_info.is_write_access = ((*err_code & PAGE_FAULT_WR_FLAG) != 0U);
+	pw_info.is_inst_fetch = ((*err_code & PAGE_FAULT_ID_FLAG) != 0U);
+
+	/* SDM vol3 27.3.2
+	 * If the segment register was unusable, the base, select and some
+	 * bits of access rights are undefined. With the exception of
+	 * DPL of SS
+	 * and others.
+	 * So we use DPL of SS access rights field for guest DPL.
+	 */
+	pw_info.is_user_mode_access = (((exec_vmread32(VMX_GUEST_SS_ATTR) >> 5U) & 0x3U) == 3U);
+	pw_info.pse = true;
+	pw_info.nxe = ((vcpu_get_efer(vcpu) & MSR_IA32_EFER_NXE_BIT) != 0UL);
+	pw_info.wp = ((vcpu_get_cr0(vcpu) & CR0_WP) != 0UL);
+	pw_info.is_smap_on = ((vcpu_get_cr4(vcpu) & CR4_SMAP) != 0UL);
+	pw_info.is_smep_on = ((vcpu_get_cr4(vcpu) & CR4_SMEP) != 0UL);
+
+	*err_code &=  ~PAGE_FAULT_P_FLAG;
+
+	if (pm == PAGING_MODE_4_LEVEL) {
+		pw_info.width = 9U;
+		ret = local_gva2gpa_common(vcpu, &pw_info, gva, gpa, err_code);
+	} else if (pm == PAGING_MODE_3_LEVEL) {
+		pw_info.width = 9U;
+		ret = local_gva2gpa_pae(vcpu, &pw_info, gva, gpa, err_code);
+	} else if (pm == PAGING_MODE_2_LEVEL) {
+		pw_info.width = 10U;
+		pw_info.pse = ((vcpu_get_cr4(vcpu) & CR4_PSE) != 0UL);
+		pw_info.nxe = false;
+		ret = local_gva2gpa_common(vcpu, &pw_info, gva, gpa, err_code);
+	} else {
+		*gpa = gva;
+	}
+
+	if (ret == -EFAULT) {
+		if (pw_info.is_user_mode_access) {
+			*err_code |= PAGE_FAULT_US_FLAG;
+		}
+	}
+
+	return ret;
+}
+
 /* Refer to SDM Vol.3A 6-39 section 6.15 for the format of paging fault error
  * code.
  *
@@ -252,53 +356,25 @@ int32_t gva2gpa(struct acrn_vcpu *vcpu, uint64_t gva, uint64_t *gpa,
 	uint32_t *err_code)
 {
 	enum vm_paging_mode pm = get_vcpu_paging_mode(vcpu);
-	struct page_walk_info pw_info;
+	uint64_t cr3;
+	uint32_t access;
 	int32_t ret = 0;
 
 	if ((gpa == NULL) || (err_code == NULL)) {
 		ret = -EINVAL;
 	} else {
 		*gpa = 0UL;
+		cr3 = vcpu_get_cr3(vcpu);
+		access = *err_code & (PAGE_FAULT_WR_FLAG | PAGE_FAULT_ID_FLAG);
 
-		pw_info.top_entry = exec_vmread(VMX_GUEST_CR3);
-		pw_info.level = (uint32_t)pm;
-		pw_info.is_write_access = ((*err_code & PAGE_FAULT_WR_FLAG) != 0U);
-		pw_info.is_inst_fetch = ((*err_code & PAGE_FAULT_ID_FLAG) != 0U);
-
-		/* SDM vol3 27.3.2
-		 * If the segment register was unusable, the base, select and some
-		 * bits of access rights are undefined. With the exception of
-		 * DPL of SS
-		 * and others.
-		 * So we use DPL of SS access rights field for guest DPL.
-		 */
-		pw_info.is_user_mode_access = (((exec_vmread32(VMX_GUEST_SS_ATTR) >> 5U) & 0x3U) == 3U);
-		pw_info.pse = true;
-		pw_info.nxe = ((vcpu_get_efer(vcpu) & MSR_IA32_EFER_NXE_BIT) != 0UL);
-		pw_info.wp = ((vcpu_get_cr0(vcpu) & CR0_WP) != 0UL);
-		pw_info.is_smap_on = ((vcpu_get_cr4(vcpu) & CR4_SMAP) != 0UL);
-		pw_info.is_smep_on = ((vcpu_get_cr4(vcpu) & CR4_SMEP) != 0UL);
-
-		*err_code &=  ~PAGE_FAULT_P_FLAG;
-
-		if (pm == PAGING_MODE_4_LEVEL) {
-			pw_info.width = 9U;
-			ret = local_gva2gpa_common(vcpu, &pw_info, gva, gpa, err_code);
-		} else if (pm == PAGING_MODE_3_LEVEL) {
-			pw_info.width = 9U;
-			ret = local_gva2gpa_pae(vcpu, &pw_info, gva, gpa, err_code);
-		} else if (pm == PAGING_MODE_2_LEVEL) {
-			pw_info.width = 10U;
-			pw_info.pse = ((vcpu_get_cr4(vcpu) & CR4_PSE) != 0UL);
-			pw_info.nxe = false;
-			ret = local_gva2gpa_common(vcpu, &pw_info, gva, gpa, err_code);
+		if (pm == PAGING_MODE_0_LEVEL) {
+			ret = local_gva2gpa(vcpu, pm, cr3, gva, gpa, err_code);
+		} else if (gva_tlb_lookup(vcpu, cr3, gva, access, gpa)) {
+			*err_code &=  ~PAGE_FAULT_P_FLAG;
 		} else {
-			*gpa = gva;
-		}
-
-		if (ret == -EFAULT) {
-			if (pw_info.is_user_mode_access) {
-				*err_code |= PAGE_FAULT_US_FLAG;
+			ret = local_gva2gpa(vcpu, pm, cr3, gva, gpa, err_code);
+			if (ret == 0) {
+				gva_tlb_insert(vcpu, cr3, gva, access, *gpa);
 			}
 		}
 	}
@@ -341,6 +417,40 @@ static inline uint32_t local_copy_gpa(struct acrn_vm *vm, void *h_ptr, uint64_t
 	return len;
 }
 
+/*
+ * The view is only handed out when [gpa, gpa + size) falls in one EPT mapping,
+ * whatever its size is, so the caller can access it through one HVA pointer.
+ */
+const void *gpa_view_get(struct acrn_vm *vm, uint64_t gpa, uint32_t size)
+{
+	uint64_t hpa;
+	uint32_t offset_in_pg, pg_size;
+	const void *view = NULL;
+
+	hpa = local_gpa2hpa(vm, gpa, &pg_size);
+	if (hpa == INVALID_HPA) {
+		pr_err("%s,vm[%hu] gpa 0x%llx,GPA is unmapping",
+			__func__, vm->vm_id, gpa);
+	} else {
+		offset_in_pg = (uint32_t)gpa & (pg_size - 1U);
+		if ((size != 0U) && (size <= (pg_size - offset_in_pg))) {
+			view = hpa2hva(hpa);
+			stac();
+		} else {
+			/* the callers fall back to copy_from_gpa() */
+			dev_dbg(ACRN_DBG_GUEST, "%s,vm[%hu] gpa 0x%llx size 0x%x crosses a page",
+				__func__, vm->vm_id, gpa, size);
+		}
+	}
+
+	return view;
+}
+
+void gpa_view_put(__attribute__((unused)) const void *view)
+{
+	clac();
+}
+
 static inline int32_t copy_gpa(struct acrn_vm *vm, void *h_ptr_arg, uint64_t gpa_arg,
 	uint32_t size_arg, bool cp_from_vm)
 {
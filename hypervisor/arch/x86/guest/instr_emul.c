@@ -35,6 +35,7 @@
 #include <vmcs.h>
 #include <mmu.h>
 #include <per_cpu.h>
+#include <vm.h>
 #include <logmsg.h>
 
 #define CPU_REG_FIRST			CPU_REG_RAX
@@ -2242,6 +2243,89 @@ static int32_t local_decode_instruction(enum vm_cpu_mode cpu_mode,
 	return ret;
 }
 
+/*
+ * Most of the MMIO accesses of the guest drivers are a MOV between a
+ * register and [base + disp], with at most an operand size and a REX
+ * prefix: decode them without going through the opcode tables and the
+ * decoding steps. The direction of the access from the exit qualification
+ * has to agree with the one of the opcode, anything else is left to
+ * local_decode_instruction().
+ */
+static bool fast_decode_mov(enum vm_cpu_mode cpu_mode, bool cs_d, uint32_t direction,
+		struct instr_emul_vie *vie)
+{
+	const uint8_t *inst = vie->inst;
+	uint8_t i = 0U, x, modrm;
+	bool ret = false;
+
+	if (cpu_mode != CPU_MODE_REAL) {
+		if (inst[i] == 0x66U) {
+			vie->opsize_override = 1U;
+			i++;
+		}
+		x = inst[i];
+		if ((cpu_mode == CPU_MODE_64BIT) && (x >= 0x40U) && (x <= 0x4FU)) {
+			vie->rex_present = 1U;
+			vie->rex_w = (x >> 0x3U) & 1U;
+			vie->rex_r = (x >> 0x2U) & 1U;
+			vie->rex_x = (x >> 0x1U) & 1U;
+			vie->rex_b = (x >> 0x0U) & 1U;
+			i++;
+			x = inst[i];
+		}
+
+		/* 0x88/0x89 store the register, 0x8A/0x8B load it */
+		if (((x == 0x88U) || (x == 0x89U)) && (direction != REQUEST_WRITE)) {
+			x = 0U;
+		} else if (((x == 0x8AU) || (x == 0x8BU)) && (direction != REQUEST_READ)) {
+			x = 0U;
+		} else {
+			/* keep the opcode */
+		}
+
+		if (((x & 0xFCU) == 0x88U) && ((uint32_t)i + 2U <= vie->num_valid)) {
+			modrm = inst[i + 1U];
+			vie->mod = (modrm >> 6U) & 0x3U;
+			vie->rm = modrm & 0x7U;
+			vie->reg = ((modrm >> 3U) & 0x7U) | (vie->rex_r << 3U);
+			i += 2U;
+
+			/* no SIB byte, no [rip + disp32] or [disp32] */
+			if ((vie->mod != VIE_MOD_DIRECT) && (vie->rm != VIE_RM_SIB) &&
+					((vie->mod != VIE_MOD_INDIRECT) || (vie->rm != VIE_RM_DISP32))) {
+				if (vie->mod == VIE_MOD_INDIRECT_DISP8) {
+					vie->disp_bytes = 1U;
+				} else if (vie->mod == VIE_MOD_INDIRECT_DISP32) {
+					vie->disp_bytes = 4U;
+				} else {
+					vie->disp_bytes = 0U;
+				}
+
+				if (((uint32_t)i + vie->disp_bytes) == vie->num_valid) {
+					if (vie->disp_bytes == 1U) {
+						vie->displacement = (int8_t)inst[i];
+					} else if (vie->disp_bytes == 4U) {
+						vie->displacement = (int32_t)((uint32_t)inst[i] | ((uint32_t)inst[i + 1U] << 8U) |
+							((uint32_t)inst[i + 2U] << 16U) | ((uint32_t)inst[i + 3U] << 24U));
+					} else {
+						vie->displacement = 0L;
+					}
+					vie->rm |= (vie->rex_b << 3U);
+					vie->base_register = (enum cpu_reg_name)vie->rm;
+					vie->opcode = x;
+					vie->op = one_byte_opcodes[x];
+					decode_op_and_addr_size(vie, cpu_mode, cs_d);
+					vie->num_processed = vie->num_valid;
+					vie->decoded = 1U;
+					ret = true;
+				}
+			}
+		}
+	}
+
+	return ret;
+}
+
 /* for instruction MOVS/STO, check the gva gotten from DI/SI. */
 static int32_t instr_check_di(struct acrn_vcpu *vcpu)
 {
@@ -2344,12 +2428,69 @@ static int32_t instr_check_gva(struct acrn_vcpu *vcpu, enum vm_cpu_mode cpu_mode
 	return ret;
 }
 
+static inline uint32_t vie_cache_index(uint64_t rip)
+{
+	return (uint32_t)((rip ^ (rip >> 12U)) & (VIE_CACHE_ENTRIES - 1U));
+}
+
+/*
+ * The decoding only depends on the instruction bytes, the cpu mode and the
+ * default operand size of CS, comparing the bytes fetched at RIP with the
+ * ones of the entry is enough to reuse its decoding, even if the guest
+ * remapped or rewrote the code at RIP.
+ */
+static bool vie_cache_lookup(struct acrn_vcpu *vcpu, uint64_t rip, enum vm_cpu_mode cpu_mode,
+		bool cs_d, struct instr_emul_vie *vie)
+{
+	struct vie_cache *cache = &vcpu->vm->vie_cache;
+	const struct vie_cache_entry *entry = &cache->entries[vie_cache_index(rip)];
+	uint64_t cr3 = vcpu_get_cr3(vcpu);
+	bool hit = false;
+	uint8_t i;
+
+	spinlock_obtain(&cache->lock);
+	if (entry->valid && (entry->rip == rip) && (entry->cr3 == cr3) && (entry->cpu_mode == (uint8_t)cpu_mode) &&
+			(entry->cs_d == cs_d) && (entry->vie.num_valid == vie->num_valid)) {
+		hit = true;
+		for (i = 0U; i < vie->num_valid; i++) {
+			if (entry->vie.inst[i] != vie->inst[i]) {
+				hit = false;
+				break;
+			}
+		}
+		if (hit) {
+			*vie = entry->vie;
+		}
+	}
+	spinlock_release(&cache->lock);
+
+	return hit;
+}
+
+static void vie_cache_insert(struct acrn_vcpu *vcpu, uint64_t rip, enum vm_cpu_mode cpu_mode,
+		bool cs_d, const struct instr_emul_vie *vie)
+{
+	struct vie_cache *cache = &vcpu->vm->vie_cache;
+	struct vie_cache_entry *entry = &cache->entries[vie_cache_index(rip)];
+
+	spinlock_obtain(&cache->lock);
+	entry->rip = rip;
+	entry->cr3 = vcpu_get_cr3(vcpu);
+	entry->cpu_mode = (uint8_t)cpu_mode;
+	entry->cs_d = cs_d;
+	entry->vie = *vie;
+	entry->valid = true;
+	spinlock_release(&cache->lock);
+}
+
 int32_t decode_instruction(struct acrn_vcpu *vcpu)
 {
 	struct instr_emul_ctxt *emul_ctxt;
 	uint32_t csar;
 	int32_t retval;
 	enum vm_cpu_mode cpu_mode;
+	uint64_t rip;
+	bool cs_d;
 
 	emul_ctxt = &vcpu->inst_ctxt;
 	retval = vie_init(&emul_ctxt->vie, vcpu);
@@ -2359,10 +2500,22 @@ int32_t decode_instruction(struct acrn_vcpu *vcpu)
 		}
 	} else {
 
-		csar = exec_vmread32(VMX_GUEST_CS_ATTR);
+		csar = vcpu_get_cs_attr(vcpu);
 		cpu_mode = get_vcpu_mode(vcpu);
-
-		retval = local_decode_instruction(cpu_mode, seg_desc_def32(csar), &emul_ctxt->vie);
+		cs_d = seg_desc_def32(csar);
+		rip = vcpu_get_rip(vcpu);
+
+		if (fast_decode_mov(cpu_mode, cs_d, vcpu->req.reqs.mmio.direction, &emul_ctxt->vie)) {
+			/* cheaper than the cache, keep its entries for the other instructions */
+			retval = 0;
+		} else if (vie_cache_lookup(vcpu, rip, cpu_mode, cs_d, &emul_ctxt->vie)) {
+			retval = 0;
+		} else {
+			retval = local_decode_instruction(cpu_mode, cs_d, &emul_ctxt->vie);
+			if (retval == 0) {
+				vie_cache_insert(vcpu, rip, cpu_mode, cs_d, &emul_ctxt->vie);
+			}
+		}
 
 		if (retval != 0) {
 			pr_err("decode instruction failed @ 0x%016llx:", vcpu_get_rip(vcpu));
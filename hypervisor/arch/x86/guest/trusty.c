@@ -44,7 +44,8 @@ struct trusty_mem {
  * @brief Create Secure World EPT hierarchy
  *
  * Create Secure World EPT hierarchy, construct new PML4/PDPT, reuse PD/PT parse from
- * vm->arch_vm->ept
+ * vm->arch_vm->ept. Above the first 512G, the PDPTs of the normal world are
+ * shared as well, a PML4 entry each.
  *
  * @param vm pointer to a VM with 2 Worlds
  * @param gpa_orig original gpa allocated from vSBL
@@ -61,10 +62,15 @@ static void create_secure_world_ept(struct acrn_vm *vm, uint64_t gpa_orig,
 	uint64_t hpa;
 	uint64_t table_present = EPT_RWX;
 	uint64_t pdpte, *dest_pdpte_p, *src_pdpte_p;
+	uint64_t pml4e, *dest_pml4e_p, *src_pml4e_p;
 	void *sub_table_addr, *pml4_base;
 	uint16_t i;
 
 	hpa = gpa2hpa(vm, gpa_orig);
+	if (!mem_aligned_check(hpa, PDE_SIZE) || !mem_aligned_check(size, PDE_SIZE)) {
+		pr_warn("%s: secure world hpa 0x%llx size 0x%llx not 2M aligned, mapped with 4K pages",
+			__func__, hpa, size);
+	}
 
 	/* Unmap gpa_orig~gpa_orig+size from guest normal world ept mapping */
 	ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, gpa_orig, size);
@@ -108,7 +114,23 @@ static void create_secure_world_ept(struct acrn_vm *vm, uint64_t gpa_orig,
 		dest_pdpte_p++;
 	}
 
-	/* Map [gpa_rebased, gpa_rebased + size) to secure ept mapping */
+	/*
+	 * Above the trusty PML4 entry, the normal world PDPTs are referenced
+	 * as they are, the execute access removed in the PML4 entry covers
+	 * all their mappings.
+	 */
+	dest_pml4e_p = (uint64_t *)pml4_base + 1U;
+	src_pml4e_p = (uint64_t *)vm->arch_vm.nworld_eptp + 1U;
+	for (i = 1U; i < (uint16_t)PTRS_PER_PML4E; i++) {
+		pml4e = get_pgentry(src_pml4e_p);
+		if ((pml4e & table_present) != 0UL) {
+			set_pgentry(dest_pml4e_p, pml4e & ~EPT_EXE, &vm->arch_vm.ept_mem_ops);
+		}
+		src_pml4e_p++;
+		dest_pml4e_p++;
+	}
+
+	/* Map [gpa_rebased, gpa_rebased + size) to secure ept mapping, with 2M pages when aligned */
 	ept_add_mr(vm, (uint64_t *)vm->arch_vm.sworld_eptp, hpa, gpa_rebased, size, EPT_RWX | EPT_WB);
 
 	/* Backup secure world info, will be used when destroy secure world and suspend UOS */
@@ -143,19 +165,14 @@ void destroy_secure_world(struct acrn_vm *vm, bool need_clr_mem)
 	}
 }
 
-static inline void save_fxstore_guest_area(struct ext_context *ext_ctx)
-{
-	asm volatile("fxsave (%0)"
-			: : "r" (ext_ctx->fxstore_guest_area) : "memory");
-}
-
-static inline void rstor_fxstore_guest_area(const struct ext_context *ext_ctx)
-{
-	asm volatile("fxrstor (%0)" : : "r" (ext_ctx->fxstore_guest_area));
-}
-
-static void save_world_ctx(struct acrn_vcpu *vcpu, struct ext_context *ext_ctx)
+/*
+ * Save the state of the running world. The switched MSRs other than
+ * IA32_KERNEL_GS_BASE are write-intercepted, their values are taken from
+ * vcpu->arch.switched_msrs[] instead of RDMSR.
+ */
+static void save_world_ctx(struct acrn_vcpu *vcpu, struct guest_cpu_context *ctx)
 {
+	struct ext_context *ext_ctx = &ctx->ext_ctx;
 	uint32_t i;
 
 	/* cache on-demand run_context for efer/rflags/rsp/rip/cr0/cr4 */
@@ -199,22 +216,54 @@ static void save_world_ctx(struct acrn_vcpu *vcpu, struct ext_context *ext_ctx)
 	ext_ctx->gdtr.limit = exec_vmread32(VMX_GUEST_GDTR_LIMIT);
 
 	/* MSRs which not in the VMCS */
-	ext_ctx->ia32_star = msr_read(MSR_IA32_STAR);
-	ext_ctx->ia32_lstar = msr_read(MSR_IA32_LSTAR);
-	ext_ctx->ia32_fmask = msr_read(MSR_IA32_FMASK);
+	ext_ctx->ia32_star = vcpu->arch.switched_msrs[SWITCHED_MSR_STAR];
+	ext_ctx->ia32_lstar = vcpu->arch.switched_msrs[SWITCHED_MSR_LSTAR];
+	ext_ctx->ia32_cstar = vcpu->arch.switched_msrs[SWITCHED_MSR_CSTAR];
+	ext_ctx->ia32_fmask = vcpu->arch.switched_msrs[SWITCHED_MSR_FMASK];
 	ext_ctx->ia32_kernel_gs_base = msr_read(MSR_IA32_KERNEL_GS_BASE);
 
-	/* FX area */
-	save_fxstore_guest_area(ext_ctx);
-
 	/* For MSRs need isolation between worlds */
 	for (i = 0U; i < NUM_WORLD_MSRS; i++) {
-		vcpu->arch.contexts[vcpu->arch.cur_context].world_msrs[i] = vcpu->arch.guest_msrs[i];
+		ctx->world_msrs[i] = vcpu->arch.guest_msrs[i];
+	}
+}
+
+static inline bool is_segment_equal(const struct segment_sel *a, const struct segment_sel *b)
+{
+	return (a->selector == b->selector) && (a->base == b->base) &&
+		(a->limit == b->limit) && (a->attr == b->attr);
+}
+
+/* only the segments which differ between the worlds are written */
+#define switch_segment(prev, next, SEG_NAME)			\
+{								\
+	if (!is_segment_equal(&(prev), &(next))) {		\
+		load_segment((next), SEG_NAME);			\
+	}							\
+}
+
+static inline void switch_vmcs_field(uint32_t field, uint64_t prev, uint64_t next)
+{
+	if (prev != next) {
+		exec_vmwrite(field, next);
 	}
 }
 
-static void load_world_ctx(struct acrn_vcpu *vcpu, const struct ext_context *ext_ctx)
+static inline void switch_world_msr(struct acrn_vcpu *vcpu, uint32_t idx, uint64_t prev, uint64_t next)
 {
+	if (prev != next) {
+		vcpu_set_switched_msr(vcpu, idx, next);
+	}
+}
+
+/*
+ * Load the state of the next world, the state of prev is in the registers
+ * and the VMCS, only what differs is written.
+ */
+static void load_world_ctx(struct acrn_vcpu *vcpu, const struct ext_context *prev,
+		const struct guest_cpu_context *ctx)
+{
+	const struct ext_context *ext_ctx = &ctx->ext_ctx;
 	uint32_t i;
 
 	/* mark to update on-demand run_context for efer/rflags/rsp/rip/cr0/cr4 */
@@ -224,45 +273,92 @@ static void load_world_ctx(struct acrn_vcpu *vcpu, const struct ext_context *ext
 	bitmap_set_lock(CPU_REG_RIP, &vcpu->reg_updated);
 	bitmap_set_lock(CPU_REG_CR0, &vcpu->reg_updated);
 	bitmap_set_lock(CPU_REG_CR4, &vcpu->reg_updated);
+	/* CR3 and CS are written below, the cached values are stale */
+	bitmap_clear_lock(CPU_REG_CR3, &vcpu->reg_cached);
+	bitmap_clear_lock(CPU_REG_CS, &vcpu->reg_cached);
 
 	/* VMCS Execution field */
-	exec_vmwrite64(VMX_TSC_OFFSET_FULL, ext_ctx->tsc_offset);
+	switch_vmcs_field(VMX_TSC_OFFSET_FULL, prev->tsc_offset, ext_ctx->tsc_offset);
 
 	/* VMCS GUEST field */
 	exec_vmwrite(VMX_GUEST_CR3, ext_ctx->cr3);
-	exec_vmwrite(VMX_GUEST_DR7, ext_ctx->dr7);
-	exec_vmwrite64(VMX_GUEST_IA32_DEBUGCTL_FULL, ext_ctx->ia32_debugctl);
-	exec_vmwrite64(VMX_GUEST_IA32_PAT_FULL, ext_ctx->ia32_pat);
-	exec_vmwrite32(VMX_GUEST_IA32_SYSENTER_CS, ext_ctx->ia32_sysenter_cs);
-	exec_vmwrite(VMX_GUEST_IA32_SYSENTER_ESP, ext_ctx->ia32_sysenter_esp);
-	exec_vmwrite(VMX_GUEST_IA32_SYSENTER_EIP, ext_ctx->ia32_sysenter_eip);
-	load_segment(ext_ctx->cs, VMX_GUEST_CS);
-	load_segment(ext_ctx->ss, VMX_GUEST_SS);
-	load_segment(ext_ctx->ds, VMX_GUEST_DS);
-	load_segment(ext_ctx->es, VMX_GUEST_ES);
-	load_segment(ext_ctx->fs, VMX_GUEST_FS);
-	load_segment(ext_ctx->gs, VMX_GUEST_GS);
-	load_segment(ext_ctx->tr, VMX_GUEST_TR);
-	load_segment(ext_ctx->ldtr, VMX_GUEST_LDTR);
+	switch_vmcs_field(VMX_GUEST_DR7, prev->dr7, ext_ctx->dr7);
+	switch_vmcs_field(VMX_GUEST_IA32_DEBUGCTL_FULL, prev->ia32_debugctl, ext_ctx->ia32_debugctl);
+	switch_vmcs_field(VMX_GUEST_IA32_PAT_FULL, prev->ia32_pat, ext_ctx->ia32_pat);
+	switch_vmcs_field(VMX_GUEST_IA32_SYSENTER_CS, prev->ia32_sysenter_cs, ext_ctx->ia32_sysenter_cs);
+	switch_vmcs_field(VMX_GUEST_IA32_SYSENTER_ESP, prev->ia32_sysenter_esp, ext_ctx->ia32_sysenter_esp);
+	switch_vmcs_field(VMX_GUEST_IA32_SYSENTER_EIP, prev->ia32_sysenter_eip, ext_ctx->ia32_sysenter_eip);
+	switch_segment(prev->cs, ext_ctx->cs, VMX_GUEST_CS);
+	switch_segment(prev->ss, ext_ctx->ss, VMX_GUEST_SS);
+	switch_segment(prev->ds, ext_ctx->ds, VMX_GUEST_DS);
+	switch_segment(prev->es, ext_ctx->es, VMX_GUEST_ES);
+	switch_segment(prev->fs, ext_ctx->fs, VMX_GUEST_FS);
+	switch_segment(prev->gs, ext_ctx->gs, VMX_GUEST_GS);
+	switch_segment(prev->tr, ext_ctx->tr, VMX_GUEST_TR);
+	switch_segment(prev->ldtr, ext_ctx->ldtr, VMX_GUEST_LDTR);
 	/* Only base and limit for IDTR and GDTR */
-	exec_vmwrite(VMX_GUEST_IDTR_BASE, ext_ctx->idtr.base);
-	exec_vmwrite(VMX_GUEST_GDTR_BASE, ext_ctx->gdtr.base);
-	exec_vmwrite32(VMX_GUEST_IDTR_LIMIT, ext_ctx->idtr.limit);
-	exec_vmwrite32(VMX_GUEST_GDTR_LIMIT, ext_ctx->gdtr.limit);
+	switch_vmcs_field(VMX_GUEST_IDTR_BASE, prev->idtr.base, ext_ctx->idtr.base);
+	switch_vmcs_field(VMX_GUEST_GDTR_BASE, prev->gdtr.base, ext_ctx->gdtr.base);
+	switch_vmcs_field(VMX_GUEST_IDTR_LIMIT, prev->idtr.limit, ext_ctx->idtr.limit);
+	switch_vmcs_field(VMX_GUEST_GDTR_LIMIT, prev->gdtr.limit, ext_ctx->gdtr.limit);
 
 	/* MSRs which not in the VMCS */
-	msr_write(MSR_IA32_STAR, ext_ctx->ia32_star);
-	msr_write(MSR_IA32_LSTAR, ext_ctx->ia32_lstar);
-	msr_write(MSR_IA32_FMASK, ext_ctx->ia32_fmask);
-	msr_write(MSR_IA32_KERNEL_GS_BASE, ext_ctx->ia32_kernel_gs_base);
-
-	/* FX area */
-	rstor_fxstore_guest_area(ext_ctx);
+	switch_world_msr(vcpu, SWITCHED_MSR_STAR, prev->ia32_star, ext_ctx->ia32_star);
+	switch_world_msr(vcpu, SWITCHED_MSR_LSTAR, prev->ia32_lstar, ext_ctx->ia32_lstar);
+	switch_world_msr(vcpu, SWITCHED_MSR_CSTAR, prev->ia32_cstar, ext_ctx->ia32_cstar);
+	switch_world_msr(vcpu, SWITCHED_MSR_FMASK, prev->ia32_fmask, ext_ctx->ia32_fmask);
+	switch_world_msr(vcpu, SWITCHED_MSR_KERNEL_GS_BASE, prev->ia32_kernel_gs_base, ext_ctx->ia32_kernel_gs_base);
 
 	/* For MSRs need isolation between worlds */
 	for (i = 0U; i < NUM_WORLD_MSRS; i++) {
-		vcpu->arch.guest_msrs[i] = vcpu->arch.contexts[!vcpu->arch.cur_context].world_msrs[i];
+		vcpu->arch.guest_msrs[i] = ctx->world_msrs[i];
+	}
+}
+
+/*
+ * The FPU registers, or vcpu->arch.xsave_area while the vCPU is switched out,
+ * hold the state of arch->fpu_world, see load_guest_state(). The one of the
+ * other world is in its guest_cpu_context.
+ */
+bool claim_world_fpu(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vcpu_arch *arch = &vcpu->arch;
+	bool claimed = false;
+
+	if (arch->fpu_world != arch->cur_context) {
+		switch_fpu_state(arch->contexts[arch->fpu_world].xsave_area,
+				arch->contexts[arch->cur_context].xsave_area, arch->xcr0);
+		arch->fpu_world = arch->cur_context;
+		vcpu_trap_fpu(vcpu, false);
+		claimed = true;
+	}
+
+	return claimed;
+}
+
+/*
+ * With the same XCR0 in both worlds the registers stay valid for either of
+ * them: the swap is left to the first FPU instruction of the next world, a
+ * world switch the FPU is not used across costs no XSAVE/XRSTOR. The swap is
+ * done right away on an XCR0 change, which is not allowed to keep the state
+ * of the components it disables.
+ */
+static void switch_world_fpu(struct acrn_vcpu *vcpu, struct guest_cpu_context *prev,
+		const struct guest_cpu_context *next, int32_t next_world)
+{
+	struct acrn_vcpu_arch *arch = &vcpu->arch;
+
+	prev->xcr0 = arch->xcr0;
+	if (arch->fpu_world == next_world) {
+		vcpu_trap_fpu(vcpu, false);
+	} else if (next->xcr0 == arch->xcr0) {
+		vcpu_trap_fpu(vcpu, true);
+	} else {
+		switch_fpu_state(arch->contexts[arch->fpu_world].xsave_area, next->xsave_area, next->xcr0);
+		arch->fpu_world = next_world;
+		vcpu_trap_fpu(vcpu, false);
 	}
+	arch->xcr0 = next->xcr0;
 }
 
 static void copy_smc_param(const struct run_context *prev_ctx,
@@ -279,10 +375,11 @@ void switch_world(struct acrn_vcpu *vcpu, int32_t next_world)
 	struct acrn_vcpu_arch *arch = &vcpu->arch;
 
 	/* save previous world context */
-	save_world_ctx(vcpu, &arch->contexts[!next_world].ext_ctx);
+	save_world_ctx(vcpu, &arch->contexts[!next_world]);
 
 	/* load next world context */
-	load_world_ctx(vcpu, &arch->contexts[next_world].ext_ctx);
+	load_world_ctx(vcpu, &arch->contexts[!next_world].ext_ctx, &arch->contexts[next_world]);
+	switch_world_fpu(vcpu, &arch->contexts[!next_world], &arch->contexts[next_world], next_world);
 
 	/* Copy SMC parameters: RDI, RSI, RDX, RBX */
 	copy_smc_param(&arch->contexts[!next_world].run_ctx,
@@ -291,16 +388,14 @@ void switch_world(struct acrn_vcpu *vcpu, int32_t next_world)
 	if (next_world == NORMAL_WORLD) {
 		/* load EPTP for next world */
 		exec_vmwrite64(VMX_EPT_POINTER_FULL,
-			hva2hpa(vcpu->vm->arch_vm.nworld_eptp) |
-			(3UL << 3U) | 0x6UL);
+			ept_pointer(vcpu->vm, vcpu->vm->arch_vm.nworld_eptp));
 
 #ifndef CONFIG_L1D_FLUSH_VMENTRY_ENABLED
 		cpu_l1d_flush();
 #endif
 	} else {
 		exec_vmwrite64(VMX_EPT_POINTER_FULL,
-			hva2hpa(vcpu->vm->arch_vm.sworld_eptp) |
-			(3UL << 3U) | 0x6UL);
+			ept_pointer(vcpu->vm, vcpu->vm->arch_vm.sworld_eptp));
 	}
 
 	/* Update world index */
@@ -382,6 +477,8 @@ static bool init_secure_world_env(struct acrn_vcpu *vcpu,
 		TRUSTY_EPT_REBASE_GPA + size;
 
 	vcpu->arch.contexts[SECURE_WORLD].ext_ctx.tsc_offset = 0UL;
+	vcpu->arch.contexts[SECURE_WORLD].xcr0 = XCR0_X87;
+	init_xsave_area(vcpu->arch.contexts[SECURE_WORLD].xsave_area);
 
 	/* Init per world MSRs */
 	for (i = 0U; i < NUM_WORLD_MSRS; i++) {
@@ -430,17 +527,20 @@ bool initialize_trusty(struct acrn_vcpu *vcpu, struct trusty_boot_param *boot_pa
 			trusty_base_hpa = vm->sworld_control.sworld_memory.base_hpa;
 
 			exec_vmwrite64(VMX_EPT_POINTER_FULL,
-					hva2hpa(vm->arch_vm.sworld_eptp) | (3UL << 3U) | 0x6UL);
+					ept_pointer(vm, vm->arch_vm.sworld_eptp));
 
-			/* save Normal World context */
-			save_world_ctx(vcpu, &vcpu->arch.contexts[NORMAL_WORLD].ext_ctx);
+			/* save Normal World context, its FPU state included */
+			save_world_ctx(vcpu, &vcpu->arch.contexts[NORMAL_WORLD]);
+			(void)claim_world_fpu(vcpu);
 
 			/* init secure world environment */
 			if (init_secure_world_env(vcpu,
 				(trusty_entry_gpa - trusty_base_gpa) + TRUSTY_EPT_REBASE_GPA,
 				trusty_base_hpa, trusty_mem_size, rpmb_key)) {
 
-				/* switch to Secure World */
+				/* switch to Secure World, it starts with the init FPU state */
+				switch_world_fpu(vcpu, &vcpu->arch.contexts[NORMAL_WORLD],
+					&vcpu->arch.contexts[SECURE_WORLD], SECURE_WORLD);
 				vcpu->arch.cur_context = SECURE_WORLD;
 			} else {
 				success = false;
@@ -451,8 +551,10 @@ bool initialize_trusty(struct acrn_vcpu *vcpu, struct trusty_boot_param *boot_pa
 	return success;
 }
 
+/* called from the Normal World, the FPU state of the Secure World gets out of the registers first */
 void save_sworld_context(struct acrn_vcpu *vcpu)
 {
+	(void)claim_world_fpu(vcpu);
 	(void)memcpy_s((void *)&vcpu->vm->sworld_snapshot, sizeof(struct guest_cpu_context),
 			(void *)&vcpu->arch.contexts[SECURE_WORLD], sizeof(struct guest_cpu_context));
 }
@@ -462,6 +564,7 @@ void restore_sworld_context(struct acrn_vcpu *vcpu)
 	struct secure_world_control *sworld_ctl =
 		&vcpu->vm->sworld_control;
 
+	(void)claim_world_fpu(vcpu);
 	create_secure_world_ept(vcpu->vm,
 		sworld_ctl->sworld_memory.base_gpa_in_uos,
 		sworld_ctl->sworld_memory.length,
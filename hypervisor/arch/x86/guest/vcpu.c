@@ -11,6 +11,7 @@
 #include <vmx.h>
 #include <logmsg.h>
 #include <cpu_caps.h>
+#include <cpufeatures.h>
 #include <per_cpu.h>
 #include <init.h>
 #include <vm.h>
@@ -123,6 +124,28 @@ void vcpu_set_rflags(struct acrn_vcpu *vcpu, uint64_t val)
 	bitmap_set_lock(CPU_REG_RFLAGS, &vcpu->reg_updated);
 }
 
+uint64_t vcpu_get_cr3(struct acrn_vcpu *vcpu)
+{
+	struct run_context *ctx =
+		&vcpu->arch.contexts[vcpu->arch.cur_context].run_ctx;
+
+	if (!bitmap_test_and_set_lock(CPU_REG_CR3, &vcpu->reg_cached)) {
+		ctx->cr3 = exec_vmread(VMX_GUEST_CR3);
+	}
+	return ctx->cr3;
+}
+
+uint32_t vcpu_get_cs_attr(struct acrn_vcpu *vcpu)
+{
+	struct run_context *ctx =
+		&vcpu->arch.contexts[vcpu->arch.cur_context].run_ctx;
+
+	if (!bitmap_test_and_set_lock(CPU_REG_CS, &vcpu->reg_cached)) {
+		ctx->cs_attr = exec_vmread32(VMX_GUEST_CS_ATTR);
+	}
+	return ctx->cs_attr;
+}
+
 uint64_t vcpu_get_guest_msr(const struct acrn_vcpu *vcpu, uint32_t msr)
 {
 	uint32_t index = vmsr_get_guest_msr_index(msr);
@@ -354,6 +377,81 @@ void init_vcpu_protect_mode_regs(struct acrn_vcpu *vcpu, uint64_t vgdt_base_gpa)
 	set_vcpu_regs(vcpu, &vcpu_regs);
 }
 
+/* Intel SDM Vol1 10.5.1, init values of the legacy region of the XSAVE area */
+#define XSAVE_FCW_OFFSET	0U
+#define XSAVE_MXCSR_OFFSET	24U
+#define XSAVE_HEADER_OFFSET	512U	/* XSTATE_BV of the XSAVE header */
+#define FCW_INIT		0x037FU
+#define MXCSR_INIT		0x1F80U
+
+/*
+ * The initial state of the x87, SSE and AVX registers. XRSTOR inits the
+ * components which are not in XSTATE_BV, but loads MXCSR from the area.
+ */
+void init_xsave_area(uint8_t *area)
+{
+	uint16_t fcw = FCW_INIT;
+	uint32_t mxcsr = MXCSR_INIT;
+
+	(void)memset((void *)area, 0U, XSAVE_AREA_SIZE);
+	(void)memcpy_s(&area[XSAVE_FCW_OFFSET], sizeof(fcw), &fcw, sizeof(fcw));
+	(void)memcpy_s(&area[XSAVE_MXCSR_OFFSET], sizeof(mxcsr), &mxcsr, sizeof(mxcsr));
+}
+
+/*
+ * XSAVEOPT skips the components not modified since the XRSTOR of the area,
+ * and the ones in their init state. XSTATE_BV of a saved area is limited to
+ * the XCR0 of its owner, XRSTOR faults on the bits not enabled in XCR0.
+ */
+void switch_fpu_state(uint8_t *save_area, const uint8_t *load_area, uint64_t load_xcr0)
+{
+	uint64_t cur_xcr0, rfbm, xstate_bv;
+
+	if (pcpu_has_cap(X86_FEATURE_XSAVE)) {
+		cur_xcr0 = read_xcr(0);
+		if (save_area != NULL) {
+			if (pcpu_has_cap(X86_FEATURE_XSAVEOPT)) {
+				xsaveopt(save_area, cur_xcr0);
+			} else {
+				xsave(save_area, cur_xcr0);
+			}
+			(void)memcpy_s(&xstate_bv, sizeof(xstate_bv), &save_area[XSAVE_HEADER_OFFSET], sizeof(xstate_bv));
+			if ((xstate_bv & ~cur_xcr0) != 0UL) {
+				xstate_bv &= cur_xcr0;
+				(void)memcpy_s(&save_area[XSAVE_HEADER_OFFSET], sizeof(xstate_bv),
+						&xstate_bv, sizeof(xstate_bv));
+			}
+		}
+
+		/* the components of the previous owner not in load_area are put in their init state */
+		rfbm = cur_xcr0 | load_xcr0;
+		if (rfbm != cur_xcr0) {
+			write_xcr(0, rfbm);
+		}
+		xrstor(load_area, rfbm);
+		if (rfbm != load_xcr0) {
+			write_xcr(0, load_xcr0);
+		}
+	} else {
+		if (save_area != NULL) {
+			fxsave(save_area);
+		}
+		fxrstor(load_area);
+	}
+}
+
+static void init_guest_fpu(struct acrn_vcpu *vcpu)
+{
+	init_xsave_area(vcpu->arch.xsave_area);
+	vcpu->arch.xcr0 = XCR0_X87;
+	(void)memset((void *)vcpu->arch.switched_msrs, 0U, sizeof(vcpu->arch.switched_msrs));
+
+	/* not loaded any more, the pCPU keeps a stale state */
+	if (per_cpu(loaded_vcpu, vcpu->pcpu_id) == vcpu) {
+		per_cpu(loaded_vcpu, vcpu->pcpu_id) = NULL;
+	}
+}
+
 void set_vcpu_startup_entry(struct acrn_vcpu *vcpu, uint64_t entry)
 {
 	struct ext_context *ectx;
@@ -368,20 +466,19 @@ void set_vcpu_startup_entry(struct acrn_vcpu *vcpu, uint64_t entry)
 /*
  *  @pre vm != NULL && rtn_vcpu_handle != NULL
  */
-int32_t create_vcpu(uint16_t pcpu_id, struct acrn_vm *vm, struct acrn_vcpu **rtn_vcpu_handle)
+int32_t create_vcpu(uint16_t pcpu_id, uint16_t vcpu_id, struct acrn_vm *vm, struct acrn_vcpu **rtn_vcpu_handle)
 {
 	struct acrn_vcpu *vcpu;
-	uint16_t vcpu_id;
 	int32_t ret;
 
 	pr_info("Creating VCPU working on PCPU%hu", pcpu_id);
 
 	/*
-	 * vcpu->vcpu_id = vm->hw.created_vcpus;
-	 * vm->hw.created_vcpus++;
+	 * Either the next vCPU of the VM, or an offline one created again for
+	 * a pCPU handed to the VM at runtime, see hcall_create_vcpu().
 	 */
-	vcpu_id = vm->hw.created_vcpus;
-	if (vcpu_id < CONFIG_MAX_VCPUS_PER_VM) {
+	if ((vcpu_id < CONFIG_MAX_VCPUS_PER_VM) && ((vcpu_id == vm->hw.created_vcpus) ||
+			((vcpu_id < vm->hw.created_vcpus) && (vm->hw.vcpu_array[vcpu_id].state == VCPU_OFFLINE)))) {
 		/* Allocate memory for VCPU */
 		vcpu = &(vm->hw.vcpu_array[vcpu_id]);
 		(void)memset((void *)vcpu, 0U, sizeof(struct acrn_vcpu));
@@ -393,14 +490,10 @@ int32_t create_vcpu(uint16_t pcpu_id, struct acrn_vm *vm, struct acrn_vcpu **rtn
 
 		/* Initialize the parent VM reference */
 		vcpu->vm = vm;
-
-		/* Initialize the virtual ID for this VCPU */
-		/* FIXME:
-		 * We have assumption that we always destroys vcpus in one
-		 * shot (like when vm is destroyed). If we need to support
-		 * specific vcpu destroy on fly, this vcpu_id assignment
-		 * needs revise.
-		 */
+		init_guest_fpu(vcpu);
+		/* the CLOS of the VM configuration, the SOS may change it by HC_VM_SET_CLOS */
+		vcpu->arch.clos = cat_cap_info.enabled ? get_vm_config(vm->vm_id)->clos : hv_clos;
+		vcpu->arch.rmid = vm_rmid(vm->vm_id);
 
 		per_cpu(vcpu, pcpu_id) = vcpu;
 
@@ -440,7 +533,9 @@ int32_t create_vcpu(uint16_t pcpu_id, struct acrn_vm *vm, struct acrn_vcpu **rtn
 
 		reset_vcpu_regs(vcpu);
 		(void)memset((void *)&vcpu->req, 0U, sizeof(struct io_request));
-		vm->hw.created_vcpus++;
+		if (vcpu_id == vm->hw.created_vcpus) {
+			vm->hw.created_vcpus++;
+		}
 		ret = 0;
 	} else {
 		pr_err("%s, vcpu id is invalid!\n", __func__);
@@ -461,10 +556,8 @@ int32_t run_vcpu(struct acrn_vcpu *vcpu)
 		&vcpu->arch.contexts[vcpu->arch.cur_context].run_ctx;
 	int32_t status = 0;
 	int32_t ibrs_type = get_ibrs_type();
+	bool rip_updated = bitmap_test_and_clear_lock(CPU_REG_RIP, &vcpu->reg_updated);
 
-	if (bitmap_test_and_clear_lock(CPU_REG_RIP, &vcpu->reg_updated)) {
-		exec_vmwrite(VMX_GUEST_RIP, ctx->rip);
-	}
 	if (bitmap_test_and_clear_lock(CPU_REG_RSP, &vcpu->reg_updated)) {
 		exec_vmwrite(VMX_GUEST_RSP, ctx->cpu_regs.regs.rsp);
 	}
@@ -493,23 +586,29 @@ int32_t run_vcpu(struct acrn_vcpu *vcpu)
 		pr_info("VM %d Starting VCPU %hu",
 				vcpu->vm->vm_id, vcpu->vcpu_id);
 
+		if (rip_updated) {
+			exec_vmwrite(VMX_GUEST_RIP, ctx->rip);
+		}
+
 		if (vcpu->arch.vpid != 0U) {
 			exec_vmwrite16(VMX_VPID, vcpu->arch.vpid);
 		}
 
 		/*
 		 * A power-up or a reset invalidates all linear mappings,
-		 * guest-physical mappings, and combined mappings
+		 * guest-physical mappings, and combined mappings. Only the
+		 * ones tagged with the VPID and the EPTP of this vCPU, the
+		 * other VMs keep their TLB entries.
 		 */
-		flush_vpid_global();
+		flush_vpid_single(vcpu->arch.vpid);
+		invept(vcpu->vm->arch_vm.nworld_eptp);
 
 		/* Set vcpu launched */
 		vcpu->launched = true;
 
 		/* avoid VMCS recycling RSB usage, set IBPB.
-		 * NOTE: this should be done for any time vmcs got switch
-		 * currently, there is no other place to do vmcs switch
-		 * Please add IBPB set for future vmcs switch case(like trusty)
+		 * NOTE: this should be done for any time vmcs got switch,
+		 * see also load_vmcs()
 		 */
 		if (ibrs_type == IBRS_RAW) {
 			msr_write(MSR_IA32_PRED_CMD, PRED_SET_IBPB);
@@ -534,12 +633,19 @@ int32_t run_vcpu(struct acrn_vcpu *vcpu)
 		}
 	} else {
 		/* This VCPU was already launched, check if the last guest
-		 * instruction needs to be repeated and resume VCPU accordingly
+		 * instruction needs to be repeated and resume VCPU accordingly,
+		 * RIP is written once, and not at all if it did not change.
 		 */
 		instlen = vcpu->arch.inst_len;
-		rip = vcpu_get_rip(vcpu);
-		exec_vmwrite(VMX_GUEST_RIP, ((rip+(uint64_t)instlen) &
-				0xFFFFFFFFFFFFFFFFUL));
+		if (rip_updated || (instlen != 0U)) {
+			if (rip_updated) {
+				rip = ctx->rip;
+			} else {
+				rip = vcpu_get_rip(vcpu);
+			}
+			exec_vmwrite(VMX_GUEST_RIP, ((rip+(uint64_t)instlen) &
+					0xFFFFFFFFFFFFFFFFUL));
+		}
 #ifdef CONFIG_L1D_FLUSH_VMENTRY_ENABLED
 		cpu_l1d_flush();
 #endif
@@ -547,13 +653,25 @@ int32_t run_vcpu(struct acrn_vcpu *vcpu)
 		/* Mitigation for MDS vulnerability, overwrite CPU internal buffers */
 		cpu_internal_buffers_clear();
 
-		/* Resume the VM */
-		status = vmx_vmrun(ctx, VM_RESUME, ibrs_type);
+		if (vcpu->arch.vmcs_cleared) {
+			/*
+			 * Moved over from another pCPU, see vcpu_migrate(). The
+			 * TLB entries this pCPU kept of the VPID and the EPTP
+			 * from an earlier stay of the vCPU are stale.
+			 */
+			flush_vpid_single(vcpu->arch.vpid);
+			invept(vcpu->vm->arch_vm.nworld_eptp);
+			vcpu->arch.vmcs_cleared = false;
+			status = vmx_vmrun(ctx, VM_LAUNCH, ibrs_type);
+		} else {
+			/* Resume the VM */
+			status = vmx_vmrun(ctx, VM_RESUME, ibrs_type);
+		}
 	}
 
 	vcpu->reg_cached = 0UL;
 
-	cs_attr = exec_vmread32(VMX_GUEST_CS_ATTR);
+	cs_attr = vcpu_get_cs_attr(vcpu);
 	ia32_efer = vcpu_get_efer(vcpu);
 	cr0 = vcpu_get_cr0(vcpu);
 	set_vcpu_mode(vcpu, cs_attr, ia32_efer, cr0);
@@ -579,6 +697,119 @@ int32_t run_vcpu(struct acrn_vcpu *vcpu)
 
 	return status;
 }
+/*
+ * Only the pCPU of the vCPU writes the page, plain stores are enough. The
+ * scheduler times are accounted by other pCPUs as well, under the
+ * scheduler_lock, and are copied as they are.
+ */
+void update_vcpu_stats(struct acrn_vcpu *vcpu, uint32_t basic_exit_reason,
+		uint64_t guest_cycles, uint64_t root_cycles)
+{
+	struct acrn_vcpu_stats *stats = vcpu->arch.stats;
+	const struct sched_context *ctx = &per_cpu(sched_ctx, vcpu->pcpu_id);
+	const struct rmid_stats *rdt = get_rmid_stats(vcpu->arch.rmid);
+	const struct softirq_stats *softirq = &per_cpu(softirq_stats, vcpu->pcpu_id);
+	uint16_t i;
+
+	if (stats != NULL) {
+		stac();
+		if (basic_exit_reason < VMEXIT_STATS_REASONS) {
+			stats->exits[basic_exit_reason]++;
+		}
+		stats->guest_tsc += guest_cycles;
+		stats->root_tsc += root_cycles;
+		stats->injected_intrs = vcpu->arch.nr_injected;
+		stats->blocked_tsc = vcpu->sched_obj.blocked_tsc;
+		stats->steal_tsc = vcpu->sched_obj.wait_tsc;
+		stats->pcpu_switches = ctx->nr_switches;
+		stats->pcpu_idle_tsc = ctx->idle_tsc;
+		stats->llc_occupancy = rdt->llc_occupancy;
+		stats->mbm_total_bytes = rdt->mbm_total_bytes;
+		stats->mbm_local_bytes = rdt->mbm_local_bytes;
+		for (i = 0U; i < NR_SOFTIRQS; i++) {
+			stats->softirq_runs[i] = softirq->runs[i];
+			stats->softirq_tsc[i] = softirq->tsc[i];
+			stats->softirq_max_tsc[i] = softirq->max_tsc[i];
+		}
+		clac();
+	}
+}
+
+static uint64_t tsc_to_ns(uint64_t cycles)
+{
+	uint64_t khz = (uint64_t)get_tsc_khz();
+
+	return ((cycles / khz) * 1000000UL) + (((cycles % khz) * 1000000UL) / khz);
+}
+
+void update_steal_time(struct acrn_vcpu *vcpu, bool preempted)
+{
+	struct acrn_steal_time *st = vcpu->arch.steal_time;
+
+	if (st != NULL) {
+		stac();
+		st->version++;
+		cpu_write_memory_barrier();
+		st->steal = tsc_to_ns(vcpu->sched_obj.wait_tsc - vcpu->arch.steal_time_base);
+		st->preempted = preempted ? 1U : 0U;
+		cpu_write_memory_barrier();
+		st->version++;
+		clac();
+	}
+}
+
+/*
+ * tsc_to_system_mul and tsc_shift of the TSC frequency, scaled for
+ * tsc_to_system_mul to have its top bit set:
+ *   ns = ((cycles << shift) * mul) >> 32
+ */
+static void pvclock_scale(uint32_t khz, uint32_t *mul, int8_t *shift)
+{
+	int32_t s = 0;
+	uint64_t m = (1000000UL << 32U) / khz;
+
+	while (m > 0xFFFFFFFFUL) {
+		s++;
+		m = (1000000UL << (uint32_t)(32 - s)) / khz;
+	}
+	/* 1000000 < 2^20, at most 2^(20 + 32 + 8) */
+	while ((m < 0x80000000UL) && (s > -8)) {
+		s--;
+		m = (1000000UL << (uint32_t)(32 - s)) / khz;
+	}
+
+	*mul = (uint32_t)m;
+	*shift = (int8_t)s;
+}
+
+void update_pvclock(struct acrn_vcpu *vcpu)
+{
+	struct acrn_pvclock *pvc = vcpu->arch.pvclock;
+	uint64_t tsc_offset, guest_tsc;
+	uint32_t khz = get_tsc_khz();
+	uint32_t mul;
+	int8_t shift;
+
+	if (pvc != NULL) {
+		pvclock_scale(khz, &mul, &shift);
+		tsc_offset = exec_vmread64(VMX_TSC_OFFSET_FULL);
+		guest_tsc = rdtsc() + tsc_offset;
+
+		stac();
+		pvc->version++;
+		cpu_write_memory_barrier();
+		pvc->tsc_timestamp = guest_tsc;
+		pvc->system_time = tsc_to_ns(guest_tsc);
+		pvc->tsc_to_system_mul = mul;
+		pvc->tsc_shift = shift;
+		pvc->flags = ACRN_PVCLOCK_TSC_STABLE;
+		pvc->tsc_khz = khz;
+		pvc->tsc_offset = tsc_offset;
+		cpu_write_memory_barrier();
+		pvc->version++;
+		clac();
+	}
+}
 
 /*
  *  @pre vcpu != NULL
@@ -639,7 +870,17 @@ void reset_vcpu(struct acrn_vcpu *vcpu)
 
 		vcpu->arch.exception_info.exception = VECTOR_INVALID;
 		vcpu->arch.cur_context = NORMAL_WORLD;
+		vcpu->arch.fpu_world = NORMAL_WORLD;
+		vcpu->arch.fpu_trapped = false;
 		vcpu->arch.irq_window_enabled = false;
+		vcpu->arch.halted = false;
+		vcpu->arch.halt_poll_cycles = 0UL;
+		vcpu->arch.steal_time_msr = 0UL;
+		vcpu->arch.steal_time = NULL;
+		vcpu->arch.pvclock_msr = 0UL;
+		vcpu->arch.pvclock = NULL;
+		vcpu->arch.vmcs_cleared = false;
+		init_guest_fpu(vcpu);
 		vcpu->sched_obj.host_sp = build_stack_frame(vcpu);
 		(void)memset((void *)vcpu->arch.vmcs, 0U, PAGE_SIZE);
 
@@ -656,6 +897,23 @@ void reset_vcpu(struct acrn_vcpu *vcpu)
 	}
 }
 
+/*
+ * A runnable vCPU waiting for its pCPU may be moved to another one, see
+ * vcpu_migrate(), the pcpu_id is stable once the scheduler_lock of the
+ * pCPU is held.
+ */
+static void lock_vcpu_pcpu(struct acrn_vcpu *vcpu)
+{
+	uint16_t pcpu_id = vcpu->pcpu_id;
+
+	get_schedule_lock(pcpu_id);
+	while (vcpu->pcpu_id != pcpu_id) {
+		release_schedule_lock(pcpu_id);
+		pcpu_id = vcpu->pcpu_id;
+		get_schedule_lock(pcpu_id);
+	}
+}
+
 void pause_vcpu(struct acrn_vcpu *vcpu, enum vcpu_state new_state)
 {
 	uint16_t pcpu_id = get_pcpu_id();
@@ -663,12 +921,12 @@ void pause_vcpu(struct acrn_vcpu *vcpu, enum vcpu_state new_state)
 	pr_dbg("vcpu%hu paused, new state: %d",
 		vcpu->vcpu_id, new_state);
 
-	get_schedule_lock(vcpu->pcpu_id);
+	lock_vcpu_pcpu(vcpu);
 	vcpu->prev_state = vcpu->state;
 	vcpu->state = new_state;
 
 	if (vcpu->running) {
-		remove_from_cpu_runqueue(&vcpu->sched_obj);
+		remove_from_cpu_runqueue(&vcpu->sched_obj, vcpu->pcpu_id);
 
 		if (is_lapic_pt_enabled(vcpu)) {
 			make_reschedule_request(vcpu->pcpu_id, DEL_MODE_INIT);
@@ -684,11 +942,55 @@ void pause_vcpu(struct acrn_vcpu *vcpu, enum vcpu_state new_state)
 			}
 		}
 	} else {
-		remove_from_cpu_runqueue(&vcpu->sched_obj);
+		remove_from_cpu_runqueue(&vcpu->sched_obj, vcpu->pcpu_id);
 		release_schedule_lock(vcpu->pcpu_id);
 	}
 }
 
+/*
+ * pause_vcpu() of the vCPUs of vcpu_mask in one pass: all of them are taken
+ * off their runqueues and kicked by a single multicast IPI before waiting for
+ * any to be switched out.
+ */
+void pause_vcpus(struct acrn_vm *vm, uint64_t vcpu_mask, enum vcpu_state new_state)
+{
+	uint16_t i, pcpu_id = get_pcpu_id();
+	uint64_t kick_mask = 0UL, wait_mask = 0UL;
+	struct acrn_vcpu *vcpu;
+
+	foreach_vcpu(i, vm, vcpu) {
+		if ((vcpu_mask & (1UL << i)) != 0UL) {
+			pr_dbg("vcpu%hu paused, new state: %d", vcpu->vcpu_id, new_state);
+
+			lock_vcpu_pcpu(vcpu);
+			vcpu->prev_state = vcpu->state;
+			vcpu->state = new_state;
+			remove_from_cpu_runqueue(&vcpu->sched_obj, vcpu->pcpu_id);
+			if (vcpu->running) {
+				if (is_lapic_pt_enabled(vcpu)) {
+					make_reschedule_request(vcpu->pcpu_id, DEL_MODE_INIT);
+				} else {
+					bitmap_set_nolock(vcpu->pcpu_id, &kick_mask);
+				}
+				if (vcpu->pcpu_id != pcpu_id) {
+					bitmap_set_nolock(i, &wait_mask);
+				}
+			}
+			release_schedule_lock(vcpu->pcpu_id);
+		}
+	}
+
+	make_reschedule_request_mask(kick_mask);
+
+	foreach_vcpu(i, vm, vcpu) {
+		if ((wait_mask & (1UL << i)) != 0UL) {
+			while (vcpu->running) {
+				asm_pause();
+			}
+		}
+	}
+}
+
 void resume_vcpu(struct acrn_vcpu *vcpu)
 {
 	pr_dbg("vcpu%hu resumed", vcpu->vcpu_id);
@@ -696,22 +998,48 @@ void resume_vcpu(struct acrn_vcpu *vcpu)
 	get_schedule_lock(vcpu->pcpu_id);
 	vcpu->state = vcpu->prev_state;
 
-	if (vcpu->state == VCPU_RUNNING) {
+	/* a halted vCPU gets back on the runqueue in wake_vcpu() */
+	if ((vcpu->state == VCPU_RUNNING) && !vcpu->arch.halted) {
 		add_to_cpu_runqueue(&vcpu->sched_obj, vcpu->pcpu_id);
 		make_reschedule_request(vcpu->pcpu_id, DEL_MODE_IPI);
 	}
 	release_schedule_lock(vcpu->pcpu_id);
 }
 
+/*
+ * The FPU state, XCR0 and the MSRs out of the VMCS of the last vCPU run on
+ * the pCPU stay in the registers, the hypervisor doesn't use them. They are
+ * only swapped when another vCPU is switched in, so a switch between a vCPU
+ * and idle costs nothing.
+ *
+ * @pre vcpu->pcpu_id == get_pcpu_id()
+ */
+static void load_guest_state(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vcpu **loaded = &get_cpu_var(loaded_vcpu);
+	struct acrn_vcpu *prev = *loaded;
+
+	if (prev != vcpu) {
+		switch_fpu_state((prev != NULL) ? prev->arch.xsave_area : NULL,
+				vcpu->arch.xsave_area, vcpu->arch.xcr0);
+		switch_guest_msrs(prev, vcpu);
+		*loaded = vcpu;
+	}
+}
+
 static void context_switch_out(struct sched_object *prev)
 {
 	struct acrn_vcpu *vcpu = list_entry(prev, struct acrn_vcpu, sched_obj);
 
 	vcpu->running = false;
-	/* do prev vcpu context switch out */
-	/* For now, we don't need to invalid ept.
-	 * But if we have more than one vcpu on one pcpu,
-	 * we need add ept invalid operation here.
+	/* still on the runqueue, it is preempted */
+	update_steal_time(vcpu, !list_empty(&prev->run_list));
+	/* the timers of the pCPU were served by the VMX preemption timer */
+	resume_physical_timer();
+	/*
+	 * The guest state is left in the pCPU, see load_guest_state(). No EPT
+	 * invalidation is needed either: the TLB entries are tagged with the
+	 * VPID and the EPTP, and the EPT flush requests are per vCPU.
 	 */
 }
 
@@ -720,13 +1048,60 @@ static void context_switch_in(struct sched_object *next)
 	struct acrn_vcpu *vcpu = list_entry(next, struct acrn_vcpu, sched_obj);
 
 	vcpu->running = true;
-	/* FIXME:
-	 * Now, we don't need to load new vcpu VMCS because
-	 * we only do switch between vcpu loop and idle loop.
-	 * If we have more than one vcpu on on pcpu, need to
-	 * add VMCS load operation here.
-	 */
+	update_steal_time(vcpu, false);
+	/* a vCPU not launched yet gets its VMCS loaded by init_vmcs() */
+	if (vcpu->launched) {
+		load_vmcs(vcpu);
+	}
+	load_guest_state(vcpu);
+	load_pqr_assoc(vcpu->arch.rmid, vcpu->arch.clos);
+	vlapic_restart_migrated_timer(vcpu_vlapic(vcpu));
+}
+
+#ifdef CONFIG_SCHED_MIGRATION
+/*
+ * Move a vCPU waiting on the runqueue of this pCPU over to pcpu_id. Its
+ * VMCS is cleared here, the pCPU it ran on last, and loaded on pcpu_id by
+ * context_switch_in(). A vCPU whose FPU and MSRs are still in the
+ * registers of this pCPU stays, see load_guest_state().
+ */
+static bool vcpu_migrate(struct sched_object *obj, uint16_t pcpu_id)
+{
+	struct acrn_vcpu *vcpu = list_entry(obj, struct acrn_vcpu, sched_obj);
+	bool moved = false;
+
+	if (vcpu->launched && (vcpu->pcpu_id == get_pcpu_id()) && (get_cpu_var(loaded_vcpu) != vcpu)) {
+		clear_vmcs(vcpu);
+		vlapic_migrate(vcpu_vlapic(vcpu), pcpu_id);
+		vcpu->arch.msr_area.host[MSR_AREA_TSC_AUX].value = pcpu_id;
+		vcpu->pcpu_id = pcpu_id;
+		moved = true;
+	}
+
+	return moved;
+}
+
+/*
+ * The vCPUs of a VM may run on any pCPU of the VM, except the ones whose
+ * LAPIC, or timing, is bound to their pCPU and the ones with a secure world.
+ */
+static uint64_t vcpu_migrate_mask(const struct acrn_vm *vm)
+{
+	const struct acrn_vm_config *vm_config = get_vm_config(vm->vm_id);
+	uint64_t mask = 0UL;
+	uint16_t i;
+
+	if (!is_lapic_pt_configured(vm) && !is_rt_vm(vm) &&
+			((vm_config->guest_flags & GUEST_FLAG_SECURE_WORLD_ENABLED) == 0UL)) {
+		for (i = 0U; i < vm_config->vcpu_num; i++) {
+			mask |= vm_config->vcpu_affinity[i];
+		}
+	}
+
+	/* nowhere to move to with a single pCPU */
+	return (bitmap_weight(mask) > 1U) ? mask : 0UL;
 }
+#endif
 
 void schedule_vcpu(struct acrn_vcpu *vcpu)
 {
@@ -739,22 +1114,199 @@ void schedule_vcpu(struct acrn_vcpu *vcpu)
 	release_schedule_lock(vcpu->pcpu_id);
 }
 
+/* schedule_vcpu() of the vCPUs of vcpu_mask, with a single multicast IPI */
+void schedule_vcpus(struct acrn_vm *vm, uint64_t vcpu_mask)
+{
+	uint16_t i;
+	uint64_t kick_mask = 0UL;
+	struct acrn_vcpu *vcpu;
+
+	foreach_vcpu(i, vm, vcpu) {
+		if ((vcpu_mask & (1UL << i)) != 0UL) {
+			vcpu->state = VCPU_RUNNING;
+			pr_dbg("vcpu%hu scheduled", vcpu->vcpu_id);
+
+			get_schedule_lock(vcpu->pcpu_id);
+			add_to_cpu_runqueue(&vcpu->sched_obj, vcpu->pcpu_id);
+			release_schedule_lock(vcpu->pcpu_id);
+			bitmap_set_nolock(vcpu->pcpu_id, &kick_mask);
+		}
+	}
+
+	make_reschedule_request_mask(kick_mask);
+}
+
+/*
+ * The events other pCPUs may latch for a halted vCPU, they are followed by
+ * wake_vcpu(). The locked updates of the events pair with the barrier taken
+ * by vcpu_halt() between setting halted and this check.
+ */
+static bool vcpu_has_wakeup_event(struct acrn_vcpu *vcpu)
+{
+	return (vcpu->arch.pending_req != 0UL) || vlapic_has_posted_intr(vcpu_vlapic(vcpu));
+}
+
+/*
+ * The poll window grows when the vCPU is woken up shortly after it blocked
+ * and shrinks when it blocked longer than the maximum window, the same way
+ * as the one of the idle loop. Polling is pointless when other objects wait
+ * for the pCPU, the vCPU blocks right away then.
+ */
+void vcpu_halt(struct acrn_vcpu *vcpu)
+{
+	uint16_t pcpu_id = vcpu->pcpu_id;
+	uint64_t start;
+
+	/*
+	 * The lazy EOIs done right before HLT would otherwise wait for the next
+	 * wakeup, with the remote IRR of their vIOAPIC pins set meanwhile.
+	 */
+	vlapic_pv_eoi_process(vcpu_vlapic(vcpu));
+
+	if (!vlapic_has_pending_intr(vcpu)) {
+		if ((vcpu->arch.halt_poll_cycles != 0UL) && is_sole_runnable(&vcpu->sched_obj, pcpu_id)) {
+			start = rdtsc();
+			while (((rdtsc() - start) < vcpu->arch.halt_poll_cycles) &&
+					!vcpu_has_wakeup_event(vcpu) && !need_reschedule(pcpu_id)) {
+				asm_pause();
+			}
+		}
+
+		get_schedule_lock(pcpu_id);
+		if (is_apicv_advanced_feature_supported()) {
+			vlapic_set_pi_wakeup(vcpu_vlapic(vcpu), true);
+		}
+		vcpu->arch.halted = true;
+		cpu_memory_barrier();
+
+		if (vcpu_has_wakeup_event(vcpu)) {
+			vcpu->arch.halted = false;
+			if (is_apicv_advanced_feature_supported()) {
+				vlapic_set_pi_wakeup(vcpu_vlapic(vcpu), false);
+			}
+		} else {
+			vcpu->arch.halt_tsc = rdtsc();
+			remove_from_cpu_runqueue(&vcpu->sched_obj, pcpu_id);
+			make_reschedule_request(pcpu_id, DEL_MODE_IPI);
+		}
+		release_schedule_lock(pcpu_id);
+	}
+}
+
+void wake_vcpu(struct acrn_vcpu *vcpu)
+{
+	uint16_t pcpu_id = vcpu->pcpu_id;
+	uint64_t max_poll = us_to_ticks(CONFIG_HALT_POLL_US);
+	uint64_t *poll_cycles = &vcpu->arch.halt_poll_cycles;
+
+	if (vcpu->arch.halted) {
+		get_schedule_lock(pcpu_id);
+		if (vcpu->arch.halted) {
+			vcpu->arch.halted = false;
+			if (is_apicv_advanced_feature_supported()) {
+				vlapic_set_pi_wakeup(vcpu_vlapic(vcpu), false);
+			}
+
+			if (max_poll != 0UL) {
+				if ((rdtsc() - vcpu->arch.halt_tsc) < max_poll) {
+					*poll_cycles = (*poll_cycles == 0UL) ? (max_poll >> 2U) : min(*poll_cycles << 1U, max_poll);
+				} else {
+					*poll_cycles >>= 1U;
+				}
+			}
+
+			/* a paused vCPU gets back on the runqueue in resume_vcpu() */
+			if (vcpu->state == VCPU_RUNNING) {
+				add_to_cpu_runqueue(&vcpu->sched_obj, pcpu_id);
+				make_reschedule_request(pcpu_id, DEL_MODE_IPI);
+			}
+		}
+		release_schedule_lock(pcpu_id);
+	}
+}
+
+void wake_pi_halted_vcpus(uint16_t pcpu_id)
+{
+	uint16_t vm_id, i;
+	struct acrn_vm *vm;
+	struct acrn_vcpu *vcpu;
+
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		vm = get_vm_from_vmid(vm_id);
+		if (!is_poweroff_vm(vm)) {
+			foreach_vcpu(i, vm, vcpu) {
+				if ((vcpu->pcpu_id == pcpu_id) && vcpu->arch.halted &&
+						vlapic_has_posted_intr(vcpu_vlapic(vcpu))) {
+					wake_vcpu(vcpu);
+				}
+			}
+		}
+	}
+}
+
+void vcpu_yield(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct acrn_vcpu *sibling, *hint = NULL;
+	uint32_t window = vcpu->arch.ple_window;
+	uint16_t i;
+
+	/*
+	 * A vCPU of the VM preempted on this pCPU may hold the lock the vCPU spins
+	 * on. Search from the next vCPU, so that the spinners don't pick the same one.
+	 */
+	for (i = 1U; i < vm->hw.created_vcpus; i++) {
+		sibling = vcpu_from_vid(vm, (uint16_t)((vcpu->vcpu_id + i) % vm->hw.created_vcpus));
+		if ((sibling->pcpu_id == vcpu->pcpu_id) && (sibling->state == VCPU_RUNNING) &&
+				!list_empty(&sibling->sched_obj.run_list)) {
+			hint = sibling;
+			break;
+		}
+	}
+
+	if (yield_current((hint != NULL) ? &hint->sched_obj : NULL)) {
+		window = PLE_WINDOW_MIN;
+	} else if (window < PLE_WINDOW_MAX) {
+		/* nobody to yield to, spin longer before the next exit */
+		window <<= 1U;
+	} else {
+		/* keep the maximum window */
+	}
+
+	if (window != vcpu->arch.ple_window) {
+		vcpu->arch.ple_window = window;
+		exec_vmwrite32(VMX_PLE_WINDOW, window);
+	}
+}
+
 /* help function for vcpu create */
-int32_t prepare_vcpu(struct acrn_vm *vm, uint16_t pcpu_id)
+int32_t prepare_vcpu(struct acrn_vm *vm, uint16_t vcpu_id, uint16_t pcpu_id)
 {
 	int32_t ret;
 	struct acrn_vcpu *vcpu = NULL;
+	struct sched_params params = { .prio = SCHED_PRIO_NORMAL, .budget_us = 0U, .period_us = 0U };
 	char thread_name[16];
 
-	ret = create_vcpu(pcpu_id, vm, &vcpu);
+	ret = create_vcpu(pcpu_id, vcpu_id, vm, &vcpu);
 	if (ret == 0) {
-		INIT_LIST_HEAD(&vcpu->sched_obj.run_list);
+		params.prio = is_rt_vm(vm) ? SCHED_PRIO_HIGH : SCHED_PRIO_NORMAL;
+		init_sched_object(&vcpu->sched_obj, &params);
 		snprintf(thread_name, 16U, "vm%hu:vcpu%hu", vm->vm_id, vcpu->vcpu_id);
 		(void)strncpy_s(vcpu->sched_obj.name, 16U, thread_name, 16U);
 		vcpu->sched_obj.thread = vcpu_thread;
 		vcpu->sched_obj.host_sp = build_stack_frame(vcpu);
 		vcpu->sched_obj.prepare_switch_out = context_switch_out;
 		vcpu->sched_obj.prepare_switch_in = context_switch_in;
+#ifdef CONFIG_SCHED_MIGRATION
+		vcpu->sched_obj.pcpu_mask = vcpu_migrate_mask(vm);
+		/* a pCPU added at runtime is out of the VM configuration, stay there */
+		if (!bitmap_test(pcpu_id, &vcpu->sched_obj.pcpu_mask)) {
+			vcpu->sched_obj.pcpu_mask = 0UL;
+		}
+		if (vcpu->sched_obj.pcpu_mask != 0UL) {
+			vcpu->sched_obj.migrate = vcpu_migrate;
+		}
+#endif
 	}
 
 	return ret;
@@ -15,33 +15,38 @@
 #include <sgx.h>
 #include <logmsg.h>
 
+/* the index of leaf, NULL if it is out of the indexed ranges */
+static inline struct vcpuid_leaf *vcpuid_leaf_index(struct acrn_vm *vm, uint32_t leaf)
+{
+	uint32_t range = leaf >> VCPUID_RANGE_SHIFT;
+	uint32_t offset = leaf & ((1U << VCPUID_RANGE_SHIFT) - 1U);
+	struct vcpuid_leaf *index = NULL;
+
+	if ((range < VCPUID_NR_RANGES) && (offset < VCPUID_LEAVES_PER_RANGE)) {
+		index = &vm->vcpuid_leaves[range][offset];
+	}
+
+	return index;
+}
+
 static inline const struct vcpuid_entry *local_find_vcpuid_entry(const struct acrn_vcpu *vcpu,
 					uint32_t leaf, uint32_t subleaf)
 {
-	uint32_t i = 0U, nr, half;
+	uint32_t i, end;
 	const struct vcpuid_entry *found_entry = NULL;
 	struct acrn_vm *vm = vcpu->vm;
+	const struct vcpuid_leaf *index = vcpuid_leaf_index(vm, leaf);
 
-	nr = vm->vcpuid_entry_nr;
-	half = nr >> 1U;
-	if (vm->vcpuid_entries[half].leaf < leaf) {
-		i = half;
-	}
-
-	for (; i < nr; i++) {
-		const struct vcpuid_entry *tmp = (const struct vcpuid_entry *)(&vm->vcpuid_entries[i]);
+	if (index != NULL) {
+		end = (uint32_t)index->first + (uint32_t)index->nr;
+		/* at most the few subleaves of the leaf */
+		for (i = index->first; i < end; i++) {
+			const struct vcpuid_entry *tmp = &vm->vcpuid_entries[i];
 
-		if (tmp->leaf < leaf) {
-			continue;
-		} else if (tmp->leaf == leaf) {
-			if (((tmp->flags & CPUID_CHECK_SUBLEAF) != 0U) && (tmp->subleaf != subleaf)) {
-				continue;
+			if (((tmp->flags & CPUID_CHECK_SUBLEAF) == 0U) || (tmp->subleaf == subleaf)) {
+				found_entry = tmp;
+				break;
 			}
-			found_entry = tmp;
-			break;
-		} else {
-			/* tmp->leaf > leaf */
-			break;
 		}
 	}
 
@@ -85,13 +90,22 @@ static inline int32_t set_vcpuid_entry(struct acrn_vm *vm,
 				const struct vcpuid_entry *entry)
 {
 	struct vcpuid_entry *tmp;
+	struct vcpuid_leaf *index = vcpuid_leaf_index(vm, entry->leaf);
 	size_t entry_size = sizeof(struct vcpuid_entry);
 	int32_t ret;
 
 	if (vm->vcpuid_entry_nr == MAX_VM_VCPUID_ENTRIES) {
 		pr_err("%s, vcpuid entry over MAX_VM_VCPUID_ENTRIES(%u)\n", __func__, MAX_VM_VCPUID_ENTRIES);
 	        ret = -ENOMEM;
+	} else if (index == NULL) {
+		pr_err("%s, vcpuid leaf 0x%x out of the indexed ranges\n", __func__, entry->leaf);
+		ret = -EINVAL;
 	} else {
+		/* the subleaves of a leaf are set in a row */
+		if (index->nr == 0U) {
+			index->first = (uint8_t)vm->vcpuid_entry_nr;
+		}
+		index->nr++;
 		tmp = &vm->vcpuid_entries[vm->vcpuid_entry_nr];
 		vm->vcpuid_entry_nr++;
 		(void)memcpy_s(tmp, entry_size, entry, entry_size);
@@ -263,6 +277,14 @@ static int32_t set_vcpuid_extended_function(struct acrn_vm *vm)
 		if (is_sos_vm(vm)) {
 			entry.eax |= GUEST_CAPS_PRIVILEGE_VM;
 		}
+		entry.eax |= GUEST_CAPS_PV_STEAL_TIME;
+		entry.eax |= GUEST_CAPS_PV_CLOCK;
+		if (!is_lapic_pt_configured(vm)) {
+			entry.eax |= GUEST_CAPS_PV_SEND_IPI;
+			if (is_apicv_advanced_feature_supported()) {
+				entry.eax |= GUEST_CAPS_PV_EOI;
+			}
+		}
 		result = set_vcpuid_entry(vm, &entry);
 	}
 
@@ -15,6 +15,7 @@
 #include <vm.h>
 #include <trace.h>
 #include <logmsg.h>
+#include <cat.h>
 
 #define EXCEPTION_ERROR_CODE_VALID  8U
 
@@ -119,13 +120,15 @@ void vcpu_make_request(struct acrn_vcpu *vcpu, uint16_t eventid)
 	if (get_pcpu_id() != vcpu->pcpu_id) {
 		send_single_ipi(vcpu->pcpu_id, VECTOR_NOTIFY_VCPU);
 	}
+
+	wake_vcpu(vcpu);
 }
 
 /*
  * @retval true when INT is injected to guest.
  * @retval false when otherwise
  */
-static bool vcpu_do_pending_extint(const struct acrn_vcpu *vcpu)
+static bool vcpu_do_pending_extint(struct acrn_vcpu *vcpu)
 {
 	struct acrn_vm *vm;
 	struct acrn_vcpu *primary;
@@ -147,6 +150,7 @@ static bool vcpu_do_pending_extint(const struct acrn_vcpu *vcpu)
 					VMX_INT_INFO_VALID |
 					(vector & 0xFFU));
 			vpic_intr_accepted(vm_pic(vcpu->vm), vector);
+			vcpu->arch.nr_injected++;
 			ret = true;
 		}
 	}
@@ -372,12 +376,25 @@ int32_t acrn_handle_pending_request(struct acrn_vcpu *vcpu)
 		pr_fatal("Triple fault happen -> shutdown!");
 		ret = -EFAULT;
 	} else {
+		/* the lazy EOIs of PV EOI may assert vIOAPIC pins again */
+		vlapic_pv_eoi_process(vcpu_vlapic(vcpu));
+
+		if (bitmap_test_and_clear_lock(ACRN_REQUEST_EPTP_UPDATE, pending_req_bits)) {
+			exec_vmwrite64(VMX_EPT_POINTER_FULL, ept_pointer(vcpu->vm,
+				(arch->cur_context == SECURE_WORLD) ? vcpu->vm->arch_vm.sworld_eptp :
+				vcpu->vm->arch_vm.nworld_eptp));
+		}
+
+		if (bitmap_test_and_clear_lock(ACRN_REQUEST_CLOS_UPDATE, pending_req_bits)) {
+			load_pqr_assoc(arch->rmid, arch->clos);
+		}
+
+		if (bitmap_test_and_clear_lock(ACRN_REQUEST_VRTC_TIMER, pending_req_bits)) {
+			vrtc_update_timer(vcpu->vm);
+		}
 
 		if (bitmap_test_and_clear_lock(ACRN_REQUEST_EPT_FLUSH, pending_req_bits)) {
-			invept(vcpu->vm->arch_vm.nworld_eptp);
-			if (vcpu->vm->sworld_control.flag.active != 0UL) {
-				invept(vcpu->vm->arch_vm.sworld_eptp);
-			}
+			flush_vm_ept(vcpu->vm);
 		}
 
 		if (bitmap_test_and_clear_lock(ACRN_REQUEST_VPID_FLUSH,	pending_req_bits)) {
@@ -397,6 +414,7 @@ int32_t acrn_handle_pending_request(struct acrn_vcpu *vcpu)
 				/* Inject NMI vector = 2 */
 				exec_vmwrite32(VMX_ENTRY_INT_INFO_FIELD,
 						VMX_INT_INFO_VALID | (VMX_INT_TYPE_NMI << 8U) | IDT_NMI);
+				vcpu->arch.nr_injected++;
 				injected = true;
 			} else {
 				/* handling pending vector injection:
@@ -414,6 +432,10 @@ int32_t acrn_handle_pending_request(struct acrn_vcpu *vcpu)
 			}
 		}
 
+		if (vlapic_has_posted_intr(vcpu_vlapic(vcpu))) {
+			bitmap_set_lock(ACRN_REQUEST_EVENT, pending_req_bits);
+		}
+
 		if (!acrn_inject_pending_intr(vcpu, pending_req_bits, injected)) {
 			/* if there is no eligible vector before this point */
 			/* SDM Vol3 table 6-2, inject lowpri exception */
@@ -496,7 +518,7 @@ int32_t exception_vmexit_handler(struct acrn_vcpu *vcpu)
 			int_err_code = exec_vmread32(VMX_EXIT_INT_ERROR_CODE);
 
 			/* get current privilege level and fault address */
-			cpl = exec_vmread32(VMX_GUEST_CS_ATTR);
+			cpl = vcpu_get_cs_attr(vcpu);
 			cpl = (cpl >> 5U) & 3U;
 
 			if (cpl < 3U) {
@@ -510,7 +532,16 @@ int32_t exception_vmexit_handler(struct acrn_vcpu *vcpu)
 	/* Handle all other exceptions */
 	vcpu_retain_rip(vcpu);
 
-	status = vcpu_queue_exception(vcpu, exception_vector, int_err_code);
+	/*
+	 * #NM is only intercepted while the FPU registers hold the state of the
+	 * other world, it is the guest's own if it set CR0.TS or CR0.EM.
+	 */
+	if ((exception_vector == IDT_NM) && ((vcpu_get_cr0(vcpu) & (CR0_TS | CR0_EM)) == 0UL) &&
+			claim_world_fpu(vcpu)) {
+		/* the FPU instruction is restarted with the state of the world loaded */
+	} else {
+		status = vcpu_queue_exception(vcpu, exception_vector, int_err_code);
+	}
 
 	if (exception_vector == IDT_MC) {
 		/* just print error message for #MC, it then will be injected
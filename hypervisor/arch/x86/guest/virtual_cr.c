@@ -42,9 +42,9 @@ static uint64_t cr0_always_off_mask;
 static uint64_t cr4_always_on_mask;
 static uint64_t cr4_always_off_mask;
 
-static int32_t load_pdptrs(const struct acrn_vcpu *vcpu)
+static int32_t load_pdptrs(struct acrn_vcpu *vcpu)
 {
-	uint64_t guest_cr3 = exec_vmread(VMX_GUEST_CR3);
+	uint64_t guest_cr3 = vcpu_get_cr3(vcpu);
 	struct cpuinfo_x86 *cpu_info = get_pcpu_info();
 	int32_t ret = 0;
 	uint64_t pdpte[4]; /* Total four PDPTE */
@@ -130,7 +130,7 @@ static bool is_cr0_write_valid(struct acrn_vcpu *vcpu, uint64_t cr0)
  *             Set the value according to the value from guest.
  *   - MP (1)  Flexible to guest
  *   - EM (2)  Flexible to guest
- *   - TS (3)  Flexible to guest
+ *   - TS (3)  Flexible to guest, unless forced by vcpu_trap_fpu()
  *   - ET (4)  Flexible to guest
  *   - NE (5)  must always be 1
  *   - WP (16) Trapped to get if it inhibits supervisor level procedures to
@@ -214,12 +214,13 @@ static void vmx_write_cr0(struct acrn_vcpu *vcpu, uint64_t cr0)
 						exec_vmwrite64(VMX_GUEST_IA32_PAT_FULL,
 							vcpu_get_guest_msr(vcpu, MSR_IA32_PAT));
 					}
-					vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
+					vcpu_make_request(vcpu, ACRN_REQUEST_VPID_FLUSH);
 				}
 			}
 
 			if ((cr0_changed_bits & (CR0_PG | CR0_WP)) != 0UL) {
-				vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
+				flush_vcpu_gva_tlb(vcpu);
+				vcpu_make_request(vcpu, ACRN_REQUEST_VPID_FLUSH);
 			}
 
 			/* CR0 has no always off bits, except the always on bits, and reserved
@@ -229,6 +230,9 @@ static void vmx_write_cr0(struct acrn_vcpu *vcpu, uint64_t cr0)
 
 			/* Don't set CD or NW bit to guest */
 			cr0_vmx &= ~(CR0_CD | CR0_NW);
+			if (vcpu->arch.fpu_trapped) {
+				cr0_vmx |= CR0_TS;
+			}
 			exec_vmwrite(VMX_GUEST_CR0, cr0_vmx & 0xFFFFFFFFUL);
 			exec_vmwrite(VMX_CR0_READ_SHADOW, cr0_mask & 0xFFFFFFFFUL);
 
@@ -322,7 +326,8 @@ static void vmx_write_cr4(struct acrn_vcpu *vcpu, uint64_t cr4)
 				}
 			}
 			if (err_found == false) {
-				vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
+				flush_vcpu_gva_tlb(vcpu);
+				vcpu_make_request(vcpu, ACRN_REQUEST_VPID_FLUSH);
 			}
 		}
 
@@ -442,6 +447,38 @@ void vcpu_set_cr4(struct acrn_vcpu *vcpu, uint64_t val)
 	vmx_write_cr4(vcpu, val);
 }
 
+void vcpu_trap_fpu(struct acrn_vcpu *vcpu, bool trap)
+{
+	uint64_t cr0, cr0_vmx, shadow, mask;
+	uint32_t excp_bitmap;
+
+	if (vcpu->arch.fpu_trapped != trap) {
+		/* the guest view, before TS changes of owner */
+		cr0 = vcpu_get_cr0(vcpu);
+		cr0_vmx = exec_vmread(VMX_GUEST_CR0);
+		mask = exec_vmread(VMX_CR0_GUEST_HOST_MASK);
+		excp_bitmap = exec_vmread32(VMX_EXCEPTION_BITMAP);
+
+		if (trap) {
+			shadow = (exec_vmread(VMX_CR0_READ_SHADOW) & ~CR0_TS) | (cr0 & CR0_TS);
+			exec_vmwrite(VMX_CR0_READ_SHADOW, shadow);
+			cr0_vmx |= CR0_TS;
+			mask |= CR0_TS;
+			excp_bitmap |= (1U << IDT_NM);
+		} else {
+			cr0_vmx = (cr0_vmx & ~CR0_TS) | (cr0 & CR0_TS);
+			mask &= ~CR0_TS;
+			excp_bitmap &= ~(1U << IDT_NM);
+		}
+
+		exec_vmwrite(VMX_GUEST_CR0, cr0_vmx);
+		exec_vmwrite(VMX_CR0_GUEST_HOST_MASK, mask);
+		exec_vmwrite32(VMX_EXCEPTION_BITMAP, excp_bitmap);
+		vcpu->arch.fpu_trapped = trap;
+		bitmap_clear_lock(CPU_REG_CR0, &vcpu->reg_cached);
+	}
+}
+
 int32_t cr_access_vmexit_handler(struct acrn_vcpu *vcpu)
 {
 	uint64_t reg;
@@ -464,6 +501,15 @@ int32_t cr_access_vmexit_handler(struct acrn_vcpu *vcpu)
 		/* mov to cr4 */
 		vcpu_set_cr4(vcpu, reg);
 		break;
+	case 0x20UL:
+		/* clts, exits while CR0.TS is host-owned, see vcpu_trap_fpu() */
+		vcpu_set_cr0(vcpu, vcpu_get_cr0(vcpu) & ~CR0_TS);
+		break;
+	case 0x30UL:
+		/* lmsw loads CR0[3:0] from the source data, it can't clear PE */
+		reg = (exit_qual >> 16U) & 0xFUL;
+		vcpu_set_cr0(vcpu, (vcpu_get_cr0(vcpu) & ~(CR0_TS | CR0_EM | CR0_MP)) | reg);
+		break;
 	default:
 		ASSERT(false, "Unhandled CR access");
 		ret = -EINVAL;
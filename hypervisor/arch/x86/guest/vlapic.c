@@ -93,10 +93,10 @@ const struct acrn_apicv_ops *apicv_ops;
 static int32_t
 apicv_set_intr_ready(struct acrn_vlapic *vlapic, uint32_t vector);
 
-static void apicv_post_intr(uint16_t dest_pcpu_id);
-
 static void vlapic_x2apic_self_ipi_handler(struct acrn_vlapic *vlapic);
 
+static void vlapic_pv_eoi_arm(struct acrn_vlapic *vlapic, uint32_t vector);
+
 /*
  * Post an interrupt to the vcpu running on 'hostcpu'. This will use a
  * hardware assist if available (e.g. Posted Interrupt) or fall back to
@@ -453,18 +453,18 @@ void vlapic_set_tsc_deadline_msr(struct acrn_vlapic *vlapic, uint64_t val_arg)
 		vcpu_set_guest_msr(vlapic->vcpu, MSR_IA32_TSC_DEADLINE, val);
 
 		timer = &vlapic->vtimer.timer;
-		del_timer(timer);
-
 		if (val != 0UL) {
 			/* transfer guest tsc to host tsc */
 			val -= exec_vmread64(VMX_TSC_OFFSET_FULL);
-			timer->fire_tsc = val;
-			/* vlapic_init_timer has been called,
-			 * and timer->fire_tsc is not 0,here
-			 * add_timer should not return error
+			/* the MSR write is trapped on the pCPU the vCPU runs on,
+			 * which is the one the timer was started on, so it can
+			 * be moved in place instead of del_timer/add_timer. A
+			 * vCPU moving to another pCPU takes its timer along,
+			 * see vlapic_migrate().
 			 */
-			(void)add_timer(timer);
+			(void)update_timer(timer, val);
 		} else {
+			del_timer(timer);
 			timer->fire_tsc = 0UL;
 		}
 	} else {
@@ -491,7 +491,10 @@ vlapic_set_tmr(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
 	lapic = &(vlapic->apic_page);
 	tmrptr = &lapic->tmr[0];
 	if (level) {
-		if (!bitmap32_test_and_set_lock((uint16_t)(vector & 0x1fU), &tmrptr[(vector & 0xffU) >> 5U].v)) {
+		bitmap32_set_lock((uint16_t)(vector & 0x1fU), &tmrptr[(vector & 0xffU) >> 5U].v);
+		if (vlapic->pv_eoi_map != NULL) {
+			vlapic_pv_eoi_arm(vlapic, vector);
+		} else {
 			vcpu_set_eoi_exit_bitmap(vlapic->vcpu, vector);
 		}
 	} else {
@@ -501,6 +504,79 @@ vlapic_set_tmr(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
 	}
 }
 
+/*
+ * Arm the PV EOI of vector, before the vector can be delivered to the
+ * guest. A vector which still has its EOI-exit bit, set before PV EOI was
+ * enabled, keeps being handled by veoi_vmexit_handler().
+ *
+ * The map bit is set before the pending one, and vlapic_pv_eoi_process()
+ * clears the pending bit before it checks the map one, so an EOI is
+ * never lost against a concurrent arming of the same vector.
+ */
+static void vlapic_pv_eoi_arm(struct acrn_vlapic *vlapic, uint32_t vector)
+{
+	uint16_t bit = (uint16_t)(vector & 0x3FU);
+	uint32_t idx = (vector & 0xFFU) >> 6U;
+
+	if (!bitmap_test(bit, &vlapic->vcpu->arch.eoi_exit_bitmap[idx])) {
+		stac();
+		bitmap_set_lock(bit, &vlapic->pv_eoi_map[idx]);
+		clac();
+		bitmap_set_lock(bit, &vlapic->pv_eoi_pending[idx]);
+	}
+}
+
+void vlapic_pv_eoi_process(struct acrn_vlapic *vlapic)
+{
+	uint32_t idx;
+	uint16_t bit;
+	uint64_t pending;
+	bool armed;
+
+	for (idx = 0U; idx < 4U; idx++) {
+		pending = vlapic->pv_eoi_pending[idx];
+		bit = ffs64(pending);
+		while (bit != INVALID_BIT_INDEX) {
+			bitmap_clear_nolock(bit, &pending);
+			if (bitmap_test_and_clear_lock(bit, &vlapic->pv_eoi_pending[idx])) {
+				stac();
+				armed = bitmap_test(bit, &vlapic->pv_eoi_map[idx]);
+				clac();
+				if (armed) {
+					/* not EOIed yet, or armed again meanwhile */
+					bitmap_set_lock(bit, &vlapic->pv_eoi_pending[idx]);
+				} else {
+					vioapic_process_eoi(vlapic->vm, (idx << 6U) + bit);
+				}
+			}
+			bit = ffs64(pending);
+		}
+	}
+}
+
+int32_t vlapic_set_pv_eoi(struct acrn_vlapic *vlapic, uint64_t gpa)
+{
+	uint64_t hpa;
+	int32_t ret = 0;
+
+	vlapic_pv_eoi_process(vlapic);
+	if ((vlapic->pv_eoi_pending[0] | vlapic->pv_eoi_pending[1] |
+			vlapic->pv_eoi_pending[2] | vlapic->pv_eoi_pending[3]) != 0UL) {
+		ret = -EBUSY;
+	} else if (gpa == 0UL) {
+		vlapic->pv_eoi_map = NULL;
+	} else {
+		hpa = gpa2hpa(vlapic->vm, gpa);
+		if (((gpa & 0x1FUL) != 0UL) || (hpa == INVALID_HPA)) {
+			ret = -EINVAL;
+		} else {
+			vlapic->pv_eoi_map = (uint64_t *)hpa2hva(hpa);
+		}
+	}
+
+	return ret;
+}
+
 static void
 vlapic_reset_tmr(struct acrn_vlapic *vlapic)
 {
@@ -518,11 +594,17 @@ vlapic_reset_tmr(struct acrn_vlapic *vlapic)
 	vcpu_reset_eoi_exit_bitmaps(vlapic->vcpu);
 }
 
-static void apicv_basic_accept_intr(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
+/*
+ * The accept_intr ops only latch the interrupt and return the vector
+ * to notify the pCPU of the target vCPU with, VECTOR_INVALID if no
+ * notification is needed. It is up to the caller to send it, so that
+ * the notifications of a multicast IPI can be batched.
+ */
+static uint32_t apicv_basic_accept_intr(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
 {
 	struct lapic_regs *lapic;
 	struct lapic_reg *irrptr;
-	uint32_t idx;
+	uint32_t idx, notify = VECTOR_INVALID;
 
 	lapic = &(vlapic->apic_page);
 	idx = vector >> 5U;
@@ -532,15 +614,21 @@ static void apicv_basic_accept_intr(struct acrn_vlapic *vlapic, uint32_t vector,
 	if (!bitmap32_test_and_set_lock((uint16_t)(vector & 0x1fU), &irrptr[idx].v)) {
 		/* set tmr if corresponding irr bit changes from 0 to 1 */
 		vlapic_set_tmr(vlapic, vector, level);
-		vcpu_make_request(vlapic->vcpu, ACRN_REQUEST_EVENT);
+		bitmap_set_lock(ACRN_REQUEST_EVENT, &vlapic->vcpu->arch.pending_req);
+		notify = VECTOR_NOTIFY_VCPU;
 	}
+
+	return notify;
 }
 
-static void apicv_advanced_accept_intr(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
+static uint32_t apicv_advanced_accept_intr(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
 {
-	int32_t pending_intr = apicv_set_intr_ready(vlapic, vector);
+	int32_t pending_intr;
+	uint32_t notify = VECTOR_INVALID;
 
+	/* before the vector gets visible to the guest, for PV EOI */
 	vlapic_set_tmr(vlapic, vector, level);
+	pending_intr = apicv_set_intr_ready(vlapic, vector);
 
 	if (pending_intr != 0) {
 		/*
@@ -554,44 +642,116 @@ static void apicv_advanced_accept_intr(struct acrn_vlapic *vlapic, uint32_t vect
 		 *    sync PIR to vIRR automatically.
 		 */
 		bitmap_set_lock(ACRN_REQUEST_EVENT, &vlapic->vcpu->arch.pending_req);
-
-		if (get_pcpu_id() != vlapic->vcpu->pcpu_id) {
-			apicv_post_intr(vlapic->vcpu->pcpu_id);
-		}
+		notify = VECTOR_POSTED_INTR;
 	}
+
+	return notify;
 }
 
 /*
  * @pre vector >= 16
+ *
+ * @return the vector to notify the pCPU of the target vCPU with,
+ *	   VECTOR_INVALID if none.
  */
-static void vlapic_accept_intr(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
+static uint32_t vlapic_latch_intr(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
 {
 	struct lapic_regs *lapic;
+	uint32_t notify = VECTOR_INVALID;
 	ASSERT(vector <= NR_MAX_VECTOR, "invalid vector %u", vector);
 
 	lapic = &(vlapic->apic_page);
 	if ((lapic->svr.v & APIC_SVR_ENABLE) == 0U) {
 		dev_dbg(ACRN_DBG_LAPIC, "vlapic is software disabled, ignoring interrupt %u", vector);
 	} else {
-		vlapic->ops->accept_intr(vlapic, vector, level);
+		notify = vlapic->ops->accept_intr(vlapic, vector, level);
+		if (notify != VECTOR_INVALID) {
+			/* a halted vCPU is not kicked by the notification */
+			wake_vcpu(vlapic->vcpu);
+		}
 	}
+
+	return notify;
 }
 
-/**
- * @brief Send notification vector to target pCPU.
- *
- * If APICv Posted-Interrupt is enabled and target pCPU is in non-root mode,
- * pCPU will sync pending virtual interrupts from PIR to vIRR automatically,
- * without VM exit.
- * If pCPU in root-mode, virtual interrupt will be injected in next VM entry.
+/*
+ * @pre vector >= 16
+ */
+static void vlapic_accept_intr(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
+{
+	uint32_t notify = vlapic_latch_intr(vlapic, vector, level);
+
+	/*
+	 * With APICv Posted-Interrupt, a pCPU in non-root mode syncs the
+	 * pending virtual interrupts from PIR to vIRR without VM exit; a pCPU
+	 * in root mode injects them in next VM entry.
+	 */
+	if ((notify != VECTOR_INVALID) && (get_pcpu_id() != vlapic->vcpu->pcpu_id)) {
+		if (get_cpu_var(notify_deferred) &&
+				((get_cpu_var(notify_pcpus) == 0UL) || (get_cpu_var(notify_vector) == notify))) {
+			bitmap_set_nolock(vlapic->vcpu->pcpu_id, &get_cpu_var(notify_pcpus));
+			get_cpu_var(notify_vector) = notify;
+		} else {
+			send_single_ipi(vlapic->vcpu->pcpu_id, notify);
+		}
+	}
+}
+
+void vlapic_defer_notifications(void)
+{
+	get_cpu_var(notify_pcpus) = 0UL;
+	get_cpu_var(notify_deferred) = true;
+}
+
+void vlapic_flush_notifications(void)
+{
+	get_cpu_var(notify_deferred) = false;
+	if (get_cpu_var(notify_pcpus) != 0UL) {
+		send_dest_ipi_mask((uint32_t)get_cpu_var(notify_pcpus), get_cpu_var(notify_vector));
+		get_cpu_var(notify_pcpus) = 0UL;
+	}
+}
+
+/*
+ * Deliver a fixed IPI to all the vCPUs in dmask.
  *
- * @param[in] dest_pcpu_id Target CPU ID.
+ * All the interrupts are latched first, then the pCPUs to notify are
+ * kicked together by one send_dest_ipi_mask(). A target vCPU which is not
+ * in non-root mode will check its pending requests before next VM entry,
+ * so its pCPU is left alone.
  *
- * @return None
+ * @pre vector >= 16
  */
-static void apicv_post_intr(uint16_t dest_pcpu_id)
+static void vlapic_multicast_intr(struct acrn_vm *vm, uint64_t dmask, uint32_t vector)
 {
-	send_single_ipi(dest_pcpu_id, VECTOR_POSTED_INTR);
+	uint16_t vcpu_id, pcpu_id = get_pcpu_id();
+	uint32_t notify, notify_vector = VECTOR_INVALID;
+	uint64_t pcpu_mask = 0UL;
+	struct acrn_vcpu *target_vcpu;
+
+	for (vcpu_id = 0U; vcpu_id < vm->hw.created_vcpus; vcpu_id++) {
+		if ((dmask & (1UL << vcpu_id)) != 0UL) {
+			target_vcpu = vcpu_from_vid(vm, vcpu_id);
+			notify = vlapic_latch_intr(vcpu_vlapic(target_vcpu), vector, LAPIC_TRIG_EDGE);
+
+			/*
+			 * The locked bit operations above order the latching before
+			 * the read of in_non_root, which pairs with the barrier taken
+			 * by the target before it checks its pending requests.
+			 */
+			if ((notify != VECTOR_INVALID) && (target_vcpu->pcpu_id != pcpu_id)
+					&& target_vcpu->arch.in_non_root) {
+				bitmap_set_nolock(target_vcpu->pcpu_id, &pcpu_mask);
+				/* all the vCPUs of a VM share the same apicv ops */
+				notify_vector = notify;
+			}
+			dev_dbg(ACRN_DBG_LAPIC, "vlapic sending ipi %u to vcpu_id %hu", vector, vcpu_id);
+		}
+	}
+
+	if (pcpu_mask != 0UL) {
+		send_dest_ipi_mask((uint32_t)pcpu_mask, notify_vector);
+	}
 }
 
 /**
@@ -614,6 +774,34 @@ uint64_t apicv_get_pir_desc_paddr(struct acrn_vcpu *vcpu)
 	return hva2hpa(&(vlapic->pir_desc));
 }
 
+bool vlapic_build_pid_table(struct acrn_vm *vm, uint16_t *last_index)
+{
+	uint16_t i;
+	uint32_t apicid, last = 0U;
+	struct acrn_vcpu *vcpu;
+	bool ret = true;
+
+	/*
+	 * An IPI to a missing or invalid entry leads to an APIC-write VM
+	 * exit, it is then emulated by vlapic_icrlo_write_handler().
+	 */
+	(void)memset((void *)vm->arch_vm.pid_table, 0U, sizeof(vm->arch_vm.pid_table));
+	foreach_vcpu(i, vm, vcpu) {
+		apicid = vlapic_get_apicid(vcpu_vlapic(vcpu));
+		if (apicid >= PID_TABLE_ENTRIES) {
+			ret = false;
+			break;
+		}
+		vm->arch_vm.pid_table[apicid] = apicv_get_pir_desc_paddr(vcpu) | PID_TABLE_ENTRY_VALID;
+		if (apicid > last) {
+			last = apicid;
+		}
+	}
+	*last_index = (uint16_t)last;
+
+	return ret;
+}
+
 /**
  * @pre offset value shall be one of the folllowing values:
  *	APIC_OFFSET_CMCI_LVT
@@ -1132,45 +1320,61 @@ vlapic_calc_dest_lapic_pt(struct acrn_vm *vm, uint64_t *dmask, bool is_broadcast
 	}
 }
 
+/*
+ * INIT and SIPI of all the vCPUs of dmask at once: a guest bringing up its
+ * APs with a broadcast INIT-SIPI-SIPI gets them paused, reset and started
+ * in one pass, each step with a single multicast kick of their pCPUs.
+ */
 static void
-vlapic_process_init_sipi(struct acrn_vcpu* target_vcpu, uint32_t mode, uint32_t icr_low)
+vlapic_process_init_sipi(struct acrn_vm *vm, uint64_t dmask, uint32_t mode, uint32_t icr_low)
 {
+	uint16_t vcpu_id;
+	uint64_t start_mask = 0UL;
+	struct acrn_vcpu *target_vcpu;
+
 	if (mode == APIC_DELMODE_INIT) {
 		if ((icr_low & APIC_LEVEL_MASK) != APIC_LEVEL_DEASSERT) {
 
 			dev_dbg(ACRN_DBG_LAPIC,
-				"Sending INIT to %hu",
-				target_vcpu->vcpu_id);
-
-			/* put target vcpu to INIT state and wait for SIPI */
-			pause_vcpu(target_vcpu, VCPU_PAUSED);
-			reset_vcpu(target_vcpu);
-			/* new cpu model only need one SIPI to kick AP run,
-			 * the second SIPI will be ignored as it move out of
-			 * wait-for-SIPI state.
-			*/
-			target_vcpu->arch.nr_sipi = 1U;
+				"Sending INIT to 0x%016llx",
+				dmask);
+
+			/* put target vcpus to INIT state and wait for SIPI */
+			pause_vcpus(vm, dmask, VCPU_PAUSED);
+			foreach_vcpu(vcpu_id, vm, target_vcpu) {
+				if ((dmask & (1UL << vcpu_id)) != 0UL) {
+					reset_vcpu(target_vcpu);
+					/* new cpu model only need one SIPI to kick AP run,
+					 * the second SIPI will be ignored as it move out of
+					 * wait-for-SIPI state.
+					*/
+					target_vcpu->arch.nr_sipi = 1U;
+				}
+			}
 		}
 	} else if (mode == APIC_DELMODE_STARTUP) {
-		/* Ignore SIPIs in any state other than wait-for-SIPI */
-		if ((target_vcpu->state == VCPU_INIT) &&
-			(target_vcpu->arch.nr_sipi != 0U)) {
+		foreach_vcpu(vcpu_id, vm, target_vcpu) {
+			/* Ignore SIPIs in any state other than wait-for-SIPI */
+			if (((dmask & (1UL << vcpu_id)) != 0UL) && (target_vcpu->state == VCPU_INIT) &&
+				(target_vcpu->arch.nr_sipi != 0U)) {
 
-			dev_dbg(ACRN_DBG_LAPIC,
-				"Sending SIPI to %hu with vector %u",
-				 target_vcpu->vcpu_id,
-				(icr_low & APIC_VECTOR_MASK));
-
-			target_vcpu->arch.nr_sipi--;
-			if (target_vcpu->arch.nr_sipi <= 0U) {
-
-				pr_err("Start Secondary VCPU%hu for VM[%d]...",
-					target_vcpu->vcpu_id,
-					target_vcpu->vm->vm_id);
-				set_vcpu_startup_entry(target_vcpu, (icr_low & APIC_VECTOR_MASK) << 12U);
-				schedule_vcpu(target_vcpu);
+				dev_dbg(ACRN_DBG_LAPIC,
+					"Sending SIPI to %hu with vector %u",
+					 target_vcpu->vcpu_id,
+					(icr_low & APIC_VECTOR_MASK));
+
+				target_vcpu->arch.nr_sipi--;
+				if (target_vcpu->arch.nr_sipi <= 0U) {
+
+					pr_err("Start Secondary VCPU%hu for VM[%d]...",
+						target_vcpu->vcpu_id,
+						target_vcpu->vm->vm_id);
+					set_vcpu_startup_entry(target_vcpu, (icr_low & APIC_VECTOR_MASK) << 12U);
+					bitmap_set_nolock(vcpu_id, &start_mask);
+				}
 			}
 		}
+		schedule_vcpus(vm, start_mask);
 	} else {
 		/* No other state currently, do nothing */
 	}
@@ -1239,23 +1443,24 @@ static void vlapic_icrlo_write_handler(struct acrn_vlapic *vlapic)
 			break;
 		}
 
+		if (mode == APIC_DELMODE_FIXED) {
+			vlapic_multicast_intr(vlapic->vm, dmask, vec);
+			dmask = 0UL;
+		} else if ((mode == APIC_DELMODE_INIT) || (mode == APIC_DELMODE_STARTUP)) {
+			vlapic_process_init_sipi(vlapic->vm, dmask, mode, icr_low);
+			dmask = 0UL;
+		} else {
+			/* NMI and SMI, per vCPU below */
+		}
+
 		for (vcpu_id = 0U; vcpu_id < vlapic->vm->hw.created_vcpus; vcpu_id++) {
 			if ((dmask & (1UL << vcpu_id)) != 0UL) {
 				target_vcpu = vcpu_from_vid(vlapic->vm, vcpu_id);
 
-				if (mode == APIC_DELMODE_FIXED) {
-					vlapic_set_intr(target_vcpu, vec, LAPIC_TRIG_EDGE);
-					dev_dbg(ACRN_DBG_LAPIC,
-						"vlapic sending ipi %u to vcpu_id %hu",
-						vec, vcpu_id);
-				} else if (mode == APIC_DELMODE_NMI) {
+				if (mode == APIC_DELMODE_NMI) {
 					vcpu_inject_nmi(target_vcpu);
 					dev_dbg(ACRN_DBG_LAPIC,
 						"vlapic send ipi nmi to vcpu_id %hu", vcpu_id);
-				} else if (mode == APIC_DELMODE_INIT) {
-					vlapic_process_init_sipi(target_vcpu, mode, icr_low);
-				} else if (mode == APIC_DELMODE_STARTUP) {
-					vlapic_process_init_sipi(target_vcpu, mode, icr_low);
 				} else if (mode == APIC_DELMODE_SMI) {
 					pr_info("vlapic: SMI IPI do not support\n");
 				} else {
@@ -1266,6 +1471,30 @@ static void vlapic_icrlo_write_handler(struct acrn_vlapic *vlapic)
 	}
 }
 
+int32_t vlapic_send_ipi_mask(const struct acrn_vcpu *vcpu, uint64_t apicid_mask, uint32_t apicid_base, uint32_t vector)
+{
+	uint16_t i;
+	uint32_t apicid;
+	uint64_t dmask = 0UL;
+	struct acrn_vcpu *target_vcpu;
+	int32_t ret = -EINVAL;
+
+	if ((vector >= 16U) && (vector <= NR_MAX_VECTOR)) {
+		foreach_vcpu(i, vcpu->vm, target_vcpu) {
+			apicid = vlapic_get_apicid(vcpu_vlapic(target_vcpu));
+			if ((apicid >= apicid_base) && ((apicid - apicid_base) < 64U)
+					&& ((apicid_mask & (1UL << (apicid - apicid_base))) != 0UL)) {
+				bitmap_set_nolock(target_vcpu->vcpu_id, &dmask);
+			}
+		}
+
+		vlapic_multicast_intr(vcpu->vm, dmask, vector);
+		ret = 0;
+	}
+
+	return ret;
+}
+
 static inline uint32_t vlapic_find_highest_irr(const struct acrn_vlapic *vlapic)
 {
 	const struct lapic_regs *lapic = &(vlapic->apic_page);
@@ -1638,6 +1867,9 @@ vlapic_reset(struct acrn_vlapic *vlapic, const struct acrn_apicv_ops *ops)
 	lapic = &(vlapic->apic_page);
 	(void)memset((void *)lapic, 0U, sizeof(struct lapic_regs));
 	(void)memset((void *)&(vlapic->pir_desc), 0U, sizeof(vlapic->pir_desc));
+	/* where VT-d sends the notifications of the interrupts it posts */
+	vlapic->pir_desc.control = ((uint64_t)VECTOR_POSTED_INTR << POSTED_INTR_NV_SHIFT) |
+		((uint64_t)per_cpu(lapic_id, vlapic->vcpu->pcpu_id) << POSTED_INTR_NDST_SHIFT);
 
 	lapic->id.v = vlapic_build_id(vlapic);
 	lapic->version.v = VLAPIC_VERSION;
@@ -1660,6 +1892,9 @@ vlapic_reset(struct acrn_vlapic *vlapic, const struct acrn_apicv_ops *ops)
 
 	vlapic->isrv = 0U;
 
+	vlapic->pv_eoi_map = NULL;
+	(void)memset((void *)vlapic->pv_eoi_pending, 0U, sizeof(vlapic->pv_eoi_pending));
+
 	vlapic->ops = ops;
 }
 
@@ -1707,10 +1942,11 @@ uint64_t vlapic_get_apicbase(const struct acrn_vlapic *vlapic)
 	return vlapic->msr_apicbase;
 }
 
-static void ptapic_accept_intr(struct acrn_vlapic *vlapic, uint32_t vector, __unused bool level)
+static uint32_t ptapic_accept_intr(struct acrn_vlapic *vlapic, uint32_t vector, __unused bool level)
 {
 	pr_err("Invalid op %s, VM%u, vCPU%u, vector %u", __func__,
 			vlapic->vm->vm_id, vlapic->vcpu->vcpu_id, vector);
+	return VECTOR_INVALID;
 }
 
 static bool ptapic_inject_intr(struct acrn_vlapic *vlapic,
@@ -2037,10 +2273,10 @@ vlapic_x2apic_pt_icr_access(struct acrn_vm *vm, uint64_t val)
 
 			switch (mode) {
 			case APIC_DELMODE_INIT:
-				vlapic_process_init_sipi(target_vcpu, mode, icr_low);
+				vlapic_process_init_sipi(vm, 1UL << vcpu_id, mode, icr_low);
 			break;
 			case APIC_DELMODE_STARTUP:
-				vlapic_process_init_sipi(target_vcpu, mode, icr_low);
+				vlapic_process_init_sipi(vm, 1UL << vcpu_id, mode, icr_low);
 			break;
 			default:
 				/* convert the dest from virtual apic_id to physical apic_id */
@@ -2178,6 +2414,14 @@ void vlapic_free(struct acrn_vcpu *vcpu)
 
 	del_timer(&vlapic->vtimer.timer);
 
+	/* no more IPI virtualization to the PI descriptor of this vCPU */
+	if (vcpu->vm->arch_vm.ipiv_enabled) {
+		uint32_t apicid = vlapic_get_apicid(vlapic);
+
+		if (apicid < PID_TABLE_ENTRIES) {
+			vcpu->vm->arch_vm.pid_table[apicid] = 0UL;
+		}
+	}
 }
 
 /**
@@ -2195,7 +2439,7 @@ apicv_set_intr_ready(struct acrn_vlapic *vlapic, uint32_t vector)
 	idx = vector >> 6U;
 
 	bitmap_set_lock((uint16_t)(vector & 0x3fU), &pir_desc->pir[idx]);
-	notify = (atomic_cmpxchg64(&pir_desc->pending, 0UL, 1UL) == 0UL) ? 1 : 0;
+	notify = bitmap_test_and_set_lock(POSTED_INTR_ON_BIT, &pir_desc->control) ? 0 : 1;
 	return notify;
 }
 
@@ -2230,6 +2474,7 @@ static bool apicv_basic_inject_intr(struct acrn_vlapic *vlapic,
 		if (vlapic_find_deliverable_intr(vlapic, &vector)) {
 			exec_vmwrite32(VMX_ENTRY_INT_INFO_FIELD, VMX_INT_INFO_VALID | vector);
 			vlapic_get_deliverable_intr(vlapic, vector);
+			vlapic->vcpu->arch.nr_injected++;
 			ret = true;
 		}
 	}
@@ -2253,7 +2498,7 @@ static void vlapic_apicv_inject_pir(struct acrn_vlapic *vlapic)
 	struct lapic_reg *irr = NULL;
 
 	pir_desc = &(vlapic->pir_desc);
-	if (atomic_cmpxchg64(&pir_desc->pending, 1UL, 0UL) == 1UL) {
+	if (bitmap_test_and_clear_lock(POSTED_INTR_ON_BIT, &pir_desc->control)) {
 		pirval = 0UL;
 		lapic = &(vlapic->apic_page);
 		irr = &lapic->irr[0];
@@ -2358,6 +2603,68 @@ bool vlapic_has_pending_delivery_intr(struct acrn_vcpu *vcpu)
 	return vlapic->ops->has_pending_delivery_intr(vcpu);
 }
 
+bool vlapic_has_posted_intr(const struct acrn_vlapic *vlapic)
+{
+	return bitmap_test(POSTED_INTR_ON_BIT, &vlapic->pir_desc.control);
+}
+
+bool vlapic_has_pending_intr(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vlapic *vlapic = vcpu_vlapic(vcpu);
+	uint32_t rvi;
+	bool ret;
+
+	if (is_apicv_advanced_feature_supported()) {
+		/* the processor evaluates RVI against the vPPR it maintains in the APIC page */
+		rvi = (uint32_t)exec_vmread16(VMX_GUEST_INTR_STATUS) & 0xFFU;
+		ret = vlapic_has_posted_intr(vlapic) || ((rvi & 0xF0U) > (vlapic->apic_page.ppr.v & 0xF0U));
+	} else {
+		ret = vlapic_has_pending_delivery_intr(vcpu);
+	}
+
+	return ret;
+}
+
+void vlapic_set_pi_wakeup(struct acrn_vlapic *vlapic, bool wakeup)
+{
+	uint64_t old, new;
+	uint64_t nv = wakeup ? (uint64_t)VECTOR_POSTED_INTR_WAKEUP : (uint64_t)VECTOR_POSTED_INTR;
+
+	/* VT-d and the processor update ON and the PIR concurrently */
+	do {
+		old = vlapic->pir_desc.control;
+		new = (old & ~POSTED_INTR_NV_MASK) | (nv << POSTED_INTR_NV_SHIFT);
+	} while ((old != new) && (atomic_cmpxchg64(&vlapic->pir_desc.control, old, new) != old));
+}
+
+void vlapic_migrate(struct acrn_vlapic *vlapic, uint16_t pcpu_id)
+{
+	struct vlapic_timer *vtimer = &vlapic->vtimer;
+	uint64_t old, new;
+	uint64_t ndst = (uint64_t)per_cpu(lapic_id, pcpu_id);
+
+	do {
+		old = vlapic->pir_desc.control;
+		new = (old & ~POSTED_INTR_NDST_MASK) | (ndst << POSTED_INTR_NDST_SHIFT);
+	} while ((old != new) && (atomic_cmpxchg64(&vlapic->pir_desc.control, old, new) != old));
+
+	/* the timer_list of a pCPU is only changed by that pCPU */
+	if (!list_empty(&vtimer->timer.node)) {
+		del_timer(&vtimer->timer);
+		vtimer->migrated = true;
+	}
+}
+
+void vlapic_restart_migrated_timer(struct acrn_vlapic *vlapic)
+{
+	struct vlapic_timer *vtimer = &vlapic->vtimer;
+
+	if (vtimer->migrated) {
+		vtimer->migrated = false;
+		(void)add_timer(&vtimer->timer);
+	}
+}
+
 static bool apicv_basic_apic_read_access_may_valid(__unused uint32_t offset)
 {
 	return true;
@@ -2508,6 +2815,13 @@ int32_t apic_write_vmexit_handler(struct acrn_vcpu *vcpu)
 		vlapic_esr_write_handler(vlapic);
 		break;
 	case APIC_OFFSET_ICR_LOW:
+		if (is_x2apic_enabled(vlapic)) {
+			/*
+			 * An x2APIC ICR write not handled by IPI virtualization:
+			 * the 64 bits vICR is stored at offset 300H.
+			 */
+			vlapic->apic_page.icr_hi.v = vlapic->apic_page.icr_lo.pad[0];
+		}
 		vlapic_icrlo_write_handler(vlapic);
 		break;
 	case APIC_OFFSET_CMCI_LVT:
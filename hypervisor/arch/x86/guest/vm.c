@@ -70,9 +70,12 @@ bool is_created_vm(const struct acrn_vm *vm)
 	return (vm->state == VM_CREATED);
 }
 
-bool is_sos_vm(const struct acrn_vm *vm)
+/**
+ * @pre vm != NULL
+ */
+bool is_paused_vm(const struct acrn_vm *vm)
 {
-	return (vm != NULL)  && (get_vm_config(vm->vm_id)->load_order == SOS_VM);
+	return (vm->state == VM_PAUSED);
 }
 
 /**
@@ -96,26 +99,6 @@ bool is_prelaunched_vm(const struct acrn_vm *vm)
 	return (vm_config->load_order == PRE_LAUNCHED_VM);
 }
 
-/**
- * @pre vm != NULL && vm_config != NULL && vm->vmid < CONFIG_MAX_VM_NUM
- */
-bool is_lapic_pt_configured(const struct acrn_vm *vm)
-{
-	struct acrn_vm_config *vm_config = get_vm_config(vm->vm_id);
-
-	return ((vm_config->guest_flags & GUEST_FLAG_LAPIC_PASSTHROUGH) != 0U);
-}
-
-/**
- * @pre vm != NULL && vm_config != NULL && vm->vmid < CONFIG_MAX_VM_NUM
- */
-bool is_rt_vm(const struct acrn_vm *vm)
-{
-	struct acrn_vm_config *vm_config = get_vm_config(vm->vm_id);
-
-	return ((vm_config->guest_flags & GUEST_FLAG_RT) != 0U);
-}
-
 /**
  * @pre vm != NULL && vm_config != NULL && vm->vmid < CONFIG_MAX_VM_NUM
  */
@@ -308,6 +291,12 @@ static void create_sos_vm_e820(struct acrn_vm *vm)
 			sos_vm_config->memory.size -= vm_config->memory.size;
 		}
 	}
+
+	/* filter out the inter-VM shared memory from e820 table */
+	if (CONFIG_IVSHMEM_SHM_SIZE != 0UL) {
+		filter_mem_from_sos_e820(vm, CONFIG_IVSHMEM_SHM_BASE, CONFIG_IVSHMEM_SHM_BASE + CONFIG_IVSHMEM_SHM_SIZE);
+		sos_vm_config->memory.size -= CONFIG_IVSHMEM_SHM_SIZE;
+	}
 }
 
 /**
@@ -380,6 +369,56 @@ static void prepare_sos_vm_memmap(struct acrn_vm *vm)
 			ept_del_mr(vm, pml4_page, vm_config->memory.start_hpa, vm_config->memory.size);
 		}
 	}
+	/* unmap the inter-VM shared memory, SOS maps it through an ivshmem device */
+	if (CONFIG_IVSHMEM_SHM_SIZE != 0UL) {
+		ept_del_mr(vm, pml4_page, CONFIG_IVSHMEM_SHM_BASE, CONFIG_IVSHMEM_SHM_SIZE);
+	}
+}
+
+/*
+ * Each 1G range which is not a single page has another level of EPT walk,
+ * the carve-outs of the hypervisor and of the pre-launched VMs are best
+ * kept within the ranges already split by MMIO holes.
+ */
+static void print_ept_page_stats(const struct acrn_vm *vm)
+{
+	struct ept_page_stats stats;
+
+	ept_page_stats(vm, &stats);
+	pr_acrnlog("VM%hu EPT: %llu 1G, %llu 2M, %llu 4K pages, %llu 1G ranges split",
+		vm->vm_id, stats.pages_1g, stats.pages_2m, stats.pages_4k, stats.split_1g);
+}
+
+/*
+ * The pCPUs of a VM are fixed by its configuration, all the hypervisor can
+ * do is tell when they don't share a last level cache: the cache lines the
+ * vCPUs share then bounce between the caches, or the sockets.
+ */
+static void check_vm_placement(const struct acrn_vm_config *vm_config, uint16_t vm_id)
+{
+	uint16_t vcpu_id, pcpu_id, first_pcpu_id;
+	bool spans_llc = false, spans_pkg = false;
+
+	first_pcpu_id = ffs64(vm_config->vcpu_affinity[0]);
+	for (vcpu_id = 1U; vcpu_id < vm_config->vcpu_num; vcpu_id++) {
+		pcpu_id = ffs64(vm_config->vcpu_affinity[vcpu_id]);
+		if ((pcpu_id < CONFIG_MAX_PCPU_NUM) && (first_pcpu_id < CONFIG_MAX_PCPU_NUM)) {
+			if (per_cpu(topo, pcpu_id).llc_id != per_cpu(topo, first_pcpu_id).llc_id) {
+				spans_llc = true;
+			}
+			if (per_cpu(topo, pcpu_id).pkg_id != per_cpu(topo, first_pcpu_id).pkg_id) {
+				spans_pkg = true;
+			}
+		}
+	}
+
+	if (spans_pkg) {
+		pr_warn("VM%hu: vCPUs spread over several packages", vm_id);
+	} else if (spans_llc) {
+		pr_warn("VM%hu: vCPUs don't share a last level cache", vm_id);
+	} else {
+		/* placed within one cache domain */
+	}
 }
 
 /* Add EPT mapping of EPC reource for the VM */
@@ -430,6 +469,18 @@ int32_t create_vm(uint16_t vm_id, struct acrn_vm_config *vm_config, struct acrn_
 	vm->vm_id = vm_id;
 	vm->hw.created_vcpus = 0U;
 	vm->emul_mmio_regions = 0U;
+	vm->emul_pio_regions = 0U;
+	spinlock_init(&vm->emul_mmio_lock);
+	spinlock_init(&vm->coalesced_lock);
+	spinlock_init(&vm->pit_latch_lock);
+	spinlock_init(&vm->pio_regs_lock);
+	spinlock_init(&vm->emul_msix_lock);
+	spinlock_init(&vm->vpci.cfg_shadow_lock);
+	spinlock_init(&vm->vie_cache.lock);
+	spinlock_init(&vm->vmtrr_ept_map.lock);
+	vm->vmtrr_ept_map.valid = false;
+	INIT_LIST_HEAD(&vm->ptdev_entries);
+	spinlock_init(&vm->ioreq_spin_lock);
 
 	init_ept_mem_ops(vm);
 	vm->arch_vm.nworld_eptp = vm->arch_vm.ept_mem_ops.get_pml4_page(vm->arch_vm.ept_mem_ops.info);
@@ -470,6 +521,8 @@ int32_t create_vm(uint16_t vm_id, struct acrn_vm_config *vm_config, struct acrn_
 			snprintf(vm_config->name, 16, "ACRN VM_%d", vm_id);
 		}
 
+		check_vm_placement(vm_config, vm_id);
+
 		 if (vm_config->load_order == PRE_LAUNCHED_VM) {
 			create_prelaunched_vm_e820(vm);
 			prepare_prelaunched_vm_memmap(vm, vm_config);
@@ -480,15 +533,21 @@ int32_t create_vm(uint16_t vm_id, struct acrn_vm_config *vm_config, struct acrn_
 	if (status == 0) {
 		prepare_epc_vm_memmap(vm);
 
+		if (!is_postlaunched_vm(vm)) {
+			print_ept_page_stats(vm);
+		}
+
 		spinlock_init(&vm->vm_lock);
 
 		vm->arch_vm.vlapic_state = VM_VLAPIC_XAPIC;
 		vm->intr_inject_delay_delta = 0UL;
+		vm->intr_mod_policy = INTR_MOD_FIXED;
 
 		/* Set up IO bit-mask such that VM exit occurs on
 		 * selected IO ranges
 		 */
 		setup_io_bitmap(vm);
+		init_vmcs_template(vm);
 
 		vm_setup_cpu_state(vm);
 
@@ -536,6 +595,8 @@ int32_t create_vm(uint16_t vm_id, struct acrn_vm_config *vm_config, struct acrn_
 	if (need_cleanup) {
 		if (vm->arch_vm.nworld_eptp != NULL) {
 			(void)memset(vm->arch_vm.nworld_eptp, 0U, PAGE_SIZE);
+			deinit_ept_mem_ops(vm);
+			vm->arch_vm.nworld_eptp = NULL;
 		}
 	}
 
@@ -546,7 +607,7 @@ int32_t create_vm(uint16_t vm_id, struct acrn_vm_config *vm_config, struct acrn_
 		 */
 		for (i = 0U; i < vm_config->vcpu_num; i++) {
 			pcpu_id = ffs64(vm_config->vcpu_affinity[i]);
-			status = prepare_vcpu(vm, pcpu_id);
+			status = prepare_vcpu(vm, vm->hw.created_vcpus, pcpu_id);
 			if (status != 0) {
 				break;
 			}
@@ -601,6 +662,8 @@ int32_t shutdown_vm(struct acrn_vm *vm)
 
 		vuart_deinit(vm);
 
+		vrtc_deinit(vm);
+
 		ptdev_release_all_entries(vm);
 
 		/* Free iommu */
@@ -13,202 +13,262 @@
 #include <hypercall.h>
 #include <trace.h>
 #include <logmsg.h>
+#include <timer.h>
 
 static spinlock_t vmm_hypercall_lock = {
 	.head = 0U,
 	.tail = 0U,
 };
 
-static int32_t dispatch_sos_hypercall(const struct acrn_vcpu *vcpu)
+/* the hypercall takes a VM id, relative to the SOS, in param1 */
+#define HC_FLAG_VMID		(1U << 0U)
+/* the hypercall is serialized with the others of the flag */
+#define HC_FLAG_LOCKED		(1U << 1U)
+
+struct hc_dispatch {
+	/* for the hypercalls of a VM: param1 is the VM id, param2 is passed */
+	int32_t (*vm_handler)(struct acrn_vm *sos_vm, uint16_t vm_id, uint64_t param2);
+	int32_t (*handler)(struct acrn_vm *sos_vm, uint16_t vm_id, uint64_t param1, uint64_t param2);
+	const char *name;
+	uint32_t flags;
+};
+
+struct hc_stats {
+	uint64_t count;
+	uint64_t cycles;
+};
+
+/* per pCPU, the hypercalls of the SOS vCPUs are not serialized */
+static struct hc_stats hc_stats[CONFIG_MAX_PCPU_NUM][HC_NR_IDS];
+
+static int32_t hc_sos_offline_cpu(struct acrn_vm *sos_vm, __unused uint16_t vm_id,
+		uint64_t param1, __unused uint64_t param2)
 {
-	struct acrn_vm *sos_vm = vcpu->vm;
-	/* hypercall ID from guest*/
-	uint64_t hypcall_id = vcpu_get_gpreg(vcpu, CPU_REG_R8);
-	/* hypercall param1 from guest*/
-	uint64_t param1 = vcpu_get_gpreg(vcpu, CPU_REG_RDI);
-	/* hypercall param2 from guest*/
-	uint64_t param2 = vcpu_get_gpreg(vcpu, CPU_REG_RSI);
-	/* hypercall param1 is a relative vm id from SOS view */
-	uint16_t relative_vm_id = (uint16_t)param1;
-	uint16_t vm_id = rel_vmid_2_vmid(sos_vm->vm_id, relative_vm_id);
-	bool vmid_is_valid = (vm_id < CONFIG_MAX_VM_NUM) ? true : false;
-	int32_t ret = -1;
+	return hcall_sos_offline_cpu(sos_vm, param1);
+}
 
-	switch (hypcall_id) {
-	case HC_SOS_OFFLINE_CPU:
-		spinlock_obtain(&vmm_hypercall_lock);
-		ret = hcall_sos_offline_cpu(sos_vm, param1);
-		spinlock_release(&vmm_hypercall_lock);
-		break;
-	case HC_GET_API_VERSION:
-		ret = hcall_get_api_version(sos_vm, param1);
-		break;
+static int32_t hc_get_api_version(struct acrn_vm *sos_vm, __unused uint16_t vm_id,
+		uint64_t param1, __unused uint64_t param2)
+{
+	return hcall_get_api_version(sos_vm, param1);
+}
 
-	case HC_GET_PLATFORM_INFO:
-		ret = hcall_get_platform_info(sos_vm, param1);
-		break;
+static int32_t hc_get_platform_info(struct acrn_vm *sos_vm, __unused uint16_t vm_id,
+		uint64_t param1, __unused uint64_t param2)
+{
+	return hcall_get_platform_info(sos_vm, param1);
+}
 
-	case HC_SET_CALLBACK_VECTOR:
-		ret = hcall_set_callback_vector(sos_vm, param1);
+static int32_t hc_set_clos_mask(struct acrn_vm *sos_vm, __unused uint16_t vm_id,
+		uint64_t param1, __unused uint64_t param2)
+{
+	return hcall_set_clos_mask(sos_vm, param1);
+}
 
-		break;
+static int32_t hc_set_callback_vector(struct acrn_vm *sos_vm, __unused uint16_t vm_id,
+		uint64_t param1, __unused uint64_t param2)
+{
+	return hcall_set_callback_vector(sos_vm, param1);
+}
 
-	case HC_CREATE_VM:
-		spinlock_obtain(&vmm_hypercall_lock);
-		ret = hcall_create_vm(sos_vm, param1);
-		spinlock_release(&vmm_hypercall_lock);
-		break;
+static int32_t hc_create_vm(struct acrn_vm *sos_vm, __unused uint16_t vm_id,
+		uint64_t param1, __unused uint64_t param2)
+{
+	return hcall_create_vm(sos_vm, param1);
+}
 
-	case HC_DESTROY_VM:
-		/* param1: relative vmid to sos, vm_id: absolute vmid */
-		if (vmid_is_valid) {
-			spinlock_obtain(&vmm_hypercall_lock);
-			ret = hcall_destroy_vm(vm_id);
-			spinlock_release(&vmm_hypercall_lock);
-		}
-		break;
+static int32_t hc_destroy_vm(__unused struct acrn_vm *sos_vm, uint16_t vm_id,
+		__unused uint64_t param1, __unused uint64_t param2)
+{
+	return hcall_destroy_vm(vm_id);
+}
 
-	case HC_START_VM:
-		/* param1: relative vmid to sos, vm_id: absolute vmid */
-		if (vmid_is_valid) {
-			spinlock_obtain(&vmm_hypercall_lock);
-			ret = hcall_start_vm(vm_id);
-			spinlock_release(&vmm_hypercall_lock);
-		}
-		break;
+static int32_t hc_start_vm(__unused struct acrn_vm *sos_vm, uint16_t vm_id,
+		__unused uint64_t param1, __unused uint64_t param2)
+{
+	return hcall_start_vm(vm_id);
+}
 
-	case HC_RESET_VM:
-		/* param1: relative vmid to sos, vm_id: absolute vmid */
-		if (vmid_is_valid) {
-			spinlock_obtain(&vmm_hypercall_lock);
-			ret = hcall_reset_vm(vm_id);
-			spinlock_release(&vmm_hypercall_lock);
-		}
-		break;
+static int32_t hc_reset_vm(__unused struct acrn_vm *sos_vm, uint16_t vm_id,
+		__unused uint64_t param1, __unused uint64_t param2)
+{
+	return hcall_reset_vm(vm_id);
+}
 
-	case HC_PAUSE_VM:
-		/* param1: relative vmid to sos, vm_id: absolute vmid */
-		if (vmid_is_valid) {
-			spinlock_obtain(&vmm_hypercall_lock);
-			ret = hcall_pause_vm(vm_id);
-			spinlock_release(&vmm_hypercall_lock);
-		}
-		break;
+static int32_t hc_pause_vm(__unused struct acrn_vm *sos_vm, uint16_t vm_id,
+		__unused uint64_t param1, __unused uint64_t param2)
+{
+	return hcall_pause_vm(vm_id);
+}
 
-	case HC_CREATE_VCPU:
-		ret = 0;
-		break;
+/*
+ * HC_VM_PCI_MSIX_REMAP does no MSI remapping, the pmsi_data equal to vmsi_data,
+ * a temporary solution before this hypercall is removed from SOS
+ */
+static int32_t hc_nop(__unused struct acrn_vm *sos_vm, __unused uint16_t vm_id,
+		__unused uint64_t param1, __unused uint64_t param2)
+{
+	return 0;
+}
 
-	case HC_SET_VCPU_REGS:
-		/* param1: relative vmid to sos, vm_id: absolute vmid */
-		if (vmid_is_valid) {
-			spinlock_obtain(&vmm_hypercall_lock);
-			ret = hcall_set_vcpu_regs(sos_vm, vm_id, param2);
-			spinlock_release(&vmm_hypercall_lock);
-		}
-		break;
+static int32_t hc_set_irqline(struct acrn_vm *sos_vm, uint16_t vm_id,
+		__unused uint64_t param1, uint64_t param2)
+{
+	return hcall_set_irqline(sos_vm, vm_id, (struct acrn_irqline_ops *)&param2);
+}
 
-	case HC_SET_IRQLINE:
-		/* param1: relative vmid to sos, vm_id: absolute vmid */
-		if (vmid_is_valid) {
-			ret = hcall_set_irqline(sos_vm, vm_id,
-					(struct acrn_irqline_ops *)&param2);
-		}
-		break;
+/* param2: vcpu_id */
+static int32_t hc_notify_ioreq_finish(__unused struct acrn_vm *sos_vm, uint16_t vm_id,
+		__unused uint64_t param1, uint64_t param2)
+{
+	return hcall_notify_ioreq_finish(vm_id, (uint16_t)param2);
+}
 
-	case HC_INJECT_MSI:
-		/* param1: relative vmid to sos, vm_id: absolute vmid */
-		if (vmid_is_valid) {
-			ret = hcall_inject_msi(sos_vm, vm_id, param2);
-		}
-		break;
+/* param2: bitmap of vcpu_id */
+static int32_t hc_notify_ioreq_finish_batch(__unused struct acrn_vm *sos_vm, uint16_t vm_id,
+		__unused uint64_t param1, uint64_t param2)
+{
+	return hcall_notify_ioreq_finish_batch(vm_id, param2);
+}
 
-	case HC_SET_IOREQ_BUFFER:
-		/* param1: relative vmid to sos, vm_id: absolute vmid */
-		if (vmid_is_valid) {
-			spinlock_obtain(&vmm_hypercall_lock);
-			ret = hcall_set_ioreq_buffer(sos_vm, vm_id, param2);
-			spinlock_release(&vmm_hypercall_lock);
-		}
-		break;
-
-	case HC_NOTIFY_REQUEST_FINISH:
-		/* param1: relative vmid to sos, vm_id: absolute vmid
-		 * param2: vcpu_id */
-		if (vmid_is_valid) {
-			ret = hcall_notify_ioreq_finish(vm_id,
-				(uint16_t)param2);
-		}
-		break;
+static int32_t hc_set_vm_memory_regions(struct acrn_vm *sos_vm, __unused uint16_t vm_id,
+		uint64_t param1, __unused uint64_t param2)
+{
+	return hcall_set_vm_memory_regions(sos_vm, param1);
+}
 
-	case HC_VM_SET_MEMORY_REGIONS:
-		ret = hcall_set_vm_memory_regions(sos_vm, param1);
-		break;
+static int32_t hc_get_cpu_pm_state(struct acrn_vm *sos_vm, __unused uint16_t vm_id,
+		uint64_t param1, uint64_t param2)
+{
+	return hcall_get_cpu_pm_state(sos_vm, param1, param2);
+}
 
-	case HC_VM_WRITE_PROTECT_PAGE:
-		/* param1: relative vmid to sos, vm_id: absolute vmid */
-		if (vmid_is_valid) {
-			ret = hcall_write_protect_page(sos_vm, vm_id, param2);
-		}
-		break;
+#define HC_VM(id, fn, fl)	[HC_IDX(id)] = { .vm_handler = (fn), .name = #id, .flags = (HC_FLAG_VMID | (fl)) }
+#define HC(id, fn, fl)		[HC_IDX(id)] = { .handler = (fn), .name = #id, .flags = (fl) }
+
+static const struct hc_dispatch hc_dispatch_table[HC_NR_IDS] = {
+	HC(HC_GET_API_VERSION, hc_get_api_version, 0U),
+	HC(HC_SOS_OFFLINE_CPU, hc_sos_offline_cpu, HC_FLAG_LOCKED),
+	HC(HC_SET_CALLBACK_VECTOR, hc_set_callback_vector, 0U),
+	HC(HC_GET_PLATFORM_INFO, hc_get_platform_info, 0U),
+	HC(HC_SET_CLOS_MASK, hc_set_clos_mask, HC_FLAG_LOCKED),
+
+	HC(HC_CREATE_VM, hc_create_vm, HC_FLAG_LOCKED),
+	HC(HC_DESTROY_VM, hc_destroy_vm, HC_FLAG_VMID | HC_FLAG_LOCKED),
+	HC(HC_START_VM, hc_start_vm, HC_FLAG_VMID | HC_FLAG_LOCKED),
+	HC(HC_PAUSE_VM, hc_pause_vm, HC_FLAG_VMID | HC_FLAG_LOCKED),
+	HC_VM(HC_CREATE_VCPU, hcall_create_vcpu, HC_FLAG_LOCKED),
+	HC_VM(HC_REMOVE_VCPU, hcall_remove_vcpu, HC_FLAG_LOCKED),
+	HC(HC_RESET_VM, hc_reset_vm, HC_FLAG_VMID | HC_FLAG_LOCKED),
+	HC_VM(HC_SET_VCPU_REGS, hcall_set_vcpu_regs, HC_FLAG_LOCKED),
+	HC_VM(HC_VM_GET_EXIT_STATS, hcall_vm_get_exit_stats, 0U),
+	HC_VM(HC_VM_SET_VCPU_STATS, hcall_vm_set_vcpu_stats, HC_FLAG_LOCKED),
+	HC_VM(HC_VM_SET_CLOS, hcall_vm_set_clos, HC_FLAG_LOCKED),
+	HC_VM(HC_VM_IVSHMEM, hcall_vm_ivshmem, 0U),
+
+	HC_VM(HC_INJECT_MSI, hcall_inject_msi, 0U),
+	HC_VM(HC_VM_INTR_MONITOR, hcall_vm_intr_monitor, 0U),
+	HC(HC_SET_IRQLINE, hc_set_irqline, HC_FLAG_VMID),
+	HC_VM(HC_INJECT_INTR_BATCH, hcall_inject_intr_batch, 0U),
+
+	HC_VM(HC_SET_IOREQ_BUFFER, hcall_set_ioreq_buffer, HC_FLAG_LOCKED),
+	HC(HC_NOTIFY_REQUEST_FINISH, hc_notify_ioreq_finish, HC_FLAG_VMID),
+	HC(HC_NOTIFY_REQUEST_FINISH_BATCH, hc_notify_ioreq_finish_batch, HC_FLAG_VMID),
+	HC_VM(HC_VM_SET_DOORBELL, hcall_vm_set_doorbell, 0U),
+	HC_VM(HC_VM_GET_DOORBELLS, hcall_vm_get_doorbells, 0U),
+	HC_VM(HC_SET_COALESCED_MMIO_RING, hcall_set_coalesced_mmio_ring, HC_FLAG_LOCKED),
+	HC_VM(HC_VM_SET_COALESCED_MMIO_ZONE, hcall_vm_set_coalesced_mmio_zone, 0U),
+	HC_VM(HC_SET_TIMER_COUNTERS, hcall_set_timer_counters, HC_FLAG_LOCKED),
+	HC_VM(HC_SET_PCI_CFG_SHADOW, hcall_set_pci_cfg_shadow, HC_FLAG_LOCKED),
+	HC_VM(HC_VM_SET_EMUL_MSIX, hcall_vm_set_emul_msix, 0U),
+	HC_VM(HC_SET_PIO_REGS, hcall_set_pio_regs, HC_FLAG_LOCKED),
+	HC_VM(HC_SET_VRTC, hcall_set_vrtc, HC_FLAG_LOCKED),
+
+	HC_VM(HC_VM_GPA2HPA, hcall_gpa_to_hpa, 0U),
+	HC(HC_VM_SET_MEMORY_REGIONS, hc_set_vm_memory_regions, 0U),
+	HC_VM(HC_VM_WRITE_PROTECT_PAGE, hcall_write_protect_page, 0U),
+	HC_VM(HC_VM_SET_DIRTY_LOG, hcall_set_dirty_log, 0U),
+	HC_VM(HC_VM_GET_DIRTY_LOG, hcall_get_dirty_log, 0U),
+
+	HC_VM(HC_ASSIGN_PTDEV, hcall_assign_ptdev, 0U),
+	HC_VM(HC_DEASSIGN_PTDEV, hcall_deassign_ptdev, 0U),
+	HC(HC_VM_PCI_MSIX_REMAP, hc_nop, 0U),
+	HC_VM(HC_SET_PTDEV_INTR_INFO, hcall_set_ptdev_intr_info, 0U),
+	HC_VM(HC_RESET_PTDEV_INTR_INFO, hcall_reset_ptdev_intr_info, 0U),
+
+	HC(HC_PM_GET_CPU_STATE, hc_get_cpu_pm_state, 0U),
+};
 
-	/*
-	 * Don't do MSI remapping and make the pmsi_data equal to vmsi_data
-	 * This is a temporary solution before this hypercall is removed from SOS
-	 */
-	case HC_VM_PCI_MSIX_REMAP:
-		ret = 0;
-		break;
+static int32_t dispatch_sos_hypercall(const struct acrn_vcpu *vcpu)
+{
+	struct acrn_vm *sos_vm = vcpu->vm;
+	/* hypercall ID from guest*/
+	uint64_t hypcall_id = vcpu_get_gpreg(vcpu, CPU_REG_R8);
+	/* hypercall param1 from guest*/
+	uint64_t param1 = vcpu_get_gpreg(vcpu, CPU_REG_RDI);
+	/* hypercall param2 from guest*/
+	uint64_t param2 = vcpu_get_gpreg(vcpu, CPU_REG_RSI);
+	/* hypercall param1 is a relative vm id from SOS view */
+	uint16_t vm_id = rel_vmid_2_vmid(sos_vm->vm_id, (uint16_t)param1);
+	const struct hc_dispatch *dispatch = NULL;
+	struct hc_stats *stats;
+	uint64_t start = rdtsc();
+	uint32_t idx = HC_NR_IDS;
+	int32_t ret = -1;
 
-	case HC_VM_GPA2HPA:
-		/* param1: relative vmid to sos, vm_id: absolute vmid */
-		if (vmid_is_valid) {
-			ret = hcall_gpa_to_hpa(sos_vm, vm_id, param2);
-		}
-		break;
+	if ((hypcall_id & ~0xFFUL) == BASE_HC_ID(HC_ID, 0UL)) {
+		idx = (uint32_t)HC_IDX(hypcall_id);
+	}
+	if (idx < HC_NR_IDS) {
+		dispatch = &hc_dispatch_table[idx];
+	}
 
-	case HC_ASSIGN_PTDEV:
+	if ((dispatch == NULL) || ((dispatch->vm_handler == NULL) && (dispatch->handler == NULL))) {
+		ret = hcall_debug(sos_vm, param1, param2, hypcall_id);
+	} else if (((dispatch->flags & HC_FLAG_VMID) != 0U) && (vm_id >= CONFIG_MAX_VM_NUM)) {
 		/* param1: relative vmid to sos, vm_id: absolute vmid */
-		if (vmid_is_valid) {
-			ret = hcall_assign_ptdev(sos_vm, vm_id, param2);
+		ret = -1;
+	} else {
+		if ((dispatch->flags & HC_FLAG_LOCKED) != 0U) {
+			spinlock_obtain(&vmm_hypercall_lock);
 		}
-		break;
-
-	case HC_DEASSIGN_PTDEV:
-		/* param1: relative vmid to sos, vm_id: absolute vmid */
-		if (vmid_is_valid) {
-			ret = hcall_deassign_ptdev(sos_vm, vm_id, param2);
+		if (dispatch->vm_handler != NULL) {
+			ret = dispatch->vm_handler(sos_vm, vm_id, param2);
+		} else {
+			ret = dispatch->handler(sos_vm, vm_id, param1, param2);
 		}
-		break;
-
-	case HC_SET_PTDEV_INTR_INFO:
-		/* param1: relative vmid to sos, vm_id: absolute vmid */
-		if (vmid_is_valid) {
-			ret = hcall_set_ptdev_intr_info(sos_vm, vm_id, param2);
+		if ((dispatch->flags & HC_FLAG_LOCKED) != 0U) {
+			spinlock_release(&vmm_hypercall_lock);
 		}
-		break;
+	}
 
-	case HC_RESET_PTDEV_INTR_INFO:
-		/* param1: relative vmid to sos, vm_id: absolute vmid */
-		if (vmid_is_valid) {
-			ret = hcall_reset_ptdev_intr_info(sos_vm, vm_id, param2);
-		}
-		break;
+	if (idx < HC_NR_IDS) {
+		stats = &hc_stats[vcpu->pcpu_id][idx];
+		stats->count++;
+		stats->cycles += rdtsc() - start;
+	}
 
-	case HC_PM_GET_CPU_STATE:
-		ret = hcall_get_cpu_pm_state(sos_vm, param1, param2);
-		break;
+	return ret;
+}
 
-	case HC_VM_INTR_MONITOR:
-		/* param1: relative vmid to sos, vm_id: absolute vmid */
-		if (vmid_is_valid) {
-			ret = hcall_vm_intr_monitor(sos_vm, vm_id, param2);
+/*
+ * The counts and cycles of a SOS hypercall on all pCPUs, false past the
+ * last index, name is NULL for the indexes of no hypercall in the table.
+ */
+bool get_hypercall_stats(uint32_t idx, const char **name, uint64_t *count, uint64_t *cycles)
+{
+	uint16_t pcpu_id;
+	bool ret = false;
+
+	if (idx < HC_NR_IDS) {
+		*name = hc_dispatch_table[idx].name;
+		*count = 0UL;
+		*cycles = 0UL;
+		for (pcpu_id = 0U; pcpu_id < CONFIG_MAX_PCPU_NUM; pcpu_id++) {
+			*count += hc_stats[pcpu_id][idx].count;
+			*cycles += hc_stats[pcpu_id][idx].cycles;
 		}
-		break;
-
-	default:
-		ret = hcall_debug(sos_vm, param1, param2, hypcall_id);
-		break;
+		ret = true;
 	}
 
 	return ret;
@@ -239,6 +299,10 @@ int32_t vmcall_vmexit_handler(struct acrn_vcpu *vcpu)
 		ret = hcall_initialize_trusty(vcpu, param1);
 	} else if (hypcall_id == HC_SAVE_RESTORE_SWORLD_CTX) {
 		ret = hcall_save_restore_sworld_ctx(vcpu);
+	} else if (hypcall_id == HC_SEND_IPI_MASK) {
+		ret = hcall_send_ipi_mask(vcpu, vcpu_get_gpreg(vcpu, CPU_REG_RDI), vcpu_get_gpreg(vcpu, CPU_REG_RSI));
+	} else if (hypcall_id == HC_SET_PV_EOI) {
+		ret = hcall_set_pv_eoi(vcpu, vcpu_get_gpreg(vcpu, CPU_REG_RDI));
 	} else if (is_sos_vm(vm)) {
 		/* Dispatch the hypercall handler */
 		ret = dispatch_sos_hypercall(vcpu);
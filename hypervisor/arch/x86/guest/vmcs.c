@@ -18,8 +18,14 @@
 #include <cpu_caps.h>
 #include <cpufeatures.h>
 #include <vmexit.h>
+#include <security.h>
 #include <logmsg.h>
 
+#define PTMR_MAX_TICKS	0xFFFFFFFFUL
+
+/* the VMX preemption timer counts down every 2^ptmr_tsc_shift TSC cycles */
+static uint8_t ptmr_tsc_shift;
+
 /* rip, rsp, ia32_efer and rflags are written to VMCS in start_vcpu */
 static void init_guest_vmx(struct acrn_vcpu *vcpu, uint64_t cr0, uint64_t cr3,
 	uint64_t cr4)
@@ -30,6 +36,8 @@ static void init_guest_vmx(struct acrn_vcpu *vcpu, uint64_t cr0, uint64_t cr3,
 	vcpu_set_cr4(vcpu, cr4);
 	vcpu_set_cr0(vcpu, cr0);
 	exec_vmwrite(VMX_GUEST_CR3, cr3);
+	bitmap_clear_lock(CPU_REG_CR3, &vcpu->reg_cached);
+	bitmap_clear_lock(CPU_REG_CS, &vcpu->reg_cached);
 
 	exec_vmwrite(VMX_GUEST_GDTR_BASE, ectx->gdtr.base);
 	pr_dbg("VMX_GUEST_GDTR_BASE: 0x%016llx", ectx->gdtr.base);
@@ -235,16 +243,62 @@ static uint32_t check_vmx_ctrl(uint32_t msr, uint32_t ctrl_req)
 
 }
 
-static void init_exec_ctrl(struct acrn_vcpu *vcpu)
+/*
+ * IPI virtualization: the fixed IPIs of the guest to a single physical
+ * destination are posted by the processor to the PI descriptor found in
+ * the PID-pointer table, without VM exit. The others lead to APIC-write
+ * VM exits.
+ */
+static void init_ipiv_ctrl(struct acrn_vcpu *vcpu)
 {
-	uint32_t value32;
-	uint64_t value64;
 	struct acrn_vm *vm = vcpu->vm;
+	uint16_t last_index;
+	uint32_t value32;
+	bool enabled = false;
+
+	if (is_apicv_ipiv_supported() && !is_lapic_pt_configured(vm)) {
+		if (vlapic_build_pid_table(vm, &last_index)) {
+			value32 = exec_vmread32(VMX_PROC_VM_EXEC_CONTROLS);
+			value32 |= VMX_PROCBASED_CTLS_TERTIARY;
+			exec_vmwrite32(VMX_PROC_VM_EXEC_CONTROLS, value32);
+
+			exec_vmwrite64(VMX_PROC_VM_EXEC_CONTROLS3_FULL, VMX_PROCBASED_CTLS3_IPIV);
+			exec_vmwrite64(VMX_PID_POINTER_TABLE_ADDR_FULL, hva2hpa(vm->arch_vm.pid_table));
+			exec_vmwrite16(VMX_LAST_PID_POINTER_INDEX, last_index);
+			enabled = true;
+		} else {
+			pr_info("VM%u: APIC ID beyond the PID-pointer table, no IPI virtualization", vm->vm_id);
+		}
+	}
+	vm->arch_vm.ipiv_enabled = enabled;
+}
 
-	/* Log messages to show initializing VMX execution controls */
-	pr_dbg("*****************************");
-	pr_dbg("Initialize execution control ");
-	pr_dbg("*****************************");
+static void tmpl_add(struct vmcs_template *tmpl, uint32_t field, uint64_t value)
+{
+	if (tmpl->num_fields < VMCS_TEMPLATE_FIELDS) {
+		tmpl->fields[tmpl->num_fields].field = field;
+		tmpl->fields[tmpl->num_fields].value = value;
+		tmpl->num_fields++;
+	} else {
+		pr_err("%s: no room for VMCS field 0x%x", __func__, field);
+	}
+}
+
+/*
+ * The VMX capability MSRs and the VM configuration are the same for all the
+ * vCPUs of a VM: the controls they allow and the fields which do not depend
+ * on the vCPU are computed once here, init_vmcs() only writes them and the
+ * per vCPU fields.
+ *
+ * @pre vm != NULL
+ * @pre vm->arch_vm.io_bitmap is set up
+ */
+void init_vmcs_template(struct acrn_vm *vm)
+{
+	struct vmcs_template *tmpl = &vm->arch_vm.vmcs_tmpl;
+	uint32_t value32;
+
+	tmpl->num_fields = 0U;
 
 	/* Set up VM Execution control to enable Set VM-exits on external
 	 * interrupts preemption timer - pg 2899 24.6.1
@@ -256,8 +310,15 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 		value32 |= VMX_PINBASED_CTLS_POST_IRQ;
 	}
 
-	exec_vmwrite32(VMX_PIN_VM_EXEC_CONTROLS, value32);
-	pr_dbg("VMX_PIN_VM_EXEC_CONTROLS: 0x%x ", value32);
+	/* a LAPIC passthrough vCPU owns the TSC-deadline MSR of its pCPU */
+	tmpl->ptmr_enabled = false;
+	if (!is_lapic_pt_configured(vm) &&
+		((msr_read(MSR_IA32_VMX_PINBASED_CTLS) & ((uint64_t)VMX_PINBASED_CTLS_ENABLE_PTMR << 32U)) != 0UL)) {
+		ptmr_tsc_shift = (uint8_t)(msr_read(MSR_IA32_VMX_MISC) & MSR_IA32_MISC_PTMR_RATE_MASK);
+		value32 |= VMX_PINBASED_CTLS_ENABLE_PTMR;
+		tmpl->ptmr_enabled = true;
+	}
+	tmpl_add(tmpl, VMX_PIN_VM_EXEC_CONTROLS, value32);
 
 	/* Set up primary processor based VM execution controls - pg 2900
 	 * 24.6.2. Set up for:
@@ -284,8 +345,11 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 	 */
 	value32 &= ~VMX_PROCBASED_CTLS_INVLPG;
 
-	exec_vmwrite32(VMX_PROC_VM_EXEC_CONTROLS, value32);
-	pr_dbg("VMX_PROC_VM_EXEC_CONTROLS: 0x%x ", value32);
+	/* a halted vCPU gives its pCPU up, see vcpu_halt() */
+	if (!is_lapic_pt_configured(vm)) {
+		value32 |= VMX_PROCBASED_CTLS_HLT;
+	}
+	tmpl_add(tmpl, VMX_PROC_VM_EXEC_CONTROLS, value32);
 
 	/* Set up secondary processor based VM execution controls - pg 2901
 	 * 24.6.2. Set up for: * Enable EPT * Enable RDTSCP * Unrestricted
@@ -294,16 +358,21 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 	value32 = check_vmx_ctrl(MSR_IA32_VMX_PROCBASED_CTLS2,
 			VMX_PROCBASED_CTLS2_VAPIC | VMX_PROCBASED_CTLS2_EPT |
 			VMX_PROCBASED_CTLS2_RDTSCP | VMX_PROCBASED_CTLS2_UNRESTRICT);
-
-	if (vcpu->arch.vpid != 0U) {
-		value32 |= VMX_PROCBASED_CTLS2_VPID;
-	} else {
-		value32 &= ~VMX_PROCBASED_CTLS2_VPID;
-	}
+	value32 &= ~VMX_PROCBASED_CTLS2_VPID;
 
 	if (is_apicv_advanced_feature_supported()) {
 		value32 |= VMX_PROCBASED_CTLS2_VIRQ;
 		value32 |= VMX_PROCBASED_CTLS2_VAPIC_REGS;
+
+		/* Disable all EOI VMEXIT by default and
+		 * clear RVI and SVI.
+		 */
+		tmpl_add(tmpl, VMX_EOI_EXIT0_FULL, 0UL);
+		tmpl_add(tmpl, VMX_EOI_EXIT1_FULL, 0UL);
+		tmpl_add(tmpl, VMX_EOI_EXIT2_FULL, 0UL);
+		tmpl_add(tmpl, VMX_EOI_EXIT3_FULL, 0UL);
+		tmpl_add(tmpl, VMX_GUEST_INTR_STATUS, 0UL);
+		tmpl_add(tmpl, VMX_POSTED_INTR_VECTOR, VECTOR_POSTED_INTR);
 	} else {
 		/*
 		 * This field exists only on processors that support
@@ -313,135 +382,162 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 		 * Set up TPR threshold for virtual interrupt delivery
 		 * - pg 2904 24.6.8
 		 */
-		exec_vmwrite32(VMX_TPR_THRESHOLD, 0U);
+		tmpl_add(tmpl, VMX_TPR_THRESHOLD, 0UL);
 	}
 
 	if (pcpu_has_cap(X86_FEATURE_OSXSAVE)) {
-		exec_vmwrite64(VMX_XSS_EXITING_BITMAP_FULL, 0UL);
+		tmpl_add(tmpl, VMX_XSS_EXITING_BITMAP_FULL, 0UL);
 		value32 |= VMX_PROCBASED_CTLS2_XSVE_XRSTR;
 	}
 
 	value32 |= VMX_PROCBASED_CTLS2_WBINVD;
 
+	/* a vCPU spinning on a lock yields to the preempted vCPUs, see vcpu_yield() */
+	tmpl->ple_enabled = false;
+	if (!is_lapic_pt_configured(vm) &&
+		((msr_read(MSR_IA32_VMX_PROCBASED_CTLS2) & ((uint64_t)VMX_PROCBASED_CTLS2_PAUSE_LOOP << 32U)) != 0UL)) {
+		value32 |= VMX_PROCBASED_CTLS2_PAUSE_LOOP;
+		tmpl_add(tmpl, VMX_PLE_GAP, PLE_GAP);
+		tmpl->ple_enabled = true;
+	}
+	tmpl->proc_ctls2 = value32;
+
+	/*APIC-v, config APIC-access address*/
+	tmpl_add(tmpl, VMX_APIC_ACCESS_ADDR_FULL, vlapic_apicv_get_apic_access_addr());
+
+	/* Set up guest exception mask bitmap setting a bit * causes a VM exit
+	 * on corresponding guest * exception - pg 2902 24.6.3
+	 * enable VM exit on MC only
+	 */
+	tmpl_add(tmpl, VMX_EXCEPTION_BITMAP, (1UL << IDT_MC));
+
+	/* Set up page fault error code mask and match - second paragraph
+	 * pg 2902 24.6.3 - guest page fault exception causing vmexit is
+	 * governed by both VMX_EXCEPTION_BITMAP and these two fields
+	 */
+	tmpl_add(tmpl, VMX_PF_ERROR_CODE_MASK, 0UL);
+	tmpl_add(tmpl, VMX_PF_ERROR_CODE_MATCH, 0UL);
+
+	/* Set up CR3 target count - An execution of mov to CR3 * by guest
+	 * causes HW to evaluate operand match with * one of N CR3-Target Value
+	 * registers. The CR3 target * count values tells the number of
+	 * target-value regs to evaluate
+	 */
+	tmpl_add(tmpl, VMX_CR3_TARGET_COUNT, 0UL);
+	tmpl_add(tmpl, VMX_CR3_TARGET_0, 0UL);
+	tmpl_add(tmpl, VMX_CR3_TARGET_1, 0UL);
+	tmpl_add(tmpl, VMX_CR3_TARGET_2, 0UL);
+	tmpl_add(tmpl, VMX_CR3_TARGET_3, 0UL);
+
+	/* Set up IO bitmap register A and B - pg 2902 24.6.4 */
+	tmpl_add(tmpl, VMX_IO_BITMAP_A_FULL, hva2hpa(vm->arch_vm.io_bitmap));
+	tmpl_add(tmpl, VMX_IO_BITMAP_B_FULL, hva2hpa((void *)&(vm->arch_vm.io_bitmap[PAGE_SIZE])));
+
+	/* Set up executive VMCS pointer - pg 2905 24.6.10 */
+	tmpl_add(tmpl, VMX_EXECUTIVE_VMCS_PTR_FULL, 0UL);
+
+	/* Set up the link pointer */
+	tmpl_add(tmpl, VMX_VMS_LINK_PTR_FULL, 0xFFFFFFFFFFFFFFFFUL);
+
+	/* Set up VMX entry controls - pg 2908 24.8.1 * Set IA32e guest mode -
+	 * on VM entry processor is in IA32e 64 bitmode * Start guest with host
+	 * IA32_PAT and IA32_EFER
+	 */
+	value32 = VMX_ENTRY_CTLS_LOAD_EFER | VMX_ENTRY_CTLS_LOAD_PAT;
+	tmpl->entry_ctls = check_vmx_ctrl(MSR_IA32_VMX_ENTRY_CTLS, value32);
+	tmpl->entry_ctls_ia32e = check_vmx_ctrl(MSR_IA32_VMX_ENTRY_CTLS, value32 | VMX_ENTRY_CTLS_IA32E_MODE);
+
+	/* Set up VM entry interrupt information, exception error code and
+	 * instruction length - pg 2909 24.8.3
+	 */
+	tmpl_add(tmpl, VMX_ENTRY_INT_INFO_FIELD, 0UL);
+	tmpl_add(tmpl, VMX_ENTRY_EXCEPTION_ERROR_CODE, 0UL);
+	tmpl_add(tmpl, VMX_ENTRY_INSTR_LENGTH, 0UL);
+
+	/* Set up VM exit controls - pg 2907 24.7.1 for: Host address space
+	 * size is 64 bit Set up to acknowledge interrupt on exit, if 1 the HW
+	 * acks the interrupt in VMX non-root and saves the interrupt vector to
+	 * the relevant VM exit field for further processing by Hypervisor
+	 * Enable saving and loading of IA32_PAT and IA32_EFER on VMEXIT Enable
+	 * saving of pre-emption timer on VMEXIT
+	 */
+	value32 = check_vmx_ctrl(MSR_IA32_VMX_EXIT_CTLS,
+			 VMX_EXIT_CTLS_ACK_IRQ | VMX_EXIT_CTLS_SAVE_PAT |
+			 VMX_EXIT_CTLS_LOAD_PAT | VMX_EXIT_CTLS_LOAD_EFER |
+			 VMX_EXIT_CTLS_SAVE_EFER | VMX_EXIT_CTLS_HOST_ADDR64);
+	tmpl_add(tmpl, VMX_EXIT_CONTROLS, value32);
+}
+
+static void init_exec_ctrl(struct acrn_vcpu *vcpu)
+{
+	uint32_t i, value32;
+	uint64_t value64;
+	struct acrn_vm *vm = vcpu->vm;
+	const struct vmcs_template *tmpl = &vm->arch_vm.vmcs_tmpl;
+
+	/* Log messages to show initializing VMX execution controls */
+	pr_dbg("*****************************");
+	pr_dbg("Initialize execution control ");
+	pr_dbg("*****************************");
+
+	/* the fields shared by all the vCPUs of the VM, see init_vmcs_template() */
+	for (i = 0U; i < tmpl->num_fields; i++) {
+		exec_vmwrite(tmpl->fields[i].field, tmpl->fields[i].value);
+	}
+
+	vcpu->arch.ptmr_enabled = tmpl->ptmr_enabled;
+
+	value32 = tmpl->proc_ctls2;
+	if (vcpu->arch.vpid != 0U) {
+		value32 |= VMX_PROCBASED_CTLS2_VPID;
+	}
 	exec_vmwrite32(VMX_PROC_VM_EXEC_CONTROLS2, value32);
 	pr_dbg("VMX_PROC_VM_EXEC_CONTROLS2: 0x%x ", value32);
 
-	/*APIC-v, config APIC-access address*/
-	value64 = vlapic_apicv_get_apic_access_addr();
-	exec_vmwrite64(VMX_APIC_ACCESS_ADDR_FULL, value64);
+	if (tmpl->ple_enabled) {
+		vcpu->arch.ple_window = PLE_WINDOW_MIN;
+		exec_vmwrite32(VMX_PLE_WINDOW, vcpu->arch.ple_window);
+	}
 
 	/*APIC-v, config APIC virtualized page address*/
 	value64 = vlapic_apicv_get_apic_page_addr(vcpu_vlapic(vcpu));
 	exec_vmwrite64(VMX_VIRTUAL_APIC_PAGE_ADDR_FULL, value64);
 
 	if (is_apicv_advanced_feature_supported()) {
-		/* Disable all EOI VMEXIT by default and
-		 * clear RVI and SVI.
-		 */
-		exec_vmwrite64(VMX_EOI_EXIT0_FULL, 0UL);
-		exec_vmwrite64(VMX_EOI_EXIT1_FULL, 0UL);
-		exec_vmwrite64(VMX_EOI_EXIT2_FULL, 0UL);
-		exec_vmwrite64(VMX_EOI_EXIT3_FULL, 0UL);
-
-		exec_vmwrite16(VMX_GUEST_INTR_STATUS, 0U);
-		exec_vmwrite16(VMX_POSTED_INTR_VECTOR, VECTOR_POSTED_INTR);
 		exec_vmwrite64(VMX_PIR_DESC_ADDR_FULL, apicv_get_pir_desc_paddr(vcpu));
 	}
 
+	init_ipiv_ctrl(vcpu);
+
 	/* Load EPTP execution control
 	 * TODO: introduce API to make this data driven based
 	 * on VMX_EPT_VPID_CAP
 	 */
-	value64 = hva2hpa(vm->arch_vm.nworld_eptp) | (3UL << 3U) | 6UL;
+	value64 = ept_pointer(vm, vm->arch_vm.nworld_eptp);
 	exec_vmwrite64(VMX_EPT_POINTER_FULL, value64);
 	pr_dbg("VMX_EPT_POINTER: 0x%016llx ", value64);
 
-	/* Set up guest exception mask bitmap setting a bit * causes a VM exit
-	 * on corresponding guest * exception - pg 2902 24.6.3
-	 * enable VM exit on MC only
-	 */
-	value32 = (1U << IDT_MC);
-	exec_vmwrite32(VMX_EXCEPTION_BITMAP, value32);
-
-	/* Set up page fault error code mask - second paragraph * pg 2902
-	 * 24.6.3 - guest page fault exception causing * vmexit is governed by
-	 * both VMX_EXCEPTION_BITMAP and * VMX_PF_ERROR_CODE_MASK
-	 */
-	exec_vmwrite32(VMX_PF_ERROR_CODE_MASK, 0U);
-
-	/* Set up page fault error code match - second paragraph * pg 2902
-	 * 24.6.3 - guest page fault exception causing * vmexit is governed by
-	 * both VMX_EXCEPTION_BITMAP and * VMX_PF_ERROR_CODE_MATCH
-	 */
-	exec_vmwrite32(VMX_PF_ERROR_CODE_MATCH, 0U);
-
-	/* Set up CR3 target count - An execution of mov to CR3 * by guest
-	 * causes HW to evaluate operand match with * one of N CR3-Target Value
-	 * registers. The CR3 target * count values tells the number of
-	 * target-value regs to evaluate
-	 */
-	exec_vmwrite32(VMX_CR3_TARGET_COUNT, 0U);
-
-	/* Set up IO bitmap register A and B - pg 2902 24.6.4 */
-	value64 = hva2hpa(vm->arch_vm.io_bitmap);
-	exec_vmwrite64(VMX_IO_BITMAP_A_FULL, value64);
-	pr_dbg("VMX_IO_BITMAP_A: 0x%016llx ", value64);
-	value64 = hva2hpa((void *)&(vm->arch_vm.io_bitmap[PAGE_SIZE]));
-	exec_vmwrite64(VMX_IO_BITMAP_B_FULL, value64);
-	pr_dbg("VMX_IO_BITMAP_B: 0x%016llx ", value64);
-
 	init_msr_emulation(vcpu);
 
-	/* Set up executive VMCS pointer - pg 2905 24.6.10 */
-	exec_vmwrite64(VMX_EXECUTIVE_VMCS_PTR_FULL, 0UL);
-
 	/* Setup Time stamp counter offset - pg 2902 24.6.5
 	 * VMCS.OFFSET = vAdjust - pAdjust
 	 */
 	value64 = vcpu_get_guest_msr(vcpu, MSR_IA32_TSC_ADJUST) - cpu_msr_read(MSR_IA32_TSC_ADJUST);
 	exec_vmwrite64(VMX_TSC_OFFSET_FULL, value64);
 
-	/* Set up the link pointer */
-	exec_vmwrite64(VMX_VMS_LINK_PTR_FULL, 0xFFFFFFFFFFFFFFFFUL);
-
-	/* Natural-width */
-	pr_dbg("Natural-width*********");
-
 	init_cr0_cr4_host_mask();
-
-	/* The CR3 target registers work in concert with VMX_CR3_TARGET_COUNT
-	 * field. Using these registers guest CR3 access can be managed. i.e.,
-	 * if operand does not match one of these register values a VM exit
-	 * would occur
-	 */
-	exec_vmwrite(VMX_CR3_TARGET_0, 0UL);
-	exec_vmwrite(VMX_CR3_TARGET_1, 0UL);
-	exec_vmwrite(VMX_CR3_TARGET_2, 0UL);
-	exec_vmwrite(VMX_CR3_TARGET_3, 0UL);
 }
 
 static void init_entry_ctrl(const struct acrn_vcpu *vcpu)
 {
+	const struct vmcs_template *tmpl = &vcpu->vm->arch_vm.vmcs_tmpl;
 	uint32_t value32;
 
-	/* Log messages to show initializing VMX entry controls */
-	pr_dbg("*************************");
-	pr_dbg("Initialize Entry control ");
-	pr_dbg("*************************");
-
-	/* Set up VMX entry controls - pg 2908 24.8.1 * Set IA32e guest mode -
-	 * on VM entry processor is in IA32e 64 bitmode * Start guest with host
-	 * IA32_PAT and IA32_EFER
-	 */
-	value32 = (VMX_ENTRY_CTLS_LOAD_EFER |
-		   VMX_ENTRY_CTLS_LOAD_PAT);
-
 	if (get_vcpu_mode(vcpu) == CPU_MODE_64BIT) {
-		value32 |= (VMX_ENTRY_CTLS_IA32E_MODE);
+		value32 = tmpl->entry_ctls_ia32e;
+	} else {
+		value32 = tmpl->entry_ctls;
 	}
-
-	value32 = check_vmx_ctrl(MSR_IA32_VMX_ENTRY_CTLS, value32);
-
 	exec_vmwrite32(VMX_ENTRY_CONTROLS, value32);
 	pr_dbg("VMX_ENTRY_CONTROLS: 0x%x ", value32);
 
@@ -451,41 +547,10 @@ static void init_entry_ctrl(const struct acrn_vcpu *vcpu)
 	 */
 	exec_vmwrite32(VMX_ENTRY_MSR_LOAD_COUNT, vcpu->arch.msr_area.count);
 	exec_vmwrite64(VMX_ENTRY_MSR_LOAD_ADDR_FULL, hva2hpa((void *)vcpu->arch.msr_area.guest));
-
-	/* Set up VM entry interrupt information field pg 2909 24.8.3 */
-	exec_vmwrite32(VMX_ENTRY_INT_INFO_FIELD, 0U);
-
-	/* Set up VM entry exception error code - pg 2910 24.8.3 */
-	exec_vmwrite32(VMX_ENTRY_EXCEPTION_ERROR_CODE, 0U);
-
-	/* Set up VM entry instruction length - pg 2910 24.8.3 */
-	exec_vmwrite32(VMX_ENTRY_INSTR_LENGTH, 0U);
 }
 
 static void init_exit_ctrl(const struct acrn_vcpu *vcpu)
 {
-	uint32_t value32;
-
-	/* Log messages to show initializing VMX entry controls */
-	pr_dbg("************************");
-	pr_dbg("Initialize Exit control ");
-	pr_dbg("************************");
-
-	/* Set up VM exit controls - pg 2907 24.7.1 for: Host address space
-	 * size is 64 bit Set up to acknowledge interrupt on exit, if 1 the HW
-	 * acks the interrupt in VMX non-root and saves the interrupt vector to
-	 * the relevant VM exit field for further processing by Hypervisor
-	 * Enable saving and loading of IA32_PAT and IA32_EFER on VMEXIT Enable
-	 * saving of pre-emption timer on VMEXIT
-	 */
-	value32 = check_vmx_ctrl(MSR_IA32_VMX_EXIT_CTLS,
-			 VMX_EXIT_CTLS_ACK_IRQ | VMX_EXIT_CTLS_SAVE_PAT |
-			 VMX_EXIT_CTLS_LOAD_PAT | VMX_EXIT_CTLS_LOAD_EFER |
-			 VMX_EXIT_CTLS_SAVE_EFER | VMX_EXIT_CTLS_HOST_ADDR64);
-
-	exec_vmwrite32(VMX_EXIT_CONTROLS, value32);
-	pr_dbg("VMX_EXIT_CONTROL: 0x%x ", value32);
-
 	/* Set up VM exit MSR store and load counts pg 2908 24.7.2 - tells the
 	 * HW number of MSRs to stored to mem and loaded from mem on VM exit.
 	 * The 64 bit VM-exit MSR store and load address fields provide the
@@ -504,7 +569,8 @@ void init_vmcs(struct acrn_vcpu *vcpu)
 {
 	uint64_t vmx_rev_id;
 	uint64_t vmcs_pa;
-	void **vmcs_ptr = &get_cpu_var(vmcs_run);
+	struct acrn_vcpu **vmcs_vcpu = &get_cpu_var(vmcs_vcpu);
+	struct acrn_vcpu *prev = *vmcs_vcpu;
 
 	/* Log message */
 	pr_dbg("Initializing VMCS");
@@ -513,16 +579,21 @@ void init_vmcs(struct acrn_vcpu *vcpu)
 	vmx_rev_id = msr_read(MSR_IA32_VMX_BASIC);
 	(void)memcpy_s(vcpu->arch.vmcs, 4U, (void *)&vmx_rev_id, 4U);
 
-	/* Execute VMCLEAR on previous un-clear VMCS */
-	if (*vmcs_ptr != NULL) {
-		vmcs_pa = hva2hpa(*vmcs_ptr);
+	/*
+	 * Execute VMCLEAR on the previous VMCS if its vCPU is not launched any
+	 * more, the VMCSs of the other vCPUs of this pCPU stay active and are
+	 * resumed after a VMPTRLD, see load_vmcs().
+	 */
+	if ((prev != NULL) && (prev != vcpu) && !prev->launched) {
+		vmcs_pa = hva2hpa(prev->arch.vmcs);
 		exec_vmclear((void *)&vmcs_pa);
 	}
 
-	/* Load VMCS pointer */
+	/* Clear the launch state of this VMCS and load the VMCS pointer */
 	vmcs_pa = hva2hpa(vcpu->arch.vmcs);
+	exec_vmclear((void *)&vmcs_pa);
 	exec_vmptrld((void *)&vmcs_pa);
-	*vmcs_ptr = (void *)vcpu->arch.vmcs;
+	*vmcs_vcpu = vcpu;
 
 	/* Initialize the Virtual Machine Control Structure (VMCS) */
 	init_host_state();
@@ -533,6 +604,87 @@ void init_vmcs(struct acrn_vcpu *vcpu)
 	init_exit_ctrl(vcpu);
 }
 
+/**
+ * Write the VMCS of a launched vCPU back to memory and clear its launch
+ * state, for it to be made current on another pCPU. The host state is
+ * the one of the next pCPU once it is loaded there, and the next VM entry
+ * is a VMLAUNCH, see run_vcpu().
+ *
+ * @pre vcpu != NULL && vcpu->launched
+ * @pre vcpu->pcpu_id == get_pcpu_id(), the pCPU it ran on last
+ */
+void clear_vmcs(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vcpu **vmcs_vcpu = &get_cpu_var(vmcs_vcpu);
+	uint64_t vmcs_pa;
+
+	vmcs_pa = hva2hpa(vcpu->arch.vmcs);
+	exec_vmclear((void *)&vmcs_pa);
+	if (*vmcs_vcpu == vcpu) {
+		*vmcs_vcpu = NULL;
+	}
+	vcpu->arch.vmcs_cleared = true;
+}
+
+/**
+ * Make the VMCS of a launched vCPU the current one of its pCPU.
+ *
+ * @pre vcpu != NULL && vcpu->launched
+ * @pre vcpu->pcpu_id == get_pcpu_id()
+ */
+void load_vmcs(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vcpu **vmcs_vcpu = &get_cpu_var(vmcs_vcpu);
+	struct acrn_vcpu *prev = *vmcs_vcpu;
+	uint64_t vmcs_pa;
+
+	if (prev != vcpu) {
+		vmcs_pa = hva2hpa(vcpu->arch.vmcs);
+		exec_vmptrld((void *)&vmcs_pa);
+		*vmcs_vcpu = vcpu;
+
+		/* moved over from another pCPU, see clear_vmcs() */
+		if (vcpu->arch.vmcs_cleared) {
+			init_host_state();
+		}
+
+		/* avoid VMCS recycling RSB usage across VMs */
+		if ((prev != NULL) && (prev->vm != vcpu->vm) && (get_ibrs_type() == IBRS_RAW)) {
+			msr_write(MSR_IA32_PRED_CMD, PRED_SET_IBPB);
+		}
+	}
+}
+
+/*
+ * Program the VMX preemption timer with the nearest timer event of the pCPU.
+ * The end of the time slice and the emulated vLAPIC timer are both hv_timers
+ * on the timer_list of the pCPU, so this is the nearest of them.
+ *
+ * The timer counts down at the TSC rate divided by 2^ptmr_tsc_shift, round the
+ * count up so that the exit doesn't come before the deadline.
+ *
+ * @pre vcpu != NULL
+ * @pre interrupts are disabled
+ */
+void update_preemption_timer(const struct acrn_vcpu *vcpu)
+{
+	uint64_t fire_tsc, now, ticks = PTMR_MAX_TICKS;
+
+	if (vcpu->arch.ptmr_enabled) {
+		fire_tsc = defer_physical_timer();
+		if (fire_tsc != 0UL) {
+			now = rdtsc();
+			if (fire_tsc > now) {
+				ticks = (fire_tsc - now + (1UL << ptmr_tsc_shift) - 1UL) >> ptmr_tsc_shift;
+				ticks = min(ticks, PTMR_MAX_TICKS);
+			} else {
+				ticks = 0UL;
+			}
+		}
+		exec_vmwrite32(VMX_GUEST_TIMER, (uint32_t)ticks);
+	}
+}
+
 void switch_apicv_mode_x2apic(struct acrn_vcpu *vcpu)
 {
 	uint32_t value32;
@@ -574,6 +726,12 @@ void switch_apicv_mode_x2apic(struct acrn_vcpu *vcpu)
 		exec_vmwrite32(VMX_PROC_VM_EXEC_CONTROLS2, value32);
 
 		update_msr_bitmap_x2apic_passthru(vcpu);
+
+		value32 = exec_vmread32(VMX_PIN_VM_EXEC_CONTROLS);
+		value32 &= ~VMX_PINBASED_CTLS_ENABLE_PTMR;
+		exec_vmwrite32(VMX_PIN_VM_EXEC_CONTROLS, value32);
+		vcpu->arch.ptmr_enabled = false;
+		resume_physical_timer();
 	} else {
 		value32 = exec_vmread32(VMX_PROC_VM_EXEC_CONTROLS2);
 		value32 &= ~VMX_PROCBASED_CTLS2_VAPIC;
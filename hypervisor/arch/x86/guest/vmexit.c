@@ -17,6 +17,7 @@
 #include <ept.h>
 #include <vtd.h>
 #include <vcpuid.h>
+#include <softirq.h>
 #include <trace.h>
 
 /*
@@ -31,6 +32,9 @@ static int32_t xsetbv_vmexit_handler(struct acrn_vcpu *vcpu);
 static int32_t wbinvd_vmexit_handler(struct acrn_vcpu *vcpu);
 static int32_t undefined_vmexit_handler(struct acrn_vcpu *vcpu);
 static int32_t init_signal_vmexit_handler(__unused struct acrn_vcpu *vcpu);
+static int32_t ptmr_vmexit_handler(struct acrn_vcpu *vcpu);
+static int32_t hlt_vmexit_handler(struct acrn_vcpu *vcpu);
+static int32_t pause_vmexit_handler(struct acrn_vcpu *vcpu);
 
 /* VM Dispatch table for Exit condition handling */
 static const struct vm_exit_dispatch dispatch_table[NR_VMX_EXIT_REASONS] = {
@@ -59,7 +63,7 @@ static const struct vm_exit_dispatch dispatch_table[NR_VMX_EXIT_REASONS] = {
 	[VMX_EXIT_REASON_GETSEC] = {
 		.handler = unhandled_vmexit_handler},
 	[VMX_EXIT_REASON_HLT] = {
-		.handler = unhandled_vmexit_handler},
+		.handler = hlt_vmexit_handler},
 	[VMX_EXIT_REASON_INVD] = {
 		.handler = unhandled_vmexit_handler},
 	[VMX_EXIT_REASON_INVLPG] = {
@@ -114,7 +118,7 @@ static const struct vm_exit_dispatch dispatch_table[NR_VMX_EXIT_REASONS] = {
 	[VMX_EXIT_REASON_MONITOR] = {
 		.handler = unhandled_vmexit_handler},
 	[VMX_EXIT_REASON_PAUSE] = {
-		.handler = unhandled_vmexit_handler},
+		.handler = pause_vmexit_handler},
 	[VMX_EXIT_REASON_ENTRY_FAILURE_MACHINE_CHECK] = {
 		.handler = unhandled_vmexit_handler},
 	[VMX_EXIT_REASON_TPR_BELOW_THRESHOLD] = {
@@ -140,7 +144,7 @@ static const struct vm_exit_dispatch dispatch_table[NR_VMX_EXIT_REASONS] = {
 	[VMX_EXIT_REASON_RDTSCP] = {
 		.handler = unhandled_vmexit_handler},
 	[VMX_EXIT_REASON_VMX_PREEMPTION_TIMER_EXPIRED] = {
-		.handler = unhandled_vmexit_handler},
+		.handler = ptmr_vmexit_handler},
 	[VMX_EXIT_REASON_INVVPID] = {
 		.handler = undefined_vmexit_handler},
 	[VMX_EXIT_REASON_WBINVD] = {
@@ -168,10 +172,24 @@ static const struct vm_exit_dispatch dispatch_table[NR_VMX_EXIT_REASONS] = {
 		.handler = unhandled_vmexit_handler}
 };
 
+/* Account the TSC cycles spent to handle one exit of basic_exit_reason */
+static void record_vmexit_stats(struct acrn_vcpu *vcpu, uint16_t basic_exit_reason, uint64_t cycles)
+{
+	struct vmexit_stats *stats = &vcpu->arch.exit_stats;
+	uint16_t bucket = (cycles != 0UL) ? fls64(cycles) : 0U;
+
+	if (basic_exit_reason < VMEXIT_STATS_REASONS) {
+		stats->count[basic_exit_reason]++;
+		stats->cycles[basic_exit_reason] += cycles;
+		stats->hist[basic_exit_reason][min(bucket, VMEXIT_STATS_BUCKETS - 1U)]++;
+	}
+}
+
 int32_t vmexit_handler(struct acrn_vcpu *vcpu)
 {
 	struct vm_exit_dispatch *dispatch = NULL;
 	uint16_t basic_exit_reason;
+	uint64_t start_tsc = rdtsc();
 	int32_t ret;
 
 	if (get_pcpu_id() != vcpu->pcpu_id) {
@@ -222,8 +240,9 @@ int32_t vmexit_handler(struct acrn_vcpu *vcpu)
 			}
 
 			/* exit dispatch handling */
-			if (basic_exit_reason == VMX_EXIT_REASON_EXTERNAL_INTERRUPT) {
-				/* Handling external_interrupt should disable intr */
+			if ((basic_exit_reason == VMX_EXIT_REASON_EXTERNAL_INTERRUPT) ||
+				(basic_exit_reason == VMX_EXIT_REASON_VMX_PREEMPTION_TIMER_EXPIRED)) {
+				/* Handling external_interrupt and running softirqs should disable intr */
 				if (!is_lapic_pt_enabled(vcpu)) {
 					CPU_IRQ_DISABLE();
 				}
@@ -236,6 +255,8 @@ int32_t vmexit_handler(struct acrn_vcpu *vcpu)
 			} else {
 				ret = dispatch->handler(vcpu);
 			}
+
+			record_vmexit_stats(vcpu, basic_exit_reason, rdtsc() - start_tsc);
 		}
 	}
 
@@ -340,6 +361,12 @@ static int32_t xsetbv_vmexit_handler(struct acrn_vcpu *vcpu)
 						if ((val64 & (XCR0_BNDREGS | XCR0_BNDCSR)) != 0UL) {
 							vcpu_inject_gp(vcpu, 0U);
 						} else {
+							/*
+							 * saved and restored by the vCPU switch, the
+							 * FPU state must be the one of the world
+							 */
+							(void)claim_world_fpu(vcpu);
+							vcpu->arch.xcr0 = val64;
 							write_xcr(0, val64);
 						}
 					}
@@ -391,3 +418,37 @@ static int32_t init_signal_vmexit_handler(__unused struct acrn_vcpu *vcpu)
 	 */
 	return 0;
 }
+
+/*
+ * The VMX preemption timer stands for the TSC-deadline interrupt of the pCPU
+ * while the vCPU runs, see update_preemption_timer(), run the expired timers.
+ *
+ * @pre interrupts are disabled
+ */
+static int32_t ptmr_vmexit_handler(struct acrn_vcpu *vcpu)
+{
+	fire_softirq(SOFTIRQ_TIMER);
+	do_softirq();
+	vcpu_retain_rip(vcpu);
+
+	return 0;
+}
+
+/*
+ * HLT exiting is enabled unless the vCPU owns its LAPIC, the vCPU leaves the
+ * pCPU until an event is latched for it.
+ */
+static int32_t hlt_vmexit_handler(struct acrn_vcpu *vcpu)
+{
+	vcpu_halt(vcpu);
+
+	return 0;
+}
+
+/* PAUSE-loop exiting, the vCPU likely spins on a lock held by a preempted vCPU */
+static int32_t pause_vmexit_handler(struct acrn_vcpu *vcpu)
+{
+	vcpu_yield(vcpu);
+
+	return 0;
+}
@@ -15,7 +15,6 @@
 #include <sgx.h>
 #include <guest_pm.h>
 #include <ucode.h>
-#include <cat.h>
 #include <trace.h>
 #include <logmsg.h>
 
@@ -61,6 +60,15 @@ static const uint32_t emulated_guest_msrs[NUM_GUEST_MSRS] = {
 };
 
 #define NUM_MTRR_MSRS	13U
+/* switched_msrs[] shares same indexes with array vcpu->arch.switched_msrs[] */
+static const uint32_t switched_msrs[NUM_SWITCHED_MSRS] = {
+	MSR_IA32_STAR,
+	MSR_IA32_LSTAR,
+	MSR_IA32_CSTAR,
+	MSR_IA32_FMASK,
+	MSR_IA32_KERNEL_GS_BASE,
+};
+
 static const uint32_t mtrr_msrs[NUM_MTRR_MSRS] = {
 	MSR_IA32_MTRR_CAP,
 	MSR_IA32_MTRR_DEF_TYPE,
@@ -78,7 +86,7 @@ static const uint32_t mtrr_msrs[NUM_MTRR_MSRS] = {
 };
 
 /* Following MSRs are intercepted, but it throws GPs for any guest accesses */
-#define NUM_UNSUPPORTED_MSRS	99U
+#define NUM_UNSUPPORTED_MSRS	100U
 static const uint32_t unsupported_msrs[NUM_UNSUPPORTED_MSRS] = {
 	/* Variable MTRRs are not supported */
 	MSR_IA32_MTRR_PHYSBASE_0,
@@ -124,6 +132,7 @@ static const uint32_t unsupported_msrs[NUM_UNSUPPORTED_MSRS] = {
 	MSR_IA32_VMX_TRUE_EXIT_CTLS,
 	MSR_IA32_VMX_TRUE_ENTRY_CTLS,
 	MSR_IA32_VMX_VMFUNC,
+	MSR_IA32_VMX_PROCBASED_CTLS3,
 
 	/* MPX disabled: CPUID.07H.EBX[14] */
 	MSR_IA32_BNDCFGS,
@@ -214,6 +223,30 @@ static const uint32_t unsupported_msrs[NUM_UNSUPPORTED_MSRS] = {
 	/* MSR 0x400 ... 0x473, not in this array */
 };
 
+struct msr_range {
+	uint32_t first;
+	uint32_t last;
+};
+
+/*
+ * The MSRs which the VM configurations may pass through: no state of the
+ * hypervisor is behind them, and they don't hold any physical address.
+ * The PMU is then owned by the VM, the hypervisor profiling is not to be
+ * used on its pCPUs.
+ */
+static const struct msr_range passthru_allowed_msrs[] = {
+	/* Performance Counters and Events */
+	{ MSR_IA32_PMC0, MSR_IA32_PMC7 },
+	{ MSR_IA32_PERFEVTSEL0, MSR_IA32_PERFEVTSEL3 },
+	{ MSR_IA32_FIXED_CTR0, MSR_IA32_FIXED_CTR2 },
+	{ MSR_IA32_PERF_CAPABILITIES, MSR_IA32_PERF_CAPABILITIES },
+	{ MSR_IA32_FIXED_CTR_CTL, MSR_IA32_PERF_GLOBAL_INUSE },
+	{ MSR_IA32_A_PMC0, MSR_IA32_A_PMC7 },
+
+	/* RDT-M */
+	{ MSR_IA32_QM_EVTSEL, MSR_IA32_QM_CTR },
+};
+
 /* emulated_guest_msrs[] shares same indexes with array vcpu->arch->guest_msrs[] */
 uint32_t vmsr_get_guest_msr_index(uint32_t msr)
 {
@@ -232,6 +265,59 @@ uint32_t vmsr_get_guest_msr_index(uint32_t msr)
 	return index;
 }
 
+static bool is_msr_in_list(uint32_t msr, const uint32_t *list, uint32_t num)
+{
+	uint32_t i;
+	bool found = false;
+
+	for (i = 0U; i < num; i++) {
+		if (list[i] == msr) {
+			found = true;
+			break;
+		}
+	}
+
+	return found;
+}
+
+/* the MSRs which rdmsr_vmexit_handler()/wrmsr_vmexit_handler() emulate */
+static bool is_emulated_msr(uint32_t msr)
+{
+	return is_msr_in_list(msr, emulated_guest_msrs, NUM_GUEST_MSRS) ||
+		is_msr_in_list(msr, switched_msrs, NUM_SWITCHED_MSRS) ||
+		is_msr_in_list(msr, mtrr_msrs, NUM_MTRR_MSRS) || is_x2apic_msr(msr);
+}
+
+/**
+ * @brief Check a MSR policy of a VM configuration
+ *
+ * A MSR may be passed through if it is in passthru_allowed_msrs[]. Its
+ * accesses may be denied if it is not emulated by the hypervisor, the
+ * denied MSRs fall into the #GP of the unsupported MSRs.
+ */
+bool is_msr_policy_valid(uint32_t msr, uint32_t policy)
+{
+	uint32_t i;
+	bool valid = false;
+
+	if (policy == MSR_POLICY_PASSTHRU) {
+		for (i = 0U; i < ARRAY_SIZE(passthru_allowed_msrs); i++) {
+			if ((msr >= passthru_allowed_msrs[i].first) && (msr <= passthru_allowed_msrs[i].last)) {
+				valid = true;
+				break;
+			}
+		}
+	} else if (policy == MSR_POLICY_DENY) {
+		/* only the MSRs of the MSR bitmap */
+		valid = ((msr <= 0x1FFFU) || ((msr >= 0xc0000000U) && (msr <= 0xc0001fffU))) &&
+			!is_emulated_msr(msr);
+	} else {
+		/* unknown policy */
+	}
+
+	return valid;
+}
+
 static void enable_msr_interception(uint8_t *bitmap, uint32_t msr_arg, uint32_t mode)
 {
 	uint32_t read_offset = 0U;
@@ -284,8 +370,6 @@ static void intercept_x2apic_msrs(uint8_t *msr_bitmap_arg, uint32_t mode)
  */
 static void init_msr_area(struct acrn_vcpu *vcpu)
 {
-	struct acrn_vm_config *cfg = get_vm_config(vcpu->vm->vm_id);
-
 	vcpu->arch.msr_area.count = 0U;
 
 	vcpu->arch.msr_area.guest[MSR_AREA_TSC_AUX].msr_index = MSR_IA32_TSC_AUX;
@@ -294,16 +378,7 @@ static void init_msr_area(struct acrn_vcpu *vcpu)
 	vcpu->arch.msr_area.host[MSR_AREA_TSC_AUX].value = vcpu->pcpu_id;
 	vcpu->arch.msr_area.count++;
 
-	/* only load/restore MSR IA32_PQR_ASSOC when hv and guest have differnt settings */
-	if (cat_cap_info.enabled && (cfg->clos != hv_clos)) {
-		vcpu->arch.msr_area.guest[MSR_AREA_IA32_PQR_ASSOC].msr_index = MSR_IA32_PQR_ASSOC;
-		vcpu->arch.msr_area.guest[MSR_AREA_IA32_PQR_ASSOC].value = clos2prq_msr(cfg->clos);
-		vcpu->arch.msr_area.host[MSR_AREA_IA32_PQR_ASSOC].msr_index = MSR_IA32_PQR_ASSOC;
-		vcpu->arch.msr_area.host[MSR_AREA_IA32_PQR_ASSOC].value = clos2prq_msr(hv_clos);
-		vcpu->arch.msr_area.count++;
-		pr_acrnlog("switch clos for VM %u vcpu_id %u, host 0x%x, guest 0x%x",
-			vcpu->vm->vm_id, vcpu->vcpu_id, hv_clos, cfg->clos);
-	}
+	/* MSR_IA32_PQR_ASSOC is loaded on the switch of the vCPUs, see load_pqr_assoc() */
 }
 
 /**
@@ -312,7 +387,8 @@ static void init_msr_area(struct acrn_vcpu *vcpu)
 void init_msr_emulation(struct acrn_vcpu *vcpu)
 {
 	uint8_t *msr_bitmap = vcpu->arch.msr_bitmap;
-	uint32_t msr, i;
+	const struct acrn_vm_config *cfg = get_vm_config(vcpu->vm->vm_id);
+	uint32_t msr, i, mode;
 	uint64_t value64;
 
 	for (i = 0U; i < NUM_GUEST_MSRS; i++) {
@@ -337,6 +413,17 @@ void init_msr_emulation(struct acrn_vcpu *vcpu)
 	/* don't need to intercept rdmsr for these MSRs */
 	enable_msr_interception(msr_bitmap, MSR_IA32_TIME_STAMP_COUNTER, INTERCEPT_WRITE);
 
+	/* track the writes of the switched MSRs, so they need not be read on a vCPU switch */
+	for (i = 0U; i < SWITCHED_MSR_KERNEL_GS_BASE; i++) {
+		enable_msr_interception(msr_bitmap, switched_msrs[i], INTERCEPT_WRITE);
+	}
+
+	/* the MSR policies of the VM, checked by sanitize_vm_config() */
+	for (i = 0U; i < cfg->msr_policy_num; i++) {
+		mode = (cfg->msr_policies[i].policy == MSR_POLICY_PASSTHRU) ? INTERCEPT_DISABLE : INTERCEPT_READ_WRITE;
+		enable_msr_interception(msr_bitmap, cfg->msr_policies[i].msr, mode);
+	}
+
 	/* Setup MSR bitmap - Intel SDM Vol3 24.6.9 */
 	value64 = hva2hpa(vcpu->arch.msr_bitmap);
 	exec_vmwrite64(VMX_MSR_BITMAP_FULL, value64);
@@ -376,30 +463,43 @@ static int32_t write_pat_msr(struct acrn_vcpu *vcpu, uint64_t value)
 	return ret;
 }
 
+static int32_t read_tsc_deadline(struct acrn_vcpu *vcpu, __unused uint32_t msr, uint64_t *val)
+{
+	*val = vlapic_get_tsc_deadline_msr(vcpu_vlapic(vcpu));
+	return 0;
+}
+
+static int32_t read_guest_msr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t *val)
+{
+	*val = vcpu_get_guest_msr(vcpu, msr);
+	return 0;
+}
+
+struct vmsr_read_handler {
+	uint32_t msr;
+	int32_t (*read)(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t *val);
+};
+
+/*
+ * The hot MSRs, looked up ahead of the switch of emulate_rdmsr():
+ * the TSC deadline timer and the x2APIC MSRs which still exit with APICv.
+ */
+static const struct vmsr_read_handler fast_rdmsr_handlers[] = {
+	{ MSR_IA32_TSC_DEADLINE, read_tsc_deadline },
+	{ MSR_IA32_EXT_APIC_ICR, vlapic_x2apic_read },
+	{ MSR_IA32_TSC_ADJUST, read_guest_msr },
+};
+
 /**
  * @pre vcpu != NULL
  */
-int32_t rdmsr_vmexit_handler(struct acrn_vcpu *vcpu)
+static int32_t emulate_rdmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t *val)
 {
 	int32_t err = 0;
-	uint32_t msr;
 	uint64_t v = 0UL;
 
-	/* Read the msr value */
-	msr = (uint32_t)vcpu_get_gpreg(vcpu, CPU_REG_RCX);
-
 	/* Do the required processing for each msr case */
 	switch (msr) {
-	case MSR_IA32_TSC_DEADLINE:
-	{
-		v = vlapic_get_tsc_deadline_msr(vcpu_vlapic(vcpu));
-		break;
-	}
-	case MSR_IA32_TSC_ADJUST:
-	{
-		v = vcpu_get_guest_msr(vcpu, MSR_IA32_TSC_ADJUST);
-		break;
-	}
 	case MSR_IA32_MTRR_CAP:
 	case MSR_IA32_MTRR_DEF_TYPE:
 	case MSR_IA32_MTRR_FIX64K_00000:
@@ -466,6 +566,16 @@ int32_t rdmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 		v = vcpu_get_guest_msr(vcpu, MSR_IA32_MISC_ENABLE);
 		break;
 	}
+	case MSR_ACRN_STEAL_TIME:
+	{
+		v = vcpu->arch.steal_time_msr;
+		break;
+	}
+	case MSR_ACRN_PV_CLOCK:
+	{
+		v = vcpu->arch.pvclock_msr;
+		break;
+	}
 	case MSR_IA32_SGXLEPUBKEYHASH0:
 	case MSR_IA32_SGXLEPUBKEYHASH1:
 	case MSR_IA32_SGXLEPUBKEYHASH2:
@@ -493,6 +603,35 @@ int32_t rdmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 	}
 	}
 
+	*val = v;
+	return err;
+}
+
+/**
+ * @pre vcpu != NULL
+ */
+int32_t rdmsr_vmexit_handler(struct acrn_vcpu *vcpu)
+{
+	int32_t err = 0;
+	uint32_t msr, i;
+	uint64_t v = 0UL;
+	bool handled = false;
+
+	/* Read the msr value */
+	msr = (uint32_t)vcpu_get_gpreg(vcpu, CPU_REG_RCX);
+
+	for (i = 0U; i < ARRAY_SIZE(fast_rdmsr_handlers); i++) {
+		if (fast_rdmsr_handlers[i].msr == msr) {
+			err = fast_rdmsr_handlers[i].read(vcpu, msr, &v);
+			handled = true;
+			break;
+		}
+	}
+
+	if (!handled) {
+		err = emulate_rdmsr(vcpu, msr, &v);
+	}
+
 	/* Store the MSR contents in RAX and RDX */
 	vcpu_set_gpreg(vcpu, CPU_REG_RAX, v & 0xffffffffU);
 	vcpu_set_gpreg(vcpu, CPU_REG_RDX, v >> 32U);
@@ -550,6 +689,7 @@ static void set_guest_tsc(struct acrn_vcpu *vcpu, uint64_t guest_tsc)
 	exec_vmwrite64(VMX_TSC_OFFSET_FULL, tsc_delta);
 
 	set_tsc_msr_intercept(vcpu, tsc_delta != 0UL);
+	update_pvclock(vcpu);
 }
 
 /*
@@ -599,6 +739,78 @@ static void set_guest_tsc_adjust(struct acrn_vcpu *vcpu, uint64_t tsc_adjust)
 	vcpu_set_guest_msr(vcpu, MSR_IA32_TSC_ADJUST, tsc_adjust);
 
 	set_tsc_msr_intercept(vcpu, (tsc_offset + tsc_adjust_delta ) != 0UL);
+	update_pvclock(vcpu);
+}
+
+/**
+ * @pre vcpu != NULL
+ */
+static int32_t set_guest_steal_time(struct acrn_vcpu *vcpu, uint64_t v)
+{
+	struct acrn_steal_time *st;
+	uint64_t hpa;
+	int32_t err = 0;
+
+	if ((v & MSR_ACRN_STEAL_TIME_RSVD) != 0UL) {
+		err = -EACCES;
+	} else {
+		vcpu->arch.steal_time = NULL;
+		if ((v & MSR_ACRN_STEAL_TIME_ENABLE) != 0UL) {
+			/* a 64-byte aligned area never crosses a page */
+			hpa = gpa2hpa(vcpu->vm, v & ~0x3FUL);
+			if (hpa == INVALID_HPA) {
+				err = -EACCES;
+			} else {
+				st = (struct acrn_steal_time *)hpa2hva(hpa);
+				stac();
+				(void)memset((void *)st, 0U, sizeof(struct acrn_steal_time));
+				clac();
+				vcpu->arch.steal_time_base = vcpu->sched_obj.wait_tsc;
+				vcpu->arch.steal_time = st;
+				update_steal_time(vcpu, false);
+			}
+		}
+
+		if (err == 0) {
+			vcpu->arch.steal_time_msr = v;
+		}
+	}
+
+	return err;
+}
+
+/**
+ * @pre vcpu != NULL
+ */
+static int32_t set_guest_pvclock(struct acrn_vcpu *vcpu, uint64_t v)
+{
+	uint64_t hpa;
+	int32_t err = 0;
+
+	if ((v & MSR_ACRN_PV_CLOCK_RSVD) != 0UL) {
+		err = -EACCES;
+	} else {
+		vcpu->arch.pvclock = NULL;
+		if ((v & MSR_ACRN_PV_CLOCK_ENABLE) != 0UL) {
+			/* a 64-byte aligned area never crosses a page */
+			hpa = gpa2hpa(vcpu->vm, v & ~0x3FUL);
+			if (hpa == INVALID_HPA) {
+				err = -EACCES;
+			} else {
+				vcpu->arch.pvclock = (struct acrn_pvclock *)hpa2hva(hpa);
+				stac();
+				(void)memset((void *)vcpu->arch.pvclock, 0U, sizeof(struct acrn_pvclock));
+				clac();
+				update_pvclock(vcpu);
+			}
+		}
+
+		if (err == 0) {
+			vcpu->arch.pvclock_msr = v;
+		}
+	}
+
+	return err;
 }
 
 /**
@@ -651,34 +863,55 @@ static void set_guest_ia32_misc_enalbe(struct acrn_vcpu *vcpu, uint64_t v)
 	}
 }
 
+/* 48-bit linear address, bits 63:47 all equal */
+static inline bool is_canonical_addr(uint64_t addr)
+{
+	uint64_t high = addr >> 47U;
+
+	return ((high == 0UL) || (high == 0x1ffffUL));
+}
+
 /**
+ * @pre vcpu != NULL && idx < NUM_SWITCHED_MSRS
+ * @pre vcpu is running on the current pCPU
+ */
+void vcpu_set_switched_msr(struct acrn_vcpu *vcpu, uint32_t idx, uint64_t val)
+{
+	vcpu->arch.switched_msrs[idx] = val;
+	msr_write(switched_msrs[idx], val);
+}
+
+/*
+ * The values in the pCPU are the ones of prev. The writes of all but
+ * KERNEL_GS_BASE are intercepted, so only that one is read back, and only
+ * the MSRs whose values differ between prev and vcpu are written.
+ *
  * @pre vcpu != NULL
  */
-int32_t wrmsr_vmexit_handler(struct acrn_vcpu *vcpu)
+void switch_guest_msrs(struct acrn_vcpu *prev, const struct acrn_vcpu *vcpu)
 {
-	int32_t err = 0;
-	uint32_t msr;
-	uint64_t v;
+	uint32_t i;
 
-	/* Read the MSR ID */
-	msr = (uint32_t)vcpu_get_gpreg(vcpu, CPU_REG_RCX);
+	if (prev != NULL) {
+		prev->arch.switched_msrs[SWITCHED_MSR_KERNEL_GS_BASE] = msr_read(MSR_IA32_KERNEL_GS_BASE);
+	}
 
-	/* Get the MSR contents */
-	v = (vcpu_get_gpreg(vcpu, CPU_REG_RDX) << 32U) |
-		vcpu_get_gpreg(vcpu, CPU_REG_RAX);
+	for (i = 0U; i < NUM_SWITCHED_MSRS; i++) {
+		if ((prev == NULL) || (prev->arch.switched_msrs[i] != vcpu->arch.switched_msrs[i])) {
+			msr_write(switched_msrs[i], vcpu->arch.switched_msrs[i]);
+		}
+	}
+}
+
+/**
+ * @pre vcpu != NULL
+ */
+static int32_t emulate_wrmsr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t v)
+{
+	int32_t err = 0;
 
 	/* Do the required processing for each msr case */
 	switch (msr) {
-	case MSR_IA32_TSC_DEADLINE:
-	{
-		vlapic_set_tsc_deadline_msr(vcpu_vlapic(vcpu), v);
-		break;
-	}
-	case MSR_IA32_TSC_ADJUST:
-	{
-		set_guest_tsc_adjust(vcpu, v);
-		break;
-	}
 	case MSR_IA32_TIME_STAMP_COUNTER:
 	{
 		set_guest_tsc(vcpu, v);
@@ -757,6 +990,41 @@ int32_t wrmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 		set_guest_ia32_misc_enalbe(vcpu, v);
 		break;
 	}
+	case MSR_ACRN_STEAL_TIME:
+	{
+		err = set_guest_steal_time(vcpu, v);
+		break;
+	}
+	case MSR_ACRN_PV_CLOCK:
+	{
+		err = set_guest_pvclock(vcpu, v);
+		break;
+	}
+	case MSR_IA32_STAR:
+	{
+		vcpu_set_switched_msr(vcpu, SWITCHED_MSR_STAR, v);
+		break;
+	}
+	case MSR_IA32_LSTAR:
+	case MSR_IA32_CSTAR:
+	{
+		if (!is_canonical_addr(v)) {
+			err = -EACCES;
+		} else {
+			vcpu_set_switched_msr(vcpu, (msr == MSR_IA32_LSTAR) ? SWITCHED_MSR_LSTAR : SWITCHED_MSR_CSTAR, v);
+		}
+		break;
+	}
+	case MSR_IA32_FMASK:
+	{
+		/* bits 63:32 are reserved */
+		if ((v >> 32U) != 0UL) {
+			err = -EACCES;
+		} else {
+			vcpu_set_switched_msr(vcpu, SWITCHED_MSR_FMASK, v);
+		}
+		break;
+	}
 	default:
 	{
 		if (is_x2apic_msr(msr)) {
@@ -770,6 +1038,63 @@ int32_t wrmsr_vmexit_handler(struct acrn_vcpu *vcpu)
 	}
 	}
 
+	return err;
+}
+
+static int32_t write_tsc_deadline(struct acrn_vcpu *vcpu, __unused uint32_t msr, uint64_t val)
+{
+	vlapic_set_tsc_deadline_msr(vcpu_vlapic(vcpu), val);
+	return 0;
+}
+
+static int32_t write_tsc_adjust(struct acrn_vcpu *vcpu, __unused uint32_t msr, uint64_t val)
+{
+	set_guest_tsc_adjust(vcpu, val);
+	return 0;
+}
+
+struct vmsr_write_handler {
+	uint32_t msr;
+	int32_t (*write)(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t val);
+};
+
+/* The hot MSRs, looked up ahead of the switch of emulate_wrmsr() */
+static const struct vmsr_write_handler fast_wrmsr_handlers[] = {
+	{ MSR_IA32_TSC_DEADLINE, write_tsc_deadline },
+	{ MSR_IA32_EXT_APIC_EOI, vlapic_x2apic_write },
+	{ MSR_IA32_EXT_APIC_ICR, vlapic_x2apic_write },
+	{ MSR_IA32_TSC_ADJUST, write_tsc_adjust },
+};
+
+/**
+ * @pre vcpu != NULL
+ */
+int32_t wrmsr_vmexit_handler(struct acrn_vcpu *vcpu)
+{
+	int32_t err = 0;
+	uint32_t msr, i;
+	uint64_t v;
+	bool handled = false;
+
+	/* Read the MSR ID */
+	msr = (uint32_t)vcpu_get_gpreg(vcpu, CPU_REG_RCX);
+
+	/* Get the MSR contents */
+	v = (vcpu_get_gpreg(vcpu, CPU_REG_RDX) << 32U) |
+		vcpu_get_gpreg(vcpu, CPU_REG_RAX);
+
+	for (i = 0U; i < ARRAY_SIZE(fast_wrmsr_handlers); i++) {
+		if (fast_wrmsr_handlers[i].msr == msr) {
+			err = fast_wrmsr_handlers[i].write(vcpu, msr, v);
+			handled = true;
+			break;
+		}
+	}
+
+	if (!handled) {
+		err = emulate_wrmsr(vcpu, msr, v);
+	}
+
 	TRACE_2L(TRACE_VMEXIT_WRMSR, msr, v);
 
 	return err;
@@ -803,6 +1128,11 @@ void update_msr_bitmap_x2apic_apicv(struct acrn_vcpu *vcpu)
 		 */
 		enable_msr_interception(msr_bitmap, MSR_IA32_EXT_APIC_EOI, INTERCEPT_DISABLE);
 		enable_msr_interception(msr_bitmap, MSR_IA32_EXT_APIC_SELF_IPI, INTERCEPT_DISABLE);
+
+		/* ICR writes are virtualized by IPI virtualization */
+		if (vcpu->vm->arch_vm.ipiv_enabled) {
+			enable_msr_interception(msr_bitmap, MSR_IA32_EXT_APIC_ICR, INTERCEPT_DISABLE);
+		}
 	}
 
 	enable_msr_interception(msr_bitmap, MSR_IA32_EXT_APIC_TPR, INTERCEPT_DISABLE);
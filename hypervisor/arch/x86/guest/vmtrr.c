@@ -133,8 +133,7 @@ void init_vmtrr(struct acrn_vcpu *vcpu)
 	}
 }
 
-static void update_ept(struct acrn_vm *vm, uint64_t start,
-	uint64_t size, uint8_t type)
+static uint64_t get_ept_mem_type(uint8_t type)
 {
 	uint64_t attr;
 
@@ -157,13 +156,12 @@ static void update_ept(struct acrn_vm *vm, uint64_t start,
 		break;
 	}
 
-	ept_modify_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, start, size, attr, EPT_MT_MASK);
+	return attr;
 }
 
-static void update_ept_mem_type(const struct acrn_vmtrr *vmtrr)
+static void get_effective_mem_types(const struct acrn_vmtrr *vmtrr, union mtrr_fixed_range_reg *types)
 {
 	uint8_t type;
-	uint64_t start, size;
 	uint32_t i, j;
 
 	/*
@@ -172,28 +170,81 @@ static void update_ept_mem_type(const struct acrn_vmtrr *vmtrr)
 	 * - when def_type.FE is clear, MTRRdefType.type is applied
 	 */
 	if (!is_mtrr_enabled(vmtrr) || !is_fixed_range_mtrr_enabled(vmtrr)) {
-		update_ept(vmtrr->vcpu->vm, 0U, MAX_FIXED_RANGE_ADDR, get_default_memory_type(vmtrr));
+		type = get_default_memory_type(vmtrr);
+		for (i = 0U; i < FIXED_RANGE_MTRR_NUM; i++) {
+			for (j = 0U; j < MTRR_SUB_RANGE_NUM; j++) {
+				types[i].type[j] = type;
+			}
+		}
 	} else {
 		/* Deal with fixed-range MTRRs only */
 		for (i = 0U; i < FIXED_RANGE_MTRR_NUM; i++) {
-			type = vmtrr->fixed_range[i].type[0];
-			start = get_subrange_start_of_fixed_mtrr(i, 0U);
-			size = get_subrange_size_of_fixed_mtrr(i);
-
-			for (j = 1U; j < MTRR_SUB_RANGE_NUM; j++) {
-				/* If it's same type, combine the subrange together */
-				if (type == vmtrr->fixed_range[i].type[j]) {
-					size += get_subrange_size_of_fixed_mtrr(i);
-				} else {
-					update_ept(vmtrr->vcpu->vm, start, size, type);
-					type = vmtrr->fixed_range[i].type[j];
-					start = get_subrange_start_of_fixed_mtrr(i, j);
-					size = get_subrange_size_of_fixed_mtrr(i);
-				}
+			types[i].value = vmtrr->fixed_range[i].value;
+		}
+	}
+}
+
+/*
+ * The sub-ranges of the fixed-range MTRRs follow each other from 0 to
+ * MAX_FIXED_RANGE_ADDR: the changed ones of a same type are merged across
+ * the MTRRs, and all of them go in one EPT update with a single flush.
+ */
+static void update_ept_mem_type(const struct acrn_vmtrr *vmtrr)
+{
+	struct acrn_vm *vm = vmtrr->vcpu->vm;
+	struct vmtrr_ept_map *map = &vm->vmtrr_ept_map;
+	union mtrr_fixed_range_reg types[FIXED_RANGE_MTRR_NUM];
+	struct ept_update update;
+	uint64_t start = 0UL, size = 0UL, sub_start, sub_size;
+	uint8_t type = 0U;
+	uint32_t i, j;
+
+	get_effective_mem_types(vmtrr, types);
+
+	spinlock_obtain(&map->lock);
+	ept_update_begin(vm, &update);
+	for (i = 0U; i < FIXED_RANGE_MTRR_NUM; i++) {
+		if (map->valid && (map->types[i].value == types[i].value)) {
+			continue;
+		}
+
+		for (j = 0U; j < MTRR_SUB_RANGE_NUM; j++) {
+			if (map->valid && (map->types[i].type[j] == types[i].type[j])) {
+				continue;
 			}
 
-			update_ept(vmtrr->vcpu->vm, start, size, type);
+			sub_start = get_subrange_start_of_fixed_mtrr(i, j);
+			sub_size = get_subrange_size_of_fixed_mtrr(i);
+			if ((size != 0UL) && ((start + size) == sub_start) && (type == types[i].type[j])) {
+				size += sub_size;
+			} else {
+				if (size != 0UL) {
+					ept_update_modify_mr(&update, (uint64_t *)vm->arch_vm.nworld_eptp, start, size,
+						get_ept_mem_type(type), EPT_MT_MASK);
+				}
+				type = types[i].type[j];
+				start = sub_start;
+				size = sub_size;
+			}
 		}
+		map->types[i].value = types[i].value;
+	}
+
+	if (size != 0UL) {
+		ept_update_modify_mr(&update, (uint64_t *)vm->arch_vm.nworld_eptp, start, size,
+			get_ept_mem_type(type), EPT_MT_MASK);
+	}
+	ept_update_commit(&update);
+	map->valid = true;
+	spinlock_release(&map->lock);
+}
+
+void invalidate_vmtrr_ept_map(struct acrn_vm *vm, uint64_t gpa, uint64_t size)
+{
+	if ((gpa < MAX_FIXED_RANGE_ADDR) && (size != 0UL)) {
+		spinlock_obtain(&vm->vmtrr_ept_map.lock);
+		vm->vmtrr_ept_map.valid = false;
+		spinlock_release(&vm->vmtrr_ept_map.lock);
 	}
 }
 
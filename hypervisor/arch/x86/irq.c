@@ -24,7 +24,20 @@ static spinlock_t irq_alloc_spinlock = { .head = 0U, .tail = 0U, };
 
 uint64_t irq_alloc_bitmap[IRQ_ALLOC_BITMAP_SIZE];
 struct irq_desc irq_desc_array[NR_IRQS];
-static uint32_t vector_to_irq[NR_MAX_VECTOR + 1];
+
+/* what dispatch_interrupt() needs of the irq of a vector, kept in irq_desc as well */
+struct irq_vector_desc {
+	irq_action_t action;
+	void *priv_data;
+	uint32_t irq;		/* IRQ_INVALID if the vector is not allocated */
+	uint32_t flags;		/* IRQ_VECTOR_MASK, IRQ_VECTOR_UNMASK */
+};
+
+/* mask the level triggered GSI around the action, unmask it after */
+#define IRQ_VECTOR_MASK		(1U << 0U)
+#define IRQ_VECTOR_UNMASK	(1U << 1U)
+
+static struct irq_vector_desc irq_vector_descs[NR_MAX_VECTOR + 1];
 
 spurious_handler_t spurious_handler;
 
@@ -38,6 +51,7 @@ static struct static_mapping_table irq_static_mappings[NR_STATIC_MAPPINGS] = {
 	{NOTIFY_IRQ, VECTOR_NOTIFY_VCPU},
 	{POSTED_INTR_NOTIFY_IRQ, VECTOR_POSTED_INTR},
 	{PMI_IRQ, VECTOR_PMI},
+	{POSTED_INTR_WAKEUP_IRQ, VECTOR_POSTED_INTR_WAKEUP},
 };
 
 /*
@@ -107,7 +121,7 @@ uint32_t alloc_irq_vector(uint32_t irq)
 		desc = &irq_desc_array[irq];
 
 		if (desc->vector != VECTOR_INVALID) {
-			if (vector_to_irq[desc->vector] == irq) {
+			if (irq_vector_descs[desc->vector].irq == irq) {
 				/* statically binded */
 				vr = desc->vector;
 			} else {
@@ -123,9 +137,9 @@ uint32_t alloc_irq_vector(uint32_t irq)
 
 			for (vr = VECTOR_DYNAMIC_START;
 				vr <= VECTOR_DYNAMIC_END; vr++) {
-				if (vector_to_irq[vr] == IRQ_INVALID) {
+				if (irq_vector_descs[vr].irq == IRQ_INVALID) {
 					desc->vector = vr;
-					vector_to_irq[vr] = irq;
+					irq_vector_descs[vr].irq = irq;
 					break;
 				}
 			}
@@ -159,14 +173,59 @@ static void free_irq_vector(uint32_t irq)
 			desc->vector = VECTOR_INVALID;
 
 			vr &= NR_MAX_VECTOR;
-			if (vector_to_irq[vr] == irq) {
-				vector_to_irq[vr] = IRQ_INVALID;
+			if (irq_vector_descs[vr].irq == irq) {
+				irq_vector_descs[vr].irq = IRQ_INVALID;
+				irq_vector_descs[vr].action = NULL;
+				irq_vector_descs[vr].priv_data = NULL;
+				irq_vector_descs[vr].flags = 0U;
 			}
 			spinlock_irqrestore_release(&irq_alloc_spinlock, rflags);
 		}
 	}
 }
 
+static inline bool irq_need_mask(const struct irq_desc *desc)
+{
+	/* level triggered gsi should be masked */
+	return (((desc->flags & IRQF_LEVEL) != 0U)
+		&& ioapic_irq_is_gsi(desc->irq));
+}
+
+static inline bool irq_need_unmask(const struct irq_desc *desc)
+{
+	/* level triggered gsi for non-ptdev should be unmasked */
+	return (((desc->flags & IRQF_LEVEL) != 0U)
+		&& ((desc->flags & IRQF_PT) == 0U)
+		&& ioapic_irq_is_gsi(desc->irq));
+}
+
+/*
+ * Copy the action and the mask decisions of the irq to its vector, so that
+ * an edge triggered vector is dispatched with no test on the irq flags.
+ *
+ * @pre desc->lock is held
+ */
+static void update_irq_vector_desc(const struct irq_desc *desc)
+{
+	struct irq_vector_desc *vd;
+	uint32_t flags = 0U;
+
+	if (desc->vector <= NR_MAX_VECTOR) {
+		vd = &irq_vector_descs[desc->vector];
+		if (vd->irq == desc->irq) {
+			if (irq_need_mask(desc)) {
+				flags |= IRQ_VECTOR_MASK;
+			}
+			if (irq_need_unmask(desc)) {
+				flags |= IRQ_VECTOR_UNMASK;
+			}
+			vd->flags = flags;
+			vd->priv_data = desc->priv_data;
+			vd->action = desc->action;
+		}
+	}
+}
+
 /*
  * There are four cases as to irq/vector allocation:
  * case 1: req_irq = IRQ_INVALID
@@ -216,6 +275,7 @@ int32_t request_irq(uint32_t req_irq, irq_action_t action_fn, void *priv_data,
 				desc->flags = flags;
 				desc->priv_data = priv_data;
 				desc->action = action_fn;
+				update_irq_vector_desc(desc);
 				spinlock_irqrestore_release(&desc->lock, rflags);
 
 				ret = (int32_t)irq;
@@ -250,6 +310,7 @@ void free_irq(uint32_t irq)
 		desc->action = NULL;
 		desc->priv_data = NULL;
 		desc->flags = IRQF_NONE;
+		update_irq_vector_desc(desc);
 		spinlock_irqrestore_release(&desc->lock, rflags);
 	}
 }
@@ -267,6 +328,7 @@ void set_irq_trigger_mode(uint32_t irq, bool is_level_triggered)
 		} else {
 			desc->flags &= ~IRQF_LEVEL;
 		}
+		update_irq_vector_desc(desc);
 		spinlock_irqrestore_release(&desc->lock, rflags);
 	}
 }
@@ -296,38 +358,24 @@ static void handle_spurious_interrupt(uint32_t vector)
 	}
 }
 
-static inline bool irq_need_mask(const struct irq_desc *desc)
-{
-	/* level triggered gsi should be masked */
-	return (((desc->flags & IRQF_LEVEL) != 0U)
-		&& ioapic_irq_is_gsi(desc->irq));
-}
-
-static inline bool irq_need_unmask(const struct irq_desc *desc)
-{
-	/* level triggered gsi for non-ptdev should be unmasked */
-	return (((desc->flags & IRQF_LEVEL) != 0U)
-		&& ((desc->flags & IRQF_PT) == 0U)
-		&& ioapic_irq_is_gsi(desc->irq));
-}
-
-static inline void handle_irq(const struct irq_desc *desc)
+static inline void handle_irq(const struct irq_vector_desc *vd)
 {
-	irq_action_t action = desc->action;
+	irq_action_t action = vd->action;
+	uint32_t flags = vd->flags;
 
-	if (irq_need_mask(desc))  {
-		ioapic_gsi_mask_irq(desc->irq);
+	if ((flags & IRQ_VECTOR_MASK) != 0U) {
+		ioapic_gsi_mask_irq(vd->irq);
 	}
 
 	/* Send EOI to LAPIC/IOAPIC IRR */
 	send_lapic_eoi();
 
 	if (action != NULL) {
-		action(desc->irq, desc->priv_data);
+		action(vd->irq, vd->priv_data);
 	}
 
-	if (irq_need_unmask(desc)) {
-		ioapic_gsi_unmask_irq(desc->irq);
+	if ((flags & IRQ_VECTOR_UNMASK) != 0U) {
+		ioapic_gsi_unmask_irq(vd->irq);
 	}
 }
 
@@ -335,29 +383,24 @@ static inline void handle_irq(const struct irq_desc *desc)
 void dispatch_interrupt(const struct intr_excp_ctx *ctx)
 {
 	uint32_t vr = ctx->vector;
-	uint32_t irq = vector_to_irq[vr];
-	struct irq_desc *desc;
+	const struct irq_vector_desc *vd = &irq_vector_descs[vr & NR_MAX_VECTOR];
+	uint32_t irq = vd->irq;
 
-	/* The value from vector_to_irq[] must be:
+	/* The irq of the vector must be:
 	 * IRQ_INVALID, which means the vector is not allocated;
 	 * or
 	 * < NR_IRQS, which is the irq number it bound with;
 	 * Any other value means there is something wrong.
 	 */
 	if (irq < NR_IRQS) {
-		desc = &irq_desc_array[irq];
 		per_cpu(irq_count, get_pcpu_id())[irq]++;
-
-		if ((vr == desc->vector) &&
-			bitmap_test((uint16_t)(irq & 0x3FU), irq_alloc_bitmap + (irq >> 6U))) {
 #ifdef PROFILING_ON
-			/* Saves ctx info into irq_desc */
-			desc->ctx_rip = ctx->rip;
-			desc->ctx_rflags = ctx->rflags;
-			desc->ctx_cs = ctx->cs;
+		/* Saves ctx info into irq_desc */
+		irq_desc_array[irq].ctx_rip = ctx->rip;
+		irq_desc_array[irq].ctx_rflags = ctx->rflags;
+		irq_desc_array[irq].ctx_cs = ctx->cs;
 #endif
-			handle_irq(desc);
-		}
+		handle_irq(vd);
 	} else {
 		handle_spurious_interrupt(vr);
 	}
@@ -393,7 +436,7 @@ static void init_irq_descs(void)
 	}
 
 	for (i = 0U; i <= NR_MAX_VECTOR; i++) {
-		vector_to_irq[i] = IRQ_INVALID;
+		irq_vector_descs[i].irq = IRQ_INVALID;
 	}
 
 	/* init fixed mapping for specific irq and vector */
@@ -402,7 +445,7 @@ static void init_irq_descs(void)
 		uint32_t vr = irq_static_mappings[i].vector;
 
 		irq_desc_array[irq].vector = vr;
-		vector_to_irq[vr] = irq;
+		irq_vector_descs[vr].irq = irq;
 		bitmap_set_nolock((uint16_t)(irq & 0x3FU),
 			      irq_alloc_bitmap + (irq >> 6U));
 	}
@@ -230,23 +230,43 @@ send_startup_ipi(enum intr_cpu_startup_shorthand cpu_startup_shorthand,
 	msr_write(MSR_IA32_EXT_APIC_ICR, icr.value);
 }
 
+/*
+ * In x2APIC mode the LDR is (cluster ID << 16) | (1 << (x2APIC ID & 0xf)),
+ * so all the pCPUs of dest_mask in one cluster are reached by a single
+ * ICR write in logical destination mode.
+ */
 void send_dest_ipi_mask(uint32_t dest_mask, uint32_t vector)
 {
 	union apic_icr icr;
-	uint16_t pcpu_id;
-	uint32_t mask = dest_mask;
+	uint16_t pcpu_id, i;
+	uint32_t mask = dest_mask, cluster, ldr;
 
-	icr.value_32.lo_32 = vector | (INTR_LAPIC_ICR_PHYSICAL << 11U);
+	icr.value_32.lo_32 = vector | (INTR_LAPIC_ICR_LOGICAL << 11U);
 
 	pcpu_id = ffs64(mask);
 
 	while (pcpu_id < CONFIG_MAX_PCPU_NUM) {
-		bitmap32_clear_nolock(pcpu_id, &mask);
-		if (is_pcpu_active(pcpu_id)) {
-			icr.value_32.hi_32 = per_cpu(lapic_id, pcpu_id);
+		cluster = per_cpu(lapic_ldr, pcpu_id) & X2APIC_LDR_CLUSTER_MASK;
+		ldr = 0U;
+
+		for (i = pcpu_id; i < CONFIG_MAX_PCPU_NUM; i++) {
+			if ((mask & (1U << i)) == 0U) {
+				continue;
+			}
+			if (!is_pcpu_active(i)) {
+				bitmap32_clear_nolock(i, &mask);
+				pr_err("pcpu_id %d not in active!", i);
+			} else if ((per_cpu(lapic_ldr, i) & X2APIC_LDR_CLUSTER_MASK) == cluster) {
+				bitmap32_clear_nolock(i, &mask);
+				ldr |= per_cpu(lapic_ldr, i);
+			} else {
+				/* left to the round of its own cluster */
+			}
+		}
+
+		if (ldr != 0U) {
+			icr.value_32.hi_32 = ldr;
 			msr_write(MSR_IA32_EXT_APIC_ICR, icr.value);
-		} else {
-			pr_err("pcpu_id %d not in active!", pcpu_id);
 		}
 		pcpu_id = ffs64(mask);
 	}
@@ -3,6 +3,28 @@
  * SPDX-License-Identifier: BSD-3-Clause
  */
 #include <types.h>
+#include <rtl.h>
+#include <cpufeatures.h>
+#include <cpu_caps.h>
+
+/*
+ * Below MEM_SHORT_LEN bytes the startup of the string instructions costs
+ * more than the moves, unless the CPU has fast short REP MOVSB (FSRM).
+ * From MEM_NT_LEN bytes a memset() uses non-temporal stores: such clears,
+ * as the one of the secure world memory, would only evict the caches.
+ */
+#define MEM_SHORT_LEN	64U
+#define MEM_NT_LEN	(1024U * 1024U)
+
+/* both false until init_mem_ops(), the generic paths are used */
+static bool mem_erms;
+static bool mem_fsrm;
+
+void init_mem_ops(void)
+{
+	mem_erms = pcpu_has_cap(X86_FEATURE_ERMS);
+	mem_fsrm = pcpu_has_cap(X86_FEATURE_FSRM);
+}
 
 static inline void memcpy_erms(void *d, const void *s, size_t slen)
 {
@@ -12,6 +34,41 @@ static inline void memcpy_erms(void *d, const void *s, size_t slen)
 		: "memory");
 }
 
+static inline void memcpy_movsq(void *d, const void *s, size_t slen)
+{
+	size_t qwords = slen >> 3U;
+	size_t bytes = slen & 7U;
+
+	asm volatile ("rep; movsq"
+		: "+D"(d), "+S"(s), "+c"(qwords)
+		:
+		: "memory");
+	asm volatile ("rep; movsb"
+		: "+D"(d), "+S"(s), "+c"(bytes)
+		:
+		: "memory");
+}
+
+static inline void memcpy_short(void *d, const void *s, size_t slen)
+{
+	uint8_t *dst = (uint8_t *)d;
+	const uint8_t *src = (const uint8_t *)s;
+	size_t n = slen;
+
+	while (n >= 8U) {
+		*(uint64_t *)dst = *(const uint64_t *)src;
+		dst += 8U;
+		src += 8U;
+		n -= 8U;
+	}
+	while (n > 0U) {
+		*dst = *src;
+		dst++;
+		src++;
+		n--;
+	}
+}
+
 /*
  * @brief  Copies at most slen bytes from src address to dest address, up to dmax.
  *
@@ -31,7 +88,13 @@ void *memcpy_s(void *d, size_t dmax, const void *s, size_t slen)
 	if ((slen != 0U) && (dmax != 0U) && (dmax >= slen)) {
 		/* same memory block, no need to copy */
 		if (d != s) {
-			memcpy_erms(d, s, slen);
+			if ((slen < MEM_SHORT_LEN) && !mem_fsrm) {
+				memcpy_short(d, s, slen);
+			} else if (mem_erms) {
+				memcpy_erms(d, s, slen);
+			} else {
+				memcpy_movsq(d, s, slen);
+			}
 		}
 	}
 	return d;
@@ -40,19 +103,91 @@ void *memcpy_s(void *d, size_t dmax, const void *s, size_t slen)
 static inline void memset_erms(void *base, uint8_t v, size_t n)
 {
 	asm volatile("rep ; stosb"
-			: "+D"(base)
-			: "a" (v), "c"(n));
+			: "+D"(base), "+c"(n)
+			: "a" (v)
+			: "memory");
+}
+
+static inline void memset_stosq(void *base, uint64_t pattern, size_t n)
+{
+	size_t qwords = n >> 3U;
+	size_t bytes = n & 7U;
+
+	asm volatile("rep ; stosq"
+			: "+D"(base), "+c"(qwords)
+			: "a" (pattern)
+			: "memory");
+	asm volatile("rep ; stosb"
+			: "+D"(base), "+c"(bytes)
+			: "a" (pattern)
+			: "memory");
+}
+
+static inline void memset_short(void *base, uint64_t pattern, size_t n)
+{
+	uint8_t *p = (uint8_t *)base;
+	size_t left = n;
+
+	while (left >= 8U) {
+		*(uint64_t *)p = pattern;
+		p += 8U;
+		left -= 8U;
+	}
+	while (left > 0U) {
+		*p = (uint8_t)pattern;
+		p++;
+		left--;
+	}
+}
+
+/*
+ * The qwords go around the caches and are only ordered with the later
+ * stores after the SFENCE. The unaligned head and the tail use plain stores.
+ */
+static void memset_nt(void *base, uint64_t pattern, size_t n)
+{
+	uint8_t *p = (uint8_t *)base;
+	size_t head = (8U - ((uint64_t)base & 7UL)) & 7UL;
+	size_t left = n - head;
+
+	memset_short(p, pattern, head);
+	p += head;
+
+	while (left >= 32U) {
+		asm volatile("movnti %1, (%0)\n\t"
+			"movnti %1, 8(%0)\n\t"
+			"movnti %1, 16(%0)\n\t"
+			"movnti %1, 24(%0)"
+			:
+			: "r"(p), "r"(pattern)
+			: "memory");
+		p += 32U;
+		left -= 32U;
+	}
+	asm volatile("sfence" : : : "memory");
+
+	memset_short(p, pattern, left);
 }
 
 void *memset(void *base, uint8_t v, size_t n)
 {
+	uint64_t pattern = (uint64_t)v * 0x0101010101010101UL;
+
 	/*
 	 * Some CPUs support enhanced REP MOVSB/STOSB feature. It is recommended
 	 * to use it when possible.
 	 */
 	if ((base != NULL) && (n != 0U)) {
-		memset_erms(base, v, n);
-        }
+		if (n >= MEM_NT_LEN) {
+			memset_nt(base, pattern, n);
+		} else if ((n < MEM_SHORT_LEN) && !mem_fsrm) {
+			memset_short(base, pattern, n);
+		} else if (mem_erms) {
+			memset_erms(base, v, n);
+		} else {
+			memset_stosq(base, pattern, n);
+		}
+	}
 
 	return base;
 }
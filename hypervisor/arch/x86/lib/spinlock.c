@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <types.h>
+#include <atomic.h>
+#include <bits.h>
+#include <cpu.h>
+#include <mmu.h>
+#include <vm_config.h>
+#include <timer.h>
+#include <spinlock.h>
+
+/*
+ * The queue nodes of a pCPU. A node is only taken while waiting for a lock,
+ * and is given back once the lock is obtained, so they are needed for the
+ * contexts that may wait at the same time: the ordinary one, and the
+ * interrupt and exception handlers nested in it. When none is left, the
+ * lock is waited for by spinning on its head, without a node.
+ */
+#define SPINLOCK_NODES		4U
+#define MCS_NODE_NONE		0U
+
+struct mcs_node {
+	uint32_t next;		/* the node queued behind this one */
+	uint32_t locked;	/* set when this node becomes the head of the queue */
+} __aligned(CACHE_LINE_SIZE);
+
+struct mcs_cpu_nodes {
+	struct mcs_node nodes[SPINLOCK_NODES];
+	uint64_t used;
+} __aligned(CACHE_LINE_SIZE);
+
+static struct mcs_cpu_nodes mcs_cpu_nodes[CONFIG_MAX_PCPU_NUM];
+
+#ifdef CONFIG_SPINLOCK_STATS
+static struct spinlock_site_stats spinlock_sites[SPINLOCK_STATS_SITES];
+#endif
+
+/* node ids start at 1, 0 is the end of a queue */
+static inline struct mcs_node *mcs_node(uint32_t id)
+{
+	return &mcs_cpu_nodes[(id - 1U) / SPINLOCK_NODES].nodes[(id - 1U) % SPINLOCK_NODES];
+}
+
+static inline uint32_t read_once32(const uint32_t *p)
+{
+	return *(const volatile uint32_t *)p;
+}
+
+/*
+ * The nodes are taken with a cmpxchg on the used bitmap, so that a pCPU id
+ * shared by several pCPUs still hands out distinct nodes. That is the case
+ * before set_current_pcpu_id(), TSC_AUX then has the value of the firmware,
+ * which is only used when in range.
+ *
+ * MCS_NODE_NONE if no node is left.
+ */
+static uint32_t get_mcs_node(void)
+{
+	uint16_t pcpu_id = get_pcpu_id();
+	struct mcs_cpu_nodes *cpu;
+	uint64_t used;
+	uint32_t id = MCS_NODE_NONE;
+	uint32_t idx;
+
+	if (pcpu_id >= CONFIG_MAX_PCPU_NUM) {
+		pcpu_id = BOOT_CPU_ID;
+	}
+	cpu = &mcs_cpu_nodes[pcpu_id];
+
+	/* an interrupt of this pCPU may take a node between the two steps */
+	do {
+		used = cpu->used;
+		for (idx = 0U; idx < SPINLOCK_NODES; idx++) {
+			if ((used & (1UL << idx)) == 0UL) {
+				break;
+			}
+		}
+	} while ((idx < SPINLOCK_NODES) && (atomic_cmpxchg64(&cpu->used, used, used | (1UL << idx)) != used));
+
+	if (idx < SPINLOCK_NODES) {
+		id = ((uint32_t)pcpu_id * SPINLOCK_NODES) + idx + 1U;
+	}
+	return id;
+}
+
+static void put_mcs_node(uint32_t id)
+{
+	bitmap_clear_lock((uint16_t)((id - 1U) % SPINLOCK_NODES),
+		&mcs_cpu_nodes[(id - 1U) / SPINLOCK_NODES].used);
+}
+
+#ifdef CONFIG_SPINLOCK_STATS
+static void update_max(uint64_t *max, uint64_t val)
+{
+	uint64_t old = *max;
+
+	while ((val > old) && (atomic_cmpxchg64(max, old, val) != old)) {
+		old = *max;
+	}
+}
+
+/* SPINLOCK_STATS_SITES once the table is full */
+static uint32_t get_site_stats(uint64_t site)
+{
+	uint32_t i, idx = (uint32_t)(site >> 2U) % SPINLOCK_STATS_SITES;
+	uint64_t cur;
+
+	for (i = 0U; i < SPINLOCK_STATS_SITES; i++) {
+		cur = spinlock_sites[idx].site;
+		if ((cur == 0UL) && (atomic_cmpxchg64(&spinlock_sites[idx].site, 0UL, site) == 0UL)) {
+			cur = site;
+		}
+		if (cur == site) {
+			break;
+		}
+		idx = (idx + 1U) % SPINLOCK_STATS_SITES;
+	}
+
+	return (i < SPINLOCK_STATS_SITES) ? idx : SPINLOCK_STATS_SITES;
+}
+
+static void record_obtain(spinlock_t *lock, uint64_t site, uint64_t start, bool contended)
+{
+	struct spinlock_site_stats *stats;
+	uint64_t now = rdtsc();
+	uint32_t idx = get_site_stats(site);
+
+	lock->site = idx;
+	lock->obtained_tsc = now;
+	if (idx < SPINLOCK_STATS_SITES) {
+		stats = &spinlock_sites[idx];
+		atomic_inc64(&stats->obtained);
+		if (contended) {
+			atomic_inc64(&stats->contended);
+			(void)atomic_xadd64(&stats->wait_cycles, (int64_t)(now - start));
+			update_max(&stats->max_wait, now - start);
+		}
+	}
+}
+
+static void record_release(const spinlock_t *lock)
+{
+	struct spinlock_site_stats *stats;
+	uint64_t held;
+
+	if (lock->site < SPINLOCK_STATS_SITES) {
+		stats = &spinlock_sites[lock->site];
+		held = rdtsc() - lock->obtained_tsc;
+		(void)atomic_xadd64(&stats->hold_cycles, (int64_t)held);
+		update_max(&stats->max_hold, held);
+	}
+}
+
+const struct spinlock_site_stats *get_spinlock_site_stats(uint32_t idx)
+{
+	return (idx < SPINLOCK_STATS_SITES) ? &spinlock_sites[idx] : NULL;
+}
+
+/* the call sites stay, only their counters start over */
+void reset_spinlock_stats(void)
+{
+	uint32_t i;
+
+	for (i = 0U; i < SPINLOCK_STATS_SITES; i++) {
+		spinlock_sites[i].obtained = 0UL;
+		spinlock_sites[i].contended = 0UL;
+		spinlock_sites[i].wait_cycles = 0L;
+		spinlock_sites[i].hold_cycles = 0L;
+		spinlock_sites[i].max_wait = 0UL;
+		spinlock_sites[i].max_hold = 0UL;
+	}
+}
+#endif
+
+static inline bool try_obtain(spinlock_t *lock)
+{
+	return (read_once32(&lock->head) == 0U) && (atomic_cmpxchg32(&lock->head, 0U, 1U) == 0U);
+}
+
+/*
+ * The waiters queue their node on the tail, the one at the head of the
+ * queue spins on the head of the lock, the others on their own node. Once
+ * it obtains the lock, the head of the queue hands its place over to the
+ * next node and gives its node back: the holder of a lock keeps no node.
+ */
+static void obtain_queued(spinlock_t *lock)
+{
+	uint32_t id, prev, next;
+	struct mcs_node *node;
+
+	id = get_mcs_node();
+	if (id == MCS_NODE_NONE) {
+		while (!try_obtain(lock)) {
+			asm_pause();
+		}
+	} else {
+		node = mcs_node(id);
+		node->next = 0U;
+		node->locked = 0U;
+		/* the locked xchg also orders the node initialization before it */
+		prev = atomic_swap32(&lock->tail, id);
+		if (prev != 0U) {
+			mcs_node(prev)->next = id;
+			/* each waiter spins on its own cache line */
+			while (read_once32(&node->locked) == 0U) {
+				asm_pause();
+			}
+		}
+
+		while (!try_obtain(lock)) {
+			asm_pause();
+		}
+
+		next = read_once32(&node->next);
+		if ((next == 0U) && (atomic_cmpxchg32(&lock->tail, id, 0U) != id)) {
+			/* a waiter swapped in its node and is linking it to ours */
+			do {
+				asm_pause();
+				next = read_once32(&node->next);
+			} while (next == 0U);
+		}
+		if (next != 0U) {
+			/* stores are not reordered with older stores on x86 */
+			*(volatile uint32_t *)&mcs_node(next)->locked = 1U;
+		}
+		put_mcs_node(id);
+	}
+}
+
+void spinlock_obtain(spinlock_t *lock)
+{
+	bool contended;
+#ifdef CONFIG_SPINLOCK_STATS
+	uint64_t start = rdtsc();
+#endif
+
+	/* the lock is taken right away only when nobody is queued for it */
+	contended = (read_once32(&lock->tail) != 0U) || !try_obtain(lock);
+	if (contended) {
+		obtain_queued(lock);
+	}
+
+#ifdef CONFIG_SPINLOCK_STATS
+	record_obtain(lock, (uint64_t)__builtin_return_address(0U), start, contended);
+#endif
+}
+
+void spinlock_release(spinlock_t *lock)
+{
+#ifdef CONFIG_SPINLOCK_STATS
+	record_release(lock);
+#endif
+	/* the locked xchg orders the stores of the critical section before it */
+	(void)atomic_swap32(&lock->head, 0U);
+}
@@ -12,10 +12,37 @@
 #include <cpu.h>
 #include <per_cpu.h>
 #include <lapic.h>
+#include <vcpu.h>
 
 static uint32_t notification_irq = IRQ_INVALID;
 
-static uint64_t smp_call_mask = 0UL;
+/* clear pcpu_id from the pending calls, true if it was the last one */
+static bool smp_call_complete(struct smp_call *call, uint16_t pcpu_id)
+{
+	uint64_t old, new;
+
+	do {
+		old = call->pending;
+		new = old & ~(1UL << pcpu_id);
+	} while (atomic_cmpxchg64(&call->pending, old, new) != old);
+
+	return (new == 0UL);
+}
+
+static void run_smp_call(struct smp_call *call, uint16_t pcpu_id)
+{
+	smp_call_func_t done = call->done;
+	void *done_data = call->done_data;
+
+	if (call->func != NULL) {
+		call->func(call->data);
+	}
+
+	/* the call is the caller's again, or free for its next async call */
+	if (smp_call_complete(call, pcpu_id) && (done != NULL)) {
+		done(done_data);
+	}
+}
 
 /* run in interrupt context */
 static void kick_notification(__unused uint32_t irq, __unused void *data)
@@ -24,42 +51,118 @@ static void kick_notification(__unused uint32_t irq, __unused void *data)
 	 * And it also serves for smp call.
 	 */
 	uint16_t pcpu_id = get_pcpu_id();
+	struct smp_call_info_data *info = &per_cpu(smp_call_info, pcpu_id);
+	struct smp_call *call;
+	uint32_t i;
 
-	if (bitmap_test(pcpu_id, &smp_call_mask)) {
-		struct smp_call_info_data *smp_call =
-			&per_cpu(smp_call_info, pcpu_id);
-
-		if (smp_call->func != NULL) {
-			smp_call->func(smp_call->data);
+	if (info->queued != 0U) {
+		for (i = 0U; i < SMP_CALL_CELLS; i++) {
+			call = info->calls[i];
+			if (call != NULL) {
+				info->calls[i] = NULL;
+				atomic_dec32(&info->queued);
+				run_smp_call(call, pcpu_id);
+			}
 		}
-		bitmap_clear_lock(pcpu_id, &smp_call_mask);
 	}
 }
 
-void smp_call_function(uint64_t mask, smp_call_func_t func, void *data)
+/*
+ * Queue the call to the active pCPUs of mask, in the cell slot of the
+ * calling pCPU. The calls of different pCPUs, and the async calls of one
+ * pCPU, do not wait for each other.
+ */
+static void post_smp_call(uint64_t mask, struct smp_call *call, uint32_t slot)
 {
+	uint16_t src = get_pcpu_id();
 	uint16_t pcpu_id;
-	struct smp_call_info_data *smp_call;
+	uint64_t targets = 0UL;
+	struct smp_call_info_data *info;
 
-	/* wait for previous smp call complete, which may run on other cpus */
-	while (atomic_cmpxchg64(&smp_call_mask, 0UL, mask & INVALID_BIT_INDEX) != 0UL);
 	pcpu_id = ffs64(mask);
 	while (pcpu_id < CONFIG_MAX_PCPU_NUM) {
 		bitmap_clear_nolock(pcpu_id, &mask);
 		if (is_pcpu_active(pcpu_id)) {
-			smp_call = &per_cpu(smp_call_info, pcpu_id);
-			smp_call->func = func;
-			smp_call->data = data;
+			bitmap_set_nolock(pcpu_id, &targets);
 		} else {
 			/* pcpu is not in active, print error */
 			pr_err("pcpu_id %d not in active!", pcpu_id);
-			bitmap_clear_nolock(pcpu_id, &smp_call_mask);
 		}
 		pcpu_id = ffs64(mask);
 	}
-	send_dest_ipi_mask((uint32_t)smp_call_mask, VECTOR_NOTIFY_VCPU);
+
+	call->pending = targets;
+	if (targets == 0UL) {
+		if (call->done != NULL) {
+			call->done(call->done_data);
+		}
+	} else {
+		cpu_write_memory_barrier();
+		mask = targets;
+		pcpu_id = ffs64(mask);
+		while (pcpu_id < CONFIG_MAX_PCPU_NUM) {
+			bitmap_clear_nolock(pcpu_id, &mask);
+			info = &per_cpu(smp_call_info, pcpu_id);
+			atomic_inc32(&info->queued);
+			info->calls[((uint32_t)src * SMP_CALL_SLOTS) + slot] = call;
+			pcpu_id = ffs64(mask);
+		}
+		cpu_write_memory_barrier();
+		send_dest_ipi_mask((uint32_t)targets, VECTOR_NOTIFY_VCPU);
+	}
+}
+
+/*
+ * Run func(data) on the pCPUs of mask and wait until all of them did.
+ *
+ * @pre not called in interrupt context
+ */
+void smp_call_function(uint64_t mask, smp_call_func_t func, void *data)
+{
+	struct smp_call call;
+
+	call.func = func;
+	call.data = data;
+	call.done = NULL;
+	call.done_data = NULL;
+	post_smp_call(mask, &call, 0U);
+
 	/* wait for current smp call complete */
-	wait_sync_change(&smp_call_mask, 0UL);
+	wait_sync_change(&call.pending, 0UL);
+}
+
+/*
+ * Run func(data) on the pCPUs of mask without waiting for them, then
+ * done(done_data), if not NULL, on the last of them. data and done_data
+ * must stay valid until done runs. Only the wait for a free async slot,
+ * with SMP_CALL_ASYNC_SLOTS calls of this pCPU still running, blocks.
+ *
+ * @pre not called in interrupt context
+ */
+void smp_call_function_async(uint64_t mask, smp_call_func_t func, void *data,
+		smp_call_func_t done, void *done_data)
+{
+	struct smp_call_info_data *info = &per_cpu(smp_call_info, get_pcpu_id());
+	struct smp_call *call = NULL;
+	uint32_t i;
+
+	while (call == NULL) {
+		for (i = 0U; i < SMP_CALL_ASYNC_SLOTS; i++) {
+			if (info->async_calls[i].pending == 0UL) {
+				call = &info->async_calls[i];
+				break;
+			}
+		}
+		if (call == NULL) {
+			wait_sync_change(&info->async_calls[0].pending, 0UL);
+		}
+	}
+
+	call->func = func;
+	call->data = data;
+	call->done = done;
+	call->done_data = done_data;
+	post_smp_call(mask, call, 1U + i);
 }
 
 static int32_t request_notification_irq(irq_action_t func, void *data)
@@ -102,9 +205,20 @@ static void posted_intr_notification(__unused uint32_t irq, __unused void *data)
 	/* Dummy IRQ handler for case that Posted-Interrupt Notification
 	 * is sent to vCPU in root mode(isn't running),interrupt will be
 	 * picked up in next vmentry,do nothine here.
+	 * It's the same for the notifications of VT-d posted interrupts
+	 * and of IPI virtualization, see vlapic_has_posted_intr().
 	 */
 }
 
+/*
+ * The notifications of the interrupts posted to a halted vCPU come with
+ * VECTOR_POSTED_INTR_WAKEUP, see vlapic_set_pi_wakeup().
+ */
+static void posted_intr_wakeup(__unused uint32_t irq, __unused void *data)
+{
+	wake_pi_halted_vcpus(get_pcpu_id());
+}
+
 /*pre-conditon: be called only by BSP initialization proccess*/
 void setup_posted_intr_notification(void)
 {
@@ -113,4 +227,10 @@ void setup_posted_intr_notification(void)
 			NULL, IRQF_NONE) < 0) {
 		pr_err("Failed to setup posted-intr notification");
 	}
+
+	if (request_irq(POSTED_INTR_WAKEUP_IRQ,
+			posted_intr_wakeup,
+			NULL, IRQF_NONE) < 0) {
+		pr_err("Failed to setup posted-intr wakeup notification");
+	}
 }
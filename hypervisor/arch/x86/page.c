@@ -11,6 +11,9 @@
 #include <vm.h>
 #include <trusty.h>
 #include <vtd.h>
+#include <bits.h>
+#include <spinlock.h>
+#include <logmsg.h>
 
 static struct page ppt_pml4_pages[PML4_PAGE_NUM(CONFIG_PLATFORM_RAM_SIZE + PLATFORM_LO_MMIO_SIZE)];
 static struct page ppt_pdpt_pages[PDPT_PAGE_NUM(CONFIG_PLATFORM_RAM_SIZE + PLATFORM_LO_MMIO_SIZE)];
@@ -60,6 +63,12 @@ static inline struct page *ppt_get_pd_page(const union pgtable_pages_info *info,
 	return pd_page;
 }
 
+/* the ppt pages are indexed by vaddr and reused as is when the range is split again */
+static inline void ppt_free_page(const union pgtable_pages_info *info __attribute__((unused)),
+		struct page *page __attribute__((unused)))
+{
+}
+
 const struct memory_ops ppt_mem_ops = {
 	.info = &ppt_pages_info,
 	.get_default_access_right = ppt_get_default_access_right,
@@ -67,6 +76,7 @@ const struct memory_ops ppt_mem_ops = {
 	.get_pml4_page = ppt_get_pml4_page,
 	.get_pdpt_page = ppt_get_pdpt_page,
 	.get_pd_page = ppt_get_pd_page,
+	.free_page = ppt_free_page,
 	.clflush_pagewalk = ppt_clflush_pagewalk,
 };
 
@@ -75,11 +85,29 @@ static struct page sos_vm_pdpt_pages[PDPT_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_SOS_
 static struct page sos_vm_pd_pages[PD_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_SOS_RAM_SIZE))];
 static struct page sos_vm_pt_pages[PT_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_SOS_RAM_SIZE))];
 
-/* uos_nworld_pml4_pages[i] is ...... of UOS i (whose vm_id = i +1) */
-static struct page uos_nworld_pml4_pages[CONFIG_MAX_VM_NUM - 1U][PML4_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))];
-static struct page uos_nworld_pdpt_pages[CONFIG_MAX_VM_NUM - 1U][PDPT_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))];
-static struct page uos_nworld_pd_pages[CONFIG_MAX_VM_NUM - 1U][PD_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))];
-static struct page uos_nworld_pt_pages[CONFIG_MAX_VM_NUM - 1U][PT_PAGE_NUM(EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE))];
+/*
+ * The nworld EPT pages of the UOSes come from one pool shared by all of them,
+ * a UOS may hold at most CONFIG_UOS_EPT_PAGES_QUOTA pages of it.
+ * uos_ept_page_owner[i] is the vm_id of the UOS which uos_ept_pages[i] is
+ * allocated to, all the pages of a UOS go back to the pool in deinit_ept_mem_ops.
+ *
+ * A page freed while the UOS runs, when its entries are merged back into a
+ * large page, may still be cached in the paging-structure caches of the UOS
+ * until the next INVEPT, so it is kept on the free list of the UOS and only
+ * reused by the same UOS. While the UOS has a secure world, whose EPT copies
+ * the PDPTEs of the normal world and so shares its PD/PT pages, a freed page
+ * may still be referenced by the secure world EPT: it is not reused at all
+ * then, and only goes back to the pool with the other pages of the UOS.
+ */
+#define UOS_EPT_PAGE_NONE	CONFIG_UOS_EPT_PAGES
+
+static struct page uos_ept_pages[CONFIG_UOS_EPT_PAGES];
+static uint64_t uos_ept_page_bitmap[INT_DIV_ROUNDUP(CONFIG_UOS_EPT_PAGES, 64U)];
+static uint16_t uos_ept_page_owner[CONFIG_UOS_EPT_PAGES];
+static uint32_t uos_ept_page_next[CONFIG_UOS_EPT_PAGES];
+static uint32_t uos_ept_free_head[CONFIG_MAX_VM_NUM];
+static uint32_t uos_ept_pages_used[CONFIG_MAX_VM_NUM];
+static spinlock_t uos_ept_pages_lock = { .head = 0U, .tail = 0U, };
 
 static struct page uos_sworld_pgtable_pages[CONFIG_MAX_VM_NUM - 1U][TRUSTY_PGTABLE_PAGE_NUM(TRUSTY_RAM_SIZE)];
 /* pre-assumption: TRUSTY_RAM_SIZE is 2M aligned */
@@ -118,47 +146,120 @@ static inline void ept_clflush_pagewalk(const void* etry)
 	iommu_flush_cache(etry, sizeof(uint64_t));
 }
 
+static struct page *alloc_uos_ept_page(uint16_t vm_id)
+{
+	struct page *page = NULL;
+	uint32_t idx;
+
+	spinlock_obtain(&uos_ept_pages_lock);
+	idx = uos_ept_free_head[vm_id];
+	if (idx != UOS_EPT_PAGE_NONE) {
+		uos_ept_free_head[vm_id] = uos_ept_page_next[idx];
+		page = &uos_ept_pages[idx];
+	} else if (uos_ept_pages_used[vm_id] < CONFIG_UOS_EPT_PAGES_QUOTA) {
+		idx = (uint32_t)ffz64_ex(uos_ept_page_bitmap, CONFIG_UOS_EPT_PAGES);
+		if (idx < CONFIG_UOS_EPT_PAGES) {
+			bitmap_set_nolock((uint16_t)(idx & 0x3FU), &uos_ept_page_bitmap[idx >> 6U]);
+			uos_ept_page_owner[idx] = vm_id;
+			uos_ept_pages_used[vm_id]++;
+			page = &uos_ept_pages[idx];
+		}
+	} else {
+		/* quota of the UOS used up */
+	}
+	spinlock_release(&uos_ept_pages_lock);
+
+	if (page == NULL) {
+		panic("vm%hu: no EPT page available, used %u of quota %u", vm_id,
+			uos_ept_pages_used[vm_id], CONFIG_UOS_EPT_PAGES_QUOTA);
+	}
+
+	(void)memset(page, 0U, PAGE_SIZE);
+	return page;
+}
+
 static inline struct page *ept_get_pml4_page(const union pgtable_pages_info *info)
 {
-	struct page *pml4_page = info->ept.nworld_pml4_base;
-	(void)memset(pml4_page, 0U, PAGE_SIZE);
+	struct page *pml4_page;
+
+	if (info->ept.vm_id != 0U) {
+		pml4_page = alloc_uos_ept_page(info->ept.vm_id);
+	} else {
+		pml4_page = info->ept.nworld_pml4_base;
+		(void)memset(pml4_page, 0U, PAGE_SIZE);
+	}
 	return pml4_page;
 }
 
 static inline struct page *ept_get_pdpt_page(const union pgtable_pages_info *info, uint64_t gpa)
 {
-	struct page *pdpt_page = info->ept.nworld_pdpt_base + (gpa >> PML4E_SHIFT);
-	(void)memset(pdpt_page, 0U, PAGE_SIZE);
+	struct page *pdpt_page;
+
+	if (info->ept.vm_id != 0U) {
+		pdpt_page = alloc_uos_ept_page(info->ept.vm_id);
+	} else {
+		pdpt_page = info->ept.nworld_pdpt_base + (gpa >> PML4E_SHIFT);
+		(void)memset(pdpt_page, 0U, PAGE_SIZE);
+	}
 	return pdpt_page;
 }
 
 static inline struct page *ept_get_pd_page(const union pgtable_pages_info *info, uint64_t gpa)
 {
 	struct page *pd_page;
-	if (gpa < TRUSTY_EPT_REBASE_GPA) {
-		pd_page = info->ept.nworld_pd_base + (gpa >> PDPTE_SHIFT);
-	} else {
+	if (gpa >= TRUSTY_EPT_REBASE_GPA) {
 		pd_page = info->ept.sworld_pgtable_base + TRUSTY_PML4_PAGE_NUM(TRUSTY_EPT_REBASE_GPA) +
 			TRUSTY_PDPT_PAGE_NUM(TRUSTY_EPT_REBASE_GPA) + ((gpa - TRUSTY_EPT_REBASE_GPA) >> PDPTE_SHIFT);
+		(void)memset(pd_page, 0U, PAGE_SIZE);
+	} else if (info->ept.vm_id != 0U) {
+		pd_page = alloc_uos_ept_page(info->ept.vm_id);
+	} else {
+		pd_page = info->ept.nworld_pd_base + (gpa >> PDPTE_SHIFT);
+		(void)memset(pd_page, 0U, PAGE_SIZE);
 	}
-	(void)memset(pd_page, 0U, PAGE_SIZE);
 	return pd_page;
 }
 
 static inline struct page *ept_get_pt_page(const union pgtable_pages_info *info, uint64_t gpa)
 {
 	struct page *pt_page;
-	if (gpa < TRUSTY_EPT_REBASE_GPA) {
-		pt_page = info->ept.nworld_pt_base + (gpa >> PDE_SHIFT);
-	} else {
+	if (gpa >= TRUSTY_EPT_REBASE_GPA) {
 		pt_page = info->ept.sworld_pgtable_base + TRUSTY_PML4_PAGE_NUM(TRUSTY_EPT_REBASE_GPA) +
 			TRUSTY_PDPT_PAGE_NUM(TRUSTY_EPT_REBASE_GPA) + TRUSTY_PD_PAGE_NUM(TRUSTY_EPT_REBASE_GPA) +
 			((gpa - TRUSTY_EPT_REBASE_GPA) >> PDE_SHIFT);
+		(void)memset(pt_page, 0U, PAGE_SIZE);
+	} else if (info->ept.vm_id != 0U) {
+		pt_page = alloc_uos_ept_page(info->ept.vm_id);
+	} else {
+		pt_page = info->ept.nworld_pt_base + (gpa >> PDE_SHIFT);
+		(void)memset(pt_page, 0U, PAGE_SIZE);
 	}
-	(void)memset(pt_page, 0U, PAGE_SIZE);
 	return pt_page;
 }
 
+/*
+ * The pages of the static pools are indexed by gpa and reused as is when the
+ * same range is split again, only the pages of the UOS pool are really freed.
+ * They are not while the secure world may still reference them.
+ */
+static inline void ept_free_page(const union pgtable_pages_info *info, struct page *page)
+{
+	const struct acrn_vm *vm = get_vm_from_vmid(info->ept.vm_id);
+	uint32_t idx;
+
+	if ((page >= uos_ept_pages) && (page < &uos_ept_pages[CONFIG_UOS_EPT_PAGES]) &&
+			(vm->arch_vm.sworld_eptp == NULL)) {
+		idx = (uint32_t)(page - uos_ept_pages);
+
+		spinlock_obtain(&uos_ept_pages_lock);
+		if (uos_ept_page_owner[idx] == info->ept.vm_id) {
+			uos_ept_page_next[idx] = uos_ept_free_head[info->ept.vm_id];
+			uos_ept_free_head[info->ept.vm_id] = idx;
+		}
+		spinlock_release(&uos_ept_pages_lock);
+	}
+}
+
 static inline void *ept_get_sworld_memory_base(const union pgtable_pages_info *info)
 {
 	return info->ept.sworld_memory_base;
@@ -168,16 +269,14 @@ void init_ept_mem_ops(struct acrn_vm *vm)
 {
 	uint16_t vm_id = vm->vm_id;
 	if (vm_id != 0U) {
-		ept_pages_info[vm_id].ept.top_address_space = EPT_ADDRESS_SPACE(CONFIG_UOS_RAM_SIZE);
-		ept_pages_info[vm_id].ept.nworld_pml4_base = uos_nworld_pml4_pages[vm_id - 1U];
-		ept_pages_info[vm_id].ept.nworld_pdpt_base = uos_nworld_pdpt_pages[vm_id - 1U];
-		ept_pages_info[vm_id].ept.nworld_pd_base = uos_nworld_pd_pages[vm_id - 1U];
-		ept_pages_info[vm_id].ept.nworld_pt_base = uos_nworld_pt_pages[vm_id - 1U];
+		ept_pages_info[vm_id].ept.top_address_space = TRUSTY_EPT_REBASE_GPA;
 		ept_pages_info[vm_id].ept.sworld_pgtable_base = uos_sworld_pgtable_pages[vm_id - 1U];
 		ept_pages_info[vm_id].ept.sworld_memory_base = uos_sworld_memory[vm_id - 1U];
+		uos_ept_free_head[vm_id] = UOS_EPT_PAGE_NONE;
 
 		vm->arch_vm.ept_mem_ops.get_sworld_memory_base = ept_get_sworld_memory_base;
 	}
+	ept_pages_info[vm_id].ept.vm_id = vm_id;
 	vm->arch_vm.ept_mem_ops.info = &ept_pages_info[vm_id];
 
 	vm->arch_vm.ept_mem_ops.get_default_access_right = ept_get_default_access_right;
@@ -186,5 +285,29 @@ void init_ept_mem_ops(struct acrn_vm *vm)
 	vm->arch_vm.ept_mem_ops.get_pdpt_page = ept_get_pdpt_page;
 	vm->arch_vm.ept_mem_ops.get_pd_page = ept_get_pd_page;
 	vm->arch_vm.ept_mem_ops.get_pt_page = ept_get_pt_page;
+	vm->arch_vm.ept_mem_ops.free_page = ept_free_page;
 	vm->arch_vm.ept_mem_ops.clflush_pagewalk = ept_clflush_pagewalk;
 }
+
+/*
+ * Give all the EPT pages of the UOS back to the pool.
+ *
+ * @pre the EPT of vm is not in use by any pCPU anymore
+ */
+void deinit_ept_mem_ops(struct acrn_vm *vm)
+{
+	uint16_t vm_id = vm->vm_id;
+	uint32_t idx;
+
+	if (vm_id != 0U) {
+		spinlock_obtain(&uos_ept_pages_lock);
+		for (idx = 0U; idx < CONFIG_UOS_EPT_PAGES; idx++) {
+			if (uos_ept_page_owner[idx] == vm_id) {
+				bitmap_clear_nolock((uint16_t)(idx & 0x3FU), &uos_ept_page_bitmap[idx >> 6U]);
+			}
+		}
+		uos_ept_pages_used[vm_id] = 0U;
+		uos_ept_free_head[vm_id] = UOS_EPT_PAGE_NONE;
+		spinlock_release(&uos_ept_pages_lock);
+	}
+}
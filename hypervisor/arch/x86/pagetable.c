@@ -6,6 +6,7 @@
 
 #include <types.h>
 #include <util.h>
+#include <rtl.h>
 #include <acrn_hv_defs.h>
 #include <page.h>
 #include <mmu.h>
@@ -55,6 +56,63 @@ static void split_large_page(uint64_t *pte, enum _page_table_level level,
 	/* TODO: flush the TLB */
 }
 
+/*
+ * Merge the next level page table of pte back into a large page once all
+ * its entries map a contiguous, large page aligned range with the same
+ * attributes, or drop it once none of them is present, so that the large
+ * pages broken by split_large_page() come back.
+ *
+ * The next level page is then handed back through mem_ops->free_page().
+ *
+ * @pre: level could only IA32E_PDPT or IA32E_PD, and pte is not a large page
+ */
+static void try_to_merge_large_page(uint64_t *pte, enum _page_table_level level,
+		const struct memory_ops *mem_ops)
+{
+	uint64_t *pbase;
+	uint64_t first, paddrinc, i;
+	bool uniform;
+
+	if (level == IA32E_PDPT) {
+		pbase = pdpte_page_vaddr(*pte);
+		paddrinc = PDE_SIZE;
+	} else {
+		pbase = pde_page_vaddr(*pte);
+		paddrinc = PTE_SIZE;
+	}
+	first = pbase[0];
+
+	if (mem_ops->pgentry_present(first) == 0UL) {
+		uniform = true;
+		for (i = 1UL; i < PTRS_PER_PTE; i++) {
+			if (mem_ops->pgentry_present(pbase[i]) != 0UL) {
+				uniform = false;
+				break;
+			}
+		}
+		/* pte may be a non present one pointing to the sanitized page */
+		if (uniform && (mem_ops->pgentry_present(*pte) != 0UL)) {
+			sanitize_pte_entry(pte, mem_ops);
+			mem_ops->free_page(mem_ops->info, (struct page *)pbase);
+		}
+	} else {
+		/*
+		 * The entries of a PD must be 2M pages, the ones of a PT must not
+		 * have bit 7 (PAT of a 4K page) set as it means PSE one level up.
+		 */
+		uniform = (((level == IA32E_PDPT) == (pde_large(first) != 0UL)) &&
+			mem_aligned_check(first & PDE_PFN_MASK, paddrinc * PTRS_PER_PTE));
+		for (i = 1UL; uniform && (i < PTRS_PER_PTE); i++) {
+			uniform = (pbase[i] == (first + (i * paddrinc)));
+		}
+		if (uniform) {
+			dev_dbg(ACRN_DBG_MMU, "%s, paddr: 0x%llx, level: %d\n", __func__, first & PDE_PFN_MASK, level);
+			set_pgentry(pte, first | PAGE_PSE, mem_ops);
+			mem_ops->free_page(mem_ops->info, (struct page *)pbase);
+		}
+	}
+}
+
 static inline void local_modify_or_del_pte(uint64_t *pte,
 		uint64_t prot_set, uint64_t prot_clr, uint32_t type, const struct memory_ops *mem_ops)
 {
@@ -143,6 +201,7 @@ static void modify_or_del_pde(const uint64_t *pdpte, uint64_t vaddr_start, uint6
 				}
 			}
 			modify_or_del_pte(pde, vaddr, vaddr_end, prot_set, prot_clr, mem_ops, type);
+			try_to_merge_large_page(pde, IA32E_PD, mem_ops);
 			if (vaddr_next >= vaddr_end) {
 				break;	/* done */
 			}
@@ -187,6 +246,7 @@ static void modify_or_del_pdpte(const uint64_t *pml4e, uint64_t vaddr_start, uin
 				}
 			}
 			modify_or_del_pde(pdpte, vaddr, vaddr_end, prot_set, prot_clr, mem_ops, type);
+			try_to_merge_large_page(pdpte, IA32E_PDPT, mem_ops);
 			if (vaddr_next >= vaddr_end) {
 				break;	/* done */
 			}
@@ -429,3 +489,47 @@ const uint64_t *lookup_address(uint64_t *pml4_page, uint64_t addr, uint64_t *pg_
 
 	return pret;
 }
+
+/**
+ * @pre (pml4_page != NULL) && (stats != NULL)
+ */
+void get_pgtable_page_stats(const uint64_t *pml4_page, struct pgtable_page_stats *stats,
+		const struct memory_ops *mem_ops)
+{
+	const uint64_t *pdpt_page, *pd_page, *pt_page;
+	uint64_t i, j, k, l;
+
+	(void)memset(stats, 0U, sizeof(*stats));
+
+	for (i = 0UL; i < PTRS_PER_PML4E; i++) {
+		if (mem_ops->pgentry_present(pml4_page[i]) == 0UL) {
+			continue;
+		}
+		pdpt_page = pml4e_page_vaddr(pml4_page[i]);
+		for (j = 0UL; j < PTRS_PER_PDPTE; j++) {
+			if (mem_ops->pgentry_present(pdpt_page[j]) == 0UL) {
+				continue;
+			}
+			if (pdpte_large(pdpt_page[j]) != 0UL) {
+				stats->pdpte_num++;
+				continue;
+			}
+			pd_page = pdpte_page_vaddr(pdpt_page[j]);
+			for (k = 0UL; k < PTRS_PER_PDE; k++) {
+				if (mem_ops->pgentry_present(pd_page[k]) == 0UL) {
+					continue;
+				}
+				if (pde_large(pd_page[k]) != 0UL) {
+					stats->pde_num++;
+					continue;
+				}
+				pt_page = pde_page_vaddr(pd_page[k]);
+				for (l = 0UL; l < PTRS_PER_PTE; l++) {
+					if (mem_ops->pgentry_present(pt_page[l]) != 0UL) {
+						stats->pte_num++;
+					}
+				}
+			}
+		}
+	}
+}
@@ -8,6 +8,7 @@
 #include <pgtable.h>
 #include <rtl.h>
 #include <mmu.h>
+#include <spinlock.h>
 #include <sprintf.h>
 #include <ept.h>
 #include <logmsg.h>
@@ -37,6 +38,29 @@ static struct seed_argument seed_arg[SEED_ARG_NUM] = {
 
 static struct physical_seed g_phy_seed;
 
+/*
+ * The derived seeds only depend on the physical seed, fixed at boot, and on
+ * the salt and the info, the UUID of the VM: they are derived once per
+ * (salt, info) and kept in the hypervisor memory, which no guest maps.
+ */
+#define VSEED_CACHE_ENTRIES	8U
+#define VSEED_CACHE_KEY_LEN	32U
+
+struct vseed_cache_entry {
+	bool valid;
+	uint8_t salt[VSEED_CACHE_KEY_LEN];
+	uint8_t info[VSEED_CACHE_KEY_LEN];
+	size_t salt_len;
+	size_t info_len;
+	struct seed_info seed_list[BOOTLOADER_SEED_MAX_ENTRIES];
+};
+
+static struct vseed_cache_entry vseed_cache[VSEED_CACHE_ENTRIES];
+static uint32_t vseed_cache_next;
+static bool attkb_key_valid;
+static uint8_t attkb_key[32];
+static spinlock_t seed_cache_lock = { .head = 0U, .tail = 0U };
+
 static uint32_t parse_seed_arg(void)
 {
 	char *cmd_src = NULL;
@@ -144,7 +168,7 @@ void append_seed_arg(char *cmd_dst, bool vm_is_sos)
  * return value:
  *    true if derive successfully, otherwise false
  */
-bool derive_virtual_seed(struct seed_info *seed_list, uint32_t *num_seeds,
+static bool local_derive_virtual_seed(struct seed_info *seed_list, uint32_t *num_seeds,
 			 const uint8_t *salt, size_t salt_len, const uint8_t *info, size_t info_len)
 {
 	uint32_t i;
@@ -174,6 +198,80 @@ bool derive_virtual_seed(struct seed_info *seed_list, uint32_t *num_seeds,
 	return ret;
 }
 
+static bool vseed_key_match(const uint8_t *key, size_t key_len, const uint8_t *buf, size_t len)
+{
+	bool match = (key_len == len);
+	size_t i;
+
+	for (i = 0U; match && (i < len); i++) {
+		match = (key[i] == buf[i]);
+	}
+
+	return match;
+}
+
+static struct vseed_cache_entry *find_vseed(const uint8_t *salt, size_t salt_len,
+		const uint8_t *info, size_t info_len)
+{
+	struct vseed_cache_entry *entry = NULL;
+	uint32_t i;
+
+	for (i = 0U; i < VSEED_CACHE_ENTRIES; i++) {
+		if (vseed_cache[i].valid && vseed_key_match(vseed_cache[i].salt, vseed_cache[i].salt_len, salt, salt_len)
+				&& vseed_key_match(vseed_cache[i].info, vseed_cache[i].info_len, info, info_len)) {
+			entry = &vseed_cache[i];
+			break;
+		}
+	}
+
+	return entry;
+}
+
+/*
+ * derive_virtual_seed
+ *
+ * description:
+ *     derive virtual seed list from physical seed list, or copy the list
+ *     derived before with the same salt and info
+ */
+bool derive_virtual_seed(struct seed_info *seed_list, uint32_t *num_seeds,
+			 const uint8_t *salt, size_t salt_len, const uint8_t *info, size_t info_len)
+{
+	struct vseed_cache_entry *entry;
+	bool ret;
+
+	if ((seed_list == NULL) || (salt_len > VSEED_CACHE_KEY_LEN) || (info_len > VSEED_CACHE_KEY_LEN)) {
+		ret = local_derive_virtual_seed(seed_list, num_seeds, salt, salt_len, info, info_len);
+	} else {
+		spinlock_obtain(&seed_cache_lock);
+		entry = find_vseed(salt, salt_len, info, info_len);
+		if (entry != NULL) {
+			(void)memcpy_s(seed_list, sizeof(entry->seed_list), entry->seed_list, sizeof(entry->seed_list));
+			*num_seeds = g_phy_seed.num_seeds;
+			ret = true;
+		} else {
+			ret = local_derive_virtual_seed(seed_list, num_seeds, salt, salt_len, info, info_len);
+			if (ret) {
+				entry = &vseed_cache[vseed_cache_next];
+				vseed_cache_next = (vseed_cache_next + 1U) % VSEED_CACHE_ENTRIES;
+				(void)memcpy_s(entry->seed_list, sizeof(entry->seed_list), seed_list, sizeof(entry->seed_list));
+				if (salt_len != 0U) {
+					(void)memcpy_s(entry->salt, VSEED_CACHE_KEY_LEN, salt, salt_len);
+				}
+				if (info_len != 0U) {
+					(void)memcpy_s(entry->info, VSEED_CACHE_KEY_LEN, info, info_len);
+				}
+				entry->salt_len = salt_len;
+				entry->info_len = info_len;
+				entry->valid = true;
+			}
+		}
+		spinlock_release(&seed_cache_lock);
+	}
+
+	return ret;
+}
+
 static inline uint32_t get_max_svn_index(void)
 {
 	uint32_t i, max_svn_idx = 0U;
@@ -214,15 +312,24 @@ bool derive_attkb_enc_key(uint8_t *out_key)
 	    (g_phy_seed.num_seeds > BOOTLOADER_SEED_MAX_ENTRIES)) {
 		ret = false;
 	} else {
-		max_svn_idx = get_max_svn_index();
-		ikm = &(g_phy_seed.seed_list[max_svn_idx].seed[0]);
-		/* only the low 32 bytes of seed are valid */
-		ikm_len = 32U;
-
-		if (hmac_sha256(out_key, ikm, ikm_len, salt, sizeof(salt)) != 1) {
-			pr_err("%s: failed to derive key!\n", __func__);
-			ret = false;
+		spinlock_obtain(&seed_cache_lock);
+		if (!attkb_key_valid) {
+			max_svn_idx = get_max_svn_index();
+			ikm = &(g_phy_seed.seed_list[max_svn_idx].seed[0]);
+			/* only the low 32 bytes of seed are valid */
+			ikm_len = 32U;
+
+			if (hmac_sha256(attkb_key, ikm, ikm_len, salt, sizeof(salt)) != 1) {
+				pr_err("%s: failed to derive key!\n", __func__);
+				ret = false;
+			} else {
+				attkb_key_valid = true;
+			}
+		}
+		if (ret) {
+			(void)memcpy_s(out_key, sizeof(attkb_key), attkb_key, sizeof(attkb_key));
 		}
+		spinlock_release(&seed_cache_lock);
 	}
 
 	return ret;
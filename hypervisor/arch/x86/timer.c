@@ -48,13 +48,14 @@ static inline void update_physical_timer(struct per_cpu_timers *cpu_timer)
 {
 	struct hv_timer *timer = NULL;
 
-	/* find the next event timer */
-	if (!list_empty(&cpu_timer->timer_list)) {
+	/* find the next event timer, it's picked up on VM entry when deferred */
+	if (!cpu_timer->deferred && !list_empty(&cpu_timer->timer_list)) {
 		timer = list_entry((&cpu_timer->timer_list)->next,
 			struct hv_timer, node);
 
 		/* it is okay to program a expired time */
 		msr_write(MSR_IA32_TSC_DEADLINE, timer->fire_tsc);
+		cpu_timer->armed_tsc = timer->fire_tsc;
 	}
 }
 
@@ -118,6 +119,65 @@ int32_t add_timer(struct hv_timer *timer)
 
 }
 
+/*
+ * A guest re-arming its deadline timer usually moves it by a small amount,
+ * so keep the timer where it is on the timer_list as long as it stays
+ * ordered with its neighbours and only fall back to a sorted re-insertion
+ * otherwise. The physical timer is reprogrammed only if the list head changed.
+ */
+int32_t update_timer(struct hv_timer *timer, uint64_t fire_tsc)
+{
+	struct per_cpu_timers *cpu_timer;
+	struct list_head *head;
+	const struct hv_timer *tmp;
+	bool after_prev, before_next, was_head;
+	int32_t ret = 0;
+	uint64_t rflags;
+
+	if ((timer == NULL) || (timer->func == NULL) || (fire_tsc == 0UL)) {
+		ret = -EINVAL;
+	} else {
+		cpu_timer = &per_cpu(cpu_timers, get_pcpu_id());
+		head = &cpu_timer->timer_list;
+
+		CPU_INT_ALL_DISABLE(&rflags);
+		if (list_empty(&timer->node)) {
+			was_head = false;
+			after_prev = false;
+			before_next = false;
+		} else {
+			was_head = (timer->node.prev == head);
+			after_prev = was_head;
+			if (!after_prev) {
+				tmp = list_entry(timer->node.prev, struct hv_timer, node);
+				after_prev = (tmp->fire_tsc <= fire_tsc);
+			}
+			before_next = (timer->node.next == head);
+			if (!before_next) {
+				tmp = list_entry(timer->node.next, struct hv_timer, node);
+				before_next = (fire_tsc <= tmp->fire_tsc);
+			}
+		}
+
+		timer->fire_tsc = fire_tsc;
+		if (after_prev && before_next) {
+			if (was_head) {
+				update_physical_timer(cpu_timer);
+			}
+		} else {
+			list_del_init(&timer->node);
+			if (local_add_timer(cpu_timer, timer) || was_head) {
+				update_physical_timer(cpu_timer);
+			}
+		}
+		CPU_INT_ALL_RESTORE(rflags);
+
+		TRACE_2L(TRACE_TIMER_ACTION_ADDED, timer->fire_tsc, 0UL);
+	}
+
+	return ret;
+}
+
 void del_timer(struct hv_timer *timer)
 {
 	uint64_t rflags;
@@ -129,12 +189,53 @@ void del_timer(struct hv_timer *timer)
 	CPU_INT_ALL_RESTORE(rflags);
 }
 
+/*
+ * While a vCPU runs, the timer events of its pCPU can be delivered as VMX
+ * preemption timer VM exits, which saves the physical interrupt and its ack.
+ * The MSR is only disarmed when it was armed, so a vCPU which keeps running
+ * doesn't pay an MSR write per VM entry.
+ */
+uint64_t defer_physical_timer(void)
+{
+	struct per_cpu_timers *cpu_timer = &per_cpu(cpu_timers, get_pcpu_id());
+	const struct hv_timer *timer;
+	uint64_t fire_tsc = 0UL;
+
+	cpu_timer->deferred = true;
+	if (cpu_timer->armed_tsc != 0UL) {
+		msr_write(MSR_IA32_TSC_DEADLINE, 0UL);
+		cpu_timer->armed_tsc = 0UL;
+	}
+
+	if (!list_empty(&cpu_timer->timer_list)) {
+		timer = list_entry((&cpu_timer->timer_list)->next, struct hv_timer, node);
+		fire_tsc = timer->fire_tsc;
+	}
+
+	return fire_tsc;
+}
+
+void resume_physical_timer(void)
+{
+	struct per_cpu_timers *cpu_timer = &per_cpu(cpu_timers, get_pcpu_id());
+	uint64_t rflags;
+
+	CPU_INT_ALL_DISABLE(&rflags);
+	if (cpu_timer->deferred) {
+		cpu_timer->deferred = false;
+		update_physical_timer(cpu_timer);
+	}
+	CPU_INT_ALL_RESTORE(rflags);
+}
+
 static void init_percpu_timer(uint16_t pcpu_id)
 {
 	struct per_cpu_timers *cpu_timer;
 
 	cpu_timer = &per_cpu(cpu_timers, pcpu_id);
 	INIT_LIST_HEAD(&cpu_timer->timer_list);
+	cpu_timer->armed_tsc = 0UL;
+	cpu_timer->deferred = false;
 }
 
 static void init_tsc_deadline_timer(void)
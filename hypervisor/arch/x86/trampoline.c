@@ -5,6 +5,7 @@
  */
 
 #include <types.h>
+#include <bits.h>
 #include <mmu.h>
 #include <per_cpu.h>
 #include <trampoline.h>
@@ -54,6 +55,47 @@ void write_trampoline_stack_sym(uint16_t pcpu_id)
 	clflush(hva);
 }
 
+/*
+ * List the stacks of the pCPUs in mask by their LAPIC ID, so that they can
+ * run the trampoline at the same time.
+ *
+ * @pre mask has no bit beyond phys_cpu_num
+ */
+void write_trampoline_stacks(uint64_t mask)
+{
+	uint64_t *stacks, stack_sym_addr;
+	uint32_t *lapic_ids, *num;
+	uint64_t base = (uint64_t)hpa2hva(trampoline_start16_paddr);
+	uint64_t pcpus = mask;
+	uint16_t i;
+	uint32_t n = 0U;
+
+	stacks = (uint64_t *)(base + trampoline_relo_addr(secondary_cpu_stacks));
+	lapic_ids = (uint32_t *)(base + trampoline_relo_addr(secondary_cpu_lapic_ids));
+	num = (uint32_t *)(base + trampoline_relo_addr(secondary_cpu_num));
+
+	i = ffs64(pcpus);
+	while (i != INVALID_BIT_INDEX) {
+		bitmap_clear_nolock(i, &pcpus);
+
+		stack_sym_addr = (uint64_t)&per_cpu(stack, i)[CONFIG_STACK_SIZE - 1];
+		stack_sym_addr &= ~(CPU_STACK_ALIGN - 1UL);
+		stacks[n] = stack_sym_addr;
+		lapic_ids[n] = per_cpu(lapic_id, i);
+		clflush(&stacks[n]);
+		clflush(&lapic_ids[n]);
+		n++;
+
+		/* and the last one for the S3 wakeup of the BSP, as before */
+		write_trampoline_stack_sym(i);
+
+		i = ffs64(pcpus);
+	}
+
+	*num = n;
+	clflush(num);
+}
+
 uint64_t get_trampoline_start16_paddr(void)
 {
 	return trampoline_start16_paddr;
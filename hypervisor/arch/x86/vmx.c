@@ -9,6 +9,7 @@
 #include <types.h>
 #include <msr.h>
 #include <per_cpu.h>
+#include <vcpu.h>
 #include <pgtable.h>
 #include <vmx.h>
 
@@ -114,14 +115,14 @@ void exec_vmptrld(void *addr)
  */
 void vmx_off(void)
 {
-	void **vmcs_ptr = &get_cpu_var(vmcs_run);
+	struct acrn_vcpu **vmcs_vcpu = &get_cpu_var(vmcs_vcpu);
 
-	if (*vmcs_ptr != NULL) {
+	if (*vmcs_vcpu != NULL) {
 		uint64_t vmcs_pa;
 
-		vmcs_pa = hva2hpa(*vmcs_ptr);
+		vmcs_pa = hva2hpa((*vmcs_vcpu)->arch.vmcs);
 		exec_vmclear((void *)&vmcs_pa);
-		*vmcs_ptr = NULL;
+		*vmcs_vcpu = NULL;
 	}
 
 	exec_vmxoff();
@@ -83,6 +83,11 @@ static inline uint64_t dmar_set_bitslice(uint64_t var, uint64_t mask, uint32_t p
 
 #define DMAR_INVALIDATION_QUEUE_SIZE	4096U
 #define DMAR_QI_INV_ENTRY_SIZE		16U
+/*
+ * Max page-selective IOTLB invalidations queued for a range, above that a
+ * domain invalidation is cheaper than the refills it causes.
+ */
+#define DMAR_PSI_MAX_DESC		16U
 #define DMAR_NUM_IR_ENTRIES_PER_PAGE	256U
 
 #define DMAR_INV_STATUS_WRITE_SHIFT	5U
@@ -91,11 +96,7 @@ static inline uint64_t dmar_set_bitslice(uint64_t var, uint64_t mask, uint32_t p
 #define DMAR_INV_IEC_DESC		0x04UL
 #define DMAR_INV_WAIT_DESC		0x05UL
 #define DMAR_INV_STATUS_WRITE		(1UL << DMAR_INV_STATUS_WRITE_SHIFT)
-#define DMAR_INV_STATUS_INCOMPLETE	0UL
-#define DMAR_INV_STATUS_COMPLETED	1UL
 #define DMAR_INV_STATUS_DATA_SHIFT	32U
-#define DMAR_INV_STATUS_DATA		(DMAR_INV_STATUS_COMPLETED << DMAR_INV_STATUS_DATA_SHIFT)
-#define DMAR_INV_WAIT_DESC_LOWER	(DMAR_INV_STATUS_WRITE | DMAR_INV_WAIT_DESC | DMAR_INV_STATUS_DATA)
 
 #define DMAR_IR_ENABLE_EIM_SHIFT	11UL
 #define DMAR_IR_ENABLE_EIM		(1UL << DMAR_IR_ENABLE_EIM_SHIFT)
@@ -125,6 +126,8 @@ struct dmar_drhd_rt {
 	uint64_t ir_table_addr;
 	uint64_t qi_queue;
 	uint16_t qi_tail;
+	uint32_t qi_seq;	/* sequence number of the last submission */
+	uint32_t qi_status;	/* sequence number of the last completed submission, written by hardware */
 
 	uint64_t cap;
 	uint64_t ecap;
@@ -190,7 +193,6 @@ bool iommu_snoop_supported(const struct iommu_domain *iommu)
 
 static struct dmar_drhd_rt dmar_drhd_units[CONFIG_MAX_IOMMU_NUM];
 static bool iommu_page_walk_coherent = true;
-static uint32_t qi_status = 0U;
 static struct dmar_info *platform_dmar_info = NULL;
 
 /* Domain id 0 is reserved in some cases per VT-d */
@@ -583,38 +585,95 @@ static struct dmar_drhd_rt *device_to_dmaru(uint16_t segment, uint8_t bus, uint8
 	return dmar_unit;
 }
 
-static void dmar_issue_qi_request(struct dmar_drhd_rt *dmar_unit, struct dmar_entry invalidate_desc)
+/* free entries of the invalidation queue, one always stays empty to tell a full queue from an empty one */
+static uint32_t dmar_qi_room(struct dmar_drhd_rt *dmar_unit)
 {
-	struct dmar_entry *invalidate_desc_ptr;
-	__unused uint64_t start;
+	uint32_t head = iommu_read32(dmar_unit, DMAR_IQH_REG) & (DMAR_INVALIDATION_QUEUE_SIZE - 1U);
 
-	invalidate_desc_ptr = (struct dmar_entry *)(dmar_unit->qi_queue + dmar_unit->qi_tail);
+	return ((head + DMAR_INVALIDATION_QUEUE_SIZE - dmar_unit->qi_tail - DMAR_QI_INV_ENTRY_SIZE) %
+			DMAR_INVALIDATION_QUEUE_SIZE) / DMAR_QI_INV_ENTRY_SIZE;
+}
 
-	invalidate_desc_ptr->hi_64 = invalidate_desc.hi_64;
-	invalidate_desc_ptr->lo_64 = invalidate_desc.lo_64;
-	dmar_unit->qi_tail = (dmar_unit->qi_tail + DMAR_QI_INV_ENTRY_SIZE) % DMAR_INVALIDATION_QUEUE_SIZE;
+/*
+ * Queue num invalidation descriptors followed by a single wait descriptor,
+ * without waiting for them to complete.
+ *
+ * The wait descriptor writes the sequence number of the submission to
+ * qi_status, as the queue is processed in order, a submission is completed
+ * once qi_status reaches its sequence number, see dmar_qi_completed().
+ *
+ * @return the sequence number of the submission
+ *
+ * @pre dmar_unit->lock is held
+ * @pre num < (DMAR_INVALIDATION_QUEUE_SIZE / DMAR_QI_INV_ENTRY_SIZE)
+ */
+static uint32_t dmar_qi_submit(struct dmar_drhd_rt *dmar_unit, const struct dmar_entry *descs, uint32_t num)
+{
+	struct dmar_entry *invalidate_desc_ptr;
+	uint32_t i;
 
-	invalidate_desc_ptr++;
+	/* the earlier asynchronous submissions may still be in the queue */
+	while (dmar_qi_room(dmar_unit) < (num + 1U)) {
+		asm_pause();
+	}
 
-	invalidate_desc_ptr->hi_64 = hva2hpa(&qi_status);
-	invalidate_desc_ptr->lo_64 = DMAR_INV_WAIT_DESC_LOWER;
+	for (i = 0U; i < num; i++) {
+		invalidate_desc_ptr = (struct dmar_entry *)(dmar_unit->qi_queue + dmar_unit->qi_tail);
+		invalidate_desc_ptr->hi_64 = descs[i].hi_64;
+		invalidate_desc_ptr->lo_64 = descs[i].lo_64;
+		dmar_unit->qi_tail = (dmar_unit->qi_tail + DMAR_QI_INV_ENTRY_SIZE) % DMAR_INVALIDATION_QUEUE_SIZE;
+	}
+
+	dmar_unit->qi_seq++;
+	invalidate_desc_ptr = (struct dmar_entry *)(dmar_unit->qi_queue + dmar_unit->qi_tail);
+	invalidate_desc_ptr->hi_64 = hva2hpa(&dmar_unit->qi_status);
+	invalidate_desc_ptr->lo_64 = DMAR_INV_STATUS_WRITE | DMAR_INV_WAIT_DESC |
+			((uint64_t)dmar_unit->qi_seq << DMAR_INV_STATUS_DATA_SHIFT);
 	dmar_unit->qi_tail = (dmar_unit->qi_tail + DMAR_QI_INV_ENTRY_SIZE) % DMAR_INVALIDATION_QUEUE_SIZE;
 
-	qi_status = DMAR_INV_STATUS_INCOMPLETE;
 	iommu_write32(dmar_unit, DMAR_IQT_REG, dmar_unit->qi_tail);
 
-	start = rdtsc();
-	while (qi_status == DMAR_INV_STATUS_INCOMPLETE) {
-		if (qi_status == DMAR_INV_STATUS_COMPLETED) {
-			break;
-		}
+	return dmar_unit->qi_seq;
+}
+
+static inline bool dmar_qi_completed(const struct dmar_drhd_rt *dmar_unit, uint32_t seq)
+{
+	const volatile uint32_t *status = &dmar_unit->qi_status;
+
+	/* sequence numbers wrap around */
+	return ((int32_t)(*status - seq) >= 0);
+}
+
+static void dmar_qi_wait(const struct dmar_drhd_rt *dmar_unit, uint32_t seq)
+{
+	uint64_t start = rdtsc();
+
+	while (!dmar_qi_completed(dmar_unit, seq)) {
 		if ((rdtsc() - start) > CYCLES_PER_MS) {
 			pr_err("DMAR OP Timeout! @ %s", __func__);
+			start = rdtsc();
 		}
 		asm_pause();
 	}
 }
 
+/*
+ * Queue num invalidation descriptors followed by a single wait descriptor,
+ * and wait for all of them to complete.
+ *
+ * @pre dmar_unit->lock is held
+ * @pre num < (DMAR_INVALIDATION_QUEUE_SIZE / DMAR_QI_INV_ENTRY_SIZE)
+ */
+static void dmar_issue_qi_requests(struct dmar_drhd_rt *dmar_unit, const struct dmar_entry *descs, uint32_t num)
+{
+	dmar_qi_wait(dmar_unit, dmar_qi_submit(dmar_unit, descs, num));
+}
+
+static void dmar_issue_qi_request(struct dmar_drhd_rt *dmar_unit, struct dmar_entry invalidate_desc)
+{
+	dmar_issue_qi_requests(dmar_unit, &invalidate_desc, 1U);
+}
+
 /*
  * did: domain id
  * sid: source id
@@ -710,6 +769,91 @@ static void dmar_invalid_iotlb_global(struct dmar_drhd_rt *dmar_unit)
 	dmar_invalid_iotlb(dmar_unit, 0U, 0UL, 0U, false, DMAR_IIRG_GLOBAL);
 }
 
+/*
+ * Split [gpa, gpa + size) in naturally aligned blocks of up to 2^max_am pages,
+ * each one covered by a page-selective invalidation with address mask am.
+ *
+ * @return the number of descriptors the range needs, only the first
+ *         DMAR_PSI_MAX_DESC ones are built in descs.
+ */
+static uint32_t dmar_build_psi_descs(uint16_t did, uint64_t gpa, uint64_t size, uint8_t max_am,
+		struct dmar_entry *descs)
+{
+	uint64_t addr = gpa & PAGE_MASK;
+	uint64_t end = (gpa + size + PAGE_SIZE - 1UL) & PAGE_MASK;
+	uint64_t block;
+	uint32_t num = 0U;
+	uint8_t am;
+
+	while ((addr < end) && (num <= DMAR_PSI_MAX_DESC)) {
+		am = 0U;
+		while (am < max_am) {
+			block = (uint64_t)PAGE_SIZE << (am + 1U);
+			if (((addr & (block - 1UL)) != 0UL) || ((addr + block) > end)) {
+				break;
+			}
+			am++;
+		}
+
+		if (num < DMAR_PSI_MAX_DESC) {
+			descs[num].lo_64 = DMA_IOTLB_DR | DMA_IOTLB_DW | DMAR_INV_IOTLB_DESC |
+					DMA_IOTLB_PAGE_INVL | dma_iotlb_did(did);
+			descs[num].hi_64 = addr | dma_iotlb_invl_addr_am(am);
+		}
+		num++;
+		addr += (uint64_t)PAGE_SIZE << am;
+	}
+
+	return num;
+}
+
+void iommu_flush_domain_range(const struct iommu_domain *domain, uint64_t gpa, uint64_t size)
+{
+	struct dmar_entry descs[DMAR_PSI_MAX_DESC];
+	struct dmar_drhd_rt *dmar_unit;
+	uint16_t did;
+	uint32_t i, num;
+
+	if (domain != NULL) {
+		did = vmid_to_domainid(domain->vm_id);
+		for (i = 0U; i < platform_dmar_info->drhd_count; i++) {
+			dmar_unit = &dmar_drhd_units[i];
+			if (!dmar_unit->drhd->ignore && ((dmar_unit->gcmd & DMA_GCMD_QIE) != 0U)) {
+				num = DMAR_PSI_MAX_DESC + 1U;
+				if (iommu_cap_pgsel_inv(dmar_unit->cap) != 0U) {
+					num = dmar_build_psi_descs(did, gpa, size,
+						iommu_cap_max_amask_val(dmar_unit->cap), descs);
+				}
+
+				if (num <= DMAR_PSI_MAX_DESC) {
+					spinlock_obtain(&(dmar_unit->lock));
+					dmar_issue_qi_requests(dmar_unit, descs, num);
+					spinlock_release(&(dmar_unit->lock));
+				} else {
+					dmar_invalid_iotlb(dmar_unit, did, 0UL, 0U, false, DMAR_IIRG_DOMAIN);
+				}
+			}
+		}
+	}
+}
+
+void iommu_flush_domain(const struct iommu_domain *domain)
+{
+	struct dmar_drhd_rt *dmar_unit;
+	uint32_t i;
+
+	if (domain != NULL) {
+		for (i = 0U; i < platform_dmar_info->drhd_count; i++) {
+			dmar_unit = &dmar_drhd_units[i];
+			/* the queued invalidation interface is only set up once the unit is enabled */
+			if (!dmar_unit->drhd->ignore && ((dmar_unit->gcmd & DMA_GCMD_QIE) != 0U)) {
+				dmar_invalid_iotlb(dmar_unit, vmid_to_domainid(domain->vm_id), 0UL, 0U, false,
+						DMAR_IIRG_DOMAIN);
+			}
+		}
+	}
+}
+
 static void dmar_set_intr_remap_table(struct dmar_drhd_rt *dmar_unit)
 {
 	uint64_t address;
@@ -737,8 +881,12 @@ static void dmar_set_intr_remap_table(struct dmar_drhd_rt *dmar_unit)
 	spinlock_release(&(dmar_unit->lock));
 }
 
+/*
+ * The invalidation is only queued if !wait, the completion of a later
+ * synchronous invalidation implies the one of this invalidation.
+ */
 static void dmar_invalid_iec(struct dmar_drhd_rt *dmar_unit, uint16_t intr_index,
-				uint8_t index_mask, bool is_global)
+				uint8_t index_mask, bool is_global, bool wait)
 {
 	struct dmar_entry invalidate_desc;
 
@@ -751,18 +899,18 @@ static void dmar_invalid_iec(struct dmar_drhd_rt *dmar_unit, uint16_t intr_index
 		invalidate_desc.lo_64 |= DMAR_IECI_INDEXED | dma_iec_index(intr_index, index_mask);
 	}
 
-	if (invalidate_desc.lo_64 != 0UL) {
-		spinlock_obtain(&(dmar_unit->lock));
-
+	spinlock_obtain(&(dmar_unit->lock));
+	if (wait) {
 		dmar_issue_qi_request(dmar_unit, invalidate_desc);
-
-		spinlock_release(&(dmar_unit->lock));
+	} else {
+		(void)dmar_qi_submit(dmar_unit, &invalidate_desc, 1U);
 	}
+	spinlock_release(&(dmar_unit->lock));
 }
 
 static void dmar_invalid_iec_global(struct dmar_drhd_rt *dmar_unit)
 {
-	dmar_invalid_iec(dmar_unit, 0U, 0U, true);
+	dmar_invalid_iec(dmar_unit, 0U, 0U, true, true);
 }
 
 static void dmar_set_root_table(struct dmar_drhd_rt *dmar_unit)
@@ -966,6 +1114,8 @@ static void dmar_enable_qi(struct dmar_drhd_rt *dmar_unit)
 	iommu_write64(dmar_unit, DMAR_IQA_REG, dmar_unit->qi_queue);
 
 	iommu_write32(dmar_unit, DMAR_IQT_REG, 0U);
+	dmar_unit->qi_tail = 0U;
+	dmar_unit->qi_status = dmar_unit->qi_seq;
 
 	if ((dmar_unit->gcmd & DMA_GCMD_QIE) == 0U) {
 		dmar_unit->gcmd |= DMA_GCMD_QIE;
@@ -983,6 +1133,8 @@ static void dmar_disable_qi(struct dmar_drhd_rt *dmar_unit)
 	spinlock_obtain(&(dmar_unit->lock));
 
 	if ((dmar_unit->gcmd & DMA_GCMD_QIE) == DMA_GCMD_QIE) {
+		/* drain the asynchronous submissions */
+		dmar_qi_wait(dmar_unit, dmar_unit->qi_seq);
 		dmar_unit->gcmd &= ~DMA_GCMD_QIE;
 		iommu_write32(dmar_unit, DMAR_GCMD_REG,	dmar_unit->gcmd);
 		dmar_wait_completion(dmar_unit, DMAR_GSTS_REG, DMA_GSTS_QIES, true, &status);
@@ -1169,6 +1321,7 @@ static int32_t remove_iommu_device(const struct iommu_domain *domain, uint16_t s
 	struct dmar_entry *context;
 	struct dmar_entry *root_entry;
 	struct dmar_entry *context_entry;
+	struct dmar_entry descs[2];
 	/* source id */
 	union pci_bdf sid;
 	int32_t ret = 0;
@@ -1211,10 +1364,17 @@ static int32_t remove_iommu_device(const struct iommu_domain *domain, uint16_t s
 				context_entry->hi_64 = 0UL;
 				iommu_flush_cache(context_entry, sizeof(struct dmar_entry));
 
-				dmar_invalid_context_cache(dmar_unit, vmid_to_domainid(domain->vm_id), sid.value, 0U,
-								DMAR_CIRG_DEVICE);
-				dmar_invalid_iotlb(dmar_unit, vmid_to_domainid(domain->vm_id), 0UL, 0U, false,
-								DMAR_IIRG_DOMAIN);
+				/* context cache then IOTLB, in one submission */
+				descs[0].hi_64 = 0UL;
+				descs[0].lo_64 = DMAR_INV_CONTEXT_CACHE_DESC | DMA_CONTEXT_DEVICE_INVL |
+					dma_ccmd_did(vmid_to_domainid(domain->vm_id)) | dma_ccmd_sid(sid.value) | dma_ccmd_fm(0U);
+				descs[1].hi_64 = 0UL;
+				descs[1].lo_64 = DMA_IOTLB_DR | DMA_IOTLB_DW | DMAR_INV_IOTLB_DESC |
+					DMA_IOTLB_DOMAIN_INVL | dma_iotlb_did(vmid_to_domainid(domain->vm_id));
+
+				spinlock_obtain(&(dmar_unit->lock));
+				dmar_issue_qi_requests(dmar_unit, descs, 2U);
+				spinlock_release(&(dmar_unit->lock));
 			}
 		}
 	}
@@ -1375,14 +1535,19 @@ int32_t dmar_assign_irte(struct intr_source intr_src, union dmar_ir_entry irte,
 	} else if (dmar_unit->ir_table_addr == 0UL) {
 		pr_err("IR table is not set for dmar unit");
 		ret = -EINVAL;
+	} else if ((irte.pi_bits.pst != 0UL) && (iommu_cap_pi(dmar_unit->cap) == 0U)) {
+		dev_dbg(ACRN_DBG_IOMMU, "dmar unit can't post interrupts");
+		ret = -ENODEV;
 	} else {
 		dmar_enable_intr_remapping(dmar_unit);
 		irte.bits.svt = 0x1UL;
 		irte.bits.sq = 0x0UL;
 		irte.bits.sid = sid.value;
 		irte.bits.present = 0x1UL;
-		irte.bits.mode = 0x0UL;
-		irte.bits.trigger_mode = trigger_mode;
+		/* bit 4 is reserved in posted format, and MSIs are edge-triggered anyway */
+		if (irte.pi_bits.pst == 0UL) {
+			irte.bits.trigger_mode = trigger_mode;
+		}
 		irte.bits.fpd = 0x0UL;
 		ir_table = (union dmar_ir_entry *)hpa2hva(dmar_unit->ir_table_addr);
 		ir_entry = ir_table + index;
@@ -1390,7 +1555,8 @@ int32_t dmar_assign_irte(struct intr_source intr_src, union dmar_ir_entry irte,
 		ir_entry->entry.lo_64 = irte.entry.lo_64;
 
 		iommu_flush_cache(ir_entry, sizeof(union dmar_ir_entry));
-		dmar_invalid_iec(dmar_unit, index, 0U, false);
+		/* the source may use the new entry as soon as it is programmed */
+		dmar_invalid_iec(dmar_unit, index, 0U, false, true);
 	}
 	return ret;
 }
@@ -1421,6 +1587,10 @@ void dmar_free_irte(struct intr_source intr_src, uint16_t index)
 		ir_entry->bits.present = 0x0UL;
 
 		iommu_flush_cache(ir_entry, sizeof(union dmar_ir_entry));
-		dmar_invalid_iec(dmar_unit, index, 0U, false);
+		/*
+		 * The source is already shut down, no need to wait, a later
+		 * dmar_assign_irte() for this index waits for this invalidation too.
+		 */
+		dmar_invalid_iec(dmar_unit, index, 0U, false, false);
 	}
 }
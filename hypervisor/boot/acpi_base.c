@@ -95,27 +95,38 @@ static struct acpi_table_rsdp *get_rsdp(void)
 	return rsdp;
 }
 
-static bool probe_table(uint64_t address, const char *signature)
-{
-	void *va =  hpa2hva(address);
-	struct acpi_table_header *table = (struct acpi_table_header *)va;
-	bool ret;
+#define ACPI_MAX_TABLES		64U
+
+/* the tables of the RSDT/XSDT, indexed at the first lookup */
+struct acpi_table_entry {
+	char signature[ACPI_NAME_SIZE];
+	uint64_t address;
+};
 
-	if (strncmp(table->signature, signature, ACPI_NAME_SIZE) != 0) {
-		ret = false;
+static struct acpi_table_entry acpi_tables[ACPI_MAX_TABLES];
+static uint32_t acpi_table_num;
+static bool acpi_tables_indexed;
+
+static void index_acpi_table(uint64_t address)
+{
+	const struct acpi_table_header *table = (const struct acpi_table_header *)hpa2hva(address);
+	struct acpi_table_entry *entry;
+
+	if (acpi_table_num < ACPI_MAX_TABLES) {
+		entry = &acpi_tables[acpi_table_num];
+		(void)memcpy_s(entry->signature, ACPI_NAME_SIZE, table->signature, ACPI_NAME_SIZE);
+		entry->address = address;
+		acpi_table_num++;
 	} else {
-		ret = true;
+		pr_err("%s: more than %u ACPI tables", __func__, ACPI_MAX_TABLES);
 	}
-
-	return ret;
 }
 
-void *get_acpi_tbl(const char *signature)
+static void index_acpi_tables(void)
 {
 	struct acpi_table_rsdp *rsdp;
 	struct acpi_table_rsdt *rsdt;
 	struct acpi_table_xsdt *xsdt;
-	uint64_t addr = 0UL;
 	uint32_t i, count;
 
 	/* the returned RSDP should always exist. Otherwise the hypervisor
@@ -133,10 +144,7 @@ void *get_acpi_tbl(const char *signature)
 		count = (xsdt->header.length - sizeof(struct acpi_table_header)) / sizeof(uint64_t);
 
 		for (i = 0U; i < count; i++) {
-			if (probe_table(xsdt->table_offset_entry[i], signature)) {
-				addr = xsdt->table_offset_entry[i];
-				break;
-			}
+			index_acpi_table(xsdt->table_offset_entry[i]);
 		}
 	} else {
 		/* Root table is an RSDT (32-bit physical addresses) */
@@ -144,10 +152,26 @@ void *get_acpi_tbl(const char *signature)
 		count = (rsdt->header.length - sizeof(struct acpi_table_header)) / sizeof(uint32_t);
 
 		for (i = 0U; i < count; i++) {
-			if (probe_table(rsdt->table_offset_entry[i], signature)) {
-				addr = rsdt->table_offset_entry[i];
-				break;
-			}
+			index_acpi_table((uint64_t)rsdt->table_offset_entry[i]);
+		}
+	}
+
+	acpi_tables_indexed = true;
+}
+
+void *get_acpi_tbl(const char *signature)
+{
+	uint64_t addr = 0UL;
+	uint32_t i;
+
+	if (!acpi_tables_indexed) {
+		index_acpi_tables();
+	}
+
+	for (i = 0U; i < acpi_table_num; i++) {
+		if (strncmp(acpi_tables[i].signature, signature, ACPI_NAME_SIZE) == 0) {
+			addr = acpi_tables[i].address;
+			break;
 		}
 	}
 
@@ -244,6 +268,27 @@ uint16_t parse_madt(uint32_t lapic_id_array[CONFIG_MAX_PCPU_NUM])
 	return ret;
 }
 
+/* The ECAM window of PCI segment \p segment, NULL if the platform has none */
+const struct acpi_mcfg_allocation *parse_mcfg(uint16_t segment)
+{
+	const struct acpi_table_mcfg *mcfg = (const struct acpi_table_mcfg *)get_acpi_tbl(ACPI_SIG_MCFG);
+	const struct acpi_mcfg_allocation *entry, *found = NULL;
+	uint32_t offset;
+
+	if (mcfg != NULL) {
+		offset = (uint32_t)sizeof(struct acpi_table_mcfg);
+		while ((found == NULL) && ((offset + sizeof(struct acpi_mcfg_allocation)) <= mcfg->header.length)) {
+			entry = (const struct acpi_mcfg_allocation *)((const uint8_t *)mcfg + offset);
+			if ((entry->pci_segment == segment) && (entry->start_bus_number <= entry->end_bus_number)) {
+				found = entry;
+			}
+			offset += (uint32_t)sizeof(struct acpi_mcfg_allocation);
+		}
+	}
+
+	return found;
+}
+
 uint16_t parse_madt_ioapic(struct ioapic_info *ioapic_id_array)
 {
 	uint16_t ret = 0U;
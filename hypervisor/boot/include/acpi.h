@@ -42,6 +42,7 @@
 #define ACPI_SIG_XSDT            "XSDT"      /* Extended  System Description Table */
 #define ACPI_SIG_MADT            "APIC" /* Multiple APIC Description Table */
 #define ACPI_SIG_DMAR            "DMAR"
+#define ACPI_SIG_MCFG            "MCFG" /* PCI Memory Mapped Configuration table */
 
 
 struct packed_gas {
@@ -116,6 +117,22 @@ struct acpi_table_madt {
 	uint32_t                     flags;
 } __packed;
 
+struct acpi_table_mcfg {
+	/* Common ACPI table header */
+	struct acpi_table_header     header;
+	uint8_t                      reserved[8];
+} __packed;
+
+/* one ECAM window of struct acpi_table_mcfg */
+struct acpi_mcfg_allocation {
+	/* Base address of the window, the one of bus 0 */
+	uint64_t                     address;
+	uint16_t                     pci_segment;
+	uint8_t                      start_bus_number;
+	uint8_t                      end_bus_number;
+	uint32_t                     reserved;
+} __packed;
+
 struct acpi_subtable_header {
 	uint8_t                   type;
 	uint8_t                   length;
@@ -198,6 +215,7 @@ void *get_acpi_tbl(const char *signature);
 struct ioapic_info;
 uint16_t parse_madt(uint32_t lapic_id_array[CONFIG_MAX_PCPU_NUM]);
 uint16_t parse_madt_ioapic(struct ioapic_info *ioapic_id_array);
+const struct acpi_mcfg_allocation *parse_mcfg(uint16_t segment);
 
 #ifdef CONFIG_ACPI_PARSE_ENABLED
 void acpi_fixup(void);
@@ -13,6 +13,7 @@
 #define DT_RELA		7U	/* relocation table */
 #define DT_RELASZ	8U	/* size of reloc table */
 #define DT_RELAENT	9U	/* size of one entry */
+#define DT_RELACOUNT	0x6ffffff9U	/* R_X86_64_RELATIVE entries leading the table */
 
 #define R_X86_64_RELATIVE	8UL
 
@@ -55,15 +56,42 @@ uint64_t get_hv_image_base(void)
 	return (get_hv_image_delta() + CONFIG_HV_RAM_START);
 }
 
+#ifdef CONFIG_RELOC
+/*
+ * we won't fixup any trampoline.S and cpu_primary.S here
+ * for a number of reasons:
+ *
+ * - trampoline code itself takes another relocation,
+ *   so any entries for trampoline symbols can't be fixed up
+ *   through .rela sections
+ * - In cpu_primary.S, the 32 bits code doesn't need relocation
+ * - Linker option "-z noreloc-overflow" could force R_X86_32
+ *   to R_X86_64 in the relocation sections, which could make
+ *   the fixed up code dirty. Even if relocation for 32 bits
+ *   is needed in the future, it's recommended to do it
+ *   explicitly in the assembly code to avoid confusion.
+ */
+static inline void fixup_relative(const struct Elf64_Rel *rel, uint64_t delta, uint64_t trampoline_end,
+		uint64_t primary_32_start, uint64_t primary_32_end)
+{
+	uint64_t *addr;
+
+	if ((rel->r_offset > trampoline_end) &&
+			((rel->r_offset < primary_32_start) || (rel->r_offset > primary_32_end))) {
+		addr = (uint64_t *)(delta + rel->r_offset);
+		*addr += delta;
+	}
+}
+#endif
+
 void relocate(void)
 {
 #ifdef CONFIG_RELOC
 	struct Elf64_Dyn *dyn;
 	struct Elf64_Rel *start = NULL, *end = NULL;
-	uint64_t delta, size = 0;
+	uint64_t delta, size = 0U, table_size = 0U, relative_count = 0U, i;
 	uint64_t trampoline_end;
 	uint64_t primary_32_start, primary_32_end;
-	uint64_t *addr;
 
 	/* get the delta that needs to be patched */
 	delta = get_hv_image_delta();
@@ -76,17 +104,25 @@ void relocate(void)
 				start = (struct Elf64_Rel *)(dyn->d_ptr + delta);
 				break;
 			case DT_RELASZ:
-				end = (struct Elf64_Rel *)start + dyn->d_ptr;
+				table_size = dyn->d_ptr;
 				break;
 			case DT_RELAENT:
 				size = dyn->d_ptr;
 				break;
+			case DT_RELACOUNT:
+				relative_count = dyn->d_ptr;
+				break;
 			default:
 				/* if no RELA/RELASZ found, both start and end will be initialized to NULL, and later while loop won't be executed */
 				break;
 			}
 		}
 
+		/* DT_RELASZ is in bytes, whichever of the tags comes first */
+		if ((start != NULL) && (size != 0U)) {
+			end = (struct Elf64_Rel *)((uint64_t)start + table_size);
+		}
+
 		/*
 		 * Need to subtract the relocation delta to get the correct
 		 * absolute addresses
@@ -95,29 +131,19 @@ void relocate(void)
 		primary_32_start = (uint64_t)(&cpu_primary_start_32) - delta;
 		primary_32_end = (uint64_t)(&cpu_primary_start_64) - delta;
 
+		/*
+		 * The linker sorts the R_X86_64_RELATIVE entries, nearly the
+		 * whole table, first and counts them in DT_RELACOUNT: that run
+		 * is patched without looking at the type of each entry.
+		 */
+		for (i = 0U; (i < relative_count) && (start < end); i++) {
+			fixup_relative(start, delta, trampoline_end, primary_32_start, primary_32_end);
+			start = (struct Elf64_Rel *)((char *)start + size);
+		}
+
 		while (start < end) {
 			if ((elf64_r_type(start->r_info)) == R_X86_64_RELATIVE) {
-				addr = (uint64_t *)(delta + start->r_offset);
-
-				/*
-				 * we won't fixup any trampoline.S and cpu_primary.S here
-				 * for a number of reasons:
-				 *
-				 * - trampoline code itself takes another relocation,
-				 *   so any entries for trampoline symbols can't be fixed up
-				 *   through .rela sections
-				 * - In cpu_primary.S, the 32 bits code doesn't need relocation
-				 * - Linker option "-z noreloc-overflow" could force R_X86_32
-				 *   to R_X86_64 in the relocation sections, which could make
-				 *   the fixed up code dirty. Even if relocation for 32 bits
-				 *   is needed in the future, it's recommended to do it
-				 *   explicitly in the assembly code to avoid confusion.
-				 */
-				if ((start->r_offset > trampoline_end) &&
-						((start->r_offset < primary_32_start) ||
-						(start->r_offset > primary_32_end))) {
-					*addr += delta;
-				}
+				fixup_relative(start, delta, trampoline_end, primary_32_start, primary_32_end);
 			}
 			start = (struct Elf64_Rel *)((char *)start + size);
 		}
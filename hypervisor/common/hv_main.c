@@ -19,6 +19,7 @@ void vcpu_thread(struct sched_object *obj)
 {
 	struct acrn_vcpu *vcpu = list_entry(obj, struct acrn_vcpu, sched_obj);
 	uint32_t basic_exit_reason = 0U;
+	uint64_t entry_tsc, exit_tsc;
 	int32_t ret = 0;
 
 	do {
@@ -36,6 +37,14 @@ void vcpu_thread(struct sched_object *obj)
 			schedule();
 		}
 
+		/*
+		 * Announce the coming VM entry before the pending requests are
+		 * checked, a sender which latched a request after the check sees
+		 * the flag and kicks this pCPU out of non-root mode.
+		 */
+		vcpu->arch.in_non_root = true;
+		cpu_memory_barrier();
+
 		/* Check and process pending requests(including interrupt) */
 		ret = acrn_handle_pending_request(vcpu);
 		if (ret < 0) {
@@ -47,8 +56,13 @@ void vcpu_thread(struct sched_object *obj)
 
 		profiling_vmenter_handler(vcpu);
 
-		TRACE_2L(TRACE_VM_ENTER, 0UL, 0UL);
+		update_preemption_timer(vcpu);
+
+		TRACE_2L(TRACE_VM_ENTER, (uint64_t)vcpu->vm->vm_id, (uint64_t)vcpu->vcpu_id);
+		entry_tsc = rdtsc();
 		ret = run_vcpu(vcpu);
+		exit_tsc = rdtsc();
+		vcpu->arch.in_non_root = false;
 		if (ret != 0) {
 			pr_fatal("vcpu resume failed");
 			pause_vcpu(vcpu, VCPU_ZOMBIE);
@@ -67,6 +81,7 @@ void vcpu_thread(struct sched_object *obj)
 		}
 		/* Dispatch handler */
 		ret = vmexit_handler(vcpu);
+		update_vcpu_stats(vcpu, basic_exit_reason, exit_tsc - entry_tsc, rdtsc() - exit_tsc);
 		if (ret < 0) {
 			pr_fatal("dispatch VM exit handler failed for reason"
 				" %d, ret = %d!", basic_exit_reason, ret);
@@ -78,6 +93,62 @@ void vcpu_thread(struct sched_object *obj)
 	} while (1);
 }
 
+/*
+ * Poll the sched_context flags for up to idle_poll_cycles before going to
+ * sleep, the poll window grows when the pCPU is woken up shortly after it
+ * went to sleep and shrinks when it slept longer than the maximum window.
+ *
+ * SCHED_IDLE_MONITOR stays set while waiting so that make_reschedule_request()
+ * doesn't need to send an IPI to wake the pCPU up.
+ *
+ * @pre interrupts are disabled
+ */
+static void idle_wait(uint16_t pcpu_id)
+{
+	struct sched_context *ctx = &per_cpu(sched_ctx, pcpu_id);
+	uint64_t *poll_cycles = &per_cpu(idle_poll_cycles, pcpu_id);
+	uint64_t max_poll = us_to_ticks(CONFIG_IDLE_POLL_US);
+	uint64_t flags, start, slept;
+	bool woken = false;
+
+	bitmap_set_lock(SCHED_IDLE_MONITOR, &ctx->flags);
+	flags = ctx->flags;
+
+	if (*poll_cycles != 0UL) {
+		start = rdtsc();
+		CPU_IRQ_ENABLE();
+		while ((rdtsc() - start) < *poll_cycles) {
+			if (ctx->flags != flags) {
+				woken = true;
+				break;
+			}
+			asm_pause();
+		}
+		CPU_IRQ_DISABLE();
+	}
+
+	if (!woken && (ctx->flags == flags)) {
+		start = rdtsc();
+		cpu_do_idle(&ctx->flags, flags);
+		slept = rdtsc() - start;
+
+		if (max_poll != 0UL) {
+			if (slept < max_poll) {
+				*poll_cycles = (*poll_cycles == 0UL) ? (max_poll >> 2U) : min(*poll_cycles << 1U, max_poll);
+			} else {
+				*poll_cycles >>= 1U;
+			}
+		}
+
+		/* service the interrupt which broke the wait */
+		CPU_IRQ_ENABLE();
+		asm_pause();
+		CPU_IRQ_DISABLE();
+	}
+
+	bitmap_clear_lock(SCHED_IDLE_MONITOR, &ctx->flags);
+}
+
 void default_idle(__unused struct sched_object *obj)
 {
 	uint16_t pcpu_id = get_pcpu_id();
@@ -90,9 +161,7 @@ void default_idle(__unused struct sched_object *obj)
 		} else if (need_shutdown_vm(pcpu_id)) {
 			shutdown_vm_from_idle(pcpu_id);
 		} else {
-			CPU_IRQ_ENABLE();
-			cpu_do_idle();
-			CPU_IRQ_DISABLE();
+			idle_wait(pcpu_id);
 		}
 	}
 }
@@ -18,6 +18,8 @@
 #include <hypercall.h>
 #include <errno.h>
 #include <logmsg.h>
+#include <timer.h>
+#include <cat.h>
 
 #define ACRN_DBG_HYCALL	6U
 
@@ -331,6 +333,35 @@ int32_t hcall_set_vcpu_regs(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
 	return ret;
 }
 
+/**
+ * @pre Pointer vm shall point to SOS_VM
+ * @pre target_vm is a post-launched VM which is not powered off
+ */
+static int32_t set_irqline(const struct acrn_vm *vm, struct acrn_vm *target_vm,
+				const struct acrn_irqline_ops *ops)
+{
+	uint32_t irq_pic;
+	int32_t ret = -1;
+
+	if (ops->gsi < vioapic_pincount(vm)) {
+		if (ops->gsi < vpic_pincount()) {
+			/*
+			 * IRQ line for 8254 timer is connected to
+			 * I/O APIC pin #2 but PIC pin #0,route GSI
+			 * number #2 to PIC IRQ #0.
+			 */
+			irq_pic = (ops->gsi == 2U) ? 0U : ops->gsi;
+			vpic_set_irqline(vm_pic(target_vm), irq_pic, ops->op);
+		}
+
+		/* handle IOAPIC irqline */
+		vioapic_set_irqline_lock(target_vm, ops->gsi, ops->op);
+		ret = 0;
+	}
+
+	return ret;
+}
+
 /**
  * @brief set or clear IRQ line
  *
@@ -348,26 +379,11 @@ int32_t hcall_set_vcpu_regs(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
 int32_t hcall_set_irqline(const struct acrn_vm *vm, uint16_t vmid,
 				const struct acrn_irqline_ops *ops)
 {
-	uint32_t irq_pic;
 	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
 	int32_t ret = -1;
 
 	if (!is_poweroff_vm(target_vm) && is_postlaunched_vm(target_vm)) {
-		if (ops->gsi < vioapic_pincount(vm)) {
-			if (ops->gsi < vpic_pincount()) {
-				/*
-				 * IRQ line for 8254 timer is connected to
-				 * I/O APIC pin #2 but PIC pin #0,route GSI
-				 * number #2 to PIC IRQ #0.
-				 */
-				irq_pic = (ops->gsi == 2U) ? 0U : ops->gsi;
-				vpic_set_irqline(vm_pic(target_vm), irq_pic, ops->op);
-		        }
-
-			/* handle IOAPIC irqline */
-			vioapic_set_irqline_lock(target_vm, ops->gsi, ops->op);
-			ret = 0;
-		}
+		ret = set_irqline(vm, target_vm, ops);
 	}
 
 	return ret;
@@ -418,59 +434,614 @@ static void inject_msi_lapic_pt(struct acrn_vm *vm, const struct acrn_msi_entry
 		icr.bits.delivery_mode = vmsi_data.bits.delivery_mode;
 		icr.bits.destination_mode = MSI_ADDR_DESTMODE_LOGICAL; 
 
-		msr_write(MSR_IA32_EXT_APIC_ICR, icr.value);
-		dev_dbg(ACRN_DBG_LAPICPT, "%s: icr.value 0x%016llx", __func__, icr.value);
+		msr_write(MSR_IA32_EXT_APIC_ICR, icr.value);
+		dev_dbg(ACRN_DBG_LAPICPT, "%s: icr.value 0x%016llx", __func__, icr.value);
+	}
+}
+
+/**
+ * @pre target_vm is a post-launched VM which is not powered off
+ */
+static int32_t inject_msi(struct acrn_vm *target_vm, const struct acrn_msi_entry *msi)
+{
+	int32_t ret = -1;
+
+	/* For target cpu with lapic pt, send ipi instead of injection via vlapic */
+	if (is_lapic_pt_configured(target_vm)) {
+		enum vm_vlapic_state vlapic_state = check_vm_vlapic_state(target_vm);
+		if (vlapic_state == VM_VLAPIC_X2APIC) {
+			/*
+			 * All the vCPUs of VM are in x2APIC mode and LAPIC is PT
+			 * Inject the vMSI as an IPI directly to VM
+			 */
+			inject_msi_lapic_pt(target_vm, msi);
+			ret = 0;
+		} else if (vlapic_state == VM_VLAPIC_XAPIC) {
+			/*
+			 * All the vCPUs of VM are in xAPIC and use vLAPIC
+			 * Inject using vLAPIC
+			 */
+			ret = vlapic_intr_msi(target_vm, msi->msi_addr, msi->msi_data);
+		} else {
+			/*
+			 * For cases VM_VLAPIC_DISABLED and VM_VLAPIC_TRANSITION
+			 * Silently drop interrupt
+			 */
+		}
+	} else {
+		ret = vlapic_intr_msi(target_vm, msi->msi_addr, msi->msi_data);
+	}
+
+	return ret;
+}
+
+/**
+ * @brief inject MSI interrupt
+ *
+ * Inject a MSI interrupt for a VM.
+ * The function will return -1 if the target VM does not exist.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to struct acrn_msi_entry
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_inject_msi(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	int32_t ret = -1;
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+
+	if (!is_poweroff_vm(target_vm) && is_postlaunched_vm(target_vm)) {
+		struct acrn_msi_entry msi;
+		const struct acrn_msi_entry *view = gpa_view_get(vm, param, sizeof(msi));
+
+		if (view != NULL) {
+			/* take a snapshot, SOS could change it while it is handled */
+			msi = *view;
+			gpa_view_put(view);
+
+			ret = inject_msi(target_vm, &msi);
+		} else if (copy_from_gpa(vm, &msi, param, sizeof(msi)) == 0) {
+			/* the entry crosses a page */
+			ret = inject_msi(target_vm, &msi);
+		} else {
+			pr_err("%s: Unable copy param to vm\n", __func__);
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief inject several MSI and IRQ line operations
+ *
+ * The batch is copied once, and the vCPUs woken up by its operations are
+ * notified once per pCPU after all of them are done.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to struct acrn_intr_batch
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, the error of the first failed operation otherwise,
+ *	   the following ones are not done.
+ */
+int32_t hcall_inject_intr_batch(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	int32_t ret = -1;
+	uint32_t i;
+	struct acrn_intr_batch batch;
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+
+	if (!is_poweroff_vm(target_vm) && is_postlaunched_vm(target_vm)) {
+		if (copy_from_gpa(vm, &batch, param, sizeof(batch)) != 0) {
+			pr_err("%s: Unable copy param to vm\n", __func__);
+		} else if (batch.count > ACRN_INTR_BATCH_MAX) {
+			ret = -EINVAL;
+		} else {
+			ret = 0;
+			vlapic_defer_notifications();
+			for (i = 0U; (i < batch.count) && (ret == 0); i++) {
+				switch (batch.ops[i].type) {
+				case ACRN_INTR_OP_MSI:
+					ret = inject_msi(target_vm, &batch.ops[i].u.msi);
+					break;
+				case ACRN_INTR_OP_IRQLINE:
+					ret = set_irqline(vm, target_vm, &batch.ops[i].u.irqline);
+					break;
+				default:
+					ret = -EINVAL;
+					break;
+				}
+			}
+			vlapic_flush_notifications();
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief set ioreq shared buffer
+ *
+ * Set the ioreq share buffer for a VM.
+ * The function will return -1 if the target VM does not exist.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_set_ioreq_buffer
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_ioreq_buffer(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	uint64_t hpa;
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	uint16_t i;
+	int32_t ret = -1;
+
+	if (is_created_vm(target_vm) && is_postlaunched_vm(target_vm)) {
+		struct acrn_set_ioreq_buffer iobuf;
+
+		if (copy_from_gpa(vm, &iobuf, param, sizeof(iobuf)) != 0) {
+			pr_err("%p %s: Unable copy param to vm\n", target_vm, __func__);
+	        } else {
+			dev_dbg(ACRN_DBG_HYCALL, "[%d] SET BUFFER=0x%p",
+					vmid, iobuf.req_buf);
+
+			hpa = gpa2hpa(vm, iobuf.req_buf);
+			if (hpa == INVALID_HPA) {
+				pr_err("%s,vm[%hu] gpa 0x%llx,GPA is unmapping.",
+					__func__, vm->vm_id, iobuf.req_buf);
+				target_vm->sw.io_shared_page = NULL;
+			} else {
+				target_vm->sw.io_shared_page = hpa2hva(hpa);
+				for (i = 0U; i < VHM_REQUEST_MAX; i++) {
+					set_vhm_req_state(target_vm, i, REQ_STATE_FREE);
+				}
+				ret = 0;
+			}
+	        }
+	}
+
+	return ret;
+}
+
+/**
+ * @brief notify request done
+ *
+ * Notify the requestor VCPU for the completion of an ioreq.
+ * The function will return -1 if the target VM does not exist.
+ *
+ * @param vmid ID of the VM
+ * @param vcpu_id vcpu ID of the requestor
+ *
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_notify_ioreq_finish(uint16_t vmid, uint16_t vcpu_id)
+{
+	struct acrn_vcpu *vcpu;
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	int32_t ret = -1;
+
+	/* make sure we have set req_buf */
+	if ((!is_poweroff_vm(target_vm)) && (is_postlaunched_vm(target_vm)) && (target_vm->sw.io_shared_page != NULL)) {
+		dev_dbg(ACRN_DBG_HYCALL, "[%d] NOTIFY_FINISH for vcpu %d",
+			vmid, vcpu_id);
+
+		if (vcpu_id >= CONFIG_MAX_VCPUS_PER_VM) {
+			pr_err("%s, failed to get VCPU %d context from VM %d\n",
+				__func__, vcpu_id, target_vm->vm_id);
+		} else {
+			vcpu = vcpu_from_vid(target_vm, vcpu_id);
+			if (vcpu->state != VCPU_OFFLINE) {
+				resume_vcpu_ioreq_done(vcpu);
+				ret = 0;
+			}
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief notify the completion of a batch of ioreqs
+ *
+ * @param vmid ID of the VM
+ * @param vcpu_bitmap bitmap of the IDs of the requestor vCPUs
+ *
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_notify_ioreq_finish_batch(uint16_t vmid, uint64_t vcpu_bitmap)
+{
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	int32_t ret = -1;
+
+	/* make sure we have set req_buf */
+	if ((!is_poweroff_vm(target_vm)) && (is_postlaunched_vm(target_vm)) && (target_vm->sw.io_shared_page != NULL)) {
+		dev_dbg(ACRN_DBG_HYCALL, "[%d] NOTIFY_FINISH_BATCH for vcpus 0x%llx",
+			vmid, vcpu_bitmap);
+
+		ret = resume_vcpus_ioreq_done(target_vm, vcpu_bitmap);
+	}
+
+	return ret;
+}
+
+/**
+ * @brief register or deregister a doorbell of a VM
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_doorbell
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_set_doorbell(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	struct acrn_doorbell doorbell;
+	int32_t ret = -EINVAL;
+
+	if (!is_poweroff_vm(target_vm) && is_postlaunched_vm(target_vm) &&
+			(copy_from_gpa(vm, &doorbell, param, sizeof(doorbell)) == 0)) {
+		if ((doorbell.flags & ACRN_DOORBELL_FLAG_DEASSIGN) != 0U) {
+			if (doorbell.index < ACRN_DOORBELL_MAX) {
+				unregister_doorbell(target_vm, doorbell.index);
+				ret = 0;
+			}
+		} else {
+			ret = register_doorbell(target_vm, &doorbell);
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief fetch and clear the pending doorbells of a VM
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to a uint64_t
+ *              receiving the bitmap of the rung doorbells
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_get_doorbells(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	uint64_t pending;
+	int32_t ret = -EINVAL;
+
+	if (!is_poweroff_vm(target_vm) && is_postlaunched_vm(target_vm)) {
+		pending = atomic_readandclear64(&target_vm->doorbell_pending);
+		ret = copy_to_gpa(vm, &pending, param, sizeof(pending));
+		if ((ret != 0) && (pending != 0UL)) {
+			/* don't lose them */
+			ring_doorbells(target_vm, pending);
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief set the coalesced MMIO ring of a VM
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address of the page holding the
+ *              struct acrn_coalesced_mmio_ring
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_coalesced_mmio_ring(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	struct acrn_coalesced_mmio_ring *ring;
+	uint64_t hpa;
+	int32_t ret = -EINVAL;
+
+	if (is_created_vm(target_vm) && is_postlaunched_vm(target_vm) && ((param & PAGE_MASK) == param)) {
+		hpa = gpa2hpa(vm, param);
+		if (hpa == INVALID_HPA) {
+			pr_err("%s,vm[%hu] gpa 0x%llx,GPA is unmapping.", __func__, vm->vm_id, param);
+		} else {
+			ring = (struct acrn_coalesced_mmio_ring *)hpa2hva(hpa);
+			stac();
+			ring->first = 0U;
+			ring->last = 0U;
+			clac();
+			target_vm->coalesced_ring = ring;
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief register or deregister a coalesced MMIO zone of a VM
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_coalesced_mmio_zone
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_set_coalesced_mmio_zone(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	struct acrn_coalesced_mmio_zone zone;
+	int32_t ret = -EINVAL;
+
+	if (!is_poweroff_vm(target_vm) && is_postlaunched_vm(target_vm) &&
+			(copy_from_gpa(vm, &zone, param, sizeof(zone)) == 0)) {
+		if ((zone.flags & ACRN_COALESCED_MMIO_FLAG_DEASSIGN) != 0U) {
+			ret = unregister_coalesced_mmio_zone(target_vm, &zone);
+		} else {
+			ret = register_coalesced_mmio_zone(target_vm, &zone);
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief set the timer counters page of a VM
+ *
+ * The hypervisor serves the HPET and PIT counter reads of the VM from the
+ * state the device model publishes in the page.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address of the page holding the
+ *              struct acrn_timer_counters
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_timer_counters(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	struct acrn_timer_counters *tc;
+	uint64_t hpa;
+	int32_t ret = -EINVAL;
+
+	if (is_created_vm(target_vm) && is_postlaunched_vm(target_vm) && ((param & PAGE_MASK) == param)) {
+		hpa = gpa2hpa(vm, param);
+		if (hpa == INVALID_HPA) {
+			pr_err("%s,vm[%hu] gpa 0x%llx,GPA is unmapping.", __func__, vm->vm_id, param);
+		} else {
+			tc = (struct acrn_timer_counters *)hpa2hva(hpa);
+			stac();
+			tc->tsc_khz = get_tsc_khz();
+			clac();
+			/* the device model takes its TSC in SOS, on whose vCPU this runs */
+			target_vm->sos_tsc_offset = exec_vmread64(VMX_TSC_OFFSET_FULL);
+			spinlock_obtain(&target_vm->pit_latch_lock);
+			(void)memset(target_vm->pit_latch_bytes, 0U, sizeof(target_vm->pit_latch_bytes));
+			spinlock_release(&target_vm->pit_latch_lock);
+			target_vm->timer_counters = tc;
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief set the PCI config space shadow of a VM
+ *
+ * The hypervisor serves the reads of the read-only PCI config space of the
+ * VM from the copy the device model pushes.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address of the struct acrn_pci_cfg_shadow
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_pci_cfg_shadow(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	struct acrn_pci_cfg_shadow *shadow;
+	int32_t ret = -EINVAL;
+
+	if (is_created_vm(target_vm) && is_postlaunched_vm(target_vm)) {
+		shadow = &target_vm->vpci.cfg_shadow;
+		spinlock_obtain(&target_vm->vpci.cfg_shadow_lock);
+		if (copy_from_gpa(vm, shadow, param, (uint32_t)sizeof(*shadow)) != 0) {
+			pr_err("%s: Unable copy param to vm\n", __func__);
+		} else if (shadow->num_devs > ACRN_PCI_CFG_SHADOW_DEVS) {
+			pr_err("%s: invalid number of devices %u\n", __func__, shadow->num_devs);
+		} else {
+			ret = 0;
+		}
+		if (ret != 0) {
+			/* serve nothing rather than a partial copy */
+			(void)memset(shadow, 0U, sizeof(*shadow));
+		}
+		spinlock_release(&target_vm->vpci.cfg_shadow_lock);
+	}
+
+	return ret;
+}
+
+/**
+ * @brief register or unregister the MSI-X table of an emulated device
+ *
+ * The hypervisor serves the accesses to the MSI-X table of the device from
+ * the copy the device model keeps in SOS memory, or for a passthrough
+ * device, the accesses to the pages of its BAR holding the table.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address of the struct acrn_emul_msix
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_set_emul_msix(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	struct acrn_emul_msix msix;
+	uint64_t hpa;
+	int32_t ret = -EINVAL;
+
+	if (!is_poweroff_vm(target_vm) && is_postlaunched_vm(target_vm) &&
+			(copy_from_gpa(vm, &msix, param, sizeof(msix)) == 0)) {
+		if ((msix.flags & ACRN_EMUL_MSIX_FLAG_DEASSIGN) != 0U) {
+			ret = unregister_emul_msix(target_vm, &msix);
+		} else if ((msix.flags & ACRN_EMUL_MSIX_FLAG_PTDEV) != 0U) {
+			/* the table is the one of the device, not a copy in SOS memory */
+			if (vpci_has_ptdev_msix(target_vm, msix.virt_bdf)) {
+				ret = register_emul_msix(target_vm, &msix, NULL);
+			}
+		} else if ((msix.table_buf & PAGE_MASK) == msix.table_buf) {
+			hpa = gpa2hpa(vm, msix.table_buf);
+			if (hpa == INVALID_HPA) {
+				pr_err("%s,vm[%hu] gpa 0x%llx,GPA is unmapping.", __func__, vm->vm_id, msix.table_buf);
+			} else {
+				ret = register_emul_msix(target_vm, &msix, (struct msix_table_entry *)hpa2hva(hpa));
+			}
+		} else {
+			/* the table must be in one page */
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief query, attach or detach the ivshmem device of a VM
+ *
+ * The shared memory BAR of the device emulated by the device model maps a
+ * region of the inter-VM shared memory, its doorbell writes are served by
+ * the hypervisor.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address of the struct acrn_ivshmem, the
+ *		outputs are copied back
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_ivshmem(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	struct acrn_ivshmem ivshmem;
+	int32_t ret = -EINVAL;
+
+	if (!is_poweroff_vm(target_vm) && is_postlaunched_vm(target_vm) &&
+			(copy_from_gpa(vm, &ivshmem, param, sizeof(ivshmem)) == 0)) {
+		ret = vpci_ivshmem_set(target_vm, &ivshmem);
+		if ((ret == 0) && (copy_to_gpa(vm, &ivshmem, param, sizeof(ivshmem)) != 0)) {
+			ret = -EFAULT;
+		}
+	}
+
+	return ret;
+}
+
+/* a pCPU no vCPU of any VM is created on, the SOS ones offlined */
+static bool is_free_pcpu(uint16_t pcpu_id)
+{
+	return (pcpu_id < get_pcpu_nums()) && (get_ever_run_vcpu(pcpu_id) == NULL);
+}
+
+/**
+ * @brief create a vCPU of a running VM on a pCPU released by the SOS
+ *
+ * The vCPUs of the VM configuration are created along with the VM, the
+ * hypercall is a no-op for them. Otherwise the vCPU is created on the pCPU,
+ * in the wait-for-SIPI state, for the guest to bring it up once it is told
+ * of it by the device model.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address of the struct acrn_create_vcpu
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, -EBUSY if the pCPU is in use, -EINVAL on other
+ *         errors.
+ */
+int32_t hcall_create_vcpu(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	struct acrn_create_vcpu cv;
+	int32_t ret = -EINVAL;
+
+	if (!is_poweroff_vm(target_vm) && is_postlaunched_vm(target_vm) &&
+			(copy_from_gpa(vm, &cv, param, sizeof(cv)) == 0)) {
+		if ((cv.vcpu_id < target_vm->hw.created_vcpus) &&
+				(target_vm->hw.vcpu_array[cv.vcpu_id].state != VCPU_OFFLINE)) {
+			ret = 0;
+		} else if (is_lapic_pt_configured(target_vm)) {
+			/* the LAPIC of the pCPU would have to be handed over as well */
+			ret = -EINVAL;
+		} else if (!is_free_pcpu(cv.pcpu_id)) {
+			pr_err("%s: pCPU%hu is in use", __func__, cv.pcpu_id);
+			ret = -EBUSY;
+		} else {
+			ret = prepare_vcpu(target_vm, cv.vcpu_id, cv.pcpu_id);
+		}
 	}
+
+	return ret;
 }
 
 /**
- * @brief inject MSI interrupt
+ * @brief remove a vCPU the guest ejected, and hand its pCPU back to the SOS
  *
- * Inject a MSI interrupt for a VM.
- * The function will return -1 if the target VM does not exist.
+ * The vCPU of the SOS offlined for the pCPU is created again, in the
+ * wait-for-SIPI state, for the SOS to online the pCPU.
  *
  * @param vm Pointer to VM data structure
  * @param vmid ID of the VM
- * @param param guest physical address. This gpa points to struct acrn_msi_entry
+ * @param param the vCPU ID, the BSP is never removed
  *
  * @pre Pointer vm shall point to SOS_VM
  * @return 0 on success, non-zero on error.
  */
-int32_t hcall_inject_msi(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+int32_t hcall_remove_vcpu(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
 {
-	int32_t ret = -1;
 	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	struct acrn_vcpu *vcpu;
+	uint16_t vcpu_id = (uint16_t)param;
+	uint16_t i, pcpu_id;
+	int32_t ret = -EINVAL;
 
-	if (!is_poweroff_vm(target_vm) && is_postlaunched_vm(target_vm)) {
-		struct acrn_msi_entry msi;
+	if (!is_poweroff_vm(target_vm) && is_postlaunched_vm(target_vm) && !is_lapic_pt_configured(target_vm) &&
+			(param != BOOT_CPU_ID) && (param < target_vm->hw.created_vcpus) &&
+			(target_vm->hw.vcpu_array[vcpu_id].state != VCPU_OFFLINE)) {
+		vcpu = vcpu_from_vid(target_vm, vcpu_id);
+		pcpu_id = vcpu->pcpu_id;
 
-		if (copy_from_gpa(vm, &msi, param, sizeof(msi)) != 0) {
-			pr_err("%s: Unable copy param to vm\n", __func__);
-		} else {
-			/* For target cpu with lapic pt, send ipi instead of injection via vlapic */
-			if (is_lapic_pt_configured(target_vm)) {
-				enum vm_vlapic_state vlapic_state = check_vm_vlapic_state(target_vm);
-				if (vlapic_state == VM_VLAPIC_X2APIC) {
-					/*
-					 * All the vCPUs of VM are in x2APIC mode and LAPIC is PT
-					 * Inject the vMSI as an IPI directly to VM
-					 */
-					inject_msi_lapic_pt(target_vm, &msi);
-					ret = 0;
-				} else if (vlapic_state == VM_VLAPIC_XAPIC) {
-					/*
-					 * All the vCPUs of VM are in xAPIC and use vLAPIC
-					 * Inject using vLAPIC
-					 */
-					ret = vlapic_intr_msi(target_vm, msi.msi_addr, msi.msi_data);
-				} else {
-					/*
-					 * For cases VM_VLAPIC_DISABLED and VM_VLAPIC_TRANSITION
-					 * Silently drop interrupt
-					 */
-				}
-			} else {
-				ret = vlapic_intr_msi(target_vm, msi.msi_addr, msi.msi_data);
+		pause_vcpu(vcpu, VCPU_ZOMBIE);
+		reset_vcpu(vcpu);
+		offline_vcpu(vcpu);
+		pr_info("VM%hu VCPU%hu removed, PCPU%hu released", target_vm->vm_id, vcpu_id, pcpu_id);
+
+		ret = 0;
+		for (i = 0U; i < vm->hw.created_vcpus; i++) {
+			vcpu = &vm->hw.vcpu_array[i];
+			if ((vcpu->state == VCPU_OFFLINE) && (vcpu->pcpu_id == pcpu_id)) {
+				ret = prepare_vcpu(vm, i, pcpu_id);
+				break;
 			}
 		}
 	}
@@ -479,86 +1050,69 @@ int32_t hcall_inject_msi(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
 }
 
 /**
- * @brief set ioreq shared buffer
+ * @brief set the simple port I/O registers page of a VM
  *
- * Set the ioreq share buffer for a VM.
- * The function will return -1 if the target VM does not exist.
+ * The hypervisor serves the guest accesses to the registers the device
+ * model describes in the page.
  *
  * @param vm Pointer to VM data structure
  * @param vmid ID of the VM
- * @param param guest physical address. This gpa points to
- *              struct acrn_set_ioreq_buffer
+ * @param param guest physical address of the page holding the
+ *              struct acrn_pio_regs
  *
  * @pre Pointer vm shall point to SOS_VM
  * @return 0 on success, non-zero on error.
  */
-int32_t hcall_set_ioreq_buffer(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+int32_t hcall_set_pio_regs(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
 {
-	uint64_t hpa;
 	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
-	uint16_t i;
-	int32_t ret = -1;
-
-	if (is_created_vm(target_vm) && is_postlaunched_vm(target_vm)) {
-		struct acrn_set_ioreq_buffer iobuf;
-
-		if (copy_from_gpa(vm, &iobuf, param, sizeof(iobuf)) != 0) {
-			pr_err("%p %s: Unable copy param to vm\n", target_vm, __func__);
-	        } else {
-			dev_dbg(ACRN_DBG_HYCALL, "[%d] SET BUFFER=0x%p",
-					vmid, iobuf.req_buf);
+	uint64_t hpa;
+	int32_t ret = -EINVAL;
 
-			hpa = gpa2hpa(vm, iobuf.req_buf);
-			if (hpa == INVALID_HPA) {
-				pr_err("%s,vm[%hu] gpa 0x%llx,GPA is unmapping.",
-					__func__, vm->vm_id, iobuf.req_buf);
-				target_vm->sw.io_shared_page = NULL;
-			} else {
-				target_vm->sw.io_shared_page = hpa2hva(hpa);
-				for (i = 0U; i < VHM_REQUEST_MAX; i++) {
-					set_vhm_req_state(target_vm, i, REQ_STATE_FREE);
-				}
-				ret = 0;
-			}
-	        }
+	if (is_created_vm(target_vm) && is_postlaunched_vm(target_vm) && ((param & PAGE_MASK) == param)) {
+		hpa = gpa2hpa(vm, param);
+		if (hpa == INVALID_HPA) {
+			pr_err("%s,vm[%hu] gpa 0x%llx,GPA is unmapping.", __func__, vm->vm_id, param);
+		} else {
+			target_vm->pio_regs = (struct acrn_pio_regs *)hpa2hva(hpa);
+			ret = 0;
+		}
 	}
 
 	return ret;
 }
 
 /**
- * @brief notify request done
+ * @brief set the RTC page of a VM
  *
- * Notify the requestor VCPU for the completion of an ioreq.
- * The function will return -1 if the target VM does not exist.
+ * The hypervisor emulates the RTC of the VM, starting from the time and
+ * the NVRAM contents of the page. The device model sets it again on a
+ * reset of the VM, the hypervisor keeps the NVRAM part of the page up to
+ * date.
  *
+ * @param vm Pointer to VM data structure
  * @param vmid ID of the VM
- * @param vcpu_id vcpu ID of the requestor
+ * @param param guest physical address of the page holding the
+ *              struct acrn_vrtc
  *
+ * @pre Pointer vm shall point to SOS_VM
  * @return 0 on success, non-zero on error.
  */
-int32_t hcall_notify_ioreq_finish(uint16_t vmid, uint16_t vcpu_id)
+int32_t hcall_set_vrtc(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
 {
-	struct acrn_vcpu *vcpu;
 	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
-	int32_t ret = -1;
-
-	/* make sure we have set req_buf */
-	if ((!is_poweroff_vm(target_vm)) && (is_postlaunched_vm(target_vm)) && (target_vm->sw.io_shared_page != NULL)) {
-		dev_dbg(ACRN_DBG_HYCALL, "[%d] NOTIFY_FINISH for vcpu %d",
-			vmid, vcpu_id);
+	uint64_t hpa;
+	int32_t ret = -EINVAL;
 
-		if (vcpu_id >= CONFIG_MAX_VCPUS_PER_VM) {
-			pr_err("%s, failed to get VCPU %d context from VM %d\n",
-				__func__, vcpu_id, target_vm->vm_id);
+	/* the RT VMs keep the physical RTC passed through */
+	if ((is_created_vm(target_vm) || is_paused_vm(target_vm)) && is_postlaunched_vm(target_vm) &&
+			!is_rt_vm(target_vm) && ((param & PAGE_MASK) == param)) {
+		hpa = gpa2hpa(vm, param);
+		if (hpa == INVALID_HPA) {
+			pr_err("%s,vm[%hu] gpa 0x%llx,GPA is unmapping.", __func__, vm->vm_id, param);
 		} else {
-			vcpu = vcpu_from_vid(target_vm, vcpu_id);
-			if (vcpu->state != VCPU_OFFLINE) {
-				if (!vcpu->vm->sw.is_completion_polling) {
-					resume_vcpu(vcpu);
-				}
-				ret = 0;
-			}
+			vrtc_setup(target_vm, (struct acrn_vrtc *)hpa2hva(hpa));
+			ret = 0;
 		}
 	}
 
@@ -568,7 +1122,7 @@ int32_t hcall_notify_ioreq_finish(uint16_t vmid, uint16_t vcpu_id)
 /**
  *@pre Pointer vm shall point to SOS_VM
  */
-static int32_t add_vm_memory_region(struct acrn_vm *vm, struct acrn_vm *target_vm,
+static int32_t add_vm_memory_region(struct acrn_vm *vm, struct ept_update *update,
 				    const struct vm_memory_region *region,uint64_t *pml4_page)
 {
 	int32_t ret;
@@ -611,7 +1165,7 @@ static int32_t add_vm_memory_region(struct acrn_vm *vm, struct acrn_vm *target_v
 				prot |= EPT_UNCACHED;
 			}
 			/* create gpa to hpa EPT mapping */
-			ept_add_mr(target_vm, pml4_page, hpa,
+			ept_update_add_mr(update, pml4_page, hpa,
 					region->gpa, region->size, prot);
 			ret = 0;
 		}
@@ -624,8 +1178,9 @@ static int32_t add_vm_memory_region(struct acrn_vm *vm, struct acrn_vm *target_v
  *@pre Pointer vm shall point to SOS_VM
  */
 static int32_t set_vm_memory_region(struct acrn_vm *vm,
-	struct acrn_vm *target_vm, const struct vm_memory_region *region)
+	struct ept_update *update, const struct vm_memory_region *region)
 {
+	struct acrn_vm *target_vm = update->vm;
 	uint64_t gpa_end;
 	uint64_t *pml4_page;
 	int32_t ret;
@@ -648,10 +1203,11 @@ static int32_t set_vm_memory_region(struct acrn_vm *vm,
 				region->sos_vm_gpa, region->size);
 
 			pml4_page = (uint64_t *)target_vm->arch_vm.nworld_eptp;
+			invalidate_vmtrr_ept_map(target_vm, region->gpa, region->size);
 			if (region->type != MR_DEL) {
-				ret = add_vm_memory_region(vm, target_vm, region, pml4_page);
+				ret = add_vm_memory_region(vm, update, region, pml4_page);
 			} else {
-				ept_del_mr(target_vm, pml4_page,
+				ept_update_del_mr(update, pml4_page,
 						region->gpa, region->size);
 				ret = 0;
 			}
@@ -675,6 +1231,7 @@ int32_t hcall_set_vm_memory_regions(struct acrn_vm *vm, uint64_t param)
 {
 	struct set_regions regions;
 	struct vm_memory_region mr;
+	struct ept_update update;
 	struct acrn_vm *target_vm = NULL;
 	uint32_t idx;
 	int32_t ret = -1;
@@ -687,6 +1244,8 @@ int32_t hcall_set_vm_memory_regions(struct acrn_vm *vm, uint64_t param)
 			target_vm = get_vm_from_vmid(target_vmid);
 		}
 		if ((target_vm != NULL) && !is_poweroff_vm(target_vm) && is_postlaunched_vm(target_vm)) {
+			/* all the regions share a single INVEPT and IOTLB invalidation */
+			ept_update_begin(target_vm, &update);
 			idx = 0U;
 			while (idx < regions.mr_num) {
 				if (copy_from_gpa(vm, &mr, regions.regions_gpa + idx * sizeof(mr), sizeof(mr)) != 0) {
@@ -694,12 +1253,13 @@ int32_t hcall_set_vm_memory_regions(struct acrn_vm *vm, uint64_t param)
 					break;
 				}
 
-				ret = set_vm_memory_region(vm, target_vm, &mr);
+				ret = set_vm_memory_region(vm, &update, &mr);
 				if (ret < 0) {
 					break;
 				}
 				idx++;
 			}
+			ept_update_commit(&update);
 		} else {
 			pr_err("%p %s:target_vm is invalid or Targeting to service vm", target_vm, __func__);
 		}
@@ -777,6 +1337,88 @@ int32_t hcall_write_protect_page(struct acrn_vm *vm, uint16_t vmid, uint64_t wp_
 	return ret;
 }
 
+/**
+ * @brief start or stop the dirty pages tracking of a VM
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param enable non-zero to start the tracking, zero to stop it
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_dirty_log(__unused struct acrn_vm *vm, uint16_t vmid, uint64_t enable)
+{
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	int32_t ret = -1;
+
+	if (!is_poweroff_vm(target_vm) && is_postlaunched_vm(target_vm)) {
+		if ((enable != 0UL) && !pcpu_has_vmx_ept_cap(VMX_EPT_AD)) {
+			ret = -ENODEV;
+		} else {
+			ept_set_ad_tracking(target_vm, (enable != 0UL));
+			ret = 0;
+		}
+	} else {
+		pr_err("%p %s: target_vm is invalid", target_vm, __func__);
+	}
+
+	return ret;
+}
+
+struct dirty_log_copy {
+	struct acrn_vm *vm;
+	uint64_t bitmap_gpa;
+};
+
+/* page_idx is a multiple of EPT_AD_CHUNK_PAGES, so the chunks are byte aligned */
+static int32_t copy_dirty_bitmap(void *data, const uint64_t *bitmap, uint64_t page_idx, uint64_t page_num)
+{
+	struct dirty_log_copy *copy = (struct dirty_log_copy *)data;
+
+	return copy_to_gpa(copy->vm, (void *)bitmap, copy->bitmap_gpa + (page_idx >> 3U),
+			(uint32_t)INT_DIV_ROUNDUP(page_num, 8UL));
+}
+
+/**
+ * @brief harvest and clear the dirty pages bitmap of a guest memory range
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_dirty_log
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_get_dirty_log(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	struct acrn_dirty_log log;
+	struct dirty_log_copy copy;
+	int32_t ret = -1;
+
+	if (!is_poweroff_vm(target_vm) && is_postlaunched_vm(target_vm) && target_vm->arch_vm.ept_ad_enabled) {
+		if (copy_from_gpa(vm, &log, param, sizeof(log)) != 0) {
+			pr_err("%s: Unable copy param to vm\n", __func__);
+		} else if (!mem_aligned_check(log.gpa, PAGE_SIZE) || !mem_aligned_check(log.size, PAGE_SIZE) ||
+				(log.size == 0UL) || ((log.gpa + log.size) < log.gpa)) {
+			pr_err("%s: invalid range gpa 0x%llx size 0x%llx", __func__, log.gpa, log.size);
+			ret = -EINVAL;
+		} else {
+			copy.vm = vm;
+			copy.bitmap_gpa = log.bitmap_gpa;
+			ret = ept_harvest_ad_bits(target_vm, log.gpa, log.size,
+					((log.flags & ACRN_DIRTY_LOG_ACCESSED) != 0U) ? EPT_ACCESSED_BIT : EPT_DIRTY_BIT,
+					copy_dirty_bitmap, &copy);
+		}
+	} else {
+		pr_err("%p %s: target_vm is invalid or not tracked", target_vm, __func__);
+	}
+
+	return ret;
+}
+
 /**
  * @brief translate guest physical address to host physical address
  *
@@ -1128,6 +1770,7 @@ int32_t hcall_vm_intr_monitor(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
 			intr_hdr = (struct acrn_intr_monitor *)hpa2hva(hpa);
 			stac();
 			if (intr_hdr->buf_cnt <= (MAX_PTDEV_NUM * 2U)) {
+				status = 0;
 				switch (intr_hdr->cmd) {
 				case INTR_CMD_GET_DATA:
 					intr_hdr->buf_cnt = ptirq_get_intr_data(target_vm,
@@ -1140,12 +1783,18 @@ int32_t hcall_vm_intr_monitor(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
 						intr_hdr->buffer[0] * CYCLES_PER_MS;
 					break;
 
+				case INTR_CMD_SET_MODERATION:
+					if (ptirq_set_moderation(target_vm, (uint32_t)intr_hdr->buffer[0],
+							(uint32_t)intr_hdr->buffer[1], (uint32_t)intr_hdr->buffer[2],
+							(uint32_t)intr_hdr->buffer[3]) != 0) {
+						status = -EINVAL;
+					}
+					break;
+
 				default:
 					/* if cmd wrong it goes here should not happen */
 					break;
 				}
-
-				status = 0;
 			}
 			clac();
 		}
@@ -1184,3 +1833,184 @@ int32_t hcall_set_callback_vector(const struct acrn_vm *vm, uint64_t param)
 
 	return ret;
 }
+
+/**
+ * @brief Get the VM exit statistics of a vCPU of a VM.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_vmexit_stats
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_get_exit_stats(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	int32_t ret = -EINVAL;
+	uint16_t vcpu_id;
+	struct acrn_vcpu *vcpu;
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+
+	if (!is_poweroff_vm(target_vm) && (copy_from_gpa(vm, &vcpu_id, param, sizeof(vcpu_id)) == 0)) {
+		if (vcpu_id < target_vm->hw.created_vcpus) {
+			vcpu = vcpu_from_vid(target_vm, vcpu_id);
+			ret = copy_to_gpa(vm, &vcpu->arch.exit_stats, param + offsetof(struct acrn_vmexit_stats, stats),
+				sizeof(struct vmexit_stats));
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Set the statistics page of a vCPU of a VM.
+ *
+ * The hypervisor updates the page on each VM exit of the vCPU, see
+ * struct acrn_vcpu_stats.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address of the page holding the
+ *              struct acrn_vcpu_stats, vcpu_id set
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_set_vcpu_stats(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	struct acrn_vcpu_stats *stats;
+	struct acrn_vcpu *vcpu;
+	uint16_t vcpu_id;
+	uint64_t hpa;
+	int32_t ret = -EINVAL;
+
+	if (is_created_vm(target_vm) && is_postlaunched_vm(target_vm) && ((param & PAGE_MASK) == param)) {
+		hpa = gpa2hpa(vm, param);
+		if (hpa == INVALID_HPA) {
+			pr_err("%s,vm[%hu] gpa 0x%llx,GPA is unmapping.", __func__, vm->vm_id, param);
+		} else {
+			stats = (struct acrn_vcpu_stats *)hpa2hva(hpa);
+			stac();
+			vcpu_id = stats->vcpu_id;
+			clac();
+			if (vcpu_id < target_vm->hw.created_vcpus) {
+				vcpu = vcpu_from_vid(target_vm, vcpu_id);
+				stac();
+				(void)memset((void *)stats, 0U, sizeof(struct acrn_vcpu_stats));
+				stats->vcpu_id = vcpu_id;
+				stats->pcpu_id = vcpu->pcpu_id;
+				stats->tsc_khz = get_tsc_khz();
+				clac();
+				vcpu->arch.stats = stats;
+				ret = 0;
+			}
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Set the Class of Service of the vCPUs of a VM.
+ *
+ * The vCPUs load the CLOS to MSR_IA32_PQR_ASSOC when they are switched in,
+ * the running ones are kicked to load it at once.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM, a post-launched VM or the SOS
+ * @param param guest physical address of the struct acrn_vm_clos
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, -EPERM for a CLOS reserved by a pre-launched VM,
+ *         -EINVAL on other errors.
+ */
+int32_t hcall_vm_set_clos(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	struct acrn_vm_clos vm_clos;
+	struct acrn_vcpu *vcpu;
+	uint16_t i;
+	int32_t ret = -EINVAL;
+
+	if (is_created_vm(target_vm) && (is_postlaunched_vm(target_vm) || is_sos_vm(target_vm)) &&
+			(copy_from_gpa(vm, &vm_clos, param, sizeof(vm_clos)) == 0) && is_clos_valid(vm_clos.clos) &&
+			((vm_clos.vcpu_id == ACRN_CLOS_ALL_VCPUS) || (vm_clos.vcpu_id < target_vm->hw.created_vcpus))) {
+		if (is_clos_reserved(vm_clos.clos)) {
+			ret = -EPERM;
+		} else {
+			foreach_vcpu(i, target_vm, vcpu) {
+				if ((vm_clos.vcpu_id == ACRN_CLOS_ALL_VCPUS) || (vm_clos.vcpu_id == i)) {
+					vcpu->arch.clos = vm_clos.clos;
+					vcpu_make_request(vcpu, ACRN_REQUEST_CLOS_UPDATE);
+				}
+			}
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Set the cache capacity bitmask or the MBA delay of a CLOS.
+ *
+ * @param vm Pointer to VM data structure
+ * @param param guest physical address of the struct acrn_clos_mask
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, -EPERM for a CLOS reserved by a pre-launched VM,
+ *         -EINVAL on other errors.
+ */
+int32_t hcall_set_clos_mask(struct acrn_vm *vm, uint64_t param)
+{
+	struct acrn_clos_mask clos_mask;
+	int32_t ret = -EINVAL;
+
+	if (copy_from_gpa(vm, &clos_mask, param, sizeof(clos_mask)) == 0) {
+		ret = set_clos_mask(clos_mask.clos, clos_mask.type, clos_mask.value);
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Send a fixed IPI to several vCPUs with one hypercall.
+ *
+ * @param vcpu Pointer to the sender vCPU
+ * @param param1 bitmap of the destination APIC IDs
+ * @param param2 bits 7:0 the vector, bits 63:32 the APIC ID of bit 0 of param1
+ *
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_send_ipi_mask(struct acrn_vcpu *vcpu, uint64_t param1, uint64_t param2)
+{
+	int32_t ret = -EPERM;
+
+	if (!is_lapic_pt_configured(vcpu->vm)) {
+		ret = vlapic_send_ipi_mask(vcpu, param1, (uint32_t)(param2 >> 32U), (uint32_t)(param2 & 0xFFUL));
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Set up the PV EOI bitmap of the calling vCPU.
+ *
+ * @param vcpu Pointer to the calling vCPU
+ * @param param guest physical address of the bitmap, 0 to disable PV EOI
+ *
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_pv_eoi(struct acrn_vcpu *vcpu, uint64_t param)
+{
+	int32_t ret = -EPERM;
+
+	/* the guest EOI has to be virtualized without trap for PV EOI */
+	if (is_apicv_advanced_feature_supported() && !is_lapic_pt_configured(vcpu->vm)) {
+		ret = vlapic_set_pv_eoi(vcpu_vlapic(vcpu), param);
+	}
+
+	return ret;
+}
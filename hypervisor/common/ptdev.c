@@ -4,6 +4,7 @@
  * SPDX-License-Identifier: BSD-3-Clause
  */
 
+#include <errno.h>
 #include <per_cpu.h>
 #include <vm.h>
 #include <softirq.h>
@@ -11,11 +12,30 @@
 #include <irq.h>
 #include <logmsg.h>
 
-#define PTIRQ_BITMAP_ARRAY_SIZE	INT_DIV_ROUNDUP(CONFIG_MAX_PT_IRQ_ENTRIES, 64U)
 struct ptirq_remapping_info ptirq_entries[CONFIG_MAX_PT_IRQ_ENTRIES];
 static uint64_t ptirq_entry_bitmaps[PTIRQ_BITMAP_ARRAY_SIZE];
 spinlock_t ptdev_lock;
 
+/* chains of the active entries, under ptdev_lock */
+static struct list_head ptirq_phys_hash[PTIRQ_HASH_SIZE];
+static struct list_head ptirq_virt_hash[PTIRQ_HASH_SIZE];
+
+static inline uint32_t ptirq_hash(uint64_t key)
+{
+	return (uint32_t)((key * 0x9E3779B97F4A7C15UL) >> (64U - PTIRQ_HASH_BITS));
+}
+
+static inline struct list_head *ptirq_phys_chain(uint32_t intr_type, const union source_id *sid)
+{
+	return &ptirq_phys_hash[ptirq_hash(sid->value ^ intr_type)];
+}
+
+static inline struct list_head *ptirq_virt_chain(uint32_t intr_type, const union source_id *sid,
+		const struct acrn_vm *vm)
+{
+	return &ptirq_virt_hash[ptirq_hash(sid->value ^ intr_type ^ ((uint64_t)vm->vm_id << 40U))];
+}
+
 static inline uint16_t ptirq_alloc_entry_id(void)
 {
 	uint16_t id = (uint16_t)ffz64_ex(ptirq_entry_bitmaps, CONFIG_MAX_PT_IRQ_ENTRIES);
@@ -30,18 +50,18 @@ static inline uint16_t ptirq_alloc_entry_id(void)
 	return (id < CONFIG_MAX_PT_IRQ_ENTRIES) ? id: INVALID_PTDEV_ENTRY_ID;
 }
 
+/*
+ * The pending entries of a pCPU are a bitmap rather than a list, so that the
+ * interrupt handler and the timer callback only set a bit, with no interrupt
+ * disabling nor contention with SOFTIRQ_PTDEV, which takes all of them at once.
+ * An entry is only pending once however many interrupts it gets.
+ */
 static void ptirq_enqueue_softirq(struct ptirq_remapping_info *entry)
 {
-	uint64_t rflags;
-
-	/* enqueue request in order, SOFTIRQ_PTDEV will pickup */
-	CPU_INT_ALL_DISABLE(&rflags);
+	uint16_t id = entry->ptdev_entry_id;
 
-	/* avoid adding recursively */
-	list_del(&entry->softirq_node);
-	/* TODO: assert if entry already in list */
-	list_add_tail(&entry->softirq_node, &get_cpu_var(softirq_dev_entry_list));
-	CPU_INT_ALL_RESTORE(rflags);
+	/* SOFTIRQ_PTDEV will pickup */
+	bitmap_set_lock(id & 0x3FU, &get_cpu_var(softirq_dev_pending)[id >> 6U]);
 	fire_softirq(SOFTIRQ_PTDEV);
 }
 
@@ -52,29 +72,64 @@ static void ptirq_intr_delay_callback(void *data)
 	ptirq_enqueue_softirq(entry);
 }
 
-struct ptirq_remapping_info *ptirq_dequeue_softirq(uint16_t pcpu_id)
+/* take the next entry of the draining bitmap, refilled from the pending one when empty */
+static uint16_t ptirq_next_pending_id(uint16_t pcpu_id)
 {
-	uint64_t rflags;
-	struct ptirq_remapping_info *entry = NULL;
+	uint64_t *draining = per_cpu(softirq_dev_draining, pcpu_id);
+	uint64_t *pending = per_cpu(softirq_dev_pending, pcpu_id);
+	uint16_t i, bit, id = INVALID_PTDEV_ENTRY_ID;
+	bool refilled = false;
+
+	while (id == INVALID_PTDEV_ENTRY_ID) {
+		for (i = 0U; i < PTIRQ_BITMAP_ARRAY_SIZE; i++) {
+			bit = ffs64(draining[i]);
+			/* ptirq_release_entry() may clear it under us */
+			if ((bit != INVALID_BIT_INDEX) && bitmap_test_and_clear_lock(bit, &draining[i])) {
+				id = (i << 6U) + bit;
+				break;
+			}
+		}
 
-	CPU_INT_ALL_DISABLE(&rflags);
+		if ((id != INVALID_PTDEV_ENTRY_ID) || refilled) {
+			break;
+		}
 
-	while (!list_empty(&get_cpu_var(softirq_dev_entry_list))) {
-		entry = get_first_item(&per_cpu(softirq_dev_entry_list, pcpu_id), struct ptirq_remapping_info, softirq_node);
+		/*
+		 * A bit moved here is out of both bitmaps in between, ptirq_release_entry()
+		 * would miss it: it only releases an entry under the lock.
+		 */
+		spinlock_obtain(&ptdev_lock);
+		for (i = 0U; i < PTIRQ_BITMAP_ARRAY_SIZE; i++) {
+			draining[i] |= atomic_readandclear64(&pending[i]);
+		}
+		spinlock_release(&ptdev_lock);
+		refilled = true;
+	}
 
-		list_del_init(&entry->softirq_node);
+	return id;
+}
+
+struct ptirq_remapping_info *ptirq_dequeue_softirq(uint16_t pcpu_id)
+{
+	struct ptirq_remapping_info *entry = NULL;
+	uint16_t id = ptirq_next_pending_id(pcpu_id);
+
+	while (id != INVALID_PTDEV_ENTRY_ID) {
+		entry = &ptirq_entries[id];
 
 		/* if sos vm, just dequeue, if uos, check delay timer */
-		if (is_sos_vm(entry->vm) || timer_expired(&entry->intr_delay_timer)) {
+		if ((entry->vm != NULL) && (is_sos_vm(entry->vm) || timer_expired(&entry->intr_delay_timer))) {
 			break;
 		} else {
-			/* add it into timer list; dequeue next one */
-			(void)add_timer(&entry->intr_delay_timer);
+			if (entry->vm != NULL) {
+				/* add it into timer list; dequeue next one */
+				(void)add_timer(&entry->intr_delay_timer);
+			}
 			entry = NULL;
+			id = ptirq_next_pending_id(pcpu_id);
 		}
 	}
 
-	CPU_INT_ALL_RESTORE(rflags);
 	return entry;
 }
 
@@ -91,8 +146,6 @@ struct ptirq_remapping_info *ptirq_alloc_entry(struct acrn_vm *vm, uint32_t intr
 		entry->vm = vm;
 		entry->intr_count = 0UL;
 
-		INIT_LIST_HEAD(&entry->softirq_node);
-
 		initialize_timer(&entry->intr_delay_timer, ptirq_intr_delay_callback, entry, 0UL, 0, 0UL);
 
 		entry->active = false;
@@ -103,26 +156,99 @@ struct ptirq_remapping_info *ptirq_alloc_entry(struct acrn_vm *vm, uint32_t intr
 	return entry;
 }
 
+/*
+ * @pre ptdev_lock is held
+ */
 void ptirq_release_entry(struct ptirq_remapping_info *entry)
 {
 	uint64_t rflags;
+	uint16_t id = entry->ptdev_entry_id;
+	uint16_t pcpu_id;
+
+	/* it may be pending on any pCPU which got its interrupt */
+	for (pcpu_id = 0U; pcpu_id < get_pcpu_nums(); pcpu_id++) {
+		bitmap_clear_lock(id & 0x3FU, &per_cpu(softirq_dev_pending, pcpu_id)[id >> 6U]);
+		bitmap_clear_lock(id & 0x3FU, &per_cpu(softirq_dev_draining, pcpu_id)[id >> 6U]);
+	}
 
 	CPU_INT_ALL_DISABLE(&rflags);
-	list_del_init(&entry->softirq_node);
 	del_timer(&entry->intr_delay_timer);
 	CPU_INT_ALL_RESTORE(rflags);
 
-	bitmap_clear_nolock((entry->ptdev_entry_id) & 0x3FU,
-		&ptirq_entry_bitmaps[((entry->ptdev_entry_id) & 0x3FU) >> 6U]);
+	bitmap_clear_lock(id & 0x3FU, &ptirq_entry_bitmaps[id >> 6U]);
 
 	(void)memset((void *)entry, 0U, sizeof(struct ptirq_remapping_info));
 }
 
+int32_t ptirq_set_moderation(struct acrn_vm *vm, uint32_t policy, uint32_t min_us, uint32_t max_us, uint32_t rate)
+{
+	int32_t ret = 0;
+
+	if ((policy > INTR_MOD_THROUGHPUT) || (min_us > max_us)) {
+		ret = -EINVAL;
+	} else {
+		if (rate != 0U) {
+			vm->intr_mod_rate = rate;
+		} else {
+			vm->intr_mod_rate = (policy == INTR_MOD_LATENCY) ? PTIRQ_MOD_LATENCY_RATE : PTIRQ_MOD_THROUGHPUT_RATE;
+		}
+		vm->intr_mod_min_delay = us_to_ticks(min_us);
+		vm->intr_mod_max_delay = us_to_ticks(max_us);
+		vm->intr_mod_policy = policy;
+	}
+
+	return ret;
+}
+
+/*
+ * Delay of the injection of an interrupt of entry. With an adaptive policy,
+ * the interrupts of each window are counted and, at the end of it, the delay
+ * doubles if the rate went over the VM's intr_mod_rate and halves if it went
+ * under half of it, within [intr_mod_min_delay, intr_mod_max_delay].
+ * INTR_MOD_LATENCY has no min delay, it drops it right away once the
+ * storm is over.
+ */
+static uint64_t ptirq_intr_delay(struct ptirq_remapping_info *entry, uint64_t now)
+{
+	const struct acrn_vm *vm = entry->vm;
+	uint64_t delay = entry->mod_delay;
+	uint64_t min_delay = (vm->intr_mod_policy == INTR_MOD_THROUGHPUT) ? vm->intr_mod_min_delay : 0UL;
+
+	if (vm->intr_mod_policy == INTR_MOD_FIXED) {
+		delay = vm->intr_inject_delay_delta;
+	} else {
+		if ((now - entry->mod_window_start) >= us_to_ticks(PTIRQ_MOD_WINDOW_US)) {
+			if (entry->mod_window_count > vm->intr_mod_rate) {
+				if (delay == 0UL) {
+					delay = (vm->intr_mod_min_delay != 0UL) ? vm->intr_mod_min_delay :
+						us_to_ticks(PTIRQ_MOD_STEP_US);
+				} else {
+					delay <<= 1U;
+				}
+			} else if (entry->mod_window_count < (vm->intr_mod_rate >> 1U)) {
+				delay = (vm->intr_mod_policy == INTR_MOD_LATENCY) ? 0UL : (delay >> 1U);
+			} else {
+				/* keep the current delay */
+			}
+			delay = min(delay, vm->intr_mod_max_delay);
+			delay = (delay < min_delay) ? min_delay : delay;
+
+			entry->mod_delay = delay;
+			entry->mod_window_start = now;
+			entry->mod_window_count = 0U;
+		}
+		entry->mod_window_count++;
+	}
+
+	return delay;
+}
+
 /* interrupt context */
 static void ptirq_interrupt_handler(__unused uint32_t irq, void *data)
 {
 	struct ptirq_remapping_info *entry = (struct ptirq_remapping_info *) data;
 	bool to_enqueue = true;
+	uint64_t now, delay;
 
 	/*
 	 * "interrupt storm" detection & delay intr injection just for UOS
@@ -130,15 +256,17 @@ static void ptirq_interrupt_handler(__unused uint32_t irq, void *data)
 	 */
 	if (!is_sos_vm(entry->vm)) {
 		entry->intr_count++;
+		now = rdtsc();
+		delay = ptirq_intr_delay(entry, now);
 
 		/* if delta > 0, set the delay TSC, dequeue to handle */
-		if (entry->vm->intr_inject_delay_delta > 0UL) {
+		if (delay > 0UL) {
 
 			/* if the timer started (entry is in timer-list), not need enqueue again */
 			if (timer_is_started(&entry->intr_delay_timer)) {
 				to_enqueue = false;
 			} else {
-				entry->intr_delay_timer.fire_tsc = rdtsc() + entry->vm->intr_inject_delay_delta;
+				entry->intr_delay_timer.fire_tsc = now + delay;
 			}
 		} else {
 			entry->intr_delay_timer.fire_tsc = 0UL;
@@ -150,6 +278,50 @@ static void ptirq_interrupt_handler(__unused uint32_t irq, void *data)
 	}
 }
 
+/*
+ * An entry of the physical chain of sid may be owned by any VM: the callers
+ * check the owner, and take the entries of SOS over.
+ */
+struct ptirq_remapping_info *ptirq_find_entry(uint32_t intr_type, const union source_id *sid,
+		const struct acrn_vm *vm)
+{
+	struct list_head *chain, *pos;
+	struct ptirq_remapping_info *entry, *entry_found = NULL;
+
+	if (vm == NULL) {
+		chain = ptirq_phys_chain(intr_type, sid);
+		list_for_each(pos, chain) {
+			entry = list_entry(pos, struct ptirq_remapping_info, phys_link);
+			if ((entry->intr_type == intr_type) && (entry->phys_sid.value == sid->value)) {
+				entry_found = entry;
+				break;
+			}
+		}
+	} else {
+		chain = ptirq_virt_chain(intr_type, sid, vm);
+		list_for_each(pos, chain) {
+			entry = list_entry(pos, struct ptirq_remapping_info, virt_link);
+			if ((entry->intr_type == intr_type) && (entry->vm == vm) &&
+					(entry->virt_sid.value == sid->value)) {
+				entry_found = entry;
+				break;
+			}
+		}
+	}
+
+	return entry_found;
+}
+
+void ptirq_change_owner(struct ptirq_remapping_info *entry, struct acrn_vm *vm, const union source_id *virt_sid)
+{
+	list_del(&entry->virt_link);
+	list_del(&entry->vm_link);
+	entry->vm = vm;
+	entry->virt_sid.value = virt_sid->value;
+	list_add(&entry->virt_link, ptirq_virt_chain(entry->intr_type, &entry->virt_sid, vm));
+	list_add_tail(&entry->vm_link, &vm->ptdev_entries);
+}
+
 /* active intr with irq registering */
 int32_t ptirq_activate_entry(struct ptirq_remapping_info *entry, uint32_t phys_irq)
 {
@@ -163,6 +335,9 @@ int32_t ptirq_activate_entry(struct ptirq_remapping_info *entry, uint32_t phys_i
 	} else {
 		entry->allocated_pirq = (uint32_t)retval;
 		entry->active = true;
+		list_add(&entry->phys_link, ptirq_phys_chain(entry->intr_type, &entry->phys_sid));
+		list_add(&entry->virt_link, ptirq_virt_chain(entry->intr_type, &entry->virt_sid, entry->vm));
+		list_add_tail(&entry->vm_link, &entry->vm->ptdev_entries);
 	}
 
 	return retval;
@@ -170,61 +345,64 @@ int32_t ptirq_activate_entry(struct ptirq_remapping_info *entry, uint32_t phys_i
 
 void ptirq_deactivate_entry(struct ptirq_remapping_info *entry)
 {
+	list_del(&entry->phys_link);
+	list_del(&entry->virt_link);
+	list_del(&entry->vm_link);
 	entry->active = false;
 	free_irq(entry->allocated_pirq);
 }
 
 void ptdev_init(void)
 {
+	uint32_t i;
+
 	if (get_pcpu_id() == BOOT_CPU_ID) {
 		spinlock_init(&ptdev_lock);
+		for (i = 0U; i < PTIRQ_HASH_SIZE; i++) {
+			INIT_LIST_HEAD(&ptirq_phys_hash[i]);
+			INIT_LIST_HEAD(&ptirq_virt_hash[i]);
+		}
 		register_softirq(SOFTIRQ_PTDEV, ptirq_softirq);
 	}
-	INIT_LIST_HEAD(&get_cpu_var(softirq_dev_entry_list));
+	(void)memset(get_cpu_var(softirq_dev_pending), 0U, sizeof(get_cpu_var(softirq_dev_pending)));
+	(void)memset(get_cpu_var(softirq_dev_draining), 0U, sizeof(get_cpu_var(softirq_dev_draining)));
 }
 
-void ptdev_release_all_entries(const struct acrn_vm *vm)
+void ptdev_release_all_entries(struct acrn_vm *vm)
 {
 	struct ptirq_remapping_info *entry;
-	uint16_t idx;
-
-	/* VM already down */
-	for (idx = 0U; idx < CONFIG_MAX_PT_IRQ_ENTRIES; idx++) {
-		entry = &ptirq_entries[idx];
-		if ((entry->vm == vm) && is_entry_active(entry)) {
-			spinlock_obtain(&ptdev_lock);
-			if (entry->release_cb != NULL) {
-				entry->release_cb(entry);
-			}
-			ptirq_deactivate_entry(entry);
-			ptirq_release_entry(entry);
-			spinlock_release(&ptdev_lock);
+
+	/* VM already down, each deactivated entry leaves the list */
+	spinlock_obtain(&ptdev_lock);
+	while (!list_empty(&vm->ptdev_entries)) {
+		entry = get_first_item(&vm->ptdev_entries, struct ptirq_remapping_info, vm_link);
+		if (entry->release_cb != NULL) {
+			entry->release_cb(entry);
 		}
+		ptirq_deactivate_entry(entry);
+		ptirq_release_entry(entry);
 	}
-
+	spinlock_release(&ptdev_lock);
 }
 
 uint32_t ptirq_get_intr_data(const struct acrn_vm *target_vm, uint64_t *buffer, uint32_t buffer_cnt)
 {
 	uint32_t index = 0U;
-	uint16_t i;
-	struct ptirq_remapping_info *entry;
+	struct list_head *pos;
+	const struct ptirq_remapping_info *entry;
 
-	for (i = 0U; i < CONFIG_MAX_PT_IRQ_ENTRIES; i++) {
-		entry = &ptirq_entries[i];
-		if (!is_entry_active(entry)) {
-			continue;
-		}
-		if (entry->vm == target_vm) {
-			buffer[index] = entry->allocated_pirq;
-			buffer[index + 1U] = entry->intr_count;
+	spinlock_obtain(&ptdev_lock);
+	list_for_each(pos, &target_vm->ptdev_entries) {
+		entry = list_entry(pos, struct ptirq_remapping_info, vm_link);
+		buffer[index] = entry->allocated_pirq;
+		buffer[index + 1U] = entry->intr_count;
 
-			index += 2U;
-			if (index > (buffer_cnt - 2U)) {
-				break;
-			}
+		index += 2U;
+		if (index > (buffer_cnt - 2U)) {
+			break;
 		}
 	}
+	spinlock_release(&ptdev_lock);
 
 	return index;
 }
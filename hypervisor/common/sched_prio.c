@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <rtl.h>
+#include <list.h>
+#include <cpu.h>
+#include <per_cpu.h>
+#include <timer.h>
+#include <schedule.h>
+
+/*
+ * Priority based, time-sliced scheduler class.
+ *
+ * The runqueue is kept sorted by priority, objects with the same priority
+ * share the pCPU in round robin with a slice of PRIO_SLICE_US. An object
+ * with a non-zero budget may run at most budget_us in each period_us, once
+ * it is depleted it is skipped until its budget is replenished, so that a
+ * high priority object cannot starve the lower priority ones.
+ *
+ * The tick_timer of the sched_context only requests a reschedule, all the
+ * accounting is done in pick_next with the scheduler_lock held.
+ */
+#define PRIO_SLICE_US		1000U
+
+static void sched_prio_tick_handler(__unused void *param)
+{
+	make_reschedule_request(get_pcpu_id(), DEL_MODE_IPI);
+}
+
+static void sched_prio_init(struct sched_context *ctx)
+{
+	initialize_timer(&ctx->tick_timer, sched_prio_tick_handler, ctx, 0UL, TICK_MODE_ONESHOT, 0UL);
+}
+
+static inline bool has_budget(const struct sched_object *obj)
+{
+	return ((obj->params.budget_us == 0U) || (obj->budget_left != 0UL));
+}
+
+static void replenish_budget(struct sched_object *obj, uint64_t now)
+{
+	if ((obj->params.budget_us != 0U) && (now >= obj->period_end)) {
+		obj->budget_left = us_to_ticks(obj->params.budget_us);
+		obj->period_end = now + us_to_ticks(obj->params.period_us);
+	}
+}
+
+/*
+ * Insert obj after the last object whose priority is not lower than the one
+ * of obj, so objects with the same priority are served in FIFO order.
+ */
+static void insert_by_prio(struct sched_context *ctx, struct sched_object *obj)
+{
+	struct list_head *pos, *prev = &ctx->runqueue;
+	struct sched_object *tmp;
+
+	list_for_each(pos, &ctx->runqueue) {
+		tmp = list_entry(pos, struct sched_object, run_list);
+		if (tmp->params.prio >= obj->params.prio) {
+			prev = pos;
+		} else {
+			break;
+		}
+	}
+	list_add(&obj->run_list, prev);
+}
+
+/* Insert obj before the objects with the same priority, see sched_prio_yield() */
+static void insert_ahead_of_peers(struct sched_context *ctx, struct sched_object *obj)
+{
+	struct list_head *pos, *prev = &ctx->runqueue;
+	struct sched_object *tmp;
+
+	list_for_each(pos, &ctx->runqueue) {
+		tmp = list_entry(pos, struct sched_object, run_list);
+		if (tmp->params.prio > obj->params.prio) {
+			prev = pos;
+		} else {
+			break;
+		}
+	}
+	list_add(&obj->run_list, prev);
+}
+
+static void sched_prio_insert(struct sched_context *ctx, struct sched_object *obj)
+{
+	if (list_empty(&obj->run_list)) {
+		replenish_budget(obj, rdtsc());
+		insert_by_prio(ctx, obj);
+	}
+}
+
+static void sched_prio_remove(__unused struct sched_context *ctx, struct sched_object *obj)
+{
+	list_del_init(&obj->run_list);
+}
+
+/* charge the runtime of the current object since it was picked */
+static void charge_curr(struct sched_context *ctx, uint64_t now)
+{
+	struct sched_object *curr = ctx->curr_obj;
+	uint64_t delta = now - ctx->slice_start;
+
+	if ((curr != NULL) && !list_empty(&curr->run_list)) {
+		if (curr->params.budget_us != 0U) {
+			curr->budget_left = (delta < curr->budget_left) ? (curr->budget_left - delta) : 0UL;
+		}
+
+		/* slice used up, let the peers with the same priority run */
+		if (delta >= us_to_ticks(PRIO_SLICE_US)) {
+			list_del_init(&curr->run_list);
+			insert_by_prio(ctx, curr);
+		}
+	}
+}
+
+static void arm_tick_timer(struct sched_context *ctx, uint64_t fire_tsc)
+{
+	del_timer(&ctx->tick_timer);
+	if (fire_tsc != UINT64_MAX) {
+		ctx->tick_timer.fire_tsc = fire_tsc;
+		(void)add_timer(&ctx->tick_timer);
+	}
+}
+
+static struct sched_object *sched_prio_pick_next(struct sched_context *ctx)
+{
+	struct list_head *pos;
+	struct sched_object *obj, *next = NULL;
+	uint64_t now = rdtsc();
+	uint64_t next_event = UINT64_MAX;
+
+	charge_curr(ctx, now);
+
+	list_for_each(pos, &ctx->runqueue) {
+		obj = list_entry(pos, struct sched_object, run_list);
+		replenish_budget(obj, now);
+
+		if (has_budget(obj)) {
+			if (next == NULL) {
+				next = obj;
+				if (obj->params.budget_us != 0U) {
+					next_event = min(next_event, now + obj->budget_left);
+				}
+			} else if (obj->params.prio == next->params.prio) {
+				/* peers are waiting, time slice the pCPU */
+				next_event = min(next_event, now + us_to_ticks(PRIO_SLICE_US));
+			} else {
+				/* lower priority objects never preempt next */
+			}
+		} else {
+			/* a depleted object may get back to run once replenished */
+			next_event = min(next_event, obj->period_end);
+		}
+	}
+
+	ctx->slice_start = now;
+	arm_tick_timer(ctx, next_event);
+
+	return next;
+}
+
+/*
+ * The hint only overtakes its peers, it never gets ahead of an object with a
+ * higher priority than its own.
+ */
+static bool sched_prio_yield(struct sched_context *ctx, struct sched_object *hint)
+{
+	struct sched_object *curr = ctx->curr_obj;
+	bool yielded = false;
+
+	if (!list_empty(&curr->run_list)) {
+		list_del_init(&curr->run_list);
+		insert_by_prio(ctx, curr);
+
+		if ((hint != NULL) && (hint != curr) && !list_empty(&hint->run_list) &&
+				(hint->params.prio == curr->params.prio)) {
+			list_del_init(&hint->run_list);
+			insert_ahead_of_peers(ctx, hint);
+		}
+		yielded = (get_first_item(&ctx->runqueue, struct sched_object, run_list) != curr);
+	}
+
+	return yielded;
+}
+
+struct acrn_scheduler sched_prio = {
+	.name		= "sched_prio",
+	.init		= sched_prio_init,
+	.insert		= sched_prio_insert,
+	.remove		= sched_prio_remove,
+	.pick_next	= sched_prio_pick_next,
+	.yield		= sched_prio_yield,
+};
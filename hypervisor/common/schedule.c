@@ -13,6 +13,58 @@
 #include <schedule.h>
 #include <sprintf.h>
 
+static void sched_fifo_insert(struct sched_context *ctx, struct sched_object *obj)
+{
+	if (list_empty(&obj->run_list)) {
+		list_add_tail(&obj->run_list, &ctx->runqueue);
+	}
+}
+
+static void sched_fifo_remove(__unused struct sched_context *ctx, struct sched_object *obj)
+{
+	list_del_init(&obj->run_list);
+}
+
+static struct sched_object *sched_fifo_pick_next(struct sched_context *ctx)
+{
+	struct sched_object *obj = NULL;
+
+	if (!list_empty(&ctx->runqueue)) {
+		obj = get_first_item(&ctx->runqueue, struct sched_object, run_list);
+	}
+
+	return obj;
+}
+
+static bool sched_fifo_yield(struct sched_context *ctx, struct sched_object *hint)
+{
+	struct sched_object *curr = ctx->curr_obj;
+	bool yielded = false;
+
+	/* curr is on the runqueue together with at least another object */
+	if (!list_empty(&curr->run_list) && (ctx->runqueue.next != ctx->runqueue.prev)) {
+		list_del_init(&curr->run_list);
+		list_add_tail(&curr->run_list, &ctx->runqueue);
+
+		if ((hint != NULL) && (hint != curr) && !list_empty(&hint->run_list)) {
+			list_del_init(&hint->run_list);
+			list_add(&hint->run_list, &ctx->runqueue);
+		}
+		yielded = true;
+	}
+
+	return yielded;
+}
+
+struct acrn_scheduler sched_fifo = {
+	.name		= "sched_fifo",
+	.init		= NULL,
+	.insert		= sched_fifo_insert,
+	.remove		= sched_fifo_remove,
+	.pick_next	= sched_fifo_pick_next,
+	.yield		= sched_fifo_yield,
+};
+
 void init_scheduler(void)
 {
 	struct sched_context *ctx;
@@ -26,42 +78,259 @@ void init_scheduler(void)
 		INIT_LIST_HEAD(&ctx->runqueue);
 		ctx->flags = 0UL;
 		ctx->curr_obj = NULL;
+		ctx->slice_start = 0UL;
+		ctx->nr_switches = 0UL;
+		ctx->idle_tsc = 0UL;
+		ctx->steal_mask = 0UL;
+		ctx->nr_movable = 0U;
+		ctx->nr_migrations = 0UL;
+		initialize_timer(&ctx->tick_timer, NULL, NULL, 0UL, TICK_MODE_ONESHOT, 0UL);
+#ifdef CONFIG_SCHED_PRIO
+		ctx->scheduler = &sched_prio;
+#else
+		ctx->scheduler = &sched_fifo;
+#endif
+		if (ctx->scheduler->init != NULL) {
+			ctx->scheduler->init(ctx);
+		}
 	}
 }
 
+void init_sched_object(struct sched_object *obj, const struct sched_params *params)
+{
+	INIT_LIST_HEAD(&obj->run_list);
+	obj->params = *params;
+	/* a budget without a replenish period makes no sense, treat it as unlimited */
+	if (obj->params.period_us == 0U) {
+		obj->params.budget_us = 0U;
+	}
+	obj->budget_left = 0UL;
+	obj->period_end = 0UL;
+	obj->state_tsc = rdtsc();
+	obj->wait_tsc = 0UL;
+	obj->blocked_tsc = 0UL;
+	obj->pcpu_mask = 0UL;
+	obj->migrate = NULL;
+	obj->migrate_tsc = 0UL;
+}
+
+/*
+ * The scheduler_lock is taken with the interrupts disabled: the softirqs wake
+ * up the vCPUs from the interrupt return path, see wake_vcpu().
+ */
 void get_schedule_lock(uint16_t pcpu_id)
 {
 	struct sched_context *ctx = &per_cpu(sched_ctx, pcpu_id);
+	uint64_t rflags;
+
+	CPU_INT_ALL_DISABLE(&rflags);
 	spinlock_obtain(&ctx->scheduler_lock);
+	ctx->lock_rflags = rflags;
 }
 
 void release_schedule_lock(uint16_t pcpu_id)
 {
 	struct sched_context *ctx = &per_cpu(sched_ctx, pcpu_id);
+	uint64_t rflags = ctx->lock_rflags;
+
 	spinlock_release(&ctx->scheduler_lock);
+	CPU_INT_ALL_RESTORE(rflags);
+}
+
+#ifdef CONFIG_SCHED_MIGRATION
+/*
+ * Work stealing between the pCPUs of the pcpu_mask of the objects: a pCPU
+ * going idle asks a pCPU with objects waiting on its runqueue for one, and
+ * a pCPU queueing an object behind its current one asks on behalf of an
+ * idle pCPU of the object. The object is handed over by the pCPU it waits
+ * on, the last one it ran on, which is the one that can move its state.
+ *
+ * An object stays at least SCHED_MIGRATE_HYSTERESIS_US on a pCPU, so that
+ * the objects don't bounce between pCPUs going busy and idle in turn, and
+ * the one waiting the longest is moved, the one with the coldest cache.
+ */
+#define SCHED_MIGRATE_HYSTERESIS_US	1000U
+
+static uint64_t idle_pcpus;
+
+static inline bool has_waiting_movable(const struct sched_context *ctx)
+{
+	/* the current object is on the runqueue unless it is blocking or idle */
+	return (ctx->nr_movable != 0U) && (ctx->runqueue.next != ctx->runqueue.prev);
 }
 
+/* ask the pCPU pcpu_id for an object for the idle pCPU idle_id */
+static void request_work(uint16_t pcpu_id, uint16_t idle_id)
+{
+	struct sched_context *ctx = &per_cpu(sched_ctx, pcpu_id);
+
+	if (!bitmap_test_and_set_lock(idle_id, &ctx->steal_mask)) {
+		make_reschedule_request(pcpu_id, DEL_MODE_IPI);
+	}
+}
+
+/* called by a pCPU going idle, the runqueues of the others are only peeked at */
+static void steal_work(uint16_t pcpu_id)
+{
+	uint16_t i, victim;
+	uint16_t pcpu_nums = get_pcpu_nums();
+
+	for (i = 1U; i < pcpu_nums; i++) {
+		victim = (pcpu_id + i) % pcpu_nums;
+		if (has_waiting_movable(&per_cpu(sched_ctx, victim))) {
+			request_work(victim, pcpu_id);
+			break;
+		}
+	}
+}
+
+/* the object for the idle pCPU idle_id, with the scheduler_locks of both pCPUs held */
+static struct sched_object *pick_movable(const struct sched_context *ctx, uint16_t idle_id, uint64_t now)
+{
+	struct list_head *pos;
+	struct sched_object *obj, *found = NULL;
+	uint32_t nr_waiting = 0U;
+
+	list_for_each(pos, &ctx->runqueue) {
+		obj = list_entry(pos, struct sched_object, run_list);
+		if (obj != ctx->curr_obj) {
+			nr_waiting++;
+			if ((obj->migrate != NULL) && bitmap_test(idle_id, &obj->pcpu_mask) &&
+					((now - obj->migrate_tsc) >= us_to_ticks(SCHED_MIGRATE_HYSTERESIS_US)) &&
+					((found == NULL) || (obj->state_tsc < found->state_tsc))) {
+				found = obj;
+			}
+		}
+	}
+
+	/* an object is kept for this pCPU if the current one doesn't stay runnable */
+	if ((nr_waiting < 2U) && ((ctx->curr_obj == NULL) || list_empty(&ctx->curr_obj->run_list))) {
+		found = NULL;
+	}
+
+	return found;
+}
+
+static bool give_work(uint16_t pcpu_id, uint16_t idle_id)
+{
+	struct sched_context *ctx = &per_cpu(sched_ctx, pcpu_id);
+	struct sched_context *idle_ctx = &per_cpu(sched_ctx, idle_id);
+	struct sched_object *obj;
+	uint64_t now = rdtsc();
+	bool moved = false;
+
+	/* the only place holding two scheduler_locks, they are taken in the order of the pCPUs */
+	get_schedule_lock(min(pcpu_id, idle_id));
+	get_schedule_lock(max(pcpu_id, idle_id));
+
+	/* the pCPU asking may have found work in the meantime */
+	if (list_empty(&idle_ctx->runqueue)) {
+		obj = pick_movable(ctx, idle_id, now);
+		if ((obj != NULL) && obj->migrate(obj, idle_id)) {
+			/* still waiting, the state and its TSC are kept */
+			ctx->scheduler->remove(ctx, obj);
+			ctx->nr_movable--;
+			idle_ctx->scheduler->insert(idle_ctx, obj);
+			idle_ctx->nr_movable++;
+			obj->migrate_tsc = now;
+			ctx->nr_migrations++;
+			moved = true;
+		}
+	}
+
+	release_schedule_lock(max(pcpu_id, idle_id));
+	release_schedule_lock(min(pcpu_id, idle_id));
+
+	return moved;
+}
+
+/* serve the idle pCPUs which asked this pCPU for work */
+static void serve_steal_requests(uint16_t pcpu_id)
+{
+	struct sched_context *ctx = &per_cpu(sched_ctx, pcpu_id);
+	uint16_t idle_id;
+
+	idle_id = ffs64(ctx->steal_mask);
+	while (idle_id < CONFIG_MAX_PCPU_NUM) {
+		bitmap_clear_lock(idle_id, &ctx->steal_mask);
+		if (give_work(pcpu_id, idle_id)) {
+			make_reschedule_request(idle_id, DEL_MODE_IPI);
+		}
+		idle_id = ffs64(ctx->steal_mask);
+	}
+}
+
+/* called with the scheduler_lock held, as the object queued on the pCPU has to wait */
+static void kick_idle_pcpu(const struct sched_object *obj, uint16_t pcpu_id)
+{
+	uint64_t mask = idle_pcpus & obj->pcpu_mask;
+	uint16_t idle_id;
+
+	bitmap_clear_nolock(pcpu_id, &mask);
+	idle_id = ffs64(mask);
+	if (idle_id < CONFIG_MAX_PCPU_NUM) {
+		/* served in the next schedule() of pcpu_id, the callers request it */
+		bitmap_set_lock(idle_id, &per_cpu(sched_ctx, pcpu_id).steal_mask);
+	}
+}
+
+static void update_idle_pcpus(uint16_t pcpu_id, bool idle)
+{
+	if (idle && !bitmap_test(pcpu_id, &idle_pcpus)) {
+		bitmap_set_lock(pcpu_id, &idle_pcpus);
+		steal_work(pcpu_id);
+	} else if (!idle && bitmap_test(pcpu_id, &idle_pcpus)) {
+		bitmap_clear_lock(pcpu_id, &idle_pcpus);
+	} else {
+		/* no change */
+	}
+}
+#endif
+
 void add_to_cpu_runqueue(struct sched_object *obj, uint16_t pcpu_id)
 {
 	struct sched_context *ctx = &per_cpu(sched_ctx, pcpu_id);
+	uint64_t now;
 
-	if (list_empty(&obj->run_list)) {
-		list_add_tail(&obj->run_list, &ctx->runqueue);
+	if (list_empty(&obj->run_list) && (obj != ctx->curr_obj)) {
+		now = rdtsc();
+		obj->blocked_tsc += now - obj->state_tsc;
+		obj->state_tsc = now;
 	}
+#ifdef CONFIG_SCHED_MIGRATION
+	if (list_empty(&obj->run_list) && (obj->pcpu_mask != 0UL)) {
+		ctx->nr_movable++;
+		if ((ctx->curr_obj != NULL) && (ctx->curr_obj != obj) && (ctx->curr_obj != &per_cpu(idle, pcpu_id))) {
+			kick_idle_pcpu(obj, pcpu_id);
+		}
+	}
+#endif
+	ctx->scheduler->insert(ctx, obj);
 }
 
-void remove_from_cpu_runqueue(struct sched_object *obj)
+void remove_from_cpu_runqueue(struct sched_object *obj, uint16_t pcpu_id)
 {
-	list_del_init(&obj->run_list);
+	struct sched_context *ctx = &per_cpu(sched_ctx, pcpu_id);
+	uint64_t now;
+
+	if (!list_empty(&obj->run_list) && (obj != ctx->curr_obj)) {
+		now = rdtsc();
+		obj->wait_tsc += now - obj->state_tsc;
+		obj->state_tsc = now;
+	}
+#ifdef CONFIG_SCHED_MIGRATION
+	if (!list_empty(&obj->run_list) && (obj->pcpu_mask != 0UL)) {
+		ctx->nr_movable--;
+	}
+#endif
+	ctx->scheduler->remove(ctx, obj);
 }
 
 static struct sched_object *get_next_sched_obj(struct sched_context *ctx)
 {
-	struct sched_object *obj = NULL;
+	struct sched_object *obj = ctx->scheduler->pick_next(ctx);
 
-	if (!list_empty(&ctx->runqueue)) {
-		obj = get_first_item(&ctx->runqueue, struct sched_object, run_list);
-	} else {
+	if (obj == NULL) {
 		obj = &get_cpu_var(idle);
 	}
 
@@ -74,12 +343,25 @@ static struct sched_object *get_next_sched_obj(struct sched_context *ctx)
 void make_reschedule_request(uint16_t pcpu_id, uint16_t delmode)
 {
 	struct sched_context *ctx = &per_cpu(sched_ctx, pcpu_id);
+	bool pending;
 
-	bitmap_set_lock(NEED_RESCHEDULE, &ctx->flags);
+	/*
+	 * The callers modify the runqueue with the scheduler_lock of pcpu_id held
+	 * and schedule() clears NEED_RESCHEDULE with the same lock held, so a
+	 * NEED_RESCHEDULE already pending guarantees the target has been kicked
+	 * and will pick up the change: the notification IPI can be coalesced.
+	 */
+	pending = bitmap_test_and_set_lock(NEED_RESCHEDULE, &ctx->flags);
 	if (get_pcpu_id() != pcpu_id) {
 		switch (delmode) {
 		case DEL_MODE_IPI:
-			send_single_ipi(pcpu_id, VECTOR_NOTIFY_VCPU);
+			/*
+			 * An idle pCPU monitoring ctx->flags with MWAIT is woken up by
+			 * the write to the flags word above, no IPI is required.
+			 */
+			if (!pending && !bitmap_test(SCHED_IDLE_MONITOR, &ctx->flags)) {
+				send_single_ipi(pcpu_id, VECTOR_NOTIFY_VCPU);
+			}
 			break;
 		case DEL_MODE_INIT:
 			send_single_init(pcpu_id);
@@ -91,6 +373,35 @@ void make_reschedule_request(uint16_t pcpu_id, uint16_t delmode)
 	}
 }
 
+/*
+ * make_reschedule_request() with DEL_MODE_IPI for all the pCPUs of pcpu_mask,
+ * the ones to notify share a single multicast IPI. The runqueues may have
+ * been modified with the scheduler_lock released already: the target that
+ * runs schedule() in between just finds NEED_RESCHEDULE set once more.
+ */
+void make_reschedule_request_mask(uint64_t pcpu_mask)
+{
+	struct sched_context *ctx;
+	uint64_t mask = pcpu_mask;
+	uint32_t ipi_mask = 0U;
+	uint16_t pcpu_id;
+
+	pcpu_id = ffs64(mask);
+	while (pcpu_id < CONFIG_MAX_PCPU_NUM) {
+		bitmap_clear_nolock(pcpu_id, &mask);
+		ctx = &per_cpu(sched_ctx, pcpu_id);
+		if (!bitmap_test_and_set_lock(NEED_RESCHEDULE, &ctx->flags) && (get_pcpu_id() != pcpu_id) &&
+				!bitmap_test(SCHED_IDLE_MONITOR, &ctx->flags)) {
+			bitmap32_set_nolock(pcpu_id, &ipi_mask);
+		}
+		pcpu_id = ffs64(mask);
+	}
+
+	if (ipi_mask != 0U) {
+		send_dest_ipi_mask(ipi_mask, VECTOR_NOTIFY_VCPU);
+	}
+}
+
 bool need_reschedule(uint16_t pcpu_id)
 {
 	struct sched_context *ctx = &per_cpu(sched_ctx, pcpu_id);
@@ -98,6 +409,59 @@ bool need_reschedule(uint16_t pcpu_id)
 	return bitmap_test(NEED_RESCHEDULE, &ctx->flags);
 }
 
+/*
+ * Let the objects sharing the pCPU with the current one run first, hint, if
+ * not NULL, is a runnable object of this pCPU to run next. The switch is left
+ * to the next schedule() of the current object.
+ *
+ * @return true if another object is going to run first.
+ */
+bool yield_current(struct sched_object *hint)
+{
+	uint16_t pcpu_id = get_pcpu_id();
+	struct sched_context *ctx = &per_cpu(sched_ctx, pcpu_id);
+	bool yielded = false;
+
+	get_schedule_lock(pcpu_id);
+	if (ctx->scheduler->yield != NULL) {
+		yielded = ctx->scheduler->yield(ctx, hint);
+	}
+	if (yielded) {
+		make_reschedule_request(pcpu_id, DEL_MODE_IPI);
+	}
+	release_schedule_lock(pcpu_id);
+
+	return yielded;
+}
+
+/* whether obj is the only object on the runqueue of pcpu_id, as a hint without the lock */
+bool is_sole_runnable(const struct sched_object *obj, uint16_t pcpu_id)
+{
+	const struct sched_context *ctx = &per_cpu(sched_ctx, pcpu_id);
+
+	return (ctx->runqueue.next == &obj->run_list) && (ctx->runqueue.prev == &obj->run_list);
+}
+
+/* called with the scheduler_lock held, prev in the state it is left in */
+static void account_switch(struct sched_context *ctx, struct sched_object *prev, struct sched_object *next)
+{
+	uint64_t now = rdtsc();
+
+	ctx->nr_switches++;
+	if (prev != NULL) {
+		if (prev == &get_cpu_var(idle)) {
+			ctx->idle_tsc += now - prev->state_tsc;
+		}
+		prev->state_tsc = now;
+	}
+
+	/* idle is the only object picked off the runqueue */
+	if (!list_empty(&next->run_list)) {
+		next->wait_tsc += now - next->state_tsc;
+	}
+	next->state_tsc = now;
+}
+
 static void prepare_switch(struct sched_object *prev, struct sched_object *next)
 {
 	if ((prev != NULL) && (prev->prepare_switch_out != NULL)) {
@@ -119,13 +483,23 @@ void schedule(void)
 	struct sched_object *next = NULL;
 	struct sched_object *prev = ctx->curr_obj;
 
+#ifdef CONFIG_SCHED_MIGRATION
+	if (ctx->steal_mask != 0UL) {
+		serve_steal_requests(pcpu_id);
+	}
+#endif
+
 	get_schedule_lock(pcpu_id);
 	next = get_next_sched_obj(ctx);
 	bitmap_clear_lock(NEED_RESCHEDULE, &ctx->flags);
+#ifdef CONFIG_SCHED_MIGRATION
+	update_idle_pcpus(pcpu_id, next == &get_cpu_var(idle));
+#endif
 
 	if (prev == next) {
 		release_schedule_lock(pcpu_id);
 	} else {
+		account_switch(ctx, prev, next);
 		prepare_switch(prev, next);
 		release_schedule_lock(pcpu_id);
 
@@ -150,9 +524,11 @@ void switch_to_idle(run_thread_t idle_thread)
 
 	snprintf(idle_name, 16U, "idle%hu", pcpu_id);
 	(void)strncpy_s(idle->name, 16U, idle_name, 16U);
+	INIT_LIST_HEAD(&idle->run_list);
 	idle->thread = idle_thread;
 	idle->prepare_switch_out = NULL;
 	idle->prepare_switch_in = NULL;
+	idle->state_tsc = rdtsc();
 	get_cpu_var(sched_ctx).curr_obj = idle;
 
 	run_sched_thread(idle);
@@ -8,6 +8,9 @@
 #include <bits.h>
 #include <cpu.h>
 #include <per_cpu.h>
+#include <timer.h>
+#include <lapic.h>
+#include <irq.h>
 #include <softirq.h>
 
 static softirq_handler softirq_handlers[NR_SOFTIRQS];
@@ -32,16 +35,30 @@ void fire_softirq(uint16_t nr)
 	bitmap_set_lock(nr, &per_cpu(softirq_pending, get_pcpu_id()));
 }
 
+/*
+ * One round takes the whole pending word at once, each softirq pending then
+ * runs once. A softirq with more work than its budget fires itself again,
+ * that work waits for the next round.
+ */
 static void do_softirq_internal(uint16_t cpu_id)
 {
-	volatile uint64_t *softirq_pending_bitmap =
-			&per_cpu(softirq_pending, cpu_id);
-	uint16_t nr = ffs64(*softirq_pending_bitmap);
+	struct softirq_stats *stats = &per_cpu(softirq_stats, cpu_id);
+	uint64_t pending = atomic_readandclear64(&per_cpu(softirq_pending, cpu_id));
+	uint64_t start, cycles;
+	uint16_t nr = ffs64(pending);
 
 	while (nr < NR_SOFTIRQS) {
-		bitmap_clear_lock(nr, softirq_pending_bitmap);
+		bitmap_clear_nolock(nr, &pending);
+		start = rdtsc();
 		(*softirq_handlers[nr])(cpu_id);
-		nr = ffs64(*softirq_pending_bitmap);
+		cycles = rdtsc() - start;
+
+		stats->runs[nr]++;
+		stats->tsc[nr] += cycles;
+		if (cycles > stats->max_tsc[nr]) {
+			stats->max_tsc[nr] = cycles;
+		}
+		nr = ffs64(pending);
 	}
 }
 
@@ -61,5 +78,13 @@ void do_softirq(void)
 
 		do_softirq_internal(cpu_id);
 		per_cpu(softirq_servicing, cpu_id) = 0U;
+
+		/*
+		 * The work left over by the budgets is not run before the VM entry,
+		 * the notification brings the pCPU back for it right after.
+		 */
+		if (per_cpu(softirq_pending, cpu_id) != 0UL) {
+			send_single_ipi(cpu_id, VECTOR_NOTIFY_VCPU);
+		}
 	}
 }
@@ -14,27 +14,192 @@
 #include <acrn_hv_defs.h>
 #include <vm.h>
 #include <console.h>
+#include <spinlock.h>
+#include <per_cpu.h>
+#include <sprintf.h>
 
 struct hv_timer console_timer;
+static struct hv_timer console_tx_timer;
 
 #define CONSOLE_KICK_TIMER_TIMEOUT  40UL /* timeout is 40ms*/
+/* a FIFO of a 16550 takes 1ms at 115200 baud */
+#define CONSOLE_TX_TIMER_TIMEOUT    1UL
 /* Switching key combinations for shell and uart console */
 #define GUEST_CONSOLE_TO_HV_SWITCH_KEY      0       /* CTRL + SPACE */
 uint16_t console_vmid = ACRN_INVALID_VMID;
 
+/*
+ * Once the console timer runs, the output of each pcpu goes to its ring,
+ * the UART FIFO is filled from the rings by the BSP, on the console timer
+ * and console_tx_timer while they are not empty. When a ring is full, its
+ * oldest messages are dropped, and a note of how many goes out in their
+ * place.
+ */
+#define CONSOLE_RING_SIZE	4096U
+#define CONSOLE_NOTE_SIZE	48U
+
+struct console_ring {
+	spinlock_t lock;
+	uint32_t head;		/* free running, where the next char goes */
+	uint32_t tail;		/* free running, the next char to the UART */
+	uint32_t dropped;	/* messages dropped, not told yet */
+	char buf[CONSOLE_RING_SIZE];
+};
+
+static struct console_ring console_rings[CONFIG_MAX_PCPU_NUM];
+static volatile bool console_buffered;
+static uint16_t console_tx_pcpu;
+static char console_note[CONSOLE_NOTE_SIZE];
+static uint32_t console_note_pos, console_note_len;
+
 void console_init(void)
 {
+	uint16_t i;
+
+	for (i = 0U; i < CONFIG_MAX_PCPU_NUM; i++) {
+		spinlock_init(&console_rings[i].lock);
+	}
+}
+
+/* drop the oldest message, up to its '\n' */
+static void console_ring_drop(struct console_ring *ring)
+{
+	char c;
+
+	do {
+		c = ring->buf[ring->tail % CONSOLE_RING_SIZE];
+		ring->tail++;
+	} while ((c != '\n') && (ring->tail != ring->head));
+	ring->dropped++;
+}
+
+static void console_ring_put(struct console_ring *ring, const char *s_arg, size_t len_arg)
+{
+	const char *s = s_arg;
+	uint32_t len = (uint32_t)len_arg, pos, n;
+
+	if (len > CONSOLE_RING_SIZE) {
+		s += len - CONSOLE_RING_SIZE;
+		len = CONSOLE_RING_SIZE;
+	}
+
+	while ((CONSOLE_RING_SIZE - (ring->head - ring->tail)) < len) {
+		console_ring_drop(ring);
+	}
+
+	pos = ring->head % CONSOLE_RING_SIZE;
+	n = min(len, CONSOLE_RING_SIZE - pos);
+	(void)memcpy_s(ring->buf + pos, n, s, n);
+	if (n < len) {
+		(void)memcpy_s(ring->buf, len - n, s + n, len - n);
+	}
+	ring->head += len;
+}
+
+/*
+ * Fill the UART FIFO from the rings, a ring until it is empty, then the
+ * next one. Returns true if output is left. It runs on the BSP, but on a
+ * fatal error.
+ */
+static bool console_drain(void)
+{
+	struct console_ring *ring;
+	uint64_t rflags;
+	uint32_t pos, len, n, empty = 0U;
+	bool left = false;
+
+	while (!left && (empty < CONFIG_MAX_PCPU_NUM)) {
+		if (console_note_len != 0U) {
+			n = (uint32_t)uart16550_write_fifo(console_note + console_note_pos,
+					console_note_len - console_note_pos);
+			console_note_pos += n;
+			if (console_note_pos < console_note_len) {
+				left = true;
+			} else {
+				console_note_len = 0U;
+			}
+			continue;
+		}
+
+		ring = &console_rings[console_tx_pcpu];
+		spinlock_irqsave_obtain(&ring->lock, &rflags);
+		if (ring->dropped != 0U) {
+			snprintf(console_note, CONSOLE_NOTE_SIZE, "\n[%u console messages dropped]\n", ring->dropped);
+			console_note_len = (uint32_t)strnlen_s(console_note, CONSOLE_NOTE_SIZE);
+			console_note_pos = 0U;
+			ring->dropped = 0U;
+			empty = 0U;
+		} else if (ring->head == ring->tail) {
+			console_tx_pcpu = (console_tx_pcpu + 1U) % CONFIG_MAX_PCPU_NUM;
+			empty++;
+		} else {
+			pos = ring->tail % CONSOLE_RING_SIZE;
+			len = min(ring->head - ring->tail, CONSOLE_RING_SIZE - pos);
+			n = (uint32_t)uart16550_write_fifo(ring->buf + pos, len);
+			ring->tail += n;
+			left = (n < len);
+			empty = 0U;
+		}
+		spinlock_irqrestore_release(&ring->lock, rflags);
+	}
+
+	return left;
+}
+
+static void console_tx_timer_callback(__unused void *data);
+
+/* on the BSP, in the console timers */
+static void console_kick_tx(void)
+{
+	uint64_t period_in_cycle;
+
+	if (console_drain() && !timer_is_started(&console_tx_timer)) {
+		period_in_cycle = CYCLES_PER_MS * CONSOLE_TX_TIMER_TIMEOUT;
+		initialize_timer(&console_tx_timer, console_tx_timer_callback, NULL,
+				rdtsc() + period_in_cycle, TICK_MODE_ONESHOT, 0UL);
+		(void)add_timer(&console_tx_timer);
+	}
+}
+
+static void console_tx_timer_callback(__unused void *data)
+{
+	console_kick_tx();
+}
+
+/*
+ * Back to writing to the UART right away, all the output of the rings
+ * first: on a fatal error, and when the console timer stops.
+ */
+void console_flush(void)
+{
+	console_buffered = false;
+	while (console_drain()) {
+		asm_pause();
+	}
 }
 
 void console_putc(const char *ch)
 {
-	(void)uart16550_puts(ch, 1U);
+	(void)console_write(ch, 1U);
 }
 
 
 size_t console_write(const char *s, size_t len)
 {
-	return  uart16550_puts(s, len);
+	struct console_ring *ring;
+	uint64_t rflags;
+	size_t ret = len;
+
+	if (console_buffered) {
+		ring = &console_rings[get_pcpu_id()];
+		spinlock_irqsave_obtain(&ring->lock, &rflags);
+		console_ring_put(ring, s, len);
+		spinlock_irqrestore_release(&ring->lock, rflags);
+	} else {
+		ret = uart16550_puts(s, (uint32_t)len);
+	}
+
+	return ret;
 }
 
 char console_getc(void)
@@ -118,6 +283,9 @@ static void console_timer_callback(__unused void *data)
 	} else {
 		shell_kick();
 	}
+
+	/* Console output, and the one of the shell */
+	console_kick_tx();
 }
 
 void console_setup_timer(void)
@@ -133,12 +301,16 @@ void console_setup_timer(void)
 	/* Start an periodic timer */
 	if (add_timer(&console_timer) != 0) {
 		pr_err("Failed to add console kick timer");
+	} else {
+		console_buffered = true;
 	}
 }
 
 void suspend_console(void)
 {
 	del_timer(&console_timer);
+	del_timer(&console_tx_timer);
+	console_flush();
 }
 
 void resume_console(void)
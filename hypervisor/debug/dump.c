@@ -13,6 +13,8 @@
 #include <init.h>
 #include <logmsg.h>
 #include <dump.h>
+#include <console.h>
+#include <npk_log.h>
 
 #define CALL_TRACE_HIERARCHY_MAX    20U
 #define DUMP_STACK_SIZE 0x200U
@@ -241,6 +243,8 @@ void asm_assert(int32_t line, const char *file, const char *txt)
 	uint64_t rsp = cpu_rsp_get();
 	uint64_t rbp = cpu_rbp_get();
 
+	console_flush();
+	npk_log_flush();
 	pr_acrnlog("Assertion failed in file %s,line %d : %s",
 			file, line, txt);
 	show_host_call_trace(rsp, rbp, pcpu_id);
@@ -290,6 +294,8 @@ void dump_intr_excp_frame(const struct intr_excp_ctx *ctx)
 
 void dump_exception(struct intr_excp_ctx *ctx, uint16_t pcpu_id)
 {
+	console_flush();
+	npk_log_flush();
 	/* Dump host context */
 	dump_intr_excp_frame(ctx);
 	/* Show host stack */
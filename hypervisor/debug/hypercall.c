@@ -12,6 +12,7 @@
 #include <npk_log.h>
 #include <vm.h>
 #include <logmsg.h>
+#include <trace.h>
 
 #ifdef PROFILING_ON
 /**
@@ -57,6 +58,9 @@ static int32_t hcall_profiling_ops(struct acrn_vm *vm, uint64_t cmd, uint64_t pa
 	case PROFILING_GET_STATUS:
 		ret = profiling_get_status_info(vm, param);
 		break;
+	case PROFILING_CONFIG_SAMPLING:
+		ret = profiling_config_sampling(vm, param);
+		break;
 	default:
 		pr_err("%s: invalid profiling command %llu\n", __func__, cmd);
 		ret = -1;
@@ -153,7 +157,41 @@ static int32_t hcall_get_hw_info(struct acrn_vm *vm, uint64_t param)
 }
 
 /**
-  * @brief Setup hypervisor debug infrastructure, such as share buffer, NPK log and profiling.
+ * @brief Setup the trace filter of a pcpu, or of all of them
+ *
+ * @param vm Pointer to vm data structure
+ * @param param Guest physical address pointing to struct acrn_trace_filter
+ *
+ * @pre vm shall point to SOS_VM
+ *
+ * @retval 0 on success
+ * @retval -1 in case of error
+ */
+static int32_t hcall_setup_trace_filter(struct acrn_vm *vm, uint64_t param)
+{
+	struct acrn_trace_filter filter;
+	uint16_t pcpu_id;
+	int32_t ret = -1;
+
+	if (copy_from_gpa(vm, &filter, param, sizeof(filter)) != 0) {
+		pr_err("%s: Unable copy param from vm\n", __func__);
+	} else if ((filter.nr_events > ACRN_TRACE_FILTER_MAX) ||
+			((filter.pcpu_id >= get_pcpu_nums()) && (filter.pcpu_id != ACRN_TRACE_FILTER_ALL_CPUS))) {
+		pr_err("%s: Invalid trace filter\n", __func__);
+	} else {
+		for (pcpu_id = 0U; pcpu_id < get_pcpu_nums(); pcpu_id++) {
+			if ((filter.pcpu_id == pcpu_id) || (filter.pcpu_id == ACRN_TRACE_FILTER_ALL_CPUS)) {
+				trace_set_filter(pcpu_id, &filter);
+			}
+		}
+		ret = 0;
+	}
+
+	return ret;
+}
+
+/**
+  * @brief Setup hypervisor debug infrastructure, such as share buffer, NPK log, trace filter and profiling.
   *
   * @param vm Pointer to VM data structure
   * @param param1 hypercall param1 from guest
@@ -185,6 +223,10 @@ int32_t hcall_debug(struct acrn_vm *vm, uint64_t param1, uint64_t param2, uint64
 		ret = hcall_get_hw_info(vm, param1);
 		break;
 
+	case HC_SETUP_TRACE_FILTER:
+		ret = hcall_setup_trace_filter(vm, param1);
+		break;
+
 	default:
 		pr_err("op %d: Invalid hypercall\n", hypcall_id);
 		ret = -EPERM;
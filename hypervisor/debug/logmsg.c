@@ -11,6 +11,7 @@
 #include <per_cpu.h>
 #include <npk_log.h>
 #include <logmsg.h>
+#include <reloc.h>
 
 /* buf size should be identical to the size in hvlog option, which is
  * transfered to SOS:
@@ -31,19 +32,141 @@ void init_logmsg(uint32_t flags)
 	logmsg_ctl.seq = 0;
 }
 
+/*
+ * With LOG_FLAG_BINARY, the messages go to the SOS ACRN log and to NPK unformatted:
+ * the header, then the args of the format string, a little endian
+ * uint64_t each but a length byte and the chars for a %s. A message takes
+ * whole log entries, acrnlog formats it with the format string it reads
+ * at fmt in the hypervisor image.
+ */
+#define LOG_BIN_TAG		0x01U	/* never the first char of a text message */
+#define LOG_BIN_HDR_SIZE	24U
+
+struct log_bin_hdr {
+	uint8_t tag;
+	uint8_t nr_entries;
+	uint8_t severity;
+	uint8_t cpu;
+	uint32_t seq;
+	uint64_t usec;
+	uint64_t fmt;		/* link address of the format string */
+};
+
+static uint32_t log_bin_put(uint8_t *buf, uint32_t pos, uint64_t v)
+{
+	uint32_t next = LOG_MESSAGE_MAX_SIZE;
+
+	if ((pos + 8U) <= LOG_MESSAGE_MAX_SIZE) {
+		(void)memcpy_s(buf + pos, 8U, &v, 8U);
+		next = pos + 8U;
+	}
+
+	return next;
+}
+
+/* Store the args of fmt at pos, parsed as vsnprintf() does */
+static uint32_t log_bin_args(uint8_t *buf, uint32_t pos_arg, const char *fmt_arg, va_list args)
+{
+	const char *fmt = fmt_arg;
+	const char *str;
+	uint32_t pos = pos_arg, len;
+	bool is_long;
+	char ch;
+
+	while ((*fmt != '\0') && (pos < LOG_MESSAGE_MAX_SIZE)) {
+		ch = *fmt;
+		fmt++;
+		if (ch == '%') {
+			/* flags, width, precision and length modifier */
+			while ((*fmt == '#') || (*fmt == '-') || (*fmt == ' ') || (*fmt == '+') ||
+					(*fmt == '.') || ((*fmt >= '0') && (*fmt <= '9'))) {
+				fmt++;
+			}
+			while (*fmt == 'h') {
+				fmt++;
+			}
+			is_long = (*fmt == 'l');
+			while (*fmt == 'l') {
+				fmt++;
+			}
+			ch = *fmt;
+			if (ch != '\0') {
+				fmt++;
+			}
+
+			if ((ch == 'd') || (ch == 'i')) {
+				if (is_long) {
+					pos = log_bin_put(buf, pos, (uint64_t)__builtin_va_arg(args, int64_t));
+				} else {
+					pos = log_bin_put(buf, pos, (uint64_t)(int64_t)__builtin_va_arg(args, int32_t));
+				}
+			} else if ((ch == 'u') || (ch == 'x') || (ch == 'X')) {
+				if (is_long) {
+					pos = log_bin_put(buf, pos, __builtin_va_arg(args, uint64_t));
+				} else {
+					pos = log_bin_put(buf, pos, (uint64_t)__builtin_va_arg(args, uint32_t));
+				}
+			} else if (ch == 'c') {
+				pos = log_bin_put(buf, pos, (uint64_t)__builtin_va_arg(args, int32_t) & 0xffUL);
+			} else if (ch == 's') {
+				str = __builtin_va_arg(args, const char *);
+				if (str == NULL) {
+					str = "(null)";
+				}
+				len = (uint32_t)strnlen_s(str, 255U);
+				if ((pos + 1U + len) > LOG_MESSAGE_MAX_SIZE) {
+					len = LOG_MESSAGE_MAX_SIZE - pos - 1U;
+				}
+				buf[pos] = (uint8_t)len;
+				(void)memcpy_s(buf + pos + 1U, len, str, len);
+				pos += 1U + len;
+			} else {
+				/* %% and the specs vsnprintf() does not know take no arg */
+			}
+		}
+	}
+
+	return pos;
+}
+
+/* A binary message in the logbuf of the pcpu, return its length in bytes */
+static uint32_t log_bin_msg(uint16_t pcpu_id, uint32_t severity, uint64_t usec, uint32_t seq,
+		const char *fmt, va_list args)
+{
+	uint8_t *buf = (uint8_t *)per_cpu(logbuf, pcpu_id);
+	struct log_bin_hdr hdr;
+	uint32_t len;
+
+	len = log_bin_args(buf, LOG_BIN_HDR_SIZE, fmt, args);
+
+	hdr.tag = (uint8_t)LOG_BIN_TAG;
+	hdr.nr_entries = (uint8_t)(((len - 1U) / LOG_ENTRY_SIZE) + 1U);
+	hdr.severity = (uint8_t)severity;
+	hdr.cpu = (uint8_t)pcpu_id;
+	hdr.seq = seq;
+	hdr.usec = usec;
+	hdr.fmt = (uint64_t)fmt - get_hv_image_delta();
+	(void)memcpy_s(buf, LOG_BIN_HDR_SIZE, &hdr, LOG_BIN_HDR_SIZE);
+
+	return (uint32_t)hdr.nr_entries * LOG_ENTRY_SIZE;
+}
+
 void do_logmsg(uint32_t severity, const char *fmt, ...)
 {
 	va_list args;
 	uint64_t timestamp, rflags;
 	uint16_t pcpu_id;
+	uint32_t seq, msg_len, bin_len = 0U;
 	bool do_console_log;
 	bool do_mem_log;
 	bool do_npk_log;
+	bool do_bin_log;
 	char *buffer;
 
 	do_console_log = (((logmsg_ctl.flags & LOG_FLAG_STDOUT) != 0U) && (severity <= console_loglevel));
 	do_mem_log = (((logmsg_ctl.flags & LOG_FLAG_MEMORY) != 0U) && (severity <= mem_loglevel));
 	do_npk_log = ((logmsg_ctl.flags & LOG_FLAG_NPK) != 0U && (severity <= npk_loglevel));
+	do_bin_log = ((do_mem_log || do_npk_log) && ((logmsg_ctl.flags & LOG_FLAG_BINARY) != 0U));
 
 	if (!do_console_log && !do_mem_log && !do_npk_log) {
 		return;
@@ -58,22 +181,25 @@ void do_logmsg(uint32_t severity, const char *fmt, ...)
 	/* Get CPU ID */
 	pcpu_id = get_pcpu_id();
 	buffer = per_cpu(logbuf, pcpu_id);
-
-	(void)memset(buffer, 0U, LOG_MESSAGE_MAX_SIZE);
-	/* Put time-stamp, CPU ID and severity into buffer */
-	snprintf(buffer, LOG_MESSAGE_MAX_SIZE, "[%lluus][cpu=%hu][sev=%u][seq=%u]:",
-			timestamp, pcpu_id, severity, atomic_inc_return(&logmsg_ctl.seq));
-
-	/* Put message into remaining portion of local buffer */
-	va_start(args, fmt);
-	vsnprintf(buffer + strnlen_s(buffer, LOG_MESSAGE_MAX_SIZE),
-		LOG_MESSAGE_MAX_SIZE
-		- strnlen_s(buffer, LOG_MESSAGE_MAX_SIZE), fmt, args);
-	va_end(args);
+	seq = (uint32_t)atomic_inc_return(&logmsg_ctl.seq);
+
+	/* the text is only needed by the consoles, with a binary log */
+	if (do_console_log || !do_bin_log) {
+		/* Put time-stamp, CPU ID and severity into buffer */
+		snprintf(buffer, LOG_MESSAGE_MAX_SIZE, "[%lluus][cpu=%hu][sev=%u][seq=%u]:",
+				timestamp, pcpu_id, severity, seq);
+
+		/* Put message into remaining portion of local buffer */
+		va_start(args, fmt);
+		vsnprintf(buffer + strnlen_s(buffer, LOG_MESSAGE_MAX_SIZE),
+			LOG_MESSAGE_MAX_SIZE
+			- strnlen_s(buffer, LOG_MESSAGE_MAX_SIZE), fmt, args);
+		va_end(args);
+	}
 
 	/* Check if flags specify to output to NPK */
-	if (do_npk_log) {
-		npk_log_write(buffer, strnlen_s(buffer, LOG_MESSAGE_MAX_SIZE));
+	if (do_npk_log && !do_bin_log) {
+		npk_log_write(buffer, strnlen_s(buffer, LOG_MESSAGE_MAX_SIZE), false);
 	}
 
 	/* Check if flags specify to output to stdout */
@@ -86,19 +212,41 @@ void do_logmsg(uint32_t severity, const char *fmt, ...)
 		spinlock_irqrestore_release(&(logmsg_ctl.lock), rflags);
 	}
 
+	/* the binary message replaces the text in the logbuf */
+	if (do_bin_log) {
+		va_start(args, fmt);
+		bin_len = log_bin_msg(pcpu_id, severity, timestamp, seq, fmt, args);
+		va_end(args);
+
+		if (do_npk_log) {
+			npk_log_write(buffer, bin_len, true);
+		}
+	}
+
+	/* the batched NPK messages go out with an error */
+	if (do_npk_log && (severity <= LOG_ERROR)) {
+		npk_log_flush();
+	}
+
 	/* Check if flags specify to output to memory */
 	if (do_mem_log) {
-		uint32_t i, msg_len;
+		struct sbuf_rsv rsv;
 		struct shared_buf *sbuf = per_cpu(sbuf, pcpu_id)[ACRN_HVLOG];
 
 		/* If sbuf is not ready, we just drop the massage */
 		if (sbuf != NULL) {
-			msg_len = strnlen_s(buffer, LOG_MESSAGE_MAX_SIZE);
+			if (do_bin_log) {
+				msg_len = bin_len;
+			} else {
+				msg_len = strnlen_s(buffer, LOG_MESSAGE_MAX_SIZE);
+
+				/* all the entries of the message at once, or none */
+				msg_len = (((msg_len - 1U) / LOG_ENTRY_SIZE) + 1U) * LOG_ENTRY_SIZE;
+			}
 
-			for (i = 0U; i < (((msg_len - 1U) / LOG_ENTRY_SIZE) + 1U);
-					i++) {
-				(void)sbuf_put(sbuf, (uint8_t *)buffer +
-							(i * LOG_ENTRY_SIZE));
+			if (sbuf_reserve(sbuf, msg_len, &rsv) != 0U) {
+				sbuf_rsv_write(&rsv, 0U, buffer, msg_len);
+				sbuf_commit(sbuf, &rsv);
 			}
 		}
 	}
@@ -9,6 +9,8 @@
 #include <io.h>
 #include <per_cpu.h>
 #include <mmu.h>
+#include <cpu.h>
+#include <softirq.h>
 #include <logmsg.h>
 #include <npk_log.h>
 
@@ -21,6 +23,23 @@ static uint64_t base;
 
 #define HV_NPK_LOG_MAX 1024U
 #define HV_NPK_LOG_HDR 0x01000242U
+#define HV_NPK_LOG_BIN_HDR 0x01000246U	/* raw, the binary messages of LOG_FLAG_BINARY */
+
+/*
+ * The messages of a pCPU are batched, and a batch goes out as one record from
+ * the NPK softirq, at the end of the VM exit or of the idle loop that logged
+ * them: the header, length and flag stores are paid once a batch, and the
+ * messages are written to Dn in 64-bit stores. The text messages of a record
+ * are separated by newlines, the binary ones take whole log entries as in the
+ * memory log. npk_log_flush() writes out the batch at once, for the errors.
+ */
+struct npk_log_batch {
+	uint64_t data[HV_NPK_LOG_MAX / 8U];
+	uint32_t len;
+	bool binary;
+};
+
+static struct npk_log_batch npk_batch[CONFIG_MAX_PCPU_NUM];
 
 enum {
 	HV_NPK_LOG_CMD_INVALID = 0U,
@@ -72,6 +91,49 @@ static inline int32_t npk_write(const char *value, void *addr, size_t sz)
 	return ret;
 }
 
+/* @pre: irq disabled */
+static void npk_log_flush_batch(uint16_t cpu_id)
+{
+	struct npk_log_batch *batch = &npk_batch[cpu_id];
+	struct npk_chan *channel = (struct npk_chan *)base;
+	const char *p, *end;
+	uint32_t i, ref;
+	int32_t sz;
+
+	if (npk_log_enabled && (channel != NULL) && (batch->len != 0U)) {
+		/* calculate the channel offset based on cpu_id and npk_log_ref */
+		ref = (atomic_inc_return((int32_t *)&per_cpu(npk_log_ref, cpu_id)) - 1)
+			& HV_NPK_LOG_REF_MASK;
+		channel += ((uint32_t)cpu_id << HV_NPK_LOG_REF_SHIFT) + ref;
+		mmio_write32(batch->binary ? HV_NPK_LOG_BIN_HDR : HV_NPK_LOG_HDR, &(channel->DnTS));
+		mmio_write16((uint16_t)batch->len, &(channel->Dn));
+
+		for (i = 0U; i < (batch->len >> 3U); i++) {
+			mmio_write64(batch->data[i], &(channel->Dn));
+		}
+
+		p = (const char *)&batch->data[i];
+		end = (const char *)batch->data + batch->len;
+		for (sz = 0; sz >= 0; p += sz) {
+			sz = npk_write(p, &(channel->Dn), end - p);
+		}
+
+		mmio_write8(0U, &(channel->FLAG));
+
+		atomic_dec32(&per_cpu(npk_log_ref, cpu_id));
+	}
+	batch->len = 0U;
+}
+
+static void npk_log_softirq(uint16_t cpu_id)
+{
+	uint64_t rflags;
+
+	CPU_INT_ALL_DISABLE(&rflags);
+	npk_log_flush_batch(cpu_id);
+	CPU_INT_ALL_RESTORE(rflags);
+}
+
 void npk_log_setup(struct hv_npk_log_param *param)
 {
 	uint16_t i;
@@ -108,6 +170,7 @@ void npk_log_setup(struct hv_npk_log_param *param)
 					pcpu_nums * (HV_NPK_LOG_REF_MASK + 1U)
 					* sizeof(struct npk_chan));
 			}
+			register_softirq(SOFTIRQ_NPK, npk_log_softirq);
 			param->res = HV_NPK_LOG_RES_OK;
 			npk_log_enabled = 1;
 		}
@@ -132,31 +195,42 @@ out:
 	atomic_dec32((uint32_t *)&npk_log_setup_ref);
 }
 
-void npk_log_write(const char *buf, size_t buf_len)
+void npk_log_write(const char *buf, size_t buf_len, bool binary)
 {
-	uint32_t cpu_id = get_pcpu_id();
-	struct npk_chan *channel = (struct npk_chan *)base;
-	const char *p = buf;
-	int32_t sz;
-	uint32_t ref;
-	uint16_t len;
-
-	if (!npk_log_enabled || (channel == NULL)) {
-		return;
-	}
+	uint16_t cpu_id = get_pcpu_id();
+	struct npk_log_batch *batch = &npk_batch[cpu_id];
+	char *data = (char *)batch->data;
+	uint32_t len = (uint32_t)(min(buf_len, HV_NPK_LOG_MAX - 1U));
+	uint64_t rflags;
+
+	if (npk_log_enabled && (base != 0UL)) {
+		CPU_INT_ALL_DISABLE(&rflags);
+		if ((batch->len != 0U) && ((batch->binary != binary)
+				|| ((batch->len + len + 1U) > HV_NPK_LOG_MAX))) {
+			npk_log_flush_batch(cpu_id);
+		}
 
-	/* calculate the channel offset based on cpu_id and npk_log_ref */
-	ref = (atomic_inc_return((int32_t *)&per_cpu(npk_log_ref, cpu_id)) - 1)
-		& HV_NPK_LOG_REF_MASK;
-	channel += (cpu_id << HV_NPK_LOG_REF_SHIFT) + ref;
-	len = (uint16_t)(min(buf_len, HV_NPK_LOG_MAX));
-	mmio_write32(HV_NPK_LOG_HDR, &(channel->DnTS));
-	mmio_write16(len, &(channel->Dn));
+		if (batch->len == 0U) {
+			batch->binary = binary;
+			fire_softirq(SOFTIRQ_NPK);
+		} else if (!binary) {
+			data[batch->len] = '\n';
+			batch->len++;
+		} else {
+			/* the binary messages need no separator */
+		}
 
-	for (sz = 0; sz >= 0; p += sz)
-		sz = npk_write(p, &(channel->Dn), buf + len - p);
+		(void)memcpy_s(data + batch->len, HV_NPK_LOG_MAX - batch->len, buf, len);
+		batch->len += len;
+		CPU_INT_ALL_RESTORE(rflags);
+	}
+}
 
-	mmio_write8(0U, &(channel->FLAG));
+void npk_log_flush(void)
+{
+	uint64_t rflags;
 
-	atomic_dec32(&per_cpu(npk_log_ref, cpu_id));
+	CPU_INT_ALL_DISABLE(&rflags);
+	npk_log_flush_batch(get_pcpu_id());
+	CPU_INT_ALL_RESTORE(rflags);
 }
@@ -15,6 +15,7 @@
 #include <vm.h>
 #include <sprintf.h>
 #include <logmsg.h>
+#include <trace.h>
 
 #define ACRN_DBG_PROFILING		5U
 #define ACRN_ERR_PROFILING		3U
@@ -28,9 +29,18 @@
 #define LVT_PERFCTR_BIT_MASK		0x10000U
 #define VALID_DEBUGCTL_BIT_MASK		0x1801U
 
+#define PERFEVTSEL_USR			(1UL << 16U)
+#define PERFEVTSEL_OS			(1UL << 17U)
+#define PERFEVTSEL_INT			(1UL << 20U)
+#define PERFEVTSEL_EN			(1UL << 22U)
+#define PMC0_OVF_BIT			(1UL << 0U)
+#define SAMPLING_MAX_PERIOD		0x7FFFFFFFUL
+
 static uint64_t sep_collection_switch;
 static uint64_t socwatch_collection_switch;
 static bool in_pmu_profiling;
+static bool in_sampling;
+static struct profiling_sampling sampling_config;
 
 static uint32_t profiling_pmi_irq = IRQ_INVALID;
 
@@ -224,86 +234,14 @@ static void profiling_disable_pmu(void)
 	}
 }
 
-/*
- * Writes specified size of data into sbuf
- */
-static int32_t profiling_sbuf_put_variable(struct shared_buf *sbuf,
-					uint8_t *data, uint32_t size)
-{
-	uint32_t remaining_space, offset, next_tail;
-	void *to;
-
-	/*
-	 * 1. check for null pointers and non-zero size
-	 * 2. check if enough room available in the buffer
-	 *     2a. if not, drop the sample, increment count of dropped samples,
-	 *         return
-	 *     2b. unless overwrite flag is enabled
-	 * 3. Continue if buffer has space for the sample
-	 * 4. Copy sample to buffer
-	 *     4a. Split variable sample to be copied if the sample is going to
-	 *         wrap around the buffer
-	 *     4b. Otherwise do a simple copy
-	 * 5. return number of bytes of data put in buffer
-	 */
-
-	if ((sbuf == NULL) || (data == NULL)) {
-		return -EINVAL;
-	}
-
-	if (size == 0U) {
-		return 0;
-	}
-
-	stac();
-	if (sbuf->tail >= sbuf->head) {
-		remaining_space = sbuf->size - (sbuf->tail - sbuf->head);
-	} else {
-		remaining_space = sbuf->head - sbuf->tail;
-	}
-
-	if (size >= remaining_space) {
-		/* Only (remaining_space - 1) can be written to sbuf.
-		 * Since if the next_tail equals head, then it is assumed
-		 * that buffer is empty, not full
-		 */
-		clac();
-		return 0;
-	}
-
-	next_tail = sbuf_next_ptr(sbuf->tail, size, sbuf->size);
-
-	to = (void *)sbuf + SBUF_HEAD_SIZE + sbuf->tail;
-
-	if (next_tail < sbuf->tail) { /* wrap-around */
-		offset = sbuf->size - sbuf->tail;
-		(void)memcpy_s(to, offset, data, offset);
-
-		/* 2nd part */
-		to = (void *)sbuf + SBUF_HEAD_SIZE;
-
-		if ((size - offset) > 0U) {
-			(void)memcpy_s(to, size - offset,
-				data + offset, size - offset);
-		}
-	} else {
-		(void)memcpy_s(to, size, data, size);
-	}
-
-	sbuf->tail = next_tail;
-	clac();
-
-	return (int32_t)size;
-}
-
 /*
  * Read profiling data and transferred to SOS
  * Drop transfer of profiling data if sbuf is full/insufficient and log it
  */
 static int32_t profiling_generate_data(int32_t collector, uint32_t type)
 {
-	uint64_t i;
-	uint32_t remaining_space = 0U;
+	uint32_t hdr_len, len;
+	struct sbuf_rsv rsv;
 	int32_t 	ret = 0;
 	struct data_header pkt_header;
 	uint64_t payload_size = 0UL;
@@ -329,15 +267,6 @@ static int32_t profiling_generate_data(int32_t collector, uint32_t type)
 		}
 
 		if (ss->pmu_state == PMU_RUNNING) {
-			stac();
-			if (sbuf->tail >= sbuf->head) {
-				remaining_space = sbuf->size
-						- (sbuf->tail - sbuf->head);
-			} else {
-				remaining_space = sbuf->head - sbuf->tail;
-			}
-			clac();
-
 			/* populate the data header */
 			pkt_header.tsc = rdtsc();
 			pkt_header.collector_id = collector;
@@ -370,22 +299,20 @@ static int32_t profiling_generate_data(int32_t collector, uint32_t type)
 			}
 			pkt_header.payload_size = payload_size;
 
-			if ((uint64_t)remaining_space < (DATA_HEADER_SIZE + payload_size)) {
+			/* the header and the payload each take whole entries */
+			hdr_len = (uint32_t)((((DATA_HEADER_SIZE - 1U) / SEP_BUF_ENTRY_SIZE) + 1U) * SEP_BUF_ENTRY_SIZE);
+			len = (uint32_t)((((payload_size - 1U) / SEP_BUF_ENTRY_SIZE) + 1U) * SEP_BUF_ENTRY_SIZE);
+			if (sbuf_reserve(sbuf, hdr_len + len, &rsv) == 0U) {
 				ss->samples_dropped++;
 				dev_dbg(ACRN_DBG_PROFILING,
-				"%s: not enough space left in sbuf[%d: %d] exiting cpu%d",
-				__func__, remaining_space,
-				DATA_HEADER_SIZE + payload_size, get_pcpu_id());
+				"%s: not enough space left in sbuf for %d exiting cpu%d",
+				__func__, hdr_len + len, get_pcpu_id());
 				return 0;
 			}
 
-			for (i = 0U; i < (((DATA_HEADER_SIZE - 1U) / SEP_BUF_ENTRY_SIZE) + 1U); i++) {
-				(void)sbuf_put(sbuf, (uint8_t *)&pkt_header + i * SEP_BUF_ENTRY_SIZE);
-			}
-
-			for (i = 0U; i < (((payload_size - 1U) / SEP_BUF_ENTRY_SIZE) + 1U); i++) {
-				(void)sbuf_put(sbuf, (uint8_t *)payload + i * SEP_BUF_ENTRY_SIZE);
-			}
+			sbuf_rsv_write(&rsv, 0U, &pkt_header, (uint32_t)DATA_HEADER_SIZE);
+			sbuf_rsv_write(&rsv, hdr_len, payload, (uint32_t)payload_size);
+			sbuf_commit(sbuf, &rsv);
 
 			ss->samples_logged++;
 		}
@@ -401,14 +328,6 @@ static int32_t profiling_generate_data(int32_t collector, uint32_t type)
 
 		sw_lock = &(get_cpu_var(profiling_info.sw_lock));
 		spinlock_irqsave_obtain(sw_lock, &rflags);
-		stac();
-		if (sbuf->tail >= sbuf->head) {
-			remaining_space
-				= sbuf->size - (sbuf->tail - sbuf->head);
-		} else {
-			remaining_space = sbuf->head - sbuf->tail;
-		}
-		clac();
 
 		/* populate the data header */
 		pkt_header.tsc = rdtsc();
@@ -445,18 +364,19 @@ static int32_t profiling_generate_data(int32_t collector, uint32_t type)
 		}
 		pkt_header.payload_size = payload_size;
 
-		if ((DATA_HEADER_SIZE + payload_size) >= (uint64_t)remaining_space) {
+		len = (uint32_t)(DATA_HEADER_SIZE + payload_size);
+		if (sbuf_reserve(sbuf, len, &rsv) == 0U) {
+			spinlock_irqrestore_release(sw_lock, rflags);
 			pr_err("%s: not enough space in socwatch buffer on cpu %d",
 				__func__, get_pcpu_id());
 			return 0;
 		}
-		/* copy header */
-		(void)profiling_sbuf_put_variable(sbuf,
-			(uint8_t *)&pkt_header, (uint32_t)DATA_HEADER_SIZE);
-
-		/* copy payload */
-		(void)profiling_sbuf_put_variable(sbuf,
-			(uint8_t *)payload, (uint32_t)payload_size);
+		/* the header, then the payload */
+		sbuf_rsv_write(&rsv, 0U, &pkt_header, (uint32_t)DATA_HEADER_SIZE);
+		if (payload_size > 0UL) {
+			sbuf_rsv_write(&rsv, (uint32_t)DATA_HEADER_SIZE, payload, (uint32_t)payload_size);
+		}
+		sbuf_commit(sbuf, &rsv);
 
 		spinlock_irqrestore_release(sw_lock, rflags);
 	} else {
@@ -571,6 +491,80 @@ static void profiling_handle_msrops(void)
 /*
  * Interrupt handler for performance monitoring interrupts
  */
+/*
+ * Log a sample of the built-in sampling, the PMI hit in non-root mode if
+ * it made the VM exit, see profiling_pre_vmexit_handler().
+ */
+static void profiling_sampling_pmi(uint32_t irq)
+{
+	struct guest_vm_info *info = &get_cpu_var(profiling_info.vm_info);
+	uint64_t status, rip, cr3;
+	uint16_t vm_id;
+
+	msr_write(MSR_IA32_PERF_GLOBAL_CTRL, 0UL);
+	status = msr_read(MSR_IA32_PERF_GLOBAL_STATUS);
+	if ((status & PMC0_OVF_BIT) != 0UL) {
+		if ((info->vmexit_reason == VMX_EXIT_REASON_EXTERNAL_INTERRUPT) &&
+				((uint64_t)info->external_vector == VECTOR_PMI)) {
+			vm_id = info->guest_vm_id;
+			rip = info->guest_rip;
+			cr3 = info->guest_cr3;
+			info->vmexit_reason = 0UL;
+			info->external_vector = -1;
+		} else {
+			vm_id = PROFILING_SAMPLE_HV;
+			rip = irq_desc_array[irq].ctx_rip;
+			cr3 = 0UL;
+		}
+
+		/* the VM id goes in the PCID bits of CR3 */
+		if ((sampling_config.vm_id == PROFILING_SAMPLE_ALL_VMS) || (sampling_config.vm_id == vm_id)) {
+			TRACE_2L(TRACE_PMU_SAMPLE, rip, (cr3 & PAGE_MASK) | (uint64_t)vm_id);
+		}
+
+		msr_write(MSR_IA32_PERF_GLOBAL_OVF_CTRL, PMC0_OVF_BIT);
+		msr_write(MSR_IA32_PMC0, 0UL - sampling_config.period);
+	}
+
+	/* the PMI masks the LVT entry */
+	msr_write(MSR_IA32_EXT_APIC_LVT_PMI, VECTOR_PMI);
+	msr_write(MSR_IA32_PERF_GLOBAL_CTRL, PMC0_OVF_BIT);
+}
+
+static void profiling_sampling_start(void)
+{
+	msr_write(MSR_IA32_PERF_GLOBAL_CTRL, 0UL);
+	msr_write(MSR_IA32_PERFEVTSEL0, 0UL);
+	/* a write to PMC0 sign-extends bit 31, the period is below 2^31 */
+	msr_write(MSR_IA32_PMC0, 0UL - sampling_config.period);
+	msr_write(MSR_IA32_PERFEVTSEL0, ((uint64_t)sampling_config.event & 0xFFFFUL) |
+			PERFEVTSEL_USR | PERFEVTSEL_OS | PERFEVTSEL_INT | PERFEVTSEL_EN);
+	msr_write(MSR_IA32_PERF_GLOBAL_OVF_CTRL, PMC0_OVF_BIT);
+	get_cpu_var(profiling_info.sampling_on) = true;
+	msr_write(MSR_IA32_EXT_APIC_LVT_PMI, VECTOR_PMI);
+	msr_write(MSR_IA32_PERF_GLOBAL_CTRL, PMC0_OVF_BIT);
+}
+
+static void profiling_sampling_stop(void)
+{
+	msr_write(MSR_IA32_PERF_GLOBAL_CTRL, 0UL);
+	msr_write(MSR_IA32_PERFEVTSEL0, 0UL);
+	msr_write(MSR_IA32_EXT_APIC_LVT_PMI, VECTOR_PMI | LVT_PERFCTR_BIT_MASK);
+	msr_write(MSR_IA32_PERF_GLOBAL_OVF_CTRL, PMC0_OVF_BIT);
+	get_cpu_var(profiling_info.sampling_on) = false;
+}
+
+static void profiling_sampling_ipi(ipi_commands cmd)
+{
+	uint16_t i;
+	uint16_t pcpu_nums = get_pcpu_nums();
+
+	for (i = 0U; i < pcpu_nums; i++) {
+		per_cpu(profiling_info.ipi_cmd, i) = cmd;
+	}
+	smp_call_function(get_active_pcpu_bitmap(), profiling_ipi_handler, NULL);
+}
+
 static void profiling_pmi_handler(uint32_t irq, __unused void *data)
 {
 	uint64_t perf_ovf_status;
@@ -586,6 +580,10 @@ static void profiling_pmi_handler(uint32_t irq, __unused void *data)
 			__func__, get_pcpu_id());
 		return;
 	}
+	if (get_cpu_var(profiling_info.sampling_on)) {
+		profiling_sampling_pmi(irq);
+		return;
+	}
 	/* Stop all the counters first */
 	msr_write(MSR_IA32_PERF_GLOBAL_CTRL, 0x0U);
 
@@ -728,7 +726,7 @@ static void profiling_start_pmu(void)
 
 	dev_dbg(ACRN_DBG_PROFILING, "%s: entering", __func__);
 
-	if (in_pmu_profiling) {
+	if (in_pmu_profiling || in_sampling) {
 		return;
 	}
 
@@ -1285,6 +1283,45 @@ int32_t profiling_get_status_info(struct acrn_vm *vm, uint64_t gpa)
 	return 0;
 }
 
+/*
+ * Start, reconfigure or stop the built-in sampling on all cpus
+ */
+int32_t profiling_config_sampling(struct acrn_vm *vm, uint64_t addr)
+{
+	struct profiling_sampling cfg;
+	int32_t ret = 0;
+
+	dev_dbg(ACRN_DBG_PROFILING, "%s: entering", __func__);
+
+	if (copy_from_gpa(vm, &cfg, addr, sizeof(cfg)) != 0) {
+		pr_err("%s: Unable to copy addr from vm\n", __func__);
+		ret = -EINVAL;
+	} else if (cfg.enable == 0U) {
+		if (in_sampling) {
+			profiling_sampling_ipi(IPI_SAMPLING_STOP);
+			in_sampling = false;
+		}
+	} else if (in_pmu_profiling) {
+		/* the PMU belongs to the external collector */
+		ret = -EBUSY;
+	} else if ((cfg.period == 0UL) || (cfg.period > SAMPLING_MAX_PERIOD)) {
+		ret = -EINVAL;
+	} else {
+		if (in_sampling) {
+			profiling_sampling_ipi(IPI_SAMPLING_STOP);
+		}
+		sampling_config = cfg;
+		profiling_sampling_ipi(IPI_SAMPLING_START);
+		in_sampling = true;
+		pr_acrnlog("profiling: sampling event 0x%x every %llu for vm 0x%x",
+			cfg.event, cfg.period, cfg.vm_id);
+	}
+
+	dev_dbg(ACRN_DBG_PROFILING, "%s: exiting", __func__);
+
+	return ret;
+}
+
 /*
  * IPI interrupt handler function
  */
@@ -1306,6 +1343,12 @@ void profiling_ipi_handler(__unused void *data)
 	case IPI_VMSW_CONFIG:
 		profiling_initialize_vmsw();
 		break;
+	case IPI_SAMPLING_START:
+		profiling_sampling_start();
+		break;
+	case IPI_SAMPLING_STOP:
+		profiling_sampling_stop();
+		break;
 	default:
 		pr_err("%s: unknown IPI command %d on cpu %d",
 		__func__, get_cpu_var(profiling_info.ipi_cmd), get_pcpu_id());
@@ -1340,7 +1383,8 @@ void profiling_pre_vmexit_handler(struct acrn_vcpu *vcpu)
 	exit_reason = vcpu->arch.exit_reason & 0xFFFFUL;
 
 	if ((get_cpu_var(profiling_info.s_state).pmu_state == PMU_RUNNING) ||
-		(get_cpu_var(profiling_info.soc_state) == SW_RUNNING)) {
+		(get_cpu_var(profiling_info.soc_state) == SW_RUNNING) ||
+		get_cpu_var(profiling_info.sampling_on)) {
 
 		get_cpu_var(profiling_info.vm_info).vmexit_tsc = rdtsc();
 		get_cpu_var(profiling_info.vm_info).vmexit_reason
@@ -1360,6 +1404,9 @@ void profiling_pre_vmexit_handler(struct acrn_vcpu *vcpu)
 		get_cpu_var(profiling_info.vm_info).guest_cs
 			= exec_vmread64(VMX_GUEST_CS_SEL);
 
+		get_cpu_var(profiling_info.vm_info).guest_cr3
+			= exec_vmread(VMX_GUEST_CR3);
+
 		get_cpu_var(profiling_info.vm_info).guest_vm_id = (int16_t)vcpu->vm->vm_id;
 	}
 }
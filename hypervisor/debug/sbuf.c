@@ -14,6 +14,8 @@
 #include <errno.h>
 #include <cpu.h>
 #include <per_cpu.h>
+#include <softirq.h>
+#include <vmx_io.h>
 
 uint32_t sbuf_next_ptr(uint32_t pos_arg,
 		uint32_t span, uint32_t scope)
@@ -44,39 +46,119 @@ uint32_t sbuf_next_ptr(uint32_t pos_arg,
 
 uint32_t sbuf_put(struct shared_buf *sbuf, uint8_t *data)
 {
-	void *to;
-	uint32_t next_tail;
+	struct sbuf_rsv rsv;
 	uint32_t ele_size;
-	bool trigger_overwrite = false;
 
 	stac();
-	next_tail = sbuf_next_ptr(sbuf->tail, sbuf->ele_size, sbuf->size);
-	/* if this write would trigger overrun */
-	if (next_tail == sbuf->head) {
-		/* accumulate overrun count if necessary */
-		sbuf->overrun_cnt += sbuf->flags & OVERRUN_CNT_EN;
-		if ((sbuf->flags & OVERWRITE_EN) == 0U) {
-			/* if not enable over write, return here. */
-			clac();
-			return 0;
+	ele_size = sbuf->ele_size;
+	clac();
+
+	if (sbuf_reserve(sbuf, ele_size, &rsv) != 0U) {
+		sbuf_rsv_write(&rsv, 0U, data, ele_size);
+		sbuf_commit(sbuf, &rsv);
+	} else {
+		ele_size = 0U;
+	}
+
+	return ele_size;
+}
+
+/*
+ * As for sbuf_put(), one element is always left free, so head == tail
+ * still means empty. With OVERWRITE_EN, the oldest elements are dropped
+ * until the reservation fits.
+ */
+uint32_t sbuf_reserve(struct shared_buf *sbuf, uint32_t len, struct sbuf_rsv *rsv)
+{
+	uint32_t used, head, tail, size, ele_size;
+	uint32_t ret = 0U;
+
+	stac();
+	head = sbuf->head;
+	tail = sbuf->tail;
+	size = sbuf->size;
+	ele_size = sbuf->ele_size;
+
+	if ((len != 0U) && (ele_size != 0U) && (len <= (size - ele_size))) {
+		used = (tail >= head) ? (tail - head) : (size - (head - tail));
+		if ((used + len) > (size - ele_size)) {
+			/* accumulate overrun count if necessary */
+			sbuf->overrun_cnt += sbuf->flags & OVERRUN_CNT_EN;
+			if ((sbuf->flags & OVERWRITE_EN) != 0U) {
+				while ((used + len) > (size - ele_size)) {
+					head = sbuf_next_ptr(head, ele_size, size);
+					used -= ele_size;
+				}
+				ret = len;
+			}
+		} else {
+			ret = len;
+		}
+	}
+
+	if (ret != 0U) {
+		rsv->buf = (uint8_t *)sbuf + SBUF_HEAD_SIZE + tail;
+		rsv->buf_len = ((size - tail) < len) ? (size - tail) : len;
+		rsv->wrap = (rsv->buf_len < len) ? ((uint8_t *)sbuf + SBUF_HEAD_SIZE) : NULL;
+		rsv->len = len;
+		rsv->next_head = head;
+		rsv->next_tail = sbuf_next_ptr(tail, len, size);
+	} else {
+		clac();
+	}
+
+	return ret;
+}
+
+void sbuf_rsv_write(const struct sbuf_rsv *rsv, uint32_t offset, const void *data, uint32_t len)
+{
+	const uint8_t *from = (const uint8_t *)data;
+	uint32_t n;
+
+	if (offset < rsv->buf_len) {
+		n = ((rsv->buf_len - offset) < len) ? (rsv->buf_len - offset) : len;
+		(void)memcpy_s(rsv->buf + offset, n, from, n);
+		if (n < len) {
+			(void)memcpy_s(rsv->wrap, len - n, from + n, len - n);
 		}
-		trigger_overwrite = true;
+	} else {
+		(void)memcpy_s(rsv->wrap + (offset - rsv->buf_len), len, from, len);
 	}
+}
+
+static inline uint32_t sbuf_used(uint32_t head, uint32_t tail, uint32_t size)
+{
+	return (tail >= head) ? (tail - head) : (size - (head - tail));
+}
 
-	to = (void *)sbuf + SBUF_HEAD_SIZE + sbuf->tail;
+void sbuf_commit(struct shared_buf *sbuf, const struct sbuf_rsv *rsv)
+{
+	uint32_t size = sbuf->size;
+	uint32_t watermark = sbuf->watermark;
+	uint32_t used = sbuf_used(sbuf->head, sbuf->tail, size);
 
-	(void)memcpy_s(to, sbuf->ele_size, data, sbuf->ele_size);
+	/* the data before the new tail, for the consumer */
+	cpu_write_memory_barrier();
+	sbuf->head = rsv->next_head;
+	sbuf->tail = rsv->next_tail;
+	clac();
 
-	if (trigger_overwrite) {
-		sbuf->head = sbuf_next_ptr(sbuf->head,
-				sbuf->ele_size, sbuf->size);
+	/* only on the crossing, the consumer drains below it again */
+	if ((watermark != 0U) && (used < watermark) &&
+			(sbuf_used(rsv->next_head, rsv->next_tail, size) >= watermark)) {
+		fire_softirq(SOFTIRQ_SBUF);
 	}
-	sbuf->tail = next_tail;
+}
 
-	ele_size = sbuf->ele_size;
+void sbuf_cancel(__unused const struct sbuf_rsv *rsv)
+{
 	clac();
+}
 
-	return ele_size;
+/* Not in the context of the producer, which can be vlapic code */
+static void sbuf_softirq(__unused uint16_t cpu_id)
+{
+	arch_fire_vhm_interrupt();
 }
 
 int32_t sbuf_share_setup(uint16_t pcpu_id, uint32_t sbuf_id, uint64_t *hva)
@@ -85,6 +167,7 @@ int32_t sbuf_share_setup(uint16_t pcpu_id, uint32_t sbuf_id, uint64_t *hva)
 		return -EINVAL;
 	}
 
+	register_softirq(SOFTIRQ_SBUF, sbuf_softirq);
 	per_cpu(sbuf, pcpu_id)[sbuf_id] = (struct shared_buf *) hva;
 	pr_info("%s share sbuf for pCPU[%u] with sbuf_id[%u] setup successfully",
 			__func__, pcpu_id, sbuf_id);
@@ -16,10 +16,13 @@
 #include <ioapic.h>
 #include <ptdev.h>
 #include <vm.h>
+#include <pgtable.h>
 #include <sprintf.h>
 #include <logmsg.h>
 #include <version.h>
 #include <shell.h>
+#include <cat.h>
+#include <hypercall.h>
 
 #define TEMP_STR_SIZE		60U
 #define MAX_STR_SIZE		256U
@@ -43,12 +46,18 @@ static int32_t shell_to_vm_console(int32_t argc, char **argv);
 static int32_t shell_show_cpu_int(__unused int32_t argc, __unused char **argv);
 static int32_t shell_show_ptdev_info(__unused int32_t argc, __unused char **argv);
 static int32_t shell_show_vioapic_info(int32_t argc, char **argv);
+static int32_t shell_show_vmexit_stats(int32_t argc, char **argv);
+static int32_t shell_show_ept_stats(int32_t argc, char **argv);
+static int32_t shell_show_ioreq_stats(int32_t argc, char **argv);
+static int32_t shell_show_rdt_stats(__unused int32_t argc, __unused char **argv);
 static int32_t shell_show_ioapic_info(__unused int32_t argc, __unused char **argv);
 static int32_t shell_loglevel(int32_t argc, char **argv);
 static int32_t shell_cpuid(int32_t argc, char **argv);
 static int32_t shell_trigger_crash(int32_t argc, char **argv);
 static int32_t shell_rdmsr(int32_t argc, char **argv);
 static int32_t shell_wrmsr(int32_t argc, char **argv);
+static int32_t shell_lockstat(int32_t argc, char **argv);
+static int32_t shell_show_hcall_stats(__unused int32_t argc, __unused char **argv);
 
 static struct shell_cmd shell_cmds[] = {
 	{
@@ -111,6 +120,30 @@ static struct shell_cmd shell_cmds[] = {
 		.help_str	= SHELL_CMD_VIOAPIC_HELP,
 		.fcn		= shell_show_vioapic_info,
 	},
+	{
+		.str		= SHELL_CMD_VMEXIT,
+		.cmd_param	= SHELL_CMD_VMEXIT_PARAM,
+		.help_str	= SHELL_CMD_VMEXIT_HELP,
+		.fcn		= shell_show_vmexit_stats,
+	},
+	{
+		.str		= SHELL_CMD_VM_EPT,
+		.cmd_param	= SHELL_CMD_VM_EPT_PARAM,
+		.help_str	= SHELL_CMD_VM_EPT_HELP,
+		.fcn		= shell_show_ept_stats,
+	},
+	{
+		.str		= SHELL_CMD_VM_IOREQ,
+		.cmd_param	= SHELL_CMD_VM_IOREQ_PARAM,
+		.help_str	= SHELL_CMD_VM_IOREQ_HELP,
+		.fcn		= shell_show_ioreq_stats,
+	},
+	{
+		.str		= SHELL_CMD_RDT,
+		.cmd_param	= SHELL_CMD_RDT_PARAM,
+		.help_str	= SHELL_CMD_RDT_HELP,
+		.fcn		= shell_show_rdt_stats,
+	},
 	{
 		.str		= SHELL_CMD_IOAPIC,
 		.cmd_param	= SHELL_CMD_IOAPIC_PARAM,
@@ -147,6 +180,18 @@ static struct shell_cmd shell_cmds[] = {
 		.help_str	= SHELL_CMD_WRMSR_HELP,
 		.fcn		= shell_wrmsr,
 	},
+	{
+		.str		= SHELL_CMD_LOCKSTAT,
+		.cmd_param	= SHELL_CMD_LOCKSTAT_PARAM,
+		.help_str	= SHELL_CMD_LOCKSTAT_HELP,
+		.fcn		= shell_lockstat,
+	},
+	{
+		.str		= SHELL_CMD_HCALL,
+		.cmd_param	= SHELL_CMD_HCALL_PARAM,
+		.help_str	= SHELL_CMD_HCALL_HELP,
+		.fcn		= shell_show_hcall_stats,
+	},
 };
 
 /* The initial log level*/
@@ -1157,6 +1202,191 @@ static int32_t shell_show_vioapic_info(int32_t argc, char **argv)
 	return -EINVAL;
 }
 
+/* upper bound of the histogram bucket reached by percent of the exits */
+static uint64_t vmexit_hist_percentile(const uint32_t *hist, uint64_t count, uint64_t percent)
+{
+	uint64_t sum = 0UL, threshold = ((count * percent) + 99UL) / 100UL;
+	uint32_t bucket;
+
+	for (bucket = 0U; bucket < (VMEXIT_STATS_BUCKETS - 1U); bucket++) {
+		sum += hist[bucket];
+		if (sum >= threshold) {
+			break;
+		}
+	}
+
+	return (1UL << (bucket + 1U));
+}
+
+static int32_t shell_show_vmexit_stats(int32_t argc, char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	struct acrn_vm *vm;
+	struct acrn_vcpu *vcpu;
+	const struct vmexit_stats *stats;
+	uint64_t count;
+	uint16_t i, reason;
+	int32_t ret;
+
+	/* User input invalidation */
+	if (argc != 2) {
+		return -EINVAL;
+	}
+	ret = strtol_deci(argv[1]);
+	if (ret < 0) {
+		return -EINVAL;
+	}
+
+	vm = get_vm_from_vmid(sanitize_vmid((uint16_t)ret));
+	if (is_poweroff_vm(vm)) {
+		shell_puts("No vm found in the input <vm_id>\r\n");
+		return -EINVAL;
+	}
+
+	shell_puts("\r\nLatency in TSC cycles, P50/P99/MAX are log2 bucket upper bounds"
+		"\r\nVCPU ID    REASON    COUNT         AVG         P50         P99         MAX"
+		"\r\n=======    ======    =====         ===         ===         ===         ===\r\n");
+
+	foreach_vcpu(i, vm, vcpu) {
+		stats = &vcpu->arch.exit_stats;
+		for (reason = 0U; reason < VMEXIT_STATS_REASONS; reason++) {
+			count = stats->count[reason];
+			if (count == 0UL) {
+				continue;
+			}
+			snprintf(temp_str, MAX_STR_SIZE, "  %-8hu %-9hu %-13llu %-11llu %-11llu %-11llu %-11llu\r\n",
+				vcpu->vcpu_id, reason, count, stats->cycles[reason] / count,
+				vmexit_hist_percentile(stats->hist[reason], count, 50UL),
+				vmexit_hist_percentile(stats->hist[reason], count, 99UL),
+				vmexit_hist_percentile(stats->hist[reason], count, 100UL));
+			shell_puts(temp_str);
+		}
+	}
+
+	return 0;
+}
+
+static int32_t shell_show_ept_stats(int32_t argc, char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	struct acrn_vm *vm;
+	struct pgtable_page_stats stats;
+	uint64_t large_size, total_size;
+	int32_t ret;
+
+	/* User input invalidation */
+	if (argc != 2) {
+		return -EINVAL;
+	}
+	ret = strtol_deci(argv[1]);
+	if (ret < 0) {
+		return -EINVAL;
+	}
+
+	vm = get_vm_from_vmid(sanitize_vmid((uint16_t)ret));
+	if (is_poweroff_vm(vm)) {
+		shell_puts("No vm found in the input <vm_id>\r\n");
+		return -EINVAL;
+	}
+
+	get_pgtable_page_stats((const uint64_t *)vm->arch_vm.nworld_eptp, &stats, &vm->arch_vm.ept_mem_ops);
+
+	large_size = (stats.pde_num * PDE_SIZE) + (stats.pdpte_num * PDPTE_SIZE);
+	total_size = large_size + (stats.pte_num * PTE_SIZE);
+	snprintf(temp_str, MAX_STR_SIZE, "\r\n4K: %llu  2M: %llu  1G: %llu\r\n"
+		"mapped: %llu MB, in large pages: %llu%%\r\n",
+		stats.pte_num, stats.pde_num, stats.pdpte_num, total_size >> 20U,
+		(total_size != 0UL) ? ((large_size * 100UL) / total_size) : 0UL);
+	shell_puts(temp_str);
+
+	return 0;
+}
+
+static int32_t shell_show_ioreq_stats(int32_t argc, char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	struct acrn_vm *vm;
+	struct ioreq_spin_range range;
+	uint64_t hits = 0UL, waits = 0UL, cycles_per_us = us_to_ticks(1U);
+	uint32_t i;
+	int32_t ret;
+
+	if (argc != 2) {
+		return -EINVAL;
+	}
+	ret = strtol_deci(argv[1]);
+	if (ret < 0) {
+		return -EINVAL;
+	}
+
+	vm = get_vm_from_vmid(sanitize_vmid((uint16_t)ret));
+	if (is_poweroff_vm(vm)) {
+		shell_puts("No vm found in the input <vm_id>\r\n");
+		return -EINVAL;
+	}
+	if (!vm->sw.is_completion_polling) {
+		shell_puts("The VM is not in IO completion polling mode\r\n");
+		return 0;
+	}
+
+	shell_puts("\r\nTYPE  PORT/PAGE      HITS        PAUSES      AVG US\r\n");
+	for (i = 0U; i < IOREQ_SPIN_RANGES; i++) {
+		spinlock_obtain(&vm->ioreq_spin_lock);
+		range = vm->ioreq_spin[i];
+		spinlock_release(&vm->ioreq_spin_lock);
+		if (range.key == 0UL) {
+			continue;
+		}
+
+		hits += range.hits;
+		waits += range.waits;
+		snprintf(temp_str, MAX_STR_SIZE, "%-6s0x%-13llx%-12llu%-12llu%llu\r\n",
+			((range.key >> 56U) == (REQ_PORTIO + 1UL)) ? "PIO" : "MMIO",
+			range.key & ((1UL << 56U) - 1UL), range.hits, range.waits,
+			range.avg_cycles / cycles_per_us);
+		shell_puts(temp_str);
+	}
+
+	snprintf(temp_str, MAX_STR_SIZE, "completed while spinning: %llu%% of %llu\r\n",
+		((hits + waits) != 0UL) ? ((hits * 100UL) / (hits + waits)) : 0UL, hits + waits);
+	shell_puts(temp_str);
+
+	return 0;
+}
+
+static int32_t shell_show_rdt_stats(__unused int32_t argc, __unused char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	struct acrn_vm *vm;
+	struct acrn_vcpu *vcpu;
+	const struct rmid_stats *stats;
+	uint16_t vm_id, rmid;
+
+	if (!cmt_cap_info.support) {
+		shell_puts("CMT is not supported, the L3 occupancy isn't monitored\r\n");
+	}
+
+	shell_puts("\r\nVM_ID CLOS RMID LLC_KB     TOTAL_MB/S LOCAL_MB/S TOTAL_MB   LOCAL_MB"
+		   "\r\n===== ==== ==== ========== ========== ========== ========== ==========\r\n");
+
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		vm = get_vm_from_vmid(vm_id);
+		if (!is_poweroff_vm(vm)) {
+			/* the CLOS of the BSP, HC_VM_SET_CLOS may give the vCPUs different ones */
+			vcpu = vcpu_from_vid(vm, BOOT_CPU_ID);
+			rmid = vm_rmid(vm_id);
+			stats = get_rmid_stats(rmid);
+			snprintf(temp_str, MAX_STR_SIZE, "%-5hu %-4hu %-4hu %-10llu %-10llu %-10llu %-10llu %-10llu\r\n",
+				vm_id, vcpu->arch.clos, rmid, stats->llc_occupancy >> 10U,
+				stats->total_bw >> 20U, stats->local_bw >> 20U,
+				stats->mbm_total_bytes >> 20U, stats->mbm_local_bytes >> 20U);
+			shell_puts(temp_str);
+		}
+	}
+
+	return 0;
+}
+
 /**
  * @brief Get information of ioapic
  *
@@ -1371,3 +1601,71 @@ static int32_t shell_wrmsr(int32_t argc, char **argv)
 
 	return ret;
 }
+
+static int32_t shell_show_hcall_stats(__unused int32_t argc, __unused char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	const char *name;
+	uint64_t count, cycles;
+	uint32_t idx;
+
+	shell_puts("\r\nHYPERCALL                           COUNT         AVG CYCLES\r\n");
+	for (idx = 0U; get_hypercall_stats(idx, &name, &count, &cycles); idx++) {
+		if (count == 0UL) {
+			continue;
+		}
+
+		if (name != NULL) {
+			snprintf(temp_str, MAX_STR_SIZE, "%-36s%-14llu%llu\r\n", name, count, cycles / count);
+		} else {
+			snprintf(temp_str, MAX_STR_SIZE, "0x%-34x%-14llu%llu\r\n", idx, count, cycles / count);
+		}
+		shell_puts(temp_str);
+	}
+
+	return 0;
+}
+
+#ifdef CONFIG_SPINLOCK_STATS
+static int32_t shell_lockstat(int32_t argc, char **argv)
+{
+	char temp_str[MAX_STR_SIZE];
+	const struct spinlock_site_stats *stats;
+	uint32_t i;
+
+	if (argc == 2) {
+		if (strcmp(argv[1], "reset") != 0) {
+			return -EINVAL;
+		}
+		reset_spinlock_stats();
+		return 0;
+	}
+	if (argc != 1) {
+		return -EINVAL;
+	}
+
+	shell_puts("\r\nSITE                OBTAINED    CONTENDED   AVG WAIT    MAX WAIT    "
+		"AVG HOLD    MAX HOLD\r\n");
+	for (i = 0U; i < SPINLOCK_STATS_SITES; i++) {
+		stats = get_spinlock_site_stats(i);
+		if ((stats->site == 0UL) || (stats->obtained == 0UL)) {
+			continue;
+		}
+
+		snprintf(temp_str, MAX_STR_SIZE, "0x%-18llx%-12llu%-12llu%-12llu%-12llu%-12llu%llu\r\n",
+			stats->site, stats->obtained, stats->contended,
+			(stats->contended != 0UL) ? ((uint64_t)stats->wait_cycles / stats->contended) : 0UL,
+			stats->max_wait, (uint64_t)stats->hold_cycles / stats->obtained, stats->max_hold);
+		shell_puts(temp_str);
+	}
+	shell_puts("cycles in TSC ticks, sites are return addresses of spinlock_obtain()\r\n");
+
+	return 0;
+}
+#else
+static int32_t shell_lockstat(__unused int32_t argc, __unused char **argv)
+{
+	shell_puts("Built without CONFIG_SPINLOCK_STATS\r\n");
+	return 0;
+}
+#endif
@@ -86,6 +86,22 @@ struct shell {
 #define SHELL_CMD_VIOAPIC_PARAM		"<vm id>"
 #define SHELL_CMD_VIOAPIC_HELP		"Show virtual IOAPIC (vIOAPIC) information for a specific VM"
 
+#define SHELL_CMD_VMEXIT		"vmexit"
+#define SHELL_CMD_VMEXIT_PARAM		"<vm id>"
+#define SHELL_CMD_VMEXIT_HELP		"Show VM exit count and handling latency per exit reason for each vCPU of a VM"
+
+#define SHELL_CMD_VM_EPT		"vm_ept"
+#define SHELL_CMD_VM_EPT_PARAM		"<vm id>"
+#define SHELL_CMD_VM_EPT_HELP		"Show the number of 4K/2M/1G mappings of the normal world EPT of a VM"
+
+#define SHELL_CMD_VM_IOREQ		"vm_ioreq"
+#define SHELL_CMD_VM_IOREQ_PARAM	"<vm id>"
+#define SHELL_CMD_VM_IOREQ_HELP		"Show the IO completion polling of a VM: spin hits, pauses and completion time per device range"
+
+#define SHELL_CMD_RDT			"rdt"
+#define SHELL_CMD_RDT_PARAM		NULL
+#define SHELL_CMD_RDT_HELP		"Show the CLOS, the L3 occupancy and the memory bandwidth of each VM"
+
 #define SHELL_CMD_LOG_LVL		"loglevel"
 #define SHELL_CMD_LOG_LVL_PARAM		"[<console_loglevel> [<mem_loglevel> [npk_loglevel]]]"
 #define SHELL_CMD_LOG_LVL_HELP		"No argument: get the level of logging for the console, memory and npk. Set "\
@@ -103,4 +119,13 @@ struct shell {
 #define SHELL_CMD_WRMSR_PARAM		"[-p<pcpu_id>]	<msr_index> <value>"
 #define SHELL_CMD_WRMSR_HELP		"Write value (in hexadecimal) to the MSR at msr_index (in hexadecimal) for CPU"\
 					" ID pcpu_id"
+
+#define SHELL_CMD_HCALL			"hcall"
+#define SHELL_CMD_HCALL_PARAM		NULL
+#define SHELL_CMD_HCALL_HELP		"Show the SOS hypercalls: count and average cycles of each of them"
+
+#define SHELL_CMD_LOCKSTAT		"lockstat"
+#define SHELL_CMD_LOCKSTAT_PARAM	"[reset]"
+#define SHELL_CMD_LOCKSTAT_HELP		"Show the spinlock obtains, contentions, wait and hold cycles per call site,"\
+					" or clear the counters"
 #endif /* SHELL_PRIV_H */
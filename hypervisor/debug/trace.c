@@ -7,6 +7,7 @@
 #include <types.h>
 #include <per_cpu.h>
 #include <trace.h>
+#include <acrn_hv_defs.h>
 
 #define TRACE_CUSTOM			0xFCU
 #define TRACE_FUNC_ENTER		0xFDU
@@ -38,73 +39,308 @@ struct trace_entry {
 	} payload;
 } __aligned(8);
 
-static inline bool trace_check(uint16_t cpu_id)
+/*
+ * Once a filter is set on a pcpu, only its events are traced, 1 in rate
+ * of each. The filter is changed from the hypercall while the pcpu
+ * traces: nr_events is cleared first and set last.
+ */
+struct trace_filter {
+	uint32_t nr_events;
+	uint32_t evid[ACRN_TRACE_FILTER_MAX];
+	uint32_t rate[ACRN_TRACE_FILTER_MAX];
+	uint32_t count[ACRN_TRACE_FILTER_MAX];	/* events since the last traced */
+};
+
+static struct trace_filter trace_filters[CONFIG_MAX_PCPU_NUM];
+
+void trace_set_filter(uint16_t pcpu_id, const struct acrn_trace_filter *filter)
+{
+	struct trace_filter *tf = &trace_filters[pcpu_id];
+	uint32_t i;
+
+	tf->nr_events = 0U;
+	cpu_write_memory_barrier();
+	for (i = 0U; i < filter->nr_events; i++) {
+		tf->evid[i] = filter->evid[i];
+		tf->rate[i] = filter->rate[i];
+		tf->count[i] = 0U;
+	}
+	cpu_write_memory_barrier();
+	tf->nr_events = filter->nr_events;
+}
+
+/* @return true if the event is filtered out, or not sampled */
+static bool trace_skip(uint32_t evid)
 {
-	if (per_cpu(sbuf, cpu_id)[ACRN_TRACE] == NULL) {
-		return false;
+	struct trace_filter *tf = &trace_filters[get_pcpu_id()];
+	uint32_t i, nr = tf->nr_events;
+	bool skip = (nr != 0U);
+
+	for (i = 0U; i < nr; i++) {
+		if (tf->evid[i] == evid) {
+			tf->count[i]++;
+			if (tf->count[i] >= tf->rate[i]) {
+				tf->count[i] = 0U;
+				skip = false;
+			}
+			break;
+		}
 	}
 
-	return true;
+	return skip;
 }
 
-static inline void trace_put(uint16_t cpu_id, uint32_t evid, uint32_t n_data, struct trace_entry *entry)
+/*
+ * The entries are filled in place in the trace sbuf of the pcpu, between
+ * trace_reserve() and trace_commit(). An entry never wraps around, the
+ * trace sbuf holds whole entries.
+ */
+static inline struct trace_entry *trace_reserve(uint32_t evid, uint32_t n_data, struct sbuf_rsv *rsv)
 {
+	uint16_t cpu_id = get_pcpu_id();
 	struct shared_buf *sbuf = per_cpu(sbuf, cpu_id)[ACRN_TRACE];
+	struct trace_entry *entry = NULL;
 
-	entry->tsc = rdtsc();
-	entry->id = evid;
-	entry->n_data = (uint8_t)n_data;
-	entry->cpu = (uint8_t)cpu_id;
-	(void)sbuf_put(sbuf, (uint8_t *)entry);
+	if ((sbuf != NULL) && (sbuf_reserve(sbuf, (uint32_t)sizeof(struct trace_entry), rsv) != 0U)) {
+		entry = (struct trace_entry *)sbuf_rsv_ptr(rsv, (uint32_t)sizeof(struct trace_entry));
+		if (entry == NULL) {
+			sbuf_cancel(rsv);
+		} else {
+			entry->tsc = rdtsc();
+			entry->id = evid;
+			entry->n_data = (uint8_t)n_data;
+			entry->cpu = (uint8_t)cpu_id;
+		}
+	}
+
+	return entry;
 }
 
-void TRACE_2L(uint32_t evid, uint64_t e, uint64_t f)
+static inline void trace_commit(const struct sbuf_rsv *rsv)
+{
+	sbuf_commit(per_cpu(sbuf, get_pcpu_id())[ACRN_TRACE], rsv);
+}
+
+/*
+ * Compact records, written instead of the trace entries once the consumer
+ * sets SBUF_COMPACT_EN in the trace sbuf (without OVERWRITE_EN, as the
+ * records are of variable length). The cpu is implicit, there is one trace
+ * sbuf per pcpu. A record is:
+ *
+ *   tag:	bits[1:0] payload kind, bit 2 absolute TSC,
+ *		bits[7:3] index in trace_hot_events[] + 1, 0 if not hot
+ *   event id:	LEB128, only if not hot
+ *   tsc:	8 bytes (little endian) if absolute, else the LEB128 delta
+ *		to the TSC of the previous record
+ *   payload:	2L: 2 x LEB128, 4I: 4 x LEB128, 6C: 6 bytes,
+ *		STR: 1 length byte + the chars
+ *
+ * The TSC is absolute in every TRACE_SYNC_RECS record and after a gap of
+ * 2^32 cycles, a decoder starts at the first absolute record.
+ */
+#define TRACE_KIND_2L		0U
+#define TRACE_KIND_4I		1U
+#define TRACE_KIND_6C		2U
+#define TRACE_KIND_STR		3U
+#define TRACE_TAG_ABS_TSC	(1U << 2U)
+#define TRACE_TAG_HOT_SHIFT	3U
+#define TRACE_SYNC_RECS		64U
+#define TRACE_REC_MAX		40U
+
+/* keep in sync with HOT_EVENTS in acrntrace_format.py and hot_events[] in trace_src.c */
+static const uint32_t trace_hot_events[] = {
+	TRACE_VM_EXIT,
+	TRACE_VM_ENTER,
+	TRACE_TIMER_ACTION_ADDED,
+	TRACE_TIMER_ACTION_PCKUP,
+	TRACE_TIMER_ACTION_UPDAT,
+	TRACE_TIMER_IRQ,
+	TRACE_VMEXIT_EXCEPTION_OR_NMI,
+	TRACE_VMEXIT_EXTERNAL_INTERRUPT,
+	TRACE_VMEXIT_INTERRUPT_WINDOW,
+	TRACE_VMEXIT_CPUID,
+	TRACE_VMEXIT_RDTSC,
+	TRACE_VMEXIT_VMCALL,
+	TRACE_VMEXIT_CR_ACCESS,
+	TRACE_VMEXIT_IO_INSTRUCTION,
+	TRACE_VMEXIT_RDMSR,
+	TRACE_VMEXIT_WRMSR,
+	TRACE_VMEXIT_EPT_VIOLATION,
+	TRACE_VMEXIT_EPT_MISCONFIGURATION,
+	TRACE_VMEXIT_RDTSCP,
+	TRACE_VMEXIT_APICV_WRITE,
+	TRACE_VMEXIT_APICV_ACCESS,
+	TRACE_VMEXIT_APICV_VIRT_EOI,
+};
+
+static uint32_t trace_hot_idx(uint32_t evid)
+{
+	uint32_t i, idx = 0U;
+
+	for (i = 0U; i < ARRAY_SIZE(trace_hot_events); i++) {
+		if (trace_hot_events[i] == evid) {
+			idx = i + 1U;
+			break;
+		}
+	}
+
+	return idx;
+}
+
+static uint32_t trace_put_varint(uint8_t *p, uint64_t v)
+{
+	uint64_t x = v;
+	uint32_t n = 0U;
+
+	while (x >= 0x80UL) {
+		p[n] = (uint8_t)(x | 0x80UL);
+		x >>= 7U;
+		n++;
+	}
+	p[n] = (uint8_t)x;
+
+	return n + 1U;
+}
+
+/* Encode the tag, event id and TSC of a compact record, return its length */
+static uint32_t trace_rec_header(uint16_t cpu_id, uint8_t *rec, uint32_t evid, uint32_t kind, uint64_t now)
+{
+	uint64_t delta = now - per_cpu(trace_tsc, cpu_id);
+	uint32_t hot = trace_hot_idx(evid);
+	uint32_t tag = kind | (hot << TRACE_TAG_HOT_SHIFT);
+	uint32_t len = 1U, i;
+
+	if (hot == 0U) {
+		len += trace_put_varint(&rec[len], evid);
+	}
+
+	if (((per_cpu(trace_nr, cpu_id) % TRACE_SYNC_RECS) == 0U) || (delta >= (1UL << 32U))) {
+		tag |= TRACE_TAG_ABS_TSC;
+		for (i = 0U; i < 8U; i++) {
+			rec[len] = (uint8_t)(now >> (i * 8U));
+			len++;
+		}
+	} else {
+		len += trace_put_varint(&rec[len], delta);
+	}
+	rec[0] = (uint8_t)tag;
+
+	return len;
+}
+
+/*
+ * Write a compact record of n_vals varints and n_bytes raw bytes, if the
+ * consumer asked for them.
+ *
+ * @return false if the trace sbuf of the pcpu takes trace entries
+ */
+static bool trace_put_compact(uint32_t evid, uint32_t kind, const uint64_t vals[], uint32_t n_vals,
+		const uint8_t bytes[], uint32_t n_bytes)
 {
-	struct trace_entry entry;
 	uint16_t cpu_id = get_pcpu_id();
+	struct shared_buf *sbuf = per_cpu(sbuf, cpu_id)[ACRN_TRACE];
+	struct sbuf_rsv rsv;
+	uint8_t rec[TRACE_REC_MAX];
+	uint32_t flags = 0U, len, i;
+	uint64_t now;
+	bool compact;
+
+	if (sbuf != NULL) {
+		stac();
+		flags = sbuf->flags;
+		clac();
+	}
+
+	compact = ((flags & (SBUF_COMPACT_EN | OVERWRITE_EN)) == SBUF_COMPACT_EN);
+	if (compact) {
+		now = rdtsc();
+		len = trace_rec_header(cpu_id, rec, evid, kind, now);
+		for (i = 0U; i < n_vals; i++) {
+			len += trace_put_varint(&rec[len], vals[i]);
+		}
+		if (kind == TRACE_KIND_STR) {
+			rec[len] = (uint8_t)n_bytes;
+			len++;
+		}
+		for (i = 0U; i < n_bytes; i++) {
+			rec[len] = bytes[i];
+			len++;
+		}
 
-	if (!trace_check(cpu_id)) {
-		return;
+		if (sbuf_reserve(sbuf, len, &rsv) != 0U) {
+			sbuf_rsv_write(&rsv, 0U, rec, len);
+			sbuf_commit(sbuf, &rsv);
+			/* the deltas are to the last record the consumer gets */
+			per_cpu(trace_tsc, cpu_id) = now;
+			per_cpu(trace_nr, cpu_id)++;
+		}
 	}
 
-	entry.payload.fields_64.e = e;
-	entry.payload.fields_64.f = f;
-	trace_put(cpu_id, evid, 2U, &entry);
+	return compact;
+}
+
+void TRACE_2L(uint32_t evid, uint64_t e, uint64_t f)
+{
+	const uint64_t vals[2] = { e, f };
+	struct sbuf_rsv rsv;
+	struct trace_entry *entry = NULL;
+
+	if (!trace_skip(evid)) {
+		if (!trace_put_compact(evid, TRACE_KIND_2L, vals, 2U, NULL, 0U)) {
+			entry = trace_reserve(evid, 2U, &rsv);
+		}
+	}
+
+	if (entry != NULL) {
+		entry->payload.fields_64.e = e;
+		entry->payload.fields_64.f = f;
+		trace_commit(&rsv);
+	}
 }
 
 void TRACE_4I(uint32_t evid, uint32_t a, uint32_t b, uint32_t c, uint32_t d)
 {
-	struct trace_entry entry;
-	uint16_t cpu_id = get_pcpu_id();
+	const uint64_t vals[4] = { a, b, c, d };
+	struct sbuf_rsv rsv;
+	struct trace_entry *entry = NULL;
 
-	if (!trace_check(cpu_id)) {
-		return;
+	if (!trace_skip(evid)) {
+		if (!trace_put_compact(evid, TRACE_KIND_4I, vals, 4U, NULL, 0U)) {
+			entry = trace_reserve(evid, 4U, &rsv);
+		}
 	}
 
-	entry.payload.fields_32.a = a;
-	entry.payload.fields_32.b = b;
-	entry.payload.fields_32.c = c;
-	entry.payload.fields_32.d = d;
-	trace_put(cpu_id, evid, 4U, &entry);
+	if (entry != NULL) {
+		entry->payload.fields_32.a = a;
+		entry->payload.fields_32.b = b;
+		entry->payload.fields_32.c = c;
+		entry->payload.fields_32.d = d;
+		trace_commit(&rsv);
+	}
 }
 
 void TRACE_6C(uint32_t evid, uint8_t a1, uint8_t a2, uint8_t a3, uint8_t a4, uint8_t b1, uint8_t b2)
 {
-	struct trace_entry entry;
-	uint16_t cpu_id = get_pcpu_id();
+	const uint8_t bytes[6] = { a1, a2, a3, a4, b1, b2 };
+	struct sbuf_rsv rsv;
+	struct trace_entry *entry = NULL;
 
-	if (!trace_check(cpu_id)) {
-		return;
+	if (!trace_skip(evid)) {
+		if (!trace_put_compact(evid, TRACE_KIND_6C, NULL, 0U, bytes, 6U)) {
+			entry = trace_reserve(evid, 8U, &rsv);
+		}
 	}
 
-	entry.payload.fields_8.a1 = a1;
-	entry.payload.fields_8.a2 = a2;
-	entry.payload.fields_8.a3 = a3;
-	entry.payload.fields_8.a4 = a4;
-	entry.payload.fields_8.b1 = b1;
-	entry.payload.fields_8.b2 = b2;
-	/* payload.fields_8.b3/b4 not used, but is put in trace buf */
-	trace_put(cpu_id, evid, 8U, &entry);
+	if (entry != NULL) {
+		entry->payload.fields_8.a1 = a1;
+		entry->payload.fields_8.a2 = a2;
+		entry->payload.fields_8.a3 = a3;
+		entry->payload.fields_8.a4 = a4;
+		entry->payload.fields_8.b1 = b1;
+		entry->payload.fields_8.b2 = b2;
+		/* payload.fields_8.b3/b4 not used, but is put in trace buf */
+		trace_commit(&rsv);
+	}
 }
 
 #define TRACE_ENTER TRACE_16STR(TRACE_FUNC_ENTER, __func__)
@@ -112,23 +348,29 @@ void TRACE_6C(uint32_t evid, uint8_t a1, uint8_t a2, uint8_t a3, uint8_t a4, uin
 
 static inline void TRACE_16STR(uint32_t evid, const char name[])
 {
-	struct trace_entry entry;
-	uint16_t cpu_id = get_pcpu_id();
+	struct sbuf_rsv rsv;
+	struct trace_entry *entry = NULL;
 	size_t len, i;
 
-	if (!trace_check(cpu_id)) {
-		return;
+	len = strnlen_s(name, 20U);
+	if (!trace_skip(evid)) {
+		/* the last char of the entry is always 0 */
+		if (!trace_put_compact(evid, TRACE_KIND_STR, NULL, 0U, (const uint8_t *)name,
+				(len > 15U) ? 15U : (uint32_t)len)) {
+			entry = trace_reserve(evid, 16U, &rsv);
+		}
 	}
 
-	entry.payload.fields_64.e = 0UL;
-	entry.payload.fields_64.f = 0UL;
+	if (entry != NULL) {
+		entry->payload.fields_64.e = 0UL;
+		entry->payload.fields_64.f = 0UL;
 
-	len = strnlen_s(name, 20U);
-	len = (len > 16U) ? 16U : len;
-	for (i = 0U; i < len; i++) {
-		entry.payload.str[i] = name[i];
-	}
+		len = (len > 16U) ? 16U : len;
+		for (i = 0U; i < len; i++) {
+			entry->payload.str[i] = name[i];
+		}
 
-	entry.payload.str[15] = 0;
-	trace_put(cpu_id, evid, 16U, &entry);
+		entry->payload.str[15] = 0;
+		trace_commit(&rsv);
+	}
 }
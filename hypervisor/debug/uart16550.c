@@ -226,6 +226,37 @@ size_t uart16550_puts(const char *buf, uint32_t len)
 	return len;
 }
 
+/*
+ * Write what the TX FIFO takes of buf, without waiting: the FIFO is empty
+ * once THRE is set. Returns the number of chars of buf written.
+ */
+size_t uart16550_write_fifo(const char *buf, uint32_t len)
+{
+	uint32_t i = 0U, room = 0U;
+	size_t ret = len;
+
+	if (uart.enabled) {
+		spinlock_obtain(&uart.tx_lock);
+		if ((uart16550_read_reg(uart, UART16550_LSR) & LSR_THRE) != 0U) {
+			room = UART16550_TX_FIFO_SIZE;
+		}
+		/* '\n' is followed by a '\r', as uart16550_puts() does */
+		while ((i < len) && (room >= ((buf[i] == '\n') ? 2U : 1U))) {
+			uart16550_write_reg(uart, (uint32_t)(uint8_t)buf[i], UART16550_THR);
+			room--;
+			if (buf[i] == '\n') {
+				uart16550_write_reg(uart, (uint32_t)'\r', UART16550_THR);
+				room--;
+			}
+			i++;
+		}
+		spinlock_release(&uart.tx_lock);
+		ret = i;
+	}
+
+	return ret;
+}
+
 void uart16550_set_property(bool enabled, bool port_mapped, uint64_t base_addr)
 {
 	uart.enabled = enabled;
@@ -70,6 +70,115 @@ static inline bool has_complete_ioreq(const struct acrn_vcpu *vcpu)
 	return (get_vhm_req_state(vcpu->vm, vcpu->vcpu_id) == REQ_STATE_COMPLETE);
 }
 
+/*
+ * In IO completion polling mode a vCPU spins for the completion of its
+ * request for twice the average completion time of the device range, within
+ * [IOREQ_SPIN_MIN_US, IOREQ_SPIN_MAX_US]. The ranges whose requests take
+ * longer are given the minimum: spinning would not save their pause.
+ */
+#define IOREQ_SPIN_MIN_US	2U
+#define IOREQ_SPIN_MAX_US	100U
+#define IOREQ_SPIN_AVG_SHIFT	3U	/* weight 1/8 for the last completion */
+
+static uint64_t ioreq_spin_key(const struct io_request *io_req)
+{
+	uint64_t addr;
+
+	if (io_req->io_type == REQ_PORTIO) {
+		addr = io_req->reqs.pio.address;
+	} else {
+		addr = io_req->reqs.mmio.address >> PAGE_SHIFT;
+	}
+
+	return (((uint64_t)io_req->io_type + 1UL) << 56U) | (addr & ((1UL << 56U) - 1UL));
+}
+
+/*
+ * @pre vm != NULL
+ */
+static struct ioreq_spin_range *get_ioreq_spin_range(struct acrn_vm *vm, uint64_t key)
+{
+	struct ioreq_spin_range *range = &vm->ioreq_spin[(key ^ (key >> 8U)) % IOREQ_SPIN_RANGES];
+
+	/* direct mapped, a range evicts the one it collides with */
+	if (range->key != key) {
+		range->key = key;
+		range->avg_cycles = 0UL;
+		range->hits = 0UL;
+		range->waits = 0UL;
+	}
+
+	return range;
+}
+
+static uint64_t ioreq_spin_budget(struct acrn_vm *vm, uint64_t key)
+{
+	const struct ioreq_spin_range *range;
+	uint64_t max = us_to_ticks(IOREQ_SPIN_MAX_US);
+	uint64_t min = us_to_ticks(IOREQ_SPIN_MIN_US);
+	uint64_t budget;
+
+	spinlock_obtain(&vm->ioreq_spin_lock);
+	range = get_ioreq_spin_range(vm, key);
+	if (range->avg_cycles == 0UL) {
+		/* not learned yet */
+		budget = max;
+	} else if ((range->avg_cycles * 2UL) > max) {
+		budget = min;
+	} else {
+		budget = (range->avg_cycles * 2UL > min) ? (range->avg_cycles * 2UL) : min;
+	}
+	spinlock_release(&vm->ioreq_spin_lock);
+
+	return budget;
+}
+
+static void ioreq_spin_account(struct acrn_vm *vm, uint64_t key, uint64_t cycles, bool hit)
+{
+	struct ioreq_spin_range *range;
+
+	spinlock_obtain(&vm->ioreq_spin_lock);
+	range = get_ioreq_spin_range(vm, key);
+	if (range->avg_cycles == 0UL) {
+		range->avg_cycles = cycles;
+	} else {
+		range->avg_cycles = (range->avg_cycles - (range->avg_cycles >> IOREQ_SPIN_AVG_SHIFT)) +
+			(cycles >> IOREQ_SPIN_AVG_SHIFT);
+	}
+	if (hit) {
+		range->hits++;
+	} else {
+		range->waits++;
+	}
+	spinlock_release(&vm->ioreq_spin_lock);
+}
+
+/*
+ * Pause the vCPU, which stopped spinning, till the completion of its request.
+ * Either the completion seen here or the one the SOS notifies resumes it,
+ * whichever clears ioreq_waiting first.
+ *
+ * @pre vcpu->vm->sw.io_shared_page != NULL
+ */
+static void wait_ioreq_completion(struct acrn_vcpu *vcpu, struct vhm_request *vhm_req)
+{
+	pause_vcpu(vcpu, VCPU_PAUSED);
+	vcpu->ioreq_waiting = 1U;
+	stac();
+	vhm_req->hv_waiting = 1U;
+	clac();
+
+	/* pairs with the DM which completes the request then reads hv_waiting */
+	cpu_memory_barrier();
+	if (has_complete_ioreq(vcpu) && (atomic_cmpxchg32(&vcpu->ioreq_waiting, 1U, 0U) == 1U)) {
+		resume_vcpu(vcpu);
+	}
+
+	if (need_reschedule(vcpu->pcpu_id)) {
+		schedule();
+	}
+}
+
 /**
  * @brief Deliver \p io_req to SOS and suspend \p vcpu till its completion
  *
@@ -83,6 +192,8 @@ int32_t acrn_insert_request(struct acrn_vcpu *vcpu, const struct io_request *io_
 	union vhm_request_buffer *req_buf = NULL;
 	struct vhm_request *vhm_req;
 	bool is_polling = false;
+	bool dm_polling = false;
+	uint64_t key = 0UL, budget = 0UL, start;
 	int32_t ret = 0;
 	uint16_t cur;
 
@@ -98,12 +209,18 @@ int32_t acrn_insert_request(struct acrn_vcpu *vcpu, const struct io_request *io_
 		vhm_req->type = io_req->io_type;
 		(void)memcpy_s(&vhm_req->reqs, sizeof(union vhm_io_request),
 			&io_req->reqs, sizeof(union vhm_io_request));
+		vhm_req->hv_waiting = 0U;
 		if (vcpu->vm->sw.is_completion_polling) {
 			vhm_req->completion_polling = 1U;
 			is_polling = true;
 		}
 		clac();
 
+		if (is_polling) {
+			key = ioreq_spin_key(io_req);
+			budget = ioreq_spin_budget(vcpu->vm, key);
+		}
+
 		/* pause vcpu in notification mode , wait for VHM to handle the MMIO request.
 		 * TODO: when pause_vcpu changed to switch vcpu out directlly, we
 		 * should fix the race issue between req.processed update and vcpu pause
@@ -122,10 +239,25 @@ int32_t acrn_insert_request(struct acrn_vcpu *vcpu, const struct io_request *io_
 		 */
 		set_vhm_req_state(vcpu->vm, vcpu->vcpu_id, REQ_STATE_PENDING);
 
+		/*
+		 * The DM may poll the completion polling requests, no upcall is
+		 * needed then. Order the PENDING state before reading dm_polling,
+		 * pairs with the DM which clears dm_polling before its last scan
+		 * of the requests, so that either side sees the other one.
+		 */
+		if (is_polling) {
+			cpu_memory_barrier();
+			stac();
+			dm_polling = (vhm_req->dm_polling != 0U);
+			clac();
+		}
+
 		/* signal VHM */
-		arch_fire_vhm_interrupt();
+		if (!dm_polling) {
+			arch_fire_vhm_interrupt();
+		}
 
-		/* Polling completion of the request in polling mode */
+		/* Polling completion of the request in polling mode, for its budget */
 		if (is_polling) {
 			/*
 			 * Now, we only have one case that will schedule out this vcpu
@@ -133,9 +265,17 @@ int32_t acrn_insert_request(struct acrn_vcpu *vcpu, const struct io_request *io_
 			 * In this case, we cannot come back to polling status again. Currently,
 			 * it's OK as we needn't handle IO completion in zombie status.
 			 */
+			start = rdtsc();
 			while (!need_reschedule(vcpu->pcpu_id)) {
 				if (has_complete_ioreq(vcpu)) {
 					/* we have completed ioreq pending */
+					ioreq_spin_account(vcpu->vm, key, rdtsc() - start, true);
+					break;
+				}
+				if ((rdtsc() - start) > budget) {
+					/* let the other sched objects run till the completion */
+					wait_ioreq_completion(vcpu, vhm_req);
+					ioreq_spin_account(vcpu->vm, key, rdtsc() - start, false);
 					break;
 				}
 				asm_pause();
@@ -201,6 +341,46 @@ uint32_t get_vhm_notification_vector(void)
 	return acrn_vhm_notification_vector;
 }
 
+void resume_vcpu_ioreq_done(struct acrn_vcpu *vcpu)
+{
+	if (!vcpu->vm->sw.is_completion_polling) {
+		resume_vcpu(vcpu);
+	} else if (atomic_cmpxchg32(&vcpu->ioreq_waiting, 1U, 0U) == 1U) {
+		/* it stopped polling for the completion */
+		resume_vcpu(vcpu);
+	} else {
+		/* the vCPU polls for the completion itself */
+	}
+}
+
+int32_t resume_vcpus_ioreq_done(struct acrn_vm *vm, uint64_t vcpu_bitmap)
+{
+	struct acrn_vcpu *vcpu;
+	uint64_t pending = vcpu_bitmap;
+	uint16_t vcpu_id;
+	int32_t ret = 0;
+
+	while (pending != 0UL) {
+		vcpu_id = ffs64(pending);
+		bitmap_clear_nolock(vcpu_id, &pending);
+
+		if (vcpu_id >= vm->hw.created_vcpus) {
+			pr_err("%s, failed to get VCPU %d context from VM %d\n",
+				__func__, vcpu_id, vm->vm_id);
+			ret = -EINVAL;
+		} else {
+			vcpu = vcpu_from_vid(vm, vcpu_id);
+			if (vcpu->state == VCPU_OFFLINE) {
+				ret = -EINVAL;
+			} else {
+				resume_vcpu_ioreq_done(vcpu);
+			}
+		}
+	}
+
+	return ret;
+}
+
 /**
  * @brief General complete-work for MMIO emulation
  *
@@ -395,6 +575,53 @@ static int32_t mmio_default_access_handler(struct io_request *io_req,
 	return 0;
 }
 
+static inline bool pio_in_range(const struct vm_io_handler_desc *handler, uint16_t port)
+{
+	return ((port >= handler->port_start) && (port < handler->port_end));
+}
+
+/**
+ * Find the emul_pio index of the handler covering \p port.
+ *
+ * The registered port ranges don't overlap, so the handler hit last time on
+ * this vCPU is tried first, then a binary search is done on emul_pio_sorted.
+ *
+ * @return the emul_pio index, or EMUL_PIO_IDX_MAX if no handler covers \p port
+ */
+static uint32_t find_pio_handler(struct acrn_vcpu *vcpu, uint16_t port)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	uint32_t idx = vcpu->last_pio_idx;
+	uint32_t lo, hi, mid;
+
+	if ((idx >= EMUL_PIO_IDX_MAX) || !pio_in_range(&vm->emul_pio[idx], port)) {
+		idx = EMUL_PIO_IDX_MAX;
+
+		spinlock_obtain(&vm->emul_mmio_lock);
+		/* find the first range starting above port, the one before it is the only candidate */
+		lo = 0U;
+		hi = vm->emul_pio_regions;
+		while (lo < hi) {
+			mid = (lo + hi) >> 1U;
+			if (vm->emul_pio[vm->emul_pio_sorted[mid]].port_start <= port) {
+				lo = mid + 1U;
+			} else {
+				hi = mid;
+			}
+		}
+		if ((lo > 0U) && pio_in_range(&vm->emul_pio[vm->emul_pio_sorted[lo - 1U]], port)) {
+			idx = vm->emul_pio_sorted[lo - 1U];
+		}
+		spinlock_release(&vm->emul_mmio_lock);
+
+		if (idx < EMUL_PIO_IDX_MAX) {
+			vcpu->last_pio_idx = (uint16_t)idx;
+		}
+	}
+
+	return idx;
+}
+
 /**
  * Try handling the given request by any port I/O handler registered in the
  * hypervisor.
@@ -420,20 +647,16 @@ hv_emulate_pio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 	port = (uint16_t)pio_req->address;
 	size = (uint16_t)pio_req->size;
 
-	for (idx = 0U; idx < EMUL_PIO_IDX_MAX; idx++) {
+	idx = find_pio_handler(vcpu, port);
+	if (idx < EMUL_PIO_IDX_MAX) {
 		handler = &(vm->emul_pio[idx]);
 
-		if ((port < handler->port_start) || (port >= handler->port_end)) {
-			continue;
-		}
-
 		if (handler->io_read != NULL) {
 			io_read = handler->io_read;
 		}
 		if (handler->io_write != NULL) {
 			io_write = handler->io_write;
 		}
-		break;
 	}
 
 	if ((pio_req->direction == REQUEST_WRITE) && (io_write != NULL)) {
@@ -454,6 +677,70 @@ hv_emulate_pio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 	return status;
 }
 
+static inline bool mmio_in_range(const struct mem_io_node *mmio_node, uint64_t address, uint64_t size)
+{
+	return ((address >= mmio_node->range_start) && ((address + size) <= mmio_node->range_end));
+}
+
+/**
+ * Find the emul_mmio index of the handler covering [address, address + size).
+ *
+ * The emulated MMIO regions are expected not to overlap. The region hit last
+ * time on this vCPU is tried first, then a binary search is done on
+ * emul_mmio_sorted. emul_mmio entries are never moved once registered, so the
+ * cached index stays valid without holding emul_mmio_lock.
+ *
+ * @retval 0 *idx is the index of the handler.
+ * @retval -ENODEV No region overlaps the access.
+ * @retval -EIO The access spans the boundary of a region.
+ */
+static int32_t find_mmio_handler(struct acrn_vcpu *vcpu, uint64_t address, uint64_t size, uint16_t *idx)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	const struct mem_io_node *mmio_node;
+	uint16_t cand = vcpu->last_mmio_idx;
+	uint16_t lo, hi, mid;
+	int32_t status = 0;
+
+	if ((cand < vm->emul_mmio_regions) && mmio_in_range(&vm->emul_mmio[cand], address, size)) {
+		*idx = cand;
+	} else {
+		status = -ENODEV;
+
+		spinlock_obtain(&vm->emul_mmio_lock);
+		/* find the first region starting at or above address + size */
+		lo = 0U;
+		hi = vm->emul_mmio_regions;
+		while (lo < hi) {
+			mid = (lo + hi) >> 1U;
+			if (vm->emul_mmio[vm->emul_mmio_sorted[mid]].range_start < (address + size)) {
+				lo = mid + 1U;
+			} else {
+				hi = mid;
+			}
+		}
+
+		/* the region before it is the only one which may overlap the access */
+		if (lo > 0U) {
+			cand = vm->emul_mmio_sorted[lo - 1U];
+			mmio_node = &vm->emul_mmio[cand];
+			if (address < mmio_node->range_end) {
+				if (mmio_in_range(mmio_node, address, size)) {
+					*idx = cand;
+					vcpu->last_mmio_idx = cand;
+					status = 0;
+				} else {
+					pr_fatal("Err MMIO, address:0x%llx, size:%x", address, size);
+					status = -EIO;
+				}
+			}
+		}
+		spinlock_release(&vm->emul_mmio_lock);
+	}
+
+	return status;
+}
+
 /**
  * Use registered MMIO handlers on the given request if it falls in the range of
  * any of them.
@@ -467,49 +754,186 @@ hv_emulate_pio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 static int32_t
 hv_emulate_mmio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 {
-	int32_t status = -ENODEV;
-	uint16_t idx;
-	uint64_t address, size;
+	int32_t status;
+	uint16_t idx = 0U;
 	struct mmio_request *mmio_req = &io_req->reqs.mmio;
 	struct mem_io_node *mmio_handler = NULL;
 	hv_mem_io_handler_t read_write = vcpu->vm->default_read_write;
 	void *handler_private_data = NULL;
 
-	address = mmio_req->address;
-	size = mmio_req->size;
+	status = find_mmio_handler(vcpu, mmio_req->address, mmio_req->size, &idx);
+	if (status == 0) {
+		mmio_handler = &(vcpu->vm->emul_mmio[idx]);
+		read_write = mmio_handler->read_write;
+		handler_private_data = mmio_handler->handler_private_data;
+		status = read_write(io_req, handler_private_data);
+	} else if ((status == -ENODEV) && (read_write != NULL)) {
+		status = read_write(io_req, handler_private_data);
+	} else {
+		/* no default handler, or the access spans multiple regions */
+	}
+
+	return status;
+}
 
-	for (idx = 0U; idx < vcpu->vm->emul_mmio_regions; idx++) {
-		uint64_t base, end;
-		bool emulation_done = false;
+static bool doorbell_match(const struct acrn_doorbell *doorbell, uint32_t io_type,
+		uint64_t address, uint64_t size, uint64_t value)
+{
+	bool is_pio = ((doorbell->flags & ACRN_DOORBELL_FLAG_PIO) != 0U);
 
-		mmio_handler = &(vcpu->vm->emul_mmio[idx]);
-		base = mmio_handler->range_start;
-		end = mmio_handler->range_end;
-
-		if (((address + size) <= base) || (address >= end)) {
-			continue;
-		} else if (!((address >= base) && ((address + size) <= end))) {
-			pr_fatal("Err MMIO, address:0x%llx, size:%x", address, size);
-			status = -EIO;
-			emulation_done = true;
+	return (is_pio == (io_type == REQ_PORTIO)) && (doorbell->addr == address) &&
+		((uint64_t)doorbell->len == size) &&
+		(((doorbell->flags & ACRN_DOORBELL_FLAG_DATAMATCH) == 0U) || (doorbell->data == value));
+}
+
+/**
+ * @brief Ring the doorbell written by \p io_req if any
+ *
+ * @return true if \p io_req is a doorbell write, which needs no further
+ *         emulation then.
+ */
+static bool hit_doorbell(struct acrn_vm *vm, const struct io_request *io_req)
+{
+	uint64_t active = vm->doorbell_active;
+	uint64_t address, size, value;
+	uint32_t direction;
+	uint16_t idx;
+	bool hit = false;
+
+	if (active != 0UL) {
+		if (io_req->io_type == REQ_PORTIO) {
+			direction = io_req->reqs.pio.direction;
+			address = io_req->reqs.pio.address;
+			size = io_req->reqs.pio.size;
+			value = (uint64_t)io_req->reqs.pio.value;
 		} else {
-			if (mmio_handler->read_write != NULL) {
-				read_write = mmio_handler->read_write;
-				handler_private_data = mmio_handler->handler_private_data;
-				emulation_done = true;
+			direction = io_req->reqs.mmio.direction;
+			address = io_req->reqs.mmio.address;
+			size = io_req->reqs.mmio.size;
+			value = io_req->reqs.mmio.value;
+		}
+
+		/* doorbells are written, REQ_WP is never one */
+		if ((direction == REQUEST_WRITE) && (io_req->io_type != REQ_WP)) {
+			while (active != 0UL) {
+				idx = ffs64(active);
+				bitmap_clear_nolock(idx, &active);
+				if (doorbell_match(&vm->doorbells[idx], io_req->io_type, address, size, value)) {
+					ring_doorbells(vm, 1UL << idx);
+					hit = true;
+					break;
+				}
 			}
 		}
+	}
 
-		if (emulation_done) {
-			break;
+	return hit;
+}
+
+/**
+ * @brief Append the MMIO write \p io_req to the coalesced MMIO ring
+ *
+ * @return true if \p io_req is a write to a coalesced MMIO zone and found room
+ *         in the ring, which needs no further emulation then.
+ */
+static bool coalesce_mmio_write(struct acrn_vm *vm, const struct io_request *io_req)
+{
+	const struct mmio_request *mmio_req = &io_req->reqs.mmio;
+	struct acrn_coalesced_mmio_ring *ring = vm->coalesced_ring;
+	const struct acrn_coalesced_mmio_zone *zone;
+	struct acrn_coalesced_mmio_entry *entry;
+	uint64_t active = vm->coalesced_active;
+	uint32_t last, next;
+	uint16_t idx;
+	bool hit = false, coalesced = false;
+
+	if ((active != 0UL) && (ring != NULL) && (io_req->io_type == REQ_MMIO) &&
+			(mmio_req->direction == REQUEST_WRITE)) {
+		while (active != 0UL) {
+			idx = ffs64(active);
+			bitmap_clear_nolock(idx, &active);
+			zone = &vm->coalesced_zones[idx];
+			if ((mmio_req->address >= zone->addr) &&
+					((mmio_req->address + mmio_req->size) <= (zone->addr + zone->size))) {
+				hit = true;
+				break;
+			}
+		}
+
+		if (hit) {
+			spinlock_obtain(&vm->coalesced_lock);
+			stac();
+			last = ring->last;
+			next = (last + 1U) % ACRN_COALESCED_MMIO_MAX;
+			/* the indexes live in SOS memory, a full ring falls back to the ioreq */
+			if ((last < ACRN_COALESCED_MMIO_MAX) && (next != ring->first)) {
+				entry = &ring->entries[last];
+				entry->address = mmio_req->address;
+				entry->value = mmio_req->value;
+				entry->size = (uint32_t)mmio_req->size;
+				/* the device model may consume it as soon as last moves */
+				cpu_write_memory_barrier();
+				ring->last = next;
+				coalesced = true;
+			}
+			clac();
+			spinlock_release(&vm->coalesced_lock);
 		}
 	}
 
-	if ((status == -ENODEV) && (read_write != NULL)) {
-		status = read_write(io_req, handler_private_data);
+	return coalesced;
+}
+
+/**
+ * @brief Emulate \p io_req from the simple registers the device model
+ * published in vm->pio_regs, if any
+ *
+ * @return true if \p io_req accesses a register whose flags let the
+ *         hypervisor complete it, the value of a read is filled in then.
+ */
+static bool emulate_pio_regs(struct acrn_vm *vm, struct io_request *io_req)
+{
+	struct acrn_pio_regs *regs = vm->pio_regs;
+	struct pio_request *pio_req = &io_req->reqs.pio;
+	struct acrn_pio_reg *reg = NULL;
+	uint32_t i, num, flags = 0U, wmask;
+	bool hit = false;
+
+	if ((regs != NULL) && (io_req->io_type == REQ_PORTIO)) {
+		stac();
+		num = regs->num_regs;
+		if (num > ACRN_PIO_REGS_MAX) {
+			num = ACRN_PIO_REGS_MAX;
+		}
+		for (i = 0U; i < num; i++) {
+			flags = regs->regs[i].flags;
+			if ((flags != 0U) && ((uint64_t)regs->regs[i].port == pio_req->address) &&
+					((uint64_t)regs->regs[i].size == pio_req->size)) {
+				reg = &regs->regs[i];
+				break;
+			}
+		}
+
+		if (reg != NULL) {
+			if (pio_req->direction == REQUEST_READ) {
+				if ((flags & ACRN_PIO_REG_FLAG_READ) != 0U) {
+					pio_req->value = reg->value;
+					hit = true;
+				}
+			} else if ((flags & ACRN_PIO_REG_FLAG_LATCH) != 0U) {
+				spinlock_obtain(&vm->pio_regs_lock);
+				wmask = reg->wmask;
+				reg->value = (reg->value & ~wmask) | (pio_req->value & wmask);
+				spinlock_release(&vm->pio_regs_lock);
+				hit = true;
+			} else {
+				/* the device model emulates the write */
+			}
+		}
+		clac();
 	}
 
-	return status;
+	return hit;
 }
 
 /**
@@ -563,21 +987,36 @@ emulate_io(struct acrn_vcpu *vcpu, struct io_request *io_req)
 		/*
 		 * No handler from HV side, search from VHM in Dom0
 		 *
+		 * A doorbell write is complete once SOS is notified, otherwise
 		 * ACRN insert request to VHM and inject upcall.
 		 */
-		status = acrn_insert_request(vcpu, io_req);
-		if (status == 0) {
-			dm_emulate_io_complete(vcpu);
+		if (hit_doorbell(vcpu->vm, io_req) || coalesce_mmio_write(vcpu->vm, io_req) ||
+				vpci_emulate_ivshmem_doorbell(vcpu->vm, io_req)) {
+			/* a write, nothing to complete */
+			status = 0;
+		} else if (emulate_timer_counter(vcpu->vm, io_req) || emulate_pio_regs(vcpu->vm, io_req) ||
+				emulate_emul_msix(vcpu->vm, io_req) || vpci_emulate_cfg_shadow(vcpu->vm, io_req)) {
+			status = 0;
+			if (io_req->io_type == REQ_PORTIO) {
+				emulate_pio_complete(vcpu, io_req);
+			} else {
+				emulate_mmio_complete(vcpu, io_req);
+			}
 		} else {
-			/* here for both IO & MMIO, the direction, address,
-			 * size definition is same
-			 */
-			struct pio_request *pio_req = &io_req->reqs.pio;
+			status = acrn_insert_request(vcpu, io_req);
+			if (status == 0) {
+				dm_emulate_io_complete(vcpu);
+			} else {
+				/* here for both IO & MMIO, the direction, address,
+				 * size definition is same
+				 */
+				struct pio_request *pio_req = &io_req->reqs.pio;
 
-			pr_fatal("%s Err: access dir %d, io_type %d, "
-				"addr = 0x%llx, size=%lu", __func__,
-				pio_req->direction, io_req->io_type,
-				pio_req->address, pio_req->size);
+				pr_fatal("%s Err: access dir %d, io_type %d, "
+					"addr = 0x%llx, size=%lu", __func__,
+					pio_req->direction, io_req->io_type,
+					pio_req->address, pio_req->size);
+			}
 		}
 	}
 
@@ -598,13 +1037,35 @@ emulate_io(struct acrn_vcpu *vcpu, struct io_request *io_req)
 void register_pio_emulation_handler(struct acrn_vm *vm, uint32_t pio_idx,
 		const struct vm_io_range *range, io_read_fn_t io_read_fn_ptr, io_write_fn_t io_write_fn_ptr)
 {
+	const struct vm_io_handler_desc *handler;
+	uint32_t idx;
+	uint16_t i, nr = 0U;
+
 	if (is_sos_vm(vm)) {
 		deny_guest_pio_access(vm, range->base, range->len);
 	}
+
+	spinlock_obtain(&vm->emul_mmio_lock);
 	vm->emul_pio[pio_idx].port_start = range->base;
 	vm->emul_pio[pio_idx].port_end = range->base + range->len;
 	vm->emul_pio[pio_idx].io_read = io_read_fn_ptr;
 	vm->emul_pio[pio_idx].io_write = io_write_fn_ptr;
+
+	/* rebuild emul_pio_sorted by insertion sort, a pio_idx may be registered again */
+	for (idx = 0U; idx < EMUL_PIO_IDX_MAX; idx++) {
+		handler = &vm->emul_pio[idx];
+		if (handler->port_end > handler->port_start) {
+			i = nr;
+			while ((i > 0U) && (vm->emul_pio[vm->emul_pio_sorted[i - 1U]].port_start > handler->port_start)) {
+				vm->emul_pio_sorted[i] = vm->emul_pio_sorted[i - 1U];
+				i--;
+			}
+			vm->emul_pio_sorted[i] = (uint8_t)idx;
+			nr++;
+		}
+	}
+	vm->emul_pio_regions = nr;
+	spinlock_release(&vm->emul_mmio_lock);
 }
 
 /**
@@ -626,20 +1087,35 @@ void register_mmio_emulation_handler(struct acrn_vm *vm,
 	uint64_t end, void *handler_private_data)
 {
 	struct mem_io_node *mmio_node;
+	uint16_t idx, i;
 
 	/* Ensure both a read/write handler and range check function exist */
 	if ((read_write != NULL) && (end > start)) {
+		spinlock_obtain(&vm->emul_mmio_lock);
 		if (vm->emul_mmio_regions >= CONFIG_MAX_EMULATED_MMIO_REGIONS) {
+			spinlock_release(&vm->emul_mmio_lock);
 			pr_err("the emulated mmio region is out of range");
 		} else {
-			mmio_node = &(vm->emul_mmio[vm->emul_mmio_regions]);
+			idx = vm->emul_mmio_regions;
+			mmio_node = &(vm->emul_mmio[idx]);
 			/* Fill in information for this node */
 			mmio_node->read_write = read_write;
 			mmio_node->handler_private_data = handler_private_data;
 			mmio_node->range_start = start;
 			mmio_node->range_end = end;
 
+			/* keep emul_mmio_sorted ordered by range_start */
+			i = idx;
+			while ((i > 0U) && (vm->emul_mmio[vm->emul_mmio_sorted[i - 1U]].range_start > start)) {
+				vm->emul_mmio_sorted[i] = vm->emul_mmio_sorted[i - 1U];
+				i--;
+			}
+			vm->emul_mmio_sorted[i] = idx;
+
+			/* the node shall be filled before it is visible to the lockless lookup */
+			cpu_write_memory_barrier();
 			(vm->emul_mmio_regions)++;
+			spinlock_release(&vm->emul_mmio_lock);
 
 			/*
 			 * SOS would map all its memory at beginning, so we
@@ -675,3 +1151,105 @@ void register_mmio_default_emulation_handler(struct acrn_vm *vm)
 {
 	vm->default_read_write = mmio_default_access_handler;
 }
+
+/**
+ * @pre vm != NULL && doorbell != NULL
+ */
+int32_t register_doorbell(struct acrn_vm *vm, const struct acrn_doorbell *doorbell)
+{
+	int32_t ret = -EINVAL;
+	uint16_t idx = doorbell->index;
+
+	if ((idx < ACRN_DOORBELL_MAX) && ((doorbell->len == 1U) || (doorbell->len == 2U) ||
+			(doorbell->len == 4U) || ((doorbell->len == 8U) && ((doorbell->flags & ACRN_DOORBELL_FLAG_PIO) == 0U)))) {
+		if (bitmap_test(idx, &vm->doorbell_active)) {
+			ret = -EBUSY;
+		} else {
+			vm->doorbells[idx] = *doorbell;
+			/* hit_doorbell() may look at it as soon as it is active */
+			cpu_write_memory_barrier();
+			bitmap_set_lock(idx, &vm->doorbell_active);
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @pre vm != NULL && index < ACRN_DOORBELL_MAX
+ */
+void unregister_doorbell(struct acrn_vm *vm, uint16_t index)
+{
+	bitmap_clear_lock(index, &vm->doorbell_active);
+}
+
+/**
+ * @pre vm != NULL
+ */
+void ring_doorbells(struct acrn_vm *vm, uint64_t mask)
+{
+	uint64_t old;
+
+	do {
+		old = vm->doorbell_pending;
+	} while (atomic_cmpxchg64(&vm->doorbell_pending, old, old | mask) != old);
+
+	/* otherwise the upcall of the pending ones is not handled by SOS yet */
+	if (old == 0UL) {
+		arch_fire_vhm_interrupt();
+	}
+}
+
+/**
+ * @pre vm != NULL && zone != NULL
+ */
+int32_t register_coalesced_mmio_zone(struct acrn_vm *vm, const struct acrn_coalesced_mmio_zone *zone)
+{
+	int32_t ret;
+	uint16_t idx;
+
+	if ((zone->size == 0U) || ((zone->addr + zone->size) < zone->addr)) {
+		ret = -EINVAL;
+	} else {
+		spinlock_obtain(&vm->coalesced_lock);
+		idx = ffz64(vm->coalesced_active);
+		if (idx >= ACRN_COALESCED_MMIO_ZONES) {
+			ret = -ENOSPC;
+		} else {
+			vm->coalesced_zones[idx] = *zone;
+			/* coalesce_mmio_write() may look at it as soon as it is active */
+			cpu_write_memory_barrier();
+			bitmap_set_lock(idx, &vm->coalesced_active);
+			ret = 0;
+		}
+		spinlock_release(&vm->coalesced_lock);
+	}
+
+	return ret;
+}
+
+/**
+ * @pre vm != NULL && zone != NULL
+ */
+int32_t unregister_coalesced_mmio_zone(struct acrn_vm *vm, const struct acrn_coalesced_mmio_zone *zone)
+{
+	int32_t ret = -ENOENT;
+	uint64_t active;
+	uint16_t idx;
+
+	spinlock_obtain(&vm->coalesced_lock);
+	active = vm->coalesced_active;
+	while (active != 0UL) {
+		idx = ffs64(active);
+		bitmap_clear_nolock(idx, &active);
+		if ((vm->coalesced_zones[idx].addr == zone->addr) && (vm->coalesced_zones[idx].size == zone->size)) {
+			bitmap_clear_lock(idx, &vm->coalesced_active);
+			ret = 0;
+			break;
+		}
+	}
+	spinlock_release(&vm->coalesced_lock);
+
+	return ret;
+}
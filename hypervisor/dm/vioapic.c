@@ -96,14 +96,14 @@ vioapic_set_pinstate(struct acrn_vioapic *vioapic, uint32_t pin, uint32_t level)
 		old_lvl = (uint32_t)bitmap_test((uint16_t)(pin & 0x3FU), &vioapic->pin_state[pin >> 6U]);
 		if (level == 0U) {
 			/* clear pin_state and deliver interrupt according to polarity */
-			bitmap_clear_nolock((uint16_t)(pin & 0x3FU), &vioapic->pin_state[pin >> 6U]);
+			bitmap_clear_lock((uint16_t)(pin & 0x3FU), &vioapic->pin_state[pin >> 6U]);
 			if ((rte.bits.intr_polarity == IOAPIC_RTE_INTPOL_ALO)
 				&& old_lvl != level) {
 				vioapic_generate_intr(vioapic, pin);
 			}
 		} else {
 			/* set pin_state and deliver intrrupt according to polarity */
-			bitmap_set_nolock((uint16_t)(pin & 0x3FU), &vioapic->pin_state[pin >> 6U]);
+			bitmap_set_lock((uint16_t)(pin & 0x3FU), &vioapic->pin_state[pin >> 6U]);
 			if ((rte.bits.intr_polarity == IOAPIC_RTE_INTPOL_AHI)
 				&& old_lvl != level) {
 				vioapic_generate_intr(vioapic, pin);
@@ -116,7 +116,7 @@ vioapic_set_pinstate(struct acrn_vioapic *vioapic, uint32_t pin, uint32_t level)
  * @brief Set vIOAPIC IRQ line status.
  *
  * Similar with vioapic_set_irqline_lock(),but would not make sure
- * operation be done with ioapic lock.
+ * operation be done with the lock of the pin, the caller holds it.
  *
  * @param[in] vm        Pointer to target VM
  * @param[in] irqline   Target IRQ number
@@ -178,9 +178,10 @@ vioapic_set_irqline_lock(const struct acrn_vm *vm, uint32_t irqline, uint32_t op
 	uint64_t rflags;
 	struct acrn_vioapic *vioapic = vm_ioapic(vm);
 	if (vioapic->ready) {
-		spinlock_irqsave_obtain(&(vioapic->mtx), &rflags);
+		/* the other pins are left to the other sources */
+		spinlock_irqsave_obtain(&(vioapic->pin_lock[irqline]), &rflags);
 		vioapic_set_irqline_nolock(vm, irqline, operation);
-		spinlock_irqrestore_release(&(vioapic->mtx), rflags);
+		spinlock_irqrestore_release(&(vioapic->pin_lock[irqline]), rflags);
 	}
 }
 
@@ -245,10 +246,20 @@ static inline bool vioapic_need_intr(const struct acrn_vioapic *vioapic, uint16_
 	return ret;
 }
 
+static inline void vioapic_map_vector_pin(struct acrn_vioapic *vioapic, uint32_t vector, uint32_t pin)
+{
+	bitmap_set_nolock((uint16_t)(pin & 0x3FU), &vioapic->vector_pins[vector & 0xFFU][pin >> 6U]);
+}
+
+static inline void vioapic_unmap_vector_pin(struct acrn_vioapic *vioapic, uint32_t vector, uint32_t pin)
+{
+	bitmap_clear_nolock((uint16_t)(pin & 0x3FU), &vioapic->vector_pins[vector & 0xFFU][pin >> 6U]);
+}
+
 /*
  * Due to the race between vcpus and vioapic->mtx could be accessed from softirq, ensure to do
  * spinlock_irqsave_obtain(&(vioapic->mtx), &rflags) & spinlock_irqrestore_release(&(vioapic->mtx), rflags)
- * by caller.
+ * by caller. The RTE of the pin is updated with its pin_lock held as well.
  */
 static void vioapic_indirect_write(struct acrn_vioapic *vioapic, uint32_t addr, uint32_t data)
 {
@@ -282,6 +293,7 @@ static void vioapic_indirect_write(struct acrn_vioapic *vioapic, uint32_t addr,
 		uint32_t rte_offset = addr_offset >> 1U;
 		pin = rte_offset;
 
+		spinlock_obtain(&(vioapic->pin_lock[pin]));
 		last = vioapic->rtbl[pin];
 		new = last;
 		if ((addr_offset & 1U) != 0U) {
@@ -325,6 +337,10 @@ static void vioapic_indirect_write(struct acrn_vioapic *vioapic, uint32_t addr,
 
 		if (wire_mode_valid) {
 			vioapic->rtbl[pin] = new;
+			if (changed.bits.vector != 0UL) {
+				vioapic_unmap_vector_pin(vioapic, (uint32_t)last.bits.vector, pin);
+				vioapic_map_vector_pin(vioapic, (uint32_t)new.bits.vector, pin);
+			}
 			dev_dbg(ACRN_DBG_IOAPIC, "ioapic pin%hhu: redir table entry %#lx",
 				pin, vioapic->rtbl[pin].full);
 
@@ -348,6 +364,7 @@ static void vioapic_indirect_write(struct acrn_vioapic *vioapic, uint32_t addr,
 				vioapic_generate_intr(vioapic, pin);
 			}
 		}
+		spinlock_release(&(vioapic->pin_lock[pin]));
 	}
 }
 
@@ -401,8 +418,11 @@ vioapic_process_eoi(struct acrn_vm *vm, uint32_t vector)
 {
 	struct acrn_vioapic *vioapic;
 	uint32_t pin, pincount = vioapic_pincount(vm);
+	uint64_t pins[STATE_BITMAP_SIZE], left;
 	union ioapic_rte rte;
 	uint64_t rflags;
+	uint32_t i;
+	uint16_t bit;
 
 	if ((vector < VECTOR_DYNAMIC_START) || (vector > NR_MAX_VECTOR)) {
 		pr_err("vioapic_process_eoi: invalid vector %u", vector);
@@ -411,37 +431,53 @@ vioapic_process_eoi(struct acrn_vm *vm, uint32_t vector)
 	vioapic = vm_ioapic(vm);
 	dev_dbg(ACRN_DBG_IOAPIC, "ioapic processing eoi for vector %u", vector);
 
-	/* notify device to ack if assigned pin */
-	for (pin = 0U; pin < pincount; pin++) {
-		rte = vioapic->rtbl[pin];
-		if ((rte.bits.vector != vector) ||
-			(rte.bits.remote_irr == 0U)) {
-			continue;
-		}
-
-		ptirq_intx_ack(vm, pin, PTDEV_VPIN_IOAPIC);
-	}
-
 	/*
-	 * XXX keep track of the pins associated with this vector instead
-	 * of iterating on every single pin each time.
+	 * only the pins programmed with this vector are looked at, vector_pins
+	 * is updated with the RTEs under mtx
 	 */
 	spinlock_irqsave_obtain(&(vioapic->mtx), &rflags);
-	for (pin = 0U; pin < pincount; pin++) {
-		rte = vioapic->rtbl[pin];
-		if ((rte.bits.vector != vector) ||
-			(rte.bits.remote_irr == 0U)) {
-			continue;
+	for (i = 0U; i < STATE_BITMAP_SIZE; i++) {
+		pins[i] = vioapic->vector_pins[vector & 0xFFU][i];
+	}
+	spinlock_irqrestore_release(&(vioapic->mtx), rflags);
+
+	/* notify device to ack if assigned pin */
+	for (i = 0U; i < STATE_BITMAP_SIZE; i++) {
+		left = pins[i];
+		bit = ffs64(left);
+		while (bit != INVALID_BIT_INDEX) {
+			bitmap_clear_nolock(bit, &left);
+			pin = (i << 6U) + bit;
+			rte = vioapic->rtbl[pin];
+			if ((pin < pincount) && (rte.bits.vector == vector) && (rte.bits.remote_irr != 0U)) {
+				ptirq_intx_ack(vm, pin, PTDEV_VPIN_IOAPIC);
+			}
+			bit = ffs64(left);
 		}
+	}
 
-		vioapic->rtbl[pin].bits.remote_irr = 0U;
-		if (vioapic_need_intr(vioapic, (uint16_t)pin)) {
-			dev_dbg(ACRN_DBG_IOAPIC,
-				"ioapic pin%hhu: asserted at eoi", pin);
-			vioapic_generate_intr(vioapic, pin);
+	for (i = 0U; i < STATE_BITMAP_SIZE; i++) {
+		left = pins[i];
+		bit = ffs64(left);
+		while (bit != INVALID_BIT_INDEX) {
+			bitmap_clear_nolock(bit, &left);
+			pin = (i << 6U) + bit;
+			if (pin < pincount) {
+				spinlock_irqsave_obtain(&(vioapic->pin_lock[pin]), &rflags);
+				rte = vioapic->rtbl[pin];
+				if ((rte.bits.vector == vector) && (rte.bits.remote_irr != 0U)) {
+					vioapic->rtbl[pin].bits.remote_irr = 0U;
+					if (vioapic_need_intr(vioapic, (uint16_t)pin)) {
+						dev_dbg(ACRN_DBG_IOAPIC,
+							"ioapic pin%hhu: asserted at eoi", pin);
+						vioapic_generate_intr(vioapic, pin);
+					}
+				}
+				spinlock_irqrestore_release(&(vioapic->pin_lock[pin]), rflags);
+			}
+			bit = ffs64(left);
 		}
 	}
-	spinlock_irqrestore_release(&(vioapic->mtx), rflags);
 }
 
 void
@@ -451,9 +487,11 @@ vioapic_reset(struct acrn_vm *vm)
 	struct acrn_vioapic *vioapic = vm_ioapic(vm);
 
 	/* Initialize all redirection entries to mask all interrupts */
+	(void)memset((void *)vioapic->vector_pins, 0U, sizeof(vioapic->vector_pins));
 	pincount = vioapic_pincount(vm);
 	for (pin = 0U; pin < pincount; pin++) {
 		vioapic->rtbl[pin].full = MASK_ALL_INTERRUPTS;
+		vioapic_map_vector_pin(vioapic, (uint32_t)vioapic->rtbl[pin].bits.vector, pin);
 	}
 	vioapic->id = 0U;
 	vioapic->ioregsel = 0U;
@@ -462,8 +500,13 @@ vioapic_reset(struct acrn_vm *vm)
 void
 vioapic_init(struct acrn_vm *vm)
 {
+	uint32_t pin;
+
 	vm->arch_vm.vioapic.vm = vm;
 	spinlock_init(&(vm->arch_vm.vioapic.mtx));
+	for (pin = 0U; pin < REDIR_ENTRIES_HW; pin++) {
+		spinlock_init(&(vm->arch_vm.vioapic.pin_lock[pin]));
+	}
 
 	vioapic_reset(vm);
 
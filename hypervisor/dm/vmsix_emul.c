@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <vm.h>
+#include <errno.h>
+#include <bits.h>
+#include <io.h>
+#include <vpci.h>
+
+/*
+ * The MSI-X tables of the devices emulated by the device model live in
+ * SOS memory, see struct acrn_emul_msix. The guest accesses to the BAR
+ * holding a table and its PBA are served here, so masking, unmasking and
+ * retargeting a vector no longer make a round trip to the device model.
+ * The accesses are emulated as the device model does: 4 and 8 byte table
+ * accesses, and 1 byte reads, the PBA reads as 0.
+ *
+ * The pages of a passthrough device BAR holding its MSI-X table are
+ * registered the same way, their accesses are handed to the vPCI of the
+ * device instead of exiting to the device model.
+ */
+
+/**
+ * @pre vm != NULL && msix != NULL
+ * @pre table != NULL unless msix->flags has ACRN_EMUL_MSIX_FLAG_PTDEV
+ */
+int32_t register_emul_msix(struct acrn_vm *vm, const struct acrn_emul_msix *msix, struct msix_table_entry *table)
+{
+	uint64_t table_size = (uint64_t)msix->table_count * MSIX_TABLE_ENTRY_SIZE;
+	int32_t ret;
+	uint16_t idx;
+
+	if (((msix->addr + msix->size) < msix->addr) || (msix->size == 0UL)) {
+		ret = -EINVAL;
+	} else if ((msix->flags & ACRN_EMUL_MSIX_FLAG_PTDEV) != 0U) {
+		ret = (((msix->addr | msix->size) & (PAGE_SIZE - 1UL)) != 0UL) ? -EINVAL : 0;
+	} else if ((msix->table_count == 0U) || (msix->table_count > ACRN_EMUL_MSIX_ENTRIES) ||
+			(table_size > msix->pba_offset) || (((uint64_t)msix->pba_offset + msix->pba_size) > msix->size)) {
+		ret = -EINVAL;
+	} else {
+		ret = 0;
+	}
+
+	if (ret == 0) {
+		spinlock_obtain(&vm->emul_msix_lock);
+		idx = ffz64(vm->emul_msix_active);
+		if (idx >= ACRN_EMUL_MSIX_TABLES) {
+			ret = -ENOSPC;
+		} else {
+			vm->emul_msix[idx] = *msix;
+			vm->emul_msix_tables[idx] = table;
+			bitmap_set_nolock(idx, &vm->emul_msix_active);
+			ret = 0;
+		}
+		spinlock_release(&vm->emul_msix_lock);
+	}
+
+	return ret;
+}
+
+/**
+ * @pre vm != NULL && msix != NULL
+ */
+int32_t unregister_emul_msix(struct acrn_vm *vm, const struct acrn_emul_msix *msix)
+{
+	int32_t ret = -ENOENT;
+	uint64_t active;
+	uint16_t idx;
+
+	spinlock_obtain(&vm->emul_msix_lock);
+	active = vm->emul_msix_active;
+	while (active != 0UL) {
+		idx = ffs64(active);
+		bitmap_clear_nolock(idx, &active);
+		if ((vm->emul_msix[idx].addr == msix->addr) && (vm->emul_msix[idx].size == msix->size)) {
+			bitmap_clear_nolock(idx, &vm->emul_msix_active);
+			vm->emul_msix_tables[idx] = NULL;
+			ret = 0;
+			break;
+		}
+	}
+	spinlock_release(&vm->emul_msix_lock);
+
+	return ret;
+}
+
+/**
+ * @pre msix != NULL && table != NULL && mmio_req != NULL
+ * @pre offset < msix->size
+ */
+static void access_emul_msix(const struct acrn_emul_msix *msix, struct msix_table_entry *table,
+		struct mmio_request *mmio_req, uint64_t offset)
+{
+	uint64_t value = ~0UL;
+	uint64_t size = mmio_req->size;
+	uint64_t entry_offset = offset % MSIX_TABLE_ENTRY_SIZE;
+	bool read = (mmio_req->direction == REQUEST_READ);
+	uint8_t *p;
+
+	if (offset < ((uint64_t)msix->table_count * MSIX_TABLE_ENTRY_SIZE)) {
+		if (((size == 4UL) || (size == 8UL) || (read && (size == 1UL))) && ((entry_offset % size) == 0UL)) {
+			p = (uint8_t *)&table[offset / MSIX_TABLE_ENTRY_SIZE] + entry_offset;
+			stac();
+			if (read) {
+				if (size == 1UL) {
+					value = *p;
+				} else if (size == 4UL) {
+					value = *(uint32_t *)p;
+				} else {
+					value = *(uint64_t *)p;
+				}
+			} else {
+				if (size == 4UL) {
+					*(uint32_t *)p = (uint32_t)mmio_req->value;
+				} else {
+					*(uint64_t *)p = mmio_req->value;
+				}
+			}
+			clac();
+		}
+	} else if ((offset >= msix->pba_offset) && (offset < ((uint64_t)msix->pba_offset + msix->pba_size))) {
+		/* the pending bits are not emulated */
+		value = 0UL;
+	} else {
+		/* reads as all ones, writes are ignored */
+	}
+
+	if (read) {
+		mmio_req->value = value;
+	}
+}
+
+/**
+ * @pre vm != NULL && io_req != NULL
+ */
+bool emulate_emul_msix(struct acrn_vm *vm, struct io_request *io_req)
+{
+	struct mmio_request *mmio_req = &io_req->reqs.mmio;
+	const struct acrn_emul_msix *msix;
+	uint64_t active;
+	uint16_t idx;
+	bool hit = false;
+
+	if ((io_req->io_type == REQ_MMIO) && (vm->emul_msix_active != 0UL)) {
+		spinlock_obtain(&vm->emul_msix_lock);
+		active = vm->emul_msix_active;
+		while ((active != 0UL) && !hit) {
+			idx = ffs64(active);
+			bitmap_clear_nolock(idx, &active);
+			msix = &vm->emul_msix[idx];
+			if ((mmio_req->address >= msix->addr) && (mmio_req->address < (msix->addr + msix->size))) {
+				if ((msix->flags & ACRN_EMUL_MSIX_FLAG_PTDEV) != 0U) {
+					hit = vpci_ptdev_msix_access(vm, msix->virt_bdf, mmio_req,
+							mmio_req->address - msix->addr);
+				} else {
+					access_emul_msix(msix, vm->emul_msix_tables[idx], mmio_req,
+							mmio_req->address - msix->addr);
+					hit = true;
+				}
+			}
+		}
+		spinlock_release(&vm->emul_msix_lock);
+	}
+
+	return hit;
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <vm.h>
+#include <io.h>
+#include <vpci.h>
+
+/*
+ * The PCI devices of a post-launched VM are emulated by the device model,
+ * which pushes the read-only bytes of their config space, see struct
+ * acrn_pci_cfg_shadow. Guest enumeration and driver probing mostly read
+ * these bytes, or probe BDFs without a device, so serving those reads here
+ * saves the round trips to the device model.
+ */
+
+static inline bool cfg_shadow_valid_access(uint32_t reg, uint32_t bytes)
+{
+	return (((bytes == 1U) || (bytes == 2U) || (bytes == 4U)) && ((reg & (bytes - 1U)) == 0U));
+}
+
+/**
+ * @pre shadow->num_devs <= ACRN_PCI_CFG_SHADOW_DEVS
+ */
+static bool read_cfg_shadow(const struct acrn_pci_cfg_shadow *shadow, uint16_t bdf,
+		uint32_t reg, uint32_t bytes, uint32_t *val)
+{
+	const struct acrn_pci_cfg_shadow_dev *dev = NULL;
+	uint32_t i, mask;
+	bool hit = false;
+
+	if (cfg_shadow_valid_access(reg, bytes)) {
+		for (i = 0U; (i < shadow->num_devs) && (dev == NULL); i++) {
+			if (shadow->devs[i].bdf == bdf) {
+				dev = &shadow->devs[i];
+			}
+		}
+
+		if (dev != NULL) {
+			mask = (1U << bytes) - 1U;
+			if (((reg + bytes) <= ACRN_PCI_CFG_SHADOW_SIZE) &&
+					((uint32_t)(dev->ro_mask >> reg) & mask) == mask) {
+				*val = 0U;
+				for (i = 0U; i < bytes; i++) {
+					*val |= (uint32_t)dev->cfg[reg + i] << (i * 8U);
+				}
+				hit = true;
+			}
+		} else if ((shadow->flags & ACRN_PCI_CFG_SHADOW_COMPLETE) != 0U) {
+			/* no device at this BDF */
+			*val = ~0U;
+			hit = true;
+		} else {
+			/* not in the shadow, ask the device model */
+		}
+	}
+
+	return hit;
+}
+
+/**
+ * @pre vpci->cfg_shadow_lock is held
+ */
+static bool emulate_cfg_shadow_pio(struct acrn_vpci *vpci, struct pio_request *pio_req)
+{
+	uint32_t addr, reg, val;
+	bool hit = false;
+
+	if (pio_req->address == PCI_CONFIG_ADDR) {
+		if ((pio_req->direction == REQUEST_WRITE) && (pio_req->size == 4UL)) {
+			/* the device model keeps its own copy of the address */
+			vpci->cfg_shadow_addr = pio_req->value;
+		}
+	} else if ((pio_req->direction == REQUEST_READ) && (pio_req->address >= PCI_CONFIG_DATA) &&
+			(pio_req->address < (PCI_CONFIG_DATA + 4UL))) {
+		addr = vpci->cfg_shadow_addr;
+		if ((addr & PCI_CFG_ENABLE) != 0U) {
+			/* the register number is taken as is, as the device model does */
+			reg = (addr & 0xffU) + (uint32_t)(pio_req->address - PCI_CONFIG_DATA);
+			hit = read_cfg_shadow(&vpci->cfg_shadow, (uint16_t)(addr >> 8U), reg,
+					(uint32_t)pio_req->size, &val);
+			if (hit) {
+				pio_req->value = val;
+			}
+		}
+	} else {
+		/* not a config access */
+	}
+
+	return hit;
+}
+
+/**
+ * @pre vpci->cfg_shadow_lock is held
+ */
+static bool emulate_cfg_shadow_mmio(struct acrn_vpci *vpci, struct mmio_request *mmio_req)
+{
+	const struct acrn_pci_cfg_shadow *shadow = &vpci->cfg_shadow;
+	uint64_t offset;
+	uint32_t val;
+	bool hit = false;
+
+	if ((mmio_req->direction == REQUEST_READ) && (shadow->ecfg_base != 0UL) &&
+			(mmio_req->address >= shadow->ecfg_base) &&
+			(mmio_req->address < (shadow->ecfg_base + shadow->ecfg_size))) {
+		offset = mmio_req->address - shadow->ecfg_base;
+		hit = read_cfg_shadow(shadow, (uint16_t)(offset >> 12U), (uint32_t)(offset & 0xfffUL),
+				(uint32_t)mmio_req->size, &val);
+		if (hit) {
+			mmio_req->value = val;
+		}
+	}
+
+	return hit;
+}
+
+/**
+ * @pre vm != NULL && io_req != NULL
+ */
+bool vpci_emulate_cfg_shadow(struct acrn_vm *vm, struct io_request *io_req)
+{
+	struct acrn_vpci *vpci = &vm->vpci;
+	uint64_t addr;
+	bool hit = false;
+
+	if (is_postlaunched_vm(vm)) {
+		if (io_req->io_type == REQ_PORTIO) {
+			addr = io_req->reqs.pio.address;
+			if ((addr >= PCI_CONFIG_ADDR) && (addr < (PCI_CONFIG_DATA + 4UL))) {
+				spinlock_obtain(&vpci->cfg_shadow_lock);
+				hit = emulate_cfg_shadow_pio(vpci, &io_req->reqs.pio);
+				spinlock_release(&vpci->cfg_shadow_lock);
+			}
+		} else if ((io_req->io_type == REQ_MMIO) && (io_req->reqs.mmio.direction == REQUEST_READ)) {
+			spinlock_obtain(&vpci->cfg_shadow_lock);
+			hit = emulate_cfg_shadow_mmio(vpci, &io_req->reqs.mmio);
+			spinlock_release(&vpci->cfg_shadow_lock);
+		} else {
+			/* nothing to do for the other requests */
+		}
+	}
+
+	return hit;
+}
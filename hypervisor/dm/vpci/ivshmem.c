@@ -0,0 +1,661 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Inter-VM shared memory device, the ivshmem device of QEMU without the
+ * legacy interrupt: BAR0 holds the registers, BAR1 the MSI-X table and PBA
+ * of ACRN_IVSHMEM_VECTORS vectors, BAR2 the shared memory.
+ *
+ * The shared memory is a region of the carve-out at CONFIG_IVSHMEM_SHM_BASE,
+ * mapped in the EPT of all the VMs attached to it. A write of
+ * (peer << 16) | vector to the doorbell register raises the MSI-X vector of
+ * the peer with that IVPosition in the region, the vectors rung while masked
+ * are kept pending.
+ *
+ * The devices of SOS and of the pre-launched VMs are emulated here, their
+ * BARs are fixed to the vbar_base of their configuration. The devices of the
+ * post-launched VMs are emulated by the device model, it attaches them with
+ * HC_VM_IVSHMEM. Their doorbell writes are still served here, their vectors
+ * are raised from the MSI-X table registered with HC_VM_SET_EMUL_MSIX and
+ * the ones rung while masked are lost, as the PBA of these tables reads as 0.
+ */
+
+#include <vm.h>
+#include <errno.h>
+#include <atomic.h>
+#include <bits.h>
+#include <ept.h>
+#include <mmu.h>
+#include <io.h>
+#include <vpci.h>
+#include <logmsg.h>
+#include "vpci_priv.h"
+
+#define IVSHMEM_VENDOR		0x1af4U
+#define IVSHMEM_DEVICE		0x1110U
+#define IVSHMEM_REVID		0x1U
+
+#define IVSHMEM_REGS_BAR	0U
+#define IVSHMEM_MSIX_BAR	1U
+#define IVSHMEM_SHM_BAR		2U
+#define IVSHMEM_NR_BARS		4U
+
+#define IVSHMEM_MSIX_CAPOFF	0x40U
+#define IVSHMEM_PBA_OFFSET	0x800U
+
+#define IVSHMEM_MAX_REGIONS	8U
+#define IVSHMEM_MAX_PEERS	8U
+
+struct ivshmem_peer {
+	struct acrn_vm *vm;		/* NULL if the IVPosition is free */
+	struct pci_vdev *vdev;		/* NULL if emulated by the device model */
+	uint64_t shm_gpa;		/* 0 if the region is not mapped */
+	uint64_t regs_gpa;
+	uint64_t msix_gpa;
+	uint64_t pending;		/* vectors rung while masked, vdev only */
+};
+
+struct ivshmem_region {
+	spinlock_t lock;		/* protects peers, free when zeroed */
+	struct ivshmem_peer peers[IVSHMEM_MAX_PEERS];
+};
+
+static struct ivshmem_region ivshmem_regions[IVSHMEM_MAX_REGIONS];
+
+/* peers emulated by the device model, to skip the lookup of their doorbells */
+static uint32_t ivshmem_dm_peers;
+
+static uint16_t ivshmem_region_num(void)
+{
+	uint64_t num = CONFIG_IVSHMEM_SHM_SIZE / CONFIG_IVSHMEM_REGION_SIZE;
+
+	if (num > IVSHMEM_MAX_REGIONS) {
+		num = IVSHMEM_MAX_REGIONS;
+	}
+
+	return (uint16_t)num;
+}
+
+static inline uint64_t ivshmem_region_hpa(uint16_t region_id)
+{
+	return CONFIG_IVSHMEM_SHM_BASE + ((uint64_t)region_id * CONFIG_IVSHMEM_REGION_SIZE);
+}
+
+/**
+ * @pre vm != NULL
+ */
+static void ivshmem_unmap_gpa(struct acrn_vm *vm, uint64_t gpa, uint64_t size)
+{
+	if (gpa2hpa(vm, gpa) != INVALID_HPA) {
+		ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, gpa, size);
+	}
+}
+
+/**
+ * @pre peer != NULL && peer->vm != NULL
+ */
+static void ivshmem_map_shm(struct ivshmem_peer *peer, uint16_t region_id, uint64_t gpa)
+{
+	struct acrn_vm *vm = peer->vm;
+
+	if (peer->shm_gpa != gpa) {
+		if (peer->shm_gpa != 0UL) {
+			ept_del_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, peer->shm_gpa, CONFIG_IVSHMEM_REGION_SIZE);
+			peer->shm_gpa = 0UL;
+		}
+		if (gpa != 0UL) {
+			ivshmem_unmap_gpa(vm, gpa, CONFIG_IVSHMEM_REGION_SIZE);
+			ept_add_mr(vm, (uint64_t *)vm->arch_vm.nworld_eptp, ivshmem_region_hpa(region_id), gpa,
+				CONFIG_IVSHMEM_REGION_SIZE, EPT_RD | EPT_WR | EPT_WB);
+			peer->shm_gpa = gpa;
+		}
+	}
+}
+
+/**
+ * @pre region != NULL && vm != NULL
+ * @pre the lock of the region is held
+ *
+ * @return the IVPosition of the new peer, IVSHMEM_MAX_PEERS if none is free.
+ */
+static uint16_t ivshmem_alloc_peer(struct ivshmem_region *region, struct acrn_vm *vm, struct pci_vdev *vdev)
+{
+	uint16_t ivpos;
+
+	for (ivpos = 0U; ivpos < IVSHMEM_MAX_PEERS; ivpos++) {
+		if (region->peers[ivpos].vm == NULL) {
+			(void)memset(&region->peers[ivpos], 0U, sizeof(struct ivshmem_peer));
+			region->peers[ivpos].vm = vm;
+			region->peers[ivpos].vdev = vdev;
+			break;
+		}
+	}
+
+	return ivpos;
+}
+
+/**
+ * @pre vdev != NULL
+ * @pre the lock of the region of vdev is held
+ */
+static struct ivshmem_peer *ivshmem_vdev_peer(const struct pci_vdev *vdev)
+{
+	struct ivshmem_region *region = &ivshmem_regions[vdev->pci_dev_config->shm_region_id];
+	struct ivshmem_peer *peer = NULL;
+	uint16_t ivpos;
+
+	for (ivpos = 0U; ivpos < IVSHMEM_MAX_PEERS; ivpos++) {
+		if (region->peers[ivpos].vdev == vdev) {
+			peer = &region->peers[ivpos];
+			break;
+		}
+	}
+
+	return peer;
+}
+
+/**
+ * @pre peer != NULL && peer->vdev != NULL
+ * @pre the lock of the region of the peer is held
+ */
+static void ivshmem_notify_vdev(struct ivshmem_peer *peer, uint16_t vector)
+{
+	struct pci_vdev *vdev = peer->vdev;
+	const struct msix_table_entry *entry = &vdev->msix.table_entries[vector];
+	uint16_t msgctrl = pci_vdev_read_cfg_u16(vdev, vdev->msix.capoff + PCIR_MSIX_CTRL);
+
+	if (((msgctrl & (PCIM_MSIXCTRL_MSIX_ENABLE | PCIM_MSIXCTRL_FUNCTION_MASK)) != PCIM_MSIXCTRL_MSIX_ENABLE) ||
+			((entry->vector_control & PCIM_MSIX_VCTRL_MASK) != 0U) || (peer->vm->state != VM_STARTED)) {
+		peer->pending |= (1UL << vector);
+	} else {
+		peer->pending &= ~(1UL << vector);
+		(void)vlapic_intr_msi(peer->vm, entry->addr, entry->data);
+	}
+}
+
+/**
+ * @pre peer != NULL && peer->vdev == NULL
+ */
+static void ivshmem_notify_emul_msix(const struct ivshmem_peer *peer, uint16_t vector)
+{
+	struct acrn_vm *vm = peer->vm;
+	struct msix_table_entry entry = { 0UL, 0U, PCIM_MSIX_VCTRL_MASK };
+	uint64_t active;
+	uint16_t idx;
+
+	spinlock_obtain(&vm->emul_msix_lock);
+	active = vm->emul_msix_active;
+	while (active != 0UL) {
+		idx = ffs64(active);
+		bitmap_clear_nolock(idx, &active);
+		if ((vm->emul_msix[idx].addr == peer->msix_gpa) && (vector < vm->emul_msix[idx].table_count)) {
+			stac();
+			entry = vm->emul_msix_tables[idx][vector];
+			clac();
+			break;
+		}
+	}
+	spinlock_release(&vm->emul_msix_lock);
+
+	if (((entry.vector_control & PCIM_MSIX_VCTRL_MASK) == 0U) && (vm->state == VM_STARTED)) {
+		(void)vlapic_intr_msi(vm, entry.addr, entry.data);
+	}
+}
+
+/**
+ * @pre region != NULL
+ * @pre the lock of the region is held
+ */
+static void ivshmem_ring(struct ivshmem_region *region, uint32_t doorbell)
+{
+	uint16_t ivpos = (uint16_t)(doorbell >> 16U);
+	uint16_t vector = (uint16_t)(doorbell & 0xffffU);
+	struct ivshmem_peer *peer;
+
+	if ((ivpos < IVSHMEM_MAX_PEERS) && (vector < ACRN_IVSHMEM_VECTORS)) {
+		peer = &region->peers[ivpos];
+		if (peer->vm == NULL) {
+			/* no such peer, the doorbell is lost */
+		} else if (peer->vdev != NULL) {
+			ivshmem_notify_vdev(peer, vector);
+		} else {
+			ivshmem_notify_emul_msix(peer, vector);
+		}
+	}
+}
+
+/**
+ * @pre peer != NULL && peer->vdev != NULL
+ * @pre the lock of the region of the peer is held
+ */
+static void ivshmem_flush_pending(struct ivshmem_peer *peer)
+{
+	uint64_t pending = peer->pending;
+	uint16_t vector;
+
+	while (pending != 0UL) {
+		vector = ffs64(pending);
+		bitmap_clear_nolock(vector, &pending);
+		ivshmem_notify_vdev(peer, vector);
+	}
+}
+
+/**
+ * @pre io_req != NULL && handler_private_data != NULL
+ */
+static int32_t ivshmem_regs_access_handler(struct io_request *io_req, void *handler_private_data)
+{
+	struct mmio_request *mmio = &io_req->reqs.mmio;
+	struct pci_vdev *vdev = (struct pci_vdev *)handler_private_data;
+	struct ivshmem_region *region = &ivshmem_regions[vdev->pci_dev_config->shm_region_id];
+	struct ivshmem_peer *peer;
+	uint64_t offset = mmio->address - vdev->bar_base_mapped[IVSHMEM_REGS_BAR];
+
+	spinlock_obtain(&region->lock);
+	peer = ivshmem_vdev_peer(vdev);
+	if (mmio->direction == REQUEST_READ) {
+		if ((offset == ACRN_IVSHMEM_IVPOSITION) && (mmio->size == 4U) && (peer != NULL)) {
+			mmio->value = (uint64_t)(peer - &region->peers[0]);
+		} else {
+			/* the mask and status of the legacy interrupt read as 0 */
+			mmio->value = 0UL;
+		}
+	} else if ((offset == ACRN_IVSHMEM_DOORBELL) && (mmio->size == 4U)) {
+		ivshmem_ring(region, (uint32_t)mmio->value);
+	} else {
+		/* the other registers are read-only */
+	}
+	spinlock_release(&region->lock);
+
+	return 0;
+}
+
+/**
+ * @pre io_req != NULL && handler_private_data != NULL
+ */
+static int32_t ivshmem_msix_access_handler(struct io_request *io_req, void *handler_private_data)
+{
+	struct mmio_request *mmio = &io_req->reqs.mmio;
+	struct pci_vdev *vdev = (struct pci_vdev *)handler_private_data;
+	struct ivshmem_region *region = &ivshmem_regions[vdev->pci_dev_config->shm_region_id];
+	struct ivshmem_peer *peer;
+	uint64_t offset = mmio->address - vdev->bar_base_mapped[IVSHMEM_MSIX_BAR];
+	uint64_t entry_offset = offset % MSIX_TABLE_ENTRY_SIZE;
+	uint64_t value = ~0UL;
+	uint8_t *p;
+
+	spinlock_obtain(&region->lock);
+	peer = ivshmem_vdev_peer(vdev);
+	if (offset < ((uint64_t)ACRN_IVSHMEM_VECTORS * MSIX_TABLE_ENTRY_SIZE)) {
+		if (((mmio->size == 4U) || (mmio->size == 8U)) && ((entry_offset % mmio->size) == 0UL)) {
+			p = (uint8_t *)&vdev->msix.table_entries[offset / MSIX_TABLE_ENTRY_SIZE] + entry_offset;
+			if (mmio->direction == REQUEST_READ) {
+				value = (mmio->size == 4U) ? (uint64_t)*(uint32_t *)p : *(uint64_t *)p;
+			} else {
+				if (mmio->size == 4U) {
+					*(uint32_t *)p = (uint32_t)mmio->value;
+				} else {
+					*(uint64_t *)p = mmio->value;
+				}
+				/* an unmasked vector gets the doorbells rung meanwhile */
+				if (peer != NULL) {
+					ivshmem_flush_pending(peer);
+				}
+			}
+		}
+	} else if ((offset == IVSHMEM_PBA_OFFSET) && (peer != NULL)) {
+		value = peer->pending;
+	} else if (offset < (IVSHMEM_PBA_OFFSET + 8U)) {
+		value = 0UL;
+	} else {
+		/* reads as all ones, writes are ignored */
+	}
+	spinlock_release(&region->lock);
+
+	if (mmio->direction == REQUEST_READ) {
+		mmio->value = (mmio->size == 4U) ? (value & 0xffffffffUL) : value;
+	}
+
+	return 0;
+}
+
+/**
+ * @pre vdev != NULL
+ */
+static void ivshmem_init_vbar(struct pci_vdev *vdev, uint32_t idx, uint32_t type, uint64_t size)
+{
+	uint64_t base = vdev->pci_dev_config->vbar_base[idx];
+	struct pci_bar *vbar = &vdev->bar[idx];
+
+	vbar->size = size;
+	vbar->reg.value = ((uint32_t)base & PCIM_BAR_MEM_BASE) | type;
+	pci_vdev_write_cfg_u32(vdev, pci_bar_offset(idx), vbar->reg.value);
+	vdev->bar_base_mapped[idx] = base;
+
+	if ((type & PCIM_BAR_MEM_64) != 0U) {
+		vbar = &vdev->bar[idx + 1U];
+		vbar->is_64bit_high = true;
+		vbar->reg.value = (uint32_t)(base >> 32U);
+		pci_vdev_write_cfg_u32(vdev, pci_bar_offset(idx + 1U), vbar->reg.value);
+	}
+}
+
+/*
+ * The BARs are fixed, a write of all ones is for sizing, any other write
+ * leaves the base of the configuration.
+ *
+ * @pre vdev != NULL
+ * @pre idx < vdev->nr_bars
+ */
+static void ivshmem_write_vbar(struct pci_vdev *vdev, uint32_t idx, uint32_t val)
+{
+	const struct pci_bar *vbar = &vdev->bar[idx];
+	uint32_t reg = vbar->reg.value;
+
+	if (val == ~0U) {
+		if (vbar->is_64bit_high) {
+			reg = (uint32_t)(~(vdev->bar[idx - 1U].size - 1UL) >> 32U);
+		} else if (vbar->size != 0UL) {
+			reg = ((uint32_t)~(vbar->size - 1UL) & PCIM_BAR_MEM_BASE) | (reg & ~PCIM_BAR_MEM_BASE);
+		} else {
+			reg = 0U;
+		}
+	}
+	pci_vdev_write_cfg_u32(vdev, pci_bar_offset(idx), reg);
+}
+
+/**
+ * @pre vdev != NULL
+ */
+static void ivshmem_write_msixcap(struct pci_vdev *vdev, uint32_t offset, uint32_t bytes, uint32_t val)
+{
+	uint32_t hi_off = vdev->msix.capoff + PCIR_MSIX_CTRL + 1U;
+	uint16_t mask = PCIM_MSIXCTRL_MSIX_ENABLE | PCIM_MSIXCTRL_FUNCTION_MASK;
+	struct ivshmem_region *region = &ivshmem_regions[vdev->pci_dev_config->shm_region_id];
+	struct ivshmem_peer *peer;
+	uint16_t msgctrl;
+	uint16_t hi;
+
+	/* only the enable and function mask bits of the message control are writable */
+	if ((offset <= hi_off) && ((offset + bytes) > hi_off)) {
+		hi = (uint16_t)((val >> ((hi_off - offset) * 8U)) & 0xffU);
+		spinlock_obtain(&region->lock);
+		msgctrl = pci_vdev_read_cfg_u16(vdev, hi_off - 1U);
+		msgctrl = (msgctrl & ~mask) | ((uint16_t)(hi << 8U) & mask);
+		pci_vdev_write_cfg_u16(vdev, hi_off - 1U, msgctrl);
+		peer = ivshmem_vdev_peer(vdev);
+		if (peer != NULL) {
+			ivshmem_flush_pending(peer);
+		}
+		spinlock_release(&region->lock);
+	}
+}
+
+/**
+ * @pre vdev != NULL
+ * @pre vdev->vpci != NULL
+ * @pre vdev->vpci->vm != NULL
+ * @pre vdev->pci_dev_config != NULL
+ */
+static void init_ivshmem(struct pci_vdev *vdev)
+{
+	struct acrn_vm *vm = vdev->vpci->vm;
+	uint16_t region_id = vdev->pci_dev_config->shm_region_id;
+	struct ivshmem_region *region;
+	struct ivshmem_peer *peer;
+	uint64_t gpa;
+	uint16_t ivpos;
+	uint32_t idx;
+
+	pci_vdev_write_cfg_u16(vdev, PCIR_VENDOR, IVSHMEM_VENDOR);
+	pci_vdev_write_cfg_u16(vdev, PCIR_DEVICE, IVSHMEM_DEVICE);
+	pci_vdev_write_cfg_u8(vdev, PCIR_REVID, IVSHMEM_REVID);
+	pci_vdev_write_cfg_u8(vdev, PCIR_CLASS, PCIC_MEMORY);
+	pci_vdev_write_cfg_u8(vdev, PCIR_SUBCLASS, PCIS_MEMORY_RAM);
+	pci_vdev_write_cfg_u8(vdev, PCIR_HDRTYPE, PCIM_HDRTYPE_NORMAL);
+	pci_vdev_write_cfg_u16(vdev, PCIR_SUBVEND_0, IVSHMEM_VENDOR);
+	pci_vdev_write_cfg_u16(vdev, PCIR_SUBDEV_0, IVSHMEM_DEVICE);
+
+	if ((region_id >= ivshmem_region_num()) || (CONFIG_MAX_MSIX_TABLE_NUM < ACRN_IVSHMEM_VECTORS)) {
+		pr_err("%s: vm%u %x:%x.%x, no ivshmem region %u", __func__, vm->vm_id,
+			vdev->bdf.bits.b, vdev->bdf.bits.d, vdev->bdf.bits.f, region_id);
+	} else {
+		region = &ivshmem_regions[region_id];
+		spinlock_obtain(&region->lock);
+		ivpos = ivshmem_alloc_peer(region, vm, vdev);
+		spinlock_release(&region->lock);
+
+		if (ivpos >= IVSHMEM_MAX_PEERS) {
+			pr_err("%s: vm%u, ivshmem region %u is full", __func__, vm->vm_id, region_id);
+		} else {
+			peer = &region->peers[ivpos];
+
+			pci_vdev_write_cfg_u16(vdev, PCIR_STATUS, PCIM_STATUS_CAPPRESENT);
+			pci_vdev_write_cfg_u8(vdev, PCIR_CAP_PTR, IVSHMEM_MSIX_CAPOFF);
+			pci_vdev_write_cfg_u8(vdev, IVSHMEM_MSIX_CAPOFF + PCICAP_ID, PCIY_MSIX);
+			pci_vdev_write_cfg_u16(vdev, IVSHMEM_MSIX_CAPOFF + PCIR_MSIX_CTRL, ACRN_IVSHMEM_VECTORS - 1U);
+			pci_vdev_write_cfg_u32(vdev, IVSHMEM_MSIX_CAPOFF + PCIR_MSIX_TABLE, IVSHMEM_MSIX_BAR);
+			pci_vdev_write_cfg_u32(vdev, IVSHMEM_MSIX_CAPOFF + PCIR_MSIX_PBA,
+				IVSHMEM_PBA_OFFSET | IVSHMEM_MSIX_BAR);
+
+			vdev->msix.capoff = IVSHMEM_MSIX_CAPOFF;
+			vdev->msix.caplen = MSIX_CAPLEN;
+			vdev->msix.table_bar = IVSHMEM_MSIX_BAR;
+			vdev->msix.table_offset = 0U;
+			vdev->msix.table_count = ACRN_IVSHMEM_VECTORS;
+			for (idx = 0U; idx < ACRN_IVSHMEM_VECTORS; idx++) {
+				vdev->msix.table_entries[idx].vector_control = PCIM_MSIX_VCTRL_MASK;
+			}
+
+			vdev->nr_bars = IVSHMEM_NR_BARS;
+			ivshmem_init_vbar(vdev, IVSHMEM_REGS_BAR, PCIM_BAR_MEM_32, PAGE_SIZE);
+			ivshmem_init_vbar(vdev, IVSHMEM_MSIX_BAR, PCIM_BAR_MEM_32, PAGE_SIZE);
+			ivshmem_init_vbar(vdev, IVSHMEM_SHM_BAR, PCIM_BAR_MEM_64 | PCIM_BAR_MEM_PREFETCH,
+				CONFIG_IVSHMEM_REGION_SIZE);
+
+			gpa = vdev->bar_base_mapped[IVSHMEM_REGS_BAR];
+			ivshmem_unmap_gpa(vm, gpa, PAGE_SIZE);
+			register_mmio_emulation_handler(vm, ivshmem_regs_access_handler, gpa, gpa + PAGE_SIZE, vdev);
+
+			gpa = vdev->bar_base_mapped[IVSHMEM_MSIX_BAR];
+			vdev->msix.mmio_gpa = gpa;
+			vdev->msix.mmio_size = PAGE_SIZE;
+			ivshmem_unmap_gpa(vm, gpa, PAGE_SIZE);
+			register_mmio_emulation_handler(vm, ivshmem_msix_access_handler, gpa, gpa + PAGE_SIZE, vdev);
+
+			ivshmem_map_shm(peer, region_id, vdev->bar_base_mapped[IVSHMEM_SHM_BAR]);
+		}
+	}
+}
+
+/**
+ * @pre vdev != NULL
+ * @pre vdev->pci_dev_config != NULL
+ */
+static void deinit_ivshmem(struct pci_vdev *vdev)
+{
+	struct ivshmem_region *region;
+	struct ivshmem_peer *peer;
+
+	if (vdev->pci_dev_config->shm_region_id < ivshmem_region_num()) {
+		region = &ivshmem_regions[vdev->pci_dev_config->shm_region_id];
+		spinlock_obtain(&region->lock);
+		peer = ivshmem_vdev_peer(vdev);
+		if (peer != NULL) {
+			/* the EPT of the VM goes away with it */
+			(void)memset(peer, 0U, sizeof(struct ivshmem_peer));
+		}
+		spinlock_release(&region->lock);
+	}
+}
+
+/**
+ * @pre vdev != NULL && val != NULL
+ */
+static int32_t ivshmem_read_cfg(const struct pci_vdev *vdev, uint32_t offset, uint32_t bytes, uint32_t *val)
+{
+	*val = pci_vdev_read_cfg(vdev, offset, bytes);
+	return 0;
+}
+
+/**
+ * @pre vdev != NULL
+ */
+static int32_t ivshmem_write_cfg(struct pci_vdev *vdev, uint32_t offset, uint32_t bytes, uint32_t val)
+{
+	if (vbar_access(vdev, offset)) {
+		if ((bytes == 4U) && ((offset & 0x3U) == 0U)) {
+			ivshmem_write_vbar(vdev, (offset - pci_bar_offset(0U)) >> 2U, val);
+		}
+	} else if (msixcap_access(vdev, offset)) {
+		ivshmem_write_msixcap(vdev, offset, bytes, val);
+	} else if ((offset == PCIR_COMMAND) && (bytes != 1U)) {
+		/* the status is read-only */
+		pci_vdev_write_cfg_u16(vdev, PCIR_COMMAND, (uint16_t)val);
+	} else {
+		/* the rest of the config space is read-only */
+	}
+
+	return 0;
+}
+
+const struct pci_vdev_ops vpci_ivshmem_ops = {
+	.init_vdev	= init_ivshmem,
+	.deinit_vdev	= deinit_ivshmem,
+	.write_vdev_cfg	= ivshmem_write_cfg,
+	.read_vdev_cfg	= ivshmem_read_cfg,
+};
+
+/**
+ * @pre region != NULL && vm != NULL
+ * @pre the lock of the region is held
+ */
+static struct ivshmem_peer *ivshmem_dm_peer(struct ivshmem_region *region, const struct acrn_vm *vm)
+{
+	struct ivshmem_peer *peer = NULL;
+	uint16_t ivpos;
+
+	for (ivpos = 0U; ivpos < IVSHMEM_MAX_PEERS; ivpos++) {
+		if ((region->peers[ivpos].vm == vm) && (region->peers[ivpos].vdev == NULL)) {
+			peer = &region->peers[ivpos];
+			break;
+		}
+	}
+
+	return peer;
+}
+
+/**
+ * @pre peer != NULL
+ * @pre the lock of the region of the peer is held
+ */
+static void ivshmem_free_dm_peer(struct ivshmem_peer *peer, uint16_t region_id, bool unmap)
+{
+	if (unmap) {
+		ivshmem_map_shm(peer, region_id, 0UL);
+	}
+	(void)memset(peer, 0U, sizeof(struct ivshmem_peer));
+	atomic_dec32(&ivshmem_dm_peers);
+}
+
+/**
+ * @pre vm != NULL && ivshmem != NULL
+ */
+int32_t vpci_ivshmem_set(struct acrn_vm *vm, struct acrn_ivshmem *ivshmem)
+{
+	struct ivshmem_region *region;
+	struct ivshmem_peer *peer;
+	uint16_t ivpos;
+	int32_t ret = 0;
+
+	if (ivshmem->region_id >= ivshmem_region_num()) {
+		ret = -EINVAL;
+	} else if (ivshmem->op == ACRN_IVSHMEM_QUERY) {
+		ivshmem->size = CONFIG_IVSHMEM_REGION_SIZE;
+	} else if ((ivshmem->op == ACRN_IVSHMEM_ATTACH) &&
+			(((ivshmem->shm_gpa & (CONFIG_IVSHMEM_REGION_SIZE - 1UL)) != 0UL) ||
+			((ivshmem->regs_gpa % ACRN_IVSHMEM_REGS_SIZE) != 0UL))) {
+		ret = -EINVAL;
+	} else {
+		region = &ivshmem_regions[ivshmem->region_id];
+		spinlock_obtain(&region->lock);
+		peer = ivshmem_dm_peer(region, vm);
+		if (ivshmem->op == ACRN_IVSHMEM_ATTACH) {
+			if (peer == NULL) {
+				ivpos = ivshmem_alloc_peer(region, vm, NULL);
+				if (ivpos < IVSHMEM_MAX_PEERS) {
+					peer = &region->peers[ivpos];
+					atomic_inc32(&ivshmem_dm_peers);
+				}
+			}
+			if (peer == NULL) {
+				ret = -ENOSPC;
+			} else {
+				ivshmem_map_shm(peer, ivshmem->region_id, ivshmem->shm_gpa);
+				peer->regs_gpa = ivshmem->regs_gpa;
+				peer->msix_gpa = ivshmem->msix_gpa;
+				ivshmem->ivpos = (uint16_t)(peer - &region->peers[0]);
+				ivshmem->size = CONFIG_IVSHMEM_REGION_SIZE;
+			}
+		} else if ((ivshmem->op == ACRN_IVSHMEM_DETACH) && (peer != NULL)) {
+			ivshmem_free_dm_peer(peer, ivshmem->region_id, true);
+		} else {
+			ret = -EINVAL;
+		}
+		spinlock_release(&region->lock);
+	}
+
+	return ret;
+}
+
+/**
+ * @pre vm != NULL && io_req != NULL
+ */
+bool vpci_emulate_ivshmem_doorbell(struct acrn_vm *vm, struct io_request *io_req)
+{
+	struct mmio_request *mmio = &io_req->reqs.mmio;
+	struct ivshmem_region *region;
+	struct ivshmem_peer *peer;
+	uint16_t region_id;
+	bool hit = false;
+
+	if ((ivshmem_dm_peers != 0U) && (io_req->io_type == REQ_MMIO) &&
+			(mmio->direction == REQUEST_WRITE) && (mmio->size == 4UL)) {
+		for (region_id = 0U; (region_id < ivshmem_region_num()) && !hit; region_id++) {
+			region = &ivshmem_regions[region_id];
+			spinlock_obtain(&region->lock);
+			peer = ivshmem_dm_peer(region, vm);
+			if ((peer != NULL) && (mmio->address == (peer->regs_gpa + ACRN_IVSHMEM_DOORBELL))) {
+				ivshmem_ring(region, (uint32_t)mmio->value);
+				hit = true;
+			}
+			spinlock_release(&region->lock);
+		}
+	}
+
+	return hit;
+}
+
+/**
+ * @pre vm != NULL
+ */
+void vpci_ivshmem_release(const struct acrn_vm *vm)
+{
+	struct ivshmem_region *region;
+	struct ivshmem_peer *peer;
+	uint16_t region_id;
+
+	for (region_id = 0U; region_id < ivshmem_region_num(); region_id++) {
+		region = &ivshmem_regions[region_id];
+		spinlock_obtain(&region->lock);
+		peer = ivshmem_dm_peer(region, vm);
+		if (peer != NULL) {
+			/* the EPT of the VM goes away with it */
+			ivshmem_free_dm_peer(peer, region_id, false);
+		}
+		spinlock_release(&region->lock);
+	}
+}
@@ -77,17 +77,56 @@ void pci_vdev_write_cfg(struct pci_vdev *vdev, uint32_t offset, uint32_t bytes,
 struct pci_vdev *pci_find_vdev(const struct acrn_vpci *vpci, union pci_bdf vbdf)
 {
 	struct pci_vdev *vdev, *tmp;
+	uint8_t bus = vpci->bus_index[vbdf.bits.b];
+	uint16_t idx;
 	uint32_t i;
 
 	vdev = NULL;
-	for (i = 0U; i < vpci->pci_vdev_cnt; i++) {
-		tmp = (struct pci_vdev *)&(vpci->pci_vdevs[i]);
+	if ((bus != VPCI_BUS_EMPTY) && (bus != VPCI_BUS_UNINDEXED)) {
+		idx = vpci->devfn_index[bus - 1U][vbdf.fields.devfun];
+		if (idx != 0U) {
+			vdev = (struct pci_vdev *)&(vpci->pci_vdevs[idx - 1U]);
+		}
+	} else if (bus == VPCI_BUS_UNINDEXED) {
+		for (i = 0U; i < vpci->pci_vdev_cnt; i++) {
+			tmp = (struct pci_vdev *)&(vpci->pci_vdevs[i]);
 
-		if (bdf_is_equal(tmp->bdf, vbdf)) {
-			vdev = tmp;
-			break;
+			if (bdf_is_equal(tmp->bdf, vbdf)) {
+				vdev = tmp;
+				break;
+			}
 		}
+	} else {
+		/* no vdev on this bus */
 	}
 
 	return vdev;
 }
+
+/**
+ * Make pci_find_vdev() find vdev, the last vdev added to vpci. The first
+ * vdev added with a BDF is the one found, as with a scan of pci_vdevs.
+ *
+ * @pre vpci != NULL
+ * @pre vdev == &vpci->pci_vdevs[vpci->pci_vdev_cnt - 1U]
+ */
+void pci_index_vdev(struct acrn_vpci *vpci, const struct pci_vdev *vdev)
+{
+	uint8_t b = vdev->bdf.bits.b;
+	uint8_t bus = vpci->bus_index[b];
+
+	if ((bus == VPCI_BUS_EMPTY) && (vpci->indexed_buses < VPCI_INDEXED_BUSES)) {
+		vpci->indexed_buses++;
+		bus = vpci->indexed_buses;
+		vpci->bus_index[b] = bus;
+	} else if (bus == VPCI_BUS_EMPTY) {
+		vpci->bus_index[b] = VPCI_BUS_UNINDEXED;
+		bus = VPCI_BUS_UNINDEXED;
+	} else {
+		/* the bus is known */
+	}
+
+	if ((bus != VPCI_BUS_UNINDEXED) && (vpci->devfn_index[bus - 1U][vdev->bdf.fields.devfun] == 0U)) {
+		vpci->devfn_index[bus - 1U][vdev->bdf.fields.devfun] = (uint16_t)vpci->pci_vdev_cnt;
+	}
+}
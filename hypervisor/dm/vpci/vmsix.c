@@ -277,24 +277,15 @@ static void vmsix_table_rw(const struct pci_vdev *vdev, struct mmio_request *mmi
 }
 
 /**
- * @pre io_req != NULL
- * @pre handler_private_data != NULL
+ * @pre vdev != NULL
+ * @pre mmio != NULL
+ * @pre offset is the offset of the access in the MSI-X table BAR
  */
-int32_t vmsix_table_mmio_access_handler(struct io_request *io_req, void *handler_private_data)
+static int32_t vmsix_bar_access(const struct pci_vdev *vdev, struct mmio_request *mmio, uint64_t offset)
 {
-	struct mmio_request *mmio = &io_req->reqs.mmio;
-	struct pci_vdev *vdev;
 	int32_t ret = 0;
-	uint64_t offset;
 	void *hva;
 
-	vdev = (struct pci_vdev *)handler_private_data;
-	/* This device is assigned to post-launched VM from SOS */
-	if (vdev->new_owner != NULL) {
-		vdev = vdev->new_owner;
-	}
-	offset = mmio->address - vdev->msix.mmio_gpa;
-
 	if (msixtable_access(vdev, (uint32_t)offset)) {
 		vmsix_table_rw(vdev, mmio, (uint32_t)offset);
 	} else {
@@ -331,6 +322,70 @@ int32_t vmsix_table_mmio_access_handler(struct io_request *io_req, void *handler
 	return ret;
 }
 
+/**
+ * @pre io_req != NULL
+ * @pre handler_private_data != NULL
+ */
+int32_t vmsix_table_mmio_access_handler(struct io_request *io_req, void *handler_private_data)
+{
+	struct mmio_request *mmio = &io_req->reqs.mmio;
+	struct pci_vdev *vdev;
+
+	vdev = (struct pci_vdev *)handler_private_data;
+	/* This device is assigned to post-launched VM from SOS */
+	if (vdev->new_owner != NULL) {
+		vdev = vdev->new_owner;
+	}
+
+	return vmsix_bar_access(vdev, mmio, mmio->address - vdev->msix.mmio_gpa);
+}
+
+/**
+ * @pre vm != NULL
+ */
+static struct pci_vdev *find_ptdev_msix(struct acrn_vm *vm, uint16_t vbdf)
+{
+	union pci_bdf bdf;
+	struct pci_vdev *vdev;
+
+	bdf.value = vbdf;
+	vdev = pci_find_vdev(&vm->vpci, bdf);
+	if ((vdev != NULL) && ((vdev->pdev == NULL) || !has_msix_cap(vdev) || (vdev->msix.mmio_hpa == 0UL))) {
+		vdev = NULL;
+	}
+
+	return vdev;
+}
+
+/**
+ * @pre vm != NULL
+ */
+bool vpci_has_ptdev_msix(struct acrn_vm *vm, uint16_t vbdf)
+{
+	return (find_ptdev_msix(vm, vbdf) != NULL);
+}
+
+/**
+ * The guest accesses to the pages holding the MSI-X table of a passthrough
+ * device would otherwise exit to the device model, which writes the table
+ * through the SOS mapping trapped in vmsix_table_mmio_access_handler(). The
+ * device model registers the pages from the first one holding the table,
+ * see struct acrn_emul_msix.
+ *
+ * @pre vm != NULL
+ * @pre mmio != NULL
+ */
+bool vpci_ptdev_msix_access(struct acrn_vm *vm, uint16_t vbdf, struct mmio_request *mmio, uint64_t offset)
+{
+	struct pci_vdev *vdev = find_ptdev_msix(vm, vbdf);
+
+	if (vdev != NULL) {
+		(void)vmsix_bar_access(vdev, mmio, round_page_down((uint64_t)vdev->msix.table_offset) + offset);
+	}
+
+	return (vdev != NULL);
+}
+
 /**
  * @pre vdev != NULL
  * @pre vdev->pdev != NULL
@@ -31,7 +31,9 @@
 #include <vtd.h>
 #include <mmu.h>
 #include <errno.h>
+#include <io.h>
 #include <logmsg.h>
+#include <acpi.h>
 #include "vpci_priv.h"
 #include "pci_dev.h"
 
@@ -40,6 +42,7 @@ static void deinit_prelaunched_vm_vpci(const struct acrn_vm *vm);
 static void deinit_postlaunched_vm_vpci(const struct acrn_vm *vm);
 static void read_cfg(const struct acrn_vpci *vpci, union pci_bdf bdf, uint32_t offset, uint32_t bytes, uint32_t *val);
 static void write_cfg(const struct acrn_vpci *vpci, union pci_bdf bdf, uint32_t offset, uint32_t bytes, uint32_t val);
+static struct pci_vdev *find_vdev(const struct acrn_vpci *vpci, union pci_bdf bdf);
 
 /**
  * @pre pi != NULL
@@ -186,6 +189,114 @@ static bool pci_cfgdata_io_write(struct acrn_vcpu *vcpu, uint16_t addr, size_t b
 	return true;
 }
 
+/**
+ * An access to the extended config space of a device of the platform goes
+ * to its physical ECAM window, the emulated devices have no extended
+ * capability.
+ *
+ * @pre vpci != NULL
+ * @pre mmio != NULL
+ */
+static void mmcfg_ext_access(const struct acrn_vpci *vpci, const struct pci_vdev *vdev,
+		struct mmio_request *mmio, uint32_t reg)
+{
+	void *hva = NULL;
+
+	if (vdev->pdev != NULL) {
+		hva = hpa2hva(vpci->mmcfg_base + ((uint64_t)vdev->pdev->bdf.value << 12U) + reg);
+	}
+
+	if (mmio->direction == REQUEST_READ) {
+		mmio->value = 0UL;
+		if (hva != NULL) {
+			stac();
+			if (mmio->size == 1UL) {
+				mmio->value = mmio_read8(hva);
+			} else if (mmio->size == 2UL) {
+				mmio->value = mmio_read16(hva);
+			} else {
+				mmio->value = mmio_read32(hva);
+			}
+			clac();
+		}
+	} else if (hva != NULL) {
+		stac();
+		if (mmio->size == 1UL) {
+			mmio_write8((uint8_t)mmio->value, hva);
+		} else if (mmio->size == 2UL) {
+			mmio_write16((uint16_t)mmio->value, hva);
+		} else {
+			mmio_write32((uint32_t)mmio->value, hva);
+		}
+		clac();
+	} else {
+		/* dropped */
+	}
+}
+
+/**
+ * The ECAM window of SOS is trapped so the config accesses through it are
+ * emulated as those through CF8/CFC, in one exit each. The BDFs without a
+ * vdev read as all ones, as through CFC.
+ *
+ * @pre io_req != NULL
+ * @pre handler_private_data != NULL
+ */
+static int32_t vpci_mmcfg_access_handler(struct io_request *io_req, void *handler_private_data)
+{
+	struct mmio_request *mmio = &io_req->reqs.mmio;
+	const struct acrn_vpci *vpci = (const struct acrn_vpci *)handler_private_data;
+	uint64_t offset = mmio->address - vpci->mmcfg_base;
+	uint32_t reg = (uint32_t)offset & 0xFFFU;
+	uint32_t bytes = (uint32_t)mmio->size;
+	uint32_t val = ~0U;
+	struct pci_vdev *vdev;
+	union pci_bdf bdf;
+
+	bdf.value = (uint16_t)(offset >> 12U);
+	if (vpci_is_valid_access(reg, bytes)) {
+		vdev = find_vdev(vpci, bdf);
+		if (reg > PCI_REGMAX) {
+			if (vdev != NULL) {
+				mmcfg_ext_access(vpci, vdev, mmio, reg);
+			} else if (mmio->direction == REQUEST_READ) {
+				mmio->value = ~0U;
+			} else {
+				/* no device */
+			}
+		} else if (mmio->direction == REQUEST_READ) {
+			read_cfg(vpci, bdf, reg, bytes, &val);
+			mmio->value = val;
+		} else {
+			write_cfg(vpci, bdf, reg, bytes, (uint32_t)mmio->value);
+		}
+	} else if (mmio->direction == REQUEST_READ) {
+		mmio->value = ~0UL;
+	} else {
+		/* invalid access, dropped */
+	}
+
+	return 0;
+}
+
+/**
+ * @pre vm != NULL
+ * @pre is_sos_vm(vm)
+ */
+static void vpci_init_mmcfg(struct acrn_vm *vm)
+{
+	struct acrn_vpci *vpci = &vm->vpci;
+	const struct acpi_mcfg_allocation *mcfg = parse_mcfg(0U);
+
+	if (mcfg != NULL) {
+		vpci->mmcfg_base = mcfg->address;
+		vpci->mmcfg_start = mcfg->address + ((uint64_t)mcfg->start_bus_number << 20U);
+		vpci->mmcfg_size = ((uint64_t)mcfg->end_bus_number - mcfg->start_bus_number + 1UL) << 20U;
+		register_mmio_emulation_handler(vm, vpci_mmcfg_access_handler, vpci->mmcfg_start,
+			vpci->mmcfg_start + vpci->mmcfg_size, vpci);
+	}
+}
+
 /**
  * @pre vm != NULL
  * @pre vm->vm_id < CONFIG_MAX_VM_NUM
@@ -224,6 +335,11 @@ void vpci_init(struct acrn_vm *vm)
 		/* Intercept and handle I/O ports CFC -- CFF */
 		register_pio_emulation_handler(vm, PCI_CFGDATA_PIO_IDX, &pci_cfgdata_range,
 			pci_cfgdata_io_read, pci_cfgdata_io_write);
+
+		/* the ECAM window of a pre-launched VM is not in its ACPI tables */
+		if (vm_config->load_order == SOS_VM) {
+			vpci_init_mmcfg(vm);
+		}
 		break;
 
 	default:
@@ -250,6 +366,7 @@ void vpci_cleanup(const struct acrn_vm *vm)
 
 	case POST_LAUNCHED_VM:
 		deinit_postlaunched_vm_vpci(vm);
+		vpci_ivshmem_release(vm);
 		break;
 
 	default:
@@ -424,6 +541,7 @@ static void vpci_init_vdev(struct acrn_vpci *vpci, struct acrn_vm_pci_dev_config
 	vpci->pci_vdev_cnt++;
 	vdev->vpci = vpci;
 	vdev->bdf.value = dev_config->vbdf.value;
+	pci_index_vdev(vpci, vdev);
 	vdev->pdev = dev_config->pdev;
 	vdev->pci_dev_config = dev_config;
 
@@ -538,6 +656,7 @@ void vpci_set_ptdev_intr_info(struct acrn_vm *target_vm, uint16_t vbdf, uint16_t
 		target_vpci->pci_vdev_cnt++;
 		(void)memcpy_s((void *)target_vdev, sizeof(struct pci_vdev), (void *)vdev, sizeof(struct pci_vdev));
 		target_vdev->bdf.value = vbdf;
+		pci_index_vdev(target_vpci, target_vdev);
 
 		vdev->new_owner = target_vdev;
 	}
@@ -144,5 +144,6 @@ uint32_t pci_vdev_read_cfg(const struct pci_vdev *vdev, uint32_t offset, uint32_
 void pci_vdev_write_cfg(struct pci_vdev *vdev, uint32_t offset, uint32_t bytes, uint32_t val);
 
 struct pci_vdev *pci_find_vdev(const struct acrn_vpci *vpci, union pci_bdf vbdf);
+void pci_index_vdev(struct acrn_vpci *vpci, const struct pci_vdev *vdev);
 
 #endif /* VPCI_PRIV_H_ */
@@ -6,12 +6,55 @@
 
 #include <vm.h>
 #include <io.h>
+#include <cpu.h>
+#include <timer.h>
+#include <vpic.h>
+#include <vioapic.h>
+#include <logmsg.h>
 
 #define CMOS_ADDR_PORT		0x70U
 #define CMOS_DATA_PORT		0x71U
 
+#define RTC_SEC			0x00U   /* seconds */
+#define RTC_SECALRM		0x01U   /* seconds alarm */
+#define RTC_MIN			0x02U   /* minutes */
+#define RTC_MINALRM		0x03U   /* minutes alarm */
+#define RTC_HRS			0x04U   /* hours */
+#define RTC_HRSALRM		0x05U   /* hours alarm */
+#define RTC_WDAY		0x06U   /* week day */
+#define RTC_DAY			0x07U   /* day of month */
+#define RTC_MONTH		0x08U   /* month of year */
+#define RTC_YEAR		0x09U   /* year of century */
 #define RTC_STATUSA		0x0AU   /* status register A */
 #define RTCSA_TUP		0x80U   /* time update, don't look now */
+#define RTCSA_DIVIDER		0x70U   /* divider select */
+#define RTCSA_DIVIDER_ON	0x20U   /* 32.768 kHz time base, counting */
+#define RTCSA_RATE		0x0FU   /* periodic interrupt rate select */
+#define RTC_STATUSB		0x0BU   /* status register B */
+#define RTCSB_HALT		0x80U   /* stop clock updates */
+#define RTCSB_PINTR		0x40U   /* periodic interrupt enable */
+#define RTCSB_AINTR		0x20U   /* alarm interrupt enable */
+#define RTCSB_UINTR		0x10U   /* update-ended interrupt enable */
+#define RTCSB_BIN		0x04U   /* binary, not BCD, date and time */
+#define RTCSB_24HR		0x02U   /* 24 hours, not 12 hours, mode */
+#define RTCSB_ALL_INTRS		(RTCSB_PINTR | RTCSB_AINTR | RTCSB_UINTR)
+#define RTC_INTR		0x0CU   /* status register C, read clears it */
+#define RTCIR_INT		0x80U   /* interrupt output signal */
+#define RTCIR_PERIOD		0x40U   /* periodic interrupt flag */
+#define RTCIR_ALARM		0x20U   /* alarm interrupt flag */
+#define RTCIR_UPDATE		0x10U   /* update-ended interrupt flag */
+#define RTCIR_ALL_FLAGS		(RTCIR_PERIOD | RTCIR_ALARM | RTCIR_UPDATE)
+#define RTC_STATUSD		0x0DU   /* status register D */
+#define RTCSD_PWR		0x80U   /* clock power OK */
+#define RTC_NVRAM_START		0x0EU   /* the NVRAM, the century aside */
+#define RTC_CENTURY		0x32U   /* century, the ACPI FADT one */
+
+#define RTC_ALARM_ANY		0xC0U   /* alarm values matching any time */
+#define RTC_IRQ			8U
+#define RTC_UIP_US		244U    /* UIP is set that long before an update */
+
+#define SECS_PER_DAY		86400UL
+#define RTC_BASE_YEAR		1970U
 
 static spinlock_t cmos_lock = { .head = 0U, .tail = 0U };
 
@@ -44,6 +87,463 @@ static uint8_t cmos_get_reg_val(uint8_t addr)
 	return reg;
 }
 
+/*
+ * The MC146818 emulation, the RTC page of the device model set.
+ */
+
+static inline bool vrtc_divider_enabled(const struct acrn_vrtc_state *vrtc)
+{
+	return ((vrtc->regs[RTC_STATUSA] & RTCSA_DIVIDER) == RTCSA_DIVIDER_ON);
+}
+
+static inline bool vrtc_halted(const struct acrn_vrtc_state *vrtc)
+{
+	return ((vrtc->regs[RTC_STATUSB] & RTCSB_HALT) != 0U);
+}
+
+/* the time counts only with the divider out of reset and the updates on */
+static inline bool vrtc_update_enabled(const struct acrn_vrtc_state *vrtc)
+{
+	return (vrtc_divider_enabled(vrtc) && !vrtc_halted(vrtc));
+}
+
+static inline uint64_t vrtc_tsc_hz(void)
+{
+	return (uint64_t)get_tsc_khz() * 1000UL;
+}
+
+static bool leapyear(uint32_t year)
+{
+	return ((((year % 4U) == 0U) && ((year % 100U) != 0U)) || ((year % 400U) == 0U));
+}
+
+static uint32_t days_in_month(uint32_t year, uint32_t month)
+{
+	static const uint8_t month_days[12] = { 31U, 28U, 31U, 30U, 31U, 30U, 31U, 31U, 30U, 31U, 30U, 31U };
+	uint32_t days = month_days[month - 1U];
+
+	if ((month == 2U) && leapyear(year)) {
+		days++;
+	}
+	return days;
+}
+
+static inline uint32_t days_in_year(uint32_t year)
+{
+	return leapyear(year) ? 366U : 365U;
+}
+
+/* a value of the date or time registers, in the format of register B */
+static uint8_t rtc_enc(const struct acrn_vrtc_state *vrtc, uint32_t val)
+{
+	uint8_t reg;
+
+	if ((vrtc->regs[RTC_STATUSB] & RTCSB_BIN) != 0U) {
+		reg = (uint8_t)val;
+	} else {
+		reg = (uint8_t)(((val / 10U) << 4U) | (val % 10U));
+	}
+	return reg;
+}
+
+/* @return false if reg is no valid BCD value */
+static bool rtc_dec(const struct acrn_vrtc_state *vrtc, uint8_t reg, uint32_t *val)
+{
+	uint32_t upper = ((uint32_t)reg >> 4U) & 0xFU, lower = (uint32_t)reg & 0xFU;
+	bool valid = true;
+
+	if ((vrtc->regs[RTC_STATUSB] & RTCSB_BIN) != 0U) {
+		*val = reg;
+	} else if ((upper > 9U) || (lower > 9U)) {
+		valid = false;
+	} else {
+		*val = (upper * 10U) + lower;
+	}
+	return valid;
+}
+
+/* the date and time registers set to secs, since the epoch */
+static void secs_to_rtc(struct acrn_vrtc_state *vrtc, uint64_t secs)
+{
+	uint64_t days = secs / SECS_PER_DAY;
+	uint32_t rsec = (uint32_t)(secs % SECS_PER_DAY);
+	uint32_t year = RTC_BASE_YEAR, month = 1U, hour;
+
+	vrtc->regs[RTC_WDAY] = rtc_enc(vrtc, (uint32_t)(((days + 4UL) % 7UL) + 1UL));
+	while (days >= days_in_year(year)) {
+		days -= days_in_year(year);
+		year++;
+	}
+	while (days >= days_in_month(year, month)) {
+		days -= days_in_month(year, month);
+		month++;
+	}
+
+	vrtc->regs[RTC_SEC] = rtc_enc(vrtc, rsec % 60U);
+	vrtc->regs[RTC_MIN] = rtc_enc(vrtc, (rsec / 60U) % 60U);
+	hour = rsec / 3600U;
+	if ((vrtc->regs[RTC_STATUSB] & RTCSB_24HR) != 0U) {
+		vrtc->regs[RTC_HRS] = rtc_enc(vrtc, hour);
+	} else {
+		/* 12 AM, 1 - 11 AM, 12 PM with bit 7 set, 1 - 11 PM */
+		vrtc->regs[RTC_HRS] = rtc_enc(vrtc, ((hour % 12U) == 0U) ? 12U : (hour % 12U));
+		if (hour >= 12U) {
+			vrtc->regs[RTC_HRS] |= 0x80U;
+		}
+	}
+	vrtc->regs[RTC_DAY] = rtc_enc(vrtc, (uint32_t)days + 1U);
+	vrtc->regs[RTC_MONTH] = rtc_enc(vrtc, month);
+	vrtc->regs[RTC_YEAR] = rtc_enc(vrtc, year % 100U);
+	vrtc->regs[RTC_CENTURY] = rtc_enc(vrtc, year / 100U);
+}
+
+/*
+ * The date and time registers the guest programmed, in seconds since the
+ * epoch. The day of the week is ignored, the guests don't all set it.
+ *
+ * @return false if the registers hold no valid date and time
+ */
+static bool rtc_to_secs(const struct acrn_vrtc_state *vrtc, uint64_t *secs)
+{
+	uint32_t sec = 0U, min = 0U, hour = 0U, day = 0U, month = 0U, year = 0U, century = 0U, i;
+	uint8_t hrs = vrtc->regs[RTC_HRS];
+	bool pm = false, valid;
+	uint64_t days = 0UL;
+
+	if (((vrtc->regs[RTC_STATUSB] & RTCSB_24HR) == 0U) && ((hrs & 0x80U) != 0U)) {
+		hrs &= 0x7FU;
+		pm = true;
+	}
+
+	valid = rtc_dec(vrtc, vrtc->regs[RTC_SEC], &sec) && rtc_dec(vrtc, vrtc->regs[RTC_MIN], &min) &&
+		rtc_dec(vrtc, hrs, &hour) && rtc_dec(vrtc, vrtc->regs[RTC_DAY], &day) &&
+		rtc_dec(vrtc, vrtc->regs[RTC_MONTH], &month) && rtc_dec(vrtc, vrtc->regs[RTC_YEAR], &year) &&
+		rtc_dec(vrtc, vrtc->regs[RTC_CENTURY], &century);
+
+	if (valid && ((vrtc->regs[RTC_STATUSB] & RTCSB_24HR) == 0U)) {
+		if ((hour < 1U) || (hour > 12U)) {
+			valid = false;
+		} else {
+			hour = ((hour == 12U) ? 0U : hour) + (pm ? 12U : 0U);
+		}
+	}
+
+	year += century * 100U;
+	if (valid && ((sec > 59U) || (min > 59U) || (hour > 23U) || (month < 1U) || (month > 12U) ||
+			(year < RTC_BASE_YEAR) || (year > 9999U) || (day < 1U) || (day > days_in_month(year, month)))) {
+		valid = false;
+	}
+
+	if (valid) {
+		for (i = RTC_BASE_YEAR; i < year; i++) {
+			days += days_in_year(i);
+		}
+		for (i = 1U; i < month; i++) {
+			days += days_in_month(year, i);
+		}
+		days += (uint64_t)day - 1UL;
+		*secs = (days * SECS_PER_DAY) + ((uint64_t)hour * 3600UL) + ((uint64_t)min * 60UL) + sec;
+	}
+
+	return valid;
+}
+
+/* the period of the periodic flag in TSC cycles, 0 if it is off */
+static uint64_t vrtc_pf_period(const struct acrn_vrtc_state *vrtc)
+{
+	uint32_t rate = vrtc->regs[RTC_STATUSA] & RTCSA_RATE;
+	uint64_t period = 0UL;
+
+	if ((rate != 0U) && vrtc_divider_enabled(vrtc)) {
+		/* 1 and 2 select the rates of 8 and 9, 256 Hz and 128 Hz */
+		if (rate < 3U) {
+			rate += 7U;
+		}
+		period = vrtc_tsc_hz() / (65536UL >> rate);
+	}
+	return period;
+}
+
+/* the period the timer runs at for the interrupts enabled, 0 for none */
+static uint64_t vrtc_timer_period(const struct acrn_vrtc_state *vrtc)
+{
+	uint8_t reg_b = vrtc->regs[RTC_STATUSB];
+	uint64_t period = 0UL;
+
+	if (!vrtc->emulated) {
+		/* stopped */
+	} else if (((reg_b & RTCSB_PINTR) != 0U) && (vrtc_pf_period(vrtc) != 0UL)) {
+		/* the alarm and the update ride on the periodic ticks, 2 Hz at least */
+		period = vrtc_pf_period(vrtc);
+	} else if (((reg_b & (RTCSB_AINTR | RTCSB_UINTR)) != 0U) && vrtc_update_enabled(vrtc)) {
+		period = vrtc_tsc_hz();
+	} else {
+		/* no interrupt to raise */
+	}
+	return period;
+}
+
+/*
+ * Register C set to the flags, the IRQ line follows its IRQF bit, it stays
+ * asserted until the guest reads register C.
+ *
+ * @pre vrtc->lock is held
+ */
+static void vrtc_set_reg_c(struct acrn_vm *vm, struct acrn_vrtc_state *vrtc, uint8_t flags)
+{
+	uint8_t old_irqf = vrtc->regs[RTC_INTR] & RTCIR_INT, new_irqf = 0U;
+	uint8_t enabled = vrtc->regs[RTC_STATUSB] & RTCSB_ALL_INTRS;
+
+	/* the flags and the enable bits of register B line up */
+	if ((flags & RTCIR_ALL_FLAGS & enabled) != 0U) {
+		new_irqf = RTCIR_INT;
+	}
+	vrtc->regs[RTC_INTR] = (flags & RTCIR_ALL_FLAGS) | new_irqf;
+
+	if ((old_irqf == 0U) && (new_irqf != 0U)) {
+		vpic_set_irqline(vm_pic(vm), RTC_IRQ, GSI_SET_HIGH);
+		vioapic_set_irqline_lock(vm, RTC_IRQ, GSI_SET_HIGH);
+	} else if ((old_irqf != 0U) && (new_irqf == 0U)) {
+		vpic_set_irqline(vm_pic(vm), RTC_IRQ, GSI_SET_LOW);
+		vioapic_set_irqline_lock(vm, RTC_IRQ, GSI_SET_LOW);
+	} else {
+		/* the line stays */
+	}
+}
+
+/*
+ * Bring the RTC time and the flags of register C up to now. The whole
+ * seconds passed are folded into base_rtctime, the alarm is checked against
+ * the second the RTC reaches.
+ *
+ * @pre vrtc->lock is held
+ */
+static void vrtc_sync(struct acrn_vm *vm, struct acrn_vrtc_state *vrtc, uint64_t now)
+{
+	uint64_t hz = vrtc_tsc_hz(), elapsed, period;
+	uint8_t flags = vrtc->regs[RTC_INTR] & RTCIR_ALL_FLAGS;
+
+	if (vrtc_update_enabled(vrtc) && (now > vrtc->base_tsc) && ((now - vrtc->base_tsc) >= hz)) {
+		elapsed = (now - vrtc->base_tsc) / hz;
+		vrtc->base_rtctime += elapsed;
+		vrtc->base_tsc += elapsed * hz;
+		secs_to_rtc(vrtc, vrtc->base_rtctime);
+
+		flags |= RTCIR_UPDATE;
+		if (((vrtc->regs[RTC_SECALRM] >= RTC_ALARM_ANY) || (vrtc->regs[RTC_SECALRM] == vrtc->regs[RTC_SEC])) &&
+				((vrtc->regs[RTC_MINALRM] >= RTC_ALARM_ANY) ||
+				 (vrtc->regs[RTC_MINALRM] == vrtc->regs[RTC_MIN])) &&
+				((vrtc->regs[RTC_HRSALRM] >= RTC_ALARM_ANY) ||
+				 (vrtc->regs[RTC_HRSALRM] == vrtc->regs[RTC_HRS]))) {
+			flags |= RTCIR_ALARM;
+		}
+	}
+
+	period = vrtc_pf_period(vrtc);
+	if ((period != 0UL) && (now >= vrtc->next_pf_tsc)) {
+		flags |= RTCIR_PERIOD;
+		vrtc->next_pf_tsc += (((now - vrtc->next_pf_tsc) / period) + 1UL) * period;
+	}
+
+	vrtc_set_reg_c(vm, vrtc, flags);
+}
+
+static void vrtc_timer_cb(void *data)
+{
+	struct acrn_vm *vm = (struct acrn_vm *)data;
+	struct acrn_vrtc_state *vrtc = &vm->vrtc;
+	uint64_t rflags;
+
+	spinlock_irqsave_obtain(&vrtc->lock, &rflags);
+	if (vrtc->emulated) {
+		vrtc_sync(vm, vrtc, rdtsc());
+	}
+	if (vrtc_timer_period(vrtc) == 0UL) {
+		/* not added again once it returns, vrtc_update_timer() restarts it */
+		vrtc->timer.mode = TICK_MODE_ONESHOT;
+		vrtc->timer_period = 0UL;
+	}
+	spinlock_irqrestore_release(&vrtc->lock, rflags);
+}
+
+/**
+ * @brief Restart the vRTC timer at the period of the interrupts enabled
+ *
+ * @pre get_pcpu_id() == vm->vrtc.timer_pcpu
+ * @pre not called from a timer callback or an interrupt handler
+ */
+void vrtc_update_timer(struct acrn_vm *vm)
+{
+	struct acrn_vrtc_state *vrtc = &vm->vrtc;
+	uint64_t rflags, period, now = rdtsc();
+
+	spinlock_irqsave_obtain(&vrtc->lock, &rflags);
+	if (vrtc->emulated) {
+		vrtc_sync(vm, vrtc, now);
+	}
+	period = vrtc_timer_period(vrtc);
+	if (period != vrtc->timer_period) {
+		del_timer(&vrtc->timer);
+		vrtc->timer_period = period;
+		if (period != 0UL) {
+			/* the 1 Hz ticks land on the second boundaries */
+			initialize_timer(&vrtc->timer, vrtc_timer_cb, vm,
+				(period == vrtc_tsc_hz()) ? (vrtc->base_tsc + period) : (now + period),
+				TICK_MODE_PERIODIC, period);
+			(void)add_timer(&vrtc->timer);
+		}
+	}
+	spinlock_irqrestore_release(&vrtc->lock, rflags);
+}
+
+/* the timer belongs to the pCPU of the BSP, the other ones ask it there */
+static void vrtc_kick_timer(struct acrn_vm *vm)
+{
+	if (get_pcpu_id() == vm->vrtc.timer_pcpu) {
+		vrtc_update_timer(vm);
+	} else {
+		vcpu_make_request(vcpu_from_vid(vm, BOOT_CPU_ID), ACRN_REQUEST_VRTC_TIMER);
+	}
+}
+
+static uint8_t vrtc_emul_read(struct acrn_vm *vm, uint16_t addr)
+{
+	struct acrn_vrtc_state *vrtc = &vm->vrtc;
+	uint64_t rflags, now = rdtsc();
+	uint8_t offset, value;
+
+	spinlock_irqsave_obtain(&vrtc->lock, &rflags);
+	offset = vrtc->addr;
+	if (addr == CMOS_ADDR_PORT) {
+		/* the index port reads as floating */
+		value = 0xFFU;
+	} else {
+		vrtc_sync(vm, vrtc, now);
+		if (((offset <= RTC_YEAR) || (offset == RTC_CENTURY)) && !vrtc_halted(vrtc)) {
+			/* the format of register B may have changed */
+			secs_to_rtc(vrtc, vrtc->base_rtctime);
+		}
+
+		value = vrtc->regs[offset];
+		if (offset == RTC_STATUSA) {
+			if (vrtc_update_enabled(vrtc) && (now > vrtc->base_tsc) &&
+					((now - vrtc->base_tsc) >= (vrtc_tsc_hz() - us_to_ticks(RTC_UIP_US)))) {
+				value |= RTCSA_TUP;
+			}
+		} else if (offset == RTC_INTR) {
+			vrtc_set_reg_c(vm, vrtc, 0U);
+		} else {
+			/* read as is */
+		}
+	}
+	spinlock_irqrestore_release(&vrtc->lock, rflags);
+
+	return value;
+}
+
+/*
+ * @pre vrtc->lock is held
+ */
+static void vrtc_set_reg_a(struct acrn_vrtc_state *vrtc, uint8_t value, uint64_t now)
+{
+	bool was_enabled = vrtc_divider_enabled(vrtc);
+	uint8_t old = vrtc->regs[RTC_STATUSA];
+
+	vrtc->regs[RTC_STATUSA] = value & (uint8_t)~RTCSA_TUP;
+	if (!was_enabled && vrtc_divider_enabled(vrtc)) {
+		/* the time was frozen while the divider was held in reset */
+		vrtc->base_tsc = now;
+	}
+	if (((old ^ value) & (RTCSA_DIVIDER | RTCSA_RATE)) != 0U) {
+		vrtc->next_pf_tsc = now + vrtc_pf_period(vrtc);
+	}
+}
+
+/*
+ * @pre vrtc->lock is held
+ */
+static void vrtc_set_reg_b(struct acrn_vm *vm, struct acrn_vrtc_state *vrtc, uint8_t value, uint64_t now)
+{
+	uint8_t changed = vrtc->regs[RTC_STATUSB] ^ value;
+	uint64_t secs;
+
+	vrtc->regs[RTC_STATUSB] = value;
+	if ((changed & RTCSB_HALT) != 0U) {
+		if ((value & RTCSB_HALT) != 0U) {
+			/* the guest owns the date and time registers, the update interrupt goes */
+			secs_to_rtc(vrtc, vrtc->base_rtctime);
+			vrtc->regs[RTC_STATUSB] &= (uint8_t)~RTCSB_UINTR;
+		} else {
+			if (rtc_to_secs(vrtc, &secs)) {
+				vrtc->base_rtctime = secs;
+			} else {
+				pr_warn("vm%hu: invalid vRTC time programmed, kept", vm->vm_id);
+			}
+			vrtc->base_tsc = now;
+		}
+	}
+
+	if ((changed & RTCSB_ALL_INTRS) != 0U) {
+		vrtc_set_reg_c(vm, vrtc, vrtc->regs[RTC_INTR]);
+	}
+}
+
+static void vrtc_emul_write(struct acrn_vm *vm, uint16_t addr, uint8_t value)
+{
+	struct acrn_vrtc_state *vrtc = &vm->vrtc;
+	uint64_t rflags, secs, now = rdtsc();
+	uint8_t offset;
+	bool kick;
+
+	spinlock_irqsave_obtain(&vrtc->lock, &rflags);
+	if (addr == CMOS_ADDR_PORT) {
+		/* bit 7 is the NMI mask of the chipset */
+		vrtc->addr = value & 0x7FU;
+	} else {
+		vrtc_sync(vm, vrtc, now);
+		offset = vrtc->addr;
+		switch (offset) {
+		case RTC_STATUSA:
+			vrtc_set_reg_a(vrtc, value, now);
+			break;
+		case RTC_STATUSB:
+			vrtc_set_reg_b(vm, vrtc, value, now);
+			break;
+		case RTC_INTR:
+		case RTC_STATUSD:
+			/* read only */
+			break;
+		case RTC_SEC:
+			/* bit 7 of the seconds is read only */
+			vrtc->regs[offset] = value & 0x7FU;
+			break;
+		default:
+			vrtc->regs[offset] = value;
+			if (offset == RTC_CENTURY) {
+				/* some guests set the century without halting the updates */
+				if (!vrtc_halted(vrtc) && rtc_to_secs(vrtc, &secs)) {
+					vrtc->base_rtctime = secs;
+					vrtc->base_tsc = now;
+				}
+			} else if ((offset >= RTC_NVRAM_START) && (vrtc->page != NULL)) {
+				/* saved by the device model */
+				stac();
+				vrtc->page->cmos[offset] = value;
+				clac();
+			} else {
+				/* a time or an alarm register */
+			}
+			break;
+		}
+	}
+	kick = (vrtc_timer_period(vrtc) != vrtc->timer_period);
+	spinlock_irqrestore_release(&vrtc->lock, rflags);
+
+	if (kick) {
+		vrtc_kick_timer(vm);
+	}
+}
+
 /**
  * @pre vcpu != NULL
  * @pre vcpu->vm != NULL
@@ -56,7 +556,9 @@ static bool vrtc_read(struct acrn_vcpu *vcpu, uint16_t addr, __unused size_t wid
 
 	offset = vm->vrtc_offset;
 
-	if (addr == CMOS_ADDR_PORT) {
+	if (vm->vrtc.emulated) {
+		pio_req->value = vrtc_emul_read(vm, addr);
+	} else if (addr == CMOS_ADDR_PORT) {
 		pio_req->value = vm->vrtc_offset;
 	} else {
 		pio_req->value = cmos_get_reg_val(offset);
@@ -72,13 +574,103 @@ static bool vrtc_read(struct acrn_vcpu *vcpu, uint16_t addr, __unused size_t wid
 static bool vrtc_write(struct acrn_vcpu *vcpu, uint16_t addr, size_t width,
 			uint32_t value)
 {
-	if ((width == 1U) && (addr == CMOS_ADDR_PORT)) {
+	if (width != 1U) {
+		/* the MC146818 registers are bytes */
+	} else if (vcpu->vm->vrtc.emulated) {
+		vrtc_emul_write(vcpu->vm, addr, (uint8_t)value);
+	} else if (addr == CMOS_ADDR_PORT) {
 		vcpu->vm->vrtc_offset = (uint8_t)value & 0x7FU;
+	} else {
+		/* the physical RTC is read only */
 	}
 
 	return true;
 }
 
+/**
+ * @brief Emulate the RTC of a post-launched VM in place of the device model
+ *
+ * The RTC starts at the time of the page with its NVRAM contents, the
+ * registers and their interrupt are reset as on the power up of the
+ * device model RTC. Set again on the reset of the VM.
+ *
+ * @pre vm->state is VM_CREATED or VM_PAUSED
+ */
+void vrtc_setup(struct acrn_vm *vm, struct acrn_vrtc *page)
+{
+	struct acrn_vrtc_state *vrtc = &vm->vrtc;
+	struct vm_io_range range = {
+	.base = CMOS_ADDR_PORT, .len = 2U};
+	uint64_t rflags, now;
+	uint32_t i;
+
+	if (vrtc->page == NULL) {
+		/* the first setup since the VM was created */
+		spinlock_init(&vrtc->lock);
+		initialize_timer(&vrtc->timer, vrtc_timer_cb, vm, 0UL, TICK_MODE_PERIODIC, 0UL);
+		vrtc->timer_period = 0UL;
+	}
+
+	spinlock_irqsave_obtain(&vrtc->lock, &rflags);
+	now = rdtsc();
+	vrtc->page = page;
+	stac();
+	for (i = RTC_NVRAM_START; i < ACRN_VRTC_CMOS_SIZE; i++) {
+		vrtc->regs[i] = page->cmos[i];
+	}
+	vrtc->base_rtctime = page->rtc_time;
+	clac();
+
+	/* counting, 24 hours mode, BCD, no interrupts */
+	vrtc->regs[RTC_STATUSA] = RTCSA_DIVIDER_ON;
+	vrtc->regs[RTC_STATUSB] = RTCSB_24HR;
+	vrtc->regs[RTC_STATUSD] = RTCSD_PWR;
+	vrtc->addr = RTC_STATUSD;
+	vrtc->base_tsc = now;
+	vrtc->next_pf_tsc = now;
+	secs_to_rtc(vrtc, vrtc->base_rtctime);
+	vrtc_set_reg_c(vm, vrtc, 0U);
+	vrtc->timer_pcpu = vcpu_from_vid(vm, BOOT_CPU_ID)->pcpu_id;
+	vrtc->emulated = true;
+	/* a timer left from before a reset stops on its next tick */
+	spinlock_irqrestore_release(&vrtc->lock, rflags);
+
+	register_pio_emulation_handler(vm, RTC_PIO_IDX, &range, vrtc_read, vrtc_write);
+}
+
+/**
+ * @brief Stop the emulated RTC of a VM, waiting for its timer if it runs
+ * on another pCPU
+ *
+ * @pre not called from a timer callback or an interrupt handler
+ */
+void vrtc_deinit(struct acrn_vm *vm)
+{
+	struct acrn_vrtc_state *vrtc = &vm->vrtc;
+	uint64_t rflags;
+	bool armed;
+
+	if (vrtc->page != NULL) {
+		spinlock_irqsave_obtain(&vrtc->lock, &rflags);
+		vrtc->emulated = false;
+		vrtc->page = NULL;
+		if (vrtc->timer_pcpu == get_pcpu_id()) {
+			del_timer(&vrtc->timer);
+			vrtc->timer_period = 0UL;
+		}
+		armed = (vrtc->timer_period != 0UL);
+		spinlock_irqrestore_release(&vrtc->lock, rflags);
+
+		/* it stops on its next tick, in a second at most */
+		while (armed) {
+			asm_pause();
+			spinlock_irqsave_obtain(&vrtc->lock, &rflags);
+			armed = (vrtc->timer_period != 0UL);
+			spinlock_irqrestore_release(&vrtc->lock, rflags);
+		}
+	}
+}
+
 void vrtc_init(struct acrn_vm *vm)
 {
 	struct vm_io_range range = {
@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <vm.h>
+#include <io.h>
+#include <timer.h>
+
+/*
+ * The HPET and the PIT of a post-launched VM are emulated by the device
+ * model, which publishes the state of their counters in a page of SOS
+ * memory, see struct acrn_timer_counters. The counter reads are served
+ * here from the TSC, so a guest polling a counter no longer makes a round
+ * trip to the device model on each read. Whenever a published state is
+ * being updated or not valid, the access goes to the device model.
+ */
+
+#define HPET_MAIN_COUNTER	0xf0UL
+
+#define PIT_CNTR0_PORT		0x40UL
+#define PIT_MODE_PORT		0x43UL
+#define PIT_8254_FREQ		1193182UL
+
+#define PIT_SEL_MASK		0xc0U
+#define PIT_SEL_READBACK	0xc0U
+#define PIT_RW_MASK		0x30U
+#define PIT_RW_LATCH		0x00U
+#define PIT_RB_CTR(ch)		(0x2U << (ch))
+
+/* ticks at freq Hz in tsc_delta ticks of a tsc_khz TSC, without overflowing */
+static uint64_t tsc_to_ticks(uint64_t tsc_delta, uint64_t freq, uint32_t tsc_khz)
+{
+	uint64_t tsc_hz = (uint64_t)tsc_khz * 1000UL;
+
+	return ((tsc_delta / tsc_hz) * freq) + (((tsc_delta % tsc_hz) * freq) / tsc_hz);
+}
+
+static inline uint64_t sos_rdtsc(const struct acrn_vm *vm)
+{
+	return rdtsc() + vm->sos_tsc_offset;
+}
+
+static uint64_t ticks_since(const struct acrn_vm *vm, uint64_t tsc, uint64_t freq, uint32_t tsc_khz)
+{
+	uint64_t now = sos_rdtsc(vm);
+
+	return (now > tsc) ? tsc_to_ticks(now - tsc, freq, tsc_khz) : 0UL;
+}
+
+/**
+ * @pre vm->timer_counters != NULL
+ */
+static bool read_hpet_counter(const struct acrn_vm *vm, struct mmio_request *mmio_req)
+{
+	const struct acrn_timer_counters *tc = vm->timer_counters;
+	const struct acrn_hpet_counter *hpet = &tc->hpet;
+	uint64_t offset, count = 0UL;
+	uint32_t seq;
+	bool hit = false;
+
+	stac();
+	seq = hpet->seq;
+	cpu_memory_barrier();
+	if (((seq & 1U) == 0U) && (hpet->valid != 0U) && (mmio_req->address >= hpet->base)) {
+		offset = mmio_req->address - hpet->base;
+		if (((offset == HPET_MAIN_COUNTER) && ((mmio_req->size == 4UL) || (mmio_req->size == 8UL))) ||
+				((offset == (HPET_MAIN_COUNTER + 4UL)) && (mmio_req->size == 4UL))) {
+			count = hpet->count;
+			if ((hpet->enabled != 0U) && (hpet->freq != 0UL) && (tc->tsc_khz != 0U)) {
+				count += ticks_since(vm, hpet->tsc, hpet->freq, tc->tsc_khz);
+			}
+			/* a 32-bit counter, zero-extended to 64 bits */
+			count &= 0xffffffffUL;
+			if (offset != HPET_MAIN_COUNTER) {
+				count = 0UL;
+			}
+			cpu_memory_barrier();
+			hit = (hpet->seq == seq);
+		}
+	}
+	clac();
+
+	if (hit) {
+		mmio_req->value = count;
+	}
+
+	return hit;
+}
+
+/* The current count of the channel, as computed by the device model */
+static uint16_t pit_count(uint32_t mode, uint32_t initial, uint64_t ticks)
+{
+	uint64_t t;
+	uint16_t count;
+
+	switch (mode) {
+	case 2U:
+		count = (uint16_t)(initial - (ticks % initial));
+		break;
+	case 3U:
+		t = ticks % initial;
+		if (t >= ((initial + 1UL) / 2UL)) {
+			t -= (initial + 1UL) / 2UL;
+		}
+		count = (uint16_t)((initial & ~0x1U) - (t * 2UL));
+		break;
+	default:
+		/* modes 0, 1 and 4 count down once */
+		count = (uint16_t)(initial - ticks);
+		break;
+	}
+
+	return count;
+}
+
+/**
+ * @pre vm->timer_counters != NULL
+ * @pre ch < ACRN_PIT_CHANNELS
+ */
+static bool latch_pit_counter(struct acrn_vm *vm, uint32_t ch)
+{
+	const struct acrn_timer_counters *tc = vm->timer_counters;
+	const struct acrn_pit_counter *pit = &tc->pit[ch];
+	uint32_t seq, mode, initial;
+	uint16_t count;
+	bool hit = false;
+
+	stac();
+	seq = pit->seq;
+	cpu_memory_barrier();
+	mode = pit->mode;
+	initial = pit->initial;
+	if (((seq & 1U) == 0U) && (pit->valid != 0U) && (mode <= 5U) && (initial != 0U) &&
+			(initial <= 0x10000U) && (tc->tsc_khz != 0U)) {
+		count = pit_count(mode, initial, ticks_since(vm, pit->tsc, PIT_8254_FREQ, tc->tsc_khz));
+		cpu_memory_barrier();
+		hit = (pit->seq == seq);
+	}
+	clac();
+
+	if (hit) {
+		/* a new count is not latched until the last one is read */
+		if (vm->pit_latch_bytes[ch] == 0U) {
+			vm->pit_latch[ch][1] = (uint8_t)count;		/* LSB */
+			vm->pit_latch[ch][0] = (uint8_t)(count >> 8U);	/* MSB */
+			vm->pit_latch_bytes[ch] = 2U;
+		}
+	}
+
+	return hit;
+}
+
+/**
+ * @pre vm->timer_counters != NULL
+ */
+static bool emulate_pit_counter(struct acrn_vm *vm, struct pio_request *pio_req)
+{
+	uint32_t ch, val;
+	bool hit = false;
+
+	spinlock_obtain(&vm->pit_latch_lock);
+	if (pio_req->address == PIT_MODE_PORT) {
+		if (pio_req->direction == REQUEST_WRITE) {
+			val = pio_req->value;
+			ch = (val & PIT_SEL_MASK) >> 6U;
+			if ((val & PIT_SEL_MASK) == PIT_SEL_READBACK) {
+				/* the device model latches them now */
+				for (ch = 0U; ch < ACRN_PIT_CHANNELS; ch++) {
+					if ((val & PIT_RB_CTR(ch)) != 0U) {
+						vm->pit_latch_bytes[ch] = 0U;
+					}
+				}
+			} else if ((val & PIT_RW_MASK) == PIT_RW_LATCH) {
+				hit = latch_pit_counter(vm, ch);
+			} else {
+				/* reprogramming drops the latch */
+				vm->pit_latch_bytes[ch] = 0U;
+			}
+		}
+	} else {
+		ch = (uint32_t)(pio_req->address - PIT_CNTR0_PORT);
+		if (pio_req->direction == REQUEST_READ) {
+			if (vm->pit_latch_bytes[ch] != 0U) {
+				vm->pit_latch_bytes[ch]--;
+				pio_req->value = vm->pit_latch[ch][vm->pit_latch_bytes[ch]];
+				hit = true;
+			}
+		} else {
+			vm->pit_latch_bytes[ch] = 0U;
+		}
+	}
+	spinlock_release(&vm->pit_latch_lock);
+
+	return hit;
+}
+
+/**
+ * @pre vm != NULL && io_req != NULL
+ */
+bool emulate_timer_counter(struct acrn_vm *vm, struct io_request *io_req)
+{
+	bool hit = false;
+
+	if (vm->timer_counters != NULL) {
+		if (io_req->io_type == REQ_MMIO) {
+			if (io_req->reqs.mmio.direction == REQUEST_READ) {
+				hit = read_hpet_counter(vm, &io_req->reqs.mmio);
+			}
+		} else if ((io_req->io_type == REQ_PORTIO) && (io_req->reqs.pio.size == 1UL) &&
+				(io_req->reqs.pio.address >= PIT_CNTR0_PORT) &&
+				(io_req->reqs.pio.address <= PIT_MODE_PORT)) {
+			hit = emulate_pit_counter(vm, &io_req->reqs.pio);
+		} else {
+			/* not a timer counter */
+		}
+	}
+
+	return hit;
+}
@@ -100,6 +100,8 @@ void vuart_putchar(struct acrn_vuart *vu, char ch)
 
 	vuart_lock(vu, rflags);
 	fifo_putchar(&vu->rxfifo, ch);
+	/* typed in the console, raised at once */
+	vu->rx_timeout = true;
 	vuart_unlock(vu, rflags);
 }
 
@@ -114,6 +116,89 @@ char vuart_getchar(struct acrn_vuart *vu)
 	return c;
 }
 
+/*
+ * The receive trigger level of the FCR, a single character when the FIFO
+ * is disabled.
+ */
+static uint32_t vuart_rx_trigger(const struct acrn_vuart *vu)
+{
+	static const uint32_t rx_trigger_levels[4] = { 1U, 4U, 8U, 14U };
+	uint32_t trigger = 1U;
+
+	if ((vu->fcr & FCR_FIFOE) != 0U) {
+		trigger = rx_trigger_levels[(vu->fcr & FCR_RX_MASK) >> 6U];
+	}
+	return trigger;
+}
+
+/* 4 characters of 10 bits at the baud rate of the divisor latch */
+static uint64_t vuart_rx_timeout_ticks(const struct acrn_vuart *vu)
+{
+	uint64_t divisor = ((uint64_t)vu->dlh << 8U) | (uint64_t)vu->dll;
+
+	if (divisor == 0UL) {
+		divisor = 1UL;
+	}
+	return us_to_ticks((uint32_t)((640UL * divisor * 1000000UL) / UART_CLOCK_RATE));
+}
+
+static void vuart_rx_timer_cb(void *data)
+{
+	struct acrn_vuart *vu = (struct acrn_vuart *)data;
+	uint64_t rflags;
+
+	vuart_lock(vu, rflags);
+	vu->rx_timer_armed = false;
+	if (vu->active && (fifo_numchars(&vu->rxfifo) > 0U)) {
+		vu->rx_timeout = true;
+		vuart_toggle_intr(vu);
+	}
+	vuart_unlock(vu, rflags);
+}
+
+/*
+ * Start the character timeout of the characters below the trigger level.
+ * The timer runs on the pCPU which armed it, it is only touched again once
+ * it fired, the other pCPUs leave it alone until then.
+ *
+ * @pre vu->lock is held
+ * @pre not called from a timer callback or an interrupt handler
+ */
+static void vuart_arm_rx_timeout(struct acrn_vuart *vu)
+{
+	uint32_t num = fifo_numchars(&vu->rxfifo);
+
+	if ((num > 0U) && (num < vuart_rx_trigger(vu)) && !vu->rx_timeout && !vu->rx_timer_armed) {
+		vu->rx_timer.fire_tsc = rdtsc() + vuart_rx_timeout_ticks(vu);
+		vu->rx_timer_pcpu = get_pcpu_id();
+		vu->rx_timer_armed = true;
+		(void)add_timer(&vu->rx_timer);
+	}
+}
+
+static void vuart_stop_rx_timer(struct acrn_vuart *vu)
+{
+	uint64_t rflags;
+	bool armed;
+
+	vuart_lock(vu, rflags);
+	vu->active = false;
+	if (vu->rx_timer_armed && (vu->rx_timer_pcpu == get_pcpu_id())) {
+		del_timer(&vu->rx_timer);
+		vu->rx_timer_armed = false;
+	}
+	armed = vu->rx_timer_armed;
+	vuart_unlock(vu, rflags);
+
+	/* armed on another pCPU, it fires there within a few characters */
+	while (armed) {
+		asm_pause();
+		vuart_lock(vu, rflags);
+		armed = vu->rx_timer_armed;
+		vuart_unlock(vu, rflags);
+	}
+}
+
 static inline void vuart_fifo_init(struct acrn_vuart *vu)
 {
 	vu->txfifo.buf = vu->vuart_tx_buf;
@@ -137,7 +222,9 @@ static uint8_t vuart_intr_reason(const struct acrn_vuart *vu)
 
 	if (((vu->lsr & LSR_OE) != 0U) && ((vu->ier & IER_ELSI) != 0U)) {
 		ret = IIR_RLS;
-	} else if ((fifo_numchars(&vu->rxfifo) > 0U) && ((vu->ier & IER_ERBFI) != 0U)) {
+	} else if ((fifo_numchars(&vu->rxfifo) >= vuart_rx_trigger(vu)) && ((vu->ier & IER_ERBFI) != 0U)) {
+		ret = IIR_RXRDY;
+	} else if ((fifo_numchars(&vu->rxfifo) > 0U) && vu->rx_timeout && ((vu->ier & IER_ERBFI) != 0U)) {
 		ret = IIR_RXTOUT;
 	} else if (vu->thre_int_pending && ((vu->ier & IER_ETBEI) != 0U)) {
 		ret = IIR_TXRDY;
@@ -207,6 +294,7 @@ static bool send_to_target(struct acrn_vuart *vu, uint8_t value_u8)
 		if (fifo_isfull(&vu->rxfifo)) {
 			ret = true;
 		}
+		vuart_arm_rx_timeout(vu);
 		vuart_toggle_intr(vu);
 	}
 	vuart_unlock(vu, rflags);
@@ -293,6 +381,7 @@ static void write_reg(struct acrn_vuart *vu, uint16_t reg, uint8_t value_u8)
 			if ((vu->mcr & MCR_LOOPBACK) != 0U) {
 				fifo_putchar(&vu->rxfifo, (char)value_u8);
 				vu->lsr |= LSR_OE;
+				vuart_arm_rx_timeout(vu);
 			} else {
 				fifo_putchar(&vu->txfifo, (char)value_u8);
 			}
@@ -318,8 +407,10 @@ static void write_reg(struct acrn_vuart *vu, uint16_t reg, uint8_t value_u8)
 			} else {
 				if ((value_u8 & FCR_RFR) != 0U) {
 					fifo_reset(&vu->rxfifo);
+					vu->rx_timeout = false;
 				}
 				vu->fcr = value_u8 & (FCR_FIFOE | FCR_DMA | FCR_RX_MASK);
+				vuart_arm_rx_timeout(vu);
 			}
 			break;
 		case UART16550_LCR:
@@ -444,6 +535,9 @@ static bool vuart_read(struct acrn_vcpu *vcpu, uint16_t offset_arg, __unused siz
 			case UART16550_RBR:
 				vu->lsr &= ~LSR_OE;
 				reg = (uint8_t)fifo_getchar(&vu->rxfifo);
+				/* the timeout interrupt is cleared by a read of RBR */
+				vu->rx_timeout = false;
+				vuart_arm_rx_timeout(vu);
 				break;
 			case UART16550_IER:
 				reg = vu->ier;
@@ -558,6 +652,9 @@ static void vuart_setup(struct acrn_vm *vm,
 	vuart_lock_init(vu);
 	vu->thre_int_pending = true;
 	vu->ier = 0U;
+	vu->rx_timeout = false;
+	vu->rx_timer_armed = false;
+	initialize_timer(&vu->rx_timer, vuart_rx_timer_cb, vu, 0UL, TICK_MODE_ONESHOT, 0UL);
 	vuart_toggle_intr(vu);
 	vu->target_vu = NULL;
 	if (vu_config->type == VUART_LEGACY_PIO) {
@@ -657,6 +754,9 @@ void vuart_deinit(struct acrn_vm *vm)
 	uint8_t i;
 
 	for (i = 0U; i < MAX_VUART_NUM_PER_VM; i++) {
+		if (vm->vuart[i].active) {
+			vuart_stop_rx_timer(&vm->vuart[i]);
+		}
 		vm->vuart[i].active = false;
 		if (vm->vuart[i].target_vu != NULL) {
 			vuart_deinit_connect(&vm->vuart[i]);
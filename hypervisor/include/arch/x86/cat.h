@@ -16,16 +16,57 @@ struct cat_hw_info {
 	uint16_t clos_max;	/* Maximum CLOS supported, the number of cache masks */
 
 	uint32_t res_id;
+
+	bool mba_support;	/* If Memory Bandwidth Allocation supported */
+	bool mba_linear;	/* If the throttling delays are linear */
+	uint16_t mba_clos_max;	/* Maximum CLOS of MBA */
+	uint16_t mba_max_delay;	/* Maximum throttling delay */
+};
+
+/* The RDT monitoring, Cache Monitoring Tech(CMT) and Memory Bandwidth Monitoring(MBM) */
+struct cmt_hw_info {
+	bool support;		/* If L3 occupancy monitoring supported */
+	bool mbm_total;		/* If L3 total external bandwidth monitoring supported */
+	bool mbm_local;		/* If L3 local external bandwidth monitoring supported */
+	uint16_t rmid_max;	/* Maximum RMID of the L3 monitoring */
+	uint32_t upscale;	/* Bytes of one unit of IA32_QM_CTR */
+	uint64_t mbm_mask;	/* Bits of the wrapping MBM counters */
+};
+
+/* The telemetry of a RMID, sampled every RDT_MON_PERIOD_MS */
+struct rmid_stats {
+	uint64_t llc_occupancy;		/* bytes of the L3 in use */
+	uint64_t mbm_total_bytes;	/* bytes moved to/from the memory */
+	uint64_t mbm_local_bytes;	/* bytes moved to/from the local memory */
+	uint64_t total_bw;		/* bytes per second in the last period */
+	uint64_t local_bw;		/* bytes per second in the last period */
+
+	bool sampled;
+	uint64_t last_total;		/* IA32_QM_CTR of the last sample */
+	uint64_t last_local;
 };
 
+#define RDT_MON_PERIOD_MS	1000U
+
 extern struct cat_hw_info cat_cap_info;
+extern struct cmt_hw_info cmt_cap_info;
 extern const uint16_t hv_clos;
 void setup_clos(uint16_t pcpu_id);
+void setup_rdt_monitor(uint16_t pcpu_id);
 
 #define CAT_RESID_L3   1U
 #define CAT_RESID_L2   2U
+#define CAT_RESID_MBA  3U
+
+#define MBA_MAX_CLOS_NUM	16U
 
 int32_t init_cat_cap_info(void);
 uint64_t clos2prq_msr(uint16_t clos);
+bool is_clos_valid(uint16_t clos);
+bool is_clos_reserved(uint16_t clos);
+void load_pqr_assoc(uint16_t rmid, uint16_t clos);
+uint16_t vm_rmid(uint16_t vm_id);
+const struct rmid_stats *get_rmid_stats(uint16_t rmid);
+int32_t set_clos_mask(uint16_t clos, uint16_t type, uint64_t value);
 
 #endif	/* CAT_H */
@@ -85,6 +85,8 @@
 #define CR4_SMAP                (1UL<<21U)
 #define CR4_PKE                 (1UL<<22U)	/* Protect-key-enable */
 
+/* XCR0_X87 */
+#define XCR0_X87		(1UL<<0U)
 /* XCR0_SSE */
 #define XCR0_SSE		(1UL<<1U)
 /* XCR0_AVX */
@@ -150,7 +152,6 @@
 
 /* Number of GPRs saved / restored for guest in VCPU structure */
 #define NUM_GPRS                            16U
-#define GUEST_STATE_AREA_SIZE               512
 
 #define	CPU_CONTEXT_OFFSET_RAX			0U
 #define	CPU_CONTEXT_OFFSET_RCX			8U
@@ -180,9 +181,6 @@
 #define	CPU_CONTEXT_OFFSET_IDTR			192U
 #define	CPU_CONTEXT_OFFSET_LDTR			216U
 
-/*sizes of various registers within the VCPU data structure */
-#define VMX_CPU_S_FXSAVE_GUEST_AREA_SIZE    GUEST_STATE_AREA_SIZE
-
 #ifndef ASSEMBLER
 
 #define AP_MASK			(((1UL << get_pcpu_nums()) - 1UL) & ~(1UL << 0U))
@@ -253,6 +251,9 @@ enum cpu_reg_name {
 /* In trampoline range, hold the jump target which trampline will jump to */
 extern uint64_t               main_entry[1];
 extern uint64_t               secondary_cpu_stack[1];
+extern uint64_t               secondary_cpu_stacks[1];
+extern uint32_t               secondary_cpu_lapic_ids[1];
+extern uint32_t               secondary_cpu_num[1];
 
 /*
  * To support per_cpu access, we use a special struct "per_cpu_region" to hold
@@ -342,6 +343,10 @@ struct run_context {
 	 */
 	uint64_t ia32_spec_ctrl;
 	uint64_t ia32_efer;
+
+	/* read from the VMCS once per VM exit, see vcpu_get_cr3() */
+	uint64_t cr3;
+	uint32_t cs_attr;
 };
 
 /*
@@ -365,6 +370,7 @@ struct ext_context {
 
 	uint64_t ia32_star;
 	uint64_t ia32_lstar;
+	uint64_t ia32_cstar;
 	uint64_t ia32_fmask;
 	uint64_t ia32_kernel_gs_base;
 
@@ -376,11 +382,6 @@ struct ext_context {
 
 	uint64_t dr7;
 	uint64_t tsc_offset;
-
-	/* The 512 bytes area to save the FPU/MMX/SSE states for the guest */
-	uint64_t
-	fxstore_guest_area[VMX_CPU_S_FXSAVE_GUEST_AREA_SIZE / sizeof(uint64_t)]
-	__aligned(16);
 };
 
 struct cpu_context {
@@ -389,7 +390,7 @@ struct cpu_context {
 };
 
 /* Function prototypes */
-void cpu_do_idle(void);
+void cpu_do_idle(volatile const uint64_t *addr, uint64_t val);
 void cpu_dead(void);
 void trampoline_start16(void);
 void load_pcpu_state_data(void);
@@ -607,6 +608,49 @@ static inline void write_xcr(int32_t reg, uint64_t val)
 	asm volatile("xsetbv" : : "c" (reg), "a" ((uint32_t)val), "d" ((uint32_t)(val >> 32U)));
 }
 
+static inline uint64_t read_xcr(int32_t reg)
+{
+	uint32_t xcrl, xcrh;
+
+	asm volatile("xgetbv" : "=a" (xcrl), "=d" (xcrh) : "c" (reg));
+
+	return (((uint64_t)xcrh) << 32U) | xcrl;
+}
+
+/* save the state components in rfbm, the area MUST be 64-byte aligned */
+static inline void xsave(void *area, uint64_t rfbm)
+{
+	asm volatile("xsave (%0)"
+			: : "r" (area), "a" ((uint32_t)rfbm), "d" ((uint32_t)(rfbm >> 32U))
+			: "memory");
+}
+
+/* as xsave(), skips the components not modified since the XRSTOR of the area */
+static inline void xsaveopt(void *area, uint64_t rfbm)
+{
+	asm volatile("xsaveopt (%0)"
+			: : "r" (area), "a" ((uint32_t)rfbm), "d" ((uint32_t)(rfbm >> 32U))
+			: "memory");
+}
+
+static inline void xrstor(const void *area, uint64_t rfbm)
+{
+	asm volatile("xrstor (%0)"
+			: : "r" (area), "a" ((uint32_t)rfbm), "d" ((uint32_t)(rfbm >> 32U))
+			: "memory");
+}
+
+/* the area MUST be 16-byte aligned */
+static inline void fxsave(void *area)
+{
+	asm volatile("fxsave (%0)" : : "r" (area) : "memory");
+}
+
+static inline void fxrstor(const void *area)
+{
+	asm volatile("fxrstor (%0)" : : "r" (area) : "memory");
+}
+
 /*
  * stac/clac pair is used to access guest's memory protected by SMAP,
  * following below flow:
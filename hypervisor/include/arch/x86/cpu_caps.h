@@ -24,7 +24,8 @@
 #define	FEAT_8000_0001_EDX	6U     /* CPUID[8000_0001].EDX */
 #define	FEAT_8000_0007_EDX	7U     /* CPUID[8000_0007].EDX */
 #define	FEAT_8000_0008_EBX	8U     /* CPUID[8000_0008].EBX */
-#define	FEATURE_WORDS		9U
+#define	FEAT_D_1_EAX		9U     /* CPUID[EAX=0xD,ECX=1].EAX */
+#define	FEATURE_WORDS		10U
 
 struct cpuinfo_x86 {
 	uint8_t family, model;
@@ -37,14 +38,27 @@ struct cpuinfo_x86 {
 	char model_name[64];
 };
 
+/*
+ * Where a pCPU sits: the x2APIC ID with the bits of the cores sharing its
+ * L2, its last level cache and its package shifted out. pCPUs with the
+ * same l2_id share an L2, hybrid parts may have L2 of different sizes.
+ */
+struct pcpu_topology {
+	uint32_t l2_id;
+	uint32_t llc_id;
+	uint32_t pkg_id;
+};
+
 bool has_monitor_cap(void);
 bool monitor_cap_buggy(void);
 bool is_apicv_advanced_feature_supported(void);
+bool is_apicv_ipiv_supported(void);
 bool pcpu_has_cap(uint32_t bit);
 bool pcpu_has_vmx_ept_cap(uint32_t bit_mask);
 bool pcpu_has_vmx_vpid_cap(uint32_t bit_mask);
 void init_pcpu_capabilities(void);
 void init_pcpu_model_name(void);
+void init_pcpu_topology(uint16_t pcpu_id);
 int32_t detect_hardware_support(void);
 struct cpuinfo_x86 *get_pcpu_info(void);
 
@@ -104,6 +104,8 @@
 #define CPUID_EAX_SGX1          (1U<<0U)
 /* CPUID.12H.EAX.SGX2 */
 #define CPUID_EAX_SGX2          (1U<<1U)
+/* CPUID.05H.ECX.MWAIT_INTERRUPT_BREAK */
+#define CPUID_ECX_MWAIT_INT_BREAK	(1U<<1U)
 /* CPUID.80000001H.EDX.XD_BIT_AVAILABLE */
 #define CPUID_EDX_XD_BIT_AVIL   (1U<<20U)
 
@@ -112,7 +114,12 @@
 #define CPUID_FEATURES          1U
 #define CPUID_TLB               2U
 #define CPUID_SERIALNUM         3U
+#define CPUID_CACHE_PARAMS      4U
+#define CPUID_MWAIT_LEAF        5U
 #define CPUID_EXTEND_FEATURE    7U
+#define CPUID_EXTEND_TOPOLOGY  0xBU
+#define CPUID_XSAVE_FEATURES   0xDU
+#define CPUID_RSD_MONITORING   0xFU
 #define CPUID_RSD_ALLOCATION   0x10U
 #define CPUID_MAX_EXTENDED_FUNCTION  0x80000000U
 #define CPUID_EXTEND_FUNCTION_1      0x80000001U
@@ -10,6 +10,47 @@
 
 typedef void (*pge_handler)(uint64_t *pgentry, uint64_t size);
 
+struct acrn_vm;
+
+/* Pages reported by one ept_harvest_ad_bits() callback at most */
+#define EPT_AD_CHUNK_PAGES	4096UL
+
+/* Max guest physical ranges a batch invalidates in the IOTLB, the whole domain beyond */
+#define EPT_UPDATE_IOTLB_RANGES	4U
+
+/**
+ * @brief A batch of EPT updates of one VM
+ *
+ * The TLB and IOTLB invalidations needed by the updates of the batch are
+ * only recorded, and done once by ept_update_commit().
+ */
+struct ept_update {
+	struct acrn_vm *vm;
+	bool flush_tlb;
+	/* iotlb_num > EPT_UPDATE_IOTLB_RANGES means the whole domain */
+	uint32_t iotlb_num;
+	struct {
+		uint64_t gpa;
+		uint64_t size;
+	} iotlb_ranges[EPT_UPDATE_IOTLB_RANGES];
+};
+
+/* Recent local_gpa2hpa() results kept by each pCPU for a VM */
+#define EPT_LOOKUP_CACHE_ENTRIES	4U
+
+struct ept_lookup_entry {
+	const void *eptp;	/* NULL means an unused entry */
+	uint64_t gen;		/* struct vm_arch.ept_gen at the lookup */
+	uint64_t gpa;		/* gpa of the page, aligned on pg_size */
+	uint64_t hpa;
+	uint64_t pg_size;
+};
+
+struct ept_lookup_cache {
+	struct ept_lookup_entry entries[EPT_LOOKUP_CACHE_ENTRIES];
+	uint32_t next;
+};
+
 /**
  * Invalid HPA is defined for error checking,
  * according to SDM vol.3A 4.1.4, the maximum
@@ -106,6 +147,69 @@ void ept_modify_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa,
 void ept_del_mr(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa,
 		uint64_t size);
 
+/**
+ * @brief Start a batch of EPT updates
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ * @param[out] update the batch to start
+ *
+ * @return None
+ */
+void ept_update_begin(struct acrn_vm *vm, struct ept_update *update);
+/**
+ * @brief Guest-physical memory region mapping, as part of a batch
+ *
+ * Same as ept_add_mr(), the invalidations are deferred to ept_update_commit().
+ *
+ * @return None
+ */
+void ept_update_add_mr(struct ept_update *update, uint64_t *pml4_page, uint64_t hpa,
+		uint64_t gpa, uint64_t size, uint64_t prot_orig);
+/**
+ * @brief Guest-physical memory page access right or memory type updating, as part of a batch
+ *
+ * Same as ept_modify_mr(), the invalidations are deferred to ept_update_commit().
+ *
+ * @return None
+ */
+void ept_update_modify_mr(struct ept_update *update, uint64_t *pml4_page, uint64_t gpa,
+		uint64_t size, uint64_t prot_set, uint64_t prot_clr);
+/**
+ * @brief Guest-physical memory region unmapping, as part of a batch
+ *
+ * Same as ept_del_mr(), the invalidations are deferred to ept_update_commit().
+ *
+ * @return None
+ *
+ * @pre [gpa,gpa+size) has been mapped into host physical memory region
+ */
+void ept_update_del_mr(struct ept_update *update, uint64_t *pml4_page, uint64_t gpa,
+		uint64_t size);
+/**
+ * @brief Finish a batch of EPT updates
+ *
+ * Request a single INVEPT from each vCPU of the VM and invalidate the IOTLB
+ * of its iommu domain once, as needed by the updates of the batch.
+ *
+ * @param[inout] update the batch to finish
+ *
+ * @return None
+ */
+void ept_update_commit(struct ept_update *update);
+
+/**
+ * @brief Invalidate the EPT derived mappings of vm on this pCPU
+ *
+ * Done on the ACRN_REQUEST_EPT_FLUSH of a vCPU. The INVEPT(s) are skipped
+ * if the EPT of vm has not changed since the last flush on this pCPU, by
+ * another vCPU of vm for instance.
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ *
+ * @return None
+ */
+void flush_vm_ept(struct acrn_vm *vm);
+
 /**
  * @brief Flush address space from the page entry
  *
@@ -127,6 +231,78 @@ void ept_flush_leaf_page(uint64_t *pge, uint64_t size);
  */
 void *get_ept_entry(struct acrn_vm *vm);
 
+/**
+ * @brief Get the value of the VMCS EPT pointer field for an EPT of the vm
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ * @param[in] eptp the EPT of the vm, nworld_eptp or sworld_eptp
+ *
+ * @return the EPT pointer, with the A/D flags enabled if tracking is on
+ */
+uint64_t ept_pointer(const struct acrn_vm *vm, const void *eptp);
+
+/**
+ * @brief Enable or disable the tracking of the accessed/dirty guest pages
+ *
+ * All the accessed/dirty flags are cleared on enabling, each vCPU of the vm
+ * reloads its EPT pointer on its next VM entry.
+ *
+ * @param[inout] vm the pointer that points to VM data structure
+ * @param[in] enable true to start the tracking, false to stop it
+ *
+ * @pre pcpu_has_vmx_ept_cap(VMX_EPT_AD) if enable is true
+ */
+void ept_set_ad_tracking(struct acrn_vm *vm, bool enable);
+
+/**
+ * @brief Callback of ept_harvest_ad_bits() to report one chunk of the bitmap
+ *
+ * Bit i of bitmap stands for the 4K page gpa + (i << 12), gpa being
+ * page_idx pages after the start of the harvested range.
+ */
+typedef int32_t (*ept_ad_bitmap_cb)(void *data, const uint64_t *bitmap, uint64_t page_idx, uint64_t page_num);
+
+/**
+ * @brief Harvest and clear the accessed or dirty flags of a guest memory range
+ *
+ * Walk the normal world EPT of [gpa, gpa + size). Each page mapped by a leaf
+ * entry with the flag set is reported through cb, in chunks of up to
+ * EPT_AD_CHUNK_PAGES pages. Then the flag is cleared and the TLBs of all the
+ * pCPUs running the vm are invalidated before returning. A 2M/1G page only
+ * partly in the range is reported but its flag is kept, so that the pages
+ * out of the range are not lost.
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ * @param[in] gpa the start GPA of the range, 4K aligned
+ * @param[in] size the size of the range, 4K aligned
+ * @param[in] ad_bit EPT_ACCESSED_BIT or EPT_DIRTY_BIT
+ * @param[in] cb the callback the bitmap chunks are reported to
+ * @param[in] data the data passed to cb
+ *
+ * @return 0 on success, the first non-zero value returned by cb otherwise
+ *
+ * @pre vm->arch_vm.ept_ad_enabled
+ */
+int32_t ept_harvest_ad_bits(struct acrn_vm *vm, uint64_t gpa, uint64_t size, uint16_t ad_bit,
+		ept_ad_bitmap_cb cb, void *data);
+
+struct ept_page_stats {
+	uint64_t pages_1g;
+	uint64_t pages_2m;
+	uint64_t pages_4k;
+	uint64_t split_1g;	/* 1G ranges mapped by smaller pages */
+};
+
+/**
+ * @brief Count the leaf entries of each page size in the EPT
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ * @param[out] stats the number of pages mapped at each level
+ *
+ * @return None
+ */
+void ept_page_stats(const struct acrn_vm *vm, struct ept_page_stats *stats);
+
 /**
  * @brief Walking through EPT table
  *
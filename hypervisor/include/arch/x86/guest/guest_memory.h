@@ -33,6 +33,9 @@ int32_t gva2gpa(struct acrn_vcpu *vcpu, uint64_t gva, uint64_t *gpa, uint32_t *e
 
 enum vm_paging_mode get_vcpu_paging_mode(struct acrn_vcpu *vcpu);
 
+/* drop the gva2gpa() translations cached by vcpu, on guest paging mode changes */
+void flush_vcpu_gva_tlb(struct acrn_vcpu *vcpu);
+
 /* gpa --> hpa -->hva */
 void *gpa2hva(struct acrn_vm *vm, uint64_t x);
 
@@ -80,6 +83,33 @@ int32_t copy_from_gpa(struct acrn_vm *vm, void *h_ptr, uint64_t gpa, uint32_t si
  * @pre Pointer vm is non-NULL
  */
 int32_t copy_to_gpa(struct acrn_vm *vm, void *h_ptr, uint64_t gpa, uint32_t size);
+/**
+ * @brief Access a VM GPA memory region in place
+ *
+ * Look up the HV address of the GPA memory region without copying it, the
+ * region shall not cross the EPT mapping (4K, 2M or 1G page) containing gpa.
+ * The returned view stays accessible until gpa_view_put(), callers are expected
+ * to read it just once and release it right away, no other guest memory access
+ * is allowed in between.
+ *
+ * @param[in] vm The pointer that points to VM data structure
+ * @param[in] gpa The start GPA address of GPA memory region
+ * @param[in] size The size (bytes) of GPA memory region
+ *
+ * @return the HV address of gpa, NULL if the region is not mapped or crosses
+ *         the page, in which case gpa_view_put() shall not be called.
+ *
+ * @pre Pointer vm is non-NULL
+ */
+const void *gpa_view_get(struct acrn_vm *vm, uint64_t gpa, uint32_t size);
+/**
+ * @brief Release a view returned by gpa_view_get()
+ *
+ * @param[in] view The pointer returned by gpa_view_get()
+ *
+ * @pre view != NULL
+ */
+void gpa_view_put(const void *view);
 /**
  * @brief Copy data from VM GVA space to HV address space
  *
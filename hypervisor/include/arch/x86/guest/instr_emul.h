@@ -33,6 +33,7 @@
 #include <types.h>
 #include <cpu.h>
 #include <guest_memory.h>
+#include <spinlock.h>
 
 struct acrn_vcpu;
 struct instr_emul_vie_op {
@@ -90,6 +91,26 @@ struct instr_emul_ctxt {
 	struct instr_emul_vie vie;
 };
 
+/*
+ * Decoded instructions of a VM, indexed by guest RIP. A hit still needs the
+ * same instruction bytes, see decode_instruction().
+ */
+#define VIE_CACHE_ENTRIES	64U
+
+struct vie_cache_entry {
+	uint64_t rip;
+	uint64_t cr3;
+	uint8_t cpu_mode;	/* enum vm_cpu_mode */
+	bool cs_d;
+	bool valid;
+	struct instr_emul_vie vie;	/* right after decode */
+};
+
+struct vie_cache {
+	spinlock_t lock;
+	struct vie_cache_entry entries[VIE_CACHE_ENTRIES];
+};
+
 int32_t emulate_instruction(struct acrn_vcpu *vcpu);
 int32_t decode_instruction(struct acrn_vcpu *vcpu);
 
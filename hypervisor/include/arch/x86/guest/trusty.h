@@ -122,6 +122,7 @@ struct trusty_startup_param {
 };
 
 void switch_world(struct acrn_vcpu *vcpu, int32_t next_world);
+bool claim_world_fpu(struct acrn_vcpu *vcpu);
 bool initialize_trusty(struct acrn_vcpu *vcpu, struct trusty_boot_param *boot_param);
 void destroy_secure_world(struct acrn_vm *vm, bool need_clr_mem);
 void save_sworld_context(struct acrn_vcpu *vcpu);
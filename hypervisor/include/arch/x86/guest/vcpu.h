@@ -86,6 +86,21 @@
  */
 #define ACRN_REQUEST_VPID_FLUSH			7U
 
+/**
+ * @brief Request for EPT pointer reload, on a change of its A/D flags enable
+ */
+#define ACRN_REQUEST_EPTP_UPDATE		8U
+
+/**
+ * @brief Request for MSR_IA32_PQR_ASSOC reload, on a change of the vCPU CLOS
+ */
+#define ACRN_REQUEST_CLOS_UPDATE		9U
+
+/**
+ * @brief Request for restarting the vRTC timer, on the pCPU of the BSP
+ */
+#define ACRN_REQUEST_VRTC_TIMER			10U
+
 /**
  * @}
  */
@@ -153,12 +168,22 @@ enum vm_cpu_mode {
 
 #define EOI_EXIT_BITMAP_SIZE	256U
 
+/*
+ * XSAVE area in the standard format, large enough for the components the
+ * guests can enable in XCR0[9:0], see XCR0_RESERVED_BITS.
+ */
+#define XSAVE_AREA_SIZE		4096U
+
 struct guest_cpu_context {
 	struct run_context run_ctx;
 	struct ext_context ext_ctx;
 
 	/* per world MSRs, need isolation between secure and normal world */
 	uint32_t world_msrs[NUM_WORLD_MSRS];
+
+	/* the FPU state and XCR0 of the world while the other one runs */
+	uint64_t xcr0;
+	uint8_t xsave_area[XSAVE_AREA_SIZE] __aligned(64);
 };
 
 /* Intel SDM 24.8.2, the address must be 16-byte aligned */
@@ -170,16 +195,45 @@ struct msr_store_entry {
 
 enum {
 	MSR_AREA_TSC_AUX = 0,
-	MSR_AREA_IA32_PQR_ASSOC,
 	MSR_AREA_COUNT,
 };
 
+/*
+ * Guest MSRs which are neither in the VMCS nor in the MSR store areas, they
+ * are swapped on a switch between two vCPUs.
+ */
+enum {
+	SWITCHED_MSR_STAR = 0,
+	SWITCHED_MSR_LSTAR,
+	SWITCHED_MSR_CSTAR,
+	SWITCHED_MSR_FMASK,
+	SWITCHED_MSR_KERNEL_GS_BASE,	/* changed by SWAPGS, not intercepted */
+	NUM_SWITCHED_MSRS,
+};
+
 struct msr_store_area {
 	struct msr_store_entry guest[MSR_AREA_COUNT];
 	struct msr_store_entry host[MSR_AREA_COUNT];
 	uint32_t count;	/* actual count of entries to be loaded/restored during VMEntry/VMExit */
 };
 
+/* PAUSE-loop exiting gap and window bounds in TSC cycles, see vcpu_yield() */
+#define PLE_GAP			128U
+#define PLE_WINDOW_MIN		4096U
+#define PLE_WINDOW_MAX		65536U
+
+/* gva2gpa() translations cached during a VM exit */
+#define GVA_TLB_ENTRIES		4U
+
+struct gva_tlb_entry {
+	uint64_t gva_page;
+	uint64_t gpa_page;
+	uint64_t cr3;		/* guest CR3, PCID included */
+	uint32_t access;	/* PAGE_FAULT_WR_FLAG and PAGE_FAULT_ID_FLAG of the walk */
+	uint32_t nrexit;	/* nrexits of the vcpu when the entry was filled */
+	bool valid;
+};
+
 struct acrn_vcpu_arch {
 	/* vmcs region for this vcpu, MUST be 4KB-aligned */
 	uint8_t vmcs[PAGE_SIZE];
@@ -194,11 +248,17 @@ struct acrn_vcpu_arch {
 
 	int32_t cur_context;
 	struct guest_cpu_context contexts[NR_WORLD];
+	/* the world whose FPU state is in the registers, see switch_world_fpu() */
+	int32_t fpu_world;
+	bool fpu_trapped;	/* CR0.TS forced, see vcpu_trap_fpu() */
 
 	/* common MSRs, world_msrs[] is a subset of it */
 	uint64_t guest_msrs[NUM_GUEST_MSRS];
 
 	uint16_t vpid;
+	/* Class of Service and RMID, loaded to MSR_IA32_PQR_ASSOC when switched in */
+	uint16_t clos;
+	uint16_t rmid;
 
 	/* Holds the information needed for IRQ/exception handling. */
 	struct {
@@ -211,7 +271,34 @@ struct acrn_vcpu_arch {
 
 	uint8_t lapic_mask;
 	bool irq_window_enabled;
+	/* set from the pending requests check to the VM exit, see vcpu_thread() */
+	volatile bool in_non_root;
+	/* timer events of the pCPU come as VMX preemption timer exits while running */
+	bool ptmr_enabled;
+	/* blocked in HLT off the runqueue until a wakeup event, see vcpu_halt() */
+	volatile bool halted;
+	uint64_t halt_tsc;		/* TSC when the vCPU blocked */
+	uint64_t halt_poll_cycles;	/* adaptive poll window of vcpu_halt() */
+	uint32_t ple_window;		/* PAUSE-loop exiting window, see vcpu_yield() */
 	uint32_t nrexits;
+	struct vmexit_stats exit_stats;
+	uint64_t nr_injected;		/* interrupts and NMIs injected at VM entry */
+	struct acrn_vcpu_stats *stats;	/* in SOS memory, NULL if not set */
+
+	/* paravirtual steal time, see struct acrn_steal_time */
+	uint64_t steal_time_msr;
+	uint64_t steal_time_base;	/* sched_obj.wait_tsc when it was enabled */
+	struct acrn_steal_time *steal_time;	/* in guest memory, NULL if disabled */
+
+	/* paravirtual clock, see struct acrn_pvclock */
+	uint64_t pvclock_msr;
+	struct acrn_pvclock *pvclock;	/* in guest memory, NULL if disabled */
+
+	/* the VMCS was cleared on the previous pCPU, see clear_vmcs() */
+	bool vmcs_cleared;
+
+	struct gva_tlb_entry gva_tlb[GVA_TLB_ENTRIES];
+	uint32_t gva_tlb_next;
 
 	/* VCPU context state information */
 	uint32_t exit_reason;
@@ -231,6 +318,14 @@ struct acrn_vcpu_arch {
 
 	/* EOI_EXIT_BITMAP buffer, for the bitmap update */
 	uint64_t eoi_exit_bitmap[EOI_EXIT_BITMAP_SIZE >> 6U];
+
+	/*
+	 * Guest state left in the registers when the vCPU is switched out, it is
+	 * only saved here when another vCPU is switched in on the pCPU.
+	 */
+	uint8_t xsave_area[XSAVE_AREA_SIZE] __aligned(64);
+	uint64_t xcr0;
+	uint64_t switched_msrs[NUM_SWITCHED_MSRS];
 } __aligned(PAGE_SIZE);
 
 struct acrn_vm;
@@ -253,6 +348,9 @@ struct acrn_vcpu {
 
 	struct instr_emul_ctxt inst_ctxt;
 	struct io_request req; /* used by io/ept emulation */
+	uint16_t last_mmio_idx;	/* emul_mmio index of the last MMIO handler hit */
+	uint16_t last_pio_idx;	/* emul_pio index of the last port io handler hit */
+	uint32_t ioreq_waiting;	/* paused for the completion of a polling request */
 
 	uint64_t reg_cached;
 	uint64_t reg_updated;
@@ -410,6 +508,30 @@ uint64_t vcpu_get_rflags(struct acrn_vcpu *vcpu);
  */
 void vcpu_set_rflags(struct acrn_vcpu *vcpu, uint64_t val);
 
+/**
+ * @brief get vcpu CR3 value
+ *
+ * Get & cache target vCPU's CR3 in run_context. The guest loads CR3
+ * without VM exit, the value is cached until the next VM exit.
+ *
+ * @param[in] vcpu pointer to vcpu data structure
+ *
+ * @return the value of CR3.
+ */
+uint64_t vcpu_get_cr3(struct acrn_vcpu *vcpu);
+
+/**
+ * @brief get vcpu CS access rights
+ *
+ * Get & cache target vCPU's CS access rights in run_context, until the
+ * next VM exit.
+ *
+ * @param[in] vcpu pointer to vcpu data structure
+ *
+ * @return the CS access rights.
+ */
+uint32_t vcpu_get_cs_attr(struct acrn_vcpu *vcpu);
+
 /**
  * @brief get guest emulated MSR
  *
@@ -435,6 +557,29 @@ uint64_t vcpu_get_guest_msr(const struct acrn_vcpu *vcpu, uint32_t msr);
  */
 void vcpu_set_guest_msr(struct acrn_vcpu *vcpu, uint32_t msr, uint64_t val);
 
+/**
+ * @brief set a guest MSR swapped on a vCPU switch
+ *
+ * Write the MSR and track its value, the vCPU must be the one running.
+ *
+ * @param[in] vcpu pointer to vcpu data structure
+ * @param[in] idx SWITCHED_MSR_STAR ~ SWITCHED_MSR_KERNEL_GS_BASE
+ * @param[in] val the value to set the target MSR
+ *
+ * @return None
+ */
+void vcpu_set_switched_msr(struct acrn_vcpu *vcpu, uint32_t idx, uint64_t val);
+
+/**
+ * @brief swap the guest MSRs not in the VMCS from one vCPU to another
+ *
+ * @param[in] prev the vCPU whose MSRs are in the pCPU, NULL if none is
+ * @param[in] vcpu the vCPU switched in
+ *
+ * @return None
+ */
+void switch_guest_msrs(struct acrn_vcpu *prev, const struct acrn_vcpu *vcpu);
+
 /**
  * @brief write eoi_exit_bitmap to VMCS fields
  *
@@ -523,6 +668,29 @@ void init_vcpu_protect_mode_regs(struct acrn_vcpu *vcpu, uint64_t vgdt_base_gpa)
  */
 void set_vcpu_startup_entry(struct acrn_vcpu *vcpu, uint64_t entry);
 
+/**
+ * @brief Init an XSAVE area to the reset state of the x87 and SSE registers
+ *
+ * @param[out] area the XSAVE area of XSAVE_AREA_SIZE bytes
+ *
+ * @return None
+ */
+void init_xsave_area(uint8_t *area);
+
+/**
+ * @brief Switch the FPU state in the registers
+ *
+ * Save the FPU, SSE and AVX state of the registers and load another one,
+ * along with its XCR0.
+ *
+ * @param[out] save_area the XSAVE area to save the registers, NULL to drop them
+ * @param[in] load_area the XSAVE area to load
+ * @param[in] load_xcr0 XCR0 of the state in load_area
+ *
+ * @return None
+ */
+void switch_fpu_state(uint8_t *save_area, const uint8_t *load_area, uint64_t load_xcr0);
+
 static inline bool is_long_mode(struct acrn_vcpu *vcpu)
 {
 	return (vcpu_get_efer(vcpu) & MSR_IA32_EFER_LMA_BIT) != 0UL;
@@ -547,12 +715,14 @@ struct acrn_vcpu* get_ever_run_vcpu(uint16_t pcpu_id);
  * vpid, vmcs, vlapic, etc. It sets the init vCPU state to VCPU_INIT
  *
  * @param[in] pcpu_id created vcpu will run on this pcpu
+ * @param[in] vcpu_id the next vCPU ID of the VM, or the one of an offline
+ *		vCPU of the VM, which is created again
  * @param[in] vm pointer to vm data structure, this vcpu will owned by this vm.
  * @param[out] rtn_vcpu_handle pointer to the created vcpu
  *
  * @retval 0 vcpu created successfully, other values failed.
  */
-int32_t create_vcpu(uint16_t pcpu_id, struct acrn_vm *vm, struct acrn_vcpu **rtn_vcpu_handle);
+int32_t create_vcpu(uint16_t pcpu_id, uint16_t vcpu_id, struct acrn_vm *vm, struct acrn_vcpu **rtn_vcpu_handle);
 
 /**
  * @brief run into non-root mode based on vcpu setting
@@ -567,6 +737,52 @@ int32_t create_vcpu(uint16_t pcpu_id, struct acrn_vm *vm, struct acrn_vcpu **rtn
  */
 int32_t run_vcpu(struct acrn_vcpu *vcpu);
 
+/**
+ * @brief publish the statistics of a VM exit of the vcpu
+ *
+ * Updates the statistics page of the vCPU, if the device model set one up.
+ * Invoked by the vCPU thread once the exit is handled.
+ *
+ * @param[inout] vcpu pointer to vcpu data structure
+ * @param[in] basic_exit_reason the VMX basic exit reason
+ * @param[in] guest_cycles TSC cycles spent in non-root mode before the exit
+ * @param[in] root_cycles TSC cycles spent to handle the exit
+ * @pre vcpu != NULL
+ * @pre vcpu is running on its pCPU
+ *
+ * @return None
+ */
+void update_vcpu_stats(struct acrn_vcpu *vcpu, uint32_t basic_exit_reason,
+		uint64_t guest_cycles, uint64_t root_cycles);
+
+/**
+ * @brief publish the steal time of the vcpu to the guest
+ *
+ * Updates the steal time area of the guest, if the guest enabled it.
+ *
+ * @param[inout] vcpu pointer to vcpu data structure
+ * @param[in] preempted whether the vCPU is switched out while runnable
+ * @pre vcpu != NULL
+ * @pre vcpu runs on the current pCPU or is being switched on it
+ *
+ * @return None
+ */
+void update_steal_time(struct acrn_vcpu *vcpu, bool preempted);
+
+/**
+ * @brief publish the clock of the vcpu to the guest
+ *
+ * Updates the pvclock area of the guest, if the guest enabled it, with the
+ * current TSC offset of the vcpu.
+ *
+ * @param[inout] vcpu pointer to vcpu data structure
+ * @pre vcpu != NULL
+ * @pre the VMCS of vcpu is the current one
+ *
+ * @return None
+ */
+void update_pvclock(struct acrn_vcpu *vcpu);
+
 /**
  * @brief unmap the vcpu with pcpu and free its vlapic
  *
@@ -602,6 +818,20 @@ void reset_vcpu(struct acrn_vcpu *vcpu);
  */
 void pause_vcpu(struct acrn_vcpu *vcpu, enum vcpu_state new_state);
 
+/**
+ * @brief pause several vcpus of a vm and set their new state
+ *
+ * Same as pause_vcpu() for each vCPU of vcpu_mask, the reschedule requests
+ * share a single multicast IPI.
+ *
+ * @param[inout] vm pointer to the vm of the vcpus
+ * @param[in] vcpu_mask bitmap of the vcpu ids to pause
+ * @param[in] new_state the state to set the vcpus
+ *
+ * @return None
+ */
+void pause_vcpus(struct acrn_vm *vm, uint64_t vcpu_mask, enum vcpu_state new_state);
+
 /**
  * @brief resume the vcpu
  *
@@ -624,18 +854,83 @@ void resume_vcpu(struct acrn_vcpu *vcpu);
  */
 void schedule_vcpu(struct acrn_vcpu *vcpu);
 
+/**
+ * @brief set several vcpus of a vm to running state
+ *
+ * Same as schedule_vcpu() for each vCPU of vcpu_mask, the reschedule
+ * requests share a single multicast IPI.
+ *
+ * @param[inout] vm pointer to the vm of the vcpus
+ * @param[in] vcpu_mask bitmap of the vcpu ids to schedule
+ *
+ * @return None
+ */
+void schedule_vcpus(struct acrn_vm *vm, uint64_t vcpu_mask);
+
+/**
+ * @brief halt the vcpu until a wakeup event
+ *
+ * Emulates HLT: polls for an event up to an adaptive window if nothing else
+ * waits for the pCPU, then takes the vCPU off the runqueue. The switch
+ * happens on its next schedule().
+ *
+ * @param[inout] vcpu pointer to vcpu data structure
+ *
+ * @return None
+ *
+ * @pre vcpu->pcpu_id == get_pcpu_id()
+ */
+void vcpu_halt(struct acrn_vcpu *vcpu);
+
+/**
+ * @brief wake up a halted vcpu
+ *
+ * Puts a vCPU blocked by vcpu_halt() back on the runqueue, nothing is done
+ * if it is not halted. Called after an event is latched for the vCPU.
+ *
+ * @param[inout] vcpu pointer to vcpu data structure
+ *
+ * @return None
+ */
+void wake_vcpu(struct acrn_vcpu *vcpu);
+
+/**
+ * @brief wake up the halted vcpus with interrupts posted to them
+ *
+ * @param[in] pcpu_id the pCPU the notification was sent to
+ *
+ * @return None
+ */
+void wake_pi_halted_vcpus(uint16_t pcpu_id);
+
+/**
+ * @brief yield the pCPU of a vcpu spinning in a PAUSE loop
+ *
+ * A preempted vCPU of the same VM on the pCPU, the possible lock holder, runs
+ * next. The PAUSE-loop exiting window of the vCPU grows while there is no one
+ * to yield to.
+ *
+ * @param[inout] vcpu pointer to vcpu data structure
+ *
+ * @return None
+ *
+ * @pre vcpu->pcpu_id == get_pcpu_id()
+ */
+void vcpu_yield(struct acrn_vcpu *vcpu);
+
 /**
  * @brief create a vcpu for the vm and mapped to the pcpu.
  *
  * Create a vcpu for the vm, and mapped to the pcpu.
  *
  * @param[inout] vm pointer to vm data structure
+ * @param[in] vcpu_id the vCPU ID, see create_vcpu()
  * @param[in] pcpu_id which the vcpu will be mapped
  *
  * @retval 0 on success
  * @retval -EINVAL if the vCPU ID is invalid
  */
-int32_t prepare_vcpu(struct acrn_vm *vm, uint16_t pcpu_id);
+int32_t prepare_vcpu(struct acrn_vm *vm, uint16_t vcpu_id, uint16_t pcpu_id);
 
 /**
  * @brief get physical destination cpu mask
@@ -10,8 +10,20 @@
 #define CPUID_CHECK_SUBLEAF	(1U << 0U)
 #define MAX_VM_VCPUID_ENTRIES	64U
 
+/*
+ * The leaves are indexed directly, per range: the basic leaves from 0H,
+ * the hypervisor leaves from 40000000H and the extended ones from 80000000H.
+ */
+#define VCPUID_RANGE_SHIFT	30U
+#define VCPUID_NR_RANGES	3U
+#define VCPUID_LEAVES_PER_RANGE	0x40U
+
 /* Guest capability flags reported by CPUID */
 #define GUEST_CAPS_PRIVILEGE_VM	(1U << 0U)
+#define GUEST_CAPS_PV_SEND_IPI	(1U << 1U)	/* HC_SEND_IPI_MASK is available */
+#define GUEST_CAPS_PV_EOI	(1U << 2U)	/* HC_SET_PV_EOI is available */
+#define GUEST_CAPS_PV_STEAL_TIME	(1U << 3U)	/* MSR_ACRN_STEAL_TIME is available */
+#define GUEST_CAPS_PV_CLOCK	(1U << 4U)	/* MSR_ACRN_PV_CLOCK is available */
 
 struct vcpuid_entry {
 	uint32_t eax;
@@ -24,6 +36,12 @@ struct vcpuid_entry {
 	uint32_t padding;
 };
 
+/* the subleaves of a leaf, in a row in vcpuid_entries */
+struct vcpuid_leaf {
+	uint8_t first;
+	uint8_t nr;
+};
+
 int32_t set_vcpuid_entries(struct acrn_vm *vm);
 void guest_cpuid(struct acrn_vcpu *vcpu,
 			uint32_t *eax, uint32_t *ebx,
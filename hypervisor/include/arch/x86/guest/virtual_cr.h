@@ -85,6 +85,19 @@ uint64_t vcpu_get_cr4(struct acrn_vcpu *vcpu);
  */
 void vcpu_set_cr4(struct acrn_vcpu *vcpu, uint64_t val);
 
+/**
+ * @brief trap the first FPU instruction of the vcpu
+ *
+ * Force CR0.TS and intercept #NM while the FPU registers hold a state the
+ * vCPU doesn't own. The guest keeps reading its own CR0.TS.
+ *
+ * @param[inout] vcpu pointer to vcpu data structure
+ * @param[in] trap true to trap, false to leave the FPU to the guest
+ *
+ * @pre vcpu->pcpu_id == get_pcpu_id()
+ */
+void vcpu_trap_fpu(struct acrn_vcpu *vcpu, bool trap);
+
 /**
  * @}
  */
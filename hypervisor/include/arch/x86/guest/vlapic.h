@@ -43,9 +43,20 @@
 
 #define VLAPIC_MAXLVT_INDEX	APIC_LVT_CMCI
 
+/* Posted-interrupt descriptor, shared by the processor and VT-d posting */
+#define POSTED_INTR_ON_BIT	0U	/* Outstanding Notification */
+#define POSTED_INTR_NV_SHIFT	16U	/* Notification Vector */
+#define POSTED_INTR_NV_MASK	(0xFFUL << POSTED_INTR_NV_SHIFT)
+#define POSTED_INTR_NDST_SHIFT	32U	/* Notification Destination, x2APIC ID */
+#define POSTED_INTR_NDST_MASK	(0xFFFFFFFFUL << POSTED_INTR_NDST_SHIFT)
+
+/* PID-pointer table of IPI virtualization, indexed by the APIC ID */
+#define PID_TABLE_ENTRIES	512U	/* one page */
+#define PID_TABLE_ENTRY_VALID	1UL
+
 struct vlapic_pir_desc {
 	uint64_t pir[4];
-	uint64_t pending;
+	uint64_t control;
 	uint64_t unused[3];
 } __aligned(64);
 
@@ -54,6 +65,7 @@ struct vlapic_timer {
 	uint32_t mode;
 	uint32_t tmicr;
 	uint32_t divisor_shift;
+	bool migrated;		/* off the timer_list for a move, see vlapic_migrate() */
 };
 
 struct acrn_vlapic {
@@ -84,6 +96,14 @@ struct acrn_vlapic {
 
 	uint64_t	msr_apicbase;
 
+	/*
+	 * PV EOI: the guest clears the bit of a level triggered vector in
+	 * pv_eoi_map at EOI instead of trapping, pv_eoi_pending holds the
+	 * vectors armed by the hypervisor and not processed yet.
+	 */
+	uint64_t	*pv_eoi_map;
+	uint64_t	pv_eoi_pending[4];
+
 	const struct acrn_apicv_ops *ops;
 
 	/*
@@ -97,7 +117,7 @@ struct acrn_vlapic {
 } __aligned(PAGE_SIZE);
 
 struct acrn_apicv_ops {
-	void (*accept_intr)(struct acrn_vlapic *vlapic, uint32_t vector, bool level);
+	uint32_t (*accept_intr)(struct acrn_vlapic *vlapic, uint32_t vector, bool level);
 	bool (*inject_intr)(struct acrn_vlapic *vlapic, bool guest_irq_enabled, bool injected);
 	bool (*has_pending_delivery_intr)(struct acrn_vcpu *vcpu);
 	bool (*apic_read_access_may_valid)(uint32_t offset);
@@ -119,6 +139,66 @@ void vlapic_set_apicv_ops(void);
 bool vlapic_inject_intr(struct acrn_vlapic *vlapic, bool guest_irq_enabled, bool injected);
 bool vlapic_has_pending_delivery_intr(struct acrn_vcpu *vcpu);
 
+/**
+ * @brief Check for interrupts posted to the PIR descriptor with no notification
+ *
+ * VT-d posted interrupts for a vCPU not running in non-root mode only set
+ * the ON bit, the notification vector sent to its pCPU is lost in root mode
+ * or taken by the vCPU sharing the pCPU.
+ *
+ * @param[in] vlapic Target vLAPIC
+ *
+ * @return true if the PIR descriptor has outstanding interrupts
+ */
+bool vlapic_has_posted_intr(const struct acrn_vlapic *vlapic);
+
+/**
+ * @brief Check for an interrupt the vCPU would take on next VM entry
+ *
+ * It covers the deliverable interrupts in the vIRR, RVI included when the
+ * virtual-interrupt delivery is enabled, and the ones in the PIR.
+ *
+ * @param[in] vcpu Target vCPU
+ *
+ * @return true if an interrupt waits for the vCPU
+ *
+ * @pre the VMCS of vcpu is the current VMCS
+ */
+bool vlapic_has_pending_intr(struct acrn_vcpu *vcpu);
+
+/**
+ * @brief Select the notification vector of the PIR descriptor
+ *
+ * A halted vCPU has no VMCS in use to sync the PIR with, the notifications
+ * of VT-d posting and of the IPI virtualization then come with
+ * VECTOR_POSTED_INTR_WAKEUP to wake it up.
+ *
+ * @param[in] vlapic Target vLAPIC
+ * @param[in] wakeup true for VECTOR_POSTED_INTR_WAKEUP, false for VECTOR_POSTED_INTR
+ */
+void vlapic_set_pi_wakeup(struct acrn_vlapic *vlapic, bool wakeup);
+
+/**
+ * @brief Move the vLAPIC of a switched out vCPU over to another pCPU
+ *
+ * Called on the pCPU the vCPU ran on last: the notifications of VT-d
+ * posting go to pcpu_id from now on, and the timer leaves the timer_list
+ * of this pCPU until vlapic_restart_migrated_timer() adds it to the one of
+ * pcpu_id.
+ *
+ * @param[in] vlapic Target vLAPIC
+ * @param[in] pcpu_id The pCPU the vCPU moves to
+ */
+void vlapic_migrate(struct acrn_vlapic *vlapic, uint16_t pcpu_id);
+
+/**
+ * @brief Add the timer taken off by vlapic_migrate() to the current pCPU
+ *
+ * @param[in] vlapic Target vLAPIC
+ * @pre vlapic->vcpu->pcpu_id == get_pcpu_id()
+ */
+void vlapic_restart_migrated_timer(struct acrn_vlapic *vlapic);
+
 /**
  * @brief Get physical address to PIR description.
  *
@@ -133,6 +213,80 @@ bool vlapic_has_pending_delivery_intr(struct acrn_vcpu *vcpu);
  */
 uint64_t apicv_get_pir_desc_paddr(struct acrn_vcpu *vcpu);
 
+/**
+ * @brief Build the PID-pointer table of a VM for IPI virtualization.
+ *
+ * Each valid entry of the table points to the PI descriptor of the vCPU
+ * whose APIC ID is the index of the entry.
+ *
+ * @param[in] vm Target VM
+ * @param[out] last_index Filled with the highest APIC ID of the vCPUs
+ *
+ * @retval true The APIC IDs of all the vCPUs fit in the table.
+ * @retval false IPI virtualization can't be used for this VM.
+ *
+ * @pre vm != NULL && last_index != NULL
+ */
+bool vlapic_build_pid_table(struct acrn_vm *vm, uint16_t *last_index);
+
+/**
+ * @brief Hold back the notifications of the interrupts accepted on this pCPU.
+ *
+ * Until vlapic_flush_notifications(), the pCPUs of the vCPUs which get an
+ * interrupt are gathered, so that each of them is notified once.
+ */
+void vlapic_defer_notifications(void);
+
+/**
+ * @brief Send the notifications held back since vlapic_defer_notifications().
+ */
+void vlapic_flush_notifications(void);
+
+/**
+ * @brief Set up the PV EOI bitmap of a vCPU.
+ *
+ * A level triggered vector accepted by the vLAPIC gets its bit set in the
+ * 256 bits bitmap at gpa, the guest clears it at EOI (still writing the
+ * virtualized EOI register) and the EOI is forwarded to the vIOAPIC at
+ * the next VM exit of the vCPU, without EOI-induced VM exit.
+ *
+ * @param[in] vlapic Target vLAPIC
+ * @param[in] gpa Guest physical address of the bitmap, 32 bytes aligned,
+ *		  0 to disable PV EOI
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if gpa is not aligned or not mapped.
+ * @retval -EBUSY if EOIs are still pending on the former bitmap.
+ *
+ * @pre vlapic != NULL
+ */
+int32_t vlapic_set_pv_eoi(struct acrn_vlapic *vlapic, uint64_t gpa);
+
+/**
+ * @brief Forward to the vIOAPIC the EOIs the guest reported in its PV EOI bitmap.
+ *
+ * @param[in] vlapic Target vLAPIC
+ *
+ * @pre vlapic != NULL
+ * @remark Called by the vCPU of vlapic only.
+ */
+void vlapic_pv_eoi_process(struct acrn_vlapic *vlapic);
+
+/**
+ * @brief Send a fixed IPI to several vCPUs of the VM of the sender.
+ *
+ * @param[in] vcpu Sender vCPU
+ * @param[in] apicid_mask Bit n set for the destination with APIC ID apicid_base + n
+ * @param[in] apicid_base APIC ID of bit 0 of apicid_mask
+ * @param[in] vector Vector of the IPI
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL if vector is an illegal vector.
+ *
+ * @pre vcpu != NULL
+ */
+int32_t vlapic_send_ipi_mask(const struct acrn_vcpu *vcpu, uint64_t apicid_mask, uint32_t apicid_base, uint32_t vector);
+
 uint64_t vlapic_get_tsc_deadline_msr(const struct acrn_vlapic *vlapic);
 void vlapic_set_tsc_deadline_msr(struct acrn_vlapic *vlapic, uint64_t val_arg);
 uint64_t vlapic_get_apicbase(const struct acrn_vlapic *vlapic);
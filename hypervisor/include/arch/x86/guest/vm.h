@@ -26,6 +26,7 @@
 #include <cpu_caps.h>
 #include <e820.h>
 #include <vm_config.h>
+#include <ept.h>
 
 struct vm_hw_info {
 	/* vcpu array of this VM */
@@ -59,6 +60,39 @@ struct vm_sw_info {
 	bool is_completion_polling;
 };
 
+/*
+ * The time the completion polling requests of a device range take, learned
+ * to bound how long a vCPU spins for their completion.
+ */
+#define IOREQ_SPIN_RANGES	16U
+
+struct ioreq_spin_range {
+	uint64_t key;		/* io type and port or 4K page, 0: unused */
+	uint64_t avg_cycles;	/* moving average of the completion time */
+	uint64_t hits;		/* completed while spinning */
+	uint64_t waits;		/* completed after the vCPU was paused */
+};
+
+/*
+ * The MC146818 RTC of a post-launched VM, emulated in place of the device
+ * model once it sets up the RTC page. The registers of time are computed
+ * from the TSC on the guest reads, the timer only runs while the periodic,
+ * alarm or update interrupts are enabled, on the pCPU of the BSP.
+ */
+struct acrn_vrtc_state {
+	bool emulated;			/* false: the physical RTC passed through or the DM */
+	uint8_t addr;			/* register selected by the index port */
+	uint8_t regs[ACRN_VRTC_CMOS_SIZE];
+	uint64_t base_rtctime;		/* RTC time at base_tsc, in seconds */
+	uint64_t base_tsc;		/* TSC of the last second boundary or divider restart */
+	uint64_t next_pf_tsc;		/* TSC of the next periodic flag */
+	uint64_t timer_period;		/* in TSC cycles, 0 if the timer isn't started */
+	uint16_t timer_pcpu;		/* pCPU the timer runs on */
+	struct hv_timer timer;
+	struct acrn_vrtc *page;		/* in SOS memory, the NVRAM is kept up to date there */
+	spinlock_t lock;
+};
+
 struct vm_pm_info {
 	uint8_t			px_cnt;		/* count of all Px states */
 	struct cpu_px_data	px_data[MAX_PSTATE];
@@ -83,9 +117,34 @@ enum vm_vlapic_state {
 	VM_VLAPIC_TRANSITION
 };
 
+#define VMCS_TEMPLATE_FIELDS	32U
+
+struct vmcs_field {
+	uint32_t field;
+	uint64_t value;
+};
+
+/*
+ * The VMCS fields and VM-execution controls shared by all the vCPUs of a
+ * VM, computed once in create_vm() from the VMX capability MSRs and the VM
+ * configuration, see init_vmcs_template().
+ */
+struct vmcs_template {
+	struct vmcs_field fields[VMCS_TEMPLATE_FIELDS];
+	uint32_t num_fields;
+	uint32_t proc_ctls2;	/* without the VPID control, set per vCPU */
+	uint32_t entry_ctls;
+	uint32_t entry_ctls_ia32e;
+	bool ptmr_enabled;
+	bool ple_enabled;
+};
+
 struct vm_arch {
 	/* I/O bitmaps A and B for this VM, MUST be 4-Kbyte aligned */
 	uint8_t io_bitmap[PAGE_SIZE*2];
+	/* PID-pointer table for IPI virtualization, MUST be 4-Kbyte aligned */
+	uint64_t pid_table[PID_TABLE_ENTRIES];
+	bool ipiv_enabled;
 
 	uint64_t guest_init_pml4;/* Guest init pml4 */
 	/* EPT hierarchy for Normal World */
@@ -96,11 +155,19 @@ struct vm_arch {
 	 */
 	void *sworld_eptp;
 	struct memory_ops ept_mem_ops;
+	/* the processor sets the accessed/dirty flags of the EPT entries */
+	bool ept_ad_enabled;
+	/* bumped on each EPT update, which drops all the lookup_cache entries */
+	uint64_t ept_gen;
+	struct ept_lookup_cache lookup_cache[CONFIG_MAX_PCPU_NUM];
+	/* ept_gen at the last INVEPT of each pCPU, see flush_vm_ept() */
+	uint64_t ept_flushed_gen[CONFIG_MAX_PCPU_NUM];
 
 	void *tmp_pg_array;	/* Page array for tmp guest paging struct */
 	struct acrn_vioapic vioapic;	/* Virtual IOAPIC base address */
 	struct acrn_vpic vpic;      /* Virtual PIC */
 	enum vm_vlapic_state vlapic_state; /* Represents vLAPIC state across vCPUs*/
+	struct vmcs_template vmcs_tmpl;
 
 	/* reference to virtual platform to come here (as needed) */
 } __aligned(PAGE_SIZE);
@@ -121,12 +188,42 @@ struct acrn_vm {
 
 	uint16_t emul_mmio_regions; /* Number of emulated mmio regions */
 	struct mem_io_node emul_mmio[CONFIG_MAX_EMULATED_MMIO_REGIONS];
+	uint16_t emul_mmio_sorted[CONFIG_MAX_EMULATED_MMIO_REGIONS]; /* emul_mmio indexes sorted by range_start */
+	spinlock_t emul_mmio_lock;	/* protects emul_mmio_sorted and emul_pio_sorted */
 	hv_mem_io_handler_t default_read_write;
 
 	struct vm_io_handler_desc emul_pio[EMUL_PIO_IDX_MAX];
+	uint16_t emul_pio_regions; /* Number of registered port io ranges */
+	uint8_t emul_pio_sorted[EMUL_PIO_IDX_MAX]; /* emul_pio indexes sorted by port_start */
 	io_read_fn_t default_io_read;
 	io_write_fn_t default_io_write;
 
+	struct acrn_doorbell doorbells[ACRN_DOORBELL_MAX];
+	uint64_t doorbell_active;	/* bitmap of the registered doorbells */
+	uint64_t doorbell_pending;	/* bitmap of the rung doorbells, not fetched by SOS yet */
+
+	struct acrn_coalesced_mmio_ring *coalesced_ring;	/* in SOS memory, NULL if not set */
+	struct acrn_coalesced_mmio_zone coalesced_zones[ACRN_COALESCED_MMIO_ZONES];
+	uint64_t coalesced_active;	/* bitmap of the registered coalesced_zones */
+	spinlock_t coalesced_lock;	/* protects coalesced_zones and the producer side of coalesced_ring */
+
+	struct acrn_timer_counters *timer_counters;	/* in SOS memory, NULL if not set */
+	uint64_t sos_tsc_offset;	/* from the pCPU TSC to the TSC of SOS */
+	uint8_t pit_latch[ACRN_PIT_CHANNELS][2];	/* counts latched by the hypervisor */
+	uint8_t pit_latch_bytes[ACRN_PIT_CHANNELS];	/* bytes of pit_latch still to be read */
+	spinlock_t pit_latch_lock;
+
+	struct acrn_pio_regs *pio_regs;	/* in SOS memory, NULL if not set */
+	spinlock_t pio_regs_lock;	/* serializes the latch writes to pio_regs */
+
+	struct acrn_emul_msix emul_msix[ACRN_EMUL_MSIX_TABLES];	/* MSI-X tables of the DM emulated devices */
+	struct msix_table_entry *emul_msix_tables[ACRN_EMUL_MSIX_TABLES];	/* in SOS memory */
+	uint64_t emul_msix_active;	/* bitmap of the registered emul_msix */
+	spinlock_t emul_msix_lock;	/* protects emul_msix and emul_msix_tables */
+
+	struct vie_cache vie_cache;
+	struct vmtrr_ept_map vmtrr_ept_map;
+
 	uint8_t uuid[16];
 	struct secure_world_control sworld_control;
 
@@ -139,16 +236,55 @@ struct acrn_vm {
 
 	uint32_t vcpuid_entry_nr, vcpuid_level, vcpuid_xlevel;
 	struct vcpuid_entry vcpuid_entries[MAX_VM_VCPUID_ENTRIES];
+	struct vcpuid_leaf vcpuid_leaves[VCPUID_NR_RANGES][VCPUID_LEAVES_PER_RANGE];
 	struct acrn_vpci vpci;
 
 	uint8_t vrtc_offset;
+	struct acrn_vrtc_state vrtc;
 
 	uint64_t intr_inject_delay_delta; /* delay of intr injection */
+	/* adaptive moderation of the passthrough interrupts, INTR_CMD_SET_MODERATION */
+	uint32_t intr_mod_policy;
+	uint32_t intr_mod_rate;		/* interrupts per PTIRQ_MOD_WINDOW_US */
+	uint64_t intr_mod_min_delay;	/* in TSC cycles */
+	uint64_t intr_mod_max_delay;
+	struct list_head ptdev_entries;	/* the active ptirq_remapping_info of the VM, under ptdev_lock */
+
+	struct ioreq_spin_range ioreq_spin[IOREQ_SPIN_RANGES];	/* completion polling mode only */
+	spinlock_t ioreq_spin_lock;
 } __aligned(PAGE_SIZE);
 
 /*
  * @pre vlapic != NULL
  */
+/*
+ * SCENARIO_GUEST_FLAGS and SCENARIO_SOS_VM_NUM are constants of the scenario,
+ * the checks below and the paths they guard are compiled out of the
+ * scenarios which cannot have such a VM.
+ */
+static inline bool is_sos_vm(const struct acrn_vm *vm)
+{
+	return (SCENARIO_SOS_VM_NUM != 0U) && (vm != NULL) && (get_vm_config(vm->vm_id)->load_order == SOS_VM);
+}
+
+/**
+ * @pre vm != NULL && vm_config != NULL && vm->vmid < CONFIG_MAX_VM_NUM
+ */
+static inline bool is_lapic_pt_configured(const struct acrn_vm *vm)
+{
+	return ((SCENARIO_GUEST_FLAGS & GUEST_FLAG_LAPIC_PASSTHROUGH) != 0UL) &&
+		((get_vm_config(vm->vm_id)->guest_flags & GUEST_FLAG_LAPIC_PASSTHROUGH) != 0UL);
+}
+
+/**
+ * @pre vm != NULL && vm_config != NULL && vm->vmid < CONFIG_MAX_VM_NUM
+ */
+static inline bool is_rt_vm(const struct acrn_vm *vm)
+{
+	return ((SCENARIO_GUEST_FLAGS & GUEST_FLAG_RT) != 0UL) &&
+		((get_vm_config(vm->vm_id)->guest_flags & GUEST_FLAG_RT) != 0UL);
+}
+
 static inline uint64_t vm_active_cpus(const struct acrn_vm *vm)
 {
 	uint64_t dmask = 0UL;
@@ -208,7 +344,7 @@ void prepare_vm(uint16_t vm_id, struct acrn_vm_config *vm_config);
 void launch_vms(uint16_t pcpu_id);
 bool is_poweroff_vm(const struct acrn_vm *vm);
 bool is_created_vm(const struct acrn_vm *vm);
-bool is_sos_vm(const struct acrn_vm *vm);
+bool is_paused_vm(const struct acrn_vm *vm);
 bool is_postlaunched_vm(const struct acrn_vm *vm);
 bool is_prelaunched_vm(const struct acrn_vm *vm);
 uint16_t get_vmid_by_uuid(const uint8_t *uuid);
@@ -221,9 +357,10 @@ typedef int32_t (*vm_sw_loader_t)(struct acrn_vm *vm);
 extern vm_sw_loader_t vm_sw_loader;
 
 void vrtc_init(struct acrn_vm *vm);
+void vrtc_setup(struct acrn_vm *vm, struct acrn_vrtc *page);
+void vrtc_update_timer(struct acrn_vm *vm);
+void vrtc_deinit(struct acrn_vm *vm);
 
-bool is_lapic_pt_configured(const struct acrn_vm *vm);
-bool is_rt_vm(const struct acrn_vm *vm);
 bool has_rt_vm(void);
 bool is_highest_severity_vm(const struct acrn_vm *vm);
 bool vm_hide_mtrr(const struct acrn_vm *vm);
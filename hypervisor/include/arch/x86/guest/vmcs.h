@@ -40,7 +40,12 @@ static inline uint64_t apic_access_offset(uint64_t qual)
 {
 	return (qual & APIC_ACCESS_OFFSET);
 }
+void init_vmcs_template(struct acrn_vm *vm);
 void init_vmcs(struct acrn_vcpu *vcpu);
+void clear_vmcs(struct acrn_vcpu *vcpu);
+void load_vmcs(struct acrn_vcpu *vcpu);
+
+void update_preemption_timer(const struct acrn_vcpu *vcpu);
 
 void switch_apicv_mode_x2apic(struct acrn_vcpu *vcpu);
 #endif /* ASSEMBLER */
@@ -9,6 +9,11 @@
  */
 #ifndef VMTRR_H
 #define VMTRR_H
+
+#include <spinlock.h>
+
+struct acrn_vm;
+
 /**
  * @brief MTRR Virtualization
  *
@@ -47,6 +52,17 @@ union mtrr_fixed_range_reg {
 	uint8_t type[MTRR_SUB_RANGE_NUM];
 };
 
+/*
+ * The memory types of the first MB the EPT of a VM has, shared by its vCPUs:
+ * each of them rewrites its MTRRs with the same values on bring-up and
+ * resume, only the sub-ranges whose type changes are updated in the EPT.
+ */
+struct vmtrr_ept_map {
+	spinlock_t lock;
+	bool valid;	/* false until the first update, the EPT types are not known */
+	union mtrr_fixed_range_reg types[FIXED_RANGE_MTRR_NUM];
+};
+
 struct acrn_vmtrr {
 	struct acrn_vcpu		*vcpu;
 	union mtrr_cap_reg		cap;
@@ -81,6 +97,19 @@ uint64_t read_vmtrr(const struct acrn_vcpu *vcpu, uint32_t msr);
  * @return None
  */
 void init_vmtrr(struct acrn_vcpu *vcpu);
+/**
+ * @brief Forget the EPT memory types of the fixed-range MTRRs of a VM
+ *
+ * To be called when [gpa, gpa + size) is mapped again in the EPT of the VM
+ * with other memory types, the next MTRR update then rewrites all of them.
+ *
+ * @param[inout] vm The VM whose EPT is changed
+ * @param[in] gpa Start of the changed guest physical range
+ * @param[in] size Size of the changed guest physical range
+ *
+ * @return None
+ */
+void invalidate_vmtrr_ept_map(struct acrn_vm *vm, uint64_t gpa, uint64_t size);
 /**
  * @}
  */
@@ -36,6 +36,7 @@ void do_acpi_sx(const struct pm_s_state_data *sstate_data, uint32_t pm1a_cnt_val
 extern void asm_enter_s3(const struct pm_s_state_data *sstate_data, uint32_t pm1a_cnt_val, uint32_t pm1b_cnt_val);
 extern void restore_s3_context(void);
 struct cpu_state_info *get_cpu_pm_state_info(void);
+uint32_t get_idle_mwait_hint(void);
 struct acpi_reset_reg *get_host_reset_reg_data(void);
 void reset_host(void);
 
@@ -35,6 +35,7 @@
 #define VECTOR_SPURIOUS		0xFFU
 #define VECTOR_HYPERVISOR_CALLBACK_VHM	0xF3U
 #define VECTOR_PMI			0xF4U
+#define VECTOR_POSTED_INTR_WAKEUP	0xF5U
 
 /* the maximum number of msi entry is 2048 according to PCI
  * local bus specification
@@ -46,11 +47,12 @@
 #define NR_IRQS		256U
 #define IRQ_INVALID		0xffffffffU
 
-#define NR_STATIC_MAPPINGS     (4U)
+#define NR_STATIC_MAPPINGS     (5U)
 #define TIMER_IRQ		(NR_IRQS - 1U)
 #define NOTIFY_IRQ		(NR_IRQS - 2U)
 #define POSTED_INTR_NOTIFY_IRQ	(NR_IRQS - 3U)
 #define PMI_IRQ			(NR_IRQS - 4U)
+#define POSTED_INTR_WAKEUP_IRQ	(NR_IRQS - 5U)
 
 #define DEFAULT_DEST_MODE	IOAPIC_RTE_DESTMODE_LOGICAL
 #define DEFAULT_DELIVERY_MODE	IOAPIC_RTE_DELMODE_LOPRI
@@ -80,12 +82,19 @@ struct intr_excp_ctx {
 };
 
 typedef void (*smp_call_func_t)(void *data);
-struct smp_call_info_data {
+
+/* a call of func on the pCPUs of pending, queued on each of them */
+struct smp_call {
 	smp_call_func_t func;
 	void *data;
+	smp_call_func_t done;
+	void *done_data;
+	uint64_t pending;
 };
 
 void smp_call_function(uint64_t mask, smp_call_func_t func, void *data);
+void smp_call_function_async(uint64_t mask, smp_call_func_t func, void *data,
+		smp_call_func_t done, void *done_data);
 
 void init_default_irqs(uint16_t cpu_id);
 
@@ -43,6 +43,9 @@
 #define LAPIC_LVT_MASK                          0x00010000U
 #define LAPIC_DELIVERY_MODE_EXTINT_MASK         0x00000700U
 
+/* x2APIC LDR: cluster ID in bits 31:16, one bit per logical ID below */
+#define X2APIC_LDR_CLUSTER_MASK                 0xFFFF0000U
+
 /* LAPIC Timer bit and bitmask definitions */
 #define LAPIC_TMR_ONESHOT                       ((uint32_t) 0x0U << 17U)
 #define LAPIC_TMR_PERIODIC                      ((uint32_t) 0x1U << 17U)
@@ -12,80 +12,47 @@
 #include <types.h>
 #include <rtl.h>
 
-/** The architecture dependent spinlock type. */
+/**
+ * The architecture dependent spinlock type, a queued (MCS) lock: each
+ * waiter but the first one spins on a node of its own pCPU, which is
+ * given back once the lock is obtained. A zeroed lock is free.
+ */
 typedef struct _spinlock {
-	uint32_t head;
-	uint32_t tail;
-
+	uint32_t head;	/* 1 while the lock is held */
+	uint32_t tail;	/* the last node queued, 0 if nobody waits */
+#ifdef CONFIG_SPINLOCK_STATS
+	uint32_t site;	/* the stats entry of the holder */
+	uint64_t obtained_tsc;
+#endif
 } spinlock_t;
 
+#ifdef CONFIG_SPINLOCK_STATS
+#define SPINLOCK_STATS_SITES	128U
+
+/* the lock statistics of a call site of spinlock_obtain() */
+struct spinlock_site_stats {
+	uint64_t site;		/* return address of spinlock_obtain() */
+	uint64_t obtained;
+	uint64_t contended;
+	int64_t wait_cycles;
+	int64_t hold_cycles;
+	uint64_t max_wait;
+	uint64_t max_hold;
+};
+
+/* entries of call sites not seen yet have site 0 */
+const struct spinlock_site_stats *get_spinlock_site_stats(uint32_t idx);
+void reset_spinlock_stats(void);
+#endif
+
 /* Function prototypes */
 static inline void spinlock_init(spinlock_t *lock)
 {
 	(void)memset(lock, 0U, sizeof(spinlock_t));
 }
 
-static inline void spinlock_obtain(spinlock_t *lock)
-{
-
-	/* The lock function atomically increments and exchanges the head
-	 * counter of the queue. If the old head of the queue is equal to the
-	 * tail, we have locked the spinlock. Otherwise we have to wait.
-	 */
-
-	asm volatile ("   movl $0x1,%%eax\n"
-		      "   lock xaddl %%eax,%[head]\n"
-		      "   cmpl %%eax,%[tail]\n"
-		      "   jz 1f\n"
-		      "2: pause\n"
-		      "   cmpl %%eax,%[tail]\n"
-		      "   jnz 2b\n"
-		      "1:\n"
-		      :
-		      :
-		      [head] "m"(lock->head),
-		      [tail] "m"(lock->tail)
-		      : "cc", "memory", "eax");
-}
-
-static inline void spinlock_release(spinlock_t *lock)
-{
-	/* Increment tail of queue */
-	asm volatile ("   lock incl %[tail]\n"
-				:
-				: [tail] "m" (lock->tail)
-				: "cc", "memory");
-}
-
-#else /* ASSEMBLER */
-
-/** The offset of the head element. */
-#define SYNC_SPINLOCK_HEAD_OFFSET       0
-
-/** The offset of the tail element. */
-#define SYNC_SPINLOCK_TAIL_OFFSET       4
-
-.macro spinlock_obtain lock
-	movl $1, % eax
-	lea \lock, % rbx
-	lock xaddl % eax, SYNC_SPINLOCK_HEAD_OFFSET(%rbx)
-	cmpl % eax, SYNC_SPINLOCK_TAIL_OFFSET(%rbx)
-	jz 1f
-2 :
-	pause
-	cmpl % eax, SYNC_SPINLOCK_TAIL_OFFSET(%rbx)
-	jnz 2b
-1 :
-.endm
-
-#define spinlock_obtain(x) spinlock_obtain lock = (x)
-
-.macro spinlock_release lock
-	lea \lock, % rbx
-	lock incl SYNC_SPINLOCK_TAIL_OFFSET(%rbx)
-.endm
-
-#define spinlock_release(x) spinlock_release lock = (x)
+void spinlock_obtain(spinlock_t *lock);
+void spinlock_release(spinlock_t *lock);
 
 #endif	/* ASSEMBLER */
 
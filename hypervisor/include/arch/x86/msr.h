@@ -252,6 +252,7 @@
 #define MSR_IA32_VMX_TRUE_EXIT_CTLS		0x0000048FU
 #define MSR_IA32_VMX_TRUE_ENTRY_CTLS		0x00000490U
 #define MSR_IA32_VMX_VMFUNC			0x00000491U
+#define MSR_IA32_VMX_PROCBASED_CTLS3		0x00000492U
 #define MSR_IA32_A_PMC0				0x000004C1U
 #define MSR_IA32_A_PMC1				0x000004C2U
 #define MSR_IA32_A_PMC2				0x000004C3U
@@ -344,6 +345,7 @@
 #define MSR_IA32_L2_MASK_1			0x00000D11U
 #define MSR_IA32_L2_MASK_2			0x00000D12U
 #define MSR_IA32_L2_MASK_3			0x00000D13U
+#define MSR_IA32_L2_QOS_EXT_BW_THRTL_0		0x00000D50U
 #define MSR_IA32_BNDCFGS			0x00000D90U
 #define MSR_IA32_EFER				0xC0000080U
 #define MSR_IA32_STAR				0xC0000081U
@@ -355,6 +357,16 @@
 #define MSR_IA32_KERNEL_GS_BASE			0xC0000102U
 #define MSR_IA32_TSC_AUX			0xC0000103U
 
+/* paravirtual steal time, out of the MSR bitmap range so it always exits */
+#define MSR_ACRN_STEAL_TIME			0x4B564D03U
+#define MSR_ACRN_STEAL_TIME_ENABLE		(1UL << 0U)
+#define MSR_ACRN_STEAL_TIME_RSVD		0x3EUL
+
+/* paravirtual clock, see struct acrn_pvclock */
+#define MSR_ACRN_PV_CLOCK			0x4B564D04U
+#define MSR_ACRN_PV_CLOCK_ENABLE		(1UL << 0U)
+#define MSR_ACRN_PV_CLOCK_RSVD			0x3EUL
+
 /* non-architectural MSRs */
 #define MSR_EBL_CR_POWERON			0x0000002AU
 #define MSR_EBC_SOFT_POWERON			0x0000002BU
@@ -564,6 +576,7 @@
 #define MSR_IA32_MISC_ENABLE_XD_DISABLE		(1UL << 34U)
 
 /* Miscellaneous data */
+#define MSR_IA32_MISC_PTMR_RATE_MASK		0x1FUL
 #define MSR_IA32_MISC_UNRESTRICTED_GUEST	(1U<<5U)
 
 #ifndef ASSEMBLER
@@ -584,6 +597,7 @@ struct acrn_vcpu;
 
 void init_msr_emulation(struct acrn_vcpu *vcpu);
 uint32_t vmsr_get_guest_msr_index(uint32_t msr);
+bool is_msr_policy_valid(uint32_t msr, uint32_t policy);
 void update_msr_bitmap_x2apic_apicv(struct acrn_vcpu *vcpu);
 void update_msr_bitmap_x2apic_passthru(struct acrn_vcpu *vcpu);
 
@@ -52,6 +52,7 @@ union pgtable_pages_info {
 		struct page *pt_base;
 	} ppt;
 	struct {
+		uint16_t vm_id;
 		uint64_t top_address_space;
 		struct page *nworld_pml4_base;
 		struct page *nworld_pdpt_base;
@@ -70,12 +71,14 @@ struct memory_ops {
 	struct page *(*get_pdpt_page)(const union pgtable_pages_info *info, uint64_t gpa);
 	struct page *(*get_pd_page)(const union pgtable_pages_info *info, uint64_t gpa);
 	struct page *(*get_pt_page)(const union pgtable_pages_info *info, uint64_t gpa);
+	void (*free_page)(const union pgtable_pages_info *info, struct page *page);
 	void *(*get_sworld_memory_base)(const union pgtable_pages_info *info);
 	void (*clflush_pagewalk)(const void *p);
 };
 
 extern const struct memory_ops ppt_mem_ops;
 void init_ept_mem_ops(struct acrn_vm *vm);
+void deinit_ept_mem_ops(struct acrn_vm *vm);
 void *get_reserve_sworld_memory_base(void);
 
 #endif /* PAGE_H */
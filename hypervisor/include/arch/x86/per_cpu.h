@@ -18,45 +18,96 @@
 #include <schedule.h>
 #include <security.h>
 #include <vm_config.h>
+#include <ptdev.h>
+#include <cpu_caps.h>
+#include <softirq.h>
+#include <mmu.h>
 
+#define SMP_CALL_ASYNC_SLOTS	3U
+/* the sync call and the async ones each pCPU may have in flight */
+#define SMP_CALL_SLOTS		(1U + SMP_CALL_ASYNC_SLOTS)
+#define SMP_CALL_CELLS		(CONFIG_MAX_PCPU_NUM * SMP_CALL_SLOTS)
+
+struct smp_call_info_data {
+	/*
+	 * the calls queued to this pCPU, cell (source pCPU * SMP_CALL_SLOTS
+	 * + slot) is only set by the source pCPU and only cleared here
+	 */
+	struct smp_call *calls[SMP_CALL_CELLS];
+	uint32_t queued;
+	/* the async calls of this pCPU, free while pending is 0 */
+	struct smp_call async_calls[SMP_CALL_ASYNC_SLOTS];
+};
+
+/*
+ * The fields are grouped by who touches them and how often, so that the VM
+ * exit path stays on a few lines and the lines written by other pCPUs are
+ * not shared with the local ones. The layout is in per_cpu_layout.txt of
+ * the build, see pre_build/per_cpu_layout.c.
+ */
 struct per_cpu_region {
 	/* vmxon_region MUST be 4KB-aligned */
 	uint8_t vmxon_region[PAGE_SIZE];
-	void *vmcs_run;
+
+	/* hot: only used by this pCPU, on each VM exit, interrupt or switch */
+	struct acrn_vcpu *vmcs_vcpu;	/* the vCPU whose VMCS is current */
+	/* the vCPU whose FPU state, XCR0 and switched MSRs are in the registers */
+	struct acrn_vcpu *loaded_vcpu;
+	struct acrn_vcpu *vcpu;
+	struct acrn_vcpu *ever_run_vcpu;
+	uint64_t pqr_assoc;	/* the RMID and the CLOS in MSR_IA32_PQR_ASSOC */
+	uint64_t softirq_pending;
+	uint32_t softirq_servicing;
+	/* vCPU notifications held back by vlapic_defer_notifications() */
+	bool notify_deferred;
+	uint32_t notify_vector;
+	uint64_t notify_pcpus;
+	uint64_t idle_poll_cycles;	/* adaptive poll window of the idle loop */
 #ifdef HV_DEBUG
+	uint64_t trace_tsc;	/* of the last compact trace record */
+	uint32_t trace_nr;	/* compact trace records written */
 	struct shared_buf *sbuf[ACRN_SBUF_ID_MAX];
-	char logbuf[LOG_MESSAGE_MAX_SIZE];
-	uint32_t npk_log_ref;
 #endif
-	uint64_t irq_count[NR_IRQS];
-	uint64_t softirq_pending;
-	uint64_t spurious;
-	struct acrn_vcpu *vcpu;
-	struct acrn_vcpu *ever_run_vcpu;
 #ifdef STACK_PROTECTOR
 	struct stack_canary stk_canary;
 #endif
-	struct per_cpu_timers cpu_timers;
-	struct sched_context sched_ctx;
+
+	/* remote: written by the other pCPUs as well, on lines of their own */
+	struct sched_context sched_ctx __aligned(CACHE_LINE_SIZE);
+	uint64_t pcpu_flag __aligned(CACHE_LINE_SIZE);
+	uint16_t shutdown_vm_id;
+	enum pcpu_boot_state boot_state;
+	struct smp_call_info_data smp_call_info __aligned(CACHE_LINE_SIZE);
+
+	/* warm: only used by this pCPU, on timers and device interrupts */
+	struct per_cpu_timers cpu_timers __aligned(CACHE_LINE_SIZE);
+	/* ptdev_entry_id of the entries SOFTIRQ_PTDEV has to handle */
+	uint64_t softirq_dev_pending[PTIRQ_BITMAP_ARRAY_SIZE];
+	/* pending entries taken by the SOFTIRQ_PTDEV run in progress */
+	uint64_t softirq_dev_draining[PTIRQ_BITMAP_ARRAY_SIZE];
+	uint64_t spurious;
+	struct softirq_stats softirq_stats;	/* only updated by the softirqs run */
+	uint64_t irq_count[NR_IRQS];
+
+	/* cold: set up once, or only used by the shell, logs and suspend */
+	uint32_t lapic_id __aligned(CACHE_LINE_SIZE);
+	uint32_t lapic_ldr;
+	struct pcpu_topology topo;
+	uint64_t tsc_suspend;
 	struct sched_object idle;
 	struct host_gdt gdt;
 	struct tss_64 tss;
-	enum pcpu_boot_state boot_state;
-	uint64_t pcpu_flag;
+#ifdef HV_DEBUG
+	char logbuf[LOG_MESSAGE_MAX_SIZE];
+	uint32_t npk_log_ref;
+#endif
+#ifdef PROFILING_ON
+	struct profiling_info_wrapper profiling_info;
+#endif
 	uint8_t mc_stack[CONFIG_STACK_SIZE] __aligned(16);
 	uint8_t df_stack[CONFIG_STACK_SIZE] __aligned(16);
 	uint8_t sf_stack[CONFIG_STACK_SIZE] __aligned(16);
 	uint8_t stack[CONFIG_STACK_SIZE] __aligned(16);
-	uint32_t lapic_id;
-	uint32_t lapic_ldr;
-	uint32_t softirq_servicing;
-	struct smp_call_info_data smp_call_info;
-	struct list_head softirq_dev_entry_list;
-#ifdef PROFILING_ON
-	struct profiling_info_wrapper profiling_info;
-#endif
-	uint16_t shutdown_vm_id;
-	uint64_t tsc_suspend;
 } __aligned(PAGE_SIZE); /* per_cpu_region size aligned with PAGE_SIZE */
 
 extern struct per_cpu_region per_cpu_data[CONFIG_MAX_PCPU_NUM];
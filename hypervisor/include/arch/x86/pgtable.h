@@ -111,6 +111,11 @@
 /* VTD: Second-Level Paging Entries: Snoop Control */
 #define EPT_SNOOP_CTRL		(1UL << 11U)
 #define EPT_VE			(1UL << 63U)
+/* Set by the processor in the leaf entries when EPT A/D flags are enabled */
+#define EPT_ACCESSED_BIT	8U
+#define EPT_DIRTY_BIT		9U
+#define EPT_ACCESSED		(1UL << EPT_ACCESSED_BIT)
+#define EPT_DIRTY		(1UL << EPT_DIRTY_BIT)
 /* EPT leaf entry bits (bit 52 - bit 63) should be maksed  when calculate PFN */
 #define EPT_PFN_HIGH_MASK	0xFFF0000000000000UL
 
@@ -279,6 +284,21 @@ static inline uint64_t pdpte_large(uint64_t pdpte)
 const uint64_t *lookup_address(uint64_t *pml4_page, uint64_t addr,
 		uint64_t *pg_size, const struct memory_ops *mem_ops);
 
+/**
+ * @brief Number of the present leaf entries of a page table, by page size
+ */
+struct pgtable_page_stats {
+	uint64_t pte_num;	/* 4K pages */
+	uint64_t pde_num;	/* 2M pages */
+	uint64_t pdpte_num;	/* 1G pages */
+};
+
+/**
+ *@pre (pml4_page != NULL) && (stats != NULL)
+ */
+void get_pgtable_page_stats(const uint64_t *pml4_page, struct pgtable_page_stats *stats,
+		const struct memory_ops *mem_ops);
+
 /**
  * @}
  */
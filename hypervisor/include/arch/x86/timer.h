@@ -31,6 +31,8 @@ enum tick_mode {
  */
 struct per_cpu_timers {
 	struct list_head timer_list;	/**< it's for runtime active timer list */
+	uint64_t armed_tsc;		/**< deadline in the TSC-deadline MSR, 0 if disarmed */
+	bool deferred;			/**< the VMX preemption timer serves timer_list for now */
 };
 
 /**
@@ -144,6 +146,21 @@ static inline bool timer_is_started(const struct hv_timer *timer)
  */
 int32_t add_timer(struct hv_timer *timer);
 
+/**
+ * @brief Move a one-shot timer to a new deadline, starting it if needed.
+ *
+ * @param[in] timer Pointer to timer.
+ * @param[in] fire_tsc new tsc deadline to interrupt.
+ *
+ * @retval 0 on success
+ * @retval -EINVAL timer or fire_tsc has an invalid value
+ *
+ * @pre the timer is not started or was started on the current pCPU
+ *
+ * @remark Don't call it in the timer callback function or interrupt content.
+ */
+int32_t update_timer(struct hv_timer *timer, uint64_t fire_tsc);
+
 /**
  * @brief Delete a timer.
  *
@@ -155,6 +172,25 @@ int32_t add_timer(struct hv_timer *timer);
  */
 void del_timer(struct hv_timer *timer);
 
+/**
+ * @brief Hand the timers of the current pCPU over to the VMX preemption timer.
+ *
+ * The TSC-deadline MSR is disarmed and left alone until resume_physical_timer(),
+ * the caller is in charge of getting back before the returned deadline.
+ *
+ * @return the nearest deadline of the pCPU, 0 if no timer is started
+ *
+ * @pre interrupts are disabled
+ */
+uint64_t defer_physical_timer(void);
+
+/**
+ * @brief Hand the timers of the current pCPU back to the TSC-deadline MSR.
+ *
+ * @return None
+ */
+void resume_physical_timer(void);
+
 /**
  * @brief Initialize timer.
  *
@@ -8,7 +8,11 @@
 
 extern uint64_t read_trampoline_sym(const void *sym);
 extern void write_trampoline_sym(const void *sym, uint64_t val);
+/* entries of secondary_cpu_stacks and secondary_cpu_lapic_ids */
+#define TRAMPOLINE_MAX_PCPUS	64U
+
 extern void write_trampoline_stack_sym(uint16_t pcpu_id);
+extern void write_trampoline_stacks(uint64_t mask);
 extern uint64_t prepare_trampoline(void);
 extern uint64_t get_trampoline_start16_paddr(void);
 
@@ -89,8 +89,21 @@ struct acrn_vm_pci_dev_config {
 	uint64_t vbar_base[PCI_BAR_COUNT];		/* vbar base address of PCI device */
 	struct pci_pdev *pdev;				/* the physical PCI device if it's a PT device */
 	const struct pci_vdev_ops *vdev_ops;		/* operations for PCI CFG read/write */
+	uint16_t shm_region_id;				/* inter-VM shared memory region of an ivshmem device */
 } __aligned(8);
 
+/*
+ * The MSR policies of a VM, on top of the emulation of vmsr.c: the MSRs are
+ * passed through, or their accesses get a #GP.
+ */
+#define MSR_POLICY_PASSTHRU	0U
+#define MSR_POLICY_DENY		1U
+
+struct acrn_vm_msr_policy {
+	uint32_t msr;
+	uint32_t policy;
+};
+
 struct acrn_vm_config {
 	enum acrn_vm_load_order load_order;		/* specify the load order of VM */
 	char name[MAX_VM_OS_NAME_LEN];			/* VM name identifier, useful for debug. */
@@ -110,6 +123,8 @@ struct acrn_vm_config {
 	struct acrn_vm_pci_dev_config *pci_devs;	/* point to PCI devices BDF list */
 	struct acrn_vm_os_config os_config;		/* OS information the VM */
 	uint16_t clos;					/* if guest_flags has GUEST_FLAG_CLOS_REQUIRED, then VM use this CLOS */
+	uint16_t msr_policy_num;			/* indicate how many MSR policies in VM */
+	const struct acrn_vm_msr_policy *msr_policies;	/* point to the MSR policy list */
 
 	struct vuart_config vuart[MAX_VUART_NUM_PER_VM];/* vuart configuration for VM */
 } __aligned(8);
@@ -10,6 +10,7 @@
 /* 16-bit control fields */
 #define VMX_VPID						0x00000000U
 #define VMX_POSTED_INTR_VECTOR	0x00000002U
+#define VMX_LAST_PID_POINTER_INDEX	0x00000008U
 /* 16-bit guest-state fields */
 #define VMX_GUEST_ES_SEL    0x00000800U
 #define VMX_GUEST_CS_SEL    0x00000802U
@@ -64,6 +65,11 @@
 
 #define VMX_XSS_EXITING_BITMAP_FULL		0x0000202CU
 #define VMX_XSS_EXITING_BITMAP_HIGH		0x0000202DU
+
+#define VMX_PROC_VM_EXEC_CONTROLS3_FULL		0x00002034U
+#define VMX_PROC_VM_EXEC_CONTROLS3_HIGH		0x00002035U
+#define VMX_PID_POINTER_TABLE_ADDR_FULL		0x00002042U
+#define VMX_PID_POINTER_TABLE_ADDR_HIGH		0x00002043U
 /* 64-bit read-only data fields */
 #define VMX_GUEST_PHYSICAL_ADDR_FULL 0x00002400U
 #define VMX_GUEST_PHYSICAL_ADDR_HIGH 0x00002401U
@@ -281,6 +287,7 @@
 #define VMX_PROCBASED_CTLS_RDTSC       (1U<<12U)
 #define VMX_PROCBASED_CTLS_CR3_LOAD    (1U<<15U)
 #define VMX_PROCBASED_CTLS_CR3_STORE   (1U<<16U)
+#define VMX_PROCBASED_CTLS_TERTIARY    (1U<<17U)
 #define VMX_PROCBASED_CTLS_CR8_LOAD    (1U<<19U)
 #define VMX_PROCBASED_CTLS_CR8_STORE   (1U<<20U)
 #define VMX_PROCBASED_CTLS_TPR_SHADOW  (1U<<21U)
@@ -312,6 +319,9 @@
 #define VMX_PROCBASED_CTLS2_EPT_VE     (1U<<18U)
 #define VMX_PROCBASED_CTLS2_XSVE_XRSTR (1U<<20U)
 
+/* tertiary processor based VM-execution controls, 64 bits */
+#define VMX_PROCBASED_CTLS3_IPIV       (1UL<<4U)
+
 /* MSR_IA32_VMX_EPT_VPID_CAP: EPT and VPID capability bits */
 #define VMX_EPT_EXECUTE_ONLY		(1U << 0U)
 #define VMX_EPT_PAGE_WALK_4		(1U << 6U)
@@ -526,6 +526,24 @@ union dmar_ir_entry {
 		uint64_t svt:2;
 		uint64_t rsvd_3:44;
 	} bits __packed;
+	/* Posted format, the interrupt is recorded into the PIR descriptor at pda */
+	struct {
+		uint64_t present:1;
+		uint64_t fpd:1;
+		uint64_t rsvd_1:6;
+		uint64_t avail:4;
+		uint64_t rsvd_2:2;
+		uint64_t urgent:1;
+		uint64_t pst:1;
+		uint64_t vector:8;
+		uint64_t rsvd_3:14;
+		uint64_t pda_l:26;
+		uint64_t sid:16;
+		uint64_t sq:2;
+		uint64_t svt:2;
+		uint64_t rsvd_4:12;
+		uint64_t pda_h:32;
+	} pi_bits __packed;
 };
 
 extern struct dmar_info *get_dmar_info(void);
@@ -659,10 +677,12 @@ bool iommu_snoop_supported(const struct iommu_domain *iommu);
  * @brief Assign RTE for Interrupt Remapping Table.
  *
  * @param[in] intr_src filled with type of interrupt source and the source
- * @param[in] irte filled with info about interrupt deliverymode, destination and destination mode
+ * @param[in] irte filled with info about interrupt deliverymode, destination and destination mode,
+ *		or with the vector and PIR descriptor in posted format (pi_bits.pst set)
  * @param[in] index into Interrupt Remapping Table
  *
  * @retval -EINVAL if corresponding DMAR is not present
+ * @retval -ENODEV if posted format is asked but the DMAR doesn't support it
  * @retval 0 otherwise
  *
  */
@@ -688,6 +708,32 @@ void dmar_free_irte(struct intr_source intr_src, uint16_t index);
  *
  */
 void iommu_flush_cache(const void *p, uint32_t size);
+
+/**
+ * @brief Invalidate the IOTLB of an iommu domain.
+ *
+ * Invalidate the IOTLB entries of the domain on all the active DMAR units,
+ * after the page table shared with the EPT of the VM has been changed.
+ *
+ * @param[in] domain iommu domain whose IOTLB entries are invalidated, nothing
+ *            is done if it is NULL
+ *
+ */
+void iommu_flush_domain(const struct iommu_domain *domain);
+
+/**
+ * @brief Invalidate the IOTLB of an iommu domain for a guest physical range.
+ *
+ * Use page-selective invalidations on the DMAR units supporting them, and
+ * fall back to a domain invalidation when the range needs too many of them.
+ *
+ * @param[in] domain iommu domain whose IOTLB entries are invalidated, nothing
+ *            is done if it is NULL
+ * @param[in] gpa start of the guest physical range
+ * @param[in] size size of the guest physical range
+ *
+ */
+void iommu_flush_domain_range(const struct iommu_domain *domain, uint64_t gpa, uint64_t size);
 /**
   * @}
   */
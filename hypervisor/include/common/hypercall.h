@@ -15,7 +15,12 @@
 
 struct vhm_request;
 
+/* index of a SOS hypercall in the dispatch table, the ID without HC_ID */
+#define HC_IDX(id)	((id) & 0xFFUL)
+#define HC_NR_IDS	0x90U
+
 bool is_hypercall_from_ring0(void);
+bool get_hypercall_stats(uint32_t idx, const char **name, uint64_t *count, uint64_t *cycles);
 
 /**
  * @brief Hypercall
@@ -181,6 +186,21 @@ int32_t hcall_set_irqline(const struct acrn_vm *vm, uint16_t vmid,
  */
 int32_t hcall_inject_msi(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
 
+/**
+ * @brief inject several MSI and IRQ line operations
+ *
+ * Inject the MSIs and do the IRQ line operations of a batch for a VM,
+ * with one parameter copy and one notification per pCPU.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to struct acrn_intr_batch
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_inject_intr_batch(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
 /**
  * @brief set ioreq shared buffer
  *
@@ -210,6 +230,199 @@ int32_t hcall_set_ioreq_buffer(struct acrn_vm *vm, uint16_t vmid, uint64_t param
  */
 int32_t hcall_notify_ioreq_finish(uint16_t vmid, uint16_t vcpu_id);
 
+/**
+ * @brief notify a batch of requests done
+ *
+ * Notify the requestor VCPUs for the completion of their ioreqs with one
+ * hypercall. The function will return -1 if the target VM does not exist.
+ *
+ * @param vmid ID of the VM
+ * @param vcpu_bitmap bitmap of the vcpu IDs of the requestors
+ *
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_notify_ioreq_finish_batch(uint16_t vmid, uint64_t vcpu_bitmap);
+
+/**
+ * @brief register or deregister a doorbell of a VM
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_doorbell
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_set_doorbell(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief fetch and clear the pending doorbells of a VM
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to a uint64_t
+ *              receiving the bitmap of the rung doorbells
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_get_doorbells(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief set the coalesced MMIO ring of a VM
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address of the page holding the
+ *              struct acrn_coalesced_mmio_ring
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_coalesced_mmio_ring(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief register or deregister a coalesced MMIO zone of a VM
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_coalesced_mmio_zone
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_set_coalesced_mmio_zone(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief set the timer counters page of a VM
+ *
+ * The hypervisor serves the HPET and PIT counter reads of the VM from the
+ * state the device model publishes in the page.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address of the page holding the
+ *              struct acrn_timer_counters
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_timer_counters(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief set the PCI config space shadow of a VM
+ *
+ * The hypervisor serves the reads of the read-only PCI config space of the
+ * VM from the copy the device model pushes.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address of the struct acrn_pci_cfg_shadow
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_pci_cfg_shadow(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief register or unregister the MSI-X table of an emulated device
+ *
+ * The hypervisor serves the accesses to the MSI-X table of the device from
+ * the copy the device model keeps in SOS memory.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address of the struct acrn_emul_msix
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_set_emul_msix(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief query, attach or detach the ivshmem device of a VM
+ *
+ * The shared memory BAR of the device emulated by the device model maps a
+ * region of the inter-VM shared memory, its doorbell writes are served by
+ * the hypervisor.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address of the struct acrn_ivshmem, the
+ *		outputs are copied back
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_ivshmem(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief create a vCPU of a running VM on a pCPU released by the SOS
+ *
+ * The vCPUs of the VM configuration are created along with the VM, the
+ * hypercall is a no-op for them. Otherwise the vCPU is created on the pCPU,
+ * in the wait-for-SIPI state, for the guest to bring it up once it is told
+ * of it by the device model.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address of the struct acrn_create_vcpu
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, -EBUSY if the pCPU is in use, -EINVAL on other
+ *         errors.
+ */
+int32_t hcall_create_vcpu(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief remove a vCPU the guest ejected, and hand its pCPU back to the SOS
+ *
+ * The vCPU of the SOS offlined for the pCPU is created again, in the
+ * wait-for-SIPI state, for the SOS to online the pCPU.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param the vCPU ID, the BSP is never removed
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_remove_vcpu(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief set the simple port I/O registers page of a VM
+ *
+ * The hypervisor serves the guest accesses to the registers the device
+ * model describes in the page.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address of the page holding the
+ *              struct acrn_pio_regs
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_pio_regs(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief set the RTC page of a VM
+ *
+ * The hypervisor emulates the RTC of the VM, starting from the time and
+ * the NVRAM contents of the page.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address of the page holding the
+ *              struct acrn_vrtc
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_vrtc(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
 /**
  * @brief setup ept memory mapping for multi regions
  *
@@ -235,6 +448,35 @@ int32_t hcall_set_vm_memory_regions(struct acrn_vm *vm, uint64_t param);
  */
 int32_t hcall_write_protect_page(struct acrn_vm *vm, uint16_t vmid, uint64_t wp_gpa);
 
+/**
+ * @brief start or stop the dirty pages tracking of a VM
+ *
+ * Enable the EPT accessed/dirty flags of the VM, the pages written before
+ * are not reported by HC_VM_GET_DIRTY_LOG.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param enable non-zero to start the tracking, zero to stop it
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, -ENODEV if the platform has no EPT A/D flags,
+ *         other non-zero on error.
+ */
+int32_t hcall_set_dirty_log(struct acrn_vm *vm, uint16_t vmid, uint64_t enable);
+
+/**
+ * @brief harvest and clear the dirty pages bitmap of a guest memory range
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_dirty_log
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_get_dirty_log(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
 /**
  * @brief translate guest physical address to host physical address
  *
@@ -344,6 +586,84 @@ int32_t hcall_get_cpu_pm_state(struct acrn_vm *vm, uint64_t cmd, uint64_t param)
  */
 int32_t hcall_vm_intr_monitor(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
 
+/**
+ * @brief Get the VM exit statistics of a vCPU of a VM.
+ *
+ * @param vm pointer to VM data structure
+ * @param vmid id of the VM
+ * @param param guest physical address. This gpa points to data structure of
+ *              acrn_vmexit_stats
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_get_exit_stats(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief Set the statistics page of a vCPU of a VM.
+ *
+ * @param vm pointer to VM data structure
+ * @param vmid id of the VM
+ * @param param guest physical address of the page holding the
+ *              struct acrn_vcpu_stats, vcpu_id set
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_set_vcpu_stats(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief Set the Class of Service of the vCPUs of a VM.
+ *
+ * @param vm pointer to VM data structure
+ * @param vmid id of the VM, a post-launched VM or the SOS
+ * @param param guest physical address of the struct acrn_vm_clos
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_vm_set_clos(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief Set the cache capacity bitmask or the MBA delay of a CLOS.
+ *
+ * @param vm pointer to VM data structure
+ * @param param guest physical address of the struct acrn_clos_mask
+ *
+ * @pre Pointer vm shall point to SOS_VM
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_clos_mask(struct acrn_vm *vm, uint64_t param);
+
+/**
+ * @brief Send a fixed IPI to several vCPUs with one hypercall.
+ *
+ * Available to any VM without LAPIC passthrough, as reported by
+ * GUEST_CAPS_PV_SEND_IPI in CPUID leaf 0x40000001.
+ *
+ * @param vcpu Pointer to the sender vCPU
+ * @param param1 bitmap of the destination APIC IDs, bit n for APIC ID
+ *               base + n
+ * @param param2 bits 7:0 the vector, bits 63:32 the base APIC ID
+ *
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_send_ipi_mask(struct acrn_vcpu *vcpu, uint64_t param1, uint64_t param2);
+
+/**
+ * @brief Set up the PV EOI bitmap of the calling vCPU.
+ *
+ * Available to the VMs reported by GUEST_CAPS_PV_EOI in CPUID leaf
+ * 0x40000001, see vlapic_set_pv_eoi() for the protocol.
+ *
+ * @param vcpu Pointer to the calling vCPU
+ * @param param guest physical address of a 32 bytes aligned 256 bits
+ *              bitmap, 0 to disable PV EOI
+ *
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_pv_eoi(struct acrn_vcpu *vcpu, uint64_t param);
+
 /**
  * @defgroup trusty_hypercall Trusty Hypercalls
  *
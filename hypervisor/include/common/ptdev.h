@@ -106,6 +106,23 @@ struct ptirq_msi_info {
 	union msi_data_reg pmsi_data; /* phys msi_data */
 };
 
+#define PTIRQ_BITMAP_ARRAY_SIZE	INT_DIV_ROUNDUP(CONFIG_MAX_PT_IRQ_ENTRIES, 64U)
+
+/* the interrupt rate of a source is sampled over this window */
+#define PTIRQ_MOD_WINDOW_US		1000U
+/* default rates of INTR_MOD_LATENCY and INTR_MOD_THROUGHPUT, per window */
+#define PTIRQ_MOD_LATENCY_RATE		200U
+#define PTIRQ_MOD_THROUGHPUT_RATE	20U
+/* first delay of a source going over the rate with no min delay */
+#define PTIRQ_MOD_STEP_US		50U
+
+/* entries a SOFTIRQ_PTDEV run delivers, the others wait for the next run */
+#define PTIRQ_SOFTIRQ_BUDGET		32U
+
+/* the active entries are hashed by physical source and by (VM, virtual source) */
+#define PTIRQ_HASH_BITS		6U
+#define PTIRQ_HASH_SIZE		(1U << PTIRQ_HASH_BITS)
+
 struct ptirq_remapping_info;
 typedef void (*ptirq_arch_release_fn_t)(const struct ptirq_remapping_info *entry);
 
@@ -123,12 +140,20 @@ struct ptirq_remapping_info {
 	bool active;	/* true=active, false=inactive*/
 	uint32_t allocated_pirq;
 	uint32_t polarity; /* 0=active high, 1=active low*/
-	struct list_head softirq_node;
 	struct ptirq_msi_info msi;
 
 	uint64_t intr_count;
 	struct hv_timer intr_delay_timer; /* used for delay intr injection */
+	/* adaptive moderation state, see ptirq_intr_delay() */
+	uint64_t mod_window_start;
+	uint32_t mod_window_count;
+	uint64_t mod_delay;
 	ptirq_arch_release_fn_t release_cb;
+
+	/* linked while the entry is active, under ptdev_lock */
+	struct list_head phys_link;	/* chain of phys_sid */
+	struct list_head virt_link;	/* chain of (vm, virt_sid) */
+	struct list_head vm_link;	/* vm->ptdev_entries */
 };
 
 static inline bool is_entry_active(const struct ptirq_remapping_info *entry)
@@ -139,9 +164,22 @@ static inline bool is_entry_active(const struct ptirq_remapping_info *entry)
 extern struct ptirq_remapping_info ptirq_entries[CONFIG_MAX_PT_IRQ_ENTRIES];
 extern spinlock_t ptdev_lock;
 
+/**
+ * @brief Set the passthrough interrupt moderation policy of a VM
+ *
+ * @param[inout] vm the VM the policy applies to
+ * @param[in] policy one of INTR_MOD_*
+ * @param[in] min_us min delay of an interrupt, in US
+ * @param[in] max_us max delay of an interrupt, in US
+ * @param[in] rate interrupts per MS from which a source is delayed, 0 for the default
+ *
+ * @return 0 on success, -EINVAL for an unknown policy or min_us > max_us
+ */
+int32_t ptirq_set_moderation(struct acrn_vm *vm, uint32_t policy, uint32_t min_us, uint32_t max_us, uint32_t rate);
+
 void ptirq_softirq(uint16_t pcpu_id);
 void ptdev_init(void);
-void ptdev_release_all_entries(const struct acrn_vm *vm);
+void ptdev_release_all_entries(struct acrn_vm *vm);
 
 struct ptirq_remapping_info *ptirq_dequeue_softirq(uint16_t pcpu_id);
 struct ptirq_remapping_info *ptirq_alloc_entry(struct acrn_vm *vm, uint32_t intr_type);
@@ -149,6 +187,27 @@ void ptirq_release_entry(struct ptirq_remapping_info *entry);
 int32_t ptirq_activate_entry(struct ptirq_remapping_info *entry, uint32_t phys_irq);
 void ptirq_deactivate_entry(struct ptirq_remapping_info *entry);
 
+/**
+ * @brief Find an active entry by physical or by virtual source
+ *
+ * @param[in] intr_type PTDEV_INTR_MSI or PTDEV_INTR_INTX
+ * @param[in] sid the physical source if vm is NULL, the virtual one of vm otherwise
+ * @param[in] vm NULL, or the VM of the virtual source
+ *
+ * @return the entry, NULL if there is none
+ *
+ * @pre ptdev_lock is held
+ */
+struct ptirq_remapping_info *ptirq_find_entry(uint32_t intr_type, const union source_id *sid,
+		const struct acrn_vm *vm);
+
+/**
+ * @brief Move an active entry to another VM and virtual source
+ *
+ * @pre ptdev_lock is held
+ */
+void ptirq_change_owner(struct ptirq_remapping_info *entry, struct acrn_vm *vm, const union source_id *virt_sid);
+
 uint32_t ptirq_get_intr_data(const struct acrn_vm *target_vm, uint64_t *buffer, uint32_t buffer_cnt);
 
 #endif /* PTDEV_H */
@@ -7,15 +7,31 @@
 #ifndef SCHEDULE_H
 #define SCHEDULE_H
 #include <spinlock.h>
+#include <timer.h>
 
 #define	NEED_RESCHEDULE		(1U)
+#define	SCHED_IDLE_MONITOR	(2U)	/* idle thread is in MWAIT monitoring flags */
 
 #define DEL_MODE_INIT		(1U)
 #define DEL_MODE_IPI		(2U)
 
+#define SCHED_PRIO_LOW		(0U)
+#define SCHED_PRIO_NORMAL	(1U)
+#define SCHED_PRIO_HIGH		(2U)
+
 struct sched_object;
+struct sched_context;
 typedef void (*run_thread_t)(struct sched_object *obj);
 typedef void (*prepare_switch_t)(struct sched_object *obj);
+typedef bool (*migrate_t)(struct sched_object *obj, uint16_t pcpu_id);
+
+/* scheduling parameters, only the priority scheduler class honors them */
+struct sched_params {
+	uint16_t prio;		/* SCHED_PRIO_LOW ~ SCHED_PRIO_HIGH */
+	uint32_t budget_us;	/* runtime allowed in each period, 0 means unlimited */
+	uint32_t period_us;	/* period in which the budget is replenished */
+};
+
 struct sched_object {
 	char name[16];
 	struct list_head run_list;
@@ -23,6 +39,48 @@ struct sched_object {
 	run_thread_t thread;
 	prepare_switch_t prepare_switch_out;
 	prepare_switch_t prepare_switch_in;
+
+	struct sched_params params;
+	uint64_t budget_left;	/* remaining budget in TSC cycles */
+	uint64_t period_end;	/* TSC at which the budget gets replenished */
+
+	/*
+	 * The object is running, waiting on the runqueue or blocked off it,
+	 * the cycles are accounted on each change with the scheduler_lock held.
+	 */
+	uint64_t state_tsc;	/* TSC of the last change of state */
+	uint64_t wait_tsc;	/* cycles runnable but waiting for the pCPU */
+	uint64_t blocked_tsc;	/* cycles off the runqueue */
+
+	/*
+	 * pCPUs an idle pCPU may take the object over from, see steal_work().
+	 * 0 for an object bound to its pCPU. migrate moves the state of the
+	 * object to pcpu_id, it is invoked on the pCPU the object ran on last,
+	 * with both scheduler_locks held, and returns false if the object has
+	 * to stay there for now.
+	 */
+	uint64_t pcpu_mask;
+	migrate_t migrate;
+	uint64_t migrate_tsc;	/* TSC of the last move */
+};
+
+/*
+ * Scheduler class, all the callbacks are invoked with the scheduler_lock
+ * of the sched_context held. pick_next is always invoked on the pCPU
+ * owning the sched_context and returns NULL if only idle could run.
+ */
+struct acrn_scheduler {
+	char name[16];
+	void (*init)(struct sched_context *ctx);
+	void (*insert)(struct sched_context *ctx, struct sched_object *obj);
+	void (*remove)(struct sched_context *ctx, struct sched_object *obj);
+	struct sched_object *(*pick_next)(struct sched_context *ctx);
+	/*
+	 * Move the current object behind the runnable objects it shares the pCPU
+	 * with, and hint ahead of its peers if it is runnable. Returns false if
+	 * nothing else would run first.
+	 */
+	bool (*yield)(struct sched_context *ctx, struct sched_object *hint);
 };
 
 struct sched_context {
@@ -30,18 +88,35 @@ struct sched_context {
 	uint64_t flags;
 	struct sched_object *curr_obj;
 	spinlock_t scheduler_lock;	/* to protect sched_context and sched_object */
+	uint64_t lock_rflags;		/* RFLAGS of the scheduler_lock holder before it got the lock */
+
+	struct acrn_scheduler *scheduler;
+	struct hv_timer tick_timer;	/* time slice / budget timer of the scheduler class */
+	uint64_t slice_start;		/* TSC when curr_obj was picked */
+	uint64_t nr_switches;		/* context switches of the pCPU */
+	uint64_t idle_tsc;		/* cycles the idle object ran */
+	uint64_t steal_mask;		/* idle pCPUs asking for an object of the runqueue */
+	uint32_t nr_movable;		/* objects on the runqueue with a pcpu_mask */
+	uint64_t nr_migrations;		/* objects given to the idle pCPUs */
 };
 
+extern struct acrn_scheduler sched_fifo;
+extern struct acrn_scheduler sched_prio;
+
 void init_scheduler(void);
 void switch_to_idle(run_thread_t idle_thread);
 void get_schedule_lock(uint16_t pcpu_id);
 void release_schedule_lock(uint16_t pcpu_id);
 
+void init_sched_object(struct sched_object *obj, const struct sched_params *params);
 void add_to_cpu_runqueue(struct sched_object *obj, uint16_t pcpu_id);
-void remove_from_cpu_runqueue(struct sched_object *obj);
+void remove_from_cpu_runqueue(struct sched_object *obj, uint16_t pcpu_id);
 
 void make_reschedule_request(uint16_t pcpu_id, uint16_t delmode);
+void make_reschedule_request_mask(uint64_t pcpu_mask);
 bool need_reschedule(uint16_t pcpu_id);
+bool yield_current(struct sched_object *hint);
+bool is_sole_runnable(const struct sched_object *obj, uint16_t pcpu_id);
 
 void schedule(void);
 void run_sched_thread(struct sched_object *obj);
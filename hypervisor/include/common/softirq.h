@@ -9,10 +9,19 @@
 
 #define SOFTIRQ_TIMER		0U
 #define SOFTIRQ_PTDEV		1U
-#define NR_SOFTIRQS		2U
+#define SOFTIRQ_SBUF		2U
+#define SOFTIRQ_NPK		3U
+#define NR_SOFTIRQS		4U
 
 typedef void (*softirq_handler)(uint16_t cpu_id);
 
+/* timing of the softirqs of a pCPU, in TSC cycles */
+struct softirq_stats {
+	uint64_t runs[NR_SOFTIRQS];
+	uint64_t tsc[NR_SOFTIRQS];
+	uint64_t max_tsc[NR_SOFTIRQS];
+};
+
 void init_softirq(void);
 void register_softirq(uint16_t nr, softirq_handler handler);
 void fire_softirq(uint16_t nr);
@@ -34,6 +34,11 @@ size_t console_write(const char *s, size_t len);
 void console_putc(const char *ch);
 char console_getc(void);
 
+/** Writes the buffered output to the console, and the next output right
+ *  away: on a fatal error.
+ */
+void console_flush(void);
+
 void console_setup_timer(void);
 
 void suspend_console(void);
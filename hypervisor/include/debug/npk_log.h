@@ -9,6 +9,7 @@
 struct hv_npk_log_param;
 
 void npk_log_setup(struct hv_npk_log_param *param);
-void npk_log_write(const char *buf, size_t len);
+void npk_log_write(const char *buf, size_t len, bool binary);
+void npk_log_flush(void);
 
 #endif /* NPK_LOG_H */
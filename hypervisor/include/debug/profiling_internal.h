@@ -48,6 +48,8 @@ typedef enum IPI_COMMANDS {
 	IPI_PMU_START,
 	IPI_PMU_STOP,
 	IPI_VMSW_CONFIG,
+	IPI_SAMPLING_START,
+	IPI_SAMPLING_STOP,
 	IPI_UNKNOWN,
 } ipi_commands;
 
@@ -163,6 +165,26 @@ struct profiling_vmsw_config {
 	struct profiling_msr_op exit_list[MAX_MSR_LIST_NUM];
 };
 
+/* the vm_id of the samples of the hypervisor in TRACE_PMU_SAMPLE */
+#define PROFILING_SAMPLE_HV		0xFFFU
+#define PROFILING_SAMPLE_ALL_VMS	0xFFFFU
+
+/*
+ * Built-in sampling, without an external collector: PMC0 counts event on
+ * all the pCPUs and each overflow logs the RIP and CR3 of the interrupted
+ * guest in the trace sbuf of the pCPU.
+ */
+struct profiling_sampling {
+	/* the event select in bits 7:0, the unit mask in bits 15:8 */
+	uint32_t event;
+	/* the VM to sample, PROFILING_SAMPLE_ALL_VMS for all and the hypervisor */
+	uint16_t vm_id;
+	/* non-zero to start the sampling, 0 to stop it */
+	uint16_t enable;
+	/* events between two samples, 1 to 0x7fffffff */
+	uint64_t period;
+};
+
 struct guest_vm_info {
 	uint64_t vmenter_tsc;
 	uint64_t vmexit_tsc;
@@ -170,6 +192,7 @@ struct guest_vm_info {
 	uint64_t guest_rip;
 	uint64_t guest_rflags;
 	uint64_t guest_cs;
+	uint64_t guest_cr3;
 	uint16_t guest_vm_id;
 	int32_t external_vector;
 };
@@ -298,6 +321,7 @@ struct profiling_info_wrapper {
 	socwatch_state soc_state;
 	struct sw_msr_op_info sw_msr_info;
 	spinlock_t sw_lock;
+	bool sampling_on;
 } __aligned(8);
 
 int32_t profiling_get_version_info(struct acrn_vm *vm, uint64_t addr);
@@ -310,6 +334,7 @@ int32_t profiling_configure_pmi(struct acrn_vm *vm, uint64_t addr);
 int32_t profiling_configure_vmsw(struct acrn_vm *vm, uint64_t addr);
 void profiling_ipi_handler(void *data);
 int32_t profiling_get_status_info(struct acrn_vm *vm, uint64_t addr);
+int32_t profiling_config_sampling(struct acrn_vm *vm, uint64_t addr);
 
 #endif
 
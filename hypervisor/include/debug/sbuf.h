@@ -19,6 +19,7 @@
 /* sbuf flags */
 #define OVERRUN_CNT_EN	(1U << 0U) /* whether overrun counting is enabled */
 #define OVERWRITE_EN	(1U << 1U) /* whether overwrite is enabled */
+#define SBUF_COMPACT_EN	(1U << 2U) /* whether the trace records are compact, set by the consumer */
 
 /**
  * (sbuf) head + buf (store (ele_num - 1) elements at most)
@@ -55,15 +56,74 @@ struct shared_buf {
 	uint32_t reserved;
 	uint32_t overrun_cnt;	/* count of overrun */
 	uint32_t size;		/* ele_num * ele_size */
-	uint32_t padding[6];
+	uint32_t watermark;	/* bytes used to notify the consumer at, 0: never */
+	uint32_t padding[5];
 };
 
+/*
+ * A reservation of len bytes at the tail of a sbuf, filled in place by
+ * the producer before it is committed. The reserved bytes are at buf,
+ * and at wrap for the part after the end of the buffer, if any.
+ */
+struct sbuf_rsv {
+	uint8_t *buf;
+	uint32_t buf_len;
+	uint8_t *wrap;
+	uint32_t len;
+	uint32_t next_head;
+	uint32_t next_tail;
+};
 
 /**
  *@pre sbuf != NULL
  *@pre data != NULL
  */
 uint32_t sbuf_put(struct shared_buf *sbuf, uint8_t *data);
+
+/**
+ * @brief Reserve len bytes at the tail of the sbuf.
+ *
+ * A fixed size record is a multiple of ele_size, so several elements
+ * can be reserved at once. On success, SMAP is off until sbuf_commit()
+ * or sbuf_cancel(): the producer fills the reservation in place with
+ * sbuf_rsv_ptr() or sbuf_rsv_write() in between, and does nothing else.
+ *
+ * @return len on success, 0 if the sbuf is full (and not OVERWRITE_EN)
+ *
+ * @pre sbuf != NULL && rsv != NULL
+ */
+uint32_t sbuf_reserve(struct shared_buf *sbuf, uint32_t len, struct sbuf_rsv *rsv);
+
+/**
+ * @brief Pointer to the first len bytes of the reservation, if contiguous.
+ *
+ * @return NULL if they wrap around the end of the sbuf
+ */
+static inline void *sbuf_rsv_ptr(const struct sbuf_rsv *rsv, uint32_t len)
+{
+	return (len <= rsv->buf_len) ? (void *)rsv->buf : NULL;
+}
+
+/**
+ * @brief Copy len bytes of data at offset in the reservation.
+ *
+ * @pre offset + len <= rsv->len
+ */
+void sbuf_rsv_write(const struct sbuf_rsv *rsv, uint32_t offset, const void *data, uint32_t len);
+
+/**
+ * @brief Publish the reservation to the consumer.
+ *
+ * The consumer gets the VHM upcall, from a softirq, when the used bytes
+ * of the sbuf cross its watermark.
+ */
+void sbuf_commit(struct shared_buf *sbuf, const struct sbuf_rsv *rsv);
+
+/**
+ * @brief Drop the reservation, nothing gets published.
+ */
+void sbuf_cancel(const struct sbuf_rsv *rsv);
+
 int32_t sbuf_share_setup(uint16_t pcpu_id, uint32_t sbuf_id, uint64_t *hva);
 void sbuf_reset(void);
 uint32_t sbuf_next_ptr(uint32_t pos, uint32_t span, uint32_t scope);
@@ -20,6 +20,7 @@
 
 #define TRACE_VM_EXIT			0x10U
 #define TRACE_VM_ENTER			0X11U
+#define TRACE_PMU_SAMPLE		0x12U
 #define TRACE_VMEXIT_ENTRY		0x10000U
 
 #define TRACE_VMEXIT_EXCEPTION_OR_NMI	    (TRACE_VMEXIT_ENTRY + 0x00000000U)
@@ -41,6 +42,9 @@
 
 #define TRACE_VMEXIT_UNHANDLED		0x20000U
 
+struct acrn_trace_filter;
+
+void trace_set_filter(uint16_t pcpu_id, const struct acrn_trace_filter *filter);
 void TRACE_2L(uint32_t evid, uint64_t e, uint64_t f);
 void TRACE_4I(uint32_t evid, uint32_t a, uint32_t b, uint32_t c, uint32_t d);
 void TRACE_6C(uint32_t evid, uint8_t a1, uint8_t a2, uint8_t a3, uint8_t a4, uint8_t b1, uint8_t b2);
@@ -120,6 +120,9 @@
 
 #define UART_IER_DISABLE_ALL	0x00000000U
 
+/* the TX FIFO of a 16550A, the larger ones of the PCI UARTs work too */
+#define UART16550_TX_FIFO_SIZE	16U
+
 #define BAUD_9600      9600U
 #define BAUD_115200    115200U
 #define BAUD_460800    460800U
@@ -130,6 +133,7 @@
 void uart16550_init(bool early_boot);
 char uart16550_getc(void);
 size_t uart16550_puts(const char *buf, uint32_t len);
+size_t uart16550_write_fifo(const char *buf, uint32_t len);
 void uart16550_set_property(bool enabled, bool port_mapped, uint64_t base_addr);
 bool is_pci_dbg_uart(union pci_bdf bdf_value);
 
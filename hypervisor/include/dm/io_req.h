@@ -46,6 +46,7 @@ struct vm_io_range {
 struct vm_io_handler_desc;
 struct acrn_vm;
 struct acrn_vcpu;
+struct msix_table_entry;
 
 typedef
 bool (*io_read_fn_t)(struct acrn_vcpu *vcpu, uint16_t port, size_t size);
@@ -207,6 +208,29 @@ void set_vhm_req_state(struct acrn_vm *vm, uint16_t vhm_req_id, uint32_t state);
  */
 void set_vhm_notification_vector(uint32_t vector);
 
+/**
+ * @brief Resume the vCPUs whose IO requests have been completed by SOS
+ *
+ * @param vm Target VM context
+ * @param vcpu_bitmap Bitmap of the IDs of the vCPUs to resume
+ *
+ * @return 0 on success, -EINVAL if any bit in \p vcpu_bitmap is not an online
+ *         vCPU of \p vm. The valid vCPUs are resumed in any case.
+ */
+int32_t resume_vcpus_ioreq_done(struct acrn_vm *vm, uint64_t vcpu_bitmap);
+
+/**
+ * @brief Resume a vCPU whose IO request has been completed by SOS
+ *
+ * In IO completion polling mode, only a vCPU which stopped polling is
+ * resumed.
+ *
+ * @param vcpu The vCPU which issued the request
+ *
+ * @pre vcpu != NULL
+ */
+void resume_vcpu_ioreq_done(struct acrn_vcpu *vcpu);
+
 /**
  * @brief Get the vector for HV callback VHM
  *
@@ -279,6 +303,113 @@ void register_pio_default_emulation_handler(struct acrn_vm *vm);
  */
 void register_mmio_default_emulation_handler(struct acrn_vm *vm);
 
+/**
+ * @brief Register a doorbell of a post-launched VM
+ *
+ * @param vm The VM to which the doorbell is registered
+ * @param doorbell The doorbell, see struct acrn_doorbell
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL \p doorbell is invalid.
+ * @retval -EBUSY the index of \p doorbell is already registered.
+ */
+int32_t register_doorbell(struct acrn_vm *vm, const struct acrn_doorbell *doorbell);
+
+/**
+ * @brief Unregister the doorbell \p index of a VM
+ *
+ * @param vm The VM to which the doorbell is registered
+ * @param index The index of the doorbell
+ *
+ * @pre index < ACRN_DOORBELL_MAX
+ */
+void unregister_doorbell(struct acrn_vm *vm, uint16_t index);
+
+/**
+ * @brief Mark the doorbells in \p mask as pending and notify SOS
+ *
+ * SOS is notified only if no doorbell was pending, it fetches all of them
+ * at once with HC_VM_GET_DOORBELLS.
+ *
+ * @param vm The VM owning the doorbells
+ * @param mask Bitmap of the doorbells to ring
+ */
+void ring_doorbells(struct acrn_vm *vm, uint64_t mask);
+
+/**
+ * @brief Register a coalesced MMIO zone of a post-launched VM
+ *
+ * The guest writes inside the zone are appended to the coalesced MMIO ring
+ * of the VM instead of being delivered as ioreqs, as long as it has room.
+ *
+ * @param vm The VM to which the zone is registered
+ * @param zone The zone, see struct acrn_coalesced_mmio_zone
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL \p zone is empty or overflows.
+ * @retval -ENOSPC no room for another zone.
+ */
+int32_t register_coalesced_mmio_zone(struct acrn_vm *vm, const struct acrn_coalesced_mmio_zone *zone);
+
+/**
+ * @brief Unregister the coalesced MMIO zone matching \p zone
+ *
+ * @param vm The VM to which the zone is registered
+ * @param zone The zone, with the addr and size it was registered with
+ *
+ * @retval 0 on success.
+ * @retval -ENOENT no such zone.
+ */
+int32_t unregister_coalesced_mmio_zone(struct acrn_vm *vm, const struct acrn_coalesced_mmio_zone *zone);
+
+/**
+ * @brief Emulate a timer counter access of a post-launched VM in the hypervisor
+ *
+ * Serves the reads of the HPET main counter, the PIT counter latch commands
+ * and the reads of the counts they latched, from the state published by the
+ * device model in struct acrn_timer_counters. The other accesses to the
+ * HPET and the PIT are left to the device model.
+ *
+ * @param vm The VM the access comes from
+ * @param io_req The I/O request, the value of a read is filled in
+ *
+ * @return true if \p io_req was emulated, false if it goes to the device model.
+ */
+bool emulate_timer_counter(struct acrn_vm *vm, struct io_request *io_req);
+
+/**
+ * @brief Register the MSI-X table of a device emulated by the device model
+ *
+ * @param vm The VM the device belongs to
+ * @param msix The BAR and the layout of the table
+ * @param table The table, mapped in the hypervisor, NULL for the table of a
+ *	  passthrough device (ACRN_EMUL_MSIX_FLAG_PTDEV)
+ *
+ * @return 0 on success, -EINVAL if \p msix is not valid, -ENOSPC if all the
+ *	   tables are in use.
+ */
+int32_t register_emul_msix(struct acrn_vm *vm, const struct acrn_emul_msix *msix, struct msix_table_entry *table);
+
+/**
+ * @brief Unregister the MSI-X table of an emulated device
+ *
+ * @param vm The VM the device belongs to
+ * @param msix The BAR registered with register_emul_msix()
+ *
+ * @return 0 on success, -ENOENT if \p msix is not registered.
+ */
+int32_t unregister_emul_msix(struct acrn_vm *vm, const struct acrn_emul_msix *msix);
+
+/**
+ * @brief Emulate an access to the MSI-X table or the PBA of an emulated device
+ *
+ * @param vm The VM the access comes from
+ * @param io_req The I/O request, the value of a read is filled in
+ *
+ * @return true if \p io_req was emulated, false if it goes to the device model.
+ */
+bool emulate_emul_msix(struct acrn_vm *vm, struct io_request *io_req);
+
 /**
  * @}
  */
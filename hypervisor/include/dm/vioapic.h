@@ -39,6 +39,7 @@
 
 #include <apicreg.h>
 #include <util.h>
+#include <irq.h>
 
 #define	VIOAPIC_BASE	0xFEC00000UL
 #define	VIOAPIC_SIZE	4096UL
@@ -51,13 +52,18 @@
 
 struct acrn_vioapic {
 	struct acrn_vm	*vm;
+	/* serializes the register accesses of the guest */
 	spinlock_t	mtx;
+	/* protects the RTE and the line state of each pin */
+	spinlock_t	pin_lock[REDIR_ENTRIES_HW];
 	uint32_t	id;
 	bool		ready;
 	uint32_t	ioregsel;
 	union ioapic_rte rtbl[REDIR_ENTRIES_HW];
 	/* pin_state status bitmap: 1 - high, 0 - low */
 	uint64_t pin_state[STATE_BITMAP_SIZE];
+	/* pins whose RTE holds the vector, for the EOI processing */
+	uint64_t vector_pins[NR_MAX_VECTOR + 1U][STATE_BITMAP_SIZE];
 	struct ptirq_remapping_info *vpin_to_pt_entry[VIOAPIC_MAX_PIN];
 };
 
@@ -30,6 +30,8 @@
 #ifndef VPCI_H_
 #define VPCI_H_
 
+#include <spinlock.h>
+#include <acrn_common.h>
 #include <pci.h>
 
 
@@ -107,17 +109,112 @@ struct pci_addr_info {
 	bool cached_enable;
 };
 
+/* buses of a VM whose vdevs are looked up by devfn, the others are scanned */
+#define VPCI_INDEXED_BUSES	8U
+
+/* bus_index values besides 1 + the index in devfn_index */
+#define VPCI_BUS_EMPTY		0U
+#define VPCI_BUS_UNINDEXED	0xFFU
+
 struct acrn_vpci {
 	struct acrn_vm *vm;
 	struct pci_addr_info addr_info;
 	uint32_t pci_vdev_cnt;
 	struct pci_vdev pci_vdevs[CONFIG_MAX_PCI_DEV_NUM];
+
+	/* pci_vdevs by BDF, so a config access does not scan pci_vdevs */
+	uint8_t bus_index[PCI_BUSMAX + 1U];
+	uint16_t devfn_index[VPCI_INDEXED_BUSES][PCI_BUSMAX + 1U];	/* 1 + index in pci_vdevs, 0 if none */
+	uint8_t indexed_buses;
+
+	/* SOS: the ECAM window of PCI segment 0, mmcfg_size is 0 if none */
+	uint64_t mmcfg_base;	/* of bus 0 */
+	uint64_t mmcfg_start;
+	uint64_t mmcfg_size;
+
+	/* post-launched VM: read-only config space pushed by the device model */
+	struct acrn_pci_cfg_shadow cfg_shadow;
+	uint32_t cfg_shadow_addr;	/* last value written to port CF8 */
+	spinlock_t cfg_shadow_lock;	/* protects cfg_shadow and cfg_shadow_addr */
 };
 
 extern const struct pci_vdev_ops vhostbridge_ops;
+extern const struct pci_vdev_ops vpci_ivshmem_ops;
 void vpci_init(struct acrn_vm *vm);
 void vpci_cleanup(const struct acrn_vm *vm);
 void vpci_set_ptdev_intr_info(struct acrn_vm *target_vm, uint16_t vbdf, uint16_t pbdf);
 void vpci_reset_ptdev_intr_info(const struct acrn_vm *target_vm, uint16_t vbdf, uint16_t pbdf);
 
+struct io_request;
+struct mmio_request;
+
+/**
+ * @brief Check the passthrough device of a post-launched VM has a MSI-X table
+ *
+ * @param vm The post-launched VM
+ * @param vbdf The virtual BDF of the device in \p vm
+ *
+ * @return true if the device is assigned to \p vm and has a MSI-X table.
+ */
+bool vpci_has_ptdev_msix(struct acrn_vm *vm, uint16_t vbdf);
+
+/**
+ * @brief Emulate an access to the MSI-X table pages of a passthrough device
+ *
+ * The table accesses remap the vectors as the accesses through SOS do, the
+ * other accesses to the pages go to the physical BAR.
+ *
+ * @param vm The post-launched VM the access comes from
+ * @param vbdf The virtual BDF of the device in \p vm
+ * @param mmio The MMIO request, the value of a read is filled in
+ * @param offset Offset of the access from the first page holding the table
+ *
+ * @return true if \p mmio was emulated, false if the device is gone.
+ */
+bool vpci_ptdev_msix_access(struct acrn_vm *vm, uint16_t vbdf, struct mmio_request *mmio, uint64_t offset);
+
+/**
+ * @brief Serve a PCI config read of a post-launched VM from the shadow
+ *
+ * Reads of the read-only bytes of the devices in struct acrn_pci_cfg_shadow,
+ * and reads of the BDFs without a device, through port CFC or the ECAM
+ * window are served in the hypervisor. The writes to port CF8 are snooped
+ * and still go to the device model.
+ *
+ * @param vm The VM the access comes from
+ * @param io_req The I/O request, the value of a read is filled in
+ *
+ * @return true if \p io_req was emulated, false if it goes to the device model.
+ */
+bool vpci_emulate_cfg_shadow(struct acrn_vm *vm, struct io_request *io_req);
+
+/**
+ * @brief Query, attach or detach the ivshmem device of a post-launched VM
+ *
+ * @param vm The post-launched VM
+ * @param ivshmem The request, see struct acrn_ivshmem, the outputs are filled in
+ *
+ * @retval 0 on success.
+ * @retval -EINVAL \p ivshmem is not valid.
+ * @retval -ENOSPC all the IVPositions of the region are in use.
+ */
+int32_t vpci_ivshmem_set(struct acrn_vm *vm, struct acrn_ivshmem *ivshmem);
+
+/**
+ * @brief Serve a doorbell write of an ivshmem device of a post-launched VM
+ *
+ * @param vm The VM the access comes from
+ * @param io_req The I/O request
+ *
+ * @return true if \p io_req was emulated, false if it goes to the device model.
+ */
+bool vpci_emulate_ivshmem_doorbell(struct acrn_vm *vm, struct io_request *io_req);
+
+/**
+ * @brief Detach the ivshmem devices of a post-launched VM being shut down
+ *
+ * @param vm The VM
+ */
+void vpci_ivshmem_release(const struct acrn_vm *vm);
+
 #endif /* VPCI_H_ */
@@ -31,9 +31,10 @@
 #define VUART_H
 #include <types.h>
 #include <spinlock.h>
+#include <timer.h>
 #include <vm_config.h>
 
-#define RX_BUF_SIZE		256U
+#define RX_BUF_SIZE		CONFIG_VUART_RX_BUF_SIZE
 #define TX_BUF_SIZE		8192U
 #define INVAILD_VUART_IDX	0xFFU
 
@@ -75,6 +76,14 @@ struct acrn_vuart {
 	char vuart_rx_buf[RX_BUF_SIZE];
 	char vuart_tx_buf[TX_BUF_SIZE];
 	bool thre_int_pending;	/* THRE interrupt pending */
+	/*
+	 * Below the FCR trigger level, the received characters raise the
+	 * character timeout interrupt once rx_timer expires.
+	 */
+	bool rx_timeout;	/* character timeout interrupt pending */
+	bool rx_timer_armed;
+	uint16_t rx_timer_pcpu;	/* pCPU rx_timer is armed on */
+	struct hv_timer rx_timer;
 	bool active;
 	struct acrn_vuart *target_vu; /* Pointer to target vuart */
 	struct acrn_vm *vm;
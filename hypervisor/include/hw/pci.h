@@ -82,7 +82,10 @@
 #define PCIM_BAR_MEM_32       0x00U
 #define PCIM_BAR_MEM_1MB      0x02U
 #define PCIM_BAR_MEM_64       0x04U
+#define PCIM_BAR_MEM_PREFETCH 0x08U
 #define PCIM_BAR_MEM_BASE     0xFFFFFFF0U
+#define PCIR_SUBVEND_0        0x2CU
+#define PCIR_SUBDEV_0         0x2EU
 #define PCIR_CAP_PTR          0x34U
 #define PCIR_CAP_PTR_CARDBUS  0x14U
 #define PCI_BASE_ADDRESS_MEM_MASK (~0x0fUL)
@@ -114,6 +117,8 @@
 #define PCIM_MSICTRL_MME_MASK 0x0070U
 
 /* PCI device class */
+#define PCIC_MEMORY           0x05U
+#define PCIS_MEMORY_RAM       0x00U
 #define PCIC_BRIDGE           0x06U
 #define PCIS_BRIDGE_HOST      0x00U
 
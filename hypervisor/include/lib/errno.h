@@ -9,6 +9,8 @@
 
 /** Indicates that operation not permitted. */
 #define EPERM		1
+/** Indicates that there is no such entry. */
+#define ENOENT		2
 /** Indicates that there is IO error. */
 #define EIO		5
 /** Indicates that not enough memory. */
@@ -23,6 +25,8 @@
 #define ENODEV		19
 /** Indicates that argument is not valid. */
 #define EINVAL		22
+/** Indicates that there is no space left. */
+#define ENOSPC		28
 /** Indicates that timeout occurs. */
 #define ETIMEDOUT	110
 
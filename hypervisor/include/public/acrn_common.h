@@ -288,11 +288,23 @@ struct vhm_request {
 	uint32_t completion_polling;
 
 	/**
-	 * @brief Reserved.
+	 * @brief Hypervisor stopped polling the completion if set.
+	 *
+	 * Set by the hypervisor when a completion polling request takes longer
+	 * than it spins for: the vCPU is paused then, the completion has to be
+	 * notified as in notification mode, including when the device model
+	 * completes it with dm_polling set.
 	 *
 	 * Byte offset: 8.
 	 */
-	uint32_t reserved0[14];
+	uint32_t hv_waiting;
+
+	/**
+	 * @brief Reserved.
+	 *
+	 * Byte offset: 12.
+	 */
+	uint32_t reserved0[13];
 
 	/**
 	 * @brief Details about this request.
@@ -329,6 +341,35 @@ struct vhm_request {
 	 * Byte offset: 136.
 	 */
 	uint32_t processed;
+
+	/**
+	 * @brief Reserved.
+	 *
+	 * Byte offset: 140.
+	 */
+	uint32_t reserved2[13];
+
+	/**
+	 * @brief Device model is polling this request if set.
+	 *
+	 * Set by the device model while it spins on the request instead of
+	 * waiting for the upcall. Hypervisor skips the upcall for a completion
+	 * polling request then, the device model claims it by moving it from
+	 * REQ_STATE_PENDING to REQ_STATE_PROCESSING itself.
+	 *
+	 * The only field the device model writes outside of a request, on a
+	 * cache line of its own.
+	 *
+	 * Byte offset: 192.
+	 */
+	uint32_t dm_polling;
+
+	/**
+	 * @brief Reserved.
+	 *
+	 * Byte offset: 196.
+	 */
+	uint32_t reserved3[15];
 } __aligned(256);
 
 union vhm_request_buffer {
@@ -367,9 +408,11 @@ struct acrn_create_vm {
 } __aligned(8);
 
 /**
- * @brief Info to create a VCPU (deprecated)
+ * @brief Info to create a VCPU
  *
- * the parameter for HC_CREATE_VCPU hypercall
+ * the parameter for HC_CREATE_VCPU hypercall, a no-op for the vCPUs of the
+ * VM configuration, which are created along with the VM. The others are
+ * added to the running VM, on a pCPU released by the SOS.
  */
 struct acrn_create_vcpu {
 	/** the virtual CPU ID for the VCPU created */
@@ -500,6 +543,46 @@ struct acrn_msi_entry {
 	uint64_t msi_data;
 } __aligned(8);
 
+/* Types of struct acrn_intr_op */
+#define ACRN_INTR_OP_MSI	0U
+#define ACRN_INTR_OP_IRQLINE	1U
+
+#define ACRN_INTR_BATCH_MAX	16U
+
+/**
+ * @brief One interrupt operation of a batch
+ */
+struct acrn_intr_op {
+	/** ACRN_INTR_OP_MSI or ACRN_INTR_OP_IRQLINE */
+	uint32_t type;
+
+	/** Reserved */
+	uint32_t reserved;
+
+	union {
+		/** for ACRN_INTR_OP_MSI */
+		struct acrn_msi_entry msi;
+
+		/** for ACRN_INTR_OP_IRQLINE */
+		struct acrn_irqline_ops irqline;
+	} u;
+} __aligned(8);
+
+/**
+ * @brief Info to inject several interrupts to a VM at once
+ *
+ * the parameter for HC_INJECT_INTR_BATCH hypercall
+ */
+struct acrn_intr_batch {
+	/** number of valid entries in ops, up to ACRN_INTR_BATCH_MAX */
+	uint32_t count;
+
+	/** Reserved */
+	uint32_t reserved;
+
+	struct acrn_intr_op ops[ACRN_INTR_BATCH_MAX];
+} __aligned(8);
+
 /**
  * @brief Info to inject a NMI interrupt for a VM
  */
@@ -655,6 +738,652 @@ struct acrn_intr_monitor {
 /** cmd for intr monitor **/
 #define INTR_CMD_GET_DATA 0U
 #define INTR_CMD_DELAY_INT 1U
+/*
+ * buffer[0]: INTR_MOD_* policy, buffer[1] and buffer[2]: the min and max
+ * delay (in US), buffer[3]: the rate (interrupts per MS) above which the
+ * delay of an interrupt source grows, 0 for the default of the policy
+ */
+#define INTR_CMD_SET_MODERATION 2U
+
+/** policies of the passthrough interrupt moderation **/
+#define INTR_MOD_FIXED		0U	/* the delay set by INTR_CMD_DELAY_INT */
+#define INTR_MOD_LATENCY	1U	/* no delay but during interrupt storms */
+#define INTR_MOD_THROUGHPUT	2U	/* coalesce the interrupts of busy sources */
+
+/** number of VMX basic exit reasons recorded in struct vmexit_stats */
+#define VMEXIT_STATS_REASONS	65U
+#define ACRN_SOFTIRQ_STATS	4U
+/** number of log2 buckets of the exit handling latency histogram */
+#define VMEXIT_STATS_BUCKETS	32U
+
+/**
+ * @brief VM exit statistics of a vCPU
+ *
+ * Indexed by the VMX basic exit reason. The latency is the number of TSC
+ * cycles spent in the hypervisor exit handler, bucket n of hist counts the
+ * exits which took [2^n, 2^(n+1)) cycles, the last bucket counts all the
+ * longer ones.
+ */
+struct vmexit_stats {
+	/** number of exits */
+	uint64_t count[VMEXIT_STATS_REASONS];
+
+	/** total TSC cycles spent to handle the exits */
+	uint64_t cycles[VMEXIT_STATS_REASONS];
+
+	/** log2 histogram of the TSC cycles spent to handle each exit */
+	uint32_t hist[VMEXIT_STATS_REASONS][VMEXIT_STATS_BUCKETS];
+} __aligned(8);
+
+/**
+ * @brief Info to get the VM exit statistics of a vCPU
+ *
+ * the parameter for HC_VM_GET_EXIT_STATS hypercall
+ */
+struct acrn_vmexit_stats {
+	/** the vCPU to get the statistics of, set by the caller */
+	uint16_t vcpu_id;
+
+	/** Reserved for future use*/
+	uint16_t reserved[3];
+
+	/** the statistics, filled by the hypervisor */
+	struct vmexit_stats stats;
+} __aligned(8);
+
+/**
+ * @brief Always-on statistics of a vCPU, published by the hypervisor
+ *
+ * One page of SOS memory per vCPU, set up with HC_VM_SET_VCPU_STATS. The
+ * device model fills in vcpu_id before the hypercall, the hypervisor clears
+ * the rest and then updates the page on each VM exit of the vCPU with plain
+ * stores from the pCPU of the vCPU: the readers sample the counters, which
+ * only grow. The times are in TSC cycles.
+ */
+struct acrn_vcpu_stats {
+	/** the vCPU of the page, set by the device model */
+	uint16_t vcpu_id;
+
+	/** the pCPU the vCPU runs on, filled in by the hypervisor */
+	uint16_t pcpu_id;
+
+	/** TSC frequency in kHz, filled in by the hypervisor */
+	uint32_t tsc_khz;
+
+	/** number of VM exits by VMX basic exit reason */
+	uint64_t exits[VMEXIT_STATS_REASONS];
+
+	/** cycles in non-root mode, a halted vCPU stays in non-root mode */
+	uint64_t guest_tsc;
+
+	/** cycles in the hypervisor to handle the VM exits of the vCPU */
+	uint64_t root_tsc;
+
+	/** interrupts and NMIs injected by the hypervisor at VM entry */
+	uint64_t injected_intrs;
+
+	/** cycles the vCPU was neither running nor runnable, e.g. paused */
+	uint64_t blocked_tsc;
+
+	/** cycles the vCPU was runnable, waiting for its pCPU */
+	uint64_t steal_tsc;
+
+	/** context switches of the pCPU of the vCPU */
+	uint64_t pcpu_switches;
+
+	/** cycles the pCPU of the vCPU was idle */
+	uint64_t pcpu_idle_tsc;
+
+	/** bytes of the L3 used by the VM, sampled each second, 0 without CMT */
+	uint64_t llc_occupancy;
+
+	/** bytes the VM moved to/from the memory, 0 without MBM */
+	uint64_t mbm_total_bytes;
+
+	/** bytes the VM moved to/from the memory of its package, 0 without MBM */
+	uint64_t mbm_local_bytes;
+
+	/** runs of each softirq on the pCPU of the vCPU: timer, ptdev, sbuf, npk */
+	uint64_t softirq_runs[ACRN_SOFTIRQ_STATS];
+
+	/** cycles spent in each softirq on the pCPU of the vCPU */
+	uint64_t softirq_tsc[ACRN_SOFTIRQ_STATS];
+
+	/** cycles of the longest run of each softirq */
+	uint64_t softirq_max_tsc[ACRN_SOFTIRQ_STATS];
+} __aligned(4096);
+
+/**
+ * @brief Steal time of a vCPU, published to the guest
+ *
+ * The layout of the KVM steal time area. The guest enables it by writing
+ * the guest physical address of the 64-byte aligned area, bit 0 set, to
+ * MSR_ACRN_STEAL_TIME, available if GUEST_CAPS_PV_STEAL_TIME is reported
+ * in CPUID leaf 0x40000001. The hypervisor updates the area when the vCPU
+ * is switched in and out, version is odd while the other fields change.
+ */
+struct acrn_steal_time {
+	/** nanoseconds the vCPU was runnable but waiting, since enabled */
+	uint64_t steal;
+
+	/** odd while the area is being updated */
+	uint32_t version;
+
+	/** Reserved for future use*/
+	uint32_t flags;
+
+	/** non-zero while the vCPU is preempted */
+	uint8_t preempted;
+
+	/** Reserved for future use*/
+	uint8_t reserved8[3];
+
+	/** Reserved for future use*/
+	uint32_t reserved[11];
+} __aligned(64);
+
+/** tsc_to_system_mul and tsc_shift do not change, the TSC is invariant */
+#define ACRN_PVCLOCK_TSC_STABLE		(1U << 0U)
+
+/**
+ * @brief Paravirtual clock of a vCPU, published to the guest
+ *
+ * The first 32 bytes are the layout of the KVM pvclock_vcpu_time_info,
+ * the nanoseconds at a guest TSC t are:
+ *
+ *   system_time + (((t - tsc_timestamp) << tsc_shift) * tsc_to_system_mul) >> 32
+ *
+ * with a right shift for a negative tsc_shift. The guest enables it by
+ * writing the guest physical address of the 64-byte aligned area, bit 0
+ * set, to MSR_ACRN_PV_CLOCK, available if GUEST_CAPS_PV_CLOCK is reported
+ * in CPUID leaf 0x40000001. The hypervisor updates the area when it is
+ * enabled and when the TSC offset of the vCPU changes, version is odd
+ * while the other fields change.
+ */
+struct acrn_pvclock {
+	/** odd while the area is being updated */
+	uint32_t version;
+
+	/** Reserved for future use*/
+	uint32_t pad0;
+
+	/** guest TSC of system_time */
+	uint64_t tsc_timestamp;
+
+	/** nanoseconds of the guest TSC at tsc_timestamp */
+	uint64_t system_time;
+
+	/** nanoseconds per 2^32 (shifted) TSC cycles */
+	uint32_t tsc_to_system_mul;
+
+	/** shift of the TSC cycles, before tsc_to_system_mul */
+	int8_t tsc_shift;
+
+	/** ACRN_PVCLOCK_TSC_STABLE */
+	uint8_t flags;
+
+	/** Reserved for future use*/
+	uint8_t pad1[2];
+
+	/** TSC frequency in kHz, as in CPUID leaf 0x40000010 */
+	uint32_t tsc_khz;
+
+	/** Reserved for future use*/
+	uint32_t pad2;
+
+	/** guest TSC minus host TSC, the VMCS TSC offset of the vCPU */
+	uint64_t tsc_offset;
+
+	/** Reserved for future use*/
+	uint64_t reserved[2];
+} __aligned(64);
+
+/** max number of doorbells per VM, index of the bit in the pending bitmap */
+#define ACRN_DOORBELL_MAX		64U
+
+#define ACRN_DOORBELL_FLAG_PIO		(1U << 0U)
+#define ACRN_DOORBELL_FLAG_DATAMATCH	(1U << 1U)
+#define ACRN_DOORBELL_FLAG_DEASSIGN	(1U << 2U)
+
+/**
+ * @brief Info to register a doorbell of a VM
+ *
+ * A guest write of len bytes at addr, with the value data if
+ * ACRN_DOORBELL_FLAG_DATAMATCH is set, is completed by the hypervisor
+ * right away. It only sets the bit index in the doorbell pending bitmap of
+ * the VM and fires the upcall to SOS, see HC_VM_GET_DOORBELLS.
+ */
+struct acrn_doorbell {
+	/** guest physical address or port of the doorbell */
+	uint64_t addr;
+
+	/** value to match if ACRN_DOORBELL_FLAG_DATAMATCH is set */
+	uint64_t data;
+
+	/** access size in bytes */
+	uint32_t len;
+
+	/** ACRN_DOORBELL_FLAG_xxx */
+	uint32_t flags;
+
+	/** index of the doorbell, less than ACRN_DOORBELL_MAX */
+	uint16_t index;
+
+	/** Reserved for future use*/
+	uint16_t reserved[3];
+} __aligned(8);
+
+/** number of entries of struct acrn_coalesced_mmio_ring, which spans one page */
+#define ACRN_COALESCED_MMIO_MAX		169U
+
+/** max number of coalesced MMIO zones per VM */
+#define ACRN_COALESCED_MMIO_ZONES	16U
+
+#define ACRN_COALESCED_MMIO_FLAG_DEASSIGN	(1U << 0U)
+
+/**
+ * @brief A guest MMIO write recorded in the coalesced MMIO ring
+ */
+struct acrn_coalesced_mmio_entry {
+	/** guest physical address of the write */
+	uint64_t address;
+
+	/** value written */
+	uint64_t value;
+
+	/** access size in bytes */
+	uint32_t size;
+
+	/** Reserved for future use*/
+	uint32_t reserved;
+} __aligned(8);
+
+/**
+ * @brief Ring of the guest MMIO writes deferred to the device model
+ *
+ * The hypervisor appends the writes to the coalesced MMIO zones of the VM
+ * and resumes the guest right away, the ring is full when last + 1 equals
+ * first. The device model consumes the entries from first before it
+ * emulates any other request of the VM.
+ */
+struct acrn_coalesced_mmio_ring {
+	/** index of the first entry not consumed, updated by the device model */
+	uint32_t first;
+
+	/** index of the next entry to fill, updated by the hypervisor */
+	uint32_t last;
+
+	/** Reserved for future use*/
+	uint32_t reserved[6];
+
+	struct acrn_coalesced_mmio_entry entries[ACRN_COALESCED_MMIO_MAX];
+} __aligned(4096);
+
+/**
+ * @brief Info to register a coalesced MMIO zone of a VM
+ */
+struct acrn_coalesced_mmio_zone {
+	/** guest physical address of the zone */
+	uint64_t addr;
+
+	/** size of the zone in bytes */
+	uint32_t size;
+
+	/** ACRN_COALESCED_MMIO_FLAG_xxx */
+	uint32_t flags;
+} __aligned(8);
+
+/** number of PIT channels in struct acrn_timer_counters */
+#define ACRN_PIT_CHANNELS	3U
+
+/**
+ * @brief The HPET main counter, published by the device model
+ *
+ * The counter reads count + ticks elapsed since tsc at freq Hz while
+ * enabled, count otherwise, truncated to 32 bits. The device model makes
+ * seq odd while it updates the other fields.
+ */
+struct acrn_hpet_counter {
+	/** even when the fields below are consistent */
+	uint32_t seq;
+
+	/** non-zero if the hypervisor may serve the counter reads */
+	uint32_t valid;
+
+	/** guest physical address of the HPET registers */
+	uint64_t base;
+
+	/** counter frequency in Hz */
+	uint64_t freq;
+
+	/** SOS TSC when the counter read count */
+	uint64_t tsc;
+
+	/** counter value at tsc */
+	uint64_t count;
+
+	/** non-zero if the counter is running */
+	uint32_t enabled;
+
+	/** Reserved for future use*/
+	uint32_t reserved;
+} __aligned(8);
+
+/**
+ * @brief A PIT channel counter, published by the device model
+ *
+ * The channel counts down from initial in the 8254 mode mode, at 1193182 Hz
+ * since tsc. The hypervisor only serves the counter latch commands of the
+ * channel and the reads of the latched count.
+ */
+struct acrn_pit_counter {
+	/** even when the fields below are consistent */
+	uint32_t seq;
+
+	/** non-zero if the hypervisor may latch the counter */
+	uint32_t valid;
+
+	/** 8254 counter mode, 0 to 4 */
+	uint32_t mode;
+
+	/** initial count, 1 to 0x10000 */
+	uint32_t initial;
+
+	/** SOS TSC when the count was loaded */
+	uint64_t tsc;
+} __aligned(8);
+
+/**
+ * @brief Timer counters of a VM read in the hypervisor, without a round
+ * trip to the device model
+ *
+ * One page of SOS memory, set up with HC_SET_TIMER_COUNTERS. The
+ * configuration writes still go to the device model, which publishes the
+ * new state of the counters here.
+ */
+struct acrn_timer_counters {
+	/** TSC frequency in kHz, filled in by the hypervisor */
+	uint32_t tsc_khz;
+
+	/** Reserved for future use*/
+	uint32_t reserved;
+
+	struct acrn_hpet_counter hpet;
+
+	struct acrn_pit_counter pit[ACRN_PIT_CHANNELS];
+} __aligned(4096);
+
+/** max number of emulated MSI-X tables served by the hypervisor per VM */
+#define ACRN_EMUL_MSIX_TABLES	16U
+
+/** max number of entries of such a table, it fits in one page */
+#define ACRN_EMUL_MSIX_ENTRIES	256U
+
+#define ACRN_EMUL_MSIX_FLAG_DEASSIGN	(1U << 0U)
+
+/** the pages hold the MSI-X table of the passthrough device virt_bdf */
+#define ACRN_EMUL_MSIX_FLAG_PTDEV	(1U << 1U)
+
+/**
+ * @brief Info to register the MSI-X table of a device emulated by the
+ * device model
+ *
+ * The device model keeps the table in a page of SOS memory. With the
+ * table registered, the hypervisor serves the guest accesses to the BAR
+ * holding the table and the PBA from that page, and the device model
+ * reads the entries from it to raise the vectors.
+ *
+ * With ACRN_EMUL_MSIX_FLAG_PTDEV, addr and size are the page aligned range
+ * of the BAR of a passthrough device holding its MSI-X table, and only
+ * virt_bdf and flags are used otherwise. The hypervisor emulates the table
+ * accesses and forwards the other accesses to those pages, a PBA or the
+ * registers of the device sharing the pages, to the physical BAR.
+ */
+struct acrn_emul_msix {
+	/** guest physical address of the BAR holding the table and the PBA */
+	uint64_t addr;
+
+	/** size of the BAR in bytes */
+	uint64_t size;
+
+	/** page holding the table, the SOS kernel passes it to the hypervisor
+	 * as a guest physical address of SOS */
+	uint64_t table_buf;
+
+	/** number of entries in the table, at most ACRN_EMUL_MSIX_ENTRIES */
+	uint32_t table_count;
+
+	/** offset of the PBA in the BAR */
+	uint32_t pba_offset;
+
+	/** size of the PBA in bytes */
+	uint32_t pba_size;
+
+	/** ACRN_EMUL_MSIX_FLAG_xxx */
+	uint32_t flags;
+
+	/** virtual BDF of the device, with ACRN_EMUL_MSIX_FLAG_PTDEV */
+	uint16_t virt_bdf;
+
+	/** Reserved */
+	uint16_t reserved[3];
+} __aligned(8);
+
+/** registers of the BAR0 of an ivshmem device */
+#define ACRN_IVSHMEM_INTR_MASK		0x00U
+#define ACRN_IVSHMEM_INTR_STATUS	0x04U
+#define ACRN_IVSHMEM_IVPOSITION		0x08U
+#define ACRN_IVSHMEM_DOORBELL		0x0cU
+#define ACRN_IVSHMEM_REGS_SIZE		0x100U
+
+/** number of MSI-X vectors of an ivshmem device */
+#define ACRN_IVSHMEM_VECTORS		8U
+
+#define ACRN_IVSHMEM_QUERY		0U
+#define ACRN_IVSHMEM_ATTACH		1U
+#define ACRN_IVSHMEM_DETACH		2U
+
+/**
+ * @brief Info to attach an ivshmem device of a post-launched VM
+ *
+ * The device is emulated by the device model, its shared memory BAR maps a
+ * region of the inter-VM shared memory of the hypervisor. A guest write of
+ * (peer << 16) | vector to the doorbell register is served by the
+ * hypervisor, it raises the MSI-X vector of the peer with that IVPosition
+ * in the region. The MSI-X table of the device is the one registered with
+ * HC_VM_SET_EMUL_MSIX at msix_gpa.
+ *
+ * ACRN_IVSHMEM_QUERY returns the size of the region, ACRN_IVSHMEM_ATTACH
+ * maps it at shm_gpa and returns the IVPosition of the VM, again to follow
+ * the BARs when the guest moves them. ACRN_IVSHMEM_DETACH unmaps it.
+ */
+struct acrn_ivshmem {
+	/** ACRN_IVSHMEM_xxx */
+	uint32_t op;
+
+	/** region of the inter-VM shared memory */
+	uint16_t region_id;
+
+	/** output: IVPosition of the VM in the region */
+	uint16_t ivpos;
+
+	/** output: size of the region in bytes */
+	uint64_t size;
+
+	/** guest physical address of the shared memory BAR */
+	uint64_t shm_gpa;
+
+	/** guest physical address of the registers BAR */
+	uint64_t regs_gpa;
+
+	/** guest physical address of the MSI-X table BAR */
+	uint64_t msix_gpa;
+} __aligned(8);
+
+/** number of devices in struct acrn_pci_cfg_shadow */
+#define ACRN_PCI_CFG_SHADOW_DEVS	48U
+
+/** bytes of the configuration space of a device in the shadow */
+#define ACRN_PCI_CFG_SHADOW_SIZE	64U
+
+/** the BDFs not in struct acrn_pci_cfg_shadow have no device */
+#define ACRN_PCI_CFG_SHADOW_COMPLETE	(1U << 0U)
+
+/**
+ * @brief The read-only configuration header of a PCI device
+ */
+struct acrn_pci_cfg_shadow_dev {
+	/** bus << 8 | device << 3 | function */
+	uint16_t bdf;
+
+	/** Reserved for future use*/
+	uint16_t reserved[3];
+
+	/** bit n is set if byte n of cfg is read-only */
+	uint64_t ro_mask;
+
+	/** the start of the configuration space */
+	uint8_t cfg[ACRN_PCI_CFG_SHADOW_SIZE];
+} __aligned(8);
+
+/**
+ * @brief Shadow of the read-only PCI configuration space of a VM
+ *
+ * Pushed by the device model with HC_SET_PCI_CFG_SHADOW once its PCI
+ * devices are set up. The hypervisor serves the guest reads of the
+ * read-only bytes, through port CFC or the ECAM window, without a round
+ * trip to the device model.
+ */
+struct acrn_pci_cfg_shadow {
+	/** ACRN_PCI_CFG_SHADOW_* */
+	uint32_t flags;
+
+	/** number of the valid entries in devs */
+	uint32_t num_devs;
+
+	/** guest physical address of the ECAM window, 0 if none */
+	uint64_t ecfg_base;
+
+	/** size of the ECAM window */
+	uint64_t ecfg_size;
+
+	struct acrn_pci_cfg_shadow_dev devs[ACRN_PCI_CFG_SHADOW_DEVS];
+} __aligned(8);
+
+/** set the CLOS of all the vCPUs of the VM */
+#define ACRN_CLOS_ALL_VCPUS	0xffffU
+
+/**
+ * @brief The Class of Service of the vCPUs of a VM
+ *
+ * the parameter of HC_VM_SET_CLOS
+ */
+struct acrn_vm_clos {
+	/** vCPU ID, or ACRN_CLOS_ALL_VCPUS */
+	uint16_t vcpu_id;
+
+	/** the CLOS loaded to IA32_PQR_ASSOC while the vCPUs run */
+	uint16_t clos;
+
+	/** Reserved for future use*/
+	uint32_t reserved;
+} __aligned(8);
+
+/** the value is a cache capacity bitmask of the L2 or L3 CAT */
+#define ACRN_CLOS_CACHE		0U
+
+/** the value is a Memory Bandwidth Allocation throttling delay */
+#define ACRN_CLOS_MBA		1U
+
+/**
+ * @brief The resource allocation of a Class of Service
+ *
+ * the parameter of HC_SET_CLOS_MASK
+ */
+struct acrn_clos_mask {
+	/** the CLOS */
+	uint16_t clos;
+
+	/** ACRN_CLOS_CACHE or ACRN_CLOS_MBA */
+	uint16_t type;
+
+	/** Reserved for future use*/
+	uint32_t reserved;
+
+	/** the capacity bitmask, or the throttling delay */
+	uint64_t value;
+} __aligned(8);
+
+/** max number of registers in struct acrn_pio_regs */
+#define ACRN_PIO_REGS_MAX	64U
+
+/** the guest reads of the register return value */
+#define ACRN_PIO_REG_FLAG_READ		(1U << 0U)
+
+/** the guest writes to the register latch their wmask bits in value */
+#define ACRN_PIO_REG_FLAG_LATCH		(1U << 1U)
+
+/**
+ * @brief A port I/O register served by the hypervisor
+ */
+struct acrn_pio_reg {
+	/** I/O port of the register */
+	uint16_t port;
+
+	/** access size in bytes, 1, 2 or 4 */
+	uint16_t size;
+
+	/** ACRN_PIO_REG_FLAG_xxx, 0 if the entry is not used */
+	uint32_t flags;
+
+	/** value of the register */
+	uint32_t value;
+
+	/** bits of value written by a guest write, with ACRN_PIO_REG_FLAG_LATCH */
+	uint32_t wmask;
+} __aligned(8);
+
+/**
+ * @brief Simple port I/O registers of a VM, served by the hypervisor
+ * without a round trip to the device model
+ *
+ * One page of SOS memory, set up with HC_SET_PIO_REGS. A guest access of
+ * the size of a register is completed by the hypervisor as the flags of
+ * the register say, any other access goes to the device model. The device
+ * model keeps value of the read registers up to date, and only reads
+ * value of the latch ones.
+ */
+struct acrn_pio_regs {
+	/** number of the entries of regs the hypervisor looks up */
+	uint32_t num_regs;
+
+	/** Reserved for future use*/
+	uint32_t reserved[3];
+
+	struct acrn_pio_reg regs[ACRN_PIO_REGS_MAX];
+} __aligned(4096);
+
+/** size of the register file of the MC146818 RTC, the NVRAM included */
+#define ACRN_VRTC_CMOS_SIZE	128U
+
+/**
+ * @brief The RTC of a VM, emulated by the hypervisor
+ *
+ * A page of the device model, HC_SET_VRTC hands it over to the hypervisor
+ * before the VM starts. The hypervisor takes the NVRAM contents and the RTC
+ * time from it, and keeps the NVRAM part of cmos up to date with the guest
+ * writes for the device model to save it, the other bytes are left alone.
+ */
+struct acrn_vrtc {
+	/** RTC time the VM starts at, in seconds since the epoch */
+	uint64_t rtc_time;
+
+	/** Reserved for future use*/
+	uint64_t reserved[7];
+
+	/** register file, the hypervisor keeps the NVRAM part of it */
+	uint8_t cmos[ACRN_VRTC_CMOS_SIZE];
+} __aligned(4096);
 
 /**
  * @}
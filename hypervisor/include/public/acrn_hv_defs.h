@@ -29,6 +29,7 @@
 #define HC_SOS_OFFLINE_CPU          BASE_HC_ID(HC_ID, HC_ID_GEN_BASE + 0x01UL)
 #define HC_SET_CALLBACK_VECTOR      BASE_HC_ID(HC_ID, HC_ID_GEN_BASE + 0x02UL)
 #define HC_GET_PLATFORM_INFO        BASE_HC_ID(HC_ID, HC_ID_GEN_BASE + 0x03UL)
+#define HC_SET_CLOS_MASK            BASE_HC_ID(HC_ID, HC_ID_GEN_BASE + 0x04UL)
 
 /* VM management */
 #define HC_ID_VM_BASE               0x10UL
@@ -39,23 +40,43 @@
 #define HC_CREATE_VCPU              BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x04UL)
 #define HC_RESET_VM                 BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x05UL)
 #define HC_SET_VCPU_REGS            BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x06UL)
+#define HC_VM_GET_EXIT_STATS        BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x07UL)
+#define HC_VM_SET_VCPU_STATS        BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x08UL)
+#define HC_VM_SET_CLOS              BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x09UL)
+#define HC_VM_IVSHMEM               BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x0AUL)
+#define HC_REMOVE_VCPU              BASE_HC_ID(HC_ID, HC_ID_VM_BASE + 0x0BUL)
 
 /* IRQ and Interrupts */
 #define HC_ID_IRQ_BASE              0x20UL
 #define HC_INJECT_MSI               BASE_HC_ID(HC_ID, HC_ID_IRQ_BASE + 0x03UL)
 #define HC_VM_INTR_MONITOR          BASE_HC_ID(HC_ID, HC_ID_IRQ_BASE + 0x04UL)
 #define HC_SET_IRQLINE              BASE_HC_ID(HC_ID, HC_ID_IRQ_BASE + 0x05UL)
+#define HC_SEND_IPI_MASK            BASE_HC_ID(HC_ID, HC_ID_IRQ_BASE + 0x06UL)
+#define HC_SET_PV_EOI               BASE_HC_ID(HC_ID, HC_ID_IRQ_BASE + 0x07UL)
+#define HC_INJECT_INTR_BATCH        BASE_HC_ID(HC_ID, HC_ID_IRQ_BASE + 0x08UL)
 
 /* DM ioreq management */
 #define HC_ID_IOREQ_BASE            0x30UL
 #define HC_SET_IOREQ_BUFFER         BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x00UL)
 #define HC_NOTIFY_REQUEST_FINISH    BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x01UL)
+#define HC_NOTIFY_REQUEST_FINISH_BATCH BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x02UL)
+#define HC_VM_SET_DOORBELL          BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x03UL)
+#define HC_VM_GET_DOORBELLS         BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x04UL)
+#define HC_SET_COALESCED_MMIO_RING  BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x05UL)
+#define HC_VM_SET_COALESCED_MMIO_ZONE BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x06UL)
+#define HC_SET_TIMER_COUNTERS       BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x07UL)
+#define HC_SET_PCI_CFG_SHADOW       BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x08UL)
+#define HC_VM_SET_EMUL_MSIX         BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x09UL)
+#define HC_SET_PIO_REGS             BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x0AUL)
+#define HC_SET_VRTC                 BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x0BUL)
 
 /* Guest memory management */
 #define HC_ID_MEM_BASE              0x40UL
 #define HC_VM_GPA2HPA               BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x01UL)
 #define HC_VM_SET_MEMORY_REGIONS    BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x02UL)
 #define HC_VM_WRITE_PROTECT_PAGE    BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x03UL)
+#define HC_VM_SET_DIRTY_LOG         BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x04UL)
+#define HC_VM_GET_DIRTY_LOG         BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x05UL)
 
 /* PCI assignment*/
 #define HC_ID_PCI_BASE              0x50UL
@@ -71,6 +92,7 @@
 #define HC_SETUP_HV_NPK_LOG         BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x01UL)
 #define HC_PROFILING_OPS            BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x02UL)
 #define HC_GET_HW_INFO              BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x03UL)
+#define HC_SETUP_TRACE_FILTER       BASE_HC_ID(HC_ID, HC_ID_DBG_BASE + 0x04UL)
 
 /* Trusty */
 #define HC_ID_TRUSTY_BASE           0x70UL
@@ -172,6 +194,34 @@ struct wp_data {
 	uint64_t gpa;
 } __aligned(8);
 
+/* Harvest the accessed pages instead of the dirty ones */
+#define ACRN_DIRTY_LOG_ACCESSED		(1U << 0U)
+
+/**
+ * @brief Info to harvest the dirty pages of a guest memory range
+ *
+ * the parameter for HC_VM_GET_DIRTY_LOG hypercall
+ */
+struct acrn_dirty_log {
+	/** the start guest physical address of the range, 4K aligned */
+	uint64_t gpa;
+
+	/** the size of the range, 4K aligned */
+	uint64_t size;
+
+	/** the SOS guest physical address of the bitmap, one bit per 4K
+	 *  page of the range, set if the page has been written (or accessed
+	 *  with ACRN_DIRTY_LOG_ACCESSED) since the previous harvest
+	 */
+	uint64_t bitmap_gpa;
+
+	/** ACRN_DIRTY_LOG_* flags */
+	uint32_t flags;
+
+	/** Reserved */
+	uint32_t reserved;
+} __aligned(8);
+
 /**
  * Setup parameter for share buffer, used for HC_SETUP_SBUF hypercall
  */
@@ -189,6 +239,31 @@ struct sbuf_setup_param {
 	uint64_t gpa;
 } __aligned(8);
 
+#define ACRN_TRACE_FILTER_MAX		16U
+#define ACRN_TRACE_FILTER_ALL_CPUS	0xffffU
+
+/**
+ * @brief Info to filter and sample the trace events of a pcpu
+ *
+ * the parameter for HC_SETUP_TRACE_FILTER hypercall
+ */
+struct acrn_trace_filter {
+	/** physical cpu id, ACRN_TRACE_FILTER_ALL_CPUS for all of them */
+	uint16_t pcpu_id;
+
+	/** Reserved */
+	uint16_t reserved;
+
+	/** number of events, 0 to trace all the events again */
+	uint32_t nr_events;
+
+	/** the events traced, the others are dropped */
+	uint32_t evid[ACRN_TRACE_FILTER_MAX];
+
+	/** 1 in rate[i] of the evid[i] events is traced, 0 or 1 for all */
+	uint32_t rate[ACRN_TRACE_FILTER_MAX];
+} __aligned(8);
+
 /**
  * @brief Info to setup the hypervisor NPK log
  *
@@ -349,7 +424,8 @@ enum profiling_cmd_type {
 	PROFILING_CONFIG_PMI,
 	PROFILING_CONFIG_VMSWITCH,
 	PROFILING_GET_PCPUID,
-	PROFILING_GET_STATUS
+	PROFILING_GET_STATUS,
+	PROFILING_CONFIG_SAMPLING
 };
 
 #endif /* ACRN_HV_DEFS_H */
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Only compiled to assembly: each LAYOUT() leaves a "->" line with the
+ * offset, the size and the name of a field of struct per_cpu_region, the
+ * Makefile turns them into per_cpu_layout.txt, with the cache lines.
+ */
+#include <per_cpu.h>
+
+#define LAYOUT(field)							\
+	asm volatile ("\n->" #field " %c0 %c1"				\
+		: : "i" (offsetof(struct per_cpu_region, field)),	\
+		"i" (sizeof(((struct per_cpu_region *)0)->field)))
+
+#define SECTION(name)	asm volatile ("\n->=" name " 0 0")
+
+void per_cpu_layout(void);
+
+void per_cpu_layout(void)
+{
+	LAYOUT(vmxon_region);
+
+	SECTION("hot");
+	LAYOUT(vmcs_vcpu);
+	LAYOUT(loaded_vcpu);
+	LAYOUT(vcpu);
+	LAYOUT(ever_run_vcpu);
+	LAYOUT(pqr_assoc);
+	LAYOUT(softirq_pending);
+	LAYOUT(softirq_servicing);
+	LAYOUT(notify_deferred);
+	LAYOUT(notify_vector);
+	LAYOUT(notify_pcpus);
+	LAYOUT(idle_poll_cycles);
+	LAYOUT(softirq_stats);
+#ifdef HV_DEBUG
+	LAYOUT(trace_tsc);
+	LAYOUT(trace_nr);
+	LAYOUT(sbuf);
+#endif
+#ifdef STACK_PROTECTOR
+	LAYOUT(stk_canary);
+#endif
+
+	SECTION("remote");
+	LAYOUT(sched_ctx);
+	LAYOUT(pcpu_flag);
+	LAYOUT(shutdown_vm_id);
+	LAYOUT(boot_state);
+	LAYOUT(smp_call_info);
+
+	SECTION("warm");
+	LAYOUT(cpu_timers);
+	LAYOUT(softirq_dev_pending);
+	LAYOUT(softirq_dev_draining);
+	LAYOUT(spurious);
+	LAYOUT(irq_count);
+
+	SECTION("cold");
+	LAYOUT(lapic_id);
+	LAYOUT(lapic_ldr);
+	LAYOUT(topo);
+	LAYOUT(tsc_suspend);
+	LAYOUT(idle);
+	LAYOUT(gdt);
+	LAYOUT(tss);
+#ifdef HV_DEBUG
+	LAYOUT(logbuf);
+	LAYOUT(npk_log_ref);
+#endif
+#ifdef PROFILING_ON
+	LAYOUT(profiling_info);
+#endif
+	LAYOUT(mc_stack);
+	LAYOUT(df_stack);
+	LAYOUT(sf_stack);
+	LAYOUT(stack);
+}
@@ -9,6 +9,10 @@
 #include <acrn_common.h>
 #include <vcpu.h>
 #include <trusty.h>
+#include <trampoline.h>
+#include <mmu.h>
+#include <softirq.h>
+#include <per_cpu.h>
 
 #define CAT__(A,B) A ## B
 #define CAT_(A,B) CAT__(A,B)
@@ -20,6 +24,11 @@ typedef int32_t CAT_(CTA_DummyType,__LINE__)[(expr) ? 1 : -1]
 #error "VM number or VCPU number are too big"
 #endif
 
+/* The trampoline lists the stack of each pCPU */
+#if (CONFIG_MAX_PCPU_NUM > TRAMPOLINE_MAX_PCPUS)
+#error "Too many pCPUs for the trampoline"
+#endif
+
 /* Build time sanity checks to make sure hard-coded offset
 *  is matching the actual offset!
 */
@@ -69,3 +78,12 @@ CTASSERT((sizeof(struct trusty_startup_param)
 		+ sizeof(struct trusty_key_info)) < 0x1000U);
 CTASSERT(NR_WORLD == 2);
 CTASSERT(sizeof(struct vhm_request) == (4096U/VHM_REQUEST_MAX));
+/* the header, the payload, the state and dm_polling not sharing a cache line */
+CTASSERT(offsetof(struct vhm_request, reqs) == CACHE_LINE_SIZE);
+CTASSERT(offsetof(struct vhm_request, processed) / CACHE_LINE_SIZE == 2U);
+CTASSERT(offsetof(struct vhm_request, dm_polling) == (3U * CACHE_LINE_SIZE));
+/* the softirq counters fit in the per-vCPU stats page */
+CTASSERT(NR_SOFTIRQS <= ACRN_SOFTIRQ_STATS);
+/* the per-CPU fields of the VM exit path stay on four cache lines */
+CTASSERT((offsetof(struct per_cpu_region, sched_ctx) - offsetof(struct per_cpu_region, vmcs_vcpu))
+	<= (4U * CACHE_LINE_SIZE));
@@ -8,4 +8,5 @@
 #include <acrn_hv_defs.h>
 
 void npk_log_setup(__unused struct hv_npk_log_param *param) {}
-void npk_log_write(__unused const char *buf, __unused size_t len) {}
+void npk_log_write(__unused const char *buf, __unused size_t len, __unused bool binary) {}
+void npk_log_flush(void) {}
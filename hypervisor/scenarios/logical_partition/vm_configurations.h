@@ -13,6 +13,10 @@
 /* Bits mask of guest flags that can be programmed by device model. Other bits are set by hypervisor only */
 #define DM_OWNED_GUEST_FLAG_MASK	0UL
 
+/* Bits mask of guest flags any VM of this scenario may have, and its number of SOS VM */
+#define SCENARIO_GUEST_FLAGS		(DM_OWNED_GUEST_FLAG_MASK | GUEST_FLAG_RT | GUEST_FLAG_LAPIC_PASSTHROUGH)
+#define SCENARIO_SOS_VM_NUM		0U
+
 #define CONFIG_MAX_VM_NUM	2U
 
 /* The VM CONFIGs like:
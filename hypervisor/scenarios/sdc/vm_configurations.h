@@ -15,6 +15,10 @@
 #define DM_OWNED_GUEST_FLAG_MASK	(GUEST_FLAG_SECURE_WORLD_ENABLED | GUEST_FLAG_LAPIC_PASSTHROUGH | \
 						GUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING)
 
+/* Bits mask of guest flags any VM of this scenario may have, and its number of SOS VM */
+#define SCENARIO_GUEST_FLAGS		(DM_OWNED_GUEST_FLAG_MASK | GUEST_FLAG_HIGHEST_SEVERITY)
+#define SCENARIO_SOS_VM_NUM		1U
+
 #define SOS_VM_BOOTARGS			SOS_ROOTFS	\
 					"rw rootwait "	\
 					"console=tty0 " \
@@ -409,6 +409,15 @@ def set_dm_pt(names, sel, vmid, config):
             sel.bdf["nvme"][vmid][3:5], sel.bdf["nvme"][vmid][6:7]), file=config)
 
 
+def virtio_poll_interval(dm, vmid, default):
+    """ the --virtio_poll interval of the launch xml, or the default of the uos type """
+    interval = dm['virtio_poll'].get(vmid, '').strip()
+    if interval:
+        return interval
+
+    return default
+
+
 def dm_arg_set(names, sel, dm, vmid, config):
 
     uos_type = names['uos_types'][vmid]
@@ -457,14 +466,16 @@ def dm_arg_set(names, sel, dm, vmid, config):
         print("   -k /usr/lib/kernel/default-iot-lts2018-preempt-rt \\", file=config)
         print("   --lapic_pt \\", file=config)
         print("   --rtvm \\", file=config)
-        print("   --virtio_poll 1000000 \\", file=config)
+        print("   --virtio_poll {} \\".format(virtio_poll_interval(dm, vmid, launch_cfg_lib.RT_VIRTIO_POLL)),
+              file=config)
         print("   --pm_notify_channel uart --pm_by_vuart tty,/dev/ttyS1 \\", file=config)
 
     # vxworks
     if uos_type == "VXWORKS":
         print("acrn-dm -A -m $mem_size -s 0:0,hostbridge -U {} \\".format(scenario_uuid[vmid + sos_vmid]), file=config)
         print("   -s {},virtio-blk,./VxWorks.img \\".format(launch_cfg_lib.virtual_dev_slot("virtio-blk")), file=config)
-        print("   --virtio_poll 1000000 \\", file=config)
+        print("   --virtio_poll {} \\".format(virtio_poll_interval(dm, vmid, launch_cfg_lib.RT_VIRTIO_POLL)),
+              file=config)
         print("   --lapic_pt \\", file=config)
 
     # zephyr
@@ -478,6 +489,19 @@ def dm_arg_set(names, sel, dm, vmid, config):
         print('   -s 2,pci-gvt -G "$3"  \\', file=config)
         print("   -s {},virtio-blk,./win10-ltsc.img \\".format(launch_cfg_lib.virtual_dev_slot("virtio-blk")), file=config)
 
+    # tuning of the acrn-dm from the launch xml, the RT UOS types poll their virtqueues already
+    if uos_type not in ("PREEMPT-RT LINUX", "VXWORKS") and virtio_poll_interval(dm, vmid, None):
+        print("   --virtio_poll {} \\".format(virtio_poll_interval(dm, vmid, None)), file=config)
+    if dm['ioreq_poll'].get(vmid):
+        print("   --ioreq_poll {} \\".format(dm['ioreq_poll'][vmid].strip()), file=config)
+    if dm['mem_backend'].get(vmid):
+        print("   --mem_backend {} \\".format(dm['mem_backend'][vmid].strip()), file=config)
+
+    # guest memory from the NUMA node of the pcpus
+    numa_node = launch_cfg_lib.get_placement_node(vmid + sos_vmid)
+    if numa_node is not None:
+        print("   --mem_node {} \\".format(numa_node), file=config)
+
    # vbootloader of ovmf
     #if uos_type != "PREEMPT-RT LINUX" and dm['vbootloader'][vmid] == "ovmf":
     if dm['vbootloader'][vmid] == "ovmf":
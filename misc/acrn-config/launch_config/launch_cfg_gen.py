@@ -47,6 +47,7 @@ def get_launch_item_values(board_info):
     launch_item_values["uos,vbootloader"] = launch_cfg_lib.BOOT_TYPE
     launch_item_values['uos,console_type'] = launch_cfg_lib.REDIRECT_CONSOLE
     launch_item_values['uos,gvt_args'] = launch_cfg_lib.GVT_ARGS
+    launch_item_values['uos,mem_backend'] = launch_cfg_lib.MEM_BACKEND
 
     return launch_item_values
 
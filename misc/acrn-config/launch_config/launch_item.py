@@ -22,6 +22,9 @@ class AcrnDmArgs:
         self.args["rootfs_dev"] = launch_cfg_lib.get_sub_tree_tag(self.launch_info, "rootfs_dev")
         self.args["vbootloader"] = launch_cfg_lib.get_sub_tree_tag(self.launch_info, "vbootloader")
         self.args["console_type"] = launch_cfg_lib.get_sub_tree_tag(self.launch_info, "console_type")
+        self.args["virtio_poll"] = launch_cfg_lib.get_sub_tree_tag(self.launch_info, "virtio_poll")
+        self.args["ioreq_poll"] = launch_cfg_lib.get_sub_tree_tag(self.launch_info, "ioreq_poll")
+        self.args["mem_backend"] = launch_cfg_lib.get_sub_tree_tag(self.launch_info, "mem_backend")
 
     def check_item(self):
         rootfs = launch_cfg_lib.get_rootdev_info(self.board_info)
@@ -31,6 +34,9 @@ class AcrnDmArgs:
         launch_cfg_lib.args_aval_check(self.args["vbootloader"], "vbootloader", launch_cfg_lib.BOOT_TYPE)
         launch_cfg_lib.args_aval_check(self.args["console_type"], "console_type", launch_cfg_lib.REDIRECT_CONSOLE)
         launch_cfg_lib.args_aval_check(self.args["rootfs_dev"], "rootfs_dev", rootfs)
+        launch_cfg_lib.args_num_check(self.args["virtio_poll"], "virtio_poll")
+        launch_cfg_lib.args_num_check(self.args["ioreq_poll"], "ioreq_poll")
+        launch_cfg_lib.mem_backend_check(self.args["mem_backend"], "mem_backend")
 
 
 class AvailablePthru():
@@ -14,7 +14,8 @@ SOURCE_PATH = os.path.join(os.path.dirname(os.path.abspath(__file__)), '../../..
 HV_LICENSE_FILE = SOURCE_PATH + 'misc/acrn-config/library/hypervisor_license'
 
 
-PY_CACHES = ["__pycache__", "../board_config/__pycache__", "../scenario_config/__pycache__"]
+PY_CACHES = ["__pycache__", "../board_config/__pycache__", "../scenario_config/__pycache__",
+             "../tuning_config/__pycache__"]
 BIN_LIST = ['git']
 GUEST_FLAG = ["0UL", "GUEST_FLAG_SECURE_WORLD_ENABLED", "GUEST_FLAG_LAPIC_PASSTHROUGH",
               "GUEST_FLAG_IO_COMPLETION_POLLING", "GUEST_FLAG_CLOS_REQUIRED",
@@ -618,3 +619,58 @@ def get_max_clos(board_file):
             clos_max = int(line.split(':')[1])
 
     return (cache_support, clos_max)
+
+
+def get_cache_domains(board_file):
+    """
+    Parse the processors sharing each cache
+    :param board_file: it is a file what contains board information for script to read from
+    :return: table of cache level:list of processor lists, one list per cache
+    """
+    cache_dic = {}
+    cache_lines = get_board_info(board_file, "<CPU_CACHE_INFO>", "</CPU_CACHE_INFO>")
+    if not cache_lines:
+        return cache_dic
+
+    for line in cache_lines:
+        if ':' not in line:
+            continue
+        level = line.split(':')[0].strip().lstrip('L')
+        cpus = [cpu.strip() for cpu in line.split(':')[1].split(',') if cpu.strip()]
+        cache_dic.setdefault(level, []).append(cpus)
+
+    return cache_dic
+
+
+def get_numa_nodes(board_file):
+    """
+    Parse the processors of each NUMA node
+    :param board_file: it is a file what contains board information for script to read from
+    :return: table of node id:list of processors
+    """
+    node_dic = {}
+    node_lines = get_board_info(board_file, "<NUMA_NODE_INFO>", "</NUMA_NODE_INFO>")
+    if not node_lines:
+        return node_dic
+
+    for line in node_lines:
+        if ':' not in line:
+            continue
+        node = line.split(':')[0].strip()
+        node_dic[node] = [cpu.strip() for cpu in line.split(':')[1].split(',') if cpu.strip()]
+
+    return node_dic
+
+
+def get_cpus_node(board_file, cpus):
+    """
+    Get the NUMA node all the processors belong to
+    :param board_file: it is a file what contains board information for script to read from
+    :param cpus: list of processors
+    :return: node id, or None if the processors are on several nodes or the node is unknown
+    """
+    for (node, node_cpus) in get_numa_nodes(board_file).items():
+        if cpus and set(cpus) <= set(node_cpus):
+            return node
+
+    return None
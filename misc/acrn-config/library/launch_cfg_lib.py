@@ -18,6 +18,9 @@ RTOS_TYPE = ['no', 'Soft RT', 'Hard RT']
 REDIRECT_CONSOLE = ['com1(ttyS0)', 'virtio-console(hvc0)']
 UOS_TYPES = ['CLEARLINUX', 'ANDROID', 'ALIOS', 'PREEMPT-RT LINUX', 'VXWORKS', 'WINDOWS', 'ZEPHYR', 'GENERIC LINUX']
 GVT_ARGS = ['64 448 8']
+MEM_BACKEND = ['hugetlb', 'memfd', 'memfd,mlock']
+# --virtio_poll interval in ns of the RT UOS types, unless the launch xml has one
+RT_VIRTIO_POLL = '1000000'
 
 RE_CONSOLE_MAP = {
         "com1(ttyS0)":"virtio-console,@pty:pty_port",
@@ -152,6 +155,23 @@ def get_scenario_uuid():
     return scenario_uuid_dic
 
 
+def get_placement_node(vmid):
+    """
+    Get the NUMA node to take the memory of a VM from
+    :param vmid: VM id in the scenario
+    :return: node id when the VM has a cpu placement and its pcpus are on one node of several, else None
+    """
+    placement = common.get_branch_tag_map(SCENARIO_INFO_FILE, 'cpu_placement').get(vmid)
+    if not placement or placement.strip() == 'none':
+        return None
+
+    if len(common.get_numa_nodes(BOARD_INFO_FILE)) < 2:
+        return None
+
+    cpus = common.get_leaf_tag_map(SCENARIO_INFO_FILE, 'pcpu_ids', 'pcpu_id').get(vmid, [])
+    return common.get_cpus_node(BOARD_INFO_FILE, cpus)
+
+
 def get_post_num_list():
     """
     Get board name from launch.xml at fist line
@@ -456,6 +476,32 @@ def args_aval_check(arg_list, item, avl_list):
         i_cnt += 1
 
 
+def args_num_check(arg_dic, item):
+    """
+    Check the optional numeric args of the acrn-dm
+    :param arg_dic: table of uos id:value of the item
+    :param item: the item in the launch xml
+    :return: None
+    """
+    for (uos_id, arg_str) in arg_dic.items():
+        if arg_str and not arg_str.strip().isdigit():
+            key = "uos,id={},{}".format(uos_id, item)
+            ERR_LIST[key] = "The {} should be a decimal number, or empty".format(item)
+
+
+def mem_backend_check(arg_dic, item):
+    """
+    Check the optional memory backend of the acrn-dm
+    :param arg_dic: table of uos id:value of the item
+    :param item: the item in the launch xml
+    :return: None
+    """
+    for (uos_id, arg_str) in arg_dic.items():
+        if arg_str and arg_str.strip() not in MEM_BACKEND:
+            key = "uos,id={},{}".format(uos_id, item)
+            ERR_LIST[key] = "The {} should be one of {}, or empty".format(item, MEM_BACKEND)
+
+
 def virtual_dev_slot(dev):
     max_slot = 31
     base_slot = 3
@@ -33,6 +33,12 @@ PCI_DEVS_LIST = ['sos_pci_devs', 'vm0_pci_devs', 'vm1_pci_devs']
 
 COMMUNICATE_VM_ID = []
 
+# <msr_policy> leaf tag: policy of the hypervisor
+MSR_POLICY = {'passthru': 'MSR_POLICY_PASSTHRU', 'deny': 'MSR_POLICY_DENY'}
+
+# <cpu_placement>: cache level the pcpus of the VM must share, 'llc' is the last level
+CPU_PLACEMENT = ['none', 'l2', 'llc']
+
 ERR_LIST = {}
 
 def prepare():
@@ -790,3 +796,85 @@ def get_first_post_vm():
             break
 
     return (err_dic, i)
+
+
+def get_msr_policies(config_file):
+    """
+    This is mapping table for {vm id:[(msr, policy)]} of the <msr_policy> items
+    :param config_file: it is a file what contains information for script to read from
+    :return: table of vm id:list of (msr, policy) type dictionary
+    """
+    policy_dic = {}
+    root = common.get_config_root(config_file)
+    for item in root:
+        if item.tag != "vm":
+            continue
+        vm_id = int(item.attrib['id'])
+        for sub in item:
+            if sub.tag != "msr_policy":
+                continue
+            for leaf in sub:
+                if leaf.tag not in MSR_POLICY or not leaf.text:
+                    continue
+                for msr in leaf.text.replace(',', ' ').split():
+                    policy_dic.setdefault(vm_id, []).append((msr, leaf.tag))
+
+    return policy_dic
+
+
+def msr_policy_check(policy_dic, item):
+    """
+    Check the MSRs of the msr policies, the hypervisor checks which ones are allowed
+    :param policy_dic: table of vm id:list of (msr, policy)
+    :param item: msr policy item in xml
+    :return: None
+    """
+    for (vm_id, policies) in policy_dic.items():
+        msrs = []
+        for (msr, _) in policies:
+            key = "vm:id={},{}".format(vm_id, item)
+            try:
+                msr_val = int(msr, 16)
+            except ValueError:
+                ERR_LIST[key] = "MSR {} should be a hex number".format(msr)
+                continue
+
+            if msr_val in msrs:
+                ERR_LIST[key] = "MSR {} has more than one policy".format(msr)
+            msrs.append(msr_val)
+
+
+def cpu_placement_check(item):
+    """
+    Check the pcpus of the VMs with a cpu placement share the cache of that level
+    :param item: cpu placement item in xml
+    :return: None
+    """
+    cpus_per_vm = common.get_leaf_tag_map(SCENARIO_INFO_FILE, "pcpu_ids", "pcpu_id")
+    placement_dic = common.get_branch_tag_map(SCENARIO_INFO_FILE, item)
+    cache_dic = common.get_cache_domains(BOARD_INFO_FILE)
+
+    for (vm_id, placement) in placement_dic.items():
+        key = "vm:id={},{}".format(vm_id, item)
+        if not placement or placement.strip() == 'none':
+            continue
+
+        placement = placement.strip()
+        if placement not in CPU_PLACEMENT:
+            ERR_LIST[key] = "VM cpu placement should be one of {}".format(CPU_PLACEMENT)
+            continue
+
+        if not cache_dic:
+            print_yel("{}: the board information has no CPU_CACHE_INFO, cpu placement not checked".format(key),
+                      warn=True)
+            continue
+
+        level = '2' if placement == 'l2' else max(cache_dic.keys())
+        if level not in cache_dic.keys():
+            ERR_LIST[key] = "The board has no L{} cache".format(level)
+            continue
+
+        cpus = cpus_per_vm.get(vm_id, [])
+        if not any(set(cpus) <= set(domain) for domain in cache_dic[level]):
+            ERR_LIST[key] = "VM pcpu_ids should be within one L{} cache: {}".format(
+                level, " or ".join([",".join(domain) for domain in cache_dic[level]]))
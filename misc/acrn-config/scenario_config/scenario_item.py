@@ -258,6 +258,7 @@ class VmInfo:
     load_order = []
     uuid = []
     clos_set = []
+    msr_policies = {}
     guest_flag_idx = []
     cpus_per_vm = []
 
@@ -285,6 +286,7 @@ class VmInfo:
         self.cpus_per_vm = scenario_cfg_lib.get_sub_leaf_tag(
             self.scenario_info, "pcpu_ids", "pcpu_id")
         self.clos_set = scenario_cfg_lib.get_sub_tree_tag(self.scenario_info, "clos")
+        self.msr_policies = scenario_cfg_lib.get_msr_policies(self.scenario_info)
         self.epc_section.get_info()
         self.mem_info.get_info()
         self.os_cfg.get_info()
@@ -308,6 +310,8 @@ class VmInfo:
         scenario_cfg_lib.uuid_format_check(self.uuid, "uuid")
         scenario_cfg_lib.guest_flag_check(self.guest_flag_idx, "guest_flags", "guest_flag")
         scenario_cfg_lib.cpus_per_vm_check("pcpu_id")
+        scenario_cfg_lib.msr_policy_check(self.msr_policies, "msr_policy")
+        scenario_cfg_lib.cpu_placement_check("cpu_placement")
 
         self.mem_info.check_item()
         self.os_cfg.check_item()
@@ -135,6 +135,7 @@ def vuart_output(i, vm_info, config):
     if scenario_name == "logical_partition":
         print("\t\t.pci_dev_num = VM{}_CONFIG_PCI_DEV_NUM,".format(i), file=config)
         print("\t\t.pci_devs = vm{}_pci_devs,".format(i), file=config)
+    msr_policy_output(i, vm_info, config)
     print("\t},", file=config)
 
     return err_dic
@@ -181,13 +182,45 @@ def get_guest_flag(flag_index):
     return (err_dic, flag_str)
 
 
-def gen_source_header(config):
+def gen_source_header(vm_info, config):
     """
     This is the common header for vm_configuration.c
+    :param vm_info: it is the class which contain all user setting information
     :param config: it is the pointer which file write to
     :return: None
     """
     print("{0}".format(C_HEADER), file=config)
+    msr_policies_output(vm_info, config)
+
+
+def msr_policies_output(vm_info, config):
+    """
+    This is generate the msr policy lists of the vms
+    :param vm_info: it is the class which contain all user setting information
+    :param config: it is the pointer which file write to
+    :return: None
+    """
+    for (vm_id, policies) in sorted(vm_info.msr_policies.items()):
+        print("static const struct acrn_vm_msr_policy vm{0}_msr_policies[] = {{".format(vm_id),
+              file=config)
+        for (msr, policy) in policies:
+            print("\t{{ 0x{0:x}U, {1} }},".format(int(msr, 16), scenario_cfg_lib.MSR_POLICY[policy]),
+                  file=config)
+        print("};", file=config)
+        print("", file=config)
+
+
+def msr_policy_output(i, vm_info, config):
+    """
+    This is generate the msr policy setting of a vm
+    :param i: vm id number
+    :param vm_info: it is the class which contain all user setting information
+    :param config: it is the pointer which file write to
+    :return: None
+    """
+    if i in vm_info.msr_policies.keys():
+        print("\t\t.msr_policy_num = {0}U,".format(len(vm_info.msr_policies[i])), file=config)
+        print("\t\t.msr_policies = vm{0}_msr_policies,".format(i), file=config)
 
 
 def gen_sdc_source(vm_info, config):
@@ -205,7 +238,7 @@ def gen_sdc_source(vm_info, config):
     if err_dic:
         return err_dic
 
-    gen_source_header(config)
+    gen_source_header(vm_info, config)
     # VM0
     print("struct acrn_vm_config vm_configs[CONFIG_MAX_VM_NUM] = {", file=config)
     print("\t{", file=config)
@@ -284,7 +317,7 @@ def gen_sdc2_source(vm_info, config):
     if err_dic:
         return err_dic
 
-    gen_source_header(config)
+    gen_source_header(vm_info, config)
 
     # VM0
     print("struct acrn_vm_config vm_configs[CONFIG_MAX_VM_NUM] = {", file=config)
@@ -392,7 +425,7 @@ def gen_logical_partition_source(vm_info, config):
     :return: None
     """
     err_dic = {}
-    gen_source_header(config)
+    gen_source_header(vm_info, config)
     for i in range(scenario_cfg_lib.VM_COUNT):
         print("extern struct acrn_vm_pci_dev_config " +
               "vm{0}_pci_devs[VM{1}_CONFIG_PCI_DEV_NUM];".format(i, i), file=config)
@@ -455,7 +488,7 @@ def gen_industry_source(vm_info, config):
     :return: None
     """
     err_dic = {}
-    gen_source_header(config)
+    gen_source_header(vm_info, config)
     print("struct acrn_vm_config vm_configs[CONFIG_MAX_VM_NUM] = {", file=config)
     for i in range(scenario_cfg_lib.VM_COUNT):
         uuid = uuid2str(vm_info.uuid[i])
@@ -521,7 +554,7 @@ def gen_hybrid_source(vm_info, config):
     if err_dic:
         return err_dic
 
-    gen_source_header(config)
+    gen_source_header(vm_info, config)
     print("struct acrn_vm_config vm_configs[CONFIG_MAX_VM_NUM] = {", file=config)
 
     for i in range(scenario_cfg_lib.VM_COUNT):
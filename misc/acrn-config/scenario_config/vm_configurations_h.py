@@ -21,6 +21,22 @@ def gen_common_header(config):
     print("{0}".format(VM_HEADER_DEFINE), file=config)
 
 
+def gen_scenario_flags(config, guest_flags, sos_vm_num):
+    """
+    Generate the guest flags and the SOS VM number the hypervisor specializes on
+    :param config: it is the pointer which file write to
+    :param guest_flags: the flags of the static VMs, besides the DM owned ones
+    :param sos_vm_num: the number of SOS VM of the scenario
+    :return: None
+    """
+    print("", file=config)
+    print("/* Bits mask of guest flags any VM of this scenario may have, and its number of SOS VM */",
+          file=config)
+    print("#define SCENARIO_GUEST_FLAGS\t\t(DM_OWNED_GUEST_FLAG_MASK | {0})".format(
+        " | ".join(guest_flags)), file=config)
+    print("#define SCENARIO_SOS_VM_NUM\t\t{0}U".format(sos_vm_num), file=config)
+
+
 def gen_sdc_header(config):
     """
     Generate vm_configuration.h of sdc scenario
@@ -37,6 +53,7 @@ def gen_sdc_header(config):
     print("#define DM_OWNED_GUEST_FLAG_MASK\t" +
           "(GUEST_FLAG_SECURE_WORLD_ENABLED | GUEST_FLAG_LAPIC_PASSTHROUGH | \\\n" +
           "\t\t\t\t\t\tGUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING)", file=config)
+    gen_scenario_flags(config, ["GUEST_FLAG_HIGHEST_SEVERITY"], 1)
 
     print("", file=config)
     print("#define SOS_VM_BOOTARGS\t\t\tSOS_ROOTFS\t\\", file=config)
@@ -72,6 +89,7 @@ def gen_sdc2_header(config):
     print("#define DM_OWNED_GUEST_FLAG_MASK\t" +
           "(GUEST_FLAG_SECURE_WORLD_ENABLED | GUEST_FLAG_LAPIC_PASSTHROUGH | \\\n" +
           "\t\t\t\t\t\tGUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING)", file=config)
+    gen_scenario_flags(config, ["GUEST_FLAG_HIGHEST_SEVERITY"], 1)
 
     print("", file=config)
     print("#define SOS_VM_BOOTARGS\t\t\tSOS_ROOTFS\t\\", file=config)
@@ -127,6 +145,7 @@ def gen_logic_header(vm_info, config):
     print("/* Bits mask of guest flags that can be programmed by device model." +
           " Other bits are set by hypervisor only */", file=config)
     print("#define DM_OWNED_GUEST_FLAG_MASK\t0UL", file=config)
+    gen_scenario_flags(config, ["GUEST_FLAG_RT", "GUEST_FLAG_LAPIC_PASSTHROUGH"], 0)
 
     logic_max_vm_num(config)
 
@@ -193,6 +212,7 @@ def gen_industry_header(config):
     print("#define DM_OWNED_GUEST_FLAG_MASK\t(GUEST_FLAG_SECURE_WORLD_ENABLED | " +
           "GUEST_FLAG_LAPIC_PASSTHROUGH | \\", file=config)
     print("\t\t\t\t\t\tGUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING)", file=config)
+    gen_scenario_flags(config, ["GUEST_FLAG_HIGHEST_SEVERITY"], 1)
     print("", file=config)
     print("#define SOS_VM_BOOTARGS\t\t\tSOS_ROOTFS\t\\", file=config)
     print('\t\t\t\t\t"rw rootwait "\t\\', file=config)
@@ -224,6 +244,7 @@ def gen_hybrid_header(vm_info, config):
     print("#define DM_OWNED_GUEST_FLAG_MASK\t" +
           "(GUEST_FLAG_SECURE_WORLD_ENABLED | GUEST_FLAG_LAPIC_PASSTHROUGH | \\\n" +
           "\t\t\t\t\t\tGUEST_FLAG_RT | GUEST_FLAG_IO_COMPLETION_POLLING)", file=config)
+    gen_scenario_flags(config, ["GUEST_FLAG_HIGHEST_SEVERITY"], 1)
 
     cpu_bits = vm_info.get_cpu_bitmap(0)
     print("", file=config)
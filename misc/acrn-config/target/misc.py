@@ -3,6 +3,7 @@
 # SPDX-License-Identifier: BSD-3-Clause
 #
 
+import os
 import parser_lib
 import subprocess
 
@@ -10,6 +11,8 @@ MEM_PATH = ['/proc/iomem', '/proc/meminfo']
 TTY_PATH = '/sys/class/tty/'
 SYS_IRQ_PATH = '/proc/interrupts'
 CPU_INFO_PATH = '/proc/cpuinfo'
+CPU_SYS_PATH = '/sys/devices/system/cpu/'
+NODE_SYS_PATH = '/sys/devices/system/node/'
 
 ttys_type = {
     '0': 'PORT',
@@ -222,6 +225,66 @@ def dump_cpu_core_info(config):
     print("", file=config)
 
 
+def cpu_list_expand(cpu_list):
+    """Expand a sysfs cpu list such as '0-3,8' to ['0', '1', '2', '3', '8']"""
+    cpus = []
+    for cpu_range in cpu_list.strip().split(','):
+        if not cpu_range:
+            continue
+        if '-' in cpu_range:
+            (lo, hi) = cpu_range.split('-')
+            cpus.extend([str(i) for i in range(int(lo), int(hi) + 1)])
+        else:
+            cpus.append(cpu_range)
+
+    return cpus
+
+
+def dump_cpu_cache_info(config):
+    """This will get the processors sharing each L2 and L3 cache, one line per cache
+    :param config: file pointer that opened for writing board config information
+    """
+    print("\t<CPU_CACHE_INFO>", file=config)
+    cache_list = []
+    cpu_dirs = [d for d in os.listdir(CPU_SYS_PATH) if d[:3] == 'cpu' and d[3:].isdigit()]
+    for cpu_dir in sorted(cpu_dirs, key=lambda d: int(d[3:])):
+        cache_path = '{}{}/cache/'.format(CPU_SYS_PATH, cpu_dir)
+        if not os.path.isdir(cache_path):
+            continue
+
+        for index in sorted(os.listdir(cache_path)):
+            if index[:5] != 'index':
+                continue
+            level = read_ttys_node('{}{}/level'.format(cache_path, index))
+            cache_type = read_ttys_node('{}{}/type'.format(cache_path, index))
+            if level not in ('2', '3') or cache_type == 'Instruction':
+                continue
+            cpus = cpu_list_expand(read_ttys_node('{}{}/shared_cpu_list'.format(cache_path, index)))
+            if (level, cpus) not in cache_list:
+                cache_list.append((level, cpus))
+
+    for (level, cpus) in sorted(cache_list, key=lambda c: (c[0], int(c[1][0]))):
+        print("\tL{}: {}".format(level, ", ".join(cpus)), file=config)
+
+    print("\t</CPU_CACHE_INFO>", file=config)
+    print("", file=config)
+
+
+def dump_numa_node_info(config):
+    """This will get the processors of each NUMA node
+    :param config: file pointer that opened for writing board config information
+    """
+    print("\t<NUMA_NODE_INFO>", file=config)
+    if os.path.isdir(NODE_SYS_PATH):
+        node_dirs = [d for d in os.listdir(NODE_SYS_PATH) if d[:4] == 'node' and d[4:].isdigit()]
+        for node_dir in sorted(node_dirs, key=lambda d: int(d[4:])):
+            cpus = cpu_list_expand(read_ttys_node('{}{}/cpulist'.format(NODE_SYS_PATH, node_dir)))
+            print("\t{}: {}".format(node_dir[4:], ", ".join(cpus)), file=config)
+
+    print("\t</NUMA_NODE_INFO>", file=config)
+    print("", file=config)
+
+
 def generate_info(board_info):
     """Get System Ram information
     :param board_info: this is the file which stores the hardware board information
@@ -239,3 +302,7 @@ def generate_info(board_info):
         dump_total_mem(config)
 
         dump_cpu_core_info(config)
+
+        dump_cpu_cache_info(config)
+
+        dump_numa_node_info(config)
@@ -0,0 +1,478 @@
+# Copyright (C) 2019 Intel Corporation. All rights reserved.
+#
+# SPDX-License-Identifier: BSD-3-Clause
+#
+
+import os
+import sys
+import getopt
+import xml.etree.ElementTree as ET
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'library'))
+import common
+
+# workload classes of the VMs, see WORKLOAD_DESC
+WORKLOAD_LIST = ['rt', 'throughput', 'interactive']
+WORKLOAD_DESC = {
+    'rt': "real time: dedicated cores, LAPIC passthrough, polled I/O",
+    'throughput': "throughput: dedicated pCPUs on one last level cache, notified I/O",
+    'interactive': "interactive: pCPUs left by the others, no memory reserved for it",
+}
+
+# the uos types launch_cfg_gen gives --lapic_pt
+RT_UOS_TYPES = ["PREEMPT-RT LINUX", "VXWORKS"]
+RT_GUEST_FLAGS = ["GUEST_FLAG_LAPIC_PASSTHROUGH", "GUEST_FLAG_RT", "GUEST_FLAG_IO_COMPLETION_POLLING"]
+
+# acrn-dm tuning of each class, in the launch xml: virtio_poll in ns, ioreq_poll in us
+LAUNCH_TUNING = {
+    'rt': {'rtos_type': 'Hard RT', 'virtio_poll': '1000000', 'ioreq_poll': '100', 'mem_backend': 'hugetlb'},
+    'throughput': {'rtos_type': 'no', 'virtio_poll': '', 'ioreq_poll': '', 'mem_backend': 'hugetlb'},
+    'interactive': {'rtos_type': 'no', 'virtio_poll': '', 'ioreq_poll': '', 'mem_backend': 'memfd'},
+}
+LAUNCH_DESC = {
+    'rtos_type': "UOS Realtime capability",
+    'virtio_poll': "acrn-dm polls the virtqueues with this interval in ns, empty for the notifications",
+    'ioreq_poll': "acrn-dm polls the ioreqs up to this time in us before sleeping, empty for no polling",
+    'mem_backend': "memory of the UOS: hugetlb (reserved hugepages) or memfd[,mlock] (transparent hugepages)",
+}
+
+
+def usage(file_name):
+    """ This is usage for how to use this tool """
+    print("usage= {} [h] ".format(file_name), end="")
+    print("--board <board_info_file> --scenario <scenario_info_file> [--launch <launch_info_file>] "
+          "[--workload <vm_id>:<class>[,...]] [--out <dir>]")
+    print('board_info_file :  file name of the board info')
+    print('scenario_info_file :  file name of the scenario info')
+    print('launch_info_file :  file name of the launch info of the post-launched VMs')
+    print('workload :  class of the VMs, one of {}, overriding their <workload>'.format(WORKLOAD_LIST))
+    print('dir :  directory of the tuned xmls and of tuning_report.txt, default the current one')
+
+
+def get_param(args):
+    """
+    Get the script parameters from command line
+    :param args: this the command line of string for the script without script name
+    :return: error dictionary, table of the parameters
+    """
+    err_dic = {}
+    params = {'board': '', 'scenario': '', 'launch': '', 'workload': {}, 'out': '.'}
+
+    try:
+        (optlist, _) = getopt.getopt(args[1:], '', ['board=', 'scenario=', 'launch=', 'workload=', 'out='])
+    except getopt.GetoptError:
+        optlist = []
+
+    for arg_k, arg_v in optlist:
+        if arg_k == '--workload':
+            for vm_class in arg_v.split(','):
+                if ':' not in vm_class:
+                    err_dic['tuning error: get wrong parameter'] = "workload {} is not <vm_id>:<class>".format(vm_class)
+                    continue
+                (vm_id, workload) = vm_class.split(':', 1)
+                params['workload'][int(vm_id)] = workload.strip()
+        else:
+            params[arg_k.lstrip('-')] = arg_v
+
+    if not params['board'] or not params['scenario']:
+        usage(args[0])
+        err_dic['tuning error: get wrong parameter'] = "wrong usage"
+        return (err_dic, params)
+
+    for item in ('board', 'scenario', 'launch'):
+        if params[item] and not os.path.exists(params[item]):
+            err_dic['tuning error: get wrong parameter'] = "{} is not exist!".format(params[item])
+
+    return (err_dic, params)
+
+
+class BoardTopology:
+    """ The pCPUs of the board, and the caches and nodes they share """
+
+    def __init__(self, board_info):
+        cpu_lines = common.get_board_info(board_info, "<CPU_PROCESSOR_INFO>", "</CPU_PROCESSOR_INFO>")
+        self.cpus = []
+        for line in cpu_lines:
+            self.cpus += [int(cpu) for cpu in line.replace(',', ' ').split()]
+        self.cpus.sort()
+
+        cache_dic = common.get_cache_domains(board_info)
+        # without CPU_CACHE_INFO, one L2 per pCPU and one last level cache
+        self.l2 = [sorted(int(cpu) for cpu in dom) for dom in cache_dic.get('2', [])]
+        if not self.l2:
+            self.l2 = [[cpu] for cpu in self.cpus]
+        if cache_dic and max(cache_dic.keys()) != '2':
+            self.llc = [sorted(int(cpu) for cpu in dom) for dom in cache_dic[max(cache_dic.keys())]]
+        else:
+            self.llc = [list(self.cpus)]
+        self.has_cache_info = bool(cache_dic)
+
+        self.nodes = common.get_numa_nodes(board_info)
+        (self.cat_cache, self.clos_max) = common.get_max_clos(board_info)
+        if self.cat_cache == "False":
+            self.clos_max = 0
+
+
+class TuningPlan:
+    """ The choices made for the VMs, and why """
+
+    def __init__(self, topo, vms):
+        self.topo = topo
+        self.vms = vms
+        self.free = list(topo.cpus)
+        self.idle = []
+        self.err_dic = {}
+        self.report = []
+        self.notes = {}
+
+    def note(self, vm, msg):
+        """ record a choice, with its reason """
+        self.notes.setdefault(vm['id'], []).append(msg)
+
+    def take_l2(self, demand):
+        """ whole L2 caches of one LLC, the siblings the VM does not use are left idle """
+        best = None
+        for llc in sorted(self.topo.llc, key=lambda llc: 0 in llc and self.vms_have_sos()):
+            doms = [dom for dom in self.topo.l2 if set(dom) <= set(self.free) and set(dom) <= set(llc)]
+            doms.sort(key=len)
+            taken = []
+            for dom in doms:
+                if len(taken) >= demand:
+                    break
+                taken += dom
+            if len(taken) >= demand:
+                best = taken
+                break
+
+        if best is None:
+            return []
+
+        cpus = best[:demand]
+        for cpu in best:
+            self.free.remove(cpu)
+        self.idle += best[demand:]
+        return cpus
+
+    def l2_is_free(self, cpu):
+        """ the other pCPUs of the L2 of cpu are free """
+        return any(cpu in dom and set(dom) <= set(self.free) for dom in self.topo.l2)
+
+    def take_llc(self, demand):
+        """ free pCPUs of the LLC with the most of them, of whole free L2 caches first """
+        llcs = sorted(self.topo.llc, key=lambda llc: len(set(llc) & set(self.free)), reverse=True)
+        for llc in llcs:
+            free = [cpu for cpu in llc if cpu in self.free]
+            if len(free) < demand:
+                continue
+            free.sort(key=lambda cpu: not self.l2_is_free(cpu))
+            cpus = sorted(free[:demand])
+            for cpu in cpus:
+                self.free.remove(cpu)
+            return cpus
+        return []
+
+    def vms_have_sos(self):
+        """ pCPU 0 is the BSP of the SOS when there is one """
+        return any(vm['load_order'] == 'SOS_VM' for vm in self.vms)
+
+    def place_cpus(self):
+        """ pick the pCPUs of the VMs: rt, then throughput, then interactive """
+        if self.vms_have_sos() and 0 in self.free:
+            self.free.remove(0)
+        for vm in [vm for vm in self.vms if not vm['class']]:
+            self.free = [cpu for cpu in self.free if cpu not in vm['pcpus']]
+
+        for workload in WORKLOAD_LIST:
+            for vm in [vm for vm in self.vms if vm['class'] == workload]:
+                key = "vm:id={},pcpu_ids".format(vm['id'])
+                if workload == 'rt':
+                    idle = len(self.idle)
+                    vm['pcpus'] = self.take_l2(vm['demand'])
+                    fits_l2 = any(set(vm['pcpus']) <= set(dom) for dom in self.topo.l2)
+                    vm['placement'] = 'l2' if fits_l2 else 'llc'
+                    self.note(vm, "pCPUs {} on whole L2 caches, none shared with another VM".format(vm['pcpus']))
+                    if self.idle[idle:]:
+                        self.note(vm, "pCPUs {} left idle, they share an L2 with its vCPUs".format(
+                            self.idle[idle:]))
+                elif workload == 'throughput':
+                    vm['pcpus'] = self.take_llc(vm['demand'])
+                    vm['placement'] = 'llc'
+                    self.note(vm, "pCPUs {} on one last level cache".format(vm['pcpus']))
+                else:
+                    vm['pcpus'] = sorted(self.free[:vm['demand']])
+                    for cpu in vm['pcpus']:
+                        self.free.remove(cpu)
+                    vm['placement'] = 'none'
+                    self.note(vm, "pCPUs {}, the cache they share does not matter".format(vm['pcpus']))
+
+                if len(vm['pcpus']) < vm['demand']:
+                    self.err_dic[key] = "{} VM wants {} pCPUs, the board has not enough free ones".format(
+                        workload, vm['demand'])
+
+        sos_cpus = sorted(set(self.free) | ({0} if self.vms_have_sos() else set()))
+        for vm in [vm for vm in self.vms if vm['load_order'] == 'SOS_VM']:
+            self.note(vm, "keeps pCPUs {}, the others are offlined by the launch scripts".format(sos_cpus))
+
+    def place_clos(self):
+        """ a CLOS of its own for each rt VM, one shared by the throughput VMs """
+        next_clos = 1
+        throughput_clos = 0
+        if self.topo.clos_max == 0:
+            self.report.append("CAT: not supported by the board, all the VMs share the caches")
+            return
+
+        for vm in [vm for vm in self.vms if vm['class'] == 'rt']:
+            if next_clos < self.topo.clos_max:
+                vm['clos'] = next_clos
+                next_clos += 1
+                self.note(vm, "CLOS {}, give it ways of the {} no other CLOS has, in board.c".format(
+                    vm['clos'], self.topo.cat_cache))
+            else:
+                self.report.append("Warning: VM{} shares CLOS 0, the board has {} CLOS".format(
+                    vm['id'], self.topo.clos_max))
+
+        for vm in [vm for vm in self.vms if vm['class'] == 'throughput']:
+            if next_clos < self.topo.clos_max:
+                throughput_clos = next_clos
+                vm['clos'] = throughput_clos
+                self.note(vm, "CLOS {}, shared by the throughput VMs, away from the ways of the rt ones".format(
+                    vm['clos']))
+
+        if throughput_clos != 0 or next_clos > 1:
+            self.report.append("CAT: the SOS and the interactive VMs keep CLOS 0, the clos_mask of the "
+                               "platform_clos_array of board.c splits the ways between the CLOS")
+
+
+def get_vms(scenario_root, workload_dic):
+    """
+    Get the VMs of the scenario, and their workload class
+    :param scenario_root: root of the scenario xml
+    :param workload_dic: table of vm id:class from the command line
+    :return: list of VM tables
+    """
+    vms = []
+    for vm_node in scenario_root.findall('vm'):
+        vm = {'id': int(vm_node.attrib['id']), 'node': vm_node, 'clos': 0}
+        vm['load_order'] = vm_node.findtext('load_order', '').strip()
+        workload = vm_node.findtext('workload', '').strip()
+        vm['class'] = workload_dic.get(vm['id'], workload)
+        pcpus = [cpu.text.strip() for cpu in vm_node.findall('pcpu_ids/pcpu_id') if cpu.text]
+        vm['pcpus'] = [int(cpu) for cpu in pcpus]
+        vm['demand'] = max(len(pcpus), 1)
+        vms.append(vm)
+
+    return vms
+
+
+def get_uos_nodes(launch_root, vms):
+    """
+    Map the uos of the launch xml to the VMs, and take their vCPU number from it
+    :param launch_root: root of the launch xml
+    :param vms: list of VM tables
+    :return: table of vm id:uos node
+    """
+    uos_dic = {}
+    if launch_root is None:
+        return uos_dic
+
+    sos_ids = [vm['id'] for vm in vms if vm['load_order'] == 'SOS_VM']
+    sos_vmid = sos_ids[0] if sos_ids else 0
+    for uos in launch_root.findall('uos'):
+        vm_id = int(uos.attrib['id']) + sos_vmid
+        uos_dic[vm_id] = uos
+        cpu_num = uos.findtext('cpu_num', '').strip()
+        for vm in vms:
+            if vm['id'] == vm_id and cpu_num.isdigit():
+                vm['demand'] = int(cpu_num)
+
+    return uos_dic
+
+
+def set_child(parent, tag, text, desc=None, after=None):
+    """
+    Set the text of a child, added with the indentation of its siblings when missing
+    :param after: tag of the sibling a new child goes after, the last one by default
+    :return: the child
+    """
+    child = parent.find(tag)
+    if child is None:
+        child = ET.Element(tag)
+        if desc:
+            child.set('desc', desc)
+        prev = parent.find(after) if after else None
+        if prev is None and len(parent):
+            prev = parent[-1]
+        if prev is None:
+            parent.insert(0, child)
+            child.tail = parent.tail
+        else:
+            parent.insert(list(parent).index(prev) + 1, child)
+            child.tail = prev.tail
+            prev.tail = parent.text
+    child.text = text
+    return child
+
+
+def set_leaves(parent, branch, leaf_tag, values, desc, after=None):
+    """ replace the leaves of a branch with values, one leaf each """
+    node = set_child(parent, branch, None, desc, after)
+    indent = (parent.text or '\n') + '    '
+    for leaf in list(node):
+        node.remove(leaf)
+    node.text = indent
+    for value in values:
+        leaf = ET.SubElement(node, leaf_tag)
+        leaf.text = str(value)
+        leaf.tail = indent
+    node[-1].tail = parent.text
+
+
+def set_scenario(plan):
+    """ write the choices of the plan to the VMs of the scenario xml """
+    for vm in [vm for vm in plan.vms if vm['class']]:
+        node = vm['node']
+
+        flags = [flag.text.strip() for flag in node.findall('guest_flags/guest_flag') if flag.text]
+        flags = [flag for flag in flags if flag not in ['0', '0UL', "GUEST_FLAG_CLOS_REQUIRED"] + RT_GUEST_FLAGS]
+        if vm['class'] == 'rt':
+            flags += [flag for flag in RT_GUEST_FLAGS
+                      if flag != "GUEST_FLAG_IO_COMPLETION_POLLING" or vm['load_order'] == 'POST_LAUNCHED_VM']
+        if vm['clos'] != 0:
+            flags.append("GUEST_FLAG_CLOS_REQUIRED")
+        set_leaves(node, 'guest_flags', 'guest_flag', flags or ['0'], "Select all applicable flags for the VM",
+                   'uuid')
+        if vm['class'] == 'rt':
+            plan.note(vm, "guest flags {}: the LAPIC timer and IPIs of the VM take no VM exit".format(
+                " | ".join(flags)))
+
+        set_leaves(node, 'pcpu_ids', 'pcpu_id', vm['pcpus'], "Assign physical CPU IDs to the VM", 'guest_flags')
+        set_child(node, 'clos', str(vm['clos']), "Class of Service for Cache Allocation Technology.", 'pcpu_ids')
+        set_child(node, 'cpu_placement', vm['placement'], "Keep the pcpus of the VM on one cache: none, l2 "
+                  "(sharing an L2) or llc (sharing the last level cache).", 'clos')
+
+
+def set_launch(plan, uos_dic):
+    """ write the vCPUs and the acrn-dm tuning of the post-launched VMs to the launch xml """
+    for vm in [vm for vm in plan.vms if vm['class'] and vm['id'] in uos_dic]:
+        uos = uos_dic[vm['id']]
+        set_child(uos, 'cpu_num', str(len(vm['pcpus'])), "max cpu number for the vm")
+        tuning = dict(LAUNCH_TUNING[vm['class']])
+        uos_type = uos.findtext('uos_type', '').strip()
+        if vm['class'] == 'rt' and uos_type not in RT_UOS_TYPES:
+            # no --lapic_pt, --rtvm and ioreq polling for the other types of launch_cfg_gen
+            tuning['ioreq_poll'] = ''
+            plan.report.append("Warning: VM{} is {}, its launch script has no --lapic_pt, make it one of {}".format(
+                vm['id'], uos_type, RT_UOS_TYPES))
+
+        prev = 'mem_size'
+        for (item, value) in tuning.items():
+            set_child(uos, item, value, LAUNCH_DESC[item], prev)
+            prev = item
+
+        if tuning['virtio_poll']:
+            plan.note(vm, "virtio_poll {} ns: the virtqueues are polled, a kick of the guest takes no "
+                      "notification".format(tuning['virtio_poll']))
+        else:
+            plan.note(vm, "no virtio_poll: the kicks notify acrn-dm, no SOS cycles spent on idle queues")
+        if tuning['ioreq_poll']:
+            plan.note(vm, "ioreq_poll {} us: acrn-dm spins on the ioreqs of the RT vCPUs before sleeping".format(
+                tuning['ioreq_poll']))
+        if tuning['mem_backend'] == 'hugetlb':
+            plan.note(vm, "hugetlb memory: reserved 1G/2M pages, no faults and fewer EPT levels")
+        else:
+            plan.note(vm, "memfd memory: transparent hugepages, no hugepages reserved in the SOS for it")
+
+
+def write_xml(root, src_file, out_dir):
+    """ write a tuned xml next to the others in out_dir, return its path """
+    path = os.path.join(out_dir, os.path.basename(src_file))
+    if os.path.abspath(path) == os.path.abspath(src_file):
+        path = os.path.join(out_dir, "tuned_" + os.path.basename(src_file))
+    ET.ElementTree(root).write(path, encoding='utf-8', short_empty_elements=False)
+    with open(path, 'a') as xml_file:
+        print("", file=xml_file)
+    return path
+
+
+def main(args):
+    """
+    This is main function to tune a scenario, and its launch xml, for the workloads of its VMs
+    :param args: it is a command line args for the script
+    """
+    (err_dic, params) = get_param(args)
+    if err_dic:
+        return err_dic
+
+    (err_dic, scenario_board) = common.get_xml_attrib(params['scenario'], "board")
+    (err_dic, board_name) = common.get_xml_attrib(params['board'], "board")
+    if scenario_board != board_name:
+        err_dic['tuning config: Not match'] = "The board xml and scenario xml should be matched!"
+        return err_dic
+
+    scenario_root = common.get_config_root(params['scenario'])
+    launch_root = common.get_config_root(params['launch']) if params['launch'] else None
+
+    vms = get_vms(scenario_root, params['workload'])
+    for vm_id in params['workload'].keys():
+        if vm_id not in [vm['id'] for vm in vms]:
+            err_dic["vm:id={},workload".format(vm_id)] = "The scenario has no VM {}".format(vm_id)
+    for vm in vms:
+        if vm['class'] and vm['class'] not in WORKLOAD_LIST:
+            err_dic["vm:id={},workload".format(vm['id'])] = "VM workload should be one of {}".format(WORKLOAD_LIST)
+        elif vm['class'] and vm['load_order'] == 'SOS_VM':
+            err_dic["vm:id={},workload".format(vm['id'])] = "The SOS takes the pCPUs left, it has no workload"
+    if err_dic:
+        return err_dic
+
+    uos_dic = get_uos_nodes(launch_root, vms)
+    topo = BoardTopology(params['board'])
+    plan = TuningPlan(topo, vms)
+    if not topo.has_cache_info:
+        plan.report.append("Warning: the board xml has no CPU_CACHE_INFO, each pCPU is taken as an L2 of its own")
+
+    plan.place_cpus()
+    if plan.err_dic:
+        return plan.err_dic
+    plan.place_clos()
+    set_scenario(plan)
+    set_launch(plan, uos_dic)
+
+    for vm in [vm for vm in vms if vm['class'] and vm['load_order'] == 'POST_LAUNCHED_VM']:
+        if vm['id'] not in uos_dic:
+            plan.report.append("Warning: VM{} has no uos in the launch xml, its acrn-dm is not tuned".format(vm['id']))
+        node = common.get_cpus_node(params['board'], [str(cpu) for cpu in vm['pcpus']])
+        if len(topo.nodes) > 1 and node is not None and vm['placement'] != 'none':
+            plan.note(vm, "memory from NUMA node {}, the one of its pCPUs".format(node))
+
+    outputs = [write_xml(scenario_root, params['scenario'], params['out'])]
+    if launch_root is not None:
+        outputs.append(write_xml(launch_root, params['launch'], params['out']))
+
+    report_file = os.path.join(params['out'], "tuning_report.txt")
+    with open(report_file, 'w') as report:
+        print("Tuning of {} on {}".format(os.path.basename(params['scenario']), board_name), file=report)
+        for line in plan.report:
+            print(line, file=report)
+        for vm in vms:
+            print("", file=report)
+            print("VM{}: {}".format(vm['id'], WORKLOAD_DESC.get(vm['class'], vm['load_order'] + ", not tuned")),
+                  file=report)
+            for line in plan.notes.get(vm['id'], []):
+                print("  - " + line, file=report)
+        print("", file=report)
+        print("Generate the configs from {}".format(" and ".join(outputs)), file=report)
+        print("with scenario_cfg_gen.py and launch_cfg_gen.py.", file=report)
+
+    with open(report_file, 'r') as report:
+        print(report.read(), end="")
+
+    return err_dic
+
+
+if __name__ == '__main__':
+
+    ARGS = sys.argv
+    err_dic = main(ARGS)
+    if err_dic:
+        for err_k, err_v in err_dic.items():
+            common.print_if_red("{}: {}".format(err_k, err_v), err=True)
+        sys.exit(1)
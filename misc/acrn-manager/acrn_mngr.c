@@ -431,7 +431,9 @@ static int connect_to_server(const char *name)
 		else
 			ret = p - entry->d_name;
 
-		if (!strncmp(entry->d_name, name, ret)) {
+		/* whole name, "vm1" is not the server of "vm10.monitor" */
+		if (!strncmp(entry->d_name, name, ret) &&
+				(name[ret] == '\0' || name[ret] == '.')) {
 			s_name = entry->d_name;
 			break;
 		}
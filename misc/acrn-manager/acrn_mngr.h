@@ -27,20 +27,50 @@ header file.
 #define ACRN_DM_BASE_PATH	"/run/acrn"
 #define ACRN_DM_SOCK_PATH	"/run/acrn/mngr"
 
+/* hugetlbfs mounts of the acrnd hugepage pool, one file per UOS in them */
+#define ACRN_HUGETLB_POOL_LV1	"/run/hugepage/acrn/pool_lv1"	/* 2M pages */
+#define ACRN_HUGETLB_POOL_LV2	"/run/hugepage/acrn/pool_lv2"	/* 1G pages */
+#define ACRN_HUGETLB_POOL_LVS	2
+
 /* TODO: Revisit PARAM_LEN and see if size can be reduced */
 #define PARAM_LEN	256
 
+#define BLK_STATS_OPS		4	/* read, write, flush, discard */
+#define BLK_STATS_LAT_BUCKETS	20	/* log2 of the latency in us */
+#define BLK_STATS_QD_BUCKETS	8	/* log2 of the queue depth */
+
+#define ACRND_BATCH_MAX		16	/* VMs of one ACRND_BATCH */
+#define DM_IOREQ_STATS_TYPES	3	/* pio, mmio, pci cfg */
+
+/* states of the VMs, as listed by acrnctl and notified by the DM */
+enum vm_state {
+	VM_STATE_UNKNOWN = 0,
+	VM_CREATED,		/* VM created / awaiting start (boot) */
+	VM_STARTED,		/* VM started (booted) */
+	VM_PAUSED,		/* VM paused */
+	VM_SUSPENDED,		/* VM suspended */
+	VM_UNTRACKED,		/* VM not created by acrnctl, or its launch script can change vm name */
+};
+
+/* op of ACRND_BATCH */
+enum acrnd_batch_op {
+	ACRND_BATCH_START = 0,
+	ACRND_BATCH_STOP,
+	ACRND_BATCH_QUERY,
+};
+
 struct mngr_msg {
 	unsigned long long magic;	/* Make sure you get a mngr_msg */
 	unsigned int msgid;
 	unsigned long timestamp;
 	union {
 
-		/* Arguments to rescan virtio-blk device */
+		/* Arguments to rescan virtio-blk device, or to set its limits */
 		char devargs[PARAM_LEN];
 
 		/* ack of DM_STOP, DM_SUSPEND, DM_RESUME, DM_PAUSE, DM_CONTINUE,
-		   ACRND_TIMER, ACRND_STOP, ACRND_RESUME, RTC_TIMER */
+		   ACRND_TIMER, ACRND_STOP, ACRND_RESUME, ACRND_HUGETLB, RTC_TIMER,
+		   ACRND_SUBSCRIBE */
 		int err;
 
 		/* ack of WAKEUP_REASON */
@@ -49,6 +79,21 @@ struct mngr_msg {
 		/* ack of DM_QUERY */
 		int state;
 
+		/* ack of DM_BLKSTATS, err is at the place of the err above */
+		struct ack_blkstats {
+			int err;
+			unsigned int inflight;
+			struct {
+				unsigned long long ops;
+				unsigned long long bytes;
+				unsigned long long merged;
+				unsigned long long errors;
+				unsigned long long lat_us;
+				unsigned int lat_hist[BLK_STATS_LAT_BUCKETS];
+			} op[BLK_STATS_OPS];
+			unsigned int qd_hist[BLK_STATS_QD_BUCKETS];
+		} blkstats;
+
 		/* req of ACRND_TIMER */
 		struct req_acrnd_timer {
 			char name[MAX_VMNAME_LEN];
@@ -73,12 +118,65 @@ struct mngr_msg {
 			unsigned timeout;
 		} acrnd_resume;
 
+		/* req of ACRND_HUGETLB, pages[0] of 2M and pages[1] of 1G */
+		struct req_acrnd_hugetlb {
+			char vmname[MAX_VMNAME_LEN];
+			unsigned int pages[ACRN_HUGETLB_POOL_LVS];
+		} acrnd_hugetlb;
+
 		/* req of RTC_TIMER */
 		struct req_rtc_timer {
 			char vmname[MAX_VMNAME_LEN];
 			time_t t;
 		} rtc_timer;
 
+		/* req of DM_NOTIFY, and of ACRND_EVENT to the subscribers */
+		struct req_dm_notify {
+			char vmname[MAX_VMNAME_LEN];
+			int state;	/* enum vm_state */
+			int pid;	/* of the DM */
+		} dm_notify;
+
+		/* req of ACRND_BATCH, names separated by ',' */
+		struct req_acrnd_batch {
+			int op;		/* enum acrnd_batch_op */
+			int force;
+			char names[PARAM_LEN];
+		} acrnd_batch;
+
+		/* ack of ACRND_BATCH, err of start/stop or enum vm_state per VM */
+		struct ack_acrnd_batch {
+			int err;
+			int count;
+			int states[ACRND_BATCH_MAX];
+		} acrnd_batch_ack;
+
+		/* req of ACRND_STATS, names separated by ',', all the VMs if empty */
+		char stats_names[PARAM_LEN];
+
+		/* ack of ACRND_STATS, the sums of the statistics of count VMs */
+		struct ack_acrnd_stats {
+			int err;
+			int count;
+			unsigned long long ioreqs[DM_IOREQ_STATS_TYPES];
+			unsigned long long ioreq_rounds;
+			unsigned long long mevent_wakeups;
+			unsigned long long mevent_events;
+			unsigned long long vq_notifies;
+			unsigned long long vq_used;
+			unsigned long long vq_interrupts;
+			struct {
+				unsigned long long ops;
+				unsigned long long bytes;
+				unsigned long long errors;
+				unsigned long long lat_us;
+			} blk[BLK_STATS_OPS];
+			unsigned long long blk_inflight;
+		} acrnd_stats_ack;
+
+		/* req of ACRND_SUBSCRIBE, the server acrnd sends ACRND_EVENT to */
+		char subscriber[PATH_LEN];
+
 	} data;
 };
 
@@ -98,6 +196,15 @@ enum dm_msgid {
 	DM_CONTINUE,		/* Unfreeze this virtual machine */
 	DM_QUERY,		/* Ask power state of this UOS */
 	DM_BLKRESCAN,		/* Rescan virtio-blk device for any changes in UOS */
+	DM_BLKQOS,		/* Change the I/O limits of a virtio-blk device */
+	DM_BLKSTATS,		/* Ask the I/O statistics of a virtio-blk device */
+	DM_NETPOLL,		/* Change the vhost busy polling of a virtio-net device */
+	DM_RDT,			/* Change the cache and memory bandwidth allocation */
+	DM_BALLOON,		/* Change the target size of a virtio-balloon device */
+	DM_SNAPSHOT,		/* Save the guest memory to a file */
+	DM_MIGRATE,		/* Stream the guest memory over TCP */
+	DM_CLONE,		/* Fork a UOS from this template DM */
+	DM_CPU,			/* Add or remove a vCPU of a running UOS */
 	DM_MAX,
 };
 
@@ -109,12 +216,21 @@ enum acrnd_msgid {
 	ACRND_TIMER = DM_MAX + 1,	/* DM request to setup a launch timer */
 	ACRND_REASON,		/* DM ask for updating wakeup reason */
 	DM_NOTIFY,		/* DM notify Acrnd that state is changed */
+	ACRND_HUGETLB,		/* DM request its memory from the hugepage pool */
 
 	/* SOS-LCS ->Acrnd */
 	ACRND_STOP,		/* SOS-LCS request to Stop all UOS */
 	ACRND_RESUME,		/* SOS-LCS request to Resume UOS */
 	ACRND_SUSPEND,		/* SOS-LCS request to Suspend all UOS */
 
+	/* Acrnctl -> Acrnd */
+	ACRND_BATCH,		/* Start, stop or query several UOS at once */
+	ACRND_SUBSCRIBE,	/* Be sent ACRND_EVENT on each state change */
+	ACRND_STATS,		/* Sum up the statistics the DMs publish */
+
+	/* Acrnd -> subscribers */
+	ACRND_EVENT,		/* State of a UOS changed, as notified by its DM */
+
 	ACRND_MAX,
 };
 
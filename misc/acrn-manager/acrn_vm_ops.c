@@ -12,6 +12,7 @@
 #include <limits.h>
 #include <pthread.h>
 #include <dirent.h>
+#include <signal.h>
 #include <sys/stat.h>
 #include "acrnctl.h"
 #include "acrn_mngr.h"
@@ -147,6 +148,7 @@ static void _scan_alive_vm(void)
 			LIST_INSERT_HEAD(&vmmngr_head, vm, list);
 		}
 
+		vm->pid = pid;
 		ret = query_state(name);
 
 		if (ret < 0)
@@ -283,6 +285,54 @@ void vmmngr_update(void)
 	pthread_mutex_unlock(&vmmngr_mutex);
 }
 
+void vmmngr_set_state(const char *name, unsigned long state, int pid)
+{
+	struct vmmngr_struct *vm;
+
+	pthread_mutex_lock(&vmmngr_mutex);
+	vm = vmmngr_find(name);
+	if (!vm) {
+		vm = calloc(1, sizeof(*vm));
+		if (!vm) {
+			printf("%s: Failed to alloc mem for %s\n", __func__, name);
+			goto unlock;
+		}
+		strncpy(vm->name, name, sizeof(vm->name) - 1);
+		vm->update = update_count;
+		LIST_INSERT_HEAD(&vmmngr_head, vm, list);
+	}
+
+	vm->state = state;
+	vm->pid = (state == VM_CREATED) ? 0 : pid;
+ unlock:
+	pthread_mutex_unlock(&vmmngr_mutex);
+}
+
+void vmmngr_refresh(void)
+{
+	struct vmmngr_struct *vm, *tvm;
+
+	pthread_mutex_lock(&vmmngr_mutex);
+	update_count++;
+	_scan_added_vm();
+
+	list_foreach_safe(vm, &vmmngr_head, list, tvm) {
+		/* the DM keeps notifying its state while alive */
+		if (vm->pid > 0 && (kill(vm->pid, 0) == 0 || errno != ESRCH))
+			continue;
+
+		vm->pid = 0;
+		if (vm->update == update_count) {
+			vm->state = VM_CREATED;
+			continue;
+		}
+		LIST_REMOVE(vm, list);
+		printf("%s: Removed dead %s\n", __func__, vm->name);
+		free(vm);
+	}
+	pthread_mutex_unlock(&vmmngr_mutex);
+}
+
 /* helper functions */
 int shell_cmd(const char *cmd, char *outbuf, int len)
 {
@@ -366,6 +416,81 @@ int start_vm(const char *vmname)
 	return system(cmd);
 }
 
+int batch_vm(int op, int force, const char *names,
+		struct ack_acrnd_batch *result)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+	int fd, ret;
+
+	memset(&req, 0, sizeof(req));
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = ACRND_BATCH;
+	req.timestamp = time(NULL);
+	req.data.acrnd_batch.op = op;
+	req.data.acrnd_batch.force = force;
+	if (strnlen(names, sizeof(req.data.acrnd_batch.names)) >=
+			sizeof(req.data.acrnd_batch.names)) {
+		printf("ERROR: names of the VMs are too long\n");
+		return -1;
+	}
+	strncpy(req.data.acrnd_batch.names, names,
+			sizeof(req.data.acrnd_batch.names) - 1);
+
+	fd = mngr_open_un("acrnd", MNGR_CLIENT);
+	if (fd < 0) {
+		printf("Unable to open acrnd socket. Is acrnd running?\n");
+		return -1;
+	}
+
+	/* acrnd stops the VMs one by one, each within 1s */
+	memset(&ack, 0, sizeof(ack));
+	ret = mngr_send_msg(fd, &req, &ack, ACRND_BATCH_MAX + 1);
+	mngr_close(fd);
+	if (ret != sizeof(ack)) {
+		printf("Unable to get the ack of acrnd\n");
+		return -1;
+	}
+
+	*result = ack.data.acrnd_batch_ack;
+	return result->err;
+}
+
+int stats_vm(const char *names, struct ack_acrnd_stats *result)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+	int fd, ret;
+
+	memset(&req, 0, sizeof(req));
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = ACRND_STATS;
+	req.timestamp = time(NULL);
+	if (strnlen(names, sizeof(req.data.stats_names)) >=
+			sizeof(req.data.stats_names)) {
+		printf("ERROR: names of the VMs are too long\n");
+		return -1;
+	}
+	strncpy(req.data.stats_names, names, sizeof(req.data.stats_names) - 1);
+
+	fd = mngr_open_un("acrnd", MNGR_CLIENT);
+	if (fd < 0) {
+		printf("Unable to open acrnd socket. Is acrnd running?\n");
+		return -1;
+	}
+
+	memset(&ack, 0, sizeof(ack));
+	ret = mngr_send_msg(fd, &req, &ack, 1);
+	mngr_close(fd);
+	if (ret != sizeof(ack)) {
+		printf("Unable to get the ack of acrnd\n");
+		return -1;
+	}
+
+	*result = ack.data.acrnd_stats_ack;
+	return result->err;
+}
+
 int stop_vm(const char *vmname, int force)
 {
 	struct mngr_msg req;
@@ -477,3 +602,192 @@ int blkrescan_vm(const char *vmname, char *devargs)
 
 	return ack.data.err;
 }
+
+int blkqos_vm(const char *vmname, char *devargs)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_BLKQOS;
+	req.timestamp = time(NULL);
+	strncpy(req.data.devargs, devargs, PARAM_LEN - 1);
+	req.data.devargs[PARAM_LEN - 1] = '\0';
+
+	send_msg(vmname, &req, &ack);
+
+	if (ack.data.err) {
+		printf("Unable to set the I/O limits of virtio-blk device in vm. errno(%d)\n", ack.data.err);
+	}
+
+	return ack.data.err;
+}
+
+int netpoll_vm(const char *vmname, char *devargs)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_NETPOLL;
+	req.timestamp = time(NULL);
+	strncpy(req.data.devargs, devargs, PARAM_LEN - 1);
+	req.data.devargs[PARAM_LEN - 1] = '\0';
+
+	send_msg(vmname, &req, &ack);
+
+	if (ack.data.err) {
+		printf("Unable to set the busy polling of virtio-net device in vm. errno(%d)\n", ack.data.err);
+	}
+
+	return ack.data.err;
+}
+
+int rdt_vm(const char *vmname, char *devargs)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_RDT;
+	req.timestamp = time(NULL);
+	strncpy(req.data.devargs, devargs, PARAM_LEN - 1);
+	req.data.devargs[PARAM_LEN - 1] = '\0';
+
+	send_msg(vmname, &req, &ack);
+
+	if (ack.data.err) {
+		printf("Unable to set the resource allocation of vm. errno(%d)\n", ack.data.err);
+	}
+
+	return ack.data.err;
+}
+
+int balloon_vm(const char *vmname, char *devargs)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_BALLOON;
+	req.timestamp = time(NULL);
+	strncpy(req.data.devargs, devargs, PARAM_LEN - 1);
+	req.data.devargs[PARAM_LEN - 1] = '\0';
+
+	send_msg(vmname, &req, &ack);
+
+	if (ack.data.err) {
+		printf("Unable to resize the virtio-balloon device in vm. errno(%d)\n", ack.data.err);
+	}
+
+	return ack.data.err;
+}
+
+int cpu_vm(const char *vmname, char *devargs)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_CPU;
+	req.timestamp = time(NULL);
+	strncpy(req.data.devargs, devargs, PARAM_LEN - 1);
+	req.data.devargs[PARAM_LEN - 1] = '\0';
+
+	send_msg(vmname, &req, &ack);
+
+	if (ack.data.err) {
+		printf("Unable to change the vCPUs of vm. errno(%d)\n", ack.data.err);
+	}
+
+	return ack.data.err;
+}
+
+int clone_vm(const char *template, char *devargs)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+	char name[PATH_LEN];
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_CLONE;
+	req.timestamp = time(NULL);
+	strncpy(req.data.devargs, devargs, PARAM_LEN - 1);
+	req.data.devargs[PARAM_LEN - 1] = '\0';
+
+	/* the socket of a template DM, see --template of acrn-dm */
+	snprintf(name, sizeof(name), "%s.template", template);
+	ack.data.err = -1;
+	send_msg(name, &req, &ack);
+
+	if (ack.data.err) {
+		printf("Unable to clone a vm from %s. errno(%d)\n", template,
+			ack.data.err);
+	}
+
+	return ack.data.err;
+}
+
+int snapshot_vm(const char *vmname, char *path)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_SNAPSHOT;
+	req.timestamp = time(NULL);
+	strncpy(req.data.devargs, path, PARAM_LEN - 1);
+	req.data.devargs[PARAM_LEN - 1] = '\0';
+
+	send_msg(vmname, &req, &ack);
+
+	if (ack.data.err) {
+		printf("Unable to save the memory of vm. errno(%d)\n", ack.data.err);
+	}
+
+	return ack.data.err;
+}
+
+int migrate_vm(const char *vmname, char *dest)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_MIGRATE;
+	req.timestamp = time(NULL);
+	strncpy(req.data.devargs, dest, PARAM_LEN - 1);
+	req.data.devargs[PARAM_LEN - 1] = '\0';
+
+	send_msg(vmname, &req, &ack);
+
+	if (ack.data.err) {
+		printf("Unable to stream the memory of vm. errno(%d)\n", ack.data.err);
+	}
+
+	return ack.data.err;
+}
+
+int blkstats_vm(const char *vmname, char *devargs, struct ack_blkstats *stats)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_BLKSTATS;
+	req.timestamp = time(NULL);
+	strncpy(req.data.devargs, devargs, PARAM_LEN - 1);
+	req.data.devargs[PARAM_LEN - 1] = '\0';
+
+	ack.data.blkstats.err = -1;
+	send_msg(vmname, &req, &ack);
+
+	if (ack.data.blkstats.err) {
+		printf("Unable to get the I/O statistics of virtio-blk device in vm. errno(%d)\n",
+			ack.data.blkstats.err);
+		return ack.data.blkstats.err;
+	}
+
+	*stats = ack.data.blkstats;
+	return 0;
+}
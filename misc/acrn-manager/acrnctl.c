@@ -15,6 +15,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <signal.h>
 #include <sys/queue.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -28,8 +29,10 @@
 
 /* vm life cycle cmd description */
 #define LIST_DESC      "List all the virtual machines added"
-#define START_DESC     "Start virtual machine VM_NAME"
+#define START_DESC     "Start virtual machine VM_NAME, several at once by acrnd"
 #define STOP_DESC      "Stop virtual machine VM_NAME, [--force/-f, force to stop VM]"
+#define QUERY_DESC     "Show the states acrnd keeps of virtual machines VM_NAME ..."
+#define WATCH_DESC     "Show the state changes of the virtual machines, as acrnd sees them"
 #define DEL_DESC       "Delete virtual machine VM_NAME"
 #define ADD_DESC       "Add one virtual machine with SCRIPTS and OPTIONS"
 #define PAUSE_DESC     "Block all vCPUs of virtual machine VM_NAME"
@@ -38,6 +41,16 @@
 #define RESUME_DESC    "Resume virtual machine from suspend state"
 #define RESET_DESC     "Stop and then start virtual machine VM_NAME"
 #define BLKRESCAN_DESC  "Rescan virtio-blk device attached to a virtual machine"
+#define BLKQOS_DESC    "Set the I/O limits of a virtio-blk device of a virtual machine"
+#define BLKSTATS_DESC  "Show the I/O statistics of a virtio-blk device of a virtual machine"
+#define NETPOLL_DESC   "Set the vhost busy polling of a virtio-net device of a virtual machine"
+#define RDT_DESC       "Set the cache and memory bandwidth allocation of a virtual machine"
+#define BALLOON_DESC   "Set the target size of the virtio-balloon device of a virtual machine"
+#define SNAPSHOT_DESC  "Save the memory of a virtual machine to a file, and leave it paused"
+#define MIGRATE_DESC   "Stream the memory of a virtual machine over TCP, and leave it paused"
+#define CLONE_DESC     "Start a virtual machine forked from a template device model"
+#define CPU_DESC       "Add a vCPU to a virtual machine on an offlined SOS cpu, or remove one"
+#define STATS_DESC     "Show the sums of the statistics the device models of VM_NAME ..., or of all, publish"
 
 #define VM_NAME (1)
 #define CMD_ARGS (2)
@@ -439,16 +452,321 @@ static int acrnctl_do_blkrescan(int argc, char *argv[])
 	return 0;
 }
 
+static int acrnctl_do_blkqos(int argc, char *argv[])
+{
+	struct vmmngr_struct *s;
+
+	s = vmmngr_find(argv[VM_NAME]);
+	if (!s) {
+		printf("can't find %s\n", argv[VM_NAME]);
+		return -1;
+	}
+	if (s->state != VM_STARTED) {
+		printf("%s is in %s state but should be in %s state for blkqos\n",
+			argv[VM_NAME], state_str[s->state], state_str[VM_STARTED]);
+		return -1;
+	}
+
+	return blkqos_vm(argv[VM_NAME], argv[CMD_ARGS]);
+}
+
+static void print_blkstats_hist(const char *name, const unsigned int *hist,
+				int n, const char *unit)
+{
+	int i;
+
+	printf("  %s:", name);
+	for (i = 0; i < n; i++) {
+		if (!hist[i])
+			continue;
+		if (i == n - 1)
+			printf(" >=%u%s:%u", 1U << i, unit, hist[i]);
+		else
+			printf(" %u%s:%u", i ? 1U << i : 0, unit, hist[i]);
+	}
+	printf("\n");
+}
+
+static int acrnctl_do_blkstats(int argc, char *argv[])
+{
+	static const char *op_str[BLK_STATS_OPS] = {
+		"read", "write", "flush", "discard"
+	};
+	struct vmmngr_struct *s;
+	struct ack_blkstats stats;
+	int i;
+
+	s = vmmngr_find(argv[VM_NAME]);
+	if (!s) {
+		printf("can't find %s\n", argv[VM_NAME]);
+		return -1;
+	}
+	if (s->state != VM_STARTED && s->state != VM_PAUSED) {
+		printf("%s is in %s state but should be in %s or %s state for blkstats\n",
+			argv[VM_NAME], state_str[s->state],
+			state_str[VM_STARTED], state_str[VM_PAUSED]);
+		return -1;
+	}
+
+	if (blkstats_vm(argv[VM_NAME], argv[CMD_ARGS], &stats))
+		return -1;
+
+	printf("%-8s %12s %16s %10s %8s %12s\n", "OP", "REQUESTS", "BYTES",
+		"MERGED", "ERRORS", "AVG_LAT(us)");
+	for (i = 0; i < BLK_STATS_OPS; i++)
+		printf("%-8s %12llu %16llu %10llu %8llu %12llu\n", op_str[i],
+			stats.op[i].ops, stats.op[i].bytes,
+			stats.op[i].merged, stats.op[i].errors,
+			stats.op[i].ops ? stats.op[i].lat_us / stats.op[i].ops : 0);
+
+	printf("\ninflight: %u\n", stats.inflight);
+	print_blkstats_hist("queue depth", stats.qd_hist,
+			BLK_STATS_QD_BUCKETS, "");
+	printf("\nlatency:\n");
+	for (i = 0; i < BLK_STATS_OPS; i++) {
+		if (stats.op[i].ops)
+			print_blkstats_hist(op_str[i], stats.op[i].lat_hist,
+					BLK_STATS_LAT_BUCKETS, "us");
+	}
+
+	return 0;
+}
+
+static int acrnctl_do_netpoll(int argc, char *argv[])
+{
+	struct vmmngr_struct *s;
+
+	s = vmmngr_find(argv[VM_NAME]);
+	if (!s) {
+		printf("can't find %s\n", argv[VM_NAME]);
+		return -1;
+	}
+	if (s->state != VM_STARTED) {
+		printf("%s is in %s state but should be in %s state for netpoll\n",
+			argv[VM_NAME], state_str[s->state], state_str[VM_STARTED]);
+		return -1;
+	}
+
+	return netpoll_vm(argv[VM_NAME], argv[CMD_ARGS]);
+}
+
+static int acrnctl_do_rdt(int argc, char *argv[])
+{
+	struct vmmngr_struct *s;
+
+	s = vmmngr_find(argv[VM_NAME]);
+	if (!s) {
+		printf("can't find %s\n", argv[VM_NAME]);
+		return -1;
+	}
+	if (s->state != VM_STARTED && s->state != VM_PAUSED) {
+		printf("%s is in %s state but should be in %s or %s state for rdt\n",
+			argv[VM_NAME], state_str[s->state], state_str[VM_STARTED],
+			state_str[VM_PAUSED]);
+		return -1;
+	}
+
+	return rdt_vm(argv[VM_NAME], argv[CMD_ARGS]);
+}
+
+static int acrnctl_do_balloon(int argc, char *argv[])
+{
+	struct vmmngr_struct *s;
+
+	s = vmmngr_find(argv[VM_NAME]);
+	if (!s) {
+		printf("can't find %s\n", argv[VM_NAME]);
+		return -1;
+	}
+	if (s->state != VM_STARTED) {
+		printf("%s is in %s state but should be in %s state for balloon\n",
+			argv[VM_NAME], state_str[s->state], state_str[VM_STARTED]);
+		return -1;
+	}
+
+	return balloon_vm(argv[VM_NAME], argv[CMD_ARGS]);
+}
+
+static int acrnctl_do_cpu(int argc, char *argv[])
+{
+	struct vmmngr_struct *s;
+
+	s = vmmngr_find(argv[VM_NAME]);
+	if (!s) {
+		printf("can't find %s\n", argv[VM_NAME]);
+		return -1;
+	}
+	if (s->state != VM_STARTED) {
+		printf("%s is in %s state but should be in %s state for cpu\n",
+			argv[VM_NAME], state_str[s->state], state_str[VM_STARTED]);
+		return -1;
+	}
+
+	return cpu_vm(argv[VM_NAME], argv[CMD_ARGS]);
+}
+
+static int acrnctl_do_clone(int argc, char *argv[])
+{
+	char devargs[PARAM_LEN] = {};
+	int i, len = 0, ret;
+
+	if (vmmngr_find(argv[2])) {
+		printf("%s is already in use\n", argv[2]);
+		return -1;
+	}
+
+	/* the VM name then its parameters, separated by spaces */
+	for (i = 2; i < argc; i++) {
+		if (strchr(argv[i], ' ')) {
+			printf("No space allowed in %s\n", argv[i]);
+			return -1;
+		}
+		ret = snprintf(devargs + len, sizeof(devargs) - len, "%s%s",
+				len ? " " : "", argv[i]);
+		if (ret >= sizeof(devargs) - len) {
+			printf("ERROR: parameters of the clone are too long\n");
+			return -1;
+		}
+		len += ret;
+	}
+
+	return clone_vm(argv[1], devargs);
+}
+
+static int acrnctl_do_snapshot(int argc, char *argv[])
+{
+	struct vmmngr_struct *s;
+
+	s = vmmngr_find(argv[VM_NAME]);
+	if (!s) {
+		printf("can't find %s\n", argv[VM_NAME]);
+		return -1;
+	}
+	if (s->state != VM_STARTED) {
+		printf("%s is in %s state but should be in %s state for snapshot\n",
+			argv[VM_NAME], state_str[s->state], state_str[VM_STARTED]);
+		return -1;
+	}
+	/* opened by the device model, its working directory is not ours */
+	if (argv[CMD_ARGS][0] != '/') {
+		printf("%s is not an absolute path\n", argv[CMD_ARGS]);
+		return -1;
+	}
+
+	return snapshot_vm(argv[VM_NAME], argv[CMD_ARGS]);
+}
+
+static int acrnctl_do_migrate(int argc, char *argv[])
+{
+	struct vmmngr_struct *s;
+
+	s = vmmngr_find(argv[VM_NAME]);
+	if (!s) {
+		printf("can't find %s\n", argv[VM_NAME]);
+		return -1;
+	}
+	if (s->state != VM_STARTED) {
+		printf("%s is in %s state but should be in %s state for migrate\n",
+			argv[VM_NAME], state_str[s->state], state_str[VM_STARTED]);
+		return -1;
+	}
+
+	return migrate_vm(argv[VM_NAME], argv[CMD_ARGS]);
+}
+
+/* one ACRND_BATCH for the VM names of argv, the options are skipped */
+static int batch_do(int op, int force, int argc, char *argv[])
+{
+	struct ack_acrnd_batch res;
+	char names[PARAM_LEN] = {};
+	const char *vms[ACRND_BATCH_MAX];
+	int i, n = 0, len = 0, ret;
+
+	for (i = 1; i < argc; i++) {
+		if (argv[i][0] == '-')
+			continue;
+		if (n >= ACRND_BATCH_MAX) {
+			printf("No more than %d VMs at once\n", ACRND_BATCH_MAX);
+			return -1;
+		}
+		ret = snprintf(names + len, sizeof(names) - len, "%s%s",
+				n ? "," : "", argv[i]);
+		if (ret >= sizeof(names) - len) {
+			printf("ERROR: names of the VMs are too long\n");
+			return -1;
+		}
+		len += ret;
+		vms[n++] = argv[i];
+	}
+
+	memset(&res, 0, sizeof(res));
+	ret = batch_vm(op, force, names, &res);
+	for (i = 0; i < res.count && i < n; i++) {
+		if (op == ACRND_BATCH_QUERY)
+			printf("%s\t\t%s\n", vms[i],
+				(res.states[i] > VM_STATE_UNKNOWN &&
+				 res.states[i] <= VM_UNTRACKED) ?
+				state_str[res.states[i]] : state_str[VM_STATE_UNKNOWN]);
+		else
+			printf("%s\t\t%s\n", vms[i], res.states[i] ? "failed" : "ok");
+	}
+
+	return ret;
+}
+
+static int acrnctl_do_stats(int argc, char *argv[])
+{
+	static const char *op_str[BLK_STATS_OPS] = {
+		"read", "write", "flush", "discard"
+	};
+	struct ack_acrnd_stats res;
+	char names[PARAM_LEN] = {};
+	int i, len = 0, ret;
+
+	for (i = 1; i < argc; i++) {
+		ret = snprintf(names + len, sizeof(names) - len, "%s%s",
+				len ? "," : "", argv[i]);
+		if (ret >= sizeof(names) - len) {
+			printf("ERROR: names of the VMs are too long\n");
+			return -1;
+		}
+		len += ret;
+	}
+
+	memset(&res, 0, sizeof(res));
+	ret = stats_vm(names, &res);
+	if (!res.count)
+		return -1;
+
+	printf("VMs: %d\n", res.count);
+	printf("ioreqs: pio %llu, mmio %llu, pci cfg %llu, in %llu rounds\n",
+		res.ioreqs[0], res.ioreqs[1], res.ioreqs[2], res.ioreq_rounds);
+	printf("mevent: %llu events in %llu wakeups\n",
+		res.mevent_events, res.mevent_wakeups);
+	printf("virtqueues: %llu notifies, %llu used buffers, %llu interrupts\n",
+		res.vq_notifies, res.vq_used, res.vq_interrupts);
+	printf("\n%-8s %12s %16s %8s %12s\n", "OP", "REQUESTS", "BYTES",
+		"ERRORS", "AVG_LAT(us)");
+	for (i = 0; i < BLK_STATS_OPS; i++)
+		printf("%-8s %12llu %16llu %8llu %12llu\n", op_str[i],
+			res.blk[i].ops, res.blk[i].bytes, res.blk[i].errors,
+			res.blk[i].ops ? res.blk[i].lat_us / res.blk[i].ops : 0);
+	printf("\ninflight: %llu\n", res.blk_inflight);
+
+	return ret;
+}
+
 static int acrnctl_do_stop(int argc, char *argv[])
 {
 	struct vmmngr_struct *s;
-	int i, force = 0;
+	int i, n = 0, force = 0;
 	const char *vmname = NULL;
 
 	for (i = 1; i < argc; i++) {
 		if (strcmp(argv[i], "--force") && strcmp(argv[i], "-f")) {
 			if (vmname == NULL)
 				vmname = argv[i];
+			n++;
 		} else {
 			force = 1;
 		}
@@ -459,6 +777,9 @@ static int acrnctl_do_stop(int argc, char *argv[])
 		return -1;
 	}
 
+	if (n > 1)
+		return batch_do(ACRND_BATCH_STOP, force, argc, argv);
+
 	s = vmmngr_find(vmname);
 	if (!s) {
 		printf("can't find %s\n", vmname);
@@ -557,6 +878,10 @@ static int acrnctl_do_start(int argc, char *argv[])
 {
 	struct vmmngr_struct *s;
 
+	/* acrnd launches them concurrently, in the background */
+	if (argc > 2)
+		return batch_do(ACRND_BATCH_START, 0, argc, argv);
+
 	s = vmmngr_find(argv[1]);
 	if (!s) {
 		printf("can't find %s\n", argv[1]);
@@ -731,6 +1056,81 @@ static int acrnctl_do_reset(int argc, char *argv[])
 }
 
 /* Default args validation function */
+static int acrnctl_do_query(int argc, char *argv[])
+{
+	return batch_do(ACRND_BATCH_QUERY, 0, argc, argv);
+}
+
+static volatile sig_atomic_t watching;
+
+static void watch_stop(int signo)
+{
+	watching = 0;
+}
+
+static void watch_event(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct req_dm_notify *n = &msg->data.dm_notify;
+
+	n->vmname[sizeof(n->vmname) - 1] = '\0';
+	if (n->state <= VM_STATE_UNKNOWN || n->state > VM_UNTRACKED)
+		return;
+
+	printf("%s\t\t%s\n", n->vmname, state_str[n->state]);
+	fflush(stdout);
+}
+
+static int acrnctl_do_watch(int argc, char *argv[])
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+	char name[PATH_LEN];
+	int fd, acrnd_fd, ret;
+
+	/* acrnd connects back to this server for each ACRND_EVENT */
+	snprintf(name, sizeof(name), "acrnctl_watch%d", getpid());
+	fd = mngr_open_un(name, MNGR_SERVER);
+	if (fd < 0) {
+		printf("Unable to open %s socket\n", name);
+		return -1;
+	}
+	mngr_add_handler(fd, ACRND_EVENT, watch_event, NULL);
+
+	acrnd_fd = mngr_open_un("acrnd", MNGR_CLIENT);
+	if (acrnd_fd < 0) {
+		printf("Unable to open acrnd socket. Is acrnd running?\n");
+		mngr_close(fd);
+		return -1;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = ACRND_SUBSCRIBE;
+	req.timestamp = time(NULL);
+	strncpy(req.data.subscriber, name, sizeof(req.data.subscriber) - 1);
+
+	memset(&ack, 0, sizeof(ack));
+	ret = mngr_send_msg(acrnd_fd, &req, &ack, 1);
+	mngr_close(acrnd_fd);
+	if (ret != sizeof(ack) || ack.data.err) {
+		printf("Unable to subscribe to acrnd\n");
+		mngr_close(fd);
+		return -1;
+	}
+
+	watching = 1;
+	signal(SIGINT, watch_stop);
+	signal(SIGTERM, watch_stop);
+	printf("Watching the VMs, Ctrl-C to stop\n");
+	fflush(stdout);
+	while (watching)
+		sleep(1);
+
+	/* acrnd drops the subscriber once the server is gone */
+	mngr_close(fd);
+	return 0;
+}
+
 int df_valid_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
 {
 	char df_opt[32] = "VM_NAME VM_NAME ...";
@@ -755,6 +1155,114 @@ static int valid_blkrescan_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
 	return 0;
 }
 
+static int valid_blkqos_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
+{
+	char df_opt[] = "VM_NAME slot[,iops=<ops/s>[/<burst>]][,bps=<bytes/s>[/<burst>]]";
+
+	if (argc != 3 || !strcmp(argv[1], "help")) {
+		printf("acrnctl %s %s\n", cmd->cmd, df_opt);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int valid_blkstats_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
+{
+	char df_opt[] = "VM_NAME slot";
+
+	if (argc != 3 || !strcmp(argv[1], "help")) {
+		printf("acrnctl %s %s\n", cmd->cmd, df_opt);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int valid_netpoll_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
+{
+	char df_opt[] = "VM_NAME slot,busyloop=<rx us>[/<tx us>]";
+
+	if (argc != 3 || !strcmp(argv[1], "help")) {
+		printf("acrnctl %s %s\n", cmd->cmd, df_opt);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int valid_rdt_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
+{
+	char df_opt[] = "VM_NAME clos=<clos>[,vcpu=<id>]|cbm=<clos>:<mask>|mba=<clos>:<delay>";
+
+	if (argc != 3 || !strcmp(argv[1], "help")) {
+		printf("acrnctl %s %s\n", cmd->cmd, df_opt);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int valid_balloon_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
+{
+	char df_opt[] = "VM_NAME slot,target=<MB>|stats";
+
+	if (argc != 3 || !strcmp(argv[1], "help")) {
+		printf("acrnctl %s %s\n", cmd->cmd, df_opt);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int valid_cpu_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
+{
+	char df_opt[] = "VM_NAME add=<sos cpu>|remove=<vcpu id>";
+
+	if (argc != 3 || !strcmp(argv[1], "help")) {
+		printf("acrnctl %s %s\n", cmd->cmd, df_opt);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int valid_snapshot_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
+{
+	char df_opt[] = "VM_NAME /path/to/file";
+
+	if (argc != 3 || !strcmp(argv[1], "help")) {
+		printf("acrnctl %s %s\n", cmd->cmd, df_opt);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int valid_migrate_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
+{
+	char df_opt[] = "VM_NAME host:port";
+
+	if (argc != 3 || !strcmp(argv[1], "help")) {
+		printf("acrnctl %s %s\n", cmd->cmd, df_opt);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int valid_clone_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
+{
+	char df_opt[] = "TEMPLATE VM_NAME [-U uuid] [--mac_seed seed] [-s slot]...";
+
+	if (argc < 3 || !strcmp(argv[1], "help")) {
+		printf("acrnctl %s %s\n", cmd->cmd, df_opt);
+		return -1;
+	}
+
+	return 0;
+}
+
 static int valid_add_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
 {
 	char df_opt[32] = "launch_scripts options";
@@ -769,9 +1277,9 @@ static int valid_add_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
 
 static int valid_start_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
 {
-	char df_opt[16] = "VM_NAME";
+	char df_opt[32] = "VM_NAME VM_NAME ...";
 
-	if (argc != 2 || ((argv + 1) && !strcmp(argv[1], "help"))) {
+	if (argc < 2 || ((argv + 1) && !strcmp(argv[1], "help"))) {
 		printf("acrnctl %s %s\n", cmd->cmd, df_opt);
 		return -1;
 	}
@@ -779,6 +1287,16 @@ static int valid_start_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
 	return 0;
 }
 
+static int valid_stats_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
+{
+	if (argc > 1 && !strcmp(argv[1], "help")) {
+		printf("acrnctl %s [VM_NAME ...]\n", cmd->cmd);
+		return -1;
+	}
+
+	return 0;
+}
+
 static int valid_list_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
 {
 	if (argc != 1) {
@@ -793,6 +1311,8 @@ struct acrnctl_cmd acmds[] = {
 	ACMD("list", acrnctl_do_list, LIST_DESC, valid_list_args),
 	ACMD("start", acrnctl_do_start, START_DESC, valid_start_args),
 	ACMD("stop", acrnctl_do_stop, STOP_DESC, df_valid_args),
+	ACMD("query", acrnctl_do_query, QUERY_DESC, df_valid_args),
+	ACMD("watch", acrnctl_do_watch, WATCH_DESC, valid_list_args),
 	ACMD("del", acrnctl_do_del, DEL_DESC, df_valid_args),
 	ACMD("add", acrnctl_do_add, ADD_DESC, valid_add_args),
 	ACMD("pause", acrnctl_do_pause, PAUSE_DESC, df_valid_args),
@@ -801,6 +1321,16 @@ struct acrnctl_cmd acmds[] = {
 	ACMD("resume", acrnctl_do_resume, RESUME_DESC, df_valid_args),
 	ACMD("reset", acrnctl_do_reset, RESET_DESC, df_valid_args),
 	ACMD("blkrescan", acrnctl_do_blkrescan, BLKRESCAN_DESC, valid_blkrescan_args),
+	ACMD("blkqos", acrnctl_do_blkqos, BLKQOS_DESC, valid_blkqos_args),
+	ACMD("blkstats", acrnctl_do_blkstats, BLKSTATS_DESC, valid_blkstats_args),
+	ACMD("netpoll", acrnctl_do_netpoll, NETPOLL_DESC, valid_netpoll_args),
+	ACMD("rdt", acrnctl_do_rdt, RDT_DESC, valid_rdt_args),
+	ACMD("balloon", acrnctl_do_balloon, BALLOON_DESC, valid_balloon_args),
+	ACMD("snapshot", acrnctl_do_snapshot, SNAPSHOT_DESC, valid_snapshot_args),
+	ACMD("migrate", acrnctl_do_migrate, MIGRATE_DESC, valid_migrate_args),
+	ACMD("clone", acrnctl_do_clone, CLONE_DESC, valid_clone_args),
+	ACMD("cpu", acrnctl_do_cpu, CPU_DESC, valid_cpu_args),
+	ACMD("stats", acrnctl_do_stats, STATS_DESC, valid_stats_args),
 };
 
 #define NCMD	(sizeof(acmds)/sizeof(struct acrnctl_cmd))
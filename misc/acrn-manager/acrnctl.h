@@ -9,15 +9,6 @@
 #include <sys/queue.h>
 #include "acrn_mngr.h"
 
-enum vm_state {
-	VM_STATE_UNKNOWN = 0,
-	VM_CREATED,		/* VM created / awaiting start (boot) */
-	VM_STARTED,		/* VM started (booted) */
-	VM_PAUSED,		/* VM paused */
-	VM_SUSPENDED,		/* VM suspended */
-	VM_UNTRACKED,		/* VM not created by acrnctl, or its launch script can change vm name */
-};
-
 extern const char *state_str[];
 
 /**
@@ -33,6 +24,7 @@ struct vmmngr_struct {
 	unsigned long state;
 	unsigned long state_tmp;
 	unsigned long update;   /* update count, remove a vm if no update for it */
+	int pid;		/* of the DM, 0 if not running */
 	LIST_ENTRY(vmmngr_struct) list;
 };
 
@@ -45,6 +37,15 @@ int shell_cmd(const char *cmd, char *outbuf, int len);
  */
 void vmmngr_update(void);
 
+/* set the state a DM notified with DM_NOTIFY, see vmmngr_refresh() */
+void vmmngr_set_state(const char *name, unsigned long state, int pid);
+
+/* cheaper than vmmngr_update() once the states come from DM_NOTIFY:
+ * only add the VMs newly configured, and stop the VMs whose DM is gone
+ * without notice, no DM is queried
+ */
+void vmmngr_refresh(void);
+
 struct vmmngr_list_struct {
 	struct vmmngr_struct *lh_first;
 };
@@ -53,11 +54,23 @@ extern struct vmmngr_list_struct vmmngr_head;
 /* vm life cycle ops */
 int list_vm(void);
 int stop_vm(const char *vmname, int force);
+int batch_vm(int op, int force, const char *names,
+		struct ack_acrnd_batch *result);
 int start_vm(const char *vmname);
 int pause_vm(const char *vmname);
 int continue_vm(const char *vmname);
 int suspend_vm(const char *vmname);
 int resume_vm(const char *vmname, unsigned reason);
 int blkrescan_vm(const char *vmname, char *devargs);
+int blkqos_vm(const char *vmname, char *devargs);
+int netpoll_vm(const char *vmname, char *devargs);
+int rdt_vm(const char *vmname, char *devargs);
+int balloon_vm(const char *vmname, char *devargs);
+int snapshot_vm(const char *vmname, char *path);
+int clone_vm(const char *template, char *devargs);
+int migrate_vm(const char *vmname, char *dest);
+int cpu_vm(const char *vmname, char *devargs);
+int blkstats_vm(const char *vmname, char *devargs, struct ack_blkstats *stats);
+int stats_vm(const char *names, struct ack_acrnd_stats *result);
 
 #endif				/* _ACRNCTL_H_ */
@@ -8,6 +8,10 @@
 #include <signal.h>
 #include <sys/queue.h>
 #include <sys/stat.h>
+#include <sys/mount.h>
+#include <sys/vfs.h>
+#include <sys/wait.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -16,16 +20,19 @@
 #include <stdbool.h>
 #include <errno.h>
 #include <limits.h>
+#include <sys/mman.h>
 #include "mevent.h"
 #include "acrnctl.h"
 #include "acrn_mngr.h"
 #include "ioc.h"
+#include "dm_stats.h"
 
 #define ACRND_NAME		"acrnd"
 #define SOS_LCS_SOCK		"sos-lcs"
 #define HW_IOC_PATH		"/dev/cbc-early-signals"
 #define VMS_STOP_TIMEOUT	20U /* Time to wait VMs to stop */
 #define SOCK_TIMEOUT		2U
+#define ACRND_SUBSCRIBERS_MAX	8
 
 /* acrnd worker timer */
 
@@ -52,6 +59,37 @@ static unsigned char platform_has_hw_ioc;
 static int sigterm = 0; /* Exit acrnd when recevied SIGTERM and stop all vms */
 
 static int logfile = 1;
+
+/*
+ * The hugepage pool: the pages are reserved once at boot, before the SOS
+ * memory gets fragmented, and kept for the pool by the min_size of its
+ * hugetlbfs mounts. A UOS gets its pages as a file of the pool created
+ * on its request, the requests are served one at a time by the mngr poll
+ * thread, so concurrent launches no longer race on nr_hugepages.
+ */
+#define HUGETLBFS_MAGIC		0x958458f6
+
+struct hugetlb_pool {
+	const char *path;
+	const char *nr_pages_path;
+	unsigned long pg_size;
+	unsigned int want;	/* pages asked for on the command line */
+	unsigned int pages;	/* really reserved */
+	int mounted;
+};
+
+static struct hugetlb_pool hugetlb_pool[ACRN_HUGETLB_POOL_LVS] = {
+	{
+		.path = ACRN_HUGETLB_POOL_LV1,
+		.nr_pages_path = "/sys/kernel/mm/hugepages/hugepages-2048kB/nr_hugepages",
+		.pg_size = 2UL << 20,
+	},
+	{
+		.path = ACRN_HUGETLB_POOL_LV2,
+		.nr_pages_path = "/sys/kernel/mm/hugepages/hugepages-1048576kB/nr_hugepages",
+		.pg_size = 1UL << 30,
+	},
+};
 #ifdef MNGR_DEBUG
 static int autostart_delay = 0;
 #endif
@@ -141,7 +179,7 @@ void acrnd_vm_timer_func(struct work_arg *arg)
 		return;
 	}
 
-	vmmngr_update();
+	vmmngr_refresh();
 	vm = vmmngr_find(arg->name);
 	if (!vm) {
 		printf("%s: Can't find %s\n", __func__, arg->name);
@@ -248,7 +286,9 @@ static void acrnd_run_vm(char *name)
 
 	start_vm(name);
 	printf("%s exited!\n", name);
-	exit(0);
+	fflush(stdout);
+	/* not exit(), the atexit handler of acrnd would run in the child */
+	_exit(0);
 }
 
 static int active_all_vms(void)
@@ -258,7 +298,7 @@ static int active_all_vms(void)
 	pid_t pid;
 	unsigned reason = 0;
 
-	vmmngr_update();
+	vmmngr_refresh();
 
 	LIST_FOREACH(vm, &vmmngr_head, list) {
 		switch (vm->state) {
@@ -286,7 +326,7 @@ static void stop_all_vms(void)
 	struct vmmngr_struct *vm;
 	int err;
 
-	vmmngr_update();
+	vmmngr_refresh();
 
 	LIST_FOREACH(vm, &vmmngr_head, list) {
 		err = stop_vm(vm->name, 0);
@@ -303,7 +343,7 @@ static int wakeup_suspended_vms(unsigned wakeup_reason)
 	struct vmmngr_struct *vm;
 	int ret = 0;
 
-	vmmngr_update();
+	vmmngr_refresh();
 
 	LIST_FOREACH(vm, &vmmngr_head, list) {
 		if (vm->state == VM_SUSPENDED)
@@ -352,7 +392,7 @@ static void handle_timer_req(struct mngr_msg *msg, int client_fd, void *param)
 	ack.timestamp = msg->timestamp;
 	ack.data.err = -1;
 
-	vmmngr_update();
+	vmmngr_refresh();
 	vm = vmmngr_find(msg->data.acrnd_timer.name);
 	if (!vm) {
 		printf("%s: Can't find %s\n", __func__, msg->data.acrnd_timer.name);
@@ -472,7 +512,7 @@ static int wait_for_stop(unsigned int timeout)
 
 	/* list and update the vm status */
 	do {
-		vmmngr_update();
+		vmmngr_refresh();
 
 		printf("Waiting %lu seconds for all vms enter S3/S5 state\n", t);
 
@@ -627,10 +667,498 @@ reply_ack:
 		mngr_send_msg(client_fd, &ack, NULL, 0);
 }
 
+static int read_nr_hugepages(const char *path)
+{
+	FILE *fp;
+	int pages = -1;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return -1;
+	if (fscanf(fp, "%d", &pages) != 1)
+		pages = -1;
+	fclose(fp);
+	return pages;
+}
+
+static int write_nr_hugepages(const char *path, int pages)
+{
+	FILE *fp;
+	int ret;
+
+	fp = fopen(path, "w");
+	if (fp == NULL)
+		return -1;
+	ret = fprintf(fp, "%d", pages);
+	if (fclose(fp) != 0)
+		ret = -1;
+	return (ret < 0) ? -1 : 0;
+}
+
+/* mkdir -p */
+static int create_dirs(const char *dir)
+{
+	char path[PATH_LEN];
+	size_t i, len;
+
+	len = strnlen(dir, PATH_LEN - 1);
+	strncpy(path, dir, PATH_LEN - 1);
+	path[len] = '\0';
+	for (i = 1; i <= len; i++) {
+		if (path[i] != '/' && path[i] != '\0')
+			continue;
+		path[i] = '\0';
+		if (mkdir(path, 0755) && errno != EEXIST) {
+			perror(path);
+			return -1;
+		}
+		path[i] = (i < len) ? '/' : '\0';
+	}
+	return 0;
+}
+
+/* Reserve the pages of the pool on top of what the SOS already has */
+static void init_hugetlb_pool(void)
+{
+	struct hugetlb_pool *pool;
+	struct statfs fs;
+	char opt[64];
+	int lvl, orig, cur;
+
+	for (lvl = 0; lvl < ACRN_HUGETLB_POOL_LVS; lvl++) {
+		pool = &hugetlb_pool[lvl];
+		if (pool->want == 0)
+			continue;
+
+		/* left mounted by a previous acrnd, its UOSes may still run */
+		if (!statfs(pool->path, &fs) && fs.f_type == HUGETLBFS_MAGIC) {
+			pool->mounted = 1;
+			printf("hugepage pool: reuse %s\n", pool->path);
+			continue;
+		}
+
+		orig = read_nr_hugepages(pool->nr_pages_path);
+		if (orig < 0 || create_dirs(pool->path))
+			continue;
+		write_nr_hugepages(pool->nr_pages_path, orig + pool->want);
+		cur = read_nr_hugepages(pool->nr_pages_path);
+		if (cur <= orig) {
+			printf("%s: no hugepage of 0x%lx reserved\n", __func__,
+				pool->pg_size);
+			continue;
+		}
+
+		snprintf(opt, sizeof(opt), "pagesize=%luK,size=%lu,min_size=%lu",
+			pool->pg_size >> 10,
+			(unsigned long)(cur - orig) * pool->pg_size,
+			(unsigned long)(cur - orig) * pool->pg_size);
+		if (mount("none", pool->path, "hugetlbfs", 0, opt)) {
+			printf("%s: failed to mount %s: %s\n", __func__,
+				pool->path, strerror(errno));
+			write_nr_hugepages(pool->nr_pages_path, orig);
+			continue;
+		}
+		pool->mounted = 1;
+		pool->pages = cur - orig;
+		printf("hugepage pool: %u pages of 0x%lx in %s\n", pool->pages,
+			pool->pg_size, pool->path);
+	}
+}
+
+static void deinit_hugetlb_pool(void)
+{
+	struct hugetlb_pool *pool;
+	int lvl, cur;
+
+	for (lvl = ACRN_HUGETLB_POOL_LVS - 1; lvl >= 0; lvl--) {
+		pool = &hugetlb_pool[lvl];
+		if (!pool->mounted)
+			continue;
+		/* busy as long as a UOS still maps its file */
+		if (umount(pool->path))
+			continue;
+		cur = read_nr_hugepages(pool->nr_pages_path);
+		if (cur >= (int)pool->pages)
+			write_nr_hugepages(pool->nr_pages_path, cur - pool->pages);
+		pool->mounted = 0;
+	}
+}
+
+/* Pages promised to the files of the pool, other than the one of vmname */
+static unsigned long hugetlb_pool_committed(struct hugetlb_pool *pool,
+		const char *vmname)
+{
+	char path[PATH_LEN + MAX_VMNAME_LEN];
+	unsigned long bytes = 0;
+	struct dirent *entry;
+	struct stat st;
+	DIR *dir;
+
+	dir = opendir(pool->path);
+	if (dir == NULL)
+		return 0;
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] == '.' || !strcmp(entry->d_name, vmname))
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", pool->path, entry->d_name);
+		if (!stat(path, &st) && S_ISREG(st.st_mode))
+			bytes += st.st_size;
+	}
+	closedir(dir);
+
+	return bytes / pool->pg_size;
+}
+
+/*
+ * Hand out the pages of a UOS as a pool file named after it, sized to
+ * them. The pages themselves are only allocated when the DM maps and
+ * touches the file, from the reservation of the mount, and the DM
+ * unlinks the file when it exits, which gives them back to the pool.
+ */
+static void handle_hugetlb_req(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct req_acrnd_hugetlb *req = &msg->data.acrnd_hugetlb;
+	struct hugetlb_pool *pool;
+	struct mngr_msg ack;
+	struct statfs fs;
+	char path[PATH_LEN + MAX_VMNAME_LEN];
+	int lvl, fd;
+
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+	ack.data.err = -1;
+
+	req->vmname[MAX_VMNAME_LEN - 1] = '\0';
+	if (req->vmname[0] == '\0' || strchr(req->vmname, '/'))
+		goto reply_ack;
+
+	for (lvl = 0; lvl < ACRN_HUGETLB_POOL_LVS; lvl++) {
+		pool = &hugetlb_pool[lvl];
+		if (req->pages[lvl] == 0)
+			continue;
+		if (!pool->mounted || statfs(pool->path, &fs) ||
+			hugetlb_pool_committed(pool, req->vmname) + req->pages[lvl]
+				> fs.f_blocks) {
+			printf("%s: no %u pages of 0x%lx for %s\n", __func__,
+				req->pages[lvl], pool->pg_size, req->vmname);
+			goto reply_ack;
+		}
+	}
+
+	for (lvl = 0; lvl < ACRN_HUGETLB_POOL_LVS; lvl++) {
+		pool = &hugetlb_pool[lvl];
+		if (!pool->mounted)
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", pool->path, req->vmname);
+		unlink(path);	/* left by a DM that crashed */
+		if (req->pages[lvl] == 0)
+			continue;
+
+		fd = open(path, O_CREAT | O_RDWR, 0600);
+		if (fd < 0)
+			goto undo;
+		if (ftruncate(fd, (off_t)req->pages[lvl] * pool->pg_size)) {
+			close(fd);
+			goto undo;
+		}
+		close(fd);
+	}
+
+	ack.data.err = 0;
+	goto reply_ack;
+
+ undo:
+	for (; lvl >= 0; lvl--) {
+		snprintf(path, sizeof(path), "%s/%s", hugetlb_pool[lvl].path,
+			req->vmname);
+		if (hugetlb_pool[lvl].mounted)
+			unlink(path);
+	}
+ reply_ack:
+	if (client_fd > 0)
+		mngr_send_msg(client_fd, &ack, NULL, 0);
+}
+
+/* -p 2M:pages,1G:pages */
+static int parse_hugetlb_pool(char *arg)
+{
+	char *cp, *end;
+	long pages;
+	int lvl;
+
+	while ((cp = strsep(&arg, ",")) != NULL) {
+		if (!strncmp(cp, "2M:", 3))
+			lvl = 0;
+		else if (!strncmp(cp, "1G:", 3))
+			lvl = 1;
+		else
+			return -EINVAL;
+
+		errno = 0;
+		pages = strtol(cp + 3, &end, 10);
+		if (errno || *end != '\0' || pages < 0 || pages > INT_MAX)
+			return -EINVAL;
+		hugetlb_pool[lvl].want = pages;
+	}
+
+	return 0;
+}
+
+/*
+ * The VM states are kept from the DM_NOTIFY of the DMs, rather than from
+ * querying every DM found in ACRN_DM_SOCK_PATH. The subscribers are the
+ * names of mngr servers, each state change is sent to them as ACRND_EVENT.
+ * All of this runs in the poll thread of acrnd_fd.
+ */
+static char subscribers[ACRND_SUBSCRIBERS_MAX][PATH_LEN];
+
+static void notify_subscribers(struct mngr_msg *msg)
+{
+	struct mngr_msg req;
+	int i, fd;
+
+	req = *msg;
+	req.msgid = ACRND_EVENT;
+
+	for (i = 0; i < ACRND_SUBSCRIBERS_MAX; i++) {
+		if (!subscribers[i][0])
+			continue;
+
+		fd = mngr_open_un(subscribers[i], MNGR_CLIENT);
+		if (fd < 0) {
+			printf("%s: Drop subscriber %s\n", __func__, subscribers[i]);
+			subscribers[i][0] = '\0';
+			continue;
+		}
+		mngr_send_msg(fd, &req, NULL, 0);
+		mngr_close(fd);
+	}
+}
+
+static void handle_dm_notify(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct req_dm_notify *n = &msg->data.dm_notify;
+
+	n->vmname[sizeof(n->vmname) - 1] = '\0';
+	if (n->state <= VM_STATE_UNKNOWN || n->state > VM_SUSPENDED) {
+		printf("%s: Unknown state %d of %s\n", __func__, n->state, n->vmname);
+		return;
+	}
+
+	printf("%s: %s %s\n", __func__, n->vmname, state_str[n->state]);
+	vmmngr_set_state(n->vmname, n->state, n->pid);
+	notify_subscribers(msg);
+}
+
+static void handle_subscribe(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct mngr_msg ack;
+	int i, free_slot = -1;
+
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+	ack.data.err = 0;
+
+	msg->data.subscriber[sizeof(msg->data.subscriber) - 1] = '\0';
+	for (i = 0; i < ACRND_SUBSCRIBERS_MAX; i++) {
+		if (!strcmp(subscribers[i], msg->data.subscriber))
+			goto reply_ack;
+		if (!subscribers[i][0] && free_slot < 0)
+			free_slot = i;
+	}
+
+	if (free_slot < 0 || !msg->data.subscriber[0]) {
+		ack.data.err = -1;
+		goto reply_ack;
+	}
+
+	strncpy(subscribers[free_slot], msg->data.subscriber, PATH_LEN - 1);
+	printf("%s: Add subscriber %s\n", __func__, subscribers[free_slot]);
+
+ reply_ack:
+	if (client_fd > 0)
+		mngr_send_msg(client_fd, &ack, NULL, 0);
+}
+
+static int batch_one(int op, int force, const char *name)
+{
+	struct vmmngr_struct *vm;
+	pid_t pid;
+
+	vm = vmmngr_find(name);
+	switch (op) {
+	case ACRND_BATCH_START:
+		if (!vm || vm->state != VM_CREATED) {
+			printf("%s: Can't start %s\n", __func__, name);
+			return -1;
+		}
+
+		/* not waited for, the DM notifies once started */
+		pid = fork();
+		if (!pid)
+			acrnd_run_vm(vm->name);
+		if (pid < 0)
+			return -1;
+		/* the launch script until the DM notifies its own pid */
+		vmmngr_set_state(vm->name, VM_STARTED, pid);
+		return 0;
+	case ACRND_BATCH_STOP:
+		if (!vm || vm->state == VM_CREATED) {
+			printf("%s: Can't stop %s\n", __func__, name);
+			return -1;
+		}
+		return stop_vm(name, force);
+	case ACRND_BATCH_QUERY:
+		return vm ? vm->state : VM_STATE_UNKNOWN;
+	default:
+		return -1;
+	}
+}
+
+static void handle_batch_req(struct mngr_msg *msg, int client_fd, void *param)
+{
+	struct req_acrnd_batch *req = &msg->data.acrnd_batch;
+	struct ack_acrnd_batch *res;
+	struct mngr_msg ack;
+	char *name, *save = NULL;
+	int i = 0;
+
+	memset(&ack, 0, sizeof(ack));
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+	res = &ack.data.acrnd_batch_ack;
+
+	req->names[sizeof(req->names) - 1] = '\0';
+	vmmngr_refresh();
+
+	for (name = strtok_r(req->names, ",", &save); name;
+			name = strtok_r(NULL, ",", &save)) {
+		if (i >= ACRND_BATCH_MAX) {
+			printf("%s: More than %d VMs\n", __func__, ACRND_BATCH_MAX);
+			res->err = -1;
+			break;
+		}
+
+		res->states[i] = batch_one(req->op, req->force, name);
+		if (req->op != ACRND_BATCH_QUERY && res->states[i])
+			res->err = -1;
+		i++;
+	}
+	res->count = i;
+
+	if (client_fd > 0)
+		mngr_send_msg(client_fd, &ack, NULL, 0);
+}
+
+/*
+ * Add the region a DM publishes in the file path, see dm_stats.h, to the
+ * sums of res. The DMs are not asked, nor woken up, the region is mapped
+ * read-only and copied under its seqlock.
+ */
+static int stats_add_one(const char *path, struct ack_acrnd_stats *res)
+{
+	static struct dm_stats_region st;
+	struct dm_stats_region *r;
+	unsigned int i, j;
+	struct stat sb;
+	int fd, ret;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &sb) < 0 || sb.st_size < sizeof(*r)) {
+		close(fd);
+		return -1;
+	}
+	r = mmap(NULL, sizeof(*r), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (r == MAP_FAILED)
+		return -1;
+	ret = dm_stats_read(r, &st);
+	munmap(r, sizeof(*r));
+
+	/* left behind by a DM which did not exit cleanly */
+	if (ret || (kill(st.pid, 0) < 0 && errno == ESRCH))
+		return -1;
+
+	for (i = 0; i < DM_IOREQ_STATS_TYPES && i < DM_STATS_IOREQ_TYPES; i++)
+		res->ioreqs[i] += st.ioreq.reqs[i];
+	res->ioreq_rounds += st.ioreq.rounds;
+	res->mevent_wakeups += st.mevent.wakeups;
+	res->mevent_events += st.mevent.events;
+	for (i = 0; i < st.nvq && i < DM_STATS_MAX_VQ; i++) {
+		res->vq_notifies += st.vq[i].notifies;
+		res->vq_used += st.vq[i].used;
+		res->vq_interrupts += st.vq[i].interrupts;
+	}
+	for (i = 0; i < st.nblk && i < DM_STATS_MAX_BLK; i++) {
+		for (j = 0; j < BLK_STATS_OPS && j < DM_STATS_BLK_OPS; j++) {
+			res->blk[j].ops += st.blk[i].ops[j];
+			res->blk[j].bytes += st.blk[i].bytes[j];
+			res->blk[j].errors += st.blk[i].errors[j];
+			res->blk[j].lat_us += st.blk[i].lat_us[j];
+		}
+		res->blk_inflight += st.blk[i].inflight;
+	}
+	res->count++;
+	return 0;
+}
+
+static void handle_stats_req(struct mngr_msg *msg, int client_fd, void *param)
+{
+	char *names = msg->data.stats_names;
+	struct ack_acrnd_stats *res;
+	struct mngr_msg ack;
+	char path[PATH_MAX];
+	char *name, *save = NULL;
+	struct dirent *entry;
+	DIR *dir;
+
+	memset(&ack, 0, sizeof(ack));
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+	res = &ack.data.acrnd_stats_ack;
+
+	names[PARAM_LEN - 1] = '\0';
+	if (names[0]) {
+		for (name = strtok_r(names, ",", &save); name;
+				name = strtok_r(NULL, ",", &save)) {
+			snprintf(path, sizeof(path), DM_STATS_PATH, name);
+			if (stats_add_one(path, res)) {
+				printf("%s: No statistics of %s\n", __func__, name);
+				res->err = -1;
+			}
+		}
+	} else {
+		dir = opendir(DM_STATS_DIR);
+		if (!dir) {
+			res->err = -1;
+			goto reply_ack;
+		}
+		while ((entry = readdir(dir))) {
+			if (strncmp(entry->d_name, DM_STATS_PREFIX,
+					strlen(DM_STATS_PREFIX)))
+				continue;
+			snprintf(path, sizeof(path), "%s/%s", DM_STATS_DIR,
+					entry->d_name);
+			stats_add_one(path, res);
+		}
+		closedir(dir);
+	}
+
+ reply_ack:
+	if (client_fd > 0)
+		mngr_send_msg(client_fd, &ack, NULL, 0);
+}
+
 static void handle_on_exit(void)
 {
 	printf("Exiting from acrnd\n");
 	store_timer_list();
+	deinit_hugetlb_pool();
 
 	if (acrnd_fd > 0) {
 		mngr_close(acrnd_fd);
@@ -675,18 +1203,19 @@ static void sigterm_handler(int signo)
 	sigterm = 1;
 }
 
-static const char optString[] = "td:h";
+static const char optString[] = "tp:d:h";
 
 static void display_usage(void)
 {
 	printf("acrnd - Daemon for ACRN VM Management\n"
 #ifdef MNGR_DEBUG
-	       "[Usage] acrnd [-t] [-d delay] [-h]\n\n"
+	       "[Usage] acrnd [-t] [-p pool] [-d delay] [-h]\n\n"
 #else
-	       "[Usage] acrnd [-t] [-h]\n\n"
+	       "[Usage] acrnd [-t] [-p pool] [-h]\n\n"
 #endif
 	       "[Options]\n"
 	       "\t-t: print messages to stdout\n"
+	       "\t-p: hugepages to reserve for the UOSes, e.g. 1G:8,2M:512\n"
 #ifdef MNGR_DEBUG
 	       "\t-d: delay the autostarting of VMs, <0-60> in second\n"
 #endif
@@ -703,6 +1232,12 @@ static int parse_opt(int argc, char *argv[])
 		case 't':
 			logfile = 0;
 			break;
+		case 'p':
+			if (parse_hugetlb_pool(optarg)) {
+				printf("'-p' invalid parameter: %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
 #ifdef MNGR_DEBUG
 		case 'd':
 			ret = strtol(optarg, NULL, 10);
@@ -768,6 +1303,13 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
+	init_hugetlb_pool();
+	mngr_add_handler(acrnd_fd, ACRND_HUGETLB, handle_hugetlb_req, NULL);
+
+	/* the only scan of the DMs, afterwards they notify their states */
+	vmmngr_update();
+	mngr_add_handler(acrnd_fd, DM_NOTIFY, handle_dm_notify, NULL);
+
 	if (init_vm()) {
 		printf("%s: Failed to init_vm\n", __func__);
 		return -1;
@@ -784,10 +1326,16 @@ int main(int argc, char *argv[])
 	mngr_add_handler(acrnd_fd, ACRND_TIMER, handle_timer_req, NULL);
 	mngr_add_handler(acrnd_fd, ACRND_STOP, handle_acrnd_stop, NULL);
 	mngr_add_handler(acrnd_fd, ACRND_RESUME, handle_acrnd_resume, NULL);
+	mngr_add_handler(acrnd_fd, ACRND_BATCH, handle_batch_req, NULL);
+	mngr_add_handler(acrnd_fd, ACRND_SUBSCRIBE, handle_subscribe, NULL);
+	mngr_add_handler(acrnd_fd, ACRND_STATS, handle_stats_req, NULL);
 
 	/* Last thing, run our timer works */
 	while (!sigterm) {
 		try_do_works();
+		/* the launches forked, or vmmngr_refresh() sees them alive */
+		while (waitpid(-1, NULL, WNOHANG) > 0)
+			;
 		sleep(1);
 	}
 
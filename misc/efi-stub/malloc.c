@@ -139,12 +139,17 @@ emalloc_reserved_aligned(EFI_PHYSICAL_ADDRESS *addr, UINTN size, UINTN align,
 		}
 		start = (start + align - 1) & ~(align - 1);
 
-		 /* Since this routine is called during booting, memory block is large
-		  * enought, the reduction of memory size for memory alignment won't
-		  * impact allocation. It is true in most cases. if it is not true, loop
-		  * again
-		  */
-		if ((start + size <= end) && (start + size <= maxaddr)) {
+		if (end > maxaddr) {
+			end = maxaddr;
+		}
+
+		/* Take the top of the block: it ends where the memory stops, so
+		 * the 1G page around that end is split in the SOS EPT anyway, and
+		 * a hypervisor fitting below it costs no other 1G mapping. At the
+		 * bottom of the block, it could split a 1G page fully of RAM.
+		 */
+		if ((end > size) && (((end - size) & ~(align - 1)) >= start)) {
+			start = (end - size) & ~(align - 1);
 			err = allocate_pages(AllocateAddress, EfiReservedMemoryType, pages, &start);
 			if (err == EFI_SUCCESS) {
 				*addr = start;
@@ -45,21 +45,25 @@
 #define __STDLIB_H__
 
 
+/*
+ * The hypervisor needs the enhanced REP MOVSB/STOSB (ERMS) anyway, with it
+ * one string instruction copies the hypervisor image, or clears the boot
+ * memory, many times faster than a byte loop.
+ */
 static inline void memset(void *dstv, char ch, UINTN size)
 {
-	char *dst = dstv;
-	int32_t i;
-
-	for (i = 0; i < size; i++)
-		dst[i] = ch;
+	asm volatile ("rep; stosb"
+		: "+D"(dstv), "+c"(size)
+		: "a"(ch)
+		: "memory");
 }
 
 static inline void memcpy(char *dst, const char *src, UINTN size)
 {
-	int32_t i;
-
-	for (i = 0; i < size; i++)
-		*dst++ = *src++;
+	asm volatile ("rep; movsb"
+		: "+D"(dst), "+S"(src), "+c"(size)
+		:
+		: "memory");
 }
 
 static inline int32_t strlen(const char *str)
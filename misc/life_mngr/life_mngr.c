@@ -8,8 +8,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define SOS_REQ		"shutdown"
 #define UOS_ACK		"acked"
@@ -17,6 +21,34 @@
 #define MSG_SIZE	8U
 #define NODE_SIZE	3U
 
+/*
+ * The mailbox in the shared memory (BAR2) of an ivshmem device, the PCI
+ * device of the SOS and of each UOS attached to the same region: a slot
+ * per IVPosition (BAR0 offset 8). The SOS writes req then req_seq, the
+ * UOS acks by copying req_seq to ack_seq before it acts. The UOS bumps
+ * heartbeat every LM_POLL_MS.
+ *
+ * A doorbell would need a kernel driver to get the MSI-X vectors of the
+ * device to user space, the slots are polled instead.
+ */
+#define LM_IVPOSITION	0x08U
+#define LM_REGS_SIZE	0x100U
+#define LM_MAX_PEERS	8U
+#define LM_POLL_MS	10U
+#define LM_ACK_TIMEOUT_MS	1000U
+
+#define LM_REQ_SHUTDOWN	1U
+#define LM_REQ_SUSPEND	2U
+
+struct lm_slot {
+	uint32_t req;
+	uint32_t req_seq;
+	uint32_t ack_seq;
+	uint32_t reserved;
+	uint64_t heartbeat;
+	uint8_t pad[40];
+};
+
 enum nodetype {
 	NODE_UNKNOWN = 0,
 	NODE_UOS_SERVER,
@@ -63,6 +95,162 @@ int set_serial_interface_attributes(int fd, int speed)
 	return 0;
 }
 
+static void *map_resource(const char *devpath, int bar, size_t size)
+{
+	char path[256];
+	struct stat st;
+	void *p;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/resource%d", devpath, bar);
+	fd = open(path, O_RDWR | O_SYNC);
+	if (fd < 0) {
+		printf("Error opening %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	if (size == 0 && fstat(fd, &st) == 0)
+		size = (size_t)st.st_size;
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		printf("Error mapping %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	return p;
+}
+
+static struct lm_slot *map_mailbox(const char *devpath, uint32_t *ivpos)
+{
+	volatile uint32_t *regs;
+	struct lm_slot *slots;
+
+	regs = map_resource(devpath, 0, LM_REGS_SIZE);
+	if (regs == NULL)
+		return NULL;
+	*ivpos = regs[LM_IVPOSITION / 4U];
+	munmap((void *)regs, LM_REGS_SIZE);
+
+	slots = map_resource(devpath, 2, LM_MAX_PEERS * sizeof(struct lm_slot));
+	if (slots != NULL && *ivpos >= LM_MAX_PEERS) {
+		printf("IVPosition %u out of the mailbox\n", *ivpos);
+		return NULL;
+	}
+	return slots;
+}
+
+static void sleep_ms(unsigned int ms)
+{
+	struct timespec ts = { ms / 1000U, (ms % 1000U) * 1000000L };
+
+	nanosleep(&ts, NULL);
+}
+
+/* UOS-server wait for the requests of SOS in its slot */
+static int uos_shm_server(const char *devpath)
+{
+	struct lm_slot *slot;
+	uint32_t ivpos, seq;
+	FILE *fp;
+
+	slot = map_mailbox(devpath, &ivpos);
+	if (slot == NULL)
+		return -ENODEV;
+	slot += ivpos;
+
+	seq = __atomic_load_n(&slot->req_seq, __ATOMIC_ACQUIRE);
+	__atomic_store_n(&slot->ack_seq, seq, __ATOMIC_RELEASE);
+	do {
+		__atomic_add_fetch(&slot->heartbeat, 1, __ATOMIC_RELAXED);
+		sleep_ms(LM_POLL_MS);
+		if (__atomic_load_n(&slot->req_seq, __ATOMIC_ACQUIRE) == seq)
+			continue;
+
+		seq = slot->req_seq;
+		__atomic_store_n(&slot->ack_seq, seq, __ATOMIC_RELEASE);
+		if (slot->req == LM_REQ_SHUTDOWN) {
+			printf("SOS start shutdown\n");
+			system("poweroff");
+			break;
+		} else if (slot->req == LM_REQ_SUSPEND) {
+			printf("SOS start suspend\n");
+			fp = fopen("/sys/power/state", "w");
+			if (fp != NULL) {
+				fputs("mem", fp);
+				fclose(fp);
+			}
+		}
+	} while (1);
+
+	return 0;
+}
+
+/*
+ * SOS-client post a request to the slots of all the live UOS servers, or
+ * of one IVPosition, at once, then wait for their acks
+ */
+static int sos_shm_client(const char *devpath, const char *cmd,
+		const char *target)
+{
+	struct lm_slot *slots;
+	uint64_t beats[LM_MAX_PEERS];
+	uint32_t ivpos, i, req, posted = 0, acked = 0, waited;
+	uint32_t seqs[LM_MAX_PEERS];
+
+	if (strcmp(cmd, "shutdown") == 0)
+		req = LM_REQ_SHUTDOWN;
+	else if (strcmp(cmd, "suspend") == 0)
+		req = LM_REQ_SUSPEND;
+	else if (strcmp(cmd, "status") == 0)
+		req = 0U;
+	else {
+		printf("Invalid request %s\n", cmd);
+		return -EINVAL;
+	}
+
+	slots = map_mailbox(devpath, &ivpos);
+	if (slots == NULL)
+		return -ENODEV;
+
+	/* the servers alive bump their heartbeat within a few polls */
+	for (i = 0U; i < LM_MAX_PEERS; i++)
+		beats[i] = __atomic_load_n(&slots[i].heartbeat, __ATOMIC_RELAXED);
+	sleep_ms(LM_POLL_MS * 5U);
+
+	for (i = 0U; i < LM_MAX_PEERS; i++) {
+		if (i == ivpos ||
+		    __atomic_load_n(&slots[i].heartbeat, __ATOMIC_RELAXED) == beats[i])
+			continue;
+		if (req == 0U) {
+			printf("IVPosition %u alive\n", i);
+			continue;
+		}
+		if (strcmp(target, "all") != 0 && (uint32_t)atoi(target) != i)
+			continue;
+
+		slots[i].req = req;
+		seqs[i] = slots[i].req_seq + 1U;
+		__atomic_store_n(&slots[i].req_seq, seqs[i], __ATOMIC_RELEASE);
+		posted |= 1U << i;
+	}
+
+	for (waited = 0U; posted != acked && waited < LM_ACK_TIMEOUT_MS;
+			waited += LM_POLL_MS) {
+		sleep_ms(LM_POLL_MS);
+		for (i = 0U; i < LM_MAX_PEERS; i++) {
+			if ((posted & (1U << i)) != 0U &&
+			    __atomic_load_n(&slots[i].ack_seq, __ATOMIC_ACQUIRE) == seqs[i])
+				acked |= 1U << i;
+		}
+	}
+
+	for (i = 0U; i < LM_MAX_PEERS; i++) {
+		if ((posted & ~acked & (1U << i)) != 0U)
+			printf("IVPosition %u did not ack %s\n", i, cmd);
+	}
+	return (posted == acked) ? 0 : -ETIMEDOUT;
+}
+
 int main(int argc, char *argv[])
 {
 	char *devname_uos = "";
@@ -75,6 +263,21 @@ int main(int argc, char *argv[])
 		return -EINVAL;
 	}
 
+	/*
+	 * ./life_mngr uos shm /sys/bus/pci/devices/<ivshmem BDF>
+	 * ./life_mngr sos shm <ivshmem dev> shutdown|suspend|status [all|<IVPosition>]
+	 */
+	if (strcmp(argv[2], "shm") == 0) {
+		if (argc > 3 && strncmp("uos", argv[1], NODE_SIZE) == 0)
+			return uos_shm_server(argv[3]);
+		if (argc > 4 && strncmp("sos", argv[1], NODE_SIZE) == 0)
+			return sos_shm_client(argv[3], argv[4],
+					(argc > 5) ? argv[5] : "all");
+		printf("Invalid param. Example: [./life_mngr uos shm "
+			"/sys/bus/pci/devices/0000:00:06.0].\n");
+		return -EINVAL;
+	}
+
 	if (strncmp("uos", argv[1], NODE_SIZE) == 0) {
 		node = NODE_UOS_SERVER;
 	} else if (strncmp("sos", argv[1], NODE_SIZE) == 0) {
@@ -209,26 +209,92 @@ fail:
 	return -1;
 }
 
-static int crash_match_file(const struct crash_t *crash, const char *filename)
+/*
+ * The trigger files read by one reclassification. The children of each
+ * level are matched against the same files, each is read once.
+ */
+#define TRFILE_CACHE_MAX 16
+
+struct trfile_cache {
+	int num;
+	struct {
+		char *path;
+		void *cnt;
+		size_t size;
+	} files[TRFILE_CACHE_MAX];
+};
+
+static void *trfile_cache_read(struct trfile_cache *cache,
+				const char *filename, size_t *size)
 {
-	size_t size;
+	int i;
 	void *cnt;
 
-	if (read_file(filename, &size, &cnt) == -1) {
+	for (i = 0; cache && i < cache->num; i++) {
+		if (!strcmp(cache->files[i].path, filename)) {
+			*size = cache->files[i].size;
+			return cache->files[i].cnt;
+		}
+	}
+
+	if (read_file(filename, size, &cnt) == -1) {
 		LOGE("read %s failed, error (%s)\n", filename, strerror(errno));
-		return 0;
+		return NULL;
 	}
-	if (!size)
-		return 0;
-	if (crash_match_content(crash, cnt)) {
-		free(cnt);
-		return 1;
+
+	if (cache && cache->num < TRFILE_CACHE_MAX) {
+		cache->files[cache->num].path = strdup(filename);
+		if (cache->files[cache->num].path) {
+			cache->files[cache->num].cnt = cnt;
+			cache->files[cache->num].size = *size;
+			cache->num++;
+		}
+	}
+
+	return cnt;
+}
+
+static void trfile_cache_put(struct trfile_cache *cache, void *cnt)
+{
+	int i;
+
+	for (i = 0; cache && i < cache->num; i++) {
+		if (cache->files[i].cnt == cnt)
+			return;
 	}
 	free(cnt);
-	return 0;
 }
 
-int crash_match_filefmt(const struct crash_t *crash, const char *filefmt)
+static void trfile_cache_free(struct trfile_cache *cache)
+{
+	int i;
+
+	for (i = 0; i < cache->num; i++) {
+		free(cache->files[i].path);
+		free(cache->files[i].cnt);
+	}
+	cache->num = 0;
+}
+
+static int crash_match_file(const struct crash_t *crash, const char *filename,
+			struct trfile_cache *cache)
+{
+	size_t size;
+	void *cnt;
+	int ret;
+
+	cnt = trfile_cache_read(cache, filename, &size);
+	if (!cnt)
+		return 0;
+
+	ret = size && crash_match_content(crash, cnt);
+	trfile_cache_put(cache, cnt);
+	return ret;
+}
+
+static int crash_match_filefmt_cached(const struct crash_t *crash,
+				const char *filefmt,
+				struct trfile_cache *cache)
 {
 	int count;
 	int i;
@@ -239,7 +305,7 @@ int crash_match_filefmt(const struct crash_t *crash, const char *filefmt)
 	if (count <= 0)
 		return ret;
 	for (i = 0; i < count; i++) {
-		if (crash_match_file(crash, files[i])) {
+		if (crash_match_file(crash, files[i], cache)) {
 			ret = 1;
 			break;
 		}
@@ -250,8 +316,14 @@ int crash_match_filefmt(const struct crash_t *crash, const char *filefmt)
 	return ret;
 }
 
+int crash_match_filefmt(const struct crash_t *crash, const char *filefmt)
+{
+	return crash_match_filefmt_cached(crash, filefmt, NULL);
+}
+
 static struct crash_t *crash_find_matched_child(const struct crash_t *crash,
-						const char *rtrfmt)
+						const char *rtrfmt,
+						struct trfile_cache *cache)
 {
 	struct crash_t *child;
 	struct crash_t *matched_child = NULL;
@@ -269,7 +341,7 @@ static struct crash_t *crash_find_matched_child(const struct crash_t *crash,
 		else
 			trfile_fmt = child->trigger->path;
 
-		if (crash_match_filefmt(child, trfile_fmt)) {
+		if (crash_match_filefmt_cached(child, trfile_fmt, cache)) {
 			matched_child = child;
 			break;
 		}
@@ -300,9 +372,10 @@ static struct crash_t *crash_reclassify_by_content(const struct crash_t *rcrash,
 	const struct crash_t *crash;
 	const struct crash_t *ret_crash = rcrash;
 	const char *trfile_fmt;
+	struct trfile_cache cache = { .num = 0 };
 	char **trfiles;
 	void *content;
-	unsigned long size;
+	size_t size;
 	int i;
 
 	if (!rcrash || !data || !dsize)
@@ -311,7 +384,7 @@ static struct crash_t *crash_reclassify_by_content(const struct crash_t *rcrash,
 	crash = rcrash;
 
 	while (1) {
-		crash = crash_find_matched_child(crash, rtrfile_fmt);
+		crash = crash_find_matched_child(crash, rtrfile_fmt, &cache);
 		if (!crash)
 			break;
 
@@ -325,30 +398,27 @@ static struct crash_t *crash_reclassify_by_content(const struct crash_t *rcrash,
 
 	/* trfile may not be specified */
 	if (!trfile_fmt)
-		return (struct crash_t *)ret_crash;
+		goto free_cache;
 
 	count = config_fmt_to_files(trfile_fmt, &trfiles);
 	if (count <= 0)
-		return (struct crash_t *)ret_crash;
+		goto free_cache;
 
 	/* get data from last file */
-	if (read_file(trfiles[count - 1], &size, &content) == -1) {
-		LOGE("failed to read %s, error (%s)\n",
-		     trfiles[count - 1], strerror(errno));
+	content = trfile_cache_read(&cache, trfiles[count - 1], &size);
+	if (!content)
 		goto free_files;
-	}
-	if (!size)
-		goto free_files;
-
-	if (get_data(content, ret_crash, data, dsize) == -1)
+	if (size && get_data(content, ret_crash, data, dsize) == -1)
 		LOGE("failed to get data\n");
 
-	free(content);
+	trfile_cache_put(&cache, content);
 
 free_files:
 	for (i = 0; i < count; i++)
 		free(trfiles[i]);
 	free(trfiles);
+free_cache:
+	trfile_cache_free(&cache);
 
 	return (struct crash_t *)ret_crash;
 }
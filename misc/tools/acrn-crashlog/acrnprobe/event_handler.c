@@ -7,6 +7,8 @@
 #include <signal.h>
 #include <string.h>
 #include <sys/time.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #include <malloc.h>
 #include <stdlib.h>
 #include "event_queue.h"
@@ -22,6 +24,12 @@
 /* Watchdog timeout in second*/
 #define WDT_TIMEOUT 300
 
+/* see ioprio_set(2), not in the libc headers */
+#define IOPRIO_WHO_PROCESS	1
+#define IOPRIO_CLASS_BE		2
+#define IOPRIO_CLASS_SHIFT	13
+#define IOPRIO_BE_LOWEST	7
+
 static struct event_t *last_e;
 static int event_processing;
 
@@ -127,6 +135,18 @@ static void watchdog_init(int timeout)
 	}
 }
 
+/**
+ * Give the disk to the SOS and the restarting UOSes first, the logs of a
+ * crash storm are collected with the lowest best-effort I/O priority.
+ */
+static void lower_io_priority(void)
+{
+	if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+		    (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) |
+		    IOPRIO_BE_LOWEST) == -1)
+		LOGW("ioprio_set failed, error (%s)\n", strerror(errno));
+}
+
 /**
  * Process each event in event queue.
  * Note that currently event handler is single threaded.
@@ -138,6 +158,9 @@ static void *event_handle(void *unused __attribute__((unused)))
 	struct event_t *e;
 	struct vm_event_t *vme;
 
+	/* 0 is the calling thread, not the whole process */
+	lower_io_priority();
+
 	while ((e = event_dequeue())) {
 		/* here we only handle internal event */
 		if (e->event_type == HEART_BEAT) {
@@ -12,19 +12,31 @@
 const char *etype_str[] = {"CRASH", "INFO", "UPTIME", "HEART_BEAT",
 					"REBOOT", "VM", "UNKNOWN"};
 
+/*
+ * A crash storm must not queue more logs to collect than the disk can take,
+ * the channels stop detecting new events until the handler catches up.
+ */
+#define EVENT_QUEUE_MAX	64
+
 static pthread_mutex_t eq_mtx = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t pcond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t ccond = PTHREAD_COND_INITIALIZER;
+static int eq_len;
 TAILQ_HEAD(, event_t) event_q;
 
 /**
- * Enqueue an event to event_queue.
+ * Enqueue an event to event_queue, waiting while event_queue is full.
+ * Heart beats are never held back, they feed the watchdog of the handler.
  *
  * @param event Event to process.
  */
 void event_enqueue(struct event_t *event)
 {
 	pthread_mutex_lock(&eq_mtx);
+	while (eq_len >= EVENT_QUEUE_MAX && event->event_type != HEART_BEAT)
+		pthread_cond_wait(&ccond, &eq_mtx);
 	TAILQ_INSERT_TAIL(&event_q, event, entries);
+	eq_len++;
 	pthread_cond_signal(&pcond);
 	LOGD("enqueue %d, (%d)%s\n", event->event_type, event->len,
 	     event->path);
@@ -38,12 +50,10 @@ void event_enqueue(struct event_t *event)
  */
 int events_count(void)
 {
-	struct event_t *e;
-	int count = 0;
+	int count;
 
 	pthread_mutex_lock(&eq_mtx);
-	TAILQ_FOREACH(e, &event_q, entries)
-		count++;
+	count = eq_len;
 	pthread_mutex_unlock(&eq_mtx);
 
 	return count;
@@ -63,6 +73,8 @@ struct event_t *event_dequeue(void)
 		pthread_cond_wait(&pcond, &eq_mtx);
 	e = TAILQ_FIRST(&event_q);
 	TAILQ_REMOVE(&event_q, e, entries);
+	eq_len--;
+	pthread_cond_signal(&ccond);
 	LOGD("dequeue %d, (%d)%s\n", e->event_type, e->len, e->path);
 	pthread_mutex_unlock(&eq_mtx);
 
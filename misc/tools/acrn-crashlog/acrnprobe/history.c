@@ -53,8 +53,69 @@ static int current_lines;
 
 #define EVENT_COUNT_FILE_NAME "all_events"
 
-static char *all_events_cnt;
-static size_t all_events_size;
+/*
+ * The counts of EVENT_COUNT_FILE_NAME, indexed by "event-type" and kept in
+ * the order of the file. The file is parsed once, each event looks its
+ * count up in the index and the file is written again from the index.
+ */
+#define EVENT_COUNT_BUCKETS 64
+
+struct event_count {
+	char *name;
+	unsigned int count;
+	struct event_count *hnext;	/* in its bucket */
+	struct event_count *next;	/* in the file */
+};
+
+static char *all_events_head;
+static struct event_count *event_counts[EVENT_COUNT_BUCKETS];
+static struct event_count *event_count_first;
+static struct event_count **event_count_tail = &event_count_first;
+
+static unsigned int event_count_hash(const char *name)
+{
+	unsigned int h = 5381;
+
+	while (*name)
+		h = h * 33 + (unsigned char)*name++;
+
+	return h % EVENT_COUNT_BUCKETS;
+}
+
+static struct event_count *find_event_count(const char *name)
+{
+	struct event_count *ec;
+
+	for (ec = event_counts[event_count_hash(name)]; ec; ec = ec->hnext) {
+		if (!strcmp(ec->name, name))
+			return ec;
+	}
+
+	return NULL;
+}
+
+static struct event_count *add_event_count(const char *name,
+					   unsigned int count)
+{
+	struct event_count *ec;
+	unsigned int h = event_count_hash(name);
+
+	ec = calloc(1, sizeof(*ec));
+	if (!ec)
+		return NULL;
+	ec->name = strdup(name);
+	if (!ec->name) {
+		free(ec);
+		return NULL;
+	}
+	ec->count = count;
+	ec->hnext = event_counts[h];
+	event_counts[h] = ec;
+	*event_count_tail = ec;
+	event_count_tail = &ec->next;
+
+	return ec;
+}
 
 static int event_count_file_path(char *path, size_t size)
 {
@@ -72,87 +133,57 @@ static int event_count_file_path(char *path, size_t size)
 	return 0;
 }
 
+static int write_event_count_file(const char *path)
+{
+	struct event_count *ec;
+	FILE *fp;
+	int ret = 0;
+
+	fp = fopen(path, "w");
+	if (!fp)
+		return -errno;
+
+	if (all_events_head && fputs(all_events_head, fp) < 0)
+		ret = -errno;
+	for (ec = event_count_first; ec && !ret; ec = ec->next) {
+		if (fprintf(fp, "%s: %u\n", ec->name, ec->count) < 0)
+			ret = -errno;
+	}
+	if (fclose(fp) && !ret)
+		ret = -errno;
+
+	return ret;
+}
+
 static void update_event_count_file(struct history_entry *entry)
 {
 	char path[PATH_MAX];
-	char line[MAXLINESIZE];
-	char *update_line;
-	char *all_events_new;
+	char name[MAXLINESIZE];
+	struct event_count *ec;
 	int len;
 
 	if (!entry->event)
 		return;
 
 	if (entry->type)
-		len = snprintf(line, sizeof(line), "%s-%s: ", entry->event,
+		len = snprintf(name, sizeof(name), "%s-%s", entry->event,
 			       entry->type);
 	else
-		len = snprintf(line, sizeof(line), "%s: ", entry->event);
+		len = snprintf(name, sizeof(name), "%s", entry->event);
 
-	if (s_not_expect(len, sizeof(line)))
+	if (s_not_expect(len, sizeof(name)))
 		return;
 
-	update_line = strstr(all_events_cnt, line);
-	if (!update_line) {
-		*(char *)(mempcpy(line + len, "1\n", 2)) = '\0';
-		len += 2;
-		all_events_new = realloc(all_events_cnt, all_events_size +
-					 len + 1);
-		if (!all_events_new)
-			return;
-
-		*(char *)(mempcpy(all_events_new + all_events_size,
-				  line, len)) = '\0';
-		all_events_cnt = all_events_new;
-		all_events_size += len;
-	} else {
-		char *s = strstr(update_line, ": ");
-		char *e = strchr(update_line, '\n');
-		const char *fmt = "%*[: ]%[[0-9]*]";
-		char num_str[16];
-		int num;
-		char *ne;
-		char *replace;
-
-		if (!s || !e)
-			return;
-
-		if (str_split_ere(s, e - s, fmt, strlen(fmt), num_str,
-				  sizeof(num_str)) != 1)
-			return;
-
-		if (cfg_atoi(num_str, strnlen(num_str, sizeof(num_str)),
-			     &num) == -1)
-			return;
-
-		if (strspn(num_str, "9") == strnlen(num_str, sizeof(num_str))) {
-			all_events_new = realloc(all_events_cnt,
-						 all_events_size + 1 + 1);
-			if (!all_events_new)
-				return;
-
-			ne = all_events_new + (e - all_events_cnt);
-			memmove(ne + 1, ne,
-				all_events_cnt + all_events_size - e + 1);
-			replace = all_events_new + (s - all_events_cnt) + 2;
-
-			all_events_cnt = all_events_new;
-			all_events_size++;
-		} else {
-			replace = s + 2;
-		}
-
-		len = snprintf(num_str, sizeof(num_str), "%u", num + 1);
-		if (s_not_expect(len, sizeof(num_str)))
-			return;
-
-		memcpy(replace, num_str, len);
-	}
+	ec = find_event_count(name);
+	if (ec)
+		ec->count++;
+	else if (!add_event_count(name, 1))
+		return;
 
 	if (event_count_file_path(path, sizeof(path)) == -1)
 		return;
 
-	if (overwrite_file(path, all_events_cnt)) {
+	if (write_event_count_file(path)) {
 		LOGE("failed to write %s, %s\n", path,
 		     strerror(errno));
 		return;
@@ -160,13 +191,58 @@ static void update_event_count_file(struct history_entry *entry)
 	return;
 }
 
+/* "name: count" lines are indexed, the others kept as the file head */
+static int parse_event_count_file(char *cnt)
+{
+	char *line, *save = NULL, *sep, *end;
+	struct event_count *ec;
+	unsigned long count;
+	size_t hlen = 0, len;
+
+	all_events_head = calloc(1, strlen(cnt) + 1);
+	if (!all_events_head)
+		return -1;
+
+	for (line = strtok_r(cnt, "\n", &save); line;
+	     line = strtok_r(NULL, "\n", &save)) {
+		sep = strstr(line, ": ");
+		if (sep && sep != line) {
+			count = strtoul(sep + 2, &end, 10);
+			if (end != sep + 2 && *end == '\0') {
+				*sep = '\0';
+				ec = find_event_count(line);
+				if (ec)
+					ec->count += count;
+				else if (!add_event_count(line, count))
+					return -1;
+				continue;
+			}
+		}
+		if (event_count_first)
+			continue;
+		len = strlen(line);
+		memcpy(all_events_head + hlen, line, len);
+		hlen += len;
+		all_events_head[hlen++] = '\n';
+	}
+
+	return 0;
+}
+
 static int init_event_count_file(void)
 {
 	char path[PATH_MAX];
+	size_t size;
+	void *cnt;
+	int ret;
 
 	if (event_count_file_path(path, sizeof(path)) == -1)
 		return -1;
 
+	/* indexed already, prepare_history() is called again on backup */
+	if (all_events_head)
+		return 0;
+
 	if (!file_exists(path)) {
 		if (overwrite_file(path, "Total:\n")) {
 			LOGE("failed to prepare %s, %s\n", path,
@@ -175,13 +251,17 @@ static int init_event_count_file(void)
 		}
 	}
 
-	if (read_file(path, &all_events_size,
-		      (void *)&all_events_cnt) == -1) {
+	if (read_file(path, &size, &cnt) == -1) {
 		LOGE("failed to read %s, %s\n", path,
 		     strerror(errno));
 		return -1;
 	}
-	return 0;
+	ret = parse_event_count_file(cnt);
+	free(cnt);
+	if (ret == -1)
+		LOGE("failed to index %s, out of memory\n", path);
+
+	return ret;
 }
 
 static int entry_to_history_line(struct history_entry *entry,
@@ -29,6 +29,8 @@
 #include <errno.h>
 #include <malloc.h>
 #include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
 #include <sys/vfs.h>
 #include <sys/wait.h>
 #include <stdlib.h>
@@ -221,6 +223,32 @@ void unmap_file(struct mm_file_t *mfile)
 	free(mfile);
 }
 
+/**
+ * sendfile(2) until count bytes are copied or the end of in_fd, one call
+ * copies at most 2G and may copy less.
+ *
+ * @return The number of bytes copied, or a negative errno-style value.
+ */
+static int sendfile_all(int out_fd, int in_fd, off_t *offset, size_t count)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < count) {
+		n = sendfile(out_fd, in_fd, offset, count - done);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (n == 0)
+			break;
+		done += n;
+	}
+
+	return done;
+}
+
 /**
  * Copy the tail data from a file which supports mmap(2)-like operations
  * to new file.
@@ -263,12 +291,20 @@ int do_copy_tail(const char *src, const char *dest, int limit)
 	if (info.st_size > limit)
 		offset = info.st_size - limit;
 
-	rc = sendfile(fdest, fsrc, &offset, limit);
+	/* the whole file shares its extents if the file system can reflink */
+	if (offset == 0 && S_ISREG(info.st_mode) &&
+	    ioctl(fdest, FICLONE, fsrc) == 0) {
+		close(fsrc);
+		close(fdest);
+		return limit;
+	}
+
+	rc = sendfile_all(fdest, fsrc, &offset, limit);
 
 	close(fsrc);
 	close(fdest);
 
-	return rc == -1 ? -errno : rc;
+	return rc;
 }
 
 /**
@@ -542,6 +578,8 @@ int do_copy_limit(const char *src, const char *des, size_t limitsize)
 	size_t rbsize = CPBUFFERSIZE;
 	ssize_t r_count;
 	ssize_t w_count;
+	struct stat info;
+	off_t offset;
 
 	if (src == NULL || des == NULL)
 		return -1;
@@ -561,6 +599,26 @@ int do_copy_limit(const char *src, const char *des, size_t limitsize)
 		return -1;
 	}
 
+	/*
+	 * Regular files are copied in the kernel. The nodes of /proc and
+	 * /sys, the devices and the pipes are read until EOF or EAGAIN.
+	 */
+	if (fstat(fd1, &info) == 0 && S_ISREG(info.st_mode) &&
+	    info.st_size > 0) {
+		offset = 0;
+		rbsize = limitsize > 0 ? MIN(limitsize, (size_t)info.st_size) :
+			 (size_t)info.st_size;
+		if (sendfile_all(fd2, fd1, &offset, rbsize) >= 0)
+			goto out;
+		if (offset != 0) {
+			LOGE("sendfile failed, err:%s\n", strerror(errno));
+			rc = -1;
+			goto out;
+		}
+		/* the file system cannot splice, copy it here */
+		rbsize = CPBUFFERSIZE;
+	}
+
 	/* Start copy loop */
 	while (1) {
 		if (limitsize > 0) {
@@ -601,6 +659,7 @@ int do_copy_limit(const char *src, const char *des, size_t limitsize)
 		dsize += w_count;
 	}
 
+out:
 	if (fd1 >= 0)
 		close(fd1);
 	if (fd2 >= 0)
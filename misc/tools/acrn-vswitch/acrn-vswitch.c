@@ -0,0 +1,1009 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * acrn-vswitch: a learning Ethernet switch between the virtio-net devices
+ * of the UOSes of the SOS.
+ *
+ * Each port is a vhost-user socket the acrn-dm of a UOS connects to, with
+ * "-s <slot>,virtio-net,vhost-user:<socket>". The DM passes the hugetlbfs
+ * files of the UOS memory and the kick and call eventfds of the rings, the
+ * switch maps the memory of all the UOSes and copies each frame once, from
+ * the buffers of the TX ring of its port straight into the buffers of the
+ * RX ring of the port its destination MAC was learnt on. The broadcast,
+ * multicast and unknown frames are copied to all the other ports.
+ *
+ * The frames are not buffered: one which finds no room in the RX ring of
+ * its destination is dropped, as a full tap queue drops it. The checksum
+ * and segmentation offloads are not offered, the UOSes send full frames
+ * with their checksums.
+ */
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <linux/vhost.h>
+#include <linux/virtio_config.h>
+#include <linux/virtio_net.h>
+#include <linux/virtio_ring.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define VHOST_USER_GET_FEATURES		1
+#define VHOST_USER_SET_FEATURES		2
+#define VHOST_USER_SET_OWNER		3
+#define VHOST_USER_RESET_OWNER		4
+#define VHOST_USER_SET_MEM_TABLE	5
+#define VHOST_USER_SET_VRING_NUM	8
+#define VHOST_USER_SET_VRING_ADDR	9
+#define VHOST_USER_SET_VRING_BASE	10
+#define VHOST_USER_GET_VRING_BASE	11
+#define VHOST_USER_SET_VRING_KICK	12
+#define VHOST_USER_SET_VRING_CALL	13
+#define VHOST_USER_GET_PROTOCOL_FEATURES	15
+#define VHOST_USER_SET_PROTOCOL_FEATURES	16
+#define VHOST_USER_SET_VRING_ENABLE	18
+
+#define VHOST_USER_VERSION		0x1
+#define VHOST_USER_REPLY_MASK		(0x1 << 2)
+#define VHOST_USER_NEED_REPLY_MASK	(0x1 << 3)
+#define VHOST_USER_VRING_IDX_MASK	0xff
+#define VHOST_USER_VRING_NOFD_MASK	(0x1 << 8)
+#define VHOST_USER_F_PROTOCOL_FEATURES	30
+#define VHOST_USER_MEMORY_MAX_NREGIONS	8
+
+struct vhost_user_memory_region {
+	uint64_t guest_phys_addr;
+	uint64_t memory_size;
+	uint64_t userspace_addr;
+	uint64_t mmap_offset;
+};
+
+struct vhost_user_memory {
+	uint32_t nregions;
+	uint32_t padding;
+	struct vhost_user_memory_region regions[VHOST_USER_MEMORY_MAX_NREGIONS];
+};
+
+struct vhost_user_msg {
+	uint32_t request;
+	uint32_t flags;
+	uint32_t size;		/* of the payload */
+	union {
+		uint64_t u64;
+		struct vhost_vring_state state;
+		struct vhost_vring_addr addr;
+		struct vhost_user_memory memory;
+	} payload;
+} __attribute__((packed));
+
+#define VHOST_USER_HDR_SIZE	offsetof(struct vhost_user_msg, payload)
+
+/* The features offered to the DMs: no offloads, no event index */
+#define VSW_FEATURES	((1ULL << VIRTIO_F_VERSION_1) | \
+			 (1ULL << VIRTIO_NET_F_MRG_RXBUF) | \
+			 (1ULL << VIRTIO_RING_F_INDIRECT_DESC) | \
+			 (1ULL << VIRTIO_F_NOTIFY_ON_EMPTY) | \
+			 (1ULL << VHOST_USER_F_PROTOCOL_FEATURES))
+
+#define VSW_MAX_PORTS	16
+#define VSW_RXQ		0
+#define VSW_TXQ		1
+#define VSW_NQ		2
+#define VSW_MAX_IOV	64
+#define VSW_MAX_BUFS	64	/* RX chains of one merged frame */
+#define VSW_BUDGET	256	/* TX frames of a port per round */
+#define ETH_HLEN	14
+#define ETH_ALEN	6
+
+/* MAC table: VSW_MAC_BUCKETS sets of VSW_MAC_WAYS entries */
+#define VSW_MAC_BUCKETS	256
+#define VSW_MAC_WAYS	4
+
+struct vsw_region {
+	uint64_t	gpa;
+	uint64_t	size;
+	uint64_t	uva;		/* in the DM, for the ring addresses */
+	uint8_t		*hva;		/* gpa in the switch */
+	void		*map;
+	size_t		map_len;
+};
+
+struct vsw_vring {
+	uint16_t	num;
+	uint16_t	last_avail;
+	struct vring_desc	*desc;
+	struct vring_avail	*avail;
+	struct vring_used	*used;
+	int		kickfd;
+	int		callfd;
+	bool		started;	/* kick fd set */
+	bool		enabled;
+	bool		signal;		/* used entries not signaled yet */
+};
+
+enum vsw_ev_type {
+	VSW_EV_LISTEN = 0,
+	VSW_EV_CONN,
+	VSW_EV_KICK_RX,
+	VSW_EV_KICK_TX,
+};
+
+struct vsw_port;
+
+struct vsw_ev {
+	enum vsw_ev_type	type;
+	struct vsw_port		*port;
+};
+
+struct vsw_port {
+	int		id;
+	const char	*path;
+	int		listenfd;
+	int		connfd;
+	uint64_t	features;
+	bool		proto;		/* VHOST_USER_F_PROTOCOL_FEATURES */
+	int		hdrlen;		/* of the virtio net header */
+	int		nregions;
+	struct vsw_region	regions[VHOST_USER_MEMORY_MAX_NREGIONS];
+	struct vsw_vring	vq[VSW_NQ];
+	bool		busy;		/* TX budget used up, frames left */
+
+	struct vsw_ev	ev_listen;
+	struct vsw_ev	ev_conn;
+	struct vsw_ev	ev_kick[VSW_NQ];
+
+	uint64_t	tx_frames;
+	uint64_t	rx_frames;
+	uint64_t	rx_drops;
+};
+
+struct vsw_mac {
+	uint8_t		addr[ETH_ALEN];
+	int8_t		port;		/* -1 if free */
+};
+
+/* A frame in the TX buffers of its port */
+struct vsw_frame {
+	struct iovec	iov[VSW_MAX_IOV];
+	int		niov;
+	size_t		len;
+};
+
+static struct vsw_port ports[VSW_MAX_PORTS];
+static int nports;
+static int epfd = -1;
+static struct vsw_mac mac_table[VSW_MAC_BUCKETS][VSW_MAC_WAYS];
+static int verbose;
+static volatile sig_atomic_t dump_stats;
+static volatile sig_atomic_t quit;
+
+#define DPRINTF(fmt, args...) \
+	do { if (verbose) printf(fmt, ##args); } while (0)
+
+static unsigned int mac_hash(const uint8_t *addr)
+{
+	return (addr[3] ^ addr[4] ^ addr[5]) % VSW_MAC_BUCKETS;
+}
+
+static int mac_lookup(const uint8_t *addr)
+{
+	struct vsw_mac *set = mac_table[mac_hash(addr)];
+	int i;
+
+	for (i = 0; i < VSW_MAC_WAYS; i++) {
+		if (set[i].port >= 0 && !memcmp(set[i].addr, addr, ETH_ALEN))
+			return set[i].port;
+	}
+	return -1;
+}
+
+/* The latest MAC goes to way 0, the least recent one drops out */
+static void mac_learn(const uint8_t *addr, int port)
+{
+	struct vsw_mac *set = mac_table[mac_hash(addr)];
+	struct vsw_mac e;
+	int i;
+
+	if (set[0].port == port && !memcmp(set[0].addr, addr, ETH_ALEN))
+		return;
+
+	for (i = 0; i < VSW_MAC_WAYS - 1; i++) {
+		if (set[i].port >= 0 && !memcmp(set[i].addr, addr, ETH_ALEN))
+			break;
+	}
+	if (set[i].port != port)
+		DPRINTF("port %d: learnt %02x:%02x:%02x:%02x:%02x:%02x\n",
+			port, addr[0], addr[1], addr[2], addr[3], addr[4],
+			addr[5]);
+	memmove(&set[1], &set[0], i * sizeof(set[0]));
+	memcpy(e.addr, addr, ETH_ALEN);
+	e.port = port;
+	set[0] = e;
+}
+
+static void mac_flush(int port)
+{
+	int i, j;
+
+	for (i = 0; i < VSW_MAC_BUCKETS; i++) {
+		for (j = 0; j < VSW_MAC_WAYS; j++) {
+			if (mac_table[i][j].port == port)
+				mac_table[i][j].port = -1;
+		}
+	}
+}
+
+static void *gpa_to_hva(struct vsw_port *p, uint64_t gpa, uint64_t len)
+{
+	struct vsw_region *r;
+	int i;
+
+	for (i = 0; i < p->nregions; i++) {
+		r = &p->regions[i];
+		if (gpa >= r->gpa && gpa - r->gpa < r->size &&
+				len <= r->size - (gpa - r->gpa))
+			return r->hva + (gpa - r->gpa);
+	}
+	return NULL;
+}
+
+static void *uva_to_hva(struct vsw_port *p, uint64_t uva)
+{
+	struct vsw_region *r;
+	int i;
+
+	for (i = 0; i < p->nregions; i++) {
+		r = &p->regions[i];
+		if (uva >= r->uva && uva - r->uva < r->size)
+			return r->hva + (uva - r->uva);
+	}
+	return NULL;
+}
+
+/*
+ * Walk the chain of head, with its indirect table if any, into iov. The
+ * buffers must all be device-readable (write false) or all writable.
+ *
+ * Return the number of iov, -1 on a bad chain.
+ */
+static int vring_walk(struct vsw_port *p, struct vsw_vring *vr, uint16_t head,
+		struct iovec *iov, int max, bool write, size_t *len)
+{
+	struct vring_desc *desc = vr->desc, *d;
+	unsigned int num = vr->num, i = head, n = 0, hops = 0;
+	bool indirect = false;
+
+	*len = 0;
+	while (1) {
+		if (i >= num || ++hops > num + 1)
+			return -1;
+		d = &desc[i];
+
+		if ((d->flags & VRING_DESC_F_INDIRECT) && !indirect) {
+			if (d->len % sizeof(struct vring_desc) ||
+					d->len == 0)
+				return -1;
+			desc = gpa_to_hva(p, d->addr, d->len);
+			if (!desc)
+				return -1;
+			num = d->len / sizeof(struct vring_desc);
+			indirect = true;
+			hops = 0;
+			i = 0;
+			continue;
+		}
+		if (!!(d->flags & VRING_DESC_F_WRITE) != write || n >= max)
+			return -1;
+		if (d->len) {
+			iov[n].iov_base = gpa_to_hva(p, d->addr, d->len);
+			if (!iov[n].iov_base)
+				return -1;
+			iov[n].iov_len = d->len;
+			*len += d->len;
+			n++;
+		}
+		if (!(d->flags & VRING_DESC_F_NEXT))
+			break;
+		i = d->next;
+	}
+	return n;
+}
+
+static inline bool vring_ready(struct vsw_vring *vr)
+{
+	return vr->started && vr->enabled && vr->desc && vr->avail &&
+		vr->used && vr->num;
+}
+
+static inline bool vring_has_avail(struct vsw_vring *vr)
+{
+	uint16_t idx = __atomic_load_n(&vr->avail->idx, __ATOMIC_ACQUIRE);
+
+	return idx != vr->last_avail;
+}
+
+/* Write the used entries, then their index */
+static void vring_put_used(struct vsw_vring *vr, const uint16_t *heads,
+		const uint32_t *lens, int n)
+{
+	uint16_t idx = vr->used->idx;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		vr->used->ring[(idx + i) % vr->num].id = heads[i];
+		vr->used->ring[(idx + i) % vr->num].len = lens[i];
+	}
+	__atomic_store_n(&vr->used->idx, (uint16_t)(idx + n), __ATOMIC_RELEASE);
+	vr->signal = true;
+}
+
+static void vring_signal(struct vsw_vring *vr)
+{
+	if (!vr->signal)
+		return;
+	vr->signal = false;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if ((vr->avail->flags & VRING_AVAIL_F_NO_INTERRUPT) &&
+			vr->avail->idx != vr->last_avail)
+		return;
+	if (vr->callfd >= 0)
+		eventfd_write(vr->callfd, 1);
+}
+
+/* Copy len bytes at off of the frame to dst */
+static void frame_copy(const struct vsw_frame *f, size_t off, uint8_t *dst,
+		size_t len)
+{
+	size_t n;
+	int i;
+
+	for (i = 0; i < f->niov && len; i++) {
+		if (off >= f->iov[i].iov_len) {
+			off -= f->iov[i].iov_len;
+			continue;
+		}
+		n = f->iov[i].iov_len - off;
+		if (n > len)
+			n = len;
+		memcpy(dst, (uint8_t *)f->iov[i].iov_base + off, n);
+		dst += n;
+		len -= n;
+		off = 0;
+	}
+}
+
+/*
+ * Copy the frame into the RX buffers of dst, behind a virtio net header
+ * of dst, over several chains if the UOS merges its RX buffers. Nothing
+ * is consumed from the ring if the frame does not fit.
+ */
+static void port_deliver(struct vsw_port *dst, const struct vsw_frame *f)
+{
+	struct vsw_vring *vr = &dst->vq[VSW_RXQ];
+	struct virtio_net_hdr_mrg_rxbuf hdr;
+	struct iovec iov[VSW_MAX_IOV];
+	uint16_t heads[VSW_MAX_BUFS], avail_idx, start = vr->last_avail;
+	uint32_t lens[VSW_MAX_BUFS];
+	bool mrg = dst->features & (1ULL << VIRTIO_NET_F_MRG_RXBUF);
+	size_t off = 0, room, n, total = dst->hdrlen + f->len;
+	uint8_t *first = NULL;
+	int nbufs = 0, niov, i;
+
+	if (!vring_ready(vr))
+		goto drop;
+
+	avail_idx = __atomic_load_n(&vr->avail->idx, __ATOMIC_ACQUIRE);
+	while (off < total) {
+		if (vr->last_avail == avail_idx || nbufs == VSW_MAX_BUFS ||
+				(nbufs && !mrg))
+			goto rollback;
+
+		heads[nbufs] = vr->avail->ring[vr->last_avail % vr->num];
+		vr->last_avail++;
+		niov = vring_walk(dst, vr, heads[nbufs], iov, VSW_MAX_IOV,
+				true, &room);
+		if (niov <= 0 || iov[0].iov_len < (nbufs ? 0 : dst->hdrlen))
+			goto rollback;
+
+		lens[nbufs] = 0;
+		for (i = 0; i < niov && off < total; i++) {
+			uint8_t *buf = iov[i].iov_base;
+			size_t len = iov[i].iov_len;
+
+			if (off == 0) {
+				/* the header, set once the buffers are known */
+				first = buf;
+				buf += dst->hdrlen;
+				len -= dst->hdrlen;
+				off = dst->hdrlen;
+				lens[nbufs] = dst->hdrlen;
+			}
+			n = total - off;
+			if (n > len)
+				n = len;
+			frame_copy(f, off - dst->hdrlen, buf, n);
+			off += n;
+			lens[nbufs] += n;
+		}
+		nbufs++;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.num_buffers = nbufs;
+	memcpy(first, &hdr, dst->hdrlen);
+	vring_put_used(vr, heads, lens, nbufs);
+	dst->rx_frames++;
+	return;
+
+rollback:
+	vr->last_avail = start;
+drop:
+	dst->rx_drops++;
+}
+
+static void port_forward(struct vsw_port *src, struct vsw_frame *f)
+{
+	uint8_t eth[ETH_HLEN];
+	int i, to;
+
+	frame_copy(f, 0, eth, ETH_HLEN);
+	if (!(eth[ETH_ALEN] & 0x01))
+		mac_learn(eth + ETH_ALEN, src->id);
+
+	to = (eth[0] & 0x01) ? -1 : mac_lookup(eth);
+	if (to == src->id)
+		return;
+	if (to >= 0) {
+		port_deliver(&ports[to], f);
+		return;
+	}
+	for (i = 0; i < nports; i++) {
+		if (i != src->id && ports[i].connfd >= 0)
+			port_deliver(&ports[i], f);
+	}
+}
+
+/* Skip the virtio net header of src in the buffers of a TX chain */
+static void frame_strip(struct vsw_frame *f, size_t hdrlen)
+{
+	int i = 0;
+
+	f->len -= hdrlen;
+	while (hdrlen && i < f->niov) {
+		if (f->iov[i].iov_len > hdrlen) {
+			f->iov[i].iov_base = (uint8_t *)f->iov[i].iov_base + hdrlen;
+			f->iov[i].iov_len -= hdrlen;
+			break;
+		}
+		hdrlen -= f->iov[i].iov_len;
+		f->iov[i].iov_len = 0;
+		i++;
+	}
+}
+
+/* Forward up to VSW_BUDGET frames of the TX ring of src */
+static void port_tx(struct vsw_port *src)
+{
+	struct vsw_vring *vr = &src->vq[VSW_TXQ];
+	static struct vsw_frame f;
+	uint16_t head;
+	uint32_t zero = 0;
+	int budget = VSW_BUDGET, i;
+
+	if (!vring_ready(vr))
+		return;
+
+	/* no kicks while the ring is drained */
+	vr->used->flags |= VRING_USED_F_NO_NOTIFY;
+	while (budget) {
+		if (!vring_has_avail(vr)) {
+			vr->used->flags &= ~VRING_USED_F_NO_NOTIFY;
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			if (!vring_has_avail(vr))
+				break;
+			vr->used->flags |= VRING_USED_F_NO_NOTIFY;
+		}
+
+		head = vr->avail->ring[vr->last_avail % vr->num];
+		vr->last_avail++;
+		f.niov = vring_walk(src, vr, head, f.iov, VSW_MAX_IOV, false,
+				&f.len);
+		if (f.niov > 0 && f.len >= src->hdrlen + ETH_HLEN) {
+			frame_strip(&f, src->hdrlen);
+			src->tx_frames++;
+			port_forward(src, &f);
+		}
+		vring_put_used(vr, &head, &zero, 1);
+		budget--;
+	}
+	src->busy = (budget == 0);
+
+	vring_signal(vr);
+	for (i = 0; i < nports; i++)
+		vring_signal(&ports[i].vq[VSW_RXQ]);
+}
+
+static void epoll_del(int fd)
+{
+	if (fd >= 0)
+		epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static int epoll_add(int fd, struct vsw_ev *ev)
+{
+	struct epoll_event ee;
+
+	memset(&ee, 0, sizeof(ee));
+	ee.events = EPOLLIN;
+	ee.data.ptr = ev;
+	return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ee);
+}
+
+static void port_unmap(struct vsw_port *p)
+{
+	int i;
+
+	for (i = 0; i < p->nregions; i++)
+		munmap(p->regions[i].map, p->regions[i].map_len);
+	p->nregions = 0;
+}
+
+static void vring_reset(struct vsw_vring *vr)
+{
+	epoll_del(vr->kickfd);
+	if (vr->kickfd >= 0)
+		close(vr->kickfd);
+	if (vr->callfd >= 0)
+		close(vr->callfd);
+	memset(vr, 0, sizeof(*vr));
+	vr->kickfd = -1;
+	vr->callfd = -1;
+}
+
+static void port_reset(struct vsw_port *p)
+{
+	int i;
+
+	for (i = 0; i < VSW_NQ; i++)
+		vring_reset(&p->vq[i]);
+	port_unmap(p);
+	p->features = 0;
+	p->proto = false;
+	p->hdrlen = sizeof(struct virtio_net_hdr);
+	p->busy = false;
+}
+
+static void port_disconnect(struct vsw_port *p)
+{
+	printf("port %d: %s disconnected, %lu frames sent, %lu received, "
+		"%lu dropped\n", p->id, p->path, p->tx_frames, p->rx_frames,
+		p->rx_drops);
+	epoll_del(p->connfd);
+	close(p->connfd);
+	p->connfd = -1;
+	port_reset(p);
+	mac_flush(p->id);
+	epoll_add(p->listenfd, &p->ev_listen);
+}
+
+static int port_set_mem_table(struct vsw_port *p, struct vhost_user_msg *msg,
+		int *fds, int nfds)
+{
+	struct vhost_user_memory mem = msg->payload.memory;
+	struct vhost_user_memory_region *m;
+	struct vsw_region *r;
+	uint32_t i;
+
+	if (mem.nregions > VHOST_USER_MEMORY_MAX_NREGIONS ||
+			mem.nregions != nfds)
+		return -1;
+
+	port_unmap(p);
+	for (i = 0; i < mem.nregions; i++) {
+		m = &mem.regions[i];
+		r = &p->regions[i];
+		r->map_len = m->memory_size + m->mmap_offset;
+		r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE,
+				MAP_SHARED, fds[i], 0);
+		if (r->map == MAP_FAILED) {
+			printf("port %d: map of region %u failed, errno %d\n",
+				p->id, i, errno);
+			port_unmap(p);
+			return -1;
+		}
+		r->gpa = m->guest_phys_addr;
+		r->size = m->memory_size;
+		r->uva = m->userspace_addr;
+		r->hva = (uint8_t *)r->map + m->mmap_offset;
+		p->nregions = i + 1;
+		DPRINTF("port %d: region %u gpa 0x%lx size 0x%lx\n", p->id, i,
+			r->gpa, r->size);
+	}
+	return 0;
+}
+
+static int port_set_vring_fd(struct vsw_port *p, struct vhost_user_msg *msg,
+		int *fds, int nfds)
+{
+	unsigned int idx = msg->payload.u64 & VHOST_USER_VRING_IDX_MASK;
+	int fd = (msg->payload.u64 & VHOST_USER_VRING_NOFD_MASK) ? -1 :
+		(nfds == 1 ? fds[0] : -2);
+	struct vsw_vring *vr;
+
+	if (idx >= VSW_NQ || fd == -2)
+		return -1;
+	vr = &p->vq[idx];
+
+	if (msg->request == VHOST_USER_SET_VRING_CALL) {
+		if (vr->callfd >= 0)
+			close(vr->callfd);
+		vr->callfd = fd;
+		return 0;
+	}
+
+	epoll_del(vr->kickfd);
+	if (vr->kickfd >= 0)
+		close(vr->kickfd);
+	vr->kickfd = fd;
+	if (fd >= 0 && epoll_add(fd, &p->ev_kick[idx]) < 0)
+		return -1;
+	/* without protocol features, a ring starts with its kick fd */
+	vr->started = true;
+	if (!p->proto)
+		vr->enabled = true;
+	return 0;
+}
+
+static int port_reply(struct vsw_port *p, struct vhost_user_msg *msg,
+		uint32_t size)
+{
+	ssize_t len;
+
+	msg->flags = VHOST_USER_VERSION | VHOST_USER_REPLY_MASK;
+	msg->size = size;
+	len = send(p->connfd, msg, VHOST_USER_HDR_SIZE + size, MSG_NOSIGNAL);
+	return len == (ssize_t)(VHOST_USER_HDR_SIZE + size) ? 0 : -1;
+}
+
+static int port_handle_msg(struct vsw_port *p, struct vhost_user_msg *msg,
+		int *fds, int nfds)
+{
+	/* the payload is not aligned in the packed message */
+	struct vhost_vring_state st = msg->payload.state, *state = &st;
+	struct vhost_vring_addr ad = msg->payload.addr, *addr = &ad;
+	struct vsw_vring *vr;
+	int ret = 0;
+
+	switch (msg->request) {
+	case VHOST_USER_GET_FEATURES:
+		msg->payload.u64 = VSW_FEATURES;
+		return port_reply(p, msg, sizeof(msg->payload.u64));
+	case VHOST_USER_SET_FEATURES:
+		p->features = msg->payload.u64;
+		p->proto = p->features &
+			(1ULL << VHOST_USER_F_PROTOCOL_FEATURES);
+		p->hdrlen = (p->features & ((1ULL << VIRTIO_F_VERSION_1) |
+				(1ULL << VIRTIO_NET_F_MRG_RXBUF))) ?
+			sizeof(struct virtio_net_hdr_mrg_rxbuf) :
+			sizeof(struct virtio_net_hdr);
+		break;
+	case VHOST_USER_GET_PROTOCOL_FEATURES:
+		msg->payload.u64 = 0;
+		return port_reply(p, msg, sizeof(msg->payload.u64));
+	case VHOST_USER_SET_PROTOCOL_FEATURES:
+	case VHOST_USER_SET_OWNER:
+		break;
+	case VHOST_USER_RESET_OWNER:
+		port_reset(p);
+		break;
+	case VHOST_USER_SET_MEM_TABLE:
+		ret = port_set_mem_table(p, msg, fds, nfds);
+		nfds = 0;
+		break;
+	case VHOST_USER_SET_VRING_NUM:
+		if (state->index >= VSW_NQ || state->num == 0 ||
+				state->num > 32768 ||
+				(state->num & (state->num - 1)))
+			return -1;
+		p->vq[state->index].num = state->num;
+		break;
+	case VHOST_USER_SET_VRING_ADDR:
+		if (addr->index >= VSW_NQ)
+			return -1;
+		vr = &p->vq[addr->index];
+		vr->desc = uva_to_hva(p, addr->desc_user_addr);
+		vr->avail = uva_to_hva(p, addr->avail_user_addr);
+		vr->used = uva_to_hva(p, addr->used_user_addr);
+		if (!vr->desc || !vr->avail || !vr->used)
+			return -1;
+		break;
+	case VHOST_USER_SET_VRING_BASE:
+		if (state->index >= VSW_NQ)
+			return -1;
+		p->vq[state->index].last_avail = state->num;
+		break;
+	case VHOST_USER_GET_VRING_BASE:
+		if (state->index >= VSW_NQ)
+			return -1;
+		vr = &p->vq[state->index];
+		vr->started = false;
+		vr->enabled = false;
+		msg->payload.state.num = vr->last_avail;
+		epoll_del(vr->kickfd);
+		return port_reply(p, msg, sizeof(*state));
+	case VHOST_USER_SET_VRING_KICK:
+	case VHOST_USER_SET_VRING_CALL:
+		ret = port_set_vring_fd(p, msg, fds, nfds);
+		nfds = 0;
+		break;
+	case VHOST_USER_SET_VRING_ENABLE:
+		if (state->index >= VSW_NQ)
+			return -1;
+		p->vq[state->index].enabled = state->num;
+		/* the frames queued before the ring was enabled */
+		if (state->index == VSW_TXQ && state->num)
+			port_tx(p);
+		break;
+	default:
+		printf("port %d: request %u not supported\n", p->id,
+			msg->request);
+		ret = -1;
+		break;
+	}
+
+	while (nfds > 0)
+		close(fds[--nfds]);
+	if (msg->flags & VHOST_USER_NEED_REPLY_MASK) {
+		msg->payload.u64 = ret ? 1 : 0;
+		return port_reply(p, msg, sizeof(msg->payload.u64));
+	}
+	return ret;
+}
+
+static int port_recv_msg(struct vsw_port *p)
+{
+	char control[CMSG_SPACE(VHOST_USER_MEMORY_MAX_NREGIONS * sizeof(int))];
+	struct vhost_user_msg msg;
+	int fds[VHOST_USER_MEMORY_MAX_NREGIONS];
+	struct cmsghdr *cmsg;
+	struct msghdr mh;
+	struct iovec iov;
+	int nfds = 0;
+	ssize_t len;
+
+	iov.iov_base = &msg;
+	iov.iov_len = VHOST_USER_HDR_SIZE;
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = control;
+	mh.msg_controllen = sizeof(control);
+
+	len = recvmsg(p->connfd, &mh, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+	if (len != (ssize_t)VHOST_USER_HDR_SIZE)
+		return -1;
+	for (cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+				cmsg->cmsg_type == SCM_RIGHTS) {
+			nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+		}
+	}
+
+	if (msg.size > sizeof(msg.payload))
+		goto fail;
+	if (msg.size) {
+		len = recv(p->connfd, &msg.payload, msg.size, MSG_WAITALL);
+		if (len != (ssize_t)msg.size)
+			goto fail;
+	}
+	return port_handle_msg(p, &msg, fds, nfds);
+
+fail:
+	while (nfds > 0)
+		close(fds[--nfds]);
+	return -1;
+}
+
+static void port_accept(struct vsw_port *p)
+{
+	int fd;
+
+	fd = accept4(p->listenfd, NULL, NULL, SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	/* one DM per port, the others wait in the backlog */
+	epoll_del(p->listenfd);
+	p->connfd = fd;
+	port_reset(p);
+	p->tx_frames = p->rx_frames = p->rx_drops = 0;
+	epoll_add(fd, &p->ev_conn);
+	printf("port %d: %s connected\n", p->id, p->path);
+}
+
+static int port_open(struct vsw_port *p, int id, const char *path)
+{
+	struct sockaddr_un sun;
+	int i;
+
+	memset(p, 0, sizeof(*p));
+	p->id = id;
+	p->path = path;
+	p->connfd = -1;
+	for (i = 0; i < VSW_NQ; i++) {
+		p->vq[i].kickfd = -1;
+		p->vq[i].callfd = -1;
+		p->ev_kick[i].port = p;
+	}
+	p->ev_listen.type = VSW_EV_LISTEN;
+	p->ev_listen.port = p;
+	p->ev_conn.type = VSW_EV_CONN;
+	p->ev_conn.port = p;
+	p->ev_kick[VSW_RXQ].type = VSW_EV_KICK_RX;
+	p->ev_kick[VSW_TXQ].type = VSW_EV_KICK_TX;
+	port_reset(p);
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		printf("%s: path too long\n", path);
+		return -1;
+	}
+	strncpy(sun.sun_path, path, sizeof(sun.sun_path) - 1);
+
+	p->listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (p->listenfd < 0)
+		return -1;
+	unlink(path);
+	if (bind(p->listenfd, (struct sockaddr *)&sun, sizeof(sun)) < 0 ||
+			listen(p->listenfd, 1) < 0 ||
+			epoll_add(p->listenfd, &p->ev_listen) < 0) {
+		printf("%s: cannot listen, errno %d\n", path, errno);
+		close(p->listenfd);
+		return -1;
+	}
+	chmod(path, 0600);
+	return 0;
+}
+
+static void handle_event(struct vsw_ev *ev)
+{
+	struct vsw_port *p = ev->port;
+	eventfd_t cnt;
+
+	switch (ev->type) {
+	case VSW_EV_LISTEN:
+		port_accept(p);
+		break;
+	case VSW_EV_CONN:
+		if (port_recv_msg(p) < 0)
+			port_disconnect(p);
+		break;
+	case VSW_EV_KICK_RX:
+		/* no frames wait for RX buffers, they are dropped */
+		eventfd_read(p->vq[VSW_RXQ].kickfd, &cnt);
+		break;
+	case VSW_EV_KICK_TX:
+		eventfd_read(p->vq[VSW_TXQ].kickfd, &cnt);
+		port_tx(p);
+		break;
+	}
+}
+
+static void print_stats(void)
+{
+	struct vsw_port *p;
+	int i;
+
+	for (i = 0; i < nports; i++) {
+		p = &ports[i];
+		printf("port %d: %s %s, %lu frames sent, %lu received, "
+			"%lu dropped\n", i, p->path,
+			p->connfd >= 0 ? "connected" : "waiting",
+			p->tx_frames, p->rx_frames, p->rx_drops);
+	}
+	fflush(stdout);
+}
+
+static void sig_stats(int signo)
+{
+	dump_stats = 1;
+}
+
+static void sig_quit(int signo)
+{
+	quit = 1;
+}
+
+static void usage(const char *prog)
+{
+	printf("Usage: %s [-v] <socket> <socket> ...\n"
+		"  A port for each vhost-user socket, use it in the acrn-dm\n"
+		"  options of a UOS as \"-s <slot>,virtio-net,vhost-user:<socket>\".\n"
+		"  -v: print the connections and the MACs learnt\n"
+		"  SIGUSR1 prints the counters of the ports.\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	struct epoll_event events[64];
+	int opt, n, i, busy;
+
+	while ((opt = getopt(argc, argv, "vh")) != -1) {
+		switch (opt) {
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (optind >= argc || argc - optind > VSW_MAX_PORTS) {
+		usage(argv[0]);
+		printf("1 to %d ports\n", VSW_MAX_PORTS);
+		return 1;
+	}
+
+	memset(mac_table, 0xff, sizeof(mac_table));
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGUSR1, sig_stats);
+	signal(SIGINT, sig_quit);
+	signal(SIGTERM, sig_quit);
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		perror("epoll_create1");
+		return 1;
+	}
+	for (i = optind; i < argc; i++) {
+		if (port_open(&ports[nports], nports, argv[i]) < 0)
+			return 1;
+		nports++;
+	}
+
+	while (!quit) {
+		/* the ports which used up their budget go on right away */
+		busy = 0;
+		for (i = 0; i < nports; i++)
+			busy |= ports[i].busy;
+
+		n = epoll_wait(epfd, events, 64, busy ? 0 : -1);
+		if (n < 0 && errno != EINTR) {
+			perror("epoll_wait");
+			break;
+		}
+		for (i = 0; i < n; i++)
+			handle_event(events[i].data.ptr);
+		for (i = 0; busy && i < nports; i++) {
+			if (ports[i].busy)
+				port_tx(&ports[i]);
+		}
+
+		if (dump_stats) {
+			dump_stats = 0;
+			print_stats();
+		}
+	}
+
+	for (i = 0; i < nports; i++)
+		unlink(ports[i].path);
+	return 0;
+}
@@ -0,0 +1,514 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: (BSD-3-Clause OR GPL-2.0)
+ */
+
+/*
+ * Guest side of the ACRN micro-benchmarks.
+ *
+ * Each operation is run back to back and timed with the TSC, one sample
+ * per operation, from the instruction leaving the guest to its return:
+ *
+ *   cpuid       CPUID exit, handled by the hypervisor
+ *   hv_pio      read of a port emulated by the hypervisor (vPIC IMR)
+ *   dm_pio      read of a port emulated by the device model (UOS only)
+ *   mmio        read of MMIO emulated by the device model (UOS only)
+ *   hypercall   HC_GET_API_VERSION (SOS only)
+ *   inject_msi  HC_INJECT_MSI into a UOS (SOS only)
+ *   ipi         IPI to a vCPU on another pCPU and its completion
+ *   world_switch  HC_WORLD_SWITCH to the secure world and back (Trusty)
+ *
+ * For the RT VMs, the LAPIC passthrough ones in particular, two operations
+ * measure a latency rather than a round trip, a sample each:
+ *
+ *   rt_timer    from the expiry of an hrtimer to its handler
+ *   rt_ipi      from sending an IPI to another vCPU to its handler
+ *
+ * Writing an operation name to <debugfs>/acrnbench/run runs it, reading
+ * <debugfs>/acrnbench/result returns the statistics and the log2 cycle
+ * histogram of the last run. The targets are the module parameters, see
+ * scripts/acrnbench.py.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/debugfs.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/smp.h>
+#include <linux/io.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/hrtimer.h>
+#include <linux/version.h>
+#include <asm/msr.h>
+#include <asm/processor.h>
+#include <asm/tsc.h>
+
+#define ACRN_HC_ID			0x80UL
+#define BASE_HC_ID(x, y)		(((x) << 24U) | (y))
+#define HC_GET_API_VERSION		BASE_HC_ID(ACRN_HC_ID, 0x00UL)
+#define HC_INJECT_MSI			BASE_HC_ID(ACRN_HC_ID, 0x23UL)
+#define HC_WORLD_SWITCH			BASE_HC_ID(ACRN_HC_ID, 0x71UL)
+
+/* Trusty SMC_SC_NOP, answered by the secure world without any work */
+#define TRUSTY_SMC_SC_NOP		0x3c000003UL
+
+#define BENCH_MAX_ITERATIONS		1000000U
+#define BENCH_HIST_BUCKETS		32U
+#define BENCH_RESULT_SIZE		4096U
+
+static unsigned int iterations = 10000U;
+module_param(iterations, uint, 0644);
+MODULE_PARM_DESC(iterations, "samples per run");
+
+static ushort hv_port = 0x21U;
+module_param(hv_port, ushort, 0644);
+MODULE_PARM_DESC(hv_port, "port emulated by the hypervisor, read by hv_pio");
+
+static ushort dm_port = 0x64U;
+module_param(dm_port, ushort, 0644);
+MODULE_PARM_DESC(dm_port, "port emulated by the device model, read by dm_pio");
+
+static ulong mmio_addr;
+module_param(mmio_addr, ulong, 0644);
+MODULE_PARM_DESC(mmio_addr, "MMIO emulated by the device model, read by mmio");
+
+static ushort msi_vmid;
+module_param(msi_vmid, ushort, 0644);
+MODULE_PARM_DESC(msi_vmid, "target UOS of inject_msi");
+
+static ulong msi_addr;
+module_param(msi_addr, ulong, 0644);
+MODULE_PARM_DESC(msi_addr, "MSI address injected by inject_msi");
+
+static ulong msi_data;
+module_param(msi_data, ulong, 0644);
+MODULE_PARM_DESC(msi_data, "MSI data injected by inject_msi");
+
+static int ipi_cpu = -1;
+module_param(ipi_cpu, int, 0644);
+MODULE_PARM_DESC(ipi_cpu, "target CPU of ipi, -1 for the next online one");
+
+static ulong smc_id = TRUSTY_SMC_SC_NOP;
+module_param(smc_id, ulong, 0644);
+MODULE_PARM_DESC(smc_id, "SMC issued to the secure world by world_switch");
+
+static ulong rt_period_us = 100UL;
+module_param(rt_period_us, ulong, 0644);
+MODULE_PARM_DESC(rt_period_us, "timeout of the hrtimer of rt_timer");
+
+/* a hard timer, expired in the interrupt on PREEMPT_RT kernels as well */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 4, 0)
+#define BENCH_HRTIMER_MODE		HRTIMER_MODE_ABS_PINNED_HARD
+#else
+#define BENCH_HRTIMER_MODE		HRTIMER_MODE_ABS_PINNED
+#endif
+
+struct bench_op {
+	const char *name;
+	/* returns non-zero if the operation cannot run here */
+	int (*setup)(void);
+	void (*run)(void);
+	void (*teardown)(void);
+	bool irqs_on;	/* timed with the interrupts enabled */
+	/* takes a sample itself, with the interrupts enabled, instead of run */
+	u64 (*sample)(void);
+};
+
+struct acrn_msi {
+	u64 addr;
+	u64 data;
+};
+
+struct acrn_api_version {
+	u32 major;
+	u32 minor;
+};
+
+static DEFINE_MUTEX(bench_lock);
+static struct dentry *bench_dir;
+static char bench_result[BENCH_RESULT_SIZE];
+static size_t bench_result_len;
+
+static void __iomem *mmio_va;
+static struct acrn_msi *msi_entry;
+static struct acrn_api_version *api_version;
+static int ipi_target;
+
+static struct hrtimer rt_timer;
+static u64 rt_expected_tsc;
+static u64 rt_handler_tsc;
+static bool rt_fired;
+
+static inline long acrn_hypercall2(unsigned long id, unsigned long p1,
+		unsigned long p2)
+{
+	register unsigned long r8 asm("r8") = id;
+	long ret;
+
+	asm volatile("vmcall"
+			: "=a"(ret)
+			: "r"(r8), "D"(p1), "S"(p2)
+			: "memory");
+	return ret;
+}
+
+static void bench_cpuid(void)
+{
+	unsigned int eax = 0U, ebx, ecx = 0U, edx;
+
+	native_cpuid(&eax, &ebx, &ecx, &edx);
+}
+
+static void bench_hv_pio(void)
+{
+	(void)inb(hv_port);
+}
+
+static void bench_dm_pio(void)
+{
+	(void)inb(dm_port);
+}
+
+static int bench_mmio_setup(void)
+{
+	if (mmio_addr == 0UL)
+		return -EINVAL;
+	mmio_va = ioremap(mmio_addr, sizeof(u32));
+	return (mmio_va == NULL) ? -ENOMEM : 0;
+}
+
+static void bench_mmio(void)
+{
+	(void)readl(mmio_va);
+}
+
+static void bench_mmio_teardown(void)
+{
+	iounmap(mmio_va);
+	mmio_va = NULL;
+}
+
+static int bench_hypercall_setup(void)
+{
+	api_version = kzalloc(sizeof(*api_version), GFP_KERNEL);
+	return (api_version == NULL) ? -ENOMEM : 0;
+}
+
+static void bench_hypercall(void)
+{
+	(void)acrn_hypercall2(HC_GET_API_VERSION, virt_to_phys(api_version), 0UL);
+}
+
+static void bench_hypercall_teardown(void)
+{
+	kfree(api_version);
+	api_version = NULL;
+}
+
+static int bench_inject_msi_setup(void)
+{
+	if (msi_addr == 0UL)
+		return -EINVAL;
+	msi_entry = kzalloc(sizeof(*msi_entry), GFP_KERNEL);
+	if (msi_entry == NULL)
+		return -ENOMEM;
+	msi_entry->addr = msi_addr;
+	msi_entry->data = msi_data;
+	return 0;
+}
+
+static void bench_inject_msi(void)
+{
+	(void)acrn_hypercall2(HC_INJECT_MSI, msi_vmid, virt_to_phys(msi_entry));
+}
+
+static void bench_inject_msi_teardown(void)
+{
+	kfree(msi_entry);
+	msi_entry = NULL;
+}
+
+static void bench_ipi_func(void *info)
+{
+}
+
+static int bench_ipi_setup(void)
+{
+	ipi_target = ipi_cpu;
+	if (ipi_target < 0) {
+		ipi_target = cpumask_next(raw_smp_processor_id(), cpu_online_mask);
+		if (ipi_target >= nr_cpu_ids)
+			ipi_target = cpumask_first(cpu_online_mask);
+	}
+	if (ipi_target == raw_smp_processor_id() || !cpu_online(ipi_target))
+		return -EINVAL;
+	return 0;
+}
+
+static void bench_ipi(void)
+{
+	(void)smp_call_function_single(ipi_target, bench_ipi_func, NULL, 1);
+}
+
+static void bench_world_switch(void)
+{
+	register unsigned long r8 asm("r8") = HC_WORLD_SWITCH;
+	unsigned long r0 = smc_id, r1 = 0UL, r2 = 0UL, r3 = 0UL;
+
+	/* the secure world returns in rdi, rsi, rdx and rbx */
+	asm volatile("vmcall"
+			: "+D"(r0), "+S"(r1), "+d"(r2), "+b"(r3)
+			: "r"(r8)
+			: "memory");
+}
+
+static enum hrtimer_restart bench_rt_timer_fn(struct hrtimer *timer)
+{
+	rt_handler_tsc = rdtsc_ordered();
+	WRITE_ONCE(rt_fired, true);
+	return HRTIMER_NORESTART;
+}
+
+static int bench_rt_timer_setup(void)
+{
+	if (rt_period_us == 0UL || tsc_khz == 0U)
+		return -EINVAL;
+	hrtimer_init(&rt_timer, CLOCK_MONOTONIC, BENCH_HRTIMER_MODE);
+	rt_timer.function = bench_rt_timer_fn;
+	return 0;
+}
+
+/* the expiry in TSC cycles is read right after the clock it is set on */
+static u64 bench_rt_timer(void)
+{
+	u64 period_ns = rt_period_us * NSEC_PER_USEC;
+	ktime_t expires;
+
+	WRITE_ONCE(rt_fired, false);
+	expires = ktime_add_ns(ktime_get(), period_ns);
+	rt_expected_tsc = rdtsc_ordered() +
+		div_u64(period_ns * tsc_khz, USEC_PER_SEC);
+	hrtimer_start(&rt_timer, expires, BENCH_HRTIMER_MODE);
+
+	while (!READ_ONCE(rt_fired))
+		cpu_relax();
+
+	return (rt_handler_tsc > rt_expected_tsc) ?
+		(rt_handler_tsc - rt_expected_tsc) : 0UL;
+}
+
+static void bench_rt_timer_teardown(void)
+{
+	hrtimer_cancel(&rt_timer);
+}
+
+static void bench_rt_ipi_func(void *info)
+{
+	rt_handler_tsc = rdtsc_ordered();
+}
+
+/* the TSCs of the vCPUs are the ones of their pCPUs, in sync */
+static u64 bench_rt_ipi(void)
+{
+	u64 t0 = rdtsc_ordered();
+
+	(void)smp_call_function_single(ipi_target, bench_rt_ipi_func, NULL, 1);
+	return (rt_handler_tsc > t0) ? (rt_handler_tsc - t0) : 0UL;
+}
+
+static const struct bench_op bench_ops[] = {
+	{ "cpuid", NULL, bench_cpuid, NULL, false },
+	{ "hv_pio", NULL, bench_hv_pio, NULL, false },
+	{ "dm_pio", NULL, bench_dm_pio, NULL, false },
+	{ "mmio", bench_mmio_setup, bench_mmio, bench_mmio_teardown, false },
+	{ "hypercall", bench_hypercall_setup, bench_hypercall,
+		bench_hypercall_teardown, false },
+	{ "inject_msi", bench_inject_msi_setup, bench_inject_msi,
+		bench_inject_msi_teardown, false },
+	/* the IPI completion is an interrupt */
+	{ "ipi", bench_ipi_setup, bench_ipi, NULL, true },
+	{ "world_switch", NULL, bench_world_switch, NULL, false },
+	{ "rt_timer", bench_rt_timer_setup, NULL, bench_rt_timer_teardown,
+		true, bench_rt_timer },
+	{ "rt_ipi", bench_ipi_setup, NULL, NULL, true, bench_rt_ipi },
+};
+
+static int bench_cmp(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+static void bench_report(const struct bench_op *op, u64 *samples,
+		unsigned int n)
+{
+	unsigned int hist[BENCH_HIST_BUCKETS] = { 0U };
+	unsigned int i, b;
+	u64 sum = 0UL;
+	size_t len;
+
+	for (i = 0U; i < n; i++) {
+		sum += samples[i];
+		b = (samples[i] == 0UL) ? 0U : ilog2(samples[i]);
+		hist[min(b, BENCH_HIST_BUCKETS - 1U)]++;
+	}
+	sort(samples, n, sizeof(u64), bench_cmp, NULL);
+
+	len = scnprintf(bench_result, BENCH_RESULT_SIZE,
+			"op %s\niterations %u\nmin %llu\navg %llu\n"
+			"p50 %llu\np99 %llu\np999 %llu\nmax %llu\n"
+			"tsc_khz %u\n",
+			op->name, n, samples[0], div_u64(sum, n),
+			samples[n / 2U], samples[(n * 99U) / 100U],
+			samples[(n * 999U) / 1000U], samples[n - 1U],
+			tsc_khz);
+	/* bucket b holds [2^b, 2^(b+1)) cycles */
+	for (b = 0U; b < BENCH_HIST_BUCKETS; b++) {
+		if (hist[b] != 0U)
+			len += scnprintf(bench_result + len,
+					BENCH_RESULT_SIZE - len,
+					"hist %llu %u\n", 1ULL << b, hist[b]);
+	}
+	bench_result_len = len;
+}
+
+static int bench_run(const struct bench_op *op)
+{
+	unsigned int n = min(iterations, BENCH_MAX_ITERATIONS), i;
+	unsigned long flags;
+	u64 *samples, t0, t1;
+	int ret = 0;
+
+	if (n == 0U)
+		return -EINVAL;
+
+	samples = vmalloc(n * sizeof(u64));
+	if (samples == NULL)
+		return -ENOMEM;
+
+	if (op->setup != NULL) {
+		ret = op->setup();
+		if (ret != 0)
+			goto out;
+	}
+
+	/* warm up the caches and the predictors */
+	for (i = 0U; i < 16U; i++) {
+		if (op->sample != NULL) {
+			preempt_disable();
+			(void)op->sample();
+			preempt_enable();
+		} else {
+			op->run();
+		}
+	}
+
+	for (i = 0U; i < n; i++) {
+		preempt_disable();
+		if (op->sample != NULL) {
+			t0 = 0UL;
+			t1 = op->sample();
+		} else if (op->irqs_on) {
+			t0 = rdtsc_ordered();
+			op->run();
+			t1 = rdtsc_ordered();
+		} else {
+			local_irq_save(flags);
+			t0 = rdtsc_ordered();
+			op->run();
+			t1 = rdtsc_ordered();
+			local_irq_restore(flags);
+		}
+		preempt_enable();
+		samples[i] = t1 - t0;
+
+		if ((i & 0x3ffU) == 0U)
+			cond_resched();
+	}
+
+	if (op->teardown != NULL)
+		op->teardown();
+
+	bench_report(op, samples, n);
+out:
+	vfree(samples);
+	return ret;
+}
+
+static ssize_t bench_run_write(struct file *file, const char __user *ubuf,
+		size_t count, loff_t *ppos)
+{
+	char name[32];
+	size_t len = min(count, sizeof(name) - 1U);
+	unsigned int i;
+	int ret = -EINVAL;
+
+	if (copy_from_user(name, ubuf, len))
+		return -EFAULT;
+	name[len] = '\0';
+	strim(name);
+
+	mutex_lock(&bench_lock);
+	for (i = 0U; i < ARRAY_SIZE(bench_ops); i++) {
+		if (strcmp(name, bench_ops[i].name) == 0) {
+			ret = bench_run(&bench_ops[i]);
+			break;
+		}
+	}
+	mutex_unlock(&bench_lock);
+
+	return (ret == 0) ? (ssize_t)count : ret;
+}
+
+static ssize_t bench_result_read(struct file *file, char __user *ubuf,
+		size_t count, loff_t *ppos)
+{
+	ssize_t ret;
+
+	mutex_lock(&bench_lock);
+	ret = simple_read_from_buffer(ubuf, count, ppos, bench_result,
+			bench_result_len);
+	mutex_unlock(&bench_lock);
+	return ret;
+}
+
+static const struct file_operations bench_run_fops = {
+	.owner	= THIS_MODULE,
+	.write	= bench_run_write,
+};
+
+static const struct file_operations bench_result_fops = {
+	.owner	= THIS_MODULE,
+	.read	= bench_result_read,
+};
+
+static int __init acrnbench_init(void)
+{
+	bench_dir = debugfs_create_dir("acrnbench", NULL);
+	if (IS_ERR_OR_NULL(bench_dir))
+		return -ENODEV;
+
+	debugfs_create_file("run", 0200, bench_dir, NULL, &bench_run_fops);
+	debugfs_create_file("result", 0400, bench_dir, NULL,
+			&bench_result_fops);
+	return 0;
+}
+
+static void __exit acrnbench_exit(void)
+{
+	debugfs_remove_recursive(bench_dir);
+}
+
+module_init(acrnbench_init);
+module_exit(acrnbench_exit);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("ACRN exit, hypercall and RT latency micro-benchmarks");
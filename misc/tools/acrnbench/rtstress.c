@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * SOS side stressors of the RT latency benchmarks, a thread per load and
+ * per CPU given:
+ *
+ *   cache   writes a buffer larger than the LLC, a cache line at a time
+ *   ipi     changes the protection of a page mapped by all the threads,
+ *           every change is a TLB shootdown IPI to the other CPUs
+ *   io      O_DIRECT writes and reads of a file, next to the disk images
+ *           of the UOSes, for the device model to compete with
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+
+#define MAX_THREADS		256
+#define CACHE_LINE		64
+#define IO_BLOCK		(64 * 1024)
+#define IO_BLOCKS		256
+
+enum load { LOAD_CACHE, LOAD_IPI, LOAD_IO, LOADS };
+
+static const char *load_names[LOADS] = { "cache", "ipi", "io" };
+
+struct stressor {
+	pthread_t thread;
+	enum load load;
+	int cpu;
+	unsigned long ops;
+};
+
+static struct stressor stressors[MAX_THREADS];
+static int nr_stressors;
+static volatile sig_atomic_t exiting;
+
+static size_t cache_size = 32UL << 20;
+static const char *io_file = "rtstress.io";
+static unsigned int duration;
+static void *shared_page;
+
+static void usage(void)
+{
+	printf("rtstress - SOS side stressors of the RT latency benchmarks\n"
+	       "[Usage] rtstress -l load[,load...] -c cpu[,cpu...] [-t seconds]\n"
+	       "\t\t [-s cache_MB] [-f io_file]\n\n"
+	       "[Options]\n"
+	       "\t-h: print this message\n"
+	       "\t-l: loads, out of cache, ipi and io\n"
+	       "\t-c: CPUs to run each load on\n"
+	       "\t-t: stop after this many seconds, run until killed by default\n"
+	       "\t-s: buffer of the cache load in MB per thread (32)\n"
+	       "\t-f: file of the io load (rtstress.io)\n");
+}
+
+static void *cache_fn(struct stressor *st)
+{
+	volatile unsigned char *buf;
+	size_t i;
+
+	buf = malloc(cache_size);
+	if (!buf)
+		return NULL;
+
+	while (!exiting) {
+		for (i = 0; i < cache_size; i += CACHE_LINE)
+			buf[i]++;
+		st->ops++;
+	}
+
+	free((void *)buf);
+	return NULL;
+}
+
+static void *ipi_fn(struct stressor *st)
+{
+	long page = sysconf(_SC_PAGESIZE);
+
+	while (!exiting) {
+		/* touched by all the threads, in the TLBs of all their CPUs */
+		*(volatile unsigned char *)shared_page = 1;
+		mprotect(shared_page, page, PROT_READ);
+		mprotect(shared_page, page, PROT_READ | PROT_WRITE);
+		st->ops++;
+	}
+
+	return NULL;
+}
+
+static void *io_fn(struct stressor *st)
+{
+	char path[256];
+	void *buf;
+	int fd, i;
+
+	snprintf(path, sizeof(path), "%s.%d", io_file, st->cpu);
+	fd = open(path, O_RDWR | O_CREAT | O_DIRECT, 0600);
+	if (fd < 0) {
+		printf("Failed to open %s, errno %d\n", path, errno);
+		return NULL;
+	}
+	if (posix_memalign(&buf, 4096, IO_BLOCK)) {
+		close(fd);
+		return NULL;
+	}
+	memset(buf, 0x5a, IO_BLOCK);
+
+	while (!exiting) {
+		for (i = 0; i < IO_BLOCKS && !exiting; i++)
+			if (pwrite(fd, buf, IO_BLOCK, (off_t)i * IO_BLOCK) < 0)
+				break;
+		fdatasync(fd);
+		for (i = 0; i < IO_BLOCKS && !exiting; i++)
+			if (pread(fd, buf, IO_BLOCK, (off_t)i * IO_BLOCK) < 0)
+				break;
+		st->ops++;
+	}
+
+	free(buf);
+	close(fd);
+	unlink(path);
+	return NULL;
+}
+
+static void *stressor_fn(void *arg)
+{
+	struct stressor *st = arg;
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(st->cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set)) {
+		printf("Failed to run on CPU %d, errno %d\n", st->cpu, errno);
+		return NULL;
+	}
+
+	switch (st->load) {
+	case LOAD_CACHE:
+		return cache_fn(st);
+	case LOAD_IPI:
+		return ipi_fn(st);
+	default:
+		return io_fn(st);
+	}
+}
+
+static int parse_loads(char *arg, unsigned int *loads)
+{
+	char *tok, *save;
+	int i;
+
+	for (tok = strtok_r(arg, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		for (i = 0; i < LOADS; i++)
+			if (strcmp(tok, load_names[i]) == 0)
+				break;
+		if (i == LOADS) {
+			printf("Unknown load %s\n", tok);
+			return -1;
+		}
+		*loads |= 1U << i;
+	}
+
+	return 0;
+}
+
+static void signal_exit_handler(int sig)
+{
+	exiting = 1;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int loads = 0;
+	char *cpus = NULL, *tok, *save;
+	int opt, i, l;
+
+	while ((opt = getopt(argc, argv, "hl:c:t:s:f:")) != -1) {
+		switch (opt) {
+		case 'l':
+			if (parse_loads(optarg, &loads))
+				return EXIT_FAILURE;
+			break;
+		case 'c':
+			cpus = optarg;
+			break;
+		case 't':
+			duration = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			cache_size = strtoul(optarg, NULL, 10) << 20;
+			break;
+		case 'f':
+			io_file = optarg;
+			break;
+		case 'h':
+		default:
+			usage();
+			return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (loads == 0 || cpus == NULL || cache_size == 0) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	shared_page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (shared_page == MAP_FAILED)
+		return EXIT_FAILURE;
+
+	signal(SIGTERM, signal_exit_handler);
+	signal(SIGINT, signal_exit_handler);
+
+	for (tok = strtok_r(cpus, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		for (l = 0; l < LOADS; l++) {
+			if (!(loads & (1U << l)))
+				continue;
+			if (nr_stressors == MAX_THREADS) {
+				printf("At most %d stressors\n", MAX_THREADS);
+				return EXIT_FAILURE;
+			}
+			stressors[nr_stressors].load = l;
+			stressors[nr_stressors].cpu = strtoul(tok, NULL, 10);
+			if (pthread_create(&stressors[nr_stressors].thread, NULL,
+					stressor_fn, &stressors[nr_stressors])) {
+				printf("Failed to create a stressor\n");
+				exiting = 1;
+				break;
+			}
+			nr_stressors++;
+		}
+	}
+
+	printf("%d stressors running\n", nr_stressors);
+	if (duration) {
+		sleep(duration);
+		exiting = 1;
+	}
+
+	for (i = 0; i < nr_stressors; i++) {
+		pthread_join(stressors[i].thread, NULL);
+		printf("%-6s cpu %-3d %lu rounds\n",
+			load_names[stressors[i].load], stressors[i].cpu,
+			stressors[i].ops);
+	}
+
+	return EXIT_SUCCESS;
+}
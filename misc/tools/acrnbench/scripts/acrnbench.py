@@ -0,0 +1,226 @@
+#!/usr/bin/python3
+# -*- coding: UTF-8 -*-
+
+"""
+This is the harness of the acrnbench micro-benchmarks, which:
+- loads the acrnbench module with the benchmark targets
+- runs the operations and prints their cycle histograms
+- saves the results to a CSV file, and compares them with a baseline
+"""
+
+import csv
+import getopt
+import os
+import subprocess
+import sys
+
+DEBUGFS = "/sys/kernel/debug/acrnbench"
+PARAMS = "/sys/module/acrnbench/parameters"
+
+ALL_OPS = ["cpuid", "hv_pio", "dm_pio", "mmio", "hypercall", "inject_msi",
+           "ipi", "world_switch", "rt_timer", "rt_ipi"]
+# run by default, the others need a target or a given kind of VM
+DEFAULT_OPS = ["cpuid", "hv_pio", "ipi"]
+
+STATS = ["min", "avg", "p50", "p99", "max"]
+HIST_WIDTH = 50
+
+def usage():
+    """print the usage of the script
+    Args: NA
+    Returns: None
+    Raises: NA
+    """
+    print('''
+    [Usage] acrnbench.py [options] [value] ...
+
+    [options]
+    -h: print this message
+    -m, --module=[string]: acrnbench.ko to load
+    -o, --ofile=[string]: output CSV file
+    -n, --iterations=[unsigned int]: samples per operation
+    -c, --cpu=[unsigned int]: CPU to run the benchmarks on, default 0
+    --ops=[string]: comma separated operations, default %s,
+                    out of %s
+    --set=[param=value]: set a parameter of the module, e.g.
+                         --set=mmio_addr=0xdf000000, may be repeated
+    --baseline=[string]: CSV file of a previous run to compare with
+    --threshold=[unsigned int]: regression threshold of p50 and p99 in
+                                percent, default 10
+    ''' % (",".join(DEFAULT_OPS), ",".join(ALL_OPS)))
+
+def set_param(name, value):
+    """set a parameter of the loaded module"""
+    with open(os.path.join(PARAMS, name), 'w') as filep:
+        filep.write(str(value))
+
+def load_module(module, params):
+    """insmod module with params, unless acrnbench is loaded already"""
+    if os.path.isdir(PARAMS):
+        for (name, value) in params:
+            set_param(name, value)
+        return
+
+    if not module:
+        print("acrnbench is not loaded, specify it with -m")
+        sys.exit(1)
+
+    args = ["insmod", module] + ["%s=%s" % p for p in params]
+    subprocess.check_call(args)
+
+def run_op(op):
+    """run an operation
+    Args:
+        op: name of the operation
+    Return:
+        dictionary of the statistics, with the histogram in 'hist' as a
+        list of (lowest cycles of the bucket, samples), None on failure
+    """
+    try:
+        with open(os.path.join(DEBUGFS, "run"), 'w') as filep:
+            filep.write(op)
+    except (IOError, OSError) as err:
+        print("%s: %s" % (op, str(err)))
+        return None
+
+    result = {'hist': []}
+    with open(os.path.join(DEBUGFS, "result"), 'r') as filep:
+        for line in filep:
+            fields = line.split()
+            if fields[0] == "hist":
+                result['hist'].append((int(fields[1]), int(fields[2])))
+            elif fields[0] == "op":
+                result['op'] = fields[1]
+            else:
+                result[fields[0]] = int(fields[1])
+
+    return result
+
+def print_result(result):
+    """print the statistics and the histogram of an operation"""
+    print("%s: %d samples (cycles)" % (result['op'], result['iterations']))
+    print("\t" + "  ".join(["%s %d" % (s, result[s]) for s in STATS]))
+
+    peak = max([cnt for (_, cnt) in result['hist']])
+    for (low, cnt) in result['hist']:
+        bar = '#' * max(1, cnt * HIST_WIDTH // peak)
+        print("\t%10d - %-10d %8d %s" % (low, low * 2 - 1, cnt, bar))
+
+def save_results(ofile, results):
+    """save the statistics to a CSV file"""
+    try:
+        with open(ofile, 'w') as filep:
+            f_csv = csv.writer(filep)
+            f_csv.writerow(['Operation', 'Iterations'] + STATS)
+            for res in results:
+                f_csv.writerow([res['op'], res['iterations']] +
+                               [res[s] for s in STATS])
+    except IOError as err:
+        print("Output File Error: " + str(err))
+
+def compare_baseline(baseline, results, threshold):
+    """compare the results with a baseline
+    Args:
+        baseline: CSV file saved by a previous run
+        results: results of this run
+        threshold: allowed increase of p50 and p99, in percent
+    Return:
+        number of the regressed operations
+    """
+    base = {}
+    with open(baseline, 'r') as filep:
+        for row in csv.DictReader(filep):
+            base[row['Operation']] = row
+
+    regressions = 0
+    print("\n%-14s%12s%12s%10s" % ("Operation", "p50 base", "p50 now", "delta"))
+    for res in results:
+        if res['op'] not in base:
+            continue
+        row = base[res['op']]
+        for stat in ["p50", "p99"]:
+            old = int(row[stat])
+            delta = 100.0 * (res[stat] - old) / old if old != 0 else 0.0
+            if stat == "p50":
+                print("%-14s%12d%12d%9.1f%%" %
+                      (res['op'], old, res[stat], delta))
+            if delta > threshold:
+                print("\tREGRESSION: %s %s %d -> %d cycles" %
+                      (res['op'], stat, old, res[stat]))
+                regressions += 1
+
+    return regressions
+
+def main(argv):
+    """Main enterance function
+
+    Args:
+        argv: arguments string
+    Returns:
+        None
+    Raises:
+        GetoptError
+    """
+    module = ''
+    outputfile = ''
+    baseline = ''
+    threshold = 10
+    cpu = 0
+    ops = DEFAULT_OPS
+    params = []
+    opts_short = "hm:o:n:c:"
+    opts_long = ["module=", "ofile=", "iterations=", "cpu=", "ops=", "set=",
+                 "baseline=", "threshold="]
+
+    try:
+        opts, args = getopt.getopt(argv, opts_short, opts_long)
+    except getopt.GetoptError:
+        usage()
+        sys.exit(1)
+
+    for opt, arg in opts:
+        if opt == '-h':
+            usage()
+            sys.exit()
+        elif opt in ("-m", "--module"):
+            module = arg
+        elif opt in ("-o", "--ofile"):
+            outputfile = arg
+        elif opt in ("-n", "--iterations"):
+            params.append(("iterations", int(arg, 0)))
+        elif opt in ("-c", "--cpu"):
+            cpu = int(arg, 0)
+        elif opt == "--ops":
+            ops = arg.split(',')
+        elif opt == "--set":
+            params.append(tuple(arg.split('=', 1)))
+        elif opt == "--baseline":
+            baseline = arg
+        elif opt == "--threshold":
+            threshold = int(arg, 0)
+        else:
+            assert False, "unhandled option"
+
+    for op in ops:
+        assert op in ALL_OPS, "unknown operation " + op
+
+    load_module(module, params)
+
+    # the IPI goes from this CPU, keep the samples on one CPU
+    os.sched_setaffinity(0, {cpu})
+
+    results = []
+    for op in ops:
+        res = run_op(op)
+        if res is not None:
+            print_result(res)
+            results.append(res)
+
+    if outputfile:
+        save_results(outputfile, results)
+
+    if baseline and compare_baseline(baseline, results, threshold) != 0:
+        sys.exit(1)
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
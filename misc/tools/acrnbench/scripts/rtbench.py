@@ -0,0 +1,277 @@
+#!/usr/bin/python3
+# -*- coding: UTF-8 -*-
+
+"""
+This is the harness of the RT latency benchmarks of the LAPIC passthrough
+RT VMs, run on both sides of a scenario:
+- "stress" on the SOS, runs rtstress on the CPUs of the SOS, all but the
+  ones of the RT VM of the scenario
+- "measure" in the RT VM, runs the rt_timer and rt_ipi operations of the
+  acrnbench module and reports the worst case and the percentiles in us
+"""
+
+import csv
+import getopt
+import os
+import re
+import subprocess
+import sys
+
+from acrnbench import load_module, run_op, print_result
+
+TREE = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                    "..", "..", "..", "..")
+SCENARIOS = os.path.join(TREE, "hypervisor", "scenarios")
+
+RT_OPS = ["rt_timer", "rt_ipi"]
+LOADS = ["cache", "ipi", "io"]
+RT_FLAGS = ["GUEST_FLAG_LAPIC_PASSTHROUGH", "GUEST_FLAG_RT",
+            "GUEST_FLAG_HIGHEST_SEVERITY"]
+STATS = ["p50", "p99", "p999", "max"]
+
+def usage():
+    """print the usage of the script
+    Args: NA
+    Returns: None
+    Raises: NA
+    """
+    print('''
+    [Usage] rtbench.py stress|measure [options] [value] ...
+
+    [common options]
+    -h: print this message
+    --scenario=[string]: scenario of hypervisor/scenarios, or its
+                         directory, default industry
+    --rt_vm=[unsigned int]: the RT VM of the scenario, by default the
+                            first one with an RT guest flag
+
+    [stress options]
+    --loads=[string]: comma separated loads, default %s
+    -t, --time=[unsigned int]: seconds to run, until killed by default
+    --io_file=[string]: file of the io load, next to the UOS images
+    --stressor=[string]: rtstress to run, default the one in PATH
+
+    [measure options]
+    -m, --module=[string]: acrnbench.ko to load
+    -o, --ofile=[string]: output CSV file
+    -n, --iterations=[unsigned int]: samples per operation
+    --ops=[string]: comma separated operations, default %s
+    --period=[unsigned int]: timeout of the rt_timer hrtimer in us
+    --ipi_cpu=[unsigned int]: vCPU receiving the IPIs of rt_ipi
+    --max_latency=[float]: fails if the worst case of an operation is
+                           above, in us
+    ''' % (",".join(LOADS), ",".join(RT_OPS)))
+
+def scenario_dir(scenario):
+    """the directory of a scenario, given by name or path"""
+    if os.path.isdir(scenario):
+        return scenario
+    return os.path.join(SCENARIOS, scenario)
+
+def parse_scenario(scenario):
+    """the VMs of a scenario
+    Args:
+        scenario: name or directory of the scenario
+    Return:
+        list of dictionaries of the VMs, in the order of vm_configs[],
+        with their 'flags' and the pCPUs of their 'affinity'
+    """
+    path = scenario_dir(scenario)
+    with open(os.path.join(path, "vm_configurations.h"), 'r') as filep:
+        header = filep.read()
+    with open(os.path.join(path, "vm_configurations.c"), 'r') as filep:
+        source = filep.read()
+
+    affinities = {}
+    for (name, cpus) in re.findall(r"#define\s+(\w+_CONFIG_VCPU_AFFINITY)"
+                                   r"\s+\{(.*)\}", header):
+        affinities[name] = [int(c) for c in
+                            re.findall(r"AFFINITY_CPU\((\d+)U?\)", cpus)]
+
+    vms = []
+    for block in re.split(r"\n\t\{[^\n]*\n", source)[1:]:
+        vm = {'id': len(vms), 'flags': [], 'affinity': []}
+        match = re.search(r"\.load_order\s*=\s*(\w+)", block)
+        vm['load_order'] = match.group(1) if match else ''
+        match = re.search(r"\.guest_flags\s*=\s*([^,]+),", block)
+        if match:
+            vm['flags'] = re.findall(r"GUEST_FLAG_\w+", match.group(1))
+        match = re.search(r"\.vcpu_affinity\s*=\s*(\w+)", block)
+        if match:
+            vm['affinity'] = affinities.get(match.group(1), [])
+        vms.append(vm)
+
+    return vms
+
+def find_rt_vm(vms, rt_vm):
+    """the RT VM, given or the first one with an RT guest flag"""
+    if rt_vm is not None:
+        assert rt_vm < len(vms), "no VM %d in the scenario" % rt_vm
+        return vms[rt_vm]
+    for vm in vms:
+        if [f for f in vm['flags'] if f in RT_FLAGS]:
+            return vm
+    assert False, "no RT VM in the scenario, specify it with --rt_vm"
+
+def online_cpus():
+    """the CPUs of the SOS, the ones of the RT VM are offline here"""
+    return sorted(os.sched_getaffinity(0))
+
+def stress(vm, loads, duration, io_file, stressor):
+    """run the stressors on the CPUs of the SOS, not the ones of vm"""
+    cpus = [c for c in online_cpus() if c not in vm['affinity']]
+    assert cpus, "no CPU of the SOS left to stress"
+    busy = [c for c in online_cpus() if c in vm['affinity']]
+    if busy:
+        print("WARN: CPUs %s of the RT VM are online in the SOS" % busy)
+
+    print("RT VM %d on pCPUs %s, stressing the SOS CPUs %s with %s" %
+          (vm['id'], vm['affinity'], cpus, ",".join(loads)))
+    args = [stressor, "-l", ",".join(loads), "-c",
+            ",".join([str(c) for c in cpus])]
+    if duration:
+        args += ["-t", str(duration)]
+    if io_file:
+        args += ["-f", io_file]
+    return subprocess.call(args)
+
+def to_us(result, stat):
+    """a statistic of an operation, from cycles to us"""
+    return float(result[stat]) * 1000 / result['tsc_khz']
+
+def report(results, ofile, max_latency):
+    """print the latencies in us, save them, and check the worst cases
+    Return:
+        number of the operations above max_latency
+    """
+    failures = 0
+    print("\n%-10s%10s%10s%10s%10s  (us)" % tuple(["Operation"] + STATS))
+    for res in results:
+        print("%-10s%10.2f%10.2f%10.2f%10.2f" %
+              tuple([res['op']] + [to_us(res, s) for s in STATS]))
+        if max_latency is not None and to_us(res, 'max') > max_latency:
+            print("\tFAIL: %s worst case %.2f us above %.2f us" %
+                  (res['op'], to_us(res, 'max'), max_latency))
+            failures += 1
+
+    if ofile:
+        try:
+            with open(ofile, 'w') as filep:
+                f_csv = csv.writer(filep)
+                f_csv.writerow(['Operation', 'Iterations'] +
+                               ["%s(us)" % s for s in STATS])
+                for res in results:
+                    f_csv.writerow([res['op'], res['iterations']] +
+                                   ["%.2f" % to_us(res, s) for s in STATS])
+        except IOError as err:
+            print("Output File Error: " + str(err))
+
+    return failures
+
+def measure(vm, module, params, ops, ofile, max_latency):
+    """run the RT operations in the RT VM"""
+    if vm['id'] is not None:
+        print("RT VM %d of the scenario, flags %s" %
+              (vm['id'], " | ".join(vm['flags']) or "none"))
+    load_module(module, params)
+
+    # the timer and the IPIs of the vCPU 0, to the next one
+    os.sched_setaffinity(0, {0})
+
+    results = []
+    for op in ops:
+        res = run_op(op)
+        if res is not None:
+            print_result(res)
+            results.append(res)
+
+    return report(results, ofile, max_latency)
+
+def main(argv):
+    """Main enterance function
+
+    Args:
+        argv: arguments string
+    Returns:
+        None
+    Raises:
+        GetoptError
+    """
+    if not argv or argv[0] not in ("stress", "measure"):
+        usage()
+        sys.exit(1)
+    role = argv[0]
+
+    scenario = "industry"
+    rt_vm = None
+    loads = LOADS
+    duration = 0
+    io_file = ''
+    stressor = "rtstress"
+    module = ''
+    outputfile = ''
+    ops = RT_OPS
+    params = []
+    max_latency = None
+    opts_short = "hm:o:n:t:"
+    opts_long = ["scenario=", "rt_vm=", "loads=", "time=", "io_file=",
+                 "stressor=", "module=", "ofile=", "iterations=", "ops=",
+                 "period=", "ipi_cpu=", "max_latency="]
+
+    try:
+        opts, args = getopt.getopt(argv[1:], opts_short, opts_long)
+    except getopt.GetoptError:
+        usage()
+        sys.exit(1)
+
+    for opt, arg in opts:
+        if opt == '-h':
+            usage()
+            sys.exit()
+        elif opt == "--scenario":
+            scenario = arg
+        elif opt == "--rt_vm":
+            rt_vm = int(arg, 0)
+        elif opt == "--loads":
+            loads = arg.split(',')
+        elif opt in ("-t", "--time"):
+            duration = int(arg, 0)
+        elif opt == "--io_file":
+            io_file = arg
+        elif opt == "--stressor":
+            stressor = arg
+        elif opt in ("-m", "--module"):
+            module = arg
+        elif opt in ("-o", "--ofile"):
+            outputfile = arg
+        elif opt in ("-n", "--iterations"):
+            params.append(("iterations", int(arg, 0)))
+        elif opt == "--ops":
+            ops = arg.split(',')
+        elif opt == "--period":
+            params.append(("rt_period_us", int(arg, 0)))
+        elif opt == "--ipi_cpu":
+            params.append(("ipi_cpu", int(arg, 0)))
+        elif opt == "--max_latency":
+            max_latency = float(arg)
+        else:
+            assert False, "unhandled option"
+
+    for load in loads:
+        assert load in LOADS, "unknown load " + load
+    for op in ops:
+        assert op in RT_OPS, "unknown operation " + op
+
+    try:
+        vm = find_rt_vm(parse_scenario(scenario), rt_vm)
+    except IOError:
+        # the RT VM may have no copy of the tree, it needs none to measure
+        assert role == "measure", "no scenario " + scenario_dir(scenario)
+        vm = {'id': rt_vm, 'flags': [], 'affinity': []}
+    if role == "stress":
+        sys.exit(stress(vm, loads, duration, io_file, stressor))
+    if measure(vm, module, params, ops, outputfile, max_latency) != 0:
+        sys.exit(1)
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
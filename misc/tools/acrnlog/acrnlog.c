@@ -16,6 +16,7 @@
 #include <dirent.h>
 #include <errno.h>
 #include <pthread.h>
+#include <elf.h>
 
 #define LOG_ELEMENT_SIZE        80
 #define LOG_MSG_SIZE		480
@@ -33,6 +34,9 @@ static unsigned long interval = DEFAULT_POLL_INTERVAL;
 static size_t hvlog_log_size = LOG_FILE_SIZE;
 static unsigned short hvlog_log_num = LOG_FILE_NUM;
 
+/* the logs go to the file in chunks of up to LOG_BUF_SIZE */
+#define LOG_BUF_SIZE	(64*1024)
+
 struct hvlog_file {
 	const char *path;
 	int fd;
@@ -40,6 +44,9 @@ struct hvlog_file {
 	size_t left_space;
 	unsigned short index;
 	unsigned short num;
+
+	size_t buf_len;
+	char buf[LOG_BUF_SIZE];
 };
 
 static struct hvlog_file cur_log = {
@@ -83,6 +90,262 @@ struct hvlog_dev {
 
 size_t write_log_file(struct hvlog_file * log, const char *buf, size_t len);
 
+/*
+ * A binary message of the hypervisor (LOG_FLAG_BINARY): this header in its
+ * first entry, then the args of the format string at fmt in the hypervisor
+ * image, a __u64 each but a length byte and the chars for a %s.
+ */
+#define LOG_BIN_TAG		0x01
+#define LOG_BIN_ENTRIES		4
+
+struct log_bin_hdr {
+	__u8 tag;
+	__u8 nr_entries;
+	__u8 severity;
+	__u8 cpu;
+	__u32 seq;
+	__u64 usec;
+	__u64 fmt;
+};
+
+/* the hypervisor image, to read the format strings from */
+static int hv_image_fd = -1;
+static Elf64_Shdr *hv_shdrs;
+static int hv_shnum;
+
+#define FMT_CACHE_SIZE	256	/* power of 2 */
+static struct {
+	__u64 addr;
+	char *fmt;
+} fmt_cache[FMT_CACHE_SIZE];
+static pthread_mutex_t fmt_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int hv_image_open(const char *path)
+{
+	Elf64_Ehdr ehdr;
+	size_t size;
+
+	hv_image_fd = open(path, O_RDONLY);
+	if (hv_image_fd < 0) {
+		perror(path);
+		return -1;
+	}
+
+	if (pread(hv_image_fd, &ehdr, sizeof(ehdr), 0) != sizeof(ehdr) ||
+		memcmp(ehdr.e_ident, ELFMAG, SELFMAG) ||
+		ehdr.e_ident[EI_CLASS] != ELFCLASS64 ||
+		ehdr.e_shentsize != sizeof(Elf64_Shdr)) {
+		printf("%s is not the ELF image of the hypervisor\n", path);
+		goto err;
+	}
+
+	size = ehdr.e_shnum * sizeof(Elf64_Shdr);
+	hv_shdrs = malloc(size);
+	if (!hv_shdrs ||
+		pread(hv_image_fd, hv_shdrs, size, ehdr.e_shoff) != size) {
+		printf("Failed to read the sections of %s\n", path);
+		goto err;
+	}
+	hv_shnum = ehdr.e_shnum;
+
+	return 0;
+
+ err:
+	free(hv_shdrs);
+	hv_shdrs = NULL;
+	close(hv_image_fd);
+	hv_image_fd = -1;
+	return -1;
+}
+
+/* The format string at addr in the hypervisor image, NULL if none */
+static const char *hv_image_fmt(__u64 addr)
+{
+	char buf[LOG_MSG_SIZE] = { 0 };
+	Elf64_Shdr *sh;
+	const char *fmt = NULL;
+	size_t len;
+	int i, slot;
+
+	if (hv_image_fd < 0)
+		return NULL;
+
+	slot = (addr >> 3) & (FMT_CACHE_SIZE - 1);
+	pthread_mutex_lock(&fmt_cache_lock);
+	if (fmt_cache[slot].fmt && fmt_cache[slot].addr == addr) {
+		fmt = fmt_cache[slot].fmt;
+		goto out;
+	}
+
+	for (i = 0; i < hv_shnum; i++) {
+		sh = &hv_shdrs[i];
+		if (sh->sh_type != SHT_PROGBITS || !(sh->sh_flags & SHF_ALLOC) ||
+			addr < sh->sh_addr || addr >= sh->sh_addr + sh->sh_size)
+			continue;
+
+		len = sh->sh_addr + sh->sh_size - addr;
+		if (len > sizeof(buf) - 1)
+			len = sizeof(buf) - 1;
+		if (pread(hv_image_fd, buf, len,
+			sh->sh_offset + (addr - sh->sh_addr)) <= 0)
+			break;
+
+		free(fmt_cache[slot].fmt);
+		fmt_cache[slot].fmt = strdup(buf);
+		fmt_cache[slot].addr = addr;
+		fmt = fmt_cache[slot].fmt;
+		break;
+	}
+
+ out:
+	pthread_mutex_unlock(&fmt_cache_lock);
+	return fmt;
+}
+
+/*
+ * Format the args as the hypervisor would, into out of size bytes.
+ * The strings returned by hv_image_fmt() are never freed.
+ */
+static size_t bin_format(char *out, size_t size, const char *fmt,
+		const __u8 *args, size_t args_len)
+{
+	char spec[32];
+	const char *start;
+	size_t n = 0, pos = 0, slen;
+	__u64 v, mask;
+	int is_long, ret;
+	char ch;
+
+	while (*fmt && n + 1 < size) {
+		if (*fmt != '%') {
+			out[n++] = *fmt++;
+			continue;
+		}
+
+		start = fmt++;
+		while (strchr("#- +.0123456789", *fmt) && *fmt)
+			fmt++;
+		if (fmt - start > sizeof(spec) - 4)
+			break;
+		memcpy(spec, start, fmt - start);
+		spec[fmt - start] = '\0';
+
+		mask = ~0ULL;
+		if (*fmt == 'h') {
+			fmt++;
+			mask = 0xffff;
+			if (*fmt == 'h') {
+				fmt++;
+				mask = 0xff;
+			}
+		}
+		is_long = (*fmt == 'l');
+		while (*fmt == 'l')
+			fmt++;
+		ch = *fmt;
+		if (ch)
+			fmt++;
+
+		ret = 0;
+		if (ch == '%') {
+			ret = snprintf(out + n, size - n, "%%");
+		} else if (strchr("diuxXc", ch) && ch) {
+			if (pos + 8 > args_len)
+				goto lost;
+			memcpy(&v, args + pos, 8);
+			pos += 8;
+			if (ch == 'c') {
+				strcat(spec, "c");
+				ret = snprintf(out + n, size - n, spec, (int)v);
+			} else {
+				if (ch != 'd' && ch != 'i') {
+					v &= mask;
+					if (!is_long)
+						v &= 0xffffffffULL;
+				}
+				strcat(spec, "ll");
+				slen = strlen(spec);
+				spec[slen] = ch;
+				spec[slen + 1] = '\0';
+				ret = snprintf(out + n, size - n, spec, v);
+			}
+		} else if (ch == 's') {
+			if (pos + 1 > args_len || pos + 1 + args[pos] > args_len)
+				goto lost;
+			slen = args[pos];
+			strcat(spec, ".*s");
+			ret = snprintf(out + n, size - n, spec, (int)slen,
+					(const char *)args + pos + 1);
+			pos += 1 + slen;
+		} else {
+			/* printed as it is, like the hypervisor does */
+			ret = snprintf(out + n, size - n, "%.*s",
+					(int)(fmt - start), start);
+		}
+
+		if (ret < 0)
+			break;
+		n += ((size_t)ret < size - n) ? (size_t)ret : size - n - 1;
+	}
+
+	out[n] = '\0';
+	return n;
+
+ lost:
+	ret = snprintf(out + n, size - n, "<args lost>");
+	n += (ret > 0 && (size_t)ret < size - n) ? (size_t)ret : 0;
+	out[n] = '\0';
+	return n;
+}
+
+/*
+ * Read the other entries of the binary message starting with the entry at
+ * first, and format it, as a text message, into msg.
+ */
+static struct hvlog_msg *hvlog_read_bin(struct hvlog_dev *dev,
+		struct hvlog_msg *msg, const char *first)
+{
+	__u8 bin[LOG_BIN_ENTRIES * LOG_ELEMENT_SIZE];
+	struct log_bin_hdr hdr;
+	const char *fmt;
+	size_t len;
+	int i, n;
+
+	memcpy(bin, first, LOG_ELEMENT_SIZE);
+	memcpy(&hdr, bin, sizeof(hdr));
+	n = hdr.nr_entries;
+	if (n < 1 || n > LOG_BIN_ENTRIES)
+		n = 1;
+	for (i = 1; i < n; i++) {
+		if (read(dev->fd, bin + i * LOG_ELEMENT_SIZE,
+			LOG_ELEMENT_SIZE) != LOG_ELEMENT_SIZE)
+			break;
+	}
+
+	memset(msg, 0, sizeof(struct hvlog_msg) + LOG_MSG_SIZE);
+	msg->usec = hdr.usec;
+	msg->cpu = hdr.cpu;
+	msg->sev = hdr.severity;
+	msg->seq = hdr.seq;
+
+	len = snprintf(msg->raw, LOG_MSG_SIZE, "[%lluus][cpu=%u][sev=%u][seq=%u]:",
+			hdr.usec, hdr.cpu, hdr.severity, hdr.seq);
+	fmt = hv_image_fmt(hdr.fmt);
+	if (fmt)
+		len += bin_format(msg->raw + len, LOG_MSG_SIZE - len - 1, fmt,
+				bin + sizeof(hdr),
+				i * LOG_ELEMENT_SIZE - sizeof(hdr));
+	else
+		len += snprintf(msg->raw + len, LOG_MSG_SIZE - len - 1,
+				"<format at 0x%llx, see -f>", hdr.fmt);
+
+	msg->raw[len] = '\n';
+	msg->raw[len + 1] = 0;
+	msg->len = len + 1;
+
+	return msg;
+}
+
 static int get_dev_cnt(char *prefix)
 {
 	struct dirent *pdir;
@@ -132,6 +395,9 @@ struct hvlog_msg *hvlog_read_dev(struct hvlog_dev *dev)
 		if (dev->latched) {
 			/* handle the latched msg first */
 			dev->latched = 0;
+			if (dev->entry_latch[0] == LOG_BIN_TAG)
+				return hvlog_read_bin(dev, msg[0],
+						dev->entry_latch);
 			memcpy(&msg[0]->raw[msg[0]->len], dev->entry_latch,
 			       LOG_ELEMENT_SIZE);
 			msg_num++;
@@ -142,6 +408,17 @@ struct hvlog_msg *hvlog_read_dev(struct hvlog_dev *dev)
 				 LOG_ELEMENT_SIZE);
 			if (!ret)
 				break;
+			if (msg[0]->raw[msg[0]->len] == LOG_BIN_TAG) {
+				if (msg_num == 0)
+					return hvlog_read_bin(dev, msg[0],
+							msg[0]->raw);
+				/* the end of the text msg is lost, latch it */
+				dev->latched = 1;
+				memcpy(dev->entry_latch,
+				       &msg[0]->raw[msg[0]->len],
+				       LOG_ELEMENT_SIZE);
+				break;
+			}
 			/* do we read a new meaasge?
 			 * msg[0]->raw[msg[0]->len format: [%lluus][cpu=%d][sev=%d][seq=%llu]: */
 			p = strstr(&msg[0]->raw[msg[0]->len], "][seq=");
@@ -332,18 +609,45 @@ static int new_log_file(struct hvlog_file *log)
 	return 0;
 }
 
-size_t write_log_file(struct hvlog_file * log, const char *buf, size_t len)
+static void flush_log_file(struct hvlog_file *log)
 {
-	int ret;
+	size_t off = 0;
+	ssize_t ret;
+
+	while (off < log->buf_len && log->fd >= 0) {
+		ret = write(log->fd, log->buf + off, log->buf_len - off);
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR)
+				continue;
+			perror("acrnlog write");
+			break;
+		}
+		off += ret;
+	}
+	log->buf_len = 0;
+}
 
-	if (len >= log->left_space)
+/*
+ * The logs are buffered, the buffer goes to the file when full, before
+ * switching to the next file, and with flush_log_file() once the
+ * devices are drained.
+ */
+size_t write_log_file(struct hvlog_file * log, const char *buf, size_t len)
+{
+	if (len >= log->left_space) {
+		flush_log_file(log);
 		if (new_log_file(log))
 			return 0;
+	}
+
+	if (len > LOG_BUF_SIZE - log->buf_len)
+		flush_log_file(log);
 
-	ret = write(log->fd, buf, len);
-	log->left_space -= ret;
+	memcpy(log->buf + log->buf_len, buf, len);
+	log->buf_len += len;
+	log->left_space -= len;
 
-	return ret;
+	return len;
 }
 
 static void *cur_read_func(void *arg)
@@ -356,6 +660,7 @@ static void *cur_read_func(void *arg)
 		hvlog_dev_read_msg(cur, cur_cnt);
 		msg = get_min_seq_msg(cur, cur_cnt);
 		if (!msg) {
+			flush_log_file(&cur_log);
 			usleep(interval);
 			continue;
 		}
@@ -420,18 +725,19 @@ static int mk_dir(const char *path)
 }
 
 /* for user optinal args */
-static const char optString[] = "s:n:t:h";
+static const char optString[] = "s:n:t:f:h";
 
 static void display_usage(void)
 {
 	printf("acrnlog - tool to collect ACRN hypervisor log\n"
-	       "[Usage] acrnlog [-s size] [-n number] [-t interval] [-h]\n\n"
+	       "[Usage] acrnlog [-s size] [-n number] [-t interval] [-f hv_image] [-h]\n\n"
 	       "[Options]\n"
 	       "\t-h: print this message\n"
 	       "\t-t: polling interval to collect logs, in ms\n"
 	       "\t-s: size limitation for each log file, in MB.\n"
 	       "\t    0 means no limitation.\n"
 	       "\t-n: how many files you would like to keep on disk\n"
+	       "\t-f: ELF image of the hypervisor, to format its binary logs\n"
 	       "[Output] capatured log files under /tmp/acrnlog/\n");
 }
 
@@ -470,6 +776,10 @@ static int parse_opt(int argc, char *argv[])
 			interval = ret * 1000;
 			printf("Polling interval is %u ms\n", ret);
 			break;
+		case 'f':
+			if (hv_image_open(optarg))
+				return -EINVAL;
+			break;
 		case 'h':
 			display_usage();
 			return -EINVAL;
@@ -574,6 +884,7 @@ int main(int argc, char *argv[])
 				break;
 			write_log_file(&last_log, msg->raw, msg->len);
 		}
+		flush_log_file(&last_log);
 	}
 
 	if (cur_thread)
@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <ctype.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "trace_analyze.h"
+
+/*
+ * The reports of acrnalyze.py, in one pass over the trace files of all the
+ * cpus: each file is decoded a chunk at a time, and the next event is the
+ * one of the smallest TSC of the files.
+ */
+#define REPORT_VM_EXIT		(1U << 0)
+#define REPORT_IRQ		(1U << 1)
+#define REPORT_LATENCY		(1U << 2)
+#define REPORT_VM		(1U << 3)
+
+#define MAX_TRACE_FILES		TRACE_STATS_CPUS
+
+static trace_src_t srcs[MAX_TRACE_FILES];
+static int nr_srcs;
+static trace_stats_t stats;
+
+/* Default TSC frequency of MRB in MHz */
+static double freq = 1881.6;
+static const char *ofile;
+static uint32_t reports;
+
+static const struct option long_options[] = {
+	{"ofile",	required_argument,	0, 'o'},
+	{"frequency",	required_argument,	0, 'f'},
+	{"vm_exit",	no_argument,		0, 'x'},
+	{"irq",		no_argument,		0, 'q'},
+	{"latency",	no_argument,		0, 'l'},
+	{"vm",		no_argument,		0, 'v'},
+	{"help",	no_argument,		0, 'h'},
+	{0, 0, 0, 0},
+};
+
+static void display_usage(void)
+{
+	printf("acrnalyze - tool to analyze ACRN trace data\n"
+	       "[Usage] acrnalyze [-o ofile] [-f MHz] [--vm_exit] [--irq]\n"
+	       "\t\t [--latency] [--vm] trace_file|trace_dir ...\n\n"
+	       "[Options]\n"
+	       "\t-h, --help: print this message\n"
+	       "\t-o, --ofile: also write the reports to ofile.csv\n"
+	       "\t-f, --frequency: TSC frequency in MHz\n"
+	       "\t--vm_exit: to generate vm_exit report\n"
+	       "\t--irq: to generate irq related report\n"
+	       "\t--latency: to generate the exit handling latency report\n"
+	       "\t--vm: to generate the per VM report\n"
+	       "\tAll the reports are generated by default. A directory stands\n"
+	       "\tfor the trace files of all the cpus of a capture.\n");
+}
+
+static int add_file(const char *path, uint32_t cpu)
+{
+	if (nr_srcs >= MAX_TRACE_FILES) {
+		fprintf(stderr, "at most %d trace files\n", MAX_TRACE_FILES);
+		return -1;
+	}
+
+	if (trace_src_open(&srcs[nr_srcs], path, cpu)) {
+		fprintf(stderr, "Failed to open %s\n", path);
+		return -1;
+	}
+	nr_srcs++;
+
+	return 0;
+}
+
+/* the trace files of a capture are named after their cpu */
+static int add_dir(const char *dir)
+{
+	char path[PATH_MAX];
+	struct dirent *d;
+	DIR *dp;
+	int ret = 0;
+
+	dp = opendir(dir);
+	if (!dp)
+		return -1;
+
+	while (ret == 0 && (d = readdir(dp)) != NULL) {
+		if (!isdigit(d->d_name[0]) ||
+			strspn(d->d_name, "0123456789") != strlen(d->d_name))
+			continue;
+		if (snprintf(path, sizeof(path), "%s/%s", dir, d->d_name) >=
+				sizeof(path))
+			continue;
+		ret = add_file(path, strtoul(d->d_name, NULL, 10));
+	}
+	closedir(dp);
+
+	return ret;
+}
+
+/*
+ * Feed the events to the statistics in the order of their TSC. There are
+ * a few cpus at most, the smallest is looked for in all of them.
+ */
+static int merge_sources(void)
+{
+	int live[MAX_TRACE_FILES], i, next, ret;
+
+	for (i = 0; i < nr_srcs; i++) {
+		live[i] = trace_src_next(&srcs[i]);
+		if (live[i] < 0)
+			return -1;
+	}
+
+	while (1) {
+		next = -1;
+		for (i = 0; i < nr_srcs; i++)
+			if (live[i] > 0 && (next < 0 ||
+				srcs[i].ev.tsc < srcs[next].ev.tsc))
+				next = i;
+		if (next < 0)
+			break;
+
+		trace_stats_add(&stats, srcs[next].cpu, &srcs[next].ev);
+		ret = trace_src_next(&srcs[next]);
+		if (ret < 0) {
+			fprintf(stderr, "Bad trace data of cpu %u, ignored "
+				"from there on\n", srcs[next].cpu);
+			ret = 0;
+		}
+		live[next] = ret;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	char csv_name[PATH_MAX];
+	struct stat st;
+	FILE *csv = NULL;
+	int opt, i, ret = 0;
+
+	while ((opt = getopt_long(argc, argv, "ho:f:", long_options,
+				NULL)) != -1) {
+		switch (opt) {
+		case 'o':
+			ofile = optarg;
+			break;
+		case 'f':
+			freq = strtod(optarg, NULL);
+			if (freq <= 0) {
+				fprintf(stderr, "'-f' require the TSC frequency in MHz\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'x':
+			reports |= REPORT_VM_EXIT;
+			break;
+		case 'q':
+			reports |= REPORT_IRQ;
+			break;
+		case 'l':
+			reports |= REPORT_LATENCY;
+			break;
+		case 'v':
+			reports |= REPORT_VM;
+			break;
+		case 'h':
+		default:
+			display_usage();
+			return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (optind >= argc) {
+		display_usage();
+		return EXIT_FAILURE;
+	}
+	if (reports == 0)
+		reports = REPORT_VM_EXIT | REPORT_IRQ | REPORT_LATENCY | REPORT_VM;
+
+	for (i = optind; i < argc && ret == 0; i++) {
+		if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode))
+			ret = add_dir(argv[i]);
+		else
+			ret = add_file(argv[i], nr_srcs);
+	}
+	if (ret || nr_srcs == 0) {
+		fprintf(stderr, "No trace file to analyze\n");
+		ret = -1;
+		goto out;
+	}
+
+	if (ofile) {
+		if (snprintf(csv_name, sizeof(csv_name), "%s.csv", ofile) >=
+				sizeof(csv_name) ||
+			(csv = fopen(csv_name, "a")) == NULL) {
+			fprintf(stderr, "Failed to open %s.csv\n", ofile);
+			ret = -1;
+			goto out;
+		}
+	}
+
+	if (merge_sources()) {
+		fprintf(stderr, "Failed to read the trace files\n");
+		ret = -1;
+		goto out;
+	}
+
+	printf("%lu events of %d trace files\n", stats.nr_events, nr_srcs);
+	if (reports & REPORT_VM_EXIT) {
+		printf("\nVM exits:\n");
+		report_vm_exits(&stats, freq, csv);
+	}
+	if (reports & REPORT_IRQ) {
+		printf("\nIRQs:\n");
+		report_irqs(&stats, freq, csv);
+	}
+	if (reports & REPORT_LATENCY) {
+		printf("\nVM exit latency:\n");
+		report_latency(&stats, freq, csv);
+	}
+	if (reports & REPORT_VM) {
+		printf("\nVMs:\n");
+		report_vms(&stats, freq, csv);
+	}
+
+out:
+	if (csv)
+		fclose(csv);
+	for (i = 0; i < nr_srcs; i++)
+		trace_src_close(&srcs[i]);
+
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
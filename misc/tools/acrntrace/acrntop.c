@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "trace_analyze.h"
+
+/*
+ * A top like view of the VM exits, per VM and per exit reason, refreshed
+ * every interval. acrntop drains the trace sbufs itself instead of
+ * acrntrace, the two do not run together.
+ */
+#define DRAIN_PERIOD_US		10000
+#define TOP_REASONS		16
+
+static const char dev_prefix[] = "acrn_trace_";
+
+static uint32_t interval = 1;		/* in second */
+static uint32_t iterations;		/* 0: until interrupted */
+static int batch;
+static double freq = 1881.6;
+static volatile sig_atomic_t exiting;
+
+static int dev_fd[TRACE_STATS_CPUS];
+static shared_buf_t *sbufs[TRACE_STATS_CPUS];
+static trace_src_t srcs[TRACE_STATS_CPUS];
+static int dev_cnt;
+static trace_stats_t stats;
+
+static void display_usage(void)
+{
+	printf("acrntop - live view of the ACRN VM exits\n"
+	       "[Usage] acrntop [-d interval] [-n iterations] [-f MHz] [-b]\n\n"
+	       "[Options]\n"
+	       "\t-h: print this message\n"
+	       "\t-d: refresh interval in second\n"
+	       "\t-n: exit after this many refreshes\n"
+	       "\t-f: TSC frequency in MHz\n"
+	       "\t-b: batch mode, append the views instead of redrawing\n");
+}
+
+static int parse_opt(int argc, char *argv[])
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "hd:n:f:b")) != -1) {
+		switch (opt) {
+		case 'd':
+			interval = strtoul(optarg, NULL, 10);
+			if (interval == 0) {
+				printf("'-d' require integer greater than 0\n");
+				return -EINVAL;
+			}
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 10);
+			break;
+		case 'f':
+			freq = strtod(optarg, NULL);
+			if (freq <= 0) {
+				printf("'-f' require the TSC frequency in MHz\n");
+				return -EINVAL;
+			}
+			break;
+		case 'b':
+			batch = 1;
+			break;
+		case 'h':
+		default:
+			display_usage();
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static void cleanup(void)
+{
+	int i;
+
+	for (i = 0; i < dev_cnt; i++) {
+		if (srcs[i].sbuf)
+			trace_src_close(&srcs[i]);
+		if (sbufs[i])
+			munmap(sbufs[i], MMAP_SIZE);
+		if (dev_fd[i] > 0)
+			close(dev_fd[i]);
+	}
+}
+
+static int attach_devs(void)
+{
+	char name[32];
+	struct dirent *d;
+	DIR *dir;
+	int i, cnt = 0;
+
+	dir = opendir("/dev");
+	if (!dir)
+		return -1;
+	while ((d = readdir(dir)) != NULL)
+		if (strstr(d->d_name, dev_prefix))
+			cnt++;
+	closedir(dir);
+
+	if (cnt > TRACE_STATS_CPUS)
+		cnt = TRACE_STATS_CPUS;
+
+	for (i = 0; i < cnt; i++) {
+		snprintf(name, sizeof(name), "/dev/%s%d", dev_prefix, i);
+		dev_fd[i] = open(name, O_RDWR);
+		if (dev_fd[i] < 0) {
+			printf("Failed to open %s, errno %d\n", name, errno);
+			return -1;
+		}
+		dev_cnt++;
+
+		sbufs[i] = mmap(NULL, MMAP_SIZE, PROT_READ | PROT_WRITE,
+				MAP_SHARED, dev_fd[i], 0);
+		if (sbufs[i] == MAP_FAILED) {
+			printf("mmap failed for %s, errno %d\n", name, errno);
+			sbufs[i] = NULL;
+			return -1;
+		}
+
+		/* the entries buffered so far are of no period of the view */
+		sbuf_clear_buffered(sbufs[i]);
+		if (trace_src_attach(&srcs[i], sbufs[i], i))
+			return -1;
+	}
+
+	return dev_cnt ? 0 : -1;
+}
+
+static void drain(void)
+{
+	int i;
+
+	for (i = 0; i < dev_cnt; i++)
+		while (trace_src_next(&srcs[i]) > 0)
+			trace_stats_add(&stats, srcs[i].cpu, &srcs[i].ev);
+}
+
+static void show(double secs)
+{
+	uint32_t order[TRACE_EXIT_REASONS], i, j, n = 0, vm, tmp;
+	double hv_cycles = secs * freq * 1000 * 1000;
+	const exit_stats_t *es;
+
+	if (!batch)
+		printf("\033[H\033[J");
+
+	printf("acrntop - %d cpus, %.2fs, %lu exits, %.0f exits/s\n\n",
+		dev_cnt, secs, stats.nr_exits, stats.nr_exits / secs);
+
+	/* the share of a cpu the exits of the VM took */
+	printf("%-4s %12s %10s %10s  %-28s\n", "VM", "exits/s", "avg_cyc",
+		"%hv", "top exit");
+	for (vm = 0; vm < TRACE_STATS_VMS; vm++) {
+		es = &stats.vm_total[vm];
+		if (es->count == 0)
+			continue;
+		tmp = 0;
+		for (i = 1; i < TRACE_EXIT_REASONS; i++)
+			if (stats.vm_reasons[vm][i] > stats.vm_reasons[vm][tmp])
+				tmp = i;
+		printf("%-4u %12.0f %10lu %10.2f  %-28s\n", vm, es->count / secs,
+			es->cycles / es->count, es->cycles * 100 / hv_cycles,
+			exit_reason_name(tmp));
+	}
+
+	for (i = 0; i < TRACE_EXIT_REASONS; i++)
+		if (stats.exits[i].count != 0)
+			order[n++] = i;
+	/* by the time they took, a handful of reasons */
+	for (i = 1; i < n; i++)
+		for (j = i; j > 0 && stats.exits[order[j]].cycles >
+				stats.exits[order[j - 1]].cycles; j--) {
+			tmp = order[j];
+			order[j] = order[j - 1];
+			order[j - 1] = tmp;
+		}
+
+	printf("\n%-28s %12s %10s %10s %10s %10s\n", "exit", "exits/s",
+		"avg_cyc", "p99_cyc", "max_cyc", "%hv");
+	for (i = 0; i < n && i < TOP_REASONS; i++) {
+		es = &stats.exits[order[i]];
+		printf("%-28s %12.0f %10lu %10lu %10lu %10.2f\n",
+			exit_reason_name(order[i]), es->count / secs,
+			es->cycles / es->count, exit_stats_percentile(es, 990),
+			es->max, es->cycles * 100 / hv_cycles);
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+static void signal_exit_handler(int sig)
+{
+	exiting = 1;
+}
+
+static double elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	struct timespec start;
+	uint32_t shown = 0;
+	double secs;
+
+	if (parse_opt(argc, argv))
+		return EXIT_FAILURE;
+
+	if (attach_devs()) {
+		printf("Failed to attach the acrn trace devices, please check "
+			"whether module acrn_trace is inserted\n");
+		cleanup();
+		return EXIT_FAILURE;
+	}
+
+	signal(SIGTERM, signal_exit_handler);
+	signal(SIGINT, signal_exit_handler);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (!exiting && (iterations == 0 || shown < iterations)) {
+		usleep(DRAIN_PERIOD_US);
+		drain();
+
+		secs = elapsed(&start);
+		if (secs < interval)
+			continue;
+
+		show(secs);
+		shown++;
+		trace_stats_reset(&stats);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+	}
+
+	cleanup();
+	return EXIT_SUCCESS;
+}
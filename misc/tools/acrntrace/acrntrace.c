@@ -15,10 +15,12 @@
 #include <time.h>
 #include <dirent.h>
 #include <signal.h>
+#include <poll.h>
 #include <errno.h>
 #include <pthread.h>
 #include <string.h>
 #include <signal.h>
+#include <zlib.h>
 
 #include "acrntrace.h"
 
@@ -29,10 +31,12 @@ static int exiting = 0;
 
 /* for opt */
 static uint64_t period = 10000;
-static const char optString[] = "i:hct:";
+static const char optString[] = "i:hczZt:e:p:";
 static const char dev_prefix[] = "acrn_trace_";
 
 static uint32_t flags;
+static trace_filter_t filter;
+static trace_sampling_t sampling;
 static char trace_file_dir[TRACE_FILE_DIR_LEN];
 
 static reader_struct *reader;
@@ -41,12 +45,18 @@ static int dev_cnt = 0; /* Count of /dev/acrn_trace_xxx devices */
 static void display_usage(void)
 {
 	printf("acrntrace - tool to collect ACRN trace data\n"
-	       "[Usage] acrntrace [-i period] [-t max_time] [-ch]\n\n"
+	       "[Usage] acrntrace [-i period] [-t max_time] [-e event[:rate]]\n"
+	       "\t\t [-p event:period[:vm_id]] [-czZh]\n\n"
 	       "[Options]\n"
 	       "\t-h: print this message\n"
 	       "\t-i: period_in_ms: specify polling interval [1-999]\n"
 	       "\t-t: max time to capture trace data (in second)\n"
-	       "\t-c: clear the buffered old data\n");
+	       "\t-c: clear the buffered old data\n"
+	       "\t-z: capture compact trace records\n"
+	       "\t-Z: write compressed trace files\n"
+	       "\t-e: only capture this event ID, 1 in rate of them (repeatable)\n"
+	       "\t-p: sample the guest RIPs every period PMU events, event is\n"
+	       "\t    event select | unit mask << 8, e.g. 0x003c for the core cycles\n");
 }
 
 static void timer_handler(union sigval sv)
@@ -92,6 +102,7 @@ static int init_timer(int timeout)
 static int parse_opt(int argc, char *argv[])
 {
 	int opt, ret;
+	char *end;
 
 	while ((opt = getopt(argc, argv, optString)) != -1) {
 		switch (opt) {
@@ -116,6 +127,41 @@ static int parse_opt(int argc, char *argv[])
 		case 'c':
 			flags |= FLAG_CLEAR_BUF;
 			break;
+		case 'z':
+			flags |= FLAG_COMPACT;
+			break;
+		case 'Z':
+			flags |= FLAG_COMPRESS;
+			break;
+		case 'e':
+			if (filter.nr_events >= TRACE_FILTER_MAX) {
+				pr_err("'-e' at most %d events\n", TRACE_FILTER_MAX);
+				return -EINVAL;
+			}
+			filter.evid[filter.nr_events] = strtoul(optarg, &end, 0);
+			filter.rate[filter.nr_events] = 1;
+			if (*end == ':')
+				filter.rate[filter.nr_events] = strtoul(end + 1, &end, 0);
+			if (end == optarg || *end != '\0') {
+				pr_err("'-e' require event[:rate]\n");
+				return -EINVAL;
+			}
+			filter.nr_events++;
+			break;
+		case 'p':
+			sampling.event = strtoul(optarg, &end, 0);
+			sampling.vm_id = TRACE_SAMPLE_ALL_VMS;
+			if (*end == ':')
+				sampling.period = strtoul(end + 1, &end, 0);
+			if (*end == ':')
+				sampling.vm_id = strtoul(end + 1, &end, 0);
+			if (end == optarg || *end != '\0' || sampling.period == 0 ||
+				sampling.period > 0x7fffffffUL) {
+				pr_err("'-p' require event:period[:vm_id], period < 2^31\n");
+				return -EINVAL;
+			}
+			sampling.enable = 1;
+			break;
 		case 'h':
 			display_usage();
 			return -EINVAL;
@@ -203,12 +249,146 @@ static int create_trace_file_dir(char *dir)
 	return err;
 }
 
+static int write_all(int fd, const void *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = write(fd, buf, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		buf = (const uint8_t *)buf + ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static trace_zfile_t *zfile_open(int fd, uint32_t cpu)
+{
+	trace_zfile_hdr_t hdr = { .cpu = cpu, .chunk_size = TRACE_ZCHUNK_SIZE };
+	trace_zfile_t *zf;
+
+	zf = calloc(1, sizeof(*zf));
+	if (!zf)
+		return NULL;
+
+	zf->zbuf_size = compressBound(TRACE_ZCHUNK_SIZE);
+	zf->raw = malloc(TRACE_ZCHUNK_SIZE);
+	zf->zbuf = malloc(zf->zbuf_size);
+	memcpy(hdr.magic, TRACE_ZFILE_MAGIC, sizeof(hdr.magic));
+	if (!zf->raw || !zf->zbuf || write_all(fd, &hdr, sizeof(hdr))) {
+		free(zf->raw);
+		free(zf->zbuf);
+		free(zf);
+		return NULL;
+	}
+	zf->offset = sizeof(hdr);
+
+	return zf;
+}
+
+/* deflate the data buffered and write them out as a chunk */
+static int zfile_flush(int fd, trace_zfile_t *zf)
+{
+	trace_zchunk_hdr_t chdr;
+	uLongf zlen = zf->zbuf_size;
+
+	if (zf->raw_len == 0)
+		return 0;
+
+	if (compress2(zf->zbuf, &zlen, zf->raw, zf->raw_len,
+			Z_BEST_SPEED) != Z_OK) {
+		pr_err("Failed to compress %u bytes\n", zf->raw_len);
+		return -1;
+	}
+
+	chdr.raw_len = zf->raw_len;
+	chdr.zlen = zlen;
+	if (write_all(fd, &chdr, sizeof(chdr)) || write_all(fd, zf->zbuf, zlen)) {
+		pr_err("Failed to write a chunk, errno %d\n", errno);
+		return -1;
+	}
+
+	/* past the index, the readers have to walk the chunks */
+	if (zf->nr_chunks < TRACE_ZINDEX_MAX) {
+		zf->index[zf->nr_chunks].offset = zf->offset;
+		zf->index[zf->nr_chunks].raw_offset = zf->raw_offset;
+	}
+	zf->nr_chunks++;
+	zf->offset += sizeof(chdr) + zlen;
+	zf->raw_offset += zf->raw_len;
+	zf->raw_len = 0;
+
+	return 0;
+}
+
+static int zfile_write(int fd, trace_zfile_t *zf, const void *data, uint32_t len)
+{
+	uint32_t n;
+
+	while (len > 0) {
+		n = TRACE_ZCHUNK_SIZE - zf->raw_len;
+		n = (n < len) ? n : len;
+		memcpy(zf->raw + zf->raw_len, data, n);
+		zf->raw_len += n;
+		data = (const uint8_t *)data + n;
+		len -= n;
+		if (zf->raw_len == TRACE_ZCHUNK_SIZE && zfile_flush(fd, zf))
+			return -1;
+	}
+
+	return 0;
+}
+
+/* move the buffered data of sbuf into the chunks */
+static int zfile_drain(int fd, trace_zfile_t *zf, shared_buf_t *sbuf)
+{
+	int ret = 0, n, state;
+
+	/* a chunk is written whole or not at all */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+	while ((n = sbuf_copy(sbuf, zf->raw + zf->raw_len,
+				TRACE_ZCHUNK_SIZE - zf->raw_len)) > 0) {
+		zf->raw_len += n;
+		ret += n;
+		if (zf->raw_len == TRACE_ZCHUNK_SIZE && zfile_flush(fd, zf)) {
+			ret = -1;
+			break;
+		}
+	}
+	pthread_setcancelstate(state, NULL);
+
+	return ret;
+}
+
+/* the last chunk and the index, the index is left out if it is partial */
+static void zfile_close(int fd, trace_zfile_t *zf)
+{
+	trace_ztail_t tail = { .reserved = 0 };
+
+	if (zfile_flush(fd, zf) == 0 && zf->nr_chunks <= TRACE_ZINDEX_MAX) {
+		tail.nr_chunks = zf->nr_chunks;
+		memcpy(tail.magic, TRACE_ZINDEX_MAGIC, sizeof(tail.magic));
+		if (write_all(fd, zf->index, zf->nr_chunks * sizeof(zf->index[0])) ||
+			write_all(fd, &tail, sizeof(tail)))
+			pr_err("Failed to write the chunk index, errno %d\n", errno);
+	}
+
+	free(zf->raw);
+	free(zf->zbuf);
+	free(zf);
+}
+
 /* function executed in each consumer thread */
 static void reader_fn(param_t * param)
 {
 	int ret;
 	int fd = param->trace_fd;
 	shared_buf_t *sbuf = param->sbuf;
+	struct pollfd pfd = { .fd = param->dev_fd, .events = POLLIN };
 
 	pr_dbg("reader thread[%lu] created for FILE*[0x%p]\n",
 	       pthread_self(), fp);
@@ -216,16 +396,37 @@ static void reader_fn(param_t * param)
 	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
 
+	/*
+	 * Switch the hypervisor to compact records, the entries buffered or
+	 * being written meanwhile are dropped.
+	 */
+	if (flags & FLAG_COMPACT) {
+		sbuf_add_flags(sbuf, SBUF_COMPACT_EN);
+		usleep(10000);
+		sbuf_clear_buffered(sbuf);
+	}
+
 	/* Clear the old data in sbuf */
 	if (flags & FLAG_CLEAR_BUF)
 		sbuf_clear_buffered(sbuf);
 
+	sbuf->watermark = sbuf->size / 2;
+
 	while (1) {
-		do {
+		if (param->zfile)
+			ret = zfile_drain(fd, param->zfile, sbuf);
+		else
 			ret = sbuf_write(fd, sbuf);
-		} while (ret > 0);
 
-		usleep(period);
+		/*
+		 * Wait for the hypervisor to notify the sbuf is half full, at
+		 * most for the period. A device that cannot poll is always
+		 * ready, and so is a wake up for another sbuf: sleep for the
+		 * period then, as long as the watermark is not reached.
+		 */
+		ret = poll(&pfd, 1, period / 1000);
+		if (ret > 0 && sbuf_used(sbuf) < sbuf->watermark)
+			usleep(period);
 	}
 }
 
@@ -255,6 +456,17 @@ static int create_reader(reader_struct * reader, uint32_t dev_id)
 		return -2;
 	}
 
+	reader->param.dev_fd = reader->dev_fd;
+
+	if (filter.nr_events) {
+		filter.pcpu_id = dev_id;
+		if (ioctl(reader->dev_fd, ACRN_TRACE_IOC_SET_FILTER, &filter) < 0) {
+			pr_err("Failed to set the event filter of %s, errno %d\n",
+				reader->dev_name, errno);
+			return -2;
+		}
+	}
+
 	pr_dbg("sbuf[%d]:\nmagic_num: %lx\nele_num: %u\n ele_size: %u\n",
 	       dev_id, reader->param.sbuf->magic, reader->param.sbuf->ele_num,
 	       reader->param.sbuf->ele_size);
@@ -269,6 +481,31 @@ static int create_reader(reader_struct * reader, uint32_t dev_id)
 		return -3;
 	}
 
+	if (flags & FLAG_COMPRESS) {
+		reader->param.zfile = zfile_open(reader->param.trace_fd, dev_id);
+		if (!reader->param.zfile) {
+			pr_err("Failed to prepare %s, err %d\n", trace_file_name, errno);
+			return -3;
+		}
+	}
+
+	/* in the compressed data as well, the readers see the plain file */
+	if (flags & FLAG_COMPACT) {
+		trace_file_hdr_t hdr = { .cpu = dev_id };
+		int err;
+
+		memcpy(hdr.magic, TRACE_COMPACT_MAGIC, sizeof(hdr.magic));
+		if (reader->param.zfile)
+			err = zfile_write(reader->param.trace_fd,
+					reader->param.zfile, &hdr, sizeof(hdr));
+		else
+			err = write_all(reader->param.trace_fd, &hdr, sizeof(hdr));
+		if (err) {
+			pr_err("Failed to write %s, err %d\n", trace_file_name, errno);
+			return -3;
+		}
+	}
+
 	pr_info("trace data file %s created for %s\n",
 		trace_file_name, reader->dev_name);
 
@@ -292,17 +529,40 @@ static void destory_reader(reader_struct * reader)
 	}
 
 	if (reader->param.sbuf) {
+		reader->param.sbuf->watermark = 0;
+		/* back to the trace entries, for the other consumers */
+		if (flags & FLAG_COMPACT) {
+			sbuf_clear_flags(reader->param.sbuf, SBUF_COMPACT_EN);
+			sbuf_clear_buffered(reader->param.sbuf);
+		}
 		munmap(reader->param.sbuf, MMAP_SIZE);
 		reader->param.sbuf = NULL;
 	}
 
 	if (reader->dev_fd) {
+		/* the sampling was started through the first device */
+		if (sampling.enable && reader->param.devid == 0) {
+			trace_sampling_t stop = { .enable = 0 };
+
+			ioctl(reader->dev_fd, ACRN_TRACE_IOC_SET_SAMPLING, &stop);
+		}
+		/* trace all the events again */
+		if (filter.nr_events) {
+			trace_filter_t all = { .pcpu_id = reader->param.devid };
+
+			ioctl(reader->dev_fd, ACRN_TRACE_IOC_SET_FILTER, &all);
+		}
 		close(reader->dev_fd);
 		reader->dev_fd = 0;
 	}
 
 	if (reader->param.trace_fd) {
+		if (reader->param.zfile) {
+			zfile_close(reader->param.trace_fd, reader->param.zfile);
+			reader->param.zfile = NULL;
+		}
 		close(reader->param.trace_fd);
+		reader->param.trace_fd = 0;
 	}
 }
 
@@ -370,6 +630,14 @@ int main(int argc, char *argv[])
 	    if (create_reader(&reader[dev_id], dev_id) < 0)
 		goto out_free;
 
+	/* the samples go to the trace of each cpu, start once all are read */
+	if (sampling.enable &&
+		ioctl(reader[0].dev_fd, ACRN_TRACE_IOC_SET_SAMPLING, &sampling) < 0) {
+		pr_err("Failed to start the sampling, errno %d\n", errno);
+		sampling.enable = 0;
+		goto out_free;
+	}
+
 	/* for kill exit handling */
 	signal(SIGTERM, signal_exit_handler);
 	signal(SIGINT, signal_exit_handler);
@@ -5,6 +5,7 @@
  */
 
 
+#include <sys/ioctl.h>
 #include "sbuf.h"
 
 #define PCPU_NUM        	4
@@ -38,17 +39,79 @@
  * flags:
  * FLAG_TO_REL   - resources need to be release
  * FLAG_CLEAR_BUF - to clear buffered old data
+ * FLAG_COMPACT   - to capture compact trace records
+ * FLAG_COMPRESS  - to write compressed trace files
  */
 #define FLAG_TO_REL		(1UL << 0)
 #define FLAG_CLEAR_BUF		(1UL << 1)
+#define FLAG_COMPACT		(1UL << 2)
+#define FLAG_COMPRESS		(1UL << 3)
 
 #define foreach_dev(dev_id)                                       \
         for ((dev_id) = 0; (dev_id) < (dev_cnt); (dev_id)++)
 
 typedef unsigned char uint8_t;
+typedef unsigned short uint16_t;
 typedef unsigned int uint32_t;
 typedef unsigned long uint64_t;
 
+/*
+ * A trace file of compact records starts with this header, the records
+ * follow as written by the hypervisor (see debug/trace.c).
+ */
+#define TRACE_COMPACT_MAGIC	"ACRNTRCZ"
+
+typedef struct {
+	char magic[8];
+	uint32_t cpu;
+	uint32_t reserved;
+} trace_file_hdr_t;
+
+/*
+ * A compressed trace file (acrntrace -Z) starts with this header, the
+ * data as they would be written to the plain file follow in chunks of
+ * chunk_size bytes at most, each deflated on its own behind a chunk
+ * header. On a clean exit the file ends with the index of the chunks:
+ * nr_chunks entries then the tail.
+ */
+#define TRACE_ZFILE_MAGIC	"ACRNTRCC"
+#define TRACE_ZINDEX_MAGIC	"ACRNTIDX"
+#define TRACE_ZCHUNK_SIZE	(256 * 1024)
+#define TRACE_ZINDEX_MAX	4096	/* chunks indexed, 1G of data */
+
+typedef struct {
+	char magic[8];
+	uint32_t cpu;
+	uint32_t chunk_size;
+} trace_zfile_hdr_t;
+
+typedef struct {
+	uint32_t raw_len;
+	uint32_t zlen;
+} trace_zchunk_hdr_t;
+
+typedef struct {
+	uint64_t offset;	/* of the chunk header in the file */
+	uint64_t raw_offset;	/* of the chunk data in the plain file */
+} trace_zindex_t;
+
+typedef struct {
+	uint32_t nr_chunks;
+	uint32_t reserved;
+	char magic[8];
+} trace_ztail_t;
+
+typedef struct {
+	uint8_t *raw;
+	uint32_t raw_len;
+	uint8_t *zbuf;
+	unsigned long zbuf_size;
+	uint64_t offset;
+	uint64_t raw_offset;
+	trace_zindex_t index[TRACE_ZINDEX_MAX];
+	uint32_t nr_chunks;
+} trace_zfile_t;
+
 typedef struct {
 	uint64_t tsc;
 	uint64_t id;
@@ -70,11 +133,45 @@ typedef struct {
 	};
 } trace_ev_t;
 
+/*
+ * Trace filter of a cpu, set through the trace device, which passes it
+ * to the hypervisor (HC_SETUP_TRACE_FILTER).
+ */
+#define TRACE_FILTER_MAX	16
+
+typedef struct {
+	uint16_t pcpu_id;
+	uint16_t reserved;
+	uint32_t nr_events;		/* 0: trace all the events */
+	uint32_t evid[TRACE_FILTER_MAX];
+	uint32_t rate[TRACE_FILTER_MAX];	/* trace 1 in rate */
+} trace_filter_t;
+
+#define ACRN_TRACE_IOC_SET_FILTER	_IOW('T', 0x01, trace_filter_t)
+
+/*
+ * Built-in PMU sampling of the guest RIPs, set through the trace device,
+ * which passes it to the hypervisor (PROFILING_CONFIG_SAMPLING). Each
+ * sample is a TRACE_PMU_SAMPLE event in the trace of the cpu.
+ */
+#define TRACE_SAMPLE_ALL_VMS	0xffff
+
+typedef struct {
+	uint32_t event;		/* event select | unit mask << 8 */
+	uint16_t vm_id;		/* TRACE_SAMPLE_ALL_VMS for all the VMs */
+	uint16_t enable;
+	uint64_t period;	/* events per sample, below 2^31 */
+} trace_sampling_t;
+
+#define ACRN_TRACE_IOC_SET_SAMPLING	_IOW('T', 0x02, trace_sampling_t)
+
 typedef struct {
 	uint32_t devid;
 	int exit_flag;
 	int trace_fd;
+	int dev_fd;
 	shared_buf_t *sbuf;
+	trace_zfile_t *zfile;	/* NULL for a plain trace file */
 	pthread_mutex_t *sbuf_lock;
 } param_t;
 
@@ -7,6 +7,7 @@
 #include <asm/errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/uio.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include "sbuf.h"
@@ -46,29 +47,78 @@ int sbuf_get(shared_buf_t *sbuf, uint8_t *data)
 	return sbuf->ele_size;
 }
 
+/*
+ * Write all the buffered data to fd straight from the sbuf, in one or
+ * two (on a wrap around) chunks. This works for the elements and for
+ * the records of variable length alike.
+ */
 int sbuf_write(int fd, shared_buf_t *sbuf)
 {
-	const void *start;
-	int written;
+	struct iovec iov[2];
+	uint32_t head, tail, len;
+	int iovcnt = 1;
+	ssize_t written;
 
 	if (sbuf == NULL)
 		return -EINVAL;
 
-	if (sbuf_is_empty(sbuf)) {
+	head = sbuf->head;
+	tail = sbuf->tail;
+	if (head == tail)
 		return 0;
+
+	iov[0].iov_base = (void *)sbuf + SBUF_HEAD_SIZE + head;
+	if (tail > head) {
+		iov[0].iov_len = tail - head;
+	} else {
+		iov[0].iov_len = sbuf->size - head;
+		iov[1].iov_base = (void *)sbuf + SBUF_HEAD_SIZE;
+		iov[1].iov_len = tail;
+		iovcnt = (tail != 0) ? 2 : 1;
 	}
+	len = iov[0].iov_len + ((iovcnt == 2) ? iov[1].iov_len : 0);
 
-	start = (void *)sbuf + SBUF_HEAD_SIZE + sbuf->head;
-        written = write(fd, start, sbuf->ele_size);
-	if (written != sbuf->ele_size) {
-		printf("Failed to write: ret %d (ele_size %d), errno %d\n",
-			written, sbuf->ele_size, (written == -1) ? errno : 0);
+	written = writev(fd, iov, iovcnt);
+	if (written != len) {
+		printf("Failed to write: ret %zd (len %u), errno %d\n",
+			written, len, (written == -1) ? errno : 0);
 		return -1;
 	}
 
-	sbuf->head = sbuf_next_ptr(sbuf->head, sbuf->ele_size, sbuf->size);
+	sbuf->head = tail;
 
-	return sbuf->ele_size;
+	return len;
+}
+
+/*
+ * Copy at most max bytes of the buffered data to data, a record may be
+ * split between two copies.
+ */
+int sbuf_copy(shared_buf_t *sbuf, uint8_t *data, uint32_t max)
+{
+	uint32_t head, tail, len, first;
+
+	if ((sbuf == NULL) || (data == NULL))
+		return -EINVAL;
+
+	head = sbuf->head;
+	tail = sbuf->tail;
+	len = (tail >= head) ? (tail - head) : (sbuf->size - (head - tail));
+	if (len > max)
+		len = max;
+	if (len == 0)
+		return 0;
+
+	first = sbuf->size - head;
+	if (first > len)
+		first = len;
+	memcpy(data, (void *)sbuf + SBUF_HEAD_SIZE + head, first);
+	if (len > first)
+		memcpy(data + first, (void *)sbuf + SBUF_HEAD_SIZE, len - first);
+
+	sbuf->head = sbuf_next_ptr(head, len, sbuf->size);
+
+	return len;
 }
 
 int sbuf_clear_buffered(shared_buf_t *sbuf)
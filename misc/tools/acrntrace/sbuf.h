@@ -16,6 +16,7 @@
 /* sbuf flags */
 #define OVERRUN_CNT_EN  (1ULL << 0) /* whether overrun counting is enabled */
 #define OVERWRITE_EN    (1ULL << 1) /* whether overwrite is enabled */
+#define SBUF_COMPACT_EN (1ULL << 2) /* whether the trace records are compact */
 
 typedef unsigned char uint8_t;
 typedef unsigned int uint32_t;
@@ -47,7 +48,8 @@ typedef struct shared_buf {
         uint64_t flags;
         uint32_t overrun_cnt;   /* count of overrun */
         uint32_t size;          /* ele_num * ele_size */
-        uint32_t padding[6];
+        uint32_t watermark;     /* bytes used to get notified at, 0: never */
+        uint32_t padding[5];
 } shared_buf_t;
 
 static inline void sbuf_clear_flags(shared_buf_t *sbuf, uint64_t flags)
@@ -65,7 +67,15 @@ static inline void sbuf_add_flags(shared_buf_t *sbuf, uint64_t flags)
         sbuf->flags |= flags;
 }
 
+static inline uint32_t sbuf_used(shared_buf_t *sbuf)
+{
+        uint32_t head = sbuf->head, tail = sbuf->tail;
+
+        return (tail >= head) ? (tail - head) : (sbuf->size - (head - tail));
+}
+
 int sbuf_get(shared_buf_t *sbuf, uint8_t *data);
 int sbuf_write(int fd, shared_buf_t *sbuf);
+int sbuf_copy(shared_buf_t *sbuf, uint8_t *data, uint32_t max);
 int sbuf_clear_buffered(shared_buf_t *sbuf);
 #endif /* SHARED_BUF_H */
@@ -12,6 +12,7 @@ import getopt
 import os
 from vmexit_analyze import analyze_vm_exit
 from irq_analyze import analyze_irq
+from profile_analyze import analyze_profile, profile_setup
 
 def usage():
     """print the usage of the script
@@ -29,6 +30,10 @@ def usage():
     -f, --frequency=[unsigned int]: TSC frequency in MHz
     --vm_exit: to generate vm_exit report
     --irq: to generate irq related report
+    --profile: to generate the guest hot spot report of the PMU samples,
+               the input may be the directory of a whole capture
+    --vm=[unsigned int]: only profile the samples of this VM
+    --symbols=[string]: System.map of the guest kernel, for --profile
     ''')
 
 def do_analysis(ifile, ofile, analyzer, freq):
@@ -62,8 +67,11 @@ def main(argv):
     # Default TSC frequency of MRB in MHz
     freq = 1881.6
     opts_short = "hi:o:f:"
-    opts_long = ["ifile=", "ofile=", "frequency=", "vm_exit", "irq"]
+    opts_long = ["ifile=", "ofile=", "frequency=", "vm_exit", "irq",
+                 "profile", "vm=", "symbols="]
     analyzer = []
+    profile_vm = None
+    symbols = None
 
     try:
         opts, args = getopt.getopt(argv, opts_short, opts_long)
@@ -85,6 +93,12 @@ def main(argv):
             analyzer.append(analyze_vm_exit)
         elif opt == "--irq":
             analyzer.append(analyze_irq)
+        elif opt == "--profile":
+            analyzer.append(analyze_profile)
+        elif opt == "--vm":
+            profile_vm = int(arg, 0)
+        elif opt == "--symbols":
+            symbols = arg
         else:
             assert False, "unhandled option"
 
@@ -92,6 +106,9 @@ def main(argv):
     assert outputfile != '', "output file is required"
     assert analyzer != '', 'MUST contain one of analyzer: ''vm_exit'
 
+    if analyze_profile in analyzer:
+        profile_setup(profile_vm, symbols)
+
     do_analysis(inputfile, outputfile, analyzer, freq)
 
 if __name__ == "__main__":
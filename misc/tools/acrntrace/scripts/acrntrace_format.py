@@ -8,6 +8,7 @@ import string
 import signal
 import struct
 import getopt
+from trace_file import open_trace
 
 def usage():
     print >> sys.stderr, \
@@ -73,6 +74,105 @@ D4REC = "IIII"
 D8REC = "BBBBBBBBBBBBBBBB"
 D16REC = "bbbbbbbbbbbbbbbb"
 
+# structure of a compact trace file (acrntrace -z)
+# MAGIC(8s) CPU(I) RESERVED(I), then the records of the cpu:
+# TAG(B) [EVENT(varint)] TSC(Q or varint) PAYLOAD
+# TAG bits[1:0] is the payload kind, 2L: 2 varints, 4I: 4 varints,
+# 6C: 6 bytes, STR: length byte + chars; bit 2 means an absolute TSC
+# instead of a delta and bits[7:3] the index + 1 of the event in
+# HOT_EVENTS, 0 when the event ID follows the tag.
+COMPACT_MAGIC = b"ACRNTRCZ"
+COMPACT_HDR = "8sII"
+
+# keep in sync with trace_hot_events[] in hypervisor/debug/trace.c
+HOT_EVENTS = [0x10, 0x11, 0x1, 0x2, 0x3, 0x4,
+              0x10000, 0x10001, 0x10002, 0x10004, 0x10010, 0x10012,
+              0x1001C, 0x1001E, 0x1001F, 0x10020, 0x10030, 0x10031,
+              0x10033, 0x10038, 0x10039, 0x1003A]
+
+def read_varint(buf, pos):
+    v = 0
+    shift = 0
+    while True:
+        b = buf[pos]
+        pos += 1
+        v |= (b & 0x7f) << shift
+        shift += 7
+        if b < 0x80:
+            return (v, pos)
+
+def output(formats, args):
+    event = args['event']
+    try:
+        if str(event) in formats.keys():
+            print (formats[str(event)] % args)
+    except TypeError:
+        if str(event) in formats.keys():
+            print (formats[str(event)])
+            print (args)
+
+def compact_loop(formats, fd):
+    global exit
+
+    hdr = fd.read(struct.calcsize(COMPACT_HDR))
+    (magic, cpu, reserved) = struct.unpack(COMPACT_HDR, hdr)
+    buf = bytearray(fd.read())
+    pos = 0
+    tsc = None
+
+    while not exit and pos < len(buf):
+        try:
+            tag = buf[pos]
+            pos += 1
+            kind = tag & 0x3
+            hot = tag >> 3
+            if hot != 0:
+                event = HOT_EVENTS[hot - 1]
+            else:
+                (event, pos) = read_varint(buf, pos)
+
+            if tag & 0x4:
+                (abs_tsc,) = struct.unpack_from("<Q", buf, pos)
+                pos += 8
+                tsc = abs_tsc
+            else:
+                (delta, pos) = read_varint(buf, pos)
+                if tsc is not None:
+                    tsc += delta
+
+            d = [0] * 16
+            if kind == 0:
+                (d[0], pos) = read_varint(buf, pos)
+                (d[1], pos) = read_varint(buf, pos)
+            elif kind == 1:
+                for j in range(4):
+                    (d[j], pos) = read_varint(buf, pos)
+            elif kind == 2:
+                d[0:6] = buf[pos:pos + 6]
+                pos += 6
+            else:
+                n = buf[pos]
+                pos += 1
+                d[0:n] = buf[pos:pos + n]
+                pos += n
+            if pos > len(buf):
+                break
+
+            # the deltas before the first absolute TSC are of no use
+            if tsc is None:
+                continue
+
+            args = {'cpu'   : cpu,
+                    'tsc'   : tsc,
+                    'event' : event }
+            for j in range(16):
+                args[str(j + 1)] = d[j]
+
+            output(formats, args)
+
+        except (IndexError, struct.error):
+            break
+
 def main_loop(formats, fd):
     global exit
     i = 0
@@ -161,13 +261,7 @@ def main_loop(formats, fd):
                     '15'    : d15,
                     '16'    : d16      }
 
-            try:
-                if str(event) in formats.keys():
-                    print (formats[str(event)] % args)
-            except TypeError:
-                if str(event) in formats.key():
-                    print (formats[str(event)])
-                    print (args)
+            output(formats, args)
 
         except struct.error:
             sys.exit()
@@ -187,11 +281,16 @@ def main(argv):
 
     try:
         formats = read_format(arg[0])
-        fd = open(arg[1], 'rb')
+        fd = open_trace(arg[1])
     except IOError:
         sys.exit(1)
 
-    main_loop(formats, fd)
+    magic = fd.read(len(COMPACT_MAGIC))
+    fd.seek(0)
+    if magic == COMPACT_MAGIC:
+        compact_loop(formats, fd)
+    else:
+        main_loop(formats, fd)
 
 if __name__ == "__main__":
     main(sys.argv[1:])
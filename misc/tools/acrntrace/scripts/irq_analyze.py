@@ -7,6 +7,7 @@ This script defines the function to do the irq related analysis
 
 import csv
 import struct
+from trace_file import open_trace
 
 TSC_BEGIN = 0
 TSC_END = 0
@@ -30,7 +31,7 @@ def parse_trace(ifile):
         None
     """
 
-    fd = open(ifile, 'rb')
+    fd = open_trace(ifile)
 
     while True:
         global TSC_BEGIN, TSC_END
@@ -0,0 +1,189 @@
+#!/usr/bin/python3
+# -*- coding: UTF-8 -*-
+
+"""
+This script defines the function to do the guest hot spot analysis of the
+PMU samples captured with acrntrace -p
+"""
+
+import bisect
+import csv
+import os
+import struct
+import sys
+from trace_file import open_trace
+
+PMU_SAMPLE = 0x12
+
+# vm id of the samples taken in the hypervisor
+VM_ID_HV = 0xfff
+VM_ID_MASK = 0xfff
+PAGE_MASK = ~0xfff
+
+# 4 * 64bit per trace entry
+TRCREC = "QQQQ"
+COMPACT_MAGIC = b"ACRNTRCZ"
+
+TOP_N = 50
+
+# (vm id, cr3, rip) -> samples
+SAMPLES = {}
+TOTAL_SAMPLES = 0
+
+VM_FILTER = None
+SYMBOLS = []
+SYMBOL_ADDRS = []
+
+def profile_setup(vm_id, symfile):
+    """configure the analysis
+    Args:
+        vm_id: only report the samples of this VM, None for all
+        symfile: System.map or 'nm' output of the guest kernel, None if
+                 the RIPs are not resolved
+    Return:
+        None
+    """
+    global VM_FILTER
+
+    VM_FILTER = vm_id
+    if symfile:
+        load_symbols(symfile)
+
+def load_symbols(symfile):
+    """load the text symbols of a System.map like file
+    Args:
+        symfile: lines of 'address type name'
+    Return:
+        None
+    """
+    syms = []
+    with open(symfile, 'r') as fd:
+        for line in fd:
+            fields = line.split()
+            if len(fields) < 3 or fields[1] not in "tTwW":
+                continue
+            try:
+                syms.append((int(fields[0], 16), fields[2]))
+            except ValueError:
+                continue
+    syms.sort()
+    SYMBOLS.extend(syms)
+    SYMBOL_ADDRS.extend([addr for (addr, _) in syms])
+
+def symbolize(rip):
+    """resolve rip to symbol+offset, or to the hex address"""
+    idx = bisect.bisect_right(SYMBOL_ADDRS, rip) - 1
+    if idx < 0:
+        return "0x%x" % rip
+    (addr, name) = SYMBOLS[idx]
+    return "%s+0x%x" % (name, rip - addr)
+
+def trace_files(ipath):
+    """the trace files of ipath, all the cpus of a capture directory"""
+    if not os.path.isdir(ipath):
+        return [ipath]
+    return [os.path.join(ipath, f) for f in sorted(os.listdir(ipath))
+            if f.isdigit()]
+
+def parse_trace(ifile):
+    """collect the PMU samples of a trace data file
+    Args:
+        ifile: input trace data file
+    Return:
+        None
+    """
+    global TOTAL_SAMPLES
+
+    with open_trace(ifile) as fd:
+        if fd.read(len(COMPACT_MAGIC)) == COMPACT_MAGIC:
+            print("%s: compact trace records, capture without -z" % ifile)
+            sys.exit(1)
+        fd.seek(0)
+
+        while True:
+            line = fd.read(struct.calcsize(TRCREC))
+            if len(line) < struct.calcsize(TRCREC):
+                break
+            (_, event, rip, cr3_vm) = struct.unpack(TRCREC, line)
+
+            if (event & 0xffffffffffff) != PMU_SAMPLE:
+                continue
+
+            vm_id = cr3_vm & VM_ID_MASK
+            if VM_FILTER is not None and vm_id != VM_FILTER:
+                continue
+
+            key = (vm_id, cr3_vm & PAGE_MASK, rip)
+            SAMPLES[key] = SAMPLES.get(key, 0) + 1
+            TOTAL_SAMPLES += 1
+
+def context_name(vm_id, cr3):
+    """VM and address space of a sample"""
+    if vm_id == VM_ID_HV:
+        return "hypervisor"
+    return "vm%d;cr3_0x%x" % (vm_id, cr3)
+
+def generate_report(ofile):
+    """ generate analysis report
+    Args:
+        ofile: output report
+    Return:
+        None
+    """
+    folded = {}
+    symbols = {}
+
+    for ((vm_id, cr3, rip), cnt) in SAMPLES.items():
+        ctx = context_name(vm_id, cr3)
+        # the kernel symbols hold for all the address spaces of a VM
+        sym = symbolize(rip) if vm_id != VM_ID_HV else "0x%x" % rip
+        func = sym.split('+')[0]
+        folded_key = "%s;%s" % (ctx, func)
+        folded[folded_key] = folded.get(folded_key, 0) + cnt
+        name = "%s %s" % (ctx.split(';')[0], func)
+        symbols[name] = symbols.get(name, 0) + cnt
+
+    print("%-10s\t%-10s\t%s" % ("Overhead", "Samples", "Symbol"))
+    top = sorted(symbols.items(), key=lambda kv: kv[1], reverse=True)
+    for (name, cnt) in top[:TOP_N]:
+        print("%9.2f%%\t%-10d\t%s" %
+              (100.0 * cnt / TOTAL_SAMPLES, cnt, name))
+
+    try:
+        # flamegraph.pl input, one stack per line
+        with open(ofile + '.folded', 'w') as filep:
+            for (stack, cnt) in sorted(folded.items()):
+                filep.write("%s %d\n" % (stack, cnt))
+
+        with open(ofile + '.csv', 'w') as filep:
+            f_csv = csv.writer(filep)
+            f_csv.writerow(['Symbol', 'Samples', 'Overhead'])
+            for (name, cnt) in top:
+                f_csv.writerow([name, cnt,
+                                '%.2f' % (100.0 * cnt / TOTAL_SAMPLES)])
+
+    except IOError as err:
+        print("Output File Error: " + str(err))
+
+def analyze_profile(ifile, ofile, freq):
+    """do the guest hot spot analysis
+    Args:
+        ifile: input trace data file, or the directory of a capture
+        ofile: output report file
+        freq: TSC frequency of the host where we capture the trace data
+    Return:
+        None
+    """
+
+    print("Profile analysis started... \n\tinput file: %s\n"
+          "\toutput file: %s.folded, %s.csv" % (ifile, ofile, ofile))
+
+    for f in trace_files(ifile):
+        parse_trace(f)
+
+    if TOTAL_SAMPLES == 0:
+        print("No PMU sample found, capture with acrntrace -p")
+        return
+
+    # save report to the output file
+    generate_report(ofile)
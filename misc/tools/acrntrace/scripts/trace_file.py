@@ -0,0 +1,147 @@
+#!/usr/bin/python3
+# -*- coding: UTF-8 -*-
+
+"""
+This script opens the trace data files, the plain and the compressed
+(acrntrace -Z) ones alike, the latter read through mmap
+"""
+
+import bisect
+import mmap
+import struct
+import zlib
+
+# structure of a compressed trace file (acrntrace -Z)
+# MAGIC(8s) CPU(I) CHUNK_SIZE(I), then the chunks:
+# RAW_LEN(I) ZLEN(I) and ZLEN bytes deflating RAW_LEN bytes of the plain
+# file; on a clean exit the index follows, NR_CHUNKS entries of
+# OFFSET(Q) RAW_OFFSET(Q), then NR_CHUNKS(I) RESERVED(I) INDEX_MAGIC(8s)
+ZFILE_MAGIC = b"ACRNTRCC"
+ZFILE_HDR = "8sII"
+ZCHUNK_HDR = "II"
+ZINDEX_MAGIC = b"ACRNTIDX"
+ZINDEX_ENTRY = "QQ"
+ZINDEX_TAIL = "II8s"
+
+class ZTraceFile(object):
+    """the plain data of a compressed trace file, one chunk inflated at
+    a time
+    """
+
+    def __init__(self, fd):
+        self.map = mmap.mmap(fd.fileno(), 0, access=mmap.ACCESS_READ)
+        self.offsets = []
+        self.raw_offsets = []
+        if not self.load_index():
+            self.walk_chunks()
+        self.chunk = -1
+        self.data = b""
+        self.pos = 0
+
+    def load_index(self):
+        """the index at the end of the file, False if there is none"""
+        tail_len = struct.calcsize(ZINDEX_TAIL)
+        if len(self.map) < struct.calcsize(ZFILE_HDR) + tail_len:
+            return False
+        (nr_chunks, _, magic) = struct.unpack_from(
+            ZINDEX_TAIL, self.map, len(self.map) - tail_len)
+        entry_len = struct.calcsize(ZINDEX_ENTRY)
+        start = len(self.map) - tail_len - nr_chunks * entry_len
+        if magic != ZINDEX_MAGIC or start < struct.calcsize(ZFILE_HDR):
+            return False
+
+        for i in range(nr_chunks):
+            (offset, raw_offset) = struct.unpack_from(
+                ZINDEX_ENTRY, self.map, start + i * entry_len)
+            self.offsets.append(offset)
+            self.raw_offsets.append(raw_offset)
+        return True
+
+    def walk_chunks(self):
+        """the chunks one by one, of a file cut short"""
+        offset = struct.calcsize(ZFILE_HDR)
+        raw_offset = 0
+        hdr_len = struct.calcsize(ZCHUNK_HDR)
+        while offset + hdr_len <= len(self.map):
+            (raw_len, zlen) = struct.unpack_from(ZCHUNK_HDR, self.map, offset)
+            if offset + hdr_len + zlen > len(self.map):
+                break
+            self.offsets.append(offset)
+            self.raw_offsets.append(raw_offset)
+            offset += hdr_len + zlen
+            raw_offset += raw_len
+
+    def load_chunk(self, chunk):
+        """inflate a chunk, False past the last one"""
+        if chunk >= len(self.offsets):
+            return False
+        hdr_len = struct.calcsize(ZCHUNK_HDR)
+        offset = self.offsets[chunk]
+        (_, zlen) = struct.unpack_from(ZCHUNK_HDR, self.map, offset)
+        try:
+            self.data = zlib.decompress(
+                self.map[offset + hdr_len:offset + hdr_len + zlen])
+        except zlib.error:
+            # a part of the index of a file cut short
+            return False
+        self.chunk = chunk
+        self.pos = 0
+        return True
+
+    def read(self, size=-1):
+        """at most size bytes of the plain file, all the rest if size < 0"""
+        out = []
+        while size != 0:
+            if self.pos >= len(self.data):
+                if not self.load_chunk(self.chunk + 1):
+                    break
+                continue
+            end = len(self.data) if size < 0 else self.pos + size
+            piece = self.data[self.pos:end]
+            self.pos += len(piece)
+            if size > 0:
+                size -= len(piece)
+            out.append(piece)
+        return b"".join(out)
+
+    def tell(self):
+        """offset in the plain file"""
+        if self.chunk < 0:
+            return 0
+        return self.raw_offsets[self.chunk] + self.pos
+
+    def seek(self, offset, whence=0):
+        """offsets of the plain file, from its start only"""
+        assert whence == 0, "only absolute offsets are supported"
+        chunk = bisect.bisect_right(self.raw_offsets, offset) - 1
+        if chunk < 0 or not self.load_chunk(chunk):
+            self.chunk = -1
+            self.data = b""
+            self.pos = 0
+            return 0
+        self.pos = offset - self.raw_offsets[chunk]
+        return offset
+
+    def close(self):
+        self.map.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+def open_trace(ifile):
+    """a trace data file opened for reading, the plain data of it if it is
+    compressed
+    """
+    fd = open(ifile, 'rb')
+    magic = fd.read(len(ZFILE_MAGIC))
+    fd.seek(0)
+    if magic != ZFILE_MAGIC:
+        return fd
+
+    try:
+        return ZTraceFile(fd)
+    finally:
+        fd.close()
@@ -7,6 +7,7 @@ This script defines the function to do the vm_exit analysis
 
 import csv
 import struct
+from trace_file import open_trace
 
 TSC_BEGIN = 0
 TSC_END = 0
@@ -93,7 +94,7 @@ def parse_trace_data(ifile):
     tsc_exit = 0
     tsc_last_exit_period = 0
 
-    fd = open(ifile, 'rb')
+    fd = open_trace(ifile)
 
     while True:
         try:
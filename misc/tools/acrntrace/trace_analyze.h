@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef TRACE_ANALYZE_H
+#define TRACE_ANALYZE_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "acrntrace.h"
+
+/*
+ * Streaming decoder of the trace of a cpu, shared by acrnalyze (trace
+ * files) and acrntop (the trace sbufs). The trace entries, the compact
+ * records (acrntrace -z) and the compressed files (acrntrace -Z) are all
+ * decoded into trace_ev_t, one at a time from a buffer of a few chunks.
+ */
+#define TRACE_SRC_BUF_SIZE	(256 * 1024)
+#define TRACE_REC_MAX		40	/* a compact record, see debug/trace.c */
+#define TRACE_EVID_MASK		0xffffffffffffUL
+
+#define TRACE_VM_EXIT		0x10
+#define TRACE_VM_ENTER		0x11
+#define TRACE_VMEXIT_ENTRY	0x10000
+#define TRACE_VMEXIT_EXTINT	(TRACE_VMEXIT_ENTRY + 0x1)
+
+typedef struct {
+	uint32_t cpu;
+	int fd;			/* -1 for an sbuf */
+	shared_buf_t *sbuf;	/* NULL for a file */
+	int compact;
+	int zipped;
+	int eof;
+	uint8_t *buf;
+	uint32_t size;
+	uint32_t len;
+	uint32_t pos;
+	uint8_t *zbuf;		/* a deflated chunk of a compressed file */
+	uint32_t zbuf_size;
+	uint32_t chunks_left;	/* UINT32_MAX without an index */
+	uint64_t tsc;		/* of the last compact record, 0 before a sync */
+	trace_ev_t ev;		/* the event decoded last */
+} trace_src_t;
+
+int trace_src_open(trace_src_t *src, const char *path, uint32_t cpu);
+int trace_src_attach(trace_src_t *src, shared_buf_t *sbuf, uint32_t cpu);
+void trace_src_close(trace_src_t *src);
+
+/*
+ * Decode the next event into src->ev.
+ *
+ * return 1 for an event, 0 at the end of a file or once an sbuf is
+ * drained (the next call may find more), -1 on error.
+ */
+int trace_src_next(trace_src_t *src);
+
+/*
+ * The statistics of the VM exits, the time from the VM exit to the next
+ * VM entry of the cpu is the time spent to handle the exit. The VM comes
+ * from the VM entry (vm id, vcpu id): the exits of a cpu are the ones of
+ * the VM it entered last.
+ */
+#define TRACE_STATS_CPUS	64
+#define TRACE_STATS_VMS		16
+#define TRACE_EXIT_REASONS	65	/* basic exit reasons of the SDM */
+#define TRACE_LAT_BUCKETS	32	/* log2 of the cycles */
+#define TRACE_IRQ_VECTORS	256
+
+typedef struct {
+	uint64_t count;
+	uint64_t cycles;
+	uint64_t max;
+	uint64_t hist[TRACE_LAT_BUCKETS];
+} exit_stats_t;
+
+typedef struct {
+	int entered;		/* seen a VM entry */
+	uint32_t vm_id;
+	uint32_t reason;
+	uint64_t exit_tsc;	/* 0 unless in an exit */
+} cpu_state_t;
+
+typedef struct {
+	uint64_t tsc_begin;
+	uint64_t tsc_end;
+	uint64_t nr_events;
+	uint64_t nr_exits;
+	exit_stats_t exits[TRACE_EXIT_REASONS];
+	exit_stats_t vm_total[TRACE_STATS_VMS];
+	uint64_t vm_reasons[TRACE_STATS_VMS][TRACE_EXIT_REASONS];
+	uint64_t irqs[TRACE_IRQ_VECTORS];
+	cpu_state_t cpus[TRACE_STATS_CPUS];
+} trace_stats_t;
+
+const char *exit_reason_name(uint32_t reason);
+
+void trace_stats_add(trace_stats_t *stats, uint32_t cpu, const trace_ev_t *ev);
+
+/* start a new period, the cpus stay in their VM and their exit */
+void trace_stats_reset(trace_stats_t *stats);
+
+/* cycles at or below which a fraction (per mille) of the exits ended */
+uint64_t exit_stats_percentile(const exit_stats_t *es, uint32_t per_mille);
+
+/* the reports of acrnalyze, csv may be NULL */
+void report_vm_exits(const trace_stats_t *stats, double freq, FILE *csv);
+void report_irqs(const trace_stats_t *stats, double freq, FILE *csv);
+void report_latency(const trace_stats_t *stats, double freq, FILE *csv);
+void report_vms(const trace_stats_t *stats, double freq, FILE *csv);
+
+#endif /* TRACE_ANALYZE_H */
@@ -0,0 +1,341 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "trace_analyze.h"
+
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+
+/* decode_*() results, besides 1 for an event */
+#define DECODE_SKIPPED		0
+#define DECODE_SHORT		-1
+#define DECODE_BAD		-2
+
+/* keep in sync with trace_hot_events[] in hypervisor/debug/trace.c */
+static const uint32_t hot_events[] = {
+	0x10, 0x11, 0x1, 0x2, 0x3, 0x4,
+	0x10000, 0x10001, 0x10002, 0x10004, 0x10010, 0x10012,
+	0x1001C, 0x1001E, 0x1001F, 0x10020, 0x10030, 0x10031,
+	0x10033, 0x10038, 0x10039, 0x1003A,
+};
+
+static int read_all(int fd, void *buf, uint32_t len)
+{
+	uint32_t done = 0;
+	ssize_t ret;
+
+	while (done < len) {
+		ret = read(fd, (uint8_t *)buf + done, len - done);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -1;
+		if (ret == 0)
+			break;
+		done += ret;
+	}
+
+	return done;
+}
+
+static int src_alloc(trace_src_t *src, uint32_t size)
+{
+	src->buf = malloc(size);
+	if (!src->buf)
+		return -1;
+	src->size = size;
+	src->len = 0;
+	src->pos = 0;
+
+	return 0;
+}
+
+/* the chunks of a file with an index are counted, the index is no chunk */
+static int zsrc_open(trace_src_t *src)
+{
+	trace_zfile_hdr_t hdr;
+	trace_ztail_t tail;
+	struct stat st;
+
+	if (read_all(src->fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+		hdr.chunk_size == 0 || hdr.chunk_size > (64 << 20))
+		return -1;
+
+	src->chunks_left = UINT32_MAX;
+	if (fstat(src->fd, &st) == 0 &&
+		st.st_size >= (off_t)(sizeof(hdr) + sizeof(tail)) &&
+		pread(src->fd, &tail, sizeof(tail), st.st_size - sizeof(tail)) ==
+			sizeof(tail) &&
+		memcmp(tail.magic, TRACE_ZINDEX_MAGIC, sizeof(tail.magic)) == 0)
+		src->chunks_left = tail.nr_chunks;
+
+	src->zbuf_size = compressBound(hdr.chunk_size);
+	src->zbuf = malloc(src->zbuf_size);
+	if (!src->zbuf)
+		return -1;
+	src->zipped = 1;
+
+	return src_alloc(src, hdr.chunk_size + TRACE_REC_MAX);
+}
+
+/* inflate the next chunk behind the data left, 0 past the last one */
+static int zsrc_read_chunk(trace_src_t *src)
+{
+	trace_zchunk_hdr_t chdr;
+	uLongf raw_len;
+
+	if (src->chunks_left == 0)
+		return 0;
+	if (read_all(src->fd, &chdr, sizeof(chdr)) != sizeof(chdr) ||
+		chdr.raw_len > src->size - src->len ||
+		chdr.zlen > src->zbuf_size ||
+		read_all(src->fd, src->zbuf, chdr.zlen) != chdr.zlen)
+		return 0;
+
+	/* a part of the index of a file cut short does not inflate */
+	raw_len = src->size - src->len;
+	if (uncompress(src->buf + src->len, &raw_len, src->zbuf,
+			chdr.zlen) != Z_OK)
+		return 0;
+
+	if (src->chunks_left != UINT32_MAX)
+		src->chunks_left--;
+
+	return raw_len;
+}
+
+/* keep the part of a record left and append the data coming next */
+static int src_fill(trace_src_t *src)
+{
+	uint32_t left = src->len - src->pos;
+	int n;
+
+	memmove(src->buf, src->buf + src->pos, left);
+	src->len = left;
+	src->pos = 0;
+
+	if (src->sbuf)
+		n = sbuf_copy(src->sbuf, src->buf + src->len,
+				src->size - src->len);
+	else if (src->zipped)
+		n = zsrc_read_chunk(src);
+	else
+		n = read_all(src->fd, src->buf + src->len,
+				src->size - src->len);
+	if (n < 0)
+		return -1;
+	if (n == 0 && !src->sbuf)
+		src->eof = 1;
+	src->len += n;
+
+	return n;
+}
+
+int trace_src_open(trace_src_t *src, const char *path, uint32_t cpu)
+{
+	trace_file_hdr_t hdr;
+	char magic[8];
+
+	memset(src, 0, sizeof(*src));
+	src->cpu = cpu;
+	src->fd = open(path, O_RDONLY);
+	if (src->fd < 0)
+		return -1;
+
+	if (pread(src->fd, magic, sizeof(magic), 0) == sizeof(magic) &&
+		memcmp(magic, TRACE_ZFILE_MAGIC, sizeof(magic)) == 0) {
+		if (zsrc_open(src))
+			goto fail;
+	} else if (src_alloc(src, TRACE_SRC_BUF_SIZE)) {
+		goto fail;
+	}
+
+	/* in the compressed data as well, a compact trace starts with its header */
+	if (src_fill(src) < 0)
+		goto fail;
+	if (src->len >= sizeof(hdr) &&
+		memcmp(src->buf, TRACE_COMPACT_MAGIC, sizeof(hdr.magic)) == 0) {
+		memcpy(&hdr, src->buf, sizeof(hdr));
+		src->cpu = hdr.cpu;
+		src->compact = 1;
+		src->pos = sizeof(hdr);
+	}
+
+	return 0;
+
+fail:
+	trace_src_close(src);
+	return -1;
+}
+
+int trace_src_attach(trace_src_t *src, shared_buf_t *sbuf, uint32_t cpu)
+{
+	memset(src, 0, sizeof(*src));
+	src->cpu = cpu;
+	src->fd = -1;
+	src->sbuf = sbuf;
+	/* an acrntrace -z running meanwhile switches the sbuf for good */
+	src->compact = (sbuf->flags & SBUF_COMPACT_EN) != 0;
+
+	return src_alloc(src, TRACE_SRC_BUF_SIZE);
+}
+
+void trace_src_close(trace_src_t *src)
+{
+	if (src->fd >= 0)
+		close(src->fd);
+	src->fd = -1;
+	free(src->buf);
+	free(src->zbuf);
+	src->buf = NULL;
+	src->zbuf = NULL;
+}
+
+static int decode_entry(trace_src_t *src)
+{
+	if (src->len - src->pos < TRACE_ELEMENT_SIZE)
+		return DECODE_SHORT;
+
+	memcpy(&src->ev, src->buf + src->pos, sizeof(src->ev));
+	src->pos += TRACE_ELEMENT_SIZE;
+	src->cpu = src->ev.id >> 56;
+	src->ev.id &= TRACE_EVID_MASK;
+
+	return 1;
+}
+
+static int get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v)
+{
+	uint32_t shift = 0;
+	uint8_t b;
+
+	*v = 0;
+	do {
+		if (*p >= end)
+			return DECODE_SHORT;
+		if (shift > 63)
+			return DECODE_BAD;
+		b = *(*p)++;
+		*v |= (uint64_t)(b & 0x7f) << shift;
+		shift += 7;
+	} while (b >= 0x80);
+
+	return 0;
+}
+
+#define GET_VARINT(v)	do {					\
+		ret = get_varint(&p, end, &(v));		\
+		if (ret < 0)					\
+			return ret;				\
+	} while (0)
+
+/* the format is described in hypervisor/debug/trace.c */
+static int decode_compact(trace_src_t *src)
+{
+	const uint8_t *p = src->buf + src->pos;
+	const uint8_t *end = src->buf + src->len;
+	uint64_t evid, tsc, v[4];
+	uint32_t tag, hot, i, n;
+	int ret;
+
+	if (p >= end)
+		return DECODE_SHORT;
+	tag = *p++;
+	hot = tag >> 3;
+	if (hot > ARRAY_SIZE(hot_events))
+		return DECODE_BAD;
+
+	if (hot != 0)
+		evid = hot_events[hot - 1];
+	else
+		GET_VARINT(evid);
+
+	if (tag & 0x4) {
+		if (end - p < 8)
+			return DECODE_SHORT;
+		memcpy(&tsc, p, sizeof(tsc));
+		p += 8;
+	} else {
+		GET_VARINT(tsc);
+		/* the deltas before the first absolute TSC are of no use */
+		tsc = (src->tsc != 0) ? src->tsc + tsc : 0;
+	}
+
+	memset(&src->ev, 0, sizeof(src->ev));
+	switch (tag & 0x3) {
+	case 0:
+		GET_VARINT(v[0]);
+		GET_VARINT(v[1]);
+		src->ev.e = v[0];
+		src->ev.f = v[1];
+		break;
+	case 1:
+		for (i = 0; i < 4; i++)
+			GET_VARINT(v[i]);
+		src->ev.a = v[0];
+		src->ev.b = v[1];
+		src->ev.c = v[2];
+		src->ev.d = v[3];
+		break;
+	case 2:
+		if (end - p < 6)
+			return DECODE_SHORT;
+		memcpy(src->ev.str, p, 6);
+		p += 6;
+		break;
+	default:
+		if (p >= end)
+			return DECODE_SHORT;
+		n = *p++;
+		if (n > 15)
+			return DECODE_BAD;
+		if (end - p < n)
+			return DECODE_SHORT;
+		memcpy(src->ev.str, p, n);
+		p += n;
+		break;
+	}
+
+	/* a whole record, consumed */
+	src->pos = p - src->buf;
+	src->tsc = tsc;
+	if (tsc == 0)
+		return DECODE_SKIPPED;
+	src->ev.tsc = tsc;
+	src->ev.id = evid;
+
+	return 1;
+}
+
+int trace_src_next(trace_src_t *src)
+{
+	int ret, n;
+
+	while (1) {
+		ret = src->compact ? decode_compact(src) : decode_entry(src);
+		if (ret > 0)
+			return 1;
+		if (ret == DECODE_SKIPPED)
+			continue;
+		if (ret == DECODE_BAD)
+			return -1;
+
+		/* a record cut short, at the end of the data read so far */
+		if (src->eof)
+			return 0;
+		n = src_fill(src);
+		if (n <= 0)
+			return n;
+	}
+}
@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include <string.h>
+
+#include "trace_analyze.h"
+
+/* the names of the reports of vmexit_analyze.py, and a few more */
+static const char *const exit_reason_names[TRACE_EXIT_REASONS] = {
+	[0x00] = "VMEXIT_EXCEPTION_OR_NMI",
+	[0x01] = "VMEXIT_EXTERNAL_INTERRUPT",
+	[0x02] = "VMEXIT_TRIPLE_FAULT",
+	[0x03] = "VMEXIT_INIT_SIGNAL",
+	[0x04] = "VMEXIT_STARTUP_IPI",
+	[0x07] = "VMEXIT_INTERRUPT_WINDOW",
+	[0x08] = "VMEXIT_NMI_WINDOW",
+	[0x09] = "VMEXIT_TASK_SWITCH",
+	[0x0A] = "VMEXIT_CPUID",
+	[0x0C] = "VMEXIT_HLT",
+	[0x0E] = "VMEXIT_INVLPG",
+	[0x10] = "VMEXIT_RDTSC",
+	[0x12] = "VMEXIT_VMCALL",
+	[0x1C] = "VMEXIT_CR_ACCESS",
+	[0x1D] = "VMEXIT_DR_ACCESS",
+	[0x1E] = "VMEXIT_IO_INSTRUCTION",
+	[0x1F] = "VMEXIT_RDMSR",
+	[0x20] = "VMEXIT_WRMSR",
+	[0x21] = "VMEXIT_ENTRY_FAILURE",
+	[0x24] = "VMEXIT_MWAIT",
+	[0x27] = "VMEXIT_MONITOR",
+	[0x28] = "VMEXIT_PAUSE",
+	[0x2B] = "VMEXIT_TPR_BELOW_THRESHOLD",
+	[0x2C] = "VMEXIT_APICV_ACCESS",
+	[0x2D] = "VMEXIT_APICV_VIRT_EOI",
+	[0x30] = "VMEXIT_EPT_VIOLATION",
+	[0x31] = "VMEXIT_EPT_MISCONFIGURATION",
+	[0x33] = "VMEXIT_RDTSCP",
+	[0x34] = "VMEXIT_PREEMPTION_TIMER",
+	[0x36] = "VMEXIT_WBINVD",
+	[0x37] = "VMEXIT_XSETBV",
+	[0x38] = "VMEXIT_APICV_WRITE",
+};
+
+const char *exit_reason_name(uint32_t reason)
+{
+	static char unknown[32];
+	const char *name = NULL;
+
+	if (reason < TRACE_EXIT_REASONS)
+		name = exit_reason_names[reason];
+	if (!name) {
+		snprintf(unknown, sizeof(unknown), "VMEXIT_0x%02x", reason);
+		name = unknown;
+	}
+
+	return name;
+}
+
+static void exit_stats_add(exit_stats_t *es, uint64_t cycles)
+{
+	uint32_t bucket = 0;
+
+	if (cycles != 0)
+		bucket = 63 - __builtin_clzl(cycles);
+	if (bucket >= TRACE_LAT_BUCKETS)
+		bucket = TRACE_LAT_BUCKETS - 1;
+
+	es->count++;
+	es->cycles += cycles;
+	if (cycles > es->max)
+		es->max = cycles;
+	es->hist[bucket]++;
+}
+
+uint64_t exit_stats_percentile(const exit_stats_t *es, uint32_t per_mille)
+{
+	uint64_t want = (es->count * per_mille + 999) / 1000, seen = 0;
+	uint64_t bound = es->max;
+	uint32_t i;
+
+	for (i = 0; i < TRACE_LAT_BUCKETS; i++) {
+		seen += es->hist[i];
+		if (seen >= want && seen != 0) {
+			bound = (2UL << i) - 1;
+			break;
+		}
+	}
+
+	return (bound < es->max) ? bound : es->max;
+}
+
+void trace_stats_add(trace_stats_t *stats, uint32_t cpu, const trace_ev_t *ev)
+{
+	cpu_state_t *cs;
+	uint64_t cycles;
+
+	if (cpu >= TRACE_STATS_CPUS)
+		return;
+	cs = &stats->cpus[cpu];
+
+	if (stats->tsc_begin == 0 || ev->tsc < stats->tsc_begin)
+		stats->tsc_begin = ev->tsc;
+	if (ev->tsc > stats->tsc_end)
+		stats->tsc_end = ev->tsc;
+	stats->nr_events++;
+
+	switch (ev->id) {
+	case TRACE_VM_EXIT:
+		stats->nr_exits++;
+		cs->reason = ev->e;
+		cs->exit_tsc = (ev->e < TRACE_EXIT_REASONS) ? ev->tsc : 0;
+		break;
+	case TRACE_VM_ENTER:
+		/* the exit handled, of the VM entered before it */
+		if (cs->exit_tsc != 0 && ev->tsc >= cs->exit_tsc) {
+			cycles = ev->tsc - cs->exit_tsc;
+			exit_stats_add(&stats->exits[cs->reason], cycles);
+			if (cs->entered && cs->vm_id < TRACE_STATS_VMS) {
+				exit_stats_add(&stats->vm_total[cs->vm_id], cycles);
+				stats->vm_reasons[cs->vm_id][cs->reason]++;
+			}
+		}
+		cs->exit_tsc = 0;
+		cs->entered = 1;
+		cs->vm_id = ev->e;
+		break;
+	case TRACE_VMEXIT_EXTINT:
+		if (ev->e < TRACE_IRQ_VECTORS)
+			stats->irqs[ev->e]++;
+		break;
+	default:
+		break;
+	}
+}
+
+void trace_stats_reset(trace_stats_t *stats)
+{
+	cpu_state_t cpus[TRACE_STATS_CPUS];
+
+	memcpy(cpus, stats->cpus, sizeof(cpus));
+	memset(stats, 0, sizeof(*stats));
+	memcpy(stats->cpus, cpus, sizeof(cpus));
+}
+
+static uint64_t run_cycles(const trace_stats_t *stats)
+{
+	return stats->tsc_end - stats->tsc_begin;
+}
+
+/* the exits of a cpu are handled one at a time, there is a run time per cpu */
+static uint32_t nr_cpus(const trace_stats_t *stats)
+{
+	uint32_t i, n = 0;
+
+	for (i = 0; i < TRACE_STATS_CPUS; i++)
+		n += stats->cpus[i].entered;
+
+	return (n != 0) ? n : 1;
+}
+
+static double run_sec(const trace_stats_t *stats, double freq)
+{
+	return (double)run_cycles(stats) / (freq * 1000 * 1000);
+}
+
+void report_vm_exits(const trace_stats_t *stats, double freq, FILE *csv)
+{
+	uint64_t rt_cycle = run_cycles(stats), total_count = 0, total_cycles = 0;
+	double rt_sec = run_sec(stats, freq);
+	double cpu_cycles = (double)rt_cycle * nr_cpus(stats);
+	const exit_stats_t *es;
+	uint32_t i;
+
+	if (rt_cycle == 0) {
+		printf("No VM exit to report\n");
+		return;
+	}
+
+	printf("Total run time: %lu cycles\n", rt_cycle);
+	printf("TSC Freq: %.1f MHz\n", freq);
+	printf("Total run time: %.3f sec, %u cpus\n", rt_sec, nr_cpus(stats));
+	printf("%-28s\t%-12s\t%-12s\t%-24s\t%-16s\n", "Event", "NR_Exit",
+		"NR_Exit/Sec", "Time Consumed(cycles)", "Time percentage");
+	if (csv) {
+		fprintf(csv, "Run time(cycles),Run time(Sec),Freq(MHz)\n");
+		fprintf(csv, "%lu,%.3f,%.1f\n", rt_cycle, rt_sec, freq);
+		fprintf(csv, "Exit_Reason,NR_Exit,NR_Exit/Sec,"
+			"Time Consumed(cycles),Time Percentage\n");
+	}
+
+	for (i = 0; i < TRACE_EXIT_REASONS; i++) {
+		es = &stats->exits[i];
+		if (es->count == 0)
+			continue;
+		total_count += es->count;
+		total_cycles += es->cycles;
+		printf("%-28s\t%-12lu\t%-12.2f\t%-24lu\t%-16.2f\n",
+			exit_reason_name(i), es->count, es->count / rt_sec,
+			es->cycles, es->cycles * 100 / cpu_cycles);
+		if (csv)
+			fprintf(csv, "%s,%lu,%.2f,%lu,%.2f\n", exit_reason_name(i),
+				es->count, es->count / rt_sec, es->cycles,
+				es->cycles * 100 / cpu_cycles);
+	}
+
+	printf("%-28s\t%-12lu\t%-12.2f\t%-24lu\t%-16.2f\n", "Total",
+		total_count, total_count / rt_sec, total_cycles,
+		total_cycles * 100 / cpu_cycles);
+	if (csv)
+		fprintf(csv, "Total,%lu,%.2f,%lu,%.2f\n", total_count,
+			total_count / rt_sec, total_cycles,
+			total_cycles * 100 / cpu_cycles);
+}
+
+void report_irqs(const trace_stats_t *stats, double freq, FILE *csv)
+{
+	double rt_sec = run_sec(stats, freq);
+	uint32_t v;
+
+	if (run_cycles(stats) == 0)
+		return;
+
+	printf("%-8s\t%-8s\t%-8s\n", "Vector", "Count", "NR_Exit/Sec");
+	if (csv)
+		fprintf(csv, "Vector,NR_Exit,NR_Exit/Sec\n");
+	for (v = 0; v < TRACE_IRQ_VECTORS; v++) {
+		if (stats->irqs[v] == 0)
+			continue;
+		printf("0x%08x\t%-8lu\t%-8.2f\n", v, stats->irqs[v],
+			stats->irqs[v] / rt_sec);
+		if (csv)
+			fprintf(csv, "0x%08x,%lu,%.2f\n", v, stats->irqs[v],
+				stats->irqs[v] / rt_sec);
+	}
+}
+
+/* the percentiles are the upper bounds of the power of 2 buckets */
+void report_latency(const trace_stats_t *stats, double freq, FILE *csv)
+{
+	const exit_stats_t *es;
+	uint32_t i;
+
+	printf("%-28s\t%-12s\t%-12s\t%-12s\t%-12s\t%-12s\t%-10s\n", "Event",
+		"NR_Exit", "Avg(cycles)", "P50(cycles)", "P99(cycles)",
+		"Max(cycles)", "Max(us)");
+	if (csv)
+		fprintf(csv, "Exit_Reason,NR_Exit,Avg(cycles),P50(cycles),"
+			"P99(cycles),Max(cycles),Max(us)\n");
+
+	for (i = 0; i < TRACE_EXIT_REASONS; i++) {
+		es = &stats->exits[i];
+		if (es->count == 0)
+			continue;
+		printf("%-28s\t%-12lu\t%-12lu\t%-12lu\t%-12lu\t%-12lu\t%-10.2f\n",
+			exit_reason_name(i), es->count, es->cycles / es->count,
+			exit_stats_percentile(es, 500),
+			exit_stats_percentile(es, 990), es->max, es->max / freq);
+		if (csv)
+			fprintf(csv, "%s,%lu,%lu,%lu,%lu,%lu,%.2f\n",
+				exit_reason_name(i), es->count,
+				es->cycles / es->count,
+				exit_stats_percentile(es, 500),
+				exit_stats_percentile(es, 990), es->max,
+				es->max / freq);
+	}
+}
+
+void report_vms(const trace_stats_t *stats, double freq, FILE *csv)
+{
+	double rt_sec = run_sec(stats, freq);
+	const exit_stats_t *es;
+	uint32_t vm, i, top;
+
+	if (run_cycles(stats) == 0)
+		return;
+
+	printf("%-4s\t%-12s\t%-12s\t%-24s\t%-12s\t%-28s\n", "VM", "NR_Exit",
+		"NR_Exit/Sec", "Time Consumed(cycles)", "Avg(cycles)",
+		"Top exit");
+	if (csv)
+		fprintf(csv, "VM,NR_Exit,NR_Exit/Sec,Time Consumed(cycles),"
+			"Avg(cycles),Top exit\n");
+
+	for (vm = 0; vm < TRACE_STATS_VMS; vm++) {
+		es = &stats->vm_total[vm];
+		if (es->count == 0)
+			continue;
+		top = 0;
+		for (i = 1; i < TRACE_EXIT_REASONS; i++)
+			if (stats->vm_reasons[vm][i] > stats->vm_reasons[vm][top])
+				top = i;
+		printf("%-4u\t%-12lu\t%-12.2f\t%-24lu\t%-12lu\t%-28s\n", vm,
+			es->count, es->count / rt_sec, es->cycles,
+			es->cycles / es->count, exit_reason_name(top));
+		if (csv)
+			fprintf(csv, "%u,%lu,%.2f,%lu,%lu,%s\n", vm, es->count,
+				es->count / rt_sec, es->cycles,
+				es->cycles / es->count, exit_reason_name(top));
+	}
+}